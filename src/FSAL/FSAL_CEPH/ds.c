@@ -33,10 +33,10 @@
  * Also, creating a data server handle -- now called via the DS itself.
  */
 
-#ifdef CEPH_PNFS
-
 #include "config.h"
 
+#ifdef USE_FSAL_CEPH_PNFS
+
 #include <cephfs/libcephfs.h>
 #include <fcntl.h>
 #include "fsal_api.h"
@@ -45,11 +45,7 @@
 #include "fsal_up.h"
 #include "internal.h"
 #include "pnfs_utils.h"
-
-#define min(a, b) ({				\
-	typeof(a) _a = (a);			\
-	typeof(b) _b = (b);			\
-	_a < _b ? _a : _b; })
+#include "nfs_core.h"
 
 /**
  * @brief Local invalidate
@@ -61,11 +57,11 @@
 static inline void local_invalidate(struct ds *ds, struct fsal_export *export)
 {
 	struct gsh_buffdesc key = {
-		.addr = &ds->wire.wire.vi,
-		.len = sizeof(ds->wire.wire.vi)
+		.addr = &ds->wire.vi,
+		.len = sizeof(ds->wire.vi)
 	};
-	up_async_invalidate(general_fridge, export->up_ops, export->fsal, &key,
-			    CACHE_INODE_INVALIDATE_ATTRS, NULL, NULL);
+	up_async_invalidate(general_fridge, export->up_ops, &key,
+			    FSAL_UP_INVALIDATE_ATTRS, NULL, NULL);
 }
 
 /**
@@ -77,6 +73,12 @@ static void ds_release(struct fsal_ds_handle *const ds_pub)
 {
 	/* The private 'full' DS handle */
 	struct ds *ds = container_of(ds_pub, struct ds, ds);
+	/* The private 'full' export */
+	struct export *export = container_of(ds_pub->pds->mds_fsal_export,
+					     struct export, export);
+
+	if (ds->i != NULL)
+		ceph_ll_put(export->cmount, ds->i);
 
 	fsal_ds_handle_fini(&ds->ds);
 	gsh_free(ds);
@@ -90,6 +92,10 @@ static void ds_release(struct fsal_ds_handle *const ds_pub)
  * structure) and do not get loaded into cache_inode or processed the
  * normal way.
  *
+ * The layout is sparse, so offsets are file offsets and the read goes
+ * through our own Ceph client, which talks to the OSDs holding the
+ * objects directly.
+ *
  * @param[in]  ds_pub           FSAL DS handle
  * @param[in]  req_ctx          Credentials
  * @param[in]  stateid          The stateid supplied with the READ operation,
@@ -110,55 +116,36 @@ static nfsstat4 ds_read(struct fsal_ds_handle *const ds_pub,
 			bool * const end_of_file)
 {
 	/* The private 'full' export */
-	struct export *export =
-	    container_of(req_ctx->fsal_export, struct export, export);
+	struct export *export = container_of(ds_pub->pds->mds_fsal_export,
+					     struct export, export);
 	/* The private 'full' DS handle */
 	struct ds *ds = container_of(ds_pub, struct ds, ds);
-	/* The OSD number for this machine */
-	int local_OSD = 0;
-	/* Width of a stripe in the file */
-	uint32_t stripe_width = 0;
-	/* Beginning of a block */
-	uint64_t block_start = 0;
-	/* Number of the stripe being read */
-	uint32_t stripe = 0;
-	/* Internal offset within the stripe */
-	uint32_t internal_offset = 0;
+	/* The open file */
+	Fh *fd = NULL;
 	/* The amount actually read */
 	int amount_read = 0;
+	/* Return code from ceph calls */
+	int ceph_status = 0;
 
-	/* Find out what my OSD ID is, so we can avoid talking to
-	   other OSDs. */
-
-	local_OSD = ceph_get_local_osd(export->cmount);
-	if (local_OSD < 0)
-		return posix2nfs4_error(-local_OSD);
-
-	/* Find out what stripe we're writing to and where within the
-	   stripe. */
+	ceph_status = fsal_ceph_ll_open(export->cmount, ds->i, O_RDONLY, &fd,
+					op_ctx->creds);
+	if (ceph_status < 0) {
+		LogDebug(COMPONENT_PNFS, "Open failed with: %d", ceph_status);
+		return posix2nfs4_error(-ceph_status);
+	}
 
-	stripe_width = ds->wire.layout.fl_stripe_unit;
-	stripe = offset / stripe_width;
-	block_start = stripe * stripe_width;
-	internal_offset = offset - block_start;
+	amount_read = ceph_ll_read(export->cmount, fd, offset,
+				   requested_length, buffer);
 
-	if (local_OSD !=
-	    ceph_ll_get_stripe_osd(export->cmount, ds->wire.wire.vi, stripe,
-				   &(ds->wire.layout))) {
-		return NFS4ERR_PNFS_IO_HOLE;
-	}
+	(void) ceph_ll_close(export->cmount, fd);
 
-	amount_read =
-	    ceph_ll_read_block(export->cmount, ds->wire.wire.vi, stripe, buffer,
-			       internal_offset,
-			       min((stripe_width - internal_offset),
-				   requested_length), &(ds->wire.layout));
-	if (amount_read < 0)
+	if (amount_read < 0) {
+		LogMajor(COMPONENT_PNFS, "Read failed with: %d", amount_read);
 		return posix2nfs4_error(-amount_read);
+	}
 
 	*supplied_length = amount_read;
-
-	*end_of_file = false;
+	*end_of_file = amount_read < requested_length;
 
 	return NFS4_OK;
 }
@@ -167,9 +154,8 @@ static nfsstat4 ds_read(struct fsal_ds_handle *const ds_pub,
  *
  * @brief Write to a data-server handle.
  *
- * This performs a DS write not going through the data server unless
- * FILE_SYNC4 is specified, in which case it connects the filehandle
- * and performs an MDS write.
+ * Unstable writes are left in the Ceph client's cache for a later
+ * COMMIT to the DS; anything else is flushed before we reply.
  *
  * @param[in]  ds_pub           FSAL DS handle
  * @param[in]  req_ctx          Credentials
@@ -196,129 +182,54 @@ static nfsstat4 ds_write(struct fsal_ds_handle *const ds_pub,
 			 stable_how4 * const stability_got)
 {
 	/* The private 'full' export */
-	struct export *export =
-	    container_of(req_ctx->fsal_export, struct export, export);
+	struct export *export = container_of(ds_pub->pds->mds_fsal_export,
+					     struct export, export);
 	/* The private 'full' DS handle */
 	struct ds *ds = container_of(ds_pub, struct ds, ds);
-	/* The OSD number for this host */
-	int local_OSD = 0;
-	/* Width of a stripe in the file */
-	uint32_t stripe_width = 0;
-	/* Beginning of a block */
-	uint64_t block_start = 0;
-	/* Number of the stripe being written */
-	uint32_t stripe = 0;
-	/* Internal offset within the stripe */
-	uint32_t internal_offset = 0;
+	/* The open file */
+	Fh *fd = NULL;
 	/* The amount actually written */
-	int32_t amount_written = 0;
-	/* The adjusted write length, confined to one object */
-	uint32_t adjusted_write = 0;
+	int amount_written = 0;
 	/* Return code from ceph calls */
 	int ceph_status = 0;
 
-	memset(*writeverf, 0, NFS4_VERIFIER_SIZE);
-
-	/* Find out what my OSD ID is, so we can avoid talking to
-	   other OSDs. */
+	memcpy(*writeverf, NFS4_write_verifier, NFS4_VERIFIER_SIZE);
 
-	local_OSD = ceph_get_local_osd(export->cmount);
-
-	/* Find out what stripe we're writing to and where within the
-	   stripe. */
-
-	stripe_width = ds->wire.layout.fl_stripe_unit;
-	stripe = offset / stripe_width;
-	block_start = stripe * stripe_width;
-	internal_offset = offset - block_start;
-
-	if (local_OSD !=
-	    ceph_ll_get_stripe_osd(export->cmount, ds->wire.wire.vi, stripe,
-				   &(ds->wire.layout))) {
-		return NFS4ERR_PNFS_IO_HOLE;
+	ceph_status = fsal_ceph_ll_open(export->cmount, ds->i, O_WRONLY, &fd,
+					op_ctx->creds);
+	if (ceph_status < 0) {
+		LogDebug(COMPONENT_PNFS, "Open failed with: %d", ceph_status);
+		return posix2nfs4_error(-ceph_status);
 	}
 
-	adjusted_write = min((stripe_width - internal_offset), write_length);
-
-	/* If the client specifies FILE_SYNC4, then we have to connect
-	   the filehandle and use the MDS to update size and access
-	   time. */
-	if (stability_wanted == FILE_SYNC4) {
-		Fh *descriptor = NULL;
-
-		if (!ds->connected) {
-			ceph_status = ceph_ll_connectable_m(
-				export->cmount,
-				&ds->wire.wire.vi,
-				ds->wire.wire.parent_ino,
-				ds->wire.wire.
-				parent_hash);
-			if (ceph_status != 0) {
-				LogMajor(COMPONENT_PNFS,
-					 "Filehandle connection failed with: %d\n",
-					 ceph_status);
-				return posix2nfs4_error(-ceph_status);
-			}
-			ds->connected = true;
-		}
-		ceph_status = fsal_ceph_ll_open(
-			export->cmount, ds->wire.wire.vi,
-			O_WRONLY, &descriptor, op_ctx->creds);
-		if (ceph_status != 0) {
-			LogMajor(COMPONENT_FSAL,
-				 "Open failed with: %d", ceph_status);
-			return posix2nfs4_error(-ceph_status);
-		}
-
-		amount_written =
-		    ceph_ll_write(export->cmount, descriptor, offset,
-				  adjusted_write, buffer);
-
-		if (amount_written < 0) {
-			LogMajor(COMPONENT_FSAL,
-				 "Write failed with: %d", amount_written);
-			ceph_ll_close(export->cmount, descriptor);
-			return posix2nfs4_error(-amount_written);
-		}
-
-		ceph_status = ceph_ll_fsync(export->cmount, descriptor, 0);
-		if (ceph_status < 0) {
-			LogMajor(COMPONENT_FSAL
-				"fsync failed with: %d", ceph_status);
-			ceph_ll_close(export->cmount, descriptor);
-			return posix2nfs4_error(-ceph_status);
-		}
+	amount_written = ceph_ll_write(export->cmount, fd, offset,
+				       write_length, buffer);
+	if (amount_written < 0) {
+		LogMajor(COMPONENT_PNFS, "Write failed with: %d",
+			 amount_written);
+		(void) ceph_ll_close(export->cmount, fd);
+		return posix2nfs4_error(-amount_written);
+	}
 
-		ceph_status = ceph_ll_close(export->cmount, descriptor);
+	if (stability_wanted != UNSTABLE4) {
+		ceph_status = ceph_ll_fsync(export->cmount, fd,
+					    stability_wanted == DATA_SYNC4);
 		if (ceph_status < 0) {
-			LogMajor(COMPONENT_FSAL,
-				 "close failed with: %d",
+			LogMajor(COMPONENT_PNFS, "fsync failed with: %d",
 				 ceph_status);
+			(void) ceph_ll_close(export->cmount, fd);
 			return posix2nfs4_error(-ceph_status);
 		}
-
-		/* invalidate client caches */
-		local_invalidate(ds, &export->export);
-
-		*written_length = amount_written;
-		*stability_got = FILE_SYNC4;
-	} else {
-		/* FILE_SYNC4 wasn't specified, so we don't have to
-		   bother with the MDS. */
-
-		amount_written =
-		    ceph_ll_write_block(export->cmount, ds->wire.wire.vi,
-					stripe, (char *)buffer, internal_offset,
-					adjusted_write, &(ds->wire.layout),
-					ds->wire.snapseq,
-					(stability_wanted == DATA_SYNC4));
-		if (amount_written < 0)
-			return posix2nfs4_error(-amount_written);
-
-		*written_length = amount_written;
-		*stability_got = stability_wanted;
 	}
 
+	(void) ceph_ll_close(export->cmount, fd);
+
+	/* invalidate client caches */
+	local_invalidate(ds, &export->export);
+
+	*written_length = amount_written;
+	*stability_got = stability_wanted;
+
 	return NFS4_OK;
 }
 
@@ -343,28 +254,22 @@ static nfsstat4 ds_commit(struct fsal_ds_handle *const ds_pub,
 			  const offset4 offset, const count4 count,
 			  verifier4 * const writeverf)
 {
-#ifdef COMMIT_FIX
 	/* The private 'full' export */
-	struct export *export =
-	    container_of(req_ctx->fsal_export, struct export, export);
+	struct export *export = container_of(ds_pub->pds->mds_fsal_export,
+					     struct export, export);
 	/* The private 'full' DS handle */
 	struct ds *ds = container_of(ds_pub, struct ds, ds);
 	/* Error return from Ceph */
 	int rc = 0;
 
-	/* Find out what stripe we're writing to and where within the
-	   stripe. */
-
-	rc = ceph_ll_commit_blocks(export->cmount, ds->wire.wire.vi, offset,
-				   (count == 0) ? UINT64_MAX : count);
-	if (rc < 0)
-		return posix2nfs4_error(rc);
-
-#endif				/* COMMIT_FIX */
+	memcpy(*writeverf, NFS4_write_verifier, NFS4_VERIFIER_SIZE);
 
-	memset(*writeverf, 0, NFS4_VERIFIER_SIZE);
+	rc = ceph_ll_sync_inode(export->cmount, ds->i, 0);
+	if (rc < 0) {
+		LogMajor(COMPONENT_PNFS, "sync failed with: %d", rc);
+		return posix2nfs4_error(-rc);
+	}
 
-	LogCrit(COMPONENT_PNFS, "Commits should go to MDS\n");
 	return NFS4_OK;
 }
 
@@ -398,28 +303,28 @@ static nfsstat4 make_ds_handle(struct fsal_pnfs_ds *const pds,
 			       struct fsal_ds_handle **const handle,
 			       int flags)
 {
+	struct export *export = container_of(pds->mds_fsal_export,
+					     struct export, export);
 	struct ds_wire *dsw = (struct ds_wire *)desc->addr;
 	struct ds *ds;			/* Handle to be created */
+	struct Inode *i;
 
 	*handle = NULL;
 
 	if (desc->len != sizeof(struct ds_wire))
 		return NFS4ERR_BADHANDLE;
 
-	if (dsw->layout.fl_stripe_unit == 0)
-		return NFS4ERR_BADHANDLE;
+	i = ceph_ll_get_inode(export->cmount, dsw->vi);
+	if (i == NULL)
+		return NFS4ERR_STALE;
 
 	ds = gsh_calloc(1, sizeof(struct ds));
 
 	*handle = &ds->ds;
 	fsal_ds_handle_init(*handle, pds);
 
-	/* Connect lazily when a FILE_SYNC4 write forces us to, not
-	   here. */
-
-	ds->connected = false;
-
 	memcpy(&ds->wire, desc->addr, desc->len);
+	ds->i = i;
 	return NFS4_OK;
 }
 
@@ -430,4 +335,4 @@ void pnfs_ds_ops_init(struct fsal_pnfs_ds_ops *ops)
 	ops->fsal_dsh_ops = dsh_ops_init;
 }
 
-#endif				/* CEPH_PNFS */
+#endif				/* USE_FSAL_CEPH_PNFS */
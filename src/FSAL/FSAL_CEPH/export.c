@@ -72,8 +72,12 @@ static void release(struct fsal_export *export_pub)
 	fsal_detach_export(export->export.fsal, &export->export.exports);
 	free_export_ops(&export->export);
 
-	ceph_shutdown(export->cmount);
+	ceph_mount_put(export);
+	export->cm = NULL;
 	export->cmount = NULL;
+	gsh_free(export->root_path);
+	gsh_free(export->fs_name);
+	gsh_free(export->cmount_path);
 	gsh_free(export);
 	export = NULL;
 }
@@ -114,6 +118,8 @@ static fsal_status_t lookup_path(struct fsal_export *export_pub,
 	int rc;
 	/* Find the actual path in the supplied path */
 	const char *realpath;
+	/* The path within the mount, when it is not the export root */
+	char walkpath[MAXPATHLEN];
 
 	if (*path != '/') {
 		realpath = strchr(path, ':');
@@ -151,6 +157,15 @@ static fsal_status_t lookup_path(struct fsal_export *export_pub,
 		return status;
 	}
 
+	/* The mount may be shared with other exports, walk from its root */
+	if (strcmp(export->root_path, "/") != 0) {
+		rc = snprintf(walkpath, sizeof(walkpath), "%s%s",
+			      export->root_path, realpath);
+		if (rc >= sizeof(walkpath))
+			return fsalstat(ERR_FSAL_NAMETOOLONG, 0);
+		realpath = walkpath;
+	}
+
 	rc = fsal_ceph_ll_walk(export->cmount, realpath, &i, &stx,
 				!!attrs_out, op_ctx->creds);
 	if (rc < 0)
@@ -523,7 +538,4 @@ void export_ops_init(struct export_ops *ops)
 	ops->fs_xattr_access_rights = fs_xattr_access_rights;
 	ops->alloc_state = ceph_alloc_state;
 	ops->free_state = ceph_free_state;
-#ifdef CEPH_PNFS
-	export_ops_pnfs(ops);
-#endif				/* CEPH_PNFS */
 }
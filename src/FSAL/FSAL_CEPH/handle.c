@@ -45,6 +45,12 @@
 #include "nfs_exports.h"
 #include "sal_data.h"
 #include "statx_compat.h"
+#ifdef USE_FSAL_CEPH_LL_DELEGATION
+#include "fsal_up.h"
+#ifdef USE_LTTNG
+#include "gsh_lttng/fsal.h"
+#endif
+#endif
 
 /**
  * @brief Release an object
@@ -93,10 +99,19 @@ static fsal_status_t lookup(struct fsal_obj_handle *dir_pub,
 
 	LogFullDebug(COMPONENT_FSAL, "Lookup %s", path);
 
+#ifdef USE_LTTNG
+	tracepoint(fsal, lookup_start, dir_pub->fsal->name, dir_pub, path);
+#endif
+
 	rc = fsal_ceph_ll_lookup(export->cmount, dir->i, path, &i, &stx,
 					!!attrs_out, op_ctx->creds);
-	if (rc < 0)
+	if (rc < 0) {
+#ifdef USE_LTTNG
+		tracepoint(fsal, lookup_end, dir_pub, NULL,
+			   posix2fsal_error(-rc), -rc);
+#endif
 		return ceph2fsal_error(rc);
+	}
 
 	construct_handle(&stx, i, export, &obj);
 
@@ -105,6 +120,10 @@ static fsal_status_t lookup(struct fsal_obj_handle *dir_pub,
 
 	*obj_pub = &obj->handle;
 
+#ifdef USE_LTTNG
+	tracepoint(fsal, lookup_end, dir_pub, *obj_pub, 0, 0);
+#endif
+
 	return fsalstat(0, 0);
 }
 
@@ -210,6 +229,18 @@ static fsal_status_t ceph_fsal_readdir(struct fsal_obj_handle *dir_pub,
 	return fsal_status;
 }
 
+/*
+ * Directory operations
+ *
+ * Creates, mkdirs and unlinks are synchronous MDS requests made on the
+ * worker thread.  libcephfs only has non-blocking calls for data I/O
+ * (see read2_async and write2_async below); it cannot complete a create
+ * or unlink locally under caps the way the kernel client does.  Nor is
+ * there an asynchronous FSAL method for them to plug into, and replying
+ * before the MDS has answered would lose EEXIST, ENOTEMPTY and the
+ * like.  Parallelism on these workloads comes from the worker count.
+ */
+
 /**
  * @brief Create a directory
  *
@@ -262,6 +293,8 @@ static fsal_status_t ceph_fsal_mkdir(struct fsal_obj_handle *dir_hdl,
 	if (rc < 0)
 		return ceph2fsal_error(rc);
 
+	ceph_notify(export, dir->vi, FSAL_UP_INVALIDATE_CACHE);
+
 	construct_handle(&stx, i, export, &obj);
 
 	*new_obj = &obj->handle;
@@ -375,6 +408,8 @@ static fsal_status_t ceph_fsal_mknode(struct fsal_obj_handle *dir_hdl,
 	if (rc < 0)
 		return ceph2fsal_error(rc);
 
+	ceph_notify(export, dir->vi, FSAL_UP_INVALIDATE_CACHE);
+
 	construct_handle(&stx, i, export, &obj);
 
 	*new_obj = &obj->handle;
@@ -461,6 +496,8 @@ static fsal_status_t ceph_fsal_symlink(struct fsal_obj_handle *dir_hdl,
 	if (rc < 0)
 		return ceph2fsal_error(rc);
 
+	ceph_notify(export, dir->vi, FSAL_UP_INVALIDATE_CACHE);
+
 	construct_handle(&stx, i, export, &obj);
 
 	*new_obj = &obj->handle;
@@ -614,6 +651,9 @@ static fsal_status_t ceph_fsal_link(struct fsal_obj_handle *handle_pub,
 	if (rc < 0)
 		return ceph2fsal_error(rc);
 
+	ceph_notify(export, destdir->vi, FSAL_UP_INVALIDATE_CACHE);
+	ceph_notify(export, handle->vi, FSAL_UP_INVALIDATE_ATTRS);
+
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
@@ -646,12 +686,18 @@ static fsal_status_t ceph_fsal_rename(struct fsal_obj_handle *obj_hdl,
 	struct handle *olddir = container_of(olddir_pub, struct handle, handle);
 	/* The private 'full' destination directory handle */
 	struct handle *newdir = container_of(newdir_pub, struct handle, handle);
+	struct handle *obj = container_of(obj_hdl, struct handle, handle);
 
 	rc = fsal_ceph_ll_rename(export->cmount, olddir->i, old_name,
 					newdir->i, new_name, op_ctx->creds);
 	if (rc < 0)
 		return ceph2fsal_error(rc);
 
+	ceph_notify(export, olddir->vi, FSAL_UP_INVALIDATE_CACHE);
+	if (newdir != olddir)
+		ceph_notify(export, newdir->vi, FSAL_UP_INVALIDATE_CACHE);
+	ceph_notify(export, obj->vi, FSAL_UP_INVALIDATE_ATTRS);
+
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
@@ -699,6 +745,11 @@ static fsal_status_t ceph_fsal_unlink(struct fsal_obj_handle *dir_pub,
 		return ceph2fsal_error(rc);
 	}
 
+	ceph_notify(export, dir->vi, FSAL_UP_INVALIDATE_CACHE);
+	ceph_notify(export,
+		    container_of(obj_pub, struct handle, handle)->vi,
+		    FSAL_UP_INVALIDATE_ATTRS);
+
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
@@ -756,11 +807,27 @@ fsal_status_t ceph_open_my_fd(struct handle *myself,
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
+#ifdef USE_FSAL_CEPH_LL_NONBLOCKING_IO
+/** Guards the inflight counts of all ceph_fds */
+static pthread_mutex_t ceph_io_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ceph_io_cv = PTHREAD_COND_INITIALIZER;
+#endif
+
 fsal_status_t ceph_close_my_fd(struct handle *handle, struct ceph_fd *my_fd)
 {
 	int rc = 0;
 	fsal_status_t status = fsalstat(ERR_FSAL_NO_ERROR, 0);
 
+#ifdef USE_FSAL_CEPH_LL_NONBLOCKING_IO
+	/* A non-blocking I/O may still be using the fd after the caller
+	 * that started it dropped the object lock.
+	 */
+	PTHREAD_MUTEX_lock(&ceph_io_mtx);
+	while (my_fd->inflight != 0)
+		pthread_cond_wait(&ceph_io_cv, &ceph_io_mtx);
+	PTHREAD_MUTEX_unlock(&ceph_io_mtx);
+#endif
+
 	if (my_fd->fd != NULL && my_fd->openflags != FSAL_O_CLOSED) {
 		rc = ceph_ll_close(handle->export->cmount, my_fd->fd);
 		if (rc < 0)
@@ -876,6 +943,19 @@ void ceph_free_state(struct fsal_export *exp_hdl, struct state_t *state)
 						      struct ceph_state_fd,
 						      state);
 
+#ifdef USE_FSAL_CEPH_LL_DELEGATION
+	/* A delegation dropped without being returned, say because its
+	 * client expired, may still hold the Fh ceph_lease_op() opened.
+	 */
+	if (state->state_type == STATE_TYPE_DELEG &&
+	    state_fd->ceph_fd.openflags != FSAL_O_CLOSED) {
+		struct export *export =
+			container_of(exp_hdl, struct export, export);
+
+		(void) ceph_ll_close(export->cmount, state_fd->ceph_fd.fd);
+	}
+#endif
+
 	gsh_free(state_fd);
 }
 
@@ -1254,6 +1334,9 @@ fsal_status_t ceph_open2(struct fsal_obj_handle *obj_hdl,
 		return ceph2fsal_error(retval);
 	}
 
+	/* Even an UNCHECKED create may have added the name */
+	ceph_notify(export, myself->vi, FSAL_UP_INVALIDATE_CACHE);
+
 	/* Remember if we were responsible for creating the file.
 	 * Note that in an UNCHECKED retry we MIGHT have re-created the
 	 * file and won't remember that. Oh well, so in that rare case we
@@ -1543,9 +1626,19 @@ fsal_status_t ceph_read2(struct fsal_obj_handle *obj_hdl,
 	if (FSAL_IS_ERROR(status))
 		goto out;
 
+#ifdef USE_LTTNG
+	tracepoint(fsal, io_start, obj_hdl->fsal->name, obj_hdl, 0, offset,
+		   buffer_size);
+#endif
+
 	nb_read =
 	    ceph_ll_read(export->cmount, my_fd, offset, buffer_size, buffer);
 
+#ifdef USE_LTTNG
+	tracepoint(fsal, io_end, obj_hdl, 0, nb_read,
+		   nb_read < 0 ? -nb_read : 0);
+#endif
+
 	if (offset == -1 || nb_read < 0) {
 		status = ceph2fsal_error(nb_read);
 		goto out;
@@ -1598,7 +1691,8 @@ fsal_status_t ceph_read2(struct fsal_obj_handle *obj_hdl,
  *                               bypass any non-mandatory deny write
  * @param[in]     state          state_t to use for this operation
  * @param[in]     offset         Position at which to write
- * @param[in]     buffer         Data to be written
+ * @param[in]     iov            Segments to be written
+ * @param[in]     iovcnt         Number of segments
  * @param[in,out] fsal_stable    In, if on, the fsal is requested to write data
  *                               to stable store. Out, the fsal reports what
  *                               it did.
@@ -1607,15 +1701,15 @@ fsal_status_t ceph_read2(struct fsal_obj_handle *obj_hdl,
  * @return FSAL status.
  */
 
-fsal_status_t ceph_write2(struct fsal_obj_handle *obj_hdl,
-			 bool bypass,
-			 struct state_t *state,
-			 uint64_t offset,
-			 size_t buffer_size,
-			 void *buffer,
-			 size_t *wrote_amount,
-			 bool *fsal_stable,
-			 struct io_info *info)
+static fsal_status_t ceph_writev2(struct fsal_obj_handle *obj_hdl,
+				  bool bypass,
+				  struct state_t *state,
+				  uint64_t offset,
+				  const struct iovec *iov,
+				  int iovcnt,
+				  size_t *wrote_amount,
+				  bool *fsal_stable,
+				  struct io_info *info)
 {
 	struct handle *myself = container_of(obj_hdl, struct handle, handle);
 	ssize_t nb_written;
@@ -1645,12 +1739,41 @@ fsal_status_t ceph_write2(struct fsal_obj_handle *obj_hdl,
 
 	fsal_set_credentials(op_ctx->creds);
 
-	nb_written =
-	    ceph_ll_write(export->cmount, my_fd, offset, buffer_size, buffer);
+#ifdef USE_LTTNG
+	tracepoint(fsal, io_start, obj_hdl->fsal->name, obj_hdl, 1, offset,
+		   fsal_iov_length(iov, iovcnt));
+#endif
+
+#ifdef USE_FSAL_CEPH_LL_WRITEV
+	nb_written = ceph_ll_writev(export->cmount, my_fd, iov, iovcnt, offset);
+#else
+	{
+		/* No vectored call; write the segments in turn, which
+		 * still avoids gathering them into one buffer.
+		 */
+		int i;
+		int64_t done;
+
+		nb_written = 0;
+		for (i = 0; i < iovcnt; i++) {
+			done = ceph_ll_write(export->cmount, my_fd,
+					     offset + nb_written,
+					     iov[i].iov_len, iov[i].iov_base);
+			if (done < 0) {
+				if (nb_written == 0)
+					nb_written = done;
+				break;
+			}
+			nb_written += done;
+			if ((size_t) done < iov[i].iov_len)
+				break;
+		}
+	}
+#endif
 
 	if (nb_written < 0) {
 		status = ceph2fsal_error(nb_written);
-		goto out;
+		goto out_trace;
 	}
 
 	*wrote_amount = nb_written;
@@ -1662,6 +1785,14 @@ fsal_status_t ceph_write2(struct fsal_obj_handle *obj_hdl,
 			status = ceph2fsal_error(retval);
 	}
 
+ out_trace:
+
+#ifdef USE_LTTNG
+	/* A stable write ends with the fsync */
+	tracepoint(fsal, io_end, obj_hdl, 1,
+		   FSAL_IS_ERROR(status) ? -1 : nb_written, status.minor);
+#endif
+
  out:
 
 	if (closefd)
@@ -1674,6 +1805,262 @@ fsal_status_t ceph_write2(struct fsal_obj_handle *obj_hdl,
 	return status;
 }
 
+/**
+ * @brief Write data to a file
+ *
+ * A single segment ceph_writev2.
+ *
+ * @param[in]     obj_hdl        File on which to operate
+ * @param[in]     bypass         If state doesn't indicate a share reservation,
+ *                               bypass any non-mandatory deny write
+ * @param[in]     state          state_t to use for this operation
+ * @param[in]     offset         Position at which to write
+ * @param[in]     buffer_size    Amount of data to write
+ * @param[in]     buffer         Data to be written
+ * @param[out]    wrote_amount   Amount of data written
+ * @param[in,out] fsal_stable    Requested and achieved stability
+ * @param[in,out] info           more information about the data
+ *
+ * @return FSAL status.
+ */
+
+fsal_status_t ceph_write2(struct fsal_obj_handle *obj_hdl,
+			 bool bypass,
+			 struct state_t *state,
+			 uint64_t offset,
+			 size_t buffer_size,
+			 void *buffer,
+			 size_t *wrote_amount,
+			 bool *fsal_stable,
+			 struct io_info *info)
+{
+	struct iovec iov = {
+		.iov_base = buffer,
+		.iov_len = buffer_size,
+	};
+
+	return ceph_writev2(obj_hdl, bypass, state, offset, &iov, 1,
+			    wrote_amount, fsal_stable, info);
+}
+
+#ifdef USE_FSAL_CEPH_LL_NONBLOCKING_IO
+/**
+ * @brief A read or write handed to libcephfs without blocking
+ */
+struct ceph_async_io {
+	struct ceph_ll_io_info io_info;	/*< Passed to libcephfs */
+	struct iovec iov;
+	struct fsal_obj_handle *obj_hdl;
+	struct export *export;
+	struct ceph_fd *stored;		/*< fd in use, NULL if temporary */
+	size_t *amount;			/*< Bytes read or written */
+	bool *end_of_file;		/*< Reads only */
+	fsal_async_cb done_cb;
+	void *caller_data;
+};
+
+/**
+ * @brief libcephfs completion of a non-blocking I/O
+ *
+ * Called from a libcephfs thread, or before
+ * ceph_ll_nonblocking_readv_writev returns.
+ */
+static void ceph_async_io_done(struct ceph_ll_io_info *io_info)
+{
+	struct ceph_async_io *cio =
+		container_of(io_info, struct ceph_async_io, io_info);
+	fsal_status_t status = fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+#ifdef USE_LTTNG
+	tracepoint(fsal, async_io_end, cio, io_info->result,
+		   io_info->result < 0 ? -io_info->result : 0);
+#endif
+
+	if (io_info->result < 0) {
+		status = ceph2fsal_error(io_info->result);
+	} else {
+		*cio->amount = io_info->result;
+		if (!io_info->write)
+			*cio->end_of_file = io_info->result == 0;
+	}
+
+	if (cio->stored == NULL) {
+		(void) ceph_ll_close(cio->export->cmount, io_info->fh);
+	} else {
+		PTHREAD_MUTEX_lock(&ceph_io_mtx);
+		if (--cio->stored->inflight == 0)
+			pthread_cond_broadcast(&ceph_io_cv);
+		PTHREAD_MUTEX_unlock(&ceph_io_mtx);
+	}
+
+	cio->done_cb(cio->obj_hdl, status, cio->caller_data);
+	gsh_free(cio);
+}
+
+/**
+ * @brief Start a non-blocking read or write
+ *
+ * The fd is found as for a blocking call.  A stored fd is pinned by
+ * its inflight count so the object lock can be dropped before the I/O
+ * finishes; a temporary one is closed by the completion.
+ *
+ * @param[in] cio        The I/O, buffers and callback filled in
+ * @param[in] bypass     Bypass any non-mandatory deny
+ * @param[in] state      state_t to use for this operation
+ * @param[in] openflags  FSAL_O_READ or FSAL_O_WRITE
+ */
+static void ceph_async_io_start(struct ceph_async_io *cio, bool bypass,
+				struct state_t *state,
+				fsal_openflags_t openflags)
+{
+	struct handle *myself =
+		container_of(cio->obj_hdl, struct handle, handle);
+	struct ceph_fd temp_fd = {0, NULL}, *out_fd = &temp_fd;
+	fsal_status_t status;
+	bool has_lock = false;
+	bool closefd = false;
+	int64_t rc;
+
+	status = fsal_find_fd((struct fsal_fd **)&out_fd, cio->obj_hdl,
+			      (struct fsal_fd *)&myself->fd, &myself->share,
+			      bypass, state, openflags,
+			      ceph_open_func, ceph_close_func,
+			      &has_lock, &closefd, false);
+
+	if (FSAL_IS_ERROR(status)) {
+		cio->done_cb(cio->obj_hdl, status, cio->caller_data);
+		gsh_free(cio);
+		return;
+	}
+
+	cio->stored = closefd ? NULL : out_fd;
+	cio->io_info.fh = out_fd->fd;
+
+	if (cio->stored != NULL) {
+		PTHREAD_MUTEX_lock(&ceph_io_mtx);
+		cio->stored->inflight++;
+		PTHREAD_MUTEX_unlock(&ceph_io_mtx);
+	}
+
+	if (has_lock)
+		PTHREAD_RWLOCK_unlock(&cio->obj_hdl->obj_lock);
+
+	if (cio->io_info.write)
+		fsal_set_credentials(op_ctx->creds);
+
+#ifdef USE_LTTNG
+	tracepoint(fsal, async_io_start, cio->obj_hdl->fsal->name, cio,
+		   cio->obj_hdl, cio->io_info.write, cio->io_info.off,
+		   cio->iov.iov_len);
+#endif
+
+	rc = ceph_ll_nonblocking_readv_writev(cio->export->cmount,
+					      &cio->io_info);
+
+	if (cio->io_info.write)
+		fsal_restore_ganesha_credentials();
+
+	if (rc < 0) {
+		/* Not started, so no completion is coming */
+		cio->io_info.result = rc;
+		ceph_async_io_done(&cio->io_info);
+	}
+}
+
+static struct ceph_async_io *ceph_async_io_alloc(
+					struct fsal_obj_handle *obj_hdl,
+					uint64_t offset, size_t size,
+					void *buffer, size_t *amount,
+					fsal_async_cb done_cb,
+					void *caller_data)
+{
+	struct ceph_async_io *cio = gsh_calloc(1, sizeof(*cio));
+
+	cio->iov.iov_base = buffer;
+	cio->iov.iov_len = size;
+	cio->io_info.callback = ceph_async_io_done;
+	cio->io_info.iov = &cio->iov;
+	cio->io_info.iovcnt = 1;
+	cio->io_info.off = offset;
+	cio->obj_hdl = obj_hdl;
+	cio->export = container_of(op_ctx->fsal_export, struct export, export);
+	cio->amount = amount;
+	cio->done_cb = done_cb;
+	cio->caller_data = caller_data;
+
+	return cio;
+}
+
+/**
+ * @brief Read data from a file without blocking
+ *
+ * As ceph_read2, except that the worker does not wait for the OSDs;
+ * done_cb is called when libcephfs completes the read.
+ */
+static void ceph_read2_async(struct fsal_obj_handle *obj_hdl,
+			     bool bypass,
+			     struct state_t *state,
+			     uint64_t offset,
+			     size_t buffer_size,
+			     void *buffer,
+			     size_t *read_amount,
+			     bool *end_of_file,
+			     struct io_info *info,
+			     fsal_async_cb done_cb,
+			     void *caller_data)
+{
+	struct ceph_async_io *cio;
+
+	if (info != NULL) {
+		/* Currently we don't support READ_PLUS */
+		done_cb(obj_hdl, fsalstat(ERR_FSAL_NOTSUPP, 0), caller_data);
+		return;
+	}
+
+	cio = ceph_async_io_alloc(obj_hdl, offset, buffer_size, buffer,
+				  read_amount, done_cb, caller_data);
+	cio->end_of_file = end_of_file;
+
+	ceph_async_io_start(cio, bypass, state, FSAL_O_READ);
+}
+
+/**
+ * @brief Write data to a file without blocking
+ *
+ * As ceph_write2, except that the worker does not wait for the OSDs;
+ * done_cb is called when libcephfs completes the write, and for a
+ * stable write the fsync that libcephfs does after it.
+ */
+static void ceph_write2_async(struct fsal_obj_handle *obj_hdl,
+			      bool bypass,
+			      struct state_t *state,
+			      uint64_t offset,
+			      size_t buffer_size,
+			      void *buffer,
+			      size_t *wrote_amount,
+			      bool *fsal_stable,
+			      struct io_info *info,
+			      fsal_async_cb done_cb,
+			      void *caller_data)
+{
+	struct ceph_async_io *cio;
+
+	if (info != NULL) {
+		/* Currently we don't support WRITE_PLUS */
+		done_cb(obj_hdl, fsalstat(ERR_FSAL_NOTSUPP, 0), caller_data);
+		return;
+	}
+
+	cio = ceph_async_io_alloc(obj_hdl, offset, buffer_size, buffer,
+				  wrote_amount, done_cb, caller_data);
+	cio->io_info.write = true;
+	cio->io_info.fsync = *fsal_stable;
+	cio->io_info.syncdataonly = false;
+
+	ceph_async_io_start(cio, bypass, state, FSAL_O_WRITE);
+}
+#endif /* USE_FSAL_CEPH_LL_NONBLOCKING_IO */
+
 /**
  * @brief Commit written data
  *
@@ -1730,6 +2117,107 @@ fsal_status_t ceph_commit2(struct fsal_obj_handle *obj_hdl,
 }
 
 #ifdef USE_FSAL_CEPH_SETLK
+#ifdef USE_FSAL_CEPH_LL_DELEGATION
+/**
+ * @brief Delegation recall callback
+ *
+ * libcephfs calls this from one of its own threads when the MDS wants
+ * back the caps a delegation rests on, for instance because a client
+ * of another gateway opened the file for write.  There is no op
+ * context here, so just queue the recall through the upcall path.
+ *
+ * @param[in] fh   File the delegation was taken on
+ * @param[in] priv Our handle
+ */
+static void ceph_deleg_cb(Fh *fh, void *priv)
+{
+	struct handle *myself = priv;
+	struct gsh_buffdesc key = {
+		.addr = &myself->vi,
+		.len = sizeof(myself->vi)
+	};
+	fsal_status_t status;
+
+	LogDebug(COMPONENT_FSAL_UP, "Recalling delegations on %p", myself);
+
+	status = up_async_delegrecall(general_fridge, myself->up_ops, &key,
+				      NULL, NULL);
+	if (FSAL_IS_ERROR(status))
+		LogCrit(COMPONENT_FSAL_UP,
+			"Unable to queue delegation recall on %p: %s",
+			myself, msg_fsal_err(status.major));
+}
+
+/**
+ * @brief Grant or return a delegation
+ *
+ * A Ceph delegation lives as long as the Fh it was taken on, so the
+ * delegation state gets an Fh of its own, opened here and closed when
+ * the delegation is returned.  Only read delegations are handed out.
+ *
+ * @param[in] obj_hdl      File on which to operate
+ * @param[in] state        Delegation state
+ * @param[in] lock_op      FSAL_OP_LOCK or FSAL_OP_UNLOCK
+ * @param[in] request_lock Lease description
+ *
+ * @return FSAL status.
+ */
+static fsal_status_t ceph_lease_op(struct fsal_obj_handle *obj_hdl,
+				   struct state_t *state,
+				   fsal_lock_op_t lock_op,
+				   fsal_lock_param_t *request_lock)
+{
+	struct handle *myself = container_of(obj_hdl, struct handle, handle);
+	struct ceph_fd *my_fd;
+	fsal_status_t status;
+	int retval;
+
+	if (state == NULL) {
+		LogCrit(COMPONENT_FSAL, "Lease operation with NULL state");
+		return fsalstat(posix2fsal_error(EINVAL), EINVAL);
+	}
+
+	my_fd = &container_of(state, struct ceph_state_fd, state)->ceph_fd;
+
+	if (lock_op == FSAL_OP_UNLOCK) {
+		if (my_fd->openflags == FSAL_O_CLOSED)
+			return fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+		retval = ceph_ll_delegation(myself->export->cmount, my_fd->fd,
+					    CEPH_DELEGATION_NONE,
+					    ceph_deleg_cb, myself);
+		if (retval < 0)
+			LogDebug(COMPONENT_FSAL,
+				 "ceph_ll_delegation returned %d %s",
+				 -retval, strerror(-retval));
+
+		(void) ceph_close_my_fd(myself, my_fd);
+		return ceph2fsal_error(retval);
+	}
+
+	if (lock_op != FSAL_OP_LOCK || request_lock->lock_type != FSAL_LOCK_R)
+		return fsalstat(ERR_FSAL_NOTSUPP, 0);
+
+	status = ceph_open_func(obj_hdl, FSAL_O_READ, (struct fsal_fd *)my_fd);
+	if (FSAL_IS_ERROR(status))
+		return status;
+
+	retval = ceph_ll_delegation(myself->export->cmount, my_fd->fd,
+				    CEPH_DELEGATION_RD, ceph_deleg_cb, myself);
+	if (retval < 0) {
+		/* Typically EAGAIN, the file is open elsewhere in a way
+		 * that conflicts; the OPEN just goes without delegation.
+		 */
+		LogDebug(COMPONENT_FSAL,
+			 "ceph_ll_delegation returned %d %s",
+			 -retval, strerror(-retval));
+		(void) ceph_close_my_fd(myself, my_fd);
+	}
+
+	return ceph2fsal_error(retval);
+}
+#endif
+
 /**
  * @brief Perform a lock operation
  *
@@ -1776,6 +2264,11 @@ fsal_status_t ceph_lock_op2(struct fsal_obj_handle *obj_hdl,
 		     lock_op, request_lock->lock_type, request_lock->lock_start,
 		     request_lock->lock_length);
 
+#ifdef USE_FSAL_CEPH_LL_DELEGATION
+	if (request_lock->lock_sle_type == FSAL_LEASE_LOCK)
+		return ceph_lease_op(obj_hdl, state, lock_op, request_lock);
+#endif
+
 	if (lock_op == FSAL_OP_LOCKT) {
 		/* We may end up using global fd, don't fail on a deny mode */
 		bypass = true;
@@ -2060,6 +2553,8 @@ fsal_status_t ceph_setattr2(struct fsal_obj_handle *obj_hdl,
 	} else {
 		/* Success */
 		status = fsalstat(ERR_FSAL_NO_ERROR, 0);
+		ceph_notify(export, myself->vi,
+			    FSAL_UP_INVALIDATE_ATTRS | FSAL_UP_INVALIDATE_ACL);
 	}
 
  out:
@@ -2203,13 +2698,18 @@ void handle_ops_init(struct fsal_obj_ops *ops)
 	ops->reopen2 = ceph_reopen2;
 	ops->read2 = ceph_read2;
 	ops->write2 = ceph_write2;
+#ifdef USE_FSAL_CEPH_LL_NONBLOCKING_IO
+	ops->read2_async = ceph_read2_async;
+	ops->write2_async = ceph_write2_async;
+#endif
+	ops->writev2 = ceph_writev2;
 	ops->commit2 = ceph_commit2;
 #ifdef USE_FSAL_CEPH_SETLK
 	ops->lock_op2 = ceph_lock_op2;
 #endif
 	ops->setattr2 = ceph_setattr2;
 	ops->close2 = ceph_close2;
-#ifdef CEPH_PNFS
+#ifdef USE_FSAL_CEPH_PNFS
 	handle_ops_pnfs(ops);
-#endif				/* CEPH_PNFS */
+#endif				/* USE_FSAL_CEPH_PNFS */
 }
@@ -191,6 +191,10 @@ void ceph2fsal_attributes(const struct ceph_statx *stx,
 	if (stx->stx_mask & CEPH_STATX_VERSION) {
 		fsalattr->valid_mask |= ATTR_CHANGE;
 		fsalattr->change = stx->stx_version;
+#ifdef USE_FSAL_CEPH_STATX
+		/* The compat statx makes it up from the ctime */
+		fsalattr->valid_mask |= ATTR_CHANGE_COUNTER;
+#endif
 	}
 
 	if ((stx->stx_mask & (CEPH_STATX_CTIME|CEPH_STATX_MTIME)) ==
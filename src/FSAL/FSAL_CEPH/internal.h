@@ -47,6 +47,10 @@
 #include <uuid/uuid.h>
 #include "statx_compat.h"
 #include "FSAL/fsal_commonlib.h"
+#include "city.h"
+#ifdef USE_FSAL_CEPH_PNFS
+#include "pnfs_utils.h"
+#endif
 
 /* Max length of a user_id string that we pass to ceph_mount */
 #define MAXUIDLEN	(64)
@@ -54,6 +58,11 @@
 /* Max length of a secret key for this user */
 #define MAXSECRETLEN	(88)
 
+#ifdef USE_FSAL_CEPH_PNFS
+/* Max number of data servers a layout stripes over */
+#define CEPH_PNFS_MAX_DS	(64)
+#endif				/* USE_FSAL_CEPH_PNFS */
+
 /**
  * Ceph Main (global) module object
  */
@@ -62,21 +71,57 @@ struct ceph_fsal_module {
 	struct fsal_module fsal;
 	fsal_staticfsinfo_t fs_info;
 	char *conf_path;
+#ifdef USE_FSAL_CEPH_PNFS
+	char *pnfs_ds_addrs;	/*< Configured list of DS addresses */
+	uint32_t pnfs_ds_count;	/*< Number of entries in pnfs_ds */
+	fsal_multipath_member_t pnfs_ds[CEPH_PNFS_MAX_DS];
+#endif				/* USE_FSAL_CEPH_PNFS */
+#ifdef USE_FSAL_CEPH_RADOS_NOTIFY
+	char *notify_pool;	/*< Pool of the notify object, or NULL */
+	char *notify_oid;	/*< Object the gateways watch */
+	char *notify_user_id;	/*< cephx user of the RADOS client */
+#endif				/* USE_FSAL_CEPH_RADOS_NOTIFY */
 };
 extern struct ceph_fsal_module CephFSM;
 
+/**
+ * A libcephfs client shared by exports
+ *
+ * Every export of the same filesystem, as the same cephx user, under
+ * the same mount path, shares one client: one MDS session, one cache
+ * and one set of client threads.  Protected by the module's mount
+ * list lock.
+ */
+
+struct ceph_mount {
+	struct glist_head cm_list;	/*< Entry in the module's mounts */
+	struct ceph_mount_info *cmount;	/*< The libcephfs client */
+	char *cm_user_id;	/*< cephx user_id, or NULL */
+	char *cm_secret_key;	/*< cephx key, or NULL */
+	char *cm_fs_name;	/*< Filesystem name, or NULL for default */
+	char *cm_mount_path;	/*< Path within the filesystem mounted */
+	uint64_t cm_fs_hash;	/*< ceph_fs_hash() of cm_fs_name */
+	struct glist_head cm_exports;	/*< Exports of this mount */
+	int32_t cm_refcnt;	/*< Exports of this mount */
+};
+
 /**
  * Ceph private export object
  */
 
 struct export {
 	struct fsal_export export;	/*< The public export object */
+	struct ceph_mount *cm;	/*< The shared client of this export */
 	struct ceph_mount_info *cmount;	/*< The mount object used to
 					   access all Ceph methods on
-					   this export. */
+					   this export, from cm. */
 	struct handle *root;	/*< The root handle */
+	char *root_path;	/*< Export root, relative to the mount */
 	char *user_id;			/* cephx user_id for this mount */
 	char *secret_key;
+	char *fs_name;		/*< Filesystem to mount, or NULL */
+	char *cmount_path;	/*< Configured path to mount, or NULL */
+	struct glist_head cm_link;	/*< Entry in cm->cm_exports */
 };
 
 struct ceph_fd {
@@ -84,6 +129,8 @@ struct ceph_fd {
 	fsal_openflags_t openflags;
 	/** The cephfs file descriptor. */
 	Fh *fd;
+	/** Non-blocking I/Os still using fd, see ceph_close_my_fd */
+	uint32_t inflight;
 };
 
 struct ceph_state_fd {
@@ -103,26 +150,19 @@ struct handle {
 	struct export *export;	/*< The first export this handle belongs to */
 	vinodeno_t vi;		/*< The object identifier */
 	struct fsal_share share;
-#ifdef CEPH_PNFS
-	uint64_t rd_issued;
-	uint64_t rd_serial;
-	uint64_t rw_issued;
-	uint64_t rw_serial;
-	uint64_t rw_max_len;
-#endif				/* CEPH_PNFS */
 };
 
-#ifdef CEPH_PNFS
+#ifdef USE_FSAL_CEPH_PNFS
 
 /**
  * The wire content of a DS (data server) handle
+ *
+ * Every DS mounts the same filesystem, so naming the inode is enough
+ * for any of them to serve I/O on the file.
  */
 
 struct ds_wire {
-	struct wire_handle wire; /*< All the information of a regualr handle */
-	struct ceph_file_layout layout;	/*< Layout information */
-	uint64_t snapseq; /*< And a single entry giving a degernate
-			      snaprealm. */
+	vinodeno_t vi;		/*< The object identifier */
 };
 
 /**
@@ -132,11 +172,10 @@ struct ds_wire {
 struct ds {
 	struct fsal_ds_handle ds;	/*< Public DS handle */
 	struct ds_wire wire;	/*< Wire data */
-	bool connected;		/*< True if the handle has been connected
-				   (in Ceph) */
+	struct Inode *i;	/*< The Ceph inode */
 };
 
-#endif				/* CEPH_PNFS */
+#endif				/* USE_FSAL_CEPH_PNFS */
 
 #define CEPH_SUPPORTED_ATTRS ((const attrmask_t) (ATTRS_POSIX))
 
@@ -181,13 +220,44 @@ unsigned int attrmask2ceph_want(attrmask_t mask);
 void ceph2fsal_attributes(const struct ceph_statx *stx,
 			  struct attrlist *fsalattr);
 
+/**
+ * @brief Name a filesystem in cache coherency messages
+ *
+ * @param[in] fs_name Filesystem name, or NULL for the default one
+ */
+static inline uint64_t ceph_fs_hash(const char *fs_name)
+{
+	if (fs_name == NULL)
+		return 0;
+	return CityHash64(fs_name, strlen(fs_name));
+}
+
+void ceph_mount_put(struct export *export);
+void ceph_mount_invalidate(struct ceph_mount *cm, vinodeno_t vi,
+			   uint32_t flags);
+void ceph_fs_invalidate(uint64_t fs_hash, vinodeno_t vi, uint32_t flags);
+void ceph_fs_invalidate_all(void);
+
+void ceph_up_register(struct ceph_mount *cm);
+#ifdef USE_FSAL_CEPH_RADOS_NOTIFY
+int ceph_notify_init(struct ceph_fsal_module *myself);
+void ceph_notify_shutdown(void);
+void ceph_notify(struct export *export, vinodeno_t vi, uint32_t flags);
+#else				/* USE_FSAL_CEPH_RADOS_NOTIFY */
+static inline void ceph_notify(struct export *export, vinodeno_t vi,
+			       uint32_t flags)
+{
+}
+#endif				/* USE_FSAL_CEPH_RADOS_NOTIFY */
+
 void export_ops_init(struct export_ops *ops);
 void handle_ops_init(struct fsal_obj_ops *ops);
-#ifdef CEPH_PNFS
+#ifdef USE_FSAL_CEPH_PNFS
 void pnfs_ds_ops_init(struct fsal_pnfs_ds_ops *ops);
+void fsal_ops_pnfs(struct fsal_ops *ops);
 void export_ops_pnfs(struct export_ops *ops);
 void handle_ops_pnfs(struct fsal_obj_ops *ops);
-#endif				/* CEPH_PNFS */
+#endif				/* USE_FSAL_CEPH_PNFS */
 
 struct state_t *ceph_alloc_state(struct fsal_export *exp_hdl,
 				 enum state_type state_type,
@@ -37,6 +37,9 @@
 
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
 #include "fsal.h"
 #include "fsal_types.h"
 #include "FSAL/fsal_init.h"
@@ -47,6 +50,9 @@
 #include "nfs_exports.h"
 #include "export_mgr.h"
 #include "statx_compat.h"
+#include "gsh_config.h"
+#include "fsal_up.h"
+#include "fridgethr.h"
 
 /**
  * Ceph global module object.
@@ -75,6 +81,9 @@ static fsal_staticfsinfo_t default_ceph_info = {
 	.lock_support = true,
 	.lock_support_owner = true,
 	.lock_support_async_block = false,
+#endif
+#ifdef USE_FSAL_CEPH_LL_DELEGATION
+	.delegations = FSAL_OPTION_FILE_READ_DELEG,
 #endif
 	.unique_handles = true,
 	.homogenous = true,
@@ -87,6 +96,22 @@ static struct config_item ceph_items[] = {
 			ceph_fsal_module, fs_info.umask),
 	CONF_ITEM_MODE("xattr_access_rights", 0,
 			ceph_fsal_module, fs_info.xattr_access_rights),
+#ifdef USE_FSAL_CEPH_PNFS
+	CONF_ITEM_BOOL("pnfs_mds", false,
+		       ceph_fsal_module, fs_info.pnfs_mds),
+	CONF_ITEM_BOOL("pnfs_ds", false,
+		       ceph_fsal_module, fs_info.pnfs_ds),
+	CONF_ITEM_STR("pnfs_ds_addrs", 0, MAXPATHLEN, NULL,
+		      ceph_fsal_module, pnfs_ds_addrs),
+#endif				/* USE_FSAL_CEPH_PNFS */
+#ifdef USE_FSAL_CEPH_RADOS_NOTIFY
+	CONF_ITEM_STR("notify_pool", 1, MAXPATHLEN, NULL,
+		      ceph_fsal_module, notify_pool),
+	CONF_ITEM_STR("notify_object", 1, MAXPATHLEN, "ganesha_cephfs_notify",
+		      ceph_fsal_module, notify_oid),
+	CONF_ITEM_STR("notify_user_id", 0, MAXUIDLEN, NULL,
+		      ceph_fsal_module, notify_user_id),
+#endif				/* USE_FSAL_CEPH_RADOS_NOTIFY */
 	CONFIG_EOL
 };
 
@@ -99,6 +124,82 @@ static struct config_block ceph_block = {
 	.blk_desc.u.blk.commit = noop_conf_commit
 };
 
+#ifdef USE_FSAL_CEPH_PNFS
+/**
+ * @brief Parse the list of data servers layouts stripe over
+ *
+ * Pnfs_DS_Addrs is a comma or space separated list of IPv4 addresses,
+ * each optionally followed by :port.  Its order is the order stripes
+ * are dealt out in, so every MDS must list the same servers in the
+ * same order.
+ *
+ * @param[in,out] myself The module, with pnfs_ds_addrs loaded
+ *
+ * @return 0, or -1 if an entry was bad or there were too many.
+ */
+
+static int ceph_parse_pnfs_ds(struct ceph_fsal_module *myself)
+{
+	char *list, *tok, *save = NULL;
+	int rc = 0;
+
+	myself->pnfs_ds_count = 0;
+
+	if (myself->pnfs_ds_addrs == NULL)
+		return 0;
+
+	list = gsh_strdup(myself->pnfs_ds_addrs);
+
+	for (tok = strtok_r(list, ", \t", &save); tok != NULL;
+	     tok = strtok_r(NULL, ", \t", &save)) {
+		fsal_multipath_member_t *host;
+		char *colon = strchr(tok, ':');
+		unsigned long port = 2049;
+		struct in_addr addr;
+
+		if (myself->pnfs_ds_count == CEPH_PNFS_MAX_DS) {
+			LogCrit(COMPONENT_CONFIG,
+				"More than %d pNFS data servers", CEPH_PNFS_MAX_DS);
+			rc = -1;
+			break;
+		}
+
+		if (colon != NULL) {
+			char *end;
+
+			*colon = '\0';
+			port = strtoul(colon + 1, &end, 10);
+			if (*end != '\0' || port == 0 || port > UINT16_MAX) {
+				LogCrit(COMPONENT_CONFIG,
+					"Bad pNFS data server port %s",
+					colon + 1);
+				rc = -1;
+				break;
+			}
+		}
+
+		if (inet_pton(AF_INET, tok, &addr) != 1) {
+			LogCrit(COMPONENT_CONFIG,
+				"Bad pNFS data server address %s", tok);
+			rc = -1;
+			break;
+		}
+
+		host = &myself->pnfs_ds[myself->pnfs_ds_count++];
+		host->proto = 6;
+		host->addr = ntohl(addr.s_addr);
+		host->port = port;
+	}
+
+	gsh_free(list);
+
+	if (rc != 0)
+		myself->pnfs_ds_count = 0;
+
+	return rc;
+}
+#endif				/* USE_FSAL_CEPH_PNFS */
+
 /* Module methods
  */
 
@@ -125,6 +226,21 @@ static fsal_status_t init_config(struct fsal_module *module_in,
 	if (!config_error_is_harmless(err_type))
 		return fsalstat(ERR_FSAL_INVAL, 0);
 
+#ifdef USE_FSAL_CEPH_PNFS
+	if (ceph_parse_pnfs_ds(myself) != 0)
+		return fsalstat(ERR_FSAL_INVAL, 0);
+
+	if (myself->fs_info.pnfs_mds && myself->pnfs_ds_count == 0)
+		LogWarn(COMPONENT_CONFIG,
+			"Ceph pnfs_mds is set but no pnfs_ds_addrs are, no layouts will be granted");
+#endif				/* USE_FSAL_CEPH_PNFS */
+
+#ifdef USE_FSAL_CEPH_RADOS_NOTIFY
+	if (myself->notify_pool != NULL && ceph_notify_init(myself) != 0)
+		LogWarn(COMPONENT_CONFIG,
+			"Ceph gateways will not see each other's changes until their cache entries expire");
+#endif				/* USE_FSAL_CEPH_RADOS_NOTIFY */
+
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
@@ -149,6 +265,9 @@ static struct config_item export_params[] = {
 	CONF_ITEM_STR("user_id", 0, MAXUIDLEN, NULL, export, user_id),
 	CONF_ITEM_STR("secret_access_key", 0, MAXSECRETLEN, NULL, export,
 			secret_key),
+	CONF_ITEM_STR("filesystem", 0, NAME_MAX, NULL, export, fs_name),
+	CONF_ITEM_PATH("cmount_path", 1, MAXPATHLEN, NULL, export,
+		       cmount_path),
 	CONFIG_EOL
 };
 
@@ -161,16 +280,358 @@ static struct config_block export_param_block = {
 	.blk_desc.u.blk.commit = noop_conf_commit
 };
 
+/** Clients shared by exports, see struct ceph_mount */
+static struct glist_head ceph_mounts = GLIST_HEAD_INIT(ceph_mounts);
+static pthread_mutex_t ceph_mounts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline bool ceph_str_eq(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+/**
+ * @brief Free a mount that never made it into the list, or left it
+ */
+
+static void ceph_mount_free(struct ceph_mount *cm)
+{
+	if (cm->cmount)
+		ceph_shutdown(cm->cmount);
+	gsh_free(cm->cm_user_id);
+	gsh_free(cm->cm_secret_key);
+	gsh_free(cm->cm_fs_name);
+	gsh_free(cm->cm_mount_path);
+	gsh_free(cm);
+}
+
+/**
+ * @brief Mount a new libcephfs client for an export
+ *
+ * @param[in]  export The export, with its FSAL block loaded
+ * @param[in]  path   Path within the filesystem to mount
+ * @param[out] cmp    The new mount, not yet in the list
+ *
+ * @return 0 or a negative Ceph error.
+ */
+
+static int ceph_mount_new(struct export *export, const char *path,
+			  struct ceph_mount **cmp)
+{
+	struct ceph_mount *cm = gsh_calloc(1, sizeof(*cm));
+	int ceph_status;
+
+	*cmp = NULL;
+
+	/* allocates ceph_mount_info */
+	ceph_status = ceph_create(&cm->cmount, export->user_id);
+	if (ceph_status != 0) {
+		cm->cmount = NULL;
+		LogCrit(COMPONENT_FSAL,
+			"Unable to create Ceph handle for %s.", path);
+		goto error;
+	}
+
+	ceph_status = ceph_conf_read_file(cm->cmount, CephFSM.conf_path);
+	if (ceph_status != 0) {
+		LogCrit(COMPONENT_FSAL,
+			"Unable to read Ceph configuration for %s.", path);
+		goto error;
+	}
+
+	if (export->secret_key) {
+		ceph_status = ceph_conf_set(cm->cmount, "key",
+					    export->secret_key);
+		if (ceph_status) {
+			LogCrit(COMPONENT_FSAL,
+				"Unable to set Ceph secret key for %s: %d",
+				path, ceph_status);
+			goto error;
+		}
+	}
+
+	if (export->fs_name) {
+		ceph_status = ceph_conf_set(cm->cmount, "client_mds_namespace",
+					    export->fs_name);
+		if (ceph_status) {
+			LogCrit(COMPONENT_FSAL,
+				"Unable to select Ceph filesystem %s: %d",
+				export->fs_name, ceph_status);
+			goto error;
+		}
+	}
+
+	/*
+	 * Workaround for broken libcephfs that doesn't handle the path
+	 * given in ceph_mount properly. Should be harmless for fixed
+	 * libcephfs as well (see http://tracker.ceph.com/issues/18254).
+	 */
+	ceph_status = ceph_conf_set(cm->cmount, "client_mountpoint", path);
+	if (ceph_status) {
+		LogCrit(COMPONENT_FSAL,
+			"Unable to set Ceph client_mountpoint for %s: %d",
+			path, ceph_status);
+		goto error;
+	}
+
+	ceph_status = ceph_mount(cm->cmount, path);
+	if (ceph_status != 0) {
+		LogCrit(COMPONENT_FSAL,
+			"Unable to mount Ceph cluster for %s: %d",
+			path, ceph_status);
+		goto error;
+	}
+
+	if (export->user_id)
+		cm->cm_user_id = gsh_strdup(export->user_id);
+	if (export->secret_key)
+		cm->cm_secret_key = gsh_strdup(export->secret_key);
+	if (export->fs_name)
+		cm->cm_fs_name = gsh_strdup(export->fs_name);
+	cm->cm_mount_path = gsh_strdup(path);
+	cm->cm_fs_hash = ceph_fs_hash(cm->cm_fs_name);
+	glist_init(&cm->cm_exports);
+
+	ceph_up_register(cm);
+
+	LogInfo(COMPONENT_FSAL, "Mounted Ceph filesystem %s path %s as %s",
+		export->fs_name ? export->fs_name : "(default)", path,
+		export->user_id ? export->user_id : "(default)");
+
+	*cmp = cm;
+	return 0;
+
+ error:
+	ceph_mount_free(cm);
+	return ceph_status ? ceph_status : -EINVAL;
+}
+
+/**
+ * @brief Find or create the mount an export is served through
+ *
+ * Takes a reference for the export and sets its cm, cmount and
+ * root_path.  Without a configured cmount_path the whole filesystem is
+ * mounted, so every export of it shares one client.  If the cephx user
+ * may not mount the root, the export falls back to a mount of its own
+ * path, as it had before mounts were shared.
+ *
+ * @param[in,out] export The export
+ * @param[in]     fullpath Export path within the filesystem
+ *
+ * @return 0 or a negative Ceph error.
+ */
+
+static int ceph_mount_get(struct export *export, const char *fullpath)
+{
+	const char *path = export->cmount_path ? export->cmount_path : "/";
+	struct ceph_mount *cm = NULL;
+	struct glist_head *glist;
+	size_t len;
+	int rc = 0;
+
+	PTHREAD_MUTEX_lock(&ceph_mounts_lock);
+
+again:
+	len = strlen(path);
+	if (strcmp(path, "/") != 0 &&
+	    (strncmp(fullpath, path, len) != 0 ||
+	     (fullpath[len] != '/' && fullpath[len] != '\0'))) {
+		LogCrit(COMPONENT_FSAL,
+			"Export path %s is not under cmount_path %s",
+			fullpath, path);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	glist_for_each(glist, &ceph_mounts) {
+		struct ceph_mount *cur =
+			glist_entry(glist, struct ceph_mount, cm_list);
+
+		if (ceph_str_eq(cur->cm_user_id, export->user_id) &&
+		    ceph_str_eq(cur->cm_secret_key, export->secret_key) &&
+		    ceph_str_eq(cur->cm_fs_name, export->fs_name) &&
+		    strcmp(cur->cm_mount_path, path) == 0) {
+			cm = cur;
+			break;
+		}
+	}
+
+	if (cm == NULL) {
+		rc = ceph_mount_new(export, path, &cm);
+		if ((rc == -EPERM || rc == -EACCES) &&
+		    export->cmount_path == NULL && strcmp(path, fullpath)) {
+			LogInfo(COMPONENT_FSAL,
+				"Cannot mount Ceph root for %s, mounting the export path alone",
+				fullpath);
+			path = fullpath;
+			goto again;
+		}
+		if (rc != 0)
+			goto out;
+		glist_add_tail(&ceph_mounts, &cm->cm_list);
+	}
+
+	cm->cm_refcnt++;
+	glist_add_tail(&cm->cm_exports, &export->cm_link);
+	export->cm = cm;
+	export->cmount = cm->cmount;
+	export->root_path = gsh_strdup(strcmp(path, "/") == 0 ? fullpath
+				       : fullpath[len] == '\0' ? "/"
+				       : fullpath + len);
+
+	LogDebug(COMPONENT_FSAL, "Export %s uses Ceph mount %s (%"PRIi32
+		 " exports)", fullpath, cm->cm_mount_path, cm->cm_refcnt);
+
+out:
+	PTHREAD_MUTEX_unlock(&ceph_mounts_lock);
+	return rc;
+}
+
+/**
+ * @brief Drop an export's reference to its mount
+ *
+ * The client is unmounted with the last export using it.
+ *
+ * @param[in] export The export
+ */
+
+void ceph_mount_put(struct export *export)
+{
+	struct ceph_mount *cm = export->cm;
+
+	PTHREAD_MUTEX_lock(&ceph_mounts_lock);
+
+	glist_del(&export->cm_link);
+
+	if (--cm->cm_refcnt > 0) {
+		PTHREAD_MUTEX_unlock(&ceph_mounts_lock);
+		return;
+	}
+
+	glist_del(&cm->cm_list);
+	PTHREAD_MUTEX_unlock(&ceph_mounts_lock);
+
+	LogInfo(COMPONENT_FSAL, "Unmounting Ceph path %s",
+		cm->cm_mount_path);
+	ceph_mount_free(cm);
+}
+
+/** Whether MDCACHE has finished setting up an export's up vector */
+static bool ceph_export_up_ready(struct export *export)
+{
+	struct fsal_up_vector *up_ops =
+		(struct fsal_up_vector *) export->export.up_ops;
+	bool ready;
+
+	PTHREAD_MUTEX_lock(&up_ops->up_mutex);
+	ready = up_ops->up_ready;
+	PTHREAD_MUTEX_unlock(&up_ops->up_mutex);
+
+	return ready;
+}
+
+/**
+ * @brief Queue an invalidate of an inode cached through a mount
+ *
+ * Cache entries are shared by all exports of the FSAL, so the up
+ * vector of any export that is ready for upcalls reaches them.
+ *
+ * @note The mount list lock MUST be held
+ */
+
+static void ceph_mount_invalidate_locked(struct ceph_mount *cm,
+					 vinodeno_t vi, uint32_t flags)
+{
+	struct gsh_buffdesc key = { .addr = &vi, .len = sizeof(vi) };
+	struct glist_head *glist;
+	struct export *export;
+
+	glist_for_each(glist, &cm->cm_exports) {
+		export = glist_entry(glist, struct export, cm_link);
+		if (!ceph_export_up_ready(export))
+			continue;
+
+		LogFullDebug(COMPONENT_FSAL_UP,
+			     "Invalidating %"PRIx64":%"PRIx64" flags %"PRIx32,
+			     vi.ino.val, vi.snapid.val, flags);
+
+		(void) up_async_invalidate(general_fridge,
+					   export->export.up_ops, &key,
+					   flags, NULL, NULL);
+		return;
+	}
+}
+
+/**
+ * @brief Invalidate an inode that changed behind a mount's back
+ *
+ * @param[in] cm    The mount
+ * @param[in] vi    The inode
+ * @param[in] flags FSAL_UP_INVALIDATE_*
+ */
+
+void ceph_mount_invalidate(struct ceph_mount *cm, vinodeno_t vi,
+			   uint32_t flags)
+{
+	PTHREAD_MUTEX_lock(&ceph_mounts_lock);
+	ceph_mount_invalidate_locked(cm, vi, flags);
+	PTHREAD_MUTEX_unlock(&ceph_mounts_lock);
+}
+
+/**
+ * @brief Invalidate an inode through every mount of a filesystem
+ *
+ * @param[in] fs_hash ceph_fs_hash() of the filesystem name
+ * @param[in] vi      The inode
+ * @param[in] flags   FSAL_UP_INVALIDATE_*
+ */
+
+void ceph_fs_invalidate(uint64_t fs_hash, vinodeno_t vi, uint32_t flags)
+{
+	struct glist_head *glist;
+	struct ceph_mount *cm;
+
+	PTHREAD_MUTEX_lock(&ceph_mounts_lock);
+	glist_for_each(glist, &ceph_mounts) {
+		cm = glist_entry(glist, struct ceph_mount, cm_list);
+		if (cm->cm_fs_hash == fs_hash)
+			ceph_mount_invalidate_locked(cm, vi, flags);
+	}
+	PTHREAD_MUTEX_unlock(&ceph_mounts_lock);
+}
+
+/**
+ * @brief Invalidate everything cached through any Ceph export
+ *
+ * For when changes may have been missed.
+ */
+
+void ceph_fs_invalidate_all(void)
+{
+	struct glist_head *gm, *ge;
+	struct ceph_mount *cm;
+	struct export *export;
+
+	PTHREAD_MUTEX_lock(&ceph_mounts_lock);
+	glist_for_each(gm, &ceph_mounts) {
+		cm = glist_entry(gm, struct ceph_mount, cm_list);
+		glist_for_each(ge, &cm->cm_exports) {
+			export = glist_entry(ge, struct export, cm_link);
+			if (ceph_export_up_ready(export))
+				(void) export->export.up_ops->invalidate_export(
+						export->export.up_ops);
+		}
+	}
+	PTHREAD_MUTEX_unlock(&ceph_mounts_lock);
+}
+
 /**
  * @brief Create a new export under this FSAL
  *
  * This function creates a new export object for the Ceph FSAL.
- *
- * @todo ACE: We do not handle re-exports of the same cluster in a
- * sane way.  Currently we create multiple handles and cache objects
- * pointing to the same one.  This is not necessarily wrong, but it is
- * inefficient.  It may also not be something we expect to use enough
- * to care about.
+ * Exports share libcephfs clients where they can, see
+ * ceph_mount_get().
  *
  * @param[in]     module_in  The supplied module handle
  * @param[in]     path       The path to export
@@ -222,58 +683,10 @@ static fsal_status_t create_export(struct fsal_module *module_in,
 
 	initialized = true;
 
-	/* allocates ceph_mount_info */
-	ceph_status = ceph_create(&export->cmount, export->user_id);
-	if (ceph_status != 0) {
-		status.major = ERR_FSAL_SERVERFAULT;
-		LogCrit(COMPONENT_FSAL,
-			"Unable to create Ceph handle for %s.",
-			op_ctx->ctx_export->fullpath);
-		goto error;
-	}
-
-	ceph_status = ceph_conf_read_file(export->cmount, CephFSM.conf_path);
+	ceph_status = ceph_mount_get(export, op_ctx->ctx_export->fullpath);
 	if (ceph_status != 0) {
-		status.major = ERR_FSAL_SERVERFAULT;
-		LogCrit(COMPONENT_FSAL,
-			"Unable to read Ceph configuration for %s.",
-			op_ctx->ctx_export->fullpath);
-		goto error;
-	}
-
-	if (export->secret_key) {
-		ceph_status = ceph_conf_set(export->cmount, "key",
-					    export->secret_key);
-		if (ceph_status) {
-			status.major = ERR_FSAL_INVAL;
-			LogCrit(COMPONENT_FSAL,
-				"Unable to set Ceph secret key for %s: %d",
-				op_ctx->ctx_export->fullpath, ceph_status);
-			goto error;
-		}
-	}
-
-	/*
-	 * Workaround for broken libcephfs that doesn't handle the path
-	 * given in ceph_mount properly. Should be harmless for fixed
-	 * libcephfs as well (see http://tracker.ceph.com/issues/18254).
-	 */
-	ceph_status = ceph_conf_set(export->cmount, "client_mountpoint",
-				    op_ctx->ctx_export->fullpath);
-	if (ceph_status) {
-		status.major = ERR_FSAL_INVAL;
-		LogCrit(COMPONENT_FSAL,
-			"Unable to set Ceph client_mountpoint for %s: %d",
-			op_ctx->ctx_export->fullpath, ceph_status);
-		goto error;
-	}
-
-	ceph_status = ceph_mount(export->cmount, op_ctx->ctx_export->fullpath);
-	if (ceph_status != 0) {
-		status.major = ERR_FSAL_SERVERFAULT;
-		LogCrit(COMPONENT_FSAL,
-			"Unable to mount Ceph cluster for %s.",
-			op_ctx->ctx_export->fullpath);
+		status.major = ceph_status == -EINVAL ? ERR_FSAL_INVAL
+						      : ERR_FSAL_SERVERFAULT;
 		goto error;
 	}
 
@@ -288,10 +701,38 @@ static fsal_status_t create_export(struct fsal_module *module_in,
 	export->export.fsal = module_in;
 	export->export.up_ops = up_ops;
 
+#ifdef USE_FSAL_CEPH_LL_DELEGATION
+	if (op_ctx->ctx_export->export_perms.options &
+	    EXPORT_OPTION_DELEGATIONS) {
+		/* The core revokes a delegation whose recall has gone
+		 * unanswered for two lease periods.  Give it that and a
+		 * little slack before libcephfs gives up on us, while
+		 * staying well short of the MDS session timeout.
+		 */
+		unsigned int timeout =
+			nfs_param.nfsv4_param.lease_lifetime * 2 + 5;
+
+		ceph_status = ceph_set_deleg_timeout(export->cmount, timeout);
+		if (ceph_status != 0) {
+			LogWarn(COMPONENT_FSAL,
+				"Unable to set delegation timeout for %s, disabling delegations: %d",
+				op_ctx->ctx_export->fullpath, ceph_status);
+			op_ctx->ctx_export->export_perms.options &=
+				~EXPORT_OPTION_DELEGATIONS;
+		}
+	}
+#endif
+
 	LogDebug(COMPONENT_FSAL, "Ceph module export %s.",
 		 op_ctx->ctx_export->fullpath);
 
-	status = find_cephfs_root(export->cmount, &i);
+	if (strcmp(export->root_path, "/") == 0) {
+		status = find_cephfs_root(export->cmount, &i);
+	} else {
+		rc = fsal_ceph_ll_walk(export->cmount, export->root_path, &i,
+				       &stx, false, op_ctx->creds);
+		status = ceph2fsal_error(rc < 0 ? rc : 0);
+	}
 	if (FSAL_IS_ERROR(status))
 		goto error;
 
@@ -307,6 +748,43 @@ static fsal_status_t create_export(struct fsal_module *module_in,
 	export->root = handle;
 	op_ctx->fsal_export = &export->export;
 
+#ifdef USE_FSAL_CEPH_PNFS
+	if (export->export.exp_ops.fs_supports(&export->export,
+					       fso_pnfs_ds_supported)) {
+		struct fsal_pnfs_ds *pds = NULL;
+
+		status = module_in->m_ops.fsal_pnfs_ds(module_in, parse_node,
+						       &pds);
+		if (FSAL_IS_ERROR(status))
+			return status;
+
+		/* special case: server_id matches export_id */
+		pds->id_servers = op_ctx->ctx_export->export_id;
+		pds->mds_export = op_ctx->ctx_export;
+		pds->mds_fsal_export = op_ctx->fsal_export;
+
+		if (!pnfs_ds_insert(pds)) {
+			LogCrit(COMPONENT_CONFIG,
+				"Server id %d already in use.",
+				pds->id_servers);
+			return fsalstat(ERR_FSAL_EXIST, 0);
+		}
+
+		LogDebug(COMPONENT_PNFS,
+			 "Ceph pNFS DS enabled for %s",
+			 op_ctx->ctx_export->fullpath);
+	}
+
+	if (export->export.exp_ops.fs_supports(&export->export,
+					       fso_pnfs_mds_supported)) {
+		LogDebug(COMPONENT_PNFS,
+			 "Ceph pNFS MDS enabled for %s",
+			 op_ctx->ctx_export->fullpath);
+		export_ops_pnfs(&export->export.exp_ops);
+		fsal_ops_pnfs(&module_in->m_ops);
+	}
+#endif				/* USE_FSAL_CEPH_PNFS */
+
 	return status;
 
  error:
@@ -314,8 +792,11 @@ static fsal_status_t create_export(struct fsal_module *module_in,
 		ceph_ll_put(export->cmount, i);
 
 	if (export) {
-		if (export->cmount)
-			ceph_shutdown(export->cmount);
+		if (export->cm)
+			ceph_mount_put(export);
+		gsh_free(export->root_path);
+		gsh_free(export->fs_name);
+		gsh_free(export->cmount_path);
 		gsh_free(export);
 	}
 
@@ -364,9 +845,9 @@ MODULE_INIT void init(void)
 	}
 
 	/* Set up module operations */
-#ifdef CEPH_PNFS
+#ifdef USE_FSAL_CEPH_PNFS
 	myself->m_ops.fsal_pnfs_ds_ops = pnfs_ds_ops_init;
-#endif				/* CEPH_PNFS */
+#endif				/* USE_FSAL_CEPH_PNFS */
 	myself->m_ops.create_export = create_export;
 	myself->m_ops.init_config = init_config;
 	myself->m_ops.support_ex = ceph_support_ex;
@@ -385,6 +866,10 @@ MODULE_FINI void finish(void)
 	LogDebug(COMPONENT_FSAL,
 		 "Ceph module finishing.");
 
+#ifdef USE_FSAL_CEPH_RADOS_NOTIFY
+	ceph_notify_shutdown();
+#endif				/* USE_FSAL_CEPH_RADOS_NOTIFY */
+
 	if (unregister_fsal(&CephFSM.fsal) != 0) {
 		LogCrit(COMPONENT_FSAL,
 			"Unable to unload Ceph FSAL.  Dying with extreme prejudice.");
@@ -20,6 +20,7 @@
  * -------------
  */
 
+#include "config.h"
 #include "gsh_rpc.h"
 #include <cephfs/libcephfs.h>
 #include "fsal.h"
@@ -32,7 +33,29 @@
 #include "FSAL/fsal_commonlib.h"
 #include "statx_compat.h"
 
-#ifdef CEPH_PNFS
+#ifdef USE_FSAL_CEPH_PNFS
+
+/**
+ * @file   FSAL_CEPH/mds.c
+ * @author Adam C. Emerson <aemerson@linuxbox.com>
+ * @date Wed Oct 22 13:24:33 2014
+ *
+ * @brief pNFS Metadata Server Operations for the Ceph FSAL
+ *
+ * This file implements the layoutget, layoutreturn, layoutcommit,
+ * getdeviceinfo, and getdevicelist operations and export query
+ * support for the Ceph FSAL.
+ *
+ * Layouts follow the file's RADOS striping.  The file is cut into
+ * stripe units of fl_stripe_unit bytes, consecutive units go round
+ * robin over the fl_stripe_count objects of an object set, and a set
+ * is done once each of its objects holds fl_object_size bytes.  Each
+ * object is mapped to one of the configured data servers, so the
+ * LAYOUT4_NFSV4_1_FILES stripe unit is the Ceph stripe unit and the
+ * pattern repeats every stripe_count * units per object * DS count
+ * units.  The data servers are Ganesha instances mounting the same
+ * filesystem, so all of them take the same filehandle and offsets.
+ */
 
 /**
  * Linux supports a stripe pattern with no more than 4096 stripes, but
@@ -43,49 +66,47 @@
 static const size_t BIGGEST_PATTERN = 1024;
 
 /**
- * @file   FSAL_CEPH/mds.c
- * @author Adam C. Emerson <aemerson@linuxbox.com>
- * @date Wed Oct 22 13:24:33 2014
+ * @brief Split a Ceph layout into what the device address needs
  *
- * @brief pNFS Metadata Server Operations for the Ceph FSAL
+ * @param[in]  layout        Layout of the file
+ * @param[in]  num_ds        Number of data servers
+ * @param[out] stripe_count  Objects per object set
+ * @param[out] units_per_obj Stripe units per object
  *
- * This file implements the layoutget, layoutreturn, layoutcommit,
- * getdeviceinfo, and getdevicelist operations and export query
- * support for the Ceph FSAL.
+ * @return Length of the stripe pattern, or 0 if it can't be expressed.
  */
 
-static bool initiate_recall(vinodeno_t vi, bool write, void *opaque)
+static uint32_t ceph_pnfs_pattern(const struct ceph_file_layout *layout,
+				  uint32_t num_ds, uint32_t *stripe_count,
+				  uint32_t *units_per_obj)
 {
-	/* The private 'full' object handle */
-	struct handle *handle = (struct handle *)opaque;
-	/* Return code from upcall operation */
-	state_status_t status = STATE_SUCCESS;
-	struct gsh_buffdesc key = {
-		.addr = &handle->vi,
-		.len = sizeof(vinodeno_t)
-	};
-	struct pnfs_segment segment = {
-		.offset = 0,
-		.length = UINT64_MAX,
-		.io_mode = (write ? LAYOUTIOMODE4_RW : LAYOUTIOMODE4_READ)
-	};
+	uint32_t unit = layout->fl_stripe_unit;
+	uint64_t length;
 
-	status = handle->up_ops->layoutrecall(&key, LAYOUT4_NFSV4_1_FILES,
-					      false, &segment, NULL, NULL);
+	if (unit == 0 || layout->fl_stripe_count == 0 ||
+	    layout->fl_object_size < unit ||
+	    layout->fl_object_size % unit != 0)
+		return 0;
 
-	if (status != STATE_SUCCESS)
-		return false;
+	*stripe_count = layout->fl_stripe_count;
+	*units_per_obj = layout->fl_object_size / unit;
 
-	return true;
+	length = (uint64_t) *stripe_count * *units_per_obj * num_ds;
+	if (length > BIGGEST_PATTERN)
+		return 0;
+
+	return length;
 }
 
 /**
  * @brief Describe a Ceph striping pattern
  *
- * At present, we support a files based layout only.  The CRUSH
- * striping pattern is a-periodic
+ * The deviceid carries the stripe count, the stripe units per object
+ * and the number of data servers the layout was built for, which is
+ * all it takes to rebuild the pattern.  A device built for a different
+ * number of data servers than are now configured is reported gone.
  *
- * @param[in]  export_pub   Public export handle
+ * @param[in]  fsal_hdl     FSAL module
  * @param[out] da_addr_body Stream we write the result to
  * @param[in]  type         Type of layout that gave the device
  * @param[in]  deviceid     The device to look up
@@ -93,51 +114,50 @@ static bool initiate_recall(vinodeno_t vi, bool write, void *opaque)
  * @return Valid error codes in RFC 5661, p. 365.
  */
 
-static nfsstat4 getdeviceinfo(struct fsal_export *export_pub,
+static nfsstat4 getdeviceinfo(struct fsal_module *fsal_hdl,
 			      XDR *da_addr_body, const layouttype4 type,
 			      const struct pnfs_deviceid *deviceid)
 {
-	/* Full 'private' export */
-	struct export *export = container_of(export_pub, struct export, export);
-	/* The number of Ceph OSDs in the cluster */
-	unsigned num_osds = ceph_ll_num_osds(export->cmount);
-	/* Minimal information needed to get layout info */
-	vinodeno_t vinode;
-	/* Structure containing the storage parameters of the file within
-	   the Ceph cluster. */
-	struct ceph_file_layout file_layout;
-	/* Currently, all layouts have the same number of stripes */
-	uint32_t stripes = BIGGEST_PATTERN;
+	struct ceph_fsal_module *myself =
+	    container_of(fsal_hdl, struct ceph_fsal_module, fsal);
+	/* Objects per object set */
+	uint32_t stripe_count = deviceid->devid >> 32;
+	/* Stripe units per object */
+	uint32_t units_per_obj = deviceid->devid & UINT32_MAX;
+	/* Number of data servers */
+	uint32_t num_ds = deviceid->device_id2;
+	/* Length of the stripe pattern */
+	uint32_t stripes;
+	/* Stripe units per object set */
+	uint32_t units_per_set;
 	/* Index for iterating over stripes */
-	size_t stripe = 0;
-	/* Index for iterating over OSDs */
-	size_t osd = 0;
+	uint32_t stripe;
+	/* Index for iterating over data servers */
+	uint32_t ds;
 	/* NFSv4 status code */
 	nfsstat4 nfs_status = 0;
 
-	vinode.ino.val = deviceid->devid;
-	vinode.snapid.val = CEPH_NOSNAP;
-
 	/* Sanity check on type */
 	if (type != LAYOUT4_NFSV4_1_FILES) {
 		LogCrit(COMPONENT_PNFS, "Unsupported layout type: %x", type);
 		return NFS4ERR_UNKNOWN_LAYOUTTYPE;
 	}
 
-	/* Retrieve and calculate storage parameters of layout */
-	memset(&file_layout, 0, sizeof(struct ceph_file_layout));
-	if (ceph_ll_file_layout(export->cmount, vinode, &file_layout) != 0) {
-		LogCrit(COMPONENT_PNFS, "Failed to get Ceph layout for inode");
-		return NFS4ERR_SERVERFAULT;
+	if (num_ds == 0 || num_ds != myself->pnfs_ds_count ||
+	    stripe_count == 0 || units_per_obj == 0 ||
+	    (uint64_t) stripe_count * units_per_obj * num_ds >
+	    BIGGEST_PATTERN) {
+		LogDebug(COMPONENT_PNFS, "Stale or bogus device %" PRIx64,
+			 deviceid->devid);
+		return NFS4ERR_NOENT;
 	}
 
-	/* As this is large, we encode as we go rather than building a
-	   structure and encoding it all at once. */
+	units_per_set = stripe_count * units_per_obj;
+	stripes = units_per_set * num_ds;
 
 	/* The first entry in the nfsv4_1_file_ds_addr4 is the array
-	   of stripe indices. First we encode the count of stripes.
-	   Since our pattern doesn't repeat, we have as many indices
-	   as we do stripes. */
+	   of stripe indices, one per stripe unit of the pattern, each
+	   naming the data server that holds that unit's object. */
 
 	if (!inline_xdr_u_int32_t(da_addr_body, &stripes)) {
 		LogCrit(COMPONENT_PNFS,
@@ -147,50 +167,31 @@ static nfsstat4 getdeviceinfo(struct fsal_export *export_pub,
 	}
 
 	for (stripe = 0; stripe < stripes; stripe++) {
-		uint32_t stripe_osd = stripe_osd =
-		    ceph_ll_get_stripe_osd(export->cmount,
-					   vinode,
-					   stripe,
-					   &file_layout);
-		if (stripe_osd < 0) {
-			LogCrit(COMPONENT_PNFS,
-				"Failed to retrieve OSD for stripe %lu of file %"
-				PRIu64 ".  Error: %u",
-				stripe, deviceid->devid, -stripe_osd);
-			return NFS4ERR_SERVERFAULT;
-		}
-		if (!inline_xdr_u_int32_t(da_addr_body, &stripe_osd)) {
+		uint32_t object = (stripe / units_per_set) * stripe_count +
+				  stripe % stripe_count;
+		uint32_t index = object % num_ds;
+
+		if (!inline_xdr_u_int32_t(da_addr_body, &index)) {
 			LogCrit(COMPONENT_PNFS,
-				"Failed to encode OSD for stripe %lu.", stripe);
+				"Failed to encode DS for stripe %" PRIu32 ".",
+				stripe);
 			return NFS4ERR_SERVERFAULT;
 		}
 	}
 
-	/* The number of OSDs in our cluster is the length of our
-	   array of multipath_lists */
+	/* Then one multipath_list per data server, holding just that
+	   server. */
 
-	if (!inline_xdr_u_int32_t(da_addr_body, &num_osds)) {
+	if (!inline_xdr_u_int32_t(da_addr_body, &num_ds)) {
 		LogCrit(COMPONENT_PNFS,
-			"Failed to encode length of multipath_ds_list array: %u",
-			num_osds);
+			"Failed to encode length of multipath_ds_list array: %"
+			PRIu32, num_ds);
 		return NFS4ERR_SERVERFAULT;
 	}
 
-	/* Since our index is the OSD number itself, we have only one
-	   host per multipath_list. */
-
-	for (osd = 0; osd < num_osds; osd++) {
-		fsal_multipath_member_t host;
-
-		memset(&host, 0, sizeof(fsal_multipath_member_t));
-		host.proto = 6;
-		if (ceph_ll_osdaddr(export->cmount, osd, &host.addr) < 0) {
-			LogCrit(COMPONENT_PNFS,
-				"Unable to get IP address for OSD %lu.", osd);
-			return NFS4ERR_SERVERFAULT;
-		}
-		host.port = 2049;
-		nfs_status = FSAL_encode_v4_multipath(da_addr_body, 1, &host);
+	for (ds = 0; ds < num_ds; ds++) {
+		nfs_status = FSAL_encode_v4_multipath(da_addr_body, 1,
+						      &myself->pnfs_ds[ds]);
 		if (nfs_status != NFS4_OK)
 			return nfs_status;
 	}
@@ -287,34 +288,39 @@ static size_t fs_loc_body_size(struct fsal_export *export_pub)
 /**
  * @brief Size of the buffer needed for a ds_addr
  *
- * This one is huge, due to the striping pattern.
+ * This one is huge, due to the striping pattern: up to
+ * BIGGEST_PATTERN stripe indices plus one address per data server.
  *
- * @param[in] export_pub Public export handle
+ * @param[in] fsal_hdl FSAL module
  *
  * @return Size of the buffer needed for a ds_addr
  */
-static size_t fs_da_addr_size(struct fsal_export *export_pub)
+static size_t fs_da_addr_size(struct fsal_module *fsal_hdl)
 {
-	return 0x1400;
+	return 0x2000;
 }
 
-void export_ops_pnfs(struct export_ops *ops)
+void fsal_ops_pnfs(struct fsal_ops *ops)
 {
 	ops->getdeviceinfo = getdeviceinfo;
+	ops->fs_da_addr_size = fs_da_addr_size;
+}
+
+void export_ops_pnfs(struct export_ops *ops)
+{
 	ops->getdevicelist = getdevicelist;
 	ops->fs_layouttypes = fs_layouttypes;
 	ops->fs_layout_blocksize = fs_layout_blocksize;
 	ops->fs_maximum_segments = fs_maximum_segments;
 	ops->fs_loc_body_size = fs_loc_body_size;
-	ops->fs_da_addr_size = fs_da_addr_size;
 }
 
 /**
  * @brief Grant a layout segment.
  *
- * Grant a layout on a subset of a file requested.  As a special case,
- * lie and grant a whole-file layout if requested, because Linux will
- * ignore it otherwise.
+ * The pattern repeats, so we always grant the whole file.  Files whose
+ * striping can't be expressed in BIGGEST_PATTERN stripe indices go
+ * through the MDS.
  *
  * @param[in]     obj_pub  Public object handle
  * @param[in]     req_ctx  Request context
@@ -337,15 +343,15 @@ static nfsstat4 layoutget(struct fsal_obj_handle *obj_pub,
 	    container_of(req_ctx->fsal_export, struct export, export);
 	/* The private 'full' object handle */
 	struct handle *handle = container_of(obj_pub, struct handle, handle);
+	/* Number of configured data servers */
+	uint32_t num_ds = CephFSM.pnfs_ds_count;
 	/* Structure containing the storage parameters of the file within
 	   the Ceph cluster. */
 	struct ceph_file_layout file_layout;
-	/* Width of each stripe on the file */
-	uint32_t stripe_width = 0;
+	/* Objects per object set and stripe units per object */
+	uint32_t stripe_count = 0, units_per_obj = 0;
 	/* Utility parameter */
 	nfl_util4 util = 0;
-	/* The last byte that can be accessed through pNFS */
-	uint64_t last_possible_byte = 0;
 	/* The deviceid for this layout */
 	struct pnfs_deviceid deviceid = DEVICE_ID_INIT_ZERO(FSAL_ID_CEPH);
 	/* NFS Status */
@@ -356,16 +362,8 @@ static nfsstat4 layoutget(struct fsal_obj_handle *obj_pub,
 	struct gsh_buffdesc ds_desc = {.addr = &ds_wire,
 		.len = sizeof(struct ds_wire)
 	};
-	/* The smallest layout the client will accept */
-	struct pnfs_segment smallest_acceptable = {
-		.io_mode = res->segment.io_mode,
-		.offset = res->segment.offset,
-		.length = arg->minlength
-	};
-	struct pnfs_segment forbidden_area = {
-		.io_mode = res->segment.io_mode,
-		.length = NFS4_UINT64_MAX
-	};
+	/* Return code from Ceph */
+	int rc;
 
 	/* We support only LAYOUT4_NFSV4_1_FILES layouts */
 
@@ -375,164 +373,71 @@ static nfsstat4 layoutget(struct fsal_obj_handle *obj_pub,
 		return NFS4ERR_UNKNOWN_LAYOUTTYPE;
 	}
 
-	/* Get basic information on the file and calculate the dimensions
-	   of the layout we can support. */
+	if (num_ds == 0)
+		return NFS4ERR_LAYOUTUNAVAILABLE;
 
 	memset(&file_layout, 0, sizeof(struct ceph_file_layout));
 
-	ceph_ll_file_layout(export->cmount, handle->wire.vi, &file_layout);
-	stripe_width = file_layout.fl_stripe_unit;
-	last_possible_byte = (BIGGEST_PATTERN * stripe_width) - 1;
-	forbidden_area.offset = last_possible_byte + 1;
-
-	/* Since the Linux kernel refuses to work with any layout that
-	   doesn't cover the whole file, if a whole file layout is
-	   requested, lie.
-
-	   Otherwise, make sure the required layout doesn't go beyond
-	   what can be accessed through pNFS. This is a preliminary
-	   check before even talking to Ceph. */
-	if (!
-	    ((res->segment.offset == 0)
-	     && (res->segment.length == NFS4_UINT64_MAX))) {
-		if (pnfs_segments_overlap
-		    (&smallest_acceptable, &forbidden_area)) {
-			LogCrit(COMPONENT_PNFS,
-				"Required layout extends beyond allowed region. offset: %"
-				PRIu64 ", minlength: %" PRIu64 ".",
-				res->segment.offset, arg->minlength);
-			return NFS4ERR_BADLAYOUT;
-		}
-		res->segment.offset = 0;
-		res->segment.length = stripe_width * BIGGEST_PATTERN;
+	rc = ceph_ll_file_layout(export->cmount, handle->i, &file_layout);
+	if (rc < 0) {
+		LogDebug(COMPONENT_PNFS,
+			 "Failed to get Ceph layout for inode %" PRIu64
+			 ": %d", handle->vi.ino.val, rc);
+		return posix2nfs4_error(-rc);
 	}
 
-	LogFullDebug(COMPONENT_PNFS,
-		     "will issue layout offset: %" PRIu64 " length: %" PRIu64,
-		     res->segment.offset, res->segment.length);
+	if (ceph_pnfs_pattern(&file_layout, num_ds, &stripe_count,
+			      &units_per_obj) == 0) {
+		LogDebug(COMPONENT_PNFS,
+			 "Striping of inode %" PRIu64
+			 " (unit %u count %u object %u) too wide for pNFS",
+			 handle->vi.ino.val, file_layout.fl_stripe_unit,
+			 file_layout.fl_stripe_count,
+			 file_layout.fl_object_size);
+		return NFS4ERR_LAYOUTUNAVAILABLE;
+	}
 
 	/* We are using sparse layouts with commit-through-DS, so our
-	   utility word contains only the stripe width, our first
+	   utility word contains only the stripe unit, our first
 	   stripe is always at the beginning of the layout, and there
 	   is no pattern offset. */
 
-	if ((stripe_width & ~NFL4_UFLG_STRIPE_UNIT_SIZE_MASK) != 0) {
+	if ((file_layout.fl_stripe_unit &
+	     ~NFL4_UFLG_STRIPE_UNIT_SIZE_MASK) != 0) {
 		LogCrit(COMPONENT_PNFS,
-			"Ceph returned stripe width that is disallowed by NFS: %"
-			PRIu32 ".", stripe_width);
-		return NFS4ERR_SERVERFAULT;
+			"Ceph returned stripe unit that is disallowed by NFS: %"
+			PRIu32 ".", file_layout.fl_stripe_unit);
+		return NFS4ERR_LAYOUTUNAVAILABLE;
 	}
-	util = stripe_width;
-
-	/* If we have a cached capbility, use that.  Otherwise, call
-	   in to Ceph. */
-
-	PTHREAD_RWLOCK_wrlock(&handle->handle.obj_lock);
-	if (res->segment.io_mode == LAYOUTIOMODE4_READ) {
-		int32_t r = 0;
-
-		if (handle->rd_issued == 0) {
-#if 0
-			/* (ceph part might be here: thunderbeast mbarrier1) */
-			r = ceph_ll_hold_rw(export->cmount, handle->wire.vi,
-					    false, initiate_recall, handle,
-					    &handle->rd_serial, NULL);
-#endif
-			if (r < 0) {
-				PTHREAD_RWLOCK_unlock(&handle->handle.obj_lock);
-				return posix2nfs4_error(-r);
-			}
-		}
-		++handle->rd_issued;
-	} else {
-		int32_t r = 0;
-
-		if (handle->rw_issued == 0) {
-#if 0
-			r = ceph_ll_hold_rw(export->cmount, handle->wire.vi,
-					    true, initiate_recall, handle,
-					    &handle->rw_serial,
-					    &handle->rw_max_len);
-#endif
-			if (r < 0) {
-				PTHREAD_RWLOCK_unlock(&handle->handle.obj_lock);
-				return posix2nfs4_error(-r);
-			}
-		}
-		forbidden_area.offset = handle->rw_max_len;
-		if (pnfs_segments_overlap
-		    (&smallest_acceptable, &forbidden_area)) {
-			PTHREAD_RWLOCK_unlock(&handle->handle.obj_lock);
-			return NFS4ERR_BADLAYOUT;
-		}
-#if CLIENTS_WILL_ACCEPT_SEGMENTED_LAYOUTS	/* sigh */
-		res->segment.length =
-		    (handle->rw_max_len - res->segment.offset);
-#endif
-		++handle->rw_issued;
-	}
-	PTHREAD_RWLOCK_unlock(&handle->handle.obj_lock);
+	util = file_layout.fl_stripe_unit;
 
-	/* For now, just make the low quad of the deviceid be the
-	   inode number.  With the span of the layouts constrained
-	   above, this lets us generate the device address on the fly
-	   from the deviceid rather than storing it. */
+	res->segment.offset = 0;
+	res->segment.length = NFS4_UINT64_MAX;
 
-	deviceid.devid = handle->wire.vi.ino.val;
+	LogFullDebug(COMPONENT_PNFS,
+		     "will issue layout offset: %" PRIu64 " length: %" PRIu64,
+		     res->segment.offset, res->segment.length);
 
-	/* We return exactly one filehandle, filling in the necessary
-	   information for the DS server to speak to the Ceph OSD
-	   directly. */
+	deviceid.device_id2 = num_ds;
+	deviceid.devid = ((uint64_t) stripe_count << 32) | units_per_obj;
 
-	ds_wire.wire = handle->wire;
-	ds_wire.layout = file_layout;
-	ds_wire.snapseq = ceph_ll_snap_seq(export->cmount, handle->wire.vi);
+	/* We return exactly one filehandle, good on every DS. */
+
+	ds_wire.vi = handle->vi;
 
 	nfs_status = FSAL_encode_file_layout(loc_body, &deviceid, util, 0, 0,
-					     &req_ctx->export->export_id, 1,
-					     &ds_desc);
+					     &req_ctx->ctx_export->export_id,
+					     1, &ds_desc);
 	if (nfs_status != NFS4_OK) {
 		LogCrit(COMPONENT_PNFS,
 			"Failed to encode nfsv4_1_file_layout.");
-		goto relinquish;
+		return nfs_status;
 	}
 
-	/* We grant only one segment, and we want it back when the file
-	   is closed. */
-
 	res->return_on_close = true;
 	res->last_segment = true;
 
 	return NFS4_OK;
-
- relinquish:
-
-	/* If we failed in encoding the lo_content, relinquish what we
-	   reserved for it. */
-
-	PTHREAD_RWLOCK_wrlock(&handle->handle.obj_lock);
-	if (res->segment.io_mode == LAYOUTIOMODE4_READ) {
-		if (--handle->rd_issued != 0) {
-			PTHREAD_RWLOCK_unlock(&handle->handle.obj_lock);
-			return nfs_status;
-		}
-	} else {
-		if (--handle->rd_issued != 0) {
-			PTHREAD_RWLOCK_unlock(&handle->handle.obj_lock);
-			return nfs_status;
-		}
-	}
-
-#if 0
-	ceph_ll_return_rw(export->cmount, handle->wire.vi,
-			  res->segment.io_mode ==
-			  LAYOUTIOMODE4_READ ? handle->rd_serial : handle->
-			  rw_serial);
-#endif
-
-	PTHREAD_RWLOCK_unlock(&handle->handle.obj_lock);
-
-	return nfs_status;
 }
 
 /**
@@ -553,12 +458,6 @@ static nfsstat4 layoutreturn(struct fsal_obj_handle *obj_pub,
 			     struct req_op_context *req_ctx, XDR *lrf_body,
 			     const struct fsal_layoutreturn_arg *arg)
 {
-	/* The private 'full' export */
-	struct export *export =
-	    container_of(req_ctx->fsal_export, struct export, export);
-	/* The private 'full' object handle */
-	struct handle *handle = container_of(obj_pub, struct handle, handle);
-
 	/* Sanity check on type */
 	if (arg->lo_type != LAYOUT4_NFSV4_1_FILES) {
 		LogCrit(COMPONENT_PNFS, "Unsupported layout type: %x",
@@ -566,37 +465,15 @@ static nfsstat4 layoutreturn(struct fsal_obj_handle *obj_pub,
 		return NFS4ERR_UNKNOWN_LAYOUTTYPE;
 	}
 
-	if (arg->dispose) {
-		PTHREAD_RWLOCK_wrlock(&handle->handle.obj_lock);
-		if (arg->cur_segment.io_mode == LAYOUTIOMODE4_READ) {
-			if (--handle->rd_issued != 0) {
-				PTHREAD_RWLOCK_unlock(&handle->handle.obj_lock);
-				return NFS4_OK;
-			}
-		} else {
-			if (--handle->rd_issued != 0) {
-				PTHREAD_RWLOCK_unlock(&handle->handle.obj_lock);
-				return NFS4_OK;
-			}
-		}
-
-#if 0
-		ceph_ll_return_rw(export->cmount, handle->wire.vi,
-				  arg->cur_segment.io_mode ==
-				  LAYOUTIOMODE4_READ ? handle->
-				  rd_serial : handle->rw_serial);
-#endif
-
-		PTHREAD_RWLOCK_unlock(&handle->handle.obj_lock);
-	}
-
 	return NFS4_OK;
 }
 
 /**
  * @brief Commit a segment of a layout
  *
- * Update the size and time for a file accessed through a layout.
+ * The data servers write through their own Ceph clients, so the size
+ * is normally already right.  Make sure it covers the last write and
+ * move mtime forward.
  *
  * @param[in]     obj_pub  Public object handle
  * @param[in]     req_ctx  Request context
@@ -635,20 +512,17 @@ static nfsstat4 layoutcommit(struct fsal_obj_handle *obj_pub,
 		return NFS4ERR_UNKNOWN_LAYOUTTYPE;
 	}
 
-	/* A more proper and robust implementation of this would use
-	   Ceph caps, but we need to hack at the client to expose
-	   those before it can work. */
-	ceph_status = fsal_ceph_ll_getattr(export->cmount, handle->wire.vi,
+	ceph_status = fsal_ceph_ll_getattr(export->cmount, handle->i,
 			&stxold, CEPH_STATX_SIZE|CEPH_STATX_MTIME,
 			op_ctx->creds);
 	if (ceph_status < 0) {
 		LogCrit(COMPONENT_PNFS,
 			"Error %d in attempt to get attributes of file %"
-			PRIu64 ".", -ceph_status, handle->wire.vi.ino.val);
+			PRIu64 ".", -ceph_status, handle->vi.ino.val);
 		return posix2nfs4_error(-ceph_status);
 	}
 
-	stxnew->stx_mask = 0;
+	memset(&stxnew, 0, sizeof(stxnew));
 	if (arg->new_offset) {
 		if (stxold.stx_size < arg->last_write + 1) {
 			attrmask |= CEPH_SETATTR_SIZE;
@@ -659,29 +533,25 @@ static nfsstat4 layoutcommit(struct fsal_obj_handle *obj_pub,
 	}
 
 	if (arg->time_changed &&
-	    (arg->new_time.seconds > stxold.stx_mtime ||
-	     (arg->new_time.seconds == stxold.stx_mtime &&
-	      arg->new_time.nseconds > stxold.stx_mtime_ns))) {
-		stxnew.stx_mtime = arg->new_time.seconds;
-		stxnew.stx_mtime_ns = arg->new_time.nseconds;
+	    (arg->new_time.seconds > stxold.stx_mtime.tv_sec ||
+	     (arg->new_time.seconds == stxold.stx_mtime.tv_sec &&
+	      arg->new_time.nseconds > stxold.stx_mtime.tv_nsec))) {
+		stxnew.stx_mtime.tv_sec = arg->new_time.seconds;
+		stxnew.stx_mtime.tv_nsec = arg->new_time.nseconds;
 	} else {
-		struct timespec now;
-
-		ceph_status = clock_gettime(CLOCK_REALTIME, &now);
+		ceph_status = clock_gettime(CLOCK_REALTIME, &stxnew.stx_mtime);
 		if (ceph_status != 0)
 			return posix2nfs4_error(errno);
-		stxnew.stx_mtime = now.tv_sec;
-		stxnew.stx_mtime_ns = now.tv_nsec;
 	}
 
 	attrmask |= CEPH_SETATTR_MTIME;
 
-	ceph_status = fsal_ceph_ll_setattr(export->cmount, handle->wire.vi,
+	ceph_status = fsal_ceph_ll_setattr(export->cmount, handle->i,
 					&stxnew, attrmask, op_ctx->creds);
 	if (ceph_status < 0) {
 		LogCrit(COMPONENT_PNFS,
-			"Error %d in attempt to get attributes of file %"
-			PRIu64 ".", -ceph_status, handle->wire.vi.ino.val);
+			"Error %d in attempt to set attributes of file %"
+			PRIu64 ".", -ceph_status, handle->vi.ino.val);
 		return posix2nfs4_error(-ceph_status);
 	}
 
@@ -699,4 +569,4 @@ void handle_ops_pnfs(struct fsal_obj_ops *ops)
 	ops->layoutcommit = layoutcommit;
 }
 
-#endif				/* CEPH_PNFS */
+#endif				/* USE_FSAL_CEPH_PNFS */
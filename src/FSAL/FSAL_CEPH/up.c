@@ -0,0 +1,405 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @file   FSAL_CEPH/up.c
+ * @brief Cache coherency between gateways exporting the same CephFS
+ *
+ * Two sources tell us that something cached in MDCACHE changed on
+ * another client of the filesystem:
+ *
+ * - libcephfs calls back when the MDS revokes the caps a cached inode
+ *   or dentry rests on, as it does for FUSE.  Each mount registers its
+ *   own callbacks, see ceph_up_register().
+ *
+ * - With Notify_Pool set, every gateway watches one RADOS object and
+ *   notifies it after each change it makes to a directory or to
+ *   attributes, which caps alone do not always reveal.  Gateways that
+ *   receive a notification invalidate the inode through every mount of
+ *   the same filesystem.  If the watch is lost, everything is
+ *   invalidated, since changes may have been missed meanwhile.
+ *
+ * Both only queue invalidates; the next access goes to the MDS.
+ */
+
+#include "config.h"
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <cephfs/libcephfs.h>
+#include "fsal.h"
+#include "fsal_up.h"
+#include "fridgethr.h"
+#include "internal.h"
+#ifdef USE_FSAL_CEPH_RADOS_NOTIFY
+#include <rados/librados.h>
+#endif
+
+#ifdef USE_FSAL_CEPH_LL_CALLBACKS
+/**
+ * @brief The MDS took back the caps cached data of an inode rests on
+ *
+ * Called from a libcephfs thread, without an op context.
+ */
+static void ceph_ino_cb(void *handle, vinodeno_t vi, int64_t off,
+			int64_t len)
+{
+	struct ceph_mount *cm = handle;
+
+	LogFullDebug(COMPONENT_FSAL_UP,
+		     "libcephfs invalidated %"PRIx64":%"PRIx64,
+		     vi.ino.val, vi.snapid.val);
+
+	ceph_mount_invalidate(cm, vi, FSAL_UP_INVALIDATE_CACHE);
+}
+
+/**
+ * @brief The MDS took back a dentry of a directory
+ *
+ * Called from a libcephfs thread, without an op context.
+ */
+static void ceph_dentry_cb(void *handle, vinodeno_t dirino, vinodeno_t ino,
+			   const char *name, size_t len)
+{
+	struct ceph_mount *cm = handle;
+
+	LogFullDebug(COMPONENT_FSAL_UP,
+		     "libcephfs invalidated dentry %.*s of %"PRIx64":%"PRIx64,
+		     (int) len, name, dirino.ino.val, dirino.snapid.val);
+
+	ceph_mount_invalidate(cm, dirino,
+			      FSAL_UP_INVALIDATE_CONTENT |
+			      FSAL_UP_INVALIDATE_DIR_POPULATED |
+			      FSAL_UP_INVALIDATE_DIR_CHUNKS);
+}
+#endif				/* USE_FSAL_CEPH_LL_CALLBACKS */
+
+/**
+ * @brief Have libcephfs tell us when caps on cached objects are revoked
+ *
+ * @param[in] cm A newly mounted client
+ */
+
+void ceph_up_register(struct ceph_mount *cm)
+{
+#ifdef USE_FSAL_CEPH_LL_CALLBACKS
+	struct ceph_client_callback_args args = {
+		.handle = cm,
+		.ino_cb = ceph_ino_cb,
+		.dentry_cb = ceph_dentry_cb,
+	};
+
+	ceph_ll_register_callbacks(cm->cmount, &args);
+
+	LogDebug(COMPONENT_FSAL_UP,
+		 "Registered invalidation callbacks for Ceph path %s",
+		 cm->cm_mount_path);
+#endif				/* USE_FSAL_CEPH_LL_CALLBACKS */
+}
+
+#ifdef USE_FSAL_CEPH_RADOS_NOTIFY
+
+/** Bump when struct ceph_notify_msg changes */
+#define CEPH_NOTIFY_VERSION 1
+
+/** How long a notify waits for every watcher to acknowledge */
+#define CEPH_NOTIFY_TIMEOUT_MS 5000
+
+/**
+ * What a gateway tells the others, all fields little endian
+ */
+
+struct ceph_notify_msg {
+	uint32_t cn_version;	/*< CEPH_NOTIFY_VERSION */
+	uint32_t cn_flags;	/*< FSAL_UP_INVALIDATE_* */
+	uint64_t cn_fs;		/*< ceph_fs_hash() of the filesystem */
+	uint64_t cn_ino;	/*< Inode that changed */
+	uint64_t cn_snap;	/*< And its snapshot */
+};
+
+static struct {
+	rados_t cluster;
+	rados_ioctx_t io;
+	char *oid;		/*< Notify_Object */
+	uint64_t cookie;	/*< Our watch */
+	uint64_t instance_id;	/*< Our RADOS client, to skip our own */
+	bool watching;		/*< Whether notifies are sent */
+	bool shutdown;
+} notify;
+
+static void ceph_notify_rewatch(struct fridgethr_context *ctx);
+
+/**
+ * @brief Another gateway changed something
+ *
+ * Called from a librados thread.  Our own notifies come back here too
+ * and are skipped.
+ */
+static void ceph_notify_cb(void *arg, uint64_t notify_id, uint64_t cookie,
+			   uint64_t notifier_id, void *data, size_t data_len)
+{
+	struct ceph_notify_msg msg;
+	vinodeno_t vi;
+
+	(void) rados_notify_ack(notify.io, notify.oid, notify_id, cookie,
+				NULL, 0);
+
+	if (notifier_id == notify.instance_id)
+		return;
+
+	if (data_len < sizeof(msg)) {
+		LogDebug(COMPONENT_FSAL_UP,
+			 "Short Ceph notify from %"PRIu64" (%zu bytes)",
+			 notifier_id, data_len);
+		return;
+	}
+
+	memcpy(&msg, data, sizeof(msg));
+	if (le32toh(msg.cn_version) != CEPH_NOTIFY_VERSION) {
+		LogDebug(COMPONENT_FSAL_UP,
+			 "Ceph notify version %"PRIu32" from %"PRIu64
+			 " not understood",
+			 le32toh(msg.cn_version), notifier_id);
+		return;
+	}
+
+	vi.ino.val = le64toh(msg.cn_ino);
+	vi.snapid.val = le64toh(msg.cn_snap);
+
+	LogFullDebug(COMPONENT_FSAL_UP,
+		     "Gateway %"PRIu64" changed %"PRIx64":%"PRIx64,
+		     notifier_id, vi.ino.val, vi.snapid.val);
+
+	ceph_fs_invalidate(le64toh(msg.cn_fs), vi,
+			   le32toh(msg.cn_flags) & FSAL_UP_INVALIDATE_CACHE);
+}
+
+/**
+ * @brief The watch broke, most likely the OSD connection was lost
+ *
+ * Notifications sent meanwhile are gone, so drop everything and watch
+ * again from a fridge thread, librados may not be reentered here.
+ */
+static void ceph_notify_errcb(void *arg, uint64_t cookie, int err)
+{
+	LogWarn(COMPONENT_FSAL_UP,
+		"Lost watch on Ceph notify object %s: %d, invalidating all Ceph exports",
+		notify.oid, err);
+
+	notify.watching = false;
+	ceph_fs_invalidate_all();
+
+	if (fridgethr_submit(general_fridge, ceph_notify_rewatch, NULL) != 0)
+		LogCrit(COMPONENT_FSAL_UP,
+			"Unable to queue a new watch on Ceph notify object %s",
+			notify.oid);
+}
+
+static int ceph_notify_watch(void)
+{
+	int rc;
+
+	rc = rados_watch2(notify.io, notify.oid, &notify.cookie,
+			  ceph_notify_cb, ceph_notify_errcb, NULL);
+	if (rc < 0)
+		return rc;
+
+	notify.watching = true;
+	return 0;
+}
+
+static void ceph_notify_rewatch(struct fridgethr_context *ctx)
+{
+	int rc;
+
+	if (notify.shutdown)
+		return;
+
+	(void) rados_unwatch2(notify.io, notify.cookie);
+
+	rc = ceph_notify_watch();
+	if (rc == 0) {
+		/* Whatever changed while we were rewatching */
+		ceph_fs_invalidate_all();
+		LogEvent(COMPONENT_FSAL_UP,
+			 "Watching Ceph notify object %s again", notify.oid);
+		return;
+	}
+
+	LogDebug(COMPONENT_FSAL_UP,
+		 "Watch on Ceph notify object %s failed: %d, retrying",
+		 notify.oid, rc);
+	sleep(1);
+
+	if (fridgethr_submit(general_fridge, ceph_notify_rewatch, NULL) != 0)
+		LogCrit(COMPONENT_FSAL_UP,
+			"Unable to queue a new watch on Ceph notify object %s",
+			notify.oid);
+}
+
+/**
+ * @brief Connect to RADOS and watch the notify object
+ *
+ * @param[in] myself The module, with its config loaded
+ *
+ * @return 0 or a negative RADOS error.
+ */
+
+int ceph_notify_init(struct ceph_fsal_module *myself)
+{
+	rados_write_op_t op;
+	int rc;
+
+	if (notify.oid != NULL)
+		return 0;
+
+	rc = rados_create(&notify.cluster, myself->notify_user_id);
+	if (rc < 0) {
+		LogCrit(COMPONENT_FSAL, "Unable to create RADOS client: %d",
+			rc);
+		return rc;
+	}
+
+	rc = rados_conf_read_file(notify.cluster, myself->conf_path);
+	if (rc == 0)
+		rc = rados_connect(notify.cluster);
+	if (rc < 0) {
+		LogCrit(COMPONENT_FSAL, "Unable to connect to RADOS: %d", rc);
+		goto shutdown;
+	}
+
+	rc = rados_ioctx_create(notify.cluster, myself->notify_pool,
+				&notify.io);
+	if (rc < 0) {
+		LogCrit(COMPONENT_FSAL, "Unable to open RADOS pool %s: %d",
+			myself->notify_pool, rc);
+		goto shutdown;
+	}
+
+	/* Every gateway creates it, the first one wins */
+	op = rados_create_write_op();
+	rados_write_op_create(op, LIBRADOS_CREATE_EXCLUSIVE, NULL);
+	rc = rados_write_op_operate(op, notify.io, myself->notify_oid,
+				    NULL, 0);
+	rados_release_write_op(op);
+	if (rc < 0 && rc != -EEXIST) {
+		LogCrit(COMPONENT_FSAL,
+			"Unable to create Ceph notify object %s: %d",
+			myself->notify_oid, rc);
+		goto destroy;
+	}
+
+	notify.oid = gsh_strdup(myself->notify_oid);
+	notify.instance_id = rados_get_instance_id(notify.cluster);
+	notify.shutdown = false;
+
+	rc = ceph_notify_watch();
+	if (rc < 0) {
+		LogCrit(COMPONENT_FSAL,
+			"Unable to watch Ceph notify object %s: %d",
+			notify.oid, rc);
+		gsh_free(notify.oid);
+		notify.oid = NULL;
+		goto destroy;
+	}
+
+	LogInfo(COMPONENT_FSAL,
+		"Watching Ceph notify object %s in pool %s as %"PRIu64,
+		notify.oid, myself->notify_pool, notify.instance_id);
+	return 0;
+
+ destroy:
+	rados_ioctx_destroy(notify.io);
+ shutdown:
+	rados_shutdown(notify.cluster);
+	return rc;
+}
+
+/**
+ * @brief Stop watching and disconnect from RADOS
+ */
+
+void ceph_notify_shutdown(void)
+{
+	if (notify.oid == NULL)
+		return;
+
+	notify.shutdown = true;
+	notify.watching = false;
+
+	(void) rados_unwatch2(notify.io, notify.cookie);
+	(void) rados_watch_flush(notify.cluster);
+	(void) rados_aio_flush(notify.io);
+	rados_ioctx_destroy(notify.io);
+	rados_shutdown(notify.cluster);
+
+	gsh_free(notify.oid);
+	notify.oid = NULL;
+}
+
+static void ceph_notify_done(rados_completion_t c, void *arg)
+{
+	int rc = rados_aio_get_return_value(c);
+
+	/* A gateway that died without unwatching times out */
+	if (rc < 0 && rc != -ETIMEDOUT)
+		LogDebug(COMPONENT_FSAL_UP, "Ceph notify failed: %d", rc);
+
+	rados_aio_release(c);
+}
+
+/**
+ * @brief Tell the other gateways that an inode changed
+ *
+ * Does not wait for them.
+ *
+ * @param[in] export Export the change was made through
+ * @param[in] vi     The inode
+ * @param[in] flags  FSAL_UP_INVALIDATE_* they should apply
+ */
+
+void ceph_notify(struct export *export, vinodeno_t vi, uint32_t flags)
+{
+	struct ceph_notify_msg msg;
+	rados_completion_t c;
+	int rc;
+
+	if (!notify.watching)
+		return;
+
+	msg.cn_version = htole32(CEPH_NOTIFY_VERSION);
+	msg.cn_flags = htole32(flags);
+	msg.cn_fs = htole64(export->cm->cm_fs_hash);
+	msg.cn_ino = htole64(vi.ino.val);
+	msg.cn_snap = htole64(vi.snapid.val);
+
+	rc = rados_aio_create_completion(NULL, ceph_notify_done, NULL, &c);
+	if (rc < 0)
+		return;
+
+	rc = rados_aio_notify(notify.io, notify.oid, c, (const char *) &msg,
+			      sizeof(msg), CEPH_NOTIFY_TIMEOUT_MS, NULL, NULL);
+	if (rc < 0) {
+		LogDebug(COMPONENT_FSAL_UP, "Ceph notify not sent: %d", rc);
+		rados_aio_release(c);
+	}
+}
+
+#endif				/* USE_FSAL_CEPH_RADOS_NOTIFY */
@@ -688,6 +688,13 @@ glusterfs_free_fs(struct glusterfs_fs *gl_fs)
 
 	atomic_inc_int8_t(&gl_fs->destroy_mode);
 
+#ifdef USE_GLUSTER_UPCALL_REGISTER
+	/* Wake up_thread, it sleeps until gfapi hands it an upcall */
+	PTHREAD_MUTEX_lock(&gl_fs->up_lock);
+	pthread_cond_broadcast(&gl_fs->up_cond);
+	PTHREAD_MUTEX_unlock(&gl_fs->up_lock);
+#endif
+
 	/* Wait for up_thread to exit */
 	err = pthread_join(gl_fs->up_thread, (void **)&retval);
 
@@ -704,6 +711,10 @@ glusterfs_free_fs(struct glusterfs_fs *gl_fs)
 
 	/* Gluster and memory cleanup */
 	glfs_fini(gl_fs->fs);
+#ifdef USE_GLUSTER_UPCALL_REGISTER
+	PTHREAD_COND_destroy(&gl_fs->up_cond);
+	PTHREAD_MUTEX_destroy(&gl_fs->up_lock);
+#endif
 	gsh_free(gl_fs->volname);
 	gsh_free(gl_fs);
 }
@@ -740,6 +751,11 @@ glusterfs_get_fs(struct glexport_params params,
 	}
 
 	glist_init(&gl_fs->fs_obj);
+#ifdef USE_GLUSTER_UPCALL_REGISTER
+	glist_init(&gl_fs->up_queue);
+	PTHREAD_MUTEX_init(&gl_fs->up_lock, NULL);
+	PTHREAD_COND_init(&gl_fs->up_cond, NULL);
+#endif
 
 	fs = glfs_new(params.glvolname);
 	if (!fs) {
@@ -800,6 +816,10 @@ out:
 
 	if (gl_fs) {
 		glist_del(&gl_fs->fs_obj); /* not needed atm */
+#ifdef USE_GLUSTER_UPCALL_REGISTER
+		PTHREAD_COND_destroy(&gl_fs->up_cond);
+		PTHREAD_MUTEX_destroy(&gl_fs->up_lock);
+#endif
 		gsh_free(gl_fs);
 	}
 
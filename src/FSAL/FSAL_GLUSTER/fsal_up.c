@@ -37,45 +37,36 @@
 #include <utime.h>
 #include <sys/time.h>
 
-int upcall_inode_invalidate(struct glusterfs_fs *gl_fs,
-			     struct glfs_object *object)
+/**
+ * @brief Invalidate the cached object behind a gfapi handle
+ *
+ * @param[in] gl_fs    Gluster filesystem the handle belongs to
+ * @param[in] globjhdl Handle descriptor, the gfapi handle already
+ *                     extracted after room for the volume id
+ *
+ * @return The FSAL status of the invalidate, or -1.
+ */
+static int upcall_handle_invalidate(struct glusterfs_fs *gl_fs,
+				    unsigned char *globjhdl)
 {
 	int	     rc                             = -1;
-	glfs_t          *fs                         = NULL;
+	glfs_t          *fs                         = gl_fs->fs;
 	char            vol_uuid[GLAPI_UUID_LENGTH] = {'\0'};
-	unsigned char   globjhdl[GLAPI_HANDLE_LENGTH];
 	struct gsh_buffdesc         key;
 	const struct fsal_up_vector *event_func;
 	fsal_status_t fsal_status = {0, 0};
 
-	fs = gl_fs->fs;
-	if (!fs) {
-		LogCrit(COMPONENT_FSAL_UP,
-			"Invalid fs object of the glusterfs_fs(%p)",
-			 gl_fs);
-		goto out;
-	}
-
-	rc = glfs_h_extract_handle(object, globjhdl+GLAPI_UUID_LENGTH,
-				   GFAPI_HANDLE_LENGTH);
-	if (rc < 0) {
-		LogDebug(COMPONENT_FSAL_UP,
-			 "glfs_h_extract_handle failed %p",
-			 fs);
-		goto out;
-	}
-
 	rc = glfs_get_volumeid(fs, vol_uuid,
 			       GLAPI_UUID_LENGTH);
 	if (rc < 0) {
 		LogDebug(COMPONENT_FSAL_UP,
 			 "glfs_get_volumeid failed %p",
 			 fs);
-		goto out;
+		return -1;
 	}
 
 	memcpy(globjhdl, vol_uuid, GLAPI_UUID_LENGTH);
-	key.addr = &globjhdl;
+	key.addr = globjhdl;
 	key.len = GLAPI_HANDLE_LENGTH;
 
 	LogDebug(COMPONENT_FSAL_UP, "Received event to process for %p",
@@ -95,25 +86,189 @@ int upcall_inode_invalidate(struct glusterfs_fs *gl_fs,
 			gl_fs->fs, rc);
 	}
 
+	return rc;
+}
+
+int upcall_inode_invalidate(struct glusterfs_fs *gl_fs,
+			     struct glfs_object *object)
+{
+	int	     rc                             = -1;
+	glfs_t          *fs                         = NULL;
+	unsigned char   globjhdl[GLAPI_HANDLE_LENGTH];
+
+	fs = gl_fs->fs;
+	if (!fs) {
+		LogCrit(COMPONENT_FSAL_UP,
+			"Invalid fs object of the glusterfs_fs(%p)",
+			 gl_fs);
+		goto out;
+	}
+
+	rc = glfs_h_extract_handle(object, globjhdl+GLAPI_UUID_LENGTH,
+				   GFAPI_HANDLE_LENGTH);
+	if (rc < 0) {
+		LogDebug(COMPONENT_FSAL_UP,
+			 "glfs_h_extract_handle failed %p",
+			 fs);
+		goto out;
+	}
+
+	rc = upcall_handle_invalidate(gl_fs, globjhdl);
+
 out:
 	return rc;
 }
 
+#ifdef USE_GLUSTER_UPCALL_REGISTER
+/**
+ * @brief An upcall handed over by gfapi, queued on the glusterfs_fs
+ */
+struct glusterfs_upcall {
+	struct glist_head list;
+	struct glfs_upcall *cbk;
+};
+
+/** Distinct objects remembered per batch to drop repeat invalidates */
+#define GLUSTERFS_UP_BATCH_HANDLES 64
+
+struct glusterfs_up_batch {
+	unsigned int count;
+	unsigned char handles[GLUSTERFS_UP_BATCH_HANDLES][GFAPI_HANDLE_LENGTH];
+};
+
+/**
+ * @brief Upcall callback registered with gfapi
+ *
+ * This runs on a gfapi thread, so just queue the upcall for the
+ * upcall thread and wake it.  Once the filesystem is going away the
+ * upcall is dropped.
+ */
+static void glusterfs_upcall_cbk(struct glfs_upcall *cbk, void *data)
+{
+	struct glusterfs_fs *gl_fs = data;
+	struct glusterfs_upcall *up;
+
+	PTHREAD_MUTEX_lock(&gl_fs->up_lock);
+
+	if (atomic_fetch_int8_t(&gl_fs->destroy_mode)) {
+		PTHREAD_MUTEX_unlock(&gl_fs->up_lock);
+		glfs_free(cbk);
+		return;
+	}
+
+	up = gsh_malloc(sizeof(*up));
+	up->cbk = cbk;
+	glist_add_tail(&gl_fs->up_queue, &up->list);
+	pthread_cond_signal(&gl_fs->up_cond);
+
+	PTHREAD_MUTEX_unlock(&gl_fs->up_lock);
+}
+
+/**
+ * @brief Invalidate an object unless this batch already did
+ *
+ * Renames and creates within one directory invalidate the same
+ * parent over and over, so only the first one in a batch goes up.
+ */
+static void upcall_batch_invalidate(struct glusterfs_fs *gl_fs,
+				    struct glusterfs_up_batch *batch,
+				    struct glfs_object *object)
+{
+	unsigned char globjhdl[GLAPI_HANDLE_LENGTH];
+	unsigned char *gfid = globjhdl + GLAPI_UUID_LENGTH;
+	unsigned int i;
+
+	if (object == NULL)
+		return;
+
+	if (glfs_h_extract_handle(object, gfid, GFAPI_HANDLE_LENGTH) < 0) {
+		LogDebug(COMPONENT_FSAL_UP,
+			 "glfs_h_extract_handle failed %p",
+			 gl_fs->fs);
+		return;
+	}
+
+	for (i = 0; i < batch->count; i++) {
+		if (memcmp(batch->handles[i], gfid, GFAPI_HANDLE_LENGTH) == 0)
+			return;
+	}
+
+	if (batch->count < GLUSTERFS_UP_BATCH_HANDLES)
+		memcpy(batch->handles[batch->count++], gfid,
+		       GFAPI_HANDLE_LENGTH);
+
+	(void) upcall_handle_invalidate(gl_fs, globjhdl);
+}
+
+/**
+ * @brief Process, then free, a batch of queued upcalls
+ *
+ * @param[in] gl_fs   Gluster filesystem the upcalls came from
+ * @param[in] queue   The upcalls
+ * @param[in] process false to just free them
+ */
+static void upcall_process_queue(struct glusterfs_fs *gl_fs,
+				 struct glist_head *queue,
+				 bool process)
+{
+	struct glusterfs_up_batch batch;
+	struct glusterfs_upcall *up;
+	struct glfs_upcall_inode *in_arg;
+	enum glfs_upcall_reason reason;
+
+	batch.count = 0;
+
+	while ((up = glist_first_entry(queue, struct glusterfs_upcall,
+				       list)) != NULL) {
+		glist_del(&up->list);
+
+		reason = glfs_upcall_get_reason(up->cbk);
+		if (!process) {
+			/* Shutting down */
+		} else if (reason == GLFS_UPCALL_INODE_INVALIDATE) {
+			in_arg = glfs_upcall_get_event(up->cbk);
+			if (in_arg) {
+				upcall_batch_invalidate(gl_fs, &batch,
+					glfs_upcall_inode_get_object(in_arg));
+				upcall_batch_invalidate(gl_fs, &batch,
+					glfs_upcall_inode_get_pobject(in_arg));
+				upcall_batch_invalidate(gl_fs, &batch,
+					glfs_upcall_inode_get_oldpobject(
+								in_arg));
+			} else {
+				/* Could be ENOMEM issues. continue */
+				LogWarn(COMPONENT_FSAL_UP,
+					"Received NULL upcall event arg");
+			}
+		} else if (reason != GLFS_UPCALL_EVENT_NULL) {
+			LogWarn(COMPONENT_FSAL_UP, "Unknown event: %d",
+				reason);
+		}
+
+		glfs_free(up->cbk);
+		gsh_free(up);
+	}
+}
+#endif /* USE_GLUSTER_UPCALL_REGISTER */
+
 void *GLUSTERFSAL_UP_Thread(void *Arg)
 {
 	struct glusterfs_fs         *gl_fs              = Arg;
 	struct fsal_up_vector *event_func;
 	char                        thr_name[16];
 	int                         rc                  = 0;
+	int                         errsv               = 0;
+#ifdef USE_GLUSTER_UPCALL_REGISTER
+	struct glist_head           batch;
+#else
 	struct glfs_upcall          *cbk                = NULL;
 	struct glfs_upcall_inode    *in_arg             = NULL;
 	enum glfs_upcall_reason     reason              = 0;
 	int                         retry               = 0;
-	int                         errsv               = 0;
 	struct glfs_object          *object             = NULL;
 	struct glfs_object          *p_object           = NULL;
 	struct glfs_object          *oldp_object        = NULL;
-
+#endif
 
 	snprintf(thr_name, sizeof(thr_name),
 		 "fsal_up_%p",
@@ -143,8 +298,59 @@ void *GLUSTERFSAL_UP_Thread(void *Arg)
 	/* wait for upcall readiness */
 	up_ready_wait(event_func);
 
+#ifdef USE_GLUSTER_UPCALL_REGISTER
+	glist_init(&batch);
+
+	/* gfapi hands upcalls to glusterfs_upcall_cbk() as they arrive, so
+	 * sleep until there are some and process whatever has piled up.
+	 */
+	rc = glfs_upcall_register(gl_fs->fs, GLFS_EVENT_INODE_INVALIDATE,
+				  glusterfs_upcall_cbk, gl_fs);
+	if (rc < 0) {
+		errsv = errno;
+		if (errsv == ENOTSUP)
+			LogEvent(COMPONENT_FSAL_UP,
+				 "Upcall feature is not supported for (%p).",
+				 gl_fs->fs);
+		else
+			LogCrit(COMPONENT_FSAL_UP,
+				"Upcall registration failed for %p. rc %d errno %d (%s)",
+				gl_fs->fs, rc, errsv, strerror(errsv));
+		goto out;
+	}
+
+	PTHREAD_MUTEX_lock(&gl_fs->up_lock);
+
+	while (!atomic_fetch_int8_t(&gl_fs->destroy_mode)) {
+		if (glist_empty(&gl_fs->up_queue)) {
+			pthread_cond_wait(&gl_fs->up_cond, &gl_fs->up_lock);
+			continue;
+		}
+
+		glist_splice_tail(&batch, &gl_fs->up_queue);
+		PTHREAD_MUTEX_unlock(&gl_fs->up_lock);
+
+		LogFullDebug(COMPONENT_FSAL_UP,
+			     "Processing upcall events for %p.",
+			     gl_fs->fs);
+		upcall_process_queue(gl_fs, &batch, true);
+
+		PTHREAD_MUTEX_lock(&gl_fs->up_lock);
+	}
+
+	PTHREAD_MUTEX_unlock(&gl_fs->up_lock);
+
+	(void) glfs_upcall_unregister(gl_fs->fs, GLFS_EVENT_ANY);
+
+	/* Anything gfapi queued after destroy_mode was set is dropped by
+	 * glusterfs_upcall_cbk(), so this empties the queue for good.
+	 */
+	PTHREAD_MUTEX_lock(&gl_fs->up_lock);
+	glist_splice_tail(&batch, &gl_fs->up_queue);
+	PTHREAD_MUTEX_unlock(&gl_fs->up_lock);
+	upcall_process_queue(gl_fs, &batch, false);
+#else /* USE_GLUSTER_UPCALL_REGISTER */
 	/* Start querying for events and processing. */
-	/** @todo : Do batch processing instead */
 	while (!atomic_fetch_int8_t(&gl_fs->destroy_mode)) {
 		LogFullDebug(COMPONENT_FSAL_UP,
 			     "Requesting event from FSAL Callback interface for %p.",
@@ -233,6 +439,7 @@ void *GLUSTERFSAL_UP_Thread(void *Arg)
 			cbk = NULL;
 		}
 	}
+#endif /* USE_GLUSTER_UPCALL_REGISTER */
 
 out:
 	return NULL;
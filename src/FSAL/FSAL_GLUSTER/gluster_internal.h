@@ -137,6 +137,11 @@ struct glusterfs_fs {
 	int64_t    refcnt;
 	pthread_t  up_thread; /* upcall thread */
 	int8_t destroy_mode;
+#ifdef USE_GLUSTER_UPCALL_REGISTER
+	pthread_mutex_t up_lock; /* protects up_queue */
+	pthread_cond_t up_cond; /* signalled when up_queue grows */
+	struct glist_head up_queue; /* upcalls handed over by gfapi */
+#endif
 };
 
 struct glusterfs_export {
@@ -159,6 +164,8 @@ struct glusterfs_fd {
 	/** Gluster file descriptor. */
 	struct glfs_fd *glfd;
 	struct user_cred creds; /* user creds opening fd*/
+	/** Asynchronous I/Os still using glfd */
+	uint32_t inflight;
 };
 
 struct glusterfs_handle {
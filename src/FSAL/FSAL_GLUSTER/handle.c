@@ -33,6 +33,9 @@
 #include "pnfs_utils.h"
 #include "nfs_exports.h"
 #include "sal_data.h"
+#ifdef USE_LTTNG
+#include "gsh_lttng/fsal.h"
+#endif
 
 /* fsal_obj_handle common methods
  */
@@ -114,6 +117,10 @@ static fsal_status_t lookup(struct fsal_obj_handle *parent,
 	now(&s_time);
 #endif
 
+#ifdef USE_LTTNG
+	tracepoint(fsal, lookup_start, parent->fsal->name, parent, path);
+#endif
+
 	glhandle = glfs_h_lookupat(glfs_export->gl_fs->fs,
 				parenthandle->glhandle, path, &sb, 0);
 	if (glhandle == NULL) {
@@ -150,6 +157,11 @@ static fsal_status_t lookup(struct fsal_obj_handle *parent,
 	now(&e_time);
 	latency_update(&s_time, &e_time, lat_lookup);
 #endif
+#ifdef USE_LTTNG
+	tracepoint(fsal, lookup_end, parent,
+		   status.major == ERR_FSAL_NO_ERROR ? *handle : NULL,
+		   status.major, status.minor);
+#endif
 
 	return status;
 }
@@ -1085,6 +1097,10 @@ out:
 	return status;
 }
 
+/** Guards the inflight counts of all glusterfs_fds */
+static pthread_mutex_t glusterfs_io_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t glusterfs_io_cv = PTHREAD_COND_INITIALIZER;
+
 fsal_status_t glusterfs_close_my_fd(struct glusterfs_fd *my_fd)
 {
 	int rc = 0;
@@ -1098,6 +1114,14 @@ fsal_status_t glusterfs_close_my_fd(struct glusterfs_fd *my_fd)
 	now(&s_time);
 #endif
 
+	/* An asynchronous I/O may still be using the fd after the caller
+	 * that started it dropped the object lock.
+	 */
+	PTHREAD_MUTEX_lock(&glusterfs_io_mtx);
+	while (my_fd->inflight != 0)
+		pthread_cond_wait(&glusterfs_io_cv, &glusterfs_io_mtx);
+	PTHREAD_MUTEX_unlock(&glusterfs_io_mtx);
+
 	if (my_fd->glfd && my_fd->openflags != FSAL_O_CLOSED) {
 
 		/* Use the same credentials which opened up the fd */
@@ -1896,9 +1920,19 @@ static fsal_status_t glusterfs_read2(struct fsal_obj_handle *obj_hdl,
 			  op_ctx->creds->caller_glen,
 			  op_ctx->creds->caller_garray);
 
+#ifdef USE_LTTNG
+	tracepoint(fsal, io_start, obj_hdl->fsal->name, obj_hdl, 0,
+		   seek_descriptor, buffer_size);
+#endif
+
 	nb_read = glfs_pread(my_fd.glfd, buffer, buffer_size,
 			     seek_descriptor, 0);
 
+#ifdef USE_LTTNG
+	tracepoint(fsal, io_end, obj_hdl, 0, nb_read,
+		   nb_read == -1 ? errno : 0);
+#endif
+
 	/* restore credentials */
 	SET_GLUSTER_CREDS(glfs_export, NULL, NULL, 0, NULL);
 
@@ -1940,18 +1974,18 @@ static fsal_status_t glusterfs_read2(struct fsal_obj_handle *obj_hdl,
 
 }
 
-/* write2
+/* writev2
  */
 
-static fsal_status_t glusterfs_write2(struct fsal_obj_handle *obj_hdl,
-				      bool bypass,
-				      struct state_t *state,
-				      uint64_t seek_descriptor,
-				      size_t buffer_size,
-				      void *buffer,
-				      size_t *write_amount,
-				      bool *fsal_stable,
-				      struct io_info *info)
+static fsal_status_t glusterfs_writev2(struct fsal_obj_handle *obj_hdl,
+				       bool bypass,
+				       struct state_t *state,
+				       uint64_t seek_descriptor,
+				       const struct iovec *iov,
+				       int iovcnt,
+				       size_t *write_amount,
+				       bool *fsal_stable,
+				       struct io_info *info)
 {
 	ssize_t nb_written;
 	fsal_status_t status;
@@ -1991,8 +2025,18 @@ static fsal_status_t glusterfs_write2(struct fsal_obj_handle *obj_hdl,
 			  op_ctx->creds->caller_glen,
 			  op_ctx->creds->caller_garray);
 
-	nb_written = glfs_pwrite(my_fd.glfd, buffer, buffer_size,
-			     seek_descriptor, ((*fsal_stable) ? O_SYNC : 0));
+#ifdef USE_LTTNG
+	tracepoint(fsal, io_start, obj_hdl->fsal->name, obj_hdl, 1,
+		   seek_descriptor, fsal_iov_length(iov, iovcnt));
+#endif
+
+	nb_written = glfs_pwritev(my_fd.glfd, iov, iovcnt, seek_descriptor,
+				  ((*fsal_stable) ? O_SYNC : 0));
+
+#ifdef USE_LTTNG
+	tracepoint(fsal, io_end, obj_hdl, 1, nb_written,
+		   nb_written == -1 ? errno : 0);
+#endif
 
 	/* restore credentials */
 	SET_GLUSTER_CREDS(glfs_export, NULL, NULL, 0, NULL);
@@ -2016,6 +2060,335 @@ static fsal_status_t glusterfs_write2(struct fsal_obj_handle *obj_hdl,
 	return status;
 }
 
+/* write2
+ */
+
+static fsal_status_t glusterfs_write2(struct fsal_obj_handle *obj_hdl,
+				      bool bypass,
+				      struct state_t *state,
+				      uint64_t seek_descriptor,
+				      size_t buffer_size,
+				      void *buffer,
+				      size_t *write_amount,
+				      bool *fsal_stable,
+				      struct io_info *info)
+{
+	struct iovec iov = {
+		.iov_base = buffer,
+		.iov_len = buffer_size,
+	};
+
+	return glusterfs_writev2(obj_hdl, bypass, state, seek_descriptor,
+				 &iov, 1, write_amount, fsal_stable, info);
+}
+
+/**
+ * @brief A read or write handed to gfapi without waiting for it
+ */
+struct glusterfs_async_io {
+	struct fsal_obj_handle *obj_hdl;
+	struct glusterfs_fd *stored;	/*< fd in use, NULL if temporary */
+	size_t size;			/*< Bytes asked for */
+	size_t *amount;			/*< Bytes read or written */
+	bool *end_of_file;		/*< Reads only */
+	fsal_async_cb done_cb;
+	void *caller_data;
+};
+
+static void glusterfs_async_io_finish(struct glusterfs_async_io *gio,
+				      ssize_t ret, int err)
+{
+	fsal_status_t status = fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+#ifdef USE_LTTNG
+	tracepoint(fsal, async_io_end, gio, ret, ret < 0 ? err : 0);
+#endif
+
+	if (ret < 0) {
+		status = gluster2fsal_error(err);
+	} else {
+		*gio->amount = ret;
+		if (gio->end_of_file != NULL)
+			*gio->end_of_file = ret < gio->size;
+	}
+
+	if (gio->stored != NULL) {
+		PTHREAD_MUTEX_lock(&glusterfs_io_mtx);
+		if (--gio->stored->inflight == 0)
+			pthread_cond_broadcast(&glusterfs_io_cv);
+		PTHREAD_MUTEX_unlock(&glusterfs_io_mtx);
+	}
+
+	gio->done_cb(gio->obj_hdl, status, gio->caller_data);
+	gsh_free(gio);
+}
+
+/**
+ * @brief gfapi completion of an asynchronous I/O
+ *
+ * Called from a gfapi thread with errno set from the fop.
+ */
+static void glusterfs_async_io_done(struct glfs_fd *glfd, ssize_t ret,
+				    void *data)
+{
+	glusterfs_async_io_finish(data, ret, errno);
+}
+
+/**
+ * @brief Start an asynchronous read or write
+ *
+ * The fd is found as for a blocking call.  A stored fd is pinned by
+ * its inflight count so the object lock can be dropped before gfapi
+ * completes the fop.  A temporary fd would have to be closed from the
+ * gfapi callback, so that case just does the blocking call.
+ *
+ * @param[in] gio        The I/O, output parameters and callback filled in
+ * @param[in] bypass     Bypass any non-mandatory deny
+ * @param[in] state      state_t to use for this operation
+ * @param[in] offset     Position of the I/O
+ * @param[in] buffer     Data to write, or room for the data read
+ * @param[in] write      true for a write
+ * @param[in] flags      O_SYNC for a stable write
+ */
+static void glusterfs_async_io_start(struct glusterfs_async_io *gio,
+				     bool bypass, struct state_t *state,
+				     uint64_t offset, void *buffer,
+				     bool write, int flags)
+{
+	struct glusterfs_handle *myself =
+		container_of(gio->obj_hdl, struct glusterfs_handle, handle);
+	struct glusterfs_export *glfs_export =
+	    container_of(op_ctx->fsal_export, struct glusterfs_export, export);
+	struct glusterfs_fd tmp_fd = {0}, *out_fd = &tmp_fd;
+	fsal_status_t status;
+	bool has_lock = false;
+	bool closefd = false;
+	ssize_t ret;
+	int err = 0;
+
+	status = fsal_find_fd((struct fsal_fd **)&out_fd, gio->obj_hdl,
+			      (struct fsal_fd *)&myself->globalfd,
+			      &myself->share, bypass, state,
+			      write ? FSAL_O_WRITE : FSAL_O_READ,
+			      glusterfs_open_func, glusterfs_close_func,
+			      &has_lock, &closefd, false);
+
+	if (FSAL_IS_ERROR(status)) {
+		gio->done_cb(gio->obj_hdl, status, gio->caller_data);
+		gsh_free(gio);
+		return;
+	}
+
+	if (!closefd) {
+		gio->stored = out_fd;
+		PTHREAD_MUTEX_lock(&glusterfs_io_mtx);
+		out_fd->inflight++;
+		PTHREAD_MUTEX_unlock(&glusterfs_io_mtx);
+
+		if (has_lock)
+			PTHREAD_RWLOCK_unlock(&gio->obj_hdl->obj_lock);
+	}
+
+	SET_GLUSTER_CREDS(glfs_export, &op_ctx->creds->caller_uid,
+			  &op_ctx->creds->caller_gid,
+			  op_ctx->creds->caller_glen,
+			  op_ctx->creds->caller_garray);
+
+#ifdef USE_LTTNG
+	tracepoint(fsal, async_io_start, gio->obj_hdl->fsal->name, gio,
+		   gio->obj_hdl, write, offset, gio->size);
+#endif
+
+	if (closefd) {
+		if (write)
+			ret = glfs_pwrite(out_fd->glfd, buffer, gio->size,
+					  offset, flags);
+		else
+			ret = glfs_pread(out_fd->glfd, buffer, gio->size,
+					 offset, 0);
+	} else {
+		if (write)
+			ret = glfs_pwrite_async(out_fd->glfd, buffer,
+						gio->size, offset, flags,
+						glusterfs_async_io_done, gio);
+		else
+			ret = glfs_pread_async(out_fd->glfd, buffer,
+					       gio->size, offset, 0,
+					       glusterfs_async_io_done, gio);
+	}
+
+	if (ret < 0)
+		err = errno;
+
+	/* restore credentials */
+	SET_GLUSTER_CREDS(glfs_export, NULL, NULL, 0, NULL);
+
+	if (closefd) {
+		glusterfs_close_my_fd(out_fd);
+		if (has_lock)
+			PTHREAD_RWLOCK_unlock(&gio->obj_hdl->obj_lock);
+		glusterfs_async_io_finish(gio, ret, err);
+	} else if (ret < 0) {
+		/* Not started, so no completion is coming */
+		glusterfs_async_io_finish(gio, ret, err);
+	}
+}
+
+/**
+ * @brief Read data from a file without waiting for gfapi
+ *
+ * As glusterfs_read2, except that done_cb is called when gfapi
+ * completes the read.
+ */
+static void glusterfs_read2_async(struct fsal_obj_handle *obj_hdl,
+				  bool bypass,
+				  struct state_t *state,
+				  uint64_t offset,
+				  size_t buffer_size,
+				  void *buffer,
+				  size_t *read_amount,
+				  bool *end_of_file,
+				  struct io_info *info,
+				  fsal_async_cb done_cb,
+				  void *caller_data)
+{
+	struct glusterfs_async_io *gio;
+
+	if (info != NULL) {
+		/* Currently we don't support READ_PLUS */
+		done_cb(obj_hdl, fsalstat(ERR_FSAL_NOTSUPP, 0), caller_data);
+		return;
+	}
+
+	gio = gsh_calloc(1, sizeof(*gio));
+	gio->obj_hdl = obj_hdl;
+	gio->size = buffer_size;
+	gio->amount = read_amount;
+	gio->end_of_file = end_of_file;
+	gio->done_cb = done_cb;
+	gio->caller_data = caller_data;
+
+	glusterfs_async_io_start(gio, bypass, state, offset, buffer,
+				 false, 0);
+}
+
+/**
+ * @brief Write data to a file without waiting for gfapi
+ *
+ * As glusterfs_write2, except that done_cb is called when gfapi
+ * completes the write.
+ */
+static void glusterfs_write2_async(struct fsal_obj_handle *obj_hdl,
+				   bool bypass,
+				   struct state_t *state,
+				   uint64_t offset,
+				   size_t buffer_size,
+				   void *buffer,
+				   size_t *wrote_amount,
+				   bool *fsal_stable,
+				   struct io_info *info,
+				   fsal_async_cb done_cb,
+				   void *caller_data)
+{
+	struct glusterfs_async_io *gio;
+
+	if (info != NULL) {
+		/* Currently we don't support WRITE_PLUS */
+		done_cb(obj_hdl, fsalstat(ERR_FSAL_NOTSUPP, 0), caller_data);
+		return;
+	}
+
+	gio = gsh_calloc(1, sizeof(*gio));
+	gio->obj_hdl = obj_hdl;
+	gio->size = buffer_size;
+	gio->amount = wrote_amount;
+	gio->done_cb = done_cb;
+	gio->caller_data = caller_data;
+
+	glusterfs_async_io_start(gio, bypass, state, offset, buffer,
+				 true, *fsal_stable ? O_SYNC : 0);
+}
+
+#ifdef USE_GLUSTER_COPY_FILE_RANGE
+/* copy
+ */
+
+static fsal_status_t glusterfs_copy(struct fsal_obj_handle *dst_hdl,
+				    struct state_t *dst_state,
+				    uint64_t dst_offset,
+				    struct fsal_obj_handle *src_hdl,
+				    struct state_t *src_state,
+				    uint64_t src_offset,
+				    uint64_t count,
+				    uint64_t *copied)
+{
+	ssize_t nb_copied;
+	fsal_status_t status;
+	int retval = 0;
+	struct glusterfs_fd src_fd = {0}, dst_fd = {0};
+	bool src_lock = false, dst_lock = false;
+	bool src_close = false, dst_close = false;
+	off64_t src_off = src_offset, dst_off = dst_offset;
+	struct stat sb;
+	struct glusterfs_export *glfs_export =
+	     container_of(op_ctx->fsal_export, struct glusterfs_export, export);
+
+	status = find_fd(&src_fd, src_hdl, false, src_state, FSAL_O_READ,
+			 &src_lock, &src_close, false);
+
+	if (FSAL_IS_ERROR(status))
+		return status;
+
+	status = find_fd(&dst_fd, dst_hdl, false, dst_state, FSAL_O_WRITE,
+			 &dst_lock, &dst_close, false);
+
+	if (FSAL_IS_ERROR(status))
+		goto out;
+
+	if (count == 0)
+		count = SSIZE_MAX;
+
+	SET_GLUSTER_CREDS(glfs_export, &op_ctx->creds->caller_uid,
+			  &op_ctx->creds->caller_gid,
+			  op_ctx->creds->caller_glen,
+			  op_ctx->creds->caller_garray);
+
+	nb_copied = glfs_copy_file_range(src_fd.glfd, &src_off,
+					 dst_fd.glfd, &dst_off,
+					 count, 0, &sb, NULL, NULL);
+
+	/* restore credentials */
+	SET_GLUSTER_CREDS(glfs_export, NULL, NULL, 0, NULL);
+
+	if (nb_copied == -1) {
+		retval = errno;
+		if (retval == ENOSYS || retval == EXDEV)
+			status = fsalstat(ERR_FSAL_NOTSUPP, retval);
+		else
+			status = fsalstat(posix2fsal_error(retval), retval);
+		goto out;
+	}
+
+	*copied = nb_copied;
+
+ out:
+
+	if (dst_close)
+		glusterfs_close_my_fd(&dst_fd);
+
+	if (dst_lock)
+		PTHREAD_RWLOCK_unlock(&dst_hdl->obj_lock);
+
+	if (src_close)
+		glusterfs_close_my_fd(&src_fd);
+
+	if (src_lock)
+		PTHREAD_RWLOCK_unlock(&src_hdl->obj_lock);
+
+	return status;
+}
+#endif
+
 /* commit2
  */
 
@@ -2711,6 +3084,12 @@ void handle_ops_init(struct fsal_obj_ops *ops)
 	ops->reopen2 = glusterfs_reopen2;
 	ops->read2 = glusterfs_read2;
 	ops->write2 = glusterfs_write2;
+	ops->writev2 = glusterfs_writev2;
+	ops->read2_async = glusterfs_read2_async;
+	ops->write2_async = glusterfs_write2_async;
+#ifdef USE_GLUSTER_COPY_FILE_RANGE
+	ops->copy = glusterfs_copy;
+#endif
 	ops->commit2 = glusterfs_commit2;
 	ops->lock_op2 = glusterfs_lock_op2;
 	ops->setattr2 = glusterfs_setattr2;
@@ -485,7 +485,7 @@ static void free_gpfs_filesystem(struct gpfs_filesystem *gpfs_fs)
 {
 	if (gpfs_fs->root_fd >= 0)
 		close(gpfs_fs->root_fd);
-	PTHREAD_MUTEX_destroy(&gpfs_fs->upvector_mutex);
+	PTHREAD_RWLOCK_destroy(&gpfs_fs->upvector_lock);
 	gsh_free(gpfs_fs);
 }
 
@@ -589,17 +589,18 @@ int gpfs_claim_filesystem(struct fsal_filesystem *fs, struct fsal_export *exp)
 		glist_init(&gpfs_fs->exports);
 		gpfs_fs->root_fd = -1;
 		gpfs_fs->fs = fs;
-		PTHREAD_MUTEX_init(&gpfs_fs->upvector_mutex, NULL);
+		gpfs_fs->up_threads = gpfs_staticinfo(exp->fsal)->up_threads;
+		PTHREAD_RWLOCK_init(&gpfs_fs->upvector_lock, NULL);
 	}
 
 	/* Now map the file system and export */
 	map = gsh_calloc(1, sizeof(*map));
 	map->fs = gpfs_fs;
 	map->exp = container_of(exp, struct gpfs_fsal_export, export);
-	PTHREAD_MUTEX_lock(&gpfs_fs->upvector_mutex);
+	PTHREAD_RWLOCK_wrlock(&gpfs_fs->upvector_lock);
 	glist_add_tail(&gpfs_fs->exports, &map->on_exports);
 	glist_add_tail(&map->exp->filesystems, &map->on_filesystems);
-	PTHREAD_MUTEX_unlock(&gpfs_fs->upvector_mutex);
+	PTHREAD_RWLOCK_unlock(&gpfs_fs->upvector_lock);
 
 	map->exp->export_fd = open(op_ctx->ctx_export->fullpath,
 						O_RDONLY | O_DIRECTORY);
@@ -663,10 +664,10 @@ errout:
 		close(map->exp->export_fd);
 		map->exp->export_fd = -1;
 	}
-	PTHREAD_MUTEX_lock(&gpfs_fs->upvector_mutex);
+	PTHREAD_RWLOCK_wrlock(&gpfs_fs->upvector_lock);
 	glist_del(&map->on_filesystems);
 	glist_del(&map->on_exports);
-	PTHREAD_MUTEX_unlock(&gpfs_fs->upvector_mutex);
+	PTHREAD_RWLOCK_unlock(&gpfs_fs->upvector_lock);
 	gsh_free(map);
 	if (!fs->private_data)
 		free_gpfs_filesystem(gpfs_fs);
@@ -694,10 +695,10 @@ void gpfs_unclaim_filesystem(struct fsal_filesystem *fs)
 				  on_exports);
 
 		/* Remove this file system from mapping */
-		PTHREAD_MUTEX_lock(&map->fs->upvector_mutex);
+		PTHREAD_RWLOCK_wrlock(&map->fs->upvector_lock);
 		glist_del(&map->on_filesystems);
 		glist_del(&map->on_exports);
-		PTHREAD_MUTEX_unlock(&map->fs->upvector_mutex);
+		PTHREAD_RWLOCK_unlock(&map->fs->upvector_lock);
 
 		if (map->exp->root_fs == fs)
 			LogInfo(COMPONENT_FSAL,
@@ -743,10 +744,10 @@ void gpfs_unexport_filesystems(struct gpfs_fsal_export *exp)
 				  on_filesystems);
 
 		/* Remove this export from mapping */
-		PTHREAD_MUTEX_lock(&map->fs->upvector_mutex);
+		PTHREAD_RWLOCK_wrlock(&map->fs->upvector_lock);
 		glist_del(&map->on_filesystems);
 		glist_del(&map->on_exports);
-		PTHREAD_MUTEX_unlock(&map->fs->upvector_mutex);
+		PTHREAD_RWLOCK_unlock(&map->fs->upvector_lock);
 
 		if (glist_empty(&map->fs->exports)) {
 			LogInfo(COMPONENT_FSAL,
@@ -1179,6 +1179,23 @@ fsal_status_t gpfs_seek(struct fsal_obj_handle *obj_hdl, struct io_info *info)
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
+/**
+ *  @brief GPFS seek2 command
+ *
+ *  Same as gpfs_seek, which uses the global fd.
+ *
+ *  @param obj_hdl FSAL object handle
+ *  @param state   state_t for the operation (unused)
+ *  @param io_info I/O information
+ *  @return FSAL status
+ */
+fsal_status_t gpfs_seek2(struct fsal_obj_handle *obj_hdl,
+			 struct state_t *state,
+			 struct io_info *info)
+{
+	return gpfs_seek(obj_hdl, info);
+}
+
 /**
  *  @brief GPFS IO advise
  *
@@ -290,6 +290,14 @@ fsal_status_t GPFSFSAL_lookup(const struct req_op_context *p_context,
 			      struct gpfs_file_handle *fh,
 			      struct fsal_filesystem **new_fs);
 
+fsal_status_t GPFSFSAL_lookup_at(const struct req_op_context *p_context,
+				 struct fsal_obj_handle *parent,
+				 int parent_fd,
+				 const char *p_filename,
+				 struct attrlist *p_object_attr,
+				 struct gpfs_file_handle *fh,
+				 struct fsal_filesystem **new_fs);
+
 fsal_status_t GPFSFSAL_lock_op(struct fsal_export *export,
 			       fsal_lock_op_t lock_op,
 			       fsal_lock_param_t *req_lock,
@@ -27,44 +27,540 @@
 #include "fsal_convert.h"
 #include "gpfs_methods.h"
 #include "nfs_init.h"
+#include "city.h"
 #include <sys/types.h>
 #include <unistd.h>
 #include <utime.h>
 #include <sys/time.h>
 
-/* Setup up_vector. File system's upvector_mutex must be held */
-static bool setup_up_vector(struct gpfs_filesystem *gpfs_fs)
+/* Find the up_vector of one of the file system's exports and set up
+ * the calling thread's op_ctx for it.  File system's upvector_lock must
+ * be held.
+ */
+static struct fsal_up_vector *setup_up_vector(struct gpfs_filesystem *gpfs_fs,
+					      struct req_op_context *req_ctx)
 {
 	struct gpfs_filesystem_export_map *map;
+	struct fsal_up_vector *up_vector;
 
 	map = glist_first_entry(&gpfs_fs->exports,
 				struct gpfs_filesystem_export_map, on_exports);
 	if (!map)
-		return false;
+		return NULL;
 
-	gpfs_fs->up_vector = (struct fsal_up_vector *)map->exp->export.up_ops;
+	up_vector = (struct fsal_up_vector *)map->exp->export.up_ops;
 
 	/* wait for upcall readiness */
-	up_ready_wait(gpfs_fs->up_vector);
+	up_ready_wait(up_vector);
 
 	/* Set up op_ctx for the thread */
-	op_ctx = &gpfs_fs->req_ctx;
-	op_ctx->fsal_export = gpfs_fs->up_vector->up_fsal_export;
-	op_ctx->ctx_export = gpfs_fs->up_vector->up_gsh_export;
+	op_ctx = req_ctx;
+	op_ctx->fsal_export = up_vector->up_fsal_export;
+	op_ctx->ctx_export = up_vector->up_gsh_export;
+
+	return up_vector;
+}
+
+/**
+ * @brief An upcall waiting for an upcall worker
+ */
+struct gpfs_up_event {
+	struct glist_head list;
+	int reason;
+	int flags;
+	uint32_t expire_time_attr;
+	struct stat buf;
+	struct glock fl;
+	struct pnfs_deviceid devid;
+	struct gpfs_file_handle handle;
+};
+
+/**
+ * @brief Upcall worker
+ *
+ * Events are hashed to a worker by file handle, so the events for an
+ * object are processed in the order GPFS sent them, while events for
+ * different objects are processed in parallel.
+ */
+struct gpfs_up_worker {
+	struct gpfs_filesystem *gpfs_fs;
+	pthread_t thread;
+	pthread_mutex_t lock;		/*< Protects queue and stop */
+	pthread_cond_t cond;		/*< Signalled when queue grows */
+	struct glist_head queue;	/*< Events still to process */
+	bool stop;			/*< Exit once queue is empty */
+	struct req_op_context req_ctx;	/*< op_ctx of the worker */
+	unsigned int index;
+};
+
+/**
+ * How far back in a worker's queue to look for an invalidate to fold a
+ * new one into.  Bounds the cost of queueing during a burst.
+ */
+#define GPFS_UP_COALESCE_DEPTH 64
+
+/**
+ * @brief How thoroughly an event invalidates its object
+ *
+ * @return 2 for invalidate_close, 1 for invalidate, 0 for an event that
+ *         must not be folded into another.
+ */
+static int gpfs_up_inval_level(int reason, int flags)
+{
+	if (reason == INODE_INVALIDATE)
+		return 2;
+
+	if (reason == INODE_UPDATE &&
+	    ((flags & (UP_SIZE | UP_SIZE_BIG)) ||
+	     (flags & ~(UP_SIZE | UP_NLINK | UP_MODE | UP_OWN | UP_TIMES |
+			UP_ATIME | UP_SIZE_BIG))))
+		return 1;
+
+	return 0;
+}
+
+/**
+ * @brief Process one upcall
+ *
+ * @param[in] event_func Up vector of one of the file system's exports
+ * @param[in] ev         The event
+ *
+ * @return Status of the upcall.
+ */
+static fsal_status_t gpfs_up_process(struct fsal_up_vector *event_func,
+				     struct gpfs_up_event *ev)
+{
+	int reason = ev->reason;
+	int flags = ev->flags;
+	uint32_t expire_time_attr = ev->expire_time_attr;
+	struct pnfs_deviceid devid = ev->devid;
+	struct gsh_buffdesc key;
+	uint32_t upflags;
+	fsal_status_t fsal_status = {0,};
+
+	key.addr = &ev->handle;
+	key.len = ev->handle.handle_key_size;
+
+	switch (reason) {
+	case INODE_LOCK_GRANTED:	/* Lock Event */
+	case INODE_LOCK_AGAIN:	/* Lock Event */
+		{
+			LogMidDebug(COMPONENT_FSAL_UP,
+				    "%s: owner %p pid %d type %d start %lld len %lld",
+				    reason ==
+				    INODE_LOCK_GRANTED ?
+				    "inode lock granted" :
+				    "inode lock again", ev->fl.lock_owner,
+				    ev->fl.flock.l_pid, ev->fl.flock.l_type,
+				    (long long)ev->fl.flock.l_start,
+				    (long long)ev->fl.flock.l_len);
+
+			fsal_lock_param_t lockdesc = {
+				.lock_sle_type = FSAL_POSIX_LOCK,
+				.lock_type = ev->fl.flock.l_type,
+				.lock_start = ev->fl.flock.l_start,
+				.lock_length = ev->fl.flock.l_len
+			};
+			if (reason == INODE_LOCK_AGAIN)
+				fsal_status = up_async_lock_avail(
+						 general_fridge,
+						 event_func,
+						 &key,
+						 ev->fl.lock_owner,
+						 &lockdesc, NULL, NULL);
+			else
+				fsal_status = up_async_lock_grant(
+						 general_fridge,
+						 event_func,
+						 &key,
+						 ev->fl.lock_owner,
+						 &lockdesc, NULL, NULL);
+		}
+		break;
+
+	case BREAK_DELEGATION:	/* Delegation Event */
+		LogDebug(COMPONENT_FSAL_UP,
+			 "delegation recall: flags:%x ino %" PRId64,
+			 flags, ev->buf.st_ino);
+		fsal_status = up_async_delegrecall(general_fridge,
+					  event_func,
+					  &key, NULL, NULL);
+		break;
+
+	case LAYOUT_FILE_RECALL:	/* Layout file recall Event */
+		{
+			struct pnfs_segment segment = {
+				.offset = 0,
+				.length = UINT64_MAX,
+				.io_mode = LAYOUTIOMODE4_ANY
+			};
+			LogDebug(COMPONENT_FSAL_UP,
+				 "layout file recall: flags:%x ino %"
+				 PRId64, flags, ev->buf.st_ino);
+
+			fsal_status = up_async_layoutrecall(
+						general_fridge,
+						event_func,
+						&key,
+						LAYOUT4_NFSV4_1_FILES,
+						false, &segment,
+						NULL, NULL, NULL,
+						NULL);
+		}
+		break;
+
+	case LAYOUT_RECALL_ANY:	/* Recall all layouts Event */
+		LogDebug(COMPONENT_FSAL_UP,
+			 "layout recall any: flags:%x ino %" PRId64,
+			 flags, ev->buf.st_ino);
+
+    /**
+     * @todo This functionality needs to be implemented as a
+     * bulk FSID CB_LAYOUTRECALL.  RECALL_ANY isn't suitable
+     * since it can't be restricted to just one FSAL.  Also
+     * an FSID LAYOUTRECALL lets you have multiplke
+     * filesystems exported from one FSAL and not yank layouts
+     * on all of them when you only need to recall them for one.
+     */
+		break;
+
+	case LAYOUT_NOTIFY_DEVICEID:	/* Device update Event */
+		LogDebug(COMPONENT_FSAL_UP,
+			 "layout dev update: flags:%x ino %"
+			 PRId64 " seq %d fd %d fsid 0x%" PRIx64,
+			 flags,
+			ev->buf.st_ino,
+			devid.device_id2,
+			devid.device_id4,
+			devid.devid);
+
+		memset(&devid, 0, sizeof(devid));
+		devid.fsal_id = FSAL_ID_GPFS;
+
+		fsal_status = up_async_notify_device(general_fridge,
+					event_func,
+					NOTIFY_DEVICEID4_DELETE_MASK,
+					LAYOUT4_NFSV4_1_FILES,
+					&devid,
+					true, NULL,
+					NULL);
+		break;
+
+	case INODE_UPDATE:	/* Update Event */
+		{
+			struct attrlist attr;
+
+			LogMidDebug(COMPONENT_FSAL_UP,
+				    "inode update: flags:%x update ino %"
+				    PRId64 " n_link:%d",
+				    flags, ev->buf.st_ino,
+				    (int)ev->buf.st_nlink);
+
+			/** @todo: This notification is completely
+			 * asynchronous.  If we happen to change some
+			 * of the attributes later, we end up over
+			 * writing those with these possibly stale
+			 * values as we don't know when we get to
+			 * update with these up call values. We should
+			 * probably use time stamp or let the up call
+			 * always provide UP_TIMES flag in which case
+			 * we can compare the current ctime vs up call
+			 * provided ctime before updating the
+			 * attributes.
+			 *
+			 * For now, we think size attribute is more
+			 * important than others, so invalidate the
+			 * attributes and let ganesha fetch attributes
+			 * as needed if this update includes a size
+			 * change. We are careless for other attribute
+			 * changes, and we may end up with stale values
+			 * until this gets fixed!
+			 */
+			if (flags & (UP_SIZE | UP_SIZE_BIG)) {
+				fsal_status = up_async_invalidate(
+					general_fridge, event_func, &key,
+					FSAL_UP_INVALIDATE_CACHE, NULL, NULL);
+				break;
+			}
+
+			/* Check for accepted flags, any other changes
+			   just invalidate. */
+			if (flags &
+			    ~(UP_SIZE | UP_NLINK | UP_MODE | UP_OWN |
+			     UP_TIMES | UP_ATIME | UP_SIZE_BIG)) {
+				fsal_status = up_async_invalidate(
+					general_fridge, event_func, &key,
+					FSAL_UP_INVALIDATE_CACHE, NULL, NULL);
+			} else {
+				/* buf may not have all attributes set.
+				 * Set the mask to what is changed
+				 */
+				attr.valid_mask = 0;
+				attr.acl = NULL;
+				upflags = 0;
+				if (flags & UP_SIZE)
+					attr.valid_mask |=
+					   ATTR_CHGTIME | ATTR_CHANGE |
+					   ATTR_SIZE | ATTR_SPACEUSED;
+				if (flags & UP_SIZE_BIG) {
+					attr.valid_mask |=
+					   ATTR_CHGTIME | ATTR_CHANGE |
+					   ATTR_SIZE | ATTR_SPACEUSED;
+					upflags |=
+					   fsal_up_update_filesize_inc |
+					   fsal_up_update_spaceused_inc;
+				}
+				if (flags & UP_MODE)
+					attr.valid_mask |=
+					   ATTR_CHGTIME | ATTR_CHANGE |
+					   ATTR_MODE;
+				if (flags & UP_OWN)
+					attr.valid_mask |=
+					   ATTR_CHGTIME | ATTR_CHANGE |
+					   ATTR_OWNER;
+				if (flags & UP_TIMES)
+					attr.valid_mask |=
+					   ATTR_CHGTIME | ATTR_CHANGE |
+					   ATTR_ATIME | ATTR_CTIME |
+					    ATTR_MTIME;
+				if (flags & UP_ATIME)
+					attr.valid_mask |=
+					   ATTR_CHGTIME | ATTR_CHANGE |
+					   ATTR_ATIME;
+				if (flags & UP_NLINK)
+					attr.valid_mask |=
+						ATTR_NUMLINKS;
+				attr.request_mask = attr.valid_mask;
+
+				attr.expire_time_attr =
+				    expire_time_attr;
+
+				posix2fsal_attributes(&ev->buf, &attr);
+				fsal_status = event_func->
+				    update(event_func,
+					   &key, &attr, upflags);
+
+				if ((flags & UP_NLINK)
+				    && (attr.numlinks == 0)) {
+					upflags = fsal_up_nlink;
+					attr.valid_mask = 0;
+					attr.request_mask = 0;
+					fsal_status = up_async_update
+					    (general_fridge,
+					     event_func,
+					     &key, &attr,
+					     upflags, NULL, NULL);
+				}
+			}
+		}
+		break;
+
+	case INODE_INVALIDATE:
+		LogMidDebug(COMPONENT_FSAL_UP,
+			    "inode invalidate: flags:%x update ino %"
+			    PRId64, flags, ev->buf.st_ino);
+
+		upflags = FSAL_UP_INVALIDATE_CACHE;
+		fsal_status = event_func->invalidate_close(
+					event_func,
+					&key,
+					upflags);
+		break;
+
+	default:
+		LogWarn(COMPONENT_FSAL_UP, "Unknown event: %d", reason);
+	}
+
+	return fsal_status;
+}
+
+/**
+ * @brief Upcall worker thread
+ *
+ * @param Arg The worker
+ */
+static void *gpfs_up_worker_thread(void *Arg)
+{
+	struct gpfs_up_worker *worker = Arg;
+	struct gpfs_filesystem *gpfs_fs = worker->gpfs_fs;
+	struct fsal_up_vector *event_func;
+	struct gpfs_up_event *ev;
+	fsal_status_t fsal_status;
+	char thr_name[16];
+
+	snprintf(thr_name, sizeof(thr_name), "fsal_up_%"PRIu64".%u",
+		 gpfs_fs->fs->dev.minor, worker->index);
+	SetNameFunction(thr_name);
+
+	PTHREAD_MUTEX_lock(&worker->lock);
+
+	while (true) {
+		ev = glist_first_entry(&worker->queue, struct gpfs_up_event,
+				       list);
+		if (ev == NULL) {
+			if (worker->stop)
+				break;
+			pthread_cond_wait(&worker->cond, &worker->lock);
+			continue;
+		}
+
+		glist_del(&ev->list);
+		PTHREAD_MUTEX_unlock(&worker->lock);
+
+		/* We need a valid up_vector while processing the event.
+		 * Hold the lock for the whole event so that the export
+		 * can't go away underneath it.
+		 */
+		PTHREAD_RWLOCK_rdlock(&gpfs_fs->upvector_lock);
+		event_func = setup_up_vector(gpfs_fs, &worker->req_ctx);
+		if (event_func != NULL)
+			fsal_status = gpfs_up_process(event_func, ev);
+		else
+			fsal_status = fsalstat(ERR_FSAL_NOENT, 0);
+		PTHREAD_RWLOCK_unlock(&gpfs_fs->upvector_lock);
 
-	return true;
+		if (FSAL_IS_ERROR(fsal_status) &&
+		    fsal_status.major != ERR_FSAL_NOENT) {
+			LogWarn(COMPONENT_FSAL_UP,
+				"Event %d could not be processed for fd %d rc %s",
+				ev->reason, gpfs_fs->root_fd,
+				fsal_err_txt(fsal_status));
+		}
+
+		gsh_free(ev);
+		PTHREAD_MUTEX_lock(&worker->lock);
+	}
+
+	PTHREAD_MUTEX_unlock(&worker->lock);
+
+	return NULL;
+}
+
+/**
+ * @brief Hand an event to the worker for its object
+ *
+ * An invalidate of an object that already has an invalidate queued is
+ * folded into the queued one; a queued invalidate is upgraded to
+ * invalidate_close if that is what the new one asks for.
+ *
+ * @param[in] worker The worker
+ * @param[in] ev     The event, consumed
+ */
+static void gpfs_up_queue(struct gpfs_up_worker *worker,
+			  struct gpfs_up_event *ev)
+{
+	int level = gpfs_up_inval_level(ev->reason, ev->flags);
+	struct glist_head *node;
+	struct gpfs_up_event *queued;
+	int depth = 0;
+
+	PTHREAD_MUTEX_lock(&worker->lock);
+
+	for (node = worker->queue.prev;
+	     level != 0 && node != &worker->queue &&
+	     depth < GPFS_UP_COALESCE_DEPTH;
+	     node = node->prev, depth++) {
+		queued = glist_entry(node, struct gpfs_up_event, list);
+
+		if (queued->handle.handle_key_size !=
+			ev->handle.handle_key_size ||
+		    memcmp(&queued->handle, &ev->handle,
+			   ev->handle.handle_key_size) != 0)
+			continue;
+
+		if (gpfs_up_inval_level(queued->reason, queued->flags) == 0)
+			/* Keep the invalidate ordered after this event */
+			break;
+
+		if (level == 2)
+			queued->reason = INODE_INVALIDATE;
+
+		LogFullDebug(COMPONENT_FSAL_UP,
+			     "Folded event %d into queued event %d",
+			     ev->reason, queued->reason);
+		PTHREAD_MUTEX_unlock(&worker->lock);
+		gsh_free(ev);
+		return;
+	}
+
+	glist_add_tail(&worker->queue, &ev->list);
+	pthread_cond_signal(&worker->cond);
+
+	PTHREAD_MUTEX_unlock(&worker->lock);
+}
+
+/**
+ * @brief Start the upcall workers of a file system
+ *
+ * @return The number of workers started.
+ */
+static unsigned int gpfs_up_workers_start(struct gpfs_filesystem *gpfs_fs,
+					  struct gpfs_up_worker *workers,
+					  unsigned int count)
+{
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < count; i++) {
+		struct gpfs_up_worker *worker = &workers[i];
+
+		worker->gpfs_fs = gpfs_fs;
+		worker->index = i;
+		glist_init(&worker->queue);
+		PTHREAD_MUTEX_init(&worker->lock, NULL);
+		PTHREAD_COND_init(&worker->cond, NULL);
+
+		rc = pthread_create(&worker->thread, NULL,
+				    gpfs_up_worker_thread, worker);
+		if (rc != 0) {
+			LogCrit(COMPONENT_THREAD,
+				"Could not create GPFS upcall worker, error = %d (%s)",
+				rc, strerror(rc));
+			PTHREAD_COND_destroy(&worker->cond);
+			PTHREAD_MUTEX_destroy(&worker->lock);
+			break;
+		}
+	}
+
+	return i;
+}
+
+/**
+ * @brief Let the upcall workers finish their queues, then reap them
+ */
+static void gpfs_up_workers_stop(struct gpfs_up_worker *workers,
+				 unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		PTHREAD_MUTEX_lock(&workers[i].lock);
+		workers[i].stop = true;
+		pthread_cond_signal(&workers[i].cond);
+		PTHREAD_MUTEX_unlock(&workers[i].lock);
+	}
+
+	for (i = 0; i < count; i++) {
+		pthread_join(workers[i].thread, NULL);
+		PTHREAD_COND_destroy(&workers[i].cond);
+		PTHREAD_MUTEX_destroy(&workers[i].lock);
+	}
+
+	gsh_free(workers);
 }
 
 /**
  * @brief Up Thread
  *
+ * Reads events from GPFS and hands them to the file system's upcall
+ * workers.
+ *
  * @param Arg reference to void
  *
  */
 void *GPFSFSAL_UP_Thread(void *Arg)
 {
 	struct gpfs_filesystem *gpfs_fs = Arg;
-	struct fsal_up_vector *event_func;
 	char thr_name[16];
 	int rc = 0;
 	struct pnfs_deviceid devid;
@@ -76,11 +572,11 @@ void *GPFSFSAL_UP_Thread(void *Arg)
 	int flags = 0;
 	unsigned int *fhP;
 	int retry = 0;
-	struct gsh_buffdesc key;
 	uint32_t expire_time_attr = 0;
-	uint32_t upflags;
 	int errsv = 0;
-	fsal_status_t fsal_status = {0,};
+	struct gpfs_up_worker *workers;
+	unsigned int nworkers;
+	struct gpfs_up_event *ev;
 
 #ifdef _VALGRIND_MEMCHECK
 		memset(&handle, 0, sizeof(handle));
@@ -103,6 +599,16 @@ void *GPFSFSAL_UP_Thread(void *Arg)
 	 */
 	nfs_init_wait();
 
+	nworkers = gpfs_fs->up_threads;
+	workers = gsh_calloc(nworkers, sizeof(*workers));
+	nworkers = gpfs_up_workers_start(gpfs_fs, workers, nworkers);
+	if (nworkers == 0) {
+		gsh_free(workers);
+		LogFatal(COMPONENT_FSAL_UP,
+			 "No upcall workers for %d.", gpfs_fs->root_fd);
+		return NULL;
+	}
+
 	/* Start querying for events and processing. */
 	while (1) {
 		LogFullDebug(COMPONENT_FSAL_UP,
@@ -134,7 +640,7 @@ void *GPFSFSAL_UP_Thread(void *Arg)
 				LogFatal(COMPONENT_FSAL_UP,
 					 "Ganesha version %d mismatch GPFS version %d.",
 					 callback.interface_version, rc);
-				return NULL;
+				break;
 			}
 
 			if (errsv == EINTR)
@@ -190,283 +696,56 @@ void *GPFSFSAL_UP_Thread(void *Arg)
 			     fhP[0], fhP[1], fhP[2], fhP[3], fhP[4], fhP[5],
 			     fhP[6]);
 
-		/* Here is where we decide what type of event this is
-		 * ... open,close,read,...,invalidate? */
-		key.addr = &handle;
-		key.len = handle.handle_key_size;
-
 		LogDebug(COMPONENT_FSAL_UP, "Received event to process for %d",
 			 gpfs_fs->root_fd);
 
-		/* We need valid up_vector while processing some of the
-		 * events below. Setup up vector and hold the mutex while
-		 * processing the event for the entire duration.
-		 */
-		PTHREAD_MUTEX_lock(&gpfs_fs->upvector_mutex);
-		if (!setup_up_vector(gpfs_fs)) {
-			PTHREAD_MUTEX_unlock(&gpfs_fs->upvector_mutex);
-			return NULL;
-		}
-		event_func = gpfs_fs->up_vector;
-
 		switch (reason) {
-		case INODE_LOCK_GRANTED:	/* Lock Event */
-		case INODE_LOCK_AGAIN:	/* Lock Event */
-			{
-				LogMidDebug(COMPONENT_FSAL_UP,
-					    "%s: owner %p pid %d type %d start %lld len %lld",
-					    reason ==
-					    INODE_LOCK_GRANTED ?
-					    "inode lock granted" :
-					    "inode lock again", fl.lock_owner,
-					    fl.flock.l_pid, fl.flock.l_type,
-					    (long long)fl.flock.l_start,
-					    (long long)fl.flock.l_len);
-
-				fsal_lock_param_t lockdesc = {
-					.lock_sle_type = FSAL_POSIX_LOCK,
-					.lock_type = fl.flock.l_type,
-					.lock_start = fl.flock.l_start,
-					.lock_length = fl.flock.l_len
-				};
-				if (reason == INODE_LOCK_AGAIN)
-					fsal_status = up_async_lock_avail(
-							 general_fridge,
-							 event_func,
-							 &key,
-							 fl.lock_owner,
-							 &lockdesc, NULL, NULL);
-				else
-					fsal_status = up_async_lock_grant(
-							 general_fridge,
-							 event_func,
-							 &key,
-							 fl.lock_owner,
-							 &lockdesc, NULL, NULL);
-			}
-			break;
-
-		case BREAK_DELEGATION:	/* Delegation Event */
-			LogDebug(COMPONENT_FSAL_UP,
-				 "delegation recall: flags:%x ino %" PRId64,
-				 flags, callback.buf->st_ino);
-			fsal_status = up_async_delegrecall(general_fridge,
-						  event_func,
-						  &key, NULL, NULL);
-			break;
-
-		case LAYOUT_FILE_RECALL:	/* Layout file recall Event */
-			{
-				struct pnfs_segment segment = {
-					.offset = 0,
-					.length = UINT64_MAX,
-					.io_mode = LAYOUTIOMODE4_ANY
-				};
-				LogDebug(COMPONENT_FSAL_UP,
-					 "layout file recall: flags:%x ino %"
-					 PRId64, flags, callback.buf->st_ino);
-
-				fsal_status = up_async_layoutrecall(
-							general_fridge,
-							event_func,
-							&key,
-							LAYOUT4_NFSV4_1_FILES,
-							false, &segment,
-							NULL, NULL, NULL,
-							NULL);
-			}
-			break;
-
-		case LAYOUT_RECALL_ANY:	/* Recall all layouts Event */
-			LogDebug(COMPONENT_FSAL_UP,
-				 "layout recall any: flags:%x ino %" PRId64,
-				 flags, callback.buf->st_ino);
-
-	    /**
-	     * @todo This functionality needs to be implemented as a
-	     * bulk FSID CB_LAYOUTRECALL.  RECALL_ANY isn't suitable
-	     * since it can't be restricted to just one FSAL.  Also
-	     * an FSID LAYOUTRECALL lets you have multiplke
-	     * filesystems exported from one FSAL and not yank layouts
-	     * on all of them when you only need to recall them for one.
-	     */
-			break;
-
-		case LAYOUT_NOTIFY_DEVICEID:	/* Device update Event */
-			LogDebug(COMPONENT_FSAL_UP,
-				 "layout dev update: flags:%x ino %"
-				 PRId64 " seq %d fd %d fsid 0x%" PRIx64,
-				 flags,
-				callback.buf->st_ino,
-				devid.device_id2,
-				devid.device_id4,
-				devid.devid);
-
-			memset(&devid, 0, sizeof(devid));
-			devid.fsal_id = FSAL_ID_GPFS;
-
-			fsal_status = up_async_notify_device(general_fridge,
-						event_func,
-						NOTIFY_DEVICEID4_DELETE_MASK,
-						LAYOUT4_NFSV4_1_FILES,
-						&devid,
-						true, NULL,
-						NULL);
-			break;
-
-		case INODE_UPDATE:	/* Update Event */
-			{
-				struct attrlist attr;
-
-				LogMidDebug(COMPONENT_FSAL_UP,
-					    "inode update: flags:%x update ino %"
-					    PRId64 " n_link:%d",
-					    flags, callback.buf->st_ino,
-					    (int)callback.buf->st_nlink);
-
-				/** @todo: This notification is completely
-				 * asynchronous.  If we happen to change some
-				 * of the attributes later, we end up over
-				 * writing those with these possibly stale
-				 * values as we don't know when we get to
-				 * update with these up call values. We should
-				 * probably use time stamp or let the up call
-				 * always provide UP_TIMES flag in which case
-				 * we can compare the current ctime vs up call
-				 * provided ctime before updating the
-				 * attributes.
-				 *
-				 * For now, we think size attribute is more
-				 * important than others, so invalidate the
-				 * attributes and let ganesha fetch attributes
-				 * as needed if this update includes a size
-				 * change. We are careless for other attribute
-				 * changes, and we may end up with stale values
-				 * until this gets fixed!
-				 */
-				if (flags & (UP_SIZE | UP_SIZE_BIG)) {
-					fsal_status = event_func->invalidate(
-						event_func, &key,
-						FSAL_UP_INVALIDATE_CACHE);
-					break;
-				}
-
-				/* Check for accepted flags, any other changes
-				   just invalidate. */
-				if (flags &
-				    ~(UP_SIZE | UP_NLINK | UP_MODE | UP_OWN |
-				     UP_TIMES | UP_ATIME | UP_SIZE_BIG)) {
-					fsal_status = event_func->invalidate(
-						event_func, &key,
-						FSAL_UP_INVALIDATE_CACHE);
-				} else {
-					/* buf may not have all attributes set.
-					 * Set the mask to what is changed
-					 */
-					attr.valid_mask = 0;
-					attr.acl = NULL;
-					upflags = 0;
-					if (flags & UP_SIZE)
-						attr.valid_mask |=
-						   ATTR_CHGTIME | ATTR_CHANGE |
-						   ATTR_SIZE | ATTR_SPACEUSED;
-					if (flags & UP_SIZE_BIG) {
-						attr.valid_mask |=
-						   ATTR_CHGTIME | ATTR_CHANGE |
-						   ATTR_SIZE | ATTR_SPACEUSED;
-						upflags |=
-						   fsal_up_update_filesize_inc |
-						   fsal_up_update_spaceused_inc;
-					}
-					if (flags & UP_MODE)
-						attr.valid_mask |=
-						   ATTR_CHGTIME | ATTR_CHANGE |
-						   ATTR_MODE;
-					if (flags & UP_OWN)
-						attr.valid_mask |=
-						   ATTR_CHGTIME | ATTR_CHANGE |
-						   ATTR_OWNER;
-					if (flags & UP_TIMES)
-						attr.valid_mask |=
-						   ATTR_CHGTIME | ATTR_CHANGE |
-						   ATTR_ATIME | ATTR_CTIME |
-						    ATTR_MTIME;
-					if (flags & UP_ATIME)
-						attr.valid_mask |=
-						   ATTR_CHGTIME | ATTR_CHANGE |
-						   ATTR_ATIME;
-					if (flags & UP_NLINK)
-						attr.valid_mask |=
-							ATTR_NUMLINKS;
-					attr.request_mask = attr.valid_mask;
-
-					attr.expire_time_attr =
-					    expire_time_attr;
-
-					posix2fsal_attributes(&buf, &attr);
-					fsal_status = event_func->
-					    update(event_func,
-						   &key, &attr, upflags);
-
-					if ((flags & UP_NLINK)
-					    && (attr.numlinks == 0)) {
-						upflags = fsal_up_nlink;
-						attr.valid_mask = 0;
-						attr.request_mask = 0;
-						fsal_status = up_async_update
-						    (general_fridge,
-						     event_func,
-						     &key, &attr,
-						     upflags, NULL, NULL);
-					}
-				}
-			}
-			break;
-
 		case THREAD_STOP:  /* We wanted to terminate this thread */
 			LogDebug(COMPONENT_FSAL_UP,
 				"Terminating the GPFS up call thread for %d",
 				gpfs_fs->root_fd);
-			PTHREAD_MUTEX_unlock(&gpfs_fs->upvector_mutex);
+			gpfs_up_workers_stop(workers, nworkers);
 			return NULL;
 
-		case INODE_INVALIDATE:
-			LogMidDebug(COMPONENT_FSAL_UP,
-				    "inode invalidate: flags:%x update ino %"
-				    PRId64, flags, callback.buf->st_ino);
-
-			upflags = FSAL_UP_INVALIDATE_CACHE;
-			fsal_status = event_func->invalidate_close(
-						event_func,
-						&key,
-						upflags);
-			break;
-
 		case THREAD_PAUSE:
 			/* File system image is probably going away, but
 			 * we don't need to do anything here as we
 			 * eventually get other errors that stop this
 			 * thread.
 			 */
-			PTHREAD_MUTEX_unlock(&gpfs_fs->upvector_mutex);
 			continue; /* get next event */
 
+		case INODE_LOCK_GRANTED:
+		case INODE_LOCK_AGAIN:
+		case BREAK_DELEGATION:
+		case LAYOUT_FILE_RECALL:
+		case LAYOUT_RECALL_ANY:
+		case LAYOUT_NOTIFY_DEVICEID:
+		case INODE_UPDATE:
+		case INODE_INVALIDATE:
+			break;
+
 		default:
-			PTHREAD_MUTEX_unlock(&gpfs_fs->upvector_mutex);
 			LogWarn(COMPONENT_FSAL_UP, "Unknown event: %d", reason);
 			continue;
 		}
 
-		PTHREAD_MUTEX_unlock(&gpfs_fs->upvector_mutex);
-
-		if (FSAL_IS_ERROR(fsal_status) &&
-		    fsal_status.major != ERR_FSAL_NOENT) {
-			LogWarn(COMPONENT_FSAL_UP,
-				"Event %d could not be processed for fd %d rc %s",
-				reason, gpfs_fs->root_fd,
-				fsal_err_txt(fsal_status));
-		}
+		ev = gsh_malloc(sizeof(*ev));
+		ev->reason = reason;
+		ev->flags = flags;
+		ev->expire_time_attr = expire_time_attr;
+		ev->buf = buf;
+		ev->fl = fl;
+		ev->devid = devid;
+		ev->handle = handle;
+
+		gpfs_up_queue(&workers[CityHash64((char *)&handle,
+						  handle.handle_key_size) %
+				       nworkers],
+			      ev);
 	}
 
+	gpfs_up_workers_stop(workers, nworkers);
+
 	return NULL;
 }				/* GPFSFSAL_UP_Thread */
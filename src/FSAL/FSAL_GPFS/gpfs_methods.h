@@ -48,16 +48,16 @@ struct gpfs_filesystem {
 	struct glist_head exports;
 	bool up_thread_started;
 	pthread_t up_thread; /* upcall thread */
-
-	/* we have an upcall thread for each file system. The upcall
-	 * thread needs a valid export/op_ctx for processing some of the
-	 * upcall requests. We use upvector_mutex to get an export from
-	 * the list of exports in a file system. The following
-	 * up_vector points to up_ops in such an export.
+	uint32_t up_threads; /* upcall workers */
+
+	/* we have an upcall thread for each file system, which hands the
+	 * events to a few upcall workers. The workers need a valid
+	 * export/op_ctx for processing some of the upcall requests. They
+	 * hold upvector_lock for read to get an export from the list of
+	 * exports in a file system and use its up_ops; changes to the
+	 * list take it for write.
 	 */
-	pthread_mutex_t upvector_mutex;
-	struct fsal_up_vector *up_vector;
-	struct req_op_context req_ctx;
+	pthread_rwlock_t upvector_lock;
 };
 
 /*
@@ -170,6 +170,9 @@ fsal_status_t gpfs_read_plus_fd(int my_fs,
 			bool *end_of_file, struct io_info *info, int expfd);
 fsal_status_t gpfs_seek(struct fsal_obj_handle *obj_hdl,
 			 struct io_info *info);
+fsal_status_t gpfs_seek2(struct fsal_obj_handle *obj_hdl,
+			 struct state_t *state,
+			 struct io_info *info);
 fsal_status_t gpfs_io_advise(struct fsal_obj_handle *obj_hdl,
 			 struct io_hints *hints);
 fsal_status_t gpfs_share_op(struct fsal_obj_handle *obj_hdl, void *p_owner,
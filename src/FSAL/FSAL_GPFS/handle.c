@@ -92,9 +92,13 @@ struct gpfs_fsal_obj_handle *alloc_handle(struct gpfs_file_handle *fh,
 /* lookup
  * deprecated NULL parent && NULL path implies root handle
  */
-static fsal_status_t lookup(struct fsal_obj_handle *parent,
-			    const char *path, struct fsal_obj_handle **handle,
-			    struct attrlist *attrs_out)
+/**
+ * @brief Look up a name, in a directory already open if dirfd >= 0
+ */
+static fsal_status_t lookup_fd(struct fsal_obj_handle *parent, int dirfd,
+			       const char *path,
+			       struct fsal_obj_handle **handle,
+			       struct attrlist *attrs_out)
 {
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
 	int retval = 0;
@@ -129,7 +133,12 @@ static fsal_status_t lookup(struct fsal_obj_handle *parent,
 	if (attrs_out != NULL)
 		attrib.request_mask |= attrs_out->request_mask;
 
-	status = GPFSFSAL_lookup(op_ctx, parent, path, &attrib, fh, &fs);
+	if (dirfd >= 0)
+		status = GPFSFSAL_lookup_at(op_ctx, parent, dirfd, path,
+					    &attrib, fh, &fs);
+	else
+		status = GPFSFSAL_lookup(op_ctx, parent, path, &attrib, fh,
+					 &fs);
 	if (FSAL_IS_ERROR(status))
 		return status;
 
@@ -152,6 +161,13 @@ static fsal_status_t lookup(struct fsal_obj_handle *parent,
 	return fsalstat(fsal_error, retval);
 }
 
+static fsal_status_t lookup(struct fsal_obj_handle *parent,
+			    const char *path, struct fsal_obj_handle **handle,
+			    struct attrlist *attrs_out)
+{
+	return lookup_fd(parent, -1, path, handle, attrs_out);
+}
+
 /* create
  * create a regular file and set its attributes
  */
@@ -469,11 +485,14 @@ static fsal_status_t linkfile(struct fsal_obj_handle *obj_hdl,
 	return status;
 }
 
-#define BUF_SIZE 1024
+/* getdents64 buffer, a few hundred names per call */
+#define BUF_SIZE (32 * 1024)
 /**
  * read_dirents
  * read the directory and call through the callback function for
- * each entry.
+ * each entry.  Names are looked up relative to the descriptor the
+ * directory is read through, rather than reopening it by handle for
+ * each one.
  * @param dir_hdl [IN] the directory to read
  * @param whence [IN] where to start (next)
  * @param dir_state [IN] pass thru of state to callback
@@ -493,7 +512,7 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 	off_t seekloc = 0;
 	int bpos, cnt, nread;
 	struct dirent64 *dentry;
-	char buf[BUF_SIZE];
+	char *buf = NULL;
 	struct gpfs_fsal_export *exp = container_of(op_ctx->fsal_export,
 					struct gpfs_fsal_export, export);
 	int export_fd = exp->export_fd;
@@ -514,6 +533,7 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 		fsal_error = posix2fsal_error(retval);
 		goto done;
 	}
+	buf = gsh_malloc(BUF_SIZE);
 	cnt = 0;
 	do {
 		nread = syscall(SYS_getdents64, dirfd, buf, BUF_SIZE);
@@ -536,7 +556,8 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 
 			fsal_prepare_attrs(&attrs, attrmask);
 
-			status = lookup(dir_hdl, dentry->d_name, &hdl, &attrs);
+			status = lookup_fd(dir_hdl, dirfd, dentry->d_name,
+					   &hdl, &attrs);
 			if (FSAL_IS_ERROR(status)) {
 				fsal_error = status.major;
 				goto done;
@@ -559,6 +580,7 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 
 	*eof = true;
  done:
+	gsh_free(buf);
 	close(dirfd);
 
 	return fsalstat(fsal_error, retval);
@@ -1010,6 +1032,7 @@ void gpfs_handle_ops_init(struct fsal_obj_ops *ops)
 	ops->fs_locations = gpfs_fs_locations;
 	ops->status = gpfs_status;
 	ops->seek = gpfs_seek;
+	ops->seek2 = gpfs_seek2;
 	ops->io_advise = gpfs_io_advise;
 	ops->share_op = share_op;
 	ops->close = gpfs_close;
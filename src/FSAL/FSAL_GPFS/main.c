@@ -81,6 +81,7 @@ static struct fsal_staticfsinfo_t default_gpfs_info = {
 	.pnfs_ds = true,
 	.fsal_trace = true,
 	.fsal_grace = false,
+	.up_threads = 4,
 	.link_supports_permission_checks = true,
 };
 
@@ -113,6 +114,8 @@ static struct config_item gpfs_params[] = {
 		       fsal_staticfsinfo_t, fsal_trace),
 	CONF_ITEM_BOOL("fsal_grace", false,
 		       fsal_staticfsinfo_t, fsal_grace),
+	CONF_ITEM_UI32("upcall_threads", 1, 64, 4,
+		       fsal_staticfsinfo_t, up_threads),
 	CONFIG_EOL
 };
 
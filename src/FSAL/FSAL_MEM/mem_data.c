@@ -0,0 +1,325 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @file   FSAL_MEM/mem_data.c
+ *
+ * @brief File data storage
+ *
+ * File data is kept in MEM_CHUNK_SIZE chunks hung off a radix tree
+ * indexed by chunk number.  Chunks are only allocated when written, so
+ * holes cost nothing and read back as zeroes, and a file grows without
+ * copying what it already holds.  With a height of 0 the root is the
+ * only chunk; each level above that multiplies the reach by
+ * MEM_RADIX_FANOUT.
+ *
+ * Bytes of a chunk beyond the end of file are always zero, so
+ * extending a file never exposes old data.
+ */
+
+#include "fsal.h"
+#include "mem_int.h"
+
+#define MEM_RADIX_SHIFT 6
+#define MEM_RADIX_FANOUT (1 << MEM_RADIX_SHIFT)
+
+#define MEM_DATA_NONE UINT64_MAX
+
+struct mem_radix_node {
+	void *slots[MEM_RADIX_FANOUT];
+};
+
+/* Number of chunks covered by a child of a node at level */
+static inline uint64_t mem_radix_span(uint32_t level)
+{
+	return 1ULL << ((level - 1) * MEM_RADIX_SHIFT);
+}
+
+/* Whether a tree of this height reaches chunk idx */
+static inline bool mem_radix_reaches(uint32_t height, uint64_t idx)
+{
+	return height * MEM_RADIX_SHIFT >= 64 ||
+	       (idx >> (height * MEM_RADIX_SHIFT)) == 0;
+}
+
+/**
+ * @brief Find the slot holding a chunk
+ *
+ * @param[in] data	File data
+ * @param[in] idx	Chunk number
+ * @param[in] create	Grow the tree as needed to reach the slot
+ *
+ * @return The slot, or NULL if it does not exist and @a create is false.
+ */
+static void **mem_data_slot(struct mem_data *data, uint64_t idx, bool create)
+{
+	void **slot;
+	uint32_t level;
+
+	while (!mem_radix_reaches(data->height, idx)) {
+		struct mem_radix_node *node;
+
+		if (!create)
+			return NULL;
+
+		if (data->root != NULL) {
+			node = gsh_calloc(1, sizeof(*node));
+			node->slots[0] = data->root;
+			data->root = node;
+		}
+		data->height++;
+	}
+
+	slot = &data->root;
+
+	for (level = data->height; level > 0; level--) {
+		struct mem_radix_node *node = *slot;
+
+		if (node == NULL) {
+			if (!create)
+				return NULL;
+			node = gsh_calloc(1, sizeof(*node));
+			*slot = node;
+		}
+
+		slot = &node->slots[(idx / mem_radix_span(level)) &
+				    (MEM_RADIX_FANOUT - 1)];
+	}
+
+	return slot;
+}
+
+/**
+ * @brief Free the chunks from first on in a subtree
+ *
+ * @return true if the subtree is now empty and was freed.
+ */
+static bool mem_data_trim(struct mem_data *data, void **slot, uint32_t level,
+			  uint64_t base, uint64_t first)
+{
+	struct mem_radix_node *node = *slot;
+	uint64_t span;
+	bool empty = true;
+	int i;
+
+	if (node == NULL)
+		return true;
+
+	if (level == 0) {
+		if (base < first)
+			return false;
+		gsh_free(*slot);
+		*slot = NULL;
+		data->nr_chunks--;
+		return true;
+	}
+
+	span = mem_radix_span(level);
+
+	for (i = 0; i < MEM_RADIX_FANOUT; i++) {
+		uint64_t child = base + i * span;
+
+		if (child + span > first) {
+			if (!mem_data_trim(data, &node->slots[i], level - 1,
+					   child, first))
+				empty = false;
+		} else if (node->slots[i] != NULL) {
+			empty = false;
+		}
+	}
+
+	if (empty) {
+		gsh_free(node);
+		*slot = NULL;
+	}
+
+	return empty;
+}
+
+/**
+ * @brief Find the first chunk from @a from on that is present or absent
+ *
+ * @return The chunk number, or MEM_DATA_NONE if the subtree has none.
+ */
+static uint64_t mem_data_find(void *slot, uint32_t level, uint64_t base,
+			      uint64_t from, bool present)
+{
+	struct mem_radix_node *node = slot;
+	uint64_t span;
+	int i;
+
+	if (node == NULL)
+		return present ? MEM_DATA_NONE : MAX(base, from);
+
+	if (level == 0)
+		return present ? MAX(base, from) : MEM_DATA_NONE;
+
+	span = mem_radix_span(level);
+
+	for (i = from > base ? (from - base) / span : 0;
+	     i < MEM_RADIX_FANOUT; i++) {
+		uint64_t found = mem_data_find(node->slots[i], level - 1,
+					       base + i * span, from, present);
+
+		if (found != MEM_DATA_NONE)
+			return found;
+	}
+
+	return MEM_DATA_NONE;
+}
+
+void mem_data_init(struct mem_data *data)
+{
+	PTHREAD_RWLOCK_init(&data->lock, NULL);
+	data->root = NULL;
+	data->height = 0;
+	data->nr_chunks = 0;
+}
+
+void mem_data_destroy(struct mem_data *data)
+{
+	mem_data_truncate(data, 0);
+	PTHREAD_RWLOCK_destroy(&data->lock);
+}
+
+/**
+ * @brief Copy file data out, holes read as zeroes
+ */
+void mem_data_read(struct mem_data *data, uint64_t offset, size_t len,
+		   void *buffer)
+{
+	char *buf = buffer;
+
+	PTHREAD_RWLOCK_rdlock(&data->lock);
+
+	while (len > 0) {
+		uint64_t idx = offset / MEM_CHUNK_SIZE;
+		size_t off = offset % MEM_CHUNK_SIZE;
+		size_t n = MIN(len, MEM_CHUNK_SIZE - off);
+		void **slot = mem_data_slot(data, idx, false);
+
+		if (slot != NULL && *slot != NULL)
+			memcpy(buf, (char *)*slot + off, n);
+		else
+			memset(buf, 0, n);
+
+		buf += n;
+		offset += n;
+		len -= n;
+	}
+
+	PTHREAD_RWLOCK_unlock(&data->lock);
+}
+
+/**
+ * @brief Copy data into a file, allocating chunks as needed
+ */
+void mem_data_write(struct mem_data *data, uint64_t offset, size_t len,
+		    const void *buffer)
+{
+	const char *buf = buffer;
+
+	PTHREAD_RWLOCK_wrlock(&data->lock);
+
+	while (len > 0) {
+		uint64_t idx = offset / MEM_CHUNK_SIZE;
+		size_t off = offset % MEM_CHUNK_SIZE;
+		size_t n = MIN(len, MEM_CHUNK_SIZE - off);
+		void **slot = mem_data_slot(data, idx, true);
+
+		if (*slot == NULL) {
+			char *chunk = gsh_malloc(MEM_CHUNK_SIZE);
+
+			/* Only zero what this write does not cover */
+			memset(chunk, 0, off);
+			memset(chunk + off + n, 0, MEM_CHUNK_SIZE - off - n);
+			*slot = chunk;
+			data->nr_chunks++;
+		}
+
+		memcpy((char *)*slot + off, buf, n);
+
+		buf += n;
+		offset += n;
+		len -= n;
+	}
+
+	PTHREAD_RWLOCK_unlock(&data->lock);
+}
+
+/**
+ * @brief Drop file data from @a size on
+ */
+void mem_data_truncate(struct mem_data *data, uint64_t size)
+{
+	uint64_t first = (size + MEM_CHUNK_SIZE - 1) / MEM_CHUNK_SIZE;
+	void **slot;
+
+	PTHREAD_RWLOCK_wrlock(&data->lock);
+
+	if (mem_data_trim(data, &data->root, data->height, 0, first))
+		data->height = 0;
+
+	/* Zero the tail of a partial last chunk */
+	if (size % MEM_CHUNK_SIZE != 0) {
+		slot = mem_data_slot(data, size / MEM_CHUNK_SIZE, false);
+		if (slot != NULL && *slot != NULL)
+			memset((char *)*slot + size % MEM_CHUNK_SIZE, 0,
+			       MEM_CHUNK_SIZE - size % MEM_CHUNK_SIZE);
+	}
+
+	PTHREAD_RWLOCK_unlock(&data->lock);
+}
+
+/**
+ * @brief Find the next data or hole
+ *
+ * @param[in] data	File data
+ * @param[in] offset	Where to start looking
+ * @param[in] what	true for data, false for a hole
+ *
+ * @return Offset of the first data or hole at or after @a offset, or
+ *         UINT64_MAX if there is no data there.  Past the end of the
+ *         stored data is always a hole.
+ */
+uint64_t mem_data_seek(struct mem_data *data, uint64_t offset, bool what)
+{
+	uint64_t idx = offset / MEM_CHUNK_SIZE;
+	uint64_t found;
+
+	PTHREAD_RWLOCK_rdlock(&data->lock);
+
+	if (!mem_radix_reaches(data->height, idx))
+		found = what ? MEM_DATA_NONE : idx;
+	else
+		found = mem_data_find(data->root, data->height, 0, idx, what);
+
+	if (found == MEM_DATA_NONE && !what)
+		/* The tree is full, the hole starts where it ends */
+		found = 1ULL << (data->height * MEM_RADIX_SHIFT);
+
+	PTHREAD_RWLOCK_unlock(&data->lock);
+
+	if (found == MEM_DATA_NONE)
+		return UINT64_MAX;
+
+	return found == idx ? offset : found * MEM_CHUNK_SIZE;
+}
@@ -277,6 +277,28 @@ static struct state_t *mem_alloc_state(struct fsal_export *exp_hdl,
 	return state;
 }
 
+static struct config_item mem_export_params[] = {
+	CONF_ITEM_NOOP("name"),
+	CONF_ITEM_UI32("Synthetic_Tree_Depth", 0, 64, 0,
+		       mem_fsal_export, tree_depth),
+	CONF_ITEM_UI32("Synthetic_Dirs_Per_Dir", 0, UINT32_MAX, 0,
+		       mem_fsal_export, tree_dirs),
+	CONF_ITEM_UI32("Synthetic_Files_Per_Dir", 0, UINT32_MAX, 0,
+		       mem_fsal_export, tree_files),
+	CONF_ITEM_UI64("Synthetic_File_Size", 0, UINT64_MAX, 0,
+		       mem_fsal_export, tree_file_size),
+	CONFIG_EOL
+};
+
+static struct config_block mem_export_param_block = {
+	.dbus_interface_name = "org.ganesha.nfsd.config.fsal.mem-export%d",
+	.blk_desc.name = "FSAL",
+	.blk_desc.type = CONFIG_BLOCK,
+	.blk_desc.u.blk.init = noop_conf_init,
+	.blk_desc.u.blk.params = mem_export_params,
+	.blk_desc.u.blk.commit = noop_conf_commit
+};
+
 /* mem_export_ops_init
  * overwrite vector entries with the methods that we support
  */
@@ -330,6 +352,17 @@ fsal_status_t mem_create_export(struct fsal_module *fsal_hdl,
 	fsal_export_init(&myself->export);
 	mem_export_ops_init(&myself->export.exp_ops);
 
+	retval = load_config_from_node(parse_node,
+				       &mem_export_param_block,
+				       myself,
+				       true,
+				       err_type);
+	if (retval != 0) {
+		free_export_ops(&myself->export);
+		gsh_free(myself);
+		return fsalstat(ERR_FSAL_INVAL, 0);
+	}
+
 	retval = fsal_attach_export(fsal_hdl, &myself->export.exports);
 
 	if (retval != 0) {
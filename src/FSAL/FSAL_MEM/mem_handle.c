@@ -396,6 +396,55 @@ static fsal_status_t mem_close_func(struct fsal_obj_handle *obj_hdl,
 	return mem_close_my_fd(fd);
 }
 
+/**
+ * @brief Account for the space used by a file
+ *
+ * Stored data uses what its chunks do.  Data past Inode_Size is not
+ * stored, but it is not a hole either.
+ *
+ * @param[in] myself	File to update
+ */
+static void mem_update_spaceused(struct mem_fsal_obj_handle *myself)
+{
+	uint64_t used = myself->mh_file.data.nr_chunks * MEM_CHUNK_SIZE;
+
+	if (myself->attrs.filesize > myself->datasize)
+		used += myself->attrs.filesize - myself->datasize;
+
+	myself->attrs.spaceused = used;
+}
+
+/**
+ * @brief Set the size of a file, dropping any data past it
+ *
+ * @param[in] myself	File to resize
+ * @param[in] size	New size
+ */
+static void mem_set_size(struct mem_fsal_obj_handle *myself, uint64_t size)
+{
+	myself->attrs.filesize = size;
+	mem_data_truncate(&myself->mh_file.data, size);
+	mem_update_spaceused(myself);
+}
+
+/**
+ * @brief Apply the data side of a setattr to a file
+ *
+ * @param[in] myself	File attributes were set on
+ * @param[in] attrs_set	Attributes that were set
+ */
+static void mem_setattrs_data(struct mem_fsal_obj_handle *myself,
+			      struct attrlist *attrs_set)
+{
+	if (myself->obj_handle.type != REGULAR_FILE)
+		return;
+
+	if (FSAL_TEST_MASK(attrs_set->valid_mask, ATTR_SIZE))
+		mem_set_size(myself, attrs_set->filesize);
+	else
+		mem_update_spaceused(myself);
+}
+
 #define mem_alloc_handle(p, n, t, e, a) \
 	_mem_alloc_handle(p, n, t, e, a, __func__, __LINE__)
 /**
@@ -417,15 +466,8 @@ _mem_alloc_handle(struct mem_fsal_obj_handle *parent,
 		  const char *func, int line)
 {
 	struct mem_fsal_obj_handle *hdl;
-	size_t isize;
 
-	isize = sizeof(struct mem_fsal_obj_handle);
-	if (type == REGULAR_FILE) {
-		/* Regular files need space to read/write */
-		isize += MEM.inode_size;
-	}
-
-	hdl = gsh_calloc(1, isize);
+	hdl = gsh_calloc(1, sizeof(struct mem_fsal_obj_handle));
 
 	/* Establish tree details for this directory */
 	hdl->m_name = gsh_strdup(name);
@@ -482,13 +524,12 @@ _mem_alloc_handle(struct mem_fsal_obj_handle *parent,
 
 	switch (type) {
 	case REGULAR_FILE:
-		if ((attrs && attrs->valid_mask & ATTR_SIZE) != 0) {
+		mem_data_init(&hdl->mh_file.data);
+		if ((attrs && attrs->valid_mask & ATTR_SIZE) != 0)
 			hdl->attrs.filesize = attrs->filesize;
-			hdl->attrs.spaceused = attrs->filesize;
-		} else {
+		else
 			hdl->attrs.filesize = 0;
-			hdl->attrs.spaceused = 0;
-		}
+		mem_update_spaceused(hdl);
 		hdl->attrs.numlinks = 1;
 		break;
 	case BLOCK_FILE:
@@ -586,6 +627,8 @@ static fsal_status_t mem_create_obj(struct mem_fsal_obj_handle *parent,
 	struct mem_fsal_obj_handle *hdl;
 	fsal_status_t status;
 
+	mem_inject_latency(MEM_OP_MODIFY, 0);
+
 	*new_obj = NULL;		/* poison it */
 
 	if (parent->obj_handle.type != DIRECTORY) {
@@ -641,6 +684,8 @@ static fsal_status_t mem_lookup(struct fsal_obj_handle *parent,
 	struct mem_fsal_obj_handle *myself, *hdl = NULL;
 	fsal_status_t status;
 
+	mem_inject_latency(MEM_OP_METADATA, 0);
+
 	myself = container_of(parent,
 			      struct mem_fsal_obj_handle,
 			      obj_handle);
@@ -699,6 +744,8 @@ static fsal_status_t mem_readdir(struct fsal_obj_handle *dir_hdl,
 	struct attrlist attrs;
 	enum fsal_dir_result cb_rc;
 
+	mem_inject_latency(MEM_OP_METADATA, 0);
+
 	myself = container_of(dir_hdl,
 			      struct mem_fsal_obj_handle,
 			      obj_handle);
@@ -899,6 +946,8 @@ static fsal_status_t mem_readlink(struct fsal_obj_handle *obj_hdl,
 	struct mem_fsal_obj_handle *myself =
 		container_of(obj_hdl, struct mem_fsal_obj_handle, obj_handle);
 
+	mem_inject_latency(MEM_OP_METADATA, 0);
+
 	if (obj_hdl->type != SYMBOLIC_LINK) {
 		LogCrit(COMPONENT_FSAL,
 			"Handle is not a symlink. hdl = 0x%p",
@@ -925,6 +974,8 @@ static fsal_status_t mem_getattrs(struct fsal_obj_handle *obj_hdl,
 	struct mem_fsal_obj_handle *myself =
 		container_of(obj_hdl, struct mem_fsal_obj_handle, obj_handle);
 
+	mem_inject_latency(MEM_OP_METADATA, 0);
+
 	if (!myself->is_export && glist_empty(&myself->dirents)) {
 		/* Removed entry - stale */
 		LogDebug(COMPONENT_FSAL,
@@ -976,6 +1027,8 @@ fsal_status_t mem_setattr2(struct fsal_obj_handle *obj_hdl,
 	struct mem_fsal_obj_handle *myself =
 		container_of(obj_hdl, struct mem_fsal_obj_handle, obj_handle);
 
+	mem_inject_latency(MEM_OP_MODIFY, 0);
+
 	/* apply umask, if mode attribute is to be changed */
 	if (FSAL_TEST_MASK(attrs_set->valid_mask, ATTR_MODE))
 		attrs_set->mode &=
@@ -992,6 +1045,7 @@ fsal_status_t mem_setattr2(struct fsal_obj_handle *obj_hdl,
 	}
 
 	mem_copy_attrs_mask(attrs_set, &myself->attrs);
+	mem_setattrs_data(myself, attrs_set);
 
 #ifdef USE_LTTNG
 	tracepoint(fsalmem, mem_setattrs, __func__, __LINE__, myself,
@@ -1021,6 +1075,8 @@ fsal_status_t mem_link(struct fsal_obj_handle *obj_hdl,
 	struct mem_fsal_obj_handle *hdl;
 	fsal_status_t status = {0, 0};
 
+	mem_inject_latency(MEM_OP_MODIFY, 0);
+
 	status = mem_int_lookup(dir, name, &hdl);
 	if (!FSAL_IS_ERROR(status)) {
 		/* It already exists */
@@ -1054,6 +1110,8 @@ static fsal_status_t mem_unlink(struct fsal_obj_handle *dir_hdl,
 	uint32_t numkids;
 	struct mem_dirent *dirent;
 
+	mem_inject_latency(MEM_OP_MODIFY, 0);
+
 	parent = container_of(dir_hdl,
 			      struct mem_fsal_obj_handle,
 			      obj_handle);
@@ -1164,6 +1222,8 @@ static fsal_status_t mem_rename(struct fsal_obj_handle *obj_hdl,
 	struct mem_fsal_obj_handle *mem_lookup_dst = NULL;
 	fsal_status_t status;
 
+	mem_inject_latency(MEM_OP_MODIFY, 0);
+
 	status = mem_int_lookup(mem_newdir, new_name, &mem_lookup_dst);
 	if (!FSAL_IS_ERROR(status)) {
 		uint32_t numkids;
@@ -1252,6 +1312,8 @@ fsal_status_t mem_open2(struct fsal_obj_handle *obj_hdl,
 	bool created = false;
 	struct attrlist verifier_attr;
 
+	mem_inject_latency(MEM_OP_METADATA, 0);
+
 	if (state != NULL)
 		my_fd = (struct fsal_fd *)(state + 1);
 
@@ -1322,7 +1384,7 @@ fsal_status_t mem_open2(struct fsal_obj_handle *obj_hdl,
 		mem_open_my_fd(my_fd, openflags);
 
 		if (truncated)
-			myself->attrs.filesize = myself->attrs.spaceused = 0;
+			mem_set_size(myself, 0);
 
 		/* Now check verifier for exclusive, but not for
 		 * FSAL_EXCLUSIVE_9P.
@@ -1420,6 +1482,7 @@ fsal_status_t mem_open2(struct fsal_obj_handle *obj_hdl,
 		 * creating */
 		if (setattrs && attrs_set->valid_mask != 0) {
 			mem_copy_attrs_mask(attrs_set, &hdl->attrs);
+			mem_setattrs_data(hdl, attrs_set);
 		}
 
 		if (attrs_out != NULL) {
@@ -1508,11 +1571,64 @@ fsal_status_t mem_reopen2(struct fsal_obj_handle *obj_hdl,
 
 	mem_open_my_fd(my_fd, openflags);
 	if (openflags & FSAL_O_TRUNC)
-		myself->attrs.filesize = myself->attrs.spaceused = 0;
+		mem_set_size(myself, 0);
 
 	return status;
 }
 
+/**
+ * @brief Look for a hole at the start of a read
+ *
+ * If @a offset is in a hole, fill in @a info with it and return true.
+ * Otherwise return false with @a read_amount set to how much of the
+ * request is data before the next hole.  Only stored data can have
+ * holes; past Inode_Size everything is data.
+ *
+ * @param[in]  myself       File being read
+ * @param[in]  offset       Start of the read
+ * @param[in]  size         Size of the read, within the file
+ * @param[out] read_amount  Size of the hole, or of the data to read
+ * @param[out] end_of_file  Whether a hole reaches end of file
+ * @param[out] info         Hole found
+ *
+ * @return true if a hole was reported.
+ */
+
+static bool mem_read_hole(struct mem_fsal_obj_handle *myself,
+			  uint64_t offset, size_t size,
+			  size_t *read_amount, bool *end_of_file,
+			  struct io_info *info)
+{
+	uint64_t stored = MIN(myself->attrs.filesize, myself->datasize);
+	uint64_t data, hole;
+
+	*read_amount = size;
+
+	if (offset >= stored)
+		return false;
+
+	data = MIN(mem_data_seek(&myself->mh_file.data, offset, true),
+		   stored);
+
+	if (data == offset) {
+		hole = mem_data_seek(&myself->mh_file.data, offset, false);
+		if (hole < stored && hole - offset < size)
+			*read_amount = hole - offset;
+		return false;
+	}
+
+	if (data - offset < size)
+		*read_amount = data - offset;
+
+	*end_of_file = offset + *read_amount >= myself->attrs.filesize;
+
+	info->io_content.what = NFS4_CONTENT_HOLE;
+	info->io_content.hole.di_offset = offset;
+	info->io_content.hole.di_length = *read_amount;
+
+	return true;
+}
+
 /**
  * @brief Read data from a file
  *
@@ -1550,10 +1666,7 @@ fsal_status_t mem_read2(struct fsal_obj_handle *obj_hdl,
 	bool has_lock, closefd = false;
 	fsal_status_t status = {ERR_FSAL_NO_ERROR, 0};
 
-	if (info != NULL) {
-		/* Currently we don't support READ_PLUS */
-		return fsalstat(ERR_FSAL_NOTSUPP, 0);
-	}
+	mem_inject_latency(MEM_OP_READ, buffer_size);
 
 	/* Find an FD */
 	status = fsal_find_fd(&fsal_fd, obj_hdl, &myself->mh_file.fd,
@@ -1570,12 +1683,22 @@ fsal_status_t mem_read2(struct fsal_obj_handle *obj_hdl,
 		buffer_size = myself->attrs.filesize - offset;
 	}
 
+	if (info != NULL) {
+		/* READ_PLUS: report a hole rather than reading zeroes */
+		if (mem_read_hole(myself, offset, buffer_size, read_amount,
+				  end_of_file, info))
+			goto out;
+
+		/* Only read up to the next hole */
+		buffer_size = *read_amount;
+	}
+
 	if (offset < myself->datasize) {
 		size_t readsize;
 
 		/* Data to read */
 		readsize = MIN(buffer_size, myself->datasize - offset);
-		memcpy(buffer, myself->data + offset, readsize);
+		mem_data_read(&myself->mh_file.data, offset, readsize, buffer);
 		if (readsize < buffer_size)
 			memset(buffer + readsize, 'a', buffer_size - readsize);
 	} else {
@@ -1590,6 +1713,15 @@ fsal_status_t mem_read2(struct fsal_obj_handle *obj_hdl,
 
 	*read_amount = buffer_size;
 	*end_of_file = (buffer_size == 0);
+
+	if (info != NULL) {
+		info->io_content.what = NFS4_CONTENT_DATA;
+		info->io_content.data.d_offset = offset;
+		info->io_content.data.d_data.data_len = buffer_size;
+		info->io_content.data.d_data.data_val = buffer;
+	}
+
+out:
 	now(&myself->attrs.atime);
 
 	if (has_lock)
@@ -1639,6 +1771,8 @@ fsal_status_t mem_write2(struct fsal_obj_handle *obj_hdl,
 	bool has_lock, closefd = false;
 	fsal_status_t status = {ERR_FSAL_NO_ERROR, 0};
 
+	mem_inject_latency(MEM_OP_WRITE, buffer_size);
+
 	if (info != NULL) {
 		/* Currently we don't support WRITE_PLUS */
 		return fsalstat(ERR_FSAL_NOTSUPP, 0);
@@ -1658,19 +1792,19 @@ fsal_status_t mem_write2(struct fsal_obj_handle *obj_hdl,
 		return status;
 	}
 
-	if (offset + buffer_size > myself->attrs.filesize) {
-		myself->attrs.filesize = myself->attrs.spaceused =
-			offset + buffer_size;
-	}
-
 	if (offset < myself->datasize) {
 		size_t writesize;
 
 		/* Space to write */
 		writesize = MIN(buffer_size, myself->datasize - offset);
-		memcpy(myself->data + offset, buffer, writesize);
+		mem_data_write(&myself->mh_file.data, offset, writesize,
+			       buffer);
 	}
 
+	if (offset + buffer_size > myself->attrs.filesize)
+		myself->attrs.filesize = offset + buffer_size;
+	mem_update_spaceused(myself);
+
 #ifdef USE_LTTNG
 	tracepoint(fsalmem, mem_write, __func__, __LINE__, myself,
 			   myself->m_name, state, myself->attrs.filesize,
@@ -1712,6 +1846,65 @@ fsal_status_t mem_commit2(struct fsal_obj_handle *obj_hdl,
 			  off_t offset,
 			  size_t len)
 {
+	mem_inject_latency(MEM_OP_COMMIT, 0);
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Seek to data or hole
+ *
+ * Only stored data can have holes, past Inode_Size everything is
+ * data.  The end of file is a hole.
+ *
+ * @param[in]     obj_hdl  File on which to operate
+ * @param[in]     state    state_t to use for this operation
+ * @param[in,out] info     What to seek for and from, what was found
+ *
+ * @return FSAL status.
+ */
+
+fsal_status_t mem_seek2(struct fsal_obj_handle *obj_hdl,
+			struct state_t *state,
+			struct io_info *info)
+{
+	struct mem_fsal_obj_handle *myself = container_of(obj_hdl,
+				  struct mem_fsal_obj_handle, obj_handle);
+	uint64_t offset = info->io_content.hole.di_offset;
+	uint64_t filesize = myself->attrs.filesize;
+	uint64_t stored = MIN(filesize, myself->datasize);
+	uint64_t found;
+
+	if (obj_hdl->type != REGULAR_FILE)
+		return fsalstat(ERR_FSAL_INVAL, 0);
+
+	if (offset >= filesize)
+		return fsalstat(ERR_FSAL_NXIO, ENXIO);
+
+	switch (info->io_content.what) {
+	case NFS4_CONTENT_DATA:
+		if (offset >= stored)
+			found = offset;
+		else
+			found = MIN(mem_data_seek(&myself->mh_file.data,
+						  offset, true), stored);
+		break;
+	case NFS4_CONTENT_HOLE:
+		if (offset >= stored)
+			found = filesize;
+		else
+			found = mem_data_seek(&myself->mh_file.data, offset,
+					      false);
+		if (found >= stored)
+			found = filesize;
+		break;
+	default:
+		return fsalstat(ERR_FSAL_UNION_NOTSUPP, 0);
+	}
+
+	info->io_eof = found >= filesize;
+	info->io_content.hole.di_offset = found;
+
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
@@ -1974,12 +2167,84 @@ void mem_handle_ops_init(struct fsal_obj_ops *ops)
 	ops->read2 = mem_read2;
 	ops->write2 = mem_write2;
 	ops->commit2 = mem_commit2;
+	ops->seek2 = mem_seek2;
 	ops->lock_op2 = mem_lock_op2;
 	ops->close2 = mem_close2;
 	ops->handle_to_wire = mem_handle_to_wire;
 	ops->handle_to_key = mem_handle_to_key;
 }
 
+/**
+ * @brief Generate one directory of the synthetic tree
+ *
+ * @param[in] mfe	Export being populated
+ * @param[in] dir	Directory to fill
+ * @param[in] depth	Levels of directories still to create below @a dir
+ * @return Number of objects created
+ */
+static uint64_t mem_populate_dir(struct mem_fsal_export *mfe,
+				 struct mem_fsal_obj_handle *dir,
+				 uint32_t depth)
+{
+	struct mem_fsal_obj_handle *hdl;
+	struct attrlist attrs;
+	char name[32];
+	uint64_t count = 0;
+	uint32_t i;
+
+	memset(&attrs, 0, sizeof(attrs));
+	attrs.valid_mask = ATTR_MODE | ATTR_SIZE;
+	attrs.mode = 0644;
+	attrs.filesize = mfe->tree_file_size;
+
+	for (i = 0; i < mfe->tree_files; i++) {
+		snprintf(name, sizeof(name), "f%"PRIu32, i);
+		(void) mem_alloc_handle(dir, name, REGULAR_FILE, mfe, &attrs);
+		count++;
+	}
+
+	if (depth == 0)
+		return count;
+
+	attrs.valid_mask = ATTR_MODE;
+	attrs.mode = 0755;
+
+	for (i = 0; i < mfe->tree_dirs; i++) {
+		snprintf(name, sizeof(name), "d%"PRIu32, i);
+		hdl = mem_alloc_handle(dir, name, DIRECTORY, mfe, &attrs);
+		count += 1 + mem_populate_dir(mfe, hdl, depth - 1);
+	}
+
+	return count;
+}
+
+/**
+ * @brief Generate the configured synthetic tree under the export root
+ *
+ * Each level has Synthetic_Dirs_Per_Dir directories d0, d1... and each
+ * directory Synthetic_Files_Per_Dir files f0, f1...
+ *
+ * @param[in] mfe	Export to populate
+ */
+static void mem_populate_tree(struct mem_fsal_export *mfe)
+{
+	struct timespec start, end;
+	uint64_t count;
+
+	if (mfe->tree_files == 0 &&
+	    (mfe->tree_depth == 0 || mfe->tree_dirs == 0))
+		return;
+
+	now(&start);
+	count = mem_populate_dir(mfe, mfe->root_handle, mfe->tree_depth);
+	now(&end);
+
+	LogEvent(COMPONENT_FSAL,
+		 "Generated %"PRIu64" objects under %s in %"PRIu64" msec",
+		 count, mfe->export_path,
+		 (uint64_t) (timespec_diff(&start, &end) / NS_PER_MSEC));
+}
+
 /* export methods that create object handles
  */
 
@@ -2015,6 +2280,7 @@ fsal_status_t mem_lookup_path(struct fsal_export *exp_hdl,
 						    DIRECTORY,
 						    mfe,
 						    &attrs);
+		mem_populate_tree(mfe);
 	}
 
 	*obj_hdl = &mfe->root_handle->obj_handle;
@@ -51,6 +51,14 @@ struct mem_fsal_export {
 	struct glist_head export_entry;
 	/** List of all the objects in this export */
 	struct glist_head mfe_objs;
+	/** Config - levels of directories to generate under the root */
+	uint32_t tree_depth;
+	/** Config - directories to generate in each directory */
+	uint32_t tree_dirs;
+	/** Config - files to generate in each directory */
+	uint32_t tree_files;
+	/** Config - size of generated files */
+	uint64_t tree_file_size;
 };
 
 fsal_status_t mem_lookup_path(struct fsal_export *exp_hdl,
@@ -63,6 +71,27 @@ fsal_status_t mem_create_handle(struct fsal_export *exp_hdl,
 				  struct fsal_obj_handle **handle,
 				  struct attrlist *attrs_out);
 
+/**
+ * @brief Data of a MEM file, see mem_data.c
+ */
+#define MEM_CHUNK_SIZE 4096
+
+struct mem_data {
+	pthread_rwlock_t lock;
+	void *root;		/*< radix tree of chunks */
+	uint32_t height;	/*< levels of nodes above the chunks */
+	uint64_t nr_chunks;	/*< chunks allocated */
+};
+
+void mem_data_init(struct mem_data *data);
+void mem_data_destroy(struct mem_data *data);
+void mem_data_read(struct mem_data *data, uint64_t offset, size_t len,
+		   void *buffer);
+void mem_data_write(struct mem_data *data, uint64_t offset, size_t len,
+		    const void *buffer);
+void mem_data_truncate(struct mem_data *data, uint64_t size);
+uint64_t mem_data_seek(struct mem_data *data, uint64_t offset, bool what);
+
 /*
  * MEM internal object handle
  */
@@ -85,6 +114,7 @@ struct mem_fsal_obj_handle {
 		struct {
 			struct fsal_share share;
 			struct fsal_fd fd;
+			struct mem_data data;
 		} mh_file;
 		struct {
 			object_file_type_t nodetype;
@@ -97,9 +127,8 @@ struct mem_fsal_obj_handle {
 	struct glist_head dirents; /* List of dirents pointing to obj */
 	struct glist_head mfo_exp_entry;
 	char *m_name;	/**< Base name of obj, for debugging */
-	uint32_t datasize;
+	uint64_t datasize;	/*< bytes of file data that are stored */
 	bool is_export;
-	char data[0]; /* Allocated data */
 };
 
 /**
@@ -151,6 +180,9 @@ static inline void _mem_free_handle(struct mem_fsal_obj_handle *hdl,
 
 	glist_del(&hdl->mfo_exp_entry);
 
+	if (hdl->obj_handle.type == REGULAR_FILE)
+		mem_data_destroy(&hdl->mh_file.data);
+
 	if (hdl->m_name != NULL) {
 		gsh_free(hdl->m_name);
 		hdl->m_name = NULL;
@@ -161,6 +193,37 @@ static inline void _mem_free_handle(struct mem_fsal_obj_handle *hdl,
 
 void mem_clean_dir_tree(struct mem_fsal_obj_handle *parent);
 
+/**
+ * @brief Classes of operations with their own synthetic latency
+ */
+enum mem_op_class {
+	MEM_OP_METADATA,	/*< lookup, readdir, getattrs, open... */
+	MEM_OP_MODIFY,		/*< create, remove, rename, setattrs... */
+	MEM_OP_READ,
+	MEM_OP_WRITE,
+	MEM_OP_COMMIT,
+	MEM_OP_CLASS_COUNT
+};
+
+#define MEM_LATENCY_NONE	0
+#define MEM_LATENCY_FIXED	1
+#define MEM_LATENCY_UNIFORM	2
+#define MEM_LATENCY_LOGNORMAL	3
+
+/**
+ * @brief Synthetic latency of a class of operations
+ *
+ * For uniform, usec and max_usec are the bounds.  For log-normal, usec
+ * is the median and max_usec the 99th percentile.
+ */
+struct mem_latency {
+	uint32_t distribution;
+	uint32_t usec;
+	uint32_t max_usec;
+};
+
+void mem_inject_latency(enum mem_op_class op_class, size_t bytes);
+
 /**
  * @brief FSAL Module wrapper for MEM
  */
@@ -171,10 +234,15 @@ struct mem_fsal_module {
 	struct fsal_staticfsinfo_t fs_info;
 	/** List of MEM exports. TODO Locking when we care */
 	struct glist_head mem_exports;
-	/** Config - size of data in inode */
-	uint32_t inode_size;
+	/** Config - bytes of each file's data that are stored */
+	uint64_t inode_size;
 	/** Config - Interval for UP call thread */
 	uint32_t up_interval;
+	/** Config - Synthetic latency per class of operation */
+	struct mem_latency latency[MEM_OP_CLASS_COUNT];
+	/** Config - Read and write bandwidth caps, MB/s, 0 for none */
+	uint32_t read_bandwidth;
+	uint32_t write_bandwidth;
 	/** Next unused inode */
 	uint64_t next_inode;
 };
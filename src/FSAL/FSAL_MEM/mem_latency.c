@@ -0,0 +1,182 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @file   FSAL_MEM/mem_latency.c
+ *
+ * @brief Synthetic latency
+ *
+ * Make MEM behave like a slower backend for benchmarking.  Each class
+ * of operation can be given a fixed, uniform or log-normal latency,
+ * and reads and writes can be capped to a bandwidth.  The calling
+ * thread sleeps, as it would waiting on a real backend.
+ */
+
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include "fsal.h"
+#include "mem_int.h"
+
+/* 99th percentile of the standard normal distribution */
+#define MEM_Z_P99 2.3263
+
+/**
+ * @brief Bandwidth cap shared by all callers
+ *
+ * Transfers are queued back to back: each one starts when the previous
+ * one would have ended.
+ */
+struct mem_bandwidth {
+	pthread_mutex_t lock;
+	uint64_t next_free;	/*< monotonic nsecs the pipe is free again */
+};
+
+static struct mem_bandwidth mem_read_bw = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static struct mem_bandwidth mem_write_bw = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread uint64_t mem_rng_state;
+
+static uint64_t mem_now_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*, seeded per thread */
+static uint64_t mem_rng(void)
+{
+	uint64_t x = mem_rng_state;
+
+	if (x == 0)
+		x = mem_now_nsecs() ^ (uint64_t) pthread_self() ^
+		    0x9e3779b97f4a7c15ULL;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	mem_rng_state = x;
+
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+/* uniform in [0, 1) */
+static double mem_rng_unit(void)
+{
+	return (mem_rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t mem_latency_nsecs(const struct mem_latency *lat)
+{
+	double sigma, z;
+
+	switch (lat->distribution) {
+	case MEM_LATENCY_FIXED:
+		return lat->usec * 1000ULL;
+
+	case MEM_LATENCY_UNIFORM:
+		if (lat->max_usec <= lat->usec)
+			return lat->usec * 1000ULL;
+		return (lat->usec + (uint64_t) (mem_rng_unit() *
+				    (lat->max_usec - lat->usec + 1))) * 1000ULL;
+
+	case MEM_LATENCY_LOGNORMAL:
+		/* usec is the median, max_usec the 99th percentile */
+		if (lat->usec == 0)
+			return 0;
+		sigma = lat->max_usec > lat->usec
+			? log((double)lat->max_usec / lat->usec) / MEM_Z_P99
+			: 0.0;
+		/* Box-Muller */
+		z = sqrt(-2.0 * log(1.0 - mem_rng_unit())) *
+		    cos(2.0 * M_PI * mem_rng_unit());
+		return (uint64_t) (lat->usec * exp(sigma * z) * 1000.0);
+
+	default:
+		return 0;
+	}
+}
+
+/* Reserve the pipe for a transfer, return when it completes */
+static uint64_t mem_bandwidth_reserve(struct mem_bandwidth *bw,
+				      uint32_t mb_per_sec, size_t bytes,
+				      uint64_t now)
+{
+	uint64_t xfer = bytes * 1000000000ULL / (mb_per_sec * 1048576ULL);
+	uint64_t done;
+
+	PTHREAD_MUTEX_lock(&bw->lock);
+	done = MAX(now, bw->next_free) + xfer;
+	bw->next_free = done;
+	PTHREAD_MUTEX_unlock(&bw->lock);
+
+	return done;
+}
+
+/**
+ * @brief Delay the caller as configured for an operation
+ *
+ * @param[in] op_class	Class of the operation
+ * @param[in] bytes	Bytes transferred, for reads and writes
+ */
+void mem_inject_latency(enum mem_op_class op_class, size_t bytes)
+{
+	const struct mem_latency *lat = &MEM.latency[op_class];
+	uint32_t mb_per_sec = 0;
+	uint64_t now, deadline;
+	struct timespec ts;
+
+	if (op_class == MEM_OP_READ)
+		mb_per_sec = MEM.read_bandwidth;
+	else if (op_class == MEM_OP_WRITE)
+		mb_per_sec = MEM.write_bandwidth;
+
+	if (lat->distribution == MEM_LATENCY_NONE &&
+	    (mb_per_sec == 0 || bytes == 0))
+		return;
+
+	deadline = now = mem_now_nsecs();
+
+	if (mb_per_sec != 0 && bytes != 0)
+		deadline = mem_bandwidth_reserve(op_class == MEM_OP_READ
+							? &mem_read_bw
+							: &mem_write_bw,
+						 mb_per_sec, bytes, now);
+
+	deadline += mem_latency_nsecs(lat);
+
+	if (deadline <= now)
+		return;
+
+	ts.tv_sec = deadline / 1000000000ULL;
+	ts.tv_nsec = deadline % 1000000000ULL;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
@@ -81,11 +81,69 @@ static struct fsal_staticfsinfo_t default_mem_info = {
 	.link_supports_permission_checks = false,
 };
 
+static struct config_item_list mem_latency_distributions[] = {
+	CONFIG_LIST_TOK("none", MEM_LATENCY_NONE),
+	CONFIG_LIST_TOK("fixed", MEM_LATENCY_FIXED),
+	CONFIG_LIST_TOK("uniform", MEM_LATENCY_UNIFORM),
+	CONFIG_LIST_TOK("lognormal", MEM_LATENCY_LOGNORMAL),
+	CONFIG_LIST_EOL
+};
+
+static int mem_latency_commit(void *node, void *link_mem, void *self_struct,
+			      struct config_error_type *err_type)
+{
+	struct mem_latency *lat = self_struct;
+
+	if (lat->distribution != MEM_LATENCY_UNIFORM &&
+	    lat->distribution != MEM_LATENCY_LOGNORMAL)
+		return 0;
+
+	if (lat->max_usec < lat->usec) {
+		LogCrit(COMPONENT_CONFIG,
+			"Latency_Max_Usec (%"PRIu32") is below Latency_Usec (%"
+			PRIu32")", lat->max_usec, lat->usec);
+		err_type->invalid = true;
+		return 1;
+	}
+
+	return 0;
+}
+
+static struct config_item mem_latency_items[] = {
+	CONF_ITEM_TOKEN("Distribution", MEM_LATENCY_NONE,
+			mem_latency_distributions,
+			mem_latency, distribution),
+	CONF_ITEM_UI32("Latency_Usec", 0, 10000000, 0,
+		       mem_latency, usec),
+	CONF_ITEM_UI32("Latency_Max_Usec", 0, 10000000, 0,
+		       mem_latency, max_usec),
+	CONFIG_EOL
+};
+
 static struct config_item mem_items[] = {
-	CONF_ITEM_UI32("Inode_Size", 0, 0x200000, 0,
+	CONF_ITEM_UI64("Inode_Size", 0, UINT64_MAX, 0,
 		       mem_fsal_module, inode_size),
 	CONF_ITEM_UI32("Up_Test_Interval", 0, UINT32_MAX, 0,
 		       mem_fsal_module, up_interval),
+	CONF_ITEM_BLOCK("Metadata_Latency", mem_latency_items,
+			noop_conf_init, mem_latency_commit,
+			mem_fsal_module, latency[MEM_OP_METADATA]),
+	CONF_ITEM_BLOCK("Modify_Latency", mem_latency_items,
+			noop_conf_init, mem_latency_commit,
+			mem_fsal_module, latency[MEM_OP_MODIFY]),
+	CONF_ITEM_BLOCK("Read_Latency", mem_latency_items,
+			noop_conf_init, mem_latency_commit,
+			mem_fsal_module, latency[MEM_OP_READ]),
+	CONF_ITEM_BLOCK("Write_Latency", mem_latency_items,
+			noop_conf_init, mem_latency_commit,
+			mem_fsal_module, latency[MEM_OP_WRITE]),
+	CONF_ITEM_BLOCK("Commit_Latency", mem_latency_items,
+			noop_conf_init, mem_latency_commit,
+			mem_fsal_module, latency[MEM_OP_COMMIT]),
+	CONF_ITEM_UI32("Read_Bandwidth", 0, UINT32_MAX, 0,
+		       mem_fsal_module, read_bandwidth),
+	CONF_ITEM_UI32("Write_Bandwidth", 0, UINT32_MAX, 0,
+		       mem_fsal_module, write_bandwidth),
 	CONFIG_EOL
 };
 
@@ -38,6 +38,7 @@ static void pxy_release(struct fsal_export *exp_hdl)
 	struct pxy_export *pxy_exp =
 	    container_of(exp_hdl, struct pxy_export, exp);
 
+	pxy_deleg_drain(exp_hdl);
 	fsal_detach_export(exp_hdl->fsal, &exp_hdl->exports);
 	free_export_ops(exp_hdl);
 
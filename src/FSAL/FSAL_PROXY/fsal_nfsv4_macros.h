@@ -47,9 +47,9 @@ do {gsh_free(argcompound.argarray_val); } while (0)
 
 /**
  * Notice about NFS4_OP_SEQUENCE argop filling :
- * As rpc_context and slot are mutualized, sa_slotid and related sa_sequenceid
- * are place holder filled later on pxy_compoundv4_execute function, only when
- * the free pxy_rpc_io_context is chosen.
+ * sa_slotid, sa_sequenceid and sa_highest_slotid are place holders filled
+ * later on pxy_compoundv4_execute function, when a slot is taken from the
+ * session's slot table.
  */
 #define COMPOUNDV4_ARG_ADD_OP_SEQUENCE(opcnt, argarray, sessionid, nb_slot) \
 do {									\
@@ -87,7 +87,7 @@ do {									\
 	fore_attrs->ca_maxresponsesize = info->srv_recvsize;		\
 	fore_attrs->ca_maxresponsesize_cached = info->srv_recvsize;	\
 	fore_attrs->ca_maxoperations = NB_MAX_OPERATIONS;		\
-	fore_attrs->ca_maxrequests = NB_RPC_SLOT;			\
+	fore_attrs->ca_maxrequests = info->session_slots;		\
 	fore_attrs->ca_rdma_ird.ca_rdma_ird_len = 0;			\
 	fore_attrs->ca_rdma_ird.ca_rdma_ird_val = NULL;			\
 	back_attrs = &opcreate_session->csa_back_chan_attrs;		\
@@ -96,7 +96,7 @@ do {									\
 	back_attrs->ca_maxresponsesize = info->srv_sendsize;		\
 	back_attrs->ca_maxresponsesize_cached = info->srv_recvsize;	\
 	back_attrs->ca_maxoperations = NB_MAX_OPERATIONS;		\
-	back_attrs->ca_maxrequests = NB_RPC_SLOT;			\
+	back_attrs->ca_maxrequests = info->session_slots;		\
 	back_attrs->ca_rdma_ird.ca_rdma_ird_len = 0;			\
 	back_attrs->ca_rdma_ird.ca_rdma_ird_val = NULL;			\
 	opcreate_session->csa_cb_program = info->srv_prognum;		\
@@ -197,6 +197,13 @@ do { \
 	       __stateid->other, 12);				\
 } while (0)
 
+#define COMPOUNDV4_ARG_ADD_OP_DELEGRETURN(opcnt, argarray, __stateid)	\
+do { \
+	nfs_argop4 *op = argarray + opcnt; opcnt++;		\
+	op->argop = NFS4_OP_DELEGRETURN;			\
+	op->nfs_argop4_u.opdelegreturn.deleg_stateid = __stateid; \
+} while (0)
+
 #define COMPOUNDV4_ARG_ADD_OP_GETATTR(opcnt, argarray, bitmap) \
 do { \
 	nfs_argop4 *op = argarray + opcnt; opcnt++;		\
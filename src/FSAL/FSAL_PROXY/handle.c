@@ -44,36 +44,79 @@
 #include "nfs_proto_tools.h"
 #include "export_mgr.h"
 #include "common_utils.h"
+#include "city.h"
 
 #define FSAL_PROXY_NFS_V4 4
 #define FSAL_PROXY_NFS_V4_MINOR 1
 #define NB_RPC_SLOT 16
-#define NB_MAX_OPERATIONS 10
+#define NB_MAX_OPERATIONS 16
 
 /**
  * pxy_clientid_mutex protects pxy_clientid, pxy_client_seqid,
- * pxy_client_sessionid, no_sessionid and cond_sessionid.
+ * pxy_client_sessionid, pxy_session_maxops, no_sessionid and
+ * cond_sessionid.
  */
 static clientid4 pxy_clientid;
 static sequenceid4 pxy_client_seqid;
 static sessionid4 pxy_client_sessionid;
+static uint32_t pxy_session_maxops = NB_MAX_OPERATIONS;
 static bool no_sessionid = true;
 static pthread_cond_t cond_sessionid = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t pxy_clientid_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static char pxy_hostname[MAXNAMLEN + 1];
-static pthread_t pxy_recv_thread;
 static pthread_t pxy_renewer_thread;
 
 /**
- * listlock protects rpc_sock and rpc_xid values, sockless condition and
- * rpc_calls list.
+ * One TCP connection to the remote server.
+ *
+ * Every connection has its own receiver thread and its own list of
+ * calls waiting for a reply, so any number of calls can be outstanding
+ * on each one and calls on different connections never wait for each
+ * other.  All connections are trunked into the same NFSv4.1 session.
+ *
+ * lock protects sock, the calls list and the sockless condition.  It is
+ * also held while a record is written so records are not interleaved.
  */
-static struct glist_head rpc_calls;
-static int rpc_sock = -1;
+struct pxy_rpc_conn {
+	pthread_mutex_t lock;
+	pthread_cond_t sockless;
+	struct glist_head calls;
+	int sock;
+	unsigned int index;
+	pthread_t recv_thread;
+	struct pxy_client_params *info;
+};
+
+static struct pxy_rpc_conn *rpc_conns;
+static unsigned int rpc_nconns;
 static uint32_t rpc_xid;
-static pthread_mutex_t listlock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t sockless = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Fore channel slot table of the session.
+ *
+ * Slots below pxy_slot_target are handed out; that starts at the number
+ * the server granted and follows sr_target_highest_slotid after that.
+ * pxy_slot_gen changes with each new session so that calls in flight
+ * across the change leave the new session's sequence ids alone.  Any
+ * SEQUENCE renews the lease, pxy_lease_renewed is when one last did.
+ *
+ * pxy_slot_lock protects all of these, pxy_slot_free is signalled when
+ * a slot is released or more become usable.
+ */
+struct pxy_slot {
+	sequenceid4 seqid;
+	bool busy;
+};
+
+static struct pxy_slot *pxy_slots;
+static uint32_t pxy_slot_max;
+static uint32_t pxy_slot_count;
+static uint32_t pxy_slot_target;
+static uint32_t pxy_slot_gen;
+static time_t pxy_lease_renewed;
+static pthread_mutex_t pxy_slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pxy_slot_free = PTHREAD_COND_INITIALIZER;
 
 /*
  * context_lock protects free_contexts list and need_context condition.
@@ -84,13 +127,11 @@ static pthread_mutex_t context_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* NB! nfs_prog is just an easy way to get this info into the call
  *     It should really be fetched via export pointer */
-/**
- * We mutualize rpc_context and slot NFSv4.1.
- */
 struct pxy_rpc_io_context {
 	pthread_mutex_t iolock;
 	pthread_cond_t iowait;
 	struct glist_head calls;
+	struct pxy_rpc_conn *conn;
 	uint32_t rpc_xid;
 	bool iodone;
 	int ioresult;
@@ -99,8 +140,6 @@ struct pxy_rpc_io_context {
 	unsigned int recvbuf_sz;
 	char *sendbuf;
 	char *recvbuf;
-	slotid4 slotid;
-	sequenceid4 seqid;
 };
 
 /* Use this to estimate storage requirements for fattr4 blob */
@@ -153,6 +192,217 @@ static struct pxy_obj_handle *pxy_alloc_handle(struct fsal_export *exp,
 					       fattr4 *obj_attributes,
 					       struct attrlist *attrs_out);
 
+/**
+ * A delegation held from the remote server.
+ *
+ * Delegations are found by file handle, for the I/O that uses their
+ * stateid and for recalls, in pxy_deleg_table.  A recalled one, or one
+ * whose object handle is released, moves to pxy_deleg_returns where the
+ * returner thread invalidates the object in the cache above us and then
+ * sends DELEGRETURN, unless the client id it belonged to is gone.
+ *
+ * pxy_deleg_lock protects the table, the queue and pxy_deleg_busy.
+ * pxy_deleg_cond is signalled when something is queued and when the
+ * queue has been worked off.
+ */
+struct pxy_deleg {
+	struct glist_head node;
+	struct fsal_export *exp;
+	stateid4 stateid;
+	open_delegation_type4 type;
+	bool revoked;
+	struct pxy_handle_blob blob;
+};
+
+#define PXY_DELEG_BUCKETS 1024
+
+static bool pxy_delegations;
+static struct glist_head pxy_deleg_table[PXY_DELEG_BUCKETS];
+static struct glist_head pxy_deleg_returns;
+static bool pxy_deleg_busy;
+static pthread_mutex_t pxy_deleg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pxy_deleg_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t pxy_deleg_thread;
+
+static struct glist_head *pxy_deleg_bucket(const nfs_fh4 *fh)
+{
+	return &pxy_deleg_table[CityHash64(fh->nfs_fh4_val, fh->nfs_fh4_len) %
+				PXY_DELEG_BUCKETS];
+}
+
+/* called with pxy_deleg_lock */
+static struct pxy_deleg *pxy_deleg_find(const nfs_fh4 *fh)
+{
+	struct glist_head *bucket = pxy_deleg_bucket(fh);
+	struct glist_head *c;
+
+	glist_for_each(c, bucket) {
+		struct pxy_deleg *d = glist_entry(c, struct pxy_deleg, node);
+
+		if (d->blob.len - sizeof(d->blob) == fh->nfs_fh4_len &&
+		    memcmp(d->blob.bytes, fh->nfs_fh4_val,
+			   fh->nfs_fh4_len) == 0)
+			return d;
+	}
+
+	return NULL;
+}
+
+/* called with pxy_deleg_lock */
+static void pxy_deleg_queue(struct pxy_deleg *d, bool revoked)
+{
+	glist_del(&d->node);
+	d->revoked = revoked;
+	glist_add_tail(&pxy_deleg_returns, &d->node);
+	pthread_cond_broadcast(&pxy_deleg_cond);
+}
+
+/**
+ * @brief Get the stateid of the delegation held on a file
+ *
+ * @param[in]  fh      File handle on the remote server
+ * @param[in]  write   Only a write delegation will do
+ * @param[out] stateid Its stateid, may be NULL
+ *
+ * @retval true if one is held.
+ */
+static bool pxy_deleg_stateid(const nfs_fh4 *fh, bool write,
+			      stateid4 *stateid)
+{
+	struct pxy_deleg *d;
+	bool held = false;
+
+	if (!pxy_delegations)
+		return false;
+
+	PTHREAD_MUTEX_lock(&pxy_deleg_lock);
+	d = pxy_deleg_find(fh);
+	if (d != NULL && (!write || d->type == OPEN_DELEGATE_WRITE)) {
+		if (stateid != NULL)
+			*stateid = d->stateid;
+		held = true;
+	}
+	PTHREAD_MUTEX_unlock(&pxy_deleg_lock);
+
+	return held;
+}
+
+/**
+ * @brief Record a delegation an OPEN granted
+ *
+ * @param[in] exp Export the file was opened through
+ * @param[in] fh  File handle on the remote server
+ * @param[in] od  Delegation part of the OPEN reply
+ */
+static void pxy_deleg_add(struct fsal_export *exp, const nfs_fh4 *fh,
+			  const open_delegation4 *od)
+{
+	struct pxy_deleg *d;
+	const stateid4 *stateid;
+
+	switch (od->delegation_type) {
+	case OPEN_DELEGATE_READ:
+		stateid = &od->open_delegation4_u.read.stateid;
+		break;
+	case OPEN_DELEGATE_WRITE:
+		stateid = &od->open_delegation4_u.write.stateid;
+		break;
+	default:
+		return;
+	}
+
+	PTHREAD_MUTEX_lock(&pxy_deleg_lock);
+	d = pxy_deleg_find(fh);
+	if (d == NULL) {
+		d = gsh_calloc(1, sizeof(*d) + fh->nfs_fh4_len);
+		d->exp = exp;
+		d->blob.len = fh->nfs_fh4_len + sizeof(d->blob);
+		d->blob.type = REGULAR_FILE;
+		memcpy(d->blob.bytes, fh->nfs_fh4_val, fh->nfs_fh4_len);
+		glist_add(pxy_deleg_bucket(fh), &d->node);
+	}
+	d->stateid = *stateid;
+	d->type = od->delegation_type;
+	PTHREAD_MUTEX_unlock(&pxy_deleg_lock);
+
+	LogFullDebug(COMPONENT_FSAL, "Got a %s delegation",
+		     d->type == OPEN_DELEGATE_WRITE ? "write" : "read");
+}
+
+/**
+ * @brief Give back the delegation held on a file, if any
+ *
+ * @param[in] fh File handle on the remote server
+ *
+ * @retval NFS4_OK if one was held.
+ * @retval NFS4ERR_BADHANDLE if not.
+ */
+static nfsstat4 pxy_deleg_return(const nfs_fh4 *fh)
+{
+	struct pxy_deleg *d;
+
+	if (!pxy_delegations)
+		return NFS4ERR_BADHANDLE;
+
+	PTHREAD_MUTEX_lock(&pxy_deleg_lock);
+	d = pxy_deleg_find(fh);
+	if (d != NULL)
+		pxy_deleg_queue(d, false);
+	PTHREAD_MUTEX_unlock(&pxy_deleg_lock);
+
+	return d != NULL ? NFS4_OK : NFS4ERR_BADHANDLE;
+}
+
+/**
+ * @brief Drop all delegations after the client id was lost
+ *
+ * The server has forgotten them, so they are only invalidated.
+ */
+static void pxy_deleg_revoke_all(void)
+{
+	struct glist_head *c, *n;
+	unsigned int i;
+
+	PTHREAD_MUTEX_lock(&pxy_deleg_lock);
+	for (i = 0; i < PXY_DELEG_BUCKETS; i++) {
+		glist_for_each_safe(c, n, &pxy_deleg_table[i])
+			pxy_deleg_queue(glist_entry(c, struct pxy_deleg, node),
+					true);
+	}
+	PTHREAD_MUTEX_unlock(&pxy_deleg_lock);
+}
+
+/**
+ * @brief Return the delegations of an export going away
+ *
+ * Waits until the returner thread is done with them so none of them
+ * refers to the export afterwards.
+ *
+ * @param[in] exp The export
+ */
+void pxy_deleg_drain(struct fsal_export *exp)
+{
+	struct glist_head *c, *n;
+	unsigned int i;
+
+	if (!pxy_delegations)
+		return;
+
+	PTHREAD_MUTEX_lock(&pxy_deleg_lock);
+	for (i = 0; i < PXY_DELEG_BUCKETS; i++) {
+		glist_for_each_safe(c, n, &pxy_deleg_table[i]) {
+			struct pxy_deleg *d =
+				glist_entry(c, struct pxy_deleg, node);
+
+			if (d->exp == exp)
+				pxy_deleg_queue(d, false);
+		}
+	}
+	while (pxy_deleg_busy || !glist_empty(&pxy_deleg_returns))
+		pthread_cond_wait(&pxy_deleg_cond, &pxy_deleg_lock);
+	PTHREAD_MUTEX_unlock(&pxy_deleg_lock);
+}
+
 #define FSAL_VERIFIER_T_TO_VERIFIER4(verif4, fsal_verif)		\
 do { \
 	BUILD_BUG_ON(sizeof(fsal_verifier_t) != sizeof(verifier4));	\
@@ -368,7 +618,7 @@ static GETATTR4resok *pxy_fill_getattr_reply(nfs_resop4 *resop, char *blob,
 }
 
 static int pxy_got_rpc_reply(struct pxy_rpc_io_context *ctx, int sock, int sz,
-			     u_int xid)
+			     u_int xid, u_int direction)
 {
 	char *repbuf = ctx->recvbuf;
 	int size;
@@ -378,14 +628,15 @@ static int pxy_got_rpc_reply(struct pxy_rpc_io_context *ctx, int sock, int sz,
 
 	PTHREAD_MUTEX_lock(&ctx->iolock);
 	memcpy(repbuf, &xid, sizeof(xid));
+	memcpy(repbuf + 4, &direction, sizeof(direction));
 	/*
-	 * sz includes 4 bytes of xid which have been processed
-	 * together with record mark - reduce the read to avoid
-	 * gobbing up next record mark.
+	 * sz includes 8 bytes of xid and direction which have been
+	 * processed together with record mark - reduce the read to
+	 * avoid gobbing up next record mark.
 	 */
-	repbuf += 4;
-	ctx->ioresult = 4;
-	sz -= 4;
+	repbuf += 8;
+	ctx->ioresult = 8;
+	sz -= 8;
 
 	while (sz > 0) {
 		/* TODO: handle timeouts - use poll(2) */
@@ -406,19 +657,23 @@ static int pxy_got_rpc_reply(struct pxy_rpc_io_context *ctx, int sock, int sz,
 	return size;
 }
 
-static int pxy_rpc_read_reply(int sock)
+static int pxy_rpc_callback(struct pxy_rpc_conn *conn, int sz, u_int xid);
+
+static int pxy_rpc_read_reply(struct pxy_rpc_conn *conn)
 {
+	int sock = conn->sock;
 	struct {
 		uint recmark;
 		uint xid;
+		uint direction;
 	} h;
 	char *buf = (char *)&h;
 	struct glist_head *c;
 	char sink[256];
 	int cnt = 0;
 
-	while (cnt < 8) {
-		int bc = read(sock, buf + cnt, 8 - cnt);
+	while (cnt < sizeof(h)) {
+		int bc = read(sock, buf + cnt, sizeof(h) - cnt);
 
 		if (bc < 0)
 			return -errno;
@@ -432,20 +687,25 @@ static int pxy_rpc_read_reply(int sock)
 	LogDebug(COMPONENT_FSAL, "Recmark %x, xid %u\n", h.recmark, h.xid);
 	h.recmark &= ~(1U << 31);
 
-	PTHREAD_MUTEX_lock(&listlock);
-	glist_for_each(c, &rpc_calls) {
+	/* The server calls us back over the same connections */
+	if (ntohl(h.direction) == CALL)
+		return pxy_rpc_callback(conn, h.recmark, h.xid);
+
+	PTHREAD_MUTEX_lock(&conn->lock);
+	glist_for_each(c, &conn->calls) {
 		struct pxy_rpc_io_context *ctx =
 		    container_of(c, struct pxy_rpc_io_context, calls);
 
 		if (ctx->rpc_xid == h.xid) {
 			glist_del(c);
-			PTHREAD_MUTEX_unlock(&listlock);
-			return pxy_got_rpc_reply(ctx, sock, h.recmark, h.xid);
+			PTHREAD_MUTEX_unlock(&conn->lock);
+			return pxy_got_rpc_reply(ctx, sock, h.recmark, h.xid,
+						 h.direction);
 		}
 	}
-	PTHREAD_MUTEX_unlock(&listlock);
+	PTHREAD_MUTEX_unlock(&conn->lock);
 
-	cnt = h.recmark - 4;
+	cnt = h.recmark - 8;
 	LogDebug(COMPONENT_FSAL, "xid %u is not on the list, skip %d bytes\n",
 		 h.xid, cnt);
 	while (cnt > 0) {
@@ -460,14 +720,14 @@ static int pxy_rpc_read_reply(int sock)
 	return 0;
 }
 
-/* called with listlock */
-static void pxy_new_socket_ready(void)
+/* called with conn->lock */
+static void pxy_new_socket_ready(struct pxy_rpc_conn *conn)
 {
 	struct glist_head *nxt;
 	struct glist_head *c;
 
 	/* If there are any outstanding calls then tell them to resend */
-	glist_for_each_safe(c, nxt, &rpc_calls) {
+	glist_for_each_safe(c, nxt, &conn->calls) {
 		struct pxy_rpc_io_context *ctx =
 		    container_of(c, struct pxy_rpc_io_context, calls);
 
@@ -482,13 +742,13 @@ static void pxy_new_socket_ready(void)
 
 	/* If there is anyone waiting for the socket then tell them
 	 * it's ready */
-	pthread_cond_broadcast(&sockless);
+	pthread_cond_broadcast(&conn->sockless);
 }
 
-/* called with listlock */
-static int pxy_connect(struct pxy_client_params *info,
-		       struct sockaddr_in *dest)
+/* called with conn->lock */
+static int pxy_connect(struct pxy_rpc_conn *conn, struct sockaddr_in *dest)
 {
+	struct pxy_client_params *info = conn->info;
 	int sock;
 
 	if (info->use_privileged_client_port) {
@@ -510,20 +770,21 @@ static int pxy_connect(struct pxy_client_params *info,
 			close(sock);
 			sock = -1;
 		} else {
-			pxy_new_socket_ready();
+			pxy_new_socket_ready(conn);
 		}
 	}
 	return sock;
 }
 
 /*
- * NB! rpc_sock can be closed by the sending thread but it will not be
- *     changing its value. Only this function will change rpc_sock which
+ * NB! conn->sock can be closed by the sending thread but it will not be
+ *     changing its value. Only this function will change conn->sock which
  *     means that it can look at the value without holding the lock.
  */
 static void *pxy_rpc_recv(void *arg)
 {
-	struct pxy_client_params *info = arg;
+	struct pxy_rpc_conn *conn = arg;
+	struct pxy_client_params *info = conn->info;
 	struct sockaddr_in addr_rpc;
 	struct sockaddr_in *info_sock = (struct sockaddr_in *)&info->srv_addr;
 	char addr[INET_ADDRSTRLEN];
@@ -539,34 +800,34 @@ static void *pxy_rpc_recv(void *arg)
 	for (;;) {
 		int nsleeps = 0;
 
-		PTHREAD_MUTEX_lock(&listlock);
+		PTHREAD_MUTEX_lock(&conn->lock);
 		do {
-			rpc_sock = pxy_connect(info, &addr_rpc);
-			if (rpc_sock < 0) {
+			conn->sock = pxy_connect(conn, &addr_rpc);
+			if (conn->sock < 0) {
 				if (nsleeps == 0)
 					LogCrit(COMPONENT_FSAL,
-						"Cannot connect to server %s:%u",
+						"Cannot connect to server %s:%u (connection %u)",
 						inet_ntop(AF_INET,
 							  &addr_rpc.sin_addr,
 							  addr,
 							  sizeof(addr)),
-						info->srv_port);
-				PTHREAD_MUTEX_unlock(&listlock);
+						info->srv_port, conn->index);
+				PTHREAD_MUTEX_unlock(&conn->lock);
 				sleep(info->retry_sleeptime);
 				nsleeps++;
-				PTHREAD_MUTEX_lock(&listlock);
+				PTHREAD_MUTEX_lock(&conn->lock);
 			} else {
 				LogDebug(COMPONENT_FSAL,
-					 "Connected after %d sleeps, resending outstanding calls",
-					 nsleeps);
+					 "Connection %u up after %d sleeps, resending outstanding calls",
+					 conn->index, nsleeps);
 			}
-		} while (rpc_sock < 0);
-		PTHREAD_MUTEX_unlock(&listlock);
+		} while (conn->sock < 0);
+		PTHREAD_MUTEX_unlock(&conn->lock);
 
-		pfd.fd = rpc_sock;
+		pfd.fd = conn->sock;
 		pfd.events = POLLIN | POLLRDHUP;
 
-		while (rpc_sock >= 0) {
+		while (conn->sock >= 0) {
 			switch (poll(&pfd, 1, millisec)) {
 			case 0:
 				LogDebug(COMPONENT_FSAL,
@@ -584,16 +845,16 @@ static void *pxy_rpc_recv(void *arg)
 					LogEvent(COMPONENT_FSAL,
 						 "Socket is closed");
 				} else {
-					if (pxy_rpc_read_reply(rpc_sock) >= 0)
+					if (pxy_rpc_read_reply(conn) >= 0)
 						continue;
 				}
 				break;
 			}
 
-			PTHREAD_MUTEX_lock(&listlock);
-			close(rpc_sock);
-			rpc_sock = -1;
-			PTHREAD_MUTEX_unlock(&listlock);
+			PTHREAD_MUTEX_lock(&conn->lock);
+			close(conn->sock);
+			conn->sock = -1;
+			PTHREAD_MUTEX_unlock(&conn->lock);
 		}
 	}
 
@@ -685,28 +946,221 @@ static enum clnt_stat pxy_process_reply(struct pxy_rpc_io_context *ctx,
 	return rc;
 }
 
-static void pxy_rpc_need_sock(void)
+static void pxy_rpc_need_sock(struct pxy_rpc_conn *conn)
 {
-	PTHREAD_MUTEX_lock(&listlock);
-	while (rpc_sock < 0)
-		pthread_cond_wait(&sockless, &listlock);
-	PTHREAD_MUTEX_unlock(&listlock);
+	PTHREAD_MUTEX_lock(&conn->lock);
+	while (conn->sock < 0)
+		pthread_cond_wait(&conn->sockless, &conn->lock);
+	PTHREAD_MUTEX_unlock(&conn->lock);
 }
 
+/**
+ * @brief Wait for the lease to need renewing
+ *
+ * The first connection is the one the client id was negotiated over,
+ * so it being re-established is what sends the renewer back to get a
+ * new client id and session.  So does a call finding the session gone,
+ * see pxy_session_lost().
+ */
 static int pxy_rpc_renewer_wait(int timeout)
 {
+	struct pxy_rpc_conn *conn = &rpc_conns[0];
 	struct timespec ts;
+	bool lost;
 	int rc;
 
-	PTHREAD_MUTEX_lock(&listlock);
+	PTHREAD_MUTEX_lock(&conn->lock);
+	PTHREAD_MUTEX_lock(&pxy_clientid_mutex);
+	lost = no_sessionid;
+	PTHREAD_MUTEX_unlock(&pxy_clientid_mutex);
+	if (lost) {
+		PTHREAD_MUTEX_unlock(&conn->lock);
+		return false;
+	}
+
 	ts.tv_sec = time(NULL) + timeout;
 	ts.tv_nsec = 0;
 
-	rc = pthread_cond_timedwait(&sockless, &listlock, &ts);
-	PTHREAD_MUTEX_unlock(&listlock);
+	rc = pthread_cond_timedwait(&conn->sockless, &conn->lock, &ts);
+	PTHREAD_MUTEX_unlock(&conn->lock);
 	return (rc == ETIMEDOUT);
 }
 
+/**
+ * @brief Note that the server no longer knows our session
+ *
+ * New calls wait in pxy_get_client_sessionid() until the renewer has
+ * created another one.
+ *
+ * @param[in] sid The session the server rejected
+ */
+static void pxy_session_lost(sessionid4 sid)
+{
+	struct pxy_rpc_conn *conn = &rpc_conns[0];
+
+	PTHREAD_MUTEX_lock(&pxy_clientid_mutex);
+	if (!no_sessionid &&
+	    memcmp(sid, pxy_client_sessionid, sizeof(sessionid4)) == 0) {
+		LogEvent(COMPONENT_FSAL,
+			 "Session with the remote server is gone");
+		no_sessionid = true;
+	}
+	PTHREAD_MUTEX_unlock(&pxy_clientid_mutex);
+
+	PTHREAD_MUTEX_lock(&conn->lock);
+	pthread_cond_broadcast(&conn->sockless);
+	PTHREAD_MUTEX_unlock(&conn->lock);
+}
+
+/**
+ * @brief Start the slot table over for a new session
+ *
+ * @param[in] count Number of slots the server granted
+ */
+static void pxy_slots_reset(uint32_t count)
+{
+	uint32_t i;
+
+	PTHREAD_MUTEX_lock(&pxy_slot_lock);
+	pxy_slot_gen++;
+	pxy_slot_count = MIN(MAX(count, 1), pxy_slot_max);
+	pxy_slot_target = pxy_slot_count;
+	for (i = 0; i < pxy_slot_max; i++)
+		pxy_slots[i].seqid = 0;
+	pxy_lease_renewed = time(NULL);
+	pthread_cond_broadcast(&pxy_slot_free);
+	PTHREAD_MUTEX_unlock(&pxy_slot_lock);
+
+	LogDebug(COMPONENT_FSAL, "Session has %"PRIu32" slots",
+		 pxy_slot_count);
+}
+
+/**
+ * @brief Take a free slot and fill in a SEQUENCE with it
+ *
+ * @param[in,out] opsequence The SEQUENCE arguments
+ *
+ * @return The slot table generation, for pxy_slot_put().
+ */
+static uint32_t pxy_slot_get(SEQUENCE4args *opsequence)
+{
+	slotid4 slot;
+	slotid4 highest;
+	uint32_t gen;
+
+	PTHREAD_MUTEX_lock(&pxy_slot_lock);
+	for (;;) {
+		for (slot = 0; slot < pxy_slot_target; slot++)
+			if (!pxy_slots[slot].busy)
+				break;
+		if (slot < pxy_slot_target)
+			break;
+		pthread_cond_wait(&pxy_slot_free, &pxy_slot_lock);
+	}
+
+	pxy_slots[slot].busy = true;
+	for (highest = pxy_slot_count - 1; highest > slot; highest--)
+		if (pxy_slots[highest].busy)
+			break;
+
+	opsequence->sa_slotid = slot;
+	opsequence->sa_sequenceid = pxy_slots[slot].seqid + 1;
+	opsequence->sa_highest_slotid = highest;
+	gen = pxy_slot_gen;
+	PTHREAD_MUTEX_unlock(&pxy_slot_lock);
+
+	return gen;
+}
+
+/**
+ * @brief Release a slot taken with pxy_slot_get()
+ *
+ * The slot's sequence id only moves on if the server processed the
+ * SEQUENCE; if no reply came back the next call on the slot reuses it.
+ *
+ * @param[in] opsequence The SEQUENCE arguments that were sent
+ * @param[in] gen        Slot table generation from pxy_slot_get()
+ * @param[in] res        The SEQUENCE result, NULL if there was no reply
+ */
+static void pxy_slot_put(SEQUENCE4args *opsequence, uint32_t gen,
+			 SEQUENCE4res *res)
+{
+	slotid4 slot = opsequence->sa_slotid;
+
+	PTHREAD_MUTEX_lock(&pxy_slot_lock);
+	if (gen == pxy_slot_gen && res != NULL && res->sr_status == NFS4_OK) {
+		SEQUENCE4resok *resok = &res->SEQUENCE4res_u.sr_resok4;
+
+		pxy_slots[slot].seqid = opsequence->sa_sequenceid;
+		pxy_slot_target =
+		    MIN(resok->sr_target_highest_slotid + 1, pxy_slot_count);
+		pxy_lease_renewed = time(NULL);
+	}
+	pxy_slots[slot].busy = false;
+	pthread_cond_broadcast(&pxy_slot_free);
+	PTHREAD_MUTEX_unlock(&pxy_slot_lock);
+
+	if (res == NULL)
+		return;
+
+	switch (res->sr_status) {
+	case NFS4_OK:
+		break;
+	case NFS4ERR_BADSESSION:
+	case NFS4ERR_DEADSESSION:
+		pxy_session_lost(opsequence->sa_sessionid);
+		break;
+	default:
+		LogDebug(COMPONENT_FSAL,
+			 "SEQUENCE on slot %"PRIu32" seqid %"PRIu32" failed with %d",
+			 slot, opsequence->sa_sequenceid, res->sr_status);
+		break;
+	}
+}
+
+/**
+ * @brief Seconds until the renewer has to renew the lease itself
+ *
+ * @param[in] lease_time The server's lease time
+ */
+static int pxy_lease_wait(uint32_t lease_time)
+{
+	time_t renewed;
+
+	PTHREAD_MUTEX_lock(&pxy_slot_lock);
+	renewed = pxy_lease_renewed;
+	PTHREAD_MUTEX_unlock(&pxy_slot_lock);
+
+	return renewed + (time_t) lease_time - 5 - time(NULL);
+}
+
+/**
+ * @brief Choose the connection to send a call on
+ *
+ * Calls are spread over the connections by XID.  If the chosen one is
+ * down the next one that is up is used instead.  sock is only peeked
+ * at here; the sender checks it again under the connection's lock.
+ *
+ * @param[in] xid XID of the call
+ *
+ * @return The connection.
+ */
+static struct pxy_rpc_conn *pxy_rpc_pick_conn(uint32_t xid)
+{
+	unsigned int start = xid % rpc_nconns;
+	unsigned int i;
+
+	for (i = 0; i < rpc_nconns; i++) {
+		struct pxy_rpc_conn *conn =
+				&rpc_conns[(start + i) % rpc_nconns];
+
+		if (conn->sock >= 0)
+			return conn;
+	}
+
+	return &rpc_conns[start];
+}
+
 static int pxy_compoundv4_call(struct pxy_rpc_io_context *pcontext,
 			       const struct user_cred *cred,
 			       COMPOUND4args *args, COMPOUND4res *res)
@@ -715,10 +1169,9 @@ static int pxy_compoundv4_call(struct pxy_rpc_io_context *pcontext,
 	struct rpc_msg rmsg;
 	AUTH *au;
 	enum clnt_stat rc;
+	struct pxy_rpc_conn *conn;
 
-	PTHREAD_MUTEX_lock(&listlock);
-	rmsg.rm_xid = rpc_xid++;
-	PTHREAD_MUTEX_unlock(&listlock);
+	rmsg.rm_xid = atomic_inc_uint32_t(&rpc_xid);
 	rmsg.rm_direction = CALL;
 
 	rmsg.rm_call.cb_rpcvers = RPC_MSG_VERSION;
@@ -748,6 +1201,8 @@ static int pxy_compoundv4_call(struct pxy_rpc_io_context *pcontext,
 		int first_try = 1;
 
 		pcontext->rpc_xid = rmsg.rm_xid;
+		conn = pxy_rpc_pick_conn(rmsg.rm_xid);
+		pcontext->conn = conn;
 
 		memcpy(pcontext->sendbuf, &recmark, sizeof(recmark));
 		pos += 4;
@@ -756,15 +1211,16 @@ static int pxy_compoundv4_call(struct pxy_rpc_io_context *pcontext,
 			int bc = 0;
 			char *buf = pcontext->sendbuf;
 
-			LogDebug(COMPONENT_FSAL, "%ssend XID %u with %d bytes",
+			LogDebug(COMPONENT_FSAL,
+				 "%ssend XID %u with %d bytes on connection %u",
 				 (first_try ? "First attempt to " : "Re"),
-				 rmsg.rm_xid, pos);
-			PTHREAD_MUTEX_lock(&listlock);
-			while (bc < pos) {
-				int wc = write(rpc_sock, buf, pos - bc);
+				 rmsg.rm_xid, pos, conn->index);
+			PTHREAD_MUTEX_lock(&conn->lock);
+			while (conn->sock >= 0 && bc < pos) {
+				int wc = write(conn->sock, buf, pos - bc);
 
 				if (wc <= 0) {
-					close(rpc_sock);
+					close(conn->sock);
 					break;
 				}
 				bc += wc;
@@ -773,7 +1229,7 @@ static int pxy_compoundv4_call(struct pxy_rpc_io_context *pcontext,
 
 			if (bc == pos) {
 				if (first_try) {
-					glist_add_tail(&rpc_calls,
+					glist_add_tail(&conn->calls,
 						       &pcontext->calls);
 					first_try = 0;
 				}
@@ -781,7 +1237,7 @@ static int pxy_compoundv4_call(struct pxy_rpc_io_context *pcontext,
 				if (!first_try)
 					glist_del(&pcontext->calls);
 			}
-			PTHREAD_MUTEX_unlock(&listlock);
+			PTHREAD_MUTEX_unlock(&conn->lock);
 
 			if (bc == pos)
 				rc = pxy_process_reply(pcontext, res);
@@ -802,6 +1258,9 @@ int pxy_compoundv4_execute(const char *caller, const struct user_cred *creds,
 {
 	enum clnt_stat rc;
 	struct pxy_rpc_io_context *ctx;
+	SEQUENCE4args *opsequence = NULL;
+	SEQUENCE4res *seq_res = NULL;
+	uint32_t slot_gen = 0;
 	COMPOUND4args arg = {
 		.minorversion = FSAL_PROXY_NFS_V4_MINOR,
 		.argarray.argarray_val = argoparray,
@@ -812,6 +1271,12 @@ int pxy_compoundv4_execute(const char *caller, const struct user_cred *creds,
 		.resarray.resarray_len = cnt
 	};
 
+	/* fill slotid and sequenceid */
+	if (argoparray->argop == NFS4_OP_SEQUENCE) {
+		opsequence = &argoparray->nfs_argop4_u.opsequence;
+		slot_gen = pxy_slot_get(opsequence);
+	}
+
 	PTHREAD_MUTEX_lock(&context_lock);
 	while (glist_empty(&free_contexts))
 		pthread_cond_wait(&need_context, &context_lock);
@@ -820,24 +1285,13 @@ int pxy_compoundv4_execute(const char *caller, const struct user_cred *creds,
 	glist_del(&ctx->calls);
 	PTHREAD_MUTEX_unlock(&context_lock);
 
-	/* fill slotid and sequenceid */
-	if (argoparray->argop == NFS4_OP_SEQUENCE) {
-		SEQUENCE4args *opsequence =
-					&argoparray->nfs_argop4_u.opsequence;
-
-		/* set slotid */
-		opsequence->sa_slotid = ctx->slotid;
-		/* increment and set sequence id */
-		opsequence->sa_sequenceid = ++ctx->seqid;
-	}
-
 	do {
 		rc = pxy_compoundv4_call(ctx, creds, &arg, &res);
 		if (rc != RPC_SUCCESS)
 			LogDebug(COMPONENT_FSAL, "%s failed with %d", caller,
 				 rc);
 		if (rc == RPC_CANTSEND)
-			pxy_rpc_need_sock();
+			pxy_rpc_need_sock(ctx->conn);
 	} while ((rc == RPC_CANTRECV && (ctx->ioresult == -EAGAIN))
 		 || (rc == RPC_CANTSEND));
 
@@ -846,6 +1300,13 @@ int pxy_compoundv4_execute(const char *caller, const struct user_cred *creds,
 	glist_add(&free_contexts, &ctx->calls);
 	PTHREAD_MUTEX_unlock(&context_lock);
 
+	if (opsequence != NULL) {
+		if (rc == RPC_SUCCESS && res.resarray.resarray_len > 0 &&
+		    resoparray->resop == NFS4_OP_SEQUENCE)
+			seq_res = &resoparray->nfs_resop4_u.opsequence;
+		pxy_slot_put(opsequence, slot_gen, seq_res);
+	}
+
 	if (rc == RPC_SUCCESS)
 		return res.status;
 	return rc;
@@ -877,6 +1338,254 @@ static inline void pxy_get_client_seqid(sequenceid4 *ret)
 	PTHREAD_MUTEX_unlock(&pxy_clientid_mutex);
 }
 
+/**
+ * @brief Run one CB_COMPOUND
+ *
+ * Only CB_SEQUENCE, CB_RECALL and CB_RECALL_ANY are understood, any
+ * other operation gets NFS4ERR_NOTSUPP.  There is no reply cache, a
+ * retried call is simply run again, which is harmless for these.
+ *
+ * @param[in]  info Remote server parameters
+ * @param[in]  args The call
+ * @param[out] res  The results, resarray to be freed by the caller
+ */
+static void pxy_cb_compound(struct pxy_client_params *info,
+			    CB_COMPOUND4args *args, CB_COMPOUND4res *res)
+{
+	u_int n = args->argarray.argarray_len;
+	nfs_cb_resop4 *resop = gsh_calloc(MAX(n, 1), sizeof(*resop));
+	nfsstat4 status = NFS4_OK;
+	u_int i;
+
+	res->tag = args->tag;
+	res->resarray.resarray_val = resop;
+
+	for (i = 0; i < n && status == NFS4_OK; i++) {
+		nfs_cb_argop4 *op = &args->argarray.argarray_val[i];
+		CB_SEQUENCE4args *seq = &op->nfs_cb_argop4_u.opcbsequence;
+		CB_SEQUENCE4res *seqres =
+				&resop[i].nfs_cb_resop4_u.opcbsequence;
+		CB_SEQUENCE4resok *seqok =
+				&seqres->CB_SEQUENCE4res_u.csr_resok4;
+
+		resop[i].resop = op->argop;
+
+		if (i == 0 && op->argop != NFS4_OP_CB_SEQUENCE) {
+			status = NFS4ERR_OP_NOT_IN_SESSION;
+		} else if (op->argop == NFS4_OP_CB_SEQUENCE) {
+			PTHREAD_MUTEX_lock(&pxy_clientid_mutex);
+			if (i != 0)
+				status = NFS4ERR_SEQUENCE_POS;
+			else if (no_sessionid ||
+				 memcmp(seq->csa_sessionid,
+					pxy_client_sessionid,
+					sizeof(sessionid4)) != 0)
+				status = NFS4ERR_BADSESSION;
+			PTHREAD_MUTEX_unlock(&pxy_clientid_mutex);
+
+			memcpy(seqok->csr_sessionid, seq->csa_sessionid,
+			       sizeof(sessionid4));
+			seqok->csr_sequenceid = seq->csa_sequenceid;
+			seqok->csr_slotid = seq->csa_slotid;
+			seqok->csr_highest_slotid = seq->csa_highest_slotid;
+			seqok->csr_target_highest_slotid =
+						info->session_slots - 1;
+		} else if (op->argop == NFS4_OP_CB_RECALL) {
+			status = pxy_deleg_return(
+					&op->nfs_cb_argop4_u.opcbrecall.fh);
+		} else if (op->argop != NFS4_OP_CB_RECALL_ANY) {
+			status = NFS4ERR_NOTSUPP;
+		}
+
+		/* Every result starts with its status */
+		resop[i].nfs_cb_resop4_u.opcbillegal.status = status;
+	}
+
+	res->status = status;
+	res->resarray.resarray_len = i;
+}
+
+/**
+ * @brief Answer a call the server sent on the back channel
+ *
+ * This runs on the connection's receiver thread, so nothing here may
+ * wait for a reply from the server.  Recalled delegations are handed
+ * to the returner thread.
+ *
+ * @param[in] conn Connection the call came in on
+ * @param[in] sz   Record size, including the xid and direction
+ * @param[in] xid  XID of the call
+ *
+ * @return 0, or -errno if the connection has to be dropped.
+ */
+static int pxy_rpc_callback(struct pxy_rpc_conn *conn, int sz, u_int xid)
+{
+	struct pxy_client_params *info = conn->info;
+	char body[MAX_AUTH_BYTES];
+	struct opaque_auth cred = { .oa_base = body };
+	struct opaque_auth verf = { .oa_base = body };
+	uint32_t rpcvers, prog, vers, proc;
+	CB_COMPOUND4args args;
+	CB_COMPOUND4res res;
+	struct rpc_msg reply;
+	char *buf, *p;
+	u_int pos, recmark;
+	int cnt, rc = 0;
+	XDR x;
+
+	if (sz < 8 || sz > info->srv_recvsize)
+		return -E2BIG;
+
+	buf = gsh_malloc(MAX(sz, info->srv_sendsize));
+	for (p = buf, cnt = sz - 8; cnt > 0; p += rc, cnt -= rc) {
+		rc = read(conn->sock, p, cnt);
+		if (rc <= 0) {
+			rc = rc < 0 ? -errno : -ECONNRESET;
+			goto out;
+		}
+	}
+	rc = 0;
+
+	memset(&args, 0, sizeof(args));
+	memset(&res, 0, sizeof(res));
+	memset(&reply, 0, sizeof(reply));
+	reply.rm_xid = xid;
+	reply.rm_direction = REPLY;
+	reply.rm_reply.rp_stat = MSG_ACCEPTED;
+	reply.RPCM_ack.ar_verf.oa_flavor = AUTH_NONE;
+	reply.RPCM_ack.ar_results.proc = (xdrproc_t) xdr_void;
+
+	xdrmem_create(&x, buf, sz - 8, XDR_DECODE);
+	if (!xdr_uint32_t(&x, &rpcvers) || rpcvers != RPC_MSG_VERSION ||
+	    !xdr_uint32_t(&x, &prog) || !xdr_uint32_t(&x, &vers) ||
+	    !xdr_uint32_t(&x, &proc) || !xdr_opaque_auth(&x, &cred) ||
+	    !xdr_opaque_auth(&x, &verf)) {
+		LogInfo(COMPONENT_FSAL,
+			"Dropping malformed call %u from the server", xid);
+		goto out;
+	}
+
+	if (prog != info->srv_prognum || vers != NFS_CB) {
+		reply.RPCM_ack.ar_stat = PROG_UNAVAIL;
+	} else if (proc == CB_NULL) {
+		reply.RPCM_ack.ar_stat = SUCCESS;
+	} else if (proc != CB_COMPOUND) {
+		reply.RPCM_ack.ar_stat = PROC_UNAVAIL;
+	} else if (!xdr_CB_COMPOUND4args(&x, &args)) {
+		reply.RPCM_ack.ar_stat = GARBAGE_ARGS;
+	} else {
+		pxy_cb_compound(info, &args, &res);
+		reply.RPCM_ack.ar_stat = SUCCESS;
+		reply.RPCM_ack.ar_results.where = (caddr_t) &res;
+		reply.RPCM_ack.ar_results.proc =
+					(xdrproc_t) xdr_CB_COMPOUND4res;
+	}
+
+	xdrmem_create(&x, buf + 4, info->srv_sendsize - 4, XDR_ENCODE);
+	if (!xdr_replymsg(&x, &reply)) {
+		LogCrit(COMPONENT_FSAL,
+			"Cannot encode the reply to call %u from the server",
+			xid);
+		goto free;
+	}
+
+	pos = xdr_getpos(&x);
+	recmark = htonl(pos | (1U << 31));
+	memcpy(buf, &recmark, sizeof(recmark));
+	pos += 4;
+
+	/* Written under the lock so it goes between whole calls */
+	PTHREAD_MUTEX_lock(&conn->lock);
+	for (p = buf, cnt = pos; cnt > 0; p += rc, cnt -= rc) {
+		rc = write(conn->sock, p, cnt);
+		if (rc <= 0) {
+			rc = -errno;
+			break;
+		}
+	}
+	PTHREAD_MUTEX_unlock(&conn->lock);
+	if (rc > 0)
+		rc = 0;
+
+free:
+	gsh_free(res.resarray.resarray_val);
+	xdr_free((xdrproc_t) xdr_CB_COMPOUND4args, &args);
+out:
+	gsh_free(buf);
+	return rc;
+}
+
+/**
+ * @brief Send DELEGRETURN for a delegation
+ *
+ * @param[in] d The delegation
+ */
+static void pxy_delegreturn(struct pxy_deleg *d)
+{
+	nfs_argop4 arg[3];
+	nfs_resop4 res[3];
+	nfs_fh4 fh = {
+		.nfs_fh4_len = d->blob.len - sizeof(d->blob),
+		.nfs_fh4_val = (char *)d->blob.bytes
+	};
+	sessionid4 sid;
+	int opcnt = 0;
+	int rc;
+
+	pxy_get_client_sessionid(sid);
+	COMPOUNDV4_ARG_ADD_OP_SEQUENCE(opcnt, arg, sid, NB_RPC_SLOT);
+	COMPOUNDV4_ARG_ADD_OP_PUTFH(opcnt, arg, fh);
+	COMPOUNDV4_ARG_ADD_OP_DELEGRETURN(opcnt, arg, d->stateid);
+
+	rc = pxy_compoundv4_execute(__func__, NULL, opcnt, arg, res);
+	if (rc != NFS4_OK)
+		LogDebug(COMPONENT_FSAL, "DELEGRETURN failed with %d", rc);
+}
+
+/**
+ * @brief Stop caching and give back queued delegations
+ *
+ * The object is invalidated in the cache above us before the
+ * delegation goes back, which is what makes it safe for MDCACHE to
+ * trust a delegated object's attributes and data until then.
+ */
+static void *pxy_deleg_returner(void *arg)
+{
+	struct pxy_deleg *d;
+	struct gsh_buffdesc key;
+	const struct fsal_up_vector *up_ops;
+
+	SetNameFunction("pxy_deleg");
+
+	PTHREAD_MUTEX_lock(&pxy_deleg_lock);
+	for (;;) {
+		pxy_deleg_busy = false;
+		while (glist_empty(&pxy_deleg_returns)) {
+			pthread_cond_broadcast(&pxy_deleg_cond);
+			pthread_cond_wait(&pxy_deleg_cond, &pxy_deleg_lock);
+		}
+		d = glist_first_entry(&pxy_deleg_returns, struct pxy_deleg,
+				      node);
+		glist_del(&d->node);
+		pxy_deleg_busy = true;
+		PTHREAD_MUTEX_unlock(&pxy_deleg_lock);
+
+		key.addr = &d->blob;
+		key.len = d->blob.len;
+		up_ops = d->exp->up_ops;
+		(void) up_ops->invalidate(up_ops, &key,
+					  FSAL_UP_INVALIDATE_CACHE);
+
+		if (!d->revoked)
+			pxy_delegreturn(d);
+		gsh_free(d);
+
+		PTHREAD_MUTEX_lock(&pxy_deleg_lock);
+	}
+
+	return NULL;
+}
+
 /**
  * Confirm pxy_clientid to set a new session.
  *
@@ -928,6 +1637,13 @@ static int pxy_setsessionid(sessionid4 new_sessionid, uint32_t *lease_time,
 	       res_ok->csr_sessionid,
 	       sizeof(sessionid4));
 
+	/* The slot table starts over with the new session */
+	pxy_slots_reset(res_ok->csr_fore_chan_attrs.ca_maxrequests);
+	PTHREAD_MUTEX_lock(&pxy_clientid_mutex);
+	pxy_session_maxops = MIN(res_ok->csr_fore_chan_attrs.ca_maxoperations,
+				 NB_MAX_OPERATIONS);
+	PTHREAD_MUTEX_unlock(&pxy_clientid_mutex);
+
 	/* Get the lease time */
 	opcnt = 0;
 	COMPOUNDV4_ARG_ADD_OP_SEQUENCE(opcnt, arg, new_sessionid, NB_RPC_SLOT);
@@ -974,7 +1690,7 @@ static int pxy_setclientid(clientid4 *new_clientid, sequenceid4 *new_seqid)
 		 "Negotiating a new ClientId with the remote server");
 
 	/* prepare input */
-	if (getsockname(rpc_sock, &sin, &slen))
+	if (getsockname(rpc_conns[0].sock, &sin, &slen))
 		return -errno;
 
 	snprintf(clientid_name, MAXNAMLEN, "%s(%d) - GANESHA NFSv4 Proxy",
@@ -1019,6 +1735,60 @@ static int pxy_setclientid(clientid4 *new_clientid, sequenceid4 *new_seqid)
 	return 0;
 }
 
+/**
+ * @brief Send a SEQUENCE on its own to renew the lease
+ *
+ * @return 0 on success, -1 if the session could not be renewed.
+ */
+static int pxy_renew_session(void)
+{
+	nfs_argop4 seq_arg;
+	nfs_resop4 res;
+	int opcnt = 0;
+	int rc;
+	sessionid4 sid;
+	clientid4 cid;
+	SEQUENCE4res *s_res;
+	SEQUENCE4resok *s_resok;
+
+	pxy_get_clientid(&cid);
+	PTHREAD_MUTEX_lock(&pxy_clientid_mutex);
+	if (no_sessionid) {
+		PTHREAD_MUTEX_unlock(&pxy_clientid_mutex);
+		return -1;
+	}
+	memcpy(sid, pxy_client_sessionid, sizeof(sessionid4));
+	PTHREAD_MUTEX_unlock(&pxy_clientid_mutex);
+
+	LogDebug(COMPONENT_FSAL,
+		 "Try renew session id for client id %"PRIx64, cid);
+	COMPOUNDV4_ARG_ADD_OP_SEQUENCE(opcnt, &seq_arg, sid, NB_RPC_SLOT);
+	s_res = &res.nfs_resop4_u.opsequence;
+	s_resok = &s_res->SEQUENCE4res_u.sr_resok4;
+	s_resok->sr_status_flags = 0;
+	rc = pxy_compoundv4_execute(__func__, NULL, 1, &seq_arg, &res);
+	if (rc != NFS4_OK)
+		return -1;
+
+	if (s_resok->sr_status_flags)
+		LogEvent(COMPONENT_FSAL,
+			 "sr_status_flags received on renewing session with seqop : %"PRIu32,
+			 s_resok->sr_status_flags);
+	else
+		LogDebug(COMPONENT_FSAL,
+			 "New session id for client id %"PRIu64, cid);
+	return 0;
+}
+
+/**
+ * @brief Keep the client id and session alive
+ *
+ * Every call starts with a SEQUENCE, which renews the lease, so this
+ * thread only sends one of its own when the proxy has been idle for
+ * most of a lease period.  Otherwise it sleeps until a connection is
+ * re-established or a call finds the session gone, and then gets a new
+ * session, or a new client id first if that fails.
+ */
 static void *pxy_clientid_renewer(void *arg)
 {
 	struct pxy_client_params *info = arg;
@@ -1030,49 +1800,19 @@ static void *pxy_clientid_renewer(void *arg)
 		clientid4 newcid = 0;
 		sequenceid4 newseqid = 0;
 
-		if (!sessionid_needed && pxy_rpc_renewer_wait(lease_time - 5)) {
-			/* Simply renew the session id you've got */
-			nfs_argop4 seq_arg;
-			nfs_resop4 res;
-			int opcnt = 0;
-			int rc;
-			sessionid4 sid;
-			clientid4 cid;
-			SEQUENCE4res *s_res;
-			SEQUENCE4resok *s_resok;
-
-			pxy_get_clientid(&cid);
-			pxy_get_client_sessionid(sid);
-			LogDebug(COMPONENT_FSAL,
-				 "Try renew session id for client id %"PRIx64,
-				 cid);
-			COMPOUNDV4_ARG_ADD_OP_SEQUENCE(opcnt, &seq_arg, sid,
-						       NB_RPC_SLOT);
-			s_res = &res.nfs_resop4_u.opsequence;
-			s_resok = &s_res->SEQUENCE4res_u.sr_resok4;
-			s_resok->sr_status_flags = 0;
-			rc = pxy_compoundv4_execute(__func__, NULL, 1, &seq_arg,
-						    &res);
-			if (rc == NFS4_OK && !s_resok->sr_status_flags) {
-				LogDebug(COMPONENT_FSAL,
-					 "New session id for client id %"PRIu64,
-					 cid);
+		if (!sessionid_needed &&
+		    pxy_rpc_renewer_wait(MAX(pxy_lease_wait(lease_time), 1))) {
+			/* Other calls renewed the lease while we slept */
+			if (pxy_lease_wait(lease_time) > 0)
 				continue;
-			} else if (rc == NFS4_OK &&
-				   s_resok->sr_status_flags) {
-				LogEvent(COMPONENT_FSAL,
-	"sr_status_flags received on renewing session with seqop : %"PRIu32,
-					 s_resok->sr_status_flags);
+			if (pxy_renew_session() == 0)
 				continue;
-			} else if (rc != NFS4_OK) {
-				LogEvent(COMPONENT_FSAL,
-					 "Failed to renew session");
-			}
+			LogEvent(COMPONENT_FSAL, "Failed to renew session");
 		}
 
 		/* We've either failed to renew or rpc socket has been
 		 * reconnected and we need new clientid or sessionid. */
-		pxy_rpc_need_sock();
+		pxy_rpc_need_sock(&rpc_conns[0]);
 
 		/* We need a new session_id */
 		if (!clientid_needed) {
@@ -1107,6 +1847,8 @@ static void *pxy_clientid_renewer(void *arg)
 			pxy_clientid = newcid;
 			pxy_client_seqid = newseqid;
 			PTHREAD_MUTEX_unlock(&pxy_clientid_mutex);
+			/* Delegations went with the old client id */
+			pxy_deleg_revoke_all();
 		}
 	}
 	return NULL;
@@ -1128,31 +1870,31 @@ static void free_io_contexts(void)
 int pxy_init_rpc(const struct pxy_fsal_module *pm)
 {
 	int rc;
-	int i = NB_RPC_SLOT;
-
-	PTHREAD_MUTEX_lock(&listlock);
-	glist_init(&rpc_calls);
-	PTHREAD_MUTEX_unlock(&listlock);
+	int i;
+	unsigned int n;
 
 	PTHREAD_MUTEX_lock(&context_lock);
 	glist_init(&free_contexts);
 	PTHREAD_MUTEX_unlock(&context_lock);
 
 /**
- * @todo this lock is not really necessary so long as we can
+ * @todo the connections and contexts are global so long as we can
  *       only do one export at a time.  This is a reminder that
  *       there is work to do to get this fnctn to truely be
  *       per export.
  */
-	PTHREAD_MUTEX_lock(&listlock);
 	if (rpc_xid == 0)
-		rpc_xid = getpid() ^ time(NULL);
-	PTHREAD_MUTEX_unlock(&listlock);
+		atomic_store_uint32_t(&rpc_xid, getpid() ^ time(NULL));
 	if (gethostname(pxy_hostname, sizeof(pxy_hostname)))
 		strncpy(pxy_hostname, "NFS-GANESHA/Proxy",
 			sizeof(pxy_hostname));
 
-	for (i = NB_RPC_SLOT; i > 0; i--) {
+	pxy_slot_max = pm->special.session_slots;
+	pxy_slots = gsh_calloc(pxy_slot_max, sizeof(*pxy_slots));
+
+	/* One context per slot, and one for the calls that set up the
+	 * session and are sent outside of it. */
+	for (i = pxy_slot_max + 1; i > 0; i--) {
 		struct pxy_rpc_io_context *c =
 		    gsh_malloc(sizeof(*c) + pm->special.srv_sendsize +
 			       pm->special.srv_recvsize);
@@ -1167,8 +1909,6 @@ int pxy_init_rpc(const struct pxy_fsal_module *pm)
 		c->recvbuf_sz = pm->special.srv_recvsize;
 		c->sendbuf = (char *)(c + 1);
 		c->recvbuf = c->sendbuf + c->sendbuf_sz;
-		c->slotid = i;
-		c->seqid = 0;
 		c->iodone = false;
 
 		PTHREAD_MUTEX_lock(&context_lock);
@@ -1176,14 +1916,45 @@ int pxy_init_rpc(const struct pxy_fsal_module *pm)
 		PTHREAD_MUTEX_unlock(&context_lock);
 	}
 
-	rc = pthread_create(&pxy_recv_thread, NULL, pxy_rpc_recv,
-			    (void *)&pm->special);
-	if (rc) {
-		LogCrit(COMPONENT_FSAL,
-			"Cannot create proxy rpc receiver thread - %s",
-			strerror(rc));
-		free_io_contexts();
-		return rc;
+	rpc_nconns = pm->special.rpc_connections;
+	rpc_conns = gsh_calloc(rpc_nconns, sizeof(*rpc_conns));
+
+	for (n = 0; n < rpc_nconns; n++) {
+		struct pxy_rpc_conn *conn = &rpc_conns[n];
+
+		PTHREAD_MUTEX_init(&conn->lock, NULL);
+		PTHREAD_COND_init(&conn->sockless, NULL);
+		glist_init(&conn->calls);
+		conn->sock = -1;
+		conn->index = n;
+		conn->info = (struct pxy_client_params *)&pm->special;
+
+		rc = pthread_create(&conn->recv_thread, NULL, pxy_rpc_recv,
+				    conn);
+		if (rc) {
+			LogCrit(COMPONENT_FSAL,
+				"Cannot create proxy rpc receiver thread - %s",
+				strerror(rc));
+			free_io_contexts();
+			return rc;
+		}
+	}
+
+	for (n = 0; n < PXY_DELEG_BUCKETS; n++)
+		glist_init(&pxy_deleg_table[n]);
+	glist_init(&pxy_deleg_returns);
+	pxy_delegations = pm->special.delegations;
+
+	if (pxy_delegations) {
+		rc = pthread_create(&pxy_deleg_thread, NULL,
+				    pxy_deleg_returner, NULL);
+		if (rc) {
+			LogCrit(COMPONENT_FSAL,
+				"Cannot create proxy delegation returner thread - %s",
+				strerror(rc));
+			free_io_contexts();
+			return rc;
+		}
 	}
 
 	rc = pthread_create(&pxy_renewer_thread, NULL, pxy_clientid_renewer,
@@ -1959,6 +2730,77 @@ static fsal_status_t pxy_getattrs(struct fsal_obj_handle *obj_hdl,
 	    NFS4_OK)
 		return fsalstat(ERR_FSAL_INVAL, 0);
 
+	if (pxy_deleg_stateid(&ph->fh4, false, NULL))
+		attrs->expire_time_attr = -1;
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/* Children fetched per compound by pxy_getattrs_bulk */
+#define PXY_GETATTRS_BULK_MAX 16
+
+/*
+ * One SEQUENCE then a PUTFH/GETATTR pair per object.  If any object
+ * fails, the compound stops there, and that batch is redone one object
+ * at a time so each gets its own answer.
+ */
+static fsal_status_t pxy_getattrs_bulk(struct fsal_obj_handle *dir_hdl,
+				       uint32_t count,
+				       struct fsal_obj_handle **obj_hdls,
+				       struct attrlist **attrs)
+{
+	nfs_argop4 argoparray[1 + 2 * PXY_GETATTRS_BULK_MAX];
+	nfs_resop4 resoparray[1 + 2 * PXY_GETATTRS_BULK_MAX];
+	GETATTR4resok *atok[PXY_GETATTRS_BULK_MAX];
+	struct pxy_obj_handle *ph;
+	uint32_t done, n, i, opcnt;
+	sessionid4 sid;
+	char *blobs;
+	int rc;
+
+	blobs = gsh_malloc(PXY_GETATTRS_BULK_MAX * FATTR_BLOB_SZ);
+
+	for (done = 0; done < count; done += n) {
+		n = count - done;
+		if (n > PXY_GETATTRS_BULK_MAX)
+			n = PXY_GETATTRS_BULK_MAX;
+		opcnt = 0;
+
+		/* SEQUENCE */
+		pxy_get_client_sessionid(sid);
+		COMPOUNDV4_ARG_ADD_OP_SEQUENCE(opcnt, argoparray, sid,
+					       NB_RPC_SLOT);
+
+		for (i = 0; i < n; i++) {
+			ph = container_of(obj_hdls[done + i],
+					  struct pxy_obj_handle, obj);
+			COMPOUNDV4_ARG_ADD_OP_PUTFH(opcnt, argoparray, ph->fh4);
+			atok[i] = pxy_fill_getattr_reply(
+					resoparray + opcnt,
+					blobs + i * FATTR_BLOB_SZ,
+					FATTR_BLOB_SZ);
+			COMPOUNDV4_ARG_ADD_OP_GETATTR(opcnt, argoparray,
+						      pxy_bitmap_getattr);
+		}
+
+		rc = pxy_nfsv4_call(op_ctx->fsal_export, op_ctx->creds, opcnt,
+				    argoparray, resoparray);
+
+		for (i = 0; i < n; i++) {
+			if (rc == NFS4_OK &&
+			    nfs4_Fattr_To_FSAL_attr(attrs[done + i],
+						    &atok[i]->obj_attributes,
+						    NULL) == NFS4_OK)
+				continue;
+
+			/* Sets ATTR_RDATTR_ERR on failure */
+			(void) pxy_getattrs(obj_hdls[done + i],
+					    attrs[done + i]);
+		}
+	}
+
+	gsh_free(blobs);
+
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
@@ -2139,6 +2981,9 @@ static void pxy_hdl_release(struct fsal_obj_handle *obj_hdl)
 	struct pxy_obj_handle *ph =
 	    container_of(obj_hdl, struct pxy_obj_handle, obj);
 
+	if (obj_hdl->type == REGULAR_FILE)
+		(void) pxy_deleg_return(&ph->fh4);
+
 	fsal_obj_handle_fini(obj_hdl);
 
 	gsh_free(ph);
@@ -2488,6 +3333,7 @@ static fsal_status_t pxy_open2(struct fsal_obj_handle *obj_hdl,
 	GETATTR4resok *atok;
 	char fattr_blob[FATTR_BLOB_SZ];
 	bool setattr_needed = false;
+	bool want_deleg, delegated = false;
 
 	/* we have not done yet any check */
 	*caller_perm_check = true;
@@ -2495,6 +3341,13 @@ static fsal_status_t pxy_open2(struct fsal_obj_handle *obj_hdl,
 	/* get back proxy handle */
 	ph = container_of(obj_hdl, struct pxy_obj_handle, obj);
 
+	/* Opening a file we hold no delegation on is a chance to get one */
+	want_deleg = pxy_delegations &&
+		     (name != NULL || (obj_hdl->type == REGULAR_FILE &&
+				       !pxy_deleg_stateid(&ph->fh4,
+						openflags & FSAL_O_WRITE,
+						NULL)));
+
 	/* include TRUNCATE case in attrs_in */
 	if (openflags & FSAL_O_TRUNC) {
 		attrs_in->valid_mask |= ATTR_SIZE;
@@ -2510,7 +3363,7 @@ static fsal_status_t pxy_open2(struct fsal_obj_handle *obj_hdl,
 	 * -open by handle to get attrs_out
 	 * -open by handle to truncate
 	 */
-	if (name || attrs_out || openflags & FSAL_O_TRUNC) {
+	if (name || attrs_out || openflags & FSAL_O_TRUNC || want_deleg) {
 		/*
 		* We do the open to get handle, check perm, check share, trunc,
 		* create if needed ...
@@ -2533,6 +3386,7 @@ static fsal_status_t pxy_open2(struct fsal_obj_handle *obj_hdl,
 		    &resoparray[opcnt].nfs_resop4_u.opopen.OPEN4res_u.resok4;
 		opok->rflags = 0; /* set to NULL for safety */
 		opok->attrset = empty_bitmap; /* set to empty for safety */
+		memset(&opok->delegation, 0, sizeof(opok->delegation));
 		/* prepare open input args */
 		/* share_access and share_deny */
 		st = fill_share_OPEN4args(&share_access, &share_deny,
@@ -2541,6 +3395,10 @@ static fsal_status_t pxy_open2(struct fsal_obj_handle *obj_hdl,
 			nfs4_Fattr_Free(&inattrs);
 			return st;
 		}
+		if (want_deleg)
+			share_access |= openflags & FSAL_O_WRITE
+					? OPEN4_SHARE_ACCESS_WANT_WRITE_DELEG
+					: OPEN4_SHARE_ACCESS_WANT_READ_DELEG;
 
 		/* owner */
 		snprintf(owner_val, sizeof(owner_val),
@@ -2593,6 +3451,15 @@ static fsal_status_t pxy_open2(struct fsal_obj_handle *obj_hdl,
 			return nfsstat4_to_fsal(rc);
 		}
 
+		/* The delegation outlives the close below */
+		if (want_deleg) {
+			pxy_deleg_add(op_ctx->fsal_export, &fhok->object,
+				      &opok->delegation);
+			delegated = pxy_deleg_stateid(&fhok->object, false,
+						      NULL);
+		}
+		xdr_free((xdrproc_t) xdr_open_delegation4, &opok->delegation);
+
 		/* The created file is still opened, to preserve the correct
 		 * seqid for later use, we close it */
 		/* we don't manage state : immediately close state on server */
@@ -2663,9 +3530,31 @@ static fsal_status_t pxy_open2(struct fsal_obj_handle *obj_hdl,
 			return nfsstat4_to_fsal(rc);
 	}
 
+	/* Nobody else can change it until the delegation is recalled */
+	if (attrs_out && delegated)
+		attrs_out->expire_time_attr = -1;
+
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
+/**
+ * @brief Check for a call that used a delegation given back meanwhile
+ *
+ * @param[in] rc Result of the call
+ */
+static bool pxy_deleg_stale(int rc)
+{
+	switch (rc) {
+	case NFS4ERR_BAD_STATEID:
+	case NFS4ERR_OLD_STATEID:
+	case NFS4ERR_EXPIRED:
+	case NFS4ERR_DELEG_REVOKED:
+		return true;
+	default:
+		return false;
+	}
+}
+
 static fsal_status_t pxy_read2(struct fsal_obj_handle *obj_hdl,
 			       bool bypass,
 			       struct state_t *state,
@@ -2685,6 +3574,8 @@ static fsal_status_t pxy_read2(struct fsal_obj_handle *obj_hdl,
 	nfs_argop4 argoparray[FSAL_READ2_NB_OP_ALLOC];
 	nfs_resop4 resoparray[FSAL_READ2_NB_OP_ALLOC];
 	READ4resok *rok;
+	stateid4 *stateid;
+	bool deleg = false;
 
 	ph = container_of(obj_hdl, struct pxy_obj_handle, obj);
 
@@ -2702,16 +3593,25 @@ static fsal_status_t pxy_read2(struct fsal_obj_handle *obj_hdl,
 	rok = &resoparray[opcnt].nfs_resop4_u.opread.READ4res_u.resok4;
 	rok->data.data_val = buffer;
 	rok->data.data_len = buffer_size;
-	if (bypass)
+	stateid = &argoparray[opcnt].nfs_argop4_u.opread.stateid;
+	if (bypass) {
 		COMPOUNDV4_ARG_ADD_OP_READ_BYPASS(opcnt, argoparray, offset,
 						  buffer_size);
-	else
+	} else {
 		COMPOUNDV4_ARG_ADD_OP_READ(opcnt, argoparray, offset,
 					   buffer_size);
+		deleg = pxy_deleg_stateid(&ph->fh4, false, stateid);
+	}
 
 	/* nfs call */
 	rc = pxy_nfsv4_call(op_ctx->fsal_export, op_ctx->creds,
 			    opcnt, argoparray, resoparray);
+	if (deleg && pxy_deleg_stale(rc)) {
+		memset(stateid, 0, sizeof(*stateid));
+		rok->data.data_len = buffer_size;
+		rc = pxy_nfsv4_call(op_ctx->fsal_export, op_ctx->creds,
+				    opcnt, argoparray, resoparray);
+	}
 	if (rc != NFS4_OK)
 		return nfsstat4_to_fsal(rc);
 
@@ -2745,6 +3645,8 @@ static fsal_status_t pxy_write2(struct fsal_obj_handle *obj_hdl,
 	nfs_resop4 resoparray[FSAL_WRITE_NB_OP_ALLOC];
 	WRITE4resok *wok;
 	struct pxy_obj_handle *ph;
+	stateid4 *stateid;
+	bool deleg;
 
 	if (info != NULL) {
 		/* Currently we don't support WRITE_PLUS */
@@ -2766,16 +3668,23 @@ static fsal_status_t pxy_write2(struct fsal_obj_handle *obj_hdl,
 	COMPOUNDV4_ARG_ADD_OP_PUTFH(opcnt, argoparray, ph->fh4);
 	/* prepare write */
 	wok = &resoparray[opcnt].nfs_resop4_u.opwrite.WRITE4res_u.resok4;
+	stateid = &argoparray[opcnt].nfs_argop4_u.opwrite.stateid;
 	if (*fsal_stable)
 		COMPOUNDV4_ARG_ADD_OP_WRITE(opcnt, argoparray, offset, buffer,
 					    buffer_size, DATA_SYNC4);
 	else
 		COMPOUNDV4_ARG_ADD_OP_WRITE(opcnt, argoparray, offset, buffer,
 					    buffer_size, UNSTABLE4);
+	deleg = pxy_deleg_stateid(&ph->fh4, true, stateid);
 
 	/* nfs call */
 	rc = pxy_nfsv4_call(op_ctx->fsal_export, op_ctx->creds,
 			    opcnt, argoparray, resoparray);
+	if (deleg && pxy_deleg_stale(rc)) {
+		memset(stateid, 0, sizeof(*stateid));
+		rc = pxy_nfsv4_call(op_ctx->fsal_export, op_ctx->creds,
+				    opcnt, argoparray, resoparray);
+	}
 	if (rc != NFS4_OK)
 		return nfsstat4_to_fsal(rc);
 
@@ -2808,6 +3717,8 @@ static fsal_status_t pxy_setattr2(struct fsal_obj_handle *obj_hdl,
 #define FSAL_SETATTR2_NB_OP_ALLOC 3 /* SEQUENCE PUTFH SETATTR */
 	nfs_argop4 argoparray[FSAL_SETATTR2_NB_OP_ALLOC];
 	nfs_resop4 resoparray[FSAL_SETATTR2_NB_OP_ALLOC];
+	stateid4 *stateid;
+	bool deleg = false;
 
 	/*prepare attributes */
 	/*
@@ -2836,19 +3747,28 @@ static fsal_status_t pxy_setattr2(struct fsal_obj_handle *obj_hdl,
 
 	/* prepare SETATTR */
 	resoparray[opcnt].nfs_resop4_u.opsetattr.attrsset = empty_bitmap;
-	if (bypass)
+	stateid = &argoparray[opcnt].nfs_argop4_u.opsetattr.stateid;
+	if (bypass) {
 		/* even if bypass state will be treated like anonymous value */
 		/* RFC 5661, section 8.2.3 */
 		COMPOUNDV4_ARG_ADD_OP_SETATTR_BYPASS(opcnt, argoparray,
 						     input_attr);
-	else
+	} else {
 		/* even if valid state should be specified when setting size */
 		/* RFC 5661, section 18.30.3 */
 		COMPOUNDV4_ARG_ADD_OP_SETATTR(opcnt, argoparray, input_attr);
+		/* so our own write delegation is not recalled for it */
+		deleg = pxy_deleg_stateid(&ph->fh4, true, stateid);
+	}
 
 	/* nfs call */
 	rc = pxy_nfsv4_call(op_ctx->fsal_export, op_ctx->creds,
 			    opcnt, argoparray, resoparray);
+	if (deleg && pxy_deleg_stale(rc)) {
+		memset(stateid, 0, sizeof(*stateid));
+		rc = pxy_nfsv4_call(op_ctx->fsal_export, op_ctx->creds,
+				    opcnt, argoparray, resoparray);
+	}
 	nfs4_Fattr_Free(&input_attr);
 	if (rc != NFS4_OK)
 		return nfsstat4_to_fsal(rc);
@@ -2918,6 +3838,7 @@ void pxy_handle_ops_init(struct fsal_obj_ops *ops)
 	ops->symlink = pxy_symlink;
 	ops->readlink = pxy_readlink;
 	ops->getattrs = pxy_getattrs;
+	ops->getattrs_bulk = pxy_getattrs_bulk;
 	ops->setattrs = pxy_setattrs;
 	ops->link = pxy_link;
 	ops->rename = pxy_rename;
@@ -3039,57 +3960,136 @@ static struct pxy_obj_handle *pxy_alloc_handle(struct fsal_export *exp,
 /* export methods that create object handles
  */
 
+/**
+ * @brief Look up a whole path in as few compounds as possible
+ *
+ * Each compound is SEQUENCE, PUTROOTFH or PUTFH of where the previous
+ * one stopped, as many LOOKUPs as the session allows and GETFH.  The
+ * last one also fetches the attributes, so only the object at the end
+ * of the path is instantiated.
+ */
 fsal_status_t pxy_lookup_path(struct fsal_export *exp_hdl,
 			      const char *path,
 			      struct fsal_obj_handle **handle,
 			      struct attrlist *attrs_out)
 {
-	struct fsal_obj_handle *next;
-	struct fsal_obj_handle *parent = NULL;
+	int rc;
+	uint32_t opcnt;
+	uint32_t maxops;
+	uint32_t nnames = 0;
+	uint32_t next = 0;
+	bool first = true;
+	GETATTR4resok *atok = NULL;
+	GETATTR4resok *atok_per_file_system_attr = NULL;
+	GETFH4resok *fhok;
+	sessionid4 sid;
+	nfs_argop4 argoparray[NB_MAX_OPERATIONS];
+	nfs_resop4 resoparray[NB_MAX_OPERATIONS];
+	char fattr_blob[FATTR_BLOB_SZ];
+	char fattr_blob_per_file_system_attr[FATTR_BLOB_SZ];
+	char padfilehandle[NFS4_FHSIZE];
+	char curfilehandle[NFS4_FHSIZE];
+	nfs_fh4 curfh = {
+		.nfs_fh4_len = 0,
+		.nfs_fh4_val = curfilehandle
+	};
+	struct user_cred *creds = op_ctx->creds;
+	const char **names;
 	char *saved;
 	char *pcopy;
-	char *p, *pnext;
-	struct user_cred *creds = op_ctx->creds;
+	char *p;
 
 	pcopy = gsh_strdup(path);
+	names = gsh_malloc((strlen(path) / 2 + 1) * sizeof(*names));
 
-	p = strtok_r(pcopy, "/", &saved);
-	while (p) {
+	for (p = strtok_r(pcopy, "/", &saved); p != NULL;
+	     p = strtok_r(NULL, "/", &saved)) {
 		if (strcmp(p, "..") == 0) {
 			/* Don't allow lookup of ".." */
 			LogInfo(COMPONENT_FSAL,
 				"Attempt to use \"..\" element in path %s",
 				path);
+			gsh_free(names);
 			gsh_free(pcopy);
 			return fsalstat(ERR_FSAL_ACCESS, EACCES);
 		}
-		/* Get the next token now, so we know if we are at the
-		 * terminal token or not.
-		 */
-		pnext = strtok_r(NULL, "/", &saved);
+		if (strcmp(p, ".") != 0)
+			names[nnames++] = p;
+	}
+
+	PTHREAD_MUTEX_lock(&pxy_clientid_mutex);
+	maxops = pxy_session_maxops;
+	PTHREAD_MUTEX_unlock(&pxy_clientid_mutex);
+
+	do {
+		/* SEQUENCE PUTROOTFH/PUTFH LOOKUP... GETFH (GETATTR GETATTR) */
+		uint32_t last = MIN(nnames, next + MAX(maxops, 6) - 5);
+
+		opcnt = 0;
+		pxy_get_client_sessionid(sid);
+		COMPOUNDV4_ARG_ADD_OP_SEQUENCE(opcnt, argoparray, sid,
+					       NB_RPC_SLOT);
+		if (first)
+			COMPOUNDV4_ARG_ADD_OP_PUTROOTFH(opcnt, argoparray);
+		else
+			COMPOUNDV4_ARG_ADD_OP_PUTFH(opcnt, argoparray, curfh);
 
 		/* Note that if any element is a symlink, the following will
-		 * fail, thus no security exposure. Only pass back the
-		 * attributes of the terminal lookup.
+		 * fail, thus no security exposure.
 		 */
-		fsal_status_t st = pxy_lookup_impl(parent, exp_hdl, creds, p,
-						   &next, pnext == NULL ?
-						   attrs_out : NULL);
-		if (FSAL_IS_ERROR(st)) {
+		for (; next < last; next++)
+			COMPOUNDV4_ARG_ADD_OP_LOOKUP(opcnt, argoparray,
+						     names[next]);
+
+		fhok = &resoparray[opcnt].nfs_resop4_u.opgetfh.GETFH4res_u.
+								resok4;
+		COMPOUNDV4_ARG_ADD_OP_GETFH(opcnt, argoparray);
+		fhok->object.nfs_fh4_val = (char *)padfilehandle;
+		fhok->object.nfs_fh4_len = sizeof(padfilehandle);
+
+		if (next == nnames) {
+			/* Only pass back the attributes of the terminal
+			 * lookup, and check the server's per file system
+			 * attributes there.
+			 */
+			atok = pxy_fill_getattr_reply(resoparray + opcnt,
+						      fattr_blob,
+						      sizeof(fattr_blob));
+			COMPOUNDV4_ARG_ADD_OP_GETATTR(opcnt, argoparray,
+						      pxy_bitmap_getattr);
+			atok_per_file_system_attr =
+			    pxy_fill_getattr_reply(resoparray + opcnt,
+				fattr_blob_per_file_system_attr,
+				sizeof(fattr_blob_per_file_system_attr));
+			COMPOUNDV4_ARG_ADD_OP_GETATTR(opcnt, argoparray,
+					pxy_bitmap_per_file_system_attr);
+		}
+
+		rc = pxy_nfsv4_call(exp_hdl, creds, opcnt, argoparray,
+				    resoparray);
+		if (rc != NFS4_OK) {
+			gsh_free(names);
 			gsh_free(pcopy);
-			return st;
+			return nfsstat4_to_fsal(rc);
 		}
 
-		p = pnext;
-		parent = next;
-	}
+		memcpy(curfilehandle, fhok->object.nfs_fh4_val,
+		       fhok->object.nfs_fh4_len);
+		curfh.nfs_fh4_len = fhok->object.nfs_fh4_len;
+		first = false;
+	} while (next < nnames);
+
 	/* The final element could be a symlink, but either way we are called
 	 * will not work with a symlink, so no security exposure there.
 	 */
-
+	gsh_free(names);
 	gsh_free(pcopy);
-	*handle = next;
-	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+	pxy_check_maxread_maxwrite(exp_hdl,
+				   &atok_per_file_system_attr->obj_attributes);
+
+	return pxy_make_object(exp_hdl, &atok->obj_attributes, &curfh,
+			       handle, attrs_out);
 }
 
 /*
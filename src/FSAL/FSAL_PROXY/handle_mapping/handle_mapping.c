@@ -37,10 +37,63 @@
 #include "nfs4.h"
 #include "handle_mapping.h"
 #include "handle_mapping_db.h"
+#include "handle_mapping_log.h"
 #include "handle_mapping_internal.h"
 
 static hash_table_t *handle_map_hash;
 
+/* where the map is made persistent */
+
+struct handlemap_backend {
+	const char *name;
+	int (*count)(const char *dir);
+	int (*init)(const handle_map_param_t *p_param);
+	int (*reload_all)(hash_table_t *target_hash);
+	int (*insert)(nfs23_map_handle_t *p_in_nfs23_digest,
+		      const void *data, uint32_t len);
+	int (*delete)(nfs23_map_handle_t *p_in_nfs23_digest);
+	int (*flush)(void);
+};
+
+static int handlemap_sqlite_init(const handle_map_param_t *p_param)
+{
+	return handlemap_db_init(p_param->databases_directory,
+				 p_param->temp_directory,
+				 p_param->database_count,
+				 p_param->synchronous_insert);
+}
+
+static int handlemap_log_backend_init(const handle_map_param_t *p_param)
+{
+	return handlemap_log_init(p_param->databases_directory,
+				  p_param->database_count,
+				  p_param->log_batch_msec);
+}
+
+static const struct handlemap_backend handlemap_backends[] = {
+	[HANDLEMAP_BACKEND_SQLITE] = {
+		.name = "sqlite",
+		.count = handlemap_db_count,
+		.init = handlemap_sqlite_init,
+		.reload_all = handlemap_db_reaload_all,
+		.insert = handlemap_db_insert,
+		.delete = handlemap_db_delete,
+		.flush = handlemap_db_flush,
+	},
+	[HANDLEMAP_BACKEND_LOG] = {
+		.name = "log",
+		.count = handlemap_log_count,
+		.init = handlemap_log_backend_init,
+		.reload_all = handlemap_log_reload_all,
+		.insert = handlemap_log_insert,
+		.delete = handlemap_log_delete,
+		.flush = handlemap_log_flush,
+	},
+};
+
+static const struct handlemap_backend *backend =
+	&handlemap_backends[HANDLEMAP_BACKEND_SQLITE];
+
 /* memory pool definitions */
 
 typedef struct digest_pool_entry__ {
@@ -220,6 +273,32 @@ int handle_mapping_hash_add(hash_table_t *p_hash, uint64_t object_id,
 	return HANDLEMAP_SUCCESS;
 }
 
+int handle_mapping_hash_del(hash_table_t *p_hash, uint64_t object_id,
+			    unsigned int handle_hash)
+{
+	int rc;
+	struct gsh_buffdesc buffkey, stored_buffkey;
+	struct gsh_buffdesc stored_buffval;
+	digest_pool_entry_t digest;
+
+	memset(&digest, 0, sizeof(digest));
+	digest.nfs23_digest.object_id = object_id;
+	digest.nfs23_digest.handle_hash = handle_hash;
+
+	buffkey.addr = (caddr_t) &digest;
+	buffkey.len = sizeof(digest_pool_entry_t);
+
+	rc = HashTable_Del(p_hash, &buffkey, &stored_buffkey, &stored_buffval);
+
+	if (rc != HASHTABLE_SUCCESS)
+		return HANDLEMAP_STALE;
+
+	digest_free((digest_pool_entry_t *) stored_buffkey.addr);
+	handle_free((handle_pool_entry_t *) stored_buffval.addr);
+
+	return HANDLEMAP_SUCCESS;
+}
+
 /* DEFAULT PARAMETERS for hash table */
 static hash_parameter_t handle_hash_config = {
 	.index_size = 67,
@@ -240,9 +319,15 @@ int HandleMap_Init(const handle_map_param_t *p_param)
 {
 	int rc;
 
+	if (p_param->backend >= sizeof(handlemap_backends) /
+				 sizeof(handlemap_backends[0]))
+		return HANDLEMAP_INVALID_PARAM;
+
+	backend = &handlemap_backends[p_param->backend];
+
 	/* first check database count */
 
-	rc = handlemap_db_count(p_param->databases_directory);
+	rc = backend->count(p_param->databases_directory);
 
 	if ((rc > 0) && (rc != p_param->database_count)) {
 		LogCrit(COMPONENT_FSAL,
@@ -255,13 +340,12 @@ int HandleMap_Init(const handle_map_param_t *p_param)
 
 	/* init database module */
 
-	rc = handlemap_db_init(p_param->databases_directory,
-			       p_param->temp_directory, p_param->database_count,
-			       p_param->synchronous_insert);
+	rc = backend->init(p_param);
 
 	if (rc) {
-		LogCrit(COMPONENT_FSAL, "ERROR %d initializing database access",
-			rc);
+		LogCrit(COMPONENT_FSAL,
+			"ERROR %d initializing %s handle map backend",
+			rc, backend->name);
 		return rc;
 	}
 
@@ -287,7 +371,7 @@ int HandleMap_Init(const handle_map_param_t *p_param)
 
 	/* reload previous data */
 
-	rc = handlemap_db_reaload_all(handle_map_hash);
+	rc = backend->reload_all(handle_map_hash);
 
 	if (rc) {
 		LogCrit(COMPONENT_FSAL,
@@ -367,7 +451,7 @@ int HandleMap_SetFH(nfs23_map_handle_t *p_in_nfs23_digest, const void *data,
 		return HANDLEMAP_EXISTS;
 	else {
 		/* insert it to DB */
-		return handlemap_db_insert(p_in_nfs23_digest, data, len);
+		return backend->insert(p_in_nfs23_digest, data, len);
 	}
 }
 
@@ -379,36 +463,19 @@ int HandleMap_SetFH(nfs23_map_handle_t *p_in_nfs23_digest, const void *data,
 int HandleMap_DelFH(nfs23_map_handle_t *p_in_nfs23_digest)
 {
 	int rc;
-	struct gsh_buffdesc buffkey, stored_buffkey;
-	struct gsh_buffdesc stored_buffval;
-
-	digest_pool_entry_t digest;
-
-	digest_pool_entry_t *p_stored_digest;
-	handle_pool_entry_t *p_stored_handle;
 
 	/* first, delete it from hash table */
 
-	digest.nfs23_digest = *p_in_nfs23_digest;
-
-	buffkey.addr = (caddr_t) &digest;
-	buffkey.len = sizeof(digest_pool_entry_t);
-
-	rc = HashTable_Del(handle_map_hash, &buffkey, &stored_buffkey,
-			   &stored_buffval);
-
-	if (rc != HASHTABLE_SUCCESS)
-		return HANDLEMAP_STALE;
-
-	p_stored_digest = (digest_pool_entry_t *) stored_buffkey.addr;
-	p_stored_handle = (handle_pool_entry_t *) stored_buffval.addr;
+	rc = handle_mapping_hash_del(handle_map_hash,
+				     p_in_nfs23_digest->object_id,
+				     p_in_nfs23_digest->handle_hash);
 
-	digest_free(p_stored_digest);
-	handle_free(p_stored_handle);
+	if (rc != HANDLEMAP_SUCCESS)
+		return rc;
 
 	/* then, submit the request to the database */
 
-	return handlemap_db_delete(p_in_nfs23_digest);
+	return backend->delete(p_in_nfs23_digest);
 
 }
 
@@ -417,5 +484,5 @@ int HandleMap_DelFH(nfs23_map_handle_t *p_in_nfs23_digest)
  */
 int HandleMap_Flush(void)
 {
-	return handlemap_db_flush();
+	return backend->flush();
 }
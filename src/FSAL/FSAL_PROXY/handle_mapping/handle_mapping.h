@@ -54,8 +54,18 @@ typedef struct handle_map_param__ {
 	/* synchronous insert mode */
 	int synchronous_insert;
 
+	/* where the map is stored, one of HANDLEMAP_BACKEND_* */
+	unsigned int backend;
+
+	/* delay for gathering log records into one write (msec) */
+	unsigned int log_batch_msec;
+
 } handle_map_param_t;
 
+/* persistence backends */
+#define HANDLEMAP_BACKEND_SQLITE 0
+#define HANDLEMAP_BACKEND_LOG    1
+
 /* this describes a handle digest for nfsv3 */
 
 #define PXY_HANDLE_MAPPED 0x23
@@ -0,0 +1,841 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file handle_mapping_log.c
+ *
+ * @brief Append-only log backend for the handle map
+ *
+ * The map itself is the handle mapping hash table, this only makes it
+ * durable.  Mappings are spread over a fixed number of logs by digest.
+ * Each log has a thread that writes whatever was appended to it since
+ * the last batch with one write and one fdatasync(), so creating a
+ * handle never waits for the disk.  Once most of a log's records are
+ * dead, the thread rewrites it with only the live ones.
+ *
+ * A record is object_id (8 bytes), handle_hash (4), check (4), op (1),
+ * fh_len (1) and the handle, in host byte order.  check covers the
+ * whole record except itself, so a torn write at the end of a log is
+ * found and cut off when the log is loaded.
+ */
+
+#include "config.h"
+#include "fsal.h"
+#include "nfs4.h"
+#include "handle_mapping.h"
+#include "handle_mapping_log.h"
+#include "handle_mapping_internal.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+
+#define LOG_REC_HDR_LEN 18
+#define LOG_REC_MAX_LEN (LOG_REC_HDR_LEN + NFS4_FHSIZE)
+#define LOG_REC_CHECK_OFF 12
+
+#define LOG_OP_INSERT 1
+#define LOG_OP_DELETE 2
+
+/* Read and write buffer size for loading and compaction */
+#define LOG_IO_BUF_SIZE (1024 * 1024)
+
+struct hdlmap_log_rec {
+	uint64_t object_id;
+	uint32_t handle_hash;
+	uint8_t op;
+	uint8_t fh_len;
+	const char *fh_data;
+};
+
+struct hdlmap_log {
+	pthread_t thr_id;
+	unsigned int index;
+	char path[MAXPATHLEN + 1];
+
+	/* only used by the log's thread once it is started */
+	int fd;
+	off_t size;
+	uint64_t nb_records;	/*< records in the file */
+	uint64_t nb_live;	/*< of which live mappings */
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_avail;
+	pthread_cond_t work_done;
+
+	/* protected by mutex */
+	char *pending;		/*< records not yet handed to the thread */
+	size_t pending_len;
+	size_t pending_size;
+	char *spare;		/*< the other buffer of the pair */
+	size_t spare_size;
+	bool busy;		/*< thread is writing or loading */
+	bool flush;		/*< someone is waiting, skip the batch delay */
+	hash_table_t *load_hash;	/*< set to have the thread load */
+	int load_rc;
+};
+
+static struct hdlmap_log logs[MAX_LOG];
+static unsigned int nb_logs;
+static unsigned int log_batch_msec;
+
+static uint32_t hdlmap_log_check(const char *rec, size_t len)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	/* FNV-1a of everything but the check field */
+	for (i = 0; i < len; i++) {
+		if (i >= LOG_REC_CHECK_OFF && i < LOG_REC_CHECK_OFF + 4)
+			continue;
+		h = (h ^ (unsigned char)rec[i]) * 16777619U;
+	}
+
+	return h;
+}
+
+static size_t hdlmap_log_encode(char *buf, const struct hdlmap_log_rec *rec)
+{
+	size_t len = LOG_REC_HDR_LEN + rec->fh_len;
+	uint32_t check;
+
+	memcpy(buf, &rec->object_id, sizeof(rec->object_id));
+	memcpy(buf + 8, &rec->handle_hash, sizeof(rec->handle_hash));
+	buf[16] = rec->op;
+	buf[17] = rec->fh_len;
+	if (rec->fh_len != 0)
+		memcpy(buf + LOG_REC_HDR_LEN, rec->fh_data, rec->fh_len);
+
+	check = hdlmap_log_check(buf, len);
+	memcpy(buf + LOG_REC_CHECK_OFF, &check, sizeof(check));
+
+	return len;
+}
+
+/**
+ * @brief Decode one record
+ *
+ * @return The length of the record, 0 if @a avail does not hold all of
+ *         it or -1 if it is corrupt.
+ */
+static int hdlmap_log_decode(const char *buf, size_t avail,
+			     struct hdlmap_log_rec *rec)
+{
+	size_t len;
+	uint32_t check;
+
+	if (avail < LOG_REC_HDR_LEN)
+		return 0;
+
+	len = LOG_REC_HDR_LEN + (uint8_t) buf[17];
+	if (avail < len)
+		return 0;
+
+	memcpy(&check, buf + LOG_REC_CHECK_OFF, sizeof(check));
+	if (check != hdlmap_log_check(buf, len))
+		return -1;
+
+	memcpy(&rec->object_id, buf, sizeof(rec->object_id));
+	memcpy(&rec->handle_hash, buf + 8, sizeof(rec->handle_hash));
+	rec->op = buf[16];
+	rec->fh_len = buf[17];
+	rec->fh_data = buf + LOG_REC_HDR_LEN;
+
+	if (rec->op != LOG_OP_INSERT && rec->op != LOG_OP_DELETE)
+		return -1;
+
+	return len;
+}
+
+typedef void (*hdlmap_log_cb)(void *arg, const struct hdlmap_log_rec *rec,
+			      off_t offset, size_t len);
+
+/**
+ * @brief Walk the records of a log
+ *
+ * @return The offset just past the last good record, or -1 if the log
+ *         could not be read.
+ */
+static off_t hdlmap_log_scan(struct hdlmap_log *log, hdlmap_log_cb cb,
+			     void *arg)
+{
+	char *buf = gsh_malloc(LOG_IO_BUF_SIZE);
+	off_t base = LOG_FILE_MAGIC_LEN;	/* file offset of buf[0] */
+	off_t next = LOG_FILE_MAGIC_LEN;	/* file offset of next read */
+	size_t have = 0;
+	size_t pos = 0;
+
+	for (;;) {
+		struct hdlmap_log_rec rec;
+		int len = hdlmap_log_decode(buf + pos, have - pos, &rec);
+		ssize_t n;
+
+		if (len > 0) {
+			cb(arg, &rec, base + pos, len);
+			pos += len;
+			continue;
+		}
+
+		if (len < 0)
+			break;
+
+		/* Keep the partial record and read some more */
+		memmove(buf, buf + pos, have - pos);
+		have -= pos;
+		base += pos;
+		pos = 0;
+
+		n = pread(log->fd, buf + have, LOG_IO_BUF_SIZE - have, next);
+		if (n < 0) {
+			LogCrit(COMPONENT_FSAL,
+				"ERROR: could not read %s: %s",
+				log->path, strerror(errno));
+			gsh_free(buf);
+			return -1;
+		}
+		if (n == 0)
+			break;
+
+		have += n;
+		next += n;
+	}
+
+	gsh_free(buf);
+	return base + pos;
+}
+
+struct hdlmap_log_load {
+	hash_table_t *hash;
+	uint64_t nb_records;
+	uint64_t nb_live;
+};
+
+static void hdlmap_log_load_rec(void *arg, const struct hdlmap_log_rec *rec,
+				off_t offset, size_t len)
+{
+	struct hdlmap_log_load *ld = arg;
+	int rc;
+
+	ld->nb_records++;
+
+	if (rec->op == LOG_OP_DELETE) {
+		if (handle_mapping_hash_del(ld->hash, rec->object_id,
+					    rec->handle_hash) ==
+		    HANDLEMAP_SUCCESS)
+			ld->nb_live--;
+		return;
+	}
+
+	rc = handle_mapping_hash_add(ld->hash, rec->object_id,
+				     rec->handle_hash, rec->fh_data,
+				     rec->fh_len);
+	if (rc == HANDLEMAP_SUCCESS)
+		ld->nb_live++;
+	else if (rc != HANDLEMAP_EXISTS)
+		LogCrit(COMPONENT_FSAL,
+			"ERROR %d adding entry to hash table <object_id=%"
+			PRIu64", FH_hash=%u>",
+			rc, rec->object_id, rec->handle_hash);
+}
+
+/* Replay a log into the hash table, dropping any torn tail */
+static int hdlmap_log_load(struct hdlmap_log *log, hash_table_t *hash)
+{
+	struct hdlmap_log_load ld = {
+		.hash = hash,
+	};
+	struct timeval t1;
+	struct timeval t2;
+	struct timeval tdiff;
+	off_t end;
+
+	gettimeofday(&t1, NULL);
+
+	end = hdlmap_log_scan(log, hdlmap_log_load_rec, &ld);
+	if (end < 0)
+		return HANDLEMAP_SYSTEM_ERROR;
+
+	if (end != log->size) {
+		LogEvent(COMPONENT_FSAL,
+			 "Dropping %lld bytes of torn records at the end of %s",
+			 (long long)(log->size - end), log->path);
+		if (ftruncate(log->fd, end) != 0) {
+			LogCrit(COMPONENT_FSAL,
+				"ERROR: could not truncate %s: %s",
+				log->path, strerror(errno));
+			return HANDLEMAP_SYSTEM_ERROR;
+		}
+		log->size = end;
+	}
+
+	log->nb_records = ld.nb_records;
+	log->nb_live = ld.nb_live;
+
+	gettimeofday(&t2, NULL);
+	timersub(&t2, &t1, &tdiff);
+
+	LogEvent(COMPONENT_FSAL,
+		 "Reloaded %"PRIu64" items from %s in %d.%06ds",
+		 ld.nb_live, log->path, (int)tdiff.tv_sec,
+		 (int)tdiff.tv_usec);
+
+	return HANDLEMAP_SUCCESS;
+}
+
+static int hdlmap_log_pwrite(int fd, const char *buf, size_t len, off_t off)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t n = pwrite(fd, buf + done, len - done, off + done);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+struct hdlmap_log_ent {
+	uint64_t object_id;
+	uint32_t handle_hash;
+	uint8_t op;
+	uint32_t len;
+	off_t offset;
+};
+
+struct hdlmap_log_ents {
+	struct hdlmap_log_ent *ents;
+	size_t count;
+	size_t size;
+};
+
+static void hdlmap_log_index_rec(void *arg, const struct hdlmap_log_rec *rec,
+				 off_t offset, size_t len)
+{
+	struct hdlmap_log_ents *idx = arg;
+	struct hdlmap_log_ent *ent;
+
+	if (idx->count == idx->size) {
+		idx->size = idx->size ? idx->size * 2 : 1024;
+		idx->ents = gsh_realloc(idx->ents,
+					idx->size * sizeof(*idx->ents));
+	}
+
+	ent = &idx->ents[idx->count++];
+	ent->object_id = rec->object_id;
+	ent->handle_hash = rec->handle_hash;
+	ent->op = rec->op;
+	ent->len = len;
+	ent->offset = offset;
+}
+
+/* Order by digest, then by position in the log */
+static int hdlmap_log_ent_cmp(const void *a, const void *b)
+{
+	const struct hdlmap_log_ent *e1 = a;
+	const struct hdlmap_log_ent *e2 = b;
+
+	if (e1->object_id != e2->object_id)
+		return e1->object_id < e2->object_id ? -1 : 1;
+	if (e1->handle_hash != e2->handle_hash)
+		return e1->handle_hash < e2->handle_hash ? -1 : 1;
+	if (e1->offset != e2->offset)
+		return e1->offset < e2->offset ? -1 : 1;
+	return 0;
+}
+
+/**
+ * @brief Rewrite a log with only its live records
+ *
+ * The last record for a digest decides whether it is live.  The new
+ * log is written next to the old one and renamed over it, so a crash
+ * part way leaves the old log in place.
+ */
+static void hdlmap_log_compact(struct hdlmap_log *log)
+{
+	struct hdlmap_log_ents idx = {
+		.ents = NULL,
+	};
+	char tmp_path[MAXPATHLEN + 1];
+	char *buf = NULL;
+	size_t buflen = 0;
+	off_t size = LOG_FILE_MAGIC_LEN;
+	uint64_t nb_live = 0;
+	size_t i;
+	int fd;
+	int rc;
+
+	if (hdlmap_log_scan(log, hdlmap_log_index_rec, &idx) < 0)
+		goto out;
+
+	qsort(idx.ents, idx.count, sizeof(*idx.ents), hdlmap_log_ent_cmp);
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.compact", log->path);
+	fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		LogCrit(COMPONENT_FSAL, "ERROR: could not create %s: %s",
+			tmp_path, strerror(errno));
+		goto out;
+	}
+
+	rc = hdlmap_log_pwrite(fd, LOG_FILE_MAGIC, LOG_FILE_MAGIC_LEN, 0);
+	if (rc != 0)
+		goto write_err;
+
+	buf = gsh_malloc(LOG_IO_BUF_SIZE);
+
+	for (i = 0; i < idx.count; i++) {
+		struct hdlmap_log_ent *ent = &idx.ents[i];
+
+		/* Only the last record of a digest counts */
+		if (i + 1 < idx.count &&
+		    idx.ents[i + 1].object_id == ent->object_id &&
+		    idx.ents[i + 1].handle_hash == ent->handle_hash)
+			continue;
+
+		if (ent->op != LOG_OP_INSERT)
+			continue;
+
+		if (buflen + ent->len > LOG_IO_BUF_SIZE) {
+			rc = hdlmap_log_pwrite(fd, buf, buflen, size);
+			if (rc != 0)
+				goto write_err;
+			size += buflen;
+			buflen = 0;
+		}
+
+		errno = 0;
+		if (pread(log->fd, buf + buflen, ent->len, ent->offset) !=
+		    (ssize_t) ent->len) {
+			rc = errno ? errno : EIO;
+			goto write_err;
+		}
+		buflen += ent->len;
+		nb_live++;
+	}
+
+	rc = hdlmap_log_pwrite(fd, buf, buflen, size);
+	if (rc != 0)
+		goto write_err;
+	size += buflen;
+
+	if (fdatasync(fd) != 0 || rename(tmp_path, log->path) != 0) {
+		rc = errno;
+		goto write_err;
+	}
+
+	LogEvent(COMPONENT_FSAL,
+		 "Compacted %s from %"PRIu64" to %"PRIu64" records",
+		 log->path, log->nb_records, nb_live);
+
+	close(log->fd);
+	log->fd = fd;
+	log->size = size;
+	log->nb_records = nb_live;
+	log->nb_live = nb_live;
+	goto out;
+
+write_err:
+	LogCrit(COMPONENT_FSAL, "ERROR: could not compact %s: %s",
+		log->path, strerror(rc));
+	close(fd);
+	unlink(tmp_path);
+
+out:
+	gsh_free(buf);
+	gsh_free(idx.ents);
+}
+
+/* Write a batch, then see whether the log needs compacting */
+static void hdlmap_log_write_batch(struct hdlmap_log *log, const char *buf,
+				   size_t len)
+{
+	size_t off;
+	int rc;
+
+	rc = hdlmap_log_pwrite(log->fd, buf, len, log->size);
+	if (rc == 0 && fdatasync(log->fd) != 0)
+		rc = errno;
+	if (rc != 0) {
+		/* The next batch goes over whatever made it */
+		LogCrit(COMPONENT_FSAL,
+			"ERROR: could not write %zu bytes to %s: %s",
+			len, log->path, strerror(rc));
+		return;
+	}
+	log->size += len;
+
+	for (off = 0; off < len;
+	     off += LOG_REC_HDR_LEN + (uint8_t) buf[off + 17]) {
+		log->nb_records++;
+		if (buf[off + 16] == LOG_OP_INSERT)
+			log->nb_live++;
+		else if (log->nb_live > 0)
+			log->nb_live--;
+	}
+
+	if (log->nb_records >= LOG_COMPACT_MIN &&
+	    log->nb_records > 2 * log->nb_live)
+		hdlmap_log_compact(log);
+}
+
+static void *hdlmap_log_thread(void *arg)
+{
+	struct hdlmap_log *log = arg;
+	char thread_name[256];
+
+	snprintf(thread_name, 256, "Log thread #%u", log->index);
+	SetNameFunction(thread_name);
+
+	PTHREAD_MUTEX_lock(&log->mutex);
+
+	for (;;) {
+		char *buf;
+		size_t len;
+		size_t size;
+
+		log->busy = false;
+		while (log->load_hash == NULL && log->pending_len == 0) {
+			pthread_cond_broadcast(&log->work_done);
+			pthread_cond_wait(&log->work_avail, &log->mutex);
+		}
+		log->busy = true;
+
+		if (log->load_hash != NULL) {
+			hash_table_t *hash = log->load_hash;
+			int rc;
+
+			PTHREAD_MUTEX_unlock(&log->mutex);
+			rc = hdlmap_log_load(log, hash);
+			PTHREAD_MUTEX_lock(&log->mutex);
+
+			log->load_rc = rc;
+			log->load_hash = NULL;
+			continue;
+		}
+
+		/* Let the batch fill up unless someone is waiting on it */
+		if (!log->flush && log_batch_msec != 0) {
+			struct timespec ts;
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += log_batch_msec / 1000;
+			ts.tv_nsec += (log_batch_msec % 1000) * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+
+			while (!log->flush &&
+			       pthread_cond_timedwait(&log->work_avail,
+						      &log->mutex,
+						      &ts) != ETIMEDOUT)
+				;
+		}
+
+		/* Swap buffers so appends go on while this one is written */
+		buf = log->pending;
+		len = log->pending_len;
+		size = log->pending_size;
+		log->pending = log->spare;
+		log->pending_size = log->spare_size;
+		log->pending_len = 0;
+		log->spare = buf;
+		log->spare_size = size;
+		log->flush = false;
+
+		PTHREAD_MUTEX_unlock(&log->mutex);
+		hdlmap_log_write_batch(log, buf, len);
+		PTHREAD_MUTEX_lock(&log->mutex);
+	}
+
+	PTHREAD_MUTEX_unlock(&log->mutex);
+	return log;
+}
+
+/* Open a log, creating it if needed */
+static int hdlmap_log_open(struct hdlmap_log *log)
+{
+	char magic[LOG_FILE_MAGIC_LEN];
+	struct stat st;
+
+	log->fd = open(log->path, O_RDWR | O_CREAT, 0600);
+	if (log->fd < 0) {
+		LogCrit(COMPONENT_FSAL, "ERROR: could not open %s: %s",
+			log->path, strerror(errno));
+		return HANDLEMAP_SYSTEM_ERROR;
+	}
+
+	if (fstat(log->fd, &st) != 0) {
+		LogCrit(COMPONENT_FSAL, "ERROR: could not stat %s: %s",
+			log->path, strerror(errno));
+		return HANDLEMAP_SYSTEM_ERROR;
+	}
+
+	if (st.st_size == 0) {
+		int rc = hdlmap_log_pwrite(log->fd, LOG_FILE_MAGIC,
+					   LOG_FILE_MAGIC_LEN, 0);
+
+		if (rc == 0 && fdatasync(log->fd) != 0)
+			rc = errno;
+		if (rc != 0) {
+			LogCrit(COMPONENT_FSAL,
+				"ERROR: could not initialize %s: %s",
+				log->path, strerror(rc));
+			return HANDLEMAP_SYSTEM_ERROR;
+		}
+		log->size = LOG_FILE_MAGIC_LEN;
+		return HANDLEMAP_SUCCESS;
+	}
+
+	if (pread(log->fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+	    memcmp(magic, LOG_FILE_MAGIC, LOG_FILE_MAGIC_LEN) != 0) {
+		LogCrit(COMPONENT_FSAL, "ERROR: %s is not a handle map log",
+			log->path);
+		return HANDLEMAP_DB_ERROR;
+	}
+
+	log->size = st.st_size;
+	return HANDLEMAP_SUCCESS;
+}
+
+static struct hdlmap_log *hdlmap_log_select(const nfs23_map_handle_t *digest)
+{
+	unsigned int h = ((digest->object_id * 1049) ^ digest->handle_hash) %
+			 2477;
+
+	return &logs[h % nb_logs];
+}
+
+static int hdlmap_log_append(const nfs23_map_handle_t *digest, uint8_t op,
+			     const void *data, uint32_t len)
+{
+	struct hdlmap_log *log = hdlmap_log_select(digest);
+	struct hdlmap_log_rec rec = {
+		.object_id = digest->object_id,
+		.handle_hash = digest->handle_hash,
+		.op = op,
+		.fh_len = len,
+		.fh_data = data,
+	};
+
+	if (len > NFS4_FHSIZE)
+		return HANDLEMAP_INVALID_PARAM;
+
+	PTHREAD_MUTEX_lock(&log->mutex);
+
+	if (log->pending_size - log->pending_len < LOG_REC_MAX_LEN) {
+		log->pending_size = MAX(log->pending_size * 2,
+					64 * LOG_REC_MAX_LEN);
+		log->pending = gsh_realloc(log->pending, log->pending_size);
+	}
+
+	if (log->pending_len == 0)
+		pthread_cond_signal(&log->work_avail);
+
+	log->pending_len += hdlmap_log_encode(log->pending + log->pending_len,
+					      &rec);
+
+	PTHREAD_MUTEX_unlock(&log->mutex);
+
+	return HANDLEMAP_SUCCESS;
+}
+
+/* Wait for a log's thread to have nothing left to do */
+static void hdlmap_log_wait_idle(struct hdlmap_log *log)
+{
+	PTHREAD_MUTEX_lock(&log->mutex);
+
+	if (log->pending_len != 0) {
+		log->flush = true;
+		pthread_cond_signal(&log->work_avail);
+	}
+
+	while (log->pending_len != 0 || log->load_hash != NULL || log->busy)
+		pthread_cond_wait(&log->work_done, &log->mutex);
+
+	PTHREAD_MUTEX_unlock(&log->mutex);
+}
+
+/**
+ * count the number of log instances in a given directory
+ * (this is used for checking that the number of logs
+ * matches the number of threads)
+ */
+int handlemap_log_count(const char *dir)
+{
+	DIR *dir_hdl;
+	struct dirent *direntry;
+	char log_pattern[MAXPATHLEN + 1];
+	unsigned int count = 0;
+
+	snprintf(log_pattern, MAXPATHLEN, "%s.*[0-9]", LOG_FILE_PREFIX);
+
+	dir_hdl = opendir(dir);
+
+	if (dir_hdl == NULL) {
+		LogCrit(COMPONENT_FSAL,
+			"ERROR: could not access directory %s: %s", dir,
+			strerror(errno));
+		return -HANDLEMAP_SYSTEM_ERROR;
+	}
+
+	for (;;) {
+		errno = 0;
+		direntry = readdir(dir_hdl);
+		if (direntry == NULL)
+			break;
+
+		if (!fnmatch(log_pattern, direntry->d_name, FNM_PATHNAME))
+			count++;
+	}
+
+	if (errno != 0) {
+		LogCrit(COMPONENT_FSAL,
+			"ERROR: error reading directory %s: %s", dir,
+			strerror(errno));
+		closedir(dir_hdl);
+		return -HANDLEMAP_SYSTEM_ERROR;
+	}
+
+	closedir(dir_hdl);
+
+	return count;
+}
+
+/**
+ * Open (or create) the logs and start one thread per log.
+ */
+int handlemap_log_init(const char *log_dir, unsigned int log_count,
+		       unsigned int batch_msec)
+{
+	unsigned int i;
+	int rc;
+
+	if (log_count == 0 || log_count > MAX_LOG)
+		return HANDLEMAP_INVALID_PARAM;
+
+	nb_logs = log_count;
+	log_batch_msec = batch_msec;
+
+	for (i = 0; i < nb_logs; i++) {
+		struct hdlmap_log *log = &logs[i];
+
+		memset(log, 0, sizeof(*log));
+		log->index = i;
+		snprintf(log->path, sizeof(log->path), "%s/%s.%u", log_dir,
+			 LOG_FILE_PREFIX, i);
+
+		PTHREAD_MUTEX_init(&log->mutex, NULL);
+		PTHREAD_COND_init(&log->work_avail, NULL);
+		PTHREAD_COND_init(&log->work_done, NULL);
+
+		rc = hdlmap_log_open(log);
+		if (rc)
+			return rc;
+
+		rc = pthread_create(&log->thr_id, NULL, hdlmap_log_thread,
+				    log);
+		if (rc)
+			return HANDLEMAP_SYSTEM_ERROR;
+	}
+
+	return HANDLEMAP_SUCCESS;
+}
+
+/**
+ * Replay every log into the hash table, all logs in parallel.
+ * The function blocks until all threads have loaded their data.
+ */
+int handlemap_log_reload_all(hash_table_t *target_hash)
+{
+	unsigned int i;
+	int rc = HANDLEMAP_SUCCESS;
+
+	for (i = 0; i < nb_logs; i++) {
+		PTHREAD_MUTEX_lock(&logs[i].mutex);
+		logs[i].load_hash = target_hash;
+		pthread_cond_signal(&logs[i].work_avail);
+		PTHREAD_MUTEX_unlock(&logs[i].mutex);
+	}
+
+	for (i = 0; i < nb_logs; i++) {
+		hdlmap_log_wait_idle(&logs[i]);
+		if (logs[i].load_rc != HANDLEMAP_SUCCESS)
+			rc = logs[i].load_rc;
+	}
+
+	return rc;
+}
+
+/**
+ * Append an 'insert' record.
+ * The record is written with the next batch of its log.
+ */
+int handlemap_log_insert(nfs23_map_handle_t *p_in_nfs23_digest,
+			 const void *data, uint32_t len)
+{
+	return hdlmap_log_append(p_in_nfs23_digest, LOG_OP_INSERT, data, len);
+}
+
+/**
+ * Append a 'delete' record.
+ * The record is written with the next batch of its log.
+ */
+int handlemap_log_delete(nfs23_map_handle_t *p_in_nfs23_digest)
+{
+	return hdlmap_log_append(p_in_nfs23_digest, LOG_OP_DELETE, NULL, 0);
+}
+
+/**
+ * Write out and sync all pending records.
+ */
+int handlemap_log_flush(void)
+{
+	unsigned int i;
+	struct timeval t1;
+	struct timeval t2;
+	struct timeval tdiff;
+
+	gettimeofday(&t1, NULL);
+
+	for (i = 0; i < nb_logs; i++)
+		hdlmap_log_wait_idle(&logs[i]);
+
+	gettimeofday(&t2, NULL);
+	timersub(&t2, &t1, &tdiff);
+
+	LogEvent(COMPONENT_FSAL, "Handle map logs synchronized in %d.%06ds",
+		 (int)tdiff.tv_sec, (int)tdiff.tv_usec);
+
+	return HANDLEMAP_SUCCESS;
+}
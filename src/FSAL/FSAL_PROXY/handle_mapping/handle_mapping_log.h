@@ -0,0 +1,55 @@
+#ifndef _HANDLE_MAPPING_LOG_H
+#define _HANDLE_MAPPING_LOG_H
+
+#include "handle_mapping.h"
+#include "hashtable.h"
+
+#define LOG_FILE_PREFIX "handlemap.log"
+
+/* First bytes of every log file */
+#define LOG_FILE_MAGIC "GSHMAPL1"
+#define LOG_FILE_MAGIC_LEN 8
+
+/* Don't bother compacting a log with fewer records than this */
+#define LOG_COMPACT_MIN 4096
+
+#define MAX_LOG 32
+
+/**
+ * count the number of log instances in a given directory
+ * (this is used for checking that the number of logs
+ * matches the number of threads)
+ */
+int handlemap_log_count(const char *dir);
+
+/**
+ * Open (or create) the logs and start one thread per log.
+ */
+int handlemap_log_init(const char *log_dir, unsigned int log_count,
+		       unsigned int batch_msec);
+
+/**
+ * Replay every log into the hash table, all logs in parallel.
+ * The function blocks until all threads have loaded their data.
+ */
+int handlemap_log_reload_all(hash_table_t *target_hash);
+
+/**
+ * Append an 'insert' record.
+ * The record is written with the next batch of its log.
+ */
+int handlemap_log_insert(nfs23_map_handle_t *p_in_nfs23_digest,
+			 const void *data, uint32_t len);
+
+/**
+ * Append a 'delete' record.
+ * The record is written with the next batch of its log.
+ */
+int handlemap_log_delete(nfs23_map_handle_t *p_in_nfs23_digest);
+
+/**
+ * Write out and sync all pending records.
+ */
+int handlemap_log_flush(void);
+
+#endif
@@ -67,6 +67,14 @@ static struct config_item_list sec_types[] = {
 };
 #endif
 
+#ifdef PROXY_HANDLE_MAPPING
+static struct config_item_list handlemap_backends[] = {
+	CONFIG_LIST_TOK("sqlite", HANDLEMAP_BACKEND_SQLITE),
+	CONFIG_LIST_TOK("log", HANDLEMAP_BACKEND_LOG),
+	CONFIG_LIST_EOL
+};
+#endif
+
 /*512 bytes to store header*/
 #define SEND_RECV_HEADER_SPACE 512
 /*1MB of default maxsize*/
@@ -93,6 +101,12 @@ static struct config_item proxy_remote_params[] = {
 		       pxy_client_params, use_privileged_client_port),
 	CONF_ITEM_UI32("RPC_Client_Timeout", 1, 60*4, 60,
 		       pxy_client_params, srv_timeout),
+	CONF_ITEM_UI32("RPC_Connections", 1, 32, 1,
+		       pxy_client_params, rpc_connections),
+	CONF_ITEM_UI32("Session_Slots", 1, 256, 16,
+		       pxy_client_params, session_slots),
+	CONF_ITEM_BOOL("Delegations", false,
+		       pxy_client_params, delegations),
 #ifdef _USE_GSSRPC
 	CONF_ITEM_STR("Remote_PrincipalName", 0, MAXNAMLEN, NULL,
 		      pxy_client_params, remote_principal),
@@ -118,6 +132,11 @@ static struct config_item proxy_remote_params[] = {
 		       pxy_client_params, hdlmap.database_count),
 	CONF_ITEM_UI32("HandleMap_HashTable_Size", 1, 127, 103,
 		       pxy_client_params, hdlmap.hashtable_size),
+	CONF_ITEM_TOKEN("HandleMap_Backend", HANDLEMAP_BACKEND_SQLITE,
+			handlemap_backends,
+			pxy_client_params, hdlmap.backend),
+	CONF_ITEM_UI32("HandleMap_Log_Batch_Delay", 0, 1000, 10,
+		       pxy_client_params, hdlmap.log_batch_msec),
 #endif
 	CONFIG_EOL
 };
@@ -12,6 +12,9 @@ struct pxy_client_params {
 	unsigned int srv_sendsize;
 	unsigned int srv_recvsize;
 	unsigned int srv_timeout;
+	unsigned int rpc_connections;
+	unsigned int session_slots;
+	bool delegations;
 	uint16_t srv_port;
 	unsigned int use_privileged_client_port;
 	char *remote_principal;
@@ -43,6 +46,8 @@ void pxy_handle_ops_init(struct fsal_obj_ops *ops);
 
 int pxy_init_rpc(const struct pxy_fsal_module *);
 
+void pxy_deleg_drain(struct fsal_export *exp);
+
 fsal_status_t pxy_list_ext_attrs(struct fsal_obj_handle *obj_hdl,
 				 const struct req_op_context *opctx,
 				 unsigned int cookie,
@@ -35,6 +35,7 @@
 #include "internal.h"
 #include "nfs_exports.h"
 #include "FSAL/fsal_commonlib.h"
+#include "abstract_atomic.h"
 
 /**
  * @brief Release an object
@@ -51,6 +52,12 @@ static void release(struct fsal_obj_handle *obj_hdl)
 		container_of(obj_hdl, struct rgw_handle, handle);
 	struct rgw_export *export = obj->export;
 
+	PTHREAD_MUTEX_lock(&obj->wb_lock);
+	if (rgw_wb_flush(export, obj) < 0)
+		LogWarn(COMPONENT_FSAL,
+			"Lost staged writes of obj_hdl %p", obj_hdl);
+	PTHREAD_MUTEX_unlock(&obj->wb_lock);
+
 	if (obj->rgw_fh != export->rgw_fs->root_fh) {
 		/* release RGW ref */
 		(void) rgw_fh_rele(export->rgw_fs, obj->rgw_fh,
@@ -131,6 +138,8 @@ struct rgw_cb_arg {
 	void *fsal_arg;
 	struct fsal_obj_handle *dir_hdl;
 	attrmask_t attrmask;
+	fsal_cookie_t last_cookie;	/*< Cookie of the last entry passed */
+	char last_name[1024 + 1];	/*< Name of the last entry passed */
 };
 
 static bool rgw_cb(const char *name, void *arg, uint64_t offset, uint32_t flags)
@@ -157,9 +166,93 @@ static bool rgw_cb(const char *name, void *arg, uint64_t offset, uint32_t flags)
 
 	fsal_release_attrs(&attrs);
 
+	if (strlen(name) < sizeof(rgw_cb_arg->last_name)) {
+		strcpy(rgw_cb_arg->last_name, name);
+		rgw_cb_arg->last_cookie = offset;
+	}
+
 	return cb_rc <= DIR_READAHEAD;
 }
 
+#ifdef USE_FSAL_RGW_READDIR2
+/**
+ * @brief Find where the READDIR that handed out a cookie left off
+ *
+ * @param[in] dir    The directory
+ * @param[in] cookie Cookie the client is resuming from
+ *
+ * @return The name to resume the listing after, to be freed by the
+ *         caller, or NULL if there is no live cursor for the cookie.
+ */
+
+static char *rgw_dir_cursor_get(struct rgw_handle *dir, fsal_cookie_t cookie)
+{
+	time_t now = time(NULL);
+	char *name = NULL;
+	int i;
+
+	PTHREAD_MUTEX_lock(&dir->dir_lock);
+
+	for (i = 0; i < RGW_DIR_CURSORS; i++) {
+		struct rgw_dir_cursor *cursor = &dir->dir_cursors[i];
+
+		if (cursor->name == NULL || cursor->cookie != cookie)
+			continue;
+
+		if (now - cursor->stamp > RGWFSM.readdir_cursor_ttl) {
+			gsh_free(cursor->name);
+			cursor->name = NULL;
+			break;
+		}
+
+		name = gsh_strdup(cursor->name);
+		break;
+	}
+
+	PTHREAD_MUTEX_unlock(&dir->dir_lock);
+
+	return name;
+}
+
+/**
+ * @brief Remember where a READDIR left off
+ *
+ * @param[in] dir    The directory
+ * @param[in] cookie Cookie of the last entry handed out
+ * @param[in] name   Name of the last entry handed out
+ */
+
+static void rgw_dir_cursor_put(struct rgw_handle *dir, fsal_cookie_t cookie,
+			       const char *name)
+{
+	struct rgw_dir_cursor *cursor = NULL;
+	int i;
+
+	PTHREAD_MUTEX_lock(&dir->dir_lock);
+
+	for (i = 0; i < RGW_DIR_CURSORS; i++) {
+		if (dir->dir_cursors[i].name != NULL &&
+		    dir->dir_cursors[i].cookie == cookie) {
+			cursor = &dir->dir_cursors[i];
+			break;
+		}
+	}
+
+	if (cursor == NULL) {
+		cursor = &dir->dir_cursors[dir->dir_cursor_next];
+		dir->dir_cursor_next = (dir->dir_cursor_next + 1) %
+							RGW_DIR_CURSORS;
+	}
+
+	gsh_free(cursor->name);
+	cursor->name = gsh_strdup(name);
+	cursor->cookie = cookie;
+	cursor->stamp = time(NULL);
+
+	PTHREAD_MUTEX_unlock(&dir->dir_lock);
+}
+#endif /* USE_FSAL_RGW_READDIR2 */
+
 /**
  * @brief Read a directory
  *
@@ -198,11 +291,40 @@ static fsal_status_t rgw_fsal_readdir(struct fsal_obj_handle *dir_hdl,
 
 	rc = 0;
 	*eof = false;
+	rgw_cb_arg.last_name[0] = '\0';
+
+#ifdef USE_FSAL_RGW_READDIR2
+	/* Resume the listing after the name the last READDIR stopped at,
+	 * rather than having RGW list up to the cookie again.
+	 */
+	char *marker = NULL;
+
+	if (r_whence != 0)
+		marker = rgw_dir_cursor_get(dir, r_whence);
+
+	if (r_whence == 0 || marker != NULL) {
+		rc = rgw_readdir2(export->rgw_fs, dir->rgw_fh, marker, rgw_cb,
+				  &rgw_cb_arg, eof, RGW_READDIR_FLAG_NONE);
+		gsh_free(marker);
+	} else {
+		rc = rgw_readdir(export->rgw_fs, dir->rgw_fh, &r_whence,
+				 rgw_cb, &rgw_cb_arg, eof,
+				 RGW_READDIR_FLAG_NONE);
+	}
+#else
 	rc = rgw_readdir(export->rgw_fs, dir->rgw_fh, &r_whence, rgw_cb,
 			&rgw_cb_arg, eof, RGW_READDIR_FLAG_NONE);
+#endif
 	if (rc < 0)
 		return rgw2fsal_error(rc);
 
+#ifdef USE_FSAL_RGW_READDIR2
+	if (!*eof && rgw_cb_arg.last_name[0] != '\0' &&
+	    RGWFSM.readdir_cursor_ttl != 0)
+		rgw_dir_cursor_put(dir, rgw_cb_arg.last_cookie,
+				   rgw_cb_arg.last_name);
+#endif
+
 	return fsal_status;
 }
 
@@ -457,6 +579,13 @@ static fsal_status_t getattrs(struct fsal_obj_handle *obj_hdl,
 		return rgw2fsal_error(rc);
 	}
 
+	/* Staged writes are not in RGW yet but the file already has them */
+	PTHREAD_MUTEX_lock(&handle->wb_lock);
+	if (handle->wb_len != 0 &&
+	    handle->wb_offset + handle->wb_len > st.st_size)
+		st.st_size = handle->wb_offset + handle->wb_len;
+	PTHREAD_MUTEX_unlock(&handle->wb_lock);
+
 	posix2fsal_attributes_all(&st, attrs);
 
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
@@ -542,8 +671,13 @@ fsal_status_t rgw_fsal_setattr2(struct fsal_obj_handle *obj_hdl,
 	memset(&st, 0, sizeof(struct stat));
 
 	if (FSAL_TEST_MASK(attrib_set->valid_mask, ATTR_SIZE)) {
-		rc = rgw_truncate(export->rgw_fs, handle->rgw_fh,
-				attrib_set->filesize, RGW_TRUNCATE_FLAG_NONE);
+		PTHREAD_MUTEX_lock(&handle->wb_lock);
+		rc = rgw_wb_flush(export, handle);
+		if (rc >= 0)
+			rc = rgw_truncate(export->rgw_fs, handle->rgw_fh,
+					  attrib_set->filesize,
+					  RGW_TRUNCATE_FLAG_NONE);
+		PTHREAD_MUTEX_unlock(&handle->wb_lock);
 
 		if (rc < 0) {
 			status = rgw2fsal_error(rc);
@@ -1361,7 +1495,16 @@ fsal_status_t rgw_fsal_read2(struct fsal_obj_handle *obj_hdl,
 	/* RGW does not support a file descriptor abstraction--so
 	 * reads are handle based */
 
-	int rc = rgw_read(export->rgw_fs, handle->rgw_fh, offset,
+	/* Staged writes have to be in RGW for the read to see them */
+	PTHREAD_MUTEX_lock(&handle->wb_lock);
+	int rc = rgw_wb_flush(export, handle);
+
+	PTHREAD_MUTEX_unlock(&handle->wb_lock);
+
+	if (rc < 0)
+		return rgw2fsal_error(rc);
+
+	rc = rgw_read(export->rgw_fs, handle->rgw_fh, offset,
 			buffer_size, read_amount, buffer,
 			RGW_READ_FLAG_NONE);
 
@@ -1373,6 +1516,59 @@ fsal_status_t rgw_fsal_read2(struct fsal_obj_handle *obj_hdl,
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
+/**
+ * @brief Make room to stage a write
+ *
+ * Sequential unstable writes smaller than Write_Buffer_Size are
+ * gathered so that RGW sees a few large writes rather than one per
+ * NFS WRITE.  A write that does not follow on from what is staged
+ * flushes it first.  The buffer is allocated on first use, unless that
+ * would take the staging buffers past Write_Buffer_Max.
+ *
+ * Must be called with wb_lock held.
+ *
+ * @param[in] handle File being written
+ * @param[in] offset Position of the write
+ * @param[in] len    Length of the write
+ *
+ * @return 1 if the write fits in the buffer at wb_len, 0 if it has to
+ *         go straight to RGW, negative error codes on failure.
+ */
+
+static int rgw_wb_stage(struct rgw_export *export,
+			struct rgw_handle *handle, uint64_t offset,
+			size_t len)
+{
+	uint64_t size = RGWFSM.write_buffer_size;
+	int rc;
+
+	if (len >= size)
+		return 0;
+
+	if (handle->wb_buf == NULL) {
+		if (atomic_add_uint64_t(&RGWFSM.write_buffer_bytes, size) >
+		    RGWFSM.write_buffer_max) {
+			(void) atomic_sub_uint64_t(&RGWFSM.write_buffer_bytes,
+						   size);
+			return 0;
+		}
+		handle->wb_buf = gsh_malloc(size);
+	}
+
+	if (handle->wb_len != 0 &&
+	    (offset != handle->wb_offset + handle->wb_len ||
+	     handle->wb_len + len > size)) {
+		rc = rgw_wb_flush(export, handle);
+		if (rc < 0)
+			return rc;
+	}
+
+	if (handle->wb_len == 0)
+		handle->wb_offset = offset;
+
+	return 1;
+}
+
 /**
  * @brief Write data to a file
  *
@@ -1413,6 +1609,8 @@ fsal_status_t rgw_fsal_write2(struct fsal_obj_handle *obj_hdl,
 
 	struct rgw_handle *handle = container_of(obj_hdl, struct rgw_handle,
 						handle);
+	int rc;
+
 	LogFullDebug(COMPONENT_FSAL,
 		"%s enter obj_hdl %p state %p", __func__, obj_hdl, state);
 
@@ -1423,9 +1621,31 @@ fsal_status_t rgw_fsal_write2(struct fsal_obj_handle *obj_hdl,
 
 	/* XXX note no call to fsal_find_fd (or wrapper) */
 
-	int rc = rgw_write(export->rgw_fs, handle->rgw_fh, offset,
-			buffer_size, wrote_amount, buffer,
-			RGW_WRITE_FLAG_NONE);
+	PTHREAD_MUTEX_lock(&handle->wb_lock);
+
+	if (*fsal_stable)
+		rc = 0;
+	else
+		rc = rgw_wb_stage(export, handle, offset, buffer_size);
+
+	if (rc > 0) {
+		memcpy(handle->wb_buf + handle->wb_len, buffer, buffer_size);
+		handle->wb_len += buffer_size;
+		*wrote_amount = buffer_size;
+
+		/* A full buffer goes out as one large write */
+		if (handle->wb_len == RGWFSM.write_buffer_size)
+			rc = rgw_wb_flush(export, handle);
+	} else if (rc == 0) {
+		/* Anything staged has to reach RGW first */
+		rc = rgw_wb_flush(export, handle);
+		if (rc >= 0)
+			rc = rgw_write(export->rgw_fs, handle->rgw_fh, offset,
+				       buffer_size, wrote_amount, buffer,
+				       RGW_WRITE_FLAG_NONE);
+	}
+
+	PTHREAD_MUTEX_unlock(&handle->wb_lock);
 
 	LogFullDebug(COMPONENT_FSAL,
 		"%s post obj_hdl %p state %p returned %d", __func__, obj_hdl,
@@ -1476,6 +1696,12 @@ fsal_status_t rgw_fsal_commit2(struct fsal_obj_handle *obj_hdl,
 		"%s enter obj_hdl %p offset %"PRIx64" length %zx",
 		__func__, obj_hdl, (uint64_t) offset, length);
 
+	PTHREAD_MUTEX_lock(&handle->wb_lock);
+	rc = rgw_wb_flush(export, handle);
+	PTHREAD_MUTEX_unlock(&handle->wb_lock);
+	if (rc < 0)
+		return rgw2fsal_error(rc);
+
 	rc = rgw_commit(export->rgw_fs, handle->rgw_fh, offset, length,
 			RGW_FSYNC_FLAG_NONE);
 	if (rc < 0)
@@ -1558,6 +1784,13 @@ fsal_status_t rgw_fsal_close2(struct fsal_obj_handle *obj_hdl,
 		return fsalstat(ERR_FSAL_NOT_OPENED, 0);
 	}
 
+	PTHREAD_MUTEX_lock(&handle->wb_lock);
+	rc = rgw_wb_flush(export, handle);
+	rgw_wb_release(handle);
+	PTHREAD_MUTEX_unlock(&handle->wb_lock);
+	if (rc < 0)
+		return rgw2fsal_error(rc);
+
 	rc = rgw_close(export->rgw_fs, handle->rgw_fh, RGW_CLOSE_FLAG_NONE);
 	if (rc < 0)
 		return rgw2fsal_error(rc);
@@ -34,6 +34,7 @@
 #include "fsal.h"
 #include "fsal_convert.h"
 #include "FSAL/fsal_commonlib.h"
+#include "abstract_atomic.h"
 
 #define RGW_INTERNAL_C
 #include "internal.h"
@@ -203,6 +204,8 @@ int construct_handle(struct rgw_export *export,
 		return -ENOMEM;
 
 	constructing->rgw_fh = rgw_fh;
+	PTHREAD_MUTEX_init(&constructing->wb_lock, NULL);
+	PTHREAD_MUTEX_init(&constructing->dir_lock, NULL);
 	constructing->up_ops = export->export.up_ops; /* XXXX going away */
 
 	fsal_obj_handle_init(&constructing->handle, &export->export,
@@ -220,6 +223,71 @@ int construct_handle(struct rgw_export *export,
 
 void deconstruct_handle(struct rgw_handle *obj)
 {
+	int i;
+
+	rgw_wb_release(obj);
+	PTHREAD_MUTEX_destroy(&obj->wb_lock);
+	for (i = 0; i < RGW_DIR_CURSORS; i++)
+		gsh_free(obj->dir_cursors[i].name);
+	PTHREAD_MUTEX_destroy(&obj->dir_lock);
 	fsal_obj_handle_fini(&obj->handle);
 	gsh_free(obj);
 }
+
+/**
+ * @brief Write out the staged writes of a file
+ *
+ * Must be called with wb_lock held.  The buffer is kept for reuse and
+ * is empty afterwards even if the write failed.
+ *
+ * @param[in] export Export the file belongs to
+ * @param[in] handle The file
+ *
+ * @return 0 on success, negative error codes on failure.
+ */
+
+int rgw_wb_flush(struct rgw_export *export, struct rgw_handle *handle)
+{
+	size_t written = 0;
+	int rc;
+
+	if (handle->wb_len == 0)
+		return 0;
+
+	rc = rgw_write(export->rgw_fs, handle->rgw_fh, handle->wb_offset,
+		       handle->wb_len, &written, handle->wb_buf,
+		       RGW_WRITE_FLAG_NONE);
+
+	if (rc >= 0 && written != handle->wb_len)
+		rc = -EIO;
+
+	if (rc < 0)
+		LogDebug(COMPONENT_FSAL,
+			 "flushing %zu bytes at %"PRIu64" returned %s (%d)",
+			 handle->wb_len, handle->wb_offset,
+			 strerror(-rc), -rc);
+
+	handle->wb_len = 0;
+
+	return rc;
+}
+
+/**
+ * @brief Give back the write buffer of a file
+ *
+ * Anything still staged is dropped, so flush first.
+ *
+ * @param[in] handle The file
+ */
+
+void rgw_wb_release(struct rgw_handle *handle)
+{
+	if (handle->wb_buf == NULL)
+		return;
+
+	gsh_free(handle->wb_buf);
+	handle->wb_buf = NULL;
+	handle->wb_len = 0;
+	(void) atomic_sub_uint64_t(&RGWFSM.write_buffer_bytes,
+				   RGWFSM.write_buffer_size);
+}
@@ -62,6 +62,10 @@ struct rgw_fsal_module {
 	char *cluster;
 	char *init_args;
 	librgw_t rgw;
+	uint64_t write_buffer_size;	/*< Staging buffer per open file */
+	uint64_t write_buffer_max;	/*< Cap on all staging buffers */
+	uint64_t write_buffer_bytes;	/*< Staging buffer memory in use */
+	uint32_t readdir_cursor_ttl;	/*< Seconds a dir_cursor is used */
 };
 extern struct rgw_fsal_module RGWFSM;
 
@@ -84,6 +88,19 @@ struct rgw_export {
 	char *rgw_secret_access_key;
 };
 
+/** Listing positions remembered per directory */
+#define RGW_DIR_CURSORS 4
+
+/**
+ * Where a READDIR left off, so the next one can resume the listing
+ * after that name rather than from the start of the bucket prefix
+ */
+struct rgw_dir_cursor {
+	fsal_cookie_t cookie;		/*< Cookie of the last entry */
+	char *name;			/*< Name of the last entry */
+	time_t stamp;			/*< When it was handed out */
+};
+
 /**
  * The RGW FSAL internal handle
  */
@@ -97,6 +114,13 @@ struct rgw_handle {
 					 *< belongs to */
 	struct fsal_share share;
 	fsal_openflags_t openflags;
+	pthread_mutex_t wb_lock;	/*< Protects the write buffer */
+	char *wb_buf;			/*< Staged sequential writes */
+	uint64_t wb_offset;		/*< File offset of wb_buf */
+	size_t wb_len;			/*< Bytes staged in wb_buf */
+	pthread_mutex_t dir_lock;	/*< Protects dir_cursors */
+	struct rgw_dir_cursor dir_cursors[RGW_DIR_CURSORS];
+	unsigned int dir_cursor_next;	/*< Next slot to reuse */
 };
 
 /**
@@ -151,4 +175,6 @@ struct state_t *rgw_alloc_state(struct fsal_export *exp_hdl,
 				enum state_type state_type,
 				struct state_t *related_state);
 void rgw_fs_invalidate(void *handle, struct rgw_fh_hk fh_hk);
+int rgw_wb_flush(struct rgw_export *export, struct rgw_handle *handle);
+void rgw_wb_release(struct rgw_handle *handle);
 #endif				/* !FSAL_RGW_INTERNAL_INTERNAL */
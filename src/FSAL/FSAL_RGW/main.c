@@ -82,6 +82,14 @@ static struct config_item rgw_items[] = {
 			rgw_fsal_module, fs_info.umask),
 	CONF_ITEM_MODE("xattr_access_rights", 0,
 			rgw_fsal_module, fs_info.xattr_access_rights),
+	CONF_ITEM_UI64("write_buffer_size", 0, FSAL_MAXIOSIZE * 8,
+			4 * 1024 * 1024,
+			rgw_fsal_module, write_buffer_size),
+	CONF_ITEM_UI64("write_buffer_max", 0, UINT64_MAX,
+			256 * 1024 * 1024,
+			rgw_fsal_module, write_buffer_max),
+	CONF_ITEM_UI32("readdir_cursor_ttl", 0, 3600, 60,
+			rgw_fsal_module, readdir_cursor_ttl),
 	CONFIG_EOL
 };
 
@@ -38,9 +38,55 @@
 #include "fsal_convert.h"
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef LINUX
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_STATX
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#endif
 #include "vfs_methods.h"
 #include "os/subr.h"
 #include "sal_data.h"
+#include "iobuf_pool.h"
+#ifdef USE_LTTNG
+#include "gsh_lttng/fsal.h"
+#endif
+
+static inline bool vfs_export_direct(void)
+{
+	return EXPORT_VFS_FROM_FSAL(op_ctx->fsal_export)->o_direct;
+}
+
+static inline bool vfs_export_deferred_open(void)
+{
+	return EXPORT_VFS_FROM_FSAL(op_ctx->fsal_export)->deferred_open;
+}
+
+/**
+ * @brief Switch a new data fd to O_DIRECT if the export asks for it
+ *
+ * Done with F_SETFL after the open so a create is never undone by a
+ * file system that refuses direct I/O; such fds simply stay buffered.
+ *
+ * @param[in] fd  Freshly opened descriptor of a regular file
+ */
+static void vfs_set_direct(int fd)
+{
+	int flags;
+
+	if (!vfs_export_direct())
+		return;
+
+	flags = fcntl(fd, F_GETFL);
+
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_DIRECT) == -1)
+		LogDebug(COMPONENT_FSAL,
+			 "fd %d stays buffered, O_DIRECT failed: %s",
+			 fd, strerror(errno));
+}
 
 fsal_status_t vfs_open_my_fd(struct vfs_fsal_obj_handle *myself,
 			     fsal_openflags_t openflags,
@@ -77,6 +123,7 @@ fsal_status_t vfs_open_my_fd(struct vfs_fsal_obj_handle *myself,
 			LogCrit(COMPONENT_FSAL,
 				"fd = %d, new openflags = %x",
 				fd, openflags);
+		vfs_set_direct(fd);
 		my_fd->fd = fd;
 		my_fd->openflags = openflags;
 	}
@@ -90,6 +137,9 @@ fsal_status_t vfs_close_my_fd(struct vfs_fd *my_fd)
 	int retval = 0;
 
 	if (my_fd->fd >= 0 && my_fd->openflags != FSAL_O_CLOSED) {
+#ifdef USE_VFS_IO_URING
+		vfs_uring_forget(my_fd);
+#endif
 		retval = close(my_fd->fd);
 		if (retval < 0) {
 			retval = errno;
@@ -97,11 +147,55 @@ fsal_status_t vfs_close_my_fd(struct vfs_fd *my_fd)
 		}
 		my_fd->fd = -1;
 		my_fd->openflags = FSAL_O_CLOSED;
+	} else {
+		/* A deferred open that never saw any I/O */
+		my_fd->openflags = FSAL_O_CLOSED;
 	}
 
 	return fsalstat(fsal_error, retval);
 }
 
+/**
+ * @brief Open the descriptor of a deferred open on its first I/O
+ *
+ * With Deferred_Open, an NFSv4 OPEN of an existing file takes its share
+ * reservation and sets the state's openflags but leaves fd at -1, so
+ * the common OPEN, GETATTR, CLOSE sequence never opens the file.  The
+ * first I/O through the state opens it here.  Two I/Os may race to do
+ * so; the loser closes its descriptor and uses the winner's.
+ *
+ * @param[in]     myself File
+ * @param[in,out] my_fd  Descriptor fsal_find_fd() chose
+ *
+ * @return FSAL status.
+ */
+static fsal_status_t vfs_open_deferred(struct vfs_fsal_obj_handle *myself,
+				       struct vfs_fd *my_fd)
+{
+	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
+	int posix_flags = 0;
+	int fd;
+
+	if (my_fd->fd >= 0 || my_fd->openflags == FSAL_O_CLOSED)
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+	fsal2posix_openflags(my_fd->openflags, &posix_flags);
+
+	fd = vfs_fsal_open(myself, posix_flags, &fsal_error);
+	if (fd < 0)
+		return fsalstat(fsal_error, -fd);
+
+	vfs_set_direct(fd);
+
+	if (!atomic_cas_int32_t(&my_fd->fd, -1, fd))
+		close(fd);
+
+	LogFullDebug(COMPONENT_FSAL, "Deferred open fd = %d, openflags = %x",
+		     my_fd->fd, my_fd->openflags);
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
 /**
  * @brief Function to open an fsal_obj_handle's global file descriptor.
  *
@@ -161,6 +255,9 @@ fsal_status_t vfs_close(struct fsal_obj_handle *obj_hdl)
 		return fsalstat(posix2fsal_error(EXDEV), EXDEV);
 	}
 
+	/* Reclaiming descriptors reclaims this one too */
+	vfs_path_fd_drop(myself);
+
 	if (myself->u.file.fd.openflags == FSAL_O_CLOSED)
 		return fsalstat(ERR_FSAL_NOT_OPENED, 0);
 
@@ -189,6 +286,10 @@ fsal_status_t vfs_close(struct fsal_obj_handle *obj_hdl)
  * @returns a state structure.
  */
 
+static struct gsh_slab vfs_state_slab =
+	GSH_SLAB_INITIALIZER("vfs_state_fd", struct vfs_state_fd, 4096,
+			     GSH_MEM_STATE);
+
 struct state_t *vfs_alloc_state(struct fsal_export *exp_hdl,
 				enum state_type state_type,
 				struct state_t *related_state)
@@ -196,7 +297,7 @@ struct state_t *vfs_alloc_state(struct fsal_export *exp_hdl,
 	struct state_t *state;
 	struct vfs_fd *my_fd;
 
-	state = init_state(gsh_calloc(1, sizeof(struct vfs_state_fd)),
+	state = init_state(gsh_slab_alloc(&vfs_state_slab),
 			   exp_hdl, state_type, related_state);
 
 	my_fd = &container_of(state, struct vfs_state_fd, state)->vfs_fd;
@@ -218,7 +319,15 @@ void vfs_free_state(struct fsal_export *exp_hdl, struct state_t *state)
 	struct vfs_state_fd *state_fd = container_of(state, struct vfs_state_fd,
 						     state);
 
-	gsh_free(state_fd);
+	gsh_slab_free(&vfs_state_slab, state_fd);
+}
+
+/**
+ * @brief Release the state slab before the module is unloaded
+ */
+void vfs_state_slab_destroy(void)
+{
+	gsh_slab_destroy(&vfs_state_slab);
 }
 
 /**
@@ -418,6 +527,18 @@ fsal_status_t vfs_open2(struct fsal_obj_handle *obj_hdl,
 			PTHREAD_RWLOCK_wrlock(&obj_hdl->obj_lock);
 		}
 
+		if (state != NULL && state->state_type == STATE_TYPE_SHARE &&
+		    createmode == FSAL_NO_CREATE && !truncated &&
+		    vfs_export_deferred_open()) {
+			/* Leave the fd to the first I/O, see
+			 * vfs_open_deferred().  We haven't done any
+			 * permission check so ask the caller to do so.
+			 */
+			my_fd->openflags = openflags;
+			*caller_perm_check = true;
+			return status;
+		}
+
 		status = vfs_open_my_fd(myself, openflags, posix_flags, my_fd);
 
 		if (FSAL_IS_ERROR(status)) {
@@ -571,7 +692,7 @@ fsal_status_t vfs_open2(struct fsal_obj_handle *obj_hdl,
 		posix_flags |= O_EXCL;
 	}
 
-	dir_fd = vfs_fsal_open(myself, O_PATH | O_NOACCESS, &status.major);
+	dir_fd = vfs_path_fd_get(myself, &status.major);
 
 	if (dir_fd < 0)
 		return fsalstat(status.major, -dir_fd);
@@ -624,6 +745,8 @@ fsal_status_t vfs_open2(struct fsal_obj_handle *obj_hdl,
 		goto direrr;
 	}
 
+	vfs_set_direct(fd);
+
 	/* Remember if we were responsible for creating the file.
 	 * Note that in an UNCHECKED retry we MIGHT have re-created the
 	 * file and won't remember that. Oh well, so in that rare case we
@@ -748,7 +871,7 @@ fsal_status_t vfs_open2(struct fsal_obj_handle *obj_hdl,
 		posix2fsal_attributes_all(&stat, attrs_out);
 	}
 
-	close(dir_fd);
+	vfs_path_fd_put(myself, dir_fd);
 
 	if (state != NULL) {
 		/* Prepare to take the share reservation, but only if we are
@@ -779,7 +902,7 @@ fsal_status_t vfs_open2(struct fsal_obj_handle *obj_hdl,
 
  direrr:
 
-	close(dir_fd);
+	vfs_path_fd_put(myself, dir_fd);
 	return fsalstat(posix2fsal_error(retval), retval);
 }
 
@@ -850,6 +973,14 @@ fsal_status_t vfs_reopen2(struct fsal_obj_handle *obj_hdl,
 	 */
 	update_share_counters(&myself->u.file.share, old_openflags, openflags);
 
+	/* An upgrade or downgrade of a deferred open stays deferred */
+	if (my_share_fd->fd < 0 && old_openflags != FSAL_O_CLOSED &&
+	    !(posix_flags & O_TRUNC)) {
+		my_share_fd->openflags = openflags;
+		PTHREAD_RWLOCK_unlock(&obj_hdl->obj_lock);
+		return status;
+	}
+
 	PTHREAD_RWLOCK_unlock(&obj_hdl->obj_lock);
 
 	status = vfs_open_my_fd(myself, openflags, posix_flags, my_fd);
@@ -923,6 +1054,9 @@ fsal_status_t find_fd(int *fd,
 				      vfs_open_func, vfs_close_func,
 				      has_lock, closefd, open_for_locks);
 
+		if (!FSAL_IS_ERROR(status))
+			status = vfs_open_deferred(myself, out_fd);
+
 		*fd = out_fd->fd;
 		return status;
 
@@ -962,6 +1096,266 @@ fsal_status_t find_fd(int *fd,
 	return status;
 }
 
+/** Offset, length and memory alignment required by O_DIRECT */
+#define VFS_DIRECT_ALIGN ((uint64_t) IOBUF_ALIGN)
+
+#define VFS_DIRECT_ALIGNED(x) \
+	(((uint64_t) (uintptr_t) (x) & (VFS_DIRECT_ALIGN - 1)) == 0)
+
+/**
+ * @brief Check whether I/O on a descriptor has to be aligned
+ *
+ * The answer comes from the fd itself: a file system may have refused
+ * O_DIRECT, and the global fd may have been opened through another
+ * export.  Exports without O_Direct only ask after an EINVAL.
+ *
+ * @param[in] fd  Descriptor of a regular file
+ *
+ * @return true if @a fd is open with O_DIRECT.
+ */
+static bool vfs_fd_direct(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	return flags != -1 && (flags & O_DIRECT) != 0;
+}
+
+/**
+ * @brief pread on an O_DIRECT fd
+ *
+ * Aligned requests go straight to the caller's buffer.  Anything else
+ * reads the covering aligned range into a pool buffer and copies out.
+ *
+ * @param[in]  myself  File being read
+ * @param[in]  fd      O_DIRECT descriptor
+ * @param[out] buffer  Where to put the data
+ * @param[in]  size    Bytes wanted
+ * @param[in]  offset  Where to read from
+ *
+ * @return Bytes read, or -1 with errno set.
+ */
+static ssize_t vfs_pread_direct(struct vfs_fsal_obj_handle *myself, int fd,
+				void *buffer, size_t size, uint64_t offset)
+{
+	uint64_t start = offset & ~(VFS_DIRECT_ALIGN - 1);
+	size_t head = offset - start;
+	size_t len = roundup(head + size, VFS_DIRECT_ALIGN);
+	char *bounce;
+	ssize_t nb_read;
+	int err;
+
+	PTHREAD_RWLOCK_rdlock(&myself->u.file.direct_lock);
+
+	if (head == 0 && VFS_DIRECT_ALIGNED(size) &&
+	    VFS_DIRECT_ALIGNED(buffer)) {
+		nb_read = pread(fd, buffer, size, offset);
+		err = errno;
+		PTHREAD_RWLOCK_unlock(&myself->u.file.direct_lock);
+		errno = err;
+		return nb_read;
+	}
+
+	bounce = iobuf_get(len);
+
+	nb_read = pread(fd, bounce, len, start);
+	err = errno;
+
+	PTHREAD_RWLOCK_unlock(&myself->u.file.direct_lock);
+
+	if (nb_read > (ssize_t) head) {
+		nb_read = MIN((size_t) nb_read - head, size);
+		memcpy(buffer, bounce + head, nb_read);
+	} else if (nb_read >= 0) {
+		nb_read = 0;
+	}
+
+	iobuf_put(bounce);
+	errno = err;
+	return nb_read;
+}
+
+/**
+ * @brief Read one aligned block for a read-modify-write
+ *
+ * Anything past end of file reads as zeroes.
+ *
+ * @return 0, or -1 with errno set.
+ */
+static int vfs_read_block(int fd, char *block, uint64_t offset)
+{
+	ssize_t nb_read = pread(fd, block, VFS_DIRECT_ALIGN, offset);
+
+	if (nb_read == -1)
+		return -1;
+
+	memset(block + nb_read, 0, VFS_DIRECT_ALIGN - nb_read);
+	return 0;
+}
+
+/**
+ * @brief pwritev on an O_DIRECT fd
+ *
+ * Aligned requests are written as they lie.  Otherwise the data is
+ * gathered into a pool buffer covering the aligned range; partial
+ * blocks at either end are first read back so the bytes around the
+ * request are preserved, and a write past end of file is trimmed
+ * back to the end of the request.  Read-modify-write excludes all
+ * other direct I/O on the file.
+ *
+ * @param[in] myself  File being written
+ * @param[in] fd      O_DIRECT descriptor
+ * @param[in] iov     Segments to write
+ * @param[in] iovcnt  Number of segments
+ * @param[in] offset  Where to write
+ *
+ * @return Bytes of the request written, or -1 with errno set.
+ */
+static ssize_t vfs_pwritev_direct(struct vfs_fsal_obj_handle *myself, int fd,
+				  const struct iovec *iov, int iovcnt,
+				  uint64_t offset)
+{
+	uint64_t start = offset & ~(VFS_DIRECT_ALIGN - 1);
+	size_t head = offset - start;
+	size_t size = 0, len, pos;
+	bool aligned = head == 0;
+	bool rmw;
+	struct stat st;
+	off_t old_size = 0;
+	char *bounce;
+	ssize_t nb_written;
+	int i, err = 0;
+
+	for (i = 0; i < iovcnt; i++) {
+		size += iov[i].iov_len;
+		aligned = aligned && VFS_DIRECT_ALIGNED(iov[i].iov_base) &&
+			  VFS_DIRECT_ALIGNED(iov[i].iov_len);
+	}
+
+	if (aligned) {
+		PTHREAD_RWLOCK_rdlock(&myself->u.file.direct_lock);
+		nb_written = pwritev(fd, iov, iovcnt, offset);
+		err = errno;
+		PTHREAD_RWLOCK_unlock(&myself->u.file.direct_lock);
+		errno = err;
+		return nb_written;
+	}
+
+	len = roundup(head + size, VFS_DIRECT_ALIGN);
+	rmw = head != 0 || !VFS_DIRECT_ALIGNED(size);
+	bounce = iobuf_get(len);
+
+	if (rmw)
+		PTHREAD_RWLOCK_wrlock(&myself->u.file.direct_lock);
+	else
+		PTHREAD_RWLOCK_rdlock(&myself->u.file.direct_lock);
+
+	if (rmw) {
+		nb_written = -1;
+
+		if (fstat(fd, &st) == -1)
+			goto out;
+		old_size = st.st_size;
+
+		if (head != 0 && vfs_read_block(fd, bounce, start) == -1)
+			goto out;
+
+		if (!VFS_DIRECT_ALIGNED(head + size) &&
+		    (len > VFS_DIRECT_ALIGN || head == 0) &&
+		    vfs_read_block(fd, bounce + len - VFS_DIRECT_ALIGN,
+				   start + len - VFS_DIRECT_ALIGN) == -1)
+			goto out;
+	}
+
+	for (i = 0, pos = head; i < iovcnt; i++) {
+		memcpy(bounce + pos, iov[i].iov_base, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	}
+
+	nb_written = pwrite(fd, bounce, len, start);
+
+	if (nb_written == -1)
+		goto out;
+
+	if (rmw && offset + size < start + len &&
+	    (uint64_t) old_size < start + len &&
+	    ftruncate(fd, MAX((uint64_t) old_size, offset + size)) == -1) {
+		nb_written = -1;
+		goto out;
+	}
+
+	if (nb_written > (ssize_t) head)
+		nb_written = MIN((size_t) nb_written - head, size);
+	else
+		nb_written = 0;
+
+ out:
+	if (nb_written == -1)
+		err = errno;
+
+	PTHREAD_RWLOCK_unlock(&myself->u.file.direct_lock);
+	iobuf_put(bounce);
+	errno = err;
+	return nb_written;
+}
+
+/**
+ * @brief Look for a hole at the start of a READ_PLUS
+ *
+ * If @a offset is in a hole, fill in @a info with it and return true.
+ * Otherwise return false with @a read_amount set to how much of the
+ * request is data before the next hole.  File systems that can not
+ * report holes look like all data.
+ *
+ * @param[in]  fd           Descriptor of the file
+ * @param[in]  offset       Start of the read
+ * @param[in]  size         Size of the read
+ * @param[out] read_amount  Size of the hole, or of the data to read
+ * @param[out] end_of_file  Whether a hole reaches end of file
+ * @param[out] info         Hole found
+ *
+ * @return true if a hole was reported.
+ */
+
+static bool vfs_read_hole(int fd, uint64_t offset, size_t size,
+			  size_t *read_amount, bool *end_of_file,
+			  struct io_info *info)
+{
+	struct stat st;
+	off_t data, hole;
+
+	*read_amount = size;
+
+	if (fstat(fd, &st) == -1 || offset >= (uint64_t) st.st_size)
+		return false;
+
+	data = lseek(fd, offset, SEEK_DATA);
+
+	if (data == -1) {
+		if (errno != ENXIO)
+			return false;
+		/* Hole all the way to end of file */
+		data = st.st_size;
+	}
+
+	if ((uint64_t) data == offset) {
+		hole = lseek(fd, offset, SEEK_HOLE);
+		if (hole != -1 && (uint64_t) hole - offset < size)
+			*read_amount = hole - offset;
+		return false;
+	}
+
+	if ((uint64_t) data - offset < size)
+		*read_amount = data - offset;
+
+	*end_of_file = offset + *read_amount >= (uint64_t) st.st_size;
+
+	info->io_content.what = NFS4_CONTENT_HOLE;
+	info->io_content.hole.di_offset = offset;
+	info->io_content.hole.di_length = *read_amount;
+
+	return true;
+}
+
 /**
  * @brief Read data from a file
  *
@@ -999,11 +1393,8 @@ fsal_status_t vfs_read2(struct fsal_obj_handle *obj_hdl,
 	int retval = 0;
 	bool has_lock = false;
 	bool closefd = false;
-
-	if (info != NULL) {
-		/* Currently we don't support READ_PLUS */
-		return fsalstat(ERR_FSAL_NOTSUPP, 0);
-	}
+	struct vfs_fsal_obj_handle *myself =
+		container_of(obj_hdl, struct vfs_fsal_obj_handle, obj_handle);
 
 	if (obj_hdl->fsal != obj_hdl->fs->fsal) {
 		LogDebug(COMPONENT_FSAL,
@@ -1019,7 +1410,35 @@ fsal_status_t vfs_read2(struct fsal_obj_handle *obj_hdl,
 	if (FSAL_IS_ERROR(status))
 		goto out;
 
-	nb_read = pread(my_fd, buffer, buffer_size, offset);
+	if (info != NULL) {
+		/* READ_PLUS: report a hole rather than reading zeroes */
+		if (vfs_read_hole(my_fd, offset, buffer_size, read_amount,
+				  end_of_file, info))
+			goto out;
+
+		/* Only read up to the next hole */
+		buffer_size = *read_amount;
+	}
+
+#ifdef USE_LTTNG
+	tracepoint(fsal, io_start, obj_hdl->fsal->name, obj_hdl, 0, offset,
+		   buffer_size);
+#endif
+
+	if (vfs_export_direct() && vfs_fd_direct(my_fd)) {
+		nb_read = vfs_pread_direct(myself, my_fd, buffer, buffer_size,
+					   offset);
+	} else {
+		nb_read = pread(my_fd, buffer, buffer_size, offset);
+		if (nb_read == -1 && errno == EINVAL && vfs_fd_direct(my_fd))
+			nb_read = vfs_pread_direct(myself, my_fd, buffer,
+						   buffer_size, offset);
+	}
+
+#ifdef USE_LTTNG
+	tracepoint(fsal, io_end, obj_hdl, 0, nb_read,
+		   nb_read == -1 ? errno : 0);
+#endif
 
 	if (offset == -1 || nb_read == -1) {
 		retval = errno;
@@ -1031,21 +1450,12 @@ fsal_status_t vfs_read2(struct fsal_obj_handle *obj_hdl,
 
 	*end_of_file = (nb_read == 0);
 
-#if 0
-	/** @todo
-	 *
-	 * Is this all we really need to do to support READ_PLUS? Will anyone
-	 * ever get upset that we don't return holes, even for blocks of all
-	 * zeroes?
-	 *
-	 */
 	if (info != NULL) {
 		info->io_content.what = NFS4_CONTENT_DATA;
-		info->io_content.data.d_offset = offset + nb_read;
+		info->io_content.data.d_offset = offset;
 		info->io_content.data.d_data.data_len = nb_read;
 		info->io_content.data.d_data.data_val = buffer;
 	}
-#endif
 
  out:
 
@@ -1092,6 +1502,47 @@ fsal_status_t vfs_write2(struct fsal_obj_handle *obj_hdl,
 			 size_t *wrote_amount,
 			 bool *fsal_stable,
 			 struct io_info *info)
+{
+	struct iovec iov = {
+		.iov_base = buffer,
+		.iov_len = buffer_size,
+	};
+
+	return vfs_writev2(obj_hdl, bypass, state, offset, &iov, 1,
+			   wrote_amount, fsal_stable, info);
+}
+
+/**
+ * @brief Write a scatter list to a file
+ *
+ * As vfs_write2, but the data is handed to pwritev as it lies, so no
+ * gathering copy is made.
+ *
+ * @param[in]     obj_hdl        File on which to operate
+ * @param[in]     bypass         If state doesn't indicate a share reservation,
+ *                               bypass any non-mandatory deny write
+ * @param[in]     state          state_t to use for this operation
+ * @param[in]     offset         Position at which to write
+ * @param[in]     iov            Segments to be written
+ * @param[in]     iovcnt         Number of segments
+ * @param[out]    wrote_amount   Amount of data written
+ * @param[in,out] fsal_stable    In, if on, the fsal is requested to write data
+ *                               to stable store. Out, the fsal reports what
+ *                               it did.
+ * @param[in,out] info           more information about the data
+ *
+ * @return FSAL status.
+ */
+
+fsal_status_t vfs_writev2(struct fsal_obj_handle *obj_hdl,
+			  bool bypass,
+			  struct state_t *state,
+			  uint64_t offset,
+			  const struct iovec *iov,
+			  int iovcnt,
+			  size_t *wrote_amount,
+			  bool *fsal_stable,
+			  struct io_info *info)
 {
 	ssize_t nb_written;
 	fsal_status_t status;
@@ -1100,6 +1551,8 @@ fsal_status_t vfs_write2(struct fsal_obj_handle *obj_hdl,
 	bool has_lock = false;
 	bool closefd = false;
 	fsal_openflags_t openflags = FSAL_O_WRITE;
+	struct vfs_fsal_obj_handle *myself =
+		container_of(obj_hdl, struct vfs_fsal_obj_handle, obj_handle);
 
 	if (info != NULL) {
 		/* Currently we don't support WRITE_PLUS */
@@ -1125,12 +1578,26 @@ fsal_status_t vfs_write2(struct fsal_obj_handle *obj_hdl,
 
 	fsal_set_credentials(op_ctx->creds);
 
-	nb_written = pwrite(my_fd, buffer, buffer_size, offset);
+#ifdef USE_LTTNG
+	tracepoint(fsal, io_start, obj_hdl->fsal->name, obj_hdl, 1, offset,
+		   fsal_iov_length(iov, iovcnt));
+#endif
+
+	if (vfs_export_direct() && vfs_fd_direct(my_fd)) {
+		nb_written = vfs_pwritev_direct(myself, my_fd, iov, iovcnt,
+						offset);
+	} else {
+		nb_written = pwritev(my_fd, iov, iovcnt, offset);
+		if (nb_written == -1 && errno == EINVAL &&
+		    vfs_fd_direct(my_fd))
+			nb_written = vfs_pwritev_direct(myself, my_fd, iov,
+							iovcnt, offset);
+	}
 
 	if (nb_written == -1) {
 		retval = errno;
 		status = fsalstat(posix2fsal_error(retval), retval);
-		goto out;
+		goto out_trace;
 	}
 
 	*wrote_amount = nb_written;
@@ -1143,6 +1610,14 @@ fsal_status_t vfs_write2(struct fsal_obj_handle *obj_hdl,
 		}
 	}
 
+ out_trace:
+
+#ifdef USE_LTTNG
+	/* A stable write ends with the fsync */
+	tracepoint(fsal, io_end, obj_hdl, 1,
+		   FSAL_IS_ERROR(status) ? -1 : nb_written, status.minor);
+#endif
+
  out:
 
 	if (closefd)
@@ -1155,59 +1630,70 @@ fsal_status_t vfs_write2(struct fsal_obj_handle *obj_hdl,
 	return status;
 }
 
+#ifdef USE_VFS_IO_URING
+static inline bool vfs_export_uring(void)
+{
+	return EXPORT_VFS_FROM_FSAL(op_ctx->fsal_export)->io_uring;
+}
+
 /**
- * @brief Commit written data
+ * @brief Hand a READ or WRITE to the io_uring engine
  *
- * This function flushes possibly buffered data to a file. This method
- * differs from commit due to the need to interact with share reservations
- * and the fact that the FSAL manages the state of "file descriptors". The
- * FSAL must be able to perform this operation without being passed a specific
- * state.
+ * Unaligned I/O on an O_Direct export needs the bounce buffers of
+ * vfs_pread_direct and vfs_pwritev_direct, so it is left to the caller,
+ * as is anything the engine cannot take right now.  The fd and the
+ * object lock are released before the request is started.
  *
- * @param[in] obj_hdl          File on which to operate
- * @param[in] state            state_t to use for this operation
- * @param[in] offset           Start of range to commit
- * @param[in] len              Length of range to commit
+ * @param[in,out] io         The I/O, owner and fd are filled in here
+ * @param[in]     bypass     Bypass any non-mandatory deny
+ * @param[in]     state      state_t to use for this operation
+ * @param[in]     openflags  FSAL_O_READ or FSAL_O_WRITE
  *
- * @return FSAL status.
+ * @return true if io->done_cb will be called by the engine.
  */
-
-fsal_status_t vfs_commit2(struct fsal_obj_handle *obj_hdl,
-			  off_t offset,
-			  size_t len)
+static bool vfs_uring_submit(struct vfs_uring_io *io, bool bypass,
+			     struct state_t *state,
+			     fsal_openflags_t openflags)
 {
-	struct vfs_fsal_obj_handle *myself;
-	fsal_status_t status;
-	int retval;
+	struct fsal_obj_handle *obj_hdl = io->obj_hdl;
+	struct vfs_fsal_obj_handle *myself =
+		container_of(obj_hdl, struct vfs_fsal_obj_handle, obj_handle);
 	struct vfs_fd temp_fd = {0, -1}, *out_fd = &temp_fd;
+	struct vfs_uring_req *req;
+	fsal_status_t status;
 	bool has_lock = false;
 	bool closefd = false;
 
-	myself = container_of(obj_hdl, struct vfs_fsal_obj_handle, obj_handle);
+	if (!vfs_export_uring() || obj_hdl->type != REGULAR_FILE ||
+	    obj_hdl->fsal != obj_hdl->fs->fsal)
+		return false;
 
-	/* Make sure file is open in appropriate mode.
-	 * Do not check share reservation.
-	 */
-	status = fsal_reopen_obj(obj_hdl, false, false, FSAL_O_WRITE,
-				 (struct fsal_fd *)&myself->u.file.fd,
-				 &myself->u.file.share,
-				 vfs_open_func, vfs_close_func,
-				 (struct fsal_fd **)&out_fd, &has_lock,
-				 &closefd);
+	if (vfs_export_direct() &&
+	    ((io->offset | io->size | (uintptr_t) io->buffer) &
+	     (IOBUF_ALIGN - 1)) != 0)
+		return false;
 
-	if (!FSAL_IS_ERROR(status)) {
+	status = fsal_find_fd((struct fsal_fd **)&out_fd, obj_hdl,
+			      (struct fsal_fd *)&myself->u.file.fd,
+			      &myself->u.file.share,
+			      bypass, state, openflags,
+			      vfs_open_func, vfs_close_func,
+			      &has_lock, &closefd, false);
 
-		fsal_set_credentials(op_ctx->creds);
+	if (!FSAL_IS_ERROR(status))
+		status = vfs_open_deferred(myself, out_fd);
 
-		retval = fsync(out_fd->fd);
+	/* Let the synchronous path report the error */
+	if (FSAL_IS_ERROR(status)) {
+		if (has_lock)
+			PTHREAD_RWLOCK_unlock(&obj_hdl->obj_lock);
+		return false;
+	}
 
-		if (retval == -1) {
-			retval = errno;
-			status = fsalstat(posix2fsal_error(retval), retval);
-		}
+	io->owner = closefd ? NULL : out_fd;
+	io->fd = out_fd->fd;
 
-		fsal_restore_ganesha_credentials();
-	}
+	req = vfs_uring_prepare(io);
 
 	if (closefd)
 		close(out_fd->fd);
@@ -1215,15 +1701,607 @@ fsal_status_t vfs_commit2(struct fsal_obj_handle *obj_hdl,
 	if (has_lock)
 		PTHREAD_RWLOCK_unlock(&obj_hdl->obj_lock);
 
-	return status;
-}
+	if (req == NULL)
+		return false;
 
-#ifdef F_OFD_GETLK
-/**
- * @brief Perform a lock operation
- *
- * This function performs a lock operation (lock, unlock, test) on a
- * file. This method assumes the FSAL is able to support lock owners,
+	if (io->write)
+		fsal_set_credentials(op_ctx->creds);
+
+#ifdef USE_LTTNG
+	tracepoint(fsal, async_io_start, obj_hdl->fsal->name, req, obj_hdl,
+		   io->write, io->offset, io->size);
+#endif
+
+	vfs_uring_start(req);
+
+	if (io->write)
+		fsal_restore_ganesha_credentials();
+
+	return true;
+}
+
+/**
+ * @brief Read data from a file asynchronously
+ *
+ * As vfs_read2, with the read done through io_uring on exports that
+ * ask for it.  READ_PLUS and I/O the engine cannot take are done by
+ * vfs_read2 and completed inline.
+ */
+void vfs_read2_async(struct fsal_obj_handle *obj_hdl,
+		     bool bypass,
+		     struct state_t *state,
+		     uint64_t offset,
+		     size_t buffer_size,
+		     void *buffer,
+		     size_t *read_amount,
+		     bool *end_of_file,
+		     struct io_info *info,
+		     fsal_async_cb done_cb,
+		     void *caller_data)
+{
+	struct vfs_uring_io io = {
+		.obj_hdl = obj_hdl,
+		.write = false,
+		.offset = offset,
+		.size = buffer_size,
+		.buffer = buffer,
+		.amount = read_amount,
+		.end_of_file = end_of_file,
+		.done_cb = done_cb,
+		.caller_data = caller_data,
+	};
+	fsal_status_t status;
+
+	if (info == NULL &&
+	    vfs_uring_submit(&io, bypass, state, FSAL_O_READ))
+		return;
+
+	status = vfs_read2(obj_hdl, bypass, state, offset, buffer_size,
+			   buffer, read_amount, end_of_file, info);
+
+	done_cb(obj_hdl, status, caller_data);
+}
+
+/**
+ * @brief Write data to a file asynchronously
+ *
+ * As vfs_write2, with the write done through io_uring on exports that
+ * ask for it.  A stable write is followed by an fsync on the same ring
+ * before done_cb is called.
+ */
+void vfs_write2_async(struct fsal_obj_handle *obj_hdl,
+		      bool bypass,
+		      struct state_t *state,
+		      uint64_t offset,
+		      size_t buffer_size,
+		      void *buffer,
+		      size_t *wrote_amount,
+		      bool *fsal_stable,
+		      struct io_info *info,
+		      fsal_async_cb done_cb,
+		      void *caller_data)
+{
+	struct vfs_uring_io io = {
+		.obj_hdl = obj_hdl,
+		.write = true,
+		.stable = *fsal_stable,
+		.offset = offset,
+		.size = buffer_size,
+		.buffer = buffer,
+		.amount = wrote_amount,
+		.done_cb = done_cb,
+		.caller_data = caller_data,
+	};
+	fsal_status_t status;
+
+	if (info == NULL &&
+	    vfs_uring_submit(&io, bypass, state, FSAL_O_WRITE))
+		return;
+
+	status = vfs_write2(obj_hdl, bypass, state, offset, buffer_size,
+			    buffer, wrote_amount, fsal_stable, info);
+
+	done_cb(obj_hdl, status, caller_data);
+}
+#endif /* USE_VFS_IO_URING */
+
+/**
+ * @brief Seek to data or hole
+ *
+ * Uses SEEK_DATA/SEEK_HOLE.  Finding no data past the offset is not an
+ * error; it is reported as end of file.  An offset at or past end of
+ * file is ERR_FSAL_NXIO.
+ *
+ * @param[in]     obj_hdl  File on which to operate
+ * @param[in]     state    state_t to use for this operation
+ * @param[in,out] info     What to seek for and from, what was found
+ *
+ * @return FSAL status.
+ */
+
+fsal_status_t vfs_seek2(struct fsal_obj_handle *obj_hdl,
+			struct state_t *state,
+			struct io_info *info)
+{
+	fsal_status_t status;
+	int my_fd = -1;
+	bool has_lock = false;
+	bool closefd = false;
+	struct stat st;
+	off_t offset = info->io_content.hole.di_offset;
+	off_t found;
+	int whence, retval;
+
+	switch (info->io_content.what) {
+	case NFS4_CONTENT_DATA:
+		whence = SEEK_DATA;
+		break;
+	case NFS4_CONTENT_HOLE:
+		whence = SEEK_HOLE;
+		break;
+	default:
+		return fsalstat(ERR_FSAL_UNION_NOTSUPP, 0);
+	}
+
+	status = find_fd(&my_fd, obj_hdl, false, state, FSAL_O_ANY,
+			 &has_lock, &closefd, false);
+
+	if (FSAL_IS_ERROR(status))
+		return status;
+
+	if (fstat(my_fd, &st) == -1) {
+		retval = errno;
+		status = fsalstat(posix2fsal_error(retval), retval);
+		goto out;
+	}
+
+	if (offset >= st.st_size) {
+		status = fsalstat(ERR_FSAL_NXIO, ENXIO);
+		goto out;
+	}
+
+	found = lseek(my_fd, offset, whence);
+
+	if (found == -1) {
+		retval = errno;
+		if (retval != ENXIO) {
+			status = fsalstat(posix2fsal_error(retval), retval);
+			goto out;
+		}
+		/* No data after offset */
+		found = st.st_size;
+	}
+
+	info->io_eof = found >= st.st_size;
+	info->io_content.hole.di_offset = found;
+
+ out:
+
+	if (closefd)
+		close(my_fd);
+
+	if (has_lock)
+		PTHREAD_RWLOCK_unlock(&obj_hdl->obj_lock);
+
+	return status;
+}
+
+/**
+ * @brief Pass IO_ADVISE hints to the kernel
+ *
+ * Each hint with a posix_fadvise() counterpart is given for the range,
+ * a count of 0 running to end of file as it does for both.  WILLNEED
+ * has the kernel start reading the range into the page cache.  Hints
+ * without a counterpart, or that the kernel refuses, are cleared.
+ *
+ * @param[in]     obj_hdl  File to advise on
+ * @param[in]     state    state_t to use for this operation
+ * @param[in,out] hints    Hints asked for, returns those honored
+ *
+ * @return FSAL status.
+ */
+
+fsal_status_t vfs_io_advise2(struct fsal_obj_handle *obj_hdl,
+			     struct state_t *state,
+			     struct io_hints *hints)
+{
+	static const struct {
+		uint32_t hint;
+		int advice;
+	} advice[] = {
+		{ IO_ADVISE4_NORMAL, POSIX_FADV_NORMAL },
+		{ IO_ADVISE4_SEQUENTIAL, POSIX_FADV_SEQUENTIAL },
+		{ IO_ADVISE4_RANDOM, POSIX_FADV_RANDOM },
+		{ IO_ADVISE4_WILLNEED, POSIX_FADV_WILLNEED },
+		{ IO_ADVISE4_WILLNEED_OPPORTUNISTIC, POSIX_FADV_WILLNEED },
+		{ IO_ADVISE4_DONTNEED, POSIX_FADV_DONTNEED },
+		{ IO_ADVISE4_NOREUSE, POSIX_FADV_NOREUSE },
+	};
+	fsal_status_t status;
+	int my_fd = -1;
+	bool has_lock = false;
+	bool closefd = false;
+	uint32_t honored = 0;
+	size_t i;
+
+	status = find_fd(&my_fd, obj_hdl, false, state, FSAL_O_ANY,
+			 &has_lock, &closefd, false);
+
+	if (FSAL_IS_ERROR(status)) {
+		hints->hints = 0;
+		return status;
+	}
+
+	for (i = 0; i < sizeof(advice) / sizeof(advice[0]); i++) {
+		if (!(hints->hints & (1 << advice[i].hint)))
+			continue;
+
+		if (posix_fadvise(my_fd, hints->offset, hints->count,
+				  advice[i].advice) == 0)
+			honored |= 1 << advice[i].hint;
+	}
+
+	hints->hints = honored;
+
+	if (closefd)
+		close(my_fd);
+
+	if (has_lock)
+		PTHREAD_RWLOCK_unlock(&obj_hdl->obj_lock);
+
+	return status;
+}
+
+/**
+ * @brief Get descriptors for both ends of a copy or clone
+ *
+ * On success, the caller must call copy_put_fds() with the same
+ * arguments.
+ *
+ * @param[in]  dst_hdl    File to copy into
+ * @param[in]  dst_state  state_t for dst_hdl
+ * @param[out] dst_fd     Descriptor open for write on dst_hdl
+ * @param[in]  src_hdl    File to copy from
+ * @param[in]  src_state  state_t for src_hdl
+ * @param[out] src_fd     Descriptor open for read on src_hdl
+ * @param[out] has_lock   Whether each obj_lock (dst, src) is held
+ * @param[out] closefd    Whether each descriptor (dst, src) is temporary
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t copy_get_fds(struct fsal_obj_handle *dst_hdl,
+				  struct state_t *dst_state,
+				  int *dst_fd,
+				  struct fsal_obj_handle *src_hdl,
+				  struct state_t *src_state,
+				  int *src_fd,
+				  bool has_lock[2],
+				  bool closefd[2])
+{
+	fsal_status_t status;
+
+	if (dst_hdl->fsal != dst_hdl->fs->fsal ||
+	    dst_hdl->fs != src_hdl->fs) {
+		LogDebug(COMPONENT_FSAL,
+			 "Copy between different file systems, return EXDEV");
+		return fsalstat(posix2fsal_error(EXDEV), EXDEV);
+	}
+
+	status = find_fd(src_fd, src_hdl, false, src_state, FSAL_O_READ,
+			 &has_lock[1], &closefd[1], false);
+
+	if (FSAL_IS_ERROR(status)) {
+		LogDebug(COMPONENT_FSAL,
+			 "find_fd for source failed %s",
+			 msg_fsal_err(status.major));
+		return status;
+	}
+
+	status = find_fd(dst_fd, dst_hdl, false, dst_state, FSAL_O_WRITE,
+			 &has_lock[0], &closefd[0], false);
+
+	if (FSAL_IS_ERROR(status)) {
+		LogDebug(COMPONENT_FSAL,
+			 "find_fd for destination failed %s",
+			 msg_fsal_err(status.major));
+
+		if (closefd[1])
+			close(*src_fd);
+
+		if (has_lock[1])
+			PTHREAD_RWLOCK_unlock(&src_hdl->obj_lock);
+	}
+
+	return status;
+}
+
+static void copy_put_fds(struct fsal_obj_handle *dst_hdl, int dst_fd,
+			 struct fsal_obj_handle *src_hdl, int src_fd,
+			 bool has_lock[2], bool closefd[2])
+{
+	if (closefd[0])
+		close(dst_fd);
+
+	if (has_lock[0])
+		PTHREAD_RWLOCK_unlock(&dst_hdl->obj_lock);
+
+	if (closefd[1])
+		close(src_fd);
+
+	if (has_lock[1])
+		PTHREAD_RWLOCK_unlock(&src_hdl->obj_lock);
+}
+
+/**
+ * @brief Copy a range of one file into another
+ *
+ * Uses copy_file_range, so the kernel (and below it the file system)
+ * moves the data.  Results the kernel can not handle are reported as
+ * ERR_FSAL_NOTSUPP so the caller can fall back to reading and writing.
+ *
+ * @param[in]  dst_hdl     File to copy into
+ * @param[in]  dst_state   state_t for dst_hdl
+ * @param[in]  dst_offset  Position in dst_hdl to copy to
+ * @param[in]  src_hdl     File to copy from
+ * @param[in]  src_state   state_t for src_hdl
+ * @param[in]  src_offset  Position in src_hdl to copy from
+ * @param[in]  count       Amount to copy, 0 for to end of file
+ * @param[out] copied      Amount copied
+ *
+ * @return FSAL status.
+ */
+
+fsal_status_t vfs_copy(struct fsal_obj_handle *dst_hdl,
+		       struct state_t *dst_state,
+		       uint64_t dst_offset,
+		       struct fsal_obj_handle *src_hdl,
+		       struct state_t *src_state,
+		       uint64_t src_offset,
+		       uint64_t count,
+		       uint64_t *copied)
+{
+#ifdef __NR_copy_file_range
+	fsal_status_t status;
+	int dst_fd = -1, src_fd = -1;
+	bool has_lock[2] = {false, false};
+	bool closefd[2] = {false, false};
+	loff_t dst_off = dst_offset, src_off = src_offset;
+	struct stat st;
+	ssize_t nb_copied;
+	int retval;
+
+	status = copy_get_fds(dst_hdl, dst_state, &dst_fd, src_hdl, src_state,
+			      &src_fd, has_lock, closefd);
+
+	if (FSAL_IS_ERROR(status))
+		return status;
+
+	if (count == 0) {
+		if (fstat(src_fd, &st) == -1) {
+			retval = errno;
+			status = fsalstat(posix2fsal_error(retval), retval);
+			goto out;
+		}
+		if ((uint64_t) st.st_size > src_offset)
+			count = st.st_size - src_offset;
+	}
+
+	if (count > SSIZE_MAX)
+		count = SSIZE_MAX;
+
+	fsal_set_credentials(op_ctx->creds);
+
+	nb_copied = syscall(__NR_copy_file_range, src_fd, &src_off,
+			    dst_fd, &dst_off, (size_t) count, 0);
+
+	if (nb_copied == -1) {
+		retval = errno;
+		if (retval == ENOSYS || retval == EXDEV ||
+		    retval == EOPNOTSUPP)
+			status = fsalstat(ERR_FSAL_NOTSUPP, retval);
+		else
+			status = fsalstat(posix2fsal_error(retval), retval);
+	} else {
+		*copied = nb_copied;
+	}
+
+	fsal_restore_ganesha_credentials();
+
+ out:
+
+	copy_put_fds(dst_hdl, dst_fd, src_hdl, src_fd, has_lock, closefd);
+	return status;
+#else
+	return fsalstat(ERR_FSAL_NOTSUPP, 0);
+#endif
+}
+
+/**
+ * @brief Clone a range of one file into another
+ *
+ * Uses FICLONERANGE, so only works where the file system can share
+ * extents between files (XFS with reflink, btrfs).
+ *
+ * @param[in]  dst_hdl     File to clone into
+ * @param[in]  dst_state   state_t for dst_hdl
+ * @param[in]  dst_offset  Position in dst_hdl to clone to
+ * @param[in]  src_hdl     File to clone from
+ * @param[in]  src_state   state_t for src_hdl
+ * @param[in]  src_offset  Position in src_hdl to clone from
+ * @param[in]  count       Amount to clone, 0 for to end of file
+ *
+ * @return FSAL status.
+ */
+
+fsal_status_t vfs_clone(struct fsal_obj_handle *dst_hdl,
+			struct state_t *dst_state,
+			uint64_t dst_offset,
+			struct fsal_obj_handle *src_hdl,
+			struct state_t *src_state,
+			uint64_t src_offset,
+			uint64_t count)
+{
+#ifdef FICLONERANGE
+	fsal_status_t status;
+	int dst_fd = -1, src_fd = -1;
+	bool has_lock[2] = {false, false};
+	bool closefd[2] = {false, false};
+	struct file_clone_range range;
+	int retval;
+
+	status = copy_get_fds(dst_hdl, dst_state, &dst_fd, src_hdl, src_state,
+			      &src_fd, has_lock, closefd);
+
+	if (FSAL_IS_ERROR(status))
+		return status;
+
+	range.src_fd = src_fd;
+	range.src_offset = src_offset;
+	range.src_length = count;
+	range.dest_offset = dst_offset;
+
+	fsal_set_credentials(op_ctx->creds);
+
+	if (ioctl(dst_fd, FICLONERANGE, &range) == -1) {
+		retval = errno;
+		if (retval == ENOTTY || retval == EXDEV)
+			status = fsalstat(ERR_FSAL_NOTSUPP, retval);
+		else
+			status = fsalstat(posix2fsal_error(retval), retval);
+	}
+
+	fsal_restore_ganesha_credentials();
+
+	copy_put_fds(dst_hdl, dst_fd, src_hdl, src_fd, has_lock, closefd);
+	return status;
+#else
+	return fsalstat(ERR_FSAL_NOTSUPP, 0);
+#endif
+}
+
+/**
+ * @brief fsync a file on behalf of a group of COMMITs
+ *
+ * Which fsync a caller can complete with only depends on when it
+ * arrived: the first one started after that.  So a caller finding an
+ * fsync running waits for it to end and then, unless another caller
+ * beat it to it, starts the next one, covering every COMMIT that
+ * arrived meanwhile.  Each caller's result is that of an fsync started
+ * after it arrived.
+ *
+ * @param[in] group  The file's commit group
+ * @param[in] fd     Descriptor to fsync if this caller runs it
+ *
+ * @return 0 or an errno.
+ */
+static int vfs_commit_grouped(struct vfs_commit_group *group, int fd)
+{
+	uint64_t need, round;
+	int retval;
+
+	PTHREAD_MUTEX_lock(&group->mtx);
+
+	need = group->started + 1;
+
+	while (group->done < need) {
+		if (group->in_flight) {
+			pthread_cond_wait(&group->cv, &group->mtx);
+			continue;
+		}
+
+		group->in_flight = true;
+		round = ++group->started;
+
+		PTHREAD_MUTEX_unlock(&group->mtx);
+
+		retval = fsync(fd);
+		if (retval == -1)
+			retval = errno;
+
+		PTHREAD_MUTEX_lock(&group->mtx);
+
+		group->done = round;
+		group->error = retval;
+		group->in_flight = false;
+		pthread_cond_broadcast(&group->cv);
+	}
+
+	retval = group->error;
+
+	PTHREAD_MUTEX_unlock(&group->mtx);
+
+	return retval;
+}
+
+/**
+ * @brief Commit written data
+ *
+ * This function flushes possibly buffered data to a file. This method
+ * differs from commit due to the need to interact with share reservations
+ * and the fact that the FSAL manages the state of "file descriptors". The
+ * FSAL must be able to perform this operation without being passed a specific
+ * state.
+ *
+ * @param[in] obj_hdl          File on which to operate
+ * @param[in] state            state_t to use for this operation
+ * @param[in] offset           Start of range to commit
+ * @param[in] len              Length of range to commit
+ *
+ * @return FSAL status.
+ */
+
+fsal_status_t vfs_commit2(struct fsal_obj_handle *obj_hdl,
+			  off_t offset,
+			  size_t len)
+{
+	struct vfs_fsal_obj_handle *myself;
+	fsal_status_t status;
+	int retval;
+	struct vfs_fd temp_fd = {0, -1}, *out_fd = &temp_fd;
+	bool has_lock = false;
+	bool closefd = false;
+
+	myself = container_of(obj_hdl, struct vfs_fsal_obj_handle, obj_handle);
+
+	/* Make sure file is open in appropriate mode.
+	 * Do not check share reservation.
+	 */
+	status = fsal_reopen_obj(obj_hdl, false, false, FSAL_O_WRITE,
+				 (struct fsal_fd *)&myself->u.file.fd,
+				 &myself->u.file.share,
+				 vfs_open_func, vfs_close_func,
+				 (struct fsal_fd **)&out_fd, &has_lock,
+				 &closefd);
+
+	if (!FSAL_IS_ERROR(status)) {
+
+		fsal_set_credentials(op_ctx->creds);
+
+		retval = vfs_commit_grouped(&myself->u.file.commit,
+					    out_fd->fd);
+
+		if (retval != 0)
+			status = fsalstat(posix2fsal_error(retval), retval);
+
+		fsal_restore_ganesha_credentials();
+	}
+
+	if (closefd)
+		close(out_fd->fd);
+
+	if (has_lock)
+		PTHREAD_RWLOCK_unlock(&obj_hdl->obj_lock);
+
+	return status;
+}
+
+#ifdef F_OFD_GETLK
+/**
+ * @brief Perform a lock operation
+ *
+ * This function performs a lock operation (lock, unlock, test) on a
+ * file. This method assumes the FSAL is able to support lock owners,
  * though it need not support asynchronous blocking locks. Passing the
  * lock state allows the FSAL to associate information with a specific
  * lock owner for each file (which may include use of a "file descriptor".
@@ -1395,6 +2473,131 @@ fsal_status_t vfs_lock_op2(struct fsal_obj_handle *obj_hdl,
 }
 #endif
 
+#ifdef HAVE_STATX
+/**
+ * Attributes that must be current.  A request for none of them can be
+ * answered from what a network file system has cached, without asking
+ * its server.
+ */
+#define VFS_ATTRS_SYNC (ATTR_SIZE | ATTR_SPACEUSED | ATTR_ATIME | \
+			ATTR_MTIME | ATTR_CTIME | ATTR_CHGTIME)
+
+static unsigned int vfs_statx_mask(attrmask_t request)
+{
+	unsigned int mask = STATX_TYPE | STATX_MODE;
+
+	if (request & ATTR_NUMLINKS)
+		mask |= STATX_NLINK;
+	if (request & ATTR_OWNER)
+		mask |= STATX_UID;
+	if (request & ATTR_GROUP)
+		mask |= STATX_GID;
+	if (request & ATTR_ATIME)
+		mask |= STATX_ATIME;
+	if (request & (ATTR_MTIME | ATTR_CHGTIME))
+		mask |= STATX_MTIME;
+	if (request & (ATTR_CTIME | ATTR_CHGTIME))
+		mask |= STATX_CTIME;
+	if (request & ATTR_FILEID)
+		mask |= STATX_INO;
+	if (request & ATTR_SIZE)
+		mask |= STATX_SIZE;
+	if (request & ATTR_SPACEUSED)
+		mask |= STATX_BLOCKS;
+#ifdef STATX_CHANGE_COOKIE
+	if (request & (ATTR_CHANGE | ATTR_CHGTIME))
+		mask |= STATX_CHANGE_COOKIE;
+#endif
+
+	return mask;
+}
+
+/**
+ * @brief Stat a file fetching only the attributes asked for
+ *
+ * The result is laid out as a struct stat for posix2fsal_attributes.
+ * File systems are free to return more than was asked for, and local
+ * ones usually do, so @a valid reports what was actually filled in.
+ *
+ * @param[in]  dirfd    As for statx
+ * @param[in]  path     As for statx
+ * @param[in]  flags    AT_* flags
+ * @param[in]  request  Attributes asked for
+ * @param[out] st       The file's attributes
+ * @param[out] valid    POSIX attributes present in @a st, plus
+ *                      ATTR_CHANGE_COUNTER if @a change was filled in
+ * @param[out] change   The inode's change cookie (i_version)
+ *
+ * @return 0, or -1 with errno set.
+ */
+static int vfs_statx(int dirfd, const char *path, int flags,
+		     attrmask_t request, struct stat *st, attrmask_t *valid,
+		     uint64_t *change)
+{
+	struct statx stx;
+	attrmask_t got = ATTR_FSID | ATTR_RAWDEV;
+
+	if ((request & VFS_ATTRS_SYNC) == 0)
+		flags |= AT_STATX_DONT_SYNC;
+
+	if (statx(dirfd, path, flags, vfs_statx_mask(request), &stx) < 0)
+		return -1;
+
+	memset(st, 0, sizeof(*st));
+	st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+	st->st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+	st->st_mode = stx.stx_mode;
+	st->st_nlink = stx.stx_nlink;
+	st->st_uid = stx.stx_uid;
+	st->st_gid = stx.stx_gid;
+	st->st_ino = stx.stx_ino;
+	st->st_size = stx.stx_size;
+	st->st_blocks = stx.stx_blocks;
+	st->st_atim.tv_sec = stx.stx_atime.tv_sec;
+	st->st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+	st->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+	st->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+
+	if (stx.stx_mask & STATX_TYPE)
+		got |= ATTR_TYPE;
+	if (stx.stx_mask & STATX_MODE)
+		got |= ATTR_MODE;
+	if (stx.stx_mask & STATX_NLINK)
+		got |= ATTR_NUMLINKS;
+	if (stx.stx_mask & STATX_UID)
+		got |= ATTR_OWNER;
+	if (stx.stx_mask & STATX_GID)
+		got |= ATTR_GROUP;
+	if (stx.stx_mask & STATX_INO)
+		got |= ATTR_FILEID;
+	if (stx.stx_mask & STATX_SIZE)
+		got |= ATTR_SIZE;
+	if (stx.stx_mask & STATX_BLOCKS)
+		got |= ATTR_SPACEUSED;
+	if (stx.stx_mask & STATX_ATIME)
+		got |= ATTR_ATIME;
+	if (stx.stx_mask & STATX_MTIME)
+		got |= ATTR_MTIME;
+	if (stx.stx_mask & STATX_CTIME)
+		got |= ATTR_CTIME;
+	if ((got & (ATTR_MTIME | ATTR_CTIME)) == (ATTR_MTIME | ATTR_CTIME))
+		got |= ATTR_CHGTIME;
+#ifdef STATX_CHANGE_COOKIE
+	/* Only file systems keeping an i_version return it */
+	if (stx.stx_mask & STATX_CHANGE_COOKIE) {
+		*change = stx.stx_change_attr;
+		got |= ATTR_CHANGE_COUNTER;
+	}
+#endif
+
+	*valid = got;
+
+	return 0;
+}
+#endif /* HAVE_STATX */
+
 fsal_status_t fetch_attrs(struct vfs_fsal_obj_handle *myself,
 			  int my_fd, struct attrlist *attrs)
 {
@@ -1402,7 +2605,36 @@ fsal_status_t fetch_attrs(struct vfs_fsal_obj_handle *myself,
 	int retval = 0;
 	fsal_status_t status = {0, 0};
 	const char *func = "unknown";
+	attrmask_t valid = ATTRS_POSIX;
+	uint64_t change = 0;
 
+#ifdef HAVE_STATX
+	const char *path = "";
+	int flags = AT_EMPTY_PATH;
+
+	/* Now stat the file, asking only for what is wanted */
+	switch (myself->obj_handle.type) {
+	case SOCKET_FILE:
+	case CHARACTER_FILE:
+	case BLOCK_FILE:
+		path = myself->u.unopenable.name;
+		flags = AT_SYMLINK_NOFOLLOW;
+		/* fall through */
+	case REGULAR_FILE:
+	case SYMBOLIC_LINK:
+	case FIFO_FILE:
+	case DIRECTORY:
+		retval = vfs_statx(my_fd, path, flags, attrs->request_mask,
+				   &stat, &valid, &change);
+		func = "statx";
+		break;
+
+	case NO_FILE_TYPE:
+	case EXTENDED_ATTR:
+		/* Caught during open with EINVAL */
+		break;
+	}
+#else
 	/* Now stat the file as appropriate */
 	switch (myself->obj_handle.type) {
 	case SOCKET_FILE:
@@ -1430,6 +2662,7 @@ fsal_status_t fetch_attrs(struct vfs_fsal_obj_handle *myself,
 		/* Caught during open with EINVAL */
 		break;
 	}
+#endif
 
 	if (retval < 0) {
 		if (errno == ENOENT)
@@ -1448,10 +2681,18 @@ fsal_status_t fetch_attrs(struct vfs_fsal_obj_handle *myself,
 		return fsalstat(posix2fsal_error(retval), retval);
 	}
 
-	posix2fsal_attributes_all(&stat, attrs);
+	attrs->valid_mask = (attrs->valid_mask &
+			     ~(ATTRS_POSIX | ATTR_CHANGE_COUNTER)) | valid;
+	posix2fsal_attributes(&stat, attrs);
 	attrs->fsid = myself->obj_handle.fs->fsid;
 
-	if (myself->sub_ops && myself->sub_ops->getattrs) {
+	/* Better than the change posix2fsal_attributes() made of the times */
+	if (valid & ATTR_CHANGE_COUNTER)
+		attrs->change = change;
+
+	/* Sub-FSALs only add the ACL, which is often not wanted */
+	if (myself->sub_ops && myself->sub_ops->getattrs &&
+	    (attrs->request_mask & ATTR_ACL) != 0) {
 		status =
 		   myself->sub_ops->getattrs(myself, my_fd, attrs->request_mask,
 					     attrs);
@@ -1499,6 +2740,24 @@ fsal_status_t vfs_getattr2(struct fsal_obj_handle *obj_hdl,
 		goto out;
 	}
 
+	/* The cached O_PATH descriptor is enough to stat, unless this is a
+	 * file whose global descriptor is already open or a sub-FSAL needs
+	 * a real descriptor to read the ACL.
+	 */
+	if ((obj_hdl->type == DIRECTORY || obj_hdl->type == SYMBOLIC_LINK ||
+	     (obj_hdl->type == REGULAR_FILE &&
+	      myself->u.file.fd.openflags == FSAL_O_CLOSED)) &&
+	    !((attrs->request_mask & ATTR_ACL) != 0 &&
+	      myself->sub_ops && myself->sub_ops->getattrs)) {
+		my_fd = vfs_path_fd_get(myself, &status.major);
+		if (my_fd >= 0) {
+			status = fetch_attrs(myself, my_fd, attrs);
+			vfs_path_fd_put(myself, my_fd);
+			return status;
+		}
+		/* Fall back, as for a symlink XFS will not open */
+	}
+
 	/* Get a usable file descriptor (don't need to bypass - FSAL_O_ANY
 	 * won't conflict with any share reservation).
 	 */
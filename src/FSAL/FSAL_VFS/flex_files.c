@@ -0,0 +1,645 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @file flex_files.c
+ * @brief pNFS flex files layouts for VFS exports of a cluster file system
+ *
+ * The data servers are other Ganesha servers exporting the same cluster
+ * file system with the same Export_Id, so the NFSv3 handle this server
+ * hands out for a file is good on every one of them.  Layouts are
+ * loosely coupled: the client does NFSv3 I/O to the data servers with
+ * the anonymous stateid, as the owner of the file.
+ *
+ * Each export has its own list of data servers, one device per server.
+ * A layout stripes the file, Stripe_Unit at a time, across
+ * FF_Stripe_Width of them, the first picked by fileid so that files
+ * spread over the servers.  As every server sees the same data,
+ * mirrors are only worth having for reading: a READ layout offers up
+ * to FF_Read_Mirrors distinct sets of servers for the client to read
+ * from, a RW layout a single one.  A server a client reported an
+ * error against, through LAYOUTERROR or a LAYOUTRETURN error report,
+ * is left out of new layouts for FF_Retry_Delay seconds.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "fsal.h"
+#include "gsh_config.h"
+#include "pnfs_utils.h"
+#include "nfs_file_handle.h"
+#include "nfs_convert.h"
+#include "abstract_atomic.h"
+#include "vfs_methods.h"
+
+struct fsal_staticfsinfo_t *vfs_staticinfo(struct fsal_module *hdl);
+
+/** Efficiency we give every data server, they are all alike */
+#define VFS_FF_EFFICIENCY 100
+
+/**
+ * @brief One data server
+ */
+struct vfs_ff_ds {
+	fsal_multipath_member_t host;
+	uint64_t down_until;	/*< Left out of new layouts until then */
+};
+
+/**
+ * @brief The data servers of one export
+ */
+struct vfs_ff_servers {
+	struct glist_head link;		/*< On vfs_ff_exports */
+	uint16_t export_id;		/*< Export, and device_id2 */
+	uint32_t retry_delay;		/*< FF_Retry_Delay of the export */
+	uint32_t count;
+	struct vfs_ff_ds ds[];
+};
+
+/* Exports handing out layouts, for getdeviceinfo and device_error */
+static pthread_mutex_t vfs_ff_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct glist_head vfs_ff_exports = GLIST_HEAD_INIT(vfs_ff_exports);
+
+/**
+ * @brief Find the data servers of an export
+ *
+ * @note Called with vfs_ff_mtx held.
+ */
+
+static struct vfs_ff_servers *vfs_ff_lookup(uint16_t export_id)
+{
+	struct glist_head *node;
+	struct vfs_ff_servers *servers;
+
+	glist_for_each(node, &vfs_ff_exports) {
+		servers = glist_entry(node, struct vfs_ff_servers, link);
+		if (servers->export_id == export_id)
+			return servers;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Parse the FF_Data_Servers option
+ *
+ * @param[in] list "address[:port]" entries separated by commas
+ *
+ * @return The data servers, NULL if the list is empty or bad.
+ */
+
+static struct vfs_ff_servers *vfs_ff_parse(const char *list)
+{
+	struct vfs_ff_servers *servers;
+	char *copy, *tok, *save = NULL, *port, *end;
+	struct in_addr in;
+	unsigned long port_num;
+	uint32_t count = 1;
+	const char *c;
+
+	for (c = list; *c != '\0'; c++)
+		if (*c == ',')
+			count++;
+
+	servers = gsh_calloc(1, sizeof(*servers) +
+				count * sizeof(struct vfs_ff_ds));
+	copy = gsh_strdup(list);
+
+	for (tok = strtok_r(copy, ", ", &save); tok != NULL;
+	     tok = strtok_r(NULL, ", ", &save)) {
+		port_num = NFS_PORT;
+		port = strchr(tok, ':');
+		if (port != NULL) {
+			*port++ = '\0';
+			port_num = strtoul(port, &end, 10);
+			if (*end != '\0' || port_num == 0 ||
+			    port_num > UINT16_MAX)
+				goto bad;
+		}
+
+		if (inet_pton(AF_INET, tok, &in) != 1)
+			goto bad;
+
+		servers->ds[servers->count].host.proto = IPPROTO_TCP;
+		servers->ds[servers->count].host.addr = ntohl(in.s_addr);
+		servers->ds[servers->count].host.port = port_num;
+		servers->count++;
+	}
+
+	gsh_free(copy);
+
+	if (servers->count == 0) {
+		gsh_free(servers);
+		return NULL;
+	}
+
+	return servers;
+
+bad:
+	LogCrit(COMPONENT_PNFS,
+		"Bad data server \"%s\" in FF_Data_Servers", tok);
+	gsh_free(copy);
+	gsh_free(servers);
+	return NULL;
+}
+
+/**
+ * @brief Set up flex files layouts for an export
+ *
+ * @param[in] myself The export
+ *
+ * @return 0 or an errno.
+ */
+
+int vfs_ff_init_export(struct vfs_fsal_export *myself)
+{
+	struct vfs_ff_servers *servers;
+
+	if (myself->ff_data_servers == NULL ||
+	    (servers = vfs_ff_parse(myself->ff_data_servers)) == NULL) {
+		LogCrit(COMPONENT_PNFS,
+			"pNFS flex files needs FF_Data_Servers for [%s]",
+			op_ctx->ctx_export->fullpath);
+		return EINVAL;
+	}
+
+	if (!nfs_param.nfsv4_param.pnfs_mds)
+		LogWarn(COMPONENT_PNFS,
+			"pNFS flex files enabled for [%s] but PNFS_MDS is not set, no client will ask for a layout",
+			op_ctx->ctx_export->fullpath);
+
+	servers->export_id = op_ctx->ctx_export->export_id;
+	servers->retry_delay = myself->ff_retry_delay;
+
+	PTHREAD_MUTEX_lock(&vfs_ff_mtx);
+	if (vfs_ff_lookup(servers->export_id) != NULL) {
+		PTHREAD_MUTEX_unlock(&vfs_ff_mtx);
+		gsh_free(servers);
+		return EEXIST;
+	}
+	glist_add_tail(&vfs_ff_exports, &servers->link);
+	PTHREAD_MUTEX_unlock(&vfs_ff_mtx);
+
+	myself->ff = servers;
+
+	LogInfo(COMPONENT_PNFS,
+		"pNFS flex files enabled for [%s] with %" PRIu32
+		" data servers", op_ctx->ctx_export->fullpath, servers->count);
+
+	return 0;
+}
+
+/**
+ * @brief Tear down flex files layouts for an export
+ *
+ * @param[in] myself The export
+ */
+
+void vfs_ff_fini_export(struct vfs_fsal_export *myself)
+{
+	if (myself->ff != NULL) {
+		PTHREAD_MUTEX_lock(&vfs_ff_mtx);
+		glist_del(&myself->ff->link);
+		PTHREAD_MUTEX_unlock(&vfs_ff_mtx);
+
+		gsh_free(myself->ff);
+		myself->ff = NULL;
+	}
+
+	gsh_free(myself->ff_data_servers);
+	myself->ff_data_servers = NULL;
+}
+
+/**
+ * @brief Leave a data server out of new layouts for a while
+ *
+ * Errors against one file, such as permission errors, are no reason
+ * to stop using the server.
+ *
+ * @param[in] ds     The data server
+ * @param[in] delay  Seconds to leave it out
+ * @param[in] status The error a client got from it
+ */
+
+static void vfs_ff_ds_failed(struct vfs_ff_ds *ds, uint32_t delay,
+			     nfsstat4 status)
+{
+	switch (status) {
+	case NFS4_OK:
+	case NFS4ERR_ACCESS:
+	case NFS4ERR_PERM:
+	case NFS4ERR_NOSPC:
+	case NFS4ERR_DQUOT:
+	case NFS4ERR_FBIG:
+		return;
+	default:
+		break;
+	}
+
+	LogEvent(COMPONENT_PNFS,
+		 "Data server %08" PRIx32 ":%" PRIu16
+		 " left out of layouts for %" PRIu32 "s after error %d",
+		 ds->host.addr, ds->host.port, delay, status);
+
+	atomic_store_uint64_t(&ds->down_until, time(NULL) + delay);
+}
+
+/**
+ * @brief Note an error a client got from one of our devices
+ */
+
+static void vfs_ff_device_error(struct fsal_module *fsal_hdl,
+				const struct pnfs_deviceid *deviceid,
+				nfsstat4 status, nfs_opnum4 opnum)
+{
+	struct vfs_ff_servers *servers;
+
+	PTHREAD_MUTEX_lock(&vfs_ff_mtx);
+
+	servers = vfs_ff_lookup(deviceid->device_id2);
+	if (servers != NULL && deviceid->devid < servers->count)
+		vfs_ff_ds_failed(&servers->ds[deviceid->devid],
+				 servers->retry_delay,
+				 status);
+
+	PTHREAD_MUTEX_unlock(&vfs_ff_mtx);
+}
+
+/**
+ * @brief Describe a data server
+ *
+ * @param[in]  fsal_hdl     FSAL module
+ * @param[out] da_addr_body Stream we write the result to
+ * @param[in]  type         Type of layout that gave the device
+ * @param[in]  deviceid     The device to look up
+ *
+ * @return Valid error codes in RFC 5661, p. 365.
+ */
+
+static nfsstat4 vfs_ff_getdeviceinfo(struct fsal_module *fsal_hdl,
+				     XDR *da_addr_body,
+				     const layouttype4 type,
+				     const struct pnfs_deviceid *deviceid)
+{
+	struct fsal_staticfsinfo_t *info = vfs_staticinfo(fsal_hdl);
+	struct vfs_ff_servers *servers;
+	fsal_multipath_member_t host;
+
+	if (type != LAYOUT4_FLEX_FILES) {
+		LogCrit(COMPONENT_PNFS, "Unsupported layout type: %x", type);
+		return NFS4ERR_UNKNOWN_LAYOUTTYPE;
+	}
+
+	PTHREAD_MUTEX_lock(&vfs_ff_mtx);
+
+	servers = vfs_ff_lookup(deviceid->device_id2);
+	if (servers == NULL || deviceid->devid >= servers->count) {
+		PTHREAD_MUTEX_unlock(&vfs_ff_mtx);
+		return NFS4ERR_NOENT;
+	}
+	host = servers->ds[deviceid->devid].host;
+
+	PTHREAD_MUTEX_unlock(&vfs_ff_mtx);
+
+	return FSAL_encode_flex_file_devaddr(da_addr_body, 1, &host,
+					     NFS_V3, 0,
+					     MIN(info->maxread, UINT32_MAX),
+					     MIN(info->maxwrite, UINT32_MAX));
+}
+
+/**
+ * @brief Size of the buffer needed for a ds_addr
+ *
+ * One address and one version.
+ */
+
+static size_t vfs_ff_da_addr_size(struct fsal_module *fsal_hdl)
+{
+	return 0x100;
+}
+
+/**
+ * @brief Get layout types supported by export
+ */
+
+static void vfs_ff_layouttypes(struct fsal_export *exp_hdl, int32_t *count,
+			       const layouttype4 **types)
+{
+	static const layouttype4 supported_layout_type = LAYOUT4_FLEX_FILES;
+
+	*types = &supported_layout_type;
+	*count = 1;
+}
+
+/**
+ * @brief Get layout block size for export
+ *
+ * @return The stripe unit.
+ */
+
+static uint32_t vfs_ff_layout_blocksize(struct fsal_export *exp_hdl)
+{
+	struct vfs_fsal_export *myself = EXPORT_VFS_FROM_FSAL(exp_hdl);
+
+	return myself->ff_stripe_unit;
+}
+
+/**
+ * @brief Maximum number of segments we will use
+ *
+ * We always grant the whole file in one segment.
+ */
+
+static uint32_t vfs_ff_maximum_segments(struct fsal_export *exp_hdl)
+{
+	return 1;
+}
+
+/**
+ * @brief Size of the buffer needed for a loc_body
+ *
+ * Each data server takes a deviceid, an efficiency, a stateid, a file
+ * handle and two short owner strings.
+ */
+
+static size_t vfs_ff_loc_body_size(struct fsal_export *exp_hdl)
+{
+	struct vfs_fsal_export *myself = EXPORT_VFS_FROM_FSAL(exp_hdl);
+	size_t per_ds = NFS4_DEVICEID4_SIZE + 4 + sizeof(stateid4) +
+			8 + NFS3_FHSIZE + 2 * (4 + 12);
+	uint32_t count = myself->ff != NULL ? myself->ff->count : 1;
+
+	return 12 + myself->ff_read_mirrors * (4 + count * per_ds);
+}
+
+/**
+ * @brief Get list of available devices
+ *
+ * We do not support listing devices and just set EOF without doing
+ * anything.
+ */
+
+static nfsstat4 vfs_ff_getdevicelist(struct fsal_export *exp_hdl,
+				     layouttype4 type, void *opaque,
+				     bool (*cb)(void *opaque,
+						const uint64_t id),
+				     struct fsal_getdevicelist_res *res)
+{
+	res->eof = true;
+	return NFS4_OK;
+}
+
+/**
+ * @brief Grant a layout segment
+ *
+ * We grant the whole file, whatever was asked for, in one segment.
+ *
+ * @param[in]     obj_hdl  The file
+ * @param[in]     req_ctx  Request context
+ * @param[out]    loc_body Stream the flex files layout goes to
+ * @param[in]     arg      Input arguments of the function
+ * @param[in,out] res      In/out and output arguments of the function
+ *
+ * @return Valid error codes in RFC 5661, pp. 366-7.
+ */
+
+static nfsstat4 vfs_ff_layoutget(struct fsal_obj_handle *obj_hdl,
+				 struct req_op_context *req_ctx,
+				 XDR *loc_body,
+				 const struct fsal_layoutget_arg *arg,
+				 struct fsal_layoutget_res *res)
+{
+	struct vfs_fsal_export *myself =
+		EXPORT_VFS_FROM_FSAL(op_ctx->fsal_export);
+	struct vfs_ff_servers *servers = myself->ff;
+	fsal_ff_data_server_t *dss;
+	uint32_t *up, n_up = 0, width, mirrors, start, i, j;
+	uint64_t now = time(NULL);
+	char fh_buf[NFS3_FHSIZE];
+	nfs_fh3 fh3 = { .data.data_val = fh_buf };
+	struct attrlist attrs;
+	fsal_status_t status;
+	nfsstat4 nfs_status;
+
+	if (arg->type != LAYOUT4_FLEX_FILES) {
+		LogCrit(COMPONENT_PNFS, "Unsupported layout type: %x",
+			arg->type);
+		return NFS4ERR_UNKNOWN_LAYOUTTYPE;
+	}
+
+	if (obj_hdl->type != REGULAR_FILE)
+		return NFS4ERR_BADIOMODE;
+
+	/* The data servers in service */
+	up = alloca(servers->count * sizeof(*up));
+	for (i = 0; i < servers->count; i++)
+		if (atomic_fetch_uint64_t(&servers->ds[i].down_until) <= now)
+			up[n_up++] = i;
+
+	if (n_up == 0) {
+		LogDebug(COMPONENT_PNFS,
+			 "No data server in service, I/O through the MDS");
+		return NFS4ERR_LAYOUTUNAVAILABLE;
+	}
+
+	width = myself->ff_stripe_width;
+	if (width == 0 || width > n_up)
+		width = n_up;
+
+	mirrors = 1;
+	if (res->segment.io_mode == LAYOUTIOMODE4_READ)
+		mirrors = MAX(MIN(myself->ff_read_mirrors, n_up / width), 1);
+
+	/* The handle the data servers know the file by, and its owner */
+	if (!nfs3_FSALToFhandle(false, &fh3, obj_hdl, req_ctx->ctx_export))
+		return NFS4ERR_LAYOUTUNAVAILABLE;
+
+	fsal_prepare_attrs(&attrs, ATTR_OWNER | ATTR_GROUP);
+	status = obj_hdl->obj_ops.getattrs(obj_hdl, &attrs);
+	if (FSAL_IS_ERROR(status)) {
+		fsal_release_attrs(&attrs);
+		return nfs4_Errno_status(status);
+	}
+
+	dss = alloca(mirrors * width * sizeof(*dss));
+	start = obj_hdl->fileid % n_up;
+
+	for (i = 0; i < mirrors; i++) {
+		for (j = 0; j < width; j++) {
+			fsal_ff_data_server_t *ds = &dss[i * width + j];
+			struct pnfs_deviceid deviceid =
+					DEVICE_ID_INIT_ZERO(FSAL_ID_VFS);
+
+			deviceid.device_id2 = servers->export_id;
+			deviceid.devid = up[(start + i * width + j) % n_up];
+
+			ds->deviceid = deviceid;
+			ds->efficiency = VFS_FF_EFFICIENCY;
+			ds->fh.addr = fh3.data.data_val;
+			ds->fh.len = fh3.data.data_len;
+			ds->uid = attrs.owner;
+			ds->gid = attrs.group;
+		}
+	}
+
+	fsal_release_attrs(&attrs);
+
+	nfs_status = FSAL_encode_flex_file_layout(loc_body,
+						  myself->ff_stripe_unit,
+						  mirrors, width, dss);
+	if (nfs_status != NFS4_OK) {
+		if (arg->maxcount <=
+		    op_ctx->fsal_export->exp_ops.fs_loc_body_size(
+						op_ctx->fsal_export))
+			nfs_status = NFS4ERR_TOOSMALL;
+		LogDebug(COMPONENT_PNFS,
+			 "Failed to encode ff_layout4.");
+		return nfs_status;
+	}
+
+	/* We want it back when the file is closed, with its reports */
+	res->return_on_close = true;
+	res->last_segment = true;
+	res->segment.offset = 0;
+	res->segment.length = NFS4_UINT64_MAX;
+
+	return NFS4_OK;
+}
+
+/**
+ * @brief Return a layout segment
+ *
+ * We hold nothing for a layout; just take note of the I/O errors the
+ * client reports against our data servers.
+ *
+ * @param[in] obj_hdl  The file
+ * @param[in] req_ctx  Request context
+ * @param[in] lrf_body ff_layoutreturn4, if the client sent one
+ * @param[in] arg      Input arguments of the function
+ *
+ * @return Valid error codes in RFC 5661, p. 367.
+ */
+
+static nfsstat4 vfs_ff_layoutreturn(struct fsal_obj_handle *obj_hdl,
+				    struct req_op_context *req_ctx,
+				    XDR *lrf_body,
+				    const struct fsal_layoutreturn_arg *arg)
+{
+	ff_layoutreturn4 lr;
+	ff_ioerr4 *ioerr;
+	device_error4 *error;
+	u_int i, j;
+
+	if (arg->lo_type != LAYOUT4_FLEX_FILES) {
+		LogCrit(COMPONENT_PNFS, "Unsupported layout type: %x",
+			arg->lo_type);
+		return NFS4ERR_UNKNOWN_LAYOUTTYPE;
+	}
+
+	if (lrf_body == NULL)
+		return NFS4_OK;
+
+	memset(&lr, 0, sizeof(lr));
+	if (!xdr_ff_layoutreturn4(lrf_body, &lr)) {
+		LogDebug(COMPONENT_PNFS, "Could not decode ff_layoutreturn4");
+		xdr_free((xdrproc_t) xdr_ff_layoutreturn4, &lr);
+		return NFS4_OK;
+	}
+
+	for (i = 0; i < lr.fflr_ioerr_report.fflr_ioerr_report_len; i++) {
+		ioerr = &lr.fflr_ioerr_report.fflr_ioerr_report_val[i];
+		for (j = 0; j < ioerr->ffie_errors.ffie_errors_len; j++) {
+			error = &ioerr->ffie_errors.ffie_errors_val[j];
+			vfs_ff_device_error(obj_hdl->fsal,
+				(struct pnfs_deviceid *) error->de_deviceid,
+				error->de_status, error->de_opnum);
+		}
+	}
+
+	xdr_free((xdrproc_t) xdr_ff_layoutreturn4, &lr);
+
+	return NFS4_OK;
+}
+
+/**
+ * @brief Commit a segment of a layout
+ *
+ * The data servers wrote to the shared file system, which already has
+ * the size and times right; there is nothing to update.
+ *
+ * @return Valid error codes in RFC 5661, p. 366.
+ */
+
+static nfsstat4 vfs_ff_layoutcommit(struct fsal_obj_handle *obj_hdl,
+				    struct req_op_context *req_ctx,
+				    XDR *lou_body,
+				    const struct fsal_layoutcommit_arg *arg,
+				    struct fsal_layoutcommit_res *res)
+{
+	if (arg->type != LAYOUT4_FLEX_FILES) {
+		LogCrit(COMPONENT_PNFS, "Unsupported layout type: %x",
+			arg->type);
+		return NFS4ERR_UNKNOWN_LAYOUTTYPE;
+	}
+
+	res->size_supplied = false;
+	res->commit_done = true;
+
+	return NFS4_OK;
+}
+
+/**
+ * @brief Set the export ops for flex files layouts
+ */
+
+void vfs_ff_export_ops(struct export_ops *ops)
+{
+	ops->getdevicelist = vfs_ff_getdevicelist;
+	ops->fs_layouttypes = vfs_ff_layouttypes;
+	ops->fs_layout_blocksize = vfs_ff_layout_blocksize;
+	ops->fs_maximum_segments = vfs_ff_maximum_segments;
+	ops->fs_loc_body_size = vfs_ff_loc_body_size;
+}
+
+/**
+ * @brief Set the handle ops for flex files layouts
+ */
+
+void vfs_ff_handle_ops(struct fsal_obj_ops *ops)
+{
+	ops->layoutget = vfs_ff_layoutget;
+	ops->layoutreturn = vfs_ff_layoutreturn;
+	ops->layoutcommit = vfs_ff_layoutcommit;
+}
+
+/**
+ * @brief Set the module ops for flex files devices
+ */
+
+void vfs_ff_fsal_ops(struct fsal_ops *ops)
+{
+	ops->getdeviceinfo = vfs_ff_getdeviceinfo;
+	ops->fs_da_addr_size = vfs_ff_da_addr_size;
+	ops->device_error = vfs_ff_device_error;
+}
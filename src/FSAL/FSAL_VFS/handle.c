@@ -50,6 +50,9 @@
 #include "city.h"
 #include "nfs_core.h"
 #include "nfs_proto_tools.h"
+#ifdef USE_LTTNG
+#include "gsh_lttng/fsal.h"
+#endif
 
 /* helpers
  */
@@ -63,6 +66,160 @@ int vfs_fsal_open(struct vfs_fsal_obj_handle *hdl,
 	return vfs_open_by_handle(vfs_fs, hdl->handle, openflags, fsal_error);
 }
 
+/**
+ * @brief O_PATH descriptors kept open on handles
+ *
+ * Lookups, creates, renames and most GETATTRs only need a descriptor to
+ * name the object in an fstat or *at() call, and opening one by handle
+ * and closing it costs two syscalls per operation.  Handles keep the
+ * O_PATH descriptor they opened instead, up to VFS_PATH_FD_MAX of them
+ * in LRU order.  They count in open_fd_count, so the MDCACHE fd LRU
+ * sees them, and closing a file's global descriptor (which is what that
+ * LRU does) closes its O_PATH descriptor too.
+ *
+ * A descriptor in use is never closed behind its user; one that cannot
+ * be cached because every cached one is busy is closed by
+ * vfs_path_fd_put() as before.
+ */
+static struct {
+	pthread_mutex_t mtx;
+	struct glist_head q;	/*< LRU is at HEAD, MRU at tail */
+	uint32_t count;
+} vfs_path_lru = {
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+	.q = GLIST_HEAD_INIT(vfs_path_lru.q),
+};
+
+/* Must hold vfs_path_lru.mtx, the handle's descriptor not in use */
+static int vfs_path_fd_unlink(struct vfs_fsal_obj_handle *hdl)
+{
+	int fd = hdl->path.fd;
+
+	glist_del(&hdl->path.lru);
+	hdl->path.fd = -1;
+	--vfs_path_lru.count;
+	return fd;
+}
+
+static void vfs_path_fd_close(int fd)
+{
+	close(fd);
+	(void) atomic_dec_size_t(&open_fd_count);
+}
+
+/**
+ * @brief Get an O_PATH descriptor for a handle
+ *
+ * @param[in]  hdl        The handle
+ * @param[out] fsal_error Error, if any
+ *
+ * @return The descriptor, to be given back with vfs_path_fd_put(), or
+ *         -errno as vfs_fsal_open().
+ */
+int vfs_path_fd_get(struct vfs_fsal_obj_handle *hdl,
+		    fsal_errors_t *fsal_error)
+{
+	struct vfs_fsal_obj_handle *victim;
+	struct glist_head *glist, *glistn;
+	int fd, evicted[8];
+	int i, n = 0;
+
+	PTHREAD_MUTEX_lock(&vfs_path_lru.mtx);
+	if (hdl->path.fd >= 0) {
+		hdl->path.users++;
+		glist_del(&hdl->path.lru);
+		glist_add_tail(&vfs_path_lru.q, &hdl->path.lru);
+		fd = hdl->path.fd;
+		PTHREAD_MUTEX_unlock(&vfs_path_lru.mtx);
+		return fd;
+	}
+	PTHREAD_MUTEX_unlock(&vfs_path_lru.mtx);
+
+	fd = vfs_fsal_open(hdl, O_PATH | O_NOACCESS, fsal_error);
+	if (fd < 0)
+		return fd;
+
+	PTHREAD_MUTEX_lock(&vfs_path_lru.mtx);
+
+	if (hdl->path.fd >= 0) {
+		/* Lost a race, use the one already there */
+		hdl->path.users++;
+		i = hdl->path.fd;
+		PTHREAD_MUTEX_unlock(&vfs_path_lru.mtx);
+		close(fd);
+		return i;
+	}
+
+	/* Make room from the LRU end, skipping descriptors in use */
+	glist_for_each_safe(glist, glistn, &vfs_path_lru.q) {
+		if (vfs_path_lru.count < VFS_PATH_FD_MAX ||
+		    n == sizeof(evicted) / sizeof(evicted[0]))
+			break;
+		victim = glist_entry(glist, struct vfs_fsal_obj_handle,
+				     path.lru);
+		if (victim->path.users == 0)
+			evicted[n++] = vfs_path_fd_unlink(victim);
+	}
+
+	if (vfs_path_lru.count < VFS_PATH_FD_MAX) {
+		hdl->path.fd = fd;
+		hdl->path.users = 1;
+		glist_add_tail(&vfs_path_lru.q, &hdl->path.lru);
+		++vfs_path_lru.count;
+		(void) atomic_inc_size_t(&open_fd_count);
+	}
+
+	PTHREAD_MUTEX_unlock(&vfs_path_lru.mtx);
+
+	for (i = 0; i < n; i++)
+		vfs_path_fd_close(evicted[i]);
+
+	return fd;
+}
+
+/**
+ * @brief Give back a descriptor from vfs_path_fd_get()
+ *
+ * @param[in] hdl The handle
+ * @param[in] fd  The descriptor
+ */
+void vfs_path_fd_put(struct vfs_fsal_obj_handle *hdl, int fd)
+{
+	if (fd < 0)
+		return;
+
+	PTHREAD_MUTEX_lock(&vfs_path_lru.mtx);
+	if (fd == hdl->path.fd) {
+		hdl->path.users--;
+		fd = -1;
+	}
+	PTHREAD_MUTEX_unlock(&vfs_path_lru.mtx);
+
+	if (fd >= 0)
+		close(fd);
+}
+
+/**
+ * @brief Close a handle's cached O_PATH descriptor if it is not in use
+ *
+ * @param[in] hdl The handle
+ */
+void vfs_path_fd_drop(struct vfs_fsal_obj_handle *hdl)
+{
+	int fd = -1;
+
+	if (hdl->path.fd < 0)
+		return;
+
+	PTHREAD_MUTEX_lock(&vfs_path_lru.mtx);
+	if (hdl->path.fd >= 0 && hdl->path.users == 0)
+		fd = vfs_path_fd_unlink(hdl);
+	PTHREAD_MUTEX_unlock(&vfs_path_lru.mtx);
+
+	if (fd >= 0)
+		vfs_path_fd_close(fd);
+}
+
 /**
  * @brief Create a VFS OBJ handle
  *
@@ -90,6 +247,7 @@ struct vfs_fsal_obj_handle *alloc_handle(int dirfd,
 	hdl = vfs_sub_alloc_handle();
 
 	memcpy(hdl->handle, fh, sizeof(vfs_file_handle_t));
+	hdl->path.fd = -1;
 	hdl->obj_handle.type = posix2fsal_type(stat->st_mode);
 	hdl->dev = posix2fsal_devt(stat->st_dev);
 	hdl->up_ops = exp_hdl->up_ops;
@@ -98,6 +256,9 @@ struct vfs_fsal_obj_handle *alloc_handle(int dirfd,
 	if (hdl->obj_handle.type == REGULAR_FILE) {
 		hdl->u.file.fd.fd = -1;	/* no open on this yet */
 		hdl->u.file.fd.openflags = FSAL_O_CLOSED;
+		PTHREAD_RWLOCK_init(&hdl->u.file.direct_lock, NULL);
+		PTHREAD_MUTEX_init(&hdl->u.file.commit.mtx, NULL);
+		PTHREAD_COND_init(&hdl->u.file.commit.cv, NULL);
 	} else if (hdl->obj_handle.type == DIRECTORY) {
 		hdl->u.directory.path = NULL;
 		hdl->u.directory.fs_location = NULL;
@@ -162,6 +323,7 @@ struct vfs_fsal_obj_handle *alloc_handle(int dirfd,
 
 static fsal_status_t lookup_with_fd(struct vfs_fsal_obj_handle *parent_hdl,
 				    int dirfd, const char *path,
+				    const struct vfs_bulk_entry *bulk,
 				    struct fsal_obj_handle **handle,
 				    struct attrlist *attrs_out)
 {
@@ -177,7 +339,14 @@ static fsal_status_t lookup_with_fd(struct vfs_fsal_obj_handle *parent_hdl,
 
 	vfs_alloc_handle(fh);
 
-	retval = fstatat(dirfd, path, &stat, AT_SYMLINK_NOFOLLOW);
+	/* An entry looked up in bulk comes with its attributes and handle */
+	if (bulk != NULL) {
+		stat = bulk->stat;
+		*fh = bulk->fh;
+		retval = 0;
+	} else {
+		retval = fstatat(dirfd, path, &stat, AT_SYMLINK_NOFOLLOW);
+	}
 
 	if (retval < 0) {
 		retval = errno;
@@ -218,7 +387,8 @@ static fsal_status_t lookup_with_fd(struct vfs_fsal_obj_handle *parent_hdl,
 		}
 	}
 
-	if (xfsal || vfs_name_to_handle(dirfd, fs, path, fh) < 0) {
+	if (bulk == NULL &&
+	    (xfsal || vfs_name_to_handle(dirfd, fs, path, fh) < 0)) {
 		retval = errno;
 		if (((retval == ENOTTY) ||
 		     (retval == EOPNOTSUPP) ||
@@ -416,7 +586,7 @@ static fsal_status_t lookup(struct fsal_obj_handle *parent,
 		return fsalstat(ERR_FSAL_XDEV, EXDEV);
 	}
 
-	dirfd = vfs_fsal_open(parent_hdl, O_PATH | O_NOACCESS, &fsal_error);
+	dirfd = vfs_path_fd_get(parent_hdl, &fsal_error);
 
 	if (dirfd < 0) {
 		LogDebug(COMPONENT_FSAL, "Failed to open parent: %s",
@@ -425,10 +595,19 @@ static fsal_status_t lookup(struct fsal_obj_handle *parent,
 		return status;
 	}
 
-	status = lookup_with_fd(parent_hdl, dirfd, path, handle, attrs_out);
+#ifdef USE_LTTNG
+	tracepoint(fsal, lookup_start, parent->fsal->name, parent, path);
+#endif
 
+	status = lookup_with_fd(parent_hdl, dirfd, path, NULL, handle,
+				attrs_out);
 
-	close(dirfd);
+#ifdef USE_LTTNG
+	tracepoint(fsal, lookup_end, parent, *handle, status.major,
+		   status.minor);
+#endif
+
+	vfs_path_fd_put(parent_hdl, dirfd);
 	return status;
 }
 
@@ -443,7 +622,6 @@ static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 	mode_t unix_mode;
 	fsal_status_t status = {0, 0};
 	int retval = 0;
-	int flags = O_PATH | O_NOACCESS;
 #ifdef ENABLE_VFS_DEBUG_ACL
 	struct attrlist attrs;
 	fsal_accessflags_t access_type;
@@ -501,7 +679,7 @@ static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 
 	unix_mode = fsal2unix_mode(attrib->mode)
 	    & ~op_ctx->fsal_export->exp_ops.fs_umask(op_ctx->fsal_export);
-	dir_fd = vfs_fsal_open(myself, flags, &status.major);
+	dir_fd = vfs_path_fd_get(myself, &status.major);
 	if (dir_fd < 0) {
 		LogFullDebug(COMPONENT_FSAL,
 			     "vfs_fsal_open returned %s",
@@ -602,14 +780,14 @@ static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 		}
 	}
 
-	close(dir_fd);
+	vfs_path_fd_put(myself, dir_fd);
 
 	return status;
 
  fileerr:
 	unlinkat(dir_fd, name, 0);
  direrr:
-	close(dir_fd);
+	vfs_path_fd_put(myself, dir_fd);
  hdlerr:
 	status.major = posix2fsal_error(retval);
 	return fsalstat(status.major, retval);
@@ -629,7 +807,6 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 	fsal_status_t status = {0, 0};
 	int retval = 0;
 	dev_t unix_dev = 0;
-	int flags = O_PATH | O_NOACCESS;
 #ifdef ENABLE_VFS_DEBUG_ACL
 	struct attrlist attrs;
 	fsal_accessflags_t access_type;
@@ -714,7 +891,7 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 		goto errout;
 	}
 
-	dir_fd = vfs_fsal_open(myself, flags, &status.major);
+	dir_fd = vfs_path_fd_get(myself, &status.major);
 
 	if (dir_fd < 0)
 		goto errout;
@@ -806,7 +983,7 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 		}
 	}
 
-	close(dir_fd);
+	vfs_path_fd_put(myself, dir_fd);
 
 	return status;
 
@@ -815,7 +992,7 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 	unlinkat(dir_fd, name, 0);
 
  direrr:
-	close(dir_fd);		/* done with parent */
+	vfs_path_fd_put(myself, dir_fd);	/* done with parent */
 
  hdlerr:
 	status.major = posix2fsal_error(retval);
@@ -840,7 +1017,6 @@ static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 	struct stat stat;
 	fsal_status_t status = {0, 0};
 	int retval = 0;
-	int flags = O_PATH | O_NOACCESS;
 #ifdef ENABLE_VFS_DEBUG_ACL
 	struct attrlist attrs;
 	fsal_accessflags_t access_type;
@@ -895,14 +1071,11 @@ static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 		return status;
 #endif /* ENABLE_VFS_DEBUG_ACL */
 
-	dir_fd = vfs_fsal_open(myself, flags, &status.major);
+	dir_fd = vfs_path_fd_get(myself, &status.major);
 
 	if (dir_fd < 0)
 		return fsalstat(status.major, -dir_fd);
 
-	flags |= O_NOFOLLOW;	/* BSD needs O_NOFOLLOW for
-				 * fhopen() of symlinks */
-
 	retval = vfs_stat_by_handle(dir_fd, &stat);
 
 	if (retval < 0) {
@@ -992,7 +1165,7 @@ static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 		}
 	}
 
-	close(dir_fd);
+	vfs_path_fd_put(myself, dir_fd);
 
 	return status;
 
@@ -1000,7 +1173,7 @@ static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 	unlinkat(dir_fd, name, 0);
 
  direrr:
-	close(dir_fd);
+	vfs_path_fd_put(myself, dir_fd);
  hdlerr:
 	if (retval == ENOENT)
 		status.major = ERR_FSAL_STALE;
@@ -1156,6 +1329,8 @@ static fsal_status_t linkfile(struct fsal_obj_handle *obj_hdl,
 }
 
 #define BUF_SIZE 1024
+/** Entries of one getdents buffer handed to vfs_bulk_lookup */
+#define BULK_MAX (BUF_SIZE / 16)
 /**
  * read_dirents
  * read the directory and call through the callback function for
@@ -1182,6 +1357,8 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 	int nread;
 	struct vfs_dirent dentry, *dentryp = &dentry;
 	char buf[BUF_SIZE];
+	struct vfs_bulk_entry *bulk = NULL;
+	int nbulk, ent;
 
 	if (whence != NULL)
 		seekloc = (off_t) *whence;
@@ -1220,7 +1397,23 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 		}
 		if (nread == 0)
 			break;
-		for (bpos = 0; bpos < nread;) {
+
+		/* Let the file system look the whole buffer up at once
+		 * where it can, the rest are done one by one.
+		 */
+		if (bulk == NULL)
+			bulk = gsh_malloc(BULK_MAX * sizeof(*bulk));
+
+		for (bpos = 0, nbulk = 0; bpos < nread && nbulk < BULK_MAX;
+		     bpos += dentryp->vd_reclen, nbulk++) {
+			(void) to_vfs_dirent(buf, bpos, dentryp, baseloc);
+			bulk[nbulk].ino = dentryp->vd_ino;
+			bulk[nbulk].found = false;
+		}
+
+		(void) vfs_bulk_lookup(dirfd, bulk, nbulk);
+
+		for (bpos = 0, ent = 0; bpos < nread; ent++) {
 			struct fsal_obj_handle *hdl;
 			struct attrlist attrs;
 			enum fsal_dir_result cb_rc;
@@ -1233,6 +1426,8 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 			fsal_prepare_attrs(&attrs, attrmask);
 
 			status = lookup_with_fd(myself, dirfd, dentryp->vd_name,
+					ent < nbulk && bulk[ent].found
+						? &bulk[ent] : NULL,
 					&hdl, &attrs);
 
 			if (FSAL_IS_ERROR(status)) {
@@ -1256,6 +1451,7 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 
 	*eof = true;
  done:
+	gsh_free(bulk);
 	close(dirfd);
 
  out:
@@ -1286,7 +1482,7 @@ static fsal_status_t renamefile(struct fsal_obj_handle *obj_hdl,
 		fsal_error = posix2fsal_error(retval);
 		goto out;
 	}
-	oldfd = vfs_fsal_open(olddir, O_PATH | O_NOACCESS, &fsal_error);
+	oldfd = vfs_path_fd_get(olddir, &fsal_error);
 	if (oldfd < 0) {
 		retval = -oldfd;
 		goto out;
@@ -1305,7 +1501,7 @@ static fsal_status_t renamefile(struct fsal_obj_handle *obj_hdl,
 		goto out;
 	}
 	obj = container_of(obj_hdl, struct vfs_fsal_obj_handle, obj_handle);
-	newfd = vfs_fsal_open(newdir, O_PATH | O_NOACCESS, &fsal_error);
+	newfd = vfs_path_fd_get(newdir, &fsal_error);
 	if (newfd < 0) {
 		retval = -newfd;
 		goto out;
@@ -1333,9 +1529,9 @@ static fsal_status_t renamefile(struct fsal_obj_handle *obj_hdl,
 	fsal_restore_ganesha_credentials();
  out:
 	if (oldfd >= 0)
-		close(oldfd);
+		vfs_path_fd_put(olddir, oldfd);
 	if (newfd >= 0)
-		close(newfd);
+		vfs_path_fd_put(newdir, newfd);
 	return fsalstat(fsal_error, retval);
 }
 
@@ -1488,7 +1684,7 @@ static fsal_status_t file_unlink(struct fsal_obj_handle *dir_hdl,
 		fsal_error = posix2fsal_error(retval);
 		goto out;
 	}
-	fd = vfs_fsal_open(myself, O_PATH | O_NOACCESS, &fsal_error);
+	fd = vfs_path_fd_get(myself, &fsal_error);
 	if (fd < 0) {
 		retval = -fd;
 		goto out;
@@ -1516,7 +1712,7 @@ static fsal_status_t file_unlink(struct fsal_obj_handle *dir_hdl,
 	fsal_restore_ganesha_credentials();
 
  errout:
-	close(fd);
+	vfs_path_fd_put(myself, fd);
  out:
 	return fsalstat(fsal_error, retval);
 }
@@ -1598,6 +1794,8 @@ static void release(struct fsal_obj_handle *obj_hdl)
 
 	myself = container_of(obj_hdl, struct vfs_fsal_obj_handle, obj_handle);
 
+	vfs_path_fd_drop(myself);
+
 	if (type == REGULAR_FILE) {
 		fsal_status_t st;
 
@@ -1627,6 +1825,9 @@ static void release(struct fsal_obj_handle *obj_hdl)
 
 		handle_to_key(obj_hdl, &key);
 		vfs_state_release(&key);
+		PTHREAD_RWLOCK_destroy(&myself->u.file.direct_lock);
+		PTHREAD_COND_destroy(&myself->u.file.commit.cv);
+		PTHREAD_MUTEX_destroy(&myself->u.file.commit.mtx);
 	} else if (type == DIRECTORY) {
 		if (myself->u.directory.path != NULL)
 			gsh_free(myself->u.directory.path);
@@ -1727,6 +1928,15 @@ void vfs_handle_ops_init(struct fsal_obj_ops *ops)
 	ops->reopen2 = vfs_reopen2;
 	ops->read2 = vfs_read2;
 	ops->write2 = vfs_write2;
+#ifdef USE_VFS_IO_URING
+	ops->read2_async = vfs_read2_async;
+	ops->write2_async = vfs_write2_async;
+#endif
+	ops->writev2 = vfs_writev2;
+	ops->seek2 = vfs_seek2;
+	ops->copy = vfs_copy;
+	ops->clone = vfs_clone;
+	ops->io_advise2 = vfs_io_advise2;
 	ops->commit2 = vfs_commit2;
 	ops->lock_op2 = vfs_lock_op2;
 	ops->setattr2 = vfs_setattr2;
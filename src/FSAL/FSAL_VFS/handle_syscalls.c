@@ -92,6 +92,12 @@ int vfs_readlink(struct vfs_fsal_obj_handle *myself,
 	return retval;
 }
 
+int vfs_bulk_lookup(int dirfd, struct vfs_bulk_entry *ents, int count)
+{
+	/* Nothing beats a stat per entry here */
+	return 0;
+}
+
 int vfs_get_root_handle(struct vfs_filesystem *vfs_fs,
 			struct vfs_fsal_export *exp)
 {
@@ -39,6 +39,7 @@
 #include "gsh_list.h"
 #include "fsal.h"
 #include "FSAL/fsal_init.h"
+#include "../vfs_methods.h"
 
 /* PANFS FSAL module private storage
  */
@@ -198,4 +199,6 @@ MODULE_FINI void panfs_unload(void)
 		fprintf(stderr, "PANFS module failed to unregister");
 		return;
 	}
+
+	vfs_state_slab_destroy();
 }
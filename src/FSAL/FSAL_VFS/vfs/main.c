@@ -40,6 +40,7 @@
 #include "fsal.h"
 #include "FSAL/fsal_init.h"
 #include "fsal_handle_syscalls.h"
+#include "../vfs_methods.h"
 
 /* VFS FSAL module private storage
  */
@@ -258,4 +259,10 @@ MODULE_FINI void vfs_unload(void)
 		fprintf(stderr, "VFS module failed to unregister");
 		return;
 	}
+
+	vfs_state_slab_destroy();
+
+#ifdef USE_VFS_IO_URING
+	vfs_uring_shutdown();
+#endif
 }
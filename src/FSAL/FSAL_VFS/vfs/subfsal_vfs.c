@@ -55,6 +55,24 @@ static struct config_item export_params[] = {
 	CONF_ITEM_TOKEN("fsid_type", FSID_NO_TYPE,
 			fsid_types,
 			vfs_fsal_export, fsid_type),
+	CONF_ITEM_BOOL("O_Direct", false,
+		       vfs_fsal_export, o_direct),
+	CONF_ITEM_BOOL("IO_Uring", false,
+		       vfs_fsal_export, io_uring),
+	CONF_ITEM_BOOL("Deferred_Open", false,
+		       vfs_fsal_export, deferred_open),
+	CONF_ITEM_BOOL("pnfs", false,
+		       vfs_fsal_export, pnfs_flex_files),
+	CONF_ITEM_STR("FF_Data_Servers", 1, MAXPATHLEN, NULL,
+		      vfs_fsal_export, ff_data_servers),
+	CONF_ITEM_UI64("FF_Stripe_Unit", 4096, UINT32_MAX, 1024 * 1024,
+		       vfs_fsal_export, ff_stripe_unit),
+	CONF_ITEM_UI32("FF_Stripe_Width", 0, 1024, 0,
+		       vfs_fsal_export, ff_stripe_width),
+	CONF_ITEM_UI32("FF_Read_Mirrors", 1, 8, 1,
+		       vfs_fsal_export, ff_read_mirrors),
+	CONF_ITEM_UI32("FF_Retry_Delay", 0, 3600, 60,
+		       vfs_fsal_export, ff_retry_delay),
 	CONFIG_EOL
 };
 
@@ -73,11 +91,17 @@ struct config_block *vfs_sub_export_param = &export_param_block;
 
 void vfs_sub_fini(struct vfs_fsal_export *myself)
 {
+	vfs_ff_fini_export(myself);
 }
 
 void vfs_sub_init_export_ops(struct vfs_fsal_export *myself,
 			      const char *export_path)
 {
+	if (!myself->pnfs_flex_files)
+		return;
+
+	vfs_ff_export_ops(&myself->export.exp_ops);
+	vfs_ff_fsal_ops(&myself->export.fsal->m_ops);
 }
 
 int vfs_sub_init_export(struct vfs_fsal_export *myself)
@@ -85,6 +109,8 @@ int vfs_sub_init_export(struct vfs_fsal_export *myself)
 #ifdef ENABLE_VFS_DEBUG_ACL
 	vfs_acl_init();
 #endif /* ENABLE_VFS_DEBUG_ACL */
+	if (myself->pnfs_flex_files)
+		return vfs_ff_init_export(myself);
 	return 0;
 }
 
@@ -114,5 +140,7 @@ int vfs_sub_init_handle(struct vfs_fsal_export *myself,
 		const char *path)
 {
 	hdl->sub_ops = &vfs_obj_subops;
+	if (myself->pnfs_flex_files)
+		vfs_ff_handle_ops(&hdl->obj_handle.obj_ops);
 	return 0;
 }
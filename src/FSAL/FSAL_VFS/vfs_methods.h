@@ -44,6 +44,16 @@ struct vfs_fsal_export {
 	struct fsal_filesystem *root_fs;
 	struct glist_head filesystems;
 	int fsid_type;
+	bool o_direct;		/*< Open data fds with O_DIRECT */
+	bool io_uring;		/*< Asynchronous I/O through io_uring */
+	bool deferred_open;	/*< Open NFSv4 OPEN fds on first I/O */
+	bool pnfs_flex_files;	/*< Hand out flex files layouts */
+	char *ff_data_servers;	/*< "address[:port]" list of data servers */
+	uint64_t ff_stripe_unit;
+	uint32_t ff_stripe_width;	/*< Data servers per mirror, 0 for all */
+	uint32_t ff_read_mirrors;	/*< Mirrors in a READ layout, at most */
+	uint32_t ff_retry_delay;	/*< Seconds a failed server is left out */
+	struct vfs_ff_servers *ff;	/*< Data servers, once set up */
 };
 
 #define EXPORT_VFS_FROM_FSAL(fsal) \
@@ -129,6 +139,23 @@ struct vfs_state_fd {
 	struct vfs_fd vfs_fd;
 };
 
+/**
+ * @brief Group of COMMITs on one file sharing fsyncs
+ *
+ * A COMMIT arriving while an fsync is running cannot use it, since
+ * that fsync may have started before the COMMIT's writes.  It waits for
+ * the next fsync instead, which one caller makes for every COMMIT that
+ * arrived in the meantime.
+ */
+struct vfs_commit_group {
+	pthread_mutex_t mtx;
+	pthread_cond_t cv;
+	uint64_t started;	/*< fsyncs started */
+	uint64_t done;		/*< fsyncs completed */
+	int error;		/*< errno of the last completed fsync */
+	bool in_flight;		/*< An fsync is running */
+};
+
 /*
  * VFS internal object handle
  * handle is a pointer because
@@ -152,10 +179,21 @@ struct vfs_fsal_obj_handle {
 #endif
 	struct vfs_subfsal_obj_ops *sub_ops;	/*< Optional subfsal ops */
 	const struct fsal_up_vector *up_ops;	/*< Upcall operations */
+	/** Cached O_PATH descriptor and its place in the path fd LRU,
+	    both protected by the LRU lock; see vfs_path_fd_get() */
+	struct {
+		int fd;			/*< -1 if none */
+		uint32_t users;		/*< callers holding fd */
+		struct glist_head lru;
+	} path;
 	union {
 		struct {
 			struct fsal_share share;
 			struct vfs_fd fd;
+			/** Excludes O_DIRECT I/O while a partial block is
+			    read, modified and written back */
+			pthread_rwlock_t direct_lock;
+			struct vfs_commit_group commit;
 		} file;
 		struct {
 			char *path;
@@ -188,6 +226,21 @@ int vfs_open_by_handle(struct vfs_filesystem *fs,
 		       vfs_file_handle_t *fh, int openflags,
 		       fsal_errors_t *fsal_error);
 
+/**
+ * @brief A directory entry looked up in bulk
+ *
+ * vfs_bulk_lookup() fills in stat and fh and sets found for the
+ * entries it could do; the others are looked up one at a time.
+ */
+struct vfs_bulk_entry {
+	uint64_t ino;		/*< Inode number from the directory */
+	bool found;
+	struct stat stat;
+	vfs_file_handle_t fh;
+};
+
+int vfs_bulk_lookup(int dirfd, struct vfs_bulk_entry *ents, int count);
+
 int vfs_encode_dummy_handle(vfs_file_handle_t *fh,
 			    struct fsal_filesystem *fs);
 
@@ -227,6 +280,14 @@ int vfs_fsal_open(struct vfs_fsal_obj_handle *hdl,
 		  int openflags,
 		  fsal_errors_t *fsal_error);
 
+/** O_PATH descriptors kept open across operations, at most */
+#define VFS_PATH_FD_MAX 1024
+
+int vfs_path_fd_get(struct vfs_fsal_obj_handle *hdl,
+		    fsal_errors_t *fsal_error);
+void vfs_path_fd_put(struct vfs_fsal_obj_handle *hdl, int fd);
+void vfs_path_fd_drop(struct vfs_fsal_obj_handle *hdl);
+
 struct vfs_fsal_obj_handle *alloc_handle(int dirfd,
 					 vfs_file_handle_t *fh,
 					 struct fsal_filesystem *fs,
@@ -259,6 +320,43 @@ struct state_hdl *vfs_state_locate(struct fsal_obj_handle *obj);
 	/* I/O management */
 fsal_status_t vfs_close_my_fd(struct vfs_fd *my_fd);
 
+#ifdef USE_VFS_IO_URING
+/**
+ * @brief An asynchronous READ or WRITE for the io_uring engine
+ */
+struct vfs_uring_io {
+	struct fsal_obj_handle *obj_hdl;
+	const struct vfs_fd *owner;	/*< Stored fd io is made on, or NULL
+					    if fd is temporary */
+	int fd;
+	bool write;
+	bool stable;			/*< fsync once written */
+	uint64_t offset;
+	size_t size;
+	void *buffer;
+	size_t *amount;			/*< Bytes read or written */
+	bool *end_of_file;		/*< Reads only */
+	fsal_async_cb done_cb;
+	void *caller_data;
+};
+
+struct vfs_uring_req;
+
+struct vfs_uring_req *vfs_uring_prepare(const struct vfs_uring_io *io);
+void vfs_uring_start(struct vfs_uring_req *req);
+void vfs_uring_forget(const struct vfs_fd *my_fd);
+void vfs_uring_shutdown(void);
+#endif
+
+/* pNFS flex files layouts, FSAL_VFS only */
+struct vfs_ff_servers;
+
+int vfs_ff_init_export(struct vfs_fsal_export *myself);
+void vfs_ff_fini_export(struct vfs_fsal_export *myself);
+void vfs_ff_export_ops(struct export_ops *ops);
+void vfs_ff_handle_ops(struct fsal_obj_ops *ops);
+void vfs_ff_fsal_ops(struct fsal_ops *ops);
+
 fsal_status_t vfs_close(struct fsal_obj_handle *obj_hdl);
 
 /* Multiple file descriptor methods */
@@ -266,6 +364,7 @@ struct state_t *vfs_alloc_state(struct fsal_export *exp_hdl,
 				enum state_type state_type,
 				struct state_t *related_state);
 void vfs_free_state(struct fsal_export *exp_hdl, struct state_t *state);
+void vfs_state_slab_destroy(void);
 
 fsal_status_t vfs_merge(struct fsal_obj_handle *orig_hdl,
 			struct fsal_obj_handle *dupe_hdl);
@@ -305,6 +404,67 @@ fsal_status_t vfs_write2(struct fsal_obj_handle *obj_hdl,
 			 bool *fsal_stable,
 			 struct io_info *info);
 
+fsal_status_t vfs_writev2(struct fsal_obj_handle *obj_hdl,
+			  bool bypass,
+			  struct state_t *state,
+			  uint64_t offset,
+			  const struct iovec *iov,
+			  int iovcnt,
+			  size_t *wrote_amount,
+			  bool *fsal_stable,
+			  struct io_info *info);
+
+#ifdef USE_VFS_IO_URING
+void vfs_read2_async(struct fsal_obj_handle *obj_hdl,
+		     bool bypass,
+		     struct state_t *state,
+		     uint64_t offset,
+		     size_t buffer_size,
+		     void *buffer,
+		     size_t *read_amount,
+		     bool *end_of_file,
+		     struct io_info *info,
+		     fsal_async_cb done_cb,
+		     void *caller_data);
+
+void vfs_write2_async(struct fsal_obj_handle *obj_hdl,
+		      bool bypass,
+		      struct state_t *state,
+		      uint64_t offset,
+		      size_t buffer_size,
+		      void *buffer,
+		      size_t *wrote_amount,
+		      bool *fsal_stable,
+		      struct io_info *info,
+		      fsal_async_cb done_cb,
+		      void *caller_data);
+#endif
+
+fsal_status_t vfs_seek2(struct fsal_obj_handle *obj_hdl,
+			struct state_t *state,
+			struct io_info *info);
+
+fsal_status_t vfs_copy(struct fsal_obj_handle *dst_hdl,
+		       struct state_t *dst_state,
+		       uint64_t dst_offset,
+		       struct fsal_obj_handle *src_hdl,
+		       struct state_t *src_state,
+		       uint64_t src_offset,
+		       uint64_t count,
+		       uint64_t *copied);
+
+fsal_status_t vfs_clone(struct fsal_obj_handle *dst_hdl,
+			struct state_t *dst_state,
+			uint64_t dst_offset,
+			struct fsal_obj_handle *src_hdl,
+			struct state_t *src_state,
+			uint64_t src_offset,
+			uint64_t count);
+
+fsal_status_t vfs_io_advise2(struct fsal_obj_handle *obj_hdl,
+			     struct state_t *state,
+			     struct io_hints *hints);
+
 fsal_status_t vfs_commit2(struct fsal_obj_handle *obj_hdl,
 			  off_t offset,
 			  size_t len);
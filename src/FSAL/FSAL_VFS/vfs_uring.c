@@ -0,0 +1,571 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @file vfs_uring.c
+ * @brief io_uring engine for asynchronous READ and WRITE
+ *
+ * A handful of rings are shared by the worker threads, each thread
+ * sticking to the ring it was first given.  Submission on a ring is
+ * serialized by its mutex; completions are reaped by one thread per
+ * ring, which calls the request's done_cb.
+ *
+ * The pool's I/O buffers are registered with every ring, so data
+ * landing in them is read and written with the _FIXED opcodes.  Each
+ * ring also has a table of registered files.  A stored fd keeps its
+ * slot for as long as it stays open and is dropped by
+ * vfs_uring_forget() when it is closed; a temporary fd gets a slot
+ * that is dropped when its I/O completes.  The registration holds the
+ * kernel file, so the caller may release its fd and the object lock
+ * as soon as the request is prepared.  When a ring has no free slot,
+ * or could not register files at all, the fd is dup()ed instead.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <liburing.h>
+#include "fsal.h"
+#include "fsal_convert.h"
+#include "log.h"
+#include "abstract_mem.h"
+#include "abstract_atomic.h"
+#include "iobuf_pool.h"
+#include "vfs_methods.h"
+#ifdef USE_LTTNG
+#include "gsh_lttng/fsal.h"
+#endif
+
+/** Number of rings shared by the worker threads */
+#define VFS_URING_RINGS 4
+
+/** Requests in flight on one ring */
+#define VFS_URING_DEPTH 256
+
+/** Registered file slots on one ring */
+#define VFS_URING_FILES 256
+
+struct vfs_uring_file {
+	const struct vfs_fd *owner;	/*< Stored fd, NULL if temporary */
+	int fd;				/*< Descriptor registered, or -1 */
+	uint32_t inflight;		/*< Requests using the slot */
+	bool dead;			/*< Drop once inflight reaches 0 */
+};
+
+struct vfs_uring {
+	struct io_uring ring;
+	pthread_mutex_t mtx;		/*< Serializes the SQ and files */
+	pthread_t reaper;
+	uint32_t inflight;		/*< Requests not yet reaped */
+	bool fixed_files;		/*< files[] is registered */
+	unsigned int nbufs;		/*< Entries of bufs registered */
+	struct iovec bufs[IOBUF_MAX_CLASSES];
+	struct vfs_uring_file files[VFS_URING_FILES];
+};
+
+struct vfs_uring_req {
+	struct vfs_uring_io io;
+	struct vfs_uring *ur;
+	int slot;			/*< Registered file slot, or -1 */
+	int fd;				/*< dup of io.fd if slot is -1 */
+	bool syncing;			/*< Write done, fsync submitted */
+};
+
+static struct vfs_uring vfs_urings[VFS_URING_RINGS];
+
+/** 0 not yet set up, 1 running, -1 io_uring is unavailable */
+static int32_t vfs_uring_state;
+static pthread_mutex_t vfs_uring_init_mtx = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t vfs_uring_next;
+static __thread int vfs_uring_mine = -1;
+
+static void vfs_uring_complete(struct vfs_uring_req *req, int res);
+
+static void *vfs_uring_reaper(void *arg)
+{
+	struct vfs_uring *ur = arg;
+	struct io_uring_cqe *cqe;
+	struct vfs_uring_req *req;
+	int rc, res;
+
+	SetNameFunction("vfs_uring");
+
+	for (;;) {
+		rc = io_uring_wait_cqe(&ur->ring, &cqe);
+
+		if (rc == -EINTR)
+			continue;
+
+		if (rc < 0) {
+			LogCrit(COMPONENT_FSAL,
+				"io_uring_wait_cqe failed: %s", strerror(-rc));
+			break;
+		}
+
+		req = io_uring_cqe_get_data(cqe);
+		res = cqe->res;
+		io_uring_cqe_seen(&ur->ring, cqe);
+
+		/* A NOP without a request asks us to stop */
+		if (req == NULL)
+			break;
+
+		vfs_uring_complete(req, res);
+	}
+
+	return NULL;
+}
+
+static int vfs_uring_add_region(void *base, size_t len, size_t buf_size,
+				void *arg)
+{
+	struct vfs_uring *ur = arg;
+
+	ur->bufs[ur->nbufs].iov_base = base;
+	ur->bufs[ur->nbufs].iov_len = len;
+	ur->nbufs++;
+
+	return 0;
+}
+
+static int vfs_uring_ring_init(struct vfs_uring *ur)
+{
+	int fds[VFS_URING_FILES];
+	int i, rc;
+
+	rc = io_uring_queue_init(VFS_URING_DEPTH, &ur->ring, 0);
+
+	if (rc < 0)
+		return rc;
+
+	ur->nbufs = 0;
+	(void) iobuf_pool_foreach_region(vfs_uring_add_region, ur);
+
+	if (ur->nbufs != 0) {
+		rc = io_uring_register_buffers(&ur->ring, ur->bufs, ur->nbufs);
+		if (rc < 0) {
+			LogInfo(COMPONENT_FSAL,
+				"io_uring could not register the I/O buffer pool: %s",
+				strerror(-rc));
+			ur->nbufs = 0;
+		}
+	}
+
+	for (i = 0; i < VFS_URING_FILES; i++) {
+		fds[i] = -1;
+		ur->files[i].owner = NULL;
+		ur->files[i].fd = -1;
+		ur->files[i].inflight = 0;
+		ur->files[i].dead = false;
+	}
+
+	rc = io_uring_register_files(&ur->ring, fds, VFS_URING_FILES);
+	ur->fixed_files = rc == 0;
+
+	if (!ur->fixed_files)
+		LogInfo(COMPONENT_FSAL,
+			"io_uring could not register files, fds will be duplicated: %s",
+			strerror(-rc));
+
+	PTHREAD_MUTEX_init(&ur->mtx, NULL);
+	ur->inflight = 0;
+
+	rc = pthread_create(&ur->reaper, NULL, vfs_uring_reaper, ur);
+
+	if (rc != 0) {
+		PTHREAD_MUTEX_destroy(&ur->mtx);
+		io_uring_queue_exit(&ur->ring);
+		return -rc;
+	}
+
+	return 0;
+}
+
+static void vfs_uring_ring_fini(struct vfs_uring *ur)
+{
+	struct io_uring_sqe *sqe;
+
+	PTHREAD_MUTEX_lock(&ur->mtx);
+
+	sqe = io_uring_get_sqe(&ur->ring);
+	if (sqe == NULL) {
+		(void) io_uring_submit(&ur->ring);
+		sqe = io_uring_get_sqe(&ur->ring);
+	}
+	io_uring_prep_nop(sqe);
+	io_uring_sqe_set_data(sqe, NULL);
+	(void) io_uring_submit(&ur->ring);
+
+	PTHREAD_MUTEX_unlock(&ur->mtx);
+
+	pthread_join(ur->reaper, NULL);
+	io_uring_queue_exit(&ur->ring);
+	PTHREAD_MUTEX_destroy(&ur->mtx);
+}
+
+/**
+ * @brief Set up the rings on first use
+ *
+ * Done lazily so a server with no io_uring export never creates them.
+ * Failing on an older kernel is not an error; asynchronous I/O simply
+ * stays synchronous.
+ */
+static void vfs_uring_init(void)
+{
+	int i, rc = 0;
+
+	PTHREAD_MUTEX_lock(&vfs_uring_init_mtx);
+
+	if (atomic_fetch_int32_t(&vfs_uring_state) != 0)
+		goto out;
+
+	for (i = 0; i < VFS_URING_RINGS; i++) {
+		rc = vfs_uring_ring_init(&vfs_urings[i]);
+		if (rc < 0)
+			break;
+	}
+
+	if (rc < 0) {
+		LogWarn(COMPONENT_FSAL,
+			"io_uring is unavailable, VFS I/O stays synchronous: %s",
+			strerror(-rc));
+		while (--i >= 0)
+			vfs_uring_ring_fini(&vfs_urings[i]);
+		atomic_store_int32_t(&vfs_uring_state, -1);
+		goto out;
+	}
+
+	LogInfo(COMPONENT_FSAL,
+		"%d io_uring rings of depth %d, %u buffer regions registered",
+		VFS_URING_RINGS, VFS_URING_DEPTH, vfs_urings[0].nbufs);
+	atomic_store_int32_t(&vfs_uring_state, 1);
+
+ out:
+	PTHREAD_MUTEX_unlock(&vfs_uring_init_mtx);
+}
+
+/**
+ * @brief Stop the reapers and tear the rings down
+ *
+ * Called when the FSAL is unloaded, by which time no I/O is in flight.
+ */
+void vfs_uring_shutdown(void)
+{
+	int i;
+
+	PTHREAD_MUTEX_lock(&vfs_uring_init_mtx);
+
+	if (atomic_fetch_int32_t(&vfs_uring_state) == 1) {
+		for (i = 0; i < VFS_URING_RINGS; i++)
+			vfs_uring_ring_fini(&vfs_urings[i]);
+	}
+
+	atomic_store_int32_t(&vfs_uring_state, 0);
+
+	PTHREAD_MUTEX_unlock(&vfs_uring_init_mtx);
+}
+
+/**
+ * @brief Find or take a registered file slot
+ *
+ * A stored fd reuses the slot it already has.  Otherwise an empty slot
+ * is preferred over evicting an idle one.  Must be called with the
+ * ring's mutex held.
+ *
+ * @return The slot, or -1 if none could be had.
+ */
+static int vfs_uring_slot(struct vfs_uring *ur, const struct vfs_fd *owner,
+			  int fd)
+{
+	struct vfs_uring_file *f;
+	int i, empty = -1, idle = -1;
+
+	if (!ur->fixed_files)
+		return -1;
+
+	for (i = 0; i < VFS_URING_FILES; i++) {
+		f = &ur->files[i];
+
+		if (owner != NULL && f->owner == owner && f->fd == fd &&
+		    !f->dead) {
+			f->inflight++;
+			return i;
+		}
+
+		if (f->fd < 0) {
+			if (empty < 0)
+				empty = i;
+		} else if (f->inflight == 0 && idle < 0) {
+			idle = i;
+		}
+	}
+
+	i = empty >= 0 ? empty : idle;
+
+	if (i < 0 || io_uring_register_files_update(&ur->ring, i, &fd, 1) != 1)
+		return -1;
+
+	f = &ur->files[i];
+	f->owner = owner;
+	f->fd = fd;
+	f->inflight = 1;
+	f->dead = owner == NULL;
+
+	return i;
+}
+
+static void vfs_uring_drop_slot(struct vfs_uring *ur, int i)
+{
+	struct vfs_uring_file *f = &ur->files[i];
+	int none = -1;
+
+	(void) io_uring_register_files_update(&ur->ring, i, &none, 1);
+
+	f->owner = NULL;
+	f->fd = -1;
+	f->inflight = 0;
+	f->dead = false;
+}
+
+/**
+ * @brief Drop the registrations of a stored fd about to be closed
+ *
+ * Slots still in use are only marked, and are dropped by the last
+ * completion using them.
+ *
+ * @param[in] my_fd  The stored fd
+ */
+void vfs_uring_forget(const struct vfs_fd *my_fd)
+{
+	struct vfs_uring *ur;
+	int r, i;
+
+	if (atomic_fetch_int32_t(&vfs_uring_state) != 1)
+		return;
+
+	for (r = 0; r < VFS_URING_RINGS; r++) {
+		ur = &vfs_urings[r];
+
+		if (!ur->fixed_files)
+			continue;
+
+		PTHREAD_MUTEX_lock(&ur->mtx);
+
+		for (i = 0; i < VFS_URING_FILES; i++) {
+			if (ur->files[i].owner != my_fd || ur->files[i].dead)
+				continue;
+
+			if (ur->files[i].inflight == 0)
+				vfs_uring_drop_slot(ur, i);
+			else
+				ur->files[i].dead = true;
+		}
+
+		PTHREAD_MUTEX_unlock(&ur->mtx);
+	}
+}
+
+static int vfs_uring_buf(struct vfs_uring *ur, const void *buffer,
+			 size_t size)
+{
+	const char *p = buffer;
+	unsigned int i;
+
+	for (i = 0; i < ur->nbufs; i++) {
+		const char *base = ur->bufs[i].iov_base;
+
+		if (p >= base && p + size <= base + ur->bufs[i].iov_len)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief Queue the next operation of a request and submit it
+ *
+ * Must be called with the ring's mutex held.  Each request has at most
+ * one operation queued and no more than VFS_URING_DEPTH requests are
+ * in flight, so the SQ cannot be full once it has been submitted.
+ */
+static void vfs_uring_queue(struct vfs_uring_req *req)
+{
+	struct vfs_uring *ur = req->ur;
+	struct vfs_uring_io *io = &req->io;
+	struct io_uring_sqe *sqe;
+	int fd = req->slot >= 0 ? req->slot : req->fd;
+	int buf;
+
+	sqe = io_uring_get_sqe(&ur->ring);
+	if (sqe == NULL) {
+		(void) io_uring_submit(&ur->ring);
+		sqe = io_uring_get_sqe(&ur->ring);
+	}
+	assert(sqe != NULL);
+
+	buf = vfs_uring_buf(ur, io->buffer, io->size);
+
+	if (req->syncing)
+		io_uring_prep_fsync(sqe, fd, 0);
+	else if (io->write && buf >= 0)
+		io_uring_prep_write_fixed(sqe, fd, io->buffer, io->size,
+					  io->offset, buf);
+	else if (io->write)
+		io_uring_prep_write(sqe, fd, io->buffer, io->size,
+				    io->offset);
+	else if (buf >= 0)
+		io_uring_prep_read_fixed(sqe, fd, io->buffer, io->size,
+					 io->offset, buf);
+	else
+		io_uring_prep_read(sqe, fd, io->buffer, io->size, io->offset);
+
+	if (req->slot >= 0)
+		io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+
+	io_uring_sqe_set_data(sqe, req);
+	(void) io_uring_submit(&ur->ring);
+}
+
+/**
+ * @brief Get a request ready to be started
+ *
+ * Once this returns, the request no longer needs @a io->fd, so the
+ * caller may close it and drop the object lock before starting it.
+ *
+ * @param[in] io  What to do
+ *
+ * @return The request, or NULL if the caller should do the I/O itself.
+ */
+struct vfs_uring_req *vfs_uring_prepare(const struct vfs_uring_io *io)
+{
+	struct vfs_uring *ur;
+	struct vfs_uring_req *req;
+
+	if (atomic_fetch_int32_t(&vfs_uring_state) == 0)
+		vfs_uring_init();
+
+	if (atomic_fetch_int32_t(&vfs_uring_state) != 1)
+		return NULL;
+
+	if (vfs_uring_mine < 0)
+		vfs_uring_mine = atomic_inc_uint32_t(&vfs_uring_next) %
+							VFS_URING_RINGS;
+	ur = &vfs_urings[vfs_uring_mine];
+
+	req = gsh_malloc(sizeof(*req));
+	req->io = *io;
+	req->ur = ur;
+	req->fd = -1;
+	req->syncing = false;
+
+	PTHREAD_MUTEX_lock(&ur->mtx);
+
+	if (ur->inflight >= VFS_URING_DEPTH) {
+		PTHREAD_MUTEX_unlock(&ur->mtx);
+		gsh_free(req);
+		return NULL;
+	}
+
+	ur->inflight++;
+	req->slot = vfs_uring_slot(ur, io->owner, io->fd);
+
+	PTHREAD_MUTEX_unlock(&ur->mtx);
+
+	if (req->slot < 0) {
+		req->fd = dup(io->fd);
+		if (req->fd < 0) {
+			PTHREAD_MUTEX_lock(&ur->mtx);
+			ur->inflight--;
+			PTHREAD_MUTEX_unlock(&ur->mtx);
+			gsh_free(req);
+			return NULL;
+		}
+	}
+
+	return req;
+}
+
+/**
+ * @brief Start a prepared request
+ *
+ * The request's done_cb is called from the ring's reaper.
+ *
+ * @param[in] req  The request
+ */
+void vfs_uring_start(struct vfs_uring_req *req)
+{
+	PTHREAD_MUTEX_lock(&req->ur->mtx);
+	vfs_uring_queue(req);
+	PTHREAD_MUTEX_unlock(&req->ur->mtx);
+}
+
+static void vfs_uring_complete(struct vfs_uring_req *req, int res)
+{
+	struct vfs_uring *ur = req->ur;
+	struct vfs_uring_io *io = &req->io;
+	fsal_status_t status = fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+	if (res < 0) {
+		status = fsalstat(posix2fsal_error(-res), -res);
+	} else if (req->syncing) {
+		/* The amount was reported by the write */
+	} else if (io->write) {
+		*io->amount = res;
+
+		if (io->stable) {
+			/* A short write still needs its data synced */
+			PTHREAD_MUTEX_lock(&ur->mtx);
+			req->syncing = true;
+			vfs_uring_queue(req);
+			PTHREAD_MUTEX_unlock(&ur->mtx);
+			return;
+		}
+	} else {
+		*io->amount = res;
+		*io->end_of_file = res == 0;
+	}
+
+	PTHREAD_MUTEX_lock(&ur->mtx);
+
+	if (req->slot >= 0 && --ur->files[req->slot].inflight == 0 &&
+	    ur->files[req->slot].dead)
+		vfs_uring_drop_slot(ur, req->slot);
+
+	ur->inflight--;
+
+	PTHREAD_MUTEX_unlock(&ur->mtx);
+
+	if (req->fd >= 0)
+		close(req->fd);
+
+#ifdef USE_LTTNG
+	tracepoint(fsal, async_io_end, req,
+		   res < 0 ? res : (int64_t) *io->amount,
+		   res < 0 ? -res : 0);
+#endif
+
+	io->done_cb(io->obj_hdl, status, io->caller_data);
+	gsh_free(req);
+}
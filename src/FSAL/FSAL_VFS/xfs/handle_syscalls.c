@@ -33,6 +33,8 @@
 #include "fsal_handle_syscalls.h"
 #include <sys/types.h>
 #include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <stdlib.h>
 #include <xfs/xfs.h>
 #include <xfs/handle.h>
 #include "gsh_list.h"
@@ -125,6 +127,151 @@ static int xfs_fsal_inode2handle(int fd, ino_t ino, vfs_file_handle_t *fh)
 	return 0;
 }
 
+/** Inodes asked of each XFS_IOC_FSBULKSTAT call */
+#define XFS_BULKSTAT_BATCH 64
+
+static int xfs_bulk_cmp(const void *a, const void *b)
+{
+	const struct vfs_bulk_entry *ea = *(const struct vfs_bulk_entry **)a;
+	const struct vfs_bulk_entry *eb = *(const struct vfs_bulk_entry **)b;
+
+	return ea->ino < eb->ino ? -1 : ea->ino > eb->ino;
+}
+
+static void xfs_bulk_fill(struct vfs_bulk_entry *ent, const xfs_bstat_t *bs,
+			  dev_t dev, const void *fsid)
+{
+	struct stat *st = &ent->stat;
+	xfs_handle_t *hdl = (xfs_handle_t *) ent->fh.handle_data;
+
+	memset(st, 0, sizeof(*st));
+	st->st_dev = dev;
+	st->st_ino = bs->bs_ino;
+	st->st_mode = bs->bs_mode;
+	st->st_nlink = bs->bs_nlink;
+	st->st_uid = bs->bs_uid;
+	st->st_gid = bs->bs_gid;
+	/* bulkstat reports the device in the old 14/18 bit sysv layout */
+	st->st_rdev = makedev(bs->bs_rdev >> 18, bs->bs_rdev & 0x3ffff);
+	st->st_size = bs->bs_size;
+	st->st_blksize = bs->bs_blksize;
+	/* bs_blocks is in file system blocks, st_blocks in 512 bytes */
+	st->st_blocks = bs->bs_blocks * (bs->bs_blksize / 512);
+	st->st_atim.tv_sec = bs->bs_atime.tv_sec;
+	st->st_atim.tv_nsec = bs->bs_atime.tv_nsec;
+	st->st_mtim.tv_sec = bs->bs_mtime.tv_sec;
+	st->st_mtim.tv_nsec = bs->bs_mtime.tv_nsec;
+	st->st_ctim.tv_sec = bs->bs_ctime.tv_sec;
+	st->st_ctim.tv_nsec = bs->bs_ctime.tv_nsec;
+
+	/* Same handle as xfs_fsal_inode2handle builds */
+	memset(&ent->fh, 0, sizeof(ent->fh));
+	memcpy(&hdl->ha_fsid, fsid, sizeof(xfs_fsid_t));
+	hdl->ha_fid.fid_len = sizeof(xfs_handle_t) -
+			      sizeof(xfs_fsid_t) -
+			      sizeof(hdl->ha_fid.fid_len);
+	hdl->ha_fid.fid_pad = 0;
+	hdl->ha_fid.fid_gen = bs->bs_gen;
+	hdl->ha_fid.fid_ino = bs->bs_ino;
+	ent->fh.handle_len = sizeof(*hdl);
+
+	ent->found = true;
+}
+
+/**
+ * @brief Stat a buffer of directory entries with XFS_IOC_FSBULKSTAT
+ *
+ * The entries are sorted by inode number and bulkstat is asked for
+ * XFS_BULKSTAT_BATCH inodes from the lowest one not yet found, so
+ * entries whose inodes share a cluster, as those of one directory
+ * usually do, come back from a single call.  Where the next wanted
+ * inode lies past the batch, the scan jumps to it, so there is never
+ * more than one call per entry.
+ *
+ * Directories are left to the caller, since the inode number in the
+ * directory is that of the covered directory if something is mounted
+ * on it.
+ *
+ * @param[in]     dirfd  The directory being read
+ * @param[in,out] ents   Entries, ino filled in
+ * @param[in]     count  Number of entries
+ *
+ * @return Number of entries found.
+ */
+int vfs_bulk_lookup(int dirfd, struct vfs_bulk_entry *ents, int count)
+{
+	struct vfs_bulk_entry **sorted;
+	xfs_bstat_t *bstat;
+	xfs_fsop_bulkreq_t bulkreq;
+	struct stat dir_stat;
+	__u64 last;
+	__s32 ocount;
+	void *data;
+	size_t sz;
+	int i, j, found = 0;
+
+	if (count == 0 || fstat(dirfd, &dir_stat) < 0)
+		return 0;
+
+	/* All the entries share the directory's fsid */
+	if (fd_to_handle(dirfd, &data, &sz) < 0)
+		return 0;
+
+	sorted = gsh_malloc(count * sizeof(*sorted));
+	bstat = gsh_malloc(XFS_BULKSTAT_BATCH * sizeof(*bstat));
+
+	for (i = 0; i < count; i++)
+		sorted[i] = &ents[i];
+
+	qsort(sorted, count, sizeof(*sorted), xfs_bulk_cmp);
+
+	/* Inode numbers from getdents are never 0 */
+	i = 0;
+	last = sorted[0]->ino - 1;
+
+	while (i < count) {
+		bulkreq.lastip = &last;
+		bulkreq.icount = XFS_BULKSTAT_BATCH;
+		bulkreq.ubuffer = bstat;
+		bulkreq.ocount = &ocount;
+
+		if (ioctl(dirfd, XFS_IOC_FSBULKSTAT, &bulkreq) < 0) {
+			LogDebug(COMPONENT_FSAL,
+				 "XFS_IOC_FSBULKSTAT failed: %s",
+				 strerror(errno));
+			break;
+		}
+
+		if (ocount <= 0)
+			break;
+
+		for (j = 0; j < ocount && i < count; j++) {
+			/* Skip entries gone since the directory was read */
+			while (i < count && sorted[i]->ino < bstat[j].bs_ino)
+				i++;
+
+			/* Hard links in one directory share an inode */
+			while (i < count && sorted[i]->ino == bstat[j].bs_ino) {
+				if (!S_ISDIR(bstat[j].bs_mode)) {
+					xfs_bulk_fill(sorted[i], &bstat[j],
+						      dir_stat.st_dev, data);
+					found++;
+				}
+				i++;
+			}
+		}
+
+		if (i < count && sorted[i]->ino - 1 > last)
+			last = sorted[i]->ino - 1;
+	}
+
+	gsh_free(bstat);
+	gsh_free(sorted);
+	free_handle(data, sz);
+
+	return found;
+}
+
 int vfs_open_by_handle(struct vfs_filesystem *fs,
 		       vfs_file_handle_t *fh, int openflags,
 		       fsal_errors_t *fsal_error)
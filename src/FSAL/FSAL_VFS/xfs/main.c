@@ -39,6 +39,7 @@
 #include "fsal.h"
 #include "FSAL/fsal_init.h"
 #include "fsal_handle_syscalls.h"
+#include "../vfs_methods.h"
 
 /* VFS FSAL module private storage
  */
@@ -256,4 +257,10 @@ MODULE_FINI void xfs_unload(void)
 		fprintf(stderr, "XFS module failed to unregister");
 		return;
 	}
+
+	vfs_state_slab_destroy();
+
+#ifdef USE_VFS_IO_URING
+	vfs_uring_shutdown();
+#endif
 }
@@ -37,6 +37,12 @@
 
 static struct config_item export_params[] = {
 	CONF_ITEM_NOOP("name"),
+	CONF_ITEM_BOOL("O_Direct", false,
+		       vfs_fsal_export, o_direct),
+	CONF_ITEM_BOOL("IO_Uring", false,
+		       vfs_fsal_export, io_uring),
+	CONF_ITEM_BOOL("Deferred_Open", false,
+		       vfs_fsal_export, deferred_open),
 	CONFIG_EOL
 };
 
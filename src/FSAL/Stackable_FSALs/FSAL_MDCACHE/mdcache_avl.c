@@ -42,6 +42,7 @@
 #include "log.h"
 #include "fsal.h"
 #include "mdcache_int.h"
+#include "mdcache_lru.h"
 #include "mdcache_avl.h"
 #include "murmur3.h"
 #include "city.h"
@@ -56,14 +57,198 @@
 void
 mdcache_avl_init(mdcache_entry_t *entry)
 {
-	avltree_init(&entry->fsobj.fsdir.avl.t, avl_dirent_hk_cmpf,
+	avltree_init(&entry->fsobj.fsdir->avl.t, avl_dirent_hk_cmpf,
 		     0 /* flags */);
-	avltree_init(&entry->fsobj.fsdir.avl.c, avl_dirent_hk_cmpf,
+	avltree_init(&entry->fsobj.fsdir->avl.c, avl_dirent_hk_cmpf,
 		     0 /* flags */);
-	avltree_init(&entry->fsobj.fsdir.avl.ck, avl_dirent_ck_cmpf,
+	avltree_init(&entry->fsobj.fsdir->avl.ck, avl_dirent_ck_cmpf,
 		     0 /* flags */);
-	avltree_init(&entry->fsobj.fsdir.avl.sorted, avl_dirent_sorted_cmpf,
+	avltree_init(&entry->fsobj.fsdir->avl.sorted, avl_dirent_sorted_cmpf,
 		     0 /* flags */);
+	entry->fsobj.fsdir->avl.index = NULL;
+	entry->fsobj.fsdir->avl.index_mask = 0;
+	entry->fsobj.fsdir->avl.index_count = 0;
+}
+
+/**
+ * @brief Compute the unprobed name hash of a dirent name
+ *
+ * @param[in] name  The name
+ *
+ * @return The hash, which is the first k-value tried for the name.
+ */
+static inline uint64_t
+mdcache_avl_name_hash(const char *name)
+{
+	uint64_t k;
+#if AVL_HASH_MURMUR3
+	uint32_t hk[4];
+
+	MurmurHash3_x64_128(name, strlen(name), 67, hk);
+	memcpy(&k, hk, 8);
+#else
+	k = CityHash64WithSeed(name, strlen(name), 67);
+#endif
+
+#ifdef _USE_9P
+	/* tmp hook : it seems like client running v9fs dislike "negative"
+	 * cookies just kill the sign bit, making
+	 * cookies 63 bits... */
+	k &= ~(1ULL << 63);
+#endif
+	return k;
+}
+
+/*
+ * Name index
+ *
+ * Large directories keep an open-addressed, linearly probed table of
+ * their active dirents next to the name tree, so that a name lookup or
+ * negative check costs a probe or two instead of a tree descent through
+ * quadratic-probe collisions.  The table is at most half full, and is
+ * kept exactly in step with the active tree under the content lock.
+ */
+
+static inline void
+dir_index_put(struct mdcache_dir_index_slot *tbl, uint32_t mask,
+	      uint64_t hash, mdcache_dir_entry_t *dirent)
+{
+	uint32_t ix = hash & mask;
+
+	while (tbl[ix].dirent != NULL)
+		ix = (ix + 1) & mask;
+
+	tbl[ix].hash = hash;
+	tbl[ix].dirent = dirent;
+}
+
+static void dir_index_resize(mdcache_entry_t *parent, uint32_t nslots)
+{
+	struct mdcache_dir_index_slot *old = parent->fsobj.fsdir->avl.index;
+	uint32_t oldn = old ? parent->fsobj.fsdir->avl.index_mask + 1 : 0;
+	struct mdcache_dir_index_slot *tbl;
+	uint32_t ix;
+
+	tbl = gsh_calloc(nslots, sizeof(*tbl));
+	for (ix = 0; ix < oldn; ++ix)
+		if (old[ix].dirent != NULL)
+			dir_index_put(tbl, nslots - 1, old[ix].hash,
+				      old[ix].dirent);
+
+	(void) atomic_add_uint64_t(&lru_state.dirent_bytes,
+				   (uint64_t)nslots * sizeof(*tbl));
+	if (old) {
+		(void) atomic_sub_uint64_t(&lru_state.dirent_bytes,
+					   (uint64_t)oldn * sizeof(*tbl));
+		gsh_free(old);
+	}
+
+	parent->fsobj.fsdir->avl.index = tbl;
+	parent->fsobj.fsdir->avl.index_mask = nslots - 1;
+}
+
+static void dir_index_build(mdcache_entry_t *parent)
+{
+	struct avltree *t = &parent->fsobj.fsdir->avl.t;
+	struct avltree_node *node;
+	mdcache_dir_entry_t *v;
+	uint32_t nslots = 64;
+
+	while (nslots < 2 * (avltree_size(t) + 1))
+		nslots <<= 1;
+
+	dir_index_resize(parent, nslots);
+
+	for (node = avltree_first(t); node; node = avltree_next(node)) {
+		v = avltree_container_of(node, mdcache_dir_entry_t, node_hk);
+		dir_index_put(parent->fsobj.fsdir->avl.index,
+			      parent->fsobj.fsdir->avl.index_mask,
+			      mdcache_avl_name_hash(v->name), v);
+	}
+	parent->fsobj.fsdir->avl.index_count = avltree_size(t);
+}
+
+/* Called after v joined the active tree */
+static void dir_index_add(mdcache_entry_t *parent, mdcache_dir_entry_t *v)
+{
+	if (parent->fsobj.fsdir->avl.index == NULL) {
+		if (avltree_size(&parent->fsobj.fsdir->avl.t) >=
+		    MDCACHE_DIR_INDEX_MIN)
+			dir_index_build(parent);
+		return;
+	}
+
+	if (2 * (parent->fsobj.fsdir->avl.index_count + 1) >
+	    parent->fsobj.fsdir->avl.index_mask + 1)
+		dir_index_resize(parent,
+				 2 * (parent->fsobj.fsdir->avl.index_mask + 1));
+
+	dir_index_put(parent->fsobj.fsdir->avl.index,
+		      parent->fsobj.fsdir->avl.index_mask,
+		      mdcache_avl_name_hash(v->name), v);
+	++parent->fsobj.fsdir->avl.index_count;
+}
+
+/* Called when v leaves the active tree */
+static void dir_index_del(mdcache_entry_t *parent, mdcache_dir_entry_t *v)
+{
+	struct mdcache_dir_index_slot *tbl = parent->fsobj.fsdir->avl.index;
+	uint32_t mask = parent->fsobj.fsdir->avl.index_mask;
+	uint32_t ix, next, home;
+
+	if (tbl == NULL)
+		return;
+
+	ix = mdcache_avl_name_hash(v->name) & mask;
+	while (tbl[ix].dirent != v) {
+		if (tbl[ix].dirent == NULL)
+			return;
+		ix = (ix + 1) & mask;
+	}
+
+	/* Backward-shift deletion keeps probe chains unbroken */
+	for (next = (ix + 1) & mask; tbl[next].dirent != NULL;
+	     next = (next + 1) & mask) {
+		home = tbl[next].hash & mask;
+		/* leave it if its home lies cyclically in (ix, next] */
+		if (ix <= next ? (ix < home && home <= next)
+			       : (ix < home || home <= next))
+			continue;
+		tbl[ix] = tbl[next];
+		ix = next;
+	}
+	tbl[ix].dirent = NULL;
+	--parent->fsobj.fsdir->avl.index_count;
+}
+
+static void dir_index_free(mdcache_entry_t *parent)
+{
+	if (parent->fsobj.fsdir->avl.index == NULL)
+		return;
+
+	(void) atomic_sub_uint64_t(&lru_state.dirent_bytes,
+				   ((uint64_t)parent->fsobj.fsdir->avl.index_mask
+				    + 1) *
+				   sizeof(struct mdcache_dir_index_slot));
+	gsh_free(parent->fsobj.fsdir->avl.index);
+	parent->fsobj.fsdir->avl.index = NULL;
+	parent->fsobj.fsdir->avl.index_mask = 0;
+	parent->fsobj.fsdir->avl.index_count = 0;
+}
+
+static mdcache_dir_entry_t *
+dir_index_lookup(mdcache_entry_t *parent, const char *name, uint64_t hash)
+{
+	struct mdcache_dir_index_slot *tbl = parent->fsobj.fsdir->avl.index;
+	uint32_t mask = parent->fsobj.fsdir->avl.index_mask;
+	uint32_t ix = hash & mask;
+
+	for (; tbl[ix].dirent != NULL; ix = (ix + 1) & mask)
+		if (tbl[ix].hash == hash &&
+		    strcmp(name, tbl[ix].dirent->name) == 0)
+			return tbl[ix].dirent;
+
+	return NULL;
 }
 
 static inline struct avltree_node *
@@ -88,15 +273,16 @@ avl_dirent_set_deleted(mdcache_entry_t *entry, mdcache_dir_entry_t *v)
 #endif
 	assert(!(v->flags & DIR_ENTRY_FLAG_DELETED));
 
-	node = avltree_inline_lookup_hk(&v->node_hk, &entry->fsobj.fsdir.avl.t);
+	node = avltree_inline_lookup_hk(&v->node_hk, &entry->fsobj.fsdir->avl.t);
 	assert(node);
-	avltree_remove(&v->node_hk, &entry->fsobj.fsdir.avl.t);
+	avltree_remove(&v->node_hk, &entry->fsobj.fsdir->avl.t);
+	dir_index_del(entry, v);
 
 	v->flags |= DIR_ENTRY_FLAG_DELETED;
-	mdcache_key_delete(&v->ckey);
+	mdcache_dirent_key_delete(v);
 
 	/* save cookie in deleted avl */
-	node = avltree_insert(&v->node_hk, &entry->fsobj.fsdir.avl.c);
+	node = avltree_insert(&v->node_hk, &entry->fsobj.fsdir->avl.c);
 	assert(!node);
 
 	/* Do stuff if chunked... */
@@ -104,7 +290,7 @@ avl_dirent_set_deleted(mdcache_entry_t *entry, mdcache_dir_entry_t *v)
 		struct dir_chunk *chunk = v->chunk;
 		mdcache_entry_t *parent = chunk->parent;
 
-		if (v->ck == parent->fsobj.fsdir.first_ck) {
+		if (v->ck == parent->fsobj.fsdir->first_ck) {
 			/* This is no longer the first entry in the directory...
 			 * Find the first non-deleted entry.
 			 */
@@ -140,10 +326,10 @@ avl_dirent_set_deleted(mdcache_entry_t *entry, mdcache_dir_entry_t *v)
 
 			if (next != NULL) {
 				/* This entry is now the first_ck. */
-				parent->fsobj.fsdir.first_ck = next->ck;
+				parent->fsobj.fsdir->first_ck = next->ck;
 			} else {
 				/* There are no more cached chunks */
-				parent->fsobj.fsdir.first_ck = 0;
+				parent->fsobj.fsdir->first_ck = 0;
 			}
 		}
 
@@ -180,19 +366,19 @@ void unchunk_dirent(mdcache_dir_entry_t *dirent)
 	glist_del(&dirent->chunk_list);
 
 	/* Remove from FSAL cookie AVL tree */
-	avltree_remove(&dirent->node_ck, &parent->fsobj.fsdir.avl.ck);
+	avltree_remove(&dirent->node_ck, &parent->fsobj.fsdir->avl.ck);
 
 	/* Check if this was the first dirent in the directory. */
-	if (parent->fsobj.fsdir.first_ck == dirent->ck) {
+	if (parent->fsobj.fsdir->first_ck == dirent->ck) {
 		/* The first dirent in the directory is no longer chunked... */
-		parent->fsobj.fsdir.first_ck = 0;
+		parent->fsobj.fsdir->first_ck = 0;
 	}
 
 	/* Check if this entry was in the sorted AVL tree */
 	if (dirent->flags & DIR_ENTRY_SORTED) {
 		/* It was, remove it. */
 		avltree_remove(&dirent->node_sorted,
-			       &parent->fsobj.fsdir.avl.sorted);
+			       &parent->fsobj.fsdir->avl.sorted);
 	}
 
 	/* Just make sure... */
@@ -211,10 +397,11 @@ void mdcache_avl_remove(mdcache_entry_t *parent,
 {
 	if (dirent->flags & DIR_ENTRY_FLAG_DELETED) {
 		/* Remove from deleted names tree */
-		avltree_remove(&dirent->node_hk, &parent->fsobj.fsdir.avl.c);
+		avltree_remove(&dirent->node_hk, &parent->fsobj.fsdir->avl.c);
 	} else {
 		/* Remove from active names tree */
-		avltree_remove(&dirent->node_hk, &parent->fsobj.fsdir.avl.t);
+		avltree_remove(&dirent->node_hk, &parent->fsobj.fsdir->avl.t);
+		dir_index_del(parent, dirent);
 	}
 
 	if (dirent->chunk != NULL) {
@@ -226,9 +413,9 @@ void mdcache_avl_remove(mdcache_entry_t *parent,
 	}
 
 	if (dirent->ckey.kv.len)
-		mdcache_key_delete(&dirent->ckey);
+		mdcache_dirent_key_delete(dirent);
 
-	gsh_free(dirent);
+	mdcache_free_dirent(dirent);
 }
 
 /**
@@ -252,8 +439,8 @@ mdcache_avl_insert_impl(mdcache_entry_t *entry, mdcache_dir_entry_t *v,
 	int code = -1;
 	struct avltree_node *node;
 	mdcache_dir_entry_t *v2;
-	struct avltree *t = &entry->fsobj.fsdir.avl.t;
-	struct avltree *c = &entry->fsobj.fsdir.avl.c;
+	struct avltree *t = &entry->fsobj.fsdir->avl.t;
+	struct avltree *c = &entry->fsobj.fsdir->avl.c;
 
 	LogFullDebug(COMPONENT_CACHE_INODE,
 		     "Insert dir entry %p %s j=%d j2=%d",
@@ -290,14 +477,15 @@ mdcache_avl_insert_impl(mdcache_entry_t *entry, mdcache_dir_entry_t *v,
 
 	if (!node) {
 		/* success, note iterations */
+		dir_index_add(entry, v);
 		v->hk.p = j + j2;
-		if (entry->fsobj.fsdir.avl.collisions < v->hk.p)
-			entry->fsobj.fsdir.avl.collisions = v->hk.p;
+		if (entry->fsobj.fsdir->avl.collisions < v->hk.p)
+			entry->fsobj.fsdir->avl.collisions = v->hk.p;
 
 		LogDebug(COMPONENT_CACHE_INODE,
 			 "inserted new dirent for %s on entry=%p cookie=%"
 			 PRIu64 " collisions %d", v->name, entry, v->hk.k,
-			 entry->fsobj.fsdir.avl.collisions);
+			 entry->fsobj.fsdir->avl.collisions);
 		code = 0;
 	} else {
 		v2 = avltree_container_of(node, mdcache_dir_entry_t, node_hk);
@@ -342,7 +530,7 @@ int mdcache_avl_insert_ck(mdcache_entry_t *entry, mdcache_dir_entry_t *v)
 #ifdef DEBUG_MDCACHE
 	assert(entry->content_lock.__data.__writer);
 #endif
-	node = avltree_inline_insert(&v->node_ck, &entry->fsobj.fsdir.avl.ck,
+	node = avltree_inline_insert(&v->node_ck, &entry->fsobj.fsdir->avl.ck,
 				     avl_dirent_ck_cmpf);
 
 	if (!node) {
@@ -394,10 +582,6 @@ int
 mdcache_avl_qp_insert(mdcache_entry_t *entry, mdcache_dir_entry_t **dirent)
 {
 	mdcache_dir_entry_t *v = *dirent, *v2;
-
-#if AVL_HASH_MURMUR3
-	uint32_t hk[4];
-#endif
 	int j, j2, code = -1;
 
 	LogFullDebug(COMPONENT_CACHE_INODE,
@@ -407,19 +591,7 @@ mdcache_avl_qp_insert(mdcache_entry_t *entry, mdcache_dir_entry_t **dirent)
 	assert(entry->content_lock.__data.__writer);
 #endif
 	/* don't permit illegal cookies */
-#if AVL_HASH_MURMUR3
-	MurmurHash3_x64_128(v->name, strlen(v->name), 67, hk);
-	memcpy(&v->hk.k, hk, 8);
-#else
-	v->hk.k = CityHash64WithSeed(v->name, strlen(v->name), 67);
-#endif
-
-#ifdef _USE_9P
-	/* tmp hook : it seems like client running v9fs dislike "negative"
-	 * cookies just kill the sign bit, making
-	 * cookies 63 bits... */
-	v->hk.k &= ~(1ULL << 63);
-#endif
+	v->hk.k = mdcache_avl_name_hash(v->name);
 
 	/* XXX would we really wait for UINT64_MAX?  if not, how many
 	 * probes should we attempt? */
@@ -448,7 +620,8 @@ again:
 					 */
 					avltree_remove(&v->node_hk,
 						       &entry
-							   ->fsobj.fsdir.avl.t);
+							   ->fsobj.fsdir->avl.t);
+					dir_index_del(entry, v);
 					v2 = NULL;
 					goto out;
 				}
@@ -610,8 +783,8 @@ again:
 
 out:
 
-	mdcache_key_delete(&v->ckey);
-	gsh_free(v);
+	mdcache_dirent_key_delete(v);
+	mdcache_free_dirent(v);
 	*dirent = v2;
 
 	return code;
@@ -638,8 +811,8 @@ enum mdcache_avl_err
 mdcache_avl_lookup_k(mdcache_entry_t *entry, uint64_t k, uint32_t flags,
 		     mdcache_dir_entry_t **dirent)
 {
-	struct avltree *t = &entry->fsobj.fsdir.avl.t;
-	struct avltree *c = &entry->fsobj.fsdir.avl.c;
+	struct avltree *t = &entry->fsobj.fsdir->avl.t;
+	struct avltree *c = &entry->fsobj.fsdir->avl.c;
 	mdcache_dir_entry_t dirent_key[1];
 	struct avltree_node *node, *node2;
 
@@ -703,7 +876,7 @@ done:
 bool mdcache_avl_lookup_ck(mdcache_entry_t *entry, uint64_t ck,
 			   mdcache_dir_entry_t **dirent)
 {
-	struct avltree *tck = &entry->fsobj.fsdir.avl.ck;
+	struct avltree *tck = &entry->fsobj.fsdir->avl.ck;
 	mdcache_dir_entry_t dirent_key[1];
 	mdcache_dir_entry_t *ent;
 	struct avltree_node *node;
@@ -739,33 +912,27 @@ bool mdcache_avl_lookup_ck(mdcache_entry_t *entry, uint64_t ck,
 mdcache_dir_entry_t *
 mdcache_avl_qp_lookup_s(mdcache_entry_t *entry, const char *name, int maxj)
 {
-	struct avltree *t = &entry->fsobj.fsdir.avl.t;
+	struct avltree *t = &entry->fsobj.fsdir->avl.t;
 	struct avltree_node *node;
 	mdcache_dir_entry_t *v2;
-#if AVL_HASH_MURMUR3
-	uint32_t hashbuff[4];
-#endif
 	int j;
-	size_t namelen = strlen(name);
 	mdcache_dir_entry_t v;
 
 	LogFullDebug(COMPONENT_CACHE_INODE, "Lookup %s", name);
 
-#if AVL_HASH_MURMUR3
-	MurmurHash3_x64_128(name, namelen, 67, hashbuff);
-	/* This seems to be correct.  The avltree_lookup function looks
-	   as hk.k, but does no namecmp on its own, so there's no need to
-	   allocate space for or copy the name in the key. */
-	memcpy(&v.hk.k, hashbuff, 8);
-#else
-	v.hk.k = CityHash64WithSeed(name, namelen, 67);
-#endif
-
-#ifdef _USE_9P
-	/* tmp hook : it seems like client running v9fs dislike "negative"
-	 * cookies */
-	v.hk.k &= ~(1ULL << 63);
-#endif
+	/* The avltree_lookup function looks at hk.k, but does no namecmp on
+	 * its own, so there's no need to allocate space for or copy the name
+	 * in the key.
+	 */
+	v.hk.k = mdcache_avl_name_hash(name);
+
+	/* The index holds every active dirent, whatever its probe count */
+	if (entry->fsobj.fsdir->avl.index != NULL) {
+		v2 = dir_index_lookup(entry, name, v.hk.k);
+		if (v2 != NULL)
+			assert(!(v2->flags & DIR_ENTRY_FLAG_DELETED));
+		return v2;
+	}
 
 	for (j = 0; j < maxj; j++) {
 		v.hk.k = (v.hk.k + (j * 2));
@@ -801,7 +968,10 @@ void mdcache_avl_clean_trees(mdcache_entry_t *parent)
 	assert(parent->content_lock.__data.__writer);
 #endif
 
-	while ((dirent_node = avltree_first(&parent->fsobj.fsdir.avl.t))) {
+	/* Everything is going, no point keeping the index in step */
+	dir_index_free(parent);
+
+	while ((dirent_node = avltree_first(&parent->fsobj.fsdir->avl.t))) {
 		dirent = avltree_container_of(dirent_node, mdcache_dir_entry_t,
 					      node_hk);
 		LogFullDebug(COMPONENT_CACHE_INODE, "Invalidate %p %s",
@@ -810,7 +980,7 @@ void mdcache_avl_clean_trees(mdcache_entry_t *parent)
 		mdcache_avl_remove(parent, dirent);
 	}
 
-	while ((dirent_node = avltree_first(&parent->fsobj.fsdir.avl.c))) {
+	while ((dirent_node = avltree_first(&parent->fsobj.fsdir->avl.c))) {
 		dirent = avltree_container_of(dirent_node, mdcache_dir_entry_t,
 					      node_hk);
 		LogFullDebug(COMPONENT_CACHE_INODE, "Invalidate %p %s",
@@ -42,6 +42,16 @@
  * @brief Structure to hold MDCACHE paramaters
  */
 
+/**
+ * @brief Entry eviction policies, selected with LRU_Policy
+ */
+enum mdcache_lru_policy {
+	/** Plain two-level LRU */
+	MDCACHE_LRU_POLICY_LRU,
+	/** LRU with victims filtered by a TinyLFU frequency sketch */
+	MDCACHE_LRU_POLICY_TINYLFU
+};
+
 struct mdcache_parameter {
 	/** Partitions in the Cache_Inode tree.  Defaults to 7,
 	 * settable with NParts. */
@@ -52,6 +62,29 @@ struct mdcache_parameter {
 	/** Use getattr for directory invalidation.  Defaults to
 	    false.  Settable with Use_Getattr_Directory_Invalidation. */
 	bool getattr_dir_invalidation;
+	/** Let each entry stretch or shrink its attribute lifetime
+	    between attr_ttl_min and attr_ttl_max based on whether its
+	    attributes changed when revalidated.  Defaults to false,
+	    settable with Attr_TTL_Adaptive. */
+	bool attr_ttl_adaptive;
+	/** Shortest adaptive attribute lifetime in seconds.  Defaults
+	    to 3, settable with Attr_TTL_Min. */
+	uint32_t attr_ttl_min;
+	/** Longest adaptive attribute lifetime in seconds.  Defaults
+	    to 60, settable with Attr_TTL_Max. */
+	uint32_t attr_ttl_max;
+	/** Access decisions remembered per entry, one per credential
+	    and requested mask, 0 (the default) for none.  Settable with
+	    Access_Cache_Size. */
+	uint32_t access_max;
+	/** Extended attribute values up to this size in bytes are
+	    cached with their entry, 0 (the default) for none.  Settable
+	    with Xattr_Cache_Size. */
+	uint32_t xattr_max_size;
+	/** Limit in bytes on the extended attributes cached across all
+	    entries.  Defaults to 16MiB, settable with
+	    Xattr_Cache_Memory. */
+	uint64_t xattr_memory;
 	struct {
 		/** Max size of per-directory cache of removed
 		    entries */
@@ -70,13 +103,58 @@ struct mdcache_parameter {
 		uint32_t avl_detached_mult;
 		/** Computed max detached dirents */
 		uint32_t avl_detached_max;
+		/** Chunks to populate in the background ahead of a
+		    chunked readdir, 0 for none */
+		uint32_t avl_chunk_readahead;
+		/** Leave entries for chunked readdir results to be created
+		    on first use */
+		bool lazy_entries;
+		/** Names per directory remembered as absent after a
+		    failed lookup, 0 for none */
+		uint32_t neg_max;
 	} dir;
+	struct {
+		/** Windows to read ahead of a sequential reader, 0 (the
+		    default) for none.  Settable with Read_Ahead_Windows. */
+		uint32_t ra_windows;
+		/** Size in bytes of each read-ahead window.  Defaults to
+		    1MiB, settable with Read_Ahead_Window_Size. */
+		uint32_t ra_window_size;
+		/** Limit in bytes on the memory held by read-ahead windows
+		    across all files.  Defaults to 256MiB, settable with
+		    Read_Ahead_Memory. */
+		uint64_t ra_memory;
+		/** Size in bytes of the buffer unstable writes to a file
+		    are gathered in, 0 (the default) to write each one
+		    through.  Settable with Write_Behind_Size. */
+		uint32_t wb_size;
+		/** Limit in bytes on the memory held by write-behind
+		    buffers across all files.  Defaults to 256MiB, settable
+		    with Write_Behind_Memory. */
+		uint64_t wb_memory;
+		/** Files up to this size in bytes have their whole
+		    content cached, 0 (the default) for none.  Settable
+		    with Small_File_Cache_Size. */
+		uint32_t sc_max_size;
+		/** Limit in bytes on the file content cached across all
+		    files.  Defaults to 64MiB, settable with
+		    Small_File_Cache_Memory. */
+		uint64_t sc_memory;
+	} file;
 	/** High water mark for cache entries.  Defaults to 100000,
 	    settable by Entries_HWMark. */
 	uint32_t entries_hwmark;
 	/** High water mark for chunks.  Defaults to 100000,
 	    settable by Chunks_HWMark. */
 	uint32_t chunks_hwmark;
+	/** Limit in bytes on the memory held by cache entries, dirent
+	    chunks and dirents, enforced by the LRU thread.  0 (the
+	    default) leaves only the count-based high water marks.
+	    Settable by Cache_Memory_Limit. */
+	uint64_t cache_memory_limit;
+	/** Entry eviction policy, an enum mdcache_lru_policy.  Defaults
+	    to LRU, settable by LRU_Policy. */
+	uint32_t lru_policy;
 	/** Base interval in seconds between runs of the LRU cleaner
 	    thread. Defaults to 60, settable with LRU_Run_Interval. */
 	time_t lru_run_interval;
@@ -97,6 +175,14 @@ struct mdcache_parameter {
 	    descriptonot reap file descriptors.  Defaults to 50,
 	    settable with FD_LWMark_Percent. */
 	uint32_t fd_lwmark_percent;
+	/** Track open global file descriptors on their own LRU and close
+	    them from it, rather than by walking the entry LRU.  Defaults
+	    to false, settable with Use_FD_LRU. */
+	bool use_fd_lru;
+	/** With Use_FD_LRU, seconds after which an unused descriptor is
+	    closed even below the high water mark, 0 for never.  Defaults
+	    to 0, settable with FD_Idle_Timeout. */
+	uint32_t fd_idle_timeout;
 	/** Roughly, the amount of work to do on each pass through the
 	    thread under normal conditions.  (Ideally, a multiple of
 	    the number of lanes.)  Defaults to 1000, settable with
@@ -105,6 +191,10 @@ struct mdcache_parameter {
 	/** The amount of work for the reaper thread to do per-lane
 	    under normal conditions. Settable with Repaper_Work_Per_Thread */
 	uint32_t reaper_work_per_lane;
+	/** Threads the LRU threads spread each pass over the lanes on,
+	    1 (the default) to walk the lanes in the LRU thread itself.
+	    Settable with Reaper_Threads. */
+	uint32_t reaper_threads;
 	/** The largest window (as a percentage of the system-imposed
 	    limit on FDs) of work that we will do in extremis.
 	    Defaults to 40, settable with Biggest_Window */
@@ -122,6 +212,19 @@ struct mdcache_parameter {
 	    client a partial reply based on what we have.
 	    Defaults to false, settable with Retry_Readdir */
 	bool retry_readdir;
+	/** File the hot set of entries is saved to and reloaded from
+	    across restarts, NULL (the default) for none.  Settable with
+	    Warm_Start_File. */
+	char *warm_start_file;
+	/** Most entries saved in the snapshot.  Defaults to 10000,
+	    settable with Warm_Start_Entries. */
+	uint32_t warm_start_entries;
+	/** Seconds between snapshots, 0 for shutdown only.  Defaults
+	    to 300, settable with Warm_Start_Interval. */
+	uint32_t warm_start_interval;
+	/** Threads instantiating snapshot entries at startup.
+	    Defaults to 4, settable with Warm_Start_Threads. */
+	uint32_t warm_start_threads;
 };
 
 extern struct mdcache_parameter mdcache_param;
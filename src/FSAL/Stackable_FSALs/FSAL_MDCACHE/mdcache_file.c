@@ -32,33 +32,38 @@
 #include "fsal_convert.h"
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/param.h>
 #include "FSAL/fsal_commonlib.h"
+#include "nfs_core.h"
 #include "mdcache_int.h"
 #include "mdcache_lru.h"
 #include "mdcache.h"
+#include "fridgethr.h"
+#include "export_mgr.h"
+#include "iobuf_pool.h"
+#include "sal_functions.h"
 
 /**
  *
  * @brief Set a timestamp to the current time
  *
- * @param[out] time Pointer to time to be set
+ * @param[in,out] attrs Cached attributes
+ * @param[in]     which Time to be set
  *
  * @return true on success, false on failure
  *
  */
 bool
-mdc_set_time_current(struct timespec *time)
+mdc_set_time_current(struct mdcache_attrs *attrs,
+		     enum mdcache_attr_time which)
 {
 	struct timeval t;
 
-	if (time == NULL)
-		return false;
-
 	if (gettimeofday(&t, NULL) != 0)
 		return false;
 
-	time->tv_sec = t.tv_sec;
-	time->tv_nsec = 1000 * t.tv_usec;
+	attrs->sec[which] = t.tv_sec;
+	attrs->nsec[which] = 1000 * t.tv_usec;
 
 	return true;
 }
@@ -92,6 +97,8 @@ fsal_status_t mdcache_open(struct fsal_obj_handle *obj_hdl,
 
 	if (FSAL_IS_ERROR(status) && (status.major == ERR_FSAL_STALE))
 		mdcache_kill_entry(entry);
+	else if (!FSAL_IS_ERROR(status))
+		mdcache_lru_fd_bump(entry);
 
 	return status;
 }
@@ -174,7 +181,7 @@ fsal_status_t mdcache_read(struct fsal_obj_handle *obj_hdl, uint64_t offset,
 	       );
 
 	if (!FSAL_IS_ERROR(status))
-		mdc_set_time_current(&entry->attrs.atime);
+		mdc_set_time_current(&entry->attrs, MDC_ATIME);
 	else if (status.major == ERR_FSAL_DELAY)
 		mdcache_kill_entry(entry);
 
@@ -211,7 +218,7 @@ fsal_status_t mdcache_read_plus(struct fsal_obj_handle *obj_hdl,
 	       );
 
 	if (!FSAL_IS_ERROR(status))
-		mdc_set_time_current(&entry->attrs.atime);
+		mdc_set_time_current(&entry->attrs, MDC_ATIME);
 	else if (status.major == ERR_FSAL_DELAY)
 		mdcache_kill_entry(entry);
 
@@ -438,6 +445,7 @@ fsal_status_t mdcache_close(struct fsal_obj_handle *obj_hdl)
 	fsal_status_t status;
 
 	/* XXX dang caching FDs?  How does it interact with multi-FD */
+	mdcache_lru_fd_remove(entry);
 	subcall(
 		status = entry->sub_handle->obj_ops.close(entry->sub_handle)
 	       );
@@ -494,6 +502,10 @@ static fsal_status_t mdc_open2_by_name(mdcache_entry_t *mdc_parent,
 
 	} /* else UNGUARDED, go ahead and open the file. */
 
+	/* Gathered data must not land after the truncate */
+	if (openflags & FSAL_O_TRUNC)
+		mdcache_file_wb_flush(entry, 0, UINT64_MAX);
+
 	subcall(
 		status = entry->sub_handle->obj_ops.open2(
 			entry->sub_handle, state, openflags, createmode,
@@ -639,6 +651,7 @@ fsal_status_t mdcache_open2(struct fsal_obj_handle *obj_hdl,
 				 */
 				atomic_clear_uint32_t_bits(
 				    &new_entry->mde_flags, MDCACHE_TRUST_ATTRS);
+				mdcache_file_ra_invalidate(new_entry);
 			}
 
 			return status;
@@ -662,6 +675,9 @@ fsal_status_t mdcache_open2(struct fsal_obj_handle *obj_hdl,
 				   fs_supported_attrs(op_ctx->fsal_export)
 				& ~ATTR_ACL) | ATTR_RDATTR_ERR);
 
+	if (!name && (openflags & FSAL_O_TRUNC))
+		mdcache_file_wb_flush(mdc_parent, 0, UINT64_MAX);
+
 	subcall(
 		status = mdc_parent->sub_handle->obj_ops.open2(
 			mdc_parent->sub_handle, state, openflags, createmode,
@@ -692,6 +708,7 @@ fsal_status_t mdcache_open2(struct fsal_obj_handle *obj_hdl,
 			 */
 			atomic_clear_uint32_t_bits(&mdc_parent->mde_flags,
 						   MDCACHE_TRUST_ATTRS);
+			mdcache_file_ra_invalidate(mdc_parent);
 		}
 
 		LogFullDebug(COMPONENT_CACHE_INODE,
@@ -797,6 +814,9 @@ fsal_status_t mdcache_reopen2(struct fsal_obj_handle *obj_hdl,
 	fsal_status_t status;
 	bool truncated = openflags & FSAL_O_TRUNC;
 
+	if (truncated)
+		mdcache_file_wb_flush(entry, 0, UINT64_MAX);
+
 	subcall(
 		status = entry->sub_handle->obj_ops.reopen2(
 			entry->sub_handle, state, openflags)
@@ -808,240 +828,1899 @@ fsal_status_t mdcache_reopen2(struct fsal_obj_handle *obj_hdl,
 	if (truncated && !FSAL_IS_ERROR(status)) {
 		atomic_clear_uint32_t_bits(&entry->mde_flags,
 					   MDCACHE_TRUST_ATTRS);
+		mdcache_file_ra_invalidate(entry);
 	}
 
 	return status;
 }
 
+/*
+ * Read-ahead of sequential readers
+ *
+ * Reads of a regular file are sorted into streams, one per open state
+ * (NFSv3 and other stateless readers share the NULL state and are told
+ * apart by offset).  Once a stream has made MDC_RA_TRIGGER back to back
+ * reads, Read_Ahead_Windows windows of Read_Ahead_Window_Size bytes
+ * past it are read from the sub-FSAL on the read-ahead threads, and
+ * reads falling in them are copied out of memory.  A reader landing in
+ * a window that is still being filled waits for it.
+ *
+ * Windows are released once they have been read through, when the slot
+ * is needed for a window further on, and whenever the file may have
+ * changed under them (writes, copies and clones into the file, size
+ * changing setattrs, truncating opens and upcall invalidates).  Bytes
+ * read ahead but released unread are counted as waste.  All windows
+ * together are held to Read_Ahead_Memory bytes.
+ */
+
 /**
- * @brief Read from a file (new style)
+ * @brief Fridge for background file read-ahead
+ */
+static struct fridgethr *file_ra_fridge;
+
+/**
+ * @brief A window fill queued for the read-ahead threads
+ */
+struct mdc_ra_job {
+	mdcache_entry_t *entry;		/*< File to read, ref'd */
+	struct gsh_export *export;	/*< Export to read through, ref'd */
+	struct mdc_ra_window *w;	/*< Window to fill */
+};
+
+static inline bool mdc_ra_enabled(struct fsal_obj_handle *obj_hdl,
+				  struct io_info *info)
+{
+	return file_ra_fridge != NULL && mdcache_param.file.ra_windows != 0 &&
+	       info == NULL && obj_hdl->type == REGULAR_FILE;
+}
+
+/**
+ * @brief Get the read-ahead part of a file, allocating it if needed
  *
- * Delegate to sub-FSAL
+ * @param[in] entry  The file
  *
- * @param[in] obj_hdl	Object owning state
- * @param[in] bypass	Bypass deny read
- * @param[in] state	Open file state to read
- * @param[in] offset	Offset into file
- * @param[in] buf_size	Size of read buffer
- * @param[in,out] buffer	Buffer to read into
- * @param[out] read_amount	Amount read in bytes
- * @param[out] eof	true if End of File was hit
- * @param[in] info	io_info for READ_PLUS
- * @return FSAL status
+ * @return The read-ahead part.
  */
-fsal_status_t mdcache_read2(struct fsal_obj_handle *obj_hdl,
-			   bool bypass,
-			   struct state_t *state,
-			   uint64_t offset,
-			   size_t buf_size,
-			   void *buffer,
-			   size_t *read_amount,
-			   bool *eof,
-			   struct io_info *info)
+static struct mdcache_file_ra *mdc_ra_get(mdcache_entry_t *entry)
 {
-	mdcache_entry_t *entry =
-		container_of(obj_hdl, mdcache_entry_t, obj_handle);
-	fsal_status_t status;
+	struct mdcache_file_ra *ra;
 
-	subcall(
-		status = entry->sub_handle->obj_ops.read2(
-			entry->sub_handle, bypass, state, offset, buf_size,
-			buffer, read_amount, eof, info)
-	       );
+	ra = atomic_fetch_voidptr((void **)&entry->fsobj.ra);
+	if (ra != NULL)
+		return ra;
 
-	if (!FSAL_IS_ERROR(status))
-		mdc_set_time_current(&entry->attrs.atime);
-	else if (status.major == ERR_FSAL_DELAY)
-		mdcache_kill_entry(entry);
+	PTHREAD_RWLOCK_wrlock(&entry->attr_lock);
 
-	return status;
+	ra = entry->fsobj.ra;
+	if (ra == NULL) {
+		ra = gsh_calloc(1, sizeof(*ra));
+		PTHREAD_MUTEX_init(&ra->mtx, NULL);
+		PTHREAD_COND_init(&ra->cv, NULL);
+		atomic_store_voidptr((void **)&entry->fsobj.ra, ra);
+	}
+
+	PTHREAD_RWLOCK_unlock(&entry->attr_lock);
+
+	return ra;
 }
 
 /**
- * @brief Write to a file (new style)
+ * @brief Release a window's buffer and free its slot
  *
- * Delegate to sub-FSAL
+ * Called with the read-ahead mtx held.
  *
- * @param[in] obj_hdl	Object owning state
- * @param[in] bypass	Bypass any non-mandatory deny write
- * @param[in] state	Open file state to write
- * @param[in] offset	Offset into file
- * @param[in] buf_size	Size of write buffer
- * @param[in] buffer	Buffer to write from
- * @param[out] write_amount	Amount written in bytes
- * @param[out] fsal_stable	true if write was to stable storage
- * @param[in] info	io_info for WRITE_PLUS
- * @return FSAL status
+ * @param[in] w       The window
+ * @param[in] unread  Bytes read ahead into it that were never served
  */
-fsal_status_t mdcache_write2(struct fsal_obj_handle *obj_hdl,
-			     bool bypass,
-			     struct state_t *state,
-			     uint64_t offset,
-			     size_t buf_size,
-			     void *buffer,
-			     size_t *write_amount,
-			     bool *fsal_stable,
-			     struct io_info *info)
+static void mdc_ra_release(struct mdc_ra_window *w, size_t unread)
 {
-	mdcache_entry_t *entry =
-		container_of(obj_hdl, mdcache_entry_t, obj_handle);
-	fsal_status_t status;
+	if (unread != 0)
+		(void) atomic_add_uint64_t(&cache_stp->ra_waste_bytes, unread);
+
+	iobuf_put(w->buf);
+	(void) atomic_sub_uint64_t(&cache_stp->ra_bytes,
+				   mdcache_param.file.ra_window_size);
+	w->buf = NULL;
+	w->state = MDC_RA_EMPTY;
+}
 
-	subcall(
-		status = entry->sub_handle->obj_ops.write2(
-			entry->sub_handle, bypass, state, offset, buf_size,
-			buffer, write_amount, fsal_stable, info)
-	       );
+static inline size_t mdc_ra_unread(struct mdc_ra_window *w)
+{
+	return w->len > w->used ? w->len - w->used : 0;
+}
 
-	if (status.major == ERR_FSAL_STALE)
-		mdcache_kill_entry(entry);
-	else
-		atomic_clear_uint32_t_bits(&entry->mde_flags,
-					   MDCACHE_TRUST_ATTRS);
+/**
+ * @brief Find the current window holding an offset
+ *
+ * A READY window at end of file also holds the offset just past its
+ * data.  Windows left over from before the last invalidate are skipped.
+ * Called with the read-ahead mtx held.
+ */
+static struct mdc_ra_window *mdc_ra_find(struct mdcache_file_ra *ra,
+					 uint64_t offset)
+{
+	uint64_t wsize = mdcache_param.file.ra_window_size;
+	int i;
+
+	for (i = 0; i < MDC_RA_MAX_WINDOWS; i++) {
+		struct mdc_ra_window *w = &ra->windows[i];
+
+		if (w->state == MDC_RA_EMPTY || w->gen != ra->gen ||
+		    offset < w->offset)
+			continue;
+
+		if (w->state == MDC_RA_PENDING) {
+			if (offset < w->offset + wsize)
+				return w;
+		} else if (offset < w->offset + w->len ||
+			   (w->eof && offset == w->offset + w->len)) {
+			return w;
+		}
+	}
 
-	return status;
+	return NULL;
 }
 
 /**
- * @brief Seek within a file (new style)
+ * @brief Find a slot for a new window
  *
- * Delegate to sub-FSAL
+ * Free slots are taken first, then READY windows lying wholly behind
+ * the reader.  Called with the read-ahead mtx held.
  *
- * @param[in] obj_hdl	Object owning state
- * @param[in] state	Open file state to seek within
- * @param[in] info	io_info for seek
- * @return FSAL status
+ * @param[in] ra      Read-ahead part of the file
+ * @param[in] behind  Offset the reader has reached
  */
-fsal_status_t mdcache_seek2(struct fsal_obj_handle *obj_hdl,
-			    struct state_t *state,
-			    struct io_info *info)
+static struct mdc_ra_window *mdc_ra_slot(struct mdcache_file_ra *ra,
+					 uint64_t behind)
 {
-	mdcache_entry_t *entry =
-		container_of(obj_hdl, mdcache_entry_t, obj_handle);
-	fsal_status_t status;
+	struct mdc_ra_window *stale = NULL;
+	unsigned int i;
 
-	subcall(
-		status = entry->sub_handle->obj_ops.seek2(
-			entry->sub_handle, state, info)
-	       );
+	for (i = 0; i < mdcache_param.file.ra_windows; i++) {
+		struct mdc_ra_window *w = &ra->windows[i];
 
-	if (status.major == ERR_FSAL_DELAY)
-		mdcache_kill_entry(entry);
+		if (w->state == MDC_RA_EMPTY)
+			return w;
 
-	return status;
+		if (stale == NULL && w->state == MDC_RA_READY &&
+		    w->offset + w->len <= behind)
+			stale = w;
+	}
+
+	if (stale != NULL)
+		mdc_ra_release(stale, mdc_ra_unread(stale));
+
+	return stale;
 }
 
 /**
- * @brief Advise access pattern for a file (new style)
+ * @brief Note a read in its stream and pick windows to read ahead
  *
- * Delegate to sub-FSAL
+ * Called with the read-ahead mtx held.  The jobs returned must be
+ * handed to mdc_ra_submit() once the mtx is dropped.
  *
- * @param[in] obj_hdl	Object owning state
- * @param[in] state	Open file state to advise on
- * @param[in] hints	io_hints containing advice
- * @return FSAL status
+ * @param[in]  entry   The file
+ * @param[in]  ra      Read-ahead part of the file
+ * @param[in]  owner   State read through
+ * @param[in]  offset  Offset read at
+ * @param[in]  amount  Bytes read
+ * @param[in]  eof     The read reached end of file
+ * @param[out] jobs    Windows to fill
+ * @param[out] seq     Set if the read continued a stream
+ *
+ * @return Number of jobs.
  */
-fsal_status_t mdcache_io_advise2(struct fsal_obj_handle *obj_hdl,
-				 struct state_t *state,
-				 struct io_hints *hints)
+static int mdc_ra_track(mdcache_entry_t *entry, struct mdcache_file_ra *ra,
+			const void *owner, uint64_t offset, size_t amount,
+			bool eof, struct mdc_ra_job **jobs, bool *seq)
 {
-	mdcache_entry_t *entry =
-		container_of(obj_hdl, mdcache_entry_t, obj_handle);
-	fsal_status_t status;
+	uint64_t wsize = mdcache_param.file.ra_window_size;
+	struct mdc_ra_stream *s = NULL;
+	struct mdc_ra_window *w;
+	uint64_t limit;
+	int i, n = 0;
+
+	/* Requests of one stream may be reordered on their way in, so a
+	 * read within a window of where the stream got to continues it.
+	 */
+	for (i = 0; i < MDC_RA_STREAMS; i++) {
+		struct mdc_ra_stream *t = &ra->streams[i];
+
+		if (t->seq != 0 && t->owner == owner &&
+		    offset + wsize >= t->next_off &&
+		    offset <= t->next_off + wsize) {
+			s = t;
+			break;
+		}
 
-	subcall(
-		status = entry->sub_handle->obj_ops.io_advise2(
-			entry->sub_handle, state, hints)
-	       );
+		if (s == NULL || t->tick < s->tick)
+			s = t;
+	}
 
-	if (status.major == ERR_FSAL_DELAY)
-		mdcache_kill_entry(entry);
+	*seq = i < MDC_RA_STREAMS;
+	if (!*seq) {
+		s->owner = owner;
+		s->next_off = 0;
+		s->ra_next = 0;
+		s->seq = 0;
+	}
 
-	return status;
+	s->tick = ++ra->tick;
+	if (s->seq < UINT32_MAX)
+		s->seq++;
+	s->next_off = MAX(s->next_off, offset + amount);
+
+	if (eof || s->seq < MDC_RA_TRIGGER)
+		return 0;
+
+	if (s->ra_next < s->next_off)
+		s->ra_next = s->next_off;
+
+	limit = s->next_off + wsize * mdcache_param.file.ra_windows;
+
+	/* Don't read past a size we trust; this is only a hint, a window
+	 * beyond end of file just comes back empty.
+	 */
+	if (test_mde_flags(entry, MDCACHE_TRUST_ATTRS) &&
+	    limit > entry->attrs.filesize)
+		limit = entry->attrs.filesize;
+
+	while (s->ra_next < limit) {
+		w = mdc_ra_find(ra, s->ra_next);
+		if (w != NULL) {
+			/* Another stream over the same data has it */
+			s->ra_next = w->offset + wsize;
+			continue;
+		}
+
+		w = mdc_ra_slot(ra, s->next_off);
+		if (w == NULL)
+			break;
+
+		if (atomic_add_uint64_t(&cache_stp->ra_bytes, wsize) >
+		    mdcache_param.file.ra_memory) {
+			(void) atomic_sub_uint64_t(&cache_stp->ra_bytes, wsize);
+			break;
+		}
+
+		w->offset = s->ra_next;
+		w->len = 0;
+		w->used = 0;
+		w->eof = false;
+		w->gen = ra->gen;
+		w->buf = iobuf_get(wsize);
+		w->state = MDC_RA_PENDING;
+
+		jobs[n] = gsh_malloc(sizeof(struct mdc_ra_job));
+		jobs[n]->entry = entry;
+		jobs[n]->w = w;
+		n++;
+
+		s->ra_next += wsize;
+	}
+
+	return n;
 }
 
 /**
- * @brief Commit to a file (new style)
+ * @brief Fill a read-ahead window
  *
- * Delegate to sub-FSAL
+ * The read is made with no state, as an NFSv3 read would be, and is
+ * subject to share reservations the same way.  Data read before an
+ * invalidate that happened while the read was out is thrown away.
  *
- * @param[in] obj_hdl	Object to commit
- * @param[in] offset	Offset into file
- * @param[in] len	Length of commit
- * @return FSAL status
+ * @param[in] ctx  Thread context, arg is the struct mdc_ra_job
  */
-fsal_status_t mdcache_commit2(struct fsal_obj_handle *obj_hdl, off_t offset,
-			      size_t len)
+static void mdc_ra_run(struct fridgethr_context *ctx)
 {
-	mdcache_entry_t *entry =
-		container_of(obj_hdl, mdcache_entry_t, obj_handle);
+	struct mdc_ra_job *job = ctx->arg;
+	mdcache_entry_t *entry = job->entry;
+	struct mdcache_file_ra *ra = entry->fsobj.ra;
+	struct mdc_ra_window *w = job->w;
+	struct root_op_context root_op_context;
 	fsal_status_t status;
+	size_t amount = 0;
+	bool eof = false;
+
+	init_root_op_context(&root_op_context, job->export,
+			     job->export->fsal_export, 0, 0, UNKNOWN_REQUEST);
+
+	mdcache_file_wb_flush(entry, w->offset,
+			      mdcache_param.file.ra_window_size);
 
 	subcall(
-		status = entry->sub_handle->obj_ops.commit2(
-			entry->sub_handle, offset, len)
+		status = entry->sub_handle->obj_ops.read2(
+			entry->sub_handle, false, NULL, w->offset,
+			mdcache_param.file.ra_window_size, w->buf, &amount,
+			&eof, NULL)
 	       );
 
-	if (status.major == ERR_FSAL_STALE)
-		mdcache_kill_entry(entry);
-	else
-		atomic_clear_uint32_t_bits(&entry->mde_flags,
-					   MDCACHE_TRUST_ATTRS);
+	release_root_op_context();
 
-	return status;
+	PTHREAD_MUTEX_lock(&ra->mtx);
+
+	if (FSAL_IS_ERROR(status)) {
+		LogDebug(COMPONENT_CACHE_INODE,
+			 "Read-ahead of %p at %"PRIu64" failed status=%s",
+			 entry, w->offset, fsal_err_txt(status));
+		mdc_ra_release(w, 0);
+	} else {
+		(void) atomic_add_uint64_t(&cache_stp->ra_fill_bytes, amount);
+		w->len = amount;
+		w->eof = eof;
+		w->state = MDC_RA_READY;
+		if (w->gen != ra->gen)
+			mdc_ra_release(w, amount);
+	}
+
+	pthread_cond_broadcast(&ra->cv);
+	PTHREAD_MUTEX_unlock(&ra->mtx);
+
+	put_gsh_export(job->export);
+	mdcache_put(entry);
+	gsh_free(job);
 }
 
 /**
- * @brief Lock/unlock a range in a file (new style)
- *
- * Delegate to sub-FSAL
+ * @brief Queue window fills picked by mdc_ra_track()
  *
- * @param[in] obj_hdl	Object owning state
- * @param[in] state	Open file state to lock/unlock
- * @param[in] p_owner	Private data for lock
- * @param[in] lock_op	Lock operation
- * @param[in] req_lock	Parameters for requested lock
- * @param[in] conflicting_lock	Description of existing conflicting lock
- * @return FSAL status
+ * @param[in] ra      Read-ahead part of the file
+ * @param[in] export  Export the triggering read came through
+ * @param[in] jobs    The jobs
+ * @param[in] n       Number of jobs
  */
-fsal_status_t mdcache_lock_op2(struct fsal_obj_handle *obj_hdl,
-			      struct state_t *state,
-			      void *p_owner,
-			      fsal_lock_op_t lock_op,
-			      fsal_lock_param_t *req_lock,
-			      fsal_lock_param_t *conflicting_lock)
+static void mdc_ra_submit(struct mdcache_file_ra *ra,
+			  struct gsh_export *export,
+			  struct mdc_ra_job **jobs, int n)
 {
-	mdcache_entry_t *entry =
-		container_of(obj_hdl, mdcache_entry_t, obj_handle);
-	fsal_status_t status;
+	int i, rc;
 
-	subcall(
-		status = entry->sub_handle->obj_ops.lock_op2(
-			entry->sub_handle, state, p_owner, lock_op, req_lock,
-			conflicting_lock)
-	       );
+	for (i = 0; i < n; i++) {
+		struct mdc_ra_job *job = jobs[i];
 
-	return status;
+		if (FSAL_IS_ERROR(mdcache_get(job->entry)))
+			goto drop;
+
+		job->export = export;
+		get_gsh_export_ref(export);
+
+		rc = fridgethr_submit(file_ra_fridge, mdc_ra_run, job);
+		if (rc == 0)
+			continue;
+
+		LogDebug(COMPONENT_CACHE_INODE,
+			 "Unable to queue read-ahead of %p, error code %d",
+			 job->entry, rc);
+		put_gsh_export(export);
+		mdcache_put(job->entry);
+drop:
+		PTHREAD_MUTEX_lock(&ra->mtx);
+		mdc_ra_release(job->w, 0);
+		pthread_cond_broadcast(&ra->cv);
+		PTHREAD_MUTEX_unlock(&ra->mtx);
+		gsh_free(job);
+	}
 }
 
 /**
- * @brief Close a file (new style)
+ * @brief Serve a read from read-ahead windows
+ *
+ * Data is copied out of consecutive windows for as long as they hold
+ * it, waiting on windows still being filled.  A read that runs off the
+ * windows part way is returned short, which the protocols allow.  The
+ * read is then noted in its stream, which may queue further windows.
+ *
+ * @param[in]  entry        The file
+ * @param[in]  state        State read through
+ * @param[in]  offset       Offset to read at
+ * @param[in]  size         Bytes wanted
+ * @param[out] buffer       Where the data goes
+ * @param[out] read_amount  Bytes served
+ * @param[out] eof          Whether end of file was reached
+ *
+ * @return true if the read was served, false to read from the sub-FSAL.
+ */
+static bool mdc_ra_read(mdcache_entry_t *entry, struct state_t *state,
+			uint64_t offset, size_t size, void *buffer,
+			size_t *read_amount, bool *eof)
+{
+	struct mdcache_file_ra *ra = mdc_ra_get(entry);
+	struct mdc_ra_job *jobs[MDC_RA_MAX_WINDOWS];
+	struct mdc_ra_window *w;
+	size_t done = 0, pos, n;
+	bool at_eof = false, seq;
+	int njobs;
+
+	PTHREAD_MUTEX_lock(&ra->mtx);
+
+	while (done < size) {
+		w = mdc_ra_find(ra, offset + done);
+		if (w == NULL)
+			break;
+
+		if (w->state == MDC_RA_PENDING) {
+			pthread_cond_wait(&ra->cv, &ra->mtx);
+			continue;
+		}
+
+		pos = offset + done - w->offset;
+		n = MIN(w->len - pos, size - done);
+		memcpy((char *)buffer + done, (char *)w->buf + pos, n);
+		w->used += n;
+		done += n;
+
+		at_eof = w->eof && pos + n == w->len;
+		if (at_eof || w->used >= w->len)
+			mdc_ra_release(w, mdc_ra_unread(w));
+		if (at_eof)
+			break;
+	}
+
+	if (done == 0 && !at_eof) {
+		PTHREAD_MUTEX_unlock(&ra->mtx);
+		return false;
+	}
+
+	njobs = mdc_ra_track(entry, ra, state, offset, done, at_eof, jobs,
+			     &seq);
+
+	PTHREAD_MUTEX_unlock(&ra->mtx);
+
+	(void) atomic_add_uint64_t(&cache_stp->ra_hit_bytes, done);
+	mdc_ra_submit(ra, op_ctx->ctx_export, jobs, njobs);
+
+	*read_amount = done;
+	*eof = at_eof;
+	return true;
+}
+
+/**
+ * @brief Note a read made through the sub-FSAL in its stream
+ *
+ * @param[in] entry   The file
+ * @param[in] export  Export the read came through
+ * @param[in] state   State read through
+ * @param[in] offset  Offset read at
+ * @param[in] amount  Bytes read
+ * @param[in] eof     The read reached end of file
+ */
+static void mdc_ra_missed(mdcache_entry_t *entry, struct gsh_export *export,
+			  struct state_t *state, uint64_t offset,
+			  size_t amount, bool eof)
+{
+	struct mdcache_file_ra *ra = mdc_ra_get(entry);
+	struct mdc_ra_job *jobs[MDC_RA_MAX_WINDOWS];
+	bool seq;
+	int njobs;
+
+	PTHREAD_MUTEX_lock(&ra->mtx);
+	njobs = mdc_ra_track(entry, ra, state, offset, amount, eof, jobs,
+			     &seq);
+	PTHREAD_MUTEX_unlock(&ra->mtx);
+
+	if (seq)
+		(void) atomic_inc_uint64_t(&cache_stp->ra_miss);
+
+	mdc_ra_submit(ra, export, jobs, njobs);
+}
+
+/**
+ * @brief Drop the read stream of a state being closed
  *
- * @param[in] obj_hdl	Object owning state
- * @param[in] state	Open file state to close
- * @return FSAL status
+ * Once no stream is left the windows are released as well.
+ *
+ * @param[in] entry  The file
+ * @param[in] state  State being closed
  */
-fsal_status_t mdcache_close2(struct fsal_obj_handle *obj_hdl,
-			     struct state_t *state)
+static void mdc_ra_close(mdcache_entry_t *entry, struct state_t *state)
 {
-	mdcache_entry_t *entry =
-		container_of(obj_hdl, mdcache_entry_t, obj_handle);
-	fsal_status_t status;
+	struct mdcache_file_ra *ra;
+	bool idle = true;
+	int i;
 
-	subcall(
-		status = entry->sub_handle->obj_ops.close2(
-			  entry->sub_handle, state)
-	       );
+	ra = atomic_fetch_voidptr((void **)&entry->fsobj.ra);
+	if (ra == NULL)
+		return;
+
+	PTHREAD_MUTEX_lock(&ra->mtx);
+
+	for (i = 0; i < MDC_RA_STREAMS; i++) {
+		if (ra->streams[i].owner == state)
+			ra->streams[i].seq = 0;
+		if (ra->streams[i].seq != 0)
+			idle = false;
+	}
+
+	if (idle) {
+		for (i = 0; i < MDC_RA_MAX_WINDOWS; i++) {
+			struct mdc_ra_window *w = &ra->windows[i];
+
+			if (w->state == MDC_RA_READY)
+				mdc_ra_release(w, mdc_ra_unread(w));
+		}
+	}
+
+	PTHREAD_MUTEX_unlock(&ra->mtx);
+}
+
+/**
+ * @brief Apply IO_ADVISE hints to read-ahead
+ *
+ * SEQUENTIAL starts the state's stream at the offset one read short of
+ * triggering read-ahead; WILLNEED does the same and reads ahead from
+ * the offset at once, up to Read_Ahead_Windows windows whatever the
+ * count.  RANDOM forgets the stream and DONTNEED releases filled
+ * windows overlapping the range.
+ *
+ * @param[in] entry  The file
+ * @param[in] state  State the hint came with
+ * @param[in] hints  Hints asked for, with the range
+ *
+ * @return The hints acted on.
+ */
+static uint32_t mdc_ra_advise(mdcache_entry_t *entry, struct state_t *state,
+			      const struct io_hints *hints)
+{
+	struct mdcache_file_ra *ra;
+	struct mdc_ra_job *jobs[MDC_RA_MAX_WINDOWS];
+	struct mdc_ra_stream *s = NULL;
+	uint64_t end = hints->count != 0 ? hints->offset + hints->count
+					 : UINT64_MAX;
+	uint32_t done = 0;
+	bool seq;
+	int i, njobs = 0;
+
+	if (!mdc_ra_enabled(&entry->obj_handle, NULL) ||
+	    !(hints->hints & (1 << IO_ADVISE4_SEQUENTIAL |
+			      1 << IO_ADVISE4_RANDOM |
+			      1 << IO_ADVISE4_WILLNEED |
+			      1 << IO_ADVISE4_DONTNEED)))
+		return 0;
+
+	ra = mdc_ra_get(entry);
+
+	PTHREAD_MUTEX_lock(&ra->mtx);
+
+	for (i = 0; i < MDC_RA_STREAMS; i++) {
+		struct mdc_ra_stream *t = &ra->streams[i];
+
+		if (t->seq != 0 && t->owner == state) {
+			s = t;
+			break;
+		}
+
+		if (s == NULL || t->tick < s->tick)
+			s = t;
+	}
+
+	if (hints->hints & (1 << IO_ADVISE4_RANDOM)) {
+		if (s->owner == state)
+			s->seq = 0;
+		done |= 1 << IO_ADVISE4_RANDOM;
+	} else if (hints->hints & (1 << IO_ADVISE4_SEQUENTIAL |
+				   1 << IO_ADVISE4_WILLNEED)) {
+		s->owner = state;
+		s->next_off = hints->offset;
+		s->ra_next = hints->offset;
+		s->seq = MDC_RA_TRIGGER - 1;
+		s->tick = ++ra->tick;
+		done |= hints->hints & (1 << IO_ADVISE4_SEQUENTIAL);
+
+		if (hints->hints & (1 << IO_ADVISE4_WILLNEED)) {
+			njobs = mdc_ra_track(entry, ra, state, hints->offset,
+					     0, false, jobs, &seq);
+			done |= 1 << IO_ADVISE4_WILLNEED;
+		}
+	}
+
+	if (hints->hints & (1 << IO_ADVISE4_DONTNEED)) {
+		for (i = 0; i < MDC_RA_MAX_WINDOWS; i++) {
+			struct mdc_ra_window *w = &ra->windows[i];
+
+			if (w->state == MDC_RA_READY &&
+			    w->offset < end &&
+			    w->offset + w->len > hints->offset)
+				mdc_ra_release(w, mdc_ra_unread(w));
+		}
+		done |= 1 << IO_ADVISE4_DONTNEED;
+	}
+
+	PTHREAD_MUTEX_unlock(&ra->mtx);
+
+	mdc_ra_submit(ra, op_ctx->ctx_export, jobs, njobs);
+
+	return done;
+}
+
+/**
+ * @brief Throw away data read ahead or cached of a file that may have
+ *        changed
+ *
+ * Windows still being filled are dropped when their read completes.
+ *
+ * @param[in] entry  The file
+ */
+void mdcache_file_ra_invalidate(mdcache_entry_t *entry)
+{
+	struct mdcache_file_ra *ra;
+	int i;
+
+	mdcache_file_sc_release(entry);
+
+	ra = atomic_fetch_voidptr((void **)&entry->fsobj.ra);
+	if (ra == NULL)
+		return;
+
+	PTHREAD_MUTEX_lock(&ra->mtx);
+
+	ra->gen++;
+
+	for (i = 0; i < MDC_RA_MAX_WINDOWS; i++) {
+		struct mdc_ra_window *w = &ra->windows[i];
+
+		if (w->state == MDC_RA_READY)
+			mdc_ra_release(w, mdc_ra_unread(w));
+	}
+
+	for (i = 0; i < MDC_RA_STREAMS; i++)
+		ra->streams[i].ra_next = 0;
+
+	pthread_cond_broadcast(&ra->cv);
+	PTHREAD_MUTEX_unlock(&ra->mtx);
+}
+
+/**
+ * @brief Release the read-ahead part of an entry being cleaned
+ *
+ * No window can be filling, as each fill holds a reference.
+ *
+ * @param[in] entry  The entry
+ */
+void mdcache_file_ra_free(mdcache_entry_t *entry)
+{
+	struct mdcache_file_ra *ra = entry->fsobj.ra;
+	int i;
+
+	if (ra == NULL)
+		return;
+
+	for (i = 0; i < MDC_RA_MAX_WINDOWS; i++) {
+		struct mdc_ra_window *w = &ra->windows[i];
+
+		if (w->state != MDC_RA_EMPTY)
+			mdc_ra_release(w, mdc_ra_unread(w));
+	}
+
+	PTHREAD_COND_destroy(&ra->cv);
+	PTHREAD_MUTEX_destroy(&ra->mtx);
+	gsh_free(ra);
+	entry->fsobj.ra = NULL;
+}
+
+/**
+ * @brief Start the file read-ahead fridge
+ *
+ * @return FSAL status
+ */
+fsal_status_t mdcache_file_ra_pkginit(void)
+{
+	struct fridgethr_params frp;
+	int rc;
+
+	if (file_ra_fridge != NULL || mdcache_param.file.ra_windows == 0)
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+	memset(&frp, 0, sizeof(struct fridgethr_params));
+	frp.thr_max = 4;
+	frp.deferment = fridgethr_defer_queue;
+
+	rc = fridgethr_init(&file_ra_fridge, "MDC_File_RA", &frp);
+	if (rc != 0) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Unable to initialize file read-ahead fridge, error code %d.",
+			 rc);
+		return fsalstat(posix2fsal_error(rc), rc);
+	}
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Drain and stop the file read-ahead fridge
+ */
+void mdcache_file_ra_pkgshutdown(void)
+{
+	int rc;
+
+	if (file_ra_fridge == NULL)
+		return;
+
+	rc = fridgethr_sync_command(file_ra_fridge, fridgethr_comm_stop, 120);
+
+	if (rc == ETIMEDOUT) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Shutdown timed out, cancelling file read-ahead threads.");
+		fridgethr_cancel(file_ra_fridge);
+	} else if (rc != 0) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Failed shutting down file read-ahead threads: %d",
+			 rc);
+	}
+
+	fridgethr_destroy(file_ra_fridge);
+	file_ra_fridge = NULL;
+}
+
+/*
+ * Write-behind of unstable writes
+ *
+ * UNSTABLE writes to a regular file are copied into a buffer of
+ * Write_Behind_Size bytes instead of being passed down one by one.  The
+ * buffer holds one extent written through one state; a write that does
+ * not extend or overwrite it, or comes through another state, writes it
+ * out first.  The extent is written out as one unstable sub-FSAL write
+ * when it fills, and before anything that must see the data: COMMIT,
+ * closing its state, locks, setattrs, truncating opens, seeks, copies
+ * and clones, delegation recalls, reads of the range, attribute
+ * refreshes and the entry being cleaned.  Once Write_Behind_Memory is
+ * taken up by buffers, writes go straight through.
+ *
+ * Gathered writes are acknowledged as UNSTABLE with the server's usual
+ * write verifier: they are lost on a restart exactly as data held by the
+ * FSAL would be, and the new verifier makes clients send them again.
+ * An error writing an extent out is kept and returned by the next
+ * COMMIT, so a client never sees a failed write committed.
+ */
+
+static inline bool mdc_wb_enabled(struct fsal_obj_handle *obj_hdl)
+{
+	return mdcache_param.file.wb_size != 0 &&
+	       obj_hdl->type == REGULAR_FILE;
+}
+
+/**
+ * @brief Get the write-behind part of a file, allocating it if needed
+ *
+ * @param[in] entry  The file
+ *
+ * @return The write-behind part.
+ */
+static struct mdcache_file_wb *mdc_wb_get(mdcache_entry_t *entry)
+{
+	struct mdcache_file_wb *wb;
+
+	wb = atomic_fetch_voidptr((void **)&entry->fsobj.wb);
+	if (wb != NULL)
+		return wb;
+
+	PTHREAD_RWLOCK_wrlock(&entry->attr_lock);
+
+	wb = entry->fsobj.wb;
+	if (wb == NULL) {
+		wb = gsh_calloc(1, sizeof(*wb));
+		PTHREAD_MUTEX_init(&wb->mtx, NULL);
+		atomic_store_voidptr((void **)&entry->fsobj.wb, wb);
+	}
+
+	PTHREAD_RWLOCK_unlock(&entry->attr_lock);
+
+	return wb;
+}
+
+static inline bool mdc_wb_overlaps(struct mdcache_file_wb *wb,
+				   uint64_t offset, uint64_t len)
+{
+	if (wb->buf == NULL || len == 0)
+		return false;
+
+	if (offset >= wb->offset)
+		return offset < wb->offset + wb->len;
+
+	return wb->offset - offset < len;
+}
+
+/**
+ * @brief Write the gathered extent out and release the buffer
+ *
+ * Called with the write-behind mtx held.  The extent goes down as
+ * unstable writes through the state and bypass it was written with.
+ *
+ * @param[in] entry  The file
+ * @param[in] wb     Write-behind part of the file
+ */
+static void mdc_wb_write_out(mdcache_entry_t *entry,
+			     struct mdcache_file_wb *wb)
+{
+	fsal_status_t status = {0, 0};
+	size_t done = 0, amount;
+	bool stable;
+
+	while (done < wb->len) {
+		amount = 0;
+		stable = false;
+
+		subcall(
+			status = entry->sub_handle->obj_ops.write2(
+				entry->sub_handle, wb->bypass, wb->owner,
+				wb->offset + done, wb->len - done,
+				(char *)wb->buf + done, &amount, &stable,
+				NULL)
+		       );
+
+		if (FSAL_IS_ERROR(status))
+			break;
+
+		if (amount == 0) {
+			status = fsalstat(ERR_FSAL_IO, 0);
+			break;
+		}
+
+		done += amount;
+	}
+
+	if (FSAL_IS_ERROR(status)) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Write-behind of %zu bytes at %"PRIu64
+			 " to %p failed status=%s",
+			 wb->len - done, wb->offset + done, entry,
+			 fsal_err_txt(status));
+		if (!FSAL_IS_ERROR(wb->error))
+			wb->error = status;
+	}
+
+	(void) atomic_inc_uint64_t(&cache_stp->wb_flushes);
+	(void) atomic_add_uint64_t(&cache_stp->wb_flush_bytes, done);
+
+	iobuf_put(wb->buf);
+	(void) atomic_sub_uint64_t(&cache_stp->wb_bytes,
+				   mdcache_param.file.wb_size);
+	wb->buf = NULL;
+	wb->len = 0;
+	wb->owner = NULL;
+
+	/* The cached attributes were kept up to date as the data was
+	 * gathered, so trust in them is left for their expiry to end;
+	 * dropping it here would turn the GETATTR following every NFSv4
+	 * WRITE into a write-out.
+	 */
+	mdcache_lru_fd_bump(entry);
+}
+
+/**
+ * @brief Write out gathered data overlapping a range
+ *
+ * @param[in] entry   The file
+ * @param[in] offset  Start of the range
+ * @param[in] len     Length of the range, UINT64_MAX for to end of file
+ */
+void mdcache_file_wb_flush(mdcache_entry_t *entry, uint64_t offset,
+			   uint64_t len)
+{
+	struct mdcache_file_wb *wb;
+
+	wb = atomic_fetch_voidptr((void **)&entry->fsobj.wb);
+	if (wb == NULL)
+		return;
+
+	PTHREAD_MUTEX_lock(&wb->mtx);
+
+	if (mdc_wb_overlaps(wb, offset, len))
+		mdc_wb_write_out(entry, wb);
+
+	PTHREAD_MUTEX_unlock(&wb->mtx);
+}
+
+/**
+ * @brief Write out everything gathered and collect any write-out error
+ *
+ * @param[in] entry  The file
+ *
+ * @return The first error writing data out since the last call.
+ */
+static fsal_status_t mdc_wb_sync(mdcache_entry_t *entry)
+{
+	struct mdcache_file_wb *wb;
+	fsal_status_t status;
+
+	wb = atomic_fetch_voidptr((void **)&entry->fsobj.wb);
+	if (wb == NULL)
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+	PTHREAD_MUTEX_lock(&wb->mtx);
+
+	if (wb->buf != NULL)
+		mdc_wb_write_out(entry, wb);
+
+	status = wb->error;
+	wb->error = fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+	PTHREAD_MUTEX_unlock(&wb->mtx);
+
+	return status;
+}
+
+/**
+ * @brief Write out the extent gathered through a state being closed
+ *
+ * @param[in] entry  The file
+ * @param[in] state  State being closed
+ */
+static void mdc_wb_close(mdcache_entry_t *entry, struct state_t *state)
+{
+	struct mdcache_file_wb *wb;
+
+	wb = atomic_fetch_voidptr((void **)&entry->fsobj.wb);
+	if (wb == NULL)
+		return;
+
+	PTHREAD_MUTEX_lock(&wb->mtx);
+
+	if (wb->buf != NULL && wb->owner == state)
+		mdc_wb_write_out(entry, wb);
+
+	PTHREAD_MUTEX_unlock(&wb->mtx);
+}
+
+/**
+ * @brief Gather a write into the file's write-behind buffer
+ *
+ * Stable writes, WRITE_PLUS and writes larger than the buffer are not
+ * gathered; any gathered data they overlap is written out first so they
+ * land in order.
+ *
+ * @param[in]  entry         The file
+ * @param[in]  bypass        Bypass any non-mandatory deny write
+ * @param[in]  state         State written through
+ * @param[in]  offset        Offset to write at
+ * @param[in]  iov           Data to write
+ * @param[in]  iovcnt        Number of segments
+ * @param[in]  size          Total length of the segments
+ * @param[in]  info          io_info for WRITE_PLUS
+ * @param[out] write_amount  Bytes written
+ * @param[in,out] fsal_stable  Stability asked for and given
+ *
+ * @return true if the write was gathered, false to write it through.
+ */
+static bool mdc_wb_write(mdcache_entry_t *entry, bool bypass,
+			 struct state_t *state, uint64_t offset,
+			 const struct iovec *iov, int iovcnt, size_t size,
+			 struct io_info *info, size_t *write_amount,
+			 bool *fsal_stable)
+{
+	uint64_t cap = mdcache_param.file.wb_size;
+	struct mdcache_file_wb *wb;
+	size_t pos;
+	int i;
+
+	if (info != NULL || *fsal_stable || size > cap) {
+		mdcache_file_wb_flush(entry, offset, size);
+		return false;
+	}
+
+	wb = mdc_wb_get(entry);
+
+	PTHREAD_MUTEX_lock(&wb->mtx);
+
+	if (wb->buf != NULL &&
+	    (wb->owner != state || wb->bypass != bypass ||
+	     offset < wb->offset || offset > wb->offset + wb->len ||
+	     offset + size > wb->offset + cap))
+		mdc_wb_write_out(entry, wb);
+
+	if (wb->buf == NULL) {
+		if (atomic_add_uint64_t(&cache_stp->wb_bytes, cap) >
+		    mdcache_param.file.wb_memory) {
+			(void) atomic_sub_uint64_t(&cache_stp->wb_bytes, cap);
+			PTHREAD_MUTEX_unlock(&wb->mtx);
+			return false;
+		}
+
+		wb->buf = iobuf_get(cap);
+		wb->owner = state;
+		wb->bypass = bypass;
+		wb->offset = offset;
+		wb->len = 0;
+	}
+
+	pos = offset - wb->offset;
+	for (i = 0; i < iovcnt; i++) {
+		memcpy((char *)wb->buf + pos, iov[i].iov_base, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	}
+
+	if (pos > wb->len)
+		wb->len = pos;
+
+	if (wb->len == cap)
+		mdc_wb_write_out(entry, wb);
+
+	PTHREAD_MUTEX_unlock(&wb->mtx);
+
+	(void) atomic_inc_uint64_t(&cache_stp->wb_writes);
+
+	/* The sub-FSAL has not seen the data, so account for it in the
+	 * cached attributes; they are refreshed only after a write-out.
+	 */
+	PTHREAD_RWLOCK_wrlock(&entry->attr_lock);
+	if (entry->attrs.filesize < offset + size)
+		entry->attrs.filesize = offset + size;
+	entry->attrs.change++;
+	mdc_set_time_current(&entry->attrs, MDC_MTIME);
+	entry->attrs.sec[MDC_CTIME] = entry->attrs.sec[MDC_MTIME];
+	entry->attrs.nsec[MDC_CTIME] = entry->attrs.nsec[MDC_MTIME];
+	fattr4_cache_invalidate(entry->obj_handle.state_hdl);
+	PTHREAD_RWLOCK_unlock(&entry->attr_lock);
+
+	mdcache_file_ra_invalidate(entry);
+
+	*write_amount = size;
+	*fsal_stable = false;
+	return true;
+}
+
+/**
+ * @brief Release the write-behind part of an entry being cleaned
+ *
+ * The entry's data must already have been written out.
+ *
+ * @param[in] entry  The entry
+ */
+void mdcache_file_wb_free(mdcache_entry_t *entry)
+{
+	struct mdcache_file_wb *wb = entry->fsobj.wb;
+
+	if (wb == NULL)
+		return;
+
+	if (wb->buf != NULL) {
+		LogCrit(COMPONENT_CACHE_INODE,
+			"Dropping %zu bytes of write-behind data of %p",
+			wb->len, entry);
+		iobuf_put(wb->buf);
+		(void) atomic_sub_uint64_t(&cache_stp->wb_bytes,
+					   mdcache_param.file.wb_size);
+	}
+
+	PTHREAD_MUTEX_destroy(&wb->mtx);
+	gsh_free(wb);
+	entry->fsobj.wb = NULL;
+}
+
+/*
+ * Small file content
+ *
+ * Files no larger than Small_File_Cache_Size are read whole from the
+ * sub-FSAL on their first read, and later reads are copied out of
+ * memory as long as the size and change attribute getattrs returns are
+ * those the data was read at.  Content is dropped whenever read-ahead
+ * windows would be, when the entry goes cold in the LRU, and when it is
+ * cleaned.  Once Small_File_Cache_Memory is held, files are read
+ * through.
+ */
+
+static inline bool mdc_sc_enabled(struct fsal_obj_handle *obj_hdl,
+				  struct io_info *info)
+{
+	return mdcache_param.file.sc_max_size != 0 && info == NULL &&
+	       obj_hdl->type == REGULAR_FILE;
+}
+
+/**
+ * @brief Get the content part of a file, allocating it if needed
+ *
+ * @param[in] entry  The file
+ *
+ * @return The content part.
+ */
+static struct mdcache_file_sc *mdc_sc_get(mdcache_entry_t *entry)
+{
+	struct mdcache_file_sc *sc;
+
+	sc = atomic_fetch_voidptr((void **)&entry->fsobj.sc);
+	if (sc != NULL)
+		return sc;
+
+	PTHREAD_RWLOCK_wrlock(&entry->attr_lock);
+
+	sc = entry->fsobj.sc;
+	if (sc == NULL) {
+		sc = gsh_calloc(1, sizeof(*sc));
+		PTHREAD_MUTEX_init(&sc->mtx, NULL);
+		atomic_store_voidptr((void **)&entry->fsobj.sc, sc);
+	}
+
+	PTHREAD_RWLOCK_unlock(&entry->attr_lock);
+
+	return sc;
+}
+
+/**
+ * @brief Drop the data held, called with the content mtx held
+ */
+static void mdc_sc_drop(struct mdcache_file_sc *sc)
+{
+	if (sc->buf == NULL)
+		return;
+
+	gsh_free(sc->buf);
+	(void) atomic_sub_uint64_t(&cache_stp->sc_bytes, sc->size);
+	sc->buf = NULL;
+}
+
+static void mdc_sc_copy(const void *data, uint64_t size, uint64_t offset,
+			size_t buf_size, void *buffer, size_t *read_amount,
+			bool *eof)
+{
+	size_t n = 0;
+
+	if (offset < size) {
+		n = MIN(buf_size, size - offset);
+		memcpy(buffer, (const char *)data + offset, n);
+	}
+
+	*read_amount = n;
+	*eof = offset + n >= size;
+}
+
+/**
+ * @brief Serve a read of a small file from its cached content
+ *
+ * On a miss the whole file is read, one byte more than its size to be
+ * sure nothing lies past it, and kept unless an invalidate came in
+ * meanwhile.
+ *
+ * @param[in]  entry        The file
+ * @param[in]  bypass       Bypass deny read, for the fill
+ * @param[in]  state        State read through, for the fill
+ * @param[in]  offset       Offset to read at
+ * @param[in]  buf_size     Bytes wanted
+ * @param[out] buffer       Where the data goes
+ * @param[out] read_amount  Bytes served
+ * @param[out] eof          Whether end of file was reached
+ *
+ * @return true if the read was served, false to read from the sub-FSAL.
+ */
+static bool mdc_sc_read(mdcache_entry_t *entry, bool bypass,
+			struct state_t *state, uint64_t offset,
+			size_t buf_size, void *buffer, size_t *read_amount,
+			bool *eof)
+{
+	struct mdcache_file_sc *sc;
+	struct attrlist attrs;
+	fsal_status_t status;
+	uint64_t size, change;
+	size_t amount = 0;
+	bool fill_eof = false;
+	uint32_t gen;
+	void *buf;
+
+	fsal_prepare_attrs(&attrs, ATTR_SIZE | ATTR_CHANGE);
+	status = entry->obj_handle.obj_ops.getattrs(&entry->obj_handle,
+						    &attrs);
+	size = attrs.filesize;
+	change = attrs.change;
+	fsal_release_attrs(&attrs);
+
+	if (FSAL_IS_ERROR(status) || size > mdcache_param.file.sc_max_size)
+		return false;
+
+	sc = mdc_sc_get(entry);
+
+	PTHREAD_MUTEX_lock(&sc->mtx);
+
+	if (sc->buf != NULL && sc->size == size && sc->change == change) {
+		mdc_sc_copy(sc->buf, size, offset, buf_size, buffer,
+			    read_amount, eof);
+		PTHREAD_MUTEX_unlock(&sc->mtx);
+		(void) atomic_add_uint64_t(&cache_stp->sc_hit_bytes,
+					   *read_amount);
+		return true;
+	}
+
+	mdc_sc_drop(sc);
+	gen = sc->gen;
+
+	PTHREAD_MUTEX_unlock(&sc->mtx);
+
+	if (atomic_add_uint64_t(&cache_stp->sc_bytes, size) >
+	    mdcache_param.file.sc_memory) {
+		(void) atomic_sub_uint64_t(&cache_stp->sc_bytes, size);
+		return false;
+	}
+
+	mdcache_file_wb_flush(entry, 0, size + 1);
+
+	buf = gsh_malloc(size + 1);
+
+	subcall(
+		status = entry->sub_handle->obj_ops.read2(
+			entry->sub_handle, bypass, state, 0, size + 1,
+			buf, &amount, &fill_eof, NULL)
+	       );
+
+	if (FSAL_IS_ERROR(status) || amount != size) {
+		/* The file changed under us, or the read came up short */
+		if (status.major == ERR_FSAL_DELAY)
+			mdcache_kill_entry(entry);
+		gsh_free(buf);
+		(void) atomic_sub_uint64_t(&cache_stp->sc_bytes, size);
+		return false;
+	}
+
+	(void) atomic_add_uint64_t(&cache_stp->sc_fill_bytes, size);
+	mdcache_lru_fd_bump(entry);
+	mdc_sc_copy(buf, size, offset, buf_size, buffer, read_amount, eof);
+
+	PTHREAD_MUTEX_lock(&sc->mtx);
+
+	if (sc->gen == gen && sc->buf == NULL) {
+		sc->buf = buf;
+		sc->size = size;
+		sc->change = change;
+		buf = NULL;
+	}
+
+	PTHREAD_MUTEX_unlock(&sc->mtx);
+
+	if (buf != NULL) {
+		gsh_free(buf);
+		(void) atomic_sub_uint64_t(&cache_stp->sc_bytes, size);
+	}
+
+	return true;
+}
+
+/**
+ * @brief Drop the cached content of a file
+ *
+ * Called wherever read-ahead windows are invalidated and when the LRU
+ * moves the entry to L2.
+ *
+ * @param[in] entry  The file
+ */
+void mdcache_file_sc_release(mdcache_entry_t *entry)
+{
+	struct mdcache_file_sc *sc;
+
+	sc = atomic_fetch_voidptr((void **)&entry->fsobj.sc);
+	if (sc == NULL)
+		return;
+
+	PTHREAD_MUTEX_lock(&sc->mtx);
+	sc->gen++;
+	mdc_sc_drop(sc);
+	PTHREAD_MUTEX_unlock(&sc->mtx);
+}
+
+/**
+ * @brief Release the content part of an entry being cleaned
+ *
+ * @param[in] entry  The entry
+ */
+void mdcache_file_sc_free(mdcache_entry_t *entry)
+{
+	struct mdcache_file_sc *sc = entry->fsobj.sc;
+
+	if (sc == NULL)
+		return;
+
+	mdc_sc_drop(sc);
+	PTHREAD_MUTEX_destroy(&sc->mtx);
+	gsh_free(sc);
+	entry->fsobj.sc = NULL;
+}
+
+/**
+ * @brief Read from a file (new style)
+ *
+ * Delegate to sub-FSAL
+ *
+ * @param[in] obj_hdl	Object owning state
+ * @param[in] bypass	Bypass deny read
+ * @param[in] state	Open file state to read
+ * @param[in] offset	Offset into file
+ * @param[in] buf_size	Size of read buffer
+ * @param[in,out] buffer	Buffer to read into
+ * @param[out] read_amount	Amount read in bytes
+ * @param[out] eof	true if End of File was hit
+ * @param[in] info	io_info for READ_PLUS
+ * @return FSAL status
+ */
+fsal_status_t mdcache_read2(struct fsal_obj_handle *obj_hdl,
+			   bool bypass,
+			   struct state_t *state,
+			   uint64_t offset,
+			   size_t buf_size,
+			   void *buffer,
+			   size_t *read_amount,
+			   bool *eof,
+			   struct io_info *info)
+{
+	mdcache_entry_t *entry =
+		container_of(obj_hdl, mdcache_entry_t, obj_handle);
+	fsal_status_t status;
+	bool ra = mdc_ra_enabled(obj_hdl, info);
+
+	if (mdc_sc_enabled(obj_hdl, info) &&
+	    mdc_sc_read(entry, bypass, state, offset, buf_size, buffer,
+			read_amount, eof)) {
+		mdc_set_time_current(&entry->attrs, MDC_ATIME);
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+	}
+
+	if (ra && mdc_ra_read(entry, state, offset, buf_size, buffer,
+			      read_amount, eof)) {
+		mdc_set_time_current(&entry->attrs, MDC_ATIME);
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+	}
+
+	mdcache_file_wb_flush(entry, offset, buf_size);
+
+	subcall(
+		status = entry->sub_handle->obj_ops.read2(
+			entry->sub_handle, bypass, state, offset, buf_size,
+			buffer, read_amount, eof, info)
+	       );
+
+	if (!FSAL_IS_ERROR(status)) {
+		mdc_set_time_current(&entry->attrs, MDC_ATIME);
+		mdcache_lru_fd_bump(entry);
+		if (ra)
+			mdc_ra_missed(entry, op_ctx->ctx_export, state, offset,
+				      *read_amount, *eof);
+	} else if (status.major == ERR_FSAL_DELAY)
+		mdcache_kill_entry(entry);
+
+	return status;
+}
+
+/**
+ * @brief Write to a file (new style)
+ *
+ * Delegate to sub-FSAL
+ *
+ * @param[in] obj_hdl	Object owning state
+ * @param[in] bypass	Bypass any non-mandatory deny write
+ * @param[in] state	Open file state to write
+ * @param[in] offset	Offset into file
+ * @param[in] buf_size	Size of write buffer
+ * @param[in] buffer	Buffer to write from
+ * @param[out] write_amount	Amount written in bytes
+ * @param[out] fsal_stable	true if write was to stable storage
+ * @param[in] info	io_info for WRITE_PLUS
+ * @return FSAL status
+ */
+fsal_status_t mdcache_write2(struct fsal_obj_handle *obj_hdl,
+			     bool bypass,
+			     struct state_t *state,
+			     uint64_t offset,
+			     size_t buf_size,
+			     void *buffer,
+			     size_t *write_amount,
+			     bool *fsal_stable,
+			     struct io_info *info)
+{
+	mdcache_entry_t *entry =
+		container_of(obj_hdl, mdcache_entry_t, obj_handle);
+	fsal_status_t status;
+	struct iovec iov = {buffer, buf_size};
+
+	if (mdc_wb_enabled(obj_hdl) &&
+	    mdc_wb_write(entry, bypass, state, offset, &iov, 1, buf_size,
+			 info, write_amount, fsal_stable))
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+	subcall(
+		status = entry->sub_handle->obj_ops.write2(
+			entry->sub_handle, bypass, state, offset, buf_size,
+			buffer, write_amount, fsal_stable, info)
+	       );
+
+	if (status.major == ERR_FSAL_STALE) {
+		mdcache_kill_entry(entry);
+	} else {
+		atomic_clear_uint32_t_bits(&entry->mde_flags,
+					   MDCACHE_TRUST_ATTRS);
+		mdcache_file_ra_invalidate(entry);
+		mdcache_lru_fd_bump(entry);
+	}
+
+	return status;
+}
+
+/**
+ * @brief Write a scatter list to a file
+ *
+ * Delegate to sub-FSAL
+ *
+ * @param[in] obj_hdl	Object owning state
+ * @param[in] bypass	Bypass any non-mandatory deny write
+ * @param[in] state	Open file state to write
+ * @param[in] offset	Offset into file
+ * @param[in] iov	Segments to write from
+ * @param[in] iovcnt	Number of segments
+ * @param[out] write_amount	Amount written in bytes
+ * @param[out] fsal_stable	true if write was to stable storage
+ * @param[in] info	io_info for WRITE_PLUS
+ * @return FSAL status
+ */
+fsal_status_t mdcache_writev2(struct fsal_obj_handle *obj_hdl,
+			      bool bypass,
+			      struct state_t *state,
+			      uint64_t offset,
+			      const struct iovec *iov,
+			      int iovcnt,
+			      size_t *write_amount,
+			      bool *fsal_stable,
+			      struct io_info *info)
+{
+	mdcache_entry_t *entry =
+		container_of(obj_hdl, mdcache_entry_t, obj_handle);
+	fsal_status_t status;
+	size_t size = 0;
+	int i;
+
+	if (mdc_wb_enabled(obj_hdl)) {
+		for (i = 0; i < iovcnt; i++)
+			size += iov[i].iov_len;
+
+		if (mdc_wb_write(entry, bypass, state, offset, iov, iovcnt,
+				 size, info, write_amount, fsal_stable))
+			return fsalstat(ERR_FSAL_NO_ERROR, 0);
+	}
+
+	subcall(
+		status = entry->sub_handle->obj_ops.writev2(
+			entry->sub_handle, bypass, state, offset, iov, iovcnt,
+			write_amount, fsal_stable, info)
+	       );
+
+	if (status.major == ERR_FSAL_STALE) {
+		mdcache_kill_entry(entry);
+	} else {
+		atomic_clear_uint32_t_bits(&entry->mde_flags,
+					   MDCACHE_TRUST_ATTRS);
+		mdcache_file_ra_invalidate(entry);
+		mdcache_lru_fd_bump(entry);
+	}
+
+	return status;
+}
+
+/**
+ * @brief Copy a range of one file into another
+ *
+ * Delegate to sub-FSAL
+ *
+ * @param[in] dst_hdl	File to copy into
+ * @param[in] dst_state	Open file state for dst_hdl
+ * @param[in] dst_offset	Offset into dst_hdl
+ * @param[in] src_hdl	File to copy from
+ * @param[in] src_state	Open file state for src_hdl
+ * @param[in] src_offset	Offset into src_hdl
+ * @param[in] count	Amount to copy
+ * @param[out] copied	Amount copied
+ * @return FSAL status
+ */
+fsal_status_t mdcache_copy(struct fsal_obj_handle *dst_hdl,
+			   struct state_t *dst_state,
+			   uint64_t dst_offset,
+			   struct fsal_obj_handle *src_hdl,
+			   struct state_t *src_state,
+			   uint64_t src_offset,
+			   uint64_t count,
+			   uint64_t *copied)
+{
+	mdcache_entry_t *dst =
+		container_of(dst_hdl, mdcache_entry_t, obj_handle);
+	mdcache_entry_t *src =
+		container_of(src_hdl, mdcache_entry_t, obj_handle);
+	fsal_status_t status;
+
+	mdcache_file_wb_flush(src, src_offset, count ? count : UINT64_MAX);
+	mdcache_file_wb_flush(dst, dst_offset, count ? count : UINT64_MAX);
+
+	subcall(
+		status = dst->sub_handle->obj_ops.copy(
+			dst->sub_handle, dst_state, dst_offset,
+			src->sub_handle, src_state, src_offset, count, copied)
+	       );
+
+	if (status.major == ERR_FSAL_STALE) {
+		mdcache_kill_entry(dst);
+	} else {
+		atomic_clear_uint32_t_bits(&dst->mde_flags,
+					   MDCACHE_TRUST_ATTRS);
+		mdcache_file_ra_invalidate(dst);
+		mdcache_lru_fd_bump(dst);
+	}
+
+	return status;
+}
+
+/**
+ * @brief Clone a range of one file into another
+ *
+ * Delegate to sub-FSAL
+ *
+ * @param[in] dst_hdl	File to clone into
+ * @param[in] dst_state	Open file state for dst_hdl
+ * @param[in] dst_offset	Offset into dst_hdl
+ * @param[in] src_hdl	File to clone from
+ * @param[in] src_state	Open file state for src_hdl
+ * @param[in] src_offset	Offset into src_hdl
+ * @param[in] count	Amount to clone
+ * @return FSAL status
+ */
+fsal_status_t mdcache_clone(struct fsal_obj_handle *dst_hdl,
+			    struct state_t *dst_state,
+			    uint64_t dst_offset,
+			    struct fsal_obj_handle *src_hdl,
+			    struct state_t *src_state,
+			    uint64_t src_offset,
+			    uint64_t count)
+{
+	mdcache_entry_t *dst =
+		container_of(dst_hdl, mdcache_entry_t, obj_handle);
+	mdcache_entry_t *src =
+		container_of(src_hdl, mdcache_entry_t, obj_handle);
+	fsal_status_t status;
+
+	mdcache_file_wb_flush(src, src_offset, count ? count : UINT64_MAX);
+	mdcache_file_wb_flush(dst, dst_offset, count ? count : UINT64_MAX);
+
+	subcall(
+		status = dst->sub_handle->obj_ops.clone(
+			dst->sub_handle, dst_state, dst_offset,
+			src->sub_handle, src_state, src_offset, count)
+	       );
+
+	if (status.major == ERR_FSAL_STALE) {
+		mdcache_kill_entry(dst);
+	} else {
+		atomic_clear_uint32_t_bits(&dst->mde_flags,
+					   MDCACHE_TRUST_ATTRS);
+		mdcache_file_ra_invalidate(dst);
+	}
+
+	return status;
+}
+
+/**
+ * @brief State carried from an asynchronous I/O to its completion
+ */
+struct mdc_async_io {
+	mdcache_entry_t *entry;		/*< Entry, ref'd by the submitter */
+	bool write;			/*< write2_async rather than read2 */
+	bool ra;			/*< Read to be noted for read-ahead */
+	struct gsh_export *export;	/*< Export of the read, held by the
+					    submitter */
+	struct state_t *state;		/*< State read through */
+	uint64_t offset;		/*< Offset read at */
+	size_t *read_amount;		/*< Where the read's length lands */
+	bool *eof;			/*< Where the read's eof lands */
+	fsal_async_cb done_cb;		/*< Caller's callback */
+	void *caller_data;		/*< Caller's argument */
+};
+
+/**
+ * @brief Complete an asynchronous I/O made through the sub-FSAL
+ *
+ * Does what mdcache_read2 and mdcache_write2 do after the sub-FSAL
+ * returns, then calls back the caller.  This may run inside the
+ * submitter's subcall or on an FSAL thread with no op_ctx, so a stale
+ * handle is not killed here; trust in the attributes is dropped instead
+ * and the next getattrs finds it stale.
+ *
+ * @param[in] sub_hdl      Sub-FSAL handle
+ * @param[in] ret          Result of the I/O
+ * @param[in] caller_data  The struct mdc_async_io
+ */
+static void mdc_async_io_done(struct fsal_obj_handle *sub_hdl,
+			      fsal_status_t ret, void *caller_data)
+{
+	struct mdc_async_io *io = caller_data;
+	mdcache_entry_t *entry = io->entry;
+	bool stale = io->write ? ret.major == ERR_FSAL_STALE
+			       : ret.major == ERR_FSAL_DELAY;
+
+	if (io->write || stale)
+		atomic_clear_uint32_t_bits(&entry->mde_flags,
+					   MDCACHE_TRUST_ATTRS);
+	else if (!FSAL_IS_ERROR(ret))
+		mdc_set_time_current(&entry->attrs, MDC_ATIME);
+
+	if (io->write)
+		mdcache_file_ra_invalidate(entry);
+	else if (io->ra && !FSAL_IS_ERROR(ret))
+		mdc_ra_missed(entry, io->export, io->state, io->offset,
+			      *io->read_amount, *io->eof);
+
+	io->done_cb(&entry->obj_handle, ret, io->caller_data);
+	gsh_free(io);
+}
+
+/**
+ * @brief Read from a file asynchronously
+ *
+ * Delegate to sub-FSAL
+ *
+ * @param[in] obj_hdl	Object owning state
+ * @param[in] bypass	Bypass deny read
+ * @param[in] state	Open file state to read
+ * @param[in] offset	Offset into file
+ * @param[in] buf_size	Size of read buffer
+ * @param[in,out] buffer	Buffer to read into
+ * @param[out] read_amount	Amount read in bytes
+ * @param[out] eof	true if End of File was hit
+ * @param[in] info	io_info for READ_PLUS
+ * @param[in] done_cb	Completion callback
+ * @param[in] caller_data	Passed to done_cb
+ */
+void mdcache_read2_async(struct fsal_obj_handle *obj_hdl,
+			 bool bypass,
+			 struct state_t *state,
+			 uint64_t offset,
+			 size_t buf_size,
+			 void *buffer,
+			 size_t *read_amount,
+			 bool *eof,
+			 struct io_info *info,
+			 fsal_async_cb done_cb,
+			 void *caller_data)
+{
+	mdcache_entry_t *entry =
+		container_of(obj_hdl, mdcache_entry_t, obj_handle);
+	struct mdc_async_io *io;
+	bool ra = mdc_ra_enabled(obj_hdl, info);
+
+	if (ra && mdc_ra_read(entry, state, offset, buf_size, buffer,
+			      read_amount, eof)) {
+		mdc_set_time_current(&entry->attrs, MDC_ATIME);
+		done_cb(obj_hdl, fsalstat(ERR_FSAL_NO_ERROR, 0), caller_data);
+		return;
+	}
+
+	mdcache_file_wb_flush(entry, offset, buf_size);
+
+	io = gsh_malloc(sizeof(*io));
+	io->entry = entry;
+	io->write = false;
+	io->ra = ra;
+	io->export = op_ctx->ctx_export;
+	io->state = state;
+	io->offset = offset;
+	io->read_amount = read_amount;
+	io->eof = eof;
+	io->done_cb = done_cb;
+	io->caller_data = caller_data;
+
+	subcall(
+		entry->sub_handle->obj_ops.read2_async(
+			entry->sub_handle, bypass, state, offset, buf_size,
+			buffer, read_amount, eof, info, mdc_async_io_done, io)
+	       );
+}
+
+/**
+ * @brief Write to a file asynchronously
+ *
+ * Delegate to sub-FSAL
+ *
+ * @param[in] obj_hdl	Object owning state
+ * @param[in] bypass	Bypass any non-mandatory deny write
+ * @param[in] state	Open file state to write
+ * @param[in] offset	Offset into file
+ * @param[in] buf_size	Size of write buffer
+ * @param[in] buffer	Buffer to write from
+ * @param[out] write_amount	Amount written in bytes
+ * @param[out] fsal_stable	true if write was to stable storage
+ * @param[in] info	io_info for WRITE_PLUS
+ * @param[in] done_cb	Completion callback
+ * @param[in] caller_data	Passed to done_cb
+ */
+void mdcache_write2_async(struct fsal_obj_handle *obj_hdl,
+			  bool bypass,
+			  struct state_t *state,
+			  uint64_t offset,
+			  size_t buf_size,
+			  void *buffer,
+			  size_t *write_amount,
+			  bool *fsal_stable,
+			  struct io_info *info,
+			  fsal_async_cb done_cb,
+			  void *caller_data)
+{
+	mdcache_entry_t *entry =
+		container_of(obj_hdl, mdcache_entry_t, obj_handle);
+	struct mdc_async_io *io;
+	struct iovec iov = {buffer, buf_size};
+
+	if (mdc_wb_enabled(obj_hdl) &&
+	    mdc_wb_write(entry, bypass, state, offset, &iov, 1, buf_size,
+			 info, write_amount, fsal_stable)) {
+		done_cb(obj_hdl, fsalstat(ERR_FSAL_NO_ERROR, 0), caller_data);
+		return;
+	}
+
+	io = gsh_malloc(sizeof(*io));
+	io->entry = entry;
+	io->write = true;
+	io->ra = false;
+	io->done_cb = done_cb;
+	io->caller_data = caller_data;
+
+	subcall(
+		entry->sub_handle->obj_ops.write2_async(
+			entry->sub_handle, bypass, state, offset, buf_size,
+			buffer, write_amount, fsal_stable, info,
+			mdc_async_io_done, io)
+	       );
+}
+
+/**
+ * @brief Seek within a file (new style)
+ *
+ * Delegate to sub-FSAL
+ *
+ * @param[in] obj_hdl	Object owning state
+ * @param[in] state	Open file state to seek within
+ * @param[in] info	io_info for seek
+ * @return FSAL status
+ */
+fsal_status_t mdcache_seek2(struct fsal_obj_handle *obj_hdl,
+			    struct state_t *state,
+			    struct io_info *info)
+{
+	mdcache_entry_t *entry =
+		container_of(obj_hdl, mdcache_entry_t, obj_handle);
+	fsal_status_t status;
+
+	mdcache_file_wb_flush(entry, 0, UINT64_MAX);
+
+	subcall(
+		status = entry->sub_handle->obj_ops.seek2(
+			entry->sub_handle, state, info)
+	       );
+
+	if (status.major == ERR_FSAL_DELAY)
+		mdcache_kill_entry(entry);
+
+	return status;
+}
+
+/**
+ * @brief Advise access pattern for a file (new style)
+ *
+ * Delegate to sub-FSAL, then apply the hints to our own read-ahead and
+ * report those as honored too.
+ *
+ * @param[in] obj_hdl	Object owning state
+ * @param[in] state	Open file state to advise on
+ * @param[in] hints	io_hints containing advice
+ * @return FSAL status
+ */
+fsal_status_t mdcache_io_advise2(struct fsal_obj_handle *obj_hdl,
+				 struct state_t *state,
+				 struct io_hints *hints)
+{
+	mdcache_entry_t *entry =
+		container_of(obj_hdl, mdcache_entry_t, obj_handle);
+	struct io_hints asked = *hints;
+	fsal_status_t status;
+
+	subcall(
+		status = entry->sub_handle->obj_ops.io_advise2(
+			entry->sub_handle, state, hints)
+	       );
+
+	if (status.major == ERR_FSAL_DELAY)
+		mdcache_kill_entry(entry);
+
+	if (!FSAL_IS_ERROR(status))
+		hints->hints |= mdc_ra_advise(entry, state, &asked);
+
+	return status;
+}
+
+/**
+ * @brief Commit to a file (new style)
+ *
+ * Delegate to sub-FSAL
+ *
+ * @param[in] obj_hdl	Object to commit
+ * @param[in] offset	Offset into file
+ * @param[in] len	Length of commit
+ * @return FSAL status
+ */
+fsal_status_t mdcache_commit2(struct fsal_obj_handle *obj_hdl, off_t offset,
+			      size_t len)
+{
+	mdcache_entry_t *entry =
+		container_of(obj_hdl, mdcache_entry_t, obj_handle);
+	fsal_status_t status;
+
+	/* Gathered data has to reach the sub-FSAL before it can be made
+	 * stable, and a failure writing it out fails the COMMIT.
+	 */
+	status = mdc_wb_sync(entry);
+	if (FSAL_IS_ERROR(status))
+		return status;
+
+	subcall(
+		status = entry->sub_handle->obj_ops.commit2(
+			entry->sub_handle, offset, len)
+	       );
+
+	if (status.major == ERR_FSAL_STALE) {
+		mdcache_kill_entry(entry);
+	} else {
+		atomic_clear_uint32_t_bits(&entry->mde_flags,
+					   MDCACHE_TRUST_ATTRS);
+		mdcache_lru_fd_bump(entry);
+	}
+
+	return status;
+}
+
+/**
+ * @brief Lock/unlock a range in a file (new style)
+ *
+ * Delegate to sub-FSAL
+ *
+ * @param[in] obj_hdl	Object owning state
+ * @param[in] state	Open file state to lock/unlock
+ * @param[in] p_owner	Private data for lock
+ * @param[in] lock_op	Lock operation
+ * @param[in] req_lock	Parameters for requested lock
+ * @param[in] conflicting_lock	Description of existing conflicting lock
+ * @return FSAL status
+ */
+fsal_status_t mdcache_lock_op2(struct fsal_obj_handle *obj_hdl,
+			      struct state_t *state,
+			      void *p_owner,
+			      fsal_lock_op_t lock_op,
+			      fsal_lock_param_t *req_lock,
+			      fsal_lock_param_t *conflicting_lock)
+{
+	mdcache_entry_t *entry =
+		container_of(obj_hdl, mdcache_entry_t, obj_handle);
+	fsal_status_t status;
+
+	/* Another locker must find the data written under the lock */
+	mdcache_file_wb_flush(entry, 0, UINT64_MAX);
+
+	subcall(
+		status = entry->sub_handle->obj_ops.lock_op2(
+			entry->sub_handle, state, p_owner, lock_op, req_lock,
+			conflicting_lock)
+	       );
+
+	return status;
+}
+
+/**
+ * @brief Close a file (new style)
+ *
+ * @param[in] obj_hdl	Object owning state
+ * @param[in] state	Open file state to close
+ * @return FSAL status
+ */
+fsal_status_t mdcache_close2(struct fsal_obj_handle *obj_hdl,
+			     struct state_t *state)
+{
+	mdcache_entry_t *entry =
+		container_of(obj_hdl, mdcache_entry_t, obj_handle);
+	fsal_status_t status;
+
+	mdc_wb_close(entry, state);
+
+	subcall(
+		status = entry->sub_handle->obj_ops.close2(
+			  entry->sub_handle, state)
+	       );
+
+	mdc_ra_close(entry, state);
 
 	if (test_mde_flags(entry, MDCACHE_UNREACHABLE) &&
 	    !mdc_has_state(entry)) {
@@ -39,6 +39,7 @@
 #include "nfs_exports.h"
 #include "sal_functions.h"
 #include <os/subr.h>
+#include "city.h"
 
 #include "mdcache_lru.h"
 #include "mdcache_hash.h"
@@ -708,13 +709,13 @@ static fsal_status_t mdcache_readdir(struct fsal_obj_handle *dir_hdl,
 		}
 	} else {
 		/* Start at beginning */
-		dirent_node = avltree_first(&directory->fsobj.fsdir.avl.t);
+		dirent_node = avltree_first(&directory->fsobj.fsdir->avl.t);
 	}
 
 	LogFullDebug(COMPONENT_NFS_READDIR,
 		     "About to readdir in mdcache_readdir: directory=%p cookie=%"
 		     PRIu64 " collisions %d",
-		     directory, *whence, directory->fsobj.fsdir.avl.collisions);
+		     directory, *whence, directory->fsobj.fsdir->avl.collisions);
 
 	/* Now satisfy the request from the cached readdir--stop when either
 	 * the requested sequence or dirent sequence is exhausted */
@@ -794,6 +795,140 @@ unlock_dir:
 	return status;
 }
 
+/**
+ * @brief Hash the supplementary groups of the caller
+ *
+ * @param[in] creds Caller credentials
+ *
+ * @return Hash of the group list.
+ */
+static inline uint64_t mdc_access_groups(const struct user_cred *creds)
+{
+	return CityHash64WithSeed((const char *)creds->caller_garray,
+				  creds->caller_glen * sizeof(gid_t),
+				  creds->caller_glen);
+}
+
+/**
+ * @brief Look for a remembered access decision
+ *
+ * @param[in]  entry       Entry to check
+ * @param[in]  groups      Hash of the caller's groups
+ * @param[in]  access_type Access requested
+ * @param[out] allowed     Access that could be granted
+ * @param[out] denied      Access that would be denied
+ * @param[out] status      The decision, if found
+ *
+ * @retval true if a decision applies.
+ */
+static bool mdc_access_lookup(mdcache_entry_t *entry, uint64_t groups,
+			      fsal_accessflags_t access_type,
+			      fsal_accessflags_t *allowed,
+			      fsal_accessflags_t *denied,
+			      fsal_status_t *status)
+{
+	const struct user_cred *creds = op_ctx->creds;
+	struct mdcache_access_cache *ac;
+	attrmask_t mask;
+	bool found = false;
+	uint32_t i;
+
+	mask = op_ctx->fsal_export->exp_ops.fs_supported_attrs(
+				op_ctx->fsal_export) &
+	       (ATTRS_CREDS | ATTR_MODE | ATTR_ACL);
+
+	PTHREAD_RWLOCK_rdlock(&entry->attr_lock);
+
+	ac = entry->access;
+	if (ac == NULL || !mdcache_is_attrs_valid(entry, mask))
+		goto out;
+
+	for (i = 0; i < ac->count; i++) {
+		if (ac->slots[i].gen != entry->access_gen ||
+		    ac->slots[i].access_type != access_type ||
+		    ac->slots[i].uid != creds->caller_uid ||
+		    ac->slots[i].gid != creds->caller_gid ||
+		    ac->slots[i].groups != groups)
+			continue;
+
+		if (allowed != NULL)
+			*allowed = ac->slots[i].allowed;
+		if (denied != NULL)
+			*denied = ac->slots[i].denied;
+		*status = fsalstat(ac->slots[i].major, 0);
+		found = true;
+		break;
+	}
+
+out:
+	PTHREAD_RWLOCK_unlock(&entry->attr_lock);
+
+	return found;
+}
+
+/**
+ * @brief Remember an access decision
+ *
+ * @param[in,out] entry       Entry checked
+ * @param[in]     gen         Entry access_gen before the check
+ * @param[in]     groups      Hash of the caller's groups
+ * @param[in]     access_type Access requested
+ * @param[in]     allowed     Access that could be granted
+ * @param[in]     denied      Access that would be denied
+ * @param[in]     major       The decision
+ */
+static void mdc_access_add(mdcache_entry_t *entry, uint32_t gen,
+			   uint64_t groups, fsal_accessflags_t access_type,
+			   fsal_accessflags_t allowed,
+			   fsal_accessflags_t denied, fsal_errors_t major)
+{
+	const struct user_cred *creds = op_ctx->creds;
+	uint32_t max = mdcache_param.access_max;
+	struct mdcache_access_cache *ac;
+	uint32_t i;
+
+	PTHREAD_RWLOCK_wrlock(&entry->attr_lock);
+
+	/* Attributes loaded while we checked may not be the ones the
+	 * decision was made on.
+	 */
+	if (entry->access_gen != gen)
+		goto out;
+
+	ac = entry->access;
+	if (ac == NULL) {
+		ac = gsh_calloc(1, sizeof(*ac) + max * sizeof(ac->slots[0]));
+		ac->max = max;
+		entry->access = ac;
+	}
+
+	/* Reuse a stale slot before evicting a live one */
+	for (i = 0; i < ac->count; i++)
+		if (ac->slots[i].gen != gen)
+			break;
+
+	if (i == ac->count) {
+		if (ac->count < ac->max) {
+			ac->count++;
+		} else {
+			i = ac->hand;
+			ac->hand = (ac->hand + 1) % ac->max;
+		}
+	}
+
+	ac->slots[i].uid = creds->caller_uid;
+	ac->slots[i].gid = creds->caller_gid;
+	ac->slots[i].groups = groups;
+	ac->slots[i].gen = gen;
+	ac->slots[i].access_type = access_type;
+	ac->slots[i].allowed = allowed;
+	ac->slots[i].denied = denied;
+	ac->slots[i].major = major;
+
+out:
+	PTHREAD_RWLOCK_unlock(&entry->attr_lock);
+}
+
 /**
  * @brief Check access for a given user against a given object
  *
@@ -824,12 +959,43 @@ static fsal_status_t mdcache_test_access(struct fsal_obj_handle *obj_hdl,
 {
 	mdcache_entry_t *entry =
 		container_of(obj_hdl, mdcache_entry_t, obj_handle);
+	fsal_accessflags_t allow = 0, deny = 0;
+	fsal_status_t status;
+	uint64_t groups;
+	uint32_t gen;
 
 	if (owner_skip && entry->attrs.owner == op_ctx->creds->caller_uid)
 		return fsalstat(ERR_FSAL_NO_ERROR, 0);
 
-	return fsal_test_access(obj_hdl, access_type, allowed, denied,
-				owner_skip);
+	if (mdcache_param.access_max == 0)
+		return fsal_test_access(obj_hdl, access_type, allowed, denied,
+					owner_skip);
+
+	groups = mdc_access_groups(op_ctx->creds);
+	if (mdc_access_lookup(entry, groups, access_type, allowed, denied,
+			      &status))
+		return status;
+
+	gen = atomic_fetch_uint32_t(&entry->access_gen);
+
+	status = fsal_test_access(obj_hdl, access_type, &allow, &deny,
+				  owner_skip);
+
+	if (allowed != NULL)
+		*allowed = allow;
+	if (denied != NULL)
+		*denied = deny;
+
+	/* Only a plain grant or refusal says anything about the next
+	 * call, and a grant because we own the file does not.
+	 */
+	if ((status.major == ERR_FSAL_NO_ERROR ||
+	     status.major == ERR_FSAL_ACCESS) &&
+	    !(owner_skip && status.major == ERR_FSAL_NO_ERROR))
+		mdc_access_add(entry, gen, groups, access_type, allow, deny,
+			       status.major);
+
+	return status;
 }
 
 /**
@@ -1060,7 +1226,7 @@ unlock:
 	if (mdc_olddir != mdc_newdir && obj_hdl->type == DIRECTORY) {
 		PTHREAD_RWLOCK_wrlock(&mdc_obj->content_lock);
 
-		mdcache_free_fh(&mdc_obj->fsobj.fsdir.parent);
+		mdcache_free_fh(&mdc_obj->fsobj.fsdir->parent);
 		mdc_dir_add_parent(mdc_obj, mdc_newdir);
 
 		PTHREAD_RWLOCK_unlock(&mdc_obj->content_lock);
@@ -1073,103 +1239,149 @@ unlock:
 }
 
 /**
- * @brief Refresh the attributes for an mdcache entry.
+ * @brief Install freshly fetched attributes into an mdcache entry.
  *
- * NOTE: Caller must hold the attribute lock.
+ * NOTE: Caller must hold the attribute lock for write.
  *
- *       The caller must also call mdcache_kill_entry after releasing the
- *       attr_lock if ERR_FSAL_STALE is returned.
- *
- * @param[in] entry       The mdcache entry to refresh attributes for.
- * @param[in] need_acl    Indicates if the ACL needs updating.
+ * @param[in] entry       The mdcache entry the attributes belong to.
+ * @param[in] attrs       Attributes from the sub-FSAL, consumed.
+ * @param[in] need_acl    The ACL was requested.
  * @param[in] invalidate  Invalidate the dirent cache if the entry is a
- *                        directory.
+ *                        directory that changed.
  */
 
-fsal_status_t mdcache_refresh_attrs(mdcache_entry_t *entry, bool need_acl,
-				    bool invalidate)
+void mdcache_install_attrs(mdcache_entry_t *entry, struct attrlist *attrs,
+			   bool need_acl, bool invalidate)
 {
-	struct attrlist attrs;
-	fsal_status_t status = {0, 0};
 	struct timespec oldmtime;
+	attrmask_t oldvalid;
+	uint64_t oldchange;
+	bool changed;
 
 	/* Use this to detect if we should invalidate a directory. */
-	oldmtime = entry->attrs.mtime;
-
-	/* We always ask for all regular attributes, even if the caller was
-	 * only interested in the ACL.
-	 */
-	fsal_prepare_attrs(&attrs, op_ctx->fsal_export->exp_ops.
-		fs_supported_attrs(op_ctx->fsal_export) | ATTR_RDATTR_ERR);
-
-	if (!need_acl) {
-		/* Don't request the ACL if not necessary. */
-		attrs.request_mask &= ~ATTR_ACL;
-	}
+	mdc_attrs_time(&entry->attrs, MDC_MTIME, &oldmtime);
+	oldvalid = entry->attrs.valid_mask;
+	oldchange = entry->attrs.change;
 
 	/* We will want all the requested attributes in the entry */
-	entry->attrs.request_mask = attrs.request_mask;
-
-	subcall(
-		status = entry->sub_handle->obj_ops.getattrs(
-			entry->sub_handle, &attrs)
-	       );
-
-	if (FSAL_IS_ERROR(status)) {
-		/* Done with the attrs */
-		fsal_release_attrs(&attrs);
+	entry->attrs.request_mask = attrs->request_mask;
 
-		return status;
-	}
-
-	if (entry->attrs.acl != NULL) {
+	if (entry->attrs.ext != NULL && entry->attrs.ext->acl != NULL) {
 		/* We used to have an ACL... */
 		if (need_acl) {
 			/* We requested update of an existing ACL, release the
 			 * old one.
 			 */
-			nfs4_acl_release_entry(entry->attrs.acl);
+			nfs4_acl_release_entry(entry->attrs.ext->acl);
 		} else {
 			/* The ACL wasn't requested, move it into the
 			 * new attributes so we will retain it and make
 			 * it such that the entry attrs DO request the
 			 * ACL.
 			 */
-			attrs.acl = entry->attrs.acl;
-			attrs.valid_mask |= ATTR_ACL;
+			attrs->acl = entry->attrs.ext->acl;
+			attrs->valid_mask |= ATTR_ACL;
 			entry->attrs.request_mask |= ATTR_ACL;
 		}
 
 		/* ACL was released or moved to new attributes. */
-		entry->attrs.acl = NULL;
+		entry->attrs.ext->acl = NULL;
 	}
 
-	if (attrs.expire_time_attr == 0) {
+	if (attrs->expire_time_attr == 0) {
 		/* FSAL did not set this, retain what was in the entry. */
-		attrs.expire_time_attr = entry->attrs.expire_time_attr;
+		attrs->expire_time_attr = entry->attrs.expire_time_attr;
 	}
 
 	/* Now move the new attributes into the entry. */
-	fsal_copy_attrs(&entry->attrs, &attrs, true);
+	mdc_attrs_set(&entry->attrs, attrs);
+	fattr4_cache_invalidate(entry->obj_handle.state_hdl);
 
 	/* Done with the attrs (we didn't need to call this since the
-	 * fsal_copy_attrs preceding consumed all the references, but we
+	 * mdc_attrs_set preceding consumed all the references, but we
 	 * release them anyway to make it easy to scan the code for correctness.
 	 */
-	fsal_release_attrs(&attrs);
+	fsal_release_attrs(attrs);
 
-	mdc_fixup_md(entry, &attrs);
+	mdc_fixup_md(entry, attrs);
 
-	LogAttrlist(COMPONENT_CACHE_INODE, NIV_FULL_DEBUG,
-		    "attrs ", &entry->attrs, true);
+	if (isFullDebug(COMPONENT_CACHE_INODE)) {
+		struct attrlist cached;
+
+		fsal_prepare_attrs(&cached, 0);
+		mdc_attrs_get(&cached, &entry->attrs);
+		LogAttrlist(COMPONENT_CACHE_INODE, NIV_FULL_DEBUG,
+			    "attrs ", &cached, true);
+	}
+
+	/* A change counter on both sides is exact.  The mtime misses
+	 * changes within its granularity, so without one the dirents can
+	 * go stale until the directory changes again.
+	 */
+	if (oldvalid & entry->attrs.valid_mask & ATTR_CHANGE_COUNTER)
+		changed = oldchange != entry->attrs.change;
+	else
+		changed = mdc_attrs_time_cmp(&oldmtime, &entry->attrs,
+					     MDC_MTIME) < 0;
 
-	if (invalidate && entry->obj_handle.type == DIRECTORY &&
-	    gsh_time_cmp(&oldmtime, &entry->attrs.mtime) < 0) {
+	if (invalidate && entry->obj_handle.type == DIRECTORY && changed) {
 
 		PTHREAD_RWLOCK_wrlock(&entry->content_lock);
 		mdcache_dirent_invalidate_all(entry);
 		PTHREAD_RWLOCK_unlock(&entry->content_lock);
 	}
+}
+
+/**
+ * @brief Refresh the attributes for an mdcache entry.
+ *
+ * NOTE: Caller must hold the attribute lock.
+ *
+ *       The caller must also call mdcache_kill_entry after releasing the
+ *       attr_lock if ERR_FSAL_STALE is returned.
+ *
+ * @param[in] entry       The mdcache entry to refresh attributes for.
+ * @param[in] need_acl    Indicates if the ACL needs updating.
+ * @param[in] invalidate  Invalidate the dirent cache if the entry is a
+ *                        directory.
+ */
+
+fsal_status_t mdcache_refresh_attrs(mdcache_entry_t *entry, bool need_acl,
+				    bool invalidate)
+{
+	struct attrlist attrs;
+	fsal_status_t status = {0, 0};
+
+	/* We always ask for all regular attributes, even if the caller was
+	 * only interested in the ACL.
+	 */
+	fsal_prepare_attrs(&attrs, op_ctx->fsal_export->exp_ops.
+		fs_supported_attrs(op_ctx->fsal_export) | ATTR_RDATTR_ERR);
+
+	if (!need_acl) {
+		/* Don't request the ACL if not necessary. */
+		attrs.request_mask &= ~ATTR_ACL;
+	}
+
+	/* We will want all the requested attributes in the entry */
+	entry->attrs.request_mask = attrs.request_mask;
+
+	/* So the size and times fetched include gathered writes */
+	mdcache_file_wb_flush(entry, 0, UINT64_MAX);
+
+	subcall(
+		status = entry->sub_handle->obj_ops.getattrs(
+			entry->sub_handle, &attrs)
+	       );
+
+	if (FSAL_IS_ERROR(status)) {
+		/* Done with the attrs */
+		fsal_release_attrs(&attrs);
+
+		return status;
+	}
+
+	mdcache_install_attrs(entry, &attrs, need_acl, invalidate);
 
 	return status;
 }
@@ -1190,6 +1402,16 @@ static fsal_status_t mdcache_getattrs(struct fsal_obj_handle *obj_hdl,
 	mdcache_entry_t *entry =
 		container_of(obj_hdl, mdcache_entry_t, obj_handle);
 	fsal_status_t status = {0, 0};
+	struct timespec oldctime;
+	uint64_t oldchange;
+	bool trusted;
+	bool need_acl = (attrs_out->request_mask & ATTR_ACL) != 0;
+	struct mdc_flight *flight = NULL;
+
+	/* Entries held across requests may have missed an export wide
+	 * invalidate since they were last found.
+	 */
+	mdc_inval_export_check(entry);
 
 	PTHREAD_RWLOCK_rdlock(&entry->attr_lock);
 
@@ -1198,8 +1420,28 @@ static fsal_status_t mdcache_getattrs(struct fsal_obj_handle *obj_hdl,
 		goto unlock;
 	}
 
-	/* Promote to write lock */
 	PTHREAD_RWLOCK_unlock(&entry->attr_lock);
+
+	/* If a refresh is already under way, wait for it and share its
+	 * result rather than queueing for the write lock behind it.
+	 */
+	if (!mdc_flight_begin(entry, NULL, need_acl ? MDC_FLIGHT_ACL : 0,
+			      &flight)) {
+		status = flight->status;
+		mdc_flight_put(flight);
+		flight = NULL;
+
+		if (FSAL_IS_ERROR(status)) {
+			if (attrs_out->request_mask & ATTR_RDATTR_ERR)
+				attrs_out->valid_mask = ATTR_RDATTR_ERR;
+			return status;
+		}
+
+		PTHREAD_RWLOCK_rdlock(&entry->attr_lock);
+		goto unlock;
+	}
+
+	/* Promote to write lock */
 	PTHREAD_RWLOCK_wrlock(&entry->attr_lock);
 
 	if (mdcache_is_attrs_valid(entry, attrs_out->request_mask)) {
@@ -1207,8 +1449,12 @@ static fsal_status_t mdcache_getattrs(struct fsal_obj_handle *obj_hdl,
 		goto unlock;
 	}
 
-	status = mdcache_refresh_attrs(
-			entry, (attrs_out->request_mask & ATTR_ACL) != 0, true);
+	/* Remember what we had, to see whether expiry bought us anything */
+	trusted = test_mde_flags(entry, MDCACHE_TRUST_ATTRS);
+	oldchange = entry->attrs.change;
+	mdc_attrs_time(&entry->attrs, MDC_CTIME, &oldctime);
+
+	status = mdcache_refresh_attrs(entry, need_acl, true);
 
 	if (FSAL_IS_ERROR(status)) {
 		/* We failed to fetch any attributes. Pass that fact back to
@@ -1220,15 +1466,27 @@ static fsal_status_t mdcache_getattrs(struct fsal_obj_handle *obj_hdl,
 		goto unlock_no_attrs;
 	}
 
+	/* An upcall that dropped our trust counts as a change.  Without a
+	 * change counter a change derived from coarse times may not move,
+	 * so the ctime is compared too.
+	 */
+	mdcache_attr_ttl_adapt(entry, !trusted ||
+			       oldchange != entry->attrs.change ||
+			       (!(entry->attrs.valid_mask &
+				  ATTR_CHANGE_COUNTER) &&
+				mdc_attrs_time_cmp(&oldctime, &entry->attrs,
+						   MDC_CTIME) != 0));
+
 unlock:
 
-	/* Struct copy */
-	fsal_copy_attrs(attrs_out, &entry->attrs, false);
+	mdc_attrs_get(attrs_out, &entry->attrs);
 
 unlock_no_attrs:
 
 	PTHREAD_RWLOCK_unlock(&entry->attr_lock);
 
+	mdc_flight_end(flight, status, NULL);
+
 	if (FSAL_IS_ERROR(status) && (status.major == ERR_FSAL_STALE))
 		mdcache_kill_entry(entry);
 
@@ -1315,6 +1573,10 @@ static fsal_status_t mdcache_setattr2(struct fsal_obj_handle *obj_hdl,
 	uint64_t change;
 	bool need_acl = false;
 
+	/* Gathered writes land before the new attributes (a truncate in
+	 * particular) */
+	mdcache_file_wb_flush(entry, 0, UINT64_MAX);
+
 	PTHREAD_RWLOCK_wrlock(&entry->attr_lock);
 
 	change = entry->attrs.change;
@@ -1352,6 +1614,8 @@ unlock:
 
 	if (FSAL_IS_ERROR(status) && (status.major == ERR_FSAL_STALE))
 		mdcache_kill_entry(entry);
+	else if (FSAL_TEST_MASK(attrs->valid_mask, ATTR_SIZE))
+		mdcache_file_ra_invalidate(entry);
 
 	return status;
 }
@@ -1417,7 +1681,7 @@ static fsal_status_t mdcache_unlink(struct fsal_obj_handle *dir_hdl,
 					   MDCACHE_TRUST_ATTRS);
 
 		if (entry->obj_handle.type == DIRECTORY)
-			mdcache_free_fh(&entry->fsobj.fsdir.parent);
+			mdcache_free_fh(&entry->fsobj.fsdir->parent);
 
 		mdc_unreachable(entry);
 	}
@@ -1473,7 +1737,7 @@ static bool mdcache_handle_is(struct fsal_obj_handle *obj_hdl,
 		container_of(obj_hdl, mdcache_entry_t, obj_handle);
 	bool status;
 
-	subcall(
+	subcall_nowait(
 		status = entry->sub_handle->obj_ops.handle_is(
 			entry->sub_handle, type)
 	       );
@@ -1500,7 +1764,7 @@ static fsal_status_t mdcache_handle_to_wire(
 		container_of(obj_hdl, mdcache_entry_t, obj_handle);
 	fsal_status_t status;
 
-	subcall(
+	subcall_nowait(
 		status = entry->sub_handle->obj_ops.handle_to_wire(
 			entry->sub_handle, out_type, fh_desc)
 	       );
@@ -1522,7 +1786,7 @@ static void mdcache_handle_to_key(struct fsal_obj_handle *obj_hdl,
 	mdcache_entry_t *entry =
 		container_of(obj_hdl, mdcache_entry_t, obj_handle);
 
-	subcall(
+	subcall_nowait(
 		entry->sub_handle->obj_ops.handle_to_key(entry->sub_handle,
 							  fh_desc)
 	       );
@@ -1546,7 +1810,7 @@ static bool mdcache_handle_cmp(struct fsal_obj_handle *obj_hdl1,
 		container_of(obj_hdl1, mdcache_entry_t, obj_handle);
 	bool status;
 
-	subcall(
+	subcall_nowait(
 		status = entry->sub_handle->obj_ops.handle_cmp(
 			entry->sub_handle, obj_hdl2)
 	       );
@@ -1781,6 +2045,11 @@ void mdcache_handle_ops_init(struct fsal_obj_ops *ops)
 	ops->reopen2 = mdcache_reopen2;
 	ops->read2 = mdcache_read2;
 	ops->write2 = mdcache_write2;
+	ops->read2_async = mdcache_read2_async;
+	ops->write2_async = mdcache_write2_async;
+	ops->writev2 = mdcache_writev2;
+	ops->copy = mdcache_copy;
+	ops->clone = mdcache_clone;
 	ops->seek2 = mdcache_seek2;
 	ops->io_advise2 = mdcache_io_advise2;
 	ops->commit2 = mdcache_commit2;
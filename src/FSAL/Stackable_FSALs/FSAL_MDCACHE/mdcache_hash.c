@@ -39,6 +39,7 @@
 #include "fsal.h"
 #include "nfs_core.h"
 #include "log.h"
+#include "common_utils.h"
 #include "mdcache_int.h"
 #include "mdcache_hash.h"
 
@@ -63,6 +64,167 @@
 struct cih_lookup_table cih_fhcache;
 static bool initialized;
 
+/**
+ * @brief Epoch-based reclamation for lockless readers
+ *
+ * Each thread that reads without the partition lock owns a reader
+ * record, published in the reader list on first use.  On entry the
+ * reader stores the current global epoch in its record, and clears it
+ * on exit.  Deferred objects are tagged with the epoch at the time they
+ * became unreachable, after which the global epoch is advanced; an
+ * object may be released once no reader has published an epoch at or
+ * below its tag.
+ */
+struct cih_reader {
+	struct glist_head q;
+	uint64_t epoch;		/*< 0 when outside a read section */
+};
+
+struct cih_deferred {
+	struct glist_head q;
+	uint64_t epoch;
+	void (*fn)(void *);
+	void *arg;
+};
+
+/* Reclaim limbo once it holds this many objects */
+#define CIH_DEFER_BATCH 64
+
+static struct {
+	pthread_mutex_t mtx;
+	pthread_key_t key;
+	struct glist_head readers;
+	struct glist_head limbo;
+	uint32_t nlimbo;
+	uint64_t epoch;
+} cih_ebr = {
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+	.readers = GLIST_HEAD_INIT(cih_ebr.readers),
+	.limbo = GLIST_HEAD_INIT(cih_ebr.limbo),
+	.epoch = 1,
+};
+
+static __thread struct cih_reader *cih_self;
+
+static void cih_reader_destroy(void *arg)
+{
+	struct cih_reader *reader = arg;
+
+	PTHREAD_MUTEX_lock(&cih_ebr.mtx);
+	glist_del(&reader->q);
+	PTHREAD_MUTEX_unlock(&cih_ebr.mtx);
+	gsh_free(reader);
+}
+
+static struct cih_reader *cih_reader_register(void)
+{
+	struct cih_reader *reader = gsh_calloc(1, sizeof(*reader));
+
+	PTHREAD_MUTEX_lock(&cih_ebr.mtx);
+	glist_add_tail(&cih_ebr.readers, &reader->q);
+	PTHREAD_MUTEX_unlock(&cih_ebr.mtx);
+	(void) pthread_setspecific(cih_ebr.key, reader);
+	cih_self = reader;
+
+	return reader;
+}
+
+/**
+ * @brief Enter a lockless read section
+ */
+void cih_read_enter(void)
+{
+	struct cih_reader *reader = cih_self;
+
+	if (unlikely(!reader))
+		reader = cih_reader_register();
+
+	atomic_store_uint64_t(&reader->epoch,
+			      atomic_fetch_uint64_t(&cih_ebr.epoch));
+}
+
+/**
+ * @brief Leave a lockless read section
+ */
+void cih_read_exit(void)
+{
+	atomic_store_uint64_t(&cih_self->epoch, 0);
+}
+
+/**
+ * @brief Release deferred objects no reader can still see
+ *
+ * @note Called with cih_ebr.mtx held; returns with it released.
+ */
+static void cih_reclaim_locked(void)
+{
+	struct glist_head *glist, *glistn;
+	struct cih_reader *reader;
+	struct cih_deferred *def;
+	uint64_t oldest = UINT64_MAX, epoch;
+	struct glist_head ready;
+
+	glist_init(&ready);
+
+	glist_for_each(glist, &cih_ebr.readers) {
+		reader = glist_entry(glist, struct cih_reader, q);
+		epoch = atomic_fetch_uint64_t(&reader->epoch);
+		if (epoch != 0 && epoch < oldest)
+			oldest = epoch;
+	}
+
+	glist_for_each_safe(glist, glistn, &cih_ebr.limbo) {
+		def = glist_entry(glist, struct cih_deferred, q);
+		if (def->epoch >= oldest)
+			continue;
+		glist_del(&def->q);
+		glist_add_tail(&ready, &def->q);
+		--cih_ebr.nlimbo;
+	}
+	PTHREAD_MUTEX_unlock(&cih_ebr.mtx);
+
+	glist_for_each_safe(glist, glistn, &ready) {
+		def = glist_entry(glist, struct cih_deferred, q);
+		glist_del(&def->q);
+		def->fn(def->arg);
+		gsh_free(def);
+	}
+}
+
+/**
+ * @brief Free an object once lockless readers are done with it
+ *
+ * The object must already be unreachable through the cache slots.
+ *
+ * @param[in] fn   Destructor
+ * @param[in] arg  Object
+ */
+void cih_defer(void (*fn)(void *), void *arg)
+{
+	struct cih_deferred *def = gsh_malloc(sizeof(*def));
+
+	def->fn = fn;
+	def->arg = arg;
+
+	PTHREAD_MUTEX_lock(&cih_ebr.mtx);
+	def->epoch = atomic_postinc_uint64_t(&cih_ebr.epoch);
+	glist_add_tail(&cih_ebr.limbo, &def->q);
+	if (++cih_ebr.nlimbo < CIH_DEFER_BATCH) {
+		PTHREAD_MUTEX_unlock(&cih_ebr.mtx);
+		return;
+	}
+	cih_reclaim_locked();
+}
+
+/**
+ * @brief Release whatever deferred objects are safe to release
+ */
+void cih_reclaim(void)
+{
+	PTHREAD_MUTEX_lock(&cih_ebr.mtx);
+	cih_reclaim_locked();
+}
+
 /**
  * @brief Initialize the package.
  */
@@ -84,6 +246,7 @@ cih_pkginit(void)
 	cih_fhcache.partition =
 		gsh_calloc(cih_fhcache.npart, sizeof(cih_partition_t));
 	cih_fhcache.cache_sz = mdcache_param.cache_size;
+	(void) pthread_key_create(&cih_ebr.key, cih_reader_destroy);
 	for (ix = 0; ix < cih_fhcache.npart; ++ix) {
 		cp = &cih_fhcache.partition[ix];
 		cp->part_ix = ix;
@@ -104,6 +267,19 @@ cih_pkgdestroy(void)
 {
 	/* Index over partitions */
 	int ix = 0;
+	struct glist_head *glist, *glistn;
+	struct cih_deferred *def;
+
+	/* Callers are quiesced; nothing can still be reading */
+	PTHREAD_MUTEX_lock(&cih_ebr.mtx);
+	glist_for_each_safe(glist, glistn, &cih_ebr.limbo) {
+		def = glist_entry(glist, struct cih_deferred, q);
+		glist_del(&def->q);
+		def->fn(def->arg);
+		gsh_free(def);
+	}
+	cih_ebr.nlimbo = 0;
+	PTHREAD_MUTEX_unlock(&cih_ebr.mtx);
 
 	/* Destroy the partitions, warning if not empty */
 	for (ix = 0; ix < cih_fhcache.npart; ++ix) {
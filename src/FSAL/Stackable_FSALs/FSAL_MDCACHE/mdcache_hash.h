@@ -67,6 +67,8 @@ typedef struct cih_partition {
 	pthread_rwlock_t lock;
 	struct avltree t;
 	struct avltree_node **cache;
+	uint32_t seq;	/*< Bumped around write-locked sections, odd while
+			    a writer holds the partition */
 #ifdef ENABLE_LOCKTRACE
 	struct {
 		char *func;
@@ -101,6 +103,20 @@ void cih_pkginit(void);
  */
 void cih_pkgdestroy(void);
 
+/**
+ * @brief Lockless reader support
+ *
+ * Readers that dereference entries found without the partition lock
+ * bracket the access with cih_read_enter() and cih_read_exit().  Memory
+ * that such a reader might still see is handed to cih_defer() rather
+ * than freed, and is released once every reader active at the time of
+ * the hand-off has left.
+ */
+void cih_read_enter(void);
+void cih_read_exit(void);
+void cih_defer(void (*fn)(void *), void *arg);
+void cih_reclaim(void);
+
 /**
  * @brief Find the correct partition for a pointer
  *
@@ -211,8 +227,7 @@ cih_hash_key(mdcache_key_t *key,
 	}
 
 	/* hash it */
-	key->hk =
-	    CityHash64WithSeed(fh_desc->addr, fh_desc->len, 557);
+	key->hk = fsal_key_hash(fh_desc);
 
 	return true;
 }
@@ -230,11 +245,16 @@ cih_hash_key(mdcache_key_t *key,
  */
 typedef struct cih_latch {
 	cih_partition_t *cp;
+	bool wlocked;
 } cih_latch_t;
 
 static inline void
 cih_hash_release(cih_latch_t *latch)
 {
+	if (latch->wlocked) {
+		(void) atomic_inc_uint32_t(&latch->cp->seq);
+		latch->wlocked = false;
+	}
 	PTHREAD_RWLOCK_unlock(&(latch->cp->lock));
 }
 
@@ -256,9 +276,12 @@ cih_latch_entry(mdcache_key_t *key, cih_latch_t *latch, uint32_t flags,
 	latch->cp = cp =
 	    cih_partition_of_scalar(&cih_fhcache, key->hk);
 
-	if (flags & CIH_GET_WLOCK)
+	latch->wlocked = (flags & CIH_GET_WLOCK) != 0;
+
+	if (latch->wlocked) {
 		PTHREAD_RWLOCK_wrlock(&cp->lock);	/* SUBTREE_WLOCK */
-	else
+		(void) atomic_inc_uint32_t(&cp->seq);
+	} else
 		PTHREAD_RWLOCK_rdlock(&cp->lock);	/* SUBTREE_RLOCK */
 
 #ifdef ENABLE_LOCKTRACE
@@ -330,6 +353,79 @@ cih_get_by_key_latch(mdcache_key_t *key, cih_latch_t *latch,
 	return entry;
 }
 
+/**
+ * @brief Lookup cache entry by key without taking the partition lock
+ *
+ * Only the partition's direct-mapped cache slot is consulted.  The
+ * slot is read between two samples of the partition sequence count, so
+ * a concurrent removal (always write-locked) is detected and the
+ * lookup gives up.  A reference is taken only if the entry is still
+ * live (refcnt non-zero), and the sequence count is checked once more
+ * afterwards so an entry unhashed in the meantime is handed back.
+ *
+ * An entry returned here carries one reference, but the LRU was not
+ * adjusted; callers wanting an initial ref call mdcache_lru_promote().
+ *
+ * @param key [in] Key being searched
+ *
+ * @return Referenced cache entry on a slot hit, else NULL; NULL means
+ *         only that the caller must take the latched path.
+ */
+static inline mdcache_entry_t *
+cih_get_by_key_lockless(mdcache_key_t *key)
+{
+	cih_partition_t *cp =
+	    cih_partition_of_scalar(&cih_fhcache, key->hk);
+	mdcache_entry_t *entry = NULL;
+	struct avltree_node *node;
+	mdcache_key_t k;
+	uint32_t seq;
+	int32_t refcnt;
+
+	cih_read_enter();
+
+	seq = atomic_fetch_uint32_t(&cp->seq);
+	if (seq & 1)
+		goto out;
+
+	node = (struct avltree_node *)atomic_fetch_voidptr((void **)
+	    &cp->cache[cih_cache_offsetof(&cih_fhcache, key->hk)]);
+	if (!node)
+		goto out;
+
+	entry = avltree_container_of(node, mdcache_entry_t, fh_hk.node_k);
+	k = entry->fh_hk.key;
+
+	/* the copy is only trustworthy if no writer intervened */
+	atomic_full_barrier();
+	if (atomic_fetch_uint32_t(&cp->seq) != seq ||
+	    mdcache_key_cmp(&k, key) != 0) {
+		entry = NULL;
+		goto out;
+	}
+
+	/* take a ref, but never resurrect an entry being freed */
+	do {
+		refcnt = atomic_fetch_int32_t(&entry->lru.refcnt);
+		if (refcnt <= 0) {
+			entry = NULL;
+			goto out;
+		}
+	} while (!atomic_cas_int32_t(&entry->lru.refcnt, refcnt, refcnt + 1));
+
+	if (unlikely(atomic_fetch_uint32_t(&cp->seq) != seq)) {
+		cih_read_exit();
+		mdcache_lru_unref(entry);
+		return NULL;
+	}
+
+	LogDebug(COMPONENT_HASHTABLE_CACHE, "cih lockless hit slot %d",
+		 cih_cache_offsetof(&cih_fhcache, key->hk));
+ out:
+	cih_read_exit();
+	return entry;
+}
+
 #define CIH_SET_NONE     0x0000
 #define CIH_SET_HASHED   0x0001	/* previously hashed entry */
 #define CIH_SET_UNLOCK   0x0002
@@ -392,6 +488,7 @@ cih_remove_checked(mdcache_entry_t *entry)
 	bool freed = false;
 
 	PTHREAD_RWLOCK_wrlock(&cp->lock);
+	(void) atomic_inc_uint32_t(&cp->seq);
 	node = cih_fhcache_inline_lookup(&cp->t, &entry->fh_hk.node_k);
 	if (entry->fh_hk.inavl && node) {
 #ifdef USE_LTTNG
@@ -405,6 +502,7 @@ cih_remove_checked(mdcache_entry_t *entry)
 		/* return sentinel ref */
 		freed = mdcache_lru_unref(entry);
 	}
+	(void) atomic_inc_uint32_t(&cp->seq);
 	PTHREAD_RWLOCK_unlock(&cp->lock);
 
 	return freed;
@@ -44,23 +44,175 @@
 #include <string.h>
 #include <stdbool.h>
 
+#include "nfs_core.h"
 #include "nfs_exports.h"
 
 #include "mdcache_lru.h"
 #include "mdcache_hash.h"
 #include "mdcache_avl.h"
+#include "fridgethr.h"
+#include "city.h"
 #ifdef USE_LTTNG
 #include "gsh_lttng/mdcache.h"
 #endif
 
 static inline bool trust_negative_cache(mdcache_entry_t *parent)
 {
-	return op_ctx_export_has_option(
-				  EXPORT_OPTION_TRUST_READIR_NEGATIVE_CACHE) &&
+	return (op_ctx_export_has_option(
+				  EXPORT_OPTION_TRUST_READIR_NEGATIVE_CACHE) ||
+		test_mde_flags(parent, MDCACHE_IMMUTABLE)) &&
 		parent->icreate_refcnt == 0 &&
 		test_mde_flags(parent, MDCACHE_DIR_POPULATED);
 }
 
+/**
+ * @brief Per-directory cache of names known not to exist
+ *
+ * A small ring of names the FSAL last answered NOENT for, valid only for
+ * the directory change attribute it was filled under.  Eviction is FIFO.
+ */
+struct mdcache_neg_cache {
+	/** Directory change attribute the names were recorded under */
+	uint64_t change;
+	/** Number of slots in use */
+	uint32_t count;
+	/** Next slot to replace once full */
+	uint32_t hand;
+	struct {
+		uint64_t hash;
+		char *name;
+	} names[];
+};
+
+static inline size_t mdc_neg_size(uint32_t max)
+{
+	return sizeof(struct mdcache_neg_cache) +
+		max * sizeof(((struct mdcache_neg_cache *)0)->names[0]);
+}
+
+static inline uint64_t mdc_neg_hash(const char *name)
+{
+	return CityHash64WithSeed(name, strlen(name), 67);
+}
+
+/**
+ * @brief Empty a directory's negative name cache
+ *
+ * @note The content lock MUST be held for write
+ *
+ * @param[in,out] dir  Directory
+ * @param[in]     keep Keep the slot array for reuse
+ */
+static void mdc_neg_purge(mdcache_entry_t *dir, bool keep)
+{
+	struct mdcache_neg_cache *neg = dir->fsobj.fsdir->neg;
+	uint32_t i;
+
+	if (neg == NULL)
+		return;
+
+	for (i = 0; i < neg->count; i++) {
+		(void) atomic_sub_uint64_t(&lru_state.dirent_bytes,
+					   strlen(neg->names[i].name) + 1);
+		gsh_free(neg->names[i].name);
+	}
+	neg->count = 0;
+	neg->hand = 0;
+
+	if (keep)
+		return;
+
+	(void) atomic_sub_uint64_t(&lru_state.dirent_bytes,
+				   mdc_neg_size(mdcache_param.dir.neg_max));
+	gsh_free(neg);
+	dir->fsobj.fsdir->neg = NULL;
+}
+
+/**
+ * @brief Check whether a name is known to be absent from a directory
+ *
+ * Only answers for names recorded while the directory had its current
+ * change attribute, and only while the attributes are trusted.
+ *
+ * @note The content lock MUST be held for read or write
+ *
+ * @param[in] dir   Directory
+ * @param[in] name  Name to check
+ *
+ * @return true if the name is known absent.
+ */
+static bool mdc_neg_lookup(mdcache_entry_t *dir, const char *name)
+{
+	struct mdcache_neg_cache *neg = dir->fsobj.fsdir->neg;
+	uint64_t hash;
+	uint32_t i;
+
+	if (neg == NULL || neg->count == 0 || dir->icreate_refcnt != 0 ||
+	    !test_mde_flags(dir, MDCACHE_TRUST_ATTRS) ||
+	    neg->change != atomic_fetch_uint64_t(&dir->attrs.change))
+		return false;
+
+	hash = mdc_neg_hash(name);
+
+	for (i = 0; i < neg->count; i++) {
+		if (neg->names[i].hash == hash &&
+		    strcmp(neg->names[i].name, name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Record a name the FSAL reported absent
+ *
+ * @note The content lock MUST be held for write
+ *
+ * @param[in,out] dir   Directory
+ * @param[in]     name  Name that does not exist
+ */
+static void mdc_neg_add(mdcache_entry_t *dir, const char *name)
+{
+	struct mdcache_neg_cache *neg = dir->fsobj.fsdir->neg;
+	uint32_t max = mdcache_param.dir.neg_max;
+	uint64_t change;
+	size_t namesize;
+	uint32_t slot;
+
+	if (max == 0 || !test_mde_flags(dir, MDCACHE_TRUST_ATTRS))
+		return;
+
+	change = atomic_fetch_uint64_t(&dir->attrs.change);
+
+	if (neg == NULL) {
+		neg = gsh_calloc(1, mdc_neg_size(max));
+		(void) atomic_add_uint64_t(&lru_state.dirent_bytes,
+					   mdc_neg_size(max));
+		dir->fsobj.fsdir->neg = neg;
+	} else if (neg->change != change) {
+		/* The directory changed, everything recorded is stale */
+		mdc_neg_purge(dir, true);
+	}
+
+	neg->change = change;
+
+	if (neg->count < max) {
+		slot = neg->count++;
+	} else {
+		slot = neg->hand;
+		neg->hand = (neg->hand + 1) % max;
+		(void) atomic_sub_uint64_t(&lru_state.dirent_bytes,
+					   strlen(neg->names[slot].name) + 1);
+		gsh_free(neg->names[slot].name);
+	}
+
+	namesize = strlen(name) + 1;
+	neg->names[slot].hash = mdc_neg_hash(name);
+	neg->names[slot].name = gsh_malloc(namesize);
+	memcpy(neg->names[slot].name, name, namesize);
+	(void) atomic_add_uint64_t(&lru_state.dirent_bytes, namesize);
+}
+
 /**
  * @brief Add a detached dirent to the LRU list (in the MRU position).
  *
@@ -79,7 +231,7 @@ static inline void add_detached_dirent(mdcache_entry_t *parent,
 #ifdef DEBUG_MDCACHE
 	assert(parent->content_lock.__data.__writer != 0);
 #endif
-	if (parent->fsobj.fsdir.detached_count ==
+	if (parent->fsobj.fsdir->detached_count ==
 	    mdcache_param.dir.avl_detached_max) {
 		/* Need to age out oldest detached dirent. */
 		mdcache_dir_entry_t *removed;
@@ -91,23 +243,23 @@ static inline void add_detached_dirent(mdcache_entry_t *parent,
 		 * don't have a racing thread, it's ok that the list is
 		 * unprotected by spin lock while we make the AVL call.
 		 */
-		pthread_spin_lock(&parent->fsobj.fsdir.spin);
+		pthread_spin_lock(&parent->fsobj.fsdir->spin);
 
-		removed = glist_last_entry(&parent->fsobj.fsdir.detached,
+		removed = glist_last_entry(&parent->fsobj.fsdir->detached,
 					   mdcache_dir_entry_t,
 					   chunk_list);
 
-		pthread_spin_unlock(&parent->fsobj.fsdir.spin);
+		pthread_spin_unlock(&parent->fsobj.fsdir->spin);
 
 		/* Remove from active names tree */
 		mdcache_avl_remove(parent, removed);
 	}
 
 	/* Add new entry to MRU (head) of list */
-	pthread_spin_lock(&parent->fsobj.fsdir.spin);
-	glist_add(&parent->fsobj.fsdir.detached, &dirent->chunk_list);
-	parent->fsobj.fsdir.detached_count++;
-	pthread_spin_unlock(&parent->fsobj.fsdir.spin);
+	pthread_spin_lock(&parent->fsobj.fsdir->spin);
+	glist_add(&parent->fsobj.fsdir->detached, &dirent->chunk_list);
+	parent->fsobj.fsdir->detached_count++;
+	pthread_spin_unlock(&parent->fsobj.fsdir->spin);
 }
 
 /**
@@ -186,17 +338,20 @@ static mdcache_entry_t *mdcache_alloc_handle(
 			     sub_handle->type);
 	/* mdcache handlers */
 	mdcache_handle_ops_init(&result->obj_handle.obj_ops);
-	/* state */
+	/* directory-only data */
 	if (sub_handle->type == DIRECTORY)
-		result->obj_handle.state_hdl = &result->fsobj.fsdir.dhdl;
-	else
-		result->obj_handle.state_hdl = &result->fsobj.hdl;
+		mdcache_alloc_fsdir(result);
+	/* state */
+	result->obj_handle.state_hdl = &result->fsobj.hdl;
 	state_hdl_init(result->obj_handle.state_hdl, result->obj_handle.type,
 		       &result->obj_handle);
+	fattr4_cache_enable(result->obj_handle.state_hdl);
 
 	/* Initialize common fields */
 	result->mde_flags = 0;
 	result->icreate_refcnt = 0;
+	result->attr_ttl = 0;
+	result->inval_gen = atomic_fetch_uint64_t(&mdc_inval_gen);
 	glist_init(&result->export_list);
 	atomic_store_int32_t(&result->first_export_id, -1);
 
@@ -265,7 +420,7 @@ void mdc_clean_entry(mdcache_entry_t *entry)
 		/* Clean up dirents */
 		mdcache_dirent_invalidate_all(entry);
 		/* Clean up parent key */
-		mdcache_free_fh(&entry->fsobj.fsdir.parent);
+		mdcache_free_fh(&entry->fsobj.fsdir->parent);
 
 		PTHREAD_RWLOCK_unlock(&entry->content_lock);
 	}
@@ -382,15 +537,15 @@ mdc_get_parent_handle(struct mdcache_fsal_export *export,
 	fsal_status_t status;
 
 	/* Get a wire handle that can be used with create_handle() */
-	subcall_raw(export,
-		    status = sub_parent->obj_ops.handle_to_wire(sub_parent,
+	subcall_nowait_raw(export,
+		status = sub_parent->obj_ops.handle_to_wire(sub_parent,
 					FSAL_DIGEST_NFSV4, &fh_desc)
-		   );
+		);
 	if (FSAL_IS_ERROR(status))
 		return status;
 
 	/* And store in the parent host-handle */
-	mdcache_copy_fh(&entry->fsobj.fsdir.parent, &fh_desc);
+	mdcache_copy_fh(&entry->fsobj.fsdir->parent, &fh_desc);
 
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
@@ -406,7 +561,7 @@ mdc_get_parent(struct mdcache_fsal_export *export, mdcache_entry_t *entry)
 		return;
 	}
 
-	if (entry->fsobj.fsdir.parent.len != 0) {
+	if (entry->fsobj.fsdir->parent.len != 0) {
 		/* Already has a parent pointer */
 		return;
 	}
@@ -429,6 +584,88 @@ mdc_get_parent(struct mdcache_fsal_export *export, mdcache_entry_t *entry)
 		   );
 }
 
+/**
+ * @brief Allocate a dirent in a chunk's arena
+ *
+ * The name and key, and the handle if one is given, are copied in behind
+ * the dirent.
+ *
+ * @note The content lock MUST be held for write
+ *
+ * @param[in,out] chunk     Chunk the dirent goes in
+ * @param[in]     name      Its name
+ * @param[in]     namesize  Size of the name including its NUL
+ * @param[in]     key       Key of the entry it names
+ * @param[in]     fh        Handle to create that entry from, or NULL
+ *
+ * @return The dirent, zeroed but for its chunk, name, key and flags.
+ */
+static mdcache_dir_entry_t *mdc_chunk_alloc_dirent(struct dir_chunk *chunk,
+						   const char *name,
+						   size_t namesize,
+						   mdcache_key_t *key,
+						   struct gsh_buffdesc *fh)
+{
+	struct mdcache_dirent_block *blk = chunk->arena;
+	size_t fh_len = fh != NULL ? fh->len : 0;
+	size_t need = (sizeof(mdcache_dir_entry_t) + namesize +
+		       key->kv.len + fh_len + 7) & ~(size_t) 7;
+	mdcache_dir_entry_t *dirent;
+	size_t size;
+
+	if (blk == NULL || blk->size - blk->used < need) {
+		size = blk == NULL ? MDCACHE_DIRENT_BLOCK_MIN : blk->size * 2;
+		if (size > MDCACHE_DIRENT_BLOCK_MAX)
+			size = MDCACHE_DIRENT_BLOCK_MAX;
+		if (size < need)
+			size = need;
+
+		blk = gsh_malloc(sizeof(*blk) + size);
+		blk->next = chunk->arena;
+		blk->size = size;
+		blk->used = 0;
+		chunk->arena = blk;
+		(void) atomic_add_uint64_t(&lru_state.dirent_bytes,
+					   sizeof(*blk) + size);
+	}
+
+	dirent = (mdcache_dir_entry_t *) (blk->data + blk->used);
+	blk->used += need;
+
+	memset(dirent, 0, sizeof(*dirent));
+	dirent->flags = DIR_ENTRY_ARENA | DIR_ENTRY_ARENA_KEY;
+	dirent->chunk = chunk;
+	memcpy(dirent->name, name, namesize);
+
+	dirent->ckey = *key;
+	dirent->ckey.kv.addr = dirent->name + namesize;
+	memcpy(dirent->ckey.kv.addr, key->kv.addr, key->kv.len);
+
+	if (fh_len != 0) {
+		dirent->fh_len = fh_len;
+		memcpy(mdc_dirent_fh(dirent), fh->addr, fh_len);
+	}
+
+	return dirent;
+}
+
+/**
+ * @brief Free a chunk's dirent arena
+ *
+ * @param[in,out] chunk  Chunk with all its arena dirents removed
+ */
+static void mdc_chunk_free_arena(struct dir_chunk *chunk)
+{
+	struct mdcache_dirent_block *blk;
+
+	while ((blk = chunk->arena) != NULL) {
+		chunk->arena = blk->next;
+		(void) atomic_sub_uint64_t(&lru_state.dirent_bytes,
+					   sizeof(*blk) + blk->size);
+		gsh_free(blk);
+	}
+}
+
 /**
  * @brief Cleans all the dirents belonging to a directory chunk.
  *
@@ -452,6 +689,11 @@ void mdcache_clean_dirent_chunk(struct dir_chunk *chunk)
 		mdcache_avl_remove(parent, dirent);
 	}
 
+	/* Dirents from the arena can only have been in this chunk, and
+	 * are all gone now.
+	 */
+	mdc_chunk_free_arena(chunk);
+
 	/* Remove chunk from directory. */
 	glist_del(&chunk->chunks);
 
@@ -460,6 +702,7 @@ void mdcache_clean_dirent_chunk(struct dir_chunk *chunk)
 	 * chunks is {NULL, NULL} do to the glist_del
 	 * dirents is {&dirents, &dirents}, i.e. empty as a result of the
 	 *                                  glist_for_each_safe above
+	 * arena is NULL
 	 * the other fields are untouched.
 	 */
 }
@@ -477,7 +720,7 @@ void mdcache_clean_dirent_chunks(mdcache_entry_t *entry)
 {
 	struct glist_head *glist, *glistn;
 
-	glist_for_each_safe(glist, glistn, &entry->fsobj.fsdir.chunks) {
+	glist_for_each_safe(glist, glistn, &entry->fsobj.fsdir->chunks) {
 		lru_remove_chunk(glist_entry(glist, struct dir_chunk, chunks));
 	}
 }
@@ -506,6 +749,9 @@ void mdcache_dirent_invalidate_all(mdcache_entry_t *entry)
 	/* Clean the active and deleted trees */
 	mdcache_avl_clean_trees(entry);
 
+	/* Whatever we knew to be missing may not be anymore */
+	mdc_neg_purge(entry, false);
+
 	atomic_clear_uint32_t_bits(&entry->mde_flags, MDCACHE_DIR_POPULATED);
 
 	atomic_set_uint32_t_bits(&entry->mde_flags, MDCACHE_TRUST_CONTENT |
@@ -555,9 +801,9 @@ mdcache_new_entry(struct mdcache_fsal_export *export,
 	*entry = NULL;
 
 	/* Get FSAL-specific key */
-	subcall_raw(export,
-		    sub_handle->obj_ops.handle_to_key(sub_handle, &fh_desc)
-		   );
+	subcall_nowait_raw(export,
+		sub_handle->obj_ops.handle_to_key(sub_handle, &fh_desc)
+		);
 
 	(void) cih_hash_key(&key, export->export.sub_export->fsal, &fh_desc,
 			    CIH_HASH_KEY_PROTOTYPE);
@@ -671,11 +917,12 @@ mdcache_new_entry(struct mdcache_fsal_export *export,
 
 		/* init avl tree */
 		mdcache_avl_init(nentry);
+		nentry->fsobj.fsdir->neg = NULL;
 
 		/* init chunk list and detached dirents list */
-		glist_init(&nentry->fsobj.fsdir.chunks);
-		glist_init(&nentry->fsobj.fsdir.detached);
-		(void) pthread_spin_init(&nentry->fsobj.fsdir.spin,
+		glist_init(&nentry->fsobj.fsdir->chunks);
+		glist_init(&nentry->fsobj.fsdir->detached);
+		(void) pthread_spin_init(&nentry->fsobj.fsdir->spin,
 					 PTHREAD_PROCESS_PRIVATE);
 		break;
 
@@ -711,16 +958,21 @@ mdcache_new_entry(struct mdcache_fsal_export *export,
 	 * requested all supported attributes including ACL).
 	 */
 	nentry->attrs.request_mask = attrs_in->request_mask;
-	fsal_copy_attrs(&nentry->attrs, attrs_in, true);
+	mdc_attrs_set(&nentry->attrs, attrs_in);
 
-	if (nentry->attrs.expire_time_attr == 0) {
+	if (op_ctx_export_has_option(EXPORT_OPTION_IMMUTABLE)) {
+		/* Never expires, see mdcache_is_attrs_valid() */
+		nentry->attrs.expire_time_attr = -1;
+		atomic_set_uint32_t_bits(&nentry->mde_flags,
+					 MDCACHE_IMMUTABLE);
+	} else if (nentry->attrs.expire_time_attr == 0) {
 		nentry->attrs.expire_time_attr =
 		    atomic_fetch_uint32_t(
 			    &op_ctx->ctx_export->expire_time_attr);
 	}
 
 	/* Validate the attributes we just set. */
-	mdc_fixup_md(nentry, &nentry->attrs);
+	mdc_fixup_md(nentry, attrs_in);
 
 	/* Hash and insert entry, after this would need attr_lock to
 	 * access attributes.
@@ -854,6 +1106,7 @@ fsal_status_t
 mdcache_find_keyed(mdcache_key_t *key, mdcache_entry_t **entry)
 {
 	cih_latch_t latch;
+	fsal_status_t status;
 
 	if (key->kv.addr == NULL) {
 		LogDebug(COMPONENT_CACHE_INODE,
@@ -871,11 +1124,17 @@ mdcache_find_keyed(mdcache_key_t *key, mdcache_entry_t **entry)
 			     "Looking for %s", str);
 	}
 
-	*entry = cih_get_by_key_latch(key, &latch,
+	/* Hits in the partition cache slot need no lock */
+	*entry = cih_get_by_key_lockless(key);
+	if (likely(*entry)) {
+		/* Lockless ref is taken, make it an initial one */
+		mdcache_lru_promote(*entry);
+	} else {
+		*entry = cih_get_by_key_latch(key, &latch,
 					CIH_GET_RLOCK | CIH_GET_UNLOCK_ON_MISS,
 					__func__, __LINE__);
-	if (likely(*entry)) {
-		fsal_status_t status;
+		if (!*entry)
+			return fsalstat(ERR_FSAL_NOENT, 0);
 
 		/* Initial Ref on entry */
 		status = mdcache_lru_ref(*entry, LRU_REQ_INITIAL);
@@ -890,29 +1149,29 @@ mdcache_find_keyed(mdcache_key_t *key, mdcache_entry_t **entry)
 			*entry = NULL;
 			return status;
 		}
+	}
 
-		status = mdc_check_mapping(*entry);
+	status = mdc_check_mapping(*entry);
 
-		if (unlikely(FSAL_IS_ERROR(status))) {
-			/* Export is in the process of being removed, don't
-			 * add this entry to the export, and bail out of the
-			 * operation sooner than later.
-			 */
-			mdcache_put(*entry);
-			*entry = NULL;
-			return status;
-		}
+	if (unlikely(FSAL_IS_ERROR(status))) {
+		/* Export is in the process of being removed, don't
+		 * add this entry to the export, and bail out of the
+		 * operation sooner than later.
+		 */
+		mdcache_put(*entry);
+		*entry = NULL;
+		return status;
+	}
 
-		LogFullDebug(COMPONENT_CACHE_INODE,
-			     "Found entry %p",
-			     entry);
+	LogFullDebug(COMPONENT_CACHE_INODE,
+		     "Found entry %p",
+		     entry);
 
-		(void)atomic_inc_uint64_t(&cache_stp->inode_hit);
+	mdc_inval_export_check(*entry);
 
-		return fsalstat(ERR_FSAL_NO_ERROR, 0);
-	}
+	(void)atomic_inc_uint64_t(&cache_stp->inode_hit);
 
-	return fsalstat(ERR_FSAL_NOENT, 0);
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
 /**
@@ -955,12 +1214,23 @@ mdcache_locate_host(struct gsh_buffdesc *fh_desc,
 	if (FSAL_IS_ERROR(status))
 		return status;
 
+	if (op_ctx->fh_key_hash != NULL) {
+		/* The handle carries the hash, a wrong one just misses */
+		key.fsal = sub_export->fsal;
+		key.hk = *op_ctx->fh_key_hash;
+
+		status = mdcache_find_keyed(&key, entry);
+		if (!FSAL_IS_ERROR(status) || status.major != ERR_FSAL_NOENT)
+			goto found;
+	}
+
 	(void)cih_hash_key(&key, sub_export->fsal, &key.kv,
 			    CIH_HASH_KEY_PROTOTYPE);
 
 
 	status = mdcache_find_keyed(&key, entry);
 
+found:
 	if (!FSAL_IS_ERROR(status)) {
 		status = get_optional_attrs(&(*entry)->obj_handle, attrs_out);
 		return status;
@@ -1040,7 +1310,7 @@ fsal_status_t mdc_add_cache(mdcache_entry_t *mdc_parent,
 #ifdef DEBUG_MDCACHE
 	assert(mdc_parent->content_lock.__data.__writer != 0);
 #endif
-	if (avltree_size(&mdc_parent->fsobj.fsdir.avl.t) >
+	if (avltree_size(&mdc_parent->fsobj.fsdir->avl.t) >
 	    mdcache_param.dir.avl_max) {
 		LogFullDebug(COMPONENT_CACHE_INODE, "Parent %p at max",
 			     mdc_parent);
@@ -1080,6 +1350,42 @@ fsal_status_t mdc_add_cache(mdcache_entry_t *mdc_parent,
 	return status;
 }
 
+/**
+ * @brief Create the entry for a dirent left by Dir_Lazy_Entries
+ *
+ * @note Caller MUST hold the content_lock of @a mdc_parent
+ *
+ * @param[in]  mdc_parent  Directory
+ * @param[in]  dirent      Dirent with fh_len set
+ * @param[out] entry       The entry, INITIAL ref'd
+ *
+ * @return FSAL status
+ */
+static fsal_status_t mdc_dirent_instantiate(mdcache_entry_t *mdc_parent,
+					    mdcache_dir_entry_t *dirent,
+					    mdcache_entry_t **entry)
+{
+	char buf[NFS4_FHSIZE];
+	struct gsh_buffdesc fh_desc = { buf, dirent->fh_len };
+	fsal_status_t status;
+
+	/* mdcache_locate_host() may rewrite the handle in place */
+	memcpy(buf, mdc_dirent_fh(dirent), dirent->fh_len);
+
+	status = mdcache_locate_host(&fh_desc, mdc_cur_export(), entry, NULL);
+	if (FSAL_IS_ERROR(status))
+		return status;
+
+	LogFullDebug(COMPONENT_CACHE_INODE,
+		     "Created entry %p for lazy dirent %s",
+		     *entry, dirent->name);
+
+	if ((*entry)->obj_handle.type == DIRECTORY)
+		mdc_dir_add_parent(*entry, mdc_parent);
+
+	return status;
+}
+
 /**
  * @brief Try to get a cached child
  *
@@ -1132,8 +1438,13 @@ fsal_status_t mdc_try_get_cached(mdcache_entry_t *mdc_parent,
 			bump_detached_dirent(mdc_parent, dirent);
 		}
 		status = mdcache_find_keyed(&dirent->ckey, entry);
-		if (!FSAL_IS_ERROR(status))
+		if (FSAL_IS_ERROR(status) && dirent->fh_len != 0)
+			status = mdc_dirent_instantiate(mdc_parent, dirent,
+							entry);
+		if (!FSAL_IS_ERROR(status)) {
+			mdc_inval_subtree_check(mdc_parent, *entry);
 			return status;
+		}
 		LogFullDebug(COMPONENT_CACHE_INODE,
 			     "mdcache_find_keyed %s failed %s",
 			     name, fsal_err_txt(status));
@@ -1147,10 +1458,180 @@ fsal_status_t mdc_try_get_cached(mdcache_entry_t *mdc_parent,
 			 * valid, it can serve negative lookups. */
 			return fsalstat(ERR_FSAL_NOENT, 0);
 		}
+		if (mdc_neg_lookup(mdc_parent, name)) {
+			/* The FSAL told us this name didn't exist, and the
+			 * directory has not changed since.
+			 */
+			LogFullDebug(COMPONENT_CACHE_INODE,
+				     "Negative cache hit %s", name);
+			return fsalstat(ERR_FSAL_NOENT, 0);
+		}
 	}
 	return fsalstat(ERR_FSAL_STALE, 0);
 }
 
+/**
+ * @brief Stripes of in-flight backend calls
+ *
+ * When many clients look up the same name or revalidate the same entry at
+ * once, the first caller makes the FSAL call and the rest wait for it and
+ * take its result instead of issuing their own.
+ */
+#define MDC_FLIGHT_STRIPES 64
+
+static struct {
+	pthread_mutex_t mtx;
+	struct glist_head flights;
+} mdc_flight_stripe[MDC_FLIGHT_STRIPES];
+
+/**
+ * @brief Set up the in-flight call stripes
+ */
+void mdc_flight_pkginit(void)
+{
+	int i;
+
+	for (i = 0; i < MDC_FLIGHT_STRIPES; i++) {
+		PTHREAD_MUTEX_init(&mdc_flight_stripe[i].mtx, NULL);
+		glist_init(&mdc_flight_stripe[i].flights);
+	}
+}
+
+static inline uint64_t mdc_flight_hash(const void *owner, const char *name)
+{
+	uint64_t seed = (uint64_t) (uintptr_t) owner;
+
+	if (name == NULL)
+		return CityHash64WithSeed((const char *) &seed, sizeof(seed),
+					  0);
+
+	return CityHash64WithSeed(name, strlen(name), seed);
+}
+
+/**
+ * @brief Join a call in flight or start a new one
+ *
+ * If an identical call covering at least @a flags is in flight, wait for
+ * it to complete and return false; the caller then reads the result from
+ * *flight and releases it with mdc_flight_put.  Otherwise return true
+ * and, unless an incompatible call is in flight, register *flight for
+ * others to join; the caller makes the call itself and finishes with
+ * mdc_flight_end (which accepts a NULL flight).
+ *
+ * @param[in]  owner   Entry the call is made on
+ * @param[in]  name    Name looked up, or NULL
+ * @param[in]  flags   MDC_FLIGHT_* the caller needs
+ * @param[out] flight  The flight joined or registered, or NULL
+ *
+ * @return true if the caller must make the call.
+ */
+bool mdc_flight_begin(const void *owner, const char *name, uint32_t flags,
+		      struct mdc_flight **flight)
+{
+	uint64_t hash = mdc_flight_hash(owner, name);
+	int stripe = hash % MDC_FLIGHT_STRIPES;
+	struct glist_head *glist;
+	struct mdc_flight *f;
+
+	PTHREAD_MUTEX_lock(&mdc_flight_stripe[stripe].mtx);
+
+	glist_for_each(glist, &mdc_flight_stripe[stripe].flights) {
+		f = glist_entry(glist, struct mdc_flight, node);
+		if (f->hash != hash || f->owner != owner ||
+		    (f->name == NULL) != (name == NULL) ||
+		    (name != NULL && strcmp(f->name, name) != 0))
+			continue;
+
+		if ((flags & ~f->flags) != 0) {
+			/* Does not cover what we need, go it alone */
+			PTHREAD_MUTEX_unlock(&mdc_flight_stripe[stripe].mtx);
+			*flight = NULL;
+			return true;
+		}
+
+		f->refs++;
+		while (!f->done)
+			pthread_cond_wait(&f->cv,
+					  &mdc_flight_stripe[stripe].mtx);
+		PTHREAD_MUTEX_unlock(&mdc_flight_stripe[stripe].mtx);
+		*flight = f;
+		return false;
+	}
+
+	f = gsh_calloc(1, sizeof(*f));
+	f->owner = owner;
+	f->name = name;
+	f->hash = hash;
+	f->flags = flags;
+	f->refs = 1;
+	PTHREAD_COND_init(&f->cv, NULL);
+	glist_add_tail(&mdc_flight_stripe[stripe].flights, &f->node);
+
+	PTHREAD_MUTEX_unlock(&mdc_flight_stripe[stripe].mtx);
+
+	*flight = f;
+	return true;
+}
+
+/**
+ * @brief Publish the result of a call and wake its waiters
+ *
+ * @param[in] flight  Flight registered by mdc_flight_begin, or NULL
+ * @param[in] status  Result of the call
+ * @param[in] entry   Entry found, if any; waiters take their own ref
+ */
+void mdc_flight_end(struct mdc_flight *flight, fsal_status_t status,
+		    mdcache_entry_t *entry)
+{
+	int stripe;
+
+	if (flight == NULL)
+		return;
+
+	/* Hold the entry until the last waiter has taken its own ref */
+	if (entry != NULL && !FSAL_IS_ERROR(status))
+		(void) mdcache_get(entry);
+	else
+		entry = NULL;
+
+	stripe = flight->hash % MDC_FLIGHT_STRIPES;
+
+	PTHREAD_MUTEX_lock(&mdc_flight_stripe[stripe].mtx);
+	glist_del(&flight->node);
+	/* The name belongs to the leader's caller */
+	flight->name = NULL;
+	flight->status = status;
+	flight->entry = entry;
+	flight->done = true;
+	pthread_cond_broadcast(&flight->cv);
+	PTHREAD_MUTEX_unlock(&mdc_flight_stripe[stripe].mtx);
+
+	mdc_flight_put(flight);
+}
+
+/**
+ * @brief Release a reference to a flight
+ *
+ * @param[in] flight  The flight
+ */
+void mdc_flight_put(struct mdc_flight *flight)
+{
+	int stripe = flight->hash % MDC_FLIGHT_STRIPES;
+	int32_t refs;
+
+	PTHREAD_MUTEX_lock(&mdc_flight_stripe[stripe].mtx);
+	refs = --flight->refs;
+	PTHREAD_MUTEX_unlock(&mdc_flight_stripe[stripe].mtx);
+
+	if (refs != 0)
+		return;
+
+	if (flight->entry != NULL)
+		mdcache_put(flight->entry);
+	PTHREAD_COND_destroy(&flight->cv);
+	gsh_free(flight);
+}
+
 /**
  * @brief Lookup a name (helper)
  *
@@ -1196,7 +1677,7 @@ fsal_status_t mdc_lookup(mdcache_entry_t *mdc_parent, const char *name,
 			     "Lookup parent (..) of %p", mdc_parent);
 		/* ".." doesn't end up in the cache */
 		status =  mdcache_locate_host(
-				&mdc_parent->fsobj.fsdir.parent,
+				&mdc_parent->fsobj.fsdir->parent,
 				export, new_entry, attrs_out);
 		goto out;
 	}
@@ -1270,8 +1751,50 @@ fsal_status_t mdc_lookup(mdcache_entry_t *mdc_parent, const char *name,
 	LogDebug(COMPONENT_CACHE_INODE, "Cache Miss detected for %s", name);
 
 uncached:
+	if (test_mde_flags(mdc_parent, MDCACHE_BYPASS_DIRCACHE)) {
+		/* Lookups here only hold the content_lock for read, so
+		 * identical ones can run together; let one of them do it.
+		 */
+		struct mdc_flight *flight;
+
+		if (!mdc_flight_begin(mdc_parent, name, 0, &flight)) {
+			status = flight->status;
+			if (!FSAL_IS_ERROR(status)) {
+				*new_entry = flight->entry;
+				status = mdcache_lru_ref(*new_entry,
+							 LRU_REQ_INITIAL);
+			}
+			mdc_flight_put(flight);
+			if (FSAL_IS_ERROR(status)) {
+				*new_entry = NULL;
+				goto out;
+			}
+
+			PTHREAD_RWLOCK_unlock(&mdc_parent->content_lock);
+
+			status = get_optional_attrs(&(*new_entry)->obj_handle,
+						    attrs_out);
+			if (FSAL_IS_ERROR(status)) {
+				mdcache_put(*new_entry);
+				*new_entry = NULL;
+			}
+			return status;
+		}
+
+		status = mdc_lookup_uncached(mdc_parent, name, new_entry,
+					     attrs_out);
+		mdc_flight_end(flight, status, *new_entry);
+		goto out;
+	}
+
 	status = mdc_lookup_uncached(mdc_parent, name, new_entry, attrs_out);
 
+	if (status.major == ERR_FSAL_NOENT &&
+	    !test_mde_flags(mdc_parent, MDCACHE_BYPASS_DIRCACHE)) {
+		/* We hold the write lock here; remember the miss */
+		mdc_neg_add(mdc_parent, name);
+	}
+
 out:
 	PTHREAD_RWLOCK_unlock(&mdc_parent->content_lock);
 	if (status.major == ERR_FSAL_STALE)
@@ -1348,6 +1871,7 @@ fsal_status_t mdc_lookup_uncached(mdcache_entry_t *mdc_parent,
 		*new_entry = NULL;
 	} else {
 		*new_entry = container_of(new_obj, mdcache_entry_t, obj_handle);
+		mdc_inval_subtree_check(mdc_parent, *new_entry);
 	}
 
 	return status;
@@ -1462,7 +1986,7 @@ fsal_status_t mdcache_dirent_find(mdcache_entry_t *dir, const char *name,
 		return fsalstat(ERR_FSAL_NOTDIR, 0);
 
 	/* If no active entry, do nothing */
-	if (avltree_size(&dir->fsobj.fsdir.avl.t) == 0) {
+	if (avltree_size(&dir->fsobj.fsdir->avl.t) == 0) {
 		if (mdc_dircache_trusted(dir))
 			return fsalstat(ERR_FSAL_NOENT, 0);
 		else
@@ -1522,12 +2046,15 @@ mdcache_dirent_add(mdcache_entry_t *parent, const char *name,
 	if (parent->obj_handle.type != DIRECTORY)
 		return fsalstat(ERR_FSAL_NOTDIR, 0);
 
+	/* The name may have been recorded as missing */
+	mdc_neg_purge(parent, true);
+
 	/* Don't cache if parent is not being cached */
 	if (test_mde_flags(parent, MDCACHE_BYPASS_DIRCACHE))
 		return fsalstat(ERR_FSAL_NO_ERROR, 0);
 
 	/* in cache avl, we always insert on pentry_parent */
-	new_dir_entry = gsh_calloc(1, sizeof(mdcache_dir_entry_t) + namesize);
+	new_dir_entry = mdcache_alloc_dirent(namesize);
 	new_dir_entry->flags = DIR_ENTRY_FLAG_NONE;
 	allocated_dir_entry = new_dir_entry;
 
@@ -1627,6 +2154,9 @@ mdcache_dirent_rename(mdcache_entry_t *parent, const char *oldname,
 #ifdef DEBUG_MDCACHE
 	assert(parent->content_lock.__data.__writer != 0);
 #endif
+	/* newname may have been recorded as missing */
+	mdc_neg_purge(parent, true);
+
 	/* Don't rename if parent is not being cached */
 	if (test_mde_flags(parent, MDCACHE_BYPASS_DIRCACHE))
 		return fsalstat(ERR_FSAL_NO_ERROR, 0);
@@ -1663,7 +2193,7 @@ mdcache_dirent_rename(mdcache_entry_t *parent, const char *oldname,
 			(void)mdcache_find_keyed(&dirent2->ckey, &oldentry);
 
 			/* dirent2 (newname) will now point to renamed entry */
-			mdcache_key_delete(&dirent2->ckey);
+			mdcache_dirent_key_delete(dirent2);
 			mdcache_key_dup(&dirent2->ckey, &dirent->ckey);
 
 			/* Delete dirent for oldname */
@@ -1690,7 +2220,7 @@ mdcache_dirent_rename(mdcache_entry_t *parent, const char *oldname,
 	size_t newnamesize = strlen(newname) + 1;
 
 	/* try to rename--no longer in-place */
-	dirent2 = gsh_calloc(1, sizeof(mdcache_dir_entry_t) + newnamesize);
+	dirent2 = mdcache_alloc_dirent(newnamesize);
 	memcpy(dirent2->name, newname, newnamesize);
 	dirent2->flags = DIR_ENTRY_FLAG_NONE;
 	mdcache_key_dup(&dirent2->ckey, &dirent->ckey);
@@ -1889,7 +2419,7 @@ void place_new_dirent(mdcache_entry_t *parent_dir,
 	new_dir_entry->ck = ck;
 
 	node = avltree_do_lookup(&new_dir_entry->node_sorted,
-				 &parent_dir->fsobj.fsdir.avl.sorted,
+				 &parent_dir->fsobj.fsdir->avl.sorted,
 				 &parent, &unbalanced, &is_left,
 				 avl_dirent_sorted_cmpf);
 
@@ -1980,7 +2510,7 @@ void place_new_dirent(mdcache_entry_t *parent_dir,
 		} else {
 			left = NULL;
 
-			if (parent_dir->fsobj.fsdir.first_ck == right->ck) {
+			if (parent_dir->fsobj.fsdir->first_ck == right->ck) {
 				/* The right node is the first entry in the
 				 * directory. Add this key to the beginning of
 				 * the first chunk and fixup the chunk.
@@ -2088,7 +2618,7 @@ void place_new_dirent(mdcache_entry_t *parent_dir,
 
 	/* Get the node into the actual tree... */
 	avltree_do_insert(&new_dir_entry->node_sorted,
-			  &parent_dir->fsobj.fsdir.avl.sorted,
+			  &parent_dir->fsobj.fsdir->avl.sorted,
 			  parent, unbalanced, is_left);
 
 	LogFullDebug(COMPONENT_CACHE_INODE,
@@ -2135,7 +2665,7 @@ void place_new_dirent(mdcache_entry_t *parent_dir,
 			LogFullDebug(COMPONENT_CACHE_INODE,
 				     "Setting directory first_ck=%"PRIx64,
 				     new_dir_entry->ck);
-			parent_dir->fsobj.fsdir.first_ck = new_dir_entry->ck;
+			parent_dir->fsobj.fsdir->first_ck = new_dir_entry->ck;
 		}
 	}
 
@@ -2157,7 +2687,7 @@ void place_new_dirent(mdcache_entry_t *parent_dir,
 		split->prev_chunk = chunk;
 		split->next_ck = chunk->next_ck;
 
-		glist_add_tail(&chunk->parent->fsobj.fsdir.chunks,
+		glist_add_tail(&chunk->parent->fsobj.fsdir->chunks,
 			       &split->chunks);
 
 		/* Make sure this chunk is in the MRU of L1 */
@@ -2244,6 +2774,11 @@ mdc_readdir_chunk_object(const char *name, struct fsal_obj_handle *sub_handle,
 	int code = 0;
 	fsal_status_t status;
 	enum fsal_dir_result result = DIR_CONTINUE;
+	char fh_buf[NFS4_FHSIZE];
+	struct gsh_buffdesc fh_desc = { fh_buf, NFS4_FHSIZE };
+	struct gsh_buffdesc key_desc;
+	mdcache_key_t key;
+	bool lazy = false;
 
 	if (chunk->num_entries == mdcache_param.dir.avl_chunk) {
 		/* We are being called readahead. */
@@ -2256,7 +2791,7 @@ mdc_readdir_chunk_object(const char *name, struct fsal_obj_handle *sub_handle,
 		/* Now add the previous chunk to the list of chunks for the
 		 * directory.
 		 */
-		glist_add_tail(&chunk->parent->fsobj.fsdir.chunks,
+		glist_add_tail(&chunk->parent->fsobj.fsdir->chunks,
 			       &chunk->chunks);
 
 
@@ -2273,33 +2808,74 @@ mdc_readdir_chunk_object(const char *name, struct fsal_obj_handle *sub_handle,
 		/* And start accepting entries into the new chunk. */
 	}
 
-	LogFullDebug(COMPONENT_CACHE_INODE,
-		     "Creating cache entry for %s cookie=0x%"PRIx64
-		     " sub_handle=0x%p",
-		     name, cookie, sub_handle);
-
-	status = mdcache_new_entry(export, sub_handle, attrs_in, NULL,
-				   false, &new_entry, NULL);
+	subcall_nowait_raw(export,
+		sub_handle->obj_ops.handle_to_key(sub_handle, &key_desc)
+		);
+	(void) cih_hash_key(&key, export->export.sub_export->fsal, &key_desc,
+			    CIH_HASH_KEY_PROTOTYPE);
 
-	if (FSAL_IS_ERROR(status)) {
-		*state->status = status;
-		LogInfo(COMPONENT_CACHE_INODE,
-			"mdcache_new_entry failed on %s in dir %p with %s",
-			name, mdc_parent, fsal_err_txt(status));
-		return DIR_TERMINATE;
+	if (mdcache_param.dir.lazy_entries) {
+		status = mdcache_find_keyed(&key, &new_entry);
+		if (!FSAL_IS_ERROR(status)) {
+			/* Cached already, mdcache_new_entry() below will
+			 * find it again.
+			 */
+			mdcache_put(new_entry);
+			new_entry = NULL;
+		} else if (status.major == ERR_FSAL_NOENT) {
+			/* Remember just enough to create it on use */
+			subcall_nowait_raw(export,
+				status = sub_handle->obj_ops.handle_to_wire(
+						sub_handle, FSAL_DIGEST_NFSV4,
+						&fh_desc)
+				);
+			lazy = !FSAL_IS_ERROR(status);
+		}
 	}
 
-	/* Entry was found in the FSAL, add this entry to the parent directory
-	 */
+	if (lazy) {
+		LogFullDebug(COMPONENT_CACHE_INODE,
+			     "Deferring cache entry for %s cookie=0x%"PRIx64,
+			     name, cookie);
+	} else {
+		LogFullDebug(COMPONENT_CACHE_INODE,
+			     "Creating cache entry for %s cookie=0x%"PRIx64
+			     " sub_handle=0x%p",
+			     name, cookie, sub_handle);
 
-	LogFullDebug(COMPONENT_CACHE_INODE,
-		     "Add mdcache entry %p for %s for FSAL %s",
-		     new_entry, name, new_entry->sub_handle->fsal->name);
+		status = mdcache_new_entry(export, sub_handle, attrs_in, NULL,
+					   false, &new_entry, NULL);
+
+		if (FSAL_IS_ERROR(status)) {
+			*state->status = status;
+			LogInfo(COMPONENT_CACHE_INODE,
+				"mdcache_new_entry failed on %s in dir %p with %s",
+				name, mdc_parent, fsal_err_txt(status));
+			return DIR_TERMINATE;
+		}
+
+		/* Entry was found in the FSAL, add this entry to the parent
+		 * directory
+		 */
+
+		LogFullDebug(COMPONENT_CACHE_INODE,
+			     "Add mdcache entry %p for %s for FSAL %s",
+			     new_entry, name,
+			     new_entry->sub_handle->fsal->name);
+	}
 
 	/* in cache avl, we always insert on mdc_parent */
-	new_dir_entry = gsh_calloc(1, sizeof(mdcache_dir_entry_t) + namesize);
-	new_dir_entry->flags = DIR_ENTRY_FLAG_NONE;
-	new_dir_entry->chunk = chunk;
+	new_dir_entry = mdc_chunk_alloc_dirent(chunk, name, namesize,
+					       lazy ? &key
+						    : &new_entry->fh_hk.key,
+					       lazy ? &fh_desc : NULL);
+
+	if (lazy) {
+		/* The dirent has its own copy of the key */
+		subcall_raw(export,
+			    sub_handle->obj_ops.release(sub_handle)
+			   );
+	}
 	new_dir_entry->ck = cookie;
 	allocated_dir_entry = new_dir_entry;
 
@@ -2311,9 +2887,6 @@ mdc_readdir_chunk_object(const char *name, struct fsal_obj_handle *sub_handle,
 	 *              chunk, posssibly making the chunk larger than normal.
 	 */
 
-	memcpy(&new_dir_entry->name, name, namesize);
-	mdcache_key_dup(&new_dir_entry->ckey, &new_entry->fh_hk.key);
-
 	/* add to avl */
 	code = mdcache_avl_qp_insert(mdc_parent, &new_dir_entry);
 
@@ -2337,12 +2910,13 @@ mdc_readdir_chunk_object(const char *name, struct fsal_obj_handle *sub_handle,
 		 */
 		LogCrit(COMPONENT_CACHE_INODE,
 			"Collision while adding dirent for %s", name);
-		mdcache_put(new_entry);
+		if (new_entry != NULL)
+			mdcache_put(new_entry);
 		return DIR_CONTINUE;
 	}
 
 	/* Note that if this dirent was already in the lookup by name AVL
-	 * tree (mdc_parent->fsobj.fsdir.avl.t), then mdcache_avl_qp_insert
+	 * tree (mdc_parent->fsobj.fsdir->avl.t), then mdcache_avl_qp_insert
 	 * freed the dirent we allocated above, and returned the one that was
 	 * in tree. It will have set chunk, ck, and nk.
 	 *
@@ -2369,7 +2943,7 @@ mdc_readdir_chunk_object(const char *name, struct fsal_obj_handle *sub_handle,
 
 		node = avltree_inline_insert(
 					&new_dir_entry->node_sorted,
-					&mdc_parent->fsobj.fsdir.avl.sorted,
+					&mdc_parent->fsobj.fsdir->avl.sorted,
 					avl_dirent_sorted_cmpf);
 
 		if (node != NULL) {
@@ -2448,6 +3022,9 @@ mdc_readdir_chunk_object(const char *name, struct fsal_obj_handle *sub_handle,
 		result = DIR_READAHEAD;
 	}
 
+	if (new_entry == NULL)
+		return result;
+
 	if (new_entry->obj_handle.type == DIRECTORY) {
 		/* Insert Parent's key */
 		mdc_dir_add_parent(new_entry, mdc_parent);
@@ -2668,7 +3245,7 @@ again:
 
 		/* Now add this chunk to the list of chunks for the directory.
 		 */
-		glist_add_tail(&directory->fsobj.fsdir.chunks,
+		glist_add_tail(&directory->fsobj.fsdir->chunks,
 			       &chunk->chunks);
 	}
 
@@ -2719,6 +3296,364 @@ again:
 	return status;
 }
 
+/**
+ * @brief Charge a dirent against the caller's reply budget
+ *
+ * The first entry is always let through, so that the callback gets to
+ * decide whether the reply is too small.
+ *
+ * @param[in]     budget  The caller's budget, NULL if unbounded
+ * @param[in,out] sent    Entries charged so far
+ * @param[in,out] left    Room left after those entries
+ * @param[in]     name    Name of the dirent
+ *
+ * @return false if the dirent can not fit.
+ */
+static bool mdc_readdir_charge(const struct fsal_readdir_budget *budget,
+			       uint32_t *sent, size_t *left, const char *name)
+{
+	size_t need;
+
+	if (budget == NULL)
+		return true;
+
+	need = budget->entry_bytes + strlen(name);
+
+	if (*sent != 0 &&
+	    (*sent >= budget->entries || *left < need + budget->slack))
+		return false;
+
+	*left = *left > need ? *left - need : 0;
+	(*sent)++;
+	return true;
+}
+
+/**
+ * @brief Refresh the expired attributes of a chunk in one FSAL call
+ *
+ * Hands the entries from @a dirent to the end of its chunk whose
+ * attributes have expired to the sub-FSAL's getattrs_bulk, so that the
+ * per-dirent getattrs in mdcache_readdir_chunked finds them valid instead
+ * of making a round trip each.  Once the sub-FSAL answers NOTSUPP this is
+ * skipped for the export.  Entries past what the caller's reply has
+ * room for are left alone.
+ *
+ * @note The content lock MUST be held
+ *
+ * @param[in] directory  Directory being read
+ * @param[in] dirent     First dirent the caller will return
+ * @param[in] attrmask   Attributes the caller wants
+ * @param[in] sent       Entries already returned to the caller
+ * @param[in] left       Room left in the caller's reply
+ */
+static void mdc_readdir_bulk_attrs(mdcache_entry_t *directory,
+				   mdcache_dir_entry_t *dirent,
+				   attrmask_t attrmask,
+				   uint32_t sent, size_t left)
+{
+	struct mdcache_fsal_export *export = mdc_cur_export();
+	struct dir_chunk *chunk = dirent->chunk;
+	uint32_t max = chunk->num_entries, count = 0, i;
+	bool need_acl = (attrmask & ATTR_ACL) != 0;
+	struct fsal_obj_handle **sub_handles;
+	struct attrlist *attrs, **attrps;
+	mdcache_entry_t **entries;
+	attrmask_t request_mask;
+	fsal_status_t status;
+
+	if ((atomic_fetch_uint8_t(&export->flags) & MDC_NO_BULK_GETATTRS) ||
+	    max == 0)
+		return;
+
+	entries = gsh_calloc(max, sizeof(*entries));
+
+	for (; dirent != NULL && count < max;
+	     dirent = glist_next_entry(&chunk->dirents, mdcache_dir_entry_t,
+				       chunk_list, &dirent->chunk_list)) {
+		mdcache_entry_t *entry;
+		bool valid;
+
+		if (dirent->flags & DIR_ENTRY_FLAG_DELETED)
+			continue;
+
+		if (!mdc_readdir_charge(op_ctx->readdir_budget, &sent, &left,
+					dirent->name))
+			break;
+
+		if (FSAL_IS_ERROR(mdcache_find_keyed(&dirent->ckey, &entry)))
+			continue;
+
+		mdc_inval_subtree_check(directory, entry);
+
+		PTHREAD_RWLOCK_rdlock(&entry->attr_lock);
+		valid = mdcache_is_attrs_valid(entry, attrmask);
+		PTHREAD_RWLOCK_unlock(&entry->attr_lock);
+
+		if (valid)
+			mdcache_put(entry);
+		else
+			entries[count++] = entry;
+	}
+
+	if (count == 0) {
+		gsh_free(entries);
+		return;
+	}
+
+	/* As mdcache_refresh_attrs, ask for everything but a needless ACL */
+	request_mask = op_ctx->fsal_export->exp_ops.fs_supported_attrs(
+					op_ctx->fsal_export) | ATTR_RDATTR_ERR;
+	if (!need_acl)
+		request_mask &= ~ATTR_ACL;
+
+	sub_handles = gsh_calloc(count, sizeof(*sub_handles));
+	attrs = gsh_calloc(count, sizeof(*attrs));
+	attrps = gsh_calloc(count, sizeof(*attrps));
+
+	for (i = 0; i < count; i++) {
+		fsal_prepare_attrs(&attrs[i], request_mask);
+		attrps[i] = &attrs[i];
+		sub_handles[i] = entries[i]->sub_handle;
+	}
+
+	subcall_raw(export,
+		    status = directory->sub_handle->obj_ops.getattrs_bulk(
+				directory->sub_handle, count, sub_handles, attrps)
+		   );
+
+	if (status.major == ERR_FSAL_NOTSUPP)
+		atomic_set_uint8_t_bits(&export->flags, MDC_NO_BULK_GETATTRS);
+	else if (FSAL_IS_ERROR(status))
+		LogDebug(COMPONENT_NFS_READDIR,
+			 "getattrs_bulk of %"PRIu32" entries failed status=%s",
+			 count, fsal_err_txt(status));
+
+	for (i = 0; i < count; i++) {
+		if (!FSAL_IS_ERROR(status) &&
+		    attrs[i].valid_mask != ATTR_RDATTR_ERR) {
+			PTHREAD_RWLOCK_wrlock(&entries[i]->attr_lock);
+			mdcache_install_attrs(entries[i], &attrs[i], need_acl,
+					      true);
+			PTHREAD_RWLOCK_unlock(&entries[i]->attr_lock);
+		} else {
+			/* Left for the per-dirent getattrs to sort out */
+			fsal_release_attrs(&attrs[i]);
+		}
+		mdcache_put(entries[i]);
+	}
+
+	gsh_free(attrps);
+	gsh_free(attrs);
+	gsh_free(sub_handles);
+	gsh_free(entries);
+}
+
+/**
+ * @brief Fridge for background dirent chunk read-ahead
+ */
+static struct fridgethr *ra_fridge;
+
+/**
+ * @brief A queued dirent chunk read-ahead
+ */
+struct mdcache_readahead {
+	mdcache_entry_t *directory;	/*< Directory to read, ref'd */
+	struct gsh_export *export;	/*< Export to read through, ref'd */
+	fsal_cookie_t ck;		/*< Last cookie the reader consumed */
+};
+
+/**
+ * @brief Populate the chunks following a cookie
+ *
+ * Runs in the read-ahead fridge.  Walks forward from the chunk holding
+ * the cookie, skipping chunks that are still resident and populating
+ * the ones that are not, until Dir_Chunk_Readahead chunks past the
+ * reader have been visited or the end of the directory is reached.
+ *
+ * @param[in] ctx  Fridge context; ctx->arg is the struct mdcache_readahead
+ */
+static void mdcache_readahead_run(struct fridgethr_context *ctx)
+{
+	struct mdcache_readahead *ra = ctx->arg;
+	mdcache_entry_t *directory = ra->directory;
+	struct root_op_context root_op_context;
+	mdcache_dir_entry_t *dirent, *last;
+	struct dir_chunk *chunk;
+	fsal_cookie_t ck = ra->ck;
+	fsal_status_t status;
+	uint32_t depth;
+	bool eod = false;
+
+	init_root_op_context(&root_op_context, ra->export,
+			     ra->export->fsal_export, 0, 0, UNKNOWN_REQUEST);
+
+	PTHREAD_RWLOCK_wrlock(&directory->content_lock);
+
+	for (depth = 0; depth < mdcache_param.dir.avl_chunk_readahead;
+	     depth++) {
+		/* The directory may have been invalidated while we were
+		 * queued or while we populated the previous chunk.
+		 */
+		if (!test_mde_flags(directory, MDCACHE_TRUST_CONTENT |
+					       MDCACHE_TRUST_DIR_CHUNKS))
+			break;
+
+		if (!mdcache_avl_lookup_ck(directory, ck, &dirent))
+			break;
+
+		chunk = dirent->chunk;
+		last = glist_last_entry(&chunk->dirents, mdcache_dir_entry_t,
+					chunk_list);
+		if (last == NULL || last->eod)
+			break;
+
+		if (chunk->next_ck != 0 &&
+		    mdcache_avl_lookup_ck(directory, chunk->next_ck, &dirent)) {
+			/* Next chunk is still cached, step over it */
+			last = glist_last_entry(&dirent->chunk->dirents,
+						mdcache_dir_entry_t,
+						chunk_list);
+			ck = last->ck;
+			continue;
+		}
+
+		dirent = NULL;
+		status = mdcache_populate_dir_chunk(directory, last->ck,
+						    &dirent, chunk, &eod);
+		if (FSAL_IS_ERROR(status)) {
+			LogDebug(COMPONENT_NFS_READDIR,
+				 "Read-ahead of directory %p failed status=%s",
+				 directory, fsal_err_txt(status));
+			break;
+		}
+
+		if (dirent == NULL || eod)
+			break;
+
+		last = glist_last_entry(&dirent->chunk->dirents,
+					mdcache_dir_entry_t, chunk_list);
+		ck = last->ck;
+	}
+
+	atomic_clear_uint32_t_bits(&directory->mde_flags,
+				   MDCACHE_DIR_READAHEAD);
+
+	PTHREAD_RWLOCK_unlock(&directory->content_lock);
+
+	release_root_op_context();
+	put_gsh_export(ra->export);
+	mdcache_put(directory);
+	gsh_free(ra);
+}
+
+/**
+ * @brief Queue read-ahead behind a chunk a reader is walking
+ *
+ * Nothing is queued if read-ahead is disabled, the next chunk is already
+ * known, the chunk ends the directory, or a read-ahead is already pending
+ * for this directory.  Called with the content_lock held.
+ *
+ * @param[in] directory  Directory being read
+ * @param[in] chunk      Chunk the reader is about to walk
+ */
+static void mdcache_readahead_schedule(mdcache_entry_t *directory,
+				       struct dir_chunk *chunk)
+{
+	struct mdcache_readahead *ra;
+	mdcache_dir_entry_t *last;
+	int rc;
+
+	if (ra_fridge == NULL || mdcache_param.dir.avl_chunk_readahead == 0 ||
+	    chunk->next_ck != 0)
+		return;
+
+	last = glist_last_entry(&chunk->dirents, mdcache_dir_entry_t,
+				chunk_list);
+	if (last == NULL || last->eod)
+		return;
+
+	if (atomic_postset_uint32_t_bits(&directory->mde_flags,
+					 MDCACHE_DIR_READAHEAD) &
+	    MDCACHE_DIR_READAHEAD)
+		return;
+
+	if (FSAL_IS_ERROR(mdcache_get(directory)))
+		goto clear;
+
+	ra = gsh_malloc(sizeof(*ra));
+	ra->directory = directory;
+	ra->export = op_ctx->ctx_export;
+	ra->ck = last->ck;
+	get_gsh_export_ref(ra->export);
+
+	rc = fridgethr_submit(ra_fridge, mdcache_readahead_run, ra);
+	if (rc == 0)
+		return;
+
+	LogDebug(COMPONENT_NFS_READDIR,
+		 "Unable to queue read-ahead of directory %p, error code %d",
+		 directory, rc);
+	put_gsh_export(ra->export);
+	gsh_free(ra);
+	mdcache_put(directory);
+clear:
+	atomic_clear_uint32_t_bits(&directory->mde_flags,
+				   MDCACHE_DIR_READAHEAD);
+}
+
+/**
+ * @brief Start the dirent chunk read-ahead fridge
+ *
+ * @return FSAL status
+ */
+fsal_status_t mdcache_readahead_pkginit(void)
+{
+	struct fridgethr_params frp;
+	int rc;
+
+	if (ra_fridge != NULL)
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+	memset(&frp, 0, sizeof(struct fridgethr_params));
+	frp.thr_max = 4;
+	frp.deferment = fridgethr_defer_queue;
+
+	rc = fridgethr_init(&ra_fridge, "MDC_Readahead", &frp);
+	if (rc != 0) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Unable to initialize read-ahead fridge, error code %d.",
+			 rc);
+		return fsalstat(posix2fsal_error(rc), rc);
+	}
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Drain and stop the dirent chunk read-ahead fridge
+ */
+void mdcache_readahead_pkgshutdown(void)
+{
+	int rc;
+
+	if (ra_fridge == NULL)
+		return;
+
+	rc = fridgethr_sync_command(ra_fridge, fridgethr_comm_stop, 120);
+
+	if (rc == ETIMEDOUT) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Shutdown timed out, cancelling read-ahead threads.");
+		fridgethr_cancel(ra_fridge);
+	} else if (rc != 0) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Failed shutting down read-ahead threads: %d", rc);
+	}
+
+	fridgethr_destroy(ra_fridge);
+	ra_fridge = NULL;
+}
+
 /**
  * @brief Read the contents of a directory
  *
@@ -2751,6 +3686,9 @@ fsal_status_t mdcache_readdir_chunked(mdcache_entry_t *directory,
 	struct dir_chunk *chunk = NULL;
 	bool first_pass = true;
 	bool eod = false;
+	struct fsal_readdir_budget *budget = op_ctx->readdir_budget;
+	size_t left = budget != NULL ? budget->bytes : 0;
+	uint32_t sent = 0;
 
 	LogFullDebug(COMPONENT_CACHE_INODE,
 		     "Starting chunked READDIR");
@@ -2774,7 +3712,7 @@ fsal_status_t mdcache_readdir_chunked(mdcache_entry_t *directory,
 		 * directory instead, this is only non-zero if the first
 		 * chunk of the directory is still present.
 		 */
-		look_ck = directory->fsobj.fsdir.first_ck;
+		look_ck = directory->fsobj.fsdir->first_ck;
 	}
 
 	/* We need to know if we need to set first_ck. */
@@ -2803,6 +3741,15 @@ again:
 			PTHREAD_RWLOCK_unlock(&directory->content_lock);
 			PTHREAD_RWLOCK_wrlock(&directory->content_lock);
 			has_write = true;
+
+			if (look_ck == 0 && next_ck != 0 &&
+			    mdcache_avl_lookup_ck(directory, next_ck, &dirent) &&
+			    dirent->chunk->next_ck != 0) {
+				/* A read-ahead linked in the chunk following
+				 * the one we finished, pick it up from there.
+				 */
+				look_ck = dirent->chunk->next_ck;
+			}
 			goto again;
 		}
 
@@ -2811,7 +3758,7 @@ again:
 
 		if (op_ctx->fsal_export->exp_ops.fs_supports(
 				op_ctx->fsal_export, fso_whence_is_name)
-		    && first_pass && directory->fsobj.fsdir.first_ck != 0) {
+		    && first_pass && directory->fsobj.fsdir->first_ck != 0) {
 			/* If whence must be the directory entry name we wish
 			 * to continue from, we need to start at the beginning
 			 * of the directory and readdir until we find the
@@ -2833,7 +3780,7 @@ again:
 			 * for.
 			 */
 			chunk = mdcache_skip_chunks(
-				directory, directory->fsobj.fsdir.first_ck);
+				directory, directory->fsobj.fsdir->first_ck);
 			/* Since first_ck was not 0, we MUST have found at least
 			 * one chunk...
 			 */
@@ -2912,7 +3859,7 @@ again:
 			LogFullDebug(COMPONENT_CACHE_INODE,
 				     "Setting directory first_ck=%"PRIx64,
 				     dirent->ck);
-			directory->fsobj.fsdir.first_ck = dirent->ck;
+			directory->fsobj.fsdir->first_ck = dirent->ck;
 			set_first_ck = false;
 		}
 	} else {
@@ -2929,6 +3876,12 @@ again:
 	/* Bump the chunk in the LRU */
 	lru_bump_chunk(chunk);
 
+	/* Start fetching what follows while the caller walks this chunk */
+	mdcache_readahead_schedule(directory, chunk);
+
+	/* Revalidate what we are about to return in one go if we can */
+	mdc_readdir_bulk_attrs(directory, dirent, attrmask, sent, left);
+
 	LogFullDebug(COMPONENT_NFS_READDIR,
 		     "About to read directory=%p cookie=%" PRIx64,
 		     directory, next_ck);
@@ -2946,6 +3899,8 @@ again:
 		enum fsal_dir_result cb_result;
 		mdcache_entry_t *entry = NULL;
 		struct attrlist attrs;
+		uint32_t next_sent = sent;
+		size_t next_left = left;
 
 		if (dirent->ck == whence) {
 			/* When called with whence, the caller always wants the
@@ -2959,8 +3914,24 @@ again:
 			continue;
 		}
 
+		if (!mdc_readdir_charge(budget, &next_sent, &next_left,
+					dirent->name)) {
+			/* The caller's reply is full, don't look up and
+			 * refresh an entry it would only turn away.
+			 */
+			LogFullDebug(COMPONENT_NFS_READDIR,
+				     "Reply budget spent after %"PRIu32
+				     " entries", sent);
+			*eod_met = false;
+			PTHREAD_RWLOCK_unlock(&directory->content_lock);
+			return fsalstat(ERR_FSAL_NO_ERROR, 0);
+		}
+
 		/* Get actual entry using the dirent ckey */
 		status = mdcache_find_keyed(&dirent->ckey, &entry);
+		if (FSAL_IS_ERROR(status) && dirent->fh_len != 0)
+			status = mdc_dirent_instantiate(directory, dirent,
+							&entry);
 
 		if (FSAL_IS_ERROR(status)) {
 			/* Failed using ckey, do full lookup. */
@@ -3023,6 +3994,8 @@ again:
 
 		next_ck = dirent->ck;
 
+		mdc_inval_subtree_check(directory, entry);
+
 		/* Ensure the attribute cache is valid.  The simplest way to do
 		 * this is to call getattrs().  We need a copy anyway, to ensure
 		 * thread safety.
@@ -3041,11 +4014,14 @@ again:
 			return status;
 		}
 
-		cb_result = cb(dirent->name, &entry->obj_handle, &entry->attrs,
+		cb_result = cb(dirent->name, &entry->obj_handle, &attrs,
 			       dir_state, next_ck);
 
 		fsal_release_attrs(&attrs);
 
+		sent = next_sent;
+		left = next_left;
+
 		if (cb_result >= DIR_TERMINATE || dirent->eod) {
 			/* Caller is done, or we have reached the end of
 			 * the directory, no need to get another dirent.
@@ -40,10 +40,14 @@
 #include "fsal_up.h"
 #include "fsal_convert.h"
 #include "display.h"
+#include "common_utils.h"
+#include "nfs_core.h"
 
 typedef struct mdcache_fsal_obj_handle mdcache_entry_t;
 
 #define MDC_UNEXPORT 1
+/* Sub-FSAL answered NOTSUPP to getattrs_bulk */
+#define MDC_NO_BULK_GETATTRS 2
 
 /*
  * MDCACHE internal export
@@ -61,6 +65,9 @@ struct mdcache_fsal_export {
 	pthread_rwlock_t mdc_exp_lock;
 	/** Flags for the export. */
 	uint8_t flags;
+	/** Invalidation generation of the last invalidate_export upcall,
+	    entries validated before it are stale. */
+	uint64_t inval_gen;
 };
 
 /**
@@ -133,6 +140,8 @@ typedef struct mdcache_lru__ {
 				 *< decrement the correct counter when moving
 				 *< or deleting the entry. */
 	uint32_t cf;		/*< Confounder */
+	uint32_t part;		/*< Cache partition charged, plus one; 0 if
+				 *< not charged */
 } mdcache_lru_t;
 
 /**
@@ -145,6 +154,20 @@ struct mdcache_stats {
 	uint64_t inode_conf;
 	uint64_t inode_added;
 	uint64_t inode_mapping;
+	uint64_t ra_hit_bytes;		/*< Bytes served from read-ahead */
+	uint64_t ra_miss;		/*< Sequential reads not served */
+	uint64_t ra_fill_bytes;		/*< Bytes read ahead */
+	uint64_t ra_waste_bytes;	/*< Bytes read ahead but never served */
+	uint64_t ra_bytes;		/*< Bytes of windows allocated */
+	uint64_t wb_writes;		/*< Writes gathered in buffers */
+	uint64_t wb_flushes;		/*< Buffers written out */
+	uint64_t wb_flush_bytes;	/*< Bytes written out */
+	uint64_t wb_bytes;		/*< Bytes of buffers allocated */
+	uint64_t sc_hit_bytes;		/*< Bytes served from file content */
+	uint64_t sc_fill_bytes;		/*< Bytes read to fill file content */
+	uint64_t sc_bytes;		/*< Bytes of file content held */
+	uint64_t xattr_hits;		/*< xattr calls served from cache */
+	uint64_t xattr_bytes;		/*< Bytes of xattrs held */
 };
 
 extern struct mdcache_stats *cache_stp;
@@ -183,6 +206,10 @@ struct entry_export_map {
 static const uint32_t MDCACHE_UNREACHABLE = 0x100;
 /** The directory is too big; skip the dirent cache */
 static const uint32_t MDCACHE_BYPASS_DIRCACHE = 0x200;
+/** A chunk read-ahead is queued or running for the directory */
+static const uint32_t MDCACHE_DIR_READAHEAD = 0x400;
+/** Created under an Immutable export; only invalidation makes it stale */
+static const uint32_t MDCACHE_IMMUTABLE = 0x800;
 
 
 /**
@@ -227,15 +254,294 @@ static const uint32_t MDCACHE_BYPASS_DIRCACHE = 0x200;
  * stuff the the fsal has to manage, i.e. filesystem bits.
  */
 
+/**
+ * @brief Directory-only part of a cache entry
+ *
+ * Allocated by mdcache_alloc_handle when the entry is a directory and
+ * released when the entry is cleaned, so that files do not carry the
+ * dirent trees around.  Everything here is protected by content_lock
+ * unless noted otherwise.
+ */
+struct mdcache_fsdir {
+	/** List of chunks in this directory, not ordered */
+	struct glist_head chunks;
+	/** List of detached directory entries. */
+	struct glist_head detached;
+	/** Spin lock to protect the detached list. */
+	pthread_spinlock_t spin;
+	/** Count of detached directory entries. */
+	int detached_count;
+	/** The parent host-handle of this directory ('..') */
+	struct gsh_buffdesc parent;
+	/** The first dirent cookie in this directory.
+	 *  0 if not known.
+	 */
+	fsal_cookie_t first_ck;
+	/** Invalidation generation of the last invalidate_subtree upcall
+	 *  reaching this directory, passed down to children as they are
+	 *  looked up.
+	 */
+	uint64_t subtree_gen;
+	struct {
+		/** Children by name hash */
+		struct avltree t;
+		/** Persist cookies for deleted entries */
+		struct avltree c;
+		/** Table of dirents by FSAL cookie */
+		struct avltree ck;
+		/** Table of dirents in sorted order. */
+		struct avltree sorted;
+		/** Heuristic. Expect 0. */
+		uint32_t collisions;
+		/** Open-addressed index of the active
+		 *  dirents by name hash, built once the
+		 *  directory grows past
+		 *  MDCACHE_DIR_INDEX_MIN.  NULL until then.
+		 */
+		struct mdcache_dir_index_slot *index;
+		uint32_t index_mask;
+		uint32_t index_count;
+	} avl;
+	/** Names the FSAL recently reported absent, NULL
+	 *  until the first miss.
+	 */
+	struct mdcache_neg_cache *neg;
+};
+
+/** Read streams told apart per file */
+#define MDC_RA_STREAMS 4
+/** Most read-ahead windows per file */
+#define MDC_RA_MAX_WINDOWS 8
+/** Back to back reads before a stream is read ahead of */
+#define MDC_RA_TRIGGER 2
+
+enum mdc_ra_state {
+	MDC_RA_EMPTY,		/*< Slot is free */
+	MDC_RA_PENDING,		/*< Being filled by a read-ahead thread */
+	MDC_RA_READY,		/*< Holds data that may be served */
+};
+
+/**
+ * @brief One window of data read ahead of a sequential reader
+ */
+struct mdc_ra_window {
+	uint64_t offset;	/*< File offset of the first byte */
+	size_t len;		/*< Bytes held once READY */
+	size_t used;		/*< Bytes served to readers */
+	void *buf;		/*< Data, from iobuf_get() */
+	uint32_t gen;		/*< Content generation it was filled in */
+	enum mdc_ra_state state;
+	bool eof;		/*< The window reaches end of file */
+};
+
+/**
+ * @brief A sequential read stream
+ *
+ * Streams are told apart by the open state they read through, NULL
+ * standing for NFSv3 and other stateless readers.
+ */
+struct mdc_ra_stream {
+	const void *owner;	/*< State read through */
+	uint64_t next_off;	/*< Offset a sequential read comes next at */
+	uint64_t ra_next;	/*< First offset not yet read ahead */
+	uint32_t seq;		/*< Back to back reads seen */
+	uint32_t tick;		/*< Last use, to pick a stream to reuse */
+};
+
+/**
+ * @brief Read-ahead part of a regular file entry
+ *
+ * Allocated on the first read with read-ahead enabled and released when
+ * the entry is cleaned.  Everything here is protected by mtx.
+ */
+struct mdcache_file_ra {
+	pthread_mutex_t mtx;
+	/** Signalled when a PENDING window is filled or dropped */
+	pthread_cond_t cv;
+	/** Content generation, bumped whenever the file may have changed */
+	uint32_t gen;
+	uint32_t tick;
+	struct mdc_ra_stream streams[MDC_RA_STREAMS];
+	struct mdc_ra_window windows[MDC_RA_MAX_WINDOWS];
+};
+
+/**
+ * @brief Whole content of a small regular file
+ *
+ * Allocated on the first read of a file no larger than
+ * Small_File_Cache_Size and released when the entry is cleaned.  The
+ * data is served for as long as the file's size and change attribute
+ * are those it was read at.  Everything here is protected by mtx.
+ */
+struct mdcache_file_sc {
+	pthread_mutex_t mtx;
+	void *buf;		/*< File data, NULL when not held */
+	uint64_t size;		/*< Bytes in buf, the file size */
+	uint64_t change;	/*< Change attribute the data goes with */
+	/** Bumped by each invalidate, so a fill that raced one is not
+	    kept */
+	uint32_t gen;
+};
+
+/**
+ * @brief Write-behind part of a regular file entry
+ *
+ * Holds one extent of unstable writes made through one state, written
+ * out as a single sub-FSAL write.  Allocated on the first write with
+ * write-behind enabled and released when the entry is cleaned.
+ * Everything here is protected by mtx, which may be taken with the
+ * attr_lock held but not the other way round.
+ */
+struct mdcache_file_wb {
+	pthread_mutex_t mtx;
+	struct state_t *owner;	/*< State the extent was written through */
+	bool bypass;		/*< Bypass of the gathered writes */
+	uint64_t offset;	/*< File offset of the extent */
+	size_t len;		/*< Bytes in the extent */
+	void *buf;		/*< Extent data, NULL when clean */
+	/** First error writing an extent out, reported by the next
+	    COMMIT */
+	fsal_status_t error;
+};
+
+/**
+ * @brief Access decisions remembered on an entry
+ *
+ * Each slot holds what fsal_test_access() answered for one credential
+ * and requested mask.  A slot only answers while the entry attributes
+ * are trusted and have not been reloaded since (access_gen).  Protected
+ * by attr_lock.
+ */
+struct mdcache_access_cache {
+	/** Slots allocated */
+	uint32_t max;
+	/** Slots in use */
+	uint32_t count;
+	/** Next slot to replace once full */
+	uint32_t hand;
+	struct {
+		uid_t uid;
+		gid_t gid;
+		/** Hash of the supplementary groups */
+		uint64_t groups;
+		/** Entry access_gen the answer was computed under */
+		uint32_t gen;
+		fsal_accessflags_t access_type;
+		fsal_accessflags_t allowed;
+		fsal_accessflags_t denied;
+		fsal_errors_t major;
+	} slots[];
+};
+
+/**
+ * @brief One extended attribute cached on an entry
+ *
+ * The name is followed by the value in data.  An xattr the sub-FSAL
+ * said does not exist is kept too, with absent set and no value.
+ */
+struct mdcache_xattr {
+	struct glist_head list;
+	uint32_t name_len;
+	uint32_t value_len;
+	bool absent;
+	char data[];
+};
+
+/**
+ * @brief The LISTXATTR answer for a cookie of zero that reached the end
+ *
+ * Served to a later LISTXATTR from the start with at least maxcount
+ * bytes, which the sub-FSAL would answer the same way.  The names
+ * follow the entries in the same allocation.
+ */
+struct mdcache_xattr_list {
+	count4 maxcount;	/*< la_maxcount the answer was made for */
+	nfs_cookie4 cookie;	/*< Cookie returned */
+	verifier4 verf;		/*< Cookie verifier returned */
+	count4 count;		/*< Names in entries */
+	size_t size;		/*< Bytes of the allocation */
+	component4 entries[];
+};
+
+/**
+ * @brief Extended attributes cached on an entry
+ *
+ * Allocated on the first xattr read with Xattr_Cache_Size set.  What is
+ * held is served while the entry's change attribute is the one it was
+ * read at, and dropped by any xattr change made through us, by
+ * attribute invalidation upcalls, when the entry goes cold in the LRU,
+ * and when it is cleaned.  Everything here is protected by mtx.
+ */
+struct mdcache_xattr_cache {
+	pthread_mutex_t mtx;
+	uint64_t change;	/*< Change attribute the contents go with */
+	/** Bumped by each invalidate, so a fill that raced one is not
+	    kept */
+	uint32_t gen;
+	struct glist_head values;
+	struct mdcache_xattr_list *list;
+};
+
+/**
+ * @brief Timestamps of struct mdcache_attrs
+ */
+enum mdcache_attr_time {
+	MDC_ATIME,
+	MDC_CTIME,
+	MDC_MTIME,
+	MDC_CHGTIME,
+	MDC_NTIMES
+};
+
+/**
+ * @brief Cached attributes few objects have
+ *
+ * Hung off struct mdcache_attrs only while one of them is present.
+ */
+struct mdcache_attrs_ext {
+	fsal_acl_t *acl;
+	struct timespec creation;
+	fsal_dev_t rawdev;	/*< only kept for device files */
+	uint64_t generation;
+};
+
+/**
+ * @brief The attributes of an entry, as cached
+ *
+ * A struct attrlist with the rarely present attributes moved out to
+ * ext and the times split so they pack without padding.  The masks
+ * and the other fields mean the same as in struct attrlist and are
+ * used directly; mdc_attrs_get() and mdc_attrs_set() convert the whole.
+ */
+struct mdcache_attrs {
+	attrmask_t request_mask;
+	attrmask_t valid_mask;
+	attrmask_t supported;
+	uint64_t filesize;
+	uint64_t fileid;
+	uint64_t owner;
+	uint64_t group;
+	uint64_t spaceused;
+	uint64_t change;
+	fsal_fsid_t fsid;
+	int64_t sec[MDC_NTIMES];
+	uint32_t nsec[MDC_NTIMES];
+	struct mdcache_attrs_ext *ext;	/*< NULL if none present */
+	uint32_t mode;
+	uint32_t numlinks;
+	int32_t expire_time_attr;
+	object_file_type_t type;
+};
+
+/**
+ * The fields touched by every lookup and reference (the LRU link, the
+ * hash linkage and key, the flags and the attribute freshness) come
+ * first so that they share the leading cache lines of the entry; the
+ * rest is laid out roughly by decreasing frequency of use.
+ */
 struct mdcache_fsal_obj_handle {
-	/** Reader-writer lock for attributes */
-	pthread_rwlock_t attr_lock;
-	/** MDCache FSAL Handle */
-	struct fsal_obj_handle obj_handle;
-	/** Sub-FSAL handle */
-	struct fsal_obj_handle *sub_handle;
-	/** Cached attributes */
-	struct attrlist attrs;
+	/** New style LRU link */
+	mdcache_lru_t lru;
 	/** FH hash linkage */
 	struct {
 		struct avltree_node node_k;	/*< AVL node in tree */
@@ -244,75 +550,88 @@ struct mdcache_fsal_obj_handle {
 	} fh_hk;
 	/** Flags for this entry */
 	uint32_t mde_flags;
-	/** refcount for number of active icreate */
-	int32_t icreate_refcnt;
-	/** Time at which we last refreshed attributes. */
-	time_t attr_time;
-	/** Time at which we last refreshed acl. */
-	time_t acl_time;
-	/** New style LRU link */
-	mdcache_lru_t lru;
-	/** Exports per entry (protected by attr_lock) */
-	struct glist_head export_list;
 	/** ID of the first mapped export for fast path
 	 *  This is an int32_t because we need it to be -1 to indicate
 	 *  no mapped export.
 	 */
 	int32_t first_export_id;
+	/** Time at which we last refreshed attributes. */
+	time_t attr_time;
+	/** Adaptive attribute lifetime in seconds, 0 until the first
+	 *  revalidation.  Protected by attr_lock.
+	 */
+	uint32_t attr_ttl;
+	/** Invalidation generation this entry was last validated at */
+	uint64_t inval_gen;
+	/** refcount for number of active icreate */
+	int32_t icreate_refcnt;
+	/** Sub-FSAL handle */
+	struct fsal_obj_handle *sub_handle;
+	/** Reader-writer lock for attributes */
+	pthread_rwlock_t attr_lock;
+	/** MDCache FSAL Handle */
+	struct fsal_obj_handle obj_handle;
+	/** Cached attributes */
+	struct mdcache_attrs attrs;
 	/** Lock on type-specific cached content.  See locking
 	    discipline for details. */
 	pthread_rwlock_t content_lock;
+	/** Time at which we last refreshed acl. */
+	time_t acl_time;
+	/** Bumped whenever attributes or ACL are loaded, which drops the
+	 *  remembered access decisions (protected by attr_lock) */
+	uint32_t access_gen;
+	/** Remembered access decisions, NULL until the first check with
+	 *  Access_Cache_Size set (protected by attr_lock) */
+	struct mdcache_access_cache *access;
+	/** Cached extended attributes, NULL until the first xattr read
+	 *  with Xattr_Cache_Size set */
+	struct mdcache_xattr_cache *xattrs;
+	/** Exports per entry (protected by attr_lock) */
+	struct glist_head export_list;
+	/** Link in the fd LRU while the global descriptor is open, and
+	 *  the second of the last I/O on it (protected by the fd LRU
+	 *  lock) */
+	struct glist_head fd_lru;
+	time_t fd_lru_time;
 	/** Filetype specific data, discriminated by the type field.
 	    Note that data for special files is in
 	    attributes.rawdev */
-	union mdcache_fsobj {
+	struct mdcache_fsobj {
+		/** Storage for the state of any type of object */
 		struct state_hdl hdl;
-		struct {
-			/** List of chunks in this directory, not ordered */
-			struct glist_head chunks;
-			/** List of detached directory entries. */
-			struct glist_head detached;
-			/** Spin lock to protect the detached list. */
-			pthread_spinlock_t spin;
-			/** Count of detached directory entries. */
-			int detached_count;
-			/** @todo FSF
-			 *
-			 * This is somewhat fragile, however, a reorganization
-			 * is possible. If state_lock was to be moved into
-			 * state_file and state_dir, and the state code was
-			 * made clear which it was working with, dhdl could
-			 * be replaced with a state_dir which would be
-			 * smaller than state_file, and then the additional
-			 * members of fsdir would basically overlay
-			 * the larger state_file that hdl is.
-			 *
-			 * Such a reorg could save memory AND make for a
-			 * crisper interface.
-			 */
-			struct state_hdl dhdl; /**< Storage for dir state */
-			/** The parent host-handle of this directory ('..') */
-			struct gsh_buffdesc parent;
-			/** The first dirent cookie in this directory.
-			 *  0 if not known.
-			 */
-			fsal_cookie_t first_ck;
-			struct {
-				/** Children by name hash */
-				struct avltree t;
-				/** Persist cookies for deleted entries */
-				struct avltree c;
-				/** Table of dirents by FSAL cookie */
-				struct avltree ck;
-				/** Table of dirents in sorted order. */
-				struct avltree sorted;
-				/** Heuristic. Expect 0. */
-				uint32_t collisions;
-			} avl;
-		} fsdir;		/**< DIRECTORY data */
+		/** DIRECTORY data, NULL for other types */
+		struct mdcache_fsdir *fsdir;
+		/** REGULAR_FILE read-ahead, NULL until a file is read with
+		    read-ahead enabled */
+		struct mdcache_file_ra *ra;
+		/** REGULAR_FILE write-behind, NULL until a file is written
+		    with write-behind enabled */
+		struct mdcache_file_wb *wb;
+		/** REGULAR_FILE content, NULL until a small file is read
+		    with Small_File_Cache_Size set */
+		struct mdcache_file_sc *sc;
 	} fsobj;
 };
 
+/**
+ * @brief Block of a chunk's dirent arena
+ *
+ * Dirents loaded by readdir are carved out of their chunk's blocks one
+ * after the other, with their name and key behind them, and the blocks
+ * are freed with the chunk.
+ */
+struct mdcache_dirent_block {
+	struct mdcache_dirent_block *next;
+	size_t size;	/*< Bytes of data */
+	size_t used;	/*< Bytes of data handed out */
+	char data[];
+};
+
+/* Arena blocks start this small and double up to the maximum */
+#define MDCACHE_DIRENT_BLOCK_MIN 2048
+#define MDCACHE_DIRENT_BLOCK_MAX (32 * 1024)
+
 struct dir_chunk {
 	/** This chunk is part of a directory */
 	struct glist_head chunks;
@@ -334,6 +653,8 @@ struct dir_chunk {
 	fsal_cookie_t next_ck;
 	/** Number of entries in chunk */
 	int num_entries;
+	/** Most recent arena block, NULL if none */
+	struct mdcache_dirent_block *arena;
 };
 
 /**
@@ -346,6 +667,8 @@ struct dir_chunk {
 #define DIR_ENTRY_FLAG_NONE     0x0000
 #define DIR_ENTRY_FLAG_DELETED  0x0001
 #define DIR_ENTRY_SORTED        0x0004
+#define DIR_ENTRY_ARENA         0x0008	/*< Allocated in a chunk's arena */
+#define DIR_ENTRY_ARENA_KEY     0x0010	/*< ckey bytes are in the arena */
 
 typedef struct mdcache_dir_entry__ {
 	/** This dirent is part of a chunk */
@@ -366,6 +689,10 @@ typedef struct mdcache_dir_entry__ {
 	/** Indicates if this dirent is the last dirent in a chunked directory.
 	 */
 	bool eod;
+	/** Length of the handle following the arena key, if the entry was
+	 *  left to be created on use (see Dir_Lazy_Entries), else 0.
+	 */
+	uint16_t fh_len;
 	struct {
 		/** Name Hash */
 		uint64_t k;
@@ -380,6 +707,19 @@ typedef struct mdcache_dir_entry__ {
 	char name[];
 } mdcache_dir_entry_t;
 
+/**
+ * @brief Slot in a directory's name index
+ *
+ * An empty slot has a NULL dirent.
+ */
+struct mdcache_dir_index_slot {
+	uint64_t hash;		/*< Unprobed name hash */
+	mdcache_dir_entry_t *dirent;
+};
+
+/* Directories index names once they hold this many active dirents */
+#define MDCACHE_DIR_INDEX_MIN 128
+
 /**
  * @brief Move a detached dirent to MRU postion in LRU list.
  *
@@ -390,13 +730,13 @@ typedef struct mdcache_dir_entry__ {
 static inline void bump_detached_dirent(mdcache_entry_t *parent,
 					mdcache_dir_entry_t *dirent)
 {
-	pthread_spin_lock(&parent->fsobj.fsdir.spin);
-	if (glist_first_entry(&parent->fsobj.fsdir.detached,
+	pthread_spin_lock(&parent->fsobj.fsdir->spin);
+	if (glist_first_entry(&parent->fsobj.fsdir->detached,
 			      mdcache_dir_entry_t, chunk_list) != dirent) {
 		glist_del(&dirent->chunk_list);
-		glist_add(&parent->fsobj.fsdir.detached, &dirent->chunk_list);
+		glist_add(&parent->fsobj.fsdir->detached, &dirent->chunk_list);
 	}
-	pthread_spin_unlock(&parent->fsobj.fsdir.spin);
+	pthread_spin_unlock(&parent->fsobj.fsdir->spin);
 }
 
 /**
@@ -409,15 +749,15 @@ static inline void bump_detached_dirent(mdcache_entry_t *parent,
 static inline void rmv_detached_dirent(mdcache_entry_t *parent,
 				       mdcache_dir_entry_t *dirent)
 {
-	pthread_spin_lock(&parent->fsobj.fsdir.spin);
+	pthread_spin_lock(&parent->fsobj.fsdir->spin);
 	/* Note that the dirent might not be on the detached list if it
 	 * was being reaped by another thread. All is well here...
 	 */
 	if (!glist_null(&dirent->chunk_list)) {
 		glist_del(&dirent->chunk_list);
-		parent->fsobj.fsdir.detached_count--;
+		parent->fsobj.fsdir->detached_count--;
 	}
-	pthread_spin_unlock(&parent->fsobj.fsdir.spin);
+	pthread_spin_unlock(&parent->fsobj.fsdir->spin);
 }
 
 /* Helpers */
@@ -436,6 +776,8 @@ fsal_status_t mdcache_alloc_and_check_handle(
 
 fsal_status_t mdcache_refresh_attrs(mdcache_entry_t *entry, bool need_acl,
 				    bool invalidate);
+void mdcache_install_attrs(mdcache_entry_t *entry, struct attrlist *attrs,
+			   bool need_acl, bool invalidate);
 
 static inline
 void mdcache_refresh_attrs_no_invalidate(mdcache_entry_t *entry)
@@ -504,6 +846,48 @@ fsal_status_t mdcache_readdir_chunked(mdcache_entry_t *directory,
 				      fsal_readdir_cb cb,
 				      attrmask_t attrmask,
 				      bool *eod_met);
+fsal_status_t mdcache_readahead_pkginit(void);
+void mdcache_readahead_pkgshutdown(void);
+fsal_status_t mdcache_file_ra_pkginit(void);
+void mdcache_file_ra_pkgshutdown(void);
+void mdcache_file_ra_invalidate(mdcache_entry_t *entry);
+void mdcache_file_ra_free(mdcache_entry_t *entry);
+void mdcache_file_sc_release(mdcache_entry_t *entry);
+void mdcache_file_sc_free(mdcache_entry_t *entry);
+void mdcache_file_wb_flush(mdcache_entry_t *entry, uint64_t offset,
+			   uint64_t len);
+void mdcache_file_wb_free(mdcache_entry_t *entry);
+void mdcache_xattr_release(mdcache_entry_t *entry);
+void mdcache_xattr_free(mdcache_entry_t *entry);
+
+/**
+ * @brief A backend call in progress that identical callers can wait for
+ *
+ * Keyed by the entry it is made on and, for lookups, the name looked up.
+ * Protected by the lock of the stripe it hashes to.
+ */
+struct mdc_flight {
+	struct glist_head node;		/*< Link in stripe while in flight */
+	const void *owner;		/*< Entry the call is made on */
+	const char *name;		/*< Name looked up, NULL for getattrs */
+	uint64_t hash;			/*< Hash of owner and name */
+	uint32_t flags;			/*< MDC_FLIGHT_* the call covers */
+	int32_t refs;			/*< Leader plus waiters */
+	bool done;			/*< Result is published */
+	pthread_cond_t cv;		/*< Signalled when done */
+	fsal_status_t status;		/*< Result of the call */
+	mdcache_entry_t *entry;		/*< Entry found, ref'd while set */
+};
+
+/** The call also fetched the ACL */
+#define MDC_FLIGHT_ACL 0x01
+
+void mdc_flight_pkginit(void);
+bool mdc_flight_begin(const void *owner, const char *name, uint32_t flags,
+		      struct mdc_flight **flight);
+void mdc_flight_end(struct mdc_flight *flight, fsal_status_t status,
+		    mdcache_entry_t *entry);
+void mdc_flight_put(struct mdc_flight *flight);
 
 void mdc_get_parent(struct mdcache_fsal_export *export,
 		    mdcache_entry_t *entry);
@@ -546,6 +930,83 @@ static inline struct mdcache_fsal_export *mdc_cur_export(void)
 	return mdc_export(op_ctx->fsal_export);
 }
 
+/** Source of invalidation generations, bumped by each subtree or
+ *  export invalidate upcall.
+ */
+extern uint64_t mdc_inval_gen;
+
+/**
+ * @brief Raise an invalidation generation, never lowering it
+ *
+ * @return true if this call raised it.
+ */
+static inline bool mdc_inval_gen_raise(uint64_t *var, uint64_t gen)
+{
+	uint64_t cur;
+
+	do {
+		cur = atomic_fetch_uint64_t(var);
+		if (likely(cur >= gen))
+			return false;
+	} while (!atomic_cas_uint64_t(var, cur, gen));
+
+	return true;
+}
+
+/**
+ * @brief Invalidate an entry validated before a generation
+ *
+ * This is how invalidate_subtree and invalidate_export upcalls reach
+ * entries: lazily, as they are next found, rather than by walking the
+ * cache when the upcall comes in.
+ *
+ * @param[in] entry  Entry being accessed
+ * @param[in] gen    Generation it must have been validated at
+ *
+ * @return true if the entry was invalidated.
+ */
+static inline bool mdc_inval_gen_check(mdcache_entry_t *entry, uint64_t gen)
+{
+	if (!mdc_inval_gen_raise(&entry->inval_gen, gen))
+		return false;
+
+	atomic_clear_uint32_t_bits(&entry->mde_flags,
+				   FSAL_UP_INVALIDATE_CACHE);
+	mdcache_file_ra_invalidate(entry);
+	mdcache_xattr_release(entry);
+	return true;
+}
+
+/**
+ * @brief Catch an entry up with its export's invalidate_export upcalls
+ *
+ * @param[in] entry  Entry found under op_ctx's export
+ */
+static inline void mdc_inval_export_check(mdcache_entry_t *entry)
+{
+	struct mdcache_fsal_export *export = mdc_cur_export();
+
+	(void) mdc_inval_gen_check(entry,
+				   atomic_fetch_uint64_t(&export->inval_gen));
+}
+
+/**
+ * @brief Pass a directory's invalidate_subtree upcalls on to a child
+ *
+ * @param[in] parent  Directory the child was found in
+ * @param[in] entry   The child
+ */
+static inline void mdc_inval_subtree_check(mdcache_entry_t *parent,
+					   mdcache_entry_t *entry)
+{
+	uint64_t gen = atomic_fetch_uint64_t(&parent->fsobj.fsdir->subtree_gen);
+
+	if (mdc_inval_gen_check(entry, gen) &&
+	    entry->obj_handle.type == DIRECTORY)
+		(void) mdc_inval_gen_raise(&entry->fsobj.fsdir->subtree_gen,
+					   gen);
+}
+
 void mdc_clean_entry(mdcache_entry_t *entry);
 fsal_status_t mdc_check_mapping(mdcache_entry_t *entry);
 void _mdcache_kill_entry(mdcache_entry_t *entry,
@@ -573,11 +1034,34 @@ extern struct config_block mdcache_param_blk;
 		op_ctx->fsal_export = &(myexp)->export; \
 } while (0)
 
+/**
+ * @brief Clock for the time requests spend in the sub-FSAL
+ *
+ * Calls into the sub-FSAL add their duration to op_ctx->fsal_time and
+ * callbacks into MDCACHE take theirs back out, so nesting adds up.
+ * Only the latency statistics read it, so with Enable_Fast_Stats, which
+ * is fixed at startup, the clock is left alone and every call reads 0.
+ */
+static inline nsecs_elapsed_t mdc_fsal_clock(void)
+{
+	struct timespec ts;
+
+	if (nfs_param.core_param.enable_FASTSTATS)
+		return 0;
+
+	now(&ts);
+	return timespec_to_nsecs(&ts);
+}
+
 /* Call a sub-FSAL function using it's export */
 #define subcall_raw(myexp, call) do { \
+	nsecs_elapsed_t __fsal_start = mdc_fsal_clock(); \
+	const char *__fsal_outer = req_inflight_fsal_enter(#call); \
 	op_ctx->fsal_export = (myexp)->export.sub_export; \
 	call; \
 	op_ctx->fsal_export = &(myexp)->export; \
+	req_inflight_fsal_exit(__fsal_outer); \
+	op_ctx->fsal_time += mdc_fsal_clock() - __fsal_start; \
 } while (0)
 
 /* Call a sub-FSAL function using it's export */
@@ -586,12 +1070,29 @@ extern struct config_block mdcache_param_blk;
 	subcall_raw(__export, call); \
 } while (0)
 
+/* Call a sub-FSAL function that only looks at the handle in memory, such
+ * as handle_to_key or handle_to_wire.  Without the clock and in-flight
+ * bookkeeping of subcall_raw, so its time stays with MDCACHE.
+ */
+#define subcall_nowait_raw(myexp, call) do { \
+	op_ctx->fsal_export = (myexp)->export.sub_export; \
+	call; \
+	op_ctx->fsal_export = &(myexp)->export; \
+} while (0)
+
+#define subcall_nowait(call) do { \
+	struct mdcache_fsal_export *__export = mdc_cur_export(); \
+	subcall_nowait_raw(__export, call); \
+} while (0)
+
 /* During a callback from a sub-FSAL, call using MDCACHE's export */
 #define supercall_raw(myexp, call) do { \
+	nsecs_elapsed_t __fsal_start = mdc_fsal_clock(); \
 	LogFullDebug(COMPONENT_CACHE_INODE, "supercall %s", myexp->name); \
 	op_ctx->fsal_export = &(myexp)->export; \
 	call; \
 	op_ctx->fsal_export = (myexp)->export.sub_export; \
+	op_ctx->fsal_time -= mdc_fsal_clock() - __fsal_start; \
 } while (0)
 
 /**
@@ -640,7 +1141,7 @@ mdcache_key_dup(mdcache_key_t *tgt,
 static inline void
 mdc_dir_add_parent(mdcache_entry_t *entry, mdcache_entry_t *mdc_parent)
 {
-	if (entry->fsobj.fsdir.parent.len == 0) {
+	if (entry->fsobj.fsdir->parent.len == 0) {
 		/* The parent key must be a host-handle so that
 		 * create_handle() works in all cases.
 		 */
@@ -666,6 +1167,38 @@ mdcache_key_delete(mdcache_key_t *key)
 	key->kv.addr = NULL;
 }
 
+/**
+ * @brief Delete a dirent's cache key, wherever it is stored
+ *
+ * @param dirent [in] The dirent
+ */
+static inline void
+mdcache_dirent_key_delete(mdcache_dir_entry_t *dirent)
+{
+	if (dirent->flags & DIR_ENTRY_ARENA_KEY) {
+		dirent->flags &= ~DIR_ENTRY_ARENA_KEY;
+		dirent->fh_len = 0;
+		dirent->ckey.kv.len = 0;
+		dirent->ckey.kv.addr = NULL;
+		return;
+	}
+
+	mdcache_key_delete(&dirent->ckey);
+}
+
+/**
+ * @brief Handle of a dirent whose entry is yet to be created
+ *
+ * Only valid while fh_len is not 0.
+ *
+ * @param dirent [in] The dirent
+ */
+static inline void *
+mdc_dirent_fh(mdcache_dir_entry_t *dirent)
+{
+	return (char *) dirent->ckey.kv.addr + dirent->ckey.kv.len;
+}
+
 /* Create a copy of host-handle */
 static inline void
 mdcache_copy_fh(struct gsh_buffdesc *dest, struct gsh_buffdesc *src)
@@ -684,6 +1217,197 @@ mdcache_free_fh(struct gsh_buffdesc *fh_desc)
 	fh_desc->addr = NULL;
 }
 
+static inline void
+mdc_attrs_time(const struct mdcache_attrs *attrs,
+	       enum mdcache_attr_time which, struct timespec *ts)
+{
+	ts->tv_sec = attrs->sec[which];
+	ts->tv_nsec = attrs->nsec[which];
+}
+
+static inline void
+mdc_attrs_set_time(struct mdcache_attrs *attrs,
+		   enum mdcache_attr_time which, const struct timespec *ts)
+{
+	attrs->sec[which] = ts->tv_sec;
+	attrs->nsec[which] = ts->tv_nsec;
+}
+
+/**
+ * @brief Compare a time with one of the cached ones
+ *
+ * @return As gsh_time_cmp(ts, cached).
+ */
+static inline int
+mdc_attrs_time_cmp(const struct timespec *ts,
+		   const struct mdcache_attrs *attrs,
+		   enum mdcache_attr_time which)
+{
+	struct timespec cached;
+
+	mdc_attrs_time(attrs, which, &cached);
+	return gsh_time_cmp(ts, &cached);
+}
+
+/**
+ * @brief The extension of cached attributes, allocated if need be
+ *
+ * @note the caller MUST hold attr_lock for write
+ */
+static inline struct mdcache_attrs_ext *
+mdc_attrs_ext(struct mdcache_attrs *attrs)
+{
+	if (attrs->ext == NULL)
+		attrs->ext = gsh_calloc(1, sizeof(*attrs->ext));
+	return attrs->ext;
+}
+
+/**
+ * @brief Expand cached attributes into a struct attrlist
+ *
+ * As fsal_copy_attrs(dest, src, false): dest keeps its request_mask,
+ * and gets a reference on the ACL only if that asks for it.
+ *
+ * @note the caller MUST hold attr_lock
+ *
+ * @param[in,out] dest Attributes to fill, request_mask set
+ * @param[in]     src  The cached attributes
+ */
+static inline void
+mdc_attrs_get(struct attrlist *dest, const struct mdcache_attrs *src)
+{
+	const struct mdcache_attrs_ext *ext = src->ext;
+
+	dest->valid_mask = src->valid_mask;
+	dest->supported = src->supported;
+	dest->type = src->type;
+	dest->filesize = src->filesize;
+	dest->fsid = src->fsid;
+	dest->fileid = src->fileid;
+	dest->mode = src->mode;
+	dest->numlinks = src->numlinks;
+	dest->owner = src->owner;
+	dest->group = src->group;
+	mdc_attrs_time(src, MDC_ATIME, &dest->atime);
+	mdc_attrs_time(src, MDC_CTIME, &dest->ctime);
+	mdc_attrs_time(src, MDC_MTIME, &dest->mtime);
+	mdc_attrs_time(src, MDC_CHGTIME, &dest->chgtime);
+	dest->spaceused = src->spaceused;
+	dest->change = src->change;
+	dest->expire_time_attr = src->expire_time_attr;
+
+	if (ext != NULL) {
+		dest->creation = ext->creation;
+		dest->rawdev = ext->rawdev;
+		dest->generation = ext->generation;
+	} else {
+		memset(&dest->creation, 0, sizeof(dest->creation));
+		memset(&dest->rawdev, 0, sizeof(dest->rawdev));
+		dest->generation = 0;
+	}
+
+	if (ext != NULL && ext->acl != NULL &&
+	    (dest->request_mask & ATTR_ACL) != 0) {
+		dest->acl = ext->acl;
+		nfs4_acl_entry_inc_ref(dest->acl);
+	} else {
+		dest->acl = NULL;
+		dest->valid_mask &= ~ATTR_ACL;
+	}
+}
+
+/**
+ * @brief Pack a struct attrlist into cached attributes
+ *
+ * As fsal_copy_attrs(dest, src, true): dest keeps its request_mask and
+ * takes src's ACL reference only if that asks for the ACL.  The
+ * extension is allocated, reused or freed as the new attributes need.
+ *
+ * @note the caller MUST hold attr_lock for write, and have released or
+ *       moved away any ACL dest held.
+ *
+ * @param[in,out] dest The cached attributes
+ * @param[in,out] src  Attributes to store
+ */
+static inline void
+mdc_attrs_set(struct mdcache_attrs *dest, struct attrlist *src)
+{
+	struct mdcache_attrs_ext *ext = dest->ext;
+	bool device = src->type == CHARACTER_FILE || src->type == BLOCK_FILE;
+	fsal_acl_t *acl = NULL;
+
+	dest->valid_mask = src->valid_mask;
+	if ((dest->request_mask & ATTR_ACL) != 0) {
+		/* Pass the reference */
+		acl = src->acl;
+		src->acl = NULL;
+		src->valid_mask &= ~ATTR_ACL;
+	} else {
+		dest->valid_mask &= ~ATTR_ACL;
+	}
+
+	dest->supported = src->supported;
+	dest->type = src->type;
+	dest->filesize = src->filesize;
+	dest->fsid = src->fsid;
+	dest->fileid = src->fileid;
+	dest->mode = src->mode;
+	dest->numlinks = src->numlinks;
+	dest->owner = src->owner;
+	dest->group = src->group;
+	mdc_attrs_set_time(dest, MDC_ATIME, &src->atime);
+	mdc_attrs_set_time(dest, MDC_CTIME, &src->ctime);
+	mdc_attrs_set_time(dest, MDC_MTIME, &src->mtime);
+	mdc_attrs_set_time(dest, MDC_CHGTIME, &src->chgtime);
+	dest->spaceused = src->spaceused;
+	dest->change = src->change;
+	dest->expire_time_attr = src->expire_time_attr;
+
+	if (acl == NULL &&
+	    (dest->valid_mask & (ATTR_CREATION | ATTR_GENERATION)) == 0 &&
+	    !(device && (dest->valid_mask & ATTR_RAWDEV) != 0)) {
+		gsh_free(ext);
+		dest->ext = NULL;
+		return;
+	}
+
+	if (ext == NULL)
+		ext = dest->ext = gsh_malloc(sizeof(*ext));
+
+	ext->acl = acl;
+	ext->creation = src->creation;
+	ext->generation = src->generation;
+	if (device)
+		ext->rawdev = src->rawdev;
+	else
+		memset(&ext->rawdev, 0, sizeof(ext->rawdev));
+}
+
+/**
+ * @brief Release what cached attributes hold
+ *
+ * @param[in,out] attrs The cached attributes
+ */
+static inline void
+mdc_attrs_release(struct mdcache_attrs *attrs)
+{
+	if (attrs->ext == NULL)
+		return;
+
+	if (attrs->ext->acl != NULL) {
+		int acl_status = nfs4_acl_release_entry(attrs->ext->acl);
+
+		if (acl_status != NFS_V4_ACL_SUCCESS)
+			LogCrit(COMPONENT_CACHE_INODE,
+				"Failed to release old acl, status=%d",
+				acl_status);
+	}
+
+	gsh_free(attrs->ext);
+	attrs->ext = NULL;
+	attrs->valid_mask &= ~ATTR_ACL;
+}
+
 /**
  * @brief Update entry metadata from its attributes
  *
@@ -743,6 +1467,9 @@ mdc_fixup_md(mdcache_entry_t *entry, struct attrlist *attrs)
 			entry->attr_time = 0;
 	}
 
+	/* Whatever was decided from the old attributes is void */
+	entry->access_gen++;
+
 	/* We have just loaded the attributes from the FSAL. */
 	atomic_set_uint32_t_bits(&entry->mde_flags, flags);
 }
@@ -766,6 +1493,58 @@ mdcache_test_attrs_trust(mdcache_entry_t *entry, attrmask_t mask)
 	return true;
 }
 
+/**
+ * @brief Lifetime of an entry's cached attributes
+ *
+ * This is the export's expiration time, or with Attr_TTL_Adaptive the
+ * entry's own lifetime once it has been revalidated at least once.
+ *
+ * @note the caller MUST hold attr_lock for read
+ *
+ * @param[in] entry     The entry to check
+ */
+
+static inline int32_t
+mdcache_attr_lifetime(mdcache_entry_t *entry)
+{
+	if (mdcache_param.attr_ttl_adaptive && entry->attr_ttl != 0 &&
+	    entry->attrs.expire_time_attr > 0)
+		return entry->attr_ttl;
+
+	return entry->attrs.expire_time_attr;
+}
+
+/**
+ * @brief Adjust an entry's attribute lifetime after revalidation
+ *
+ * Like the NFS client's acregmin/acregmax: each revalidation that finds
+ * the attributes unchanged doubles the lifetime up to Attr_TTL_Max, and
+ * one that finds them changed drops it back to Attr_TTL_Min.
+ *
+ * @note the caller MUST hold attr_lock for write
+ *
+ * @param[in,out] entry     The entry just revalidated
+ * @param[in]     changed   Whether the attributes had changed
+ */
+
+static inline void
+mdcache_attr_ttl_adapt(mdcache_entry_t *entry, bool changed)
+{
+	uint32_t ttl = entry->attr_ttl;
+
+	if (!mdcache_param.attr_ttl_adaptive)
+		return;
+
+	if (changed || ttl == 0)
+		ttl = mdcache_param.attr_ttl_min;
+	else if (ttl < mdcache_param.attr_ttl_max / 2)
+		ttl *= 2;
+	else
+		ttl = mdcache_param.attr_ttl_max;
+
+	entry->attr_ttl = ttl;
+}
+
 /**
  * @brief Check if attributes are valid
  *
@@ -784,7 +1563,8 @@ mdcache_is_attrs_valid(mdcache_entry_t *entry, attrmask_t mask)
 		return false;
 
 	if (entry->obj_handle.type == DIRECTORY
-	    && mdcache_param.getattr_dir_invalidation)
+	    && mdcache_param.getattr_dir_invalidation
+	    && !test_mde_flags(entry, MDCACHE_IMMUTABLE))
 		return false;
 
 	if ((mask & ~ATTR_ACL) != 0 && entry->attrs.expire_time_attr == 0)
@@ -794,7 +1574,7 @@ mdcache_is_attrs_valid(mdcache_entry_t *entry, attrmask_t mask)
 		time_t current_time = time(NULL);
 
 		if (current_time - entry->attr_time >
-		    entry->attrs.expire_time_attr)
+		    mdcache_attr_lifetime(entry))
 			return false;
 	}
 
@@ -805,7 +1585,7 @@ mdcache_is_attrs_valid(mdcache_entry_t *entry, attrmask_t mask)
 		time_t current_time = time(NULL);
 
 		if (current_time - entry->acl_time >
-		    entry->attrs.expire_time_attr)
+		    mdcache_attr_lifetime(entry))
 			return false;
 	}
 
@@ -851,9 +1631,9 @@ mdc_has_state(mdcache_entry_t *entry)
 			return true;
 		return false;
 	case DIRECTORY:
-		if (entry->fsobj.fsdir.dhdl.dir.junction_export)
+		if (entry->fsobj.hdl.dir.junction_export)
 			return true;
-		if (entry->fsobj.fsdir.dhdl.dir.exp_root_refcount)
+		if (entry->fsobj.hdl.dir.exp_root_refcount)
 			return true;
 		return false;
 	default:
@@ -1007,6 +1787,52 @@ fsal_status_t mdcache_write2(struct fsal_obj_handle *obj_hdl,
 			     size_t *write_amount,
 			     bool *fsal_stable,
 			     struct io_info *info);
+void mdcache_read2_async(struct fsal_obj_handle *obj_hdl,
+			 bool bypass,
+			 struct state_t *state,
+			 uint64_t offset,
+			 size_t buf_size,
+			 void *buffer,
+			 size_t *read_amount,
+			 bool *eof,
+			 struct io_info *info,
+			 fsal_async_cb done_cb,
+			 void *caller_data);
+void mdcache_write2_async(struct fsal_obj_handle *obj_hdl,
+			  bool bypass,
+			  struct state_t *state,
+			  uint64_t offset,
+			  size_t buf_size,
+			  void *buffer,
+			  size_t *write_amount,
+			  bool *fsal_stable,
+			  struct io_info *info,
+			  fsal_async_cb done_cb,
+			  void *caller_data);
+fsal_status_t mdcache_writev2(struct fsal_obj_handle *obj_hdl,
+			      bool bypass,
+			      struct state_t *state,
+			      uint64_t offset,
+			      const struct iovec *iov,
+			      int iovcnt,
+			      size_t *write_amount,
+			      bool *fsal_stable,
+			      struct io_info *info);
+fsal_status_t mdcache_copy(struct fsal_obj_handle *dst_hdl,
+			   struct state_t *dst_state,
+			   uint64_t dst_offset,
+			   struct fsal_obj_handle *src_hdl,
+			   struct state_t *src_state,
+			   uint64_t src_offset,
+			   uint64_t count,
+			   uint64_t *copied);
+fsal_status_t mdcache_clone(struct fsal_obj_handle *dst_hdl,
+			    struct state_t *dst_state,
+			    uint64_t dst_offset,
+			    struct fsal_obj_handle *src_hdl,
+			    struct state_t *src_state,
+			    uint64_t src_offset,
+			    uint64_t count);
 fsal_status_t mdcache_seek2(struct fsal_obj_handle *obj_hdl,
 			    struct state_t *state,
 			    struct io_info *info);
@@ -89,6 +89,8 @@
 
 struct lru_state lru_state;
 
+struct lru_partition lru_partitions[EXPORT_CACHE_PARTITIONS];
+
 /**
  * A single queue structure.
  */
@@ -225,6 +227,113 @@ static const uint32_t FD_FALLBACK_LIMIT = 0x400;
 	((n) == LRU_SENTINEL_REFCOUNT+1) && \
 	 ((e)->fh_hk.inavl))
 
+/**
+ * @brief TinyLFU frequency sketch
+ *
+ * A count-min sketch of 4-bit counters (held in bytes) indexed by the
+ * entry key hash, so it remembers handles that have left the cache.
+ * Updates are deliberately unlocked and may be lost under contention;
+ * the sketch only needs to be approximately right.  Every reset_at
+ * additions the LRU thread halves all counters, so frequency ages out.
+ */
+#define LRU_SKETCH_DEPTH 4
+#define LRU_SKETCH_MAX 15
+/* Victims seen this many times or more get a second chance */
+#define LRU_SKETCH_ADMIT 2
+/* Candidates examined per lane before giving up and taking the head */
+#define LRU_SKETCH_PROBE 8
+
+static struct {
+	uint8_t *counters;
+	uint32_t mask;
+	uint64_t additions;
+	uint64_t reset_at;
+} lru_sketch;
+
+static const uint64_t lru_sketch_seeds[LRU_SKETCH_DEPTH] = {
+	0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+	0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL
+};
+
+static inline bool lru_tinylfu(void)
+{
+	return lru_sketch.counters != NULL;
+}
+
+static inline uint8_t *lru_sketch_slot(uint64_t hk, int row)
+{
+	uint64_t h = (hk ^ (hk >> 29)) * lru_sketch_seeds[row];
+
+	return &lru_sketch.counters[(row * (lru_sketch.mask + 1)) +
+				    ((h >> 32) & lru_sketch.mask)];
+}
+
+static inline void lru_sketch_record(uint64_t hk)
+{
+	uint8_t *c;
+	int row;
+
+	for (row = 0; row < LRU_SKETCH_DEPTH; ++row) {
+		c = lru_sketch_slot(hk, row);
+		if (*c < LRU_SKETCH_MAX)
+			++(*c);
+	}
+	++lru_sketch.additions;
+}
+
+static inline uint8_t lru_sketch_estimate(uint64_t hk)
+{
+	uint8_t est = LRU_SKETCH_MAX, c;
+	int row;
+
+	for (row = 0; row < LRU_SKETCH_DEPTH; ++row) {
+		c = *lru_sketch_slot(hk, row);
+		if (c < est)
+			est = c;
+	}
+	return est;
+}
+
+/* Charge a second chance against the entry's frequency */
+static inline void lru_sketch_decay(uint64_t hk)
+{
+	uint8_t *c;
+	int row;
+
+	for (row = 0; row < LRU_SKETCH_DEPTH; ++row) {
+		c = lru_sketch_slot(hk, row);
+		*c >>= 1;
+	}
+}
+
+static void lru_sketch_age(void)
+{
+	size_t ix, n = LRU_SKETCH_DEPTH * ((size_t)lru_sketch.mask + 1);
+
+	if (!lru_tinylfu() || lru_sketch.additions < lru_sketch.reset_at)
+		return;
+
+	for (ix = 0; ix < n; ++ix)
+		lru_sketch.counters[ix] >>= 1;
+	lru_sketch.additions /= 2;
+}
+
+static void lru_sketch_init(void)
+{
+	uint32_t width = 1024;
+
+	if (mdcache_param.lru_policy != MDCACHE_LRU_POLICY_TINYLFU)
+		return;
+
+	while (width < mdcache_param.entries_hwmark && width < (1U << 30))
+		width <<= 1;
+
+	lru_sketch.mask = width - 1;
+	lru_sketch.additions = 0;
+	lru_sketch.reset_at = 10 * (uint64_t)width;
+	lru_sketch.counters = gsh_calloc(LRU_SKETCH_DEPTH, width);
+}
+
 /**
  * @brief Initialize a single base queue.
  *
@@ -450,6 +559,229 @@ lru_insert_chunk(struct dir_chunk *chunk, struct lru_q *q, enum lru_edge edge)
 	QUNLOCK(qlane);
 }
 
+/**
+ * @brief Open file descriptor LRU
+ *
+ * With Use_FD_LRU, every entry whose sub-FSAL holds a global file
+ * descriptor is linked here in order of last I/O, independent of the
+ * entry LRU.  I/O moves the entry to the MRU end (at most once a second
+ * per entry) and closing the descriptor unlinks it, both in constant
+ * time.  fd_lru_run closes descriptors from the LRU end in batches once
+ * open_fd_count reaches FD_HWMark_Percent, or once they have gone unused
+ * for FD_Idle_Timeout, so the entry LRU no longer has to walk the lanes
+ * closing files.
+ *
+ * The list holds no reference; entries are unlinked before they are
+ * cleaned.  The list lock nests outside the lane locks.
+ */
+static struct {
+	pthread_mutex_t mtx;
+	struct glist_head q;	/*< LRU is at HEAD, MRU at tail */
+	uint64_t count;
+} fd_lru;
+
+/** Descriptors closed by one batch of fd_lru_run */
+#define FD_LRU_BATCH 64
+
+static inline bool fd_lru_enabled(void)
+{
+	return mdcache_param.use_fd_lru;
+}
+
+/**
+ * @brief Note I/O on an entry's global file descriptor
+ *
+ * Links the entry at the MRU end of the fd LRU if its sub-FSAL has the
+ * global descriptor open, and unlinks it if not.
+ *
+ * @param[in] entry  The entry
+ */
+void mdcache_lru_fd_bump(mdcache_entry_t *entry)
+{
+	fsal_openflags_t openflags;
+	time_t now;
+
+	if (!fd_lru_enabled() || entry->obj_handle.type != REGULAR_FILE)
+		return;
+
+	now = time(NULL);
+
+	/* Already linked and recent enough, nothing to do */
+	if (entry->fd_lru.next != NULL && entry->fd_lru_time == now)
+		return;
+
+	subcall(
+		openflags = entry->sub_handle->obj_ops.status(
+							entry->sub_handle)
+	       );
+
+	if (openflags == FSAL_O_CLOSED) {
+		mdcache_lru_fd_remove(entry);
+		return;
+	}
+
+	PTHREAD_MUTEX_lock(&fd_lru.mtx);
+	if (entry->fd_lru.next != NULL)
+		glist_del(&entry->fd_lru);
+	else
+		++fd_lru.count;
+	glist_add_tail(&fd_lru.q, &entry->fd_lru);
+	entry->fd_lru_time = now;
+	PTHREAD_MUTEX_unlock(&fd_lru.mtx);
+}
+
+/**
+ * @brief Unlink an entry from the fd LRU
+ *
+ * @param[in] entry  The entry, whose global descriptor is or is about to
+ *                   be closed
+ */
+void mdcache_lru_fd_remove(mdcache_entry_t *entry)
+{
+	if (entry->fd_lru.next == NULL)
+		return;
+
+	PTHREAD_MUTEX_lock(&fd_lru.mtx);
+	if (entry->fd_lru.next != NULL) {
+		glist_del(&entry->fd_lru);
+		--fd_lru.count;
+	}
+	PTHREAD_MUTEX_unlock(&fd_lru.mtx);
+}
+
+/**
+ * @brief Release the directory-only part of an entry
+ *
+ * @param[in] entry  The entry, already cleaned of dirents
+ */
+static inline void mdcache_free_fsdir(mdcache_entry_t *entry)
+{
+	if (entry->fsobj.fsdir == NULL)
+		return;
+
+	gsh_free(entry->fsobj.fsdir);
+	entry->fsobj.fsdir = NULL;
+	(void) atomic_sub_uint64_t(&lru_state.entry_bytes,
+				   sizeof(struct mdcache_fsdir));
+}
+
+/**
+ * @brief Charge an entry or chunk to a cache partition
+ *
+ * @param[in,out] lru    Its LRU link
+ * @param[in]     part   Partition
+ * @param[in]     chunk  True for a chunk
+ */
+static inline void lru_part_charge(mdcache_lru_t *lru, uint32_t part,
+				   bool chunk)
+{
+	struct lru_partition *lp = &lru_partitions[part];
+
+	lru->part = part + 1;
+	(void) atomic_inc_uint64_t(chunk ? &lp->chunks : &lp->entries);
+}
+
+/**
+ * @brief Undo lru_part_charge(), if it was done
+ *
+ * @param[in,out] lru    LRU link
+ * @param[in]     chunk  True for a chunk
+ * @param[in]     reaped True if it is being reclaimed
+ */
+static inline void lru_part_uncharge(mdcache_lru_t *lru, bool chunk,
+				     bool reaped)
+{
+	struct lru_partition *lp;
+
+	if (lru->part == 0)
+		return;
+
+	lp = &lru_partitions[lru->part - 1];
+	lru->part = 0;
+	(void) atomic_dec_uint64_t(chunk ? &lp->chunks : &lp->entries);
+	if (reaped)
+		(void) atomic_inc_uint64_t(chunk ? &lp->chunks_reaped
+						 : &lp->entries_reaped);
+}
+
+/**
+ * @brief Return true if the reaper must pass over an entry or chunk
+ *
+ * @param[in] lru    LRU link
+ * @param[in] chunk  True for a chunk
+ */
+static inline bool lru_part_protected(const mdcache_lru_t *lru, bool chunk)
+{
+	struct lru_partition *lp;
+
+	/* Partition 0 never holds a reservation */
+	if (lru->part <= 1)
+		return false;
+
+	lp = &lru_partitions[lru->part - 1];
+	if (chunk)
+		return atomic_fetch_uint64_t(&lp->chunks) <=
+		       atomic_fetch_uint64_t(&lp->chunks_reserved);
+
+	return atomic_fetch_uint64_t(&lp->entries) <=
+	       atomic_fetch_uint64_t(&lp->entries_reserved);
+}
+
+static bool lru_part_reserve_cb(struct gsh_export *exp, void *state)
+{
+	struct lru_partition *res = state;
+	uint32_t part = atomic_fetch_uint32_t(&exp->cache_partition);
+	uint64_t entries = atomic_fetch_uint64_t(&exp->cache_reserved_entries);
+	uint64_t chunks = atomic_fetch_uint64_t(&exp->cache_reserved_chunks);
+
+	if (part == 0 || part >= EXPORT_CACHE_PARTITIONS)
+		return true;
+
+	if (entries > res[part].entries_reserved)
+		res[part].entries_reserved = entries;
+	if (chunks > res[part].chunks_reserved)
+		res[part].chunks_reserved = chunks;
+
+	return true;
+}
+
+/**
+ * @brief Refresh partition reservations from the exports
+ *
+ * Exports sharing a partition get the largest of their reservations.
+ */
+static void lru_part_reserve(void)
+{
+	static bool overcommitted;
+	struct lru_partition res[EXPORT_CACHE_PARTITIONS];
+	uint64_t entries = 0, chunks = 0;
+	bool over;
+	int i;
+
+	memset(res, 0, sizeof(res));
+	(void) foreach_gsh_export(lru_part_reserve_cb, false, res);
+
+	for (i = 0; i < EXPORT_CACHE_PARTITIONS; i++) {
+		atomic_store_uint64_t(&lru_partitions[i].entries_reserved,
+				      res[i].entries_reserved);
+		atomic_store_uint64_t(&lru_partitions[i].chunks_reserved,
+				      res[i].chunks_reserved);
+		entries += res[i].entries_reserved;
+		chunks += res[i].chunks_reserved;
+	}
+
+	over = entries > lru_state.entries_hiwat ||
+	       chunks > lru_state.chunks_hiwat;
+	if (over && !overcommitted)
+		LogWarn(COMPONENT_CACHE_INODE_LRU,
+			"Cache partitions reserve %" PRIu64 " entries and %"
+			PRIu64 " chunks, more than Entries_HWMark %" PRIu64
+			" or Chunks_HWMark %" PRIu64,
+			entries, chunks, lru_state.entries_hiwat,
+			lru_state.chunks_hiwat);
+	overcommitted = over;
+}
+
 /**
  * @brief Clean an entry for recycling.
  *
@@ -462,6 +794,8 @@ mdcache_lru_clean(mdcache_entry_t *entry)
 {
 	fsal_status_t status = {0, 0};
 
+	lru_part_uncharge(&entry->lru, false, false);
+
 	/* Free SubFSAL resources */
 	if (entry->sub_handle) {
 		/* There are four basic paths to get here.
@@ -560,6 +894,8 @@ mdcache_lru_clean(mdcache_entry_t *entry)
 		 * Don't bother with the content_lock since we have exclusive
 		 * ownership of this entry.
 		 */
+		mdcache_lru_fd_remove(entry);
+		mdcache_file_wb_flush(entry, 0, UINT64_MAX);
 		status = fsal_close(&entry->obj_handle);
 
 		if (FSAL_IS_ERROR(status)) {
@@ -583,7 +919,8 @@ mdcache_lru_clean(mdcache_entry_t *entry)
 	}
 
 	/* Done with the attrs */
-	fsal_release_attrs(&entry->attrs);
+	mdc_attrs_release(&entry->attrs);
+	fattr4_cache_fini(&entry->fsobj.hdl);
 
 	/* Clean our handle */
 	fsal_obj_handle_fini(&entry->obj_handle);
@@ -591,14 +928,74 @@ mdcache_lru_clean(mdcache_entry_t *entry)
 	/* Clean out the export mapping before deconstruction */
 	mdc_clean_entry(entry);
 
+	/* Directory data is only carried while the entry is a directory */
+	mdcache_free_fsdir(entry);
+	mdcache_file_ra_free(entry);
+	mdcache_file_wb_free(entry);
+	mdcache_file_sc_free(entry);
+	gsh_free(entry->access);
+	entry->access = NULL;
+	mdcache_xattr_free(entry);
+
 	/* Finalize last bits of the cache entry, delete the key if any and
-	 * destroy the rw locks.
+	 * destroy the rw locks.  The key bytes may still be compared by a
+	 * lockless lookup, so their release is deferred.
 	 */
-	mdcache_key_delete(&entry->fh_hk.key);
+	if (entry->fh_hk.key.kv.addr)
+		cih_defer(gsh_free, entry->fh_hk.key.kv.addr);
+	entry->fh_hk.key.kv.addr = NULL;
+	entry->fh_hk.key.kv.len = 0;
 	PTHREAD_RWLOCK_destroy(&entry->content_lock);
 	PTHREAD_RWLOCK_destroy(&entry->attr_lock);
 }
 
+/**
+ * @brief Pick a reclaim candidate from the cold end of a queue
+ *
+ * Under LRU this is just the head.  Under TinyLFU, up to
+ * LRU_SKETCH_PROBE frequently used entries are rotated to the MRU end
+ * (at the cost of half their frequency) in favour of the first
+ * infrequent one; if none is found the head is taken after all.
+ * Either way, entries of a partition within its reservation are
+ * rotated too, and never taken.
+ *
+ * @note The caller MUST hold the lane lock
+ *
+ * @param[in] q  Queue to pick from
+ *
+ * @return The candidate, or NULL if the queue is empty.
+ */
+static inline mdcache_lru_t *lru_reap_candidate(struct lru_q *q)
+{
+	mdcache_lru_t *lru = glist_first_entry(&q->q, mdcache_lru_t, q);
+	mdcache_entry_t *entry;
+	uint32_t probe;
+
+	for (probe = 0; lru && probe < LRU_SKETCH_PROBE && probe < q->size;
+	     ++probe) {
+		entry = container_of(lru, mdcache_entry_t, lru);
+		if (!lru_part_protected(lru, false)) {
+			if (!lru_tinylfu())
+				return lru;
+			if (lru_sketch_estimate(entry->fh_hk.key.hk) <
+			    LRU_SKETCH_ADMIT)
+				return lru;
+			lru_sketch_decay(entry->fh_hk.key.hk);
+		}
+		/* LRU_DQ_SAFE() uses its queue argument's name for the
+		 * link too, so the queue must be called q.
+		 */
+		LRU_DQ_SAFE(lru, q);
+		lru_insert(lru, q, LRU_MRU);
+		lru = glist_first_entry(&q->q, mdcache_lru_t, q);
+	}
+
+	if (lru && lru_part_protected(lru, false))
+		return NULL;
+
+	return lru;
+}
+
 /**
  * @brief Try to pull an entry off the queue
  *
@@ -636,7 +1033,7 @@ lru_reap_impl(enum lru_q_id qid)
 		lq = (qid == LRU_ENTRY_L1) ? &qlane->L1 : &qlane->L2;
 
 		QLOCK(qlane);
-		lru = glist_first_entry(&lq->q, mdcache_lru_t, q);
+		lru = lru_reap_candidate(lq);
 		if (!lru) {
 			QUNLOCK(qlane);
 			continue;
@@ -674,6 +1071,7 @@ lru_reap_impl(enum lru_q_id qid)
 				LRU_DQ_SAFE(lru, q);
 				entry->lru.qid = LRU_ENTRY_NONE;
 				QUNLOCK(qlane);
+				lru_part_uncharge(lru, false, true);
 				cih_remove_latched(entry, &latch,
 						   CIH_REMOVE_UNLOCK);
 				/* Note, we're not releasing our ref here.
@@ -708,7 +1106,8 @@ lru_try_reap_entry(void)
 {
 	mdcache_lru_t *lru;
 
-	if (lru_state.entries_used < lru_state.entries_hiwat)
+	if (lru_state.entries_used < lru_state.entries_hiwat &&
+	    !mdcache_lru_over_budget())
 		return NULL;
 
 	/* XXX dang why not start with the cleanup list? */
@@ -771,6 +1170,16 @@ lru_reap_chunk_impl(enum lru_q_id qid, mdcache_entry_t *parent)
 			continue;
 		}
 
+		if (lru_part_protected(lru, true)) {
+			/* Within its partition's reservation, send it to
+			 * the back and try the next lane.
+			 */
+			CHUNK_LRU_DQ_SAFE(lru, lq);
+			lru_insert(lru, lq, LRU_MRU);
+			QUNLOCK(qlane);
+			continue;
+		}
+
 		/* Get the chunk and parent entry that owns the chunk, all of
 		 * this is valid because we hold the QLANE lock, the chunk was
 		 * in the LRU, and thus the chunk is not yet being destroyed,
@@ -797,6 +1206,7 @@ lru_reap_chunk_impl(enum lru_q_id qid, mdcache_entry_t *parent)
 			/* Dequeue the chunk so it won't show up anymore */
 			CHUNK_LRU_DQ_SAFE(lru, lq);
 			chunk->chunk_lru.qid = LRU_ENTRY_NONE;
+			lru_part_uncharge(lru, true, true);
 
 			/* Drop the lane lock, we can now safely clean up the
 			 * chunk. We hold the content_lock on the parent of
@@ -863,7 +1273,8 @@ struct dir_chunk *mdcache_get_chunk(mdcache_entry_t *parent)
 	mdcache_lru_t *lru = NULL;
 	struct dir_chunk *chunk = NULL;
 
-	if (lru_state.chunks_used >= lru_state.chunks_hiwat) {
+	if (lru_state.chunks_used >= lru_state.chunks_hiwat ||
+	    mdcache_lru_over_budget()) {
 		lru = lru_reap_chunk_impl(LRU_ENTRY_L2, parent);
 		if (!lru)
 			lru = lru_reap_chunk_impl(LRU_ENTRY_L1, parent);
@@ -881,6 +1292,8 @@ struct dir_chunk *mdcache_get_chunk(mdcache_entry_t *parent)
 		chunk = gsh_calloc(1, sizeof(struct dir_chunk));
 		glist_init(&chunk->dirents);
 		(void) atomic_inc_int64_t(&lru_state.chunks_used);
+		(void) atomic_add_uint64_t(&lru_state.chunk_bytes,
+					   sizeof(struct dir_chunk));
 	}
 
 	/* Set the chunk's parent. */
@@ -893,6 +1306,8 @@ struct dir_chunk *mdcache_get_chunk(mdcache_entry_t *parent)
 	chunk->chunk_lru.refcnt = 0;
 	chunk->chunk_lru.cf = 0;
 	chunk->chunk_lru.lane = lru_lane_of(chunk);
+	lru_part_charge(&chunk->chunk_lru,
+			parent->lru.part ? parent->lru.part - 1 : 0, true);
 
 	/* Enqueue into MRU of L2.
 	 *
@@ -1014,13 +1429,15 @@ mdcache_lru_cleanup_try_push(mdcache_entry_t *entry)
  * @brief Function that executes in the lru thread to process one lane
  *
  * @param[in]     lane          The lane to process
+ * @param[in]     budget        Most entries to process on this lane
  * @param[in,out] totalclosed   Track the number of file closes
  *
  * @returns the number of files worked on (workdone)
  *
  */
 
-static inline size_t lru_run_lane(size_t lane, uint64_t *const totalclosed)
+static inline size_t lru_run_lane(size_t lane, uint32_t budget,
+				  uint64_t *const totalclosed)
 {
 	struct lru_q *q;
 	/* The amount of work done on this lane on this pass. */
@@ -1041,8 +1458,8 @@ static inline size_t lru_run_lane(size_t lane, uint64_t *const totalclosed)
 	q = &qlane->L1;
 
 	LogDebug(COMPONENT_CACHE_INODE_LRU,
-		 "Reaping up to %d entries from lane %zd",
-		 lru_state.per_lane_work, lane);
+		 "Reaping up to %"PRIu32" entries from lane %zd",
+		 budget, lane);
 
 	/* ACTIVE */
 	QLOCK(qlane);
@@ -1059,7 +1476,7 @@ static inline size_t lru_run_lane(size_t lane, uint64_t *const totalclosed)
 		struct gsh_export *export;
 
 		/* check per-lane work */
-		if (workdone >= lru_state.per_lane_work)
+		if (workdone >= budget)
 			goto next_lane;
 
 		lru = glist_entry(qlane->iter.glist, mdcache_lru_t, q);
@@ -1091,6 +1508,19 @@ static inline size_t lru_run_lane(size_t lane, uint64_t *const totalclosed)
 		q = &qlane->L2;
 		lru_insert(lru, q, LRU_MRU);
 
+		/* Cold files give their cached content back */
+		mdcache_file_sc_release(entry);
+		mdcache_xattr_release(entry);
+
+		if (fd_lru_enabled()) {
+			/* Descriptors are closed by fd_lru_run */
+			QUNLOCK(qlane);
+			mdcache_lru_unref(entry);
+			QLOCK(qlane);
+			++workdone;
+			continue;
+		}
+
 		/* Get a reference to the first export and build an op context
 		 * with it. By holding the QLANE lock while we get the export
 		 * reference we assure that the entry doesn't get detached from
@@ -1181,6 +1611,167 @@ next_lane:
 	return workdone;
 }
 
+static inline size_t chunk_lru_run_lane(size_t lane, uint32_t budget);
+
+/**
+ * @brief A pass of the reaper over every lane of one queue complex
+ *
+ * When Reaper_Threads is above 1 the lanes of a pass are handed to
+ * reaper_fridge, one job per lane, and the looper waits for all of them
+ * before deciding on another pass.  A lane is thus only ever walked by
+ * one job at a time.
+ */
+struct lru_reap_pass {
+	pthread_mutex_t mtx;
+	pthread_cond_t cv;
+	uint32_t pending;	/*< Lane jobs not yet finished */
+	bool chunks;		/*< CHUNK_LRU rather than LRU */
+	uint32_t budget;	/*< Per-lane work for this pass */
+	size_t workdone;	/*< Sum of work over all lanes */
+	uint64_t closed;	/*< Sum of fds closed over all lanes */
+};
+
+/**
+ * @brief One lane of a reaper pass
+ */
+struct lru_reap_job {
+	struct lru_reap_pass *pass;
+	size_t lane;
+};
+
+/** Workers fanning reaper passes out over the lanes, NULL when the
+ *  reaper runs lanes inline. */
+static struct fridgethr *reaper_fridge;
+
+/** Most that pressure may multiply the per-lane work by */
+#define LRU_PRESSURE_MAX 4
+
+/**
+ * @brief Scale the per-lane work by how far over its high water mark a
+ *        queue complex is
+ *
+ * Below the mark the configured per-lane work is used; each further
+ * quarter of the mark in use adds another share of it, up to
+ * LRU_PRESSURE_MAX times the configured amount.
+ *
+ * @param[in] used   Objects in use
+ * @param[in] hiwat  High water mark
+ *
+ * @return Per-lane work for this pass.
+ */
+static inline uint32_t lru_pressure_budget(uint64_t used, uint64_t hiwat)
+{
+	uint64_t mult;
+
+	if (hiwat == 0 || used <= hiwat)
+		return lru_state.per_lane_work;
+
+	mult = 1 + ((used - hiwat) * 4) / hiwat;
+	if (mult > LRU_PRESSURE_MAX)
+		mult = LRU_PRESSURE_MAX;
+
+	return lru_state.per_lane_work * mult;
+}
+
+/**
+ * @brief Reap one lane of a pass in reaper_fridge
+ *
+ * @param[in] ctx  Fridge context; ctx->arg is the struct lru_reap_job
+ */
+static void lru_reap_job_run(struct fridgethr_context *ctx)
+{
+	struct lru_reap_job *job = ctx->arg;
+	struct lru_reap_pass *pass = job->pass;
+	uint64_t closed = 0;
+	size_t work;
+
+	SetNameFunction("lru_reaper");
+
+	if (pass->chunks)
+		work = chunk_lru_run_lane(job->lane, pass->budget);
+	else
+		work = lru_run_lane(job->lane, pass->budget, &closed);
+
+	PTHREAD_MUTEX_lock(&pass->mtx);
+	pass->workdone += work;
+	pass->closed += closed;
+	if (--pass->pending == 0)
+		pthread_cond_signal(&pass->cv);
+	PTHREAD_MUTEX_unlock(&pass->mtx);
+}
+
+/**
+ * @brief Run one reaper pass over every lane
+ *
+ * Lanes are fanned out over reaper_fridge when it exists; any lane that
+ * can not be queued, and every lane when the pool is disabled, is reaped
+ * inline by the caller.
+ *
+ * @param[in]     chunks       Reap CHUNK_LRU rather than LRU
+ * @param[in]     budget       Per-lane work
+ * @param[in,out] totalclosed  Track the number of file closes
+ *
+ * @return Work done over all lanes.
+ */
+static size_t lru_reap_pass(bool chunks, uint32_t budget,
+			    uint64_t *const totalclosed)
+{
+	struct lru_reap_pass pass = {
+		.chunks = chunks,
+		.budget = budget,
+	};
+	struct lru_reap_job jobs[LRU_N_Q_LANES];
+	size_t lane, work = 0;
+
+	if (reaper_fridge == NULL) {
+		for (lane = 0; lane < LRU_N_Q_LANES; ++lane) {
+			if (chunks)
+				work += chunk_lru_run_lane(lane, budget);
+			else
+				work += lru_run_lane(lane, budget,
+						     totalclosed);
+		}
+		return work;
+	}
+
+	PTHREAD_MUTEX_init(&pass.mtx, NULL);
+	PTHREAD_COND_init(&pass.cv, NULL);
+
+	for (lane = 0; lane < LRU_N_Q_LANES; ++lane) {
+		jobs[lane].pass = &pass;
+		jobs[lane].lane = lane;
+
+		PTHREAD_MUTEX_lock(&pass.mtx);
+		++pass.pending;
+		PTHREAD_MUTEX_unlock(&pass.mtx);
+
+		if (fridgethr_submit(reaper_fridge, lru_reap_job_run,
+				     &jobs[lane]) == 0)
+			continue;
+
+		PTHREAD_MUTEX_lock(&pass.mtx);
+		--pass.pending;
+		PTHREAD_MUTEX_unlock(&pass.mtx);
+
+		if (chunks)
+			work += chunk_lru_run_lane(lane, budget);
+		else
+			work += lru_run_lane(lane, budget, totalclosed);
+	}
+
+	PTHREAD_MUTEX_lock(&pass.mtx);
+	while (pass.pending != 0)
+		pthread_cond_wait(&pass.cv, &pass.mtx);
+	work += pass.workdone;
+	*totalclosed += pass.closed;
+	PTHREAD_MUTEX_unlock(&pass.mtx);
+
+	PTHREAD_COND_destroy(&pass.cv);
+	PTHREAD_MUTEX_destroy(&pass.mtx);
+
+	return work;
+}
+
 /**
  * @brief Function that executes in the lru thread
  *
@@ -1231,11 +1822,89 @@ next_lane:
  * @param[in] ctx Fridge context
  */
 
+/**
+ * @brief Evict and free the coldest reclaimable dirent chunk
+ *
+ * @return true if a chunk was freed.
+ */
+static bool lru_evict_chunk(void)
+{
+	mdcache_lru_t *lru;
+
+	lru = lru_reap_chunk_impl(LRU_ENTRY_L2, NULL);
+	if (!lru)
+		lru = lru_reap_chunk_impl(LRU_ENTRY_L1, NULL);
+	if (!lru)
+		return false;
+
+	/* Already cleaned and off the LRU */
+	(void) atomic_dec_int64_t(&lru_state.chunks_used);
+	(void) atomic_sub_uint64_t(&lru_state.chunk_bytes,
+				   sizeof(struct dir_chunk));
+	gsh_free(container_of(lru, struct dir_chunk, chunk_lru));
+
+	return true;
+}
+
+/**
+ * @brief Evict and free the coldest reclaimable entry
+ *
+ * @return true if an entry was released.
+ */
+static bool lru_evict_entry(void)
+{
+	mdcache_lru_t *lru;
+
+	lru = lru_reap_impl(LRU_ENTRY_L2);
+	if (!lru)
+		lru = lru_reap_impl(LRU_ENTRY_L1);
+	if (!lru)
+		return false;
+
+	/* Unhashed and dequeued, holding only our ref */
+	mdcache_lru_unref(container_of(lru, mdcache_entry_t, lru));
+
+	return true;
+}
+
+/**
+ * @brief Evict cache contents until back under the memory budget
+ *
+ * Whichever of entries or directory contents (chunks and their
+ * dirents) holds more bytes is evicted first, coldest queue first.
+ * At most @a limit objects are evicted in one call.
+ *
+ * @param[in] limit  Work limit for this pass
+ *
+ * @return Number of objects evicted.
+ */
+static size_t lru_reap_budget(size_t limit)
+{
+	size_t work = 0;
+	bool chunks_first, evicted;
+
+	while (work < limit && mdcache_lru_over_budget()) {
+		chunks_first =
+		    atomic_fetch_uint64_t(&lru_state.chunk_bytes) +
+		    atomic_fetch_uint64_t(&lru_state.dirent_bytes) >
+		    atomic_fetch_uint64_t(&lru_state.entry_bytes);
+
+		if (chunks_first)
+			evicted = lru_evict_chunk() || lru_evict_entry();
+		else
+			evicted = lru_evict_entry() || lru_evict_chunk();
+
+		if (!evicted)
+			break;
+		++work;
+	}
+
+	return work;
+}
+
 static void
 lru_run(struct fridgethr_context *ctx)
 {
-	/* Index */
-	size_t lane = 0;
 	/* True if we were explicitly awakened. */
 	bool woke = ctx->woke;
 	/* Finalized */
@@ -1252,17 +1921,29 @@ lru_run(struct fridgethr_context *ctx)
 	/* The current count (after reaping) of open FDs */
 	size_t currentopen = 0;
 	time_t new_thread_wait;
+	/* Per-lane work, raised while entries are over the high water
+	 * mark */
+	uint32_t budget;
 
 	SetNameFunction("cache_lru");
 
 	fds_avg = (lru_state.fds_hiwat - lru_state.fds_lowat) / 2;
 
-	if (mdcache_param.use_fd_cache)
+	/* With the fd LRU, descriptors are not reclaimed by walking the
+	 * lanes, so there is nothing to be extreme about here.
+	 */
+	if (mdcache_param.use_fd_cache && !fd_lru_enabled())
 		extremis = (atomic_fetch_size_t(&open_fd_count) >
 			    lru_state.fds_hiwat);
 
 	LogFullDebug(COMPONENT_CACHE_INODE_LRU, "LRU awakes.");
 
+#ifdef USE_LTTNG
+	tracepoint(mdcache, mdc_lru_run_start, __func__, __LINE__,
+		   atomic_fetch_uint64_t(&lru_state.entries_used),
+		   atomic_fetch_size_t(&open_fd_count));
+#endif
+
 	if (!woke) {
 		/* If we make it all the way through a timed sleep
 		   without being woken, we assume we aren't racing
@@ -1273,6 +1954,15 @@ lru_run(struct fridgethr_context *ctx)
 	LogFullDebug(COMPONENT_CACHE_INODE_LRU, "lru entries: %" PRIu64,
 		     lru_state.entries_used);
 
+	/* Release entries and keys lockless lookups are done with */
+	cih_reclaim();
+
+	/* Pick up Cache_Reserved_* changes from export updates */
+	lru_part_reserve();
+
+	/* Age the admission sketch */
+	lru_sketch_age();
+
 	/* Reap file descriptors.  This is a preliminary example of the
 	   L2 functionality rather than something we expect to be
 	   permanent.  (It will have to adapt heavily to the new FSAL
@@ -1315,23 +2005,21 @@ lru_run(struct fridgethr_context *ctx)
 				 "Open FDs over high water mark, reapring aggressively.");
 		}
 
+		budget = lru_pressure_budget(
+				atomic_fetch_uint64_t(&lru_state.entries_used),
+				lru_state.entries_hiwat);
+
 		/* Total fds closed between all lanes and all current runs. */
 		do {
-			workpass = 0;
-			for (lane = 0; lane < LRU_N_Q_LANES; ++lane) {
-				LogDebug(COMPONENT_CACHE_INODE_LRU,
-					 "Reaping up to %d entries from lane %zd",
-					 lru_state.per_lane_work, lane);
-
-				LogFullDebug(COMPONENT_CACHE_INODE_LRU,
-					     "formeropen=%zd totalwork=%zd workpass=%zd totalclosed:%"
-					     PRIu64, formeropen, totalwork,
-					     workpass, totalclosed);
-
-				workpass += lru_run_lane(lane, &totalclosed);
-			}
+			LogFullDebug(COMPONENT_CACHE_INODE_LRU,
+				     "formeropen=%zd totalwork=%zd budget=%"
+				     PRIu32" totalclosed:%"PRIu64,
+				     formeropen, totalwork, budget,
+				     totalclosed);
+
+			workpass = lru_reap_pass(false, budget, &totalclosed);
 			totalwork += workpass;
-		} while (extremis && (workpass >= lru_state.per_lane_work)
+		} while (extremis && (workpass >= budget)
 			 && (totalwork < lru_state.biggest_window));
 
 		currentopen = atomic_fetch_size_t(&open_fd_count);
@@ -1351,6 +2039,18 @@ lru_run(struct fridgethr_context *ctx)
 		}
 	}
 
+	/* Enforce the memory budget */
+	if (mdcache_lru_over_budget()) {
+		size_t evicted =
+		    lru_reap_budget(lru_state.per_lane_work * LRU_N_Q_LANES);
+
+		totalwork += evicted;
+		LogDebug(COMPONENT_CACHE_INODE_LRU,
+			 "Evicted %zu objects for memory budget, %" PRIu64
+			 " of %" PRIu64 " bytes held",
+			 evicted, mdcache_lru_bytes(), lru_state.bytes_hiwat);
+	}
+
 	/* The following calculation will progressively garbage collect
 	 * more frequently as these two factors increase:
 	 * 1. current number of open file descriptors
@@ -1378,8 +2078,20 @@ lru_run(struct fridgethr_context *ctx)
 	if (new_thread_wait < mdcache_param.lru_run_interval / 10)
 		new_thread_wait = mdcache_param.lru_run_interval / 10;
 
+	/* Come back soon if the budget could not be met this pass, or if
+	 * entries are still over their high water mark */
+	if (mdcache_lru_over_budget() ||
+	    atomic_fetch_uint64_t(&lru_state.entries_used) >
+	    lru_state.entries_hiwat)
+		new_thread_wait = mdcache_param.lru_run_interval / 10;
+
 	fridgethr_setwait(ctx, new_thread_wait);
 
+#ifdef USE_LTTNG
+	tracepoint(mdcache, mdc_lru_run_end, __func__, __LINE__,
+		   totalwork, totalclosed, new_thread_wait);
+#endif
+
 	LogDebug(COMPONENT_CACHE_INODE_LRU,
 		 "After work, open_fd_count:%zd  count:%" PRIu64
 		 " fdrate:%u threadwait=%" PRIu64,
@@ -1399,12 +2111,13 @@ lru_run(struct fridgethr_context *ctx)
  * This function really just demotes chunks from L1 to L2, so very simple.
  *
  * @param[in]     lane          The lane to process
+ * @param[in]     budget        Most chunks to process on this lane
  *
  * @returns the number of chunks worked on (workdone)
  *
  */
 
-static inline size_t chunk_lru_run_lane(size_t lane)
+static inline size_t chunk_lru_run_lane(size_t lane, uint32_t budget)
 {
 	struct lru_q *q;
 	/* The amount of work done on this lane on this pass. */
@@ -1417,8 +2130,8 @@ static inline size_t chunk_lru_run_lane(size_t lane)
 	q = &qlane->L1;
 
 	LogFullDebug(COMPONENT_CACHE_INODE_LRU,
-		 "Reaping up to %d chunks from lane %zd",
-		 lru_state.per_lane_work, lane);
+		 "Reaping up to %"PRIu32" chunks from lane %zd",
+		 budget, lane);
 
 	/* ACTIVE */
 	QLOCK(qlane);
@@ -1431,7 +2144,7 @@ static inline size_t chunk_lru_run_lane(size_t lane)
 		struct lru_q *q;
 
 		/* check per-lane work */
-		if (workdone >= lru_state.per_lane_work)
+		if (workdone >= budget)
 			goto next_lane;
 
 		lru = glist_entry(qlane->iter.glist, mdcache_lru_t, q);
@@ -1470,8 +2183,6 @@ next_lane:
 
 static void chunk_lru_run(struct fridgethr_context *ctx)
 {
-	/* Index */
-	size_t lane;
 	/* A ratio computed to adjust wait time based on how close to high
 	 * water mark for number of chunks we are.
 	 */
@@ -1480,24 +2191,31 @@ static void chunk_lru_run(struct fridgethr_context *ctx)
 	time_t new_thread_wait;
 	/* Total work done (number of chunks demoted) across all lanes. */
 	size_t totalwork = 0;
+	/* Chunks in use, and per-lane work derived from it */
+	uint64_t used = atomic_fetch_uint64_t(&lru_state.chunks_used);
+	uint32_t budget = lru_pressure_budget(used, lru_state.chunks_hiwat);
+	/* No fds are closed by chunk reaping */
+	uint64_t closed = 0;
 
 	SetNameFunction("chunk_lru");
 
 	LogFullDebug(COMPONENT_CACHE_INODE_LRU,
-		     "LRU awakes, lru chunks used: %" PRIu64,
-		     lru_state.chunks_used);
+		     "LRU awakes, lru chunks used: %" PRIu64
+		     " reaping up to %" PRIu32 " per lane",
+		     used, budget);
 
-	/* Total chunks demoted to L2 between all lanes and all current runs. */
-	for (lane = 0; lane < LRU_N_Q_LANES; ++lane) {
-		LogFullDebug(COMPONENT_CACHE_INODE_LRU,
-			 "Reaping up to %d chunks from lane %zd totalwork=%zd",
-			 lru_state.per_lane_work, lane, totalwork);
+#ifdef USE_LTTNG
+	tracepoint(mdcache, mdc_lru_run_start, __func__, __LINE__, used,
+		   atomic_fetch_size_t(&open_fd_count));
+#endif
 
-		totalwork += chunk_lru_run_lane(lane);
-	}
+	/* Total chunks demoted to L2 between all lanes and all current runs. */
+	totalwork = lru_reap_pass(true, budget, &closed);
 
 	/* Run more frequently the closer to max number of chunks we are. */
-	wait_ratio = 1.0 - (lru_state.chunks_used / lru_state.chunks_hiwat);
+	wait_ratio = 1.0 - ((float)used / lru_state.chunks_hiwat);
+	if (wait_ratio < 0)
+		wait_ratio = 0;
 
 	new_thread_wait = mdcache_param.lru_run_interval * wait_ratio;
 
@@ -1506,11 +2224,199 @@ static void chunk_lru_run(struct fridgethr_context *ctx)
 
 	fridgethr_setwait(ctx, new_thread_wait);
 
+#ifdef USE_LTTNG
+	tracepoint(mdcache, mdc_lru_run_end, __func__, __LINE__,
+		   totalwork, closed, new_thread_wait);
+#endif
+
 	LogDebug(COMPONENT_CACHE_INODE_LRU,
 		 "After work, threadwait=%" PRIu64 " totalwork=%zd",
 		 ((uint64_t) new_thread_wait), totalwork);
 }
 
+/**
+ * @brief Close one batch of descriptors from the LRU end of the fd LRU
+ *
+ * Entries are taken while there are more than @c want of them or while
+ * the oldest has been idle past @c idle_before.  A reference and an
+ * export reference are taken under the lane lock, as lru_run_lane does,
+ * so the descriptor can be closed with the list unlocked.
+ *
+ * @param[in] want         Descriptors to close regardless of age
+ * @param[in] idle_before  Close descriptors last used before this, 0 for
+ *                         none
+ *
+ * @return Number of entries taken off the list.
+ */
+static size_t fd_lru_run_batch(size_t want, time_t idle_before)
+{
+	struct {
+		mdcache_entry_t *entry;
+		struct gsh_export *export;
+	} batch[FD_LRU_BATCH];
+	size_t n = 0, taken = 0, i;
+	struct req_op_context *saved_ctx = op_ctx;
+	struct root_op_context ctx;
+	fsal_status_t status;
+	bool not_support_ex;
+
+	PTHREAD_MUTEX_lock(&fd_lru.mtx);
+	while (n < FD_LRU_BATCH && !glist_empty(&fd_lru.q)) {
+		mdcache_entry_t *entry = glist_first_entry(&fd_lru.q,
+							   mdcache_entry_t,
+							   fd_lru);
+		struct lru_q_lane *qlane = &LRU[entry->lru.lane];
+		int32_t export_id;
+
+		if (taken >= want &&
+		    (idle_before == 0 || entry->fd_lru_time >= idle_before))
+			break;
+
+		glist_del(&entry->fd_lru);
+		--fd_lru.count;
+		++taken;
+
+		/* Only entries still on L1 or L2 can be referenced here; an
+		 * entry being cleaned or unexported closes its own
+		 * descriptor.
+		 */
+		QLOCK(qlane);
+		if (entry->lru.qid != LRU_ENTRY_L1 &&
+		    entry->lru.qid != LRU_ENTRY_L2) {
+			QUNLOCK(qlane);
+			continue;
+		}
+		(void) atomic_inc_int32_t(&entry->lru.refcnt);
+		export_id = atomic_fetch_int32_t(&entry->first_export_id);
+		batch[n].export = export_id < 0 ? NULL
+						: get_gsh_export(export_id);
+		QUNLOCK(qlane);
+
+		batch[n].entry = entry;
+		++n;
+	}
+	PTHREAD_MUTEX_unlock(&fd_lru.mtx);
+
+	for (i = 0; i < n; ++i) {
+		mdcache_entry_t *entry = batch[i].entry;
+		struct gsh_export *export = batch[i].export;
+
+		if (export == NULL) {
+			/* Detached while we looked, cleanup will close */
+			mdcache_lru_unref(entry);
+			continue;
+		}
+
+		init_root_op_context(&ctx, export, export->fsal_export, 0, 0,
+				     UNKNOWN_REQUEST);
+
+		not_support_ex = !entry->obj_handle.fsal->m_ops.support_ex(
+							&entry->obj_handle);
+
+		if (not_support_ex)
+			PTHREAD_RWLOCK_wrlock(&entry->content_lock);
+
+		status = fsal_close(&entry->obj_handle);
+
+		if (not_support_ex)
+			PTHREAD_RWLOCK_unlock(&entry->content_lock);
+
+		if (FSAL_IS_ERROR(status))
+			LogCrit(COMPONENT_CACHE_INODE_LRU,
+				"Error closing file in fd LRU thread.");
+
+		mdcache_lru_unref(entry);
+		put_gsh_export(export);
+		op_ctx = saved_ctx;
+	}
+
+	return taken;
+}
+
+/**
+ * @brief Function that executes in the lru thread to close descriptors
+ *
+ * Once open_fd_count reaches the high water mark, descriptors are closed
+ * from the LRU end until it is back halfway between the low and high
+ * water marks.  Descriptors idle past FD_Idle_Timeout are closed in any
+ * case.
+ *
+ * @param[in] ctx Fridge context
+ */
+static void fd_lru_run(struct fridgethr_context *ctx)
+{
+	size_t open, target, want, work, totalwork = 0;
+	time_t idle_before = 0;
+	time_t new_thread_wait = mdcache_param.lru_run_interval;
+
+	SetNameFunction("fd_lru");
+
+	if (!fd_lru_enabled()) {
+		fridgethr_setwait(ctx, new_thread_wait);
+		return;
+	}
+
+	if (mdcache_param.fd_idle_timeout != 0)
+		idle_before = time(NULL) - mdcache_param.fd_idle_timeout;
+
+	open = atomic_fetch_size_t(&open_fd_count);
+	target = lru_state.fds_lowat +
+		 (lru_state.fds_hiwat - lru_state.fds_lowat) / 2;
+
+	want = open >= lru_state.fds_hiwat ? open - target : 0;
+
+#ifdef USE_LTTNG
+	tracepoint(mdcache, mdc_lru_run_start, __func__, __LINE__,
+		   fd_lru.count, open);
+#endif
+
+	do {
+		work = fd_lru_run_batch(want > totalwork ? want - totalwork : 0,
+					idle_before);
+		totalwork += work;
+	} while (work == FD_LRU_BATCH);
+
+	/* Come back sooner the closer to the high water mark we are */
+	open = atomic_fetch_size_t(&open_fd_count);
+	if (open >= lru_state.fds_lowat)
+		new_thread_wait = mdcache_param.lru_run_interval / 10;
+	if (mdcache_param.fd_idle_timeout != 0 &&
+	    new_thread_wait > mdcache_param.fd_idle_timeout)
+		new_thread_wait = mdcache_param.fd_idle_timeout;
+	if (new_thread_wait < 1)
+		new_thread_wait = 1;
+
+	fridgethr_setwait(ctx, new_thread_wait);
+
+#ifdef USE_LTTNG
+	tracepoint(mdcache, mdc_lru_run_end, __func__, __LINE__,
+		   totalwork, totalwork, new_thread_wait);
+#endif
+
+	LogDebug(COMPONENT_CACHE_INODE_LRU,
+		 "After work, open_fd_count:%zd fd lru:%"PRIu64
+		 " closed:%zd threadwait=%"PRIu64,
+		 open, fd_lru.count, totalwork,
+		 ((uint64_t) new_thread_wait));
+}
+
+/**
+ * @brief Set the FD watermarks from the FD_*_Percent parameters
+ */
+
+static void lru_set_fd_limits(void)
+{
+	atomic_store_uint32_t(&lru_state.fds_hard_limit,
+			      (mdcache_param.fd_limit_percent *
+			       lru_state.fds_system_imposed) / 100);
+	atomic_store_uint32_t(&lru_state.fds_hiwat,
+			      (mdcache_param.fd_hwmark_percent *
+			       lru_state.fds_system_imposed) / 100);
+	atomic_store_uint32_t(&lru_state.fds_lowat,
+			      (mdcache_param.fd_lwmark_percent *
+			       lru_state.fds_system_imposed) / 100);
+}
+
 void init_fds_limit(void)
 {
 	int code = 0;
@@ -1588,15 +2494,7 @@ err_open:
 			lru_state.fds_system_imposed);
 	}
 
-	lru_state.fds_hard_limit =
-	    (mdcache_param.fd_limit_percent *
-	     lru_state.fds_system_imposed) / 100;
-	lru_state.fds_hiwat =
-	    (mdcache_param.fd_hwmark_percent *
-	     lru_state.fds_system_imposed) / 100;
-	lru_state.fds_lowat =
-	    (mdcache_param.fd_lwmark_percent *
-	     lru_state.fds_system_imposed) / 100;
+	lru_set_fd_limits();
 	lru_state.futility = 0;
 
 	if (mdcache_param.reaper_work) {
@@ -1615,6 +2513,53 @@ err_open:
 
 /* Public functions */
 
+/**
+ * @brief Reference the hottest entries in the cache
+ *
+ * Walks each lane's L1 queue from the MRU end, spreading @a max evenly
+ * across lanes.  Each entry returned carries a reference the caller
+ * must drop with mdcache_put().
+ *
+ * @param[out] entries  Array of at least @a max entries
+ * @param[in]  max      Most entries to return
+ *
+ * @return Number of entries returned.
+ */
+size_t mdcache_lru_hot_entries(mdcache_entry_t **entries, size_t max)
+{
+	size_t per_lane = (max + LRU_N_Q_LANES - 1) / LRU_N_Q_LANES;
+	size_t count = 0;
+	int lane;
+
+	for (lane = 0; lane < LRU_N_Q_LANES && count < max; ++lane) {
+		struct lru_q_lane *qlane = &LRU[lane];
+		struct glist_head *glist;
+		size_t taken = 0;
+
+		QLOCK(qlane);
+		for (glist = qlane->L1.q.prev;
+		     glist != &qlane->L1.q && taken < per_lane && count < max;
+		     glist = glist->prev) {
+			mdcache_lru_t *lru = glist_entry(glist, mdcache_lru_t,
+							 q);
+
+			/* As in lru_run_lane, an L1 entry is reachable, so the
+			 * lane lock is enough to take a reference.
+			 */
+			(void) atomic_inc_int32_t(&lru->refcnt);
+			entries[count++] = container_of(lru, mdcache_entry_t,
+							lru);
+			taken++;
+		}
+		QUNLOCK(qlane);
+	}
+
+	return count;
+}
+
+static void entry_slab_init(void);
+static void entry_slab_shutdown(void);
+
 /**
  * Initialize subsystem
  */
@@ -1626,8 +2571,8 @@ mdcache_lru_pkginit(void)
 	struct fridgethr_params frp;
 
 	memset(&frp, 0, sizeof(struct fridgethr_params));
-	frp.thr_max = 2;
-	frp.thr_min = 2;
+	frp.thr_max = 3;
+	frp.thr_min = 3;
 	frp.thread_delay = mdcache_param.lru_run_interval;
 	frp.flavor = fridgethr_flavor_looper;
 
@@ -1646,9 +2591,20 @@ mdcache_lru_pkginit(void)
 	lru_state.chunks_hiwat = mdcache_param.chunks_hwmark;
 	lru_state.chunks_used = 0;
 
+	/* Byte budget over entries, chunks and dirents */
+	lru_state.bytes_hiwat = mdcache_param.cache_memory_limit;
+	lru_state.entry_bytes = 0;
+	lru_state.chunk_bytes = 0;
+	lru_state.dirent_bytes = 0;
+
 
 	/* init queue complex */
 	lru_init_queues();
+	lru_sketch_init();
+	entry_slab_init();
+	PTHREAD_MUTEX_init(&fd_lru.mtx, NULL);
+	glist_init(&fd_lru.q);
+	fd_lru.count = 0;
 
 	/* spawn LRU background thread */
 	code = fridgethr_init(&lru_fridge, "LRU_fridge", &frp);
@@ -1659,6 +2615,21 @@ mdcache_lru_pkginit(void)
 		return fsalstat(posix2fsal_error(code), code);
 	}
 
+	if (mdcache_param.reaper_threads > 1) {
+		memset(&frp, 0, sizeof(struct fridgethr_params));
+		frp.thr_max = mdcache_param.reaper_threads;
+		frp.deferment = fridgethr_defer_queue;
+
+		code = fridgethr_init(&reaper_fridge, "LRU_reaper", &frp);
+		if (code != 0) {
+			/* Not fatal, the LRU threads reap lanes inline */
+			LogMajor(COMPONENT_CACHE_INODE_LRU,
+				 "Unable to initialize LRU reaper fridge, error code %d.",
+				 code);
+			reaper_fridge = NULL;
+		}
+	}
+
 	code = fridgethr_submit(lru_fridge, lru_run, NULL);
 	if (code != 0) {
 		LogMajor(COMPONENT_CACHE_INODE_LRU,
@@ -1675,6 +2646,14 @@ mdcache_lru_pkginit(void)
 		return fsalstat(posix2fsal_error(code), code);
 	}
 
+	code = fridgethr_submit(lru_fridge, fd_lru_run, NULL);
+	if (code != 0) {
+		LogMajor(COMPONENT_CACHE_INODE_LRU,
+			 "Unable to start FD LRU thread, error code %d.",
+			 code);
+		return fsalstat(posix2fsal_error(code), code);
+	}
+
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
@@ -1698,6 +2677,29 @@ mdcache_lru_pkgshutdown(void)
 		LogMajor(COMPONENT_CACHE_INODE_LRU,
 			 "Failed shutting down LRU thread: %d", rc);
 	}
+
+	/* The LRU threads are stopped, so no pass is waiting on the
+	 * reapers any more. */
+	if (reaper_fridge != NULL) {
+		int rrc = fridgethr_sync_command(reaper_fridge,
+						 fridgethr_comm_stop,
+						 120);
+
+		if (rrc == ETIMEDOUT) {
+			LogMajor(COMPONENT_CACHE_INODE_LRU,
+				 "Shutdown timed out, cancelling reaper threads.");
+			fridgethr_cancel(reaper_fridge);
+		} else if (rrc != 0) {
+			LogMajor(COMPONENT_CACHE_INODE_LRU,
+				 "Failed shutting down LRU reaper threads: %d",
+				 rrc);
+		}
+		fridgethr_destroy(reaper_fridge);
+		reaper_fridge = NULL;
+	}
+
+	entry_slab_shutdown();
+
 	return fsalstat(posix2fsal_error(rc), rc);
 }
 
@@ -1708,16 +2710,221 @@ static inline void init_rw_locks(mdcache_entry_t *entry)
 	PTHREAD_RWLOCK_init(&entry->content_lock, NULL);
 }
 
+/**
+ * @brief Entry slab
+ *
+ * Freed entries are kept for reuse instead of going back to the heap.
+ * Each thread holds a small magazine of them that it allocates from and
+ * frees to without locking; a magazine that runs dry refills half way
+ * from the shared list, and one that overflows hands half of itself
+ * back.  The shared list holds at most an eighth of Entries_HWMark
+ * entries, anything past that goes back to the pool.  Free entries are
+ * linked through their first word.
+ */
+
+/** Entries held by one thread's magazine */
+#define ENTRY_SLAB_MAG 32
+
+struct entry_slab_mag {
+	uint32_t count;
+	void *objs[ENTRY_SLAB_MAG];
+};
+
+static struct {
+	pthread_mutex_t mtx;
+	void *head;		/*< Shared free entries */
+	uint64_t count;		/*< Length of head */
+	uint64_t max;		/*< Most entries kept on head */
+	pthread_key_t key;	/*< Flushes a magazine on thread exit */
+	bool ready;
+} entry_slab;
+
+static __thread struct entry_slab_mag *entry_slab_mag;
+
+/**
+ * @brief Return entries to the shared list, or the pool once it is full
+ *
+ * @param[in] mag    Magazine to take entries from
+ * @param[in] count  Number of entries to take from the top of mag
+ */
+static void entry_slab_flush(struct entry_slab_mag *mag, uint32_t count)
+{
+	void *obj;
+
+	PTHREAD_MUTEX_lock(&entry_slab.mtx);
+	while (count-- > 0) {
+		obj = mag->objs[--mag->count];
+		if (entry_slab.count < entry_slab.max) {
+			*(void **)obj = entry_slab.head;
+			entry_slab.head = obj;
+			++entry_slab.count;
+		} else {
+			pool_free(mdcache_entry_pool, obj);
+		}
+	}
+	PTHREAD_MUTEX_unlock(&entry_slab.mtx);
+}
+
+/**
+ * @brief Thread exit destructor for a magazine
+ *
+ * @param[in] arg  The magazine
+ */
+static void entry_slab_mag_release(void *arg)
+{
+	struct entry_slab_mag *mag = arg;
+
+	entry_slab_flush(mag, mag->count);
+	gsh_free(mag);
+}
+
+/**
+ * @brief Get this thread's magazine, creating it on first use
+ *
+ * @return The magazine, or NULL if the slab is not set up.
+ */
+static inline struct entry_slab_mag *entry_slab_get_mag(void)
+{
+	if (likely(entry_slab_mag != NULL))
+		return entry_slab_mag;
+
+	if (!entry_slab.ready)
+		return NULL;
+
+	entry_slab_mag = gsh_calloc(1, sizeof(*entry_slab_mag));
+	(void) pthread_setspecific(entry_slab.key, entry_slab_mag);
+
+	return entry_slab_mag;
+}
+
+/**
+ * @brief Take a zeroed entry from the slab, or the pool if it is empty
+ *
+ * @return The entry.
+ */
+static void *entry_slab_alloc(void)
+{
+	struct entry_slab_mag *mag = entry_slab_get_mag();
+	void *obj;
+
+	if (mag == NULL)
+		return pool_alloc(mdcache_entry_pool);
+
+	if (mag->count == 0 && entry_slab.count != 0) {
+		PTHREAD_MUTEX_lock(&entry_slab.mtx);
+		while (mag->count < ENTRY_SLAB_MAG / 2 &&
+		       entry_slab.head != NULL) {
+			obj = entry_slab.head;
+			entry_slab.head = *(void **)obj;
+			--entry_slab.count;
+			mag->objs[mag->count++] = obj;
+		}
+		PTHREAD_MUTEX_unlock(&entry_slab.mtx);
+	}
+
+	if (mag->count == 0)
+		return pool_alloc(mdcache_entry_pool);
+
+	obj = mag->objs[--mag->count];
+	memset(obj, 0, sizeof(mdcache_entry_t));
+
+	return obj;
+}
+
+/**
+ * @brief Give an entry back to the slab
+ *
+ * @param[in] obj  The entry
+ */
+static void entry_slab_free(void *obj)
+{
+	struct entry_slab_mag *mag = entry_slab_get_mag();
+
+	if (mag == NULL) {
+		pool_free(mdcache_entry_pool, obj);
+		return;
+	}
+
+	if (mag->count == ENTRY_SLAB_MAG)
+		entry_slab_flush(mag, ENTRY_SLAB_MAG / 2);
+
+	mag->objs[mag->count++] = obj;
+}
+
+/**
+ * @brief Set up the entry slab
+ */
+static void entry_slab_init(void)
+{
+	int rc;
+
+	PTHREAD_MUTEX_init(&entry_slab.mtx, NULL);
+	entry_slab.head = NULL;
+	entry_slab.count = 0;
+	entry_slab.max = mdcache_param.entries_hwmark / 8;
+
+	rc = pthread_key_create(&entry_slab.key, entry_slab_mag_release);
+	if (rc != 0) {
+		/* Not fatal, entries come straight from the pool */
+		LogMajor(COMPONENT_CACHE_INODE_LRU,
+			 "Unable to create entry slab key, error code %d.",
+			 rc);
+		return;
+	}
+
+	entry_slab.ready = true;
+}
+
+/**
+ * @brief Return the shared list of the entry slab to the pool
+ *
+ * Magazines of threads still running are left to their destructors.
+ */
+static void entry_slab_shutdown(void)
+{
+	void *obj;
+
+	if (!entry_slab.ready)
+		return;
+
+	PTHREAD_MUTEX_lock(&entry_slab.mtx);
+	while (entry_slab.head != NULL) {
+		obj = entry_slab.head;
+		entry_slab.head = *(void **)obj;
+		pool_free(mdcache_entry_pool, obj);
+	}
+	entry_slab.count = 0;
+	entry_slab.max = 0;
+	PTHREAD_MUTEX_unlock(&entry_slab.mtx);
+}
+
+/**
+ * @brief Allocate the directory-only part of an entry
+ *
+ * @param[in] entry  The entry, becoming a directory
+ */
+void mdcache_alloc_fsdir(mdcache_entry_t *entry)
+{
+	if (entry->fsobj.fsdir != NULL)
+		return;
+
+	entry->fsobj.fsdir = gsh_calloc(1, sizeof(struct mdcache_fsdir));
+	(void) atomic_add_uint64_t(&lru_state.entry_bytes,
+				   sizeof(struct mdcache_fsdir));
+}
+
 mdcache_entry_t *alloc_cache_entry(void)
 {
 	mdcache_entry_t *nentry;
 
-	nentry = pool_alloc(mdcache_entry_pool);
+	nentry = entry_slab_alloc();
 
 	/* Initialize the entry locks */
 	init_rw_locks(nentry);
 
 	(void) atomic_inc_int64_t(&lru_state.entries_used);
+	(void) atomic_add_uint64_t(&lru_state.entry_bytes,
+				   sizeof(mdcache_entry_t));
 
 	return nentry;
 }
@@ -1749,13 +2956,17 @@ mdcache_entry_t *mdcache_lru_get(void)
 		mdcache_lru_clean(nentry);
 		memset(&nentry->attrs, 0, sizeof(nentry->attrs));
 		init_rw_locks(nentry);
+		/* A lockless lookup may still hold a transient ref on the
+		 * old identity, so add ours rather than overwriting.
+		 */
+		(void) atomic_inc_int32_t(&nentry->lru.refcnt);
 	} else {
 		/* alloc entry (if fails, aborts) */
 		nentry = alloc_cache_entry();
+		/* Since the entry isn't in a queue, nobody can bump refcnt. */
+		nentry->lru.refcnt = 2;
 	}
 
-	/* Since the entry isn't in a queue, nobody can bump refcnt. */
-	nentry->lru.refcnt = 2;
 	nentry->lru.cf = 0;
 	nentry->lru.lane = lru_lane_of(nentry);
 
@@ -1776,10 +2987,32 @@ mdcache_entry_t *mdcache_lru_get(void)
  */
 void mdcache_lru_insert(mdcache_entry_t *entry)
 {
+	uint32_t part = 0;
+
+	if (op_ctx != NULL && op_ctx->ctx_export != NULL)
+		part = atomic_fetch_uint32_t(
+				&op_ctx->ctx_export->cache_partition);
+	lru_part_charge(&entry->lru, part, false);
+
+	if (lru_tinylfu())
+		lru_sketch_record(entry->fh_hk.key.hk);
+
 	/* Enqueue. */
 	lru_insert_entry(entry, &LRU[entry->lru.lane].L1, LRU_LRU);
 }
 
+/**
+ * @brief Return an entry to the pool once lockless readers are done
+ *
+ * @param[in] arg  The entry
+ */
+static void mdcache_entry_free(void *arg)
+{
+	(void) atomic_sub_uint64_t(&lru_state.entry_bytes,
+				   sizeof(mdcache_entry_t));
+	entry_slab_free(arg);
+}
+
 /**
  * @brief Get a reference
  *
@@ -1803,9 +3036,6 @@ fsal_status_t
 _mdcache_lru_ref(mdcache_entry_t *entry, uint32_t flags, const char *func,
 		 int line)
 {
-	mdcache_lru_t *lru = &entry->lru;
-	struct lru_q_lane *qlane = &LRU[lru->lane];
-	struct lru_q *q;
 #ifdef USE_LTTNG
 	int32_t refcnt =
 #endif
@@ -1817,37 +3047,55 @@ _mdcache_lru_ref(mdcache_entry_t *entry, uint32_t flags, const char *func,
 #endif
 
 	/* adjust LRU on initial refs */
-	if (flags & LRU_REQ_INITIAL) {
+	if (flags & LRU_REQ_INITIAL)
+		mdcache_lru_promote(entry);
 
-		/* do it less */
-		if ((atomic_inc_int32_t(&entry->lru.cf) % 3) != 0)
-			goto out;
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
 
-		QLOCK(qlane);
+/**
+ * @brief Adjust the LRU for an initial reference
+ *
+ * Advances an already referenced entry toward the MRU end of L1, as an
+ * LRU_REQ_INITIAL ref does.
+ *
+ * @param[in] entry  The referenced entry
+ */
+void mdcache_lru_promote(mdcache_entry_t *entry)
+{
+	mdcache_lru_t *lru = &entry->lru;
+	struct lru_q_lane *qlane = &LRU[lru->lane];
+	struct lru_q *q;
 
-		switch (lru->qid) {
-		case LRU_ENTRY_L1:
-			q = lru_queue_of(entry);
-			/* advance entry to MRU (of L1) */
-			LRU_DQ_SAFE(lru, q);
-			lru_insert(lru, q, LRU_MRU);
-			break;
-		case LRU_ENTRY_L2:
-			q = lru_queue_of(entry);
-			/* move entry to LRU of L1 */
-			glist_del(&lru->q);	/* skip L1 fixups */
-			--(q->size);
-			q = &qlane->L1;
-			lru_insert(lru, q, LRU_LRU);
-			break;
-		default:
-			/* do nothing */
-			break;
-		}		/* switch qid */
-		QUNLOCK(qlane);
-	}			/* initial ref */
- out:
-	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+	if (lru_tinylfu())
+		lru_sketch_record(entry->fh_hk.key.hk);
+
+	/* do it less */
+	if ((atomic_inc_int32_t(&entry->lru.cf) % 3) != 0)
+		return;
+
+	QLOCK(qlane);
+
+	switch (lru->qid) {
+	case LRU_ENTRY_L1:
+		q = lru_queue_of(entry);
+		/* advance entry to MRU (of L1) */
+		LRU_DQ_SAFE(lru, q);
+		lru_insert(lru, q, LRU_MRU);
+		break;
+	case LRU_ENTRY_L2:
+		q = lru_queue_of(entry);
+		/* move entry to LRU of L1 */
+		glist_del(&lru->q);	/* skip L1 fixups */
+		--(q->size);
+		q = &qlane->L1;
+		lru_insert(lru, q, LRU_LRU);
+		break;
+	default:
+		/* do nothing */
+		break;
+	}		/* switch qid */
+	QUNLOCK(qlane);
 }
 
 /**
@@ -1926,7 +3174,8 @@ _mdcache_lru_unref(mdcache_entry_t *entry, uint32_t flags, const char *func,
 		QUNLOCK(qlane);
 
 		mdcache_lru_clean(entry);
-		pool_free(mdcache_entry_pool, entry);
+		/* lockless lookups may still be looking at the entry */
+		cih_defer(mdcache_entry_free, entry);
 		freed = true;
 
 		(void) atomic_dec_int64_t(&lru_state.entries_used);
@@ -1959,11 +3208,14 @@ void lru_remove_chunk(struct dir_chunk *chunk)
 	QUNLOCK(qlane);
 
 	(void) atomic_dec_int64_t(&lru_state.chunks_used);
+	lru_part_uncharge(&chunk->chunk_lru, true, false);
 
 	/* Then do the actual cleaning work. */
 	mdcache_clean_dirent_chunk(chunk);
 
 	/* And now we can free the chunk. */
+	(void) atomic_sub_uint64_t(&lru_state.chunk_bytes,
+				   sizeof(struct dir_chunk));
 	gsh_free(chunk);
 }
 
@@ -2000,6 +3252,33 @@ void lru_bump_chunk(struct dir_chunk *chunk)
 	QUNLOCK(qlane);
 }
 
+/**
+ * @brief Apply changed LRU watermarks
+ *
+ * Entries_HWMark, Chunks_HWMark and the FD_*_Percent parameters count
+ * from the next reclaim; the reaper is woken to bring the cache under
+ * lowered marks.  The TinyLFU sketch and entry slab keep the size
+ * Entries_HWMark gave them at startup.
+ */
+
+void mdcache_lru_retune(void)
+{
+	atomic_store_uint64_t(&lru_state.entries_hiwat,
+			      mdcache_param.entries_hwmark);
+	atomic_store_uint64_t(&lru_state.chunks_hiwat,
+			      mdcache_param.chunks_hwmark);
+	lru_set_fd_limits();
+
+	LogEvent(COMPONENT_CACHE_INODE_LRU,
+		 "LRU marks now entries %" PRIu64 " chunks %" PRIu64
+		 " fds %" PRIu32 "/%" PRIu32 "/%" PRIu32,
+		 lru_state.entries_hiwat, lru_state.chunks_hiwat,
+		 lru_state.fds_lowat, lru_state.fds_hiwat,
+		 lru_state.fds_hard_limit);
+
+	lru_wake_thread();
+}
+
 /**
  *
  * @brief Wake the LRU thread to free FDs.
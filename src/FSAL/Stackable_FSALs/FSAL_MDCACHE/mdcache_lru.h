@@ -38,6 +38,7 @@
 #include "config.h"
 #include "log.h"
 #include "mdcache_int.h"
+#include "export_mgr.h"
 
 /**
  * @file mdcache_lru.h
@@ -69,6 +70,12 @@ struct lru_state {
 	uint64_t entries_used;
 	uint64_t chunks_hiwat;
 	uint64_t chunks_used;
+	/* Bytes held per category, and the limit on their sum (0 for
+	 * none) */
+	uint64_t entry_bytes;
+	uint64_t chunk_bytes;
+	uint64_t dirent_bytes;
+	uint64_t bytes_hiwat;
 	uint32_t fds_system_imposed;
 	uint32_t fds_hard_limit;
 	uint32_t fds_hiwat;
@@ -86,6 +93,25 @@ struct lru_state {
 
 extern struct lru_state lru_state;
 
+/**
+ * @brief Usage and reservation of one cache partition
+ *
+ * Exports choose a partition with Cache_Partition.  While a partition
+ * other than 0 holds no more entries (chunks) than reserved, the
+ * reaper passes over them.
+ */
+struct lru_partition {
+	uint64_t entries;
+	uint64_t chunks;
+	uint64_t entries_reserved;
+	uint64_t chunks_reserved;
+	/** Reclaimed from this partition */
+	uint64_t entries_reaped;
+	uint64_t chunks_reaped;
+};
+
+extern struct lru_partition lru_partitions[EXPORT_CACHE_PARTITIONS];
+
 /** Cache entries pool */
 extern pool_t *mdcache_entry_pool;
 
@@ -137,14 +163,20 @@ extern pool_t *mdcache_entry_pool;
 
 fsal_status_t mdcache_lru_pkginit(void);
 fsal_status_t mdcache_lru_pkgshutdown(void);
+void mdcache_lru_retune(void);
 
 extern size_t open_fd_count;
 
 mdcache_entry_t *mdcache_lru_get(void);
+void mdcache_alloc_fsdir(mdcache_entry_t *entry);
+void mdcache_lru_fd_bump(mdcache_entry_t *entry);
+void mdcache_lru_fd_remove(mdcache_entry_t *entry);
 void mdcache_lru_insert(mdcache_entry_t *entry);
 #define mdcache_lru_ref(e, f) _mdcache_lru_ref(e, f, __func__, __LINE__)
 fsal_status_t _mdcache_lru_ref(mdcache_entry_t *entry, uint32_t flags,
 			       const char *func, int line);
+void mdcache_lru_promote(mdcache_entry_t *entry);
+size_t mdcache_lru_hot_entries(mdcache_entry_t **entries, size_t max);
 
 /* XXX */
 void mdcache_lru_kill(mdcache_entry_t *entry);
@@ -190,6 +222,53 @@ static inline void mdcache_put(mdcache_entry_t *entry)
 	mdcache_lru_unref(entry);
 }
 
+/**
+ * @brief Bytes held by the cache, all categories
+ */
+static inline uint64_t mdcache_lru_bytes(void)
+{
+	return atomic_fetch_uint64_t(&lru_state.entry_bytes) +
+	       atomic_fetch_uint64_t(&lru_state.chunk_bytes) +
+	       atomic_fetch_uint64_t(&lru_state.dirent_bytes);
+}
+
+/**
+ * @brief Return true if the cache holds more bytes than configured
+ */
+static inline bool mdcache_lru_over_budget(void)
+{
+	return lru_state.bytes_hiwat != 0 &&
+	       mdcache_lru_bytes() > lru_state.bytes_hiwat;
+}
+
+/**
+ * @brief Allocate a dirent, charging it to the memory budget
+ *
+ * @param[in] namesize  Size of the name including its terminating NUL
+ */
+static inline mdcache_dir_entry_t *mdcache_alloc_dirent(size_t namesize)
+{
+	(void) atomic_add_uint64_t(&lru_state.dirent_bytes,
+				   sizeof(mdcache_dir_entry_t) + namesize);
+	return gsh_calloc(1, sizeof(mdcache_dir_entry_t) + namesize);
+}
+
+/**
+ * @brief Free a dirent allocated by mdcache_alloc_dirent()
+ *
+ * Dirents in a chunk's arena are left for the chunk to free.
+ */
+static inline void mdcache_free_dirent(mdcache_dir_entry_t *dirent)
+{
+	if (dirent->flags & DIR_ENTRY_ARENA)
+		return;
+
+	(void) atomic_sub_uint64_t(&lru_state.dirent_bytes,
+				   sizeof(mdcache_dir_entry_t) +
+				   strlen(dirent->name) + 1);
+	gsh_free(dirent);
+}
+
 /**
  * Return true if we are currently caching file descriptors.
  */
@@ -47,6 +47,7 @@
 #include "FSAL/fsal_commonlib.h"
 #include "mdcache_hash.h"
 #include "mdcache_lru.h"
+#include "server_metrics.h"
 
 pool_t *mdcache_entry_pool;
 
@@ -313,6 +314,9 @@ mdcache_fsal_unload(struct fsal_module *fsal_hdl)
 	/* Destroy the cache inode AVL tree */
 	cih_pkgdestroy();
 
+	mdcache_readahead_pkgshutdown();
+	mdcache_file_ra_pkgshutdown();
+
 	status = mdcache_lru_pkgshutdown();
 	if (FSAL_IS_ERROR(status))
 		fprintf(stderr, "MDCACHE LRU failed to shut down");
@@ -379,8 +383,9 @@ fsal_status_t mdcache_pkginit(void)
 	if (mdcache_entry_pool)
 		return fsalstat(ERR_FSAL_NO_ERROR, 0);
 
-	mdcache_entry_pool = pool_basic_init("MDCACHE Entry Pool",
-					     sizeof(mdcache_entry_t));
+	mdcache_entry_pool = pool_tagged_init("MDCACHE Entry Pool",
+					      sizeof(mdcache_entry_t),
+					      GSH_MEM_MDCACHE);
 
 	status = mdcache_lru_pkginit();
 	if (FSAL_IS_ERROR(status)) {
@@ -390,8 +395,13 @@ fsal_status_t mdcache_pkginit(void)
 	}
 
 	cih_pkginit();
+	mdc_flight_pkginit();
 
-	return status;
+	status = mdcache_readahead_pkginit();
+	if (FSAL_IS_ERROR(status))
+		return status;
+
+	return mdcache_file_ra_pkginit();
 }
 
 /**
@@ -459,9 +469,233 @@ void mdcache_dbus_show(DBusMessageIter *iter)
 	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
 	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
 					&cache_st.inode_mapping);
+	type = "cache_entry_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&lru_state.entry_bytes);
+	type = "cache_chunk_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&lru_state.chunk_bytes);
+	type = "cache_dirent_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&lru_state.dirent_bytes);
+	type = "cache_memory_limit";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&lru_state.bytes_hiwat);
+	type = "ra_hit_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.ra_hit_bytes);
+	type = "ra_miss";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.ra_miss);
+	type = "ra_fill_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.ra_fill_bytes);
+	type = "ra_waste_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.ra_waste_bytes);
+	type = "ra_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.ra_bytes);
+	type = "ra_memory_limit";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&mdcache_param.file.ra_memory);
+	type = "wb_writes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.wb_writes);
+	type = "wb_flushes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.wb_flushes);
+	type = "wb_flush_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.wb_flush_bytes);
+	type = "wb_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.wb_bytes);
+	type = "wb_memory_limit";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&mdcache_param.file.wb_memory);
+	type = "sc_hit_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.sc_hit_bytes);
+	type = "sc_fill_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.sc_fill_bytes);
+	type = "sc_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.sc_bytes);
+	type = "sc_memory_limit";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&mdcache_param.file.sc_memory);
+	type = "xattr_hits";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.xattr_hits);
+	type = "xattr_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					&cache_st.xattr_bytes);
 
 	dbus_message_iter_close_container(iter, &struct_iter);
 }
 #endif /* USE_DBUS */
 
+/**
+ * @brief Report the cache statistics for the metrics endpoint
+ *
+ * @param out [IN] page being built
+ */
+void mdcache_metrics(FILE *out)
+{
+	const struct {
+		const char *name;
+		const char *type;
+		const char *help;
+		uint64_t *value;
+	} st[] = {
+		{"ganesha_mdcache_entries", "gauge", "Cache entries in use",
+		 &lru_state.entries_used},
+		{"ganesha_mdcache_entries_hiwat", "gauge",
+		 "Cache entries above which reaping starts",
+		 &lru_state.entries_hiwat},
+		{"ganesha_mdcache_chunks", "gauge", "Dirent chunks in use",
+		 &lru_state.chunks_used},
+		{"ganesha_mdcache_entry_bytes", "gauge",
+		 "Bytes held by cache entries", &lru_state.entry_bytes},
+		{"ganesha_mdcache_chunk_bytes", "gauge",
+		 "Bytes held by dirent chunks", &lru_state.chunk_bytes},
+		{"ganesha_mdcache_dirent_bytes", "gauge",
+		 "Bytes held by dirents", &lru_state.dirent_bytes},
+		{"ganesha_mdcache_lookups", "counter", "Cache lookups",
+		 &cache_st.inode_req},
+		{"ganesha_mdcache_hits", "counter", "Cache lookups hit",
+		 &cache_st.inode_hit},
+		{"ganesha_mdcache_misses", "counter", "Cache lookups missed",
+		 &cache_st.inode_miss},
+		{"ganesha_mdcache_conflicts", "counter",
+		 "Entries found added by someone else", &cache_st.inode_conf},
+		{"ganesha_mdcache_added", "counter", "Entries added",
+		 &cache_st.inode_added},
+		{"ganesha_mdcache_mappings", "counter",
+		 "Entries mapped to another export", &cache_st.inode_mapping},
+		{"ganesha_mdcache_ra_hit_bytes", "counter",
+		 "Bytes served from read-ahead", &cache_st.ra_hit_bytes},
+		{"ganesha_mdcache_ra_misses", "counter",
+		 "Sequential reads not served from read-ahead",
+		 &cache_st.ra_miss},
+		{"ganesha_mdcache_ra_fill_bytes", "counter", "Bytes read ahead",
+		 &cache_st.ra_fill_bytes},
+		{"ganesha_mdcache_ra_waste_bytes", "counter",
+		 "Bytes read ahead but never served",
+		 &cache_st.ra_waste_bytes},
+		{"ganesha_mdcache_ra_bytes", "gauge",
+		 "Bytes of read-ahead windows", &cache_st.ra_bytes},
+		{"ganesha_mdcache_wb_writes", "counter",
+		 "Writes gathered in write-behind buffers",
+		 &cache_st.wb_writes},
+		{"ganesha_mdcache_wb_flushes", "counter",
+		 "Write-behind buffers written out", &cache_st.wb_flushes},
+		{"ganesha_mdcache_wb_flush_bytes", "counter",
+		 "Bytes written out from write-behind buffers",
+		 &cache_st.wb_flush_bytes},
+		{"ganesha_mdcache_wb_bytes", "gauge",
+		 "Bytes of write-behind buffers", &cache_st.wb_bytes},
+		{"ganesha_mdcache_sc_hit_bytes", "counter",
+		 "Bytes served from cached small file content",
+		 &cache_st.sc_hit_bytes},
+		{"ganesha_mdcache_sc_fill_bytes", "counter",
+		 "Bytes read to cache small file content",
+		 &cache_st.sc_fill_bytes},
+		{"ganesha_mdcache_sc_bytes", "gauge",
+		 "Bytes of cached small file content", &cache_st.sc_bytes},
+		{"ganesha_mdcache_xattr_hits", "counter",
+		 "Extended attribute calls served from the cache",
+		 &cache_st.xattr_hits},
+		{"ganesha_mdcache_xattr_bytes", "gauge",
+		 "Bytes of cached extended attributes", &cache_st.xattr_bytes},
+	};
+	const struct {
+		const char *name;
+		const char *type;
+		const char *help;
+		size_t off;
+	} pt[] = {
+		{"ganesha_mdcache_partition_entries", "gauge",
+		 "Cache entries charged, per partition",
+		 offsetof(struct lru_partition, entries)},
+		{"ganesha_mdcache_partition_chunks", "gauge",
+		 "Dirent chunks charged, per partition",
+		 offsetof(struct lru_partition, chunks)},
+		{"ganesha_mdcache_partition_entries_reserved", "gauge",
+		 "Cache entries reserved, per partition",
+		 offsetof(struct lru_partition, entries_reserved)},
+		{"ganesha_mdcache_partition_chunks_reserved", "gauge",
+		 "Dirent chunks reserved, per partition",
+		 offsetof(struct lru_partition, chunks_reserved)},
+		{"ganesha_mdcache_partition_entries_reaped", "counter",
+		 "Cache entries reclaimed, per partition",
+		 offsetof(struct lru_partition, entries_reaped)},
+		{"ganesha_mdcache_partition_chunks_reaped", "counter",
+		 "Dirent chunks reclaimed, per partition",
+		 offsetof(struct lru_partition, chunks_reaped)},
+	};
+	struct lru_partition *lp;
+	uint64_t value;
+	int i, p;
+
+	for (i = 0; i < sizeof(st) / sizeof(st[0]); i++)
+		metrics_scalar(out, st[i].name, st[i].type, st[i].help,
+			       atomic_fetch_uint64_t(st[i].value));
+
+	metrics_scalar(out, "ganesha_mdcache_open_fds", "gauge",
+		       "File descriptors held open",
+		       atomic_fetch_size_t(&open_fd_count));
+	metrics_scalar(out, "ganesha_mdcache_fds_hiwat", "gauge",
+		       "Open file descriptors above which reaping starts",
+		       lru_state.fds_hiwat);
+	metrics_scalar(out, "ganesha_mdcache_fds_caching", "gauge",
+		       "Whether file descriptors are being cached",
+		       lru_state.caching_fds);
+
+	/* Only partitions that were ever used */
+	for (i = 0; i < sizeof(pt) / sizeof(pt[0]); i++) {
+		metrics_family(out, pt[i].name, pt[i].type, pt[i].help);
+		for (p = 0; p < EXPORT_CACHE_PARTITIONS; p++) {
+			lp = &lru_partitions[p];
+			if (atomic_fetch_uint64_t(&lp->entries) == 0 &&
+			    atomic_fetch_uint64_t(&lp->chunks) == 0 &&
+			    atomic_fetch_uint64_t(&lp->entries_reaped) == 0 &&
+			    atomic_fetch_uint64_t(&lp->chunks_reaped) == 0 &&
+			    atomic_fetch_uint64_t(&lp->entries_reserved) == 0 &&
+			    atomic_fetch_uint64_t(&lp->chunks_reserved) == 0)
+				continue;
+			value = atomic_fetch_uint64_t(
+				(uint64_t *)((char *)lp + pt[i].off));
+			fprintf(out, "%s%s{partition=\"%d\"} %" PRIu64 "\n",
+				pt[i].name,
+				strcmp(pt[i].type, "counter") == 0
+					? "_total" : "",
+				p, value);
+		}
+	}
+}
+
 /** @} */
@@ -38,6 +38,8 @@
 #include "hashtable.h"
 #include "fsal.h"
 #include "mdcache_int.h"
+#include "mdcache_lru.h"
+#include "mdcache.h"
 #include "config_parsing.h"
 
 #include <unistd.h>
@@ -46,12 +48,20 @@
 #include <time.h>
 #include <pthread.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
 
 /** File cache configuration, settable in the CacheInode
     stanza. */
 
 struct mdcache_parameter mdcache_param;
 
+static struct config_item_list lru_policies[] = {
+	CONFIG_LIST_TOK("LRU", MDCACHE_LRU_POLICY_LRU),
+	CONFIG_LIST_TOK("TinyLFU", MDCACHE_LRU_POLICY_TINYLFU),
+	CONFIG_LIST_EOL
+};
+
 static struct config_item mdcache_params[] = {
 	CONF_ITEM_UI32("NParts", 1, 32633, 7,
 		       mdcache_parameter, nparts),
@@ -59,18 +69,56 @@ static struct config_item mdcache_params[] = {
 		       mdcache_parameter, cache_size),
 	CONF_ITEM_BOOL("Use_Getattr_Directory_Invalidation", false,
 		       mdcache_parameter, getattr_dir_invalidation),
+	CONF_ITEM_BOOL("Attr_TTL_Adaptive", false,
+		       mdcache_parameter, attr_ttl_adaptive),
+	CONF_ITEM_UI32("Attr_TTL_Min", 1, 86400, 3,
+		       mdcache_parameter, attr_ttl_min),
+	CONF_ITEM_UI32("Attr_TTL_Max", 1, 86400, 60,
+		       mdcache_parameter, attr_ttl_max),
+	CONF_ITEM_UI32("Access_Cache_Size", 0, 64, 0,
+		       mdcache_parameter, access_max),
+	CONF_ITEM_UI32("Xattr_Cache_Size", 0, 64 * 1024, 0,
+		       mdcache_parameter, xattr_max_size),
+	CONF_ITEM_UI64("Xattr_Cache_Memory", 0, UINT64_MAX, 16 * 1024 * 1024,
+		       mdcache_parameter, xattr_memory),
 	CONF_ITEM_UI32("Dir_Max_Deleted", 1, UINT32_MAX, 65536,
 		       mdcache_parameter, dir.avl_max_deleted),
 	CONF_ITEM_UI32("Dir_Max", 1, UINT32_MAX, 65536,
 		       mdcache_parameter, dir.avl_max),
 	CONF_ITEM_UI32("Dir_Chunk", 0, UINT32_MAX, 128,
 		       mdcache_parameter, dir.avl_chunk),
+	CONF_ITEM_UI32("Dir_Chunk_Readahead", 0, 16, 0,
+		       mdcache_parameter, dir.avl_chunk_readahead),
+	CONF_ITEM_BOOL("Dir_Lazy_Entries", false,
+		       mdcache_parameter, dir.lazy_entries),
+	CONF_ITEM_UI32("Dir_Negative_Cache_Size", 0, 1024, 0,
+		       mdcache_parameter, dir.neg_max),
 	CONF_ITEM_UI32("Detached_Mult", 1, UINT32_MAX, 1,
 		       mdcache_parameter, dir.avl_detached_mult),
+	CONF_ITEM_UI32("Read_Ahead_Windows", 0, MDC_RA_MAX_WINDOWS, 0,
+		       mdcache_parameter, file.ra_windows),
+	CONF_ITEM_UI32("Read_Ahead_Window_Size", 4096, 64 * 1024 * 1024,
+		       1024 * 1024,
+		       mdcache_parameter, file.ra_window_size),
+	CONF_ITEM_UI64("Read_Ahead_Memory", 0, UINT64_MAX, 256 * 1024 * 1024,
+		       mdcache_parameter, file.ra_memory),
+	CONF_ITEM_UI32("Write_Behind_Size", 0, 64 * 1024 * 1024, 0,
+		       mdcache_parameter, file.wb_size),
+	CONF_ITEM_UI64("Write_Behind_Memory", 0, UINT64_MAX, 256 * 1024 * 1024,
+		       mdcache_parameter, file.wb_memory),
+	CONF_ITEM_UI32("Small_File_Cache_Size", 0, 1024 * 1024, 0,
+		       mdcache_parameter, file.sc_max_size),
+	CONF_ITEM_UI64("Small_File_Cache_Memory", 0, UINT64_MAX,
+		       64 * 1024 * 1024,
+		       mdcache_parameter, file.sc_memory),
 	CONF_ITEM_UI32("Entries_HWMark", 1, UINT32_MAX, 100000,
 		       mdcache_parameter, entries_hwmark),
 	CONF_ITEM_UI32("Chunks_HWMark", 1, UINT32_MAX, 100000,
 		       mdcache_parameter, chunks_hwmark),
+	CONF_ITEM_UI64("Cache_Memory_Limit", 0, UINT64_MAX, 0,
+		       mdcache_parameter, cache_memory_limit),
+	CONF_ITEM_TOKEN("LRU_Policy", MDCACHE_LRU_POLICY_LRU, lru_policies,
+			mdcache_parameter, lru_policy),
 	CONF_ITEM_UI32("LRU_Run_Interval", 1, 24 * 3600, 90,
 		       mdcache_parameter, lru_run_interval),
 	CONF_ITEM_BOOL("Cache_FDs", true,
@@ -81,10 +129,16 @@ static struct config_item mdcache_params[] = {
 		       mdcache_parameter, fd_hwmark_percent),
 	CONF_ITEM_UI32("FD_LWMark_Percent", 0, 100, 50,
 		       mdcache_parameter, fd_lwmark_percent),
+	CONF_ITEM_BOOL("Use_FD_LRU", false,
+		       mdcache_parameter, use_fd_lru),
+	CONF_ITEM_UI32("FD_Idle_Timeout", 0, 24 * 3600, 0,
+		       mdcache_parameter, fd_idle_timeout),
 	CONF_ITEM_UI32("Reaper_Work", 1, 2000, 0,
 		       mdcache_parameter, reaper_work),
 	CONF_ITEM_UI32("Reaper_Work_Per_Lane", 1, 2000, 50,
 		       mdcache_parameter, reaper_work_per_lane),
+	CONF_ITEM_UI32("Reaper_Threads", 1, 64, 1,
+		       mdcache_parameter, reaper_threads),
 	CONF_ITEM_UI32("Biggest_Window", 1, 100, 40,
 		       mdcache_parameter, biggest_window),
 	CONF_ITEM_UI32("Required_Progress", 1, 50, 5,
@@ -93,6 +147,14 @@ static struct config_item mdcache_params[] = {
 		       mdcache_parameter, futility_count),
 	CONF_ITEM_BOOL("Retry_Readdir", false,
 		       mdcache_parameter, retry_readdir),
+	CONF_ITEM_PATH("Warm_Start_File", 1, MAXPATHLEN, NULL,
+		       mdcache_parameter, warm_start_file),
+	CONF_ITEM_UI32("Warm_Start_Entries", 1, 10000000, 10000,
+		       mdcache_parameter, warm_start_entries),
+	CONF_ITEM_UI32("Warm_Start_Interval", 0, 24 * 3600, 300,
+		       mdcache_parameter, warm_start_interval),
+	CONF_ITEM_UI32("Warm_Start_Threads", 1, 64, 4,
+		       mdcache_parameter, warm_start_threads),
 	CONFIG_EOL
 };
 
@@ -113,6 +175,113 @@ struct config_block mdcache_param_blk = {
 	.blk_desc.u.blk.commit = noop_conf_commit
 };
 
+/** Parameters that may change while running, see mdcache_lru_retune() */
+static const char * const mdcache_tunables[] = {
+	"Entries_HWMark",
+	"Chunks_HWMark",
+	"FD_Limit_Percent",
+	"FD_HWMark_Percent",
+	"FD_LWMark_Percent",
+	NULL
+};
+
+/** The CacheInode block, loaded into a scratch copy on reload */
+static struct config_block mdcache_reload_blk = {
+	.blk_desc.name = "CacheInode",
+	.blk_desc.type = CONFIG_BLOCK,
+	.blk_desc.u.blk.init = noop_conf_init,
+	.blk_desc.u.blk.params = mdcache_params,
+	.blk_desc.u.blk.commit = noop_conf_commit
+};
+
+static bool mdcache_is_tunable(const char *name)
+{
+	int i;
+
+	for (i = 0; mdcache_tunables[i] != NULL; i++) {
+		if (strcasecmp(mdcache_tunables[i], name) == 0)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Change one MDCACHE parameter on a running server
+ *
+ * @param[in] name  Parameter name as in the CacheInode block
+ * @param[in] value New value
+ *
+ * @retval 0 on success.
+ * @retval ENOENT if it is not a parameter that can change at runtime.
+ * @retval ERANGE if the value is out of range.
+ */
+int mdcache_set_tunable(const char *name, uint64_t value)
+{
+	int rc;
+
+	if (!mdcache_is_tunable(name))
+		return ENOENT;
+
+	rc = config_set_uint_param(&mdcache_param_blk, &mdcache_param, name,
+				   value);
+	if (rc == 0)
+		mdcache_lru_retune();
+	return rc;
+}
+
+/**
+ * @brief Apply the runtime MDCACHE parameters of a reread config
+ *
+ * Other CacheInode parameters in the file are ignored until the next
+ * restart.
+ *
+ * @param[in]     parse_tree Parsed config file
+ * @param[in,out] err_type   Error reporting state
+ *
+ * @return -1 on a parse error, else 0.
+ */
+int mdcache_reread_tunables(config_file_t parse_tree,
+			    struct config_error_type *err_type)
+{
+	struct mdcache_parameter *fresh = gsh_calloc(1, sizeof(*fresh));
+	uint64_t cur, val;
+	bool changed = false;
+	int i;
+
+	(void) load_config_from_parse(parse_tree, &mdcache_reload_blk, fresh,
+				      true, err_type);
+	if (!config_error_is_harmless(err_type)) {
+		gsh_free(fresh->warm_start_file);
+		gsh_free(fresh);
+		return -1;
+	}
+
+	for (i = 0; mdcache_tunables[i] != NULL; i++) {
+		(void) config_get_uint_param(&mdcache_param_blk, fresh,
+					     mdcache_tunables[i], &val);
+		(void) config_get_uint_param(&mdcache_param_blk,
+					     &mdcache_param,
+					     mdcache_tunables[i], &cur);
+		if (val == cur)
+			continue;
+
+		LogEvent(COMPONENT_CONFIG,
+			 "CacheInode %s %" PRIu64 " -> %" PRIu64,
+			 mdcache_tunables[i], cur, val);
+		(void) config_set_uint_param(&mdcache_param_blk,
+					     &mdcache_param,
+					     mdcache_tunables[i], val);
+		changed = true;
+	}
+
+	if (changed)
+		mdcache_lru_retune();
+
+	gsh_free(fresh->warm_start_file);
+	gsh_free(fresh);
+	return 0;
+}
+
 int mdcache_set_param_from_conf(config_file_t parse_tree,
 				struct config_error_type *err_type)
 {
@@ -127,6 +296,16 @@ int mdcache_set_param_from_conf(config_file_t parse_tree,
 		return -1;
 	}
 
+	if (mdcache_param.attr_ttl_min > mdcache_param.attr_ttl_max) {
+		LogWarn(COMPONENT_INIT,
+			"Attr_TTL_Min %"PRIu32" exceeds Attr_TTL_Max %"PRIu32
+			", using %"PRIu32" for both",
+			mdcache_param.attr_ttl_min,
+			mdcache_param.attr_ttl_max,
+			mdcache_param.attr_ttl_max);
+		mdcache_param.attr_ttl_min = mdcache_param.attr_ttl_max;
+	}
+
 	/* Compute avl_chunk_split after reading config, make sure it's a
 	 * multiple of two.
 	 */
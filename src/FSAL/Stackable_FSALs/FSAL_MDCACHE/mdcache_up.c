@@ -37,6 +37,9 @@
 #include "nfs4_acls.h"
 #include "mdcache_hash.h"
 #include "mdcache_int.h"
+#include "sal_functions.h"
+
+uint64_t mdc_inval_gen;
 
 static fsal_status_t
 mdc_up_invalidate(const struct fsal_up_vector *vec, struct gsh_buffdesc *handle,
@@ -46,6 +49,7 @@ mdc_up_invalidate(const struct fsal_up_vector *vec, struct gsh_buffdesc *handle,
 	fsal_status_t status;
 	struct req_op_context *save_ctx, req_ctx = {0};
 	mdcache_key_t key;
+	bool recall;
 
 	req_ctx.ctx_export = vec->up_gsh_export;
 	req_ctx.fsal_export = vec->up_fsal_export;
@@ -69,11 +73,45 @@ mdc_up_invalidate(const struct fsal_up_vector *vec, struct gsh_buffdesc *handle,
 	atomic_clear_uint32_t_bits(&entry->mde_flags,
 				   flags & FSAL_UP_INVALIDATE_CACHE);
 
+	/* An FSAL that let us trust the attributes until now, as FSAL_PROXY
+	 * does while it holds a delegation, is taking that back.
+	 */
+	if ((flags & FSAL_UP_INVALIDATE_ATTRS) && op_ctx->ctx_export &&
+	    !test_mde_flags(entry, MDCACHE_IMMUTABLE)) {
+		PTHREAD_RWLOCK_wrlock(&entry->attr_lock);
+		if (entry->attrs.expire_time_attr < 0)
+			entry->attrs.expire_time_attr = atomic_fetch_int32_t(
+				&op_ctx->ctx_export->expire_time_attr);
+		PTHREAD_RWLOCK_unlock(&entry->attr_lock);
+	}
+
+	if (flags & FSAL_UP_INVALIDATE_CONTENT)
+		mdcache_file_ra_invalidate(entry);
+
+	if (flags & FSAL_UP_INVALIDATE_ATTRS)
+		mdcache_xattr_release(entry);
+
 	if (flags & FSAL_UP_INVALIDATE_CLOSE)
 		status = fsal_close(&entry->obj_handle);
 
+	/* Entries changed behind our back, no notification can describe
+	 * that, so directory delegations have to go.  An unlocked peek at
+	 * the list is enough to skip directories nobody holds one on.
+	 */
+	recall = entry->obj_handle.type == DIRECTORY &&
+		 (flags & (FSAL_UP_INVALIDATE_DIR_POPULATED |
+			   FSAL_UP_INVALIDATE_DIR_CHUNKS)) &&
+		 !glist_empty(&entry->obj_handle.state_hdl->dir.dir_delegations);
+
 	mdcache_put(entry);
 
+	if (recall) {
+		struct mdcache_fsal_export *myself =
+			mdc_export(vec->up_fsal_export);
+
+		(void) myself->super_up_ops.delegrecall(vec, handle);
+	}
+
 out:
 	op_ctx = save_ctx;
 	return status;
@@ -194,6 +232,8 @@ mdc_up_update(const struct fsal_up_vector *vec, struct gsh_buffdesc *handle,
 	}
 
 	if (FSAL_TEST_MASK(attr->valid_mask, ATTR_ACL)) {
+		struct mdcache_attrs_ext *ext = mdc_attrs_ext(&entry->attrs);
+
 		/**
 		 * @todo Someone who knows the ACL code, please look
 		 * over this.  We assume that the FSAL takes a
@@ -202,9 +242,9 @@ mdc_up_update(const struct fsal_up_vector *vec, struct gsh_buffdesc *handle,
 		 * an asynchronous call.
 		 */
 
-		nfs4_acl_release_entry(entry->attrs.acl);
+		nfs4_acl_release_entry(ext->acl);
 
-		entry->attrs.acl = attr->acl;
+		ext->acl = attr->acl;
 		mutatis_mutandis = true;
 	}
 
@@ -231,40 +271,46 @@ mdc_up_update(const struct fsal_up_vector *vec, struct gsh_buffdesc *handle,
 	if (FSAL_TEST_MASK(attr->valid_mask, ATTR_ATIME)
 	    && ((flags & ~fsal_up_update_atime_inc)
 		||
-		(gsh_time_cmp(&attr->atime, &entry->attrs.atime) == 1))) {
-		entry->attrs.atime = attr->atime;
+		(mdc_attrs_time_cmp(&attr->atime, &entry->attrs,
+				    MDC_ATIME) == 1))) {
+		mdc_attrs_set_time(&entry->attrs, MDC_ATIME, &attr->atime);
 		mutatis_mutandis = true;
 	}
 
 	if (FSAL_TEST_MASK(attr->valid_mask, ATTR_CREATION)
 	    && ((flags & ~fsal_up_update_creation_inc)
 		||
-		(gsh_time_cmp(&attr->creation, &entry->attrs.creation) == 1))) {
-		entry->attrs.creation = attr->creation;
+		(entry->attrs.ext == NULL ||
+		 gsh_time_cmp(&attr->creation,
+			      &entry->attrs.ext->creation) == 1))) {
+		mdc_attrs_ext(&entry->attrs)->creation = attr->creation;
 		mutatis_mutandis = true;
 	}
 
 	if (FSAL_TEST_MASK(attr->valid_mask, ATTR_CTIME)
 	    && ((flags & ~fsal_up_update_ctime_inc)
 		||
-		(gsh_time_cmp(&attr->ctime, &entry->attrs.ctime) == 1))) {
-		entry->attrs.ctime = attr->ctime;
+		(mdc_attrs_time_cmp(&attr->ctime, &entry->attrs,
+				    MDC_CTIME) == 1))) {
+		mdc_attrs_set_time(&entry->attrs, MDC_CTIME, &attr->ctime);
 		mutatis_mutandis = true;
 	}
 
 	if (FSAL_TEST_MASK(attr->valid_mask, ATTR_MTIME)
 	    && ((flags & ~fsal_up_update_mtime_inc)
 		||
-		(gsh_time_cmp(&attr->mtime, &entry->attrs.mtime) == 1))) {
-		entry->attrs.mtime = attr->mtime;
+		(mdc_attrs_time_cmp(&attr->mtime, &entry->attrs,
+				    MDC_MTIME) == 1))) {
+		mdc_attrs_set_time(&entry->attrs, MDC_MTIME, &attr->mtime);
 		mutatis_mutandis = true;
 	}
 
 	if (FSAL_TEST_MASK(attr->valid_mask, ATTR_CHGTIME)
 	    && ((flags & ~fsal_up_update_chgtime_inc)
 		||
-		(gsh_time_cmp(&attr->chgtime, &entry->attrs.chgtime) == 1))) {
-		entry->attrs.chgtime = attr->chgtime;
+		(mdc_attrs_time_cmp(&attr->chgtime, &entry->attrs,
+				    MDC_CHGTIME) == 1))) {
+		mdc_attrs_set_time(&entry->attrs, MDC_CHGTIME, &attr->chgtime);
 		mutatis_mutandis = true;
 	}
 
@@ -274,6 +320,7 @@ mdc_up_update(const struct fsal_up_vector *vec, struct gsh_buffdesc *handle,
 	}
 
 	if (mutatis_mutandis) {
+		fattr4_cache_invalidate(entry->obj_handle.state_hdl);
 		mdc_fixup_md(entry, attr);
 		/* If directory can not trust content anymore. */
 		if (entry->obj_handle.type == DIRECTORY) {
@@ -321,6 +368,87 @@ mdc_up_invalidate_close(const struct fsal_up_vector *vec,
 	return status;
 }
 
+/**
+ * @brief Invalidate a directory and everything below it
+ *
+ * The directory itself is invalidated now.  It gets a new subtree
+ * generation that its children pick up as they are looked up or read
+ * through it, invalidating themselves and passing it on further down.
+ *
+ * @param[in] vec    Up ops vector
+ * @param[in] handle Directory to invalidate
+ *
+ * @return FSAL status
+ */
+
+static fsal_status_t
+mdc_up_invalidate_subtree(const struct fsal_up_vector *vec,
+			  struct gsh_buffdesc *handle)
+{
+	mdcache_entry_t *entry;
+	fsal_status_t status;
+	struct req_op_context *save_ctx, req_ctx = {0};
+	mdcache_key_t key;
+	uint64_t gen;
+
+	req_ctx.ctx_export = vec->up_gsh_export;
+	req_ctx.fsal_export = vec->up_fsal_export;
+	save_ctx = op_ctx;
+	op_ctx = &req_ctx;
+
+	key.fsal = vec->up_fsal_export->sub_export->fsal;
+	(void) cih_hash_key(&key, vec->up_fsal_export->sub_export->fsal, handle,
+			    CIH_HASH_KEY_PROTOTYPE);
+
+	status = mdcache_find_keyed(&key, &entry);
+	if (status.major == ERR_FSAL_NOENT) {
+		/* Not cached, nothing below it can be reached through it */
+		status = fsalstat(ERR_FSAL_NO_ERROR, 0);
+		goto out;
+	} else if (FSAL_IS_ERROR(status)) {
+		goto out;
+	}
+
+	gen = atomic_inc_uint64_t(&mdc_inval_gen);
+
+	if (entry->obj_handle.type == DIRECTORY)
+		(void) mdc_inval_gen_raise(&entry->fsobj.fsdir->subtree_gen,
+					   gen);
+
+	(void) mdc_inval_gen_check(entry, gen);
+
+	mdcache_put(entry);
+
+out:
+	op_ctx = save_ctx;
+	return status;
+}
+
+/**
+ * @brief Invalidate every cached object of an export
+ *
+ * Entries compare the export's new generation when they are next found
+ * through it.
+ *
+ * @param[in] vec    Up ops vector
+ *
+ * @return FSAL status
+ */
+
+static fsal_status_t
+mdc_up_invalidate_export(const struct fsal_up_vector *vec)
+{
+	struct mdcache_fsal_export *myself = mdc_export(vec->up_fsal_export);
+
+	(void) mdc_inval_gen_raise(&myself->inval_gen,
+				   atomic_inc_uint64_t(&mdc_inval_gen));
+
+	LogDebug(COMPONENT_CACHE_INODE,
+		 "Invalidated export %s", myself->name);
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
 /** Grant a lock to a client
  *
  * Pass up to upper layer
@@ -428,7 +556,8 @@ state_status_t mdc_up_layoutrecall(const struct fsal_up_vector *vec,
 
 /** Recall a delegation
  *
- * Pass to upper layer
+ * Write out data gathered for the file, so the conflicting access
+ * through the FSAL sees it, then pass to upper layer
  *
  * @param[in] vec	Up ops vector
  * @param[in] handle Handle on which the delegation is held
@@ -439,12 +568,23 @@ state_status_t mdc_up_delegrecall(const struct fsal_up_vector *vec,
 	struct mdcache_fsal_export *myself = mdc_export(vec->up_fsal_export);
 	state_status_t rc;
 	struct req_op_context *save_ctx, req_ctx = {0};
+	mdcache_entry_t *entry;
+	mdcache_key_t key;
 
 	req_ctx.ctx_export = vec->up_gsh_export;
 	req_ctx.fsal_export = vec->up_fsal_export;
 	save_ctx = op_ctx;
 	op_ctx = &req_ctx;
 
+	key.fsal = vec->up_fsal_export->sub_export->fsal;
+	(void) cih_hash_key(&key, vec->up_fsal_export->sub_export->fsal, handle,
+			    CIH_HASH_KEY_PROTOTYPE);
+
+	if (!FSAL_IS_ERROR(mdcache_find_keyed(&key, &entry))) {
+		mdcache_file_wb_flush(entry, 0, UINT64_MAX);
+		mdcache_put(entry);
+	}
+
 	rc = myself->super_up_ops.delegrecall(vec, handle);
 
 	op_ctx = save_ctx;
@@ -465,6 +605,8 @@ mdcache_export_up_ops_init(struct fsal_up_vector *my_up_ops,
 	my_up_ops->invalidate = mdc_up_invalidate;
 	my_up_ops->update = mdc_up_update;
 	my_up_ops->invalidate_close = mdc_up_invalidate_close;
+	my_up_ops->invalidate_subtree = mdc_up_invalidate_subtree;
+	my_up_ops->invalidate_export = mdc_up_invalidate_export;
 
 	/* These are pass-through calls that set op_ctx */
 	my_up_ops->lock_grant = mdc_up_lock_grant;
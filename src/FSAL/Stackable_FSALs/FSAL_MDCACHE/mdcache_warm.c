@@ -0,0 +1,533 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @addtogroup FSAL_MDCACHE
+ * @{
+ */
+
+/**
+ * @file mdcache_warm.c
+ * @brief Warm-start snapshot of the hot cache entries
+ *
+ * The handles of the hottest L1 entries, and the parent handles of the
+ * directories among them, are written to Warm_Start_File periodically
+ * and at shutdown.  At startup the snapshot is read back and the entries
+ * are instantiated by a pool of threads while the grace period runs, so
+ * that reclaiming clients find them cached.
+ *
+ * Handles are recorded in the same NFSv4 wire form mdcache already keeps
+ * as the '..' handle of a directory, and are brought back the same way,
+ * through mdcache_locate_host().
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "log.h"
+#include "fsal.h"
+#include "nfs_core.h"
+#include "export_mgr.h"
+#include "sal_functions.h"
+#include "fridgethr.h"
+#include "abstract_atomic.h"
+#include "mdcache_int.h"
+#include "mdcache_lru.h"
+#include "mdcache.h"
+
+#define MDC_WARM_MAGIC 0x4d444357	/* "MDCW" */
+#define MDC_WARM_VERSION 1
+/** Records handed to each prefetch job */
+#define MDC_WARM_BATCH 64
+
+/**
+ * @brief Snapshot file header
+ */
+struct mdc_warm_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;		/*< Records following */
+};
+
+/**
+ * @brief One snapshot record, followed on disk by its handles
+ */
+struct mdc_warm_rec {
+	int32_t export_id;
+	uint16_t fh_len;	/*< Length of the entry's handle */
+	uint16_t parent_len;	/*< Length of the parent handle, 0 if none */
+	char data[];		/*< Entry handle, then parent handle */
+};
+
+/**
+ * @brief A group of records for one prefetch job
+ */
+struct mdc_warm_batch {
+	uint32_t count;
+	struct mdc_warm_rec *recs[MDC_WARM_BATCH];
+};
+
+/** Periodic snapshot writer */
+static struct fridgethr *warm_save_fridge;
+/** Prefetch workers */
+static struct fridgethr *warm_load_fridge;
+/** Prefetch batches queued or running */
+static int32_t warm_pending;
+/** Entries instantiated from the snapshot */
+static uint64_t warm_loaded;
+/** Set at shutdown so queued prefetch batches drain quickly */
+static uint32_t warm_stopping;
+
+/**
+ * @brief Write one entry to the snapshot
+ *
+ * @param[in] fp     Snapshot being written
+ * @param[in] entry  Referenced entry
+ *
+ * @return true if a record was written.
+ */
+static bool mdc_warm_write_entry(FILE *fp, mdcache_entry_t *entry)
+{
+	char fh[NFS4_FHSIZE], parent[NFS4_FHSIZE];
+	struct gsh_buffdesc fh_desc = { fh, sizeof(fh) };
+	struct root_op_context root_op_context;
+	struct gsh_export *export;
+	struct mdc_warm_rec rec;
+	fsal_status_t status;
+	int32_t export_id;
+	bool written = false;
+
+	export_id = atomic_fetch_int32_t(&entry->first_export_id);
+	if (export_id < 0)
+		return false;
+
+	export = get_gsh_export(export_id);
+	if (export == NULL)
+		return false;
+
+	init_root_op_context(&root_op_context, export, export->fsal_export,
+			     0, 0, UNKNOWN_REQUEST);
+
+	subcall_nowait_raw(mdc_export(export->fsal_export),
+		status = entry->sub_handle->obj_ops.handle_to_wire(
+				entry->sub_handle, FSAL_DIGEST_NFSV4, &fh_desc)
+		);
+	if (FSAL_IS_ERROR(status))
+		goto out;
+
+	rec.export_id = export_id;
+	rec.fh_len = fh_desc.len;
+	rec.parent_len = 0;
+
+	if (entry->obj_handle.type == DIRECTORY) {
+		PTHREAD_RWLOCK_rdlock(&entry->content_lock);
+		if (entry->fsobj.fsdir->parent.len <= sizeof(parent)) {
+			rec.parent_len = entry->fsobj.fsdir->parent.len;
+			memcpy(parent, entry->fsobj.fsdir->parent.addr,
+			       rec.parent_len);
+		}
+		PTHREAD_RWLOCK_unlock(&entry->content_lock);
+	}
+
+	written = fwrite(&rec, sizeof(rec), 1, fp) == 1 &&
+		  fwrite(fh, rec.fh_len, 1, fp) == 1 &&
+		  (rec.parent_len == 0 ||
+		   fwrite(parent, rec.parent_len, 1, fp) == 1);
+
+out:
+	release_root_op_context();
+	put_gsh_export(export);
+	return written;
+}
+
+/**
+ * @brief Write the hot set to Warm_Start_File
+ *
+ * The snapshot is written beside the file and renamed over it, so a
+ * crash mid-write leaves the previous snapshot intact.
+ *
+ * @return 0 or an errno.
+ */
+static int mdc_warm_save(void)
+{
+	const char *path = mdcache_param.warm_start_file;
+	struct mdc_warm_hdr hdr = { MDC_WARM_MAGIC, MDC_WARM_VERSION, 0 };
+	size_t max = mdcache_param.warm_start_entries;
+	mdcache_entry_t **entries;
+	size_t count, i;
+	char *tmp;
+	FILE *fp;
+	int rc = 0;
+
+	tmp = gsh_malloc(strlen(path) + sizeof(".tmp"));
+	sprintf(tmp, "%s.tmp", path);
+
+	entries = gsh_calloc(max, sizeof(*entries));
+	count = mdcache_lru_hot_entries(entries, max);
+
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		rc = errno;
+	} else if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+		rc = ferror(fp) ? errno : EIO;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (rc == 0 && mdc_warm_write_entry(fp, entries[i]))
+			hdr.count++;
+		mdcache_put(entries[i]);
+	}
+	gsh_free(entries);
+
+	if (fp == NULL)
+		goto out;
+
+	if (rc == 0 && ferror(fp))
+		rc = EIO;
+
+	if (rc == 0) {
+		rewind(fp);
+		if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 || fflush(fp) != 0 ||
+		    fsync(fileno(fp)) != 0)
+			rc = errno ? errno : EIO;
+	}
+
+	if (fclose(fp) != 0 && rc == 0)
+		rc = errno;
+
+	if (rc == 0 && rename(tmp, path) != 0)
+		rc = errno;
+
+	if (rc != 0)
+		(void) unlink(tmp);
+	else
+		LogInfo(COMPONENT_CACHE_INODE,
+			"Saved %"PRIu32" entries to warm start file %s",
+			hdr.count, path);
+
+out:
+	if (rc != 0)
+		LogWarn(COMPONENT_CACHE_INODE,
+			"Unable to save warm start file %s: %s",
+			path, strerror(rc));
+	gsh_free(tmp);
+	return rc;
+}
+
+/**
+ * @brief Periodic snapshot looper
+ *
+ * @param[in] ctx  Fridge context
+ */
+static void mdc_warm_save_run(struct fridgethr_context *ctx)
+{
+	static bool started;
+
+	SetNameFunction("mdc_warm");
+
+	/* The looper fires once as soon as it starts, and until the prefetch
+	 * is done the cache is colder than the snapshot it came from.
+	 */
+	if (!started || atomic_fetch_int32_t(&warm_pending) != 0) {
+		started = true;
+		return;
+	}
+
+	(void) mdc_warm_save();
+}
+
+/**
+ * @brief Instantiate one snapshot record
+ *
+ * @param[in] rec  Record
+ */
+static void mdc_warm_load_rec(struct mdc_warm_rec *rec)
+{
+	struct root_op_context root_op_context;
+	struct mdcache_fsal_export *mdc_exp;
+	struct gsh_buffdesc fh_desc, parent_desc;
+	struct gsh_export *export;
+	mdcache_entry_t *entry;
+	fsal_status_t status;
+
+	export = get_gsh_export(rec->export_id);
+	if (export == NULL)
+		return;
+
+	init_root_op_context(&root_op_context, export, export->fsal_export,
+			     0, 0, UNKNOWN_REQUEST);
+	mdc_exp = mdc_export(export->fsal_export);
+
+	fh_desc.addr = rec->data;
+	fh_desc.len = rec->fh_len;
+	parent_desc.addr = rec->data + rec->fh_len;
+	parent_desc.len = rec->parent_len;
+
+	if (parent_desc.len != 0) {
+		status = mdcache_locate_host(&parent_desc, mdc_exp, &entry,
+					     NULL);
+		if (!FSAL_IS_ERROR(status))
+			mdcache_put(entry);
+	}
+
+	status = mdcache_locate_host(&fh_desc, mdc_exp, &entry, NULL);
+	if (FSAL_IS_ERROR(status)) {
+		LogFullDebug(COMPONENT_CACHE_INODE,
+			     "Warm start of export %"PRIi32" entry failed %s",
+			     rec->export_id, fsal_err_txt(status));
+		goto out;
+	}
+
+	if (entry->obj_handle.type == DIRECTORY && parent_desc.len != 0) {
+		/* Restore the '..' linkage so it needn't be looked up */
+		PTHREAD_RWLOCK_wrlock(&entry->content_lock);
+		if (entry->fsobj.fsdir->parent.len == 0)
+			mdcache_copy_fh(&entry->fsobj.fsdir->parent,
+					&parent_desc);
+		PTHREAD_RWLOCK_unlock(&entry->content_lock);
+	}
+
+	mdcache_put(entry);
+	(void) atomic_inc_uint64_t(&warm_loaded);
+
+out:
+	release_root_op_context();
+	put_gsh_export(export);
+}
+
+/**
+ * @brief Prefetch job
+ *
+ * Records are only worth loading while clients are still reclaiming;
+ * after grace the cache fills on demand as usual.
+ *
+ * @param[in] ctx  Fridge context; ctx->arg is the struct mdc_warm_batch
+ */
+static void mdc_warm_load_run(struct fridgethr_context *ctx)
+{
+	struct mdc_warm_batch *batch = ctx->arg;
+	uint32_t i;
+
+	for (i = 0; i < batch->count; i++) {
+		if (!atomic_fetch_uint32_t(&warm_stopping) && nfs_in_grace())
+			mdc_warm_load_rec(batch->recs[i]);
+		gsh_free(batch->recs[i]);
+	}
+	gsh_free(batch);
+
+	if (atomic_dec_int32_t(&warm_pending) == 0)
+		LogEvent(COMPONENT_CACHE_INODE,
+			 "Warm start loaded %"PRIu64" entries",
+			 atomic_fetch_uint64_t(&warm_loaded));
+}
+
+/**
+ * @brief Queue a prefetch batch
+ *
+ * @param[in] batch  Batch, consumed
+ */
+static void mdc_warm_submit(struct mdc_warm_batch *batch)
+{
+	uint32_t i;
+	int rc;
+
+	(void) atomic_inc_int32_t(&warm_pending);
+
+	rc = fridgethr_submit(warm_load_fridge, mdc_warm_load_run, batch);
+	if (rc == 0)
+		return;
+
+	LogWarn(COMPONENT_CACHE_INODE,
+		"Unable to queue warm start batch, error code %d", rc);
+	(void) atomic_dec_int32_t(&warm_pending);
+	for (i = 0; i < batch->count; i++)
+		gsh_free(batch->recs[i]);
+	gsh_free(batch);
+}
+
+/**
+ * @brief Read Warm_Start_File and queue its records for prefetch
+ */
+static void mdc_warm_load(void)
+{
+	const char *path = mdcache_param.warm_start_file;
+	struct mdc_warm_batch *batch = NULL;
+	struct mdc_warm_hdr hdr;
+	struct mdc_warm_rec head, *rec;
+	uint32_t i;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		if (errno != ENOENT)
+			LogWarn(COMPONENT_CACHE_INODE,
+				"Unable to open warm start file %s: %s",
+				path, strerror(errno));
+		return;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    hdr.magic != MDC_WARM_MAGIC || hdr.version != MDC_WARM_VERSION) {
+		LogWarn(COMPONENT_CACHE_INODE,
+			"Ignoring warm start file %s, bad header", path);
+		goto out;
+	}
+
+	for (i = 0; i < hdr.count; i++) {
+		if (fread(&head, sizeof(head), 1, fp) != 1 ||
+		    head.fh_len == 0 || head.fh_len > NFS4_FHSIZE ||
+		    head.parent_len > NFS4_FHSIZE) {
+			LogWarn(COMPONENT_CACHE_INODE,
+				"Warm start file %s truncated at record %"PRIu32,
+				path, i);
+			break;
+		}
+
+		rec = gsh_malloc(sizeof(*rec) + head.fh_len + head.parent_len);
+		*rec = head;
+		if (fread(rec->data, head.fh_len + head.parent_len, 1, fp)
+		    != 1) {
+			gsh_free(rec);
+			LogWarn(COMPONENT_CACHE_INODE,
+				"Warm start file %s truncated at record %"PRIu32,
+				path, i);
+			break;
+		}
+
+		if (batch == NULL)
+			batch = gsh_calloc(1, sizeof(*batch));
+
+		batch->recs[batch->count++] = rec;
+
+		if (batch->count == MDC_WARM_BATCH) {
+			mdc_warm_submit(batch);
+			batch = NULL;
+		}
+	}
+
+	if (batch != NULL)
+		mdc_warm_submit(batch);
+
+	LogEvent(COMPONENT_CACHE_INODE,
+		 "Warm start prefetching %"PRIu32" entries from %s",
+		 i, path);
+out:
+	fclose(fp);
+}
+
+/**
+ * @brief Start warm-start prefetch and periodic snapshots
+ *
+ * Called once exports are set up and the grace period has started.
+ */
+void mdcache_warm_start(void)
+{
+	struct fridgethr_params frp;
+	int rc;
+
+	if (mdcache_param.warm_start_file == NULL)
+		return;
+
+	memset(&frp, 0, sizeof(struct fridgethr_params));
+	frp.thr_max = mdcache_param.warm_start_threads;
+	frp.deferment = fridgethr_defer_queue;
+
+	rc = fridgethr_init(&warm_load_fridge, "MDC_Warm_Load", &frp);
+	if (rc != 0) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Unable to initialize warm start fridge, error code %d.",
+			 rc);
+		return;
+	}
+
+	mdc_warm_load();
+
+	if (mdcache_param.warm_start_interval == 0)
+		return;
+
+	memset(&frp, 0, sizeof(struct fridgethr_params));
+	frp.thr_max = 1;
+	frp.thr_min = 1;
+	frp.thread_delay = mdcache_param.warm_start_interval;
+	frp.flavor = fridgethr_flavor_looper;
+
+	rc = fridgethr_init(&warm_save_fridge, "MDC_Warm_Save", &frp);
+	if (rc == 0)
+		rc = fridgethr_submit(warm_save_fridge, mdc_warm_save_run,
+				      NULL);
+	if (rc != 0)
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Unable to start warm start snapshot thread, error code %d.",
+			 rc);
+}
+
+/**
+ * @brief Stop a warm-start fridge
+ *
+ * @param[in,out] fr  Fridge to stop, cleared
+ */
+static void mdc_warm_stop(struct fridgethr **fr)
+{
+	int rc;
+
+	if (*fr == NULL)
+		return;
+
+	rc = fridgethr_sync_command(*fr, fridgethr_comm_stop, 120);
+
+	if (rc == ETIMEDOUT) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Shutdown timed out, cancelling warm start threads.");
+		fridgethr_cancel(*fr);
+	} else if (rc != 0) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Failed shutting down warm start threads: %d", rc);
+	}
+
+	fridgethr_destroy(*fr);
+	*fr = NULL;
+}
+
+/**
+ * @brief Stop the warm-start threads and write a final snapshot
+ *
+ * Called at shutdown once requests have stopped but before exports are
+ * removed, while the cache is still populated.
+ */
+void mdcache_warm_shutdown(void)
+{
+	if (mdcache_param.warm_start_file == NULL)
+		return;
+
+	atomic_store_uint32_t(&warm_stopping, 1);
+
+	mdc_warm_stop(&warm_save_fridge);
+	mdc_warm_stop(&warm_load_fridge);
+
+	(void) mdc_warm_save();
+}
+
+/** @} */
@@ -40,6 +40,342 @@
 #include "FSAL/fsal_commonlib.h"
 #include "mdcache_int.h"
 
+/*
+ * Extended attribute cache
+ *
+ * With Xattr_Cache_Size set, NFSv4.2 GETXATTR answers (values up to that
+ * size, and "no such xattr") and a LISTXATTR from the start that reached
+ * the end are kept on the entry and served while getattrs returns the
+ * change attribute they were read at.  SELinux labels, POSIX ACLs and
+ * the like are then read once rather than on every access.  Once
+ * Xattr_Cache_Memory is held, xattrs are read through.
+ */
+
+static inline bool mdc_xattr_enabled(void)
+{
+	return mdcache_param.xattr_max_size != 0;
+}
+
+/**
+ * @brief Get the xattr cache of an entry, allocating it if needed
+ *
+ * @param[in] entry  The entry
+ *
+ * @return The xattr cache.
+ */
+static struct mdcache_xattr_cache *mdc_xattr_get(mdcache_entry_t *entry)
+{
+	struct mdcache_xattr_cache *xc;
+
+	xc = atomic_fetch_voidptr((void **)&entry->xattrs);
+	if (xc != NULL)
+		return xc;
+
+	PTHREAD_RWLOCK_wrlock(&entry->attr_lock);
+
+	xc = entry->xattrs;
+	if (xc == NULL) {
+		xc = gsh_calloc(1, sizeof(*xc));
+		PTHREAD_MUTEX_init(&xc->mtx, NULL);
+		glist_init(&xc->values);
+		atomic_store_voidptr((void **)&entry->xattrs, xc);
+	}
+
+	PTHREAD_RWLOCK_unlock(&entry->attr_lock);
+
+	return xc;
+}
+
+/**
+ * @brief Drop everything held, called with the cache mtx held
+ */
+static void mdc_xattr_drop(struct mdcache_xattr_cache *xc)
+{
+	struct mdcache_xattr *x;
+
+	while ((x = glist_first_entry(&xc->values, struct mdcache_xattr,
+				      list)) != NULL) {
+		glist_del(&x->list);
+		(void) atomic_sub_uint64_t(&cache_stp->xattr_bytes,
+					   sizeof(*x) + x->name_len +
+					   x->value_len);
+		gsh_free(x);
+	}
+
+	if (xc->list != NULL) {
+		(void) atomic_sub_uint64_t(&cache_stp->xattr_bytes,
+					   xc->list->size);
+		gsh_free(xc->list);
+		xc->list = NULL;
+	}
+}
+
+/**
+ * @brief Charge bytes about to be cached against Xattr_Cache_Memory
+ *
+ * @retval true if they fit.
+ */
+static bool mdc_xattr_charge(size_t size)
+{
+	if (atomic_add_uint64_t(&cache_stp->xattr_bytes, size) >
+	    mdcache_param.xattr_memory) {
+		(void) atomic_sub_uint64_t(&cache_stp->xattr_bytes, size);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Look up the xattr cache for a call on an entry
+ *
+ * Fetches the change attribute and drops what was cached under another
+ * one.  On success the cache mtx is held.
+ *
+ * @param[in]  entry   The entry
+ * @param[out] change  Change attribute now
+ *
+ * @return The locked cache, or NULL to pass the call through.
+ */
+static struct mdcache_xattr_cache *mdc_xattr_lock(mdcache_entry_t *entry,
+						 uint64_t *change)
+{
+	struct mdcache_xattr_cache *xc;
+	struct attrlist attrs;
+	fsal_status_t status;
+
+	fsal_prepare_attrs(&attrs, ATTR_CHANGE);
+	status = entry->obj_handle.obj_ops.getattrs(&entry->obj_handle,
+						    &attrs);
+	*change = attrs.change;
+	fsal_release_attrs(&attrs);
+
+	if (FSAL_IS_ERROR(status))
+		return NULL;
+
+	xc = mdc_xattr_get(entry);
+
+	PTHREAD_MUTEX_lock(&xc->mtx);
+
+	if (xc->change != *change) {
+		mdc_xattr_drop(xc);
+		xc->change = *change;
+	}
+
+	return xc;
+}
+
+static struct mdcache_xattr *mdc_xattr_find(struct mdcache_xattr_cache *xc,
+					    const xattrname4 *name)
+{
+	struct glist_head *glist;
+	struct mdcache_xattr *x;
+
+	glist_for_each(glist, &xc->values) {
+		x = glist_entry(glist, struct mdcache_xattr, list);
+		if (x->name_len == name->utf8string_len &&
+		    memcmp(x->data, name->utf8string_val, x->name_len) == 0)
+			return x;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Answer a GETXATTR from a cached xattr
+ *
+ * Like the sub-FSALs, a NULL value buffer only asks for the length.
+ */
+static fsal_status_t mdc_xattr_copy(const struct mdcache_xattr *x,
+				    xattrvalue4 *value)
+{
+	if (x->absent)
+		return fsalstat(ERR_FSAL_NOENT, 0);
+
+	if (value->utf8string_val != NULL) {
+		if (x->value_len > value->utf8string_len)
+			return fsalstat(ERR_FSAL_TOOSMALL, 0);
+		memcpy(value->utf8string_val, x->data + x->name_len,
+		       x->value_len);
+	}
+
+	value->utf8string_len = x->value_len;
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Keep what the sub-FSAL answered to a GETXATTR
+ *
+ * Only kept if no invalidate and no change came in since @a gen and
+ * @a change were taken.
+ */
+static void mdc_xattr_add(mdcache_entry_t *entry, uint32_t gen,
+			  uint64_t change, const xattrname4 *name,
+			  const xattrvalue4 *value, bool absent)
+{
+	struct mdcache_xattr_cache *xc = entry->xattrs;
+	uint32_t value_len = absent ? 0 : value->utf8string_len;
+	size_t size = sizeof(struct mdcache_xattr) + name->utf8string_len +
+		      value_len;
+	struct mdcache_xattr *x;
+
+	if (value_len > mdcache_param.xattr_max_size ||
+	    !mdc_xattr_charge(size))
+		return;
+
+	x = gsh_malloc(size);
+	x->name_len = name->utf8string_len;
+	x->value_len = value_len;
+	x->absent = absent;
+	memcpy(x->data, name->utf8string_val, x->name_len);
+	if (value_len != 0)
+		memcpy(x->data + x->name_len, value->utf8string_val,
+		       value_len);
+
+	PTHREAD_MUTEX_lock(&xc->mtx);
+
+	if (xc->gen == gen && xc->change == change &&
+	    mdc_xattr_find(xc, name) == NULL) {
+		glist_add(&xc->values, &x->list);
+		x = NULL;
+	}
+
+	PTHREAD_MUTEX_unlock(&xc->mtx);
+
+	if (x != NULL) {
+		gsh_free(x);
+		(void) atomic_sub_uint64_t(&cache_stp->xattr_bytes, size);
+	}
+}
+
+/**
+ * @brief Answer a LISTXATTR from the cached list
+ *
+ * The names go in the second half of the caller's entries buffer, as
+ * the sub-FSALs put them.
+ */
+static void mdc_xattr_list_copy(const struct mdcache_xattr_list *xl,
+				count4 len, nfs_cookie4 *cookie,
+				verifier4 *verf, bool_t *eof,
+				xattrlist4 *names)
+{
+	char *val = (char *)names->entries + len;
+	count4 i;
+
+	for (i = 0; i < xl->count; i++) {
+		names->entries[i].utf8string_len =
+			xl->entries[i].utf8string_len;
+		names->entries[i].utf8string_val = val;
+		memcpy(val, xl->entries[i].utf8string_val,
+		       xl->entries[i].utf8string_len);
+		val += xl->entries[i].utf8string_len;
+	}
+
+	names->entryCount = xl->count;
+	*cookie = xl->cookie;
+	memcpy(verf, xl->verf, NFS4_VERIFIER_SIZE);
+	*eof = true;
+}
+
+/**
+ * @brief Keep a complete LISTXATTR answer
+ */
+static void mdc_xattr_list_add(mdcache_entry_t *entry, uint32_t gen,
+			       uint64_t change, count4 len,
+			       nfs_cookie4 cookie, verifier4 *verf,
+			       const xattrlist4 *names)
+{
+	struct mdcache_xattr_cache *xc = entry->xattrs;
+	struct mdcache_xattr_list *xl;
+	size_t ents = names->entryCount * sizeof(component4);
+	size_t size = 0;
+	char *val;
+	count4 i;
+
+	for (i = 0; i < names->entryCount; i++)
+		size += names->entries[i].utf8string_len;
+
+	/* Both halves must fit a buffer of len for it to be served */
+	if (ents > len || size > len)
+		return;
+
+	size += sizeof(*xl) + ents;
+
+	if (!mdc_xattr_charge(size))
+		return;
+
+	xl = gsh_malloc(size);
+	xl->maxcount = len;
+	xl->cookie = cookie;
+	memcpy(xl->verf, verf, NFS4_VERIFIER_SIZE);
+	xl->count = names->entryCount;
+	xl->size = size;
+	val = (char *)&xl->entries[xl->count];
+
+	for (i = 0; i < xl->count; i++) {
+		xl->entries[i].utf8string_len =
+			names->entries[i].utf8string_len;
+		xl->entries[i].utf8string_val = val;
+		memcpy(val, names->entries[i].utf8string_val,
+		       names->entries[i].utf8string_len);
+		val += names->entries[i].utf8string_len;
+	}
+
+	PTHREAD_MUTEX_lock(&xc->mtx);
+
+	if (xc->gen == gen && xc->change == change && xc->list == NULL) {
+		xc->list = xl;
+		xl = NULL;
+	}
+
+	PTHREAD_MUTEX_unlock(&xc->mtx);
+
+	if (xl != NULL) {
+		gsh_free(xl);
+		(void) atomic_sub_uint64_t(&cache_stp->xattr_bytes, size);
+	}
+}
+
+/**
+ * @brief Drop the cached xattrs of an entry that may have changed
+ *
+ * Called after any xattr change made through us, on attribute
+ * invalidation and when the LRU moves the entry to L2.
+ *
+ * @param[in] entry  The entry
+ */
+void mdcache_xattr_release(mdcache_entry_t *entry)
+{
+	struct mdcache_xattr_cache *xc;
+
+	xc = atomic_fetch_voidptr((void **)&entry->xattrs);
+	if (xc == NULL)
+		return;
+
+	PTHREAD_MUTEX_lock(&xc->mtx);
+	xc->gen++;
+	mdc_xattr_drop(xc);
+	PTHREAD_MUTEX_unlock(&xc->mtx);
+}
+
+/**
+ * @brief Release the xattr cache of an entry being cleaned
+ *
+ * @param[in] entry  The entry
+ */
+void mdcache_xattr_free(mdcache_entry_t *entry)
+{
+	struct mdcache_xattr_cache *xc = entry->xattrs;
+
+	if (xc == NULL)
+		return;
+
+	mdc_xattr_drop(xc);
+	PTHREAD_MUTEX_destroy(&xc->mtx);
+	gsh_free(xc);
+	entry->xattrs = NULL;
+}
+
 /**
  * @brief List extended attributes on a file
  *
@@ -193,6 +529,8 @@ fsal_status_t mdcache_setextattr_value(struct fsal_obj_handle *obj_hdl,
 			buf_size, create)
 	       );
 
+	mdcache_xattr_release(handle);
+
 	return status;
 }
 
@@ -223,6 +561,8 @@ fsal_status_t mdcache_setextattr_value_by_id(struct fsal_obj_handle *obj_hdl,
 				buf_size)
 	       );
 
+	mdcache_xattr_release(handle);
+
 	return status;
 }
 
@@ -248,6 +588,8 @@ fsal_status_t mdcache_remove_extattr_by_id(struct fsal_obj_handle *obj_hdl,
 			handle->sub_handle, id)
 	       );
 
+	mdcache_xattr_release(handle);
+
 	return status;
 }
 
@@ -273,13 +615,16 @@ fsal_status_t mdcache_remove_extattr_by_name(struct fsal_obj_handle *obj_hdl,
 			handle->sub_handle, name)
 	       );
 
+	mdcache_xattr_release(handle);
+
 	return status;
 }
 
 /**
  * @brief Get an Extended Attribute
  *
- * Pass through to sub-FSAL
+ * Served from the xattr cache when it can be, else passed through to
+ * the sub-FSAL and the answer kept.
  *
  * @param[in] obj_hdl	File to search
  * @param[in] name	Name of attribute
@@ -292,13 +637,39 @@ fsal_status_t mdcache_getxattrs(struct fsal_obj_handle *obj_hdl,
 	struct mdcache_fsal_obj_handle *handle =
 		container_of(obj_hdl, struct mdcache_fsal_obj_handle,
 			     obj_handle);
+	struct mdcache_xattr_cache *xc = NULL;
+	struct mdcache_xattr *x;
 	fsal_status_t status;
+	uint64_t change = 0;
+	uint32_t gen = 0;
+
+	if (mdc_xattr_enabled())
+		xc = mdc_xattr_lock(handle, &change);
+
+	if (xc != NULL) {
+		x = mdc_xattr_find(xc, name);
+		if (x != NULL) {
+			status = mdc_xattr_copy(x, value);
+			PTHREAD_MUTEX_unlock(&xc->mtx);
+			(void) atomic_inc_uint64_t(&cache_stp->xattr_hits);
+			return status;
+		}
+		gen = xc->gen;
+		PTHREAD_MUTEX_unlock(&xc->mtx);
+	}
 
 	subcall(
 		status = handle->sub_handle->obj_ops.getxattrs(
 			handle->sub_handle, name, value)
 	       );
 
+	/* A length only probe has no value to keep */
+	if (xc != NULL &&
+	    ((!FSAL_IS_ERROR(status) && value->utf8string_val != NULL) ||
+	     status.major == ERR_FSAL_NOENT))
+		mdc_xattr_add(handle, gen, change, name, value,
+			      FSAL_IS_ERROR(status));
+
 	return status;
 }
 
@@ -327,6 +698,8 @@ fsal_status_t mdcache_setxattrs(struct fsal_obj_handle *obj_hdl,
 			handle->sub_handle, type, name, value)
 	       );
 
+	mdcache_xattr_release(handle);
+
 	return status;
 }
 
@@ -352,13 +725,17 @@ fsal_status_t mdcache_removexattrs(struct fsal_obj_handle *obj_hdl,
 			handle->sub_handle, name)
 	       );
 
+	mdcache_xattr_release(handle);
+
 	return status;
 }
 
 /**
  * @brief List Extended Attributes
  *
- * Pass through to sub-FSAL
+ * A listing from the start that fits is served from the xattr cache
+ * when it can be, else passed through to the sub-FSAL and kept if it
+ * came back complete.
  *
  * @param[in] obj_hdl	File to search
  * @param[in] len	Length of names buffer
@@ -376,12 +753,34 @@ fsal_status_t mdcache_listxattrs(struct fsal_obj_handle *obj_hdl,
 	struct mdcache_fsal_obj_handle *handle =
 		container_of(obj_hdl, struct mdcache_fsal_obj_handle,
 			     obj_handle);
+	struct mdcache_xattr_cache *xc = NULL;
 	fsal_status_t status;
+	uint64_t change = 0;
+	uint32_t gen = 0;
+
+	if (mdc_xattr_enabled() && *cookie == 0)
+		xc = mdc_xattr_lock(handle, &change);
+
+	if (xc != NULL) {
+		if (xc->list != NULL && len >= xc->list->maxcount) {
+			mdc_xattr_list_copy(xc->list, len, cookie, verf, eof,
+					    names);
+			PTHREAD_MUTEX_unlock(&xc->mtx);
+			(void) atomic_inc_uint64_t(&cache_stp->xattr_hits);
+			return fsalstat(ERR_FSAL_NO_ERROR, 0);
+		}
+		gen = xc->gen;
+		PTHREAD_MUTEX_unlock(&xc->mtx);
+	}
 
 	subcall(
 		status = handle->sub_handle->obj_ops.listxattrs(
 			handle->sub_handle, len, cookie, verf, eof, names)
 	       );
 
+	if (xc != NULL && !FSAL_IS_ERROR(status) && *eof)
+		mdc_xattr_list_add(handle, gen, change, len, *cookie, verf,
+				   names);
+
 	return status;
 }
@@ -0,0 +1,812 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* cache.c
+ * PCACHE FSAL data cache
+ *
+ * File data is cached in pages of Page_Size bytes, read whole from the
+ * sub fsal on a miss.  Pages of a file hang off a pcache_file, found by
+ * the sub fsal handle key so the data outlives the object handles
+ * MDCACHE recycles.  Pages are on a global LRU bounded by Cache_Size;
+ * pages pushed out of RAM go to a file on local disk when Ssd_Cache_Path
+ * is set, and are read back from there on a hit.
+ *
+ * A file's pages are dropped when its change attribute moves, when the
+ * sub fsal sends an invalidate or update upcall, and on truncate.
+ * Writes go through to the sub fsal and drop the pages they touch.
+ *
+ * Locking: a file's lock protects its pages and change attribute.
+ * pcache.lock protects the LRUs and SSD slots and nests inside file
+ * locks.  Reclaim holds pcache.lock and only ever trylocks files.
+ */
+
+#include "config.h"
+
+#include "fsal.h"
+#include <pthread.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "gsh_list.h"
+#include "avltree.h"
+#include "city.h"
+#include "abstract_atomic.h"
+#include "FSAL/fsal_commonlib.h"
+#include "pcache_methods.h"
+
+#define PCACHE_HASH_SIZE 1021
+
+#define PCACHE_NO_SLOT UINT32_MAX
+
+struct pcache_file {
+	struct glist_head hash;		/*< In the hash bucket */
+	uint64_t hk;			/*< Hash of the key */
+	struct fsal_module *fsal;	/*< Sub fsal the key belongs to */
+	struct gsh_buffdesc key;	/*< Sub fsal handle key */
+	int32_t refcnt;			/*< Handles, plus one while any page
+					    is cached.  Only drops to zero
+					    under the bucket lock. */
+	pthread_rwlock_t lock;
+	struct avltree pages;		/*< Cached pages, by index */
+	uint32_t nr_pages;
+	uint64_t gen;			/*< Bumped on each invalidation */
+	uint64_t change;		/*< Change attribute pages match */
+	bool change_valid;		/*< change is known */
+	bool expect_change;		/*< Our own write moved change */
+	uint64_t eof_index;		/*< Page holding end of file */
+};
+
+struct pcache_page {
+	struct avltree_node node_k;	/*< In file->pages */
+	struct glist_head lru;		/*< In the RAM or SSD LRU */
+	struct pcache_file *file;
+	uint64_t index;
+	uint32_t valid;			/*< Bytes of data in the page */
+	bool eof;			/*< The file ends in this page */
+	bool referenced;		/*< Hit since last seen by reclaim */
+	char *data;			/*< NULL if the page is on SSD */
+	uint32_t slot;			/*< SSD slot if data is NULL */
+};
+
+struct pcache_bucket {
+	pthread_mutex_t lock;
+	struct glist_head files;
+};
+
+static struct pcache_state {
+	pthread_mutex_t lock;
+	struct glist_head ram_lru;
+	struct glist_head ssd_lru;
+	uint64_t ram_pages;
+	uint64_t ram_max;		/*< 0 when the cache is off */
+	int ssd_fd;			/*< -1 without a second tier */
+	uint32_t *free_slots;
+	uint32_t nr_free;
+	struct pcache_bucket hash[PCACHE_HASH_SIZE];
+} pcache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.ssd_fd = -1,
+};
+
+static int pcache_page_cmpf(const struct avltree_node *lhs,
+			    const struct avltree_node *rhs)
+{
+	struct pcache_page *lk, *rk;
+
+	lk = avltree_container_of(lhs, struct pcache_page, node_k);
+	rk = avltree_container_of(rhs, struct pcache_page, node_k);
+
+	if (lk->index < rk->index)
+		return -1;
+	if (lk->index > rk->index)
+		return 1;
+	return 0;
+}
+
+static struct pcache_page *pcache_page_lookup(struct pcache_file *file,
+					      uint64_t index)
+{
+	struct pcache_page key = { .index = index };
+	struct avltree_node *node;
+
+	node = avltree_lookup(&key.node_k, &file->pages);
+	if (node == NULL)
+		return NULL;
+
+	return avltree_container_of(node, struct pcache_page, node_k);
+}
+
+/**
+ * @brief Set up the cache once the module config is read
+ */
+void pcache_pkginit(void)
+{
+	uint64_t nr_slots;
+	uint32_t i;
+
+	for (i = 0; i < PCACHE_HASH_SIZE; i++) {
+		PTHREAD_MUTEX_init(&pcache.hash[i].lock, NULL);
+		glist_init(&pcache.hash[i].files);
+	}
+	glist_init(&pcache.ram_lru);
+	glist_init(&pcache.ssd_lru);
+
+	pcache.ram_max = pcache_params.cache_size / pcache_params.page_size;
+	if (pcache.ram_max == 0) {
+		LogInfo(COMPONENT_FSAL,
+			"PCACHE data cache disabled, reads go to the sub fsal");
+		return;
+	}
+
+	nr_slots = MIN(pcache_params.ssd_size / pcache_params.page_size,
+		       PCACHE_NO_SLOT);
+
+	if (pcache_params.ssd_path == NULL || nr_slots == 0)
+		return;
+
+	pcache.ssd_fd = open(pcache_params.ssd_path,
+			     O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (pcache.ssd_fd < 0) {
+		LogCrit(COMPONENT_FSAL,
+			"Could not open SSD cache %s: %s, using RAM only",
+			pcache_params.ssd_path, strerror(errno));
+		return;
+	}
+
+	if (ftruncate(pcache.ssd_fd,
+		      nr_slots * pcache_params.page_size) != 0) {
+		LogCrit(COMPONENT_FSAL,
+			"Could not size SSD cache %s: %s, using RAM only",
+			pcache_params.ssd_path, strerror(errno));
+		close(pcache.ssd_fd);
+		pcache.ssd_fd = -1;
+		return;
+	}
+
+	pcache.free_slots = gsh_malloc(nr_slots * sizeof(uint32_t));
+	for (i = 0; i < nr_slots; i++)
+		pcache.free_slots[i] = nr_slots - 1 - i;
+	pcache.nr_free = nr_slots;
+
+	LogInfo(COMPONENT_FSAL,
+		"PCACHE %"PRIu64" RAM pages and %"PRIu64
+		" SSD pages of %"PRIu32" bytes",
+		pcache.ram_max, nr_slots, pcache_params.page_size);
+}
+
+void pcache_pkgshutdown(void)
+{
+	if (pcache.ssd_fd >= 0) {
+		close(pcache.ssd_fd);
+		pcache.ssd_fd = -1;
+		/* The contents are useless without the index */
+		if (unlink(pcache_params.ssd_path) != 0)
+			LogDebug(COMPONENT_FSAL,
+				 "Could not remove SSD cache %s: %s",
+				 pcache_params.ssd_path, strerror(errno));
+	}
+	gsh_free(pcache.free_slots);
+	pcache.free_slots = NULL;
+}
+
+/**
+ * @brief Find, or create, the cache of a file
+ *
+ * @param[in] sub_fsal  Sub fsal of the handle
+ * @param[in] key       Its handle key
+ * @param[in] create    Create the cache if there is none
+ *
+ * @return The file with a reference held, NULL if not found.
+ */
+struct pcache_file *pcache_file_get(struct fsal_module *sub_fsal,
+				    struct gsh_buffdesc *key, bool create)
+{
+	uint64_t hk = CityHash64WithSeed(key->addr, key->len,
+					 (uint64_t) (uintptr_t) sub_fsal);
+	struct pcache_bucket *bucket = &pcache.hash[hk % PCACHE_HASH_SIZE];
+	struct pcache_file *file;
+	struct glist_head *glist;
+
+	if (pcache.ram_max == 0)
+		return NULL;
+
+	PTHREAD_MUTEX_lock(&bucket->lock);
+
+	glist_for_each(glist, &bucket->files) {
+		file = glist_entry(glist, struct pcache_file, hash);
+		if (file->hk == hk && file->fsal == sub_fsal &&
+		    file->key.len == key->len &&
+		    memcmp(file->key.addr, key->addr, key->len) == 0) {
+			atomic_inc_int32_t(&file->refcnt);
+			PTHREAD_MUTEX_unlock(&bucket->lock);
+			return file;
+		}
+	}
+
+	if (!create) {
+		PTHREAD_MUTEX_unlock(&bucket->lock);
+		return NULL;
+	}
+
+	file = gsh_calloc(1, sizeof(*file));
+	file->hk = hk;
+	file->fsal = sub_fsal;
+	file->key.len = key->len;
+	file->key.addr = gsh_malloc(key->len);
+	memcpy(file->key.addr, key->addr, key->len);
+	file->refcnt = 1;
+	file->eof_index = UINT64_MAX;
+	PTHREAD_RWLOCK_init(&file->lock, NULL);
+	avltree_init(&file->pages, pcache_page_cmpf, 0);
+	glist_add(&bucket->files, &file->hash);
+
+	PTHREAD_MUTEX_unlock(&bucket->lock);
+
+	return file;
+}
+
+void pcache_file_put(struct pcache_file *file)
+{
+	struct pcache_bucket *bucket = &pcache.hash[file->hk %
+						    PCACHE_HASH_SIZE];
+
+	PTHREAD_MUTEX_lock(&bucket->lock);
+
+	if (atomic_dec_int32_t(&file->refcnt) != 0) {
+		PTHREAD_MUTEX_unlock(&bucket->lock);
+		return;
+	}
+
+	glist_del(&file->hash);
+	PTHREAD_MUTEX_unlock(&bucket->lock);
+
+	PTHREAD_RWLOCK_destroy(&file->lock);
+	gsh_free(file->key.addr);
+	gsh_free(file);
+}
+
+/* Drop a page from its file and the LRUs.  Called with the file lock
+ * and pcache.lock held.  The caller puts the file's page reference when
+ * this returns true.
+ */
+static bool pcache_page_drop(struct pcache_page *page)
+{
+	struct pcache_file *file = page->file;
+
+	glist_del(&page->lru);
+	if (page->data != NULL) {
+		pcache.ram_pages--;
+		gsh_free(page->data);
+	} else {
+		pcache.free_slots[pcache.nr_free++] = page->slot;
+	}
+
+	avltree_remove(&page->node_k, &file->pages);
+	if (page->index == file->eof_index)
+		file->eof_index = UINT64_MAX;
+	gsh_free(page);
+
+	return --file->nr_pages == 0;
+}
+
+/* Drop all pages of a file, with its lock held */
+static bool pcache_file_drop_locked(struct pcache_file *file)
+{
+	struct avltree_node *node;
+	bool last = false;
+
+	file->gen++;
+
+	if (file->nr_pages == 0)
+		return false;
+
+	PTHREAD_MUTEX_lock(&pcache.lock);
+	while ((node = avltree_first(&file->pages)) != NULL)
+		last = pcache_page_drop(avltree_container_of(
+				node, struct pcache_page, node_k));
+	PTHREAD_MUTEX_unlock(&pcache.lock);
+
+	return last;
+}
+
+void pcache_file_invalidate(struct pcache_file *file)
+{
+	bool last;
+
+	PTHREAD_RWLOCK_wrlock(&file->lock);
+	last = pcache_file_drop_locked(file);
+	PTHREAD_RWLOCK_unlock(&file->lock);
+
+	if (last)
+		pcache_file_put(file);
+}
+
+/**
+ * @brief Check cached data against fresh attributes
+ *
+ * Drops the pages if the change attribute moved, unless it moved
+ * because of a write of ours, which already dropped what it touched.
+ */
+void pcache_file_check(struct pcache_file *file, struct attrlist *attrs)
+{
+	bool last = false;
+
+	if (attrs == NULL || !FSAL_TEST_MASK(attrs->valid_mask, ATTR_CHANGE))
+		return;
+
+	PTHREAD_RWLOCK_rdlock(&file->lock);
+	if (file->change_valid && file->change == attrs->change) {
+		PTHREAD_RWLOCK_unlock(&file->lock);
+		return;
+	}
+	PTHREAD_RWLOCK_unlock(&file->lock);
+
+	PTHREAD_RWLOCK_wrlock(&file->lock);
+	if (file->change_valid && file->change != attrs->change &&
+	    !file->expect_change) {
+		LogFullDebug(COMPONENT_FSAL,
+			     "Change moved from %"PRIu64" to %"PRIu64
+			     ", dropping %"PRIu32" pages",
+			     file->change, attrs->change, file->nr_pages);
+		last = pcache_file_drop_locked(file);
+	}
+	file->change = attrs->change;
+	file->change_valid = true;
+	file->expect_change = false;
+	PTHREAD_RWLOCK_unlock(&file->lock);
+
+	if (last)
+		pcache_file_put(file);
+}
+
+/**
+ * @brief Check cached data when a new handle is made for the file
+ *
+ * Nothing may have watched the file since its last handle went away,
+ * so without a change attribute to compare the pages are dropped.
+ */
+void pcache_file_attach(struct pcache_file *file, struct attrlist *attrs)
+{
+	if (attrs != NULL && FSAL_TEST_MASK(attrs->valid_mask, ATTR_CHANGE))
+		pcache_file_check(file, attrs);
+	else
+		pcache_file_invalidate(file);
+}
+
+/**
+ * @brief Forget the pages a write or truncate went through
+ *
+ * The page the file ended in goes too, the write may have extended
+ * the file past it.
+ *
+ * @param[in] file    Cached file
+ * @param[in] offset  Start of the change
+ * @param[in] len     Its length, 0 for up to the end of file
+ */
+void pcache_file_written(struct pcache_file *file, uint64_t offset,
+			 size_t len)
+{
+	uint64_t first = offset / pcache_params.page_size;
+	uint64_t last_index = len == 0 ? UINT64_MAX
+				       : (offset + len - 1) /
+					 pcache_params.page_size;
+	struct pcache_page key = { .index = first };
+	struct avltree_node *node;
+	bool last = false;
+
+	PTHREAD_RWLOCK_wrlock(&file->lock);
+
+	file->gen++;
+	file->expect_change = true;
+
+	if (file->nr_pages != 0) {
+		PTHREAD_MUTEX_lock(&pcache.lock);
+
+		node = avltree_sup(&key.node_k, &file->pages);
+		while (node != NULL) {
+			struct pcache_page *page = avltree_container_of(
+					node, struct pcache_page, node_k);
+
+			if (page->index > last_index)
+				break;
+			node = avltree_next(node);
+			last = pcache_page_drop(page);
+		}
+
+		if (file->eof_index != UINT64_MAX) {
+			struct pcache_page *page =
+				pcache_page_lookup(file, file->eof_index);
+
+			if (page != NULL)
+				last = pcache_page_drop(page);
+		}
+
+		PTHREAD_MUTEX_unlock(&pcache.lock);
+	}
+
+	PTHREAD_RWLOCK_unlock(&file->lock);
+
+	if (last)
+		pcache_file_put(file);
+}
+
+/* Take a free SSD slot, or the one of the oldest SSD page.  Called with
+ * pcache.lock and @a held locked.  A file that lost its last page is
+ * returned in *put for the caller to put once it dropped its locks.
+ */
+static uint32_t pcache_ssd_slot(struct pcache_file *held,
+				struct pcache_file **put)
+{
+	struct glist_head *node;
+	uint32_t slot;
+
+	if (pcache.nr_free != 0)
+		return pcache.free_slots[--pcache.nr_free];
+
+	for (node = pcache.ssd_lru.prev; node != &pcache.ssd_lru;
+	     node = node->prev) {
+		struct pcache_page *page =
+			glist_entry(node, struct pcache_page, lru);
+		struct pcache_file *file = page->file;
+
+		if (file != held && pthread_rwlock_trywrlock(&file->lock) != 0)
+			continue;
+
+		slot = page->slot;
+		/* Hand the slot over instead of freeing it */
+		page->data = NULL;
+		glist_del(&page->lru);
+		avltree_remove(&page->node_k, &file->pages);
+		if (page->index == file->eof_index)
+			file->eof_index = UINT64_MAX;
+		gsh_free(page);
+		if (--file->nr_pages == 0)
+			*put = file;
+
+		if (file != held)
+			PTHREAD_RWLOCK_unlock(&file->lock);
+
+		return slot;
+	}
+
+	return PCACHE_NO_SLOT;
+}
+
+/**
+ * @brief Bring RAM use back under Cache_Size
+ *
+ * Pages are taken from the cold end of the LRU, with a second chance
+ * for those hit since they were last looked at.  Pages of files that
+ * are busy are skipped, so RAM use may stay over the limit for a while.
+ */
+static void pcache_reclaim(void)
+{
+	struct pcache_page *victim;
+	struct pcache_file *file, *put1, *put2;
+	struct glist_head *node, *prev;
+	uint32_t slot;
+	ssize_t written;
+
+	for (;;) {
+		victim = NULL;
+		put1 = NULL;
+		put2 = NULL;
+
+		PTHREAD_MUTEX_lock(&pcache.lock);
+
+		if (pcache.ram_pages <= pcache.ram_max) {
+			PTHREAD_MUTEX_unlock(&pcache.lock);
+			return;
+		}
+
+		for (node = pcache.ram_lru.prev; node != &pcache.ram_lru;
+		     node = prev) {
+			struct pcache_page *page =
+				glist_entry(node, struct pcache_page, lru);
+
+			prev = node->prev;
+
+			if (page->referenced) {
+				page->referenced = false;
+				glist_del(&page->lru);
+				glist_add(&pcache.ram_lru, &page->lru);
+				continue;
+			}
+
+			if (pthread_rwlock_trywrlock(&page->file->lock) == 0) {
+				victim = page;
+				break;
+			}
+		}
+
+		if (victim == NULL) {
+			PTHREAD_MUTEX_unlock(&pcache.lock);
+			return;
+		}
+
+		file = victim->file;
+		slot = PCACHE_NO_SLOT;
+		if (pcache.ssd_fd >= 0)
+			slot = pcache_ssd_slot(file, &put1);
+
+		if (slot == PCACHE_NO_SLOT) {
+			if (pcache_page_drop(victim))
+				put2 = file;
+			PTHREAD_MUTEX_unlock(&pcache.lock);
+			goto unlock;
+		}
+
+		glist_del(&victim->lru);
+		pcache.ram_pages--;
+		PTHREAD_MUTEX_unlock(&pcache.lock);
+
+		/* The file stays locked, so its readers wait for this */
+		written = pwrite(pcache.ssd_fd, victim->data,
+				 pcache_params.page_size,
+				 (off_t) slot * pcache_params.page_size);
+
+		PTHREAD_MUTEX_lock(&pcache.lock);
+		if (written != (ssize_t) pcache_params.page_size) {
+			LogInfo(COMPONENT_FSAL,
+				"Could not write SSD cache: %s",
+				written < 0 ? strerror(errno) : "short write");
+			pcache.free_slots[pcache.nr_free++] = slot;
+			/* Back on the list for pcache_page_drop */
+			glist_add(&pcache.ram_lru, &victim->lru);
+			pcache.ram_pages++;
+			if (pcache_page_drop(victim))
+				put2 = file;
+		} else {
+			gsh_free(victim->data);
+			victim->data = NULL;
+			victim->slot = slot;
+			glist_add(&pcache.ssd_lru, &victim->lru);
+		}
+		PTHREAD_MUTEX_unlock(&pcache.lock);
+
+unlock:
+		PTHREAD_RWLOCK_unlock(&file->lock);
+		if (put1 != NULL)
+			pcache_file_put(put1);
+		if (put2 != NULL)
+			pcache_file_put(put2);
+	}
+}
+
+/* Bring a page back from SSD, with the file write locked.  A page that
+ * can't be read back is dropped, *last tells if it was the file's last.
+ */
+static bool pcache_page_promote(struct pcache_page *page, bool *last)
+{
+	char *data = gsh_malloc(pcache_params.page_size);
+	ssize_t got;
+
+	got = pread(pcache.ssd_fd, data, page->valid,
+		    (off_t) page->slot * pcache_params.page_size);
+
+	PTHREAD_MUTEX_lock(&pcache.lock);
+
+	if (got != (ssize_t) page->valid) {
+		LogInfo(COMPONENT_FSAL,
+			"Could not read SSD cache: %s",
+			got < 0 ? strerror(errno) : "short read");
+		*last = pcache_page_drop(page);
+		PTHREAD_MUTEX_unlock(&pcache.lock);
+		gsh_free(data);
+		return false;
+	}
+
+	pcache.free_slots[pcache.nr_free++] = page->slot;
+	page->data = data;
+	glist_del(&page->lru);
+	glist_add(&pcache.ram_lru, &page->lru);
+	pcache.ram_pages++;
+
+	PTHREAD_MUTEX_unlock(&pcache.lock);
+
+	return true;
+}
+
+/**
+ * @brief Copy out of a cached page
+ *
+ * @return Bytes copied, or -1 if the page is not in RAM.
+ */
+static ssize_t pcache_page_copy(struct pcache_page *page, uint32_t off,
+				char *buf, size_t len, bool *eof)
+{
+	size_t n;
+
+	if (page->data == NULL)
+		return -1;
+
+	n = off < page->valid ? MIN(len, page->valid - off) : 0;
+	memcpy(buf, page->data + off, n);
+	*eof = page->eof && off + n >= page->valid;
+	if (!page->referenced)
+		page->referenced = true;
+
+	return n;
+}
+
+/* Read one page from the sub fsal and cache it */
+static fsal_status_t pcache_page_fill(struct pcache_fsal_obj_handle *handle,
+				      bool bypass, struct state_t *state,
+				      uint64_t index, uint32_t off,
+				      char *buf, size_t len, size_t *copied,
+				      bool *eof)
+{
+	struct pcache_file *file = handle->file;
+	struct pcache_fsal_export *export =
+		container_of(op_ctx->fsal_export, struct pcache_fsal_export,
+			     export);
+	struct pcache_page *page, *old;
+	fsal_status_t status;
+	size_t read_amount = 0;
+	bool sub_eof = false;
+	bool first = false;
+	uint64_t gen;
+
+	PTHREAD_RWLOCK_rdlock(&file->lock);
+	gen = file->gen;
+	PTHREAD_RWLOCK_unlock(&file->lock);
+
+	page = gsh_calloc(1, sizeof(*page));
+	page->data = gsh_malloc(pcache_params.page_size);
+	page->file = file;
+	page->index = index;
+
+	op_ctx->fsal_export = export->export.sub_export;
+	status = handle->sub_handle->obj_ops.read2(
+			handle->sub_handle, bypass, state,
+			index * pcache_params.page_size,
+			pcache_params.page_size, page->data, &read_amount,
+			&sub_eof, NULL);
+	op_ctx->fsal_export = &export->export;
+
+	if (FSAL_IS_ERROR(status)) {
+		gsh_free(page->data);
+		gsh_free(page);
+		return status;
+	}
+
+	page->valid = read_amount;
+	page->eof = sub_eof || read_amount < pcache_params.page_size;
+
+	*copied = off < page->valid ? MIN(len, page->valid - off) : 0;
+	memcpy(buf, page->data + off, *copied);
+	*eof = page->eof && off + *copied >= page->valid;
+
+	PTHREAD_RWLOCK_wrlock(&file->lock);
+
+	/* Don't cache what an invalidation or write raced with */
+	if (file->gen != gen ||
+	    (page->eof && file->eof_index != UINT64_MAX &&
+	     file->eof_index != index)) {
+		PTHREAD_RWLOCK_unlock(&file->lock);
+		gsh_free(page->data);
+		gsh_free(page);
+		return status;
+	}
+
+	old = pcache_page_lookup(file, index);
+	if (old != NULL) {
+		/* Another reader got here first */
+		PTHREAD_RWLOCK_unlock(&file->lock);
+		gsh_free(page->data);
+		gsh_free(page);
+		return status;
+	}
+
+	avltree_insert(&page->node_k, &file->pages);
+	if (page->eof)
+		file->eof_index = index;
+	first = file->nr_pages++ == 0;
+
+	PTHREAD_MUTEX_lock(&pcache.lock);
+	glist_add(&pcache.ram_lru, &page->lru);
+	pcache.ram_pages++;
+	PTHREAD_MUTEX_unlock(&pcache.lock);
+
+	/* The pages hold a reference on their file */
+	if (first)
+		atomic_inc_int32_t(&file->refcnt);
+
+	PTHREAD_RWLOCK_unlock(&file->lock);
+
+	pcache_reclaim();
+
+	return status;
+}
+
+/**
+ * @brief Read through the data cache
+ *
+ * Same arguments as read2.  READ_PLUS reads do not come here.
+ */
+fsal_status_t pcache_file_read(struct pcache_fsal_obj_handle *handle,
+			       bool bypass, struct state_t *state,
+			       uint64_t offset, size_t buf_size, void *buffer,
+			       size_t *read_amount, bool *eof)
+{
+	struct pcache_file *file = handle->file;
+	fsal_status_t status = fsalstat(ERR_FSAL_NO_ERROR, 0);
+	char *buf = buffer;
+	size_t done = 0;
+	bool page_eof = false;
+
+	while (done < buf_size && !page_eof) {
+		uint64_t index = (offset + done) / pcache_params.page_size;
+		uint32_t off = (offset + done) % pcache_params.page_size;
+		struct pcache_page *page;
+		ssize_t n = -1;
+
+		PTHREAD_RWLOCK_rdlock(&file->lock);
+		page = pcache_page_lookup(file, index);
+		if (page != NULL)
+			n = pcache_page_copy(page, off, buf + done,
+					     buf_size - done, &page_eof);
+		PTHREAD_RWLOCK_unlock(&file->lock);
+
+		if (n < 0 && page != NULL) {
+			bool last = false;
+
+			/* On SSD, bring it back */
+			PTHREAD_RWLOCK_wrlock(&file->lock);
+			page = pcache_page_lookup(file, index);
+			if (page != NULL && (page->data != NULL ||
+					     pcache_page_promote(page, &last)))
+				n = pcache_page_copy(page, off, buf + done,
+						     buf_size - done,
+						     &page_eof);
+			PTHREAD_RWLOCK_unlock(&file->lock);
+			if (last)
+				pcache_file_put(file);
+			if (n >= 0)
+				pcache_reclaim();
+		}
+
+		if (n < 0) {
+			size_t copied;
+
+			status = pcache_page_fill(handle, bypass, state, index,
+						  off, buf + done,
+						  buf_size - done, &copied,
+						  &page_eof);
+			if (FSAL_IS_ERROR(status)) {
+				/* Return what we have, if anything */
+				if (done != 0)
+					status = fsalstat(ERR_FSAL_NO_ERROR, 0);
+				break;
+			}
+			n = copied;
+		}
+
+		done += n;
+		if (n == 0)
+			page_eof = true;
+	}
+
+	*read_amount = done;
+	*eof = page_eof;
+
+	return status;
+}
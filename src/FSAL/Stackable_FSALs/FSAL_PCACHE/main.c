@@ -0,0 +1,218 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Panasas Inc., 2011
+ * Author: Jim Lieb jlieb@panasas.com
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *                Thomas LEIBOVICI  thomas.leibovici@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* main.c
+ * Module core functions
+ */
+
+#include "config.h"
+
+#include "fsal.h"
+#include <libgen.h>		/* used for 'dirname' */
+#include <pthread.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/types.h>
+#include "gsh_list.h"
+#include "FSAL/fsal_init.h"
+#include "pcache_methods.h"
+
+/* PCACHE FSAL module private storage
+ */
+
+struct pcache_fsal_module {
+	struct fsal_module fsal;
+	struct fsal_staticfsinfo_t fs_info;
+	/* pcachefs_specific_initinfo_t specific_info;  placeholder */
+};
+
+/* FSAL name determines name of shared library: libfsal<name>.so */
+const char myname[] = "PCACHE";
+
+/* filesystem info for PCACHE */
+static struct fsal_staticfsinfo_t default_posix_info = {
+	.maxfilesize = UINT64_MAX,
+	.maxlink = _POSIX_LINK_MAX,
+	.maxnamelen = 1024,
+	.maxpathlen = 1024,
+	.no_trunc = true,
+	.chown_restricted = true,
+	.case_insensitive = false,
+	.case_preserving = true,
+	.link_support = true,
+	.symlink_support = true,
+	.lock_support = true,
+	.lock_support_owner = false,
+	.lock_support_async_block = false,
+	.named_attr = true,
+	.unique_handles = true,
+	.lease_time = {10, 0},
+	.acl_support = FSAL_ACLSUPPORT_ALLOW,
+	.cansettime = true,
+	.homogenous = true,
+	.supported_attrs = ALL_ATTRIBUTES,
+	.maxread = FSAL_MAXIOSIZE,
+	.maxwrite = FSAL_MAXIOSIZE,
+	.umask = 0,
+	.auth_exportpath_xdev = false,
+	.xattr_access_rights = 0400,	/* root=RW, owner=R */
+	.link_supports_permission_checks = true,
+};
+
+struct pcache_params pcache_params;
+
+static struct config_item pcache_items[] = {
+	CONF_ITEM_UI32("Page_Size", 4096, 1024 * 1024, 65536,
+		       pcache_params, page_size),
+	CONF_ITEM_UI64("Cache_Size", 0, UINT64_MAX, 256 * 1024 * 1024,
+		       pcache_params, cache_size),
+	CONF_ITEM_PATH("Ssd_Cache_Path", 1, MAXPATHLEN, NULL,
+		       pcache_params, ssd_path),
+	CONF_ITEM_UI64("Ssd_Cache_Size", 0, UINT64_MAX, 0,
+		       pcache_params, ssd_size),
+	CONFIG_EOL
+};
+
+static struct config_block pcache_block = {
+	.dbus_interface_name = "org.ganesha.nfsd.config.fsal.pcache",
+	.blk_desc.name = "PCACHE",
+	.blk_desc.type = CONFIG_BLOCK,
+	.blk_desc.u.blk.init = noop_conf_init,
+	.blk_desc.u.blk.params = pcache_items,
+	.blk_desc.u.blk.commit = noop_conf_commit
+};
+
+/* private helper for export object
+ */
+
+struct fsal_staticfsinfo_t *pcache_staticinfo(struct fsal_module *hdl)
+{
+	struct pcache_fsal_module *myself;
+
+	myself = container_of(hdl, struct pcache_fsal_module, fsal);
+	return &myself->fs_info;
+}
+
+/* Module methods
+ */
+
+/* init_config
+ * must be called with a reference taken (via lookup_fsal)
+ */
+
+static fsal_status_t init_config(struct fsal_module *fsal_hdl,
+				 config_file_t config_struct,
+				 struct config_error_type *err_type)
+{
+	struct pcache_fsal_module *pcache_me =
+	    container_of(fsal_hdl, struct pcache_fsal_module, fsal);
+
+	/* get a copy of the defaults */
+	pcache_me->fs_info = default_posix_info;
+
+	/* The data cache is shared by all PCACHE exports, so its
+	 * parameters are the module's.
+	 */
+	(void) load_config_from_parse(config_struct,
+				      &pcache_block,
+				      &pcache_params,
+				      true,
+				      err_type);
+	if (!config_error_is_harmless(err_type))
+		return fsalstat(ERR_FSAL_INVAL, 0);
+
+	pcache_pkginit();
+
+	display_fsinfo(&pcache_me->fs_info);
+	LogFullDebug(COMPONENT_FSAL,
+		     "Supported attributes default = 0x%" PRIx64,
+		     default_posix_info.supported_attrs);
+	LogDebug(COMPONENT_FSAL,
+		 "FSAL INIT: Supported attributes mask = 0x%" PRIx64,
+		 pcache_me->fs_info.supported_attrs);
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/* Internal PCACHE method linkage to export object
+ */
+
+fsal_status_t pcache_create_export(struct fsal_module *fsal_hdl,
+				   void *parse_node,
+				   struct config_error_type *err_type,
+				   const struct fsal_up_vector *up_ops);
+
+/* Module initialization.
+ * Called by dlopen() to register the module
+ * keep a private pointer to me in myself
+ */
+
+/* my module private storage
+ */
+
+static struct pcache_fsal_module PCACHE;
+struct next_ops next_ops;
+
+static bool pcache_support_ex(struct fsal_obj_handle *obj_hdl)
+{
+	struct pcache_fsal_obj_handle *handle =
+		container_of(obj_hdl, struct pcache_fsal_obj_handle,
+			     obj_handle);
+
+	return handle->sub_handle->fsal->m_ops.support_ex(handle->sub_handle);
+}
+
+
+/* linkage to the exports and handle ops initializers
+ */
+MODULE_INIT void pcache_init(void)
+{
+	int retval;
+	struct fsal_module *myself = &PCACHE.fsal;
+
+	retval = register_fsal(myself, myname, FSAL_MAJOR_VERSION,
+			       FSAL_MINOR_VERSION, FSAL_ID_NO_PNFS);
+	if (retval != 0) {
+		fprintf(stderr, "PCACHE module failed to register");
+		return;
+	}
+	myself->m_ops.create_export = pcache_create_export;
+	myself->m_ops.init_config = init_config;
+	myself->m_ops.support_ex = pcache_support_ex;
+}
+
+MODULE_FINI void pcache_unload(void)
+{
+	int retval;
+
+	retval = unregister_fsal(&PCACHE.fsal);
+	if (retval != 0) {
+		fprintf(stderr, "PCACHE module failed to unregister");
+		return;
+	}
+
+	pcache_pkgshutdown();
+}
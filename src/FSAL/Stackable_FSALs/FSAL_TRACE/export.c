@@ -0,0 +1,628 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Panasas Inc., 2011
+ * Author: Jim Lieb jlieb@panasas.com
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *                Thomas LEIBOVICI  thomas.leibovici@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* export.c
+ * TRACE FSAL export object
+ */
+
+#include "config.h"
+
+#include "fsal.h"
+#include <libgen.h>		/* used for 'dirname' */
+#include <pthread.h>
+#include <string.h>
+#include <sys/types.h>
+#include <os/mntent.h>
+#include <os/quota.h>
+#include <dlfcn.h>
+#include "gsh_list.h"
+#include "config_parsing.h"
+#include "fsal_convert.h"
+#include "FSAL/fsal_commonlib.h"
+#include "FSAL/fsal_config.h"
+#include "tracefs_methods.h"
+#include "nfs_exports.h"
+#include "export_mgr.h"
+
+/* helpers to/from other TRACE objects
+ */
+
+struct fsal_staticfsinfo_t *tracefs_staticinfo(struct fsal_module *hdl);
+
+/* export object methods
+ */
+
+static void release(struct fsal_export *exp_hdl)
+{
+	struct tracefs_fsal_export *myself;
+	struct fsal_module *sub_fsal;
+
+	myself = container_of(exp_hdl, struct tracefs_fsal_export, export);
+	sub_fsal = myself->export.sub_export->fsal;
+
+	/* Release the sub_export */
+	myself->export.sub_export->exp_ops.release(myself->export.sub_export);
+	fsal_put(sub_fsal);
+
+	fsal_detach_export(exp_hdl->fsal, &exp_hdl->exports);
+	free_export_ops(exp_hdl);
+
+	tracefs_export_fini(myself);
+	gsh_free(myself);	/* elvis has left the building */
+}
+
+static fsal_status_t get_dynamic_info(struct fsal_export *exp_hdl,
+				      struct fsal_obj_handle *obj_hdl,
+				      fsal_dynamicfsinfo_t *infop)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_fsal_obj_handle *handle =
+		container_of(obj_hdl, struct tracefs_fsal_obj_handle,
+			     obj_handle);
+
+	/* calling subfsal method */
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_GET_FS_DYNAMIC_INFO, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	fsal_status_t status = op_ctx->fsal_export->exp_ops.get_fs_dynamic_info(
+		op_ctx->fsal_export, handle->sub_handle, infop);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, status.major);
+
+	return status;
+}
+
+static bool fs_supports(struct fsal_export *exp_hdl,
+			fsal_fsinfo_options_t option)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FS_SUPPORTS, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	bool result =
+		exp->export.sub_export->exp_ops.fs_supports(
+				exp->export.sub_export, option);
+
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return result;
+}
+
+static uint64_t fs_maxfilesize(struct fsal_export *exp_hdl)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FS_MAXFILESIZE, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	uint64_t result =
+		exp->export.sub_export->exp_ops.fs_maxfilesize(
+				exp->export.sub_export);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return result;
+}
+
+static uint32_t fs_maxread(struct fsal_export *exp_hdl)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FS_MAXREAD, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	uint32_t result = exp->export.sub_export->exp_ops.fs_maxread(
+				exp->export.sub_export);
+
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return result;
+}
+
+static uint32_t fs_maxwrite(struct fsal_export *exp_hdl)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FS_MAXWRITE, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	uint32_t result = exp->export.sub_export->exp_ops.fs_maxwrite(
+				exp->export.sub_export);
+
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return result;
+}
+
+static uint32_t fs_maxlink(struct fsal_export *exp_hdl)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FS_MAXLINK, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	uint32_t result = exp->export.sub_export->exp_ops.fs_maxlink(
+				exp->export.sub_export);
+
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return result;
+}
+
+static uint32_t fs_maxnamelen(struct fsal_export *exp_hdl)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FS_MAXNAMELEN, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	uint32_t result =
+		exp->export.sub_export->exp_ops.fs_maxnamelen(
+				exp->export.sub_export);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return result;
+}
+
+static uint32_t fs_maxpathlen(struct fsal_export *exp_hdl)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FS_MAXPATHLEN, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	uint32_t result =
+		exp->export.sub_export->exp_ops.fs_maxpathlen(
+				exp->export.sub_export);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return result;
+}
+
+static struct timespec fs_lease_time(struct fsal_export *exp_hdl)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FS_LEASE_TIME, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	struct timespec result = exp->export.sub_export->exp_ops.fs_lease_time(
+		exp->export.sub_export);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return result;
+}
+
+static fsal_aclsupp_t fs_acl_support(struct fsal_export *exp_hdl)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FS_ACL_SUPPORT, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	fsal_aclsupp_t result = exp->export.sub_export->exp_ops.fs_acl_support(
+		exp->export.sub_export);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return result;
+}
+
+static attrmask_t fs_supported_attrs(struct fsal_export *exp_hdl)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FS_SUPPORTED_ATTRS, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	attrmask_t result =
+		exp->export.sub_export->exp_ops.fs_supported_attrs(
+		exp->export.sub_export);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return result;
+}
+
+static uint32_t fs_umask(struct fsal_export *exp_hdl)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FS_UMASK, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	uint32_t result = exp->export.sub_export->exp_ops.fs_umask(
+				exp->export.sub_export);
+
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return result;
+}
+
+static uint32_t fs_xattr_access_rights(struct fsal_export *exp_hdl)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FS_XATTR_ACCESS_RIGHTS, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	uint32_t result =
+		exp->export.sub_export->exp_ops.fs_xattr_access_rights(
+				exp->export.sub_export);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return result;
+}
+
+/* get_quota
+ * return quotas for this export.
+ * path could cross a lower mount boundary which could
+ * mask lower mount values with those of the export root
+ * if this is a real issue, we can scan each time with setmntent()
+ * better yet, compare st_dev of the file with st_dev of root_fd.
+ * on linux, can map st_dev -> /proc/partitions name -> /dev/<name>
+ */
+
+static fsal_status_t get_quota(struct fsal_export *exp_hdl,
+			       const char *filepath, int quota_type,
+			       int quota_id,
+			       fsal_quota_t *pquota)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_GET_QUOTA, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	fsal_status_t result =
+		exp->export.sub_export->exp_ops.get_quota(
+			exp->export.sub_export, filepath,
+			quota_type, quota_id, pquota);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, result.major);
+
+	return result;
+}
+
+/* set_quota
+ * same lower mount restriction applies
+ */
+
+static fsal_status_t set_quota(struct fsal_export *exp_hdl,
+			       const char *filepath, int quota_type,
+			       int quota_id,
+			       fsal_quota_t *pquota, fsal_quota_t *presquota)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_SET_QUOTA, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	fsal_status_t result =
+		exp->export.sub_export->exp_ops.set_quota(
+			exp->export.sub_export, filepath, quota_type, quota_id,
+			pquota, presquota);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, result.major);
+
+	return result;
+}
+
+static struct state_t *tracefs_alloc_state(struct fsal_export *exp_hdl,
+					   enum state_type state_type,
+					   struct state_t *related_state)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_ALLOC_STATE, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	state_t *state =
+		exp->export.sub_export->exp_ops.alloc_state(
+			exp->export.sub_export, state_type, related_state);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	/* Replace stored export with ours so stacking works */
+	state->state_exp = exp_hdl;
+
+	return state;
+}
+
+static void tracefs_free_state(struct fsal_export *exp_hdl,
+			       struct state_t *state)
+{
+	struct tracefs_fsal_export *exp = container_of(exp_hdl,
+					struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_FREE_STATE, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	exp->export.sub_export->exp_ops.free_state(exp->export.sub_export,
+						   state);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+}
+
+static bool tracefs_is_superuser(struct fsal_export *exp_hdl,
+				 const struct user_cred *creds)
+{
+	struct tracefs_fsal_export *exp = container_of(exp_hdl,
+					struct tracefs_fsal_export, export);
+	bool rv;
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_IS_SUPERUSER, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	rv = exp->export.sub_export->exp_ops.is_superuser(
+					exp->export.sub_export, creds);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, ERR_FSAL_NO_ERROR);
+
+	return rv;
+}
+
+
+/* extract a file handle from a buffer.
+ * do verification checks and flag any and all suspicious bits.
+ * Return an updated fh_desc into whatever was passed.  The most
+ * common behavior, done here is to just reset the length.
+ */
+
+static fsal_status_t wire_to_host(struct fsal_export *exp_hdl,
+				    fsal_digesttype_t in_type,
+				    struct gsh_buffdesc *fh_desc,
+				    int flags)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_WIRE_TO_HOST, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	fsal_status_t result =
+		exp->export.sub_export->exp_ops.wire_to_host(
+			exp->export.sub_export, in_type, fh_desc, flags);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, result.major);
+
+	return result;
+}
+
+static fsal_status_t tracefs_host_to_key(struct fsal_export *exp_hdl,
+					  struct gsh_buffdesc *fh_desc)
+{
+	struct tracefs_fsal_export *exp =
+		container_of(exp_hdl, struct tracefs_fsal_export, export);
+
+	struct tracefs_call call =
+		tracefs_begin(exp, TRACEFS_OP_HOST_TO_KEY, NULL);
+	op_ctx->fsal_export = exp->export.sub_export;
+	fsal_status_t result =
+		exp->export.sub_export->exp_ops.host_to_key(
+			exp->export.sub_export, fh_desc);
+	op_ctx->fsal_export = &exp->export;
+	tracefs_end(&call, result.major);
+
+	return result;
+}
+
+/* tracefs_export_ops_init
+ * overwrite vector entries with the methods that we support
+ */
+
+void tracefs_export_ops_init(struct export_ops *ops)
+{
+	ops->release = release;
+	ops->lookup_path = tracefs_lookup_path;
+	ops->wire_to_host = wire_to_host;
+	ops->host_to_key = tracefs_host_to_key;
+	ops->create_handle = tracefs_create_handle;
+	ops->get_fs_dynamic_info = get_dynamic_info;
+	ops->fs_supports = fs_supports;
+	ops->fs_maxfilesize = fs_maxfilesize;
+	ops->fs_maxread = fs_maxread;
+	ops->fs_maxwrite = fs_maxwrite;
+	ops->fs_maxlink = fs_maxlink;
+	ops->fs_maxnamelen = fs_maxnamelen;
+	ops->fs_maxpathlen = fs_maxpathlen;
+	ops->fs_lease_time = fs_lease_time;
+	ops->fs_acl_support = fs_acl_support;
+	ops->fs_supported_attrs = fs_supported_attrs;
+	ops->fs_umask = fs_umask;
+	ops->fs_xattr_access_rights = fs_xattr_access_rights;
+	ops->get_quota = get_quota;
+	ops->set_quota = set_quota;
+	ops->alloc_state = tracefs_alloc_state;
+	ops->free_state = tracefs_free_state;
+	ops->is_superuser = tracefs_is_superuser;
+}
+
+struct tracefsal_args {
+	struct subfsal_args subfsal;
+	uint32_t slow_usec;
+	uint32_t slow_ring_size;
+};
+
+static struct config_item sub_fsal_params[] = {
+	CONF_ITEM_STR("name", 1, 10, NULL,
+		      subfsal_args, name),
+	CONFIG_EOL
+};
+
+static struct config_item export_params[] = {
+	CONF_ITEM_NOOP("name"),
+	CONF_RELAX_BLOCK("FSAL", sub_fsal_params,
+			 noop_conf_init, subfsal_commit,
+			 tracefsal_args, subfsal),
+	CONF_ITEM_UI32("Slow_Threshold_Usec", 0, UINT32_MAX, 10000,
+		       tracefsal_args, slow_usec),
+	CONF_ITEM_UI32("Slow_Ring_Size", 0, 65536, 256,
+		       tracefsal_args, slow_ring_size),
+	CONFIG_EOL
+};
+
+static struct config_block export_param = {
+	.dbus_interface_name = "org.ganesha.nfsd.config.fsal.tracefs-export%d",
+	.blk_desc.name = "FSAL",
+	.blk_desc.type = CONFIG_BLOCK,
+	.blk_desc.u.blk.init = noop_conf_init,
+	.blk_desc.u.blk.params = export_params,
+	.blk_desc.u.blk.commit = noop_conf_commit
+};
+
+/* create_export
+ * Create an export point and return a handle to it to be kept
+ * in the export list.
+ * First lookup the fsal, then create the export and then put the fsal back.
+ * returns the export with one reference taken.
+ */
+
+fsal_status_t tracefs_create_export(struct fsal_module *fsal_hdl,
+				    void *parse_node,
+				    struct config_error_type *err_type,
+				    const struct fsal_up_vector *up_ops)
+{
+	fsal_status_t expres;
+	struct fsal_module *fsal_stack;
+	struct tracefs_fsal_export *myself;
+	struct tracefsal_args tracefsal;
+	int retval;
+
+	/* process our FSAL block to get the name of the fsal
+	 * underneath us.
+	 */
+	retval = load_config_from_node(parse_node,
+				       &export_param,
+				       &tracefsal,
+				       true,
+				       err_type);
+	if (retval != 0)
+		return fsalstat(ERR_FSAL_INVAL, 0);
+	fsal_stack = lookup_fsal(tracefsal.subfsal.name);
+	if (fsal_stack == NULL) {
+		LogMajor(COMPONENT_FSAL,
+			 "tracefs_create_export: failed to lookup for FSAL %s",
+			 tracefsal.subfsal.name);
+		return fsalstat(ERR_FSAL_INVAL, EINVAL);
+	}
+
+	myself = gsh_calloc(1, sizeof(struct tracefs_fsal_export));
+	expres = fsal_stack->m_ops.create_export(fsal_stack,
+						 tracefsal.subfsal.fsal_node,
+						 err_type,
+						 up_ops);
+	fsal_put(fsal_stack);
+	if (FSAL_IS_ERROR(expres)) {
+		LogMajor(COMPONENT_FSAL,
+			 "Failed to call create_export on underlying FSAL %s",
+			 tracefsal.subfsal.name);
+		gsh_free(myself);
+		return expres;
+	}
+
+	fsal_export_stack(op_ctx->fsal_export, &myself->export);
+
+	/* Init next_ops structure */
+	/*** FIX ME!!!
+	 * This structure had 3 mallocs that were never freed,
+	 * and would leak for every export created.
+	 * Now static to avoid the leak, the saved contents were
+	 * never restored back to the original.
+	 */
+
+	memcpy(&next_ops.exp_ops,
+	       &myself->export.sub_export->exp_ops,
+	       sizeof(struct export_ops));
+#ifdef EXPORT_OPS_INIT
+	/*** FIX ME!!!
+	 * Need to iterate through the lists to save and restore.
+	 */
+	memcpy(&next_ops.obj_ops,
+	       myself->export.sub_export->obj_ops,
+	       sizeof(struct fsal_obj_ops));
+	memcpy(&next_ops.dsh_ops,
+	       myself->export.sub_export->dsh_ops,
+	       sizeof(struct fsal_dsh_ops));
+#endif				/* EXPORT_OPS_INIT */
+	next_ops.up_ops = up_ops;
+
+	fsal_export_init(&myself->export);
+	tracefs_export_ops_init(&myself->export.exp_ops);
+	tracefs_export_init(myself, tracefsal.slow_usec,
+			    tracefsal.slow_ring_size);
+#ifdef EXPORT_OPS_INIT
+	/*** FIX ME!!!
+	 * Need to iterate through the lists to save and restore.
+	 */
+	tracefs_handle_ops_init(myself->export.obj_ops);
+#endif				/* EXPORT_OPS_INIT */
+	myself->export.up_ops = up_ops;
+	myself->export.fsal = fsal_hdl;
+
+	/* The D-Bus stats dump walks the exports of the module */
+	PTHREAD_RWLOCK_wrlock(&fsal_hdl->lock);
+	retval = fsal_attach_export(fsal_hdl, &myself->export.exports);
+	PTHREAD_RWLOCK_unlock(&fsal_hdl->lock);
+	if (retval != 0)
+		LogMajor(COMPONENT_FSAL,
+			 "Failed to attach export %d, it will not be reported",
+			 myself->export.export_id);
+
+	/* lock myself before attaching to the fsal.
+	 * keep myself locked until done with creating myself.
+	 */
+	op_ctx->fsal_export = &myself->export;
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
@@ -0,0 +1,206 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Panasas Inc., 2011
+ * Author: Jim Lieb jlieb@panasas.com
+ *
+ * contributeur : Philippe DENIEL   philippe.deniel@cea.fr
+ *                Thomas LEIBOVICI  thomas.leibovici@cea.fr
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* main.c
+ * Module core functions
+ */
+
+#include "config.h"
+
+#include "fsal.h"
+#include <libgen.h>		/* used for 'dirname' */
+#include <pthread.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/types.h>
+#include "gsh_list.h"
+#include "FSAL/fsal_init.h"
+#include "tracefs_methods.h"
+
+/* TRACEFS FSAL module private storage
+ */
+
+struct tracefs_fsal_module {
+	struct fsal_module fsal;
+	struct fsal_staticfsinfo_t fs_info;
+	/* tracefsfs_specific_initinfo_t specific_info;  placeholder */
+};
+
+/* FSAL name determines name of shared library: libfsal<name>.so */
+const char myname[] = "TRACE";
+
+/* filesystem info for TRACEFS */
+static struct fsal_staticfsinfo_t default_posix_info = {
+	.maxfilesize = UINT64_MAX,
+	.maxlink = _POSIX_LINK_MAX,
+	.maxnamelen = 1024,
+	.maxpathlen = 1024,
+	.no_trunc = true,
+	.chown_restricted = true,
+	.case_insensitive = false,
+	.case_preserving = true,
+	.link_support = true,
+	.symlink_support = true,
+	.lock_support = true,
+	.lock_support_owner = false,
+	.lock_support_async_block = false,
+	.named_attr = true,
+	.unique_handles = true,
+	.lease_time = {10, 0},
+	.acl_support = FSAL_ACLSUPPORT_ALLOW,
+	.cansettime = true,
+	.homogenous = true,
+	.supported_attrs = ALL_ATTRIBUTES,
+	.maxread = FSAL_MAXIOSIZE,
+	.maxwrite = FSAL_MAXIOSIZE,
+	.umask = 0,
+	.auth_exportpath_xdev = false,
+	.xattr_access_rights = 0400,	/* root=RW, owner=R */
+	.link_supports_permission_checks = true,
+};
+
+/* private helper for export object
+ */
+
+struct fsal_staticfsinfo_t *tracefs_staticinfo(struct fsal_module *hdl)
+{
+	struct tracefs_fsal_module *myself;
+
+	myself = container_of(hdl, struct tracefs_fsal_module, fsal);
+	return &myself->fs_info;
+}
+
+/* Module methods
+ */
+
+/* init_config
+ * must be called with a reference taken (via lookup_fsal)
+ */
+
+static fsal_status_t init_config(struct fsal_module *fsal_hdl,
+				 config_file_t config_struct,
+				 struct config_error_type *err_type)
+{
+	struct tracefs_fsal_module *tracefs_me =
+	    container_of(fsal_hdl, struct tracefs_fsal_module, fsal);
+
+	/* get a copy of the defaults */
+	tracefs_me->fs_info = default_posix_info;
+
+	/* Configuration setting options:
+	 * 1. there are none that are changeable. (this case)
+	 *
+	 * 2. we set some here.  These must be independent of whatever
+	 *    may be set by lower level fsals.
+	 *
+	 * If there is any filtering or change of parameters in the stack,
+	 * this must be done in export data structures, not fsal params because
+	 * a stackable could be configured above multiple fsals for multiple
+	 * diverse exports.
+	 */
+
+	display_fsinfo(&tracefs_me->fs_info);
+	LogFullDebug(COMPONENT_FSAL,
+		     "Supported attributes default = 0x%" PRIx64,
+		     default_posix_info.supported_attrs);
+	LogDebug(COMPONENT_FSAL,
+		 "FSAL INIT: Supported attributes mask = 0x%" PRIx64,
+		 tracefs_me->fs_info.supported_attrs);
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/* Internal TRACEFS method linkage to export object
+ */
+
+fsal_status_t tracefs_create_export(struct fsal_module *fsal_hdl,
+				    void *parse_node,
+				    struct config_error_type *err_type,
+				    const struct fsal_up_vector *up_ops);
+
+/* Module initialization.
+ * Called by dlopen() to register the module
+ * keep a private pointer to me in myself
+ */
+
+/* my module private storage
+ */
+
+static struct tracefs_fsal_module TRACEFS;
+struct next_ops next_ops;
+
+#ifdef USE_DBUS
+/* Only tells GetFSALStats and ResetStats that we keep stats, the
+ * counters themselves are per export.
+ */
+static struct fsal_stats tracefs_stats = {
+	.total_ops = TRACEFS_OP_COUNT,
+};
+#endif
+
+static bool tracefs_support_ex(struct fsal_obj_handle *obj_hdl)
+{
+	struct tracefs_fsal_obj_handle *handle =
+		container_of(obj_hdl, struct tracefs_fsal_obj_handle,
+			     obj_handle);
+
+	return handle->sub_handle->fsal->m_ops.support_ex(handle->sub_handle);
+}
+
+
+/* linkage to the exports and handle ops initializers
+ */
+MODULE_INIT void tracefs_init(void)
+{
+	int retval;
+	struct fsal_module *myself = &TRACEFS.fsal;
+
+	retval = register_fsal(myself, myname, FSAL_MAJOR_VERSION,
+			       FSAL_MINOR_VERSION, FSAL_ID_NO_PNFS);
+	if (retval != 0) {
+		fprintf(stderr, "TRACEFS module failed to register");
+		return;
+	}
+	myself->m_ops.create_export = tracefs_create_export;
+	myself->m_ops.init_config = init_config;
+	myself->m_ops.support_ex = tracefs_support_ex;
+#ifdef USE_DBUS
+	myself->m_ops.fsal_extract_stats = tracefs_extract_stats;
+	myself->m_ops.fsal_reset_stats = tracefs_reset_stats;
+	myself->stats = &tracefs_stats;
+#endif
+}
+
+MODULE_FINI void tracefs_unload(void)
+{
+	int retval;
+
+	retval = unregister_fsal(&TRACEFS.fsal);
+	if (retval != 0) {
+		fprintf(stderr, "TRACEFS module failed to unregister");
+		return;
+	}
+}
@@ -0,0 +1,400 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* trace.c
+ * TRACE FSAL latency accounting
+ *
+ * Every call into the sub FSAL is timed and added to a per export,
+ * per operation histogram.  Calls slower than the configured threshold
+ * are also kept, with their arguments, in a ring of recent slow calls.
+ * Both are dumped by the GetFSALStats D-Bus method for FSAL "TRACE"
+ * and cleared by ResetStats.
+ */
+
+#include "config.h"
+
+#include "fsal.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include "gsh_list.h"
+#include "abstract_atomic.h"
+#include "common_utils.h"
+#include "FSAL/fsal_commonlib.h"
+#ifdef USE_DBUS
+#include "gsh_dbus.h"
+#endif
+#include "tracefs_methods.h"
+
+const char *tracefs_op_names[TRACEFS_OP_COUNT] = {
+	[TRACEFS_OP_GET_FS_DYNAMIC_INFO] = "get_fs_dynamic_info",
+	[TRACEFS_OP_FS_SUPPORTS] = "fs_supports",
+	[TRACEFS_OP_FS_MAXFILESIZE] = "fs_maxfilesize",
+	[TRACEFS_OP_FS_MAXREAD] = "fs_maxread",
+	[TRACEFS_OP_FS_MAXWRITE] = "fs_maxwrite",
+	[TRACEFS_OP_FS_MAXLINK] = "fs_maxlink",
+	[TRACEFS_OP_FS_MAXNAMELEN] = "fs_maxnamelen",
+	[TRACEFS_OP_FS_MAXPATHLEN] = "fs_maxpathlen",
+	[TRACEFS_OP_FS_LEASE_TIME] = "fs_lease_time",
+	[TRACEFS_OP_FS_ACL_SUPPORT] = "fs_acl_support",
+	[TRACEFS_OP_FS_SUPPORTED_ATTRS] = "fs_supported_attrs",
+	[TRACEFS_OP_FS_UMASK] = "fs_umask",
+	[TRACEFS_OP_FS_XATTR_ACCESS_RIGHTS] = "fs_xattr_access_rights",
+	[TRACEFS_OP_GET_QUOTA] = "get_quota",
+	[TRACEFS_OP_SET_QUOTA] = "set_quota",
+	[TRACEFS_OP_ALLOC_STATE] = "alloc_state",
+	[TRACEFS_OP_FREE_STATE] = "free_state",
+	[TRACEFS_OP_IS_SUPERUSER] = "is_superuser",
+	[TRACEFS_OP_WIRE_TO_HOST] = "wire_to_host",
+	[TRACEFS_OP_HOST_TO_KEY] = "host_to_key",
+	[TRACEFS_OP_OPEN] = "open",
+	[TRACEFS_OP_STATUS] = "status",
+	[TRACEFS_OP_READ] = "read",
+	[TRACEFS_OP_WRITE] = "write",
+	[TRACEFS_OP_COMMIT] = "commit",
+	[TRACEFS_OP_LOCK_OP] = "lock_op",
+	[TRACEFS_OP_CLOSE] = "close",
+	[TRACEFS_OP_OPEN2] = "open2",
+	[TRACEFS_OP_CHECK_VERIFIER] = "check_verifier",
+	[TRACEFS_OP_STATUS2] = "status2",
+	[TRACEFS_OP_REOPEN2] = "reopen2",
+	[TRACEFS_OP_READ2] = "read2",
+	[TRACEFS_OP_WRITE2] = "write2",
+	[TRACEFS_OP_SEEK2] = "seek2",
+	[TRACEFS_OP_IO_ADVISE2] = "io_advise2",
+	[TRACEFS_OP_COMMIT2] = "commit2",
+	[TRACEFS_OP_LOCK_OP2] = "lock_op2",
+	[TRACEFS_OP_CLOSE2] = "close2",
+	[TRACEFS_OP_LOOKUP] = "lookup",
+	[TRACEFS_OP_CREATE] = "create",
+	[TRACEFS_OP_MKDIR] = "mkdir",
+	[TRACEFS_OP_MKNODE] = "mknode",
+	[TRACEFS_OP_SYMLINK] = "symlink",
+	[TRACEFS_OP_READLINK] = "readlink",
+	[TRACEFS_OP_LINK] = "link",
+	[TRACEFS_OP_READDIR] = "readdir",
+	[TRACEFS_OP_COMPUTE_READDIR_COOKIE] = "compute_readdir_cookie",
+	[TRACEFS_OP_DIRENT_CMP] = "dirent_cmp",
+	[TRACEFS_OP_RENAME] = "rename",
+	[TRACEFS_OP_GETATTRS] = "getattrs",
+	[TRACEFS_OP_SETATTRS] = "setattrs",
+	[TRACEFS_OP_SETATTR2] = "setattr2",
+	[TRACEFS_OP_UNLINK] = "unlink",
+	[TRACEFS_OP_HANDLE_TO_WIRE] = "handle_to_wire",
+	[TRACEFS_OP_HANDLE_TO_KEY] = "handle_to_key",
+	[TRACEFS_OP_RELEASE] = "release",
+	[TRACEFS_OP_LOOKUP_PATH] = "lookup_path",
+	[TRACEFS_OP_CREATE_HANDLE] = "create_handle",
+	[TRACEFS_OP_LIST_EXT_ATTRS] = "list_ext_attrs",
+	[TRACEFS_OP_GETEXTATTR_ID_BY_NAME] = "getextattr_id_by_name",
+	[TRACEFS_OP_GETEXTATTR_VALUE_BY_ID] = "getextattr_value_by_id",
+	[TRACEFS_OP_GETEXTATTR_VALUE_BY_NAME] = "getextattr_value_by_name",
+	[TRACEFS_OP_SETEXTATTR_VALUE] = "setextattr_value",
+	[TRACEFS_OP_SETEXTATTR_VALUE_BY_ID] = "setextattr_value_by_id",
+	[TRACEFS_OP_REMOVE_EXTATTR_BY_ID] = "remove_extattr_by_id",
+	[TRACEFS_OP_REMOVE_EXTATTR_BY_NAME] = "remove_extattr_by_name",
+};
+
+static inline unsigned int tracefs_bucket(uint64_t nsecs)
+{
+	uint64_t usecs = nsecs / 1000;
+	unsigned int bucket;
+
+	if (usecs == 0)
+		return 0;
+
+	bucket = 64 - __builtin_clzll(usecs);
+
+	return MIN(bucket, TRACEFS_BUCKETS - 1);
+}
+
+/**
+ * @brief Keep a slow call in the ring
+ *
+ * The name is copied with anything that is not printable ASCII
+ * replaced, it will be sent over D-Bus as a string.
+ */
+static void tracefs_sample(struct tracefs_call *call, fsal_errors_t status,
+			   uint64_t nsecs)
+{
+	struct tracefs_fsal_export *exp = call->exp;
+	struct tracefs_slow_call *slow;
+	int i = 0;
+
+	PTHREAD_MUTEX_lock(&exp->slow_lock);
+
+	slow = &exp->slow_ring[exp->slow_total % exp->slow_ring_size];
+	exp->slow_total++;
+
+	now(&slow->when);
+	slow->op = call->op;
+	slow->status = status;
+	slow->nsecs = nsecs;
+	slow->fileid = call->fileid;
+	slow->offset = call->offset;
+	slow->length = call->length;
+
+	if (call->name != NULL) {
+		for (; i < TRACEFS_NAME_LEN - 1 && call->name[i] != '\0'; i++)
+			slow->name[i] = (call->name[i] >= ' ' &&
+					 call->name[i] <= '~')
+						? call->name[i] : '?';
+	}
+	slow->name[i] = '\0';
+
+	PTHREAD_MUTEX_unlock(&exp->slow_lock);
+}
+
+/**
+ * @brief Account for a completed sub FSAL call
+ *
+ * @param[in] call    The call, from tracefs_begin
+ * @param[in] status  Its result, ERR_FSAL_NO_ERROR for calls that
+ *                    cannot fail
+ */
+void tracefs_end(struct tracefs_call *call, fsal_errors_t status)
+{
+	struct tracefs_op_stats *st = &call->exp->stats[call->op];
+	struct timespec end;
+	uint64_t nsecs, max;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	nsecs = timespec_diff(&call->start, &end);
+	nsecs = nsecs > call->excluded ? nsecs - call->excluded : 0;
+
+	atomic_inc_uint64_t(&st->calls);
+	if (status != ERR_FSAL_NO_ERROR)
+		atomic_inc_uint64_t(&st->errors);
+	atomic_add_uint64_t(&st->total_nsecs, nsecs);
+	atomic_inc_uint64_t(&st->buckets[tracefs_bucket(nsecs)]);
+
+	max = atomic_fetch_uint64_t(&st->max_nsecs);
+	while (nsecs > max && !atomic_cas_uint64_t(&st->max_nsecs, max, nsecs))
+		max = atomic_fetch_uint64_t(&st->max_nsecs);
+
+	if (call->exp->slow_ring != NULL && nsecs >= call->exp->slow_nsecs)
+		tracefs_sample(call, status, nsecs);
+}
+
+void tracefs_export_init(struct tracefs_fsal_export *exp,
+			 uint32_t slow_usec, uint32_t slow_ring_size)
+{
+	PTHREAD_MUTEX_init(&exp->slow_lock, NULL);
+	exp->slow_nsecs = slow_usec * 1000ULL;
+	exp->slow_ring_size = slow_ring_size;
+	if (slow_ring_size != 0)
+		exp->slow_ring = gsh_calloc(slow_ring_size,
+					    sizeof(*exp->slow_ring));
+}
+
+void tracefs_export_fini(struct tracefs_fsal_export *exp)
+{
+	gsh_free(exp->slow_ring);
+	PTHREAD_MUTEX_destroy(&exp->slow_lock);
+}
+
+#ifdef USE_DBUS
+
+static void tracefs_dbus_ops(struct tracefs_fsal_export *exp,
+			     DBusMessageIter *iter)
+{
+	DBusMessageIter array_iter, op_iter, bucket_iter;
+	dbus_uint64_t buckets[TRACEFS_BUCKETS];
+	const dbus_uint64_t *bucketp = buckets;
+	uint64_t calls, errors, total, max;
+	int op, i;
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "(sttttat)",
+					 &array_iter);
+
+	for (op = 0; op < TRACEFS_OP_COUNT; op++) {
+		struct tracefs_op_stats *st = &exp->stats[op];
+
+		calls = atomic_fetch_uint64_t(&st->calls);
+		if (calls == 0)
+			continue;
+		errors = atomic_fetch_uint64_t(&st->errors);
+		total = atomic_fetch_uint64_t(&st->total_nsecs);
+		max = atomic_fetch_uint64_t(&st->max_nsecs);
+		for (i = 0; i < TRACEFS_BUCKETS; i++)
+			buckets[i] = atomic_fetch_uint64_t(&st->buckets[i]);
+
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &op_iter);
+		dbus_message_iter_append_basic(&op_iter, DBUS_TYPE_STRING,
+					       &tracefs_op_names[op]);
+		dbus_message_iter_append_basic(&op_iter, DBUS_TYPE_UINT64,
+					       &calls);
+		dbus_message_iter_append_basic(&op_iter, DBUS_TYPE_UINT64,
+					       &errors);
+		dbus_message_iter_append_basic(&op_iter, DBUS_TYPE_UINT64,
+					       &total);
+		dbus_message_iter_append_basic(&op_iter, DBUS_TYPE_UINT64,
+					       &max);
+		dbus_message_iter_open_container(&op_iter, DBUS_TYPE_ARRAY,
+						 DBUS_TYPE_UINT64_AS_STRING,
+						 &bucket_iter);
+		dbus_message_iter_append_fixed_array(&bucket_iter,
+						     DBUS_TYPE_UINT64,
+						     &bucketp,
+						     TRACEFS_BUCKETS);
+		dbus_message_iter_close_container(&op_iter, &bucket_iter);
+		dbus_message_iter_close_container(&array_iter, &op_iter);
+	}
+
+	dbus_message_iter_close_container(iter, &array_iter);
+}
+
+static void tracefs_dbus_slow(struct tracefs_fsal_export *exp,
+			      DBusMessageIter *iter)
+{
+	DBusMessageIter array_iter, call_iter;
+	uint64_t first, seq;
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "(tsttsttts)",
+					 &array_iter);
+
+	PTHREAD_MUTEX_lock(&exp->slow_lock);
+
+	/* Oldest first */
+	first = exp->slow_total > exp->slow_ring_size
+			? exp->slow_total - exp->slow_ring_size : 0;
+
+	for (seq = first; seq < exp->slow_total; seq++) {
+		struct tracefs_slow_call *slow =
+			&exp->slow_ring[seq % exp->slow_ring_size];
+		const char *op = tracefs_op_names[slow->op];
+		const char *status = msg_fsal_err(slow->status);
+		const char *name = slow->name;
+		uint64_t when = slow->when.tv_sec;
+
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &call_iter);
+		dbus_message_iter_append_basic(&call_iter, DBUS_TYPE_UINT64,
+					       &when);
+		dbus_message_iter_append_basic(&call_iter, DBUS_TYPE_STRING,
+					       &op);
+		dbus_message_iter_append_basic(&call_iter, DBUS_TYPE_UINT64,
+					       &slow->nsecs);
+		dbus_message_iter_append_basic(&call_iter, DBUS_TYPE_UINT64,
+					       &slow->fileid);
+		dbus_message_iter_append_basic(&call_iter, DBUS_TYPE_STRING,
+					       &status);
+		dbus_message_iter_append_basic(&call_iter, DBUS_TYPE_UINT64,
+					       &slow->offset);
+		dbus_message_iter_append_basic(&call_iter, DBUS_TYPE_UINT64,
+					       &slow->length);
+		dbus_message_iter_append_basic(&call_iter, DBUS_TYPE_UINT64,
+					       &seq);
+		dbus_message_iter_append_basic(&call_iter, DBUS_TYPE_STRING,
+					       &name);
+		dbus_message_iter_close_container(&array_iter, &call_iter);
+	}
+
+	PTHREAD_MUTEX_unlock(&exp->slow_lock);
+
+	dbus_message_iter_close_container(iter, &array_iter);
+}
+
+/**
+ * @brief Dump the histograms and slow calls of every TRACE export
+ *
+ * The reply is a timestamp followed by an array with, for each export:
+ * its id, an array of (op, calls, errors, total nsecs, max nsecs,
+ * histogram) for the operations that were called, and an array of
+ * (time, op, nsecs, fileid, status, offset, length, sequence, name)
+ * for the sampled slow calls, oldest first.
+ *
+ * @param[in] fsal_hdl  TRACE FSAL module
+ * @param[in] iter      DBusMessageIter to append to
+ */
+void tracefs_extract_stats(struct fsal_module *fsal_hdl, void *iter)
+{
+	DBusMessageIter *iterp = iter;
+	DBusMessageIter array_iter, exp_iter;
+	struct timespec timestamp;
+	struct glist_head *glist;
+
+	now(&timestamp);
+	dbus_append_timestamp(iterp, &timestamp);
+
+	dbus_message_iter_open_container(iterp, DBUS_TYPE_ARRAY,
+					 "(qa(sttttat)a(tsttsttts))",
+					 &array_iter);
+
+	PTHREAD_RWLOCK_rdlock(&fsal_hdl->lock);
+
+	glist_for_each(glist, &fsal_hdl->exports) {
+		struct tracefs_fsal_export *exp =
+			container_of(glist, struct tracefs_fsal_export,
+				     export.exports);
+
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &exp_iter);
+		dbus_message_iter_append_basic(&exp_iter, DBUS_TYPE_UINT16,
+					       &exp->export.export_id);
+		tracefs_dbus_ops(exp, &exp_iter);
+		tracefs_dbus_slow(exp, &exp_iter);
+		dbus_message_iter_close_container(&array_iter, &exp_iter);
+	}
+
+	PTHREAD_RWLOCK_unlock(&fsal_hdl->lock);
+
+	dbus_message_iter_close_container(iterp, &array_iter);
+}
+
+/**
+ * @brief Clear the histograms and slow calls of every TRACE export
+ *
+ * @param[in] fsal_hdl  TRACE FSAL module
+ */
+void tracefs_reset_stats(struct fsal_module *fsal_hdl)
+{
+	struct glist_head *glist;
+
+	PTHREAD_RWLOCK_rdlock(&fsal_hdl->lock);
+
+	glist_for_each(glist, &fsal_hdl->exports) {
+		struct tracefs_fsal_export *exp =
+			container_of(glist, struct tracefs_fsal_export,
+				     export.exports);
+		int op, i;
+
+		for (op = 0; op < TRACEFS_OP_COUNT; op++) {
+			struct tracefs_op_stats *st = &exp->stats[op];
+
+			atomic_store_uint64_t(&st->calls, 0);
+			atomic_store_uint64_t(&st->errors, 0);
+			atomic_store_uint64_t(&st->total_nsecs, 0);
+			atomic_store_uint64_t(&st->max_nsecs, 0);
+			for (i = 0; i < TRACEFS_BUCKETS; i++)
+				atomic_store_uint64_t(&st->buckets[i], 0);
+		}
+
+		PTHREAD_MUTEX_lock(&exp->slow_lock);
+		exp->slow_total = 0;
+		PTHREAD_MUTEX_unlock(&exp->slow_lock);
+	}
+
+	PTHREAD_RWLOCK_unlock(&fsal_hdl->lock);
+}
+
+#endif				/* USE_DBUS */
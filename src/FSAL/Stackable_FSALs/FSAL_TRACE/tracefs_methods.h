@@ -0,0 +1,345 @@
+/* TRACEFS methods for handles
+ */
+
+struct tracefs_fsal_obj_handle;
+
+struct next_ops {
+	struct export_ops exp_ops;	/*< Vector of operations */
+	struct fsal_obj_ops obj_ops;	/*< Shared handle methods vector */
+	struct fsal_dsh_ops dsh_ops;	/*< Shared handle methods vector */
+	const struct fsal_up_vector *up_ops;	/*< Upcall operations */
+};
+
+/**
+ * Structure used to store data for read_dirents callback.
+ *
+ * Before executing the upper level callback (it might be another
+ * stackable fsal or the inode cache), the context has to be restored.
+ */
+struct tracefs_readdir_state {
+	fsal_readdir_cb cb; /*< Callback to the upper layer. */
+	struct tracefs_fsal_export *exp; /*< Export of the current tracefsal. */
+	void *dir_state; /*< State to be sent to the next callback. */
+	uint64_t cb_nsecs; /*< Time spent in the upper layer callback. */
+};
+
+
+extern struct next_ops next_ops;
+extern struct fsal_up_vector fsal_up_top;
+void tracefs_handle_ops_init(struct fsal_obj_ops *ops);
+
+/**
+ * Operations of the sub FSAL that are timed
+ */
+enum tracefs_op {
+	TRACEFS_OP_GET_FS_DYNAMIC_INFO,
+	TRACEFS_OP_FS_SUPPORTS,
+	TRACEFS_OP_FS_MAXFILESIZE,
+	TRACEFS_OP_FS_MAXREAD,
+	TRACEFS_OP_FS_MAXWRITE,
+	TRACEFS_OP_FS_MAXLINK,
+	TRACEFS_OP_FS_MAXNAMELEN,
+	TRACEFS_OP_FS_MAXPATHLEN,
+	TRACEFS_OP_FS_LEASE_TIME,
+	TRACEFS_OP_FS_ACL_SUPPORT,
+	TRACEFS_OP_FS_SUPPORTED_ATTRS,
+	TRACEFS_OP_FS_UMASK,
+	TRACEFS_OP_FS_XATTR_ACCESS_RIGHTS,
+	TRACEFS_OP_GET_QUOTA,
+	TRACEFS_OP_SET_QUOTA,
+	TRACEFS_OP_ALLOC_STATE,
+	TRACEFS_OP_FREE_STATE,
+	TRACEFS_OP_IS_SUPERUSER,
+	TRACEFS_OP_WIRE_TO_HOST,
+	TRACEFS_OP_HOST_TO_KEY,
+	TRACEFS_OP_OPEN,
+	TRACEFS_OP_STATUS,
+	TRACEFS_OP_READ,
+	TRACEFS_OP_WRITE,
+	TRACEFS_OP_COMMIT,
+	TRACEFS_OP_LOCK_OP,
+	TRACEFS_OP_CLOSE,
+	TRACEFS_OP_OPEN2,
+	TRACEFS_OP_CHECK_VERIFIER,
+	TRACEFS_OP_STATUS2,
+	TRACEFS_OP_REOPEN2,
+	TRACEFS_OP_READ2,
+	TRACEFS_OP_WRITE2,
+	TRACEFS_OP_SEEK2,
+	TRACEFS_OP_IO_ADVISE2,
+	TRACEFS_OP_COMMIT2,
+	TRACEFS_OP_LOCK_OP2,
+	TRACEFS_OP_CLOSE2,
+	TRACEFS_OP_LOOKUP,
+	TRACEFS_OP_CREATE,
+	TRACEFS_OP_MKDIR,
+	TRACEFS_OP_MKNODE,
+	TRACEFS_OP_SYMLINK,
+	TRACEFS_OP_READLINK,
+	TRACEFS_OP_LINK,
+	TRACEFS_OP_READDIR,
+	TRACEFS_OP_COMPUTE_READDIR_COOKIE,
+	TRACEFS_OP_DIRENT_CMP,
+	TRACEFS_OP_RENAME,
+	TRACEFS_OP_GETATTRS,
+	TRACEFS_OP_SETATTRS,
+	TRACEFS_OP_SETATTR2,
+	TRACEFS_OP_UNLINK,
+	TRACEFS_OP_HANDLE_TO_WIRE,
+	TRACEFS_OP_HANDLE_TO_KEY,
+	TRACEFS_OP_RELEASE,
+	TRACEFS_OP_LOOKUP_PATH,
+	TRACEFS_OP_CREATE_HANDLE,
+	TRACEFS_OP_LIST_EXT_ATTRS,
+	TRACEFS_OP_GETEXTATTR_ID_BY_NAME,
+	TRACEFS_OP_GETEXTATTR_VALUE_BY_ID,
+	TRACEFS_OP_GETEXTATTR_VALUE_BY_NAME,
+	TRACEFS_OP_SETEXTATTR_VALUE,
+	TRACEFS_OP_SETEXTATTR_VALUE_BY_ID,
+	TRACEFS_OP_REMOVE_EXTATTR_BY_ID,
+	TRACEFS_OP_REMOVE_EXTATTR_BY_NAME,
+	TRACEFS_OP_COUNT
+};
+
+extern const char *tracefs_op_names[TRACEFS_OP_COUNT];
+
+/* Latency histogram buckets.  Bucket 0 counts calls under a
+ * microsecond, bucket n those from 2^(n-1) up to 2^n microseconds, and
+ * the last one everything slower.
+ */
+#define TRACEFS_BUCKETS 32
+
+struct tracefs_op_stats {
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t total_nsecs;
+	uint64_t max_nsecs;
+	uint64_t buckets[TRACEFS_BUCKETS];
+};
+
+#define TRACEFS_NAME_LEN 64
+
+/**
+ * A call that took longer than the slow threshold
+ */
+struct tracefs_slow_call {
+	struct timespec when;	/*< When the call completed */
+	enum tracefs_op op;
+	fsal_errors_t status;
+	uint64_t nsecs;
+	uint64_t fileid;	/*< Object operated on, 0 for export calls */
+	uint64_t offset;
+	uint64_t length;
+	char name[TRACEFS_NAME_LEN];	/*< Name argument, if any */
+};
+
+/*
+ * TRACEFS internal export
+ */
+struct tracefs_fsal_export {
+	struct fsal_export export;
+	struct tracefs_op_stats stats[TRACEFS_OP_COUNT];
+	uint64_t slow_nsecs;	/*< Sample calls at least this long */
+	pthread_mutex_t slow_lock;	/*< Protects the ring */
+	struct tracefs_slow_call *slow_ring;	/*< NULL if not sampling */
+	uint32_t slow_ring_size;
+	uint64_t slow_total;	/*< Slow calls seen, the next goes to
+				   slow_total % slow_ring_size */
+};
+
+/**
+ * A sub FSAL call in progress
+ */
+struct tracefs_call {
+	struct tracefs_fsal_export *exp;
+	enum tracefs_op op;
+	struct timespec start;
+	uint64_t excluded;	/*< Time not spent below us */
+	uint64_t fileid;
+	const char *name;
+	uint64_t offset;
+	uint64_t length;
+};
+
+static inline struct tracefs_call tracefs_begin(
+					struct tracefs_fsal_export *exp,
+					enum tracefs_op op,
+					struct fsal_obj_handle *obj)
+{
+	struct tracefs_call call = {
+		.exp = exp,
+		.op = op,
+		.fileid = obj != NULL ? obj->fileid : 0,
+	};
+
+	clock_gettime(CLOCK_MONOTONIC, &call.start);
+	return call;
+}
+
+void tracefs_end(struct tracefs_call *call, fsal_errors_t status);
+void tracefs_export_init(struct tracefs_fsal_export *exp,
+			 uint32_t slow_usec, uint32_t slow_ring_size);
+void tracefs_export_fini(struct tracefs_fsal_export *exp);
+
+#ifdef USE_DBUS
+void tracefs_extract_stats(struct fsal_module *fsal_hdl, void *iter);
+void tracefs_reset_stats(struct fsal_module *fsal_hdl);
+#endif
+
+fsal_status_t tracefs_lookup_path(struct fsal_export *exp_hdl,
+				  const char *path,
+				  struct fsal_obj_handle **handle,
+				  struct attrlist *attrs_out);
+
+fsal_status_t tracefs_create_handle(struct fsal_export *exp_hdl,
+				    struct gsh_buffdesc *hdl_desc,
+				    struct fsal_obj_handle **handle,
+				    struct attrlist *attrs_out);
+
+fsal_status_t tracefs_alloc_and_check_handle(
+		struct tracefs_fsal_export *export,
+		struct fsal_obj_handle *sub_handle,
+		struct fsal_filesystem *fs,
+		struct fsal_obj_handle **new_handle,
+		fsal_status_t subfsal_status);
+
+/*
+ * TRACEFS internal object handle
+ *
+ * It contains a pointer to the fsal_obj_handle used by the subfsal.
+ *
+ * AF_UNIX sockets are strange ducks.  I personally cannot see why they
+ * are here except for the ability of a client to see such an animal with
+ * an 'ls' or get rid of one with an 'rm'.  You can't open them in the
+ * usual file way so open_by_handle_at leads to a deadend.  To work around
+ * this, we save the args that were used to mknod or lookup the socket.
+ */
+
+struct tracefs_fsal_obj_handle {
+	struct fsal_obj_handle obj_handle; /*< Handle containing tracefs data */
+	struct fsal_obj_handle *sub_handle; /*< Handle of the sub fsal.*/
+	int32_t refcnt;		/*< Reference count.  This is signed to make
+				   mistakes easy to see. */
+};
+
+int tracefs_fsal_open(struct tracefs_fsal_obj_handle *, int, fsal_errors_t *);
+int tracefs_fsal_readlink(struct tracefs_fsal_obj_handle *, fsal_errors_t *);
+
+static inline bool tracefs_unopenable_type(object_file_type_t type)
+{
+	if ((type == SOCKET_FILE) || (type == CHARACTER_FILE)
+	    || (type == BLOCK_FILE)) {
+		return true;
+	} else {
+		return false;
+	}
+}
+
+	/* I/O management */
+fsal_status_t tracefs_open(struct fsal_obj_handle *obj_hdl,
+			   fsal_openflags_t openflags);
+fsal_openflags_t tracefs_status(struct fsal_obj_handle *obj_hdl);
+fsal_status_t tracefs_read(struct fsal_obj_handle *obj_hdl,
+			   uint64_t offset,
+			   size_t buffer_size, void *buffer,
+			   size_t *read_amount, bool *end_of_file);
+fsal_status_t tracefs_write(struct fsal_obj_handle *obj_hdl,
+			    uint64_t offset,
+			    size_t buffer_size, void *buffer,
+			    size_t *write_amount, bool *fsal_stable);
+fsal_status_t tracefs_commit(struct fsal_obj_handle *obj_hdl,	/* sync */
+			     off_t offset, size_t len);
+fsal_status_t tracefs_lock_op(struct fsal_obj_handle *obj_hdl,
+			      void *p_owner,
+			      fsal_lock_op_t lock_op,
+			      fsal_lock_param_t *request_lock,
+			      fsal_lock_param_t *conflicting_lock);
+fsal_status_t tracefs_share_op(struct fsal_obj_handle *obj_hdl, void *p_owner,
+			       fsal_share_param_t request_share);
+fsal_status_t tracefs_close(struct fsal_obj_handle *obj_hdl);
+
+/* Multi-FD */
+fsal_status_t tracefs_open2(struct fsal_obj_handle *obj_hdl,
+			    struct state_t *state,
+			    fsal_openflags_t openflags,
+			    enum fsal_create_mode createmode,
+			    const char *name,
+			    struct attrlist *attrs_in,
+			    fsal_verifier_t verifier,
+			    struct fsal_obj_handle **new_obj,
+			    struct attrlist *attrs_out,
+			    bool *caller_perm_check);
+bool tracefs_check_verifier(struct fsal_obj_handle *obj_hdl,
+			    fsal_verifier_t verifier);
+fsal_openflags_t tracefs_status2(struct fsal_obj_handle *obj_hdl,
+				 struct state_t *state);
+fsal_status_t tracefs_reopen2(struct fsal_obj_handle *obj_hdl,
+			      struct state_t *state,
+			      fsal_openflags_t openflags);
+fsal_status_t tracefs_read2(struct fsal_obj_handle *obj_hdl,
+			    bool bypass,
+			    struct state_t *state,
+			    uint64_t offset,
+			    size_t buf_size,
+			    void *buffer,
+			    size_t *read_amount,
+			    bool *eof,
+			    struct io_info *info);
+fsal_status_t tracefs_write2(struct fsal_obj_handle *obj_hdl,
+			     bool bypass,
+			     struct state_t *state,
+			     uint64_t offset,
+			     size_t buf_size,
+			     void *buffer,
+			     size_t *write_amount,
+			     bool *fsal_stable,
+			     struct io_info *info);
+fsal_status_t tracefs_seek2(struct fsal_obj_handle *obj_hdl,
+			    struct state_t *state,
+			    struct io_info *info);
+fsal_status_t tracefs_io_advise2(struct fsal_obj_handle *obj_hdl,
+				 struct state_t *state,
+				 struct io_hints *hints);
+fsal_status_t tracefs_commit2(struct fsal_obj_handle *obj_hdl, off_t offset,
+			      size_t len);
+fsal_status_t tracefs_lock_op2(struct fsal_obj_handle *obj_hdl,
+			       struct state_t *state,
+			       void *p_owner,
+			       fsal_lock_op_t lock_op,
+			       fsal_lock_param_t *req_lock,
+			       fsal_lock_param_t *conflicting_lock);
+fsal_status_t tracefs_close2(struct fsal_obj_handle *obj_hdl,
+			     struct state_t *state);
+
+/* extended attributes management */
+fsal_status_t tracefs_list_ext_attrs(struct fsal_obj_handle *obj_hdl,
+				     unsigned int cookie,
+				     fsal_xattrent_t *xattrs_tab,
+				     unsigned int xattrs_tabsize,
+				     unsigned int *p_nb_returned,
+				     int *end_of_list);
+fsal_status_t tracefs_getextattr_id_by_name(struct fsal_obj_handle *obj_hdl,
+					    const char *xattr_name,
+					    unsigned int *pxattr_id);
+fsal_status_t tracefs_getextattr_value_by_name(struct fsal_obj_handle *obj_hdl,
+					       const char *xattr_name,
+					       caddr_t buffer_addr,
+					       size_t buffer_size,
+					       size_t *p_output_size);
+fsal_status_t tracefs_getextattr_value_by_id(struct fsal_obj_handle *obj_hdl,
+					     unsigned int xattr_id,
+					     caddr_t buffer_addr,
+					     size_t buffer_size,
+					     size_t *p_output_size);
+fsal_status_t tracefs_setextattr_value(struct fsal_obj_handle *obj_hdl,
+				       const char *xattr_name,
+				       caddr_t buffer_addr, size_t buffer_size,
+				       int create);
+fsal_status_t tracefs_setextattr_value_by_id(struct fsal_obj_handle *obj_hdl,
+					     unsigned int xattr_id,
+					     caddr_t buffer_addr,
+					     size_t buffer_size);
+fsal_status_t tracefs_remove_extattr_by_id(struct fsal_obj_handle *obj_hdl,
+					   unsigned int xattr_id);
+fsal_status_t tracefs_remove_extattr_by_name(struct fsal_obj_handle *obj_hdl,
+					     const char *xattr_name);
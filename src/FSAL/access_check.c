@@ -14,6 +14,7 @@
 #include "nfs_core.h"
 #include <sys/stat.h>
 #include "FSAL/access_check.h"
+#include "nfs4_acls.h"
 #include <stdbool.h>
 #include <unistd.h>
 #include <sys/syscall.h>
@@ -41,8 +42,54 @@ static bool fsal_check_ace_group(gid_t gid, struct user_cred *creds)
 	return false;
 }
 
+/**
+ * @brief Mark which groups of a compiled ACL the caller is in
+ *
+ * @param[in]  comp   Compiled ACL
+ * @param[in]  creds  Caller credentials
+ * @param[out] member One bit per entry of comp->gids
+ */
+static void fsal_acl_members(struct fsal_acl_compiled *comp,
+			     struct user_cred *creds, uint64_t *member)
+{
+	uint32_t lo, hi, mid;
+	gid_t gid;
+	int i;
+
+	memset(member, 0, (NFS4_ACL_MAX_GIDS + 63) / 64 * sizeof(uint64_t));
+
+	/* The primary group first, then the supplementary ones */
+	for (i = -1; i < (int)creds->caller_glen; i++) {
+		gid = i < 0 ? creds->caller_gid : creds->caller_garray[i];
+		lo = 0;
+		hi = comp->ngids;
+
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (comp->gids[mid] == gid) {
+				member[mid / 64] |= 1ULL << (mid % 64);
+				break;
+			}
+			if (comp->gids[mid] < gid)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+	}
+}
+
+/**
+ * @brief Check whether an ACE names the caller
+ *
+ * @param[in] pace     The ACE
+ * @param[in] creds    Caller credentials
+ * @param[in] is_owner Caller owns the object
+ * @param[in] is_group Caller is in the owning group
+ * @param[in] in_group For a named group ACE, whether the caller is
+ *                     known to be in it (1) or not (0), -1 to look
+ */
 static bool fsal_check_ace_matches(fsal_ace_t *pace, struct user_cred *creds,
-				   bool is_owner, bool is_group)
+				   bool is_owner, bool is_group, int in_group)
 {
 	bool result = false;
 	char *cause = "";
@@ -71,7 +118,9 @@ static bool fsal_check_ace_matches(fsal_ace_t *pace, struct user_cred *creds,
 		default:
 			break;
 	} else if (IS_FSAL_ACE_GROUP_ID(*pace)) {
-		if (fsal_check_ace_group(pace->who.gid, creds)) {
+		if (in_group < 0)
+			in_group = fsal_check_ace_group(pace->who.gid, creds);
+		if (in_group) {
 			result = true;
 			cause = "group";
 		}
@@ -94,7 +143,8 @@ static bool fsal_check_ace_applicable(fsal_ace_t *pace,
 				      bool is_dir,
 				      bool is_owner,
 				      bool is_group,
-				      bool is_root)
+				      bool is_root,
+				      int in_group)
 {
 	bool is_applicable = false;
 	bool is_file = !is_dir;
@@ -125,7 +175,8 @@ static bool fsal_check_ace_applicable(fsal_ace_t *pace,
 
 	/* The user should match who value. */
 	is_applicable = is_root
-	    || fsal_check_ace_matches(pace, creds, is_owner, is_group);
+	    || fsal_check_ace_matches(pace, creds, is_owner, is_group,
+				      in_group);
 	if (is_applicable)
 		LogFullDebug(COMPONENT_NFS_V4_ACL, "Applicable, flag=0X%x",
 			     pace->flag);
@@ -443,6 +494,9 @@ static fsal_status_t fsal_check_access_acl(struct user_cred *creds,
 	gid_t gid;
 	fsal_acl_t *pacl = NULL;
 	fsal_ace_t *pace = NULL;
+	struct fsal_acl_compiled *comp;
+	uint64_t member[(NFS4_ACL_MAX_GIDS + 63) / 64];
+	int in_group;
 	int ace_number = 0;
 	bool is_dir = false;
 	bool is_owner = false;
@@ -542,6 +596,26 @@ static fsal_status_t fsal_check_access_acl(struct user_cred *creds,
 	}
 	/** @todo Even if user is admin, audit/alarm checks should be done. */
 
+	comp = pacl->compiled;
+
+	/* With only special principals, the ACEs that apply depend on
+	 * ownership alone and a grant can be read off directly.  Refusals
+	 * still go through the walk, which picks their error and mask.
+	 */
+	if (comp != NULL && comp->special_only && !is_root &&
+	    (missing_access & ~comp->allow[is_dir][is_owner][is_group]) == 0) {
+		if (allowed != NULL)
+			*allowed = v4mask & ~FSAL_ACE4_PERM_CONTINUE;
+		LogFullDebug(COMPONENT_NFS_V4_ACL,
+			     "access granted by compiled ACL");
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+	}
+
+	if (comp != NULL && comp->ngids != 0)
+		fsal_acl_members(comp, creds, member);
+	else
+		comp = NULL;
+
 	for (pace = pacl->aces; pace < pacl->aces + pacl->naces; pace++) {
 		ace_number += 1;
 
@@ -558,9 +632,17 @@ static fsal_status_t fsal_check_access_acl(struct user_cred *creds,
 
 		LogFullDebug(COMPONENT_NFS_V4_ACL, "allow or deny");
 
+		in_group = -1;
+		if (comp != NULL && !IS_FSAL_ACE_SPECIAL_ID(*pace) &&
+		    IS_FSAL_ACE_GROUP_ID(*pace)) {
+			int idx = comp->gid_idx[ace_number - 1];
+
+			in_group = (member[idx / 64] >> (idx % 64)) & 1;
+		}
+
 		/* Check if this ACE is applicable. */
 		if (fsal_check_ace_applicable(pace, creds, is_dir, is_owner,
-					      is_group, is_root)) {
+					      is_group, is_root, in_group)) {
 			if (IS_FSAL_ACE_ALLOW(*pace)) {
 				/* Do not set bits which are already denied */
 				if (denied)
@@ -345,6 +345,144 @@ nfsstat4 FSAL_encode_v4_multipath(XDR *xdrs, const uint32_t num_hosts,
 	return NFS4_OK;
 }
 
+/**
+ * @brief Encode a numeric owner or group string
+ *
+ * @param[in,out] xdrs The XDR stream
+ * @param[in]     id   The uid or gid
+ *
+ * @return true on success.
+ */
+
+static bool xdr_ff_id(XDR *xdrs, uint32_t id)
+{
+	char buffer[sizeof("4294967295")];
+	char *str = buffer;
+	u_int len = snprintf(buffer, sizeof(buffer), "%" PRIu32, id);
+
+	return xdr_bytes(xdrs, &str, &len, len);
+}
+
+/**
+ * @brief Encode a LAYOUT4_FLEX_FILES loc_body
+ *
+ * The data servers are given mirror by mirror, @c stripe_width of
+ * them each, and are loosely coupled: the client does its I/O with
+ * the anonymous stateid and the credentials given for each.
+ *
+ * @param[in,out] xdrs         The XDR stream
+ * @param[in]     stripe_unit  Stripe unit of the layout
+ * @param[in]     num_mirrors  Number of mirrors
+ * @param[in]     stripe_width Data servers in each mirror
+ * @param[in]     dss          num_mirrors * stripe_width data servers
+ *
+ * @return NFS status codes.
+ */
+
+nfsstat4 FSAL_encode_flex_file_layout(XDR *xdrs, const length4 stripe_unit,
+				      const uint32_t num_mirrors,
+				      const uint32_t stripe_width,
+				      const fsal_ff_data_server_t *dss)
+{
+	const fsal_ff_data_server_t *ds = dss;
+	length4 unit = stripe_unit;
+	stateid4 anonymous;
+	uint32_t count;
+	size_t i, j;
+
+	memset(&anonymous, 0, sizeof(anonymous));
+
+	if (!xdr_length4(xdrs, &unit)) {
+		LogMajor(COMPONENT_PNFS, "Failed encoding stripe_unit.");
+		return NFS4ERR_SERVERFAULT;
+	}
+
+	count = num_mirrors;
+	if (!xdr_uint32_t(xdrs, &count)) {
+		LogMajor(COMPONENT_PNFS, "Failed encoding number of mirrors.");
+		return NFS4ERR_SERVERFAULT;
+	}
+
+	for (i = 0; i < num_mirrors; i++) {
+		count = stripe_width;
+		if (!xdr_uint32_t(xdrs, &count)) {
+			LogMajor(COMPONENT_PNFS,
+				 "Failed encoding width of mirror %zu.", i);
+			return NFS4ERR_SERVERFAULT;
+		}
+
+		for (j = 0; j < stripe_width; j++, ds++) {
+			char *fh_val = ds->fh.addr;
+			u_int fh_len = ds->fh.len;
+			uint32_t efficiency = ds->efficiency;
+
+			count = 1;
+			if (!xdr_fsal_deviceid(xdrs,
+				     (struct pnfs_deviceid *)&ds->deviceid) ||
+			    !xdr_uint32_t(xdrs, &efficiency) ||
+			    !xdr_stateid4(xdrs, &anonymous) ||
+			    !xdr_uint32_t(xdrs, &count) ||
+			    !xdr_bytes(xdrs, &fh_val, &fh_len, NFS4_FHSIZE) ||
+			    !xdr_ff_id(xdrs, ds->uid) ||
+			    !xdr_ff_id(xdrs, ds->gid)) {
+				LogMajor(COMPONENT_PNFS,
+					 "Failed encoding data server %zu of mirror %zu.",
+					 j, i);
+				return NFS4ERR_SERVERFAULT;
+			}
+		}
+	}
+
+	return NFS4_OK;
+}
+
+/**
+ * @brief Encode a LAYOUT4_FLEX_FILES da_addr_body
+ *
+ * The device is reached through any of @c hosts, with the one NFS
+ * version given, loosely coupled.
+ *
+ * @param[in,out] xdrs         The XDR stream
+ * @param[in]     num_hosts    Number of hosts in array
+ * @param[in]     hosts        Array of hosts
+ * @param[in]     version      NFS version to use
+ * @param[in]     minorversion NFS minor version to use
+ * @param[in]     rsize        Preferred read size
+ * @param[in]     wsize        Preferred write size
+ *
+ * @return NFS status codes.
+ */
+
+nfsstat4 FSAL_encode_flex_file_devaddr(XDR *xdrs, const uint32_t num_hosts,
+				       const fsal_multipath_member_t *hosts,
+				       const uint32_t version,
+				       const uint32_t minorversion,
+				       const uint32_t rsize,
+				       const uint32_t wsize)
+{
+	ff_device_versions4 versions = {
+		.ffdv_version = version,
+		.ffdv_minorversion = minorversion,
+		.ffdv_rsize = rsize,
+		.ffdv_wsize = wsize,
+		.ffdv_tightly_coupled = false,
+	};
+	uint32_t count = 1;
+	nfsstat4 nfs_status;
+
+	nfs_status = FSAL_encode_v4_multipath(xdrs, num_hosts, hosts);
+	if (nfs_status != NFS4_OK)
+		return nfs_status;
+
+	if (!xdr_uint32_t(xdrs, &count) ||
+	    !xdr_ff_device_versions4(xdrs, &versions)) {
+		LogMajor(COMPONENT_PNFS, "Failed encoding device versions.");
+		return NFS4ERR_SERVERFAULT;
+	}
+
+	return NFS4_OK;
+}
+
 /**
  * @brief Convert POSIX error codes to NFS 4 error codes
  *
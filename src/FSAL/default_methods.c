@@ -183,6 +183,16 @@ static size_t fs_da_addr_size(struct fsal_module *fsal_hdl)
 	return 0;
 }
 
+/**
+ * Ignore device errors.
+ */
+
+static void device_error(struct fsal_module *fsal_hdl,
+			 const struct pnfs_deviceid *deviceid,
+			 nfsstat4 status, nfs_opnum4 opnum)
+{
+}
+
 /**
  * @brief Try to create a FSAL pNFS data server
  *
@@ -271,6 +281,7 @@ struct fsal_ops def_fsal_ops = {
 	.support_ex = support_ex,
 	.fsal_extract_stats = fsal_extract_stats,
 	.fsal_reset_stats = fsal_reset_stats,
+	.device_error = device_error,
 };
 
 /* get_name
@@ -601,11 +612,14 @@ static void global_verifier(struct fsal_export *exp_hdl,
  * @returns a state structure.
  */
 
+static struct gsh_slab state_slab =
+	GSH_SLAB_INITIALIZER("state_t", struct state_t, 4096, GSH_MEM_STATE);
+
 static struct state_t *alloc_state(struct fsal_export *exp_hdl,
 				   enum state_type state_type,
 				   struct state_t *related_state)
 {
-	return init_state(gsh_calloc(1, sizeof(struct state_t)),
+	return init_state(gsh_slab_alloc(&state_slab),
 			  exp_hdl, state_type, related_state);
 }
 
@@ -619,7 +633,7 @@ static struct state_t *alloc_state(struct fsal_export *exp_hdl,
 
 void free_state(struct fsal_export *exp_hdl, struct state_t *state)
 {
-	gsh_free(state);
+	gsh_slab_free(&state_slab, state);
 }
 
 /**
@@ -932,6 +946,141 @@ static fsal_status_t getattrs(struct fsal_obj_handle *obj_hdl,
 	return fsalstat(ERR_FSAL_NOTSUPP, ENOTSUP);
 }
 
+/* getattrs_bulk
+ * default case not supported, callers fall back to getattrs
+ */
+
+static fsal_status_t getattrs_bulk(struct fsal_obj_handle *dir_hdl,
+				   uint32_t count,
+				   struct fsal_obj_handle **obj_hdls,
+				   struct attrlist **attrs_out)
+{
+	return fsalstat(ERR_FSAL_NOTSUPP, ENOTSUP);
+}
+
+/* read2_async
+ * default case is a synchronous read2, completed inline
+ */
+
+static void read2_async(struct fsal_obj_handle *obj_hdl,
+			bool bypass,
+			struct state_t *state,
+			uint64_t offset,
+			size_t buffer_size,
+			void *buffer,
+			size_t *read_amount,
+			bool *end_of_file,
+			struct io_info *info,
+			fsal_async_cb done_cb,
+			void *caller_data)
+{
+	fsal_status_t status;
+
+	status = obj_hdl->obj_ops.read2(obj_hdl, bypass, state, offset,
+					buffer_size, buffer, read_amount,
+					end_of_file, info);
+
+	done_cb(obj_hdl, status, caller_data);
+}
+
+/* write2_async
+ * default case is a synchronous write2, completed inline
+ */
+
+static void write2_async(struct fsal_obj_handle *obj_hdl,
+			 bool bypass,
+			 struct state_t *state,
+			 uint64_t offset,
+			 size_t buffer_size,
+			 void *buffer,
+			 size_t *wrote_amount,
+			 bool *fsal_stable,
+			 struct io_info *info,
+			 fsal_async_cb done_cb,
+			 void *caller_data)
+{
+	fsal_status_t status;
+
+	status = obj_hdl->obj_ops.write2(obj_hdl, bypass, state, offset,
+					 buffer_size, buffer, wrote_amount,
+					 fsal_stable, info);
+
+	done_cb(obj_hdl, status, caller_data);
+}
+
+/* writev2
+ * default case gathers the segments and calls write2
+ */
+
+static fsal_status_t writev2(struct fsal_obj_handle *obj_hdl,
+			     bool bypass,
+			     struct state_t *state,
+			     uint64_t offset,
+			     const struct iovec *iov,
+			     int iovcnt,
+			     size_t *wrote_amount,
+			     bool *fsal_stable,
+			     struct io_info *info)
+{
+	fsal_status_t status;
+	size_t total = 0;
+	char *buffer, *pos;
+	int i;
+
+	if (iovcnt == 1)
+		return obj_hdl->obj_ops.write2(obj_hdl, bypass, state, offset,
+					       iov[0].iov_len, iov[0].iov_base,
+					       wrote_amount, fsal_stable, info);
+
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	buffer = gsh_malloc(total);
+
+	for (i = 0, pos = buffer; i < iovcnt; i++) {
+		memcpy(pos, iov[i].iov_base, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	}
+
+	status = obj_hdl->obj_ops.write2(obj_hdl, bypass, state, offset,
+					 total, buffer, wrote_amount,
+					 fsal_stable, info);
+
+	gsh_free(buffer);
+	return status;
+}
+
+/* copy_range
+ * default case not supported
+ */
+
+static fsal_status_t copy_range(struct fsal_obj_handle *dst_hdl,
+				struct state_t *dst_state,
+				uint64_t dst_offset,
+				struct fsal_obj_handle *src_hdl,
+				struct state_t *src_state,
+				uint64_t src_offset,
+				uint64_t count,
+				uint64_t *copied)
+{
+	return fsalstat(ERR_FSAL_NOTSUPP, 0);
+}
+
+/* clone_range
+ * default case not supported
+ */
+
+static fsal_status_t clone_range(struct fsal_obj_handle *dst_hdl,
+				 struct state_t *dst_state,
+				 uint64_t dst_offset,
+				 struct fsal_obj_handle *src_hdl,
+				 struct state_t *src_state,
+				 uint64_t src_offset,
+				 uint64_t count)
+{
+	return fsalstat(ERR_FSAL_NOTSUPP, 0);
+}
+
 /* setattrs
  * default case not supported
  */
@@ -1657,6 +1806,12 @@ struct fsal_obj_ops def_handle_ops = {
 	.lock_op2 = lock_op2,
 	.setattr2 = setattr2,
 	.close2 = close2,
+	.getattrs_bulk = getattrs_bulk,
+	.read2_async = read2_async,
+	.write2_async = write2_async,
+	.writev2 = writev2,
+	.copy = copy_range,
+	.clone = clone_range,
 };
 
 /* fsal_pnfs_ds common methods */
@@ -49,6 +49,7 @@
 #include "sal_data.h"
 #include "sal_functions.h"
 #include "FSAL/fsal_commonlib.h"
+#include "iobuf_pool.h"
 
 /**
  * This is a global counter of files opened.
@@ -426,6 +427,15 @@ fsal_status_t open2_by_name(struct fsal_obj_handle *in_obj,
 		(void) atomic_inc_size_t(&open_fd_count);
 	}
 
+	/* Only a guarded create is sure to have added the name, any other
+	 * create recalls the directory's delegations since no notification
+	 * is ever granted for directory attribute changes.
+	 */
+	if (createmode == FSAL_GUARDED)
+		state_dir_notify(in_obj, NOTIFY4_ADD_ENTRY, name, NULL);
+	else if (createmode != FSAL_NO_CREATE)
+		state_dir_notify(in_obj, NOTIFY4_CHANGE_DIR_ATTRS, name, NULL);
+
 	LogFullDebug(COMPONENT_FSAL,
 		     "Created entry %p FSAL %s for %s",
 		     *obj, (*obj)->fsal->name, name);
@@ -660,6 +670,10 @@ fsal_status_t fsal_link(struct fsal_obj_handle *obj,
 	/* Rather than performing a lookup first, just try to make the
 	   link and return the FSAL's error if it fails. */
 	status = obj->obj_ops.link(obj, dest_dir, name);
+
+	if (!FSAL_IS_ERROR(status))
+		state_dir_notify(dest_dir, NOTIFY4_ADD_ENTRY, name, NULL);
+
 	return status;
 }
 
@@ -918,6 +932,8 @@ fsal_status_t fsal_create(struct fsal_obj_handle *parent,
 		goto out;
 	}
 
+	state_dir_notify(parent, NOTIFY4_ADD_ENTRY, name, NULL);
+
 setattrs:
 	if (!support_ex) {
 		/* Handle setattr for old API */
@@ -1002,6 +1018,48 @@ bool fsal_create_verify(struct fsal_obj_handle *obj, uint32_t verf_hi,
 	return verified;
 }
 
+/**
+ * @brief Wait for an asynchronous read2 or write2 to complete
+ */
+struct fsal_io_wait {
+	pthread_mutex_t mtx;
+	pthread_cond_t cv;
+	bool done;
+	fsal_status_t status;
+};
+
+static void fsal_io_wait_init(struct fsal_io_wait *wait)
+{
+	PTHREAD_MUTEX_init(&wait->mtx, NULL);
+	PTHREAD_COND_init(&wait->cv, NULL);
+	wait->done = false;
+}
+
+static void fsal_io_done(struct fsal_obj_handle *obj, fsal_status_t ret,
+			 void *caller_data)
+{
+	struct fsal_io_wait *wait = caller_data;
+
+	PTHREAD_MUTEX_lock(&wait->mtx);
+	wait->status = ret;
+	wait->done = true;
+	pthread_cond_signal(&wait->cv);
+	PTHREAD_MUTEX_unlock(&wait->mtx);
+}
+
+static fsal_status_t fsal_io_wait(struct fsal_io_wait *wait)
+{
+	PTHREAD_MUTEX_lock(&wait->mtx);
+	while (!wait->done)
+		pthread_cond_wait(&wait->cv, &wait->mtx);
+	PTHREAD_MUTEX_unlock(&wait->mtx);
+
+	PTHREAD_COND_destroy(&wait->cv);
+	PTHREAD_MUTEX_destroy(&wait->mtx);
+
+	return wait->status;
+}
+
 /**
  * @brief New style reads
  *
@@ -1031,9 +1089,15 @@ fsal_status_t fsal_read2(struct fsal_obj_handle *obj,
 {
 	/* Error return from FSAL calls */
 	fsal_status_t status = { 0, 0 };
+	struct fsal_io_wait wait;
 
-	status = obj->obj_ops.read2(obj, bypass, state, offset, io_size, buffer,
-				    bytes_moved, eof, info);
+	/* The protocol layer can not yet park a request while its I/O is
+	 * outstanding, so wait here for FSALs that complete later.
+	 */
+	fsal_io_wait_init(&wait);
+	obj->obj_ops.read2_async(obj, bypass, state, offset, io_size, buffer,
+				 bytes_moved, eof, info, fsal_io_done, &wait);
+	status = fsal_io_wait(&wait);
 
 	/* Fixup FSAL_SHARE_DENIED status */
 	if (status.major == ERR_FSAL_SHARE_DENIED)
@@ -1084,21 +1148,26 @@ fsal_status_t fsal_write2(struct fsal_obj_handle *obj,
 {
 	/* Error return from FSAL calls */
 	fsal_status_t status = { 0, 0 };
+	struct fsal_io_wait wait;
 
 	if (op_ctx->export_perms->options & EXPORT_OPTION_COMMIT) {
 		/* Force sync if export requires it */
 		*sync = true;
 	}
 
-	status = obj->obj_ops.write2(obj,
-				     bypass,
-				     state,
-				     offset,
-				     io_size,
-				     buffer,
-				     bytes_moved,
-				     sync,
-				     info);
+	fsal_io_wait_init(&wait);
+	obj->obj_ops.write2_async(obj,
+				  bypass,
+				  state,
+				  offset,
+				  io_size,
+				  buffer,
+				  bytes_moved,
+				  sync,
+				  info,
+				  fsal_io_done,
+				  &wait);
+	status = fsal_io_wait(&wait);
 
 	/* Fixup ERR_FSAL_SHARE_DENIED status */
 	if (status.major == ERR_FSAL_SHARE_DENIED)
@@ -1121,6 +1190,108 @@ fsal_status_t fsal_write2(struct fsal_obj_handle *obj,
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
+/** Size of each read and write when falling back from FSAL copy */
+#define FSAL_COPY_CHUNK (1024 * 1024)
+
+/** Most copied by one fsal_copy when falling back from FSAL copy */
+#define FSAL_COPY_FALLBACK_MAX (64 * FSAL_COPY_CHUNK)
+
+/**
+ * @brief Copy a range of one file into another
+ *
+ * Ask the FSAL to copy; if it can not, read and write in chunks here,
+ * which still keeps the data off the network.  Copying stops short (as
+ * a WRITE may) at end of file, at FSAL_COPY_FALLBACK_MAX when falling
+ * back, or on an error after some data has been copied.
+ *
+ * Both files must be regular files of the current export.
+ *
+ * @param[in]  dst         File to copy into
+ * @param[in]  dst_state   state_t for dst, or NULL
+ * @param[in]  dst_offset  Position in dst to copy to
+ * @param[in]  src         File to copy from
+ * @param[in]  src_state   state_t for src, or NULL
+ * @param[in]  src_offset  Position in src to copy from
+ * @param[in]  count       Amount to copy, 0 for to end of file
+ * @param[out] copied      Amount copied
+ *
+ * @return FSAL status
+ */
+
+fsal_status_t fsal_copy(struct fsal_obj_handle *dst,
+			struct state_t *dst_state,
+			uint64_t dst_offset,
+			struct fsal_obj_handle *src,
+			struct state_t *src_state,
+			uint64_t src_offset,
+			uint64_t count,
+			uint64_t *copied)
+{
+	fsal_status_t status;
+	uint64_t limit;
+	size_t chunk, nb_read, nb_written;
+	void *buffer;
+	bool eof, sync;
+
+	*copied = 0;
+
+	status = dst->obj_ops.copy(dst, dst_state, dst_offset,
+				   src, src_state, src_offset, count, copied);
+
+	if (status.major != ERR_FSAL_NOTSUPP) {
+		LogFullDebug(COMPONENT_FSAL,
+			     "FSAL COPY operation returned %s, count=%"
+			     PRIu64 ", copied=%" PRIu64,
+			     fsal_err_txt(status), count, *copied);
+		return status;
+	}
+
+	limit = count;
+	if (limit == 0 || limit > FSAL_COPY_FALLBACK_MAX)
+		limit = FSAL_COPY_FALLBACK_MAX;
+
+	buffer = iobuf_get(FSAL_COPY_CHUNK);
+	*copied = 0;
+
+	while (*copied < limit) {
+		chunk = MIN(limit - *copied, FSAL_COPY_CHUNK);
+		eof = false;
+
+		status = fsal_read2(src, false, src_state,
+				    src_offset + *copied, chunk, &nb_read,
+				    buffer, &eof, NULL);
+
+		if (FSAL_IS_ERROR(status) || nb_read == 0)
+			break;
+
+		sync = false;
+		status = fsal_write2(dst, false, dst_state,
+				     dst_offset + *copied, nb_read,
+				     &nb_written, buffer, &sync, NULL);
+
+		if (FSAL_IS_ERROR(status))
+			break;
+
+		*copied += nb_written;
+
+		if (nb_written < nb_read || eof)
+			break;
+	}
+
+	iobuf_put(buffer);
+
+	LogFullDebug(COMPONENT_FSAL,
+		     "COPY by read and write returned %s, count=%" PRIu64
+		     ", copied=%" PRIu64,
+		     fsal_err_txt(status), count, *copied);
+
+	/* Report a partial copy as a short one */
+	if (FSAL_IS_ERROR(status) && *copied != 0)
+		status = fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+	return status;
+}
+
 /**
  * @brief Read/Write
  *
@@ -1572,6 +1743,8 @@ fsal_remove(struct fsal_obj_handle *parent, const char *name)
 		goto out;
 	}
 
+	state_dir_notify(parent, NOTIFY4_REMOVE_ENTRY, name, NULL);
+
 out:
 
 	to_remove_obj->obj_ops.put_ref(to_remove_obj);
@@ -1644,6 +1817,14 @@ fsal_status_t fsal_rename(struct fsal_obj_handle *dir_src,
 		goto out;
 	}
 
+	if (dir_src == dir_dest) {
+		state_dir_notify(dir_src, NOTIFY4_RENAME_ENTRY,
+				 oldname, newname);
+	} else {
+		state_dir_notify(dir_src, NOTIFY4_REMOVE_ENTRY, oldname, NULL);
+		state_dir_notify(dir_dest, NOTIFY4_ADD_ENTRY, newname, NULL);
+	}
+
 out:
 	if (lookup_src) {
 		/* Note that even with a junction, this object is in the same
@@ -48,12 +48,19 @@
  * returns it after execution.
  *
  * Every async call returns 0 on success and a POSIX error code on error.
+ *
+ * Invalidates without a callback are coalesced: while one is queued
+ * for an object, later ones for the same object only add their flags
+ * to it.  All queued invalidates are run by a single job, grouped by
+ * export, optionally after waiting Upcall_Coalesce_Usec for more to
+ * come in.
  */
 
 #include "config.h"
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
 #include "nfs_core.h"
 #include "log.h"
 #include "fsal.h"
@@ -65,6 +72,9 @@
 /* Invalidate */
 
 struct invalidate_args {
+	struct glist_head hash_link;	/*< On its coalesce bucket */
+	struct glist_head queue_link;	/*< On the coalesce queue */
+	uint64_t hash;
 	const struct fsal_up_vector *vec;
 	struct gsh_buffdesc obj;
 	uint32_t flags;
@@ -73,6 +83,22 @@ struct invalidate_args {
 	char key[];
 };
 
+#define UP_COALESCE_BUCKETS 1024
+
+/**
+ * @brief Invalidates waiting to be run by the coalesce job
+ */
+static struct {
+	pthread_mutex_t mtx;
+	struct glist_head queue;	/*< In arrival order */
+	size_t count;
+	bool scheduled;			/*< A coalesce job is queued */
+	bool init;
+	struct glist_head bucket[UP_COALESCE_BUCKETS];
+} up_coalesce = {
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+};
+
 static void queue_invalidate(struct fridgethr_context *ctx)
 {
 	struct invalidate_args *args = ctx->arg;
@@ -88,6 +114,152 @@ static void queue_invalidate(struct fridgethr_context *ctx)
 	gsh_free(args);
 }
 
+static int invalidate_args_cmp(const void *a, const void *b)
+{
+	const struct invalidate_args *x = *(struct invalidate_args **)a;
+	const struct invalidate_args *y = *(struct invalidate_args **)b;
+
+	if (x->vec != y->vec)
+		return x->vec < y->vec ? -1 : 1;
+
+	return 0;
+}
+
+/**
+ * @brief Run every coalesced invalidate queued so far
+ *
+ * The batch is sorted by export so each export's invalidates run
+ * together; qsort is not stable, so the order within an export is
+ * not kept, which does not matter as each object is there only once.
+ */
+static void up_coalesce_run(void)
+{
+	struct glist_head batch;
+	struct invalidate_args **vec_args, *args;
+	struct glist_head *glist;
+	size_t count, i = 0;
+	fsal_status_t status;
+
+	glist_init(&batch);
+
+	PTHREAD_MUTEX_lock(&up_coalesce.mtx);
+	glist_for_each(glist, &up_coalesce.queue) {
+		args = glist_entry(glist, struct invalidate_args, queue_link);
+		glist_del(&args->hash_link);
+	}
+	glist_splice_tail(&batch, &up_coalesce.queue);
+	count = up_coalesce.count;
+	up_coalesce.count = 0;
+	up_coalesce.scheduled = false;
+	PTHREAD_MUTEX_unlock(&up_coalesce.mtx);
+
+	if (count == 0)
+		return;
+
+	vec_args = gsh_malloc(count * sizeof(*vec_args));
+	glist_for_each(glist, &batch)
+		vec_args[i++] = glist_entry(glist, struct invalidate_args,
+					    queue_link);
+
+	qsort(vec_args, count, sizeof(*vec_args), invalidate_args_cmp);
+
+	LogFullDebug(COMPONENT_FSAL_UP,
+		     "Running %zu coalesced invalidates", count);
+
+	for (i = 0; i < count; i++) {
+		args = vec_args[i];
+		status = args->vec->up_fsal_export->up_ops->invalidate(
+							args->vec,
+							&args->obj,
+							args->flags);
+		if (FSAL_IS_ERROR(status) && status.major != ERR_FSAL_NOENT)
+			LogDebug(COMPONENT_FSAL_UP,
+				 "Coalesced invalidate failed: %s",
+				 msg_fsal_err(status.major));
+		gsh_free(args);
+	}
+
+	gsh_free(vec_args);
+}
+
+static void queue_coalesced_invalidates(struct fridgethr_context *ctx)
+{
+	if (nfs_param.core_param.upcall_coalesce_usec != 0)
+		usleep(nfs_param.core_param.upcall_coalesce_usec);
+
+	up_coalesce_run();
+}
+
+/**
+ * @brief Queue an invalidate without callback for coalescing
+ */
+static void up_coalesce_invalidate(struct fridgethr *fr,
+				   const struct fsal_up_vector *vec,
+				   struct gsh_buffdesc *obj, uint32_t flags)
+{
+	struct glist_head *bucket, *glist;
+	struct invalidate_args *args;
+	uint64_t hash;
+	bool schedule;
+	int rc, i;
+
+	hash = fsal_key_hash(obj) ^ (uintptr_t) vec;
+
+	PTHREAD_MUTEX_lock(&up_coalesce.mtx);
+
+	if (!up_coalesce.init) {
+		glist_init(&up_coalesce.queue);
+		for (i = 0; i < UP_COALESCE_BUCKETS; i++)
+			glist_init(&up_coalesce.bucket[i]);
+		up_coalesce.init = true;
+	}
+
+	bucket = &up_coalesce.bucket[hash % UP_COALESCE_BUCKETS];
+
+	glist_for_each(glist, bucket) {
+		args = glist_entry(glist, struct invalidate_args, hash_link);
+		if (args->hash == hash && args->vec == vec &&
+		    args->obj.len == obj->len &&
+		    memcmp(args->key, obj->addr, obj->len) == 0) {
+			args->flags |= flags;
+			PTHREAD_MUTEX_unlock(&up_coalesce.mtx);
+			return;
+		}
+	}
+
+	args = gsh_malloc(sizeof(struct invalidate_args) + obj->len);
+
+	args->hash = hash;
+	args->vec = vec;
+	args->flags = flags;
+	args->cb = NULL;
+	args->cb_arg = NULL;
+	memcpy(args->key, obj->addr, obj->len);
+	args->obj.addr = args->key;
+	args->obj.len = obj->len;
+
+	glist_add_tail(bucket, &args->hash_link);
+	glist_add_tail(&up_coalesce.queue, &args->queue_link);
+	up_coalesce.count++;
+
+	schedule = !up_coalesce.scheduled;
+	up_coalesce.scheduled = true;
+
+	PTHREAD_MUTEX_unlock(&up_coalesce.mtx);
+
+	if (!schedule)
+		return;
+
+	rc = fridgethr_submit(fr, queue_coalesced_invalidates, NULL);
+
+	if (rc != 0) {
+		/* Nothing else will pick the queue up, so run it here */
+		LogDebug(COMPONENT_FSAL_UP,
+			 "Could not queue coalesced invalidates, rc %d", rc);
+		up_coalesce_run();
+	}
+}
+
 fsal_status_t up_async_invalidate(struct fridgethr *fr,
 				  const struct fsal_up_vector *vec,
 			struct gsh_buffdesc *obj, uint32_t flags,
@@ -96,6 +268,11 @@ fsal_status_t up_async_invalidate(struct fridgethr *fr,
 	struct invalidate_args *args = NULL;
 	int rc = 0;
 
+	if (cb == NULL) {
+		up_coalesce_invalidate(fr, vec, obj, flags);
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+	}
+
 	args = gsh_malloc(sizeof(struct invalidate_args) + obj->len);
 
 	args->vec = vec;
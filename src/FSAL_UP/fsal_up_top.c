@@ -105,6 +105,34 @@ fsal_status_t invalidate(const struct fsal_up_vector *vec,
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 }
 
+/** Invalidate a directory and everything below it
+ *
+ * @param[in] vec    Up ops vector
+ * @param[in] handle Directory being invalidated
+ *
+ * @return FSAL status
+ *
+ */
+
+static fsal_status_t invalidate_subtree(const struct fsal_up_vector *vec,
+					struct gsh_buffdesc *handle)
+{
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/** Invalidate every cached object of an export
+ *
+ * @param[in] vec    Up ops vector
+ *
+ * @return FSAL status
+ *
+ */
+
+static fsal_status_t invalidate_export(const struct fsal_up_vector *vec)
+{
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
 /**
  * @brief Update cached attributes
  *
@@ -1089,9 +1117,7 @@ static enum recall_resp_action handle_recall_response(
 static inline void
 free_delegrecall_context(struct delegrecall_context *deleg_ctx)
 {
-	PTHREAD_MUTEX_lock(&deleg_ctx->drc_clid->cid_mutex);
 	update_lease(deleg_ctx->drc_clid);
-	PTHREAD_MUTEX_unlock(&deleg_ctx->drc_clid->cid_mutex);
 
 	put_gsh_export(deleg_ctx->drc_exp);
 
@@ -1152,8 +1178,6 @@ static int32_t delegrecall_completion_func(rpc_call_t *call,
 	switch (hook) {
 	case RPC_CALL_COMPLETE:
 		LogMidDebug(COMPONENT_NFS_CB, "call result: %d", call->stat);
-		fh = call->cbt.v_u.v4.args.argarray.argarray_val->
-				nfs_cb_argop4_u.opcbrecall.fh.nfs_fh4_val;
 		if (call->stat != RPC_SUCCESS) {
 			LogEvent(COMPONENT_NFS_CB,
 				 "Call stat: %d, marking CB channel down",
@@ -1217,10 +1241,18 @@ out_free_drc:
 
 out_free:
 
-	fh = call->cbt.v_u.v4.args.argarray.argarray_val->
+	/* A v4.1 compound leads with the CB_SEQUENCE */
+	if (call->chan->type == RPC_CHAN_V41) {
+		fh = call->cbt.v_u.v4.args.argarray.argarray_val[1].
+				nfs_cb_argop4_u.opcbrecall.fh.nfs_fh4_val;
+		gsh_free(fh);
+		nfs41_complete_single(call, hook, arg, flags);
+	} else {
+		fh = call->cbt.v_u.v4.args.argarray.argarray_val[0].
 				nfs_cb_argop4_u.opcbrecall.fh.nfs_fh4_val;
-	gsh_free(fh);
-	free_rpc_call(call);
+		gsh_free(fh);
+		free_rpc_call(call);
+	}
 
 	if (state != NULL)
 		dec_state_t_ref(state);
@@ -1267,6 +1299,32 @@ void delegrecall_one(struct fsal_obj_handle *obj,
 
 	inc_recalls(p_cargs->drc_clid->gsh_client);
 
+	argop->argop = NFS4_OP_CB_RECALL;
+	COPY_STATEID(&argop->nfs_cb_argop4_u.opcbrecall.stateid, state);
+	argop->nfs_cb_argop4_u.opcbrecall.truncate = false;
+	argop->nfs_cb_argop4_u.opcbrecall.fh.nfs_fh4_val = NULL;
+
+	/* NFSv4.1 clients are called back over a session back channel */
+	if (p_cargs->drc_clid->cid_minorversion > 0) {
+		if (!nfs4_FSALToFhandle(true,
+					&argop->nfs_cb_argop4_u.opcbrecall.fh,
+					obj, p_cargs->drc_exp)) {
+			LogCrit(COMPONENT_FSAL_UP,
+				"nfs4_FSALToFhandle failed, can not process recall");
+			goto out;
+		}
+
+		if (nfs_rpc_v41_single(p_cargs->drc_clid, argop,
+				       &state->state_refer,
+				       delegrecall_completion_func,
+				       p_cargs, NULL) == 0)
+			return;
+
+		LogDebug(COMPONENT_NFS_CB,
+			 "No back channel up, not issuing a recall");
+		goto out;
+	}
+
 	/* Attempt a recall only if channel state is UP */
 	if (get_cb_chan_down(p_cargs->drc_clid)) {
 		LogCrit(COMPONENT_NFS_CB,
@@ -1296,10 +1354,6 @@ void delegrecall_one(struct fsal_obj_handle *obj,
 			    p_cargs->drc_clid->cid_cb.v40.cb_callback_ident,
 			    "brrring!!!", 10);
 
-	argop->argop = NFS4_OP_CB_RECALL;
-	COPY_STATEID(&argop->nfs_cb_argop4_u.opcbrecall.stateid, state);
-	argop->nfs_cb_argop4_u.opcbrecall.truncate = false;
-
 	/* Convert it to a file handle */
 	if (!nfs4_FSALToFhandle(true, &argop->nfs_cb_argop4_u.opcbrecall.fh,
 				obj, p_cargs->drc_exp)) {
@@ -1487,86 +1541,286 @@ static int schedule_delegrevoke_check(struct delegrecall_context *ctx,
 	return rc;
 }
 
-state_status_t delegrecall_impl(struct fsal_obj_handle *obj)
+/**
+ * @brief Start the recall of one delegation
+ *
+ * @note The state_lock MUST be held for write
+ *
+ * @param[in] obj   File or directory the delegation is on
+ * @param[in] state Delegation state
+ */
+void delegrecall_state(struct fsal_obj_handle *obj, struct state_t *state)
 {
-	struct glist_head *glist, *glist_n;
-	state_status_t rc = 0;
 	uint32_t *deleg_state = NULL;
-	struct state_t *state;
 	state_owner_t *owner;
 	struct delegrecall_context *drc_ctx;
 
+	if (isDebug(COMPONENT_NFS_CB)) {
+		char str[LOG_BUFF_LEN] = "\0";
+		struct display_buffer dspbuf = {sizeof(str), str, str};
+
+		display_stateid(&dspbuf, state);
+		LogDebug(COMPONENT_NFS_CB, "Delegation for %s", str);
+	}
+
+	deleg_state = &state->state_data.deleg.sd_state;
+	if (*deleg_state != DELEG_GRANTED) {
+		LogDebug(COMPONENT_FSAL_UP,
+			 "Delegation already being recalled, NOOP");
+		return;
+	}
+	*deleg_state = DELEG_RECALL_WIP;
+
+	drc_ctx = gsh_malloc(sizeof(struct delegrecall_context));
+
+	/* Get references on the owner and the the export. The
+	 * export reference we will hold while we perform the recall.
+	 * The owner reference will be used to get access to the
+	 * clientid and reserve the lease.
+	 */
+	if (!get_state_obj_export_owner_refs(state, NULL,
+					     &drc_ctx->drc_exp,
+					     &owner)) {
+		LogDebug(COMPONENT_FSAL_UP,
+			 "Something is going stale, no need to recall delegation");
+		gsh_free(drc_ctx);
+		return;
+	}
+
+	drc_ctx->drc_clid = owner->so_owner.so_nfs4_owner.so_clientrec;
+	COPY_STATEID(&drc_ctx->drc_stateid, state);
+	inc_client_id_ref(drc_ctx->drc_clid);
+	dec_state_owner_ref(owner);
+
+	if (obj->type == REGULAR_FILE) {
+		obj->state_hdl->file.fdeleg_stats.fds_last_recall = time(NULL);
+		obj->state_hdl->file.fdeleg_stats.fds_recalls_sent++;
+	}
+
+	/* Prevent client's lease expiring until we complete
+	 * this recall/revoke operation. If the client's lease
+	 * has already expired, let the reaper thread handling
+	 * expired clients revoke this delegation, and we just
+	 * skip it here.
+	 */
+	if (!reserve_lease(drc_ctx->drc_clid)) {
+		put_gsh_export(drc_ctx->drc_exp);
+		dec_client_id_ref(drc_ctx->drc_clid);
+		gsh_free(drc_ctx);
+		return;
+	}
+
+	delegrecall_one(obj, state, drc_ctx);
+}
+
+state_status_t delegrecall_impl(struct fsal_obj_handle *obj)
+{
+	struct glist_head *glist, *glist_n, *states;
+	state_status_t rc = 0;
+	struct state_t *state;
+
 	LogDebug(COMPONENT_FSAL_UP,
 		 "FSAL_UP_DELEG: obj %p type %u",
 		 obj, obj->type);
 
+	if (obj->type == DIRECTORY)
+		states = &obj->state_hdl->dir.dir_delegations;
+	else
+		states = &obj->state_hdl->file.list_of_states;
+
 	PTHREAD_RWLOCK_wrlock(&obj->state_hdl->state_lock);
-	glist_for_each_safe(glist, glist_n,
-			    &obj->state_hdl->file.list_of_states) {
+	glist_for_each_safe(glist, glist_n, states) {
 		state = glist_entry(glist, struct state_t, state_list);
 
 		if (state->state_type != STATE_TYPE_DELEG)
 			continue;
 
-		if (isDebug(COMPONENT_NFS_CB)) {
-			char str[LOG_BUFF_LEN] = "\0";
-			struct display_buffer dspbuf = {sizeof(str), str, str};
+		delegrecall_state(obj, state);
+	}
+	PTHREAD_RWLOCK_unlock(&obj->state_hdl->state_lock);
+	return rc;
+}
 
-			display_stateid(&dspbuf, state);
-			LogDebug(COMPONENT_NFS_CB, "Delegation for %s", str);
-		}
+/**
+ * @brief Data for a CB_NOTIFY on a directory delegation
+ */
 
-		deleg_state = &state->state_data.deleg.sd_state;
-		if (*deleg_state != DELEG_GRANTED) {
-			LogDebug(COMPONENT_FSAL_UP,
-				 "Delegation already being recalled, NOOP");
-			continue;
-		}
-		*deleg_state = DELEG_RECALL_WIP;
+struct dir_notify_context {
+	nfs_cb_argop4 dnc_arg;		/*< Arguments (so we can free them) */
+	struct notify4 dnc_notify;	/*< The one change being sent */
+	stateid4 dnc_stateid;		/*< Delegation to recall on failure */
+};
 
-		drc_ctx = gsh_malloc(sizeof(struct delegrecall_context));
+static void free_dir_notify_context(struct dir_notify_context *dnc)
+{
+	nfs4_freeFH(&dnc->dnc_arg.nfs_cb_argop4_u.opcbnotify.cna_fh);
+	gsh_free(dnc->dnc_notify.notify_vals.notifylist4_val);
+	gsh_free(dnc);
+}
 
-		/* Get references on the owner and the the export. The
-		 * export reference we will hold while we perform the recall.
-		 * The owner reference will be used to get access to the
-		 * clientid and reserve the lease.
-		 */
-		if (!get_state_obj_export_owner_refs(state, NULL,
-						     &drc_ctx->drc_exp,
-						     &owner)) {
-			LogDebug(COMPONENT_FSAL_UP,
-				 "Something is going stale, no need to recall delegation");
-			gsh_free(drc_ctx);
-			continue;
-		}
+/**
+ * @brief Handle the reply to a CB_NOTIFY
+ *
+ * A client that did not take the notification holds a stale view of
+ * the directory, so its delegation is recalled instead.
+ *
+ * @param[in] call  The RPC call being completed
+ * @param[in] hook  The hook itself
+ * @param[in] arg   Supplied argument (the notify context)
+ * @param[in] flags There are no flags.
+ *
+ * @return 0, constantly.
+ */
 
-		drc_ctx->drc_clid = owner->so_owner.so_nfs4_owner.so_clientrec;
-		COPY_STATEID(&drc_ctx->drc_stateid, state);
-		inc_client_id_ref(drc_ctx->drc_clid);
-		dec_state_owner_ref(owner);
+static int32_t dir_notify_completion(rpc_call_t *call, rpc_call_hook hook,
+				     void *arg, uint32_t flags)
+{
+	struct dir_notify_context *dnc = arg;
+	struct fsal_obj_handle *obj;
+	struct state_t *state;
 
-		obj->state_hdl->file.fdeleg_stats.fds_last_recall = time(NULL);
+	LogFullDebug(COMPONENT_NFS_CB, "status %d arg %p",
+		     call->cbt.v_u.v4.res.status, arg);
 
-		/* Prevent client's lease expiring until we complete
-		 * this recall/revoke operation. If the client's lease
-		 * has already expired, let the reaper thread handling
-		 * expired clients revoke this delegation, and we just
-		 * skip it here.
-		 */
-		PTHREAD_MUTEX_lock(&drc_ctx->drc_clid->cid_mutex);
-		if (!reserve_lease(drc_ctx->drc_clid)) {
-			PTHREAD_MUTEX_unlock(&drc_ctx->drc_clid->cid_mutex);
-			put_gsh_export(drc_ctx->drc_exp);
-			dec_client_id_ref(drc_ctx->drc_clid);
-			gsh_free(drc_ctx);
-			continue;
-		}
-		PTHREAD_MUTEX_unlock(&drc_ctx->drc_clid->cid_mutex);
+	if (hook == RPC_CALL_COMPLETE &&
+	    call->cbt.v_u.v4.res.status == NFS4_OK)
+		goto out;
 
-		delegrecall_one(obj, state, drc_ctx);
+	state = nfs4_State_Get_Pointer(dnc->dnc_stateid.other);
+
+	if (state == NULL)
+		goto out;
+
+	obj = get_state_obj_ref(state);
+
+	if (obj != NULL) {
+		PTHREAD_RWLOCK_wrlock(&obj->state_hdl->state_lock);
+		delegrecall_state(obj, state);
+		PTHREAD_RWLOCK_unlock(&obj->state_hdl->state_lock);
+		obj->obj_ops.put_ref(obj);
 	}
-	PTHREAD_RWLOCK_unlock(&obj->state_hdl->state_lock);
-	return rc;
+
+	dec_state_t_ref(state);
+
+out:
+
+	nfs41_complete_single(call, hook, arg, flags);
+	free_dir_notify_context(dnc);
+	return 0;
+}
+
+/**
+ * @brief Send a CB_NOTIFY for one directory delegation
+ *
+ * Only the entry notifications a client may ask for in
+ * GET_DIR_DELEGATION are sent, with no attributes and no cookies.
+ *
+ * @note The state_lock MUST be held for write
+ *
+ * @param[in] dir     Directory the delegation is on
+ * @param[in] state   Directory delegation
+ * @param[in] type    NOTIFY4_ADD_ENTRY, NOTIFY4_REMOVE_ENTRY or
+ *                    NOTIFY4_RENAME_ENTRY
+ * @param[in] name    Entry added or removed, or the old name on rename
+ * @param[in] newname New name on rename, otherwise NULL
+ *
+ * @return true if the notification was sent, false if the caller has to
+ *         fall back to a recall.
+ */
+
+bool notify_dir_deleg(struct fsal_obj_handle *dir, struct state_t *state,
+		      notify_type4 type, const char *name,
+		      const char *newname)
+{
+	struct dir_notify_context *dnc;
+	CB_NOTIFY4args *cb_notify;
+	struct gsh_export *export;
+	state_owner_t *owner;
+	nfs_client_id_t *clid;
+	notify_remove4 nrm;
+	notify_add4 nad;
+	XDR body;
+	u_int size;
+	bool ok;
+
+	if (!get_state_obj_export_owner_refs(state, NULL, &export, &owner))
+		return false;
+
+	clid = owner->so_owner.so_nfs4_owner.so_clientrec;
+
+	/* freed in dir_notify_completion */
+	dnc = gsh_calloc(1, sizeof(*dnc));
+	COPY_STATEID(&dnc->dnc_stateid, state);
+
+	cb_notify = &dnc->dnc_arg.nfs_cb_argop4_u.opcbnotify;
+	dnc->dnc_arg.argop = NFS4_OP_CB_NOTIFY;
+	COPY_STATEID(&cb_notify->cna_stateid, state);
+	cb_notify->cna_changes.cna_changes_len = 1;
+	cb_notify->cna_changes.cna_changes_val = &dnc->dnc_notify;
+
+	if (!nfs4_FSALToFhandle(true, &cb_notify->cna_fh, dir, export)) {
+		ok = false;
+		goto out;
+	}
+
+	dnc->dnc_notify.notify_mask.bitmap4_len = 1;
+	dnc->dnc_notify.notify_mask.map[0] = 1U << type;
+
+	/* Fixed parts of a rename, the largest change, fit in 64 bytes */
+	size = 64 + strlen(name) + (newname != NULL ? strlen(newname) : 0);
+	dnc->dnc_notify.notify_vals.notifylist4_val = gsh_malloc(size);
+
+	xdrmem_create(&body, dnc->dnc_notify.notify_vals.notifylist4_val,
+		      size, XDR_ENCODE);
+
+	memset(&nrm, 0, sizeof(nrm));
+	memset(&nad, 0, sizeof(nad));
+
+	switch (type) {
+	case NOTIFY4_REMOVE_ENTRY:
+		nrm.nrm_old_entry.ne_file.utf8string_val = (char *) name;
+		nrm.nrm_old_entry.ne_file.utf8string_len = strlen(name);
+		ok = xdr_notify_remove4(&body, &nrm);
+		break;
+	case NOTIFY4_ADD_ENTRY:
+		nad.nad_new_entry.ne_file.utf8string_val = (char *) name;
+		nad.nad_new_entry.ne_file.utf8string_len = strlen(name);
+		ok = xdr_notify_add4(&body, &nad);
+		break;
+	case NOTIFY4_RENAME_ENTRY:
+		nrm.nrm_old_entry.ne_file.utf8string_val = (char *) name;
+		nrm.nrm_old_entry.ne_file.utf8string_len = strlen(name);
+		nad.nad_new_entry.ne_file.utf8string_val = (char *) newname;
+		nad.nad_new_entry.ne_file.utf8string_len = strlen(newname);
+		ok = xdr_notify_remove4(&body, &nrm) &&
+		     xdr_notify_add4(&body, &nad);
+		break;
+	default:
+		ok = false;
+		break;
+	}
+
+	dnc->dnc_notify.notify_vals.notifylist4_len = xdr_getpos(&body);
+	xdr_destroy(&body);
+
+	if (!ok) {
+		LogCrit(COMPONENT_NFS_CB,
+			"Could not encode notification type %d", type);
+		goto out;
+	}
+
+	ok = nfs_rpc_v41_single(clid, &dnc->dnc_arg, &state->state_refer,
+				dir_notify_completion, dnc, NULL) == 0;
+
+out:
+
+	if (!ok)
+		free_dir_notify_context(dnc);
+
+	put_gsh_export(export);
+	dec_state_owner_ref(owner);
+
+	return ok;
 }
 
 /**
@@ -1647,7 +1901,9 @@ struct fsal_up_vector fsal_up_top = {
 	.layoutrecall = layoutrecall,
 	.notify_device = notify_device,
 	.delegrecall = delegrecall,
-	.invalidate_close = invalidate_close
+	.invalidate_close = invalidate_close,
+	.invalidate_subtree = invalidate_subtree,
+	.invalidate_export = invalidate_export
 };
 
 /** @} */
@@ -45,6 +45,7 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <poll.h>
+#include <sys/epoll.h>
 #include <arpa/inet.h>		/* For inet_ntop() */
 #include "hashtable.h"
 #include "log.h"
@@ -57,6 +58,7 @@
 #include "nfs_file_handle.h"
 #include "client_mgr.h"
 #include "server_stats.h"
+#include "iobuf_pool.h"
 #include "9p.h"
 #include <stdbool.h>
 
@@ -94,247 +96,340 @@ void DispatchWork9P(request_data_t *req)
 	/* increase connection refcount */
 	(void) atomic_inc_uint32_t(&req->r_u._9p.pconn->refcount);
 
+	/* 9P arguments are parsed by the service functions, so decoding
+	 * only covers what was done here and parsing counts as execution.
+	 */
+	req_phase_end(req, REQ_PHASE_DECODE);
+
 	/* new-style dispatch */
 	nfs_rpc_enqueue_req(req);
 }
 
 /**
- * _9p_socket_thread: 9p socket manager.
+ * @brief A 9P/TCP connection
  *
- * This function is the main loop for the 9p socket manager.
- * One such thread exists per connection.
+ * The socket is non blocking and watched by one of the event threads,
+ * which reads messages as they come and hands each one to the worker
+ * pool.  Workers send their replies themselves, in whatever order they
+ * finish, under the connection's sock_lock.
  *
- * @param Arg the socket number cast as a void * in pthread_create
- *
- * @return NULL
+ * The event thread holds one reference on the connection and each
+ * request in flight another; the last one to go tears it down.
+ */
+struct _9p_tcp_conn {
+	struct _9p_conn conn;
+	char hdr[_9P_HDR_SIZE];	/*< Length of the message being read */
+	char *msg;		/*< Message being read, once hdr is in */
+	uint32_t readlen;	/*< Bytes of it read so far */
+	char strcaller[INET6_ADDRSTRLEN];
+};
+
+/** Most messages read from one connection before serving the others */
+#define _9P_TCP_BATCH 16
+
+/** Most events taken from epoll at once */
+#define _9P_EVENT_BATCH 64
+
+static int *_9p_epoll_fds;
+
+/**
+ * @brief Release a reference on a 9P/TCP connection
  *
+ * @param[in] pconn The connection
  */
 
-void *_9p_socket_thread(void *Arg)
+void _9p_tcp_conn_put(struct _9p_conn *pconn)
 {
-	long int tcp_sock = (long int)Arg;
-	int rc = -1;
-	struct pollfd fds[1];
-	int fdcount = 1;
-	static char my_name[MAXNAMLEN + 1];
-	char strcaller[INET6_ADDRSTRLEN];
-	request_data_t *req = NULL;
-	int tag;
-	unsigned long sequence = 0;
-	unsigned int i = 0;
-	char *_9pmsg = NULL;
-	uint32_t msglen;
+	struct _9p_tcp_conn *tcp_conn =
+		container_of(pconn, struct _9p_tcp_conn, conn);
+	struct req_op_context *saved_ctx = op_ctx;
+	unsigned int i;
 
-	struct _9p_conn _9p_conn;
-	socklen_t addrpeerlen;
+	if (atomic_dec_uint32_t(&pconn->refcount) != 0)
+		return;
 
-	int readlen = 0;
-	int total_readlen = 0;
+	LogEvent(COMPONENT_9P, "Closing connection on socket %lu",
+		 pconn->trans_data.sockfd);
+	close(pconn->trans_data.sockfd);
 
-	snprintf(my_name, MAXNAMLEN, "9p_sock_mgr#fd=%ld", tcp_sock);
-	SetNameFunction(my_name);
+	op_ctx = NULL;
+	_9p_cleanup_fids(pconn);
+	op_ctx = saved_ctx;
+
+	if (pconn->client != NULL)
+		put_gsh_client(pconn->client);
+
+	for (i = 0; i < FLUSH_BUCKETS; i++)
+		PTHREAD_MUTEX_destroy(&pconn->flush_buckets[i].lock);
+	PTHREAD_MUTEX_destroy(&pconn->sock_lock);
+	PTHREAD_MUTEX_destroy(&pconn->fid_lock);
+
+	gsh_free_tag(GSH_MEM_9P, tcp_conn, sizeof(*tcp_conn));
+}
+
+/**
+ * @brief Set up a newly accepted 9P/TCP connection
+ *
+ * @param[in] tcp_sock The socket
+ *
+ * @return The connection, with the event thread's reference.
+ */
+
+static struct _9p_tcp_conn *_9p_tcp_conn_new(long int tcp_sock)
+{
+	struct _9p_tcp_conn *tcp_conn;
+	struct _9p_conn *pconn;
+	socklen_t addrpeerlen;
+	unsigned int i;
+	int rc;
+
+	tcp_conn = gsh_calloc_tag(GSH_MEM_9P, 1, sizeof(*tcp_conn));
+	pconn = &tcp_conn->conn;
 
 	/* Init the struct _9p_conn structure */
-	memset(&_9p_conn, 0, sizeof(_9p_conn));
-	PTHREAD_MUTEX_init(&_9p_conn.sock_lock, NULL);
-	_9p_conn.trans_type = _9P_TCP;
-	_9p_conn.trans_data.sockfd = tcp_sock;
+	PTHREAD_MUTEX_init(&pconn->sock_lock, NULL);
+	PTHREAD_MUTEX_init(&pconn->fid_lock, NULL);
+	pconn->trans_type = _9P_TCP;
+	pconn->trans_data.sockfd = tcp_sock;
 	for (i = 0; i < FLUSH_BUCKETS; i++) {
-		PTHREAD_MUTEX_init(&_9p_conn.flush_buckets[i].lock, NULL);
-		glist_init(&_9p_conn.flush_buckets[i].list);
+		PTHREAD_MUTEX_init(&pconn->flush_buckets[i].lock, NULL);
+		glist_init(&pconn->flush_buckets[i].list);
 	}
-	atomic_store_uint32_t(&_9p_conn.refcount, 0);
-
-	/* Init the fids pointers array */
-	memset(&_9p_conn.fids, 0, _9P_FID_PER_CONN * sizeof(struct _9p_fid *));
+	atomic_store_uint32_t(&pconn->refcount, 1);
 
 	/* Set initial msize.
 	 * Client may request a lower value during TVERSION */
-	_9p_conn.msize = _9p_param._9p_tcp_msize;
+	pconn->msize = _9p_param._9p_tcp_msize;
 
-	if (gettimeofday(&_9p_conn.birth, NULL) == -1)
+	if (gettimeofday(&pconn->birth, NULL) == -1)
 		LogFatal(COMPONENT_9P, "Cannot get connection's time of birth");
 
-	addrpeerlen = sizeof(_9p_conn.addrpeer);
-	rc = getpeername(tcp_sock, (struct sockaddr *)&_9p_conn.addrpeer,
+	addrpeerlen = sizeof(pconn->addrpeer);
+	rc = getpeername(tcp_sock, (struct sockaddr *)&pconn->addrpeer,
 			 &addrpeerlen);
 	if (rc == -1) {
 		LogMajor(COMPONENT_9P,
 			 "Cannot get peername to tcp socket for 9p, error %d (%s)",
 			 errno, strerror(errno));
-		/* XXX */
-		strncpy(strcaller, "(unresolved)", INET6_ADDRSTRLEN);
-		strcaller[12] = '\0';
+		strcpy(tcp_conn->strcaller, "(unresolved)");
 	} else {
-		switch (_9p_conn.addrpeer.ss_family) {
+		switch (pconn->addrpeer.ss_family) {
 		case AF_INET:
-			inet_ntop(_9p_conn.addrpeer.ss_family,
-				  &((struct sockaddr_in *)&_9p_conn.addrpeer)->
-				  sin_addr, strcaller, INET6_ADDRSTRLEN);
+			inet_ntop(pconn->addrpeer.ss_family,
+				  &((struct sockaddr_in *)&pconn->addrpeer)->
+				  sin_addr, tcp_conn->strcaller,
+				  INET6_ADDRSTRLEN);
 			break;
 		case AF_INET6:
-			inet_ntop(_9p_conn.addrpeer.ss_family,
-				  &((struct sockaddr_in6 *)&_9p_conn.addrpeer)->
-				  sin6_addr, strcaller, INET6_ADDRSTRLEN);
+			inet_ntop(pconn->addrpeer.ss_family,
+				  &((struct sockaddr_in6 *)&pconn->addrpeer)->
+				  sin6_addr, tcp_conn->strcaller,
+				  INET6_ADDRSTRLEN);
 			break;
 		default:
-			snprintf(strcaller, INET6_ADDRSTRLEN, "BAD ADDRESS");
+			snprintf(tcp_conn->strcaller, INET6_ADDRSTRLEN,
+				 "BAD ADDRESS");
 			break;
 		}
 
 		LogEvent(COMPONENT_9P, "9p socket #%ld is connected to %s",
-			 tcp_sock, strcaller);
+			 tcp_sock, tcp_conn->strcaller);
 	}
-	_9p_conn.client = get_gsh_client(&_9p_conn.addrpeer, false);
+	pconn->client = get_gsh_client(&pconn->addrpeer, false);
 
-	/* Set up the structure used by poll */
-	memset((char *)fds, 0, sizeof(struct pollfd));
-	fds[0].fd = tcp_sock;
-	fds[0].events =
-	    POLLIN | POLLPRI | POLLRDBAND | POLLRDNORM | POLLRDHUP | POLLHUP |
-	    POLLERR | POLLNVAL;
+	return tcp_conn;
+}
 
-	for (;;) {
-		total_readlen = 0;  /* new message */
-		rc = poll(fds, fdcount, -1);
-		if (rc == -1) {
-			/* timeout = -1 => Wait indefinitely for events */
-			/* Interruption if not an issue */
-			if (errno == EINTR)
-				continue;
+/**
+ * @brief Read what a 9P/TCP connection has for us
+ *
+ * Complete messages are dispatched to the workers; a partial one is
+ * kept for the next time the socket is readable.
+ *
+ * @param[in] tcp_conn The connection
+ *
+ * @return false if the connection must be closed.
+ */
 
-			LogCrit(COMPONENT_9P,
-				"Got error %u (%s) on fd %ld connect to %s while polling on socket",
-				errno, strerror(errno), tcp_sock, strcaller);
-		}
+static bool _9p_tcp_conn_read(struct _9p_tcp_conn *tcp_conn)
+{
+	struct _9p_conn *pconn = &tcp_conn->conn;
+	long int tcp_sock = pconn->trans_data.sockfd;
+	request_data_t *req;
+	uint32_t msglen;
+	ssize_t readlen;
+	int msgcount = 0;
+	int tag;
 
-		if (fds[0].revents & POLLNVAL) {
-			LogEvent(COMPONENT_9P,
-				 "Client %s on socket %lu produced POLLNVAL",
-				 strcaller, tcp_sock);
-			goto end;
-		}
+	while (msgcount < _9P_TCP_BATCH) {
+		/* An incoming 9P request: the msg has a 4 bytes header
+		   showing the size of the msg including the header */
+		if (tcp_conn->msg == NULL) {
+			readlen = recv(tcp_sock,
+				       tcp_conn->hdr + tcp_conn->readlen,
+				       _9P_HDR_SIZE - tcp_conn->readlen, 0);
+			if (readlen <= 0)
+				goto check;
+
+			tcp_conn->readlen += readlen;
+			if (tcp_conn->readlen < _9P_HDR_SIZE)
+				continue;
 
-		if (fds[0].revents & (POLLERR | POLLHUP | POLLRDHUP)) {
-			LogEvent(COMPONENT_9P,
-				 "Client %s on socket %lu has shut down and closed",
-				 strcaller, tcp_sock);
-			goto end;
-		}
+			msglen = *(uint32_t *) tcp_conn->hdr;
+			if (msglen > pconn->msize || msglen < _9P_HDR_SIZE) {
+				LogCrit(COMPONENT_9P,
+					"Bad message size from client %s, got %u, max = %u",
+					tcp_conn->strcaller, msglen,
+					pconn->msize);
+				return false;
+			}
 
-		if (!(fds[0].revents & (POLLIN | POLLRDNORM)))
-			continue;
+			tcp_conn->msg = iobuf_get(pconn->msize);
+			memcpy(tcp_conn->msg, tcp_conn->hdr, _9P_HDR_SIZE);
+		}
 
-		/* Prepare to read the message */
-		_9pmsg = gsh_malloc(_9p_conn.msize);
+		msglen = *(uint32_t *) tcp_conn->msg;
+		if (tcp_conn->readlen < msglen) {
+			readlen = recv(tcp_sock,
+				       tcp_conn->msg + tcp_conn->readlen,
+				       msglen - tcp_conn->readlen, 0);
+			if (readlen <= 0)
+				goto check;
 
-		/* An incoming 9P request: the msg has a 4 bytes header
-		   showing the size of the msg including the header */
-		readlen = recv(fds[0].fd, _9pmsg,
-			       _9P_HDR_SIZE, MSG_WAITALL);
-		if (readlen != _9P_HDR_SIZE)
-			goto badmsg;
-
-		msglen = *(uint32_t *) _9pmsg;
-		if (msglen > _9p_conn.msize) {
-			LogCrit(COMPONENT_9P,
-				"Message size too big! got %u, max = %u",
-				msglen, _9p_conn.msize);
-			goto end;
+			tcp_conn->readlen += readlen;
+			if (tcp_conn->readlen < msglen)
+				continue;
 		}
 
 		LogFullDebug(COMPONENT_9P,
 			     "Received 9P/TCP message of size %u from client %s on socket %lu",
-			     msglen, strcaller, tcp_sock);
+			     msglen, tcp_conn->strcaller, tcp_sock);
 
-		total_readlen += readlen;
-		while (total_readlen < msglen) {
-			readlen = recv(fds[0].fd,
-				       _9pmsg + total_readlen,
-				       msglen - total_readlen,
-				       0);
-
-			if (readlen > 0) {
-				total_readlen += readlen;
-				continue;
-			}
-			if (readlen == 0 ||
-			    (readlen < 0 && errno != EINTR))
-				goto badmsg;
-		}	/* while */
-
-		server_stats_transport_done(_9p_conn.client,
-					    total_readlen, 1, 0,
+		server_stats_transport_done(pconn->client,
+					    msglen, 1, 0,
 					    0, 0, 0);
 
 		/* Message is good. */
 		req = pool_alloc(request_pool);
+		req_phase_begin(req);
 
 		req->rtype = _9P_REQUEST;
-		req->r_u._9p._9pmsg = _9pmsg;
-		req->r_u._9p.pconn = &_9p_conn;
+		req->r_u._9p._9pmsg = tcp_conn->msg;
+		req->r_u._9p.pconn = pconn;
 
 		/* Add this request to the request list,
 		 * should it be flushed later. */
-		tag = *(u16 *) (_9pmsg + _9P_HDR_SIZE +
+		tag = *(u16 *) (tcp_conn->msg + _9P_HDR_SIZE +
 				_9P_TYPE_SIZE);
 		_9p_AddFlushHook(&req->r_u._9p, tag,
-				 sequence++);
+				 pconn->sequence++);
 		LogFullDebug(COMPONENT_9P,
 			     "Request tag is %d\n", tag);
 
+		/* Not our buffer anymore */
+		tcp_conn->msg = NULL;
+		tcp_conn->readlen = 0;
+		msgcount++;
+
 		/* Message was OK push it */
 		DispatchWork9P(req);
+	}
 
-		/* Not our buffer anymore */
-		_9pmsg = NULL;
-		continue;
-
-badmsg:
-		if (readlen == 0)
-			LogEvent(COMPONENT_9P,
-				 "Premature end for Client %s on socket %lu, total read = %u",
-				 strcaller, tcp_sock, total_readlen);
-		else if (readlen < 0) {
-			LogEvent(COMPONENT_9P,
-				 "Read error client %s on socket %lu errno=%d, total read = %u",
-				 strcaller, tcp_sock,
-				 errno, total_readlen);
-		} else
-			LogEvent(COMPONENT_9P,
-				 "Header too small! for client %s on socket %lu: readlen=%u expected=%u",
-				 strcaller, tcp_sock, readlen,
-				 _9P_HDR_SIZE);
-
-		/* Either way, we close the connection.
-		 * It is not possible to survive
-		 * once we get out of sync in the TCP stream
-		 * with the client
-		 */
-		break; /* bail out */
-	}			/* for( ;; ) */
-
-end:
-	LogEvent(COMPONENT_9P, "Closing connection on socket %lu", tcp_sock);
-	close(tcp_sock);
+	return true;
+
+check:
+	if (readlen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+			    errno == EINTR))
+		return true;
+
+	if (readlen == 0)
+		LogEvent(COMPONENT_9P,
+			 "Client %s on socket %lu has shut down and closed, total read = %u",
+			 tcp_conn->strcaller, tcp_sock, tcp_conn->readlen);
+	else
+		LogEvent(COMPONENT_9P,
+			 "Read error client %s on socket %lu errno=%d, total read = %u",
+			 tcp_conn->strcaller, tcp_sock,
+			 errno, tcp_conn->readlen);
+
+	/* Either way, we close the connection.
+	 * It is not possible to survive
+	 * once we get out of sync in the TCP stream
+	 * with the client
+	 */
+	return false;
+}
+
+/**
+ * @brief Stop reading a 9P/TCP connection and drop it
+ *
+ * Requests still running on it fail to send their replies and release
+ * it when they are done.
+ *
+ * @param[in] epoll_fd Event thread's epoll instance
+ * @param[in] tcp_conn The connection
+ */
+
+static void _9p_tcp_conn_close(int epoll_fd, struct _9p_tcp_conn *tcp_conn)
+{
+	long int tcp_sock = tcp_conn->conn.trans_data.sockfd;
+
+	(void) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, tcp_sock, NULL);
+	(void) shutdown(tcp_sock, SHUT_RDWR);
 
 	/* Free buffer if we encountered an error
 	 * before we could give it to a worker */
-	if (_9pmsg)
-		gsh_free(_9pmsg);
-
-	while (atomic_fetch_uint32_t(&_9p_conn.refcount)) {
-		LogEvent(COMPONENT_9P, "Waiting for workers to release pconn");
-		sleep(1);
+	if (tcp_conn->msg != NULL) {
+		iobuf_put(tcp_conn->msg);
+		tcp_conn->msg = NULL;
 	}
 
-	_9p_cleanup_fids(&_9p_conn);
+	_9p_tcp_conn_put(&tcp_conn->conn);
+}
+
+/**
+ * _9p_event_thread: read the 9P/TCP connections given to it.
+ *
+ * @param Arg the index of the thread's epoll instance
+ *
+ * @return NULL
+ */
+
+static void *_9p_event_thread(void *Arg)
+{
+	int epoll_fd = _9p_epoll_fds[(long int)Arg];
+	struct epoll_event events[_9P_EVENT_BATCH];
+	struct _9p_tcp_conn *tcp_conn;
+	char my_name[MAXNAMLEN + 1];
+	int i, n;
+
+	snprintf(my_name, MAXNAMLEN, "9p_evt#%ld", (long int)Arg);
+	SetNameFunction(my_name);
+
+	for (;;) {
+		n = epoll_wait(epoll_fd, events, _9P_EVENT_BATCH, -1);
+		if (n < 0) {
+			if (errno != EINTR)
+				LogCrit(COMPONENT_9P,
+					"Got error %d (%s) waiting for 9p sockets",
+					errno, strerror(errno));
+			continue;
+		}
 
-	if (_9p_conn.client != NULL)
-		put_gsh_client(_9p_conn.client);
+		for (i = 0; i < n; i++) {
+			tcp_conn = events[i].data.ptr;
 
-	pthread_exit(NULL);
-}				/* _9p_socket_thread */
+			/* Read what is there even if the client hung up */
+			if (events[i].events & (EPOLLIN | EPOLLRDHUP |
+						EPOLLHUP | EPOLLERR)) {
+				if (!_9p_tcp_conn_read(tcp_conn))
+					_9p_tcp_conn_close(epoll_fd, tcp_conn);
+			}
+		}
+	}
+
+	return NULL;
+}
 
 /**
  * _9p_create_socket_V4 : create the socket and bind for 9P using
@@ -544,6 +639,11 @@ void *_9p_dispatcher_thread(void *Arg)
 	long int newsock = -1;
 	pthread_attr_t attr_thr;
 	pthread_t tcp_thrid;
+	struct _9p_tcp_conn *tcp_conn;
+	struct epoll_event event;
+	uint32_t nthreads = _9p_param._9p_tcp_event_threads;
+	uint32_t next = 0;
+	long int i;
 
 	SetNameFunction("_9p_disp");
 
@@ -576,10 +676,31 @@ void *_9p_dispatcher_thread(void *Arg)
 		LogDebug(COMPONENT_9P_DISPATCH,
 			 "can't set pthread's join state");
 
-	LogEvent(COMPONENT_9P_DISPATCH, "9P dispatcher started");
+	/* Connections are spread over a few event threads */
+	_9p_epoll_fds = gsh_calloc(nthreads, sizeof(*_9p_epoll_fds));
+	for (i = 0; i < nthreads; i++) {
+		_9p_epoll_fds[i] = epoll_create1(EPOLL_CLOEXEC);
+		if (_9p_epoll_fds[i] < 0)
+			LogFatal(COMPONENT_9P_DISPATCH,
+				 "Could not create 9p epoll instance, error = %d (%s)",
+				 errno, strerror(errno));
+
+		rc = pthread_create(&tcp_thrid, &attr_thr,
+				    _9p_event_thread, (void *)i);
+		if (rc != 0) {
+			LogFatal(COMPONENT_THREAD,
+				 "Could not create 9p event thread, error = %d (%s)",
+				 rc, strerror(rc));
+		}
+	}
+
+	LogEvent(COMPONENT_9P_DISPATCH,
+		 "9P dispatcher started with %" PRIu32 " event threads",
+		 nthreads);
 
 	while (true) {
-		newsock = accept(_9p_socket, NULL, NULL);
+		newsock = accept4(_9p_socket, NULL, NULL,
+				  SOCK_NONBLOCK | SOCK_CLOEXEC);
 
 		if (newsock < 0) {
 			LogCrit(COMPONENT_9P_DISPATCH, "accept failed: %d",
@@ -587,13 +708,18 @@ void *_9p_dispatcher_thread(void *Arg)
 			continue;
 		}
 
-		/* Starting the thread dedicated to signal handling */
-		rc = pthread_create(&tcp_thrid, &attr_thr,
-				    _9p_socket_thread, (void *)newsock);
-		if (rc != 0) {
-			LogFatal(COMPONENT_THREAD,
-				 "Could not create 9p socket manager thread, error = %d (%s)",
-				 errno, strerror(errno));
+		tcp_conn = _9p_tcp_conn_new(newsock);
+
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.ptr = tcp_conn;
+
+		if (epoll_ctl(_9p_epoll_fds[next++ % nthreads], EPOLL_CTL_ADD,
+			      newsock, &event) != 0) {
+			LogCrit(COMPONENT_9P_DISPATCH,
+				"Could not watch 9p socket #%ld, error = %d (%s)",
+				newsock, errno, strerror(errno));
+			_9p_tcp_conn_put(&tcp_conn->conn);
 		}
 	}			/* while */
 
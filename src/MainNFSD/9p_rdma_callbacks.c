@@ -50,6 +50,7 @@
 #include "nfs_dupreq.h"
 #include "nfs_file_handle.h"
 #include "server_stats.h"
+#include "iobuf_pool.h"
 #include "9p.h"
 
 #include <mooshika.h>
@@ -115,12 +116,12 @@ void _9p_rdma_callback_disconnect(msk_trans_t *trans)
 	_9p_rdma_cleanup_conn(trans);
 }
 
-void _9p_rdma_process_request(struct _9p_request_data *req9p)
+/**
+ * @brief Take a registered buffer to send a reply from
+ */
+static msk_data_t *_9p_rdma_get_outbuf(msk_trans_t *trans,
+				       struct _9p_rdma_priv *priv)
 {
-	uint32_t msglen;
-	int rc = 0;
-	msk_trans_t *trans = req9p->pconn->trans_data.rdma_trans;
-	struct _9p_rdma_priv *priv = _9p_rdma_priv_of(trans);
 	msk_data_t *dataout;
 
 	/* get output buffer and move forward in queue */
@@ -139,55 +140,108 @@ void _9p_rdma_process_request(struct _9p_request_data *req9p)
 	dataout->size = 0;
 	dataout->mr = priv->pernic->outmr;
 
+	return dataout;
+}
+
+/**
+ * @brief Give back a registered buffer that was not sent
+ */
+static void _9p_rdma_put_outbuf(struct _9p_rdma_priv *priv,
+				msk_data_t *dataout)
+{
+	PTHREAD_MUTEX_lock(&priv->outqueue->lock);
+	dataout->next = priv->outqueue->data;
+	priv->outqueue->data = dataout;
+	pthread_cond_signal(&priv->outqueue->cond);
+	PTHREAD_MUTEX_unlock(&priv->outqueue->lock);
+}
+
+/**
+ * @brief Process a 9P/RDMA request
+ *
+ * Write data is used where it was received, and read data is read by
+ * the FSAL straight into the registered buffer the reply is sent from,
+ * so neither is copied.  The registered output buffers are few and
+ * shared by all connections, so only the requests that return bulk
+ * data hold one while they run; the others build their reply aside
+ * and copy its few bytes into a buffer once they are done, so that
+ * slow metadata operations do not starve reads of buffers.
+ */
+void _9p_rdma_process_request(struct _9p_request_data *req9p)
+{
+	request_data_t *reqdata = container_of(req9p, request_data_t, r_u._9p);
+	uint32_t msglen;
+	int rc = 0;
+	msk_trans_t *trans = req9p->pconn->trans_data.rdma_trans;
+	struct _9p_rdma_priv *priv = _9p_rdma_priv_of(trans);
+	msk_data_t *dataout;
+	char *replydata = NULL;
+	u32 outdatalen = 0;
+	u8 msgtype;
+
 	/* Use buffer received via RDMA as a 9P message */
 	req9p->_9pmsg = req9p->data->data;
 	msglen = *(uint32_t *)req9p->_9pmsg;
 
-	if (req9p->data->size < _9P_HDR_SIZE
+	if (req9p->data->size < _9P_HDR_SIZE + _9P_TYPE_SIZE
 	    || msglen != req9p->data->size) {
 		LogMajor(COMPONENT_9P,
 			 "Malformed 9P/RDMA packet, bad header size");
 		/* send a rerror ? */
 		msk_post_recv(trans, req9p->data, _9p_rdma_callback_recv,
 			      _9p_rdma_callback_recv_err, NULL);
-	} else {
-		LogFullDebug(COMPONENT_9P,
-			     "Received 9P/RDMA message of size %u",
-			     msglen);
+		_9p_DiscardFlushHook(req9p);
+		return;
+	}
+
+	LogFullDebug(COMPONENT_9P,
+		     "Received 9P/RDMA message of size %u",
+		     msglen);
 
+	msgtype = _9p_msgtype(req9p->_9pmsg);
+	if (msgtype == _9P_TREAD || msgtype == _9P_TREADDIR) {
+		dataout = _9p_rdma_get_outbuf(trans, priv);
 		rc = _9p_process_buffer(req9p, dataout->data, &dataout->size);
-		if (rc != 1) {
-			LogMajor(COMPONENT_9P,
-				 "Could not process 9P buffer on trans %p",
-				 req9p->pconn->trans_data.rdma_trans);
+	} else {
+		replydata = iobuf_get(req9p->pconn->msize);
+		rc = _9p_process_buffer(req9p, replydata, &outdatalen);
+		dataout = _9p_rdma_get_outbuf(trans, priv);
+		if (rc == 1) {
+			memcpy(dataout->data, replydata, outdatalen);
+			dataout->size = outdatalen;
 		}
+		iobuf_put(replydata);
+	}
+	req_phase_end(reqdata, REQ_PHASE_EXECUTE);
+	if (rc != 1) {
+		LogMajor(COMPONENT_9P,
+			 "Could not process 9P buffer on trans %p",
+			 req9p->pconn->trans_data.rdma_trans);
+	}
 
-		msk_post_recv(trans, req9p->data, _9p_rdma_callback_recv,
-			      _9p_rdma_callback_recv_err, NULL);
+	msk_post_recv(trans, req9p->data, _9p_rdma_callback_recv,
+		      _9p_rdma_callback_recv_err, NULL);
 
-		/* If earlier processing succeeded, post it */
-		if (rc == 1) {
-			if (0 !=
-			    msk_post_send(trans, dataout,
-					  _9p_rdma_callback_send,
-					  _9p_rdma_callback_send_err,
-					  NULL))
-				rc = -1;
-		}
+	/* If earlier processing succeeded, post it */
+	if (rc == 1) {
+		if (0 !=
+		    msk_post_send(trans, dataout,
+				  _9p_rdma_callback_send,
+				  _9p_rdma_callback_send_err,
+				  NULL))
+			rc = -1;
+	}
+	req_phase_end(reqdata, REQ_PHASE_REPLY);
 
-		if (rc != 1) {
-			LogMajor(COMPONENT_9P,
-				 "Could not send buffer on trans %p",
-				 req9p->pconn->trans_data.rdma_trans);
-			/* Give the buffer back right away
-			 * since no buffer is being sent */
-			PTHREAD_MUTEX_lock(&priv->outqueue->lock);
-			dataout->next = priv->outqueue->data;
-			priv->outqueue->data = dataout;
-			pthread_cond_signal(&priv->outqueue->cond);
-			PTHREAD_MUTEX_unlock(&priv->outqueue->lock);
-		}
+	if (rc != 1) {
+		LogMajor(COMPONENT_9P,
+			 "Could not send buffer on trans %p",
+			 req9p->pconn->trans_data.rdma_trans);
+		/* Give the buffer back right away
+		 * since no buffer is being sent */
+		_9p_rdma_put_outbuf(priv, dataout);
 	}
+
 	_9p_DiscardFlushHook(req9p);
 }
 
@@ -198,6 +252,7 @@ void _9p_rdma_callback_recv(msk_trans_t *trans, msk_data_t *data, void *arg)
 	char *_9pmsg = NULL;
 
 	req = pool_alloc(request_pool);
+	req_phase_begin(req);
 
 	req->rtype = _9P_REQUEST;
 	req->r_u._9p._9pmsg = _9pmsg;
@@ -39,12 +39,17 @@
 #include "sal_data.h"
 #include "idmapper.h"
 #include "delayed_exec.h"
+#include "server_metrics.h"
 #include "export_mgr.h"
 #include "fsal.h"
 #include "netgroup_cache.h"
+#include "mdcache.h"
+#include "nfs_rpc_callback.h"
+#ifdef _USE_NLM
+#include "nsm.h"
+#endif
 #ifdef USE_DBUS
 #include "gsh_dbus.h"
-#include "mdcache.h"
 #endif
 
 /**
@@ -214,6 +219,46 @@ static struct gsh_dbus_method method_shutdown = {
 		 END_ARG_LIST}
 };
 
+/**
+ * @brief Dbus method for replacing the running server binary
+ *
+ * Execs the server binary again and hands it our listening sockets.
+ * We keep serving until it is up, then drain and exit.
+ *
+ * @param[in]  args  Unused
+ * @param[out] reply Status of starting the new server
+ */
+
+static bool admin_dbus_upgrade(DBusMessageIter *args,
+			       DBusMessage *reply,
+			       DBusError *error)
+{
+	char *errormsg = "Upgrade started";
+	bool success = true;
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	if (args != NULL) {
+		errormsg = "Upgrade takes no arguments.";
+		success = false;
+		LogWarn(COMPONENT_DBUS, "%s", errormsg);
+		goto out;
+	}
+
+	success = nfs_upgrade_start(&errormsg);
+
+ out:
+	dbus_status_reply(&iter, success, errormsg);
+	return success;
+}
+
+static struct gsh_dbus_method method_upgrade = {
+	.name = "upgrade",
+	.method = admin_dbus_upgrade,
+	.args = {STATUS_REPLY,
+		 END_ARG_LIST}
+};
+
 /**
  * @brief Dbus method for flushing manage gids cache
  *
@@ -322,14 +367,93 @@ static struct gsh_dbus_method method_init_fds_limit = {
 		 END_ARG_LIST}
 };
 
+/**
+ * @brief Dbus method for changing a performance parameter
+ *
+ * Takes the parameter name as in the config file and its new value.
+ * See core_tunables[] and mdcache_tunables[] for what can change.
+ *
+ * @param[in]  args  Name and value
+ * @param[out] reply Status
+ */
+static bool admin_dbus_set_tunable(DBusMessageIter *args,
+				   DBusMessage *reply,
+				   DBusError *error)
+{
+	char *errormsg = "Parameter changed";
+	bool success = false;
+	DBusMessageIter iter;
+	char *name;
+	uint64_t value;
+	int rc;
+
+	dbus_message_iter_init_append(reply, &iter);
+	if (args == NULL ||
+	    dbus_message_iter_get_arg_type(args) != DBUS_TYPE_STRING) {
+		errormsg = "Set tunable takes a parameter name and a value.";
+		LogWarn(COMPONENT_DBUS, "%s", errormsg);
+		goto out;
+	}
+	dbus_message_iter_get_basic(args, &name);
+
+	if (!dbus_message_iter_next(args) ||
+	    dbus_message_iter_get_arg_type(args) != DBUS_TYPE_UINT64) {
+		errormsg = "Set tunable arg 2 not a uint64.";
+		LogWarn(COMPONENT_DBUS, "%s", errormsg);
+		goto out;
+	}
+	dbus_message_iter_get_basic(args, &value);
+
+	rc = nfs_set_tunable(name, value);
+	switch (rc) {
+	case 0:
+		success = true;
+		break;
+	case ENOENT:
+		errormsg = "Not a parameter that can change at runtime.";
+		break;
+	case ERANGE:
+		errormsg = "Value out of range for the parameter.";
+		break;
+	default:
+		errormsg = "Value refused, see the log.";
+		break;
+	}
+	if (!success)
+		LogWarn(COMPONENT_DBUS, "set_tunable %s %" PRIu64 ": %s",
+			name, value, errormsg);
+
+ out:
+	dbus_status_reply(&iter, success, errormsg);
+	return success;
+}
+
+static struct gsh_dbus_method method_set_tunable = {
+	.name = "set_tunable",
+	.method = admin_dbus_set_tunable,
+	.args = {{
+		  .name = "name",
+		  .type = "s",
+		  .direction = "in",
+		 },
+		 {
+		  .name = "value",
+		  .type = "t",
+		  .direction = "in",
+		 },
+		 STATUS_REPLY,
+		 END_ARG_LIST}
+};
 
 static struct gsh_dbus_method *admin_methods[] = {
 	&method_shutdown,
+	&method_upgrade,
 	&method_grace_period,
 	&method_get_grace,
 	&method_purge_gids,
 	&method_purge_netgroups,
 	&method_init_fds_limit,
+	&method_set_tunable,
 	NULL
 };
 
@@ -400,6 +524,9 @@ static void do_shutdown(void)
 	gsh_dbus_pkgshutdown();
 #endif
 
+	LogEvent(COMPONENT_MAIN, "Stopping metrics endpoint.");
+	metrics_shutdown();
+
 	LogEvent(COMPONENT_MAIN, "Stopping delayed executor.");
 	delayed_shutdown();
 	LogEvent(COMPONENT_MAIN, "Delayed executor stopped.");
@@ -453,6 +580,9 @@ static void do_shutdown(void)
 			 "Worker threads successfully shut down.");
 	}
 
+	LogEvent(COMPONENT_MAIN, "Stopping callback threads");
+	nfs_rpc_cb_pkgshutdown();
+
 	rc = general_fridge_shutdown();
 	if (rc != 0) {
 		LogMajor(COMPONENT_THREAD,
@@ -471,6 +601,14 @@ static void do_shutdown(void)
 		LogEvent(COMPONENT_THREAD, "Reaper thread shut down.");
 	}
 
+#ifdef _USE_NLM
+	LogEvent(COMPONENT_MAIN, "Stopping NSM thread.");
+	nsm_shutdown();
+#endif
+
+	LogEvent(COMPONENT_MAIN, "Saving MDCACHE warm start snapshot.");
+	mdcache_warm_shutdown();
+
 	LogEvent(COMPONENT_MAIN, "Removing all exports.");
 	remove_all_exports();
 
@@ -491,7 +629,9 @@ static void do_shutdown(void)
 		LogEvent(COMPONENT_MAIN, "FSAL system destroyed.");
 	}
 
-	unlink(pidfile_path);
+	/* The pid file belongs to our successor now */
+	if (!nfs_upgrading)
+		unlink(pidfile_path);
 }
 
 void *admin_thread(void *UnusedArg)
@@ -0,0 +1,430 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file  nfs_inflight.c
+ * @brief Requests being executed right now
+ *
+ * Every worker thread owns a struct req_inflight, listed here while the
+ * thread lives.  The worker fills it in as it goes: the request when
+ * it starts executing, each NFSv4 operation of a compound, the reply,
+ * and the sub-FSAL call MDCACHE is making (see subcall_raw).  Nothing
+ * is locked on that path; readers copy a slot under its sequence count
+ * and try again if it changed.
+ *
+ * When a request finishes it is logged if it took longer than
+ * Slow_Request_Threshold.  9P requests are not tracked.
+ */
+
+#include "config.h"
+#include <string.h>
+#include <ctype.h>
+#include "log.h"
+#include "abstract_mem.h"
+#include "abstract_atomic.h"
+#include "nfs_core.h"
+#include "nfs_exports.h"
+#include "export_mgr.h"
+#ifdef USE_DBUS
+#include "gsh_dbus.h"
+#endif
+
+#define NFS_pcp nfs_param.core_param
+#define NFS_program NFS_pcp.program
+
+/** Attempts at a consistent copy of a busy slot before skipping it */
+#define REQ_INFLIGHT_RETRIES 64
+
+__thread struct req_inflight *req_inflight_cur;
+
+static struct glist_head req_inflight_list =
+	GLIST_HEAD_INIT(req_inflight_list);
+static pthread_mutex_t req_inflight_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void req_inflight_write_begin(struct req_inflight *ri)
+{
+	(void) atomic_inc_uint32_t(&ri->seq);
+}
+
+static inline void req_inflight_write_end(struct req_inflight *ri)
+{
+	(void) atomic_inc_uint32_t(&ri->seq);
+}
+
+static int32_t req_inflight_export_id(void)
+{
+	return op_ctx->ctx_export != NULL ? op_ctx->ctx_export->export_id : -1;
+}
+
+static void req_inflight_set_fh(struct req_inflight *ri, const void *fh,
+				uint32_t fh_len)
+{
+	if (fh == NULL)
+		fh_len = 0;
+	if (fh_len > sizeof(ri->fh))
+		fh_len = sizeof(ri->fh);
+
+	memcpy(ri->fh, fh, fh_len);
+	ri->fh_len = fh_len;
+}
+
+/**
+ * @brief Give the calling worker its slot
+ *
+ * @param[in] worker Worker index
+ */
+void req_inflight_register(unsigned int worker)
+{
+	struct req_inflight *ri = gsh_calloc(1, sizeof(*ri));
+
+	ri->worker = worker;
+	ri->export_id = -1;
+
+	PTHREAD_MUTEX_lock(&req_inflight_mtx);
+	glist_add_tail(&req_inflight_list, &ri->list);
+	PTHREAD_MUTEX_unlock(&req_inflight_mtx);
+
+	req_inflight_cur = ri;
+}
+
+/**
+ * @brief Drop the calling worker's slot as the thread exits
+ */
+void req_inflight_unregister(void)
+{
+	struct req_inflight *ri = req_inflight_cur;
+
+	if (ri == NULL)
+		return;
+
+	req_inflight_cur = NULL;
+
+	PTHREAD_MUTEX_lock(&req_inflight_mtx);
+	glist_del(&ri->list);
+	PTHREAD_MUTEX_unlock(&req_inflight_mtx);
+
+	gsh_free(ri);
+}
+
+/**
+ * @brief Record the request a worker is about to execute
+ *
+ * Called from nfs_rpc_execute() once the export is known.  NFSv3 calls
+ * carry their handle first; NFSv4 handles come with each operation.
+ *
+ * @param[in] reqdata The request
+ */
+void req_inflight_begin(request_data_t *reqdata)
+{
+	struct req_inflight *ri = req_inflight_cur;
+	struct rpc_msg *msg = &reqdata->r_u.req.svc.rq_msg;
+	const void *fh = NULL;
+	uint32_t fh_len = 0;
+
+	if (ri == NULL)
+		return;
+
+#ifdef _USE_NFS3
+	if (msg->cb_prog == NFS_program[P_NFS] && msg->cb_vers == NFS_V3 &&
+	    msg->cb_proc != NFSPROC_NULL) {
+		nfs_fh3 *fh3 = (nfs_fh3 *) &reqdata->r_u.req.arg_nfs;
+
+		fh = fh3->data.data_val;
+		fh_len = fh3->data.data_len;
+	}
+#endif
+
+	req_inflight_write_begin(ri);
+	ri->proc = reqdata->r_u.req.funcdesc->funcname;
+	ri->op = ri->proc;
+	ri->xid = msg->rm_xid;
+	ri->export_id = req_inflight_export_id();
+	ri->phase = REQ_PHASE_EXECUTE;
+	ri->received = reqdata->time_queued;
+	now(&ri->started);
+	if (op_ctx->caller_addr != NULL)
+		memcpy(&ri->client, op_ctx->caller_addr, sizeof(ri->client));
+	else
+		memset(&ri->client, 0, sizeof(ri->client));
+	req_inflight_set_fh(ri, fh, fh_len);
+	req_inflight_write_end(ri);
+}
+
+/**
+ * @brief Record the NFSv4 operation a compound has reached
+ *
+ * @param[in] op     Operation name
+ * @param[in] fh     Current filehandle
+ * @param[in] fh_len Its length
+ */
+void req_inflight_op(const char *op, const void *fh, uint32_t fh_len)
+{
+	struct req_inflight *ri = req_inflight_cur;
+
+	if (ri == NULL || ri->proc == NULL)
+		return;
+
+	req_inflight_write_begin(ri);
+	ri->op = op;
+	ri->export_id = req_inflight_export_id();
+	req_inflight_set_fh(ri, fh, fh_len);
+	req_inflight_write_end(ri);
+}
+
+/**
+ * @brief Record the phase the current request has reached
+ *
+ * @param[in] phase The phase
+ */
+void req_inflight_phase(enum req_phase phase)
+{
+	struct req_inflight *ri = req_inflight_cur;
+
+	if (ri == NULL || ri->proc == NULL)
+		return;
+
+	req_inflight_write_begin(ri);
+	ri->phase = phase;
+	req_inflight_write_end(ri);
+}
+
+/**
+ * @brief Clear a worker's slot, logging the request if it was slow
+ *
+ * Called once nfs_rpc_execute() returns, the time to decode the request
+ * counting with the rest.
+ *
+ * @param[in] reqdata The request just executed
+ */
+void req_inflight_end(request_data_t *reqdata)
+{
+	struct req_inflight *ri = req_inflight_cur;
+	uint32_t threshold = nfs_param.core_param.slow_request_threshold;
+	struct timespec ts;
+	nsecs_elapsed_t total;
+	char client[SOCK_NAME_MAX];
+
+	if (ri == NULL || ri->proc == NULL)
+		return;
+
+	now(&ts);
+	total = timespec_diff(&ri->received, &ts) +
+		reqdata->phase[REQ_PHASE_DECODE];
+
+	if (threshold != 0 &&
+	    total >= (nsecs_elapsed_t) threshold * NS_PER_MSEC) {
+		if (sprint_sockip(&ri->client, client, sizeof(client)) == 0)
+			strcpy(client, "<unknown>");
+
+		LogWarn(COMPONENT_DISPATCH,
+			"Slow request %s (last op %s) xid=%" PRIu32
+			" from %s export %" PRIi32 " took %" PRIu64
+			" us: decode %" PRIu64 " queue %" PRIu64
+			" execute %" PRIu64 " fsal %" PRIu64 " reply %" PRIu64,
+			ri->proc, ri->op, ri->xid, client, ri->export_id,
+			total / NS_PER_USEC,
+			reqdata->phase[REQ_PHASE_DECODE] / NS_PER_USEC,
+			reqdata->phase[REQ_PHASE_QUEUE] / NS_PER_USEC,
+			reqdata->phase[REQ_PHASE_EXECUTE] / NS_PER_USEC,
+			reqdata->phase[REQ_PHASE_FSAL] / NS_PER_USEC,
+			reqdata->phase[REQ_PHASE_REPLY] / NS_PER_USEC);
+	}
+
+	req_inflight_write_begin(ri);
+	ri->proc = NULL;
+	ri->op = NULL;
+	ri->export_id = -1;
+	ri->fh_len = 0;
+	req_inflight_write_end(ri);
+}
+
+/**
+ * @brief Count the workers executing a request and those in the FSAL
+ *
+ * A snapshot for the worker pool autotuner; fields are read without
+ * their sequence count since only whether they are set matters.
+ *
+ * @param[out] workers Workers registered
+ * @param[out] busy    Of those, executing a request
+ * @param[out] in_fsal Of those, blocked in a sub-FSAL call
+ */
+void req_inflight_count(uint32_t *workers, uint32_t *busy,
+			uint32_t *in_fsal)
+{
+	struct glist_head *glist;
+	struct req_inflight *ri;
+
+	*workers = *busy = *in_fsal = 0;
+
+	PTHREAD_MUTEX_lock(&req_inflight_mtx);
+	glist_for_each(glist, &req_inflight_list) {
+		ri = glist_entry(glist, struct req_inflight, list);
+		(*workers)++;
+		if (atomic_fetch_voidptr((void **)&ri->proc) != NULL)
+			(*busy)++;
+		if (atomic_fetch_voidptr((void **)&ri->fsal_call) != NULL)
+			(*in_fsal)++;
+	}
+	PTHREAD_MUTEX_unlock(&req_inflight_mtx);
+}
+
+#ifdef USE_DBUS
+/**
+ * @brief Take a consistent copy of a slot
+ *
+ * @param[in]  ri   The slot
+ * @param[out] copy Where to put it
+ *
+ * @retval false if it kept changing under us.
+ */
+static bool req_inflight_copy(struct req_inflight *ri,
+			      struct req_inflight *copy)
+{
+	uint32_t seq;
+	int tries;
+
+	for (tries = 0; tries < REQ_INFLIGHT_RETRIES; tries++) {
+		seq = atomic_fetch_uint32_t(&ri->seq);
+		if (seq & 1)
+			continue;
+		memcpy(copy, ri, sizeof(*copy));
+		if (atomic_fetch_uint32_t(&ri->seq) == seq)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Name the method in the text of a sub-FSAL call
+ *
+ * @param[in]  call Stringified call, as in subcall_raw
+ * @param[out] buf  Where to put the name
+ * @param[in]  len  Size of buf
+ */
+static void req_inflight_fsal_name(const char *call, char *buf, size_t len)
+{
+	const char *end = strchr(call, '('), *start;
+
+	if (end == NULL) {
+		strlcpy(buf, call, len);
+		return;
+	}
+
+	for (start = end; start > call; start--)
+		if (!isalnum((unsigned char)start[-1]) && start[-1] != '_')
+			break;
+
+	if ((size_t)(end - start) >= len)
+		end = start + len - 1;
+
+	memcpy(buf, start, end - start);
+	buf[end - start] = '\0';
+}
+
+/**
+ * @brief Report the requests being executed
+ *
+ * Appends the timestamp, the number of requests waiting for a worker,
+ * then for each busy worker its index, the xid, the procedure, the
+ * operation (the current one in an NFSv4 compound), the sub-FSAL method
+ * in progress or "", the export id, the phase, the client, the ns spent
+ * queued, the ns spent executing so far and the file handle.
+ */
+void req_inflight_dbus_show(DBusMessageIter *iter)
+{
+	struct timespec timestamp;
+	DBusMessageIter array_iter, struct_iter, fh_iter;
+	struct glist_head *glist;
+	struct req_inflight *ri, copy;
+	const char *fsal_call;
+	char fsal_buf[64], client_buf[SOCK_NAME_MAX];
+	char *proc, *op, *fsal = fsal_buf, *phase, *client = client_buf;
+	unsigned char *fh = (unsigned char *) copy.fh;
+	uint64_t queued, waited, running;
+
+	now(&timestamp);
+	dbus_append_timestamp(iter, &timestamp);
+
+	queued = get_enqueue_count() - get_dequeue_count();
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_UINT64, &queued);
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					 "(uusssissttay)", &array_iter);
+
+	PTHREAD_MUTEX_lock(&req_inflight_mtx);
+	glist_for_each(glist, &req_inflight_list) {
+		ri = glist_entry(glist, struct req_inflight, list);
+
+		fsal_call = atomic_fetch_voidptr((void **)&ri->fsal_call);
+		if (!req_inflight_copy(ri, &copy) || copy.proc == NULL)
+			continue;
+
+		proc = (char *) copy.proc;
+		op = (char *) copy.op;
+		fsal_buf[0] = '\0';
+		if (fsal_call != NULL)
+			req_inflight_fsal_name(fsal_call, fsal_buf,
+					       sizeof(fsal_buf));
+		if (fsal_call != NULL && copy.phase == REQ_PHASE_EXECUTE)
+			copy.phase = REQ_PHASE_FSAL;
+		phase = (char *) req_phase_name[copy.phase];
+		if (sprint_sockip(&copy.client, client_buf,
+				  sizeof(client_buf)) == 0)
+			strcpy(client_buf, "<unknown>");
+		waited = timespec_diff(&copy.received, &copy.started);
+		running = timespec_diff(&copy.started, &timestamp);
+
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &struct_iter);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32,
+					       &copy.worker);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32,
+					       &copy.xid);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &proc);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &op);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &fsal);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_INT32,
+					       &copy.export_id);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &phase);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &client);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &waited);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &running);
+		dbus_message_iter_open_container(&struct_iter, DBUS_TYPE_ARRAY,
+						 DBUS_TYPE_BYTE_AS_STRING,
+						 &fh_iter);
+		dbus_message_iter_append_fixed_array(&fh_iter, DBUS_TYPE_BYTE,
+						     &fh, copy.fh_len);
+		dbus_message_iter_close_container(&struct_iter, &fh_iter);
+		dbus_message_iter_close_container(&array_iter, &struct_iter);
+	}
+	PTHREAD_MUTEX_unlock(&req_inflight_mtx);
+
+	dbus_message_iter_close_container(iter, &array_iter);
+}
+#endif
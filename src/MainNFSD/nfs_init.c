@@ -62,6 +62,8 @@
 #include "fridgethr.h"
 #include "idmapper.h"
 #include "delayed_exec.h"
+#include "server_metrics.h"
+#include "server_topk.h"
 #include "client_mgr.h"
 #include "export_mgr.h"
 #ifdef USE_CAPS
@@ -69,6 +71,7 @@
 #endif
 #include "uid2grp.h"
 #include "netgroup_cache.h"
+#include "iobuf_pool.h"
 #include "pnfs_utils.h"
 #include "mdcache.h"
 #include <execinfo.h>
@@ -128,6 +131,8 @@ char *pidfile_path = GANESHA_PIDFILE_PATH;
  * EXPORT {}
  * EXPORT { CLIENT {} }
  *
+ * and the parameters reread_tunables() knows of in NFS_CORE_PARAM {}
+ * and CACHEINODE {}.
  */
 
 void reread_config(void)
@@ -169,6 +174,11 @@ void reread_config(void)
 	if (status < 0)
 		LogCrit(COMPONENT_CONFIG, "Error while parsing LOG entries");
 
+	/* Update the performance parameters that can change */
+	status = reread_tunables(config_struct, &err_type);
+	if (status < 0)
+		LogCrit(COMPONENT_CONFIG, "Error while parsing tunable entries");
+
 	/* Update the export configuration */
 	status = reread_exports(config_struct, &err_type);
 	if (status < 0)
@@ -339,6 +349,11 @@ void nfs_print_param_config(void)
 
 	printf("\tManage_Gids_Expiration = %" PRIu64 " ;\n",
 	       (uint64_t) nfs_param.core_param.manage_gids_expiration);
+	printf("\tNetgroup_Cache_Expiration = %" PRIu64 " ;\n",
+	       (uint64_t) nfs_param.core_param.netgroup_cache_expiration);
+	printf("\tNetgroup_Negative_Cache_Expiration = %" PRIu64 " ;\n",
+	       (uint64_t)
+	       nfs_param.core_param.netgroup_negative_cache_expiration);
 
 	if (nfs_param.core_param.drop_io_errors)
 		printf("\tDrop_IO_Errors = true ;\n");
@@ -470,6 +485,9 @@ int init_server_pkgs(void)
 
 	ng_cache_init(); /* netgroup cache */
 
+	/* I/O buffers, before exports so FSALs can register them */
+	iobuf_pool_pkginit();
+
 	/* MDCACHE Initialisation */
 	fsal_status = mdcache_pkginit();
 	if (FSAL_IS_ERROR(fsal_status)) {
@@ -525,7 +543,7 @@ static void nfs_Start_threads(void)
 		LogDebug(COMPONENT_THREAD, "can't set pthread's join state");
 
 	LogEvent(COMPONENT_THREAD, "Starting delayed executor.");
-	delayed_start();
+	delayed_start(nfs_param.core_param.delayed_wheels);
 
 	/* Starting the thread dedicated to signal handling */
 	rc = pthread_create(&sigmgr_thrid, &attr_thr, sigmgr_thread, NULL);
@@ -583,6 +601,9 @@ static void nfs_Start_threads(void)
 	LogEvent(COMPONENT_THREAD, "gsh_dbusthread was started successfully");
 #endif
 
+	/* Starting the metrics endpoint, if configured */
+	metrics_start();
+
 	/* Starting the admin thread */
 	rc = pthread_create(&admin_thrid, &attr_thr, admin_thread, NULL);
 	if (rc != 0) {
@@ -643,11 +664,14 @@ static void nfs_Init(const nfs_start_info_t *p_start_info)
 	 */
 	exports_pkginit();
 
-	nfs41_session_pool =
-	    pool_basic_init("NFSv4.1 session pool", sizeof(nfs41_session_t));
+	nfs41_session_pool = pool_tagged_init("NFSv4.1 session pool",
+					      sizeof(nfs41_session_t),
+					      GSH_MEM_STATE);
 
-	request_pool =
-	    pool_basic_init("Request pool", sizeof(request_data_t));
+	request_pool = pool_tagged_init("Request pool", sizeof(request_data_t),
+					GSH_MEM_REQUEST);
+
+	topk_pkginit();
 
 	/* If rpcsec_gss is used, set the path to the keytab */
 #ifdef _HAVE_GSSAPI
@@ -821,6 +845,9 @@ static void nfs_Init(const nfs_start_info_t *p_start_info)
 	/* Start grace period */
 	nfs4_start_grace(NULL);
 
+	/* Refill the cache from the last run while clients reclaim */
+	mdcache_warm_start();
+
 	/* callback dispatch */
 	nfs_rpc_cb_pkginit();
 #ifdef _USE_CB_SIMULATOR
@@ -942,10 +969,13 @@ void nfs_start(nfs_start_info_t *p_start_info)
 
 	nfs_init_complete();
 
+	/* If we are replacing a running server, it can go now */
+	nfs_upgrade_ready();
+
 #ifdef _USE_NLM
 	if (nfs_param.core_param.enable_NLM) {
-		/* NSM Unmonitor all */
-		nsm_unmonitor_all();
+		/* Reclaim or forget statd's hosts, start the NSM thread */
+		nsm_start();
 	}
 #endif /* _USE_NLM */
 
@@ -962,8 +992,9 @@ void nfs_start(nfs_start_info_t *p_start_info)
 	/* Regular exit */
 	LogEvent(COMPONENT_MAIN, "NFS EXIT: regular exit");
 
-	/* if not in grace period, clean up the old state directory */
-	if (!nfs_in_grace())
+	/* if not in grace period, clean up the old state directory,
+	 * unless our successor is still reclaiming from it */
+	if (!nfs_in_grace() && !nfs_upgrading)
 		nfs4_recovery_cleanup();
 
 	Cleanup();
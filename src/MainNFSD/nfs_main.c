@@ -69,6 +69,7 @@
 #include "gsh_lttng/nfs_rpc.h"
 #include "gsh_lttng/state.h"
 #include "gsh_lttng/fsal_mem.h"
+#include "gsh_lttng/fsal.h"
 #endif /* USE_LTTNG */
 
 /* parameters for NFSd startup and default values */
@@ -148,6 +149,7 @@ int main(int argc, char *argv[])
 #endif
 	sigset_t signals_to_block;
 	struct config_error_type err_type;
+	bool upgrade;
 
 	/* Set the server's boot time and epoch */
 	now(&ServerBootTime);
@@ -160,6 +162,8 @@ int main(int argc, char *argv[])
 	if (*exec_name == '\0')
 		exec_name = argv[0];
 
+	upgrade = nfs_upgrade_init(argv);
+
 	/* get host name */
 	if (gethostname(localmachine, sizeof(localmachine)) != 0) {
 		fprintf(stderr, "Could not get local host name, exiting...\n");
@@ -271,8 +275,10 @@ int main(int argc, char *argv[])
 
 	nfs_check_malloc();
 
-	/* Start in background, if wanted */
-	if (detach_flag) {
+	/* Start in background, if wanted.  A server started by an upgrade
+	 * stays the child of the one it replaces, which is already detached
+	 * and must be able to kill it if it never comes up. */
+	if (detach_flag && !upgrade) {
 #ifdef HAVE_DAEMON
 		/* daemonize the process (fork, close xterm fds,
 		 * detach from parent process) */
@@ -383,9 +389,11 @@ int main(int argc, char *argv[])
 		if (fcntl(pidfile, F_SETLK, &lk) == -1)
 			LogFatal(COMPONENT_MAIN, "Ganesha already started");
 
-		/* Put pid into file, then close it */
+		/* Put pid into file, then close it.  The server we are
+		 * upgrading from may have left a longer pid behind. */
 		(void)snprintf(linebuf, sizeof(linebuf), "%u\n", getpid());
-		if (write(pidfile, linebuf, strlen(linebuf)) == -1)
+		if (ftruncate(pidfile, 0) == -1 ||
+		    write(pidfile, linebuf, strlen(linebuf)) == -1)
 			LogCrit(COMPONENT_MAIN, "Couldn't write pid to file %s",
 				pidfile_path);
 	}
@@ -41,94 +41,74 @@ unsigned int reaper_delay = REAPER_DELAY;
 
 static struct fridgethr *reaper_fridge;
 
-static int reap_hash_table(hash_table_t *ht_reap)
+static int reap_expired_leases(void)
 {
-	struct rbt_head *head_rbt;
-	struct hash_data *addr = NULL;
-	uint32_t i;
-	struct rbt_node *pn;
+	time_t tnow = time(NULL);
 	nfs_client_id_t *client_id;
 	nfs_client_record_t *client_rec;
 	int count = 0;
 
-	/* For each bucket of the requested hashtable */
-	for (i = 0; i < ht_reap->parameter.index_size; i++) {
-		head_rbt = &ht_reap->partitions[i].rbt;
-
-restart:
-		/* acquire mutex */
-		PTHREAD_RWLOCK_wrlock(&ht_reap->partitions[i].lock);
-
-		/* go through all entries in the red-black-tree */
-		RBT_LOOP(head_rbt, pn) {
-			char str[LOG_BUFF_LEN] = "\0";
-			struct display_buffer dspbuf = {sizeof(str), str, str};
-			bool str_valid = false;
-
-			addr = RBT_OPAQ(pn);
-			client_id = addr->val.addr;
-
-			count++;
-
-			PTHREAD_MUTEX_lock(&client_id->cid_mutex);
-
-			if (valid_lease(client_id)) {
-				PTHREAD_MUTEX_unlock(&client_id->cid_mutex);
-				RBT_INCREMENT(pn);
-				continue;
-			}
+	/* Only look at the clientids whose lease deadline has come, the
+	 * wheel's reference on each passes to us.
+	 */
+	while ((client_id = lease_wheel_next_due(tnow)) != NULL) {
+		char str[LOG_BUFF_LEN] = "\0";
+		struct display_buffer dspbuf = {sizeof(str), str, str};
+		bool str_valid = false;
 
-			if (isDebug(COMPONENT_CLIENTID)) {
-				display_client_id_rec(&dspbuf, client_id);
-				LogFullDebug(COMPONENT_CLIENTID,
-					     "Expire index %d %s", i, str);
-				str_valid = true;
-			}
+		count++;
 
-			/* Get the client record */
-			client_rec = client_id->cid_client_record;
+		PTHREAD_MUTEX_lock(&client_id->cid_mutex);
 
-			/* get a ref to client_id as we might drop the
-			 * last reference with expiring.
-			 */
-			inc_client_id_ref(client_id);
+		if (!expire_lease(client_id)) {
+			/* Renewed since it was queued */
+			lease_schedule(client_id);
+			PTHREAD_MUTEX_unlock(&client_id->cid_mutex);
+			dec_client_id_ref(client_id);
+			continue;
+		}
 
-			/* if record is STALE, the linkage to client_record is
-			 * removed already. Acquire a ref on client record
-			 * before we drop the mutex on clientid
-			 */
-			if (client_rec != NULL)
-				inc_client_record_ref(client_rec);
+		if (isDebug(COMPONENT_CLIENTID)) {
+			display_client_id_rec(&dspbuf, client_id);
+			LogFullDebug(COMPONENT_CLIENTID, "Expire %s", str);
+			str_valid = true;
+		}
 
-			PTHREAD_MUTEX_unlock(&client_id->cid_mutex);
-			PTHREAD_RWLOCK_unlock(&ht_reap->partitions[i].lock);
+		/* Get the client record */
+		client_rec = client_id->cid_client_record;
 
-			if (client_rec != NULL)
-				PTHREAD_MUTEX_lock(&client_rec->cr_mutex);
+		/* if record is STALE, the linkage to client_record is
+		 * removed already. Acquire a ref on client record
+		 * before we drop the mutex on clientid
+		 */
+		if (client_rec != NULL)
+			inc_client_record_ref(client_rec);
 
-			nfs_client_id_expire(client_id, false);
+		PTHREAD_MUTEX_unlock(&client_id->cid_mutex);
 
-			if (client_rec != NULL) {
-				PTHREAD_MUTEX_unlock(&client_rec->cr_mutex);
-				dec_client_record_ref(client_rec);
-			}
+		if (client_rec != NULL)
+			PTHREAD_MUTEX_lock(&client_rec->cr_mutex);
 
-			if (isFullDebug(COMPONENT_CLIENTID)) {
-				if (!str_valid)
-					display_printf(&dspbuf, "clientid %p",
-						       client_id);
+		nfs_client_id_expire(client_id, false);
 
-				LogFullDebug(COMPONENT_CLIENTID,
-					     "Reaper done, expired {%s}", str);
-			}
+		if (client_rec != NULL) {
+			PTHREAD_MUTEX_unlock(&client_rec->cr_mutex);
+			dec_client_record_ref(client_rec);
+		}
 
-			/* drop our reference to the client_id */
-			dec_client_id_ref(client_id);
+		if (isFullDebug(COMPONENT_CLIENTID)) {
+			if (!str_valid)
+				display_printf(&dspbuf, "clientid %p",
+					       client_id);
 
-			goto restart;
+			LogFullDebug(COMPONENT_CLIENTID,
+				     "Reaper done, expired {%s}", str);
 		}
-		PTHREAD_RWLOCK_unlock(&ht_reap->partitions[i].lock);
+
+		/* drop the reference we had from the wheel */
+		dec_client_id_ref(client_id);
 	}
+
 	return count;
 }
 
@@ -233,9 +213,7 @@ static void reaper_run(struct fridgethr_context *ctx)
 #endif
 	}
 
-	rst->count =
-	    (reap_hash_table(ht_confirmed_client_id) +
-	     reap_hash_table(ht_unconfirmed_client_id));
+	rst->count = reap_expired_leases();
 
 	rst->count += reap_expired_open_owners();
 }
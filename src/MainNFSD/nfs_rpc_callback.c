@@ -51,11 +51,13 @@
 #include "nfs_req_queue.h"
 #include "log.h"
 #include "nfs_rpc_callback.h"
+#include "fridgethr.h"
 #include "nfs4.h"
 #ifdef _HAVE_GSSAPI
 #include "gss_credcache.h"
 #endif /* _HAVE_GSSAPI */
 #include "sal_data.h"
+#include "sal_functions.h"
 #include <misc/timespec.h>
 
 const struct __netid_nc_table netid_nc_table[9] = {
@@ -70,6 +72,15 @@ const struct __netid_nc_table netid_nc_table[9] = {
 	"udp", 3, _NC_UDP, AF_INET}, {
 	"udp6", 4, _NC_UDP6, AF_INET6},};
 
+/**
+ * @brief Threads sending callbacks
+ *
+ * Callbacks wait on the client for up to nfsv4_param.cb_timeout, so
+ * they get their own threads rather than holding up the workers, and
+ * the number of them bounds how many clients are called back at once.
+ */
+static struct fridgethr *cb_fridge;
+
 /**
  * @brief Initialize the callback credential cache
  *
@@ -109,6 +120,21 @@ static inline void nfs_rpc_cb_init_ccache(const char *ccache)
  */
 void nfs_rpc_cb_pkginit(void)
 {
+	struct fridgethr_params frp;
+	int rc;
+
+	memset(&frp, 0, sizeof(struct fridgethr_params));
+	frp.thr_max = nfs_param.nfsv4_param.cb_threads;
+	frp.deferment = fridgethr_defer_queue;
+
+	rc = fridgethr_init(&cb_fridge, "NFS_CB", &frp);
+	if (rc != 0) {
+		LogMajor(COMPONENT_NFS_CB,
+			 "Unable to initialize callback fridge, error code %d, callbacks will use the worker threads.",
+			 rc);
+		cb_fridge = NULL;
+	}
+
 #ifdef _HAVE_GSSAPI
 	/* ccache */
 	nfs_rpc_cb_init_ccache(nfs_param.krb5_param.ccache_dir);
@@ -125,7 +151,24 @@ void nfs_rpc_cb_pkginit(void)
  */
 void nfs_rpc_cb_pkgshutdown(void)
 {
-	/* return */
+	int rc;
+
+	if (cb_fridge == NULL)
+		return;
+
+	rc = fridgethr_sync_command(cb_fridge, fridgethr_comm_stop, 120);
+
+	if (rc == ETIMEDOUT) {
+		LogMajor(COMPONENT_NFS_CB,
+			 "Shutdown timed out, cancelling callback threads.");
+		fridgethr_cancel(cb_fridge);
+	} else if (rc != 0) {
+		LogMajor(COMPONENT_NFS_CB,
+			 "Failed shutting down callback threads: %d", rc);
+	}
+
+	fridgethr_destroy(cb_fridge);
+	cb_fridge = NULL;
 }
 
 /**
@@ -591,7 +634,8 @@ int nfs_rpc_create_chan_v40(nfs_client_id_t *clientid, uint32_t flags)
 /**
  * @brief Dispose of a channel
  *
- * The caller should hold the channel mutex.
+ * The caller should hold the channel mutex.  Calls in flight on the
+ * channel are let finish first, no new ones start meanwhile.
  *
  * @param[in] chan The channel to dispose of
  */
@@ -599,6 +643,11 @@ static void _nfs_rpc_destroy_chan(rpc_call_channel_t *chan)
 {
 	assert(chan);
 
+	chan->draining = true;
+	while (chan->inflight != 0)
+		pthread_cond_wait(&chan->cv, &chan->mtx);
+	chan->draining = false;
+
 	/* clean up auth, if any */
 	if (chan->auth) {
 		AUTH_DESTROY(chan->auth);
@@ -619,8 +668,9 @@ static void _nfs_rpc_destroy_chan(rpc_call_channel_t *chan)
  * @brief Create a channel for an NFSv4.1 session
  *
  * This function creates a channel on an NFSv4.1 session, using the
- * given security parameters.  If a channel already exists, it is
- * removed and replaced.
+ * given security parameters, over the most recently used connection
+ * bound to the session for the back channel.  If a channel already
+ * exists, it is left alone and EEXIST returned.
  *
  * @param[in,out] session       The session on which to create the
  *                              back channel
@@ -635,6 +685,7 @@ int nfs_rpc_create_chan_v41(nfs41_session_t *session, int num_sec_parms,
 {
 	int code = 0;
 	rpc_call_channel_t *chan = &session->cb_chan;
+	SVCXPRT *xprt = NULL;
 	int i;
 	bool authed = false;
 	struct timeval cb_timeout = { 15, 0 };
@@ -650,9 +701,14 @@ int nfs_rpc_create_chan_v41(nfs41_session_t *session, int num_sec_parms,
 	chan->type = RPC_CHAN_V41;
 	chan->source.session = session;
 
-	assert(session->xprt);
+	/* Run it on the most recently used connection bound for it */
+	xprt = nfs41_session_back_xprt(session);
+	if (xprt == NULL) {
+		code = ENOTCONN;
+		goto out;
+	}
 
-	if (svc_get_xprt_type(session->xprt) == XPRT_RDMA) {
+	if (svc_get_xprt_type(xprt) == XPRT_RDMA) {
 		LogWarn(COMPONENT_NFS_CB,
 			"refusing to create back channel over RDMA for now");
 		code = EINVAL;
@@ -662,7 +718,7 @@ int nfs_rpc_create_chan_v41(nfs41_session_t *session, int num_sec_parms,
 	/* connect an RPC client
 	 * Use version 1 per errata ID 2291 for RFC 5661
 	 */
-	chan->clnt = clnt_vc_create_svc(session->xprt, session->cb_program,
+	chan->clnt = clnt_vc_create_svc(xprt, session->cb_program,
 					NFS_CB /* Errata ID: 2291 */,
 					CLNT_CREATE_FLAG_NONE);
 
@@ -730,6 +786,9 @@ int nfs_rpc_create_chan_v41(nfs41_session_t *session, int num_sec_parms,
 
 	PTHREAD_MUTEX_unlock(&chan->mtx);
 
+	if (xprt != NULL)
+		SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+
 	return code;
 }
 
@@ -896,6 +955,16 @@ static inline void RPC_CALL_HOOK(rpc_call_t *call, rpc_call_hook hook,
 		call->call_hook(call, hook, arg, flags);
 }
 
+/**
+ * @brief Send a queued call on a callback thread
+ *
+ * @param[in] ctx Thread context, holding the call
+ */
+static void nfs_rpc_cb_run(struct fridgethr_context *ctx)
+{
+	nfs_rpc_dispatch_call(ctx->arg, NFS_RPC_CALL_NONE);
+}
+
 /**
  * @brief Fire off an RPC call
  *
@@ -909,6 +978,7 @@ int32_t nfs_rpc_submit_call(rpc_call_t *call, void *completion_arg,
 			    uint32_t flags)
 {
 	request_data_t *reqdata;
+	int rc;
 
 	assert(call->chan);
 
@@ -916,12 +986,21 @@ int32_t nfs_rpc_submit_call(rpc_call_t *call, void *completion_arg,
 	if (flags & NFS_RPC_CALL_INLINE)
 		return nfs_rpc_dispatch_call(call, NFS_RPC_CALL_NONE);
 
-	reqdata = container_of(call, request_data_t, r_u.call);
 	PTHREAD_MUTEX_lock(&call->we.mtx);
 	call->states = NFS_CB_CALL_QUEUED;
-	nfs_rpc_enqueue_req(reqdata);
 	PTHREAD_MUTEX_unlock(&call->we.mtx);
 
+	if (cb_fridge != NULL) {
+		rc = fridgethr_submit(cb_fridge, nfs_rpc_cb_run, call);
+		if (rc == 0)
+			return 0;
+		LogDebug(COMPONENT_NFS_CB,
+			 "Unable to queue callback, error code %d", rc);
+	}
+
+	reqdata = container_of(call, request_data_t, r_u.call);
+	nfs_rpc_enqueue_req(reqdata);
+
 	return 0;
 }
 
@@ -936,8 +1015,10 @@ int32_t nfs_rpc_submit_call(rpc_call_t *call, void *completion_arg,
 
 int32_t nfs_rpc_dispatch_call(rpc_call_t *call, uint32_t flags)
 {
-	struct timeval CB_TIMEOUT = { 15, 0 };	/* XXX */
+	struct timeval CB_TIMEOUT = { nfs_param.nfsv4_param.cb_timeout, 0 };
+	rpc_call_channel_t *chan = call->chan;
 	rpc_call_hook hook_status = RPC_CALL_COMPLETE;
+	bool pipelined;
 
 	/* send the call, set states, wake waiters, etc */
 	PTHREAD_MUTEX_lock(&call->we.mtx);
@@ -951,28 +1032,44 @@ int32_t nfs_rpc_dispatch_call(rpc_call_t *call, uint32_t flags)
 	PTHREAD_MUTEX_unlock(&call->we.mtx);
 
 	/* XXX TI-RPC does the signal masking */
-	PTHREAD_MUTEX_lock(&call->chan->mtx);
+	PTHREAD_MUTEX_lock(&chan->mtx);
 
-	if (!call->chan->clnt) {
+	if (!chan->clnt || chan->draining) {
 		call->stat = RPC_INTR;
 		goto unlock;
 	}
 
-	call->stat = clnt_call(call->chan->clnt, call->chan->auth, CB_COMPOUND,
+	/* A v4.1 back channel shares the client's connection, where replies
+	 * are matched by xid, so calls on different slots may be in flight
+	 * together.  A v4.0 channel keeps one call at a time.
+	 */
+	pipelined = chan->type == RPC_CHAN_V41;
+	if (pipelined) {
+		chan->inflight++;
+		PTHREAD_MUTEX_unlock(&chan->mtx);
+	}
+
+	call->stat = clnt_call(chan->clnt, chan->auth, CB_COMPOUND,
 			       (xdrproc_t) xdr_CB_COMPOUND4args,
 			       &call->cbt.v_u.v4.args,
 			       (xdrproc_t) xdr_CB_COMPOUND4res,
 			       &call->cbt.v_u.v4.res, CB_TIMEOUT);
 
+	if (pipelined) {
+		PTHREAD_MUTEX_lock(&chan->mtx);
+		if (--chan->inflight == 0)
+			pthread_cond_broadcast(&chan->cv);
+	}
+
 	/* If a call fails, we have to assume path down, or equally fatal
 	 * error.  We may need back-off. */
 	if (call->stat != RPC_SUCCESS) {
-		_nfs_rpc_destroy_chan(call->chan);
+		_nfs_rpc_destroy_chan(chan);
 		hook_status = RPC_CALL_ABORT;
 	}
 
  unlock:
-	PTHREAD_MUTEX_unlock(&call->chan->mtx);
+	PTHREAD_MUTEX_unlock(&chan->mtx);
 
 	/* signal waiter(s) */
 	PTHREAD_MUTEX_lock(&call->we.mtx);
@@ -1125,7 +1222,7 @@ static bool find_cb_slot(nfs41_session_t *session, bool wait, slotid4 *slot,
  retry:
 	for (cur = 0;
 	     cur < MIN(session->back_channel_attrs.ca_maxrequests,
-		       NFS41_NB_SLOTS);
+		       nfs_param.nfsv4_param.cb_slots);
 	     ++cur) {
 
 		if (!(session->cb_slots[cur].in_use) && (!found)) {
@@ -90,6 +90,7 @@ static bool nfs_rpc_cbsim_get_v40_client_ids(DBusMessageIter *args,
 	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
 					 DBUS_TYPE_UINT64_AS_STRING, &sub_iter);
 	/* For each bucket of the hashtable */
+	hashtable_walk_begin(ht);
 	for (i = 0; i < ht->parameter.index_size; i++) {
 		head_rbt = &(ht->partitions[i].rbt);
 
@@ -108,6 +109,7 @@ static bool nfs_rpc_cbsim_get_v40_client_ids(DBusMessageIter *args,
 		}
 		PTHREAD_RWLOCK_unlock(&(ht->partitions[i].lock));
 	}
+	hashtable_walk_end(ht);
 	dbus_message_iter_close_container(&iter, &sub_iter);
 	return true;
 }
@@ -160,6 +162,7 @@ static bool nfs_rpc_cbsim_get_session_ids(DBusMessageIter *args,
 	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
 					 DBUS_TYPE_UINT64_AS_STRING, &sub_iter);
 	/* For each bucket of the hashtable */
+	hashtable_walk_begin(ht);
 	for (i = 0; i < ht->parameter.index_size; i++) {
 		head_rbt = &(ht->partitions[i].rbt);
 
@@ -181,6 +184,7 @@ static bool nfs_rpc_cbsim_get_session_ids(DBusMessageIter *args,
 		}
 		PTHREAD_RWLOCK_unlock(&(ht->partitions[i].lock));
 	}
+	hashtable_walk_end(ht);
 	dbus_message_iter_close_container(&iter, &sub_iter);
 	return true;
 }
@@ -37,6 +37,9 @@
 #include <sys/file.h>		/* for having FNDELAY */
 #include <sys/select.h>
 #include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <inttypes.h>
 #ifdef RPC_VSOCK
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -44,6 +47,9 @@
 #endif
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#ifdef LINUX
+#include <linux/filter.h>	/* for SO_ATTACH_REUSEPORT_CBPF */
+#endif
 #include <assert.h>
 #include "hashtable.h"
 #include "log.h"
@@ -63,6 +69,13 @@
 #include "nfs_dupreq.h"
 #include "nfs_file_handle.h"
 #include "fridgethr.h"
+#include "client_mgr.h"
+#include "export_mgr.h"
+#include "delayed_exec.h"
+#include "server_metrics.h"
+#ifdef USE_LTTNG
+#include "gsh_lttng/nfs_rpc.h"
+#endif
 
 #define NFS_pcp nfs_param.core_param
 #define NFS_options NFS_pcp.core_options
@@ -87,11 +100,15 @@ enum evchan {
 };
 #define N_TCP_EVENT_CHAN  3	/*< We don't really want to have too many,
 				   relative to the number of available cores. */
-#define N_EVENT_CHAN (N_TCP_EVENT_CHAN + EVCHAN_SIZE)
+#define REUSEPORT_MAX	16	/*< Upper bound of RPC_{UDP,TCP}_Listeners */
+#define N_EVENT_CHAN (N_TCP_EVENT_CHAN + EVCHAN_SIZE + 2 * (REUSEPORT_MAX - 1))
 
 static struct rpc_evchan rpc_evchan[EVCHAN_SIZE];
 
 struct fridgethr *req_fridge;	/*< Decoder thread pool */
+#ifdef _HAVE_GSSAPI
+static struct fridgethr *gss_unwrap_fridge;	/*< krb5i/krb5p unwrap pool */
+#endif
 struct nfs_req_st nfs_req_st;	/*< Shared request queues */
 
 const char *req_q_s[N_REQ_QUEUES] = {
@@ -159,6 +176,21 @@ int tcp_socket[P_COUNT];
 SVCXPRT *udp_xprt[P_COUNT];
 SVCXPRT *tcp_xprt[P_COUNT];
 
+/* SO_REUSEPORT siblings of udp_socket[] or tcp_socket[], for
+ * RPC_UDP_Listeners or RPC_TCP_Listeners > 1
+ */
+struct rpc_fanout {
+	int count;		/*< Siblings per protocol */
+	int sock[P_COUNT][REUSEPORT_MAX - 1];
+	struct rpc_evchan chan[REUSEPORT_MAX - 1]; /*< One per sibling */
+};
+
+static struct rpc_fanout udp_fanout;
+static struct rpc_fanout tcp_fanout;
+
+/* Sockets handed over, already bound, by the process we are replacing */
+static bool sock_adopted[P_COUNT];
+
 /* Flag to indicate if V6 interfaces on the host are enabled */
 bool v6disabled;
 bool vsock;
@@ -249,10 +281,17 @@ static inline bool nfs_protocol_enabled(protos p)
 static void close_rpc_fd(void)
 {
 	protos p;
+	int i;
 
 	for (p = P_NFS; p < P_COUNT; p++) {
 		if (udp_socket[p] != -1)
 			close(udp_socket[p]);
+		for (i = 0; i < udp_fanout.count; i++)
+			if (udp_fanout.sock[p][i] != -1)
+				close(udp_fanout.sock[p][i]);
+		for (i = 0; i < tcp_fanout.count; i++)
+			if (tcp_fanout.sock[p][i] != -1)
+				close(tcp_fanout.sock[p][i]);
 		if (tcp_socket[p] != -1)
 			close(tcp_socket[p]);
 	}
@@ -369,62 +408,97 @@ const svc_xprt_fun_t tcp_dispatch[] = {
 	NULL,
 };
 
-void Create_udp(protos prot)
+static SVCXPRT *Create_udp_xprt(protos prot, int fd, uint32_t chan_id)
 {
-	udp_xprt[prot] =
-	    svc_dg_create(udp_socket[prot],
-			  nfs_param.core_param.rpc.max_send_buffer_size,
-			  nfs_param.core_param.rpc.max_recv_buffer_size);
-	if (udp_xprt[prot] == NULL)
+	SVCXPRT *xprt;
+
+	xprt = svc_dg_create(fd,
+			     nfs_param.core_param.rpc.max_send_buffer_size,
+			     nfs_param.core_param.rpc.max_recv_buffer_size);
+	if (xprt == NULL)
 		LogFatal(COMPONENT_DISPATCH, "Cannot allocate %s/UDP SVCXPRT",
 			 tags[prot]);
 
-	udp_xprt[prot]->xp_dispatch.rendezvous_cb = udp_dispatch[prot];
+	xprt->xp_dispatch.rendezvous_cb = udp_dispatch[prot];
 
 	/* Hook xp_free_user_data (finalize/free private data) */
-	(void)SVC_CONTROL(udp_xprt[prot], SVCSET_XP_FREE_USER_DATA,
+	(void)SVC_CONTROL(xprt, SVCSET_XP_FREE_USER_DATA,
 			  nfs_rpc_free_user_data);
 
 	/* Setup private data */
-	(udp_xprt[prot])->xp_u1 =
-		alloc_gsh_xprt_private(udp_xprt[prot],
-				       XPRT_PRIVATE_FLAG_NONE);
+	xprt->xp_u1 = alloc_gsh_xprt_private(xprt, XPRT_PRIVATE_FLAG_NONE);
 
-	(void)svc_rqst_evchan_reg(rpc_evchan[UDP_UREG_CHAN].chan_id,
-				  udp_xprt[prot], SVC_RQST_FLAG_XPRT_UREG);
+	(void)svc_rqst_evchan_reg(chan_id, xprt, SVC_RQST_FLAG_XPRT_UREG);
+
+	return xprt;
 }
 
-void Create_tcp(protos prot)
+void Create_udp(protos prot)
 {
-	tcp_xprt[prot] =
-		svc_vc_ncreatef(tcp_socket[prot],
-				nfs_param.core_param.rpc.max_send_buffer_size,
-				nfs_param.core_param.rpc.max_recv_buffer_size,
-				SVC_CREATE_FLAG_CLOSE | SVC_CREATE_FLAG_LISTEN);
-	if (tcp_xprt[prot] == NULL)
+	int i;
+
+	udp_xprt[prot] = Create_udp_xprt(prot, udp_socket[prot],
+					 rpc_evchan[UDP_UREG_CHAN].chan_id);
+
+	/* The siblings are only polled; programs are registered with
+	 * rpcbind through udp_xprt[] and the kernel spreads datagrams
+	 * for the port over all of them.
+	 */
+	for (i = 0; i < udp_fanout.count; i++)
+		if (udp_fanout.sock[prot][i] != -1)
+			(void)Create_udp_xprt(prot, udp_fanout.sock[prot][i],
+					      udp_fanout.chan[i].chan_id);
+}
+
+static SVCXPRT *Create_tcp_xprt(protos prot, int fd, uint32_t chan_id)
+{
+	SVCXPRT *xprt;
+
+	xprt = svc_vc_ncreatef(fd,
+			       nfs_param.core_param.rpc.max_send_buffer_size,
+			       nfs_param.core_param.rpc.max_recv_buffer_size,
+			       SVC_CREATE_FLAG_CLOSE | SVC_CREATE_FLAG_LISTEN);
+	if (xprt == NULL)
 		LogFatal(COMPONENT_DISPATCH, "Cannot allocate %s/TCP SVCXPRT",
 			 tags[prot]);
 
-	tcp_xprt[prot]->xp_dispatch.rendezvous_cb = tcp_dispatch[prot];
+	xprt->xp_dispatch.rendezvous_cb = tcp_dispatch[prot];
 
 	/* Hook xp_free_user_data (finalize/free private data) */
-	(void)SVC_CONTROL(tcp_xprt[prot], SVCSET_XP_FREE_USER_DATA,
+	(void)SVC_CONTROL(xprt, SVCSET_XP_FREE_USER_DATA,
 			  nfs_rpc_free_user_data);
 
 	/* Setup private data */
-	(tcp_xprt[prot])->xp_u1 =
-		alloc_gsh_xprt_private(tcp_xprt[prot],
-				       XPRT_PRIVATE_FLAG_NONE);
+	xprt->xp_u1 = alloc_gsh_xprt_private(xprt, XPRT_PRIVATE_FLAG_NONE);
 
-	(void)svc_rqst_evchan_reg(rpc_evchan[TCP_UREG_CHAN].chan_id,
-				  tcp_xprt[prot], SVC_RQST_FLAG_XPRT_UREG);
+	(void)svc_rqst_evchan_reg(chan_id, xprt, SVC_RQST_FLAG_XPRT_UREG);
+
+	return xprt;
+}
+
+void Create_tcp(protos prot)
+{
+	int i;
+
+	tcp_xprt[prot] = Create_tcp_xprt(prot, tcp_socket[prot],
+					 rpc_evchan[TCP_UREG_CHAN].chan_id);
+
+	/* Each sibling accepts, and runs nfs_rpc_tcp_user_data() for, its
+	 * share of the connections on its own event thread.
+	 */
+	for (i = 0; i < tcp_fanout.count; i++)
+		if (tcp_fanout.sock[prot][i] != -1)
+			(void)Create_tcp_xprt(prot, tcp_fanout.sock[prot][i],
+					      tcp_fanout.chan[i].chan_id);
 }
 
 #ifdef _USE_NFS_RDMA
+static char rpc_rdma_port[sizeof("65535")];
+
 struct rpc_rdma_attr rpc_rdma_xa = {
 	.statistics_prefix = NULL,
 	.node = "::",
-	.port = "20049",
+	.port = rpc_rdma_port,
 	.sq_depth = 32,			/* default was 50 */
 	.max_send_sge = 32,		/* minimum 2 */
 	.rq_depth = 32,			/* default was 50 */
@@ -441,11 +515,22 @@ static enum xprt_stat nfs_rpc_dispatch_RDMA(SVCXPRT *xprt)
 		     "RDMA request on SVCXPRT %p fd %d",
 		     xprt, xprt->xp_fd);
 	xprt->xp_dispatch.process_cb = nfs_rpc_valid_NFS;
-	return SVC_STAT(xprt->xp_parent);
+	/* Like a TCP connection, requests need the per-connection data */
+	return nfs_rpc_tcp_user_data(xprt);
 }
 
 void Create_RDMA(protos prot)
 {
+	snprintf(rpc_rdma_port, sizeof(rpc_rdma_port), "%"PRIu16,
+		 nfs_param.core_param.port[prot]);
+
+	/* One receive per credit, plus headroom for the sends that answer
+	 * them and for control messages.
+	 */
+	rpc_rdma_xa.credits = nfs_param.core_param.rdma_credits;
+	rpc_rdma_xa.sq_depth = rpc_rdma_xa.credits + 2;
+	rpc_rdma_xa.rq_depth = rpc_rdma_xa.credits + 2;
+
 	/* This has elements of both UDP and TCP setup */
 	tcp_xprt[prot] =
 		svc_rdma_create(&rpc_rdma_xa,
@@ -494,6 +579,159 @@ void Create_SVCXPRTs(void)
 #endif /* _USE_NFS_RDMA */
 }
 
+static int tcp_listener_setopts(protos p, int fd);
+
+/**
+ * @brief Have reads on a socket busy poll the NIC queue
+ *
+ * With RPC_Busy_Poll_Usec set, a receive on the socket that finds
+ * nothing queued polls the device's receive queue for that long before
+ * sleeping, and SO_PREFER_BUSY_POLL keeps the NIC interrupt from
+ * racing it.  Connections accepted on a tcp listener inherit this.
+ * Raising the time past net.core.busy_read needs CAP_NET_ADMIN, so a
+ * failure is only logged.
+ *
+ * @param[in] p  Protocol
+ * @param[in] fd Socket
+ */
+static void rpc_busy_poll_setopts(protos p, int fd)
+{
+	const struct nfs_core_param *nfs_cp = &nfs_param.core_param;
+#ifdef SO_PREFER_BUSY_POLL
+	int one = 1;
+#endif
+
+	if (nfs_cp->rpc.busy_poll_usec == 0)
+		return;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+		       &nfs_cp->rpc.busy_poll_usec,
+		       sizeof(nfs_cp->rpc.busy_poll_usec)))
+		LogWarn(COMPONENT_DISPATCH,
+			"Cannot set SO_BUSY_POLL for %s, error %d(%s)",
+			tags[p], errno, strerror(errno));
+#ifdef SO_PREFER_BUSY_POLL
+	if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+		       &one, sizeof(one)))
+		LogDebug(COMPONENT_DISPATCH,
+			 "Cannot set SO_PREFER_BUSY_POLL for %s, error %d(%s)",
+			 tags[p], errno, strerror(errno));
+#endif
+#ifdef SO_BUSY_POLL_BUDGET
+	if (nfs_cp->rpc.busy_poll_budget &&
+	    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET,
+		       &nfs_cp->rpc.busy_poll_budget,
+		       sizeof(nfs_cp->rpc.busy_poll_budget)))
+		LogDebug(COMPONENT_DISPATCH,
+			 "Cannot set SO_BUSY_POLL_BUDGET for %s, error %d(%s)",
+			 tags[p], errno, strerror(errno));
+#endif
+}
+
+/**
+ * @brief Steer a reuseport group to the listener of the receiving CPU
+ *
+ * The classic BPF program returns the group index, so with n sockets
+ * CPU c lands on the socket bound (c mod n)th.  Without it the kernel
+ * picks by the connection's hash.
+ *
+ * @param[in] p  Protocol
+ * @param[in] fd Any socket of the group
+ * @param[in] n  Sockets in the group
+ */
+static void fanout_steer_cpu(protos p, int fd, int n)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, n },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog = {
+		.len = sizeof(code) / sizeof(code[0]),
+		.filter = code,
+	};
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+		       &prog, sizeof(prog)))
+		LogWarn(COMPONENT_DISPATCH,
+			"Cannot steer %s listeners by CPU, error %d (%s)",
+			tags[p], errno, strerror(errno));
+#else
+	LogWarn(COMPONENT_DISPATCH,
+		"RPC_Listeners_CPU_Steering is not supported on this platform");
+#endif
+}
+
+/**
+ * @brief Open the extra SO_REUSEPORT listeners of one protocol
+ *
+ * Each sibling is bound to the address the primary socket ended up
+ * with, so this works the same for adopted sockets.  A sibling that
+ * cannot be bound, e.g. because an adopted socket lacks SO_REUSEPORT,
+ * is only logged; the protocol keeps the listeners it has.
+ *
+ * @param[in]     p       Protocol
+ * @param[in]     type    SOCK_DGRAM or SOCK_STREAM
+ * @param[in]     primary udp_socket[p] or tcp_socket[p]
+ * @param[in,out] fanout  Where the siblings go
+ */
+static void Bind_fanout(protos p, int type, int primary,
+			struct rpc_fanout *fanout)
+{
+	const char *what = type == SOCK_DGRAM ? "udp" : "tcp";
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof(ss);
+	int one = 1;
+	int i, fd, rc;
+
+	if (getsockname(primary, (struct sockaddr *)&ss, &len) == -1) {
+		LogWarn(COMPONENT_DISPATCH,
+			"Cannot get %s %s socket address, error %d (%s)",
+			tags[p], what, errno, strerror(errno));
+		return;
+	}
+
+	for (i = 0; i < fanout->count; i++) {
+		fd = socket(ss.ss_family, type, 0);
+		if (fd == -1) {
+			LogWarn(COMPONENT_DISPATCH,
+				"Cannot allocate extra %s %s socket, error %d (%s)",
+				tags[p], what, errno, strerror(errno));
+			break;
+		}
+
+		if (type == SOCK_DGRAM)
+			rc = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+					&one, sizeof(one)) ||
+			     setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+					&one, sizeof(one)) ||
+			     fcntl(fd, F_SETFL, FNDELAY) == -1;
+		else
+			rc = tcp_listener_setopts(p, fd);
+
+		if (type == SOCK_DGRAM)
+			rpc_busy_poll_setopts(p, fd);
+
+		if (rc != 0 ||
+		    bind(fd, (struct sockaddr *)&ss, len) == -1) {
+			LogWarn(COMPONENT_DISPATCH,
+				"Cannot bind extra %s %s socket, error %d (%s)",
+				tags[p], what, errno, strerror(errno));
+			close(fd);
+			break;
+		}
+
+		fanout->sock[p][i] = fd;
+	}
+
+	if (i > 0 && nfs_param.core_param.rpc.listeners_cpu_steering)
+		fanout_steer_cpu(p, primary, i + 1);
+
+	LogInfo(COMPONENT_DISPATCH, "%s %s spread over %d sockets",
+		tags[p], what, i + 1);
+}
+
 /**
  * @brief Bind the udp and tcp sockets for V6 Interfaces
  */
@@ -503,7 +741,7 @@ static int Bind_sockets_V6(void)
 	int    rc = 0;
 
 	for (p = P_NFS; p < P_COUNT; p++) {
-		if (nfs_protocol_enabled(p)) {
+		if (nfs_protocol_enabled(p) && !sock_adopted[p]) {
 
 			proto_data *pdatap = &pdata[p];
 
@@ -591,7 +829,7 @@ static int Bind_sockets_V4(void)
 	int    rc = 0;
 
 	for (p = P_NFS; p < P_COUNT; p++) {
-		if (nfs_protocol_enabled(p)) {
+		if (nfs_protocol_enabled(p) && !sock_adopted[p]) {
 
 			proto_data *pdatap = &pdata[p];
 
@@ -694,6 +932,7 @@ int bind_sockets_vsock(void)
 
 void Bind_sockets(void)
 {
+	protos p;
 	int rc = 0;
 
 	/*
@@ -719,45 +958,71 @@ void Bind_sockets(void)
 				"AF_VSOCK bind failed (continuing startup)");
 	}
 #endif /* RPC_VSOCK */
+	for (p = P_NFS; p < P_COUNT; p++) {
+		if (!nfs_protocol_enabled(p))
+			continue;
+		if (udp_fanout.count > 0)
+			Bind_fanout(p, SOCK_DGRAM, udp_socket[p], &udp_fanout);
+		if (tcp_fanout.count > 0)
+			Bind_fanout(p, SOCK_STREAM, tcp_socket[p], &tcp_fanout);
+	}
 	LogInfo(COMPONENT_DISPATCH,
 		"Bind_sockets() successful, v6disabled = %d, vsock = %d, rdma = %d",
 		v6disabled, vsock, rdma);
 }
 
 /**
- * @brief Function to set the socket options on the allocated
- *	  udp and tcp sockets
+ * @brief Set the socket options of a tcp listener
+ *
+ * @param[in] p  Protocol
+ * @param[in] fd tcp_socket[p] or one of its siblings
  *
+ * @return 0 on success, -1 on failure.
  */
-static int alloc_socket_setopts(int p)
+static int tcp_listener_setopts(protos p, int fd)
 {
 	int one = 1;
 	const struct nfs_core_param *nfs_cp = &nfs_param.core_param;
 
-	/* Use SO_REUSEADDR in order to avoid wait
-	 * the 2MSL timeout */
-	if (setsockopt(udp_socket[p],
+	if (setsockopt(fd,
 		       SOL_SOCKET, SO_REUSEADDR,
 		       &one, sizeof(one))) {
 		LogWarn(COMPONENT_DISPATCH,
-			"Bad udp socket options for %s, error %d(%s)",
+			"Bad tcp socket option reuseaddr for %s, error %d(%s)",
 			tags[p], errno, strerror(errno));
 
 		return -1;
 	}
 
-	if (setsockopt(tcp_socket[p],
-		       SOL_SOCKET, SO_REUSEADDR,
-		       &one, sizeof(one))) {
+	rpc_busy_poll_setopts(p, fd);
+
+	/* Lets the siblings from Bind_fanout() share the port */
+	if (tcp_fanout.count > 0 &&
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))) {
 		LogWarn(COMPONENT_DISPATCH,
-			"Bad tcp socket option reuseaddr for %s, error %d(%s)",
+			"Bad tcp socket option reuseport for %s, error %d(%s)",
+			tags[p], errno, strerror(errno));
+
+		return -1;
+	}
+
+	/* Let the kernel complete the handshake and hold the connection
+	 * back until the client has sent something, so the accept and the
+	 * first read are serviced by a single wakeup.
+	 */
+	if (nfs_cp->rpc.tcp_defer_accept &&
+	    setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+		       &nfs_cp->rpc.tcp_defer_accept,
+		       sizeof(nfs_cp->rpc.tcp_defer_accept))) {
+		LogWarn(COMPONENT_DISPATCH,
+			"Bad tcp socket option TCP_DEFER_ACCEPT for %s, error %d(%s)",
 			tags[p], errno, strerror(errno));
 
 		return -1;
 	}
 
 	if (nfs_cp->enable_tcp_keepalive) {
-		if (setsockopt(tcp_socket[p],
+		if (setsockopt(fd,
 			       SOL_SOCKET, SO_KEEPALIVE,
 			       &one, sizeof(one))) {
 			LogWarn(COMPONENT_DISPATCH,
@@ -768,7 +1033,7 @@ static int alloc_socket_setopts(int p)
 		}
 
 		if (nfs_cp->tcp_keepcnt) {
-			if (setsockopt(tcp_socket[p], IPPROTO_TCP, TCP_KEEPCNT,
+			if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT,
 				       &nfs_cp->tcp_keepcnt,
 				       sizeof(nfs_cp->tcp_keepcnt))) {
 				LogWarn(COMPONENT_DISPATCH,
@@ -780,7 +1045,7 @@ static int alloc_socket_setopts(int p)
 		}
 
 		if (nfs_cp->tcp_keepidle) {
-			if (setsockopt(tcp_socket[p], IPPROTO_TCP, TCP_KEEPIDLE,
+			if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE,
 				       &nfs_cp->tcp_keepidle,
 				       sizeof(nfs_cp->tcp_keepidle))) {
 				LogWarn(COMPONENT_DISPATCH,
@@ -792,7 +1057,7 @@ static int alloc_socket_setopts(int p)
 		}
 
 		if (nfs_cp->tcp_keepintvl) {
-			if (setsockopt(tcp_socket[p], IPPROTO_TCP,
+			if (setsockopt(fd, IPPROTO_TCP,
 				       TCP_KEEPINTVL, &nfs_cp->tcp_keepintvl,
 				       sizeof(nfs_cp->tcp_keepintvl))) {
 				LogWarn(COMPONENT_DISPATCH,
@@ -804,6 +1069,47 @@ static int alloc_socket_setopts(int p)
 		}
 	}
 
+	return 0;
+}
+
+/**
+ * @brief Function to set the socket options on the allocated
+ *	  udp and tcp sockets
+ *
+ */
+static int alloc_socket_setopts(int p)
+{
+	int one = 1;
+
+	/* Use SO_REUSEADDR in order to avoid wait
+	 * the 2MSL timeout */
+	if (setsockopt(udp_socket[p],
+		       SOL_SOCKET, SO_REUSEADDR,
+		       &one, sizeof(one))) {
+		LogWarn(COMPONENT_DISPATCH,
+			"Bad udp socket options for %s, error %d(%s)",
+			tags[p], errno, strerror(errno));
+
+		return -1;
+	}
+
+	rpc_busy_poll_setopts(p, udp_socket[p]);
+
+	/* Lets the siblings from Bind_fanout() share the port */
+	if (udp_fanout.count > 0 &&
+	    setsockopt(udp_socket[p],
+		       SOL_SOCKET, SO_REUSEPORT,
+		       &one, sizeof(one))) {
+		LogWarn(COMPONENT_DISPATCH,
+			"Bad udp socket option reuseport for %s, error %d(%s)",
+			tags[p], errno, strerror(errno));
+
+		return -1;
+	}
+
+	if (tcp_listener_setopts(p, tcp_socket[p]))
+		return -1;
+
 	/* We prefer using non-blocking socket
 	 * in the specific case */
 	if (fcntl(udp_socket[p], F_SETFL, FNDELAY) == -1) {
@@ -888,6 +1194,87 @@ static int allocate_socket_vsock(void)
 }
 #endif /* RPC_VSOCK */
 
+/**
+ * @brief Take one handed over socket matching a protocol's port
+ *
+ * @param[in,out] fds   Handed over sockets, taken ones are set to -1
+ * @param[in]     nfds  Number of entries in fds
+ * @param[in]     type  SOCK_DGRAM or SOCK_STREAM
+ * @param[in]     port  Configured port
+ *
+ * @return The socket, or -1 if none matches.
+ */
+static int adopt_socket(int *fds, int nfds, int type, uint16_t port)
+{
+	struct sockaddr_storage ss;
+	socklen_t len;
+	int family = v6disabled ? AF_INET : AF_INET6;
+	int fd_type;
+	int i, fd;
+
+	for (i = 0; i < nfds; i++) {
+		if (fds[i] == -1)
+			continue;
+
+		len = sizeof(fd_type);
+		if (getsockopt(fds[i], SOL_SOCKET, SO_TYPE, &fd_type, &len) ||
+		    fd_type != type)
+			continue;
+
+		len = sizeof(ss);
+		if (getsockname(fds[i], (struct sockaddr *)&ss, &len) ||
+		    ss.ss_family != family)
+			continue;
+
+		if (family == AF_INET6 ?
+		    ntohs(((struct sockaddr_in6 *)&ss)->sin6_port) != port :
+		    ntohs(((struct sockaddr_in *)&ss)->sin_port) != port)
+			continue;
+
+		fd = fds[i];
+		fds[i] = -1;
+		return fd;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief Use the sockets handed over by an upgrade for a protocol
+ *
+ * Sockets are matched by type, family and configured port, so a change
+ * of protocol numbering between versions does not matter.  Protocols on
+ * dynamic ports, or whose port changed, get fresh sockets.
+ *
+ * @return true if both the udp and tcp socket were adopted.
+ */
+static bool adopt_sockets(protos p, int *fds, int nfds)
+{
+	uint16_t port = nfs_param.core_param.port[p];
+
+	if (port == 0)
+		return false;
+
+	udp_socket[p] = adopt_socket(fds, nfds, SOCK_DGRAM, port);
+	tcp_socket[p] = adopt_socket(fds, nfds, SOCK_STREAM, port);
+
+	if (udp_socket[p] == -1 || tcp_socket[p] == -1) {
+		if (udp_socket[p] != -1)
+			close(udp_socket[p]);
+		if (tcp_socket[p] != -1)
+			close(tcp_socket[p]);
+		udp_socket[p] = -1;
+		tcp_socket[p] = -1;
+		return false;
+	}
+
+	LogEvent(COMPONENT_DISPATCH,
+		 "Adopted %s sockets tcp=%d udp=%d from previous server",
+		 tags[p], tcp_socket[p], udp_socket[p]);
+	sock_adopted[p] = true;
+	return true;
+}
+
 /**
  * @brief Allocate the tcp and udp sockets for the nfs daemon
  */
@@ -895,9 +1282,19 @@ static void Allocate_sockets(void)
 {
 	protos	p;
 	int	rc = 0;
+	int	fds[NFS_UPGRADE_MAX_FDS];
+	int	nfds, i;
 
 	LogFullDebug(COMPONENT_DISPATCH, "Allocation of the sockets");
 
+	for (p = P_NFS; p < P_COUNT; p++)
+		for (i = 0; i < REUSEPORT_MAX - 1; i++) {
+			udp_fanout.sock[p][i] = -1;
+			tcp_fanout.sock[p][i] = -1;
+		}
+
+	nfds = nfs_upgrade_recv_sockets(fds, NFS_UPGRADE_MAX_FDS);
+
 	for (p = P_NFS; p < P_COUNT; p++) {
 		/* Initialize all the sockets to -1 because
 		 * it makes some code later easier */
@@ -905,6 +1302,9 @@ static void Allocate_sockets(void)
 		tcp_socket[p] = -1;
 
 		if (nfs_protocol_enabled(p)) {
+			if (adopt_sockets(p, fds, nfds))
+				goto setopts;
+
 			if (v6disabled)
 				goto try_V4;
 
@@ -961,6 +1361,7 @@ try_V4:
 				}
 			}
 
+setopts:
 			rc = alloc_socket_setopts(p);
 			if (rc) {
 				LogFatal(COMPONENT_DISPATCH,
@@ -974,12 +1375,45 @@ try_V4:
 				udp_socket[p]);
 		}
 	}
+
+	/* Anything the new configuration has no use for */
+	for (i = 0; i < nfds; i++)
+		if (fds[i] != -1)
+			close(fds[i]);
+
 #ifdef RPC_VSOCK
 	if (vsock)
 		allocate_socket_vsock();
 #endif /* RPC_VSOCK */
 }
 
+/**
+ * @brief Collect the bound udp and tcp listeners for an upgrade
+ *
+ * AF_VSOCK listeners are left out; the new process binds its own.
+ *
+ * @param[out] fds  Filled with the sockets
+ * @param[in]  max  Size of fds
+ *
+ * @return Number of sockets.
+ */
+int nfs_rpc_listener_fds(int *fds, int max)
+{
+	protos p;
+	int n = 0;
+
+	for (p = P_NFS; p < P_COUNT && n + 2 <= max; p++) {
+		if (p == P_NFS_VSOCK)
+			continue;
+		if (udp_socket[p] != -1)
+			fds[n++] = udp_socket[p];
+		if (tcp_socket[p] != -1)
+			fds[n++] = tcp_socket[p];
+	}
+
+	return n;
+}
+
 /* The following routine must ONLY be called from the shutdown
  * thread */
 void Clean_RPC(void)
@@ -988,7 +1422,9 @@ void Clean_RPC(void)
    * @todo Consider the need to call Svc_dg_destroy for UDP & ?? for
    * TCP based services
    */
-	unregister_rpc();
+	/* Our successor has registered the same programs over us */
+	if (!nfs_upgrading)
+		unregister_rpc();
 	close_rpc_fd();
 }
 
@@ -1055,12 +1491,57 @@ tirpc_pkg_params ntirpc_pp = {
 	gsh_realloc__,
 };
 
+/**
+ * @brief Register our programs with the portmapper
+ *
+ * Also used to take the registrations back after a failed upgrade.
+ */
+void nfs_rpc_register_programs(void)
+{
+#ifndef _NO_PORTMAPPER
+	/* Perform all the RPC registration, for UDP and TCP,
+	 * for NFS_V2, NFS_V3 and NFS_V4 */
+#ifdef _USE_NFS3
+	Register_program(P_NFS, CORE_OPTION_NFSV3, NFS_V3);
+#endif /* _USE_NFS3 */
+	Register_program(P_NFS, CORE_OPTION_NFSV4, NFS_V4);
+	Register_program(P_MNT, CORE_OPTION_NFSV3, MOUNT_V1);
+	Register_program(P_MNT, CORE_OPTION_NFSV3, MOUNT_V3);
+#ifdef _USE_NLM
+	if (nfs_param.core_param.enable_NLM)
+		Register_program(P_NLM, CORE_OPTION_NFSV3, NLM4_VERS);
+#endif /* _USE_NLM */
+	if (nfs_param.core_param.enable_RQUOTA &&
+	    (NFS_options & (CORE_OPTION_NFSV3 | CORE_OPTION_NFSV4))) {
+		Register_program(P_RQUOTA, CORE_OPTION_ALL_VERS, RQUOTAVERS);
+		Register_program(P_RQUOTA, CORE_OPTION_ALL_VERS,
+				 EXT_RQUOTAVERS);
+	}
+#endif				/* _NO_PORTMAPPER */
+}
+
 /**
  * @brief Init the svc descriptors for the nfs daemon
  *
  * Perform all the required initialization for the RPC subsystem and event
  * channels.
  */
+static void fanout_new_evchans(struct rpc_fanout *fanout)
+{
+	int ix, code;
+
+	for (ix = 0; ix < fanout->count; ++ix) {
+		fanout->chan[ix].chan_id = 0;
+		code = svc_rqst_new_evchan(&fanout->chan[ix].chan_id,
+					   NULL /* u_data */,
+					   SVC_RQST_FLAG_NONE);
+		if (code)
+			LogFatal(COMPONENT_DISPATCH,
+				 "Cannot create TI-RPC listener event channel (%d, %d)",
+				 ix, code);
+	}
+}
+
 void nfs_Init_svc(void)
 {
 	svc_init_params svc_params;
@@ -1073,6 +1554,15 @@ void nfs_Init_svc(void)
 	/* Init request queue before RPC stack */
 	nfs_rpc_queue_init();
 
+#ifdef USE_RPC_TLS
+	if (!nfs_rpc_tls_init())
+		LogFatal(COMPONENT_INIT, "RPC-with-TLS setup failed");
+#else
+	if (nfs_param.core_param.rpc.tls.enable)
+		LogWarn(COMPONENT_INIT,
+			"RPC_TLS is set but this server was built without USE_RPC_TLS");
+#endif
+
 	LogInfo(COMPONENT_DISPATCH, "NFS INIT: using TIRPC");
 
 	memset(&svc_params, 0, sizeof(svc_params));
@@ -1133,6 +1623,11 @@ void nfs_Init_svc(void)
 		/* XXX bail?? */
 	}
 
+	udp_fanout.count = nfs_param.core_param.rpc.udp_listeners - 1;
+	tcp_fanout.count = nfs_param.core_param.rpc.tcp_listeners - 1;
+	fanout_new_evchans(&udp_fanout);
+	fanout_new_evchans(&tcp_fanout);
+
 	/* Get the netconfig entries from /etc/netconfig */
 	netconfig_udpv4 = (struct netconfig *)getnetconfigent("udp");
 	if (netconfig_udpv4 == NULL)
@@ -1210,27 +1705,7 @@ void nfs_Init_svc(void)
 	}
 #endif				/* _HAVE_GSSAPI */
 
-#ifndef _NO_PORTMAPPER
-	/* Perform all the RPC registration, for UDP and TCP,
-	 * for NFS_V2, NFS_V3 and NFS_V4 */
-#ifdef _USE_NFS3
-	Register_program(P_NFS, CORE_OPTION_NFSV3, NFS_V3);
-#endif /* _USE_NFS3 */
-	Register_program(P_NFS, CORE_OPTION_NFSV4, NFS_V4);
-	Register_program(P_MNT, CORE_OPTION_NFSV3, MOUNT_V1);
-	Register_program(P_MNT, CORE_OPTION_NFSV3, MOUNT_V3);
-#ifdef _USE_NLM
-	if (nfs_param.core_param.enable_NLM)
-		Register_program(P_NLM, CORE_OPTION_NFSV3, NLM4_VERS);
-#endif /* _USE_NLM */
-	if (nfs_param.core_param.enable_RQUOTA &&
-	    (NFS_options & (CORE_OPTION_NFSV3 | CORE_OPTION_NFSV4))) {
-		Register_program(P_RQUOTA, CORE_OPTION_ALL_VERS, RQUOTAVERS);
-		Register_program(P_RQUOTA, CORE_OPTION_ALL_VERS,
-				 EXT_RQUOTAVERS);
-	}
-#endif				/* _NO_PORTMAPPER */
-
+	nfs_rpc_register_programs();
 }
 
 void nfs_rpc_dispatch_stop(void)
@@ -1241,6 +1716,88 @@ void nfs_rpc_dispatch_stop(void)
 		svc_rqst_thrd_signal(rpc_evchan[ix].chan_id,
 				     SVC_RQST_SIGNAL_SHUTDOWN);
 	}
+
+	for (ix = 0; ix < udp_fanout.count; ++ix)
+		svc_rqst_thrd_signal(udp_fanout.chan[ix].chan_id,
+				     SVC_RQST_SIGNAL_SHUTDOWN);
+
+	for (ix = 0; ix < tcp_fanout.count; ++ix)
+		svc_rqst_thrd_signal(tcp_fanout.chan[ix].chan_id,
+				     SVC_RQST_SIGNAL_SHUTDOWN);
+
+#ifdef _HAVE_GSSAPI
+	if (gss_unwrap_fridge != NULL &&
+	    fridgethr_sync_command(gss_unwrap_fridge, fridgethr_comm_stop,
+				   120) == ETIMEDOUT) {
+		LogMajor(COMPONENT_THREAD,
+			 "Shutdown timed out, cancelling GSS unwrap threads!");
+		fridgethr_cancel(gss_unwrap_fridge);
+	}
+#endif
+}
+
+/**
+ * @brief Read a client's fair-share weight into its connection
+ *
+ * @param[in,out] xu   Connection's private data
+ * @param[in]     addr The client's address
+ */
+static void nfs_rpc_xprt_weight_refresh(gsh_xprt_private_t *xu,
+					sockaddr_t *addr)
+{
+	/* Read before the weight, so a change racing with this one is
+	 * picked up on the next request.
+	 */
+	uint32_t gen = atomic_fetch_uint32_t(&client_weight_gen);
+	struct gsh_client *client = xu->client;
+	uint32_t weight = 0;
+
+	/* bound when the connection was accepted */
+	if (client != NULL)
+		weight = atomic_fetch_uint32_t(&client->sched_weight);
+	else {
+		client = get_gsh_client(addr, true);
+		if (client != NULL) {
+			weight = atomic_fetch_uint32_t(&client->sched_weight);
+			put_gsh_client(client);
+		}
+	}
+
+	atomic_store_uint32_t(&xu->sched_weight, weight);
+	atomic_store_uint32_t(&xu->sched_weight_gen, gen);
+}
+
+/**
+ * @brief Set the per-connection socket options on an accepted socket
+ *
+ * With RPC_TCP_Buffer_Autotune, buffers start at the configured minimum
+ * and nfs_rpc_reply_done() grows them to fit the connection.
+ *
+ * @param[in] newxprt Newly accepted transport
+ * @param[in] xu      Its private data
+ */
+static void nfs_rpc_tcp_setopts(SVCXPRT *newxprt, gsh_xprt_private_t *xu)
+{
+	const struct nfs_core_param *nfs_cp = &nfs_param.core_param;
+	uint32_t bufsz = nfs_cp->rpc.tcp_buf_min;
+
+	if (nfs_cp->rpc.tcp_notsent_lowat &&
+	    setsockopt(newxprt->xp_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+		       &nfs_cp->rpc.tcp_notsent_lowat,
+		       sizeof(nfs_cp->rpc.tcp_notsent_lowat)))
+		LogDebug(COMPONENT_DISPATCH,
+			 "Cannot set TCP_NOTSENT_LOWAT on fd %d, error %d(%s)",
+			 newxprt->xp_fd, errno, strerror(errno));
+
+	if (!nfs_cp->rpc.tcp_buf_autotune)
+		return;
+
+	if (setsockopt(newxprt->xp_fd, SOL_SOCKET, SO_SNDBUF,
+		       &bufsz, sizeof(bufsz)) == 0)
+		xu->sndbuf = bufsz;
+	if (setsockopt(newxprt->xp_fd, SOL_SOCKET, SO_RCVBUF,
+		       &bufsz, sizeof(bufsz)) == 0)
+		xu->rcvbuf = bufsz;
 }
 
 /**
@@ -1257,9 +1814,22 @@ void nfs_rpc_dispatch_stop(void)
  */
 static enum xprt_stat nfs_rpc_tcp_user_data(SVCXPRT *newxprt)
 {
+	gsh_xprt_private_t *xu;
+
 	/* setup private data (freed when xprt is destroyed) */
-	newxprt->xp_u1 =
-	    alloc_gsh_xprt_private(newxprt, XPRT_PRIVATE_FLAG_NONE);
+	xu = alloc_gsh_xprt_private(newxprt, XPRT_PRIVATE_FLAG_NONE);
+	/* all requests on a connection come from one address */
+	xu->perm_cache = export_perm_cache_alloc();
+	xu->client = get_gsh_client(
+			(sockaddr_t *)svc_getrpccaller(newxprt), false);
+	newxprt->xp_u1 = xu;
+
+	/* every request on it comes from one client */
+	if (nfs_param.core_param.dispatch_fair_share)
+		nfs_rpc_xprt_weight_refresh(newxprt->xp_u1,
+			(sockaddr_t *)svc_getrpccaller(newxprt));
+
+	nfs_rpc_tcp_setopts(newxprt, xu);
 
 	/* NB: xu->drc is allocated on first request--we need shared
 	 * TCP DRC for v3, but per-connection for v4 */
@@ -1274,10 +1844,16 @@ static enum xprt_stat nfs_rpc_tcp_user_data(SVCXPRT *newxprt)
  */
 static enum xprt_stat nfs_rpc_free_user_data(SVCXPRT *xprt)
 {
+	gsh_xprt_private_t *xu = xprt->xp_u1;
+
 	if (xprt->xp_u2) {
 		nfs_dupreq_put_drc(xprt, xprt->xp_u2, DRC_FLAG_RELEASE);
 		xprt->xp_u2 = NULL;
 	}
+	if (xu != NULL && xu->client != NULL) {
+		put_gsh_client(xu->client);
+		xu->client = NULL;
+	}
 	free_gsh_xprt_private(xprt);
 	return XPRT_DESTROYED;
 }
@@ -1288,26 +1864,102 @@ uint32_t nfs_rpc_outstanding_reqs_est(void)
 	static uint32_t nreqs;
 	struct req_q_pair *qpair;
 	uint32_t treqs;
+	uint32_t sx;
 	int ix;
 
 	if ((atomic_inc_uint32_t(&ctr) % 10) != 0)
 		return atomic_fetch_uint32_t(&nreqs);
 
 	treqs = 0;
-	for (ix = 0; ix < N_REQ_QUEUES; ++ix) {
-		qpair = &(nfs_req_st.reqs.nfs_request_q.qset[ix]);
-		treqs += atomic_fetch_uint32_t(&qpair->producer.size);
-		treqs += atomic_fetch_uint32_t(&qpair->consumer.size);
+	for (sx = 0; sx < nfs_req_st.reqs.nshards; ++sx) {
+		for (ix = 0; ix < N_REQ_QUEUES; ++ix) {
+			qpair = &nfs_req_st.reqs.nfs_request_q[sx].qset[ix];
+			treqs += atomic_fetch_uint32_t(&qpair->producer.size);
+			treqs += atomic_fetch_uint32_t(&qpair->consumer.size);
+			if (qpair->fq)
+				treqs += atomic_fetch_uint32_t(
+							&qpair->fq->size);
+		}
 	}
 
 	atomic_store_uint32_t(&nreqs, treqs);
 	return treqs;
 }
 
+/**
+ * @brief Report the request queues for the metrics endpoint
+ *
+ * @param out [IN] page being built
+ */
+void nfs_rpc_queue_metrics(FILE *out)
+{
+	struct req_q_pair *qpair;
+	uint32_t depth;
+	uint32_t sx;
+	int ix;
+
+	metrics_family(out, "ganesha_request_queue_depth", "gauge",
+		       "Requests waiting for a worker");
+	for (ix = 0; ix < N_REQ_QUEUES; ++ix) {
+		depth = 0;
+		for (sx = 0; sx < nfs_req_st.reqs.nshards; ++sx) {
+			qpair = &nfs_req_st.reqs.nfs_request_q[sx].qset[ix];
+			depth += atomic_fetch_uint32_t(&qpair->producer.size);
+			depth += atomic_fetch_uint32_t(&qpair->consumer.size);
+			if (qpair->fq)
+				depth += atomic_fetch_uint32_t(
+							&qpair->fq->size);
+		}
+		fprintf(out,
+			"ganesha_request_queue_depth{queue=\"%s\"} %" PRIu32
+			"\n", req_q_s[ix], depth);
+	}
+
+	metrics_scalar(out, "ganesha_idle_workers", "gauge",
+		       "Workers waiting for requests",
+		       atomic_fetch_uint32_t(&nfs_req_st.reqs.waiters));
+	metrics_scalar(out, "ganesha_requests_inflight", "gauge",
+		       "Requests queued or executing",
+		       atomic_fetch_uint32_t(&nfs_req_st.admission.inflight));
+	metrics_scalar(out, "ganesha_admission_stalls", "counter",
+		       "Times a connection was held by admission control",
+		       atomic_fetch_uint64_t(&nfs_req_st.admission.stalls));
+	metrics_scalar(out, "ganesha_requests_dropped_closed", "counter",
+		       "Queued requests dropped because their connection closed",
+		       atomic_fetch_uint64_t(&nfs_req_st.dropped.closed));
+	metrics_scalar(out, "ganesha_requests_dropped_late", "counter",
+		       "Queued requests dropped past Dispatch_Request_Deadline_Msec",
+		       atomic_fetch_uint64_t(&nfs_req_st.dropped.late));
+	metrics_scalar(out, "ganesha_requests_dropped_in_progress", "counter",
+		       "Retransmissions dropped at decode, another copy will reply",
+		       atomic_fetch_uint64_t(&nfs_req_st.dropped.in_progress));
+}
+
+/**
+ * @brief Allocate and initialize a fair-share queue
+ *
+ * @return The new queue.
+ */
+static struct req_fq *nfs_rpc_fq_alloc(void)
+{
+	struct req_fq *fq = gsh_calloc(1, sizeof(struct req_fq));
+	int ix;
+
+	pthread_spin_init(&fq->sp, PTHREAD_PROCESS_PRIVATE);
+	glist_init(&fq->active);
+	for (ix = 0; ix < REQ_FQ_BUCKETS; ++ix) {
+		glist_init(&fq->bucket[ix].q);
+		glist_init(&fq->bucket[ix].active);
+	}
+	return fq;
+}
+
 void nfs_rpc_queue_init(void)
 {
 	struct fridgethr_params reqparams;
 	struct req_q_pair *qpair;
+	uint32_t nshards;
+	uint32_t sx;
 	int rc = 0;
 	int ix;
 
@@ -1329,25 +1981,95 @@ void nfs_rpc_queue_init(void)
 		LogFatal(COMPONENT_DISPATCH,
 			 "Unable to initialize decoder thread pool: %d", rc);
 
-	/* queues */
-	pthread_spin_init(&nfs_req_st.reqs.sp, PTHREAD_PROCESS_PRIVATE);
-	nfs_req_st.reqs.size = 0;
-	for (ix = 0; ix < N_REQ_QUEUES; ++ix) {
-		qpair = &(nfs_req_st.reqs.nfs_request_q.qset[ix]);
-		qpair->s = req_q_s[ix];
-		nfs_rpc_q_init(&qpair->producer);
-		nfs_rpc_q_init(&qpair->consumer);
+#ifdef _HAVE_GSSAPI
+	/* RPCSEC_GSS unwrap pool, threads stay up for the server's life */
+	if (nfs_param.core_param.rpc.gss.unwrap_threads != 0) {
+		memset(&reqparams, 0, sizeof(struct fridgethr_params));
+		reqparams.thr_max = nfs_param.core_param.rpc.gss.unwrap_threads;
+		reqparams.thr_min = reqparams.thr_max;
+		reqparams.thread_delay =
+			nfs_param.core_param.decoder_fridge_expiration_delay;
+		reqparams.flavor = fridgethr_flavor_worker;
+		reqparams.deferment = fridgethr_defer_queue;
+
+		rc = fridgethr_init(&gss_unwrap_fridge, "gss_unwrap",
+				    &reqparams);
+		if (rc != 0)
+			LogFatal(COMPONENT_DISPATCH,
+				 "Unable to initialize GSS unwrap thread pool: %d",
+				 rc);
+	}
+#endif
+
+	/* queue shards */
+	nshards = nfs_param.core_param.dispatch_queue_shards;
+	if (nshards == 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nshards = (ncpu > 0) ? ncpu : 1;
+		if (nshards > nfs_param.core_param.nb_worker)
+			nshards = nfs_param.core_param.nb_worker;
 	}
+	nfs_req_st.reqs.nnodes = 1;
+	if (nfs_param.core_param.worker_numa_affinity) {
+		uint32_t nnodes = fridgethr_numa_nodes();
 
-	/* waitq */
-	glist_init(&nfs_req_st.reqs.wait_list);
+		/* every node gets the same number of shards */
+		nshards = ((nshards + nnodes - 1) / nnodes) * nnodes;
+		nfs_req_st.reqs.nnodes = nnodes;
+	}
+	nfs_req_st.reqs.nshards = nshards;
+	nfs_req_st.reqs.nfs_request_q =
+		gsh_calloc(nshards, sizeof(struct req_q_set));
+	nfs_req_st.reqs.size = 0;
 	nfs_req_st.reqs.waiters = 0;
 
+	for (sx = 0; sx < nshards; ++sx) {
+		struct req_q_set *shard = &nfs_req_st.reqs.nfs_request_q[sx];
+
+		for (ix = 0; ix < N_REQ_QUEUES; ++ix) {
+			qpair = &shard->qset[ix];
+			qpair->s = req_q_s[ix];
+			nfs_rpc_q_init(&qpair->producer);
+			nfs_rpc_q_init(&qpair->consumer);
+			if (nfs_param.core_param.dispatch_fair_share
+			    && (ix == REQ_Q_LOW_LATENCY
+				|| ix == REQ_Q_HIGH_LATENCY))
+				qpair->fq = nfs_rpc_fq_alloc();
+		}
+
+		/* waitq */
+		pthread_spin_init(&shard->sp, PTHREAD_PROCESS_PRIVATE);
+		glist_init(&shard->wait_list);
+		shard->waiters = 0;
+	}
+
+	LogInfo(COMPONENT_DISPATCH,
+		"Request queues initialized with %" PRIu32 " shards on %"
+		PRIu32 " node(s)",
+		nshards, nfs_req_st.reqs.nnodes);
+
 	/* stallq */
 	gsh_mutex_init(&nfs_req_st.stallq.mtx, NULL);
 	glist_init(&nfs_req_st.stallq.q);
 	nfs_req_st.stallq.active = false;
 	nfs_req_st.stallq.stalled = 0;
+
+	/* admission control */
+	pthread_spin_init(&nfs_req_st.admission.sp, PTHREAD_PROCESS_PRIVATE);
+	gsh_mutex_init(&nfs_req_st.admission.mtx, NULL);
+	pthread_cond_init(&nfs_req_st.admission.cv, NULL);
+	nfs_req_st.admission.interval_start = 0;
+	nfs_req_st.admission.min_sojourn = UINT64_MAX;
+	nfs_req_st.admission.samples = 0;
+	nfs_req_st.admission.overloaded = 0;
+	nfs_req_st.admission.inflight = 0;
+	nfs_req_st.admission.active_xprts = 0;
+	nfs_req_st.admission.stalls = 0;
+
+	nfs_req_st.dropped.closed = 0;
+	nfs_req_st.dropped.late = 0;
+	nfs_req_st.dropped.in_progress = 0;
 }
 
 static uint32_t enqueued_reqs;
@@ -1363,6 +2085,278 @@ uint32_t get_dequeue_count(void)
 	return dequeued_reqs;
 }
 
+/**
+ * @brief Map the ix'th sibling of a shard, nearest first
+ *
+ * Siblings on the same NUMA node as @c home come first, so stealing
+ * and wakeups stay on the node while there is anything there.
+ *
+ * @param[in] home Index of the starting shard
+ * @param[in] ix   Sibling number, 1 to nshards - 1
+ *
+ * @return Shard index.
+ */
+static inline uint32_t nfs_rpc_shard_sibling(uint32_t home, uint32_t ix)
+{
+	uint32_t nshards = nfs_req_st.reqs.nshards;
+	uint32_t nnodes = nfs_req_st.reqs.nnodes;
+	uint32_t per = nshards / nnodes;
+
+	if (ix < per)
+		return (home + ix * nnodes) % nshards;
+
+	ix -= per;
+	return (home + 1 + ix / per + (ix % per) * nnodes) % nshards;
+}
+
+/**
+ * @brief Find the NUMA node a TCP connection is received on
+ *
+ * Taken once per connection from SO_INCOMING_CPU, which reflects the
+ * NIC queue and IRQ steering of the flow.
+ *
+ * @param[in] xprt Transport
+ *
+ * @return Node index, or -1 if not known.
+ */
+static int nfs_rpc_xprt_node(SVCXPRT *xprt)
+{
+	gsh_xprt_private_t *xu = xprt->xp_u1;
+	int node;
+
+	if (xu == NULL || xprt->xp_type != XPRT_TCP)
+		return -1;
+
+	node = atomic_fetch_int32_t(&xu->numa_node);
+#ifdef SO_INCOMING_CPU
+	if (node < 0) {
+		int cpu = -1;
+		socklen_t len = sizeof(cpu);
+
+		if (getsockopt(xprt->xp_fd, SOL_SOCKET, SO_INCOMING_CPU,
+			       &cpu, &len) == 0 && cpu >= 0) {
+			node = fridgethr_cpu_node(cpu);
+			atomic_store_int32_t(&xu->numa_node, node);
+		}
+	}
+#endif
+	return node;
+}
+
+/**
+ * @brief Select the queue shard local to the calling thread
+ *
+ * Producers (the decoder threads) enqueue to the shard of the CPU they
+ * are running on, so that a request is normally executed by a worker
+ * homed on the same shard.  With NUMA groups, the node is taken from
+ * the connection when known and a shard of that node is chosen.
+ *
+ * @param[in] xprt Transport the request came in on, or NULL
+ *
+ * @return The local shard.
+ */
+static inline struct req_q_set *nfs_rpc_local_shard(SVCXPRT *xprt)
+{
+	uint32_t nshards = nfs_req_st.reqs.nshards;
+	uint32_t nnodes = nfs_req_st.reqs.nnodes;
+	uint32_t ix;
+	int cpu = -1;
+	int node = -1;
+
+	if (nshards == 1)
+		return &nfs_req_st.reqs.nfs_request_q[0];
+#if defined(__linux__)
+	cpu = sched_getcpu();
+#endif
+	if (cpu >= 0)
+		ix = cpu;
+	else
+		ix = atomic_inc_uint32_t(&nfs_req_st.reqs.ctr);
+
+	if (nnodes == 1)
+		return &nfs_req_st.reqs.nfs_request_q[ix % nshards];
+
+	if (xprt != NULL)
+		node = nfs_rpc_xprt_node(xprt);
+	if (node < 0)
+		node = (cpu >= 0) ? fridgethr_cpu_node(cpu) : 0;
+
+	return &nfs_req_st.reqs.nfs_request_q[(node % nnodes) + nnodes *
+					      (ix % (nshards / nnodes))];
+}
+
+/**
+ * @brief Queue a request on its client's flow in a fair-share queue
+ *
+ * The flow is chosen by hashing the caller's address, and takes its
+ * DRR quantum from the client's configured weight.  Connections keep
+ * the weight in their private data; only requests on connectionless
+ * transports look the client up.
+ *
+ * @param[in] fq      Fair-share queue
+ * @param[in] reqdata Request to queue
+ */
+static void nfs_rpc_fq_enqueue(struct req_fq *fq, request_data_t *reqdata)
+{
+	sockaddr_t *addr = NULL;
+	gsh_xprt_private_t *xu = NULL;
+	struct gsh_client *client = NULL;
+	struct req_fq_bucket *b;
+	uint32_t weight = nfs_param.core_param.dispatch_fair_share_weight;
+	uint32_t client_weight = 0;
+	uint32_t hash = 2166136261U;	/* FNV-1a */
+	const uint8_t *p = NULL;
+	size_t len = 0;
+
+	if (reqdata->rtype == NFS_REQUEST) {
+		SVCXPRT *xprt = reqdata->r_u.req.svc.rq_xprt;
+
+		addr = (sockaddr_t *)svc_getrpccaller(xprt);
+		xu = xprt->xp_u1;
+	}
+#ifdef _USE_9P
+	else if (reqdata->rtype == _9P_REQUEST)
+		addr = &reqdata->r_u._9p.pconn->addrpeer;
+#endif
+
+	if (addr != NULL) {
+		switch (addr->ss_family) {
+		case AF_INET:
+			p = (uint8_t *)&((struct sockaddr_in *)addr)->sin_addr;
+			len = sizeof(struct in_addr);
+			break;
+		case AF_INET6:
+			p = (uint8_t *)
+				&((struct sockaddr_in6 *)addr)->sin6_addr;
+			len = sizeof(struct in6_addr);
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (len) {
+		while (len--) {
+			hash ^= *p++;
+			hash *= 16777619U;
+		}
+		if (xu != NULL &&
+		    atomic_fetch_uint32_t(&xu->sched_weight_gen) != 0) {
+			if (atomic_fetch_uint32_t(&xu->sched_weight_gen) !=
+			    atomic_fetch_uint32_t(&client_weight_gen))
+				nfs_rpc_xprt_weight_refresh(xu, addr);
+			client_weight = atomic_fetch_uint32_t(
+							&xu->sched_weight);
+		} else {
+			client = get_gsh_client(addr, true);
+			if (client) {
+				client_weight = client->sched_weight;
+				put_gsh_client(client);
+			}
+		}
+		if (client_weight)
+			weight = client_weight;
+	}
+
+	b = &fq->bucket[hash % REQ_FQ_BUCKETS];
+
+	pthread_spin_lock(&fq->sp);
+	glist_add_tail(&b->q, &reqdata->req_q);
+	b->weight = weight;
+	if (b->size++ == 0) {
+		/* newly active flow starts a fresh round */
+		b->deficit = weight;
+		glist_add_tail(&fq->active, &b->active);
+	}
+	++(fq->size);
+	pthread_spin_unlock(&fq->sp);
+}
+
+/**
+ * @brief Take the next request from a fair-share queue
+ *
+ * Deficit round-robin: the flow at the head of the active ring is
+ * served until its deficit is spent, then goes to the tail with its
+ * quantum replenished.
+ *
+ * @param[in] fq Fair-share queue
+ *
+ * @return A request, or NULL if the queue is empty.
+ */
+static request_data_t *nfs_rpc_fq_consume(struct req_fq *fq)
+{
+	request_data_t *reqdata = NULL;
+	struct req_fq_bucket *b;
+
+	if (!atomic_fetch_uint32_t(&fq->size))
+		return NULL;
+
+	pthread_spin_lock(&fq->sp);
+	while ((b = glist_first_entry(&fq->active, struct req_fq_bucket,
+				      active)) != NULL) {
+		if (b->deficit <= 0) {
+			b->deficit += b->weight;
+			glist_del(&b->active);
+			glist_add_tail(&fq->active, &b->active);
+			continue;
+		}
+
+		reqdata = glist_first_entry(&b->q, request_data_t, req_q);
+		glist_del(&reqdata->req_q);
+		--(b->deficit);
+		--(fq->size);
+		if (--(b->size) == 0) {
+			b->deficit = 0;
+			glist_del(&b->active);
+		}
+		break;
+	}
+	pthread_spin_unlock(&fq->sp);
+
+	return reqdata;
+}
+
+/**
+ * @brief Release one waiting worker on a shard, if any
+ *
+ * @param[in] shard Shard whose wait list to check
+ *
+ * @return true if a worker was signalled.
+ */
+static bool nfs_rpc_wake_shard(struct req_q_set *shard)
+{
+	wait_q_entry_t *wqe;
+
+	/* SPIN LOCKED */
+	pthread_spin_lock(&shard->sp);
+	if (!shard->waiters) {
+		/* ! SPIN LOCKED */
+		pthread_spin_unlock(&shard->sp);
+		return false;
+	}
+
+	wqe = glist_first_entry(&shard->wait_list, wait_q_entry_t, waitq);
+
+	LogFullDebug(COMPONENT_DISPATCH,
+		     "shard %p waiters %u signal wqe %p",
+		     shard, shard->waiters, wqe);
+
+	/* release 1 waiter */
+	glist_del(&wqe->waitq);
+	--(shard->waiters);
+	--(wqe->waiters);
+	(void) atomic_dec_uint32_t(&nfs_req_st.reqs.waiters);
+	/* ! SPIN LOCKED */
+	pthread_spin_unlock(&shard->sp);
+	PTHREAD_MUTEX_lock(&wqe->lwe.mtx);
+	/* XXX reliable handoff */
+	wqe->flags |= Wqe_LFlag_SyncDone;
+	if (wqe->flags & Wqe_LFlag_WaitSync)
+		pthread_cond_signal(&wqe->lwe.cv);
+	PTHREAD_MUTEX_unlock(&wqe->lwe.mtx);
+	return true;
+}
+
 void nfs_rpc_enqueue_req(request_data_t *reqdata)
 {
 	struct req_q_set *nfs_request_q;
@@ -1376,7 +2370,9 @@ void nfs_rpc_enqueue_req(request_data_t *reqdata)
 		"enqueue-enter");
 #endif
 
-	nfs_request_q = &nfs_req_st.reqs.nfs_request_q;
+	nfs_request_q = nfs_rpc_local_shard(
+		reqdata->rtype == NFS_REQUEST
+			? reqdata->r_u.req.svc.rq_xprt : NULL);
 
 	switch (reqdata->rtype) {
 	case NFS_REQUEST:
@@ -1384,6 +2380,16 @@ void nfs_rpc_enqueue_req(request_data_t *reqdata)
 			     "enter rq_xid=%" PRIu32 " lookahead.flags=%u",
 			     reqdata->r_u.req.svc.rq_msg.rm_xid,
 			     reqdata->r_u.req.lookahead.flags);
+		{
+			gsh_xprt_private_t *xu =
+				reqdata->r_u.req.svc.rq_xprt->xp_u1;
+
+			(void) atomic_inc_uint32_t(
+				&nfs_req_st.admission.inflight);
+			if (atomic_inc_uint32_t(&xu->inflight) == 1)
+				(void) atomic_inc_uint32_t(
+					&nfs_req_st.admission.active_xprts);
+		}
 		if (reqdata->r_u.req.lookahead.flags & NFS_LOOKAHEAD_MOUNT) {
 			qpair = &(nfs_request_q->qset[REQ_Q_MOUNT]);
 			break;
@@ -1398,9 +2404,10 @@ void nfs_rpc_enqueue_req(request_data_t *reqdata)
 		break;
 #ifdef _USE_9P
 	case _9P_REQUEST:
-		/* XXX identify high-latency requests and allocate
-		 * to the high-latency queue, as above */
-		qpair = &(nfs_request_q->qset[REQ_Q_LOW_LATENCY]);
+		if (_9p_lookahead_high_latency(&reqdata->r_u._9p))
+			qpair = &(nfs_request_q->qset[REQ_Q_HIGH_LATENCY]);
+		else
+			qpair = &(nfs_request_q->qset[REQ_Q_LOW_LATENCY]);
 		break;
 #endif
 	default:
@@ -1412,10 +2419,14 @@ void nfs_rpc_enqueue_req(request_data_t *reqdata)
 	now(&reqdata->time_queued);
 	/* always append to producer queue */
 	q = &qpair->producer;
-	pthread_spin_lock(&q->sp);
-	glist_add_tail(&q->q, &reqdata->req_q);
-	++(q->size);
-	pthread_spin_unlock(&q->sp);
+	if (qpair->fq) {
+		nfs_rpc_fq_enqueue(qpair->fq, reqdata);
+	} else {
+		pthread_spin_lock(&q->sp);
+		glist_add_tail(&q->q, &reqdata->req_q);
+		++(q->size);
+		pthread_spin_unlock(&q->sp);
+	}
 
 	(void) atomic_inc_uint32_t(&enqueued_reqs);
 
@@ -1438,37 +2449,28 @@ void nfs_rpc_enqueue_req(request_data_t *reqdata)
 		 q, qpair->s, &qpair->producer, &qpair->consumer, q->size,
 		 enqueued_reqs, dequeued_reqs);
 
-	/* potentially wakeup some thread */
-
-	/* global waitq */
-	{
-		wait_q_entry_t *wqe;
-
-		/* SPIN LOCKED */
-		pthread_spin_lock(&nfs_req_st.reqs.sp);
-		if (nfs_req_st.reqs.waiters) {
-			wqe = glist_first_entry(&nfs_req_st.reqs.wait_list,
-						wait_q_entry_t, waitq);
+	/* A worker polling this shard will pick the request up without
+	 * any handoff.  The spinner re-checks the queues after it stops
+	 * advertising itself, so the request cannot be stranded.
+	 */
+	if (atomic_fetch_uint32_t(&nfs_request_q->spinners))
+		goto out;
 
-			LogFullDebug(COMPONENT_DISPATCH,
-				     "nfs_req_st.reqs.waiters %u signal wqe %p (for q %p)",
-				     nfs_req_st.reqs.waiters, wqe, q);
-
-			/* release 1 waiter */
-			glist_del(&wqe->waitq);
-			--(nfs_req_st.reqs.waiters);
-			--(wqe->waiters);
-			/* ! SPIN LOCKED */
-			pthread_spin_unlock(&nfs_req_st.reqs.sp);
-			PTHREAD_MUTEX_lock(&wqe->lwe.mtx);
-			/* XXX reliable handoff */
-			wqe->flags |= Wqe_LFlag_SyncDone;
-			if (wqe->flags & Wqe_LFlag_WaitSync)
-				pthread_cond_signal(&wqe->lwe.cv);
-			PTHREAD_MUTEX_unlock(&wqe->lwe.mtx);
-		} else
-			/* ! SPIN LOCKED */
-			pthread_spin_unlock(&nfs_req_st.reqs.sp);
+	/* potentially wakeup some thread, preferring one homed on this
+	 * shard; a worker woken elsewhere will steal the request.
+	 */
+	if (atomic_fetch_uint32_t(&nfs_req_st.reqs.waiters)
+	    && !nfs_rpc_wake_shard(nfs_request_q)) {
+		uint32_t nshards = nfs_req_st.reqs.nshards;
+		uint32_t home = nfs_request_q - nfs_req_st.reqs.nfs_request_q;
+		uint32_t ix;
+
+		for (ix = 1; ix < nshards; ++ix) {
+			if (nfs_rpc_wake_shard(
+			    &nfs_req_st.reqs.nfs_request_q[
+				nfs_rpc_shard_sibling(home, ix)]))
+				break;
+		}
 	}
 
  out:
@@ -1480,6 +2482,9 @@ request_data_t *nfs_rpc_consume_req(struct req_q_pair *qpair)
 {
 	request_data_t *reqdata = NULL;
 
+	if (qpair->fq)
+		return nfs_rpc_fq_consume(qpair->fq);
+
 	pthread_spin_lock(&qpair->consumer.sp);
 	if (qpair->consumer.size > 0) {
 		reqdata =
@@ -1533,37 +2538,41 @@ request_data_t *nfs_rpc_consume_req(struct req_q_pair *qpair)
 	return reqdata;
 }
 
-request_data_t *nfs_rpc_dequeue_req(nfs_worker_data_t *worker)
+/**
+ * @brief Take a request from any classification queue of a shard
+ *
+ * @param[in] shard Shard to drain
+ *
+ * @return A request, or NULL if the shard is empty.
+ */
+static request_data_t *nfs_rpc_dequeue_shard(struct req_q_set *shard)
 {
 	request_data_t *reqdata = NULL;
-	struct req_q_set *nfs_request_q = &nfs_req_st.reqs.nfs_request_q;
 	struct req_q_pair *qpair;
 	uint32_t ix, slot;
-	struct timespec timeout;
 
 	/* XXX: the following stands in for a more robust/flexible
 	 * weighting function */
 
 	/* slot in 1..4 */
- retry_deq:
-	slot = (nfs_rpc_q_next_slot() % 4);
+	slot = (nfs_rpc_q_next_slot(shard) % 4);
 	for (ix = 0; ix < 4; ++ix) {
 		switch (slot) {
 		case 0:
 			/* MOUNT */
-			qpair = &(nfs_request_q->qset[REQ_Q_MOUNT]);
+			qpair = &(shard->qset[REQ_Q_MOUNT]);
 			break;
 		case 1:
 			/* NFS_CALL */
-			qpair = &(nfs_request_q->qset[REQ_Q_CALL]);
+			qpair = &(shard->qset[REQ_Q_CALL]);
 			break;
 		case 2:
 			/* LL */
-			qpair = &(nfs_request_q->qset[REQ_Q_LOW_LATENCY]);
+			qpair = &(shard->qset[REQ_Q_LOW_LATENCY]);
 			break;
 		case 3:
 			/* HL */
-			qpair = &(nfs_request_q->qset[REQ_Q_HIGH_LATENCY]);
+			qpair = &(shard->qset[REQ_Q_HIGH_LATENCY]);
 			break;
 		default:
 			/* not here */
@@ -1587,69 +2596,384 @@ request_data_t *nfs_rpc_dequeue_req(nfs_worker_data_t *worker)
 
 	}			/* for */
 
-	/* wait */
-	if (!reqdata) {
-		struct fridgethr_context *ctx =
-			container_of(worker, struct fridgethr_context, wd);
-		wait_q_entry_t *wqe = &worker->wqe;
+	return reqdata;
+}
 
-		assert(wqe->waiters == 0); /* wqe is not on any wait queue */
-		PTHREAD_MUTEX_lock(&wqe->lwe.mtx);
-		wqe->flags = Wqe_LFlag_WaitSync;
-		wqe->waiters = 1;
-		/* XXX functionalize */
-		pthread_spin_lock(&nfs_req_st.reqs.sp);
-		glist_add_tail(&nfs_req_st.reqs.wait_list, &wqe->waitq);
-		++(nfs_req_st.reqs.waiters);
-		pthread_spin_unlock(&nfs_req_st.reqs.sp);
-		while (!(wqe->flags & Wqe_LFlag_SyncDone)) {
-			timeout.tv_sec = time(NULL) + 5;
-			timeout.tv_nsec = 0;
-			pthread_cond_timedwait(&wqe->lwe.cv, &wqe->lwe.mtx,
-					       &timeout);
-			if (fridgethr_you_should_break(ctx)) {
-				/* We are returning;
-				 * so take us out of the waitq */
-				pthread_spin_lock(&nfs_req_st.reqs.sp);
-				if (wqe->waitq.next != NULL
-				    || wqe->waitq.prev != NULL) {
-					/* Element is still in wqitq,
-					 * remove it */
-					glist_del(&wqe->waitq);
-					--(nfs_req_st.reqs.waiters);
-					--(wqe->waiters);
-					wqe->flags &=
-					    ~(Wqe_LFlag_WaitSync |
-					      Wqe_LFlag_SyncDone);
-				}
-				pthread_spin_unlock(&nfs_req_st.reqs.sp);
-				PTHREAD_MUTEX_unlock(&wqe->lwe.mtx);
-				return NULL;
-			}
-		}
+/**
+ * @brief Take a request from the home shard, or steal one
+ *
+ * @param[in] home Index of the caller's home shard
+ *
+ * @return A request, or NULL if all shards are empty.
+ */
+static inline request_data_t *nfs_rpc_dequeue_any(uint32_t home)
+{
+	request_data_t *reqdata;
+	uint32_t nshards = nfs_req_st.reqs.nshards;
+	uint32_t ix;
 
-		/* XXX wqe was removed from nfs_req_st.waitq
-		 * (by signalling thread) */
-		wqe->flags &= ~(Wqe_LFlag_WaitSync | Wqe_LFlag_SyncDone);
-		PTHREAD_MUTEX_unlock(&wqe->lwe.mtx);
-		LogFullDebug(COMPONENT_DISPATCH, "wqe wakeup %p", wqe);
-		goto retry_deq;
-	} /* !reqdata */
+	/* local shard first */
+	reqdata = nfs_rpc_dequeue_shard(&nfs_req_st.reqs.nfs_request_q[home]);
 
-#if defined(HAVE_BLKIN)
-	/* thread id */
-	BLKIN_KEYVAL_INTEGER(
-		&reqdata->r_u.req.svc.bl_trace,
-		&reqdata->r_u.req.xprt->blkin.endp,
-		"worker-id",
-		worker->worker_index
-		);
+	/* then steal from siblings, nearest first */
+	for (ix = 1; !reqdata && ix < nshards; ++ix) {
+		reqdata = nfs_rpc_dequeue_shard(
+			&nfs_req_st.reqs.nfs_request_q[
+				nfs_rpc_shard_sibling(home, ix)]);
+	}
+
+	return reqdata;
+}
+
+/**
+ * @brief Poll the queues for a bounded time before parking
+ *
+ * The worker advertises itself on its home shard while it spins, so
+ * that producers can skip the wakeup handoff entirely.  Once it stops
+ * advertising it takes one last look, closing the window in which a
+ * producer may have seen it spinning and not signalled anybody.
+ *
+ * @param[in] shard Home shard
+ * @param[in] home  Index of the home shard
+ *
+ * @return A request, or NULL if none showed up in time.
+ */
+static request_data_t *nfs_rpc_dequeue_spin(struct req_q_set *shard,
+					    uint32_t home)
+{
+	request_data_t *reqdata = NULL;
+	nsecs_elapsed_t limit =
+		nfs_param.core_param.worker_spin_usec * NS_PER_USEC;
+	struct timespec start, cur;
+	uint32_t polls = 0;
+
+	(void) atomic_inc_uint32_t(&shard->spinners);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	cur = start;
+
+	do {
+		gsh_cpu_relax();
+		reqdata = nfs_rpc_dequeue_any(home);
+		if (reqdata)
+			break;
+		/* don't read the clock on every poll */
+		if ((++polls & 0x3f) != 0)
+			continue;
+		clock_gettime(CLOCK_MONOTONIC, &cur);
+	} while (timespec_diff(&start, &cur) < limit);
+
+	(void) atomic_dec_uint32_t(&shard->spinners);
+
+	if (!reqdata)
+		reqdata = nfs_rpc_dequeue_any(home);
+
+	return reqdata;
+}
+
+/**
+ * @brief Pick a worker's home shard
+ *
+ * A worker bound to a NUMA node is homed on one of its node's shards.
+ *
+ * @param[in] ctx The worker's fridge context
+ *
+ * @return Index of the home shard.
+ */
+static inline uint32_t nfs_rpc_home_shard(struct fridgethr_context *ctx)
+{
+	uint32_t nshards = nfs_req_st.reqs.nshards;
+	uint32_t nnodes = nfs_req_st.reqs.nnodes;
+	uint32_t index = ctx->wd.worker_index;
+
+	if (nnodes == 1 || ctx->numa_node < 0)
+		return index % nshards;
+
+	return (ctx->numa_node % nnodes) +
+	       nnodes * ((index / nnodes) % (nshards / nnodes));
+}
+
+/**
+ * @brief Account a finished NFS request against its transport
+ *
+ * Paired with the inflight increment in nfs_rpc_enqueue_req().
+ *
+ * @param[in] xprt Transport the request arrived on
+ *
+ * @return Requests still queued or executing for this transport.
+ */
+
+uint32_t nfs_rpc_xprt_done(SVCXPRT *xprt)
+{
+	gsh_xprt_private_t *xu = xprt->xp_u1;
+	uint32_t left;
+
+	(void) atomic_dec_uint32_t(&nfs_req_st.admission.inflight);
+	left = atomic_dec_uint32_t(&xu->inflight);
+	if (left == 0)
+		(void) atomic_dec_uint32_t(&nfs_req_st.admission.active_xprts);
+	return left;
+}
+
+/**
+ * @brief Number of NFS requests queued or executing
+ */
+
+uint32_t nfs_rpc_inflight_count(void)
+{
+	return atomic_fetch_uint32_t(&nfs_req_st.admission.inflight);
+}
+
+/**
+ * @brief Decide whether a dequeued request is still worth executing
+ *
+ * A request whose connection has since been destroyed can no longer be
+ * answered.  One that waited longer than Dispatch_Request_Deadline_Msec
+ * has been given up on and retransmitted by its client, and the
+ * retransmission is queued behind it.  An NFSv4 client only retransmits
+ * on a new connection, so NFSv4 requests are only dropped by the first
+ * test.  Dropped requests were never started, so nothing is undone.
+ *
+ * @param[in] reqdata Request just dequeued
+ *
+ * @retval true if it must be dropped without a reply.
+ */
+
+bool nfs_rpc_req_stale(request_data_t *reqdata)
+{
+	struct svc_req *req = &reqdata->r_u.req.svc;
+	uint32_t deadline = nfs_param.core_param.dispatch_request_deadline_msec;
+	struct timespec ts;
+
+	/* Idempotent: once set, the DESTROYED flag is never cleared.
+	 * No lock needed.
+	 */
+	if (req->rq_xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED) {
+		(void) atomic_inc_uint64_t(&nfs_req_st.dropped.closed);
+		return true;
+	}
+
+	if (deadline == 0 ||
+	    (req->rq_msg.cb_prog == NFS_program[P_NFS] &&
+	     req->rq_msg.cb_vers == NFS_V4))
+		return false;
+
+	now(&ts);
+	if (timespec_diff(&reqdata->time_queued, &ts) <
+	    (nsecs_elapsed_t) deadline * NS_PER_MSEC)
+		return false;
+
+	(void) atomic_inc_uint64_t(&nfs_req_st.dropped.late);
+	LogDebug(COMPONENT_DISPATCH,
+		 "Dropping xid=%" PRIu32 " after %" PRIu32 "ms in the queue",
+		 req->rq_msg.rm_xid, deadline);
+	return true;
+}
+
+/**
+ * @brief Release connections held by admission control
+ */
+
+static void nfs_rpc_admission_clear(void)
+{
+	if (atomic_postclear_uint32_t_bits(&nfs_req_st.admission.overloaded,
+					   1) == 0)
+		return;
+
+	LogDebug(COMPONENT_DISPATCH, "Request backlog cleared");
+	PTHREAD_MUTEX_lock(&nfs_req_st.admission.mtx);
+	pthread_cond_broadcast(&nfs_req_st.admission.cv);
+	PTHREAD_MUTEX_unlock(&nfs_req_st.admission.mtx);
+}
+
+/**
+ * @brief Feed a queue wait time to the admission controller
+ *
+ * CoDel-style: a standing queue shows up as a minimum wait that stays
+ * above Dispatch_Target_Latency_Usec for a whole interval, whereas a
+ * burst that drains in time lets at least one request through quickly.
+ * Only one dequeue in 16 is sampled to keep the spinlock cold.
+ *
+ * @param[in] reqdata Request just dequeued
+ */
+
+static void nfs_rpc_admission_sample(request_data_t *reqdata)
+{
+	uint32_t target = nfs_param.core_param.dispatch_target_latency_usec;
+	nsecs_elapsed_t interval =
+		nfs_param.core_param.dispatch_latency_interval_msec *
+		NS_PER_MSEC;
+	nsecs_elapsed_t t_now, sojourn, min_sojourn;
+	struct timespec ts;
+	bool over;
+
+	if (target == 0 ||
+	    (atomic_inc_uint32_t(&nfs_req_st.admission.samples) & 15) != 0)
+		return;
+
+	now(&ts);
+	t_now = timespec_diff(&ServerBootTime, &ts);
+	sojourn = timespec_diff(&reqdata->time_queued, &ts);
+
+	pthread_spin_lock(&nfs_req_st.admission.sp);
+	if (sojourn < nfs_req_st.admission.min_sojourn)
+		nfs_req_st.admission.min_sojourn = sojourn;
+	if (t_now - nfs_req_st.admission.interval_start < interval) {
+		pthread_spin_unlock(&nfs_req_st.admission.sp);
+		return;
+	}
+	min_sojourn = nfs_req_st.admission.min_sojourn;
+	nfs_req_st.admission.min_sojourn = UINT64_MAX;
+	nfs_req_st.admission.interval_start = t_now;
+	pthread_spin_unlock(&nfs_req_st.admission.sp);
+
+	over = min_sojourn > (nsecs_elapsed_t) target * NS_PER_USEC;
+	if (!over) {
+		nfs_rpc_admission_clear();
+	} else if (atomic_postset_uint32_t_bits(
+				&nfs_req_st.admission.overloaded, 1) == 0) {
+		LogDebug(COMPONENT_DISPATCH,
+			 "Queue wait %" PRIu64 "us above target, holding busy connections",
+			 min_sojourn / NS_PER_USEC);
+	}
+}
+
+/**
+ * @brief Hold the receive path of a connection while the server is behind
+ *
+ * Called by the transport's receive thread after queueing a request.
+ * Each connection is read by a single thread, so blocking here stops
+ * reading from it and its pipelined requests wait in the client's
+ * socket buffer rather than in our queues.  Only connections with more
+ * than their fair share of the inflight requests are held, and never
+ * for longer than a second, so no client is starved outright.
+ *
+ * @param[in] xprt Transport the request arrived on
+ */
+
+static void nfs_rpc_admission_hold(SVCXPRT *xprt)
+{
+	gsh_xprt_private_t *xu = xprt->xp_u1;
+	nsecs_elapsed_t interval =
+		nfs_param.core_param.dispatch_latency_interval_msec *
+		NS_PER_MSEC;
+	struct timespec deadline;
+	uint32_t active, share;
+	int waits;
+
+	if (nfs_param.core_param.dispatch_target_latency_usec == 0)
+		return;
+
+	for (waits = 0; waits * interval < NS_PER_SEC; waits++) {
+		if (!atomic_fetch_uint32_t(&nfs_req_st.admission.overloaded) ||
+		    (xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED))
+			return;
+
+		active = atomic_fetch_uint32_t(
+				&nfs_req_st.admission.active_xprts);
+		share = atomic_fetch_uint32_t(&nfs_req_st.admission.inflight) /
+			(active ? active : 1);
+		if (atomic_fetch_uint32_t(&xu->inflight) <= (share ? share : 1))
+			return;
+
+		if (waits == 0)
+			(void) atomic_inc_uint64_t(
+				&nfs_req_st.admission.stalls);
+
+		now(&deadline);
+		timespec_add_nsecs(interval, &deadline);
+		PTHREAD_MUTEX_lock(&nfs_req_st.admission.mtx);
+		if (atomic_fetch_uint32_t(&nfs_req_st.admission.overloaded))
+			(void) pthread_cond_timedwait(
+					&nfs_req_st.admission.cv,
+					&nfs_req_st.admission.mtx, &deadline);
+		PTHREAD_MUTEX_unlock(&nfs_req_st.admission.mtx);
+	}
+}
+
+request_data_t *nfs_rpc_dequeue_req(nfs_worker_data_t *worker)
+{
+	request_data_t *reqdata = NULL;
+	struct fridgethr_context *ctx =
+		container_of(worker, struct fridgethr_context, wd);
+	uint32_t home = nfs_rpc_home_shard(ctx);
+	struct req_q_set *shard = &nfs_req_st.reqs.nfs_request_q[home];
+	struct timespec timeout;
+
+ retry_deq:
+	reqdata = nfs_rpc_dequeue_any(home);
+
+	/* spin */
+	if (!reqdata && nfs_param.core_param.worker_spin_usec)
+		reqdata = nfs_rpc_dequeue_spin(shard, home);
+
+	/* wait */
+	if (!reqdata) {
+		wait_q_entry_t *wqe = &worker->wqe;
+
+		/* An idle worker means there is no standing queue */
+		nfs_rpc_admission_clear();
+
+		assert(wqe->waiters == 0); /* wqe is not on any wait queue */
+		PTHREAD_MUTEX_lock(&wqe->lwe.mtx);
+		wqe->flags = Wqe_LFlag_WaitSync;
+		wqe->waiters = 1;
+		/* XXX functionalize */
+		pthread_spin_lock(&shard->sp);
+		glist_add_tail(&shard->wait_list, &wqe->waitq);
+		++(shard->waiters);
+		(void) atomic_inc_uint32_t(&nfs_req_st.reqs.waiters);
+		pthread_spin_unlock(&shard->sp);
+		while (!(wqe->flags & Wqe_LFlag_SyncDone)) {
+			timeout.tv_sec = time(NULL) + 5;
+			timeout.tv_nsec = 0;
+			pthread_cond_timedwait(&wqe->lwe.cv, &wqe->lwe.mtx,
+					       &timeout);
+			if (fridgethr_you_should_break(ctx)) {
+				/* We are returning;
+				 * so take us out of the waitq */
+				pthread_spin_lock(&shard->sp);
+				if (wqe->waitq.next != NULL
+				    || wqe->waitq.prev != NULL) {
+					/* Element is still in wqitq,
+					 * remove it */
+					glist_del(&wqe->waitq);
+					--(shard->waiters);
+					--(wqe->waiters);
+					(void) atomic_dec_uint32_t(
+						&nfs_req_st.reqs.waiters);
+					wqe->flags &=
+					    ~(Wqe_LFlag_WaitSync |
+					      Wqe_LFlag_SyncDone);
+				}
+				pthread_spin_unlock(&shard->sp);
+				PTHREAD_MUTEX_unlock(&wqe->lwe.mtx);
+				return NULL;
+			}
+		}
+
+		/* XXX wqe was removed from the shard waitq
+		 * (by signalling thread) */
+		wqe->flags &= ~(Wqe_LFlag_WaitSync | Wqe_LFlag_SyncDone);
+		PTHREAD_MUTEX_unlock(&wqe->lwe.mtx);
+		LogFullDebug(COMPONENT_DISPATCH, "wqe wakeup %p", wqe);
+		goto retry_deq;
+	} /* !reqdata */
+
+#if defined(HAVE_BLKIN)
+	/* thread id */
+	BLKIN_KEYVAL_INTEGER(
+		&reqdata->r_u.req.svc.bl_trace,
+		&reqdata->r_u.req.xprt->blkin.endp,
+		"worker-id",
+		worker->worker_index
+		);
 
 	BLKIN_TIMESTAMP(
 		&reqdata->r_u.req.svc.bl_trace,
 		&reqdata->r_u.req.xprt->blkin.endp,
 		"dequeue-req");
 #endif
+	nfs_rpc_admission_sample(reqdata);
 	return reqdata;
 }
 
@@ -1673,6 +2997,7 @@ static inline request_data_t *alloc_nfs_request(SVCXPRT *xprt, XDR *xdrs)
 	reqdata->r_u.req.svc.rq_xdrs = xdrs;
 
 	reqdata->r_d_refs = 1;
+	req_phase_begin(reqdata);
 	return reqdata;
 }
 
@@ -1700,6 +3025,7 @@ int free_nfs_request(request_data_t *reqdata)
 	default:
 		break;
 	}
+	req_arena_release(&reqdata->arena);
 	SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
 	pool_free(request_pool, reqdata);
 	return 0;
@@ -1780,12 +3106,437 @@ static enum xprt_stat nfs_rpc_decode_request(SVCXPRT *xprt, XDR *xdrs)
 	return stat;
 }
 
-enum xprt_stat nfs_rpc_process_request(request_data_t *reqdata)
+/**
+ * @brief Find the export and payload a decoded request will charge
+ *
+ * NFSv3 requests carry the handle first in their arguments.  For NFSv4
+ * the first PUTFH of the compound decides the export, and every READ
+ * and WRITE in the compound is charged against it.
+ *
+ * @param[in]  reqdata     Decoded request
+ * @param[out] read_bytes  Bytes the request will read
+ * @param[out] write_bytes Bytes the request will write
+ *
+ * @return Referenced export or NULL if the request is not charged.
+ */
+
+static struct gsh_export *nfs_rpc_qos_export(request_data_t *reqdata,
+					     uint64_t *read_bytes,
+					     uint64_t *write_bytes)
+{
+	struct svc_req *req = &reqdata->r_u.req.svc;
+	nfs_arg_t *arg_nfs = &reqdata->r_u.req.arg_nfs;
+	int exportid = -1;
+
+	*read_bytes = 0;
+	*write_bytes = 0;
+
+	if (req->rq_msg.cb_prog != NFS_program[P_NFS] ||
+	    req->rq_msg.cb_proc == NFSPROC_NULL)
+		return NULL;
+
+#ifdef _USE_NFS3
+	if (req->rq_msg.cb_vers == NFS_V3) {
+		exportid = nfs3_FhandleToExportId((nfs_fh3 *) arg_nfs);
+		if (req->rq_msg.cb_proc == NFSPROC3_READ)
+			*read_bytes = arg_nfs->arg_read3.count;
+		else if (req->rq_msg.cb_proc == NFSPROC3_WRITE)
+			*write_bytes = arg_nfs->arg_write3.data.data_len;
+	}
+#endif /* _USE_NFS3 */
+
+	if (req->rq_msg.cb_vers == NFS_V4) {
+		COMPOUND4args *compound = &arg_nfs->arg_compound4;
+		nfs_argop4 *op;
+		u_int i;
+
+		for (i = 0; i < compound->argarray.argarray_len; i++) {
+			op = &compound->argarray.argarray_val[i];
+			switch (op->argop) {
+			case NFS4_OP_PUTFH:
+				if (exportid < 0 &&
+				    nfs4_Is_Fh_Invalid(
+					&op->nfs_argop4_u.opputfh.object)
+				    == NFS4_OK) {
+					file_handle_v4_t *fh = (file_handle_v4_t *)
+					    op->nfs_argop4_u.opputfh.object.
+					    nfs_fh4_val;
+
+					exportid = ntohs(fh->id.exports);
+				}
+				break;
+			case NFS4_OP_READ:
+				*read_bytes += op->nfs_argop4_u.opread.count;
+				break;
+			case NFS4_OP_WRITE:
+				*write_bytes +=
+				    op->nfs_argop4_u.opwrite.data.data_len;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	if (exportid < 0)
+		return NULL;
+
+	return get_gsh_export(exportid);
+}
+
+/**
+ * @brief Queue a decoded request, subject to its export's Max_Inflight
+ *
+ * A request over the limit is parked on the export, holding no worker,
+ * until nfs_rpc_export_release() of one of the export's requests queues
+ * it.  An export whose FSAL stalls thus ties up at most Max_Inflight
+ * workers and the rest keep serving other exports.
+ *
+ * @param[in] reqdata Decoded and referenced request
+ */
+
+static void nfs_rpc_export_admit(request_data_t *reqdata)
+{
+	struct gsh_export *export = reqdata->r_u.req.admit_export;
+	struct export_inflight *ei;
+	uint32_t max;
+
+	if (export == NULL) {
+		nfs_rpc_enqueue_req(reqdata);
+		return;
+	}
+
+	max = atomic_fetch_uint32_t(&export->max_inflight);
+	if (max == 0) {
+		reqdata->r_u.req.admit_export = NULL;
+		put_gsh_export(export);
+		nfs_rpc_enqueue_req(reqdata);
+		return;
+	}
+
+	ei = &export->inflight;
+	pthread_spin_lock(&ei->sp);
+
+	if (ei->count < max) {
+		ei->count++;
+		pthread_spin_unlock(&ei->sp);
+		nfs_rpc_enqueue_req(reqdata);
+		return;
+	}
+
+	glist_add_tail(&ei->parked, &reqdata->req_q);
+	ei->parked_count++;
+	ei->held++;
+	pthread_spin_unlock(&ei->sp);
+
+	LogFullDebug(COMPONENT_DISPATCH,
+		     "Export %d at Max_Inflight %" PRIu32 ", parking xid=%"
+		     PRIu32,
+		     export->export_id, max,
+		     reqdata->r_u.req.svc.rq_msg.rm_xid);
+}
+
+/**
+ * @brief Account the end of a request against its export's
+ *        Max_Inflight and queue what was waiting on it
+ *
+ * Called by the worker once the request is answered or dropped.
+ *
+ * @param[in] reqdata The request
+ */
+
+void nfs_rpc_export_release(request_data_t *reqdata)
+{
+	struct gsh_export *export = reqdata->r_u.req.admit_export;
+	struct export_inflight *ei;
+	struct glist_head ready, *glist, *glistn;
+	request_data_t *next;
+	uint32_t max;
+
+	if (export == NULL)
+		return;
+
+	reqdata->r_u.req.admit_export = NULL;
+	max = atomic_fetch_uint32_t(&export->max_inflight);
+	ei = &export->inflight;
+	glist_init(&ready);
+
+	pthread_spin_lock(&ei->sp);
+
+	ei->count--;
+
+	/* The limit may have been raised or lifted meanwhile */
+	while ((max == 0 || ei->count < max) && !glist_empty(&ei->parked)) {
+		next = glist_first_entry(&ei->parked, request_data_t, req_q);
+		glist_del(&next->req_q);
+		glist_add_tail(&ready, &next->req_q);
+		ei->parked_count--;
+		ei->count++;
+	}
+
+	pthread_spin_unlock(&ei->sp);
+
+	put_gsh_export(export);
+
+	glist_for_each_safe(glist, glistn, &ready) {
+		next = glist_entry(glist, request_data_t, req_q);
+		glist_del(&next->req_q);
+		nfs_rpc_enqueue_req(next);
+	}
+}
+
+/**
+ * @brief Release a request held back by export QoS
+ *
+ * @param[in] arg The request
+ */
+
+static void nfs_rpc_qos_resume(void *arg)
+{
+	nfs_rpc_export_admit(arg);
+}
+
+/**
+ * @brief Apply export QoS to a decoded request
+ *
+ * A request that overdraws its export's token buckets is parked on the
+ * delayed executor instead of a worker queue, so throttled exports do
+ * not tie up worker threads while they wait.  The export found is kept
+ * on the request for nfs_rpc_export_admit().
+ *
+ * @param[in] reqdata Decoded and referenced request
+ *
+ * @retval true if the request was delayed and will be queued later.
+ */
+
+static bool nfs_rpc_qos_throttle(request_data_t *reqdata)
+{
+	struct gsh_export *export;
+	uint64_t read_bytes, write_bytes;
+	nsecs_elapsed_t delay;
+
+	export = nfs_rpc_qos_export(reqdata, &read_bytes, &write_bytes);
+	if (export == NULL)
+		return false;
+
+	delay = export_qos_charge(export, read_bytes, write_bytes);
+	reqdata->r_u.req.admit_export = export;
+
+	if (delay == 0)
+		return false;
+
+	LogFullDebug(COMPONENT_DISPATCH,
+		     "QoS delaying xid=%" PRIu32 " by %" PRIu64 " ns",
+		     reqdata->r_u.req.svc.rq_msg.rm_xid, delay);
+
+	return delayed_submit(nfs_rpc_qos_resume, reqdata, delay) == 0;
+}
+
+/**
+ * @brief Start the request's DRC transaction before it is queued
+ *
+ * A retransmission of a request already queued or executing is dropped
+ * here, and one of a request already answered gets the cached reply,
+ * so neither waits in the queue or takes a worker.  The DRC entry is
+ * then finished or deleted by the worker that runs the request.
+ *
+ * @param[in] reqdata Request with decoded arguments
+ *
+ * @retval true if it must be queued.
+ */
+
+static bool nfs_rpc_dupreq_start(request_data_t *reqdata)
+{
+	const nfs_function_desc_t *reqdesc = reqdata->r_u.req.funcdesc;
+	struct svc_req *req = &reqdata->r_u.req.svc;
+	dupreq_status_t status;
+
+	/* If req is uncacheable, or if req is v41+, nfs_dupreq_start will do
+	 * nothing but allocate a result object and mark the request (ie, the
+	 * path is short, lockless, and does no hash/search). */
+#ifdef USE_LTTNG
+	tracepoint(nfs_rpc, drc_start, reqdata, req->rq_msg.rm_xid);
+#endif
+	status = nfs_dupreq_start(&reqdata->r_u.req, req);
+#ifdef USE_LTTNG
+	tracepoint(nfs_rpc, drc_start_end, reqdata, status);
+#endif
+
+	switch (status) {
+	case DUPREQ_SUCCESS:
+		return true;
+
+	case DUPREQ_EXISTS:
+		/* Found the request in the dupreq cache.
+		 * Send cached reply. */
+		LogFullDebug(COMPONENT_DISPATCH,
+			     "DUP: DupReq Cache Hit: using previous reply, rpcxid=%"
+			     PRIu32, req->rq_msg.rm_xid);
+		req->rq_msg.RPCM_ack.ar_results.where =
+			(caddr_t) reqdata->r_u.req.res_nfs;
+		req->rq_msg.RPCM_ack.ar_results.proc =
+			reqdesc->xdr_encode_func;
+		if (svc_sendreply(req) >= XPRT_DIED)
+			LogDebug(COMPONENT_DISPATCH,
+				 "Error sending cached reply for xid=%" PRIu32
+				 " fd=%d function:%s errno: %d",
+				 req->rq_msg.rm_xid, req->rq_xprt->xp_fd,
+				 reqdesc->funcname, errno);
+		nfs_dupreq_rele(req, reqdesc);
+		break;
+
+	case DUPREQ_BEING_PROCESSED:
+		/* Another copy is queued or executing and will reply */
+		LogFullDebug(COMPONENT_DISPATCH,
+			     "DUP: Request xid=%" PRIu32
+			     " is already being processed; the active thread will reply",
+			     req->rq_msg.rm_xid);
+		(void) atomic_inc_uint64_t(&nfs_req_st.dropped.in_progress);
+		break;
+
+	case DUPREQ_INSERT_MALLOC_ERROR:
+		LogCrit(COMPONENT_DISPATCH,
+			"DUP: Cannot process request, not enough memory available!");
+		svcerr_systemerr(req);
+		break;
+
+	default:
+		LogCrit(COMPONENT_DISPATCH,
+			"DUP: Did not find the request in the duplicate request cache and couldn't add the request.");
+		svcerr_systemerr(req);
+		break;
+	}
+
+	if (!xdr_free(reqdesc->xdr_decode_func,
+		      (caddr_t) &reqdata->r_u.req.arg_nfs))
+		LogCrit(COMPONENT_DISPATCH,
+			"%s FAILURE: Bad xdr_free for %s",
+			__func__, reqdesc->funcname);
+	return false;
+}
+
+/**
+ * @brief Unwrap and decode the arguments of an authenticated request
+ *
+ * For RPCSEC_GSS integrity and privacy this is where the checksum is
+ * verified or the body decrypted.  On success the request is queued
+ * for a worker.
+ *
+ * @param[in] reqdata Authenticated request
+ *
+ * @retval false if the arguments could not be decoded.
+ */
+
+static bool nfs_rpc_decode_args(request_data_t *reqdata)
 {
 	const nfs_function_desc_t *reqdesc = reqdata->r_u.req.funcdesc;
 	nfs_arg_t *arg_nfs = &reqdata->r_u.req.arg_nfs;
 	SVCXPRT *xprt = reqdata->r_u.req.svc.rq_xprt;
 	XDR *xdrs = reqdata->r_u.req.svc.rq_xdrs;
+
+	/*
+	 * Extract RPC argument.
+	 */
+	LogFullDebug(COMPONENT_DISPATCH,
+		     "Before SVCAUTH_CHECKSUM on SVCXPRT %p fd %d",
+		     xprt, xprt->xp_fd);
+
+	memset(arg_nfs, 0, sizeof(nfs_arg_t));
+	reqdata->r_u.req.svc.rq_msg.rm_xdr.where = (caddr_t) arg_nfs;
+	reqdata->r_u.req.svc.rq_msg.rm_xdr.proc = reqdesc->xdr_decode_func;
+	xdrs->x_public = &reqdata->r_u.req.lookahead;
+
+	if (!SVCAUTH_CHECKSUM(&reqdata->r_u.req.svc)) {
+		LogInfo(COMPONENT_DISPATCH,
+			"SVCAUTH_CHECKSUM failed for Program %" PRIu32
+			", Version %" PRIu32
+			", Function %" PRIu32
+			", xid=%" PRIu32
+			", SVCXPRT=%p, fd=%d",
+			reqdata->r_u.req.svc.rq_msg.cb_prog,
+			reqdata->r_u.req.svc.rq_msg.cb_vers,
+			reqdata->r_u.req.svc.rq_msg.cb_proc,
+			reqdata->r_u.req.svc.rq_msg.rm_xid,
+			xprt, xprt->xp_fd);
+
+		if (!xdr_free(reqdesc->xdr_decode_func, (caddr_t) arg_nfs)) {
+			LogCrit(COMPONENT_DISPATCH,
+				"%s FAILURE: Bad xdr_free for %s",
+				__func__,
+				reqdesc->funcname);
+		}
+		return false;
+	}
+
+
+	req_phase_end(reqdata, REQ_PHASE_DECODE);
+
+	if (!nfs_rpc_dupreq_start(reqdata))
+		return true;
+
+	atomic_inc_uint32_t(&reqdata->r_d_refs);
+	if (!nfs_rpc_qos_throttle(reqdata))
+		nfs_rpc_export_admit(reqdata);
+	return true;
+}
+
+#ifdef _HAVE_GSSAPI
+/**
+ * @brief Unwrap a request on the GSS unwrap pool
+ *
+ * @param[in] ctx Thread context, arg is the request
+ */
+
+static void nfs_rpc_gss_unwrap(struct fridgethr_context *ctx)
+{
+	request_data_t *reqdata = ctx->arg;
+
+	if (!nfs_rpc_decode_args(reqdata))
+		svcerr_decode(&reqdata->r_u.req.svc);
+	free_nfs_request(reqdata);
+}
+
+/**
+ * @brief Hand a krb5i/krb5p request's unwrap to its own pool
+ *
+ * Requests on one connection are decoded one at a time, so inline the
+ * checksum or decryption of every large WRITE runs back to back on a
+ * single core.  With RPC_GSS_Unwrap_Threads set, the unwraps of several
+ * requests run in parallel while the connection moves on to the next
+ * record.  Reply wrapping already runs on the workers.
+ *
+ * @param[in] reqdata Authenticated request
+ *
+ * @retval true if the pool owns the rest of decoding.
+ */
+
+static bool nfs_rpc_gss_offload(request_data_t *reqdata)
+{
+	struct svc_req *req = &reqdata->r_u.req.svc;
+	struct rpc_gss_cred *gc;
+
+	if (gss_unwrap_fridge == NULL ||
+	    req->rq_msg.RPCM_ack.ar_verf.oa_flavor != RPCSEC_GSS)
+		return false;
+
+	gc = (struct rpc_gss_cred *) req->rq_msg.rq_cred_body;
+	if (gc->gc_svc == RPCSEC_GSS_SVC_NONE)
+		return false;
+
+	/* the pool's reference, the caller keeps its own */
+	atomic_inc_uint32_t(&reqdata->r_d_refs);
+	if (fridgethr_submit(gss_unwrap_fridge, nfs_rpc_gss_unwrap,
+			     reqdata) != 0) {
+		atomic_dec_uint32_t(&reqdata->r_d_refs);
+		return false;
+	}
+	return true;
+}
+#endif
+
+enum xprt_stat nfs_rpc_process_request(request_data_t *reqdata)
+{
+	SVCXPRT *xprt = reqdata->r_u.req.svc.rq_xprt;
 	enum auth_stat why;
 	bool no_dispatch = false;
 
@@ -1810,6 +3561,16 @@ enum xprt_stat nfs_rpc_process_request(request_data_t *reqdata)
 	 * GSSAPI. It should not be processed by the worker and SVC_STAT
 	 * should be returned to the dispatcher.
 	 */
+#ifdef USE_RPC_TLS
+	if (reqdata->r_u.req.svc.rq_msg.cb_cred.oa_flavor == AUTH_TLS)
+		return nfs_rpc_tls_starttls(&reqdata->r_u.req.svc);
+	if (nfs_rpc_tls_refused(&reqdata->r_u.req.svc)) {
+		LogInfo(COMPONENT_DISPATCH,
+			"Rejecting request on fd %d without TLS",
+			xprt->xp_fd);
+		return svcerr_auth(&reqdata->r_u.req.svc, AUTH_TOOWEAK);
+	}
+#endif
 	why = svc_auth_authenticate(&reqdata->r_u.req.svc, &no_dispatch);
 	if (why != AUTH_OK) {
 		LogInfo(COMPONENT_DISPATCH,
@@ -1832,41 +3593,16 @@ enum xprt_stat nfs_rpc_process_request(request_data_t *reqdata)
 #endif
 	}
 
-	/*
-	 * Extract RPC argument.
-	 */
-	LogFullDebug(COMPONENT_DISPATCH,
-		     "Before SVCAUTH_CHECKSUM on SVCXPRT %p fd %d",
-		     xprt, xprt->xp_fd);
-
-	memset(arg_nfs, 0, sizeof(nfs_arg_t));
-	reqdata->r_u.req.svc.rq_msg.rm_xdr.where = (caddr_t) arg_nfs;
-	reqdata->r_u.req.svc.rq_msg.rm_xdr.proc = reqdesc->xdr_decode_func;
-	xdrs->x_public = &reqdata->r_u.req.lookahead;
-
-	if (!SVCAUTH_CHECKSUM(&reqdata->r_u.req.svc)) {
-		LogInfo(COMPONENT_DISPATCH,
-			"SVCAUTH_CHECKSUM failed for Program %" PRIu32
-			", Version %" PRIu32
-			", Function %" PRIu32
-			", xid=%" PRIu32
-			", SVCXPRT=%p, fd=%d",
-			reqdata->r_u.req.svc.rq_msg.cb_prog,
-			reqdata->r_u.req.svc.rq_msg.cb_vers,
-			reqdata->r_u.req.svc.rq_msg.cb_proc,
-			reqdata->r_u.req.svc.rq_msg.rm_xid,
-			xprt, xprt->xp_fd);
+#ifdef _HAVE_GSSAPI
+	if (nfs_rpc_gss_offload(reqdata)) {
+		nfs_rpc_admission_hold(xprt);
+		return SVC_STAT(xprt);
+	}
+#endif
 
-		if (!xdr_free(reqdesc->xdr_decode_func, (caddr_t) arg_nfs)) {
-			LogCrit(COMPONENT_DISPATCH,
-				"%s FAILURE: Bad xdr_free for %s",
-				__func__,
-				reqdesc->funcname);
-		}
+	if (!nfs_rpc_decode_args(reqdata))
 		return svcerr_decode(&reqdata->r_u.req.svc);
-	}
 
-	atomic_inc_uint32_t(&reqdata->r_d_refs);
-	nfs_rpc_enqueue_req(reqdata);
+	nfs_rpc_admission_hold(xprt);
 	return SVC_STAT(xprt);
 }
@@ -0,0 +1,299 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file  nfs_rpc_tls.c
+ * @brief RPC-with-TLS (RFC 9289) on TCP connections
+ *
+ * A client asks for TLS with a NULL call carrying AUTH_TLS
+ * credentials.  We answer it with the "STARTTLS" verifier and, still on
+ * the event thread that decoded the probe so nothing else reads the
+ * socket, run a TLS 1.3 handshake with OpenSSL.  OpenSSL then installs
+ * the session keys in the kernel (kTLS) for both directions and we drop
+ * the SSL object without sending anything.  From there TI-RPC keeps
+ * reading and writing plain records and the kernel, or a NIC with TLS
+ * offload, does the encryption, so replies take the same zero-copy path
+ * as on a clear connection.
+ *
+ * Records that are not application data (alerts, a KeyUpdate) come up
+ * as a read error and the connection is dropped; clients reconnect and
+ * start over.
+ */
+
+#include "config.h"
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "log.h"
+#include "gsh_rpc.h"
+#include "abstract_atomic.h"
+#include "common_utils.h"
+#include "nfs23.h"
+#include "nfs_core.h"
+
+/** Milliseconds a client gets to finish its handshake */
+#define NFS_RPC_TLS_HANDSHAKE_MS 10000
+
+/** ALPN protocol id, RFC 9289 section 7.2 */
+static const unsigned char tls_alpn[] = "\x06sunrpc";
+
+static char tls_starttls[] = "STARTTLS";
+
+static SSL_CTX *tls_ctx;
+
+static void tls_log_error(const char *what)
+{
+	char buf[256];
+
+	ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+	LogCrit(COMPONENT_DISPATCH, "%s: %s", what, buf);
+	ERR_clear_error();
+}
+
+static int tls_alpn_select(SSL *ssl, const unsigned char **out,
+			   unsigned char *outlen, const unsigned char *in,
+			   unsigned int inlen, void *arg)
+{
+	if (SSL_select_next_proto((unsigned char **)out, outlen,
+				  tls_alpn, sizeof(tls_alpn) - 1,
+				  in, inlen) != OPENSSL_NPN_NEGOTIATED)
+		return SSL_TLSEXT_ERR_ALERT_FATAL;
+
+	return SSL_TLSEXT_ERR_OK;
+}
+
+/**
+ * @brief Set up the TLS context from the RPC_TLS options
+ *
+ * @retval true if TLS is off or ready.
+ */
+
+bool nfs_rpc_tls_init(void)
+{
+	const struct nfs_core_param *cp = &nfs_param.core_param;
+
+	if (!cp->rpc.tls.enable) {
+		if (cp->rpc.tls.required)
+			LogWarn(COMPONENT_INIT,
+				"RPC_TLS_Required without RPC_TLS refuses every request but NULL");
+		return true;
+	}
+
+	if (cp->rpc.tls.certificate == NULL ||
+	    cp->rpc.tls.private_key == NULL) {
+		LogCrit(COMPONENT_INIT,
+			"RPC_TLS needs RPC_TLS_Certificate and RPC_TLS_Private_Key");
+		return false;
+	}
+
+	tls_ctx = SSL_CTX_new(TLS_server_method());
+	if (tls_ctx == NULL) {
+		tls_log_error("SSL_CTX_new");
+		return false;
+	}
+
+	/* RFC 9289 requires TLS 1.3.  Session tickets would be written
+	 * after the handshake, so none are issued; clients do full
+	 * handshakes, which are rare on long lived NFS connections.
+	 */
+	SSL_CTX_set_min_proto_version(tls_ctx, TLS1_3_VERSION);
+	SSL_CTX_set_options(tls_ctx, SSL_OP_ENABLE_KTLS);
+	SSL_CTX_set_num_tickets(tls_ctx, 0);
+	SSL_CTX_set_alpn_select_cb(tls_ctx, tls_alpn_select, NULL);
+
+	if (SSL_CTX_use_certificate_chain_file(tls_ctx,
+					       cp->rpc.tls.certificate) != 1) {
+		tls_log_error(cp->rpc.tls.certificate);
+		goto fail;
+	}
+
+	if (SSL_CTX_use_PrivateKey_file(tls_ctx, cp->rpc.tls.private_key,
+					SSL_FILETYPE_PEM) != 1 ||
+	    SSL_CTX_check_private_key(tls_ctx) != 1) {
+		tls_log_error(cp->rpc.tls.private_key);
+		goto fail;
+	}
+
+	if (cp->rpc.tls.ca_file != NULL) {
+		if (SSL_CTX_load_verify_locations(tls_ctx, cp->rpc.tls.ca_file,
+						  NULL) != 1) {
+			tls_log_error(cp->rpc.tls.ca_file);
+			goto fail;
+		}
+		SSL_CTX_set_verify(tls_ctx,
+				   SSL_VERIFY_PEER |
+				   SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
+				   NULL);
+	}
+
+	LogEvent(COMPONENT_INIT, "RPC-with-TLS enabled%s",
+		 cp->rpc.tls.required ? " and required" : "");
+	return true;
+
+fail:
+	SSL_CTX_free(tls_ctx);
+	tls_ctx = NULL;
+	return false;
+}
+
+/**
+ * @brief Run the server side of a handshake and hand it to the kernel
+ *
+ * @param[in] fd Connection socket, possibly non-blocking
+ *
+ * @retval true if both directions are now in kernel TLS.
+ */
+
+static bool tls_handshake(int fd)
+{
+	struct timespec start, cur;
+	struct pollfd pfd = { .fd = fd };
+	nsecs_elapsed_t spent;
+	SSL *ssl;
+	bool ok = false;
+	char err[256];
+	int rc;
+
+	ssl = SSL_new(tls_ctx);
+	if (ssl == NULL || SSL_set_fd(ssl, fd) != 1) {
+		tls_log_error("SSL_new");
+		goto out;
+	}
+
+	now(&start);
+	while ((rc = SSL_accept(ssl)) != 1) {
+		switch (SSL_get_error(ssl, rc)) {
+		case SSL_ERROR_WANT_READ:
+			pfd.events = POLLIN;
+			break;
+		case SSL_ERROR_WANT_WRITE:
+			pfd.events = POLLOUT;
+			break;
+		default:
+			ERR_error_string_n(ERR_get_error(), err, sizeof(err));
+			LogInfo(COMPONENT_DISPATCH,
+				"TLS handshake on fd %d failed: %s", fd, err);
+			ERR_clear_error();
+			goto out;
+		}
+
+		now(&cur);
+		spent = timespec_diff(&start, &cur) / NS_PER_MSEC;
+		if (spent >= NFS_RPC_TLS_HANDSHAKE_MS ||
+		    poll(&pfd, 1, NFS_RPC_TLS_HANDSHAKE_MS - spent) <= 0) {
+			LogInfo(COMPONENT_DISPATCH,
+				"TLS handshake on fd %d timed out", fd);
+			goto out;
+		}
+	}
+
+	/* TI-RPC only does plain socket I/O, so the kernel must own the
+	 * records both ways or the connection is useless.
+	 */
+	if (!BIO_get_ktls_send(SSL_get_wbio(ssl)) ||
+	    !BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+		LogWarn(COMPONENT_DISPATCH,
+			"Kernel TLS unavailable for fd %d (%s), is the tls module loaded?",
+			fd, SSL_get_cipher_name(ssl));
+		goto out;
+	}
+
+	LogDebug(COMPONENT_DISPATCH, "fd %d moved to kernel TLS with %s",
+		 fd, SSL_get_cipher_name(ssl));
+	ok = true;
+
+out:
+	/* Freeing without SSL_shutdown() sends nothing on the socket */
+	SSL_free(ssl);
+	return ok;
+}
+
+/**
+ * @brief Answer an AUTH_TLS probe and start TLS on its connection
+ *
+ * Called from nfs_rpc_process_request() on the decoder thread for any
+ * call with AUTH_TLS credentials.
+ *
+ * @param[in] req The probe
+ *
+ * @return Transport status.
+ */
+
+enum xprt_stat nfs_rpc_tls_starttls(struct svc_req *req)
+{
+	SVCXPRT *xprt = req->rq_xprt;
+	gsh_xprt_private_t *xu = xprt->xp_u1;
+	bool no_dispatch = false;
+	enum auth_stat why;
+
+	if (tls_ctx == NULL || xprt->xp_type != XPRT_TCP || xu == NULL ||
+	    req->rq_msg.cb_proc != NFSPROC_NULL ||
+	    atomic_fetch_uint16_t(&xu->flags) & XPRT_PRIVATE_FLAG_TLS)
+		return svcerr_auth(req, AUTH_REJECTEDCRED);
+
+	/* The probe is answered like an AUTH_NONE NULL call, with the
+	 * verifier body set to "STARTTLS".
+	 */
+	req->rq_msg.cb_cred.oa_flavor = AUTH_NONE;
+	req->rq_msg.cb_cred.oa_length = 0;
+	why = svc_auth_authenticate(req, &no_dispatch);
+	if (why != AUTH_OK)
+		return svcerr_auth(req, why);
+
+	req->rq_msg.RPCM_ack.ar_verf.oa_flavor = AUTH_NONE;
+	req->rq_msg.RPCM_ack.ar_verf.oa_base = tls_starttls;
+	req->rq_msg.RPCM_ack.ar_verf.oa_length = sizeof(tls_starttls) - 1;
+	req->rq_msg.RPCM_ack.ar_results.where = NULL;
+	req->rq_msg.RPCM_ack.ar_results.proc = (xdrproc_t) xdr_void;
+
+	if (svc_sendreply(req) >= XPRT_DIED)
+		return SVC_STAT(xprt);
+
+	if (!tls_handshake(xprt->xp_fd)) {
+		SVC_DESTROY(xprt);
+		return SVC_STAT(xprt);
+	}
+
+	atomic_set_uint16_t_bits(&xu->flags, XPRT_PRIVATE_FLAG_TLS);
+	return SVC_STAT(xprt);
+}
+
+/**
+ * @brief Check a call against RPC_TLS_Required
+ *
+ * @param[in] req The call
+ *
+ * @retval true if it must be refused.
+ */
+
+bool nfs_rpc_tls_refused(struct svc_req *req)
+{
+	gsh_xprt_private_t *xu = req->rq_xprt->xp_u1;
+
+	if (!nfs_param.core_param.rpc.tls.required ||
+	    req->rq_msg.cb_proc == NFSPROC_NULL)
+		return false;
+
+	return xu == NULL ||
+	       !(atomic_fetch_uint16_t(&xu->flags) & XPRT_PRIVATE_FLAG_TLS);
+}
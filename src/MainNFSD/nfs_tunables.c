@@ -0,0 +1,184 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file  nfs_tunables.c
+ * @brief Changing performance parameters on a running server
+ *
+ * A few NFS_Core_Param and CacheInode parameters can change without a
+ * restart, either one at a time with the admin "set_tunable" D-Bus
+ * method or all together when SIGHUP rereads the config file.  The new
+ * value is stored in nfs_param or mdcache_param, then the subsystem
+ * that uses it is told.  Everything else in the file still needs a
+ * restart.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include "log.h"
+#include "nfs_core.h"
+#include "nfs_dupreq.h"
+#include "config_parsing.h"
+#include "mdcache.h"
+
+static int tunable_workers(void)
+{
+	return worker_resize(nfs_param.core_param.nb_worker);
+}
+
+/** NFS_Core_Param parameters that may change while running */
+static struct nfs_tunable {
+	const char *name;
+	int (*apply)(void);	/*< Called once the new value is stored */
+} core_tunables[] = {
+	{ "Nb_Worker", tunable_workers },
+	/* Only recorded, nothing reads them after startup */
+	{ "Dispatch_Max_Reqs", NULL },
+	{ "Dispatch_Max_Reqs_Xprt", NULL },
+	{ "DRC_TCP_Size", dupreq2_retune },
+	{ "DRC_TCP_Hiwat", dupreq2_retune },
+	{ "DRC_UDP_Size", dupreq2_retune },
+	{ "DRC_UDP_Hiwat", dupreq2_retune },
+	{ "DRC_Max_Bytes", dupreq2_retune },
+	{ "DRC_Client_Max_Bytes", dupreq2_retune },
+	{ NULL, NULL }
+};
+
+/** Serializes changes so a failed apply can put the old value back */
+static pthread_mutex_t tunables_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static int set_core_tunable(struct nfs_tunable *t, uint64_t value)
+{
+	uint64_t old;
+	int rc;
+
+	(void) config_get_uint_param(&nfs_core, &nfs_param.core_param,
+				     t->name, &old);
+	if (old == value)
+		return 0;
+
+	rc = config_set_uint_param(&nfs_core, &nfs_param.core_param,
+				   t->name, value);
+	if (rc != 0)
+		return rc;
+
+	if (t->apply != NULL) {
+		rc = t->apply();
+		if (rc != 0) {
+			(void) config_set_uint_param(&nfs_core,
+						     &nfs_param.core_param,
+						     t->name, old);
+			(void) t->apply();
+			return rc;
+		}
+	}
+
+	LogEvent(COMPONENT_CONFIG, "NFS_Core_Param %s %" PRIu64 " -> %" PRIu64,
+		 t->name, old, value);
+	return 0;
+}
+
+/**
+ * @brief Change one parameter on a running server
+ *
+ * @param[in] name  Parameter name as in the config file
+ * @param[in] value New value
+ *
+ * @retval 0 on success.
+ * @retval ENOENT if it is not a parameter that can change at runtime.
+ * @retval ERANGE if the value is out of range.
+ * @retval Other codes from the subsystem refusing the value.
+ */
+
+int nfs_set_tunable(const char *name, uint64_t value)
+{
+	struct nfs_tunable *t;
+	int rc;
+
+	PTHREAD_MUTEX_lock(&tunables_mtx);
+
+	for (t = core_tunables; t->name != NULL; t++) {
+		if (strcasecmp(t->name, name) == 0)
+			break;
+	}
+
+	if (t->name != NULL)
+		rc = set_core_tunable(t, value);
+	else
+		rc = mdcache_set_tunable(name, value);
+
+	PTHREAD_MUTEX_unlock(&tunables_mtx);
+
+	return rc;
+}
+
+/**
+ * @brief Apply the runtime parameters of a reread config file
+ *
+ * @param[in]     config   Parsed config file
+ * @param[in,out] err_type Error reporting state
+ *
+ * @return -1 if a block failed to parse, else 0.
+ */
+
+int reread_tunables(config_file_t config, struct config_error_type *err_type)
+{
+	struct nfs_core_param *fresh = gsh_calloc(1, sizeof(*fresh));
+	struct nfs_tunable *t;
+	uint64_t value;
+	int rc, status = 0;
+
+	(void) load_config_from_parse(config, &nfs_core, fresh, true,
+				      err_type);
+
+	PTHREAD_MUTEX_lock(&tunables_mtx);
+
+	if (config_error_is_harmless(err_type)) {
+		for (t = core_tunables; t->name != NULL; t++) {
+			(void) config_get_uint_param(&nfs_core, fresh, t->name,
+						     &value);
+			rc = set_core_tunable(t, value);
+			if (rc != 0)
+				LogWarn(COMPONENT_CONFIG,
+					"NFS_Core_Param %s not changed: %s",
+					t->name, strerror(rc));
+		}
+	} else {
+		status = -1;
+	}
+
+	if (mdcache_reread_tunables(config, err_type) < 0)
+		status = -1;
+
+	PTHREAD_MUTEX_unlock(&tunables_mtx);
+
+	gsh_free(fresh->rpc.tls.certificate);
+	gsh_free(fresh->rpc.tls.private_key);
+	gsh_free(fresh->rpc.tls.ca_file);
+	gsh_free(fresh->ganesha_modules_loc);
+	gsh_free(fresh->nsm_cache_file);
+	gsh_free(fresh);
+
+	return status;
+}
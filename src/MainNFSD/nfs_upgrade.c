@@ -0,0 +1,535 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file  nfs_upgrade.c
+ * @brief Hand the RPC listeners over to a freshly exec'd server
+ *
+ * An upgrade forks and execs the server binary, by the path it was
+ * started from, with the same command line.  One end of a socketpair is
+ * passed in GANESHA_UPGRADE_FD.  The old process sends its bound udp and
+ * tcp listeners across with SCM_RIGHTS; the new one adopts them instead
+ * of creating and binding its own (see Allocate_sockets()), so the
+ * ports never stop accepting.  Once it is serving it writes a single
+ * byte back, and the old process shuts down as usual, except for the
+ * steps that would undo its successor's setup: rpcbind unregistration,
+ * removing the pid file and cleaning the recovery directory.
+ *
+ * Established connections and client state are not handed over.  The
+ * new server starts in grace and clients reclaim from the records the
+ * recovery backend already keeps.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "log.h"
+#include "abstract_mem.h"
+#include "fridgethr.h"
+#include "nfs_core.h"
+#ifdef USE_DBUS
+#include "gsh_dbus.h"
+#endif
+
+#define NFS_UPGRADE_ENV "GANESHA_UPGRADE_FD"
+
+/** Seconds the new server gets to come up before we give up on it */
+#define NFS_UPGRADE_TIMEOUT 300
+
+#define NFS_UPGRADE_MAGIC 0x47534855	/* "GSHU" */
+#define NFS_UPGRADE_READY 'R'
+
+extern char **environ;
+
+/**
+ * @brief Header sent along with the listeners
+ */
+struct upgrade_msg {
+	uint32_t magic;
+	uint32_t count;		/*< Number of descriptors attached */
+};
+
+/** Set in the old process once its successor is serving */
+bool nfs_upgrading;
+
+static pthread_mutex_t upgrade_mtx = PTHREAD_MUTEX_INITIALIZER;
+static bool upgrade_busy;
+
+static char **upgrade_argv;
+static char upgrade_exe[PATH_MAX];
+
+/* The process we are replacing, in the new server */
+static int upgrade_from = -1;
+
+/* Our successor, in the old server */
+static int upgrade_to = -1;
+static pid_t upgrade_pid;
+
+/* Pid file descriptor, when we had to take the lock back */
+static int upgrade_pidfile = -1;
+
+/**
+ * @brief Remember how we were started, and whether it was by an upgrade
+ *
+ * Called before daemonizing.  The binary path is resolved now, so that
+ * a later upgrade executes whatever has been installed at that path
+ * rather than the deleted image we may be running from.
+ *
+ * @param[in] argv Command line, kept for the successor
+ *
+ * @return true if this process is taking over from a running server.
+ */
+
+bool nfs_upgrade_init(char **argv)
+{
+	const char *env = getenv(NFS_UPGRADE_ENV);
+	ssize_t len;
+
+	upgrade_argv = argv;
+
+	len = readlink("/proc/self/exe", upgrade_exe, sizeof(upgrade_exe) - 1);
+	if (len > 0)
+		upgrade_exe[len] = '\0';
+
+	if (env == NULL)
+		return false;
+
+	upgrade_from = atoi(env);
+	unsetenv(NFS_UPGRADE_ENV);
+
+	if (upgrade_from < 0 || fcntl(upgrade_from, F_SETFD, FD_CLOEXEC)) {
+		upgrade_from = -1;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Receive the listeners from the process we are replacing
+ *
+ * @param[out] fds  Filled with the sockets
+ * @param[in]  max  Size of fds
+ *
+ * @return Number of sockets received, 0 if this is not an upgrade.
+ */
+
+int nfs_upgrade_recv_sockets(int *fds, int max)
+{
+	struct upgrade_msg hdr;
+	struct iovec iov = {
+		.iov_base = &hdr,
+		.iov_len = sizeof(hdr),
+	};
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * NFS_UPGRADE_MAX_FDS)];
+		struct cmsghdr align;
+	} ctl;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = ctl.buf,
+		.msg_controllen = sizeof(ctl.buf),
+	};
+	struct cmsghdr *cmsg;
+	ssize_t rc;
+	int n = 0, i, cnt;
+
+	if (upgrade_from < 0)
+		return 0;
+
+	do {
+		rc = recvmsg(upgrade_from, &msg, 0);
+	} while (rc == -1 && errno == EINTR);
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		cnt = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < cnt; i++) {
+			int fd;
+
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int),
+			       sizeof(fd));
+			if (n < max)
+				fds[n++] = fd;
+			else
+				close(fd);
+		}
+	}
+
+	if (rc != sizeof(hdr) || hdr.magic != NFS_UPGRADE_MAGIC) {
+		LogCrit(COMPONENT_INIT,
+			"Bad upgrade hand over from previous server (%zd, %s), binding fresh sockets",
+			rc, rc == -1 ? strerror(errno) : "short message");
+		for (i = 0; i < n; i++)
+			close(fds[i]);
+		return 0;
+	}
+
+	if ((msg.msg_flags & MSG_CTRUNC) || n != hdr.count)
+		LogWarn(COMPONENT_INIT,
+			"Previous server sent %"PRIu32" sockets, got %d",
+			hdr.count, n);
+
+	LogEvent(COMPONENT_INIT,
+		 "Received %d listening sockets from previous server", n);
+
+	return n;
+}
+
+/**
+ * @brief Tell the process we are replacing that we are serving
+ */
+
+void nfs_upgrade_ready(void)
+{
+	char byte = NFS_UPGRADE_READY;
+
+	if (upgrade_from < 0)
+		return;
+
+	if (write(upgrade_from, &byte, 1) != 1)
+		LogCrit(COMPONENT_INIT,
+			"Could not signal previous server: %s",
+			strerror(errno));
+	else
+		LogEvent(COMPONENT_INIT,
+			 "Signalled previous server to drain and exit");
+
+	close(upgrade_from);
+	upgrade_from = -1;
+}
+
+/**
+ * @brief Send our listeners to the new server
+ */
+
+static int upgrade_send_sockets(int sock)
+{
+	int fds[NFS_UPGRADE_MAX_FDS];
+	int nfds = nfs_rpc_listener_fds(fds, NFS_UPGRADE_MAX_FDS);
+	struct upgrade_msg hdr = {
+		.magic = NFS_UPGRADE_MAGIC,
+		.count = nfds,
+	};
+	struct iovec iov = {
+		.iov_base = &hdr,
+		.iov_len = sizeof(hdr),
+	};
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * NFS_UPGRADE_MAX_FDS)];
+		struct cmsghdr align;
+	} ctl;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	struct cmsghdr *cmsg;
+
+	if (nfds > 0) {
+		memset(&ctl, 0, sizeof(ctl));
+		msg.msg_control = ctl.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+	}
+
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(hdr))
+		return errno ? errno : EIO;
+
+	LogEvent(COMPONENT_MAIN, "Sent %d listening sockets to new server",
+		 nfds);
+	return 0;
+}
+
+/**
+ * @brief Let go of the pid file lock so our successor can take it
+ *
+ * Closing any descriptor for the file drops every lock this process
+ * holds on it, including the one taken at startup.
+ */
+
+static void upgrade_release_pidfile(void)
+{
+	int fd = open(pidfile_path, O_RDWR);
+
+	if (fd != -1)
+		close(fd);
+	if (upgrade_pidfile != -1) {
+		close(upgrade_pidfile);
+		upgrade_pidfile = -1;
+	}
+}
+
+/**
+ * @brief Take the pid file back after a failed upgrade
+ */
+
+static void upgrade_reclaim_pidfile(void)
+{
+	struct flock lk = {
+		.l_type = F_WRLCK,
+		.l_whence = SEEK_SET,
+	};
+	char linebuf[32];
+
+	upgrade_pidfile = open(pidfile_path, O_CREAT | O_RDWR, 0644);
+	if (upgrade_pidfile == -1 ||
+	    fcntl(upgrade_pidfile, F_SETLK, &lk) == -1) {
+		LogCrit(COMPONENT_MAIN, "Could not relock pid file %s: %s",
+			pidfile_path, strerror(errno));
+		return;
+	}
+
+	(void)snprintf(linebuf, sizeof(linebuf), "%u\n", getpid());
+	if (ftruncate(upgrade_pidfile, 0) == -1 ||
+	    write(upgrade_pidfile, linebuf, strlen(linebuf)) == -1)
+		LogCrit(COMPONENT_MAIN, "Couldn't write pid to file %s",
+			pidfile_path);
+}
+
+/**
+ * @brief Undo what we gave up for a successor that never came up
+ */
+
+static void upgrade_abort(void)
+{
+	upgrade_reclaim_pidfile();
+#ifdef USE_DBUS
+	(void)gsh_dbus_request_name();
+#endif
+	nfs_rpc_register_programs();
+
+	PTHREAD_MUTEX_lock(&upgrade_mtx);
+	upgrade_busy = false;
+	PTHREAD_MUTEX_unlock(&upgrade_mtx);
+}
+
+/**
+ * @brief Wait for the new server to report in, then drain
+ */
+
+static void upgrade_wait(struct fridgethr_context *ctx)
+{
+	struct pollfd pfd = {
+		.fd = upgrade_to,
+		.events = POLLIN,
+	};
+	char byte = 0;
+	int rc;
+
+	SetNameFunction("upgrade");
+
+	do {
+		rc = poll(&pfd, 1, NFS_UPGRADE_TIMEOUT * 1000);
+	} while (rc == -1 && errno == EINTR);
+
+	if (rc == 1 && read(upgrade_to, &byte, 1) == 1 &&
+	    byte == NFS_UPGRADE_READY) {
+		close(upgrade_to);
+		upgrade_to = -1;
+		LogEvent(COMPONENT_MAIN,
+			 "New server (pid %d) is serving, draining and exiting",
+			 (int)upgrade_pid);
+		nfs_upgrading = true;
+		admin_halt();
+		return;
+	}
+
+	LogCrit(COMPONENT_MAIN,
+		"New server (pid %d) %s, continuing to serve",
+		(int)upgrade_pid,
+		rc == 0 ? "did not come up in time" : "exited during startup");
+
+	close(upgrade_to);
+	upgrade_to = -1;
+	(void)kill(upgrade_pid, SIGKILL);
+	(void)waitpid(upgrade_pid, NULL, 0);
+
+	upgrade_abort();
+}
+
+/**
+ * @brief Build the successor's environment
+ *
+ * @param[in]  fd   Descriptor to pass in GANESHA_UPGRADE_FD
+ * @param[out] var  The allocated GANESHA_UPGRADE_FD entry
+ */
+
+static char **upgrade_envp(int fd, char **var)
+{
+	char **envp;
+	int n = 0, i, j = 0;
+
+	while (environ[n] != NULL)
+		n++;
+
+	envp = gsh_calloc(n + 2, sizeof(char *));
+
+	for (i = 0; i < n; i++)
+		if (strncmp(environ[i], NFS_UPGRADE_ENV "=",
+			    sizeof(NFS_UPGRADE_ENV)) != 0)
+			envp[j++] = environ[i];
+
+	*var = envp[j] = gsh_malloc(sizeof(NFS_UPGRADE_ENV) + 12);
+	(void)sprintf(*var, NFS_UPGRADE_ENV "=%d", fd);
+
+	return envp;
+}
+
+/**
+ * @brief Start a new server and hand our listeners over to it
+ *
+ * Returns once the new process has the sockets; it then initializes in
+ * parallel with this one, which keeps serving until it hears back.
+ *
+ * @param[out] errormsg Status for the caller
+ *
+ * @return true if the new server was started.
+ */
+
+bool nfs_upgrade_start(char **errormsg)
+{
+	sigset_t none;
+	char **envp, *var;
+	long maxfd = sysconf(_SC_OPEN_MAX);
+	int sv[2];
+	int fd, rc;
+
+	PTHREAD_MUTEX_lock(&upgrade_mtx);
+	if (upgrade_busy) {
+		PTHREAD_MUTEX_unlock(&upgrade_mtx);
+		*errormsg = "Upgrade already in progress";
+		return false;
+	}
+	upgrade_busy = true;
+	PTHREAD_MUTEX_unlock(&upgrade_mtx);
+
+	if (upgrade_exe[0] == '\0') {
+		*errormsg = "Server binary path unknown";
+		goto fail;
+	}
+
+	/* The 9P listener is bound late, from its dispatcher thread, and
+	 * is not handed over; the new server would die on it after we had
+	 * already started draining. */
+	if (nfs_param.core_param.core_options & CORE_OPTION_9P) {
+		*errormsg = "Upgrade is not supported with 9P enabled";
+		goto fail;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+		*errormsg = "Could not create upgrade socket";
+		goto fail;
+	}
+
+	envp = upgrade_envp(sv[1], &var);
+	sigemptyset(&none);
+
+	LogEvent(COMPONENT_MAIN, "Upgrading to %s", upgrade_exe);
+
+	/* The new server claims both at startup and fails without them */
+	upgrade_release_pidfile();
+#ifdef USE_DBUS
+	gsh_dbus_release_name();
+#endif
+
+	upgrade_pid = fork();
+	if (upgrade_pid == 0) {
+		/* Only async-signal-safe calls from here to exec */
+		for (fd = 3; fd < maxfd; fd++)
+			if (fd != sv[1])
+				close(fd);
+		(void)fcntl(sv[1], F_SETFD, 0);
+		(void)sigprocmask(SIG_SETMASK, &none, NULL);
+		execve(upgrade_exe, upgrade_argv, envp);
+		_exit(127);
+	}
+
+	close(sv[1]);
+	gsh_free(var);
+	gsh_free(envp);
+
+	if (upgrade_pid == -1) {
+		LogCrit(COMPONENT_MAIN, "Could not fork new server: %s",
+			strerror(errno));
+		close(sv[0]);
+		*errormsg = "Could not fork new server";
+		goto abort;
+	}
+
+	upgrade_to = sv[0];
+
+	rc = upgrade_send_sockets(upgrade_to);
+	if (rc != 0) {
+		LogCrit(COMPONENT_MAIN,
+			"Could not send sockets to new server: %s",
+			strerror(rc));
+		*errormsg = "Could not send sockets to new server";
+		goto kill;
+	}
+
+	rc = fridgethr_submit(general_fridge, upgrade_wait, NULL);
+	if (rc != 0) {
+		LogCrit(COMPONENT_MAIN,
+			"Could not start upgrade wait: %d", rc);
+		*errormsg = "Could not wait for new server";
+		goto kill;
+	}
+
+	*errormsg = "Upgrade started";
+	return true;
+
+ kill:
+	close(upgrade_to);
+	upgrade_to = -1;
+	(void)kill(upgrade_pid, SIGKILL);
+	(void)waitpid(upgrade_pid, NULL, 0);
+
+ abort:
+	upgrade_abort();
+	return false;
+
+ fail:
+	PTHREAD_MUTEX_lock(&upgrade_mtx);
+	upgrade_busy = false;
+	PTHREAD_MUTEX_unlock(&upgrade_mtx);
+	return false;
+}
@@ -42,6 +42,8 @@
 #include <sys/file.h>		/* for having FNDELAY */
 #include <sys/signal.h>
 #include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "hashtable.h"
 #include "abstract_atomic.h"
 #include "log.h"
@@ -60,6 +62,7 @@
 #include "export_mgr.h"
 #include "server_stats.h"
 #include "uid2grp.h"
+#include "iobuf_pool.h"
 
 #ifdef USE_LTTNG
 #include "gsh_lttng/nfs_rpc.h"
@@ -73,6 +76,9 @@ pool_t *request_pool;
 
 static struct fridgethr *worker_fridge;
 
+/** Sizes the worker pool when Worker_Autotune is set */
+static struct fridgethr *worker_tune_fridge;
+
 const nfs_function_desc_t invalid_funcdesc = {
 	.service_function = nfs_null,
 	.free_function = nfs_null_free,
@@ -671,6 +677,154 @@ const nfs_function_desc_t rquota2_func_desc[] = {
  * @param[in,out] reqdata	NFS request
  *
  */
+/**
+ * @brief Cork a TCP connection that has more replies coming
+ *
+ * With Enable_TCP_Reply_Coalescing, a reply sent while other requests
+ * from the same connection are queued or executing is held in the
+ * socket so pipelined replies share segments.  The connection is
+ * uncorked by nfs_rpc_reply_done() when the last of them finishes, and
+ * the kernel flushes a cork after 200ms regardless.
+ *
+ * @param[in] xprt Transport about to send a reply
+ */
+
+static void nfs_rpc_reply_cork(SVCXPRT *xprt)
+{
+	gsh_xprt_private_t *xu = xprt->xp_u1;
+	int one = 1;
+
+	if (!nfs_param.core_param.tcp_reply_coalesce ||
+	    xprt->xp_type != XPRT_TCP || xu == NULL ||
+	    atomic_fetch_uint32_t(&xu->inflight) < 2)
+		return;
+
+	/* We hold one of the inflight counts, so whoever drops it to zero
+	 * comes after us and will see corked set.
+	 */
+	if (atomic_postset_uint32_t_bits(&xu->corked, 1) == 0)
+		(void) setsockopt(xprt->xp_fd, IPPROTO_TCP, TCP_CORK,
+				  &one, sizeof(one));
+}
+
+/**
+ * @brief Re-size one auto-tuned socket buffer
+ *
+ * Leaves the buffer alone unless the target is more than a quarter
+ * away from its current size, to keep the setsockopt calls rare.
+ *
+ * @param[in]     fd     Connection socket
+ * @param[in]     opt    SO_SNDBUF or SO_RCVBUF
+ * @param[in]     target Wanted size, before clamping
+ * @param[in,out] cur    Current size
+ */
+
+static void nfs_rpc_tcp_resize(int fd, int opt, uint64_t target,
+			       uint32_t *cur)
+{
+	const struct nfs_core_param *nfs_cp = &nfs_param.core_param;
+	uint32_t max = MAX(nfs_cp->rpc.tcp_buf_min, nfs_cp->rpc.tcp_buf_max);
+	uint32_t size = MIN(MAX(target, nfs_cp->rpc.tcp_buf_min), max);
+	uint32_t old = atomic_fetch_uint32_t(cur);
+
+	if (size > old - old / 4 && size < old + old / 4)
+		return;
+
+	if (setsockopt(fd, SOL_SOCKET, opt, &size, sizeof(size)) == 0)
+		atomic_store_uint32_t(cur, size);
+}
+
+/**
+ * @brief Size a connection's socket buffers to its bandwidth-delay product
+ *
+ * Every NFS_TCP_AUTOTUNE_REPLIES replies, read TCP_INFO and give each
+ * buffer twice the bytes TCP wants in flight, so the buffer is never
+ * what limits the window.  For sends that is the congestion window,
+ * which TCP sizes to the throughput it measures times the RTT; for
+ * receives it is the kernel's estimate of what the peer sends per RTT.
+ *
+ * @param[in] xprt Transport a reply was just sent on
+ * @param[in] xu   Its private data
+ */
+
+#define NFS_TCP_AUTOTUNE_REPLIES 64
+
+static void nfs_rpc_tcp_autotune(SVCXPRT *xprt, gsh_xprt_private_t *xu)
+{
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+
+	if (!nfs_param.core_param.rpc.tcp_buf_autotune ||
+	    xprt->xp_type != XPRT_TCP ||
+	    atomic_inc_uint32_t(&xu->replies) % NFS_TCP_AUTOTUNE_REPLIES != 1)
+		return;
+
+	if (getsockopt(xprt->xp_fd, IPPROTO_TCP, TCP_INFO, &ti, &len) ||
+	    ti.tcpi_rtt == 0)
+		return;
+
+	nfs_rpc_tcp_resize(xprt->xp_fd, SO_SNDBUF,
+			   2ULL * ti.tcpi_snd_cwnd * ti.tcpi_snd_mss,
+			   &xu->sndbuf);
+	nfs_rpc_tcp_resize(xprt->xp_fd, SO_RCVBUF,
+			   2ULL * ti.tcpi_rcv_space, &xu->rcvbuf);
+
+	LogFullDebug(COMPONENT_DISPATCH,
+		     "fd %d rtt %"PRIu32"us cwnd %"PRIu32" mss %"PRIu32
+		     " rcv_space %"PRIu32" sndbuf %"PRIu32" rcvbuf %"PRIu32,
+		     xprt->xp_fd, ti.tcpi_rtt, ti.tcpi_snd_cwnd,
+		     ti.tcpi_snd_mss, ti.tcpi_rcv_space, xu->sndbuf,
+		     xu->rcvbuf);
+}
+
+/**
+ * @brief Account a finished request and flush coalesced replies
+ *
+ * @param[in] xprt Transport the request arrived on
+ */
+
+static void nfs_rpc_reply_done(SVCXPRT *xprt)
+{
+	gsh_xprt_private_t *xu = xprt->xp_u1;
+	int zero = 0;
+
+	if (xu == NULL)
+		return;
+
+	nfs_rpc_tcp_autotune(xprt, xu);
+
+	if (nfs_rpc_xprt_done(xprt) == 0 &&
+	    nfs_param.core_param.tcp_reply_coalesce &&
+	    atomic_postclear_uint32_t_bits(&xu->corked, 1) != 0)
+		(void) setsockopt(xprt->xp_fd, IPPROTO_TCP, TCP_CORK,
+				  &zero, sizeof(zero));
+}
+
+/**
+ * @brief Release a queued request that will not be executed
+ *
+ * Its DRC entry is still in the START state, where every retransmission
+ * would be dropped as in progress, so it is deleted first.
+ *
+ * @param[in] reqdata Request dropped by nfs_rpc_req_stale()
+ */
+
+static void nfs_rpc_drop_req(request_data_t *reqdata)
+{
+	const nfs_function_desc_t *reqdesc = reqdata->r_u.req.funcdesc;
+
+	if (reqdata->r_u.req.res_nfs != NULL) {
+		(void) nfs_dupreq_delete(&reqdata->r_u.req.svc);
+		nfs_dupreq_rele(&reqdata->r_u.req.svc, reqdesc);
+	}
+
+	if (!xdr_free(reqdesc->xdr_decode_func,
+		      (caddr_t) &reqdata->r_u.req.arg_nfs))
+		LogCrit(COMPONENT_DISPATCH,
+			"%s FAILURE: Bad xdr_free for %s",
+			__func__, reqdesc->funcname);
+}
+
 void nfs_rpc_execute(request_data_t *reqdata)
 {
 	const char *client_ip = "<unknown client>";
@@ -678,6 +832,7 @@ void nfs_rpc_execute(request_data_t *reqdata)
 	const nfs_function_desc_t *reqdesc = reqdata->r_u.req.funcdesc;
 	nfs_arg_t *arg_nfs = &reqdata->r_u.req.arg_nfs;
 	SVCXPRT *xprt = reqdata->r_u.req.svc.rq_xprt;
+	gsh_xprt_private_t *xu;
 	nfs_res_t *res_nfs;
 	struct export_perms export_perms;
 	struct user_cred user_credentials;
@@ -690,6 +845,7 @@ void nfs_rpc_execute(request_data_t *reqdata)
 	int rc = NFS_REQ_OK;
 #ifdef _USE_NFS3
 	int exportid = -1;
+	bool health_checked = false;
 #endif /* _USE_NFS3 */
 
 #ifdef USE_LTTNG
@@ -713,9 +869,10 @@ void nfs_rpc_execute(request_data_t *reqdata)
 	op_ctx->nfs_vers = reqdata->r_u.req.svc.rq_msg.cb_vers;
 	op_ctx->req_type = reqdata->rtype;
 	op_ctx->export_perms = &export_perms;
+	op_ctx->arena = &reqdata->arena;
 
 	/* Set up initial export permissions that don't allow anything. */
-	export_check_access();
+	export_check_access_xprt(xprt);
 
 	/* start the processing clock
 	 * we measure all time stats as intervals (elapsed nsecs) from
@@ -726,6 +883,7 @@ void nfs_rpc_execute(request_data_t *reqdata)
 	op_ctx->queue_wait =
 	    op_ctx->start_time - timespec_diff(&ServerBootTime,
 					       &reqdata->time_queued);
+	req_phase_end(reqdata, REQ_PHASE_QUEUE);
 
 	/* Initialized user_credentials */
 	init_credentials();
@@ -740,7 +898,14 @@ void nfs_rpc_execute(request_data_t *reqdata)
 	 * xprt private data. */
 
 	port = get_port(op_ctx->caller_addr);
-	op_ctx->client = get_gsh_client(op_ctx->caller_addr, false);
+	xu = xprt->xp_u1;
+	if (xu != NULL && xu->client != NULL) {
+		/* bound when the connection was accepted */
+		op_ctx->client = xu->client;
+		inc_gsh_client_refcount(op_ctx->client);
+	} else {
+		op_ctx->client = get_gsh_client(op_ctx->caller_addr, false);
+	}
 	if (op_ctx->client == NULL) {
 		LogDebug(COMPONENT_DISPATCH,
 			 "Cannot get client block for Program %" PRIu32
@@ -771,89 +936,10 @@ void nfs_rpc_execute(request_data_t *reqdata)
 		&reqdata->r_u.req.svc.rq_xprt->blkin.endp,
 		"rpc_execute-have-clientid");
 #endif
-	/* If req is uncacheable, or if req is v41+, nfs_dupreq_start will do
-	 * nothing but allocate a result object and mark the request (ie, the
-	 * path is short, lockless, and does no hash/search). */
-	dpq_status = nfs_dupreq_start(&reqdata->r_u.req, &reqdata->r_u.req.svc);
+	/* The DRC transaction was started when the request was decoded,
+	 * duplicates never got here.
+	 */
 	res_nfs = reqdata->r_u.req.res_nfs;
-	if (dpq_status == DUPREQ_SUCCESS) {
-		/* A new request, continue processing it. */
-		LogFullDebug(COMPONENT_DISPATCH,
-			     "Current request is not duplicate or not cacheable.");
-	} else {
-		switch (dpq_status) {
-		case DUPREQ_EXISTS:
-			/* Found the request in the dupreq cache.
-			 * Send cached reply. */
-			LogFullDebug(COMPONENT_DISPATCH,
-				     "DUP: DupReq Cache Hit: using previous reply,"
-				     " rpcxid=%" PRIu32,
-				     reqdata->r_u.req.svc.rq_msg.rm_xid);
-
-			LogFullDebug(COMPONENT_DISPATCH,
-				     "Before svc_sendreply on socket %d (dup req)",
-				     xprt->xp_fd);
-
-			reqdata->r_u.req.svc.rq_msg.RPCM_ack.ar_results.where =
-						(caddr_t) res_nfs;
-			reqdata->r_u.req.svc.rq_msg.RPCM_ack.ar_results.proc =
-						reqdesc->xdr_encode_func;
-			xprt_rc = svc_sendreply(&reqdata->r_u.req.svc);
-			if (xprt_rc >= XPRT_DIED) {
-				LogDebug(COMPONENT_DISPATCH,
-					 "NFS DISPATCHER: FAILURE: Error while calling svc_sendreply on a duplicate request."
-					 " rpcxid=%" PRIu32
-					 " socket=%d function:%s client:%s"
-					 " program:%" PRIu32
-					 " nfs version:%" PRIu32
-					 " proc:%" PRIu32
-					 " errno: %d",
-					 reqdata->r_u.req.svc.rq_msg.rm_xid,
-					 xprt->xp_fd,
-					 reqdesc->funcname,
-					 client_ip,
-					 reqdata->r_u.req.svc.rq_msg.cb_prog,
-					 reqdata->r_u.req.svc.rq_msg.cb_vers,
-					 reqdata->r_u.req.svc.rq_msg.cb_proc,
-					 errno);
-				svcerr_systemerr(&reqdata->r_u.req.svc);
-			}
-			break;
-
-			/* Another thread owns the request */
-		case DUPREQ_BEING_PROCESSED:
-			LogFullDebug(COMPONENT_DISPATCH,
-				     "DUP: Request xid=%" PRIu32
-				     " is already being processed; the active thread will reply",
-				     reqdata->r_u.req.svc.rq_msg.rm_xid);
-			/* Free the arguments */
-			/* Ignore the request, send no error */
-			break;
-
-			/* something is very wrong with
-			 * the duplicate request cache */
-		case DUPREQ_ERROR:
-			LogCrit(COMPONENT_DISPATCH,
-				"DUP: Did not find the request in the duplicate request cache and couldn't add the request.");
-			svcerr_systemerr(&reqdata->r_u.req.svc);
-			break;
-
-			/* oom */
-		case DUPREQ_INSERT_MALLOC_ERROR:
-			LogCrit(COMPONENT_DISPATCH,
-				"DUP: Cannot process request, not enough memory available!");
-			svcerr_systemerr(&reqdata->r_u.req.svc);
-			break;
-
-		default:
-			LogCrit(COMPONENT_DISPATCH,
-				"DUP: Unknown duplicate request cache status. This should never be reached!");
-			svcerr_systemerr(&reqdata->r_u.req.svc);
-			break;
-		}
-		server_stats_nfs_done(reqdata, rc, true);
-		goto freeargs;
-	}
 
 	/* Don't waste time for null or invalid ops
 	 * null op code in all valid protos == 0
@@ -1022,7 +1108,7 @@ void nfs_rpc_execute(request_data_t *reqdata)
 			    "nfs_rpc_execute about to call nfs_export_check_access for client %s",
 			    client_ip);
 
-		export_check_access();
+		export_check_access_xprt(xprt);
 
 		if ((export_perms.options & EXPORT_OPTION_ACCESS_MASK) == 0) {
 			LogInfoAlt(COMPONENT_DISPATCH, COMPONENT_EXPORT,
@@ -1201,6 +1287,31 @@ void nfs_rpc_execute(request_data_t *reqdata)
 			}
 		}
 
+#ifdef _USE_NFS3
+		/* Only NFSv3 has its export here, nfs4_Compound() asks the
+		 * health breaker for each export a compound reaches.
+		 */
+		if (op_ctx->ctx_export != NULL &&
+		    reqdata->r_u.req.svc.rq_msg.cb_prog ==
+							NFS_program[P_NFS]) {
+			if (!export_health_admit(op_ctx->ctx_export)) {
+				LogDebugAlt(COMPONENT_DISPATCH,
+					    COMPONENT_EXPORT,
+					    "Returning NFS3ERR_JUKEBOX because the backend of Export_Id %d is unhealthy",
+					    op_ctx->ctx_export->export_id);
+				if (nfs_param.core_param.drop_delay_errors) {
+					rc = NFS_REQ_DROP;
+				} else {
+					res_nfs->res_getattr3.status =
+								NFS3ERR_JUKEBOX;
+					rc = NFS_REQ_OK;
+				}
+				goto req_error;
+			}
+			health_checked = true;
+		}
+#endif /* _USE_NFS3 */
+
 		/* processing
 		 * At this point, op_ctx->ctx_export has one of the following
 		 * conditions:
@@ -1254,6 +1365,7 @@ void nfs_rpc_execute(request_data_t *reqdata)
 			(op_ctx->ctx_export != NULL)
 			? op_ctx->ctx_export->export_id : -1);
 #endif
+		req_inflight_begin(reqdata);
 		rc = reqdesc->service_function(arg_nfs, &reqdata->r_u.req.svc,
 					res_nfs);
 
@@ -1273,6 +1385,19 @@ void nfs_rpc_execute(request_data_t *reqdata)
  req_error:
 #endif /* _USE_NFS3 */
 
+	req_phase_end(reqdata, REQ_PHASE_EXECUTE);
+	req_phase_fsal(reqdata, op_ctx->fsal_time);
+
+#ifdef _USE_NFS3
+	/* All NFSv3 results start with the status */
+	if (health_checked)
+		export_health_done(op_ctx->ctx_export, op_ctx->fsal_time,
+				   rc == NFS_REQ_DROP ||
+				   res_nfs->res_getattr3.status == NFS3ERR_IO ||
+				   res_nfs->res_getattr3.status ==
+							NFS3ERR_SERVERFAULT);
+#endif /* _USE_NFS3 */
+
 /* NFSv4 stats are handled in nfs4_compound()
  */
 	if (reqdata->r_u.req.svc.rq_msg.cb_prog != NFS_program[P_NFS]
@@ -1311,6 +1436,8 @@ void nfs_rpc_execute(request_data_t *reqdata)
 					(caddr_t) res_nfs;
 		reqdata->r_u.req.svc.rq_msg.RPCM_ack.ar_results.proc =
 					reqdesc->xdr_encode_func;
+		req_inflight_phase(REQ_PHASE_REPLY);
+		nfs_rpc_reply_cork(xprt);
 		xprt_rc = svc_sendreply(&reqdata->r_u.req.svc);
 		if (xprt_rc >= XPRT_DIED) {
 			LogDebug(COMPONENT_DISPATCH,
@@ -1336,11 +1463,30 @@ void nfs_rpc_execute(request_data_t *reqdata)
 		LogFullDebug(COMPONENT_DISPATCH,
 			     "After svc_sendreply on socket %d", xprt->xp_fd);
 
+		req_phase_end(reqdata, REQ_PHASE_REPLY);
+		server_stats_phases_done(reqdata);
+#ifdef USE_LTTNG
+		tracepoint(nfs_rpc, phases, reqdata,
+			   reqdata->phase[REQ_PHASE_DECODE],
+			   reqdata->phase[REQ_PHASE_QUEUE],
+			   reqdata->phase[REQ_PHASE_EXECUTE],
+			   reqdata->phase[REQ_PHASE_FSAL],
+			   reqdata->phase[REQ_PHASE_REPLY]);
+#endif
 	}			/* rc == NFS_REQ_DROP */
 
-	/* Finish any request not already deleted */
-	if (dpq_status == DUPREQ_SUCCESS)
-		dpq_status = nfs_dupreq_finish(&reqdata->r_u.req.svc, res_nfs);
+	/* Finish the request, it was not deleted */
+#ifdef USE_LTTNG
+	tracepoint(nfs_rpc, drc_finish, reqdata);
+#endif
+	dpq_status = nfs_dupreq_finish(&reqdata->r_u.req.svc, res_nfs);
+#ifdef USE_LTTNG
+	tracepoint(nfs_rpc, drc_finish_end, reqdata, dpq_status);
+#endif
+	if (dpq_status != DUPREQ_SUCCESS)
+		LogDebug(COMPONENT_DISPATCH,
+			 "DUP: Could not finish xid=%" PRIu32 " in the DRC",
+			 reqdata->r_u.req.svc.rq_msg.rm_xid);
 	goto freeargs;
 
 	/* Reject the request for authentication reason (incompatible
@@ -1420,6 +1566,7 @@ static void _9p_execute(request_data_t *reqdata)
 	op_ctx->caller_addr = (sockaddr_t *)&reqdata->r_u._9p.pconn->addrpeer;
 	op_ctx->req_type = reqdata->rtype;
 	op_ctx->export_perms = &export_perms;
+	req_phase_end(reqdata, REQ_PHASE_QUEUE);
 
 	if (req9p->pconn->trans_type == _9P_TCP)
 		_9p_tcp_process_request(req9p);
@@ -1428,6 +1575,18 @@ static void _9p_execute(request_data_t *reqdata)
 		_9p_rdma_process_request(req9p);
 #endif
 	op_ctx = NULL;
+
+	/* The interpreter is done with the op context but it is still ours */
+	req_phase_fsal(reqdata, req_ctx.fsal_time);
+	server_stats_phases_done(reqdata);
+#ifdef USE_LTTNG
+	tracepoint(nfs_rpc, phases, reqdata,
+		   reqdata->phase[REQ_PHASE_DECODE],
+		   reqdata->phase[REQ_PHASE_QUEUE],
+		   reqdata->phase[REQ_PHASE_EXECUTE],
+		   reqdata->phase[REQ_PHASE_FSAL],
+		   reqdata->phase[REQ_PHASE_REPLY]);
+#endif
 }				/* _9p_execute */
 
 /**
@@ -1439,8 +1598,13 @@ static void _9p_execute(request_data_t *reqdata)
  */
 static void _9p_free_reqdata(struct _9p_request_data *req9p)
 {
-	if (req9p->pconn->trans_type == _9P_TCP)
-		gsh_free(req9p->_9pmsg);
+	if (req9p->pconn->trans_type == _9P_TCP) {
+		iobuf_put(req9p->_9pmsg);
+
+		/* the last one out tears the connection down */
+		_9p_tcp_conn_put(req9p->pconn);
+		return;
+	}
 
 	/* decrease connection refcount */
 	(void) atomic_dec_uint32_t(&req9p->pconn->refcount);
@@ -1466,6 +1630,8 @@ static void worker_thread_initializer(struct fridgethr_context *ctx)
 
 	/* Initalize thr waitq */
 	init_wait_q_entry(&wd->wqe);
+
+	req_inflight_register(wd->worker_index);
 }
 
 /**
@@ -1476,6 +1642,8 @@ static void worker_thread_initializer(struct fridgethr_context *ctx)
 
 static void worker_thread_finalizer(struct fridgethr_context *ctx)
 {
+	req_inflight_unregister();
+	req_arena_thread_cleanup();
 	ctx->thread_info = NULL;
 }
 
@@ -1512,12 +1680,11 @@ static void worker_run(struct fridgethr_context *ctx)
 				"Unexpected unknown request");
 			break;
 		case NFS_REQUEST:
-			/* check for destroyed xprts */
-			if (reqdata->r_u.req.svc.rq_xprt->
-			    xp_flags & SVC_XPRT_FLAG_DESTROYED) {
-				/* Idempotent: once set, the DESTROYED flag
-				 * is never cleared. No lock needed.
-				 */
+			/* check for destroyed xprts and expired requests */
+			if (nfs_rpc_req_stale(reqdata)) {
+				nfs_rpc_drop_req(reqdata);
+				nfs_rpc_reply_done(
+					reqdata->r_u.req.svc.rq_xprt);
 				goto finalize_req;
 			}
 
@@ -1526,6 +1693,13 @@ static void worker_run(struct fridgethr_context *ctx)
 				 reqdata,
 				 reqdata->r_u.req.svc.rq_xprt);
 			nfs_rpc_execute(reqdata);
+			req_inflight_end(reqdata);
+			nfs_rpc_reply_done(reqdata->r_u.req.svc.rq_xprt);
+			/* Nothing in the arena outlives the reply, return it
+			 * to this worker's slab cache now rather than on
+			 * whichever thread drops the last reference.
+			 */
+			req_arena_release(&reqdata->arena);
 			break;
 
 		case NFS_CALL:
@@ -1547,6 +1721,7 @@ static void worker_run(struct fridgethr_context *ctx)
 
 		switch (reqdata->rtype) {
 		case NFS_REQUEST:
+			nfs_rpc_export_release(reqdata);
 			break;
 		case NFS_CALL:
 			break;
@@ -1567,6 +1742,122 @@ static void worker_run(struct fridgethr_context *ctx)
 	}
 }
 
+/**
+ * @brief Percent of workers blocked in the FSAL above which the pool
+ *        grows, if requests are waiting
+ */
+#define WORKER_TUNE_BLOCKED_PCT 75
+
+/**
+ * @brief Percent of workers executing a request below which the pool
+ *        shrinks, if nothing is waiting
+ */
+#define WORKER_TUNE_BUSY_PCT 50
+
+/** Samples taken once a second since the last decision */
+struct worker_tune_state {
+	uint32_t samples;
+	uint64_t workers;
+	uint64_t busy;
+	uint64_t in_fsal;
+	uint64_t queued;
+};
+
+static struct worker_tune_state worker_tune_state;
+
+/**
+ * @brief Grow or shrink the worker pool
+ *
+ * With synchronous FSAL calls a worker waiting on the backend can do
+ * nothing else.  When most workers are blocked in the FSAL and
+ * requests are still queued, more workers keep the backend busier, so
+ * the pool grows by a quarter.  When most workers are not executing
+ * anything and nothing waits, the pool gives back an eighth.  Workers
+ * busy but not in the FSAL are CPU bound and more of them would only
+ * contend, so a queue alone does not grow the pool.
+ *
+ * The queue depth comes from nfs_rpc_outstanding_reqs_est() and is
+ * averaged over Worker_Autotune_Interval samples.
+ *
+ * @param[in] ctx Fridge thread context
+ */
+
+static void worker_tune_run(struct fridgethr_context *ctx)
+{
+	struct worker_tune_state *wts = ctx->arg;
+	uint32_t workers, busy, in_fsal, cur, target, lo, hi;
+
+	req_inflight_count(&workers, &busy, &in_fsal);
+	wts->workers += workers;
+	wts->busy += busy;
+	wts->in_fsal += in_fsal;
+	wts->queued += nfs_rpc_outstanding_reqs_est();
+
+	if (++wts->samples < NFS_pcp.worker_autotune_interval ||
+	    wts->workers == 0)
+		return;
+
+	cur = atomic_fetch_uint32_t(&NFS_pcp.nb_worker);
+	lo = NFS_pcp.nb_worker_min;
+	hi = MAX(NFS_pcp.nb_worker_max, lo);
+	target = cur;
+
+	if (wts->in_fsal * 100 >= wts->workers * WORKER_TUNE_BLOCKED_PCT &&
+	    wts->queued >= wts->samples)
+		target = cur + MAX(cur / 4, 1);
+	else if (wts->busy * 100 < wts->workers * WORKER_TUNE_BUSY_PCT &&
+		 wts->queued < wts->samples)
+		target = cur - MIN(MAX(cur / 8, 1), cur);
+
+	target = MIN(MAX(target, lo), hi);
+
+	LogFullDebug(COMPONENT_DISPATCH,
+		     "Worker autotune over %" PRIu32 " s: workers %" PRIu64
+		     " busy %" PRIu64 " in FSAL %" PRIu64 " queued %" PRIu64
+		     ", %" PRIu32 " -> %" PRIu32,
+		     wts->samples, wts->workers / wts->samples,
+		     wts->busy / wts->samples, wts->in_fsal / wts->samples,
+		     wts->queued / wts->samples, cur, target);
+
+	memset(wts, 0, sizeof(*wts));
+
+	if (target != cur)
+		(void) nfs_set_tunable("Nb_Worker", target);
+}
+
+static int worker_tune_init(void)
+{
+	struct fridgethr_params frp;
+	int rc;
+
+	if (NFS_pcp.nb_worker_max < NFS_pcp.nb_worker_min)
+		LogWarn(COMPONENT_INIT,
+			"Nb_Worker_Max %" PRIu32 " below Nb_Worker_Min %" PRIu32
+			", using Nb_Worker_Min for both",
+			NFS_pcp.nb_worker_max, NFS_pcp.nb_worker_min);
+
+	memset(&frp, 0, sizeof(struct fridgethr_params));
+	frp.thr_max = 1;
+	frp.thr_min = 1;
+	frp.thread_delay = 1;
+	frp.flavor = fridgethr_flavor_looper;
+
+	rc = fridgethr_init(&worker_tune_fridge, "Wrk_tune", &frp);
+	if (rc != 0) {
+		LogMajor(COMPONENT_DISPATCH,
+			 "Unable to initialize worker autotune fridge: %d", rc);
+		return rc;
+	}
+
+	rc = fridgethr_submit(worker_tune_fridge, worker_tune_run,
+			      &worker_tune_state);
+	if (rc != 0)
+		LogMajor(COMPONENT_DISPATCH,
+			 "Unable to start worker autotune thread: %d", rc);
+
+	return rc;
+}
+
 int worker_init(void)
 {
 	struct fridgethr_params frp;
@@ -1580,6 +1871,7 @@ int worker_init(void)
 	frp.thread_finalize = worker_thread_finalizer;
 	frp.wake_threads = nfs_rpc_queue_awaken;
 	frp.wake_threads_arg = &nfs_req_st;
+	frp.numa_affinity = nfs_param.core_param.worker_numa_affinity;
 
 	rc = fridgethr_init(&worker_fridge, "Wrk", &frp);
 	if (rc != 0) {
@@ -1593,16 +1885,50 @@ int worker_init(void)
 	if (rc != 0) {
 		LogMajor(COMPONENT_DISPATCH,
 			 "Unable to populate worker fridge: %d", rc);
+		return rc;
 	}
 
+	if (NFS_pcp.worker_autotune)
+		rc = worker_tune_init();
+
+	return rc;
+}
+
+/**
+ * @brief Change the number of worker threads
+ *
+ * Queue shards were sized from the worker count at startup and stay
+ * as they are; workers of a grown pool share them.
+ *
+ * @param[in] nb_worker New thread count
+ *
+ * @return 0 or the error from fridgethr_resize().
+ */
+
+int worker_resize(uint32_t nb_worker)
+{
+	int rc = fridgethr_resize(worker_fridge, nb_worker, worker_run, NULL);
+
+	if (rc != 0)
+		LogMajor(COMPONENT_DISPATCH,
+			 "Unable to resize worker fridge to %" PRIu32 ": %d",
+			 nb_worker, rc);
+
 	return rc;
 }
 
 int worker_shutdown(void)
 {
-	int rc = fridgethr_sync_command(worker_fridge,
-					fridgethr_comm_stop,
-					120);
+	int rc;
+
+	if (worker_tune_fridge != NULL) {
+		rc = fridgethr_sync_command(worker_tune_fridge,
+					    fridgethr_comm_stop, 10);
+		if (rc != 0)
+			fridgethr_cancel(worker_tune_fridge);
+	}
+
+	rc = fridgethr_sync_command(worker_fridge, fridgethr_comm_stop, 120);
 
 	if (rc == ETIMEDOUT) {
 		LogMajor(COMPONENT_DISPATCH,
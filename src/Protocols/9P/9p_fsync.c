@@ -57,10 +57,10 @@ int _9p_fsync(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 
 	LogDebug(COMPONENT_9P, "TFSYNC: tag=%u fid=%u", (u32) *msgtag, *fid);
 
-	if (*fid >= _9P_FID_PER_CONN)
+	if (*fid >= _9p_param._9p_max_fids)
 		return _9p_rerror(req9p, msgtag, ERANGE, plenout, preply);
 
-	pfid = req9p->pconn->fids[*fid];
+	pfid = _9p_getfid(req9p->pconn, *fid);
 
 	/* Check that it is a valid open file */
 	if (pfid == NULL || pfid->pentry == NULL) {
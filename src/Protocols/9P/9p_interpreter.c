@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <poll.h>
 
 #include "nfs_core.h"
 #include "9p.h"
@@ -41,6 +42,7 @@
 #include "nfs_dupreq.h"
 #include "nfs_file_handle.h"
 #include "server_stats.h"
+#include "iobuf_pool.h"
 
 /* opcode to function array */
 const struct _9p_function_desc _9pfuncdesc[] = {
@@ -103,13 +105,36 @@ int _9p_not_2000L(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 	return -1;
 }				/* _9p_not_2000L */
 
+/* The socket is non blocking, it is read by an event thread */
 static ssize_t tcp_conn_send(struct _9p_conn *conn, const void *buf, size_t len,
 			     int flags)
 {
-	ssize_t ret;
+	struct pollfd pfd = {
+		.fd = conn->trans_data.sockfd,
+		.events = POLLOUT,
+	};
+	ssize_t ret = 0, sent;
 
 	PTHREAD_MUTEX_lock(&conn->sock_lock);
-	ret = send(conn->trans_data.sockfd, buf, len, flags);
+	while ((size_t)ret < len) {
+		sent = send(conn->trans_data.sockfd, (const char *)buf + ret,
+			    len - ret, flags | MSG_NOSIGNAL);
+		if (sent >= 0) {
+			ret += sent;
+			continue;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			ret = -1;
+			break;
+		}
+		/* Wait for the client to take some of the replies */
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			ret = -1;
+			break;
+		}
+	}
 	PTHREAD_MUTEX_unlock(&conn->sock_lock);
 
 	if (ret < 0)
@@ -125,11 +150,13 @@ static ssize_t tcp_conn_send(struct _9p_conn *conn, const void *buf, size_t len,
 
 void _9p_tcp_process_request(struct _9p_request_data *req9p)
 {
+	request_data_t *reqdata = container_of(req9p, request_data_t, r_u._9p);
 	u32 outdatalen = 0;
 	int rc = 0;
-	char replydata[_9P_MSG_SIZE];
+	char *replydata = iobuf_get(_9P_MSG_SIZE);
 
 	rc = _9p_process_buffer(req9p, replydata, &outdatalen);
+	req_phase_end(reqdata, REQ_PHASE_EXECUTE);
 	if (rc != 1) {
 		LogMajor(COMPONENT_9P,
 			 "Could not process 9P buffer on socket #%lu",
@@ -141,6 +168,8 @@ void _9p_tcp_process_request(struct _9p_request_data *req9p)
 				 "Could not send 9P/TCP reply correctly on socket #%lu",
 				 req9p->pconn->trans_data.sockfd);
 	}
+	req_phase_end(reqdata, REQ_PHASE_REPLY);
+	iobuf_put(replydata);
 	_9p_DiscardFlushHook(req9p);
 }				/* _9p_process_request */
 
@@ -159,7 +188,7 @@ int _9p_process_buffer(struct _9p_request_data *req9p, char *replydata,
 	msgdata += _9P_HDR_SIZE;
 
 	/* Get message's type */
-	msgtype = *(u8 *) msgdata;
+	msgtype = _9p_msgtype(req9p->_9pmsg);
 	msgdata += _9P_TYPE_SIZE;
 
 	/* Check boundaries. 0 is no_function fallback */
@@ -68,10 +68,10 @@ int _9p_link(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 	LogDebug(COMPONENT_9P, "TLINK: tag=%u dfid=%u targetfid=%u name=%.*s",
 		 (u32) *msgtag, *dfid, *targetfid, *name_len, name_str);
 
-	if (*dfid >= _9P_FID_PER_CONN)
+	if (*dfid >= _9p_param._9p_max_fids)
 		return _9p_rerror(req9p, msgtag, ERANGE, plenout, preply);
 
-	pdfid = req9p->pconn->fids[*dfid];
+	pdfid = _9p_getfid(req9p->pconn, *dfid);
 
 	/* Check that it is a valid fid */
 	if (pdfid == NULL || pdfid->pentry == NULL) {
@@ -85,10 +85,10 @@ int _9p_link(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 				 EXPORT_OPTION_WRITE_ACCESS) == 0)
 		return _9p_rerror(req9p, msgtag, EROFS, plenout, preply);
 
-	if (*targetfid >= _9P_FID_PER_CONN)
+	if (*targetfid >= _9p_param._9p_max_fids)
 		return _9p_rerror(req9p, msgtag, ERANGE, plenout, preply);
 
-	ptargetfid = req9p->pconn->fids[*targetfid];
+	ptargetfid = _9p_getfid(req9p->pconn, *targetfid);
 	/* Check that it is a valid fid */
 	if (ptargetfid == NULL || ptargetfid->pentry == NULL) {
 		LogDebug(COMPONENT_9P, "request on invalid targetfid=%u",
@@ -350,7 +350,7 @@ void free_fid(struct _9p_fid *pfid)
 		release_9p_user_cred_ref(pfid->ucred);
 
 	gsh_free(pfid->xattr);
-	gsh_free(pfid);
+	gsh_free_tag(GSH_MEM_9P, pfid, sizeof(*pfid));
 }
 
 int _9p_tools_clunk(struct _9p_fid *pfid)
@@ -426,7 +426,8 @@ int _9p_tools_clunk(struct _9p_fid *pfid)
 
 void _9p_cleanup_fids(struct _9p_conn *conn)
 {
-	int i;
+	struct _9p_fid **page;
+	int i, j;
 
 	/* Allocate op_ctx, is should always be NULL here
 	 * Note we only need it if there is a non-null fid,
@@ -434,15 +435,78 @@ void _9p_cleanup_fids(struct _9p_conn *conn)
 	 */
 	op_ctx = gsh_calloc(1, sizeof(struct req_op_context));
 
-	for (i = 0; i < _9P_FID_PER_CONN; i++) {
-		if (conn->fids[i]) {
-			_9p_init_opctx(conn->fids[i], NULL);
-			_9p_tools_clunk(conn->fids[i]);
-			_9p_release_opctx();
-			conn->fids[i] = NULL;	/* poison the entry */
+	for (i = 0; i < _9P_FID_PAGES; i++) {
+		page = conn->fids[i];
+		if (page == NULL)
+			continue;
+
+		for (j = 0; j < _9P_FID_PAGE_SIZE; j++) {
+			if (page[j]) {
+				_9p_init_opctx(page[j], NULL);
+				_9p_tools_clunk(page[j]);
+				_9p_release_opctx();
+				page[j] = NULL;	/* poison the entry */
+			}
 		}
+
+		gsh_free(page);
+		conn->fids[i] = NULL;
 	}
 
+	LogDebug(COMPONENT_9P,
+		 "Connection released %" PRIu32 " fid pages, %zu bytes",
+		 conn->fid_pages,
+		 conn->fid_pages * _9P_FID_PAGE_SIZE * sizeof(*page));
+	conn->fid_pages = 0;
+	conn->fid_count = 0;
+
 	gsh_free(op_ctx);
 	op_ctx = NULL;
 }
+
+/**
+ * @brief Set or clear a fid of a connection
+ *
+ * The page holding the fid is allocated on first use.  Callers check
+ * the fid against _9P_Max_Fids first.
+ *
+ * @param[in] conn The connection
+ * @param[in] fid  The fid
+ * @param[in] pfid What to store, NULL to clear it
+ */
+
+void _9p_setfid(struct _9p_conn *conn, u32 fid, struct _9p_fid *pfid)
+{
+	struct _9p_fid **page, *old;
+	void **slot = (void **)&conn->fids[fid >> _9P_FID_PAGE_SHIFT];
+
+	page = atomic_fetch_voidptr(slot);
+	if (page == NULL) {
+		if (pfid == NULL)
+			return;
+
+		PTHREAD_MUTEX_lock(&conn->fid_lock);
+		page = atomic_fetch_voidptr(slot);
+		if (page == NULL) {
+			page = gsh_calloc(_9P_FID_PAGE_SIZE, sizeof(*page));
+			atomic_store_voidptr(slot, page);
+			conn->fid_pages++;
+			LogDebug(COMPONENT_9P,
+				 "Connection has %" PRIu32 " fid pages, %zu bytes",
+				 conn->fid_pages,
+				 conn->fid_pages * _9P_FID_PAGE_SIZE *
+				 sizeof(*page));
+		}
+		PTHREAD_MUTEX_unlock(&conn->fid_lock);
+	}
+
+	old = atomic_fetch_voidptr(
+			(void **)&page[fid & (_9P_FID_PAGE_SIZE - 1)]);
+	atomic_store_voidptr((void **)&page[fid & (_9P_FID_PAGE_SIZE - 1)],
+			     pfid);
+
+	if (old == NULL && pfid != NULL)
+		(void) atomic_inc_uint32_t(&conn->fid_count);
+	else if (old != NULL && pfid == NULL)
+		(void) atomic_dec_uint32_t(&conn->fid_count);
+}
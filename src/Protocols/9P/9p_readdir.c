@@ -59,6 +59,8 @@ struct _9p_cb_data {
 	u8 *cursor;
 	unsigned int count;
 	unsigned int max;
+	uint64_t last_cookie;	/*< Offset of the last entry in the reply */
+	bool full;		/*< An entry did not fit */
 };
 
 static inline u8 *fill_entry(u8 *cursor, u8 qid_type, u64 qid_path, u64 cookie,
@@ -100,6 +102,7 @@ static fsal_errors_t _9p_readdir_callback(void *opaque,
 	}
 
 	if (tracker->count + 24 + name_len > tracker->max) {
+		tracker->full = true;
 		cb_parms->in_result = false;
 		return ERR_FSAL_NO_ERROR;
 	}
@@ -152,6 +155,7 @@ static fsal_errors_t _9p_readdir_callback(void *opaque,
 	tracker->cursor =
 	    fill_entry(tracker->cursor, qid_type, obj->fileid,
 		       cookie, d_type, name_len, cb_parms->name);
+	tracker->last_cookie = cookie;
 
 	cb_parms->in_result = true;
 	return ERR_FSAL_NO_ERROR;
@@ -179,6 +183,9 @@ int _9p_readdir(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 	unsigned int num_entries = 0;
 
 	struct _9p_fid *pfid = NULL;
+	struct fsal_readdir_budget budget;
+	struct attrlist attrs;
+	uint64_t change = 0;
 
 	/* Get data */
 	_9p_getptr(cursor, msgtag, u16);
@@ -189,10 +196,10 @@ int _9p_readdir(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 	LogDebug(COMPONENT_9P, "TREADDIR: tag=%u fid=%u offset=%llu count=%u",
 		 (u32) *msgtag, *fid, (unsigned long long)*offset, *count);
 
-	if (*fid >= _9P_FID_PER_CONN)
+	if (*fid >= _9p_param._9p_max_fids)
 		return _9p_rerror(req9p, msgtag, ERANGE, plenout, preply);
 
-	pfid = req9p->pconn->fids[*fid];
+	pfid = _9p_getfid(req9p->pconn, *fid);
 
 	/* Make sure the requested amount of data respects negotiated msize */
 	if (*count + _9P_ROOM_RREADDIR > req9p->pconn->msize)
@@ -225,6 +232,29 @@ int _9p_readdir(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 	/* Remember dcount position for later use */
 	_9p_savepos(cursor, dcount_pos, u32);
 
+	/* The client reads on until it gets an empty reply. If the last
+	 * reply already reached the end and the directory has not changed
+	 * since, that is all this is: answer without walking it again.
+	 */
+	fsal_prepare_attrs(&attrs, ATTR_CHANGE);
+	fsal_status = pfid->pentry->obj_ops.getattrs(pfid->pentry, &attrs);
+	if (!FSAL_IS_ERROR(fsal_status))
+		change = attrs.change;
+	fsal_release_attrs(&attrs);
+
+	if (*offset >= 2LL && *offset == pfid->readdir_eod &&
+	    !FSAL_IS_ERROR(fsal_status) && change == pfid->readdir_change) {
+		_9p_setvalue(dcount_pos, 0, u32);
+		_9p_setendptr(cursor, preply);
+		_9p_checkbound(cursor, preply, plenout);
+
+		LogDebug(COMPONENT_9P,
+			 "RREADDIR: tag=%u fid=%u dcount=0 (end of directory)",
+			 (u32) *msgtag, *fid);
+		return 1;
+	}
+	pfid->readdir_eod = 0;
+
 	/* Is this the first request ? */
 	if (*offset == 0LL) {
 		/* compute the parent entry */
@@ -277,9 +307,21 @@ int _9p_readdir(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 	tracker.cursor = cursor;
 	tracker.count = dcount;
 	tracker.max = *count;
-
+	tracker.last_cookie = cookie == 0LL ? 2LL : cookie;
+	tracker.full = false;
+
+	/* Tell the cache how much fits, so it stops looking up entries
+	 * once the reply is full.
+	 */
+	budget.bytes = *count - dcount;
+	budget.entry_bytes = 24;
+	budget.slack = 0;
+	budget.entries = UINT32_MAX;
+
+	op_ctx->readdir_budget = &budget;
 	fsal_status = fsal_readdir(pfid->pentry, cookie, &num_entries, &eod_met,
 				   0, _9p_readdir_callback, &tracker);
+	op_ctx->readdir_budget = NULL;
 	if (FSAL_IS_ERROR(fsal_status)) {
 		/* The avl lookup will try to get the next entry after 'cookie'.
 		 * If none is found CACHE_INODE_NOT_FOUND is returned
@@ -292,6 +334,12 @@ int _9p_readdir(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 
 	cursor = tracker.cursor;
 
+	/* Remember where the directory ends if this reply got there */
+	if (eod_met && !tracker.full) {
+		pfid->readdir_eod = tracker.last_cookie;
+		pfid->readdir_change = change;
+	}
+
 	/* Set buffsize in previously saved position */
 	_9p_setvalue(dcount_pos, tracker.count, u32);
 
@@ -48,7 +48,7 @@
 	pfid->pentry = NULL;						\
 	/* Free the fid */                                              \
 	free_fid(pfid);							\
-	req9p->pconn->fids[*fid] = NULL;                                \
+	_9p_setfid(req9p->pconn, *fid, NULL);				\
 } while (0)
 
 int _9p_remove(struct _9p_request_data *req9p, u32 *plenout, char *preply)
@@ -66,10 +66,10 @@ int _9p_remove(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 
 	LogDebug(COMPONENT_9P, "TREMOVE: tag=%u fid=%u", (u32) *msgtag, *fid);
 
-	if (*fid >= _9P_FID_PER_CONN)
+	if (*fid >= _9p_param._9p_max_fids)
 		return _9p_rerror(req9p, msgtag, ERANGE, plenout, preply);
 
-	pfid = req9p->pconn->fids[*fid];
+	pfid = _9p_getfid(req9p->pconn, *fid);
 
 	/* Check that it is a valid fid */
 	if (pfid == NULL || pfid->pentry == NULL) {
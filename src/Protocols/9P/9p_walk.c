@@ -71,20 +71,20 @@ int _9p_walk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 	LogDebug(COMPONENT_9P, "TWALK: tag=%u fid=%u newfid=%u nwname=%u",
 		 (u32) *msgtag, *fid, *newfid, *nwname);
 
-	if (*fid >= _9P_FID_PER_CONN)
+	if (*fid >= _9p_param._9p_max_fids)
 		return _9p_rerror(req9p, msgtag, ERANGE, plenout, preply);
 
-	if (*newfid >= _9P_FID_PER_CONN)
+	if (*newfid >= _9p_param._9p_max_fids)
 		return _9p_rerror(req9p, msgtag, ERANGE, plenout, preply);
 
-	pfid = req9p->pconn->fids[*fid];
+	pfid = _9p_getfid(req9p->pconn, *fid);
 	/* Check that it is a valid fid */
 	if (pfid == NULL || pfid->pentry == NULL) {
 		LogDebug(COMPONENT_9P, "request on invalid fid=%u", *fid);
 		return _9p_rerror(req9p, msgtag, EIO, plenout, preply);
 	}
 	_9p_init_opctx(pfid, req9p);
-	pnewfid = gsh_calloc(1, sizeof(struct _9p_fid));
+	pnewfid = gsh_calloc_tag(GSH_MEM_9P, 1, sizeof(struct _9p_fid));
 
 	/* Is this a lookup or a fid cloning operation ? */
 	if (*nwname == 0) {
@@ -103,7 +103,8 @@ int _9p_walk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 		for (i = 0; i < *nwname; i++) {
 			_9p_getstr(cursor, wnames_len, wnames_str);
 			if (*wnames_len >= sizeof(name)) {
-				gsh_free(pnewfid);
+				gsh_free_tag(GSH_MEM_9P, pnewfid,
+					     sizeof(*pnewfid));
 				return _9p_rerror(req9p, msgtag, ENAMETOOLONG,
 						  plenout, preply);
 			}
@@ -122,7 +123,8 @@ int _9p_walk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 			fsal_status = fsal_lookup(pentry, name,
 						  &pnewfid->pentry, NULL);
 			if (FSAL_IS_ERROR(fsal_status)) {
-				gsh_free(pnewfid);
+				gsh_free_tag(GSH_MEM_9P, pnewfid,
+					     sizeof(*pnewfid));
 				return _9p_rerror(req9p, msgtag,
 						  _9p_tools_errno(fsal_status),
 						  plenout, preply);
@@ -179,7 +181,7 @@ int _9p_walk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 			LogMajor(COMPONENT_9P,
 				 "implementation error, you should not see this message !!!!!!");
 			pentry->obj_ops.put_ref(pentry);
-			gsh_free(pnewfid);
+			gsh_free_tag(GSH_MEM_9P, pnewfid, sizeof(*pnewfid));
 			return _9p_rerror(req9p, msgtag, EINVAL,
 					  plenout, preply);
 			break;
@@ -200,7 +202,7 @@ int _9p_walk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 	pnewfid->state->state_refcount = 1;
 
 	/* keep info on new fid */
-	req9p->pconn->fids[*newfid] = pnewfid;
+	_9p_setfid(req9p->pconn, *newfid, pnewfid);
 
 	/* As much qid as requested fid */
 	nwqid = nwname;
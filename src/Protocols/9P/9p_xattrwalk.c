@@ -87,13 +87,13 @@ int _9p_xattrwalk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 			 "TXATTRWALK (component): tag=%u fid=%u attrfid=%u name=%.*s",
 			 (u32) *msgtag, *fid, *attrfid, *name_len, name_str);
 
-	if (*fid >= _9P_FID_PER_CONN)
+	if (*fid >= _9p_param._9p_max_fids)
 		return _9p_rerror(req9p, msgtag, ERANGE, plenout, preply);
 
-	if (*attrfid >= _9P_FID_PER_CONN)
+	if (*attrfid >= _9p_param._9p_max_fids)
 		return _9p_rerror(req9p, msgtag, ERANGE, plenout, preply);
 
-	pfid = req9p->pconn->fids[*fid];
+	pfid = _9p_getfid(req9p->pconn, *fid);
 	/* Check that it is a valid fid */
 	if (pfid == NULL || pfid->pentry == NULL) {
 		LogDebug(COMPONENT_9P, "request on invalid fid=%u", *fid);
@@ -107,7 +107,7 @@ int _9p_xattrwalk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 				  preply);
 	}
 
-	pxattrfid = gsh_calloc(1, sizeof(struct _9p_fid));
+	pxattrfid = gsh_calloc_tag(GSH_MEM_9P, 1, sizeof(struct _9p_fid));
 
 	/* set op_ctx, it will be useful if FSAL is later called */
 	_9p_init_opctx(pfid, req9p);
@@ -137,7 +137,7 @@ int _9p_xattrwalk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 
 		if (FSAL_IS_ERROR(fsal_status)) {
 			gsh_free(pxattrfid->xattr);
-			gsh_free(pxattrfid);
+			gsh_free_tag(GSH_MEM_9P, pxattrfid, sizeof(*pxattrfid));
 			return _9p_rerror(req9p, msgtag,
 					  _9p_tools_errno(fsal_status), plenout,
 					  preply);
@@ -147,7 +147,7 @@ int _9p_xattrwalk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 		 * returns ERANGE as listxattr does */
 		if (eod_met != true) {
 			gsh_free(pxattrfid->xattr);
-			gsh_free(pxattrfid);
+			gsh_free_tag(GSH_MEM_9P, pxattrfid, sizeof(*pxattrfid));
 			return _9p_rerror(req9p, msgtag, ERANGE,
 					  plenout, preply);
 		}
@@ -160,7 +160,8 @@ int _9p_xattrwalk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 			 * @todo realloc here too */
 			if (attrsize + tmplen + 1 > XATTR_BUFFERSIZE) {
 				gsh_free(pxattrfid->xattr);
-				gsh_free(pxattrfid);
+				gsh_free_tag(GSH_MEM_9P, pxattrfid,
+					     sizeof(*pxattrfid));
 				return _9p_rerror(req9p, msgtag, ERANGE,
 						  plenout, preply);
 			}
@@ -191,7 +192,8 @@ int _9p_xattrwalk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 					     0, &attrsize);
 			if (FSAL_IS_ERROR(fsal_status)) {
 				gsh_free(pxattrfid->xattr);
-				gsh_free(pxattrfid);
+				gsh_free_tag(GSH_MEM_9P, pxattrfid,
+					     sizeof(*pxattrfid));
 
 				/* fsal_status.minor is a valid errno code */
 				return _9p_rerror(req9p, msgtag,
@@ -202,7 +204,8 @@ int _9p_xattrwalk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 			/* Check our own limit too before reallocating */
 			if (attrsize > _9P_XATTR_MAX_SIZE) {
 				gsh_free(pxattrfid->xattr);
-				gsh_free(pxattrfid);
+				gsh_free_tag(GSH_MEM_9P, pxattrfid,
+					     sizeof(*pxattrfid));
 
 				return _9p_rerror(req9p, msgtag, E2BIG,
 						  plenout, preply);
@@ -219,7 +222,7 @@ int _9p_xattrwalk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 		}
 		if (FSAL_IS_ERROR(fsal_status)) {
 			gsh_free(pxattrfid->xattr);
-			gsh_free(pxattrfid);
+			gsh_free_tag(GSH_MEM_9P, pxattrfid, sizeof(*pxattrfid));
 
 			/* ENOENT for xattr is ENOATTR */
 			if (fsal_status.major == ERR_FSAL_NOENT)
@@ -234,7 +237,7 @@ int _9p_xattrwalk(struct _9p_request_data *req9p, u32 *plenout, char *preply)
 	pxattrfid->xattr->xattr_size = attrsize;
 	pxattrfid->xattr->xattr_write = _9P_XATTR_READ_ONLY;
 
-	req9p->pconn->fids[*attrfid] = pxattrfid;
+	_9p_setfid(req9p->pconn, *attrfid, pxattrfid);
 
 	/* Increments refcount as we're manually making a new copy */
 	pfid->pentry->obj_ops.get_ref(pfid->pentry);
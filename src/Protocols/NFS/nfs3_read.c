@@ -43,6 +43,7 @@
 #include "nfs_convert.h"
 #include "server_stats.h"
 #include "export_mgr.h"
+#include "iobuf_pool.h"
 #include "sal_functions.h"
 
 static void nfs_read_ok(struct svc_req *req, nfs_res_t *res, char *data,
@@ -50,7 +51,7 @@ static void nfs_read_ok(struct svc_req *req, nfs_res_t *res, char *data,
 			int eof)
 {
 	if ((read_size == 0) && (data != NULL)) {
-		gsh_free(data);
+		iobuf_put(data);
 		data = NULL;
 	}
 
@@ -204,7 +205,11 @@ int nfs3_read(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 		rc = NFS_REQ_OK;
 		goto out;
 	} else {
-		data = gsh_malloc(size);
+		/* Page aligned, from the shared pool like the NFSv4 READ
+		 * buffer, so the FSAL can fill it with direct I/O and the
+		 * reply hands whole pages to the transport.
+		 */
+		data = iobuf_get(size);
 
 		res->res_read3.status = nfs3_Errno_state(
 				state_share_anonymous_io_start(
@@ -214,7 +219,7 @@ int nfs3_read(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 
 		if (res->res_read3.status != NFS3_OK) {
 			rc = NFS_REQ_OK;
-			gsh_free(data);
+			iobuf_put(data);
 			goto out;
 		}
 
@@ -250,7 +255,7 @@ int nfs3_read(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 			rc = NFS_REQ_OK;
 			goto out;
 		}
-		gsh_free(data);
+		iobuf_put(data);
 	}
 
 	/* If we are here, there was an error */
@@ -289,6 +294,6 @@ void nfs3_read_free(nfs_res_t *res)
 {
 	if ((res->res_read3.status == NFS3_OK)
 	    && (res->res_read3.READ3res_u.resok.data.data_len != 0)) {
-		gsh_free(res->res_read3.READ3res_u.resok.data.data_val);
+		iobuf_put(res->res_read3.READ3res_u.resok.data.data_val);
 	}
 }
@@ -122,6 +122,7 @@ int nfs3_readdirplus(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 	fsal_status_t fsal_status = {0, 0};
 	fsal_status_t fsal_status_gethandle = {0, 0};
 	int rc = NFS_REQ_OK;
+	struct fsal_readdir_budget budget;
 	struct nfs3_readdirplus_cb_data tracker = {
 		.entries = NULL,
 		.mem_left = 0,
@@ -305,10 +306,24 @@ int nfs3_readdirplus(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 		}
 	}
 
+	/* Tell MDCACHE how much the reply can take.  An entry is charged
+	 * at least its cookie, name length, handle length, follows flags
+	 * and attributes besides the name and handle, while the callback
+	 * only takes one with room for a whole entryplus3 and a full size
+	 * handle besides the name.
+	 */
+	budget.bytes = tracker.mem_left;
+	budget.entry_bytes = sizeof(cookie3) + 4 + 12 + sizeof(post_op_attr);
+	budget.slack = sizeof(entryplus3) + NFS3_FHSIZE - budget.entry_bytes;
+	budget.entries = tracker.total_entries > tracker.count
+			 ? tracker.total_entries - tracker.count : 0;
+
 	/* Call readdir */
+	op_ctx->readdir_budget = &budget;
 	fsal_status = fsal_readdir(dir_obj, fsal_cookie, &num_entries, &eod_met,
 				   ATTRS_NFS3, nfs3_readdirplus_callback,
 				   &tracker);
+	op_ctx->readdir_budget = NULL;
 
 	if (FSAL_IS_ERROR(fsal_status)) {
 		/* Is this a retryable error */
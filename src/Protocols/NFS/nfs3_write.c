@@ -47,6 +47,132 @@
 #include "export_mgr.h"
 #include "sal_functions.h"
 
+/**
+ * @brief Stable writes to one file sharing their flushes
+ *
+ * With Write_Gather_Usec set, stable writes are written unstable and
+ * then wait for a flush of the file started after their data went
+ * out.  If none is under way, the writer runs one itself, first
+ * giving the other stable writes to the file still in progress up to
+ * the gather window to finish, so that one flush covers them all.
+ */
+
+struct write_gather {
+	struct glist_head link;		/*< Link in write_gathers */
+	struct fsal_obj_handle *obj;	/*< File being written */
+	uint32_t refs;			/*< Writes using this record */
+	uint32_t writing;		/*< Writes not written yet */
+	bool busy;			/*< A write is gathering or flushing */
+	uint64_t started;		/*< Flushes started */
+	uint64_t done;			/*< Flushes finished */
+	fsal_status_t status;		/*< Result of the last flush */
+};
+
+static pthread_mutex_t write_gather_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t write_gather_cond = PTHREAD_COND_INITIALIZER;
+static struct glist_head write_gathers = GLIST_HEAD_INIT(write_gathers);
+
+/**
+ * @brief Join the stable writes to a file
+ *
+ * @param[in] obj File about to be written
+ *
+ * @return The record to pass to write_gather_end().
+ */
+
+static struct write_gather *write_gather_begin(struct fsal_obj_handle *obj)
+{
+	struct write_gather *wg;
+	struct glist_head *node;
+
+	PTHREAD_MUTEX_lock(&write_gather_mtx);
+
+	glist_for_each(node, &write_gathers) {
+		wg = glist_entry(node, struct write_gather, link);
+		if (wg->obj == obj)
+			goto found;
+	}
+
+	wg = gsh_calloc(1, sizeof(*wg));
+	wg->obj = obj;
+	glist_add_tail(&write_gathers, &wg->link);
+
+found:
+	wg->refs++;
+	wg->writing++;
+
+	PTHREAD_MUTEX_unlock(&write_gather_mtx);
+	return wg;
+}
+
+/**
+ * @brief Leave the stable writes to a file, flushing it if asked
+ *
+ * @param[in] wg    Record from write_gather_begin()
+ * @param[in] flush Whether this write's data still has to be flushed
+ *
+ * @return Status of the flush covering this write.
+ */
+
+static fsal_status_t write_gather_end(struct write_gather *wg, bool flush)
+{
+	fsal_status_t status = fsalstat(ERR_FSAL_NO_ERROR, 0);
+	struct timespec deadline;
+	uint64_t target;
+
+	PTHREAD_MUTEX_lock(&write_gather_mtx);
+
+	if (--wg->writing == 0)
+		pthread_cond_broadcast(&write_gather_cond);
+
+	/* A flush already started may have missed our data */
+	target = wg->started + 1;
+
+	while (flush && wg->done < target) {
+		if (wg->busy) {
+			pthread_cond_wait(&write_gather_cond,
+					  &write_gather_mtx);
+			continue;
+		}
+
+		wg->busy = true;
+
+		if (wg->writing != 0) {
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			timespec_add_nsecs(
+			    nfs_param.core_param.write_gather_usec * NS_PER_USEC,
+			    &deadline);
+			while (wg->writing != 0 &&
+			       pthread_cond_timedwait(&write_gather_cond,
+						      &write_gather_mtx,
+						      &deadline) != ETIMEDOUT)
+				;
+		}
+
+		wg->started++;
+		PTHREAD_MUTEX_unlock(&write_gather_mtx);
+
+		status = fsal_commit(wg->obj, 0, 0);
+
+		PTHREAD_MUTEX_lock(&write_gather_mtx);
+		wg->status = status;
+		wg->done = wg->started;
+		wg->busy = false;
+		pthread_cond_broadcast(&write_gather_cond);
+	}
+
+	if (flush)
+		status = wg->status;
+
+	if (--wg->refs == 0) {
+		glist_del(&wg->link);
+		gsh_free(wg);
+	}
+
+	PTHREAD_MUTEX_unlock(&write_gather_mtx);
+	return status;
+}
+
 /**
  *
  * @brief The NFSPROC3_WRITE
@@ -66,6 +192,7 @@
 int nfs3_write(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 {
 	struct fsal_obj_handle *obj;
+	struct write_gather *gather = NULL;
 	pre_op_attr pre_attr = {
 		.attributes_follow = false
 	};
@@ -228,6 +355,12 @@ int nfs3_write(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 		goto out;
 	}
 
+	if (sync && nfs_param.core_param.write_gather_usec != 0) {
+		/* Write unstable, flush below with the others */
+		gather = write_gather_begin(obj);
+		sync = false;
+	}
+
 	if (obj->fsal->m_ops.support_ex(obj)) {
 		/* Call the new fsal_write */
 		/** @todo for now pass NULL state */
@@ -255,6 +388,24 @@ int nfs3_write(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 
 	state_share_anonymous_io_done(obj, OPEN4_SHARE_ACCESS_WRITE);
 
+	if (gather != NULL) {
+		/* Leave even on error, the flusher may be waiting for us;
+		 * the FSAL may also have gone stable on its own.
+		 */
+		fsal_status_t flush_status;
+
+		flush_status = write_gather_end(gather,
+						!FSAL_IS_ERROR(fsal_status) &&
+						!sync);
+
+		if (!FSAL_IS_ERROR(fsal_status)) {
+			if (FSAL_IS_ERROR(flush_status))
+				fsal_status = flush_status;
+			else
+				sync = true;
+		}
+	}
+
 	if (FSAL_IS_ERROR(fsal_status)) {
 		/* If we are here, there was an error */
 		LogFullDebug(COMPONENT_NFSPROTO,
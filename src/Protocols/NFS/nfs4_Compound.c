@@ -270,9 +270,9 @@ static const struct nfs4_op_desc optabv4[] = {
 		.exp_perm_flags = 0	/* tbd */},
 	[NFS4_OP_BIND_CONN_TO_SESSION] = {
 		.name = "OP_BIND_CONN_TO_SESSION",
-		.funct = nfs4_op_illegal,
-		.free_res = nfs4_op_illegal_Free,
-		.exp_perm_flags = 0	/* tbd */},
+		.funct = nfs4_op_bind_conn,
+		.free_res = nfs4_op_bind_conn_Free,
+		.exp_perm_flags = 0},
 	[NFS4_OP_EXCHANGE_ID] = {
 		.name = "OP_EXCHANGE_ID",
 		.funct = nfs4_op_exchange_id,
@@ -295,9 +295,9 @@ static const struct nfs4_op_desc optabv4[] = {
 		.exp_perm_flags = 0},
 	[NFS4_OP_GET_DIR_DELEGATION] = {
 		.name = "OP_GET_DIR_DELEGATION",
-		.funct = nfs4_op_illegal,
-		.free_res = nfs4_op_illegal_Free,
-		.exp_perm_flags = 0	/* tbd */},
+		.funct = nfs4_op_get_dir_delegation,
+		.free_res = nfs4_op_get_dir_delegation_Free,
+		.exp_perm_flags = 0},
 	[NFS4_OP_GETDEVICEINFO] = {
 		.name = "OP_GETDEVICEINFO",
 		.funct = nfs4_op_getdeviceinfo,
@@ -367,9 +367,9 @@ static const struct nfs4_op_desc optabv4[] = {
 				.exp_perm_flags = 0},
 	[NFS4_OP_COPY] = {
 				.name = "OP_COPY",
-				.funct = nfs4_op_notsupp,
-				.free_res = nfs4_op_notsupp_Free,
-				.exp_perm_flags = 0},
+				.funct = nfs4_op_copy,
+				.free_res = nfs4_op_copy_Free,
+				.exp_perm_flags = EXPORT_OPTION_WRITE_ACCESS},
 	[NFS4_OP_COPY_NOTIFY] = {
 				.name = "OP_COPY_NOTIFY",
 				.funct = nfs4_op_notsupp,
@@ -397,13 +397,13 @@ static const struct nfs4_op_desc optabv4[] = {
 				.exp_perm_flags = 0},
 	[NFS4_OP_OFFLOAD_CANCEL] = {
 				.name = "OP_OFFLOAD_CANCEL",
-				.funct = nfs4_op_notsupp,
-				.free_res = nfs4_op_notsupp_Free,
+				.funct = nfs4_op_offload_cancel,
+				.free_res = nfs4_op_offload_cancel_Free,
 				.exp_perm_flags = 0},
 	[NFS4_OP_OFFLOAD_STATUS] = {
 				.name = "OP_OFFLOAD_STATUS",
-				.funct = nfs4_op_notsupp,
-				.free_res = nfs4_op_notsupp_Free,
+				.funct = nfs4_op_offload_status,
+				.free_res = nfs4_op_offload_status_Free,
 				.exp_perm_flags = 0},
 	[NFS4_OP_READ_PLUS] = {
 				.name = "OP_READ_PLUS",
@@ -422,9 +422,9 @@ static const struct nfs4_op_desc optabv4[] = {
 				.exp_perm_flags = 0},
 	[NFS4_OP_CLONE] = {
 				.name = "OP_CLONE",
-				.funct = nfs4_op_notsupp,
-				.free_res = nfs4_op_notsupp_Free,
-				.exp_perm_flags = 0},
+				.funct = nfs4_op_clone,
+				.free_res = nfs4_op_clone_Free,
+				.exp_perm_flags = EXPORT_OPTION_WRITE_ACCESS},
 
 	/* NFSv4.3 */
 	[NFS4_OP_GETXATTR] = {
@@ -458,6 +458,40 @@ nfs_opnum4 LastOpcode[] = {
 	NFS4_OP_REMOVEXATTR
 };
 
+/**
+ * @brief Recognize the compounds clients send over and over
+ *
+ * SEQUENCE and PUTFH followed by GETATTR, READ, ACCESS or ACCESS and
+ * GETATTR.  Every op in these is valid in any minor version with
+ * sessions, none is BIND_CONN_TO_SESSION or DESTROY_SESSION, and the
+ * ops after PUTFH all work on the filehandle it set, so the compound
+ * loop can skip the checks that cannot fire and only check export
+ * permissions once.
+ *
+ * @param[in] argarray Op arguments
+ * @param[in] len      Number of ops
+ * @param[in] minor    Minor version
+ *
+ * @return true if the compound has one of these shapes.
+ */
+
+static bool nfs4_compound_is_common(const nfs_argop4 *argarray, uint32_t len,
+				    uint32_t minor)
+{
+	if (minor == 0 || len < 3 || len > 4 ||
+	    argarray[0].argop != NFS4_OP_SEQUENCE ||
+	    argarray[1].argop != NFS4_OP_PUTFH)
+		return false;
+
+	if (len == 3)
+		return argarray[2].argop == NFS4_OP_GETATTR ||
+		       argarray[2].argop == NFS4_OP_READ ||
+		       argarray[2].argop == NFS4_OP_ACCESS;
+
+	return argarray[2].argop == NFS4_OP_ACCESS &&
+	       argarray[3].argop == NFS4_OP_GETATTR;
+}
+
 /**
  * @brief The NFS PROC4 COMPOUND
  *
@@ -491,8 +525,12 @@ int nfs4_Compound(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 	nfs_argop4 * const argarray = arg->arg_compound4.argarray.argarray_val;
 	nfs_resop4 *resarray;
 	nsecs_elapsed_t op_start_time;
+	nsecs_elapsed_t op_fsal_time;
 	struct timespec ts;
 	int perm_flags;
+	int perms_checked = 0;
+	struct gsh_export *health_export = NULL;
+	bool common;
 	char *tagname = NULL;
 	char *notag = "NO TAG";
 
@@ -587,9 +625,14 @@ int nfs4_Compound(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 	res->res_compound4.resarray.resarray_len = argarray_len;
 	resarray = res->res_compound4.resarray.resarray_val;
 
+	common = nfs4_compound_is_common(argarray, argarray_len,
+					 compound4_minor);
+
 	/* Manage errors NFS4ERR_OP_NOT_IN_SESSION and NFS4ERR_NOT_ONLY_OP.
-	 * These checks apply only to 4.1 */
-	if (compound4_minor > 0) {
+	 * These checks apply only to 4.1, and never fail for the common
+	 * compounds.
+	 */
+	if (compound4_minor > 0 && !common) {
 
 		/* Check for valid operation to start an NFS v4.1 COMPOUND:
 		 */
@@ -657,7 +700,7 @@ int nfs4_Compound(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 		/* Verify BIND_CONN_TO_SESSION is not used in a compound
 		 * with length > 1.
 		 */
-		if (i > 0 &&
+		if (!common && i > 0 &&
 		    argarray[i].argop == NFS4_OP_BIND_CONN_TO_SESSION) {
 			status = NFS4ERR_NOT_ONLY_OP;
 			goto bad_op_state;
@@ -666,10 +709,11 @@ int nfs4_Compound(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 		/* time each op */
 		now(&ts);
 		op_start_time = timespec_diff(&ServerBootTime, &ts);
+		op_fsal_time = op_ctx->fsal_time;
 		opcode = argarray[i].argop;
 
 		/* Handle opcode overflow */
-		if (opcode > LastOpcode[compound4_minor])
+		if (!common && opcode > LastOpcode[compound4_minor])
 			opcode = 0;
 
 		if (compound4_minor > 0 && data.session != NULL &&
@@ -680,9 +724,18 @@ int nfs4_Compound(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 
 		LogDebug(COMPONENT_NFS_V4, "Request %d: opcode %d is %s", i,
 			 argarray[i].argop, optabv4[opcode].name);
+		req_inflight_op(optabv4[opcode].name,
+				data.currentFH.nfs_fh4_val,
+				data.currentFH.nfs_fh4_len);
 		perm_flags =
 		    optabv4[opcode].exp_perm_flags & EXPORT_OPTION_ACCESS_MASK;
 
+		/* The common compounds keep the filehandle PUTFH set, so
+		 * what has been checked once needs no checking again.
+		 */
+		if (common)
+			perm_flags &= ~perms_checked;
+
 		if (perm_flags != 0) {
 			status = nfs4_Is_Fh_Empty(&data.currentFH);
 			if (status != NFS4_OK) {
@@ -733,6 +786,19 @@ int nfs4_Compound(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 					i + 1;
 				break;
 			}
+			perms_checked |= perm_flags;
+		}
+
+		/* Ask the backend health breaker once per export reached */
+		if (op_ctx->ctx_export != NULL &&
+		    op_ctx->ctx_export != health_export &&
+		    (optabv4[opcode].exp_perm_flags &
+		     EXPORT_OPTION_ACCESS_MASK) != 0) {
+			health_export = op_ctx->ctx_export;
+			if (!export_health_admit(health_export)) {
+				status = NFS4ERR_DELAY;
+				goto bad_op_state;
+			}
 		}
 
 #ifdef USE_LTTNG
@@ -756,7 +822,18 @@ int nfs4_Compound(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 		 */
 		resarray[i].nfs_resop4_u.opaccess.status = status;
 
-		server_stats_nfsv4_op_done(opcode, op_start_time, status);
+		server_stats_nfsv4_op_done(opcode, op_start_time,
+					   op_ctx->fsal_time - op_fsal_time,
+					   status, &data.currentFH);
+
+		if (op_ctx->ctx_export == health_export &&
+		    health_export != NULL &&
+		    (optabv4[opcode].exp_perm_flags &
+		     EXPORT_OPTION_ACCESS_MASK) != 0)
+			export_health_done(health_export,
+					   op_ctx->fsal_time - op_fsal_time,
+					   status == NFS4ERR_IO ||
+					   status == NFS4ERR_SERVERFAULT);
 
 		if (status != NFS4_OK) {
 			/* An error occured, we do not manage the other requests
@@ -829,11 +906,7 @@ int nfs4_Compound(nfs_arg_t *arg, struct svc_req *req, nfs_res_t *res)
 	/* If we have reserved a lease, update it and release it */
 	if (data.preserved_clientid != NULL) {
 		/* Update and release lease */
-		PTHREAD_MUTEX_lock(&data.preserved_clientid->cid_mutex);
-
 		update_lease(data.preserved_clientid);
-
-		PTHREAD_MUTEX_unlock(&data.preserved_clientid->cid_mutex);
 	}
 
 	if (status != NFS4_OK)
@@ -943,10 +1016,10 @@ void compound_data_Free(compound_data_t *data)
 	}
 
 	if (data->currentFH.nfs_fh4_val != NULL)
-		gsh_free(data->currentFH.nfs_fh4_val);
+		nfs4_freeScratchFH(&data->currentFH);
 
 	if (data->savedFH.nfs_fh4_val != NULL)
-		gsh_free(data->savedFH.nfs_fh4_val);
+		nfs4_freeScratchFH(&data->savedFH);
 
 }				/* compound_data_Free */
 
@@ -0,0 +1,148 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file    nfs4_op_bind_conn.c
+ * @brief   Routines used for managing the NFS4_OP_BIND_CONN_TO_SESSION
+ *          operation.
+ *
+ * A client binds each connection it wants to use for a session, or
+ * moves the back channel to a new one after losing the old.
+ */
+#include "config.h"
+#include "log.h"
+#include "nfs_core.h"
+#include "nfs_rpc_callback.h"
+#include "nfs_proto_functions.h"
+#include "sal_functions.h"
+
+/**
+ *
+ * @brief The NFS4_OP_BIND_CONN_TO_SESSION operation
+ *
+ * nfs4_Compound has already checked this is the only operation.  A
+ * client asking for either channel or both gets both when the session
+ * can have a back channel.  If the back channel is down and this
+ * connection may carry it, it is set up here.
+ *
+ * @param[in]     op   nfs4_op arguments
+ * @param[in,out] data Compound request's data
+ * @param[out]    resp nfs4_op results
+ *
+ * @return values as per RFC5661 p. 363
+ *
+ * @see nfs4_Compound
+ *
+ */
+
+int nfs4_op_bind_conn(struct nfs_argop4 *op, compound_data_t *data,
+		      struct nfs_resop4 *resp)
+{
+	BIND_CONN_TO_SESSION4args * const arg_BIND_CONN_TO_SESSION4 =
+	    &op->nfs_argop4_u.opbind_conn_to_session;
+	BIND_CONN_TO_SESSION4res * const res_BIND_CONN_TO_SESSION4 =
+	    &resp->nfs_resop4_u.opbind_conn_to_session;
+	BIND_CONN_TO_SESSION4resok * const resok =
+	    &res_BIND_CONN_TO_SESSION4->BIND_CONN_TO_SESSION4res_u.bctsr_resok4;
+	nfs41_session_t *session;
+	channel_dir_from_server4 dir;
+
+	resp->resop = NFS4_OP_BIND_CONN_TO_SESSION;
+	res_BIND_CONN_TO_SESSION4->bctsr_status = NFS4_OK;
+
+	if (data->minorversion == 0) {
+		res_BIND_CONN_TO_SESSION4->bctsr_status = NFS4ERR_INVAL;
+		return res_BIND_CONN_TO_SESSION4->bctsr_status;
+	}
+
+	if (!nfs41_Session_Get_Pointer(arg_BIND_CONN_TO_SESSION4->bctsa_sessid,
+				       &session)) {
+		res_BIND_CONN_TO_SESSION4->bctsr_status = NFS4ERR_BADSESSION;
+		return res_BIND_CONN_TO_SESSION4->bctsr_status;
+	}
+
+	/* A bind is a sign of life from the client, as a SEQUENCE is */
+	if (!reserve_lease(session->clientid_record)) {
+		dec_session_ref(session);
+		res_BIND_CONN_TO_SESSION4->bctsr_status = NFS4ERR_EXPIRED;
+		return res_BIND_CONN_TO_SESSION4->bctsr_status;
+	}
+
+	switch (arg_BIND_CONN_TO_SESSION4->bctsa_dir) {
+	case CDFC4_FORE:
+		dir = CDFS4_FORE;
+		break;
+	case CDFC4_BACK:
+		dir = CDFS4_BACK;
+		break;
+	case CDFC4_FORE_OR_BOTH:
+	case CDFC4_BACK_OR_BOTH:
+		dir = (session->flags & session_cb_sec) ? CDFS4_BOTH
+							: CDFS4_FORE;
+		break;
+	default:
+		res_BIND_CONN_TO_SESSION4->bctsr_status = NFS4ERR_INVAL;
+		goto out;
+	}
+
+	nfs41_session_bind_conn(session, data->req->rq_xprt, dir);
+
+	if ((dir & CDFS4_BACK) && (session->flags & session_cb_sec) &&
+	    !(session->flags & session_bc_up))
+		(void) nfs_rpc_create_chan_v41(session, 1,
+					       &session->cb_sec_parms);
+
+	if (isDebug(COMPONENT_SESSIONS)) {
+		char str[LOG_BUFF_LEN] = "\0";
+		struct display_buffer dspbuf = {sizeof(str), str, str};
+
+		display_session(&dspbuf, session);
+		LogDebug(COMPONENT_SESSIONS,
+			 "Bound connection %p to %s dir %d back channel %s",
+			 data->req->rq_xprt, str, dir,
+			 session->flags & session_bc_up ? "up" : "down");
+	}
+
+	memcpy(resok->bctsr_sessid, arg_BIND_CONN_TO_SESSION4->bctsa_sessid,
+	       sizeof(resok->bctsr_sessid));
+	resok->bctsr_dir = dir;
+	/* RDMA mode is not offered */
+	resok->bctsr_use_conn_in_rdma_mode = false;
+
+ out:
+	update_lease(session->clientid_record);
+
+	/* Release ref taken in get_pointer */
+	dec_session_ref(session);
+
+	return res_BIND_CONN_TO_SESSION4->bctsr_status;
+}				/* nfs4_op_bind_conn */
+
+/**
+ * @brief Free memory allocated for result of nfs4_op_bind_conn
+ *
+ * @param[in,out] resp  nfs4_op results
+ *
+ */
+void nfs4_op_bind_conn_Free(nfs_resop4 *resp)
+{
+	/* Nothing to be done */
+}
@@ -0,0 +1,505 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file nfs4_op_copy.c
+ * @brief NFSv4.2 server side COPY, CLONE and the OFFLOAD operations
+ *
+ * Only intra-server copies are supported, and every COPY is performed
+ * synchronously (RFC 7862 lets the server choose), so no copy stateid
+ * is ever handed out and OFFLOAD_STATUS/OFFLOAD_CANCEL have nothing to
+ * find.
+ */
+
+#include "config.h"
+#include "log.h"
+#include "fsal.h"
+#include "nfs_core.h"
+#include "sal_functions.h"
+#include "nfs_proto_functions.h"
+#include "nfs_proto_tools.h"
+#include "nfs_convert.h"
+#include "nfs_file_handle.h"
+#include "export_mgr.h"
+
+/**
+ * @brief One end (source or destination) of a COPY or CLONE
+ */
+struct copy_end {
+	struct fsal_obj_handle *obj;	/*< The file */
+	state_t *state;			/*< State from the stateid, ref'd */
+	int access;			/*< OPEN4_SHARE_ACCESS needed */
+	bool anonymous;			/*< Anonymous I/O was started */
+};
+
+/**
+ * @brief Check the stateid for one end of a copy
+ *
+ * On success, copy_end_done must be called on the end.
+ *
+ * @param[in,out] end      End to check, obj and access filled in
+ * @param[in]     stateid  Stateid the client passed for the end
+ * @param[in]     data     Compound request's data
+ * @param[in]     tag      Operation name for logging
+ *
+ * @return NFS4_OK or the error to return.
+ */
+
+static nfsstat4 copy_end_start(struct copy_end *end, stateid4 *stateid,
+			       compound_data_t *data, const char *tag)
+{
+	struct state_deleg *sdeleg;
+	state_t *state_open;
+	nfsstat4 status;
+
+	status = nfs4_Check_Stateid(stateid, end->obj, &end->state, data,
+				    STATEID_SPECIAL_ANY, 0, false, tag);
+
+	if (status != NFS4_OK)
+		return status;
+
+	if (end->state == NULL) {
+		/* Special stateid, check for share conflicts */
+		status = nfs4_Errno_state(
+			state_share_anonymous_io_start(end->obj, end->access,
+						       SHARE_BYPASS_NONE));
+
+		if (status == NFS4_OK)
+			end->anonymous = true;
+
+		return status;
+	}
+
+	switch (end->state->state_type) {
+	case STATE_TYPE_SHARE:
+		state_open = end->state;
+		break;
+
+	case STATE_TYPE_LOCK:
+		state_open = end->state->state_data.lock.openstate;
+		break;
+
+	case STATE_TYPE_DELEG:
+		sdeleg = &end->state->state_data.deleg;
+		if (sdeleg->sd_state != DELEG_GRANTED ||
+		    (end->access == OPEN4_SHARE_ACCESS_WRITE &&
+		     !(sdeleg->sd_type & OPEN_DELEGATE_WRITE))) {
+			LogDebug(COMPONENT_STATE,
+				 "%s delegation type:%d state:%d", tag,
+				 sdeleg->sd_type, sdeleg->sd_state);
+			return NFS4ERR_BAD_STATEID;
+		}
+		return NFS4_OK;
+
+	default:
+		LogDebug(COMPONENT_NFS_V4_LOCK,
+			 "%s with invalid stateid of type %d", tag,
+			 (int)end->state->state_type);
+		return NFS4ERR_BAD_STATEID;
+	}
+
+	if ((state_open->state_data.share.share_access & end->access) == 0) {
+		LogDebug(COMPONENT_NFS_V4_LOCK,
+			 "%s stateid not open for %s", tag,
+			 end->access == OPEN4_SHARE_ACCESS_READ
+				? "read" : "write");
+		return NFS4ERR_OPENMODE;
+	}
+
+	return NFS4_OK;
+}
+
+/**
+ * @brief Release what copy_end_start took
+ *
+ * @param[in] end  End to release
+ */
+
+static void copy_end_done(struct copy_end *end)
+{
+	if (end->anonymous)
+		state_share_anonymous_io_done(end->obj, end->access);
+
+	if (end->state != NULL)
+		dec_state_t_ref(end->state);
+}
+
+/**
+ * @brief Checks common to COPY and CLONE
+ *
+ * The source is the saved filehandle and the destination the current
+ * one; both must be regular files of the same export, and the ranges
+ * may not overlap within one file.
+ *
+ * @param[in] data        Compound request's data
+ * @param[in] src_offset  Start of source range
+ * @param[in] dst_offset  Start of destination range
+ * @param[in] count       Length of the ranges, 0 for to end of file
+ *
+ * @return NFS4_OK or the error to return.
+ */
+
+static nfsstat4 copy_check_args(compound_data_t *data, uint64_t src_offset,
+				uint64_t dst_offset, uint64_t count)
+{
+	nfsstat4 status;
+	uint64_t lo, hi;
+	uint64_t MaxOffsetWrite =
+		atomic_fetch_uint64_t(&op_ctx->ctx_export->MaxOffsetWrite);
+
+	if (data->minorversion < 2)
+		return NFS4ERR_NOTSUPP;
+
+	status = nfs4_sanity_check_saved_FH(data, REGULAR_FILE, false);
+	if (status != NFS4_OK)
+		return status;
+
+	status = nfs4_sanity_check_FH(data, REGULAR_FILE, false);
+	if (status != NFS4_OK)
+		return status;
+
+	if (data->saved_export != op_ctx->ctx_export)
+		return NFS4ERR_XDEV;
+
+	if (!data->current_obj->fsal->m_ops.support_ex(data->current_obj))
+		return NFS4ERR_NOTSUPP;
+
+	if (data->saved_obj == data->current_obj) {
+		lo = MIN(src_offset, dst_offset);
+		hi = MAX(src_offset, dst_offset);
+		if (count == 0 || hi - lo < count)
+			return NFS4ERR_INVAL;
+	}
+
+	if (MaxOffsetWrite < UINT64_MAX &&
+	    count != 0 && dst_offset + count > MaxOffsetWrite) {
+		LogEvent(COMPONENT_NFS_V4,
+			 "A client tried to copy past max file size %"
+			 PRIu64 " for exportid #%hu",
+			 MaxOffsetWrite, op_ctx->ctx_export->export_id);
+		return NFS4ERR_FBIG;
+	}
+
+	return NFS4_OK;
+}
+
+/**
+ * @brief Start both ends of a copy and check access to them
+ *
+ * @param[in,out] src   Source end, obj filled in
+ * @param[in]     src_stateid  Stateid for the source
+ * @param[in,out] dst   Destination end, obj filled in
+ * @param[in]     dst_stateid  Stateid for the destination
+ * @param[in]     data  Compound request's data
+ * @param[in]     tag   Operation name for logging
+ *
+ * @return NFS4_OK or the error to return.
+ */
+
+static nfsstat4 copy_start(struct copy_end *src, stateid4 *src_stateid,
+			   struct copy_end *dst, stateid4 *dst_stateid,
+			   compound_data_t *data, const char *tag)
+{
+	fsal_status_t fsal_status;
+	nfsstat4 status;
+
+	status = copy_end_start(src, src_stateid, data, tag);
+	if (status != NFS4_OK)
+		return status;
+
+	status = copy_end_start(dst, dst_stateid, data, tag);
+	if (status != NFS4_OK)
+		return status;
+
+	fsal_status = src->obj->obj_ops.test_access(src->obj,
+						    FSAL_READ_ACCESS,
+						    NULL, NULL, true);
+	if (FSAL_IS_ERROR(fsal_status))
+		return nfs4_Errno_status(fsal_status);
+
+	fsal_status = dst->obj->obj_ops.test_access(dst->obj,
+						    FSAL_WRITE_ACCESS,
+						    NULL, NULL, true);
+	if (FSAL_IS_ERROR(fsal_status))
+		return nfs4_Errno_status(fsal_status);
+
+	fsal_status = op_ctx->fsal_export->exp_ops.check_quota(
+						op_ctx->fsal_export,
+						op_ctx->ctx_export->fullpath,
+						FSAL_QUOTA_INODES);
+	if (FSAL_IS_ERROR(fsal_status))
+		return NFS4ERR_DQUOT;
+
+	return NFS4_OK;
+}
+
+/**
+ * @brief The NFS4_OP_COPY operation
+ *
+ * This functions handles the NFS4_OP_COPY operation in NFSv4.2. This
+ * function can be called only from nfs4_Compound.
+ *
+ * @param[in]     op    Arguments for nfs4_op
+ * @param[in,out] data  Compound request's data
+ * @param[out]    resp  Results for nfs4_op
+ *
+ * @return per RFC7862
+ */
+
+int nfs4_op_copy(struct nfs_argop4 *op, compound_data_t *data,
+		 struct nfs_resop4 *resp)
+{
+	COPY4args * const arg_COPY = &op->nfs_argop4_u.opcopy;
+	COPY4res * const res_COPY = &resp->nfs_resop4_u.opcopy;
+	COPY4resok *resok = &res_COPY->COPY4res_u.cr_resok4;
+	struct copy_end src = {
+		.access = OPEN4_SHARE_ACCESS_READ,
+	};
+	struct copy_end dst = {
+		.access = OPEN4_SHARE_ACCESS_WRITE,
+	};
+	struct gsh_buffdesc verf_desc;
+	fsal_status_t fsal_status;
+	uint64_t copied = 0;
+
+	resp->resop = NFS4_OP_COPY;
+
+	res_COPY->cr_status = copy_check_args(data, arg_COPY->ca_src_offset,
+					      arg_COPY->ca_dst_offset,
+					      arg_COPY->ca_count);
+	if (res_COPY->cr_status != NFS4_OK)
+		return res_COPY->cr_status;
+
+	if (arg_COPY->ca_source_server.ca_source_server_len != 0) {
+		/* Inter-server copy */
+		res_COPY->cr_status = NFS4ERR_NOTSUPP;
+		return res_COPY->cr_status;
+	}
+
+	src.obj = data->saved_obj;
+	dst.obj = data->current_obj;
+
+	res_COPY->cr_status = copy_start(&src, &arg_COPY->ca_src_stateid,
+					 &dst, &arg_COPY->ca_dst_stateid,
+					 data, "COPY");
+	if (res_COPY->cr_status != NFS4_OK)
+		goto out;
+
+	LogFullDebug(COMPONENT_NFS_V4,
+		     "src_offset = %" PRIu64 " dst_offset = %" PRIu64
+		     " count = %" PRIu64, arg_COPY->ca_src_offset,
+		     arg_COPY->ca_dst_offset, arg_COPY->ca_count);
+
+	fsal_status = fsal_copy(dst.obj, dst.state, arg_COPY->ca_dst_offset,
+				src.obj, src.state, arg_COPY->ca_src_offset,
+				arg_COPY->ca_count, &copied);
+
+	if (FSAL_IS_ERROR(fsal_status)) {
+		LogDebug(COMPONENT_NFS_V4, "copy returned %s",
+			 fsal_err_txt(fsal_status));
+		res_COPY->cr_status = nfs4_Errno_status(fsal_status);
+		goto out;
+	}
+
+	/* Done synchronously, so there is no callback stateid */
+	resok->cr_response.wr_ids = 0;
+	resok->cr_response.wr_count = copied;
+	resok->cr_response.wr_committed = UNSTABLE4;
+
+	verf_desc.addr = resok->cr_response.wr_writeverf;
+	verf_desc.len = sizeof(verifier4);
+	op_ctx->fsal_export->exp_ops.get_write_verifier(op_ctx->fsal_export,
+							&verf_desc);
+
+	resok->cr_requirements.cr_consecutive = true;
+	resok->cr_requirements.cr_synchronous = true;
+
+ out:
+
+	copy_end_done(&dst);
+	copy_end_done(&src);
+
+	return res_COPY->cr_status;
+}
+
+/**
+ * @brief Free memory allocated for COPY result
+ *
+ * @param[in,out] resp  nfs4_op results
+ */
+
+void nfs4_op_copy_Free(nfs_resop4 *resp)
+{
+	/* Nothing to be done */
+}
+
+/**
+ * @brief The NFS4_OP_CLONE operation
+ *
+ * This functions handles the NFS4_OP_CLONE operation in NFSv4.2. This
+ * function can be called only from nfs4_Compound.
+ *
+ * @param[in]     op    Arguments for nfs4_op
+ * @param[in,out] data  Compound request's data
+ * @param[out]    resp  Results for nfs4_op
+ *
+ * @return per RFC7862
+ */
+
+int nfs4_op_clone(struct nfs_argop4 *op, compound_data_t *data,
+		  struct nfs_resop4 *resp)
+{
+	CLONE4args * const arg_CLONE = &op->nfs_argop4_u.opclone;
+	CLONE4res * const res_CLONE = &resp->nfs_resop4_u.opclone;
+	struct copy_end src = {
+		.access = OPEN4_SHARE_ACCESS_READ,
+	};
+	struct copy_end dst = {
+		.access = OPEN4_SHARE_ACCESS_WRITE,
+	};
+	fsal_status_t fsal_status;
+
+	resp->resop = NFS4_OP_CLONE;
+
+	res_CLONE->cl_status = copy_check_args(data, arg_CLONE->cl_src_offset,
+					       arg_CLONE->cl_dst_offset,
+					       arg_CLONE->cl_count);
+	if (res_CLONE->cl_status != NFS4_OK)
+		return res_CLONE->cl_status;
+
+	src.obj = data->saved_obj;
+	dst.obj = data->current_obj;
+
+	res_CLONE->cl_status = copy_start(&src, &arg_CLONE->cl_src_stateid,
+					  &dst, &arg_CLONE->cl_dst_stateid,
+					  data, "CLONE");
+	if (res_CLONE->cl_status != NFS4_OK)
+		goto out;
+
+	fsal_status = dst.obj->obj_ops.clone(dst.obj, dst.state,
+					     arg_CLONE->cl_dst_offset,
+					     src.obj, src.state,
+					     arg_CLONE->cl_src_offset,
+					     arg_CLONE->cl_count);
+
+	if (FSAL_IS_ERROR(fsal_status)) {
+		LogDebug(COMPONENT_NFS_V4, "clone returned %s",
+			 fsal_err_txt(fsal_status));
+		res_CLONE->cl_status = nfs4_Errno_status(fsal_status);
+	}
+
+ out:
+
+	copy_end_done(&dst);
+	copy_end_done(&src);
+
+	return res_CLONE->cl_status;
+}
+
+/**
+ * @brief Free memory allocated for CLONE result
+ *
+ * @param[in,out] resp  nfs4_op results
+ */
+
+void nfs4_op_clone_Free(nfs_resop4 *resp)
+{
+	/* Nothing to be done */
+}
+
+/**
+ * @brief The NFS4_OP_OFFLOAD_STATUS operation
+ *
+ * No copy is ever left running after its COPY returns, so no stateid
+ * can name one.
+ *
+ * @param[in]     op    Arguments for nfs4_op
+ * @param[in,out] data  Compound request's data
+ * @param[out]    resp  Results for nfs4_op
+ *
+ * @return per RFC7862
+ */
+
+int nfs4_op_offload_status(struct nfs_argop4 *op, compound_data_t *data,
+			   struct nfs_resop4 *resp)
+{
+	OFFLOAD_STATUS4res * const res_OFFLOAD_STATUS =
+		&resp->nfs_resop4_u.opoffload_status;
+
+	resp->resop = NFS4_OP_OFFLOAD_STATUS;
+
+	if (data->minorversion < 2)
+		res_OFFLOAD_STATUS->osr_status = NFS4ERR_NOTSUPP;
+	else
+		res_OFFLOAD_STATUS->osr_status = NFS4ERR_BAD_STATEID;
+
+	return res_OFFLOAD_STATUS->osr_status;
+}
+
+/**
+ * @brief Free memory allocated for OFFLOAD_STATUS result
+ *
+ * @param[in,out] resp  nfs4_op results
+ */
+
+void nfs4_op_offload_status_Free(nfs_resop4 *resp)
+{
+	/* Nothing to be done */
+}
+
+/**
+ * @brief The NFS4_OP_OFFLOAD_CANCEL operation
+ *
+ * As OFFLOAD_STATUS, there is never an asynchronous copy to cancel.
+ *
+ * @param[in]     op    Arguments for nfs4_op
+ * @param[in,out] data  Compound request's data
+ * @param[out]    resp  Results for nfs4_op
+ *
+ * @return per RFC7862
+ */
+
+int nfs4_op_offload_cancel(struct nfs_argop4 *op, compound_data_t *data,
+			   struct nfs_resop4 *resp)
+{
+	OFFLOAD_CANCEL4res * const res_OFFLOAD_CANCEL =
+		&resp->nfs_resop4_u.opoffload_cancel;
+
+	resp->resop = NFS4_OP_OFFLOAD_CANCEL;
+
+	if (data->minorversion < 2)
+		res_OFFLOAD_CANCEL->ocr_status = NFS4ERR_NOTSUPP;
+	else
+		res_OFFLOAD_CANCEL->ocr_status = NFS4ERR_BAD_STATEID;
+
+	return res_OFFLOAD_CANCEL->ocr_status;
+}
+
+/**
+ * @brief Free memory allocated for OFFLOAD_CANCEL result
+ *
+ * @param[in,out] resp  nfs4_op results
+ */
+
+void nfs4_op_offload_cancel_Free(nfs_resop4 *resp)
+{
+	/* Nothing to be done */
+}
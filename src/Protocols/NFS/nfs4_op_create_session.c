@@ -32,6 +32,7 @@
 #include "config.h"
 #include <pthread.h>
 #include <assert.h>
+#include <sys/param.h>
 #include "log.h"
 #include "nfs4.h"
 #include "nfs_core.h"
@@ -87,6 +88,7 @@ int nfs4_op_create_session(struct nfs_argop4 *op, compound_data_t *data,
 		sizeof(str_clientid4), str_clientid4, str_clientid4};
 	/* Return code from clientid calls */
 	int i, rc = 0;
+	uint32_t nslots;
 	/* Component for logging */
 	log_components_t component = COMPONENT_CLIENTID;
 	/* Abbreviated alias for arguments */
@@ -280,6 +282,12 @@ int nfs4_op_create_session(struct nfs_argop4 *op, compound_data_t *data,
 		goto out;
 	}
 
+	/* A client at Max_Sessions_Per_Client waits for one to go */
+	if (nfs4_client_at_limit(found, CLIENT_LIMIT_SESSIONS)) {
+		res_CREATE_SESSION4->csr_status = NFS4ERR_DELAY;
+		goto out;
+	}
+
 	/* Record session related information at the right place */
 	nfs41_session = pool_alloc(nfs41_session_pool);
 
@@ -296,12 +304,28 @@ int nfs4_op_create_session(struct nfs_argop4 *op, compound_data_t *data,
 	    arg_CREATE_SESSION4->csa_fore_chan_attrs;
 	nfs41_session->back_channel_attrs =
 	    arg_CREATE_SESSION4->csa_back_chan_attrs;
-	nfs41_session->xprt = data->req->rq_xprt;
 	nfs41_session->flags = false;
-	nfs41_session->cb_program = 0;
+	nfs41_session->cb_program = arg_CREATE_SESSION4->csa_cb_program;
+	memset(&nfs41_session->cb_sec_parms, 0,
+	       sizeof(nfs41_session->cb_sec_parms));
+	PTHREAD_MUTEX_init(&nfs41_session->conn_mutex, NULL);
+	glist_init(&nfs41_session->conns);
+	nfs41_session->num_conns = 0;
 	PTHREAD_MUTEX_init(&nfs41_session->cb_mutex, NULL);
 	PTHREAD_COND_init(&nfs41_session->cb_cond, NULL);
-	for (i = 0; i < NFS41_NB_SLOTS; i++)
+	PTHREAD_MUTEX_init(&nfs41_session->cb_chan.mtx, NULL);
+	PTHREAD_COND_init(&nfs41_session->cb_chan.cv, NULL);
+
+	/* Size the slot table from what the client asked for */
+	nslots = MIN(arg_CREATE_SESSION4->csa_fore_chan_attrs.ca_maxrequests,
+		     nfs_param.nfsv4_param.max_slots);
+	if (nslots == 0)
+		nslots = 1;
+	nfs41_session->fore_channel_attrs.ca_maxrequests = nslots;
+	nfs41_session->target_slots = MIN(nslots, NFS41_NB_SLOTS);
+	nfs41_session->slots = gsh_calloc(nslots,
+					  sizeof(nfs41_session_slot_t));
+	for (i = 0; i < nslots; i++)
 		PTHREAD_MUTEX_init(&nfs41_session->slots[i].lock, NULL);
 
 	/* Take reference to clientid record on behalf the session. */
@@ -311,10 +335,9 @@ int nfs4_op_create_session(struct nfs_argop4 *op, compound_data_t *data,
 	PTHREAD_MUTEX_lock(&found->cid_mutex);
 	glist_add(&found->cid_cb.v41.cb_session_list,
 		  &nfs41_session->session_link);
+	(void) atomic_inc_uint32_t(&found->cid_nb_session);
 	PTHREAD_MUTEX_unlock(&found->cid_mutex);
 
-	/* Set ca_maxrequests */
-	nfs41_session->fore_channel_attrs.ca_maxrequests = NFS41_NB_SLOTS;
 	nfs41_Build_sessionid(&clientid, nfs41_session->session_id);
 
 	res_CREATE_SESSION4ok->csr_sequence = arg_CREATE_SESSION4->csa_sequence;
@@ -457,7 +480,7 @@ int nfs4_op_create_session(struct nfs_argop4 *op, compound_data_t *data,
 	conf->cid_create_session_sequence++;
 
 	/* Bump the lease timer */
-	conf->cid_last_renew = time(NULL);
+	renew_lease(conf);
 
 	if (isFullDebug(component)) {
 		char str[LOG_BUFF_LEN] = "\0";
@@ -471,11 +494,23 @@ int nfs4_op_create_session(struct nfs_argop4 *op, compound_data_t *data,
 			     client_record->cr_unconfirmed_rec);
 	}
 
+	/* The connection this came in on is the session's first.  Keep
+	 * the callback security so a back channel can be set up later on
+	 * a connection bound with BIND_CONN_TO_SESSION.
+	 */
+	nfs41_session_bind_conn(nfs41_session, data->req->rq_xprt,
+				(arg_CREATE_SESSION4->csa_flags &
+				 CREATE_SESSION4_FLAG_CONN_BACK_CHAN)
+					? CDFS4_BOTH : CDFS4_FORE);
+	nfs41_session_save_cb_sec(
+		nfs41_session,
+		arg_CREATE_SESSION4->csa_sec_parms.csa_sec_parms_len,
+		arg_CREATE_SESSION4->csa_sec_parms.csa_sec_parms_val);
+
 	/* Handle the creation of the back channel, if the client
 	   requested one. */
 	if (arg_CREATE_SESSION4->csa_flags &
 	    CREATE_SESSION4_FLAG_CONN_BACK_CHAN) {
-		nfs41_session->cb_program = arg_CREATE_SESSION4->csa_cb_program;
 		if (nfs_rpc_create_chan_v41(
 			nfs41_session,
 			arg_CREATE_SESSION4->csa_sec_parms.csa_sec_parms_len,
@@ -78,15 +78,18 @@ int nfs4_op_delegreturn(struct nfs_argop4 *op, compound_data_t *data,
 	resp->resop = NFS4_OP_DELEGRETURN;
 
 	/* If the filehandle is invalid. Delegations are only supported on
-	 * regular files at the moment.
+	 * regular files and directories.
 	 */
 	res_DELEGRETURN4->status = nfs4_sanity_check_FH(data,
-							REGULAR_FILE,
+							NO_FILE_TYPE,
 							false);
 
-	if (res_DELEGRETURN4->status != NFS4_OK) {
-		if (res_DELEGRETURN4->status == NFS4ERR_ISDIR)
-			res_DELEGRETURN4->status = NFS4ERR_INVAL;
+	if (res_DELEGRETURN4->status != NFS4_OK)
+		return res_DELEGRETURN4->status;
+
+	if (data->current_obj->type != REGULAR_FILE &&
+	    data->current_obj->type != DIRECTORY) {
+		res_DELEGRETURN4->status = NFS4ERR_INVAL;
 		return res_DELEGRETURN4->status;
 	}
 
@@ -121,9 +124,13 @@ int nfs4_op_delegreturn(struct nfs_argop4 *op, compound_data_t *data,
 	PTHREAD_RWLOCK_wrlock(&data->current_obj->state_hdl->state_lock);
 	/* Now we have a lock owner and a stateid.
 	 * Go ahead and push unlock into SAL (and FSAL) to return
-	 * the delegation.
+	 * the delegation. Directory delegations never reach the FSAL.
 	 */
-	state_status = release_lease_lock(data->current_obj, state_found);
+	if (data->current_obj->type == DIRECTORY)
+		state_status = STATE_SUCCESS;
+	else
+		state_status = release_lease_lock(data->current_obj,
+						  state_found);
 
 	res_DELEGRETURN4->status = nfs4_Errno_state(state_status);
 
@@ -31,6 +31,9 @@
 
 #include "config.h"
 #include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
 #include "log.h"
 #include "fsal.h"
 #include "nfs_core.h"
@@ -65,6 +68,33 @@ int get_raddr(SVCXPRT *xprt)
 	return addr;
 }
 
+/** Server owner and scope, the same in every reply */
+static char server_owner[MAXNAMLEN + 1]; /* max hostname length */
+static char server_scope[MAXNAMLEN + sizeof("_NFS-Ganesha")];
+static int server_owner_len, server_scope_len;
+static pthread_once_t server_owner_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Look the host name up once instead of on every EXCHANGE_ID
+ *
+ * A reconnect storm sends thousands of these in a few seconds.
+ */
+static void server_owner_init(void)
+{
+	if (gethostname(server_owner, sizeof(server_owner)) == -1) {
+		LogCrit(COMPONENT_CLIENTID, "gethostname failed: %s",
+			strerror(errno));
+		return;
+	}
+
+	server_owner[sizeof(server_owner) - 1] = '\0';
+	server_owner_len = strlen(server_owner);
+
+	/* The scope length counts the NUL, as it always has */
+	server_scope_len = snprintf(server_scope, sizeof(server_scope),
+				    "%s_NFS-Ganesha", server_owner) + 1;
+}
+
 /**
  * @brief The NFS4_OP_EXCHANGE_ID operation
  *
@@ -85,13 +115,10 @@ int nfs4_op_exchange_id(struct nfs_argop4 *op, compound_data_t *data,
 	nfs_client_id_t *conf;
 	nfs_client_id_t *unconf;
 	int rc;
-	int owner_len, scope_len;
 	char *temp;
 	bool update;
 	uint32_t pnfs_flags;
 	in_addr_t server_addr = 0;
-	char cid_server_owner[MAXNAMLEN+1]; /* max hostname length */
-	const char cid_server_scope_suffix[] = "_NFS-Ganesha";
 	/* Arguments and response */
 	EXCHANGE_ID4args * const arg_EXCHANGE_ID4 =
 	    &op->nfs_argop4_u.opexchange_id;
@@ -117,6 +144,10 @@ int nfs4_op_exchange_id(struct nfs_argop4 *op, compound_data_t *data,
 
 	/* If client did not ask for pNFS related server roles than just set
 	   server roles */
+	(void) pthread_once(&server_owner_once, server_owner_init);
+	if (server_owner_len == 0)
+		return res_EXCHANGE_ID4->eir_status = NFS4ERR_SERVERFAULT;
+
 	pnfs_flags = arg_EXCHANGE_ID4->eia_flags & EXCHGID4_FLAG_MASK_PNFS;
 	if (pnfs_flags == 0) {
 		if (nfs_param.nfsv4_param.pnfs_mds)
@@ -313,15 +344,7 @@ int nfs4_op_exchange_id(struct nfs_argop4 *op, compound_data_t *data,
 	       arg_EXCHANGE_ID4->eia_clientowner.co_verifier,
 	       NFS4_VERIFIER_SIZE);
 
-	if (gethostname(cid_server_owner,
-			sizeof(cid_server_owner)) == -1) {
-		/* Free the clientid record and return */
-		free_client_id(unconf);
-		res_EXCHANGE_ID4->eir_status = NFS4ERR_SERVERFAULT;
-		goto out;
-	}
-
-	LogDebug(COMPONENT_CLIENTID, "Serving IP %s", cid_server_owner);
+	LogDebug(COMPONENT_CLIENTID, "Serving IP %s", server_owner);
 
 	rc = nfs_client_id_insert(unconf);
 
@@ -345,24 +368,21 @@ int nfs4_op_exchange_id(struct nfs_argop4 *op, compound_data_t *data,
 
 	res_EXCHANGE_ID4_ok->eir_state_protect.spr_how = SP4_NONE;
 
-	owner_len = strlen(cid_server_owner);
-	temp = gsh_malloc(owner_len + 1);
-	memcpy(temp, cid_server_owner, owner_len + 1);
+	temp = gsh_malloc(server_owner_len + 1);
+	memcpy(temp, server_owner, server_owner_len + 1);
 
 	res_EXCHANGE_ID4_ok->eir_server_owner.so_major_id.so_major_id_len =
-	    owner_len;
+	    server_owner_len;
 	res_EXCHANGE_ID4_ok->eir_server_owner.so_major_id.so_major_id_val =
 	    temp;
 
 	res_EXCHANGE_ID4_ok->eir_server_owner.so_minor_id = 0;
 
-	scope_len = strlen(cid_server_scope_suffix);
-	temp = gsh_malloc(owner_len + scope_len + 1);
-	memcpy(temp, cid_server_owner, owner_len);
-	memcpy(temp + owner_len, cid_server_scope_suffix, scope_len + 1);
+	temp = gsh_malloc(server_scope_len);
+	memcpy(temp, server_scope, server_scope_len);
 
 	res_EXCHANGE_ID4_ok->eir_server_scope.eir_server_scope_len =
-	    owner_len + scope_len + 1;
+	    server_scope_len;
 	res_EXCHANGE_ID4_ok->eir_server_scope.eir_server_scope_val = temp;
 
 	res_EXCHANGE_ID4_ok->eir_server_impl_id.eir_server_impl_id_len = 0;
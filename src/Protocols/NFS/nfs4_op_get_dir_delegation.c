@@ -0,0 +1,197 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file    nfs4_op_get_dir_delegation.c
+ * @brief   Routines used for managing the NFS4 COMPOUND functions.
+ *
+ * Directory delegations let a client cache a directory's entries.
+ * Changes made through this server either reach the holder as a
+ * CB_NOTIFY, for the entry notifications it asked for, or recall the
+ * delegation.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "log.h"
+#include "gsh_rpc.h"
+#include "nfs4.h"
+#include "nfs_core.h"
+#include "nfs_exports.h"
+#include "sal_functions.h"
+#include "nfs_proto_functions.h"
+#include "nfs_proto_tools.h"
+#include "server_stats.h"
+
+/** The notifications we can send, entry changes without attributes */
+#define DIR_DELEG_NOTIFY ((1U << NOTIFY4_REMOVE_ENTRY) | \
+			  (1U << NOTIFY4_ADD_ENTRY) | \
+			  (1U << NOTIFY4_RENAME_ENTRY))
+
+/**
+ * @brief Find the delegation a client already holds on a directory
+ *
+ * @note The state_lock MUST be held
+ */
+static state_t *find_dir_deleg(struct state_hdl *ostate,
+			       state_owner_t *clientowner)
+{
+	struct glist_head *glist;
+	state_t *state;
+
+	glist_for_each(glist, &ostate->dir.dir_delegations) {
+		state = glist_entry(glist, state_t, state_list);
+
+		if (state->state_owner == clientowner &&
+		    state->state_data.deleg.sd_state == DELEG_GRANTED)
+			return state;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief The NFS4_OP_GET_DIR_DELEGATION operation.
+ *
+ * Anything keeping us from delegating is reported as GDD4_UNAVAIL, which
+ * is not an error for the compound.  We never promise to signal when a
+ * delegation becomes available.
+ *
+ * @param[in]     op    Arguments for nfs4_op
+ * @param[in,out] data  Compound request's data
+ * @param[out]    resp  Results for nfs4_op
+ *
+ * @return per RFC5661, p. 377
+ */
+int nfs4_op_get_dir_delegation(struct nfs_argop4 *op, compound_data_t *data,
+			       struct nfs_resop4 *resp)
+{
+	GET_DIR_DELEGATION4args * const arg_GDD4 =
+	    &op->nfs_argop4_u.opget_dir_delegation;
+	GET_DIR_DELEGATION4res * const res_GDD4 =
+	    &resp->nfs_resop4_u.opget_dir_delegation;
+	GET_DIR_DELEGATION4res_non_fatal *non_fatal =
+	    &res_GDD4->GET_DIR_DELEGATION4res_u.gddr_res_non_fatal4;
+	GET_DIR_DELEGATION4resok *resok =
+	    &non_fatal->GET_DIR_DELEGATION4res_non_fatal_u.gddrnf_resok4;
+	nfs_client_id_t *client;
+	state_owner_t *clientowner;
+	union state_data state_data;
+	struct state_refer refer;
+	struct state_hdl *ostate;
+	state_status_t state_status;
+	state_t *state;
+	uint32_t notify = 0;
+	bool added = false;
+
+	resp->resop = NFS4_OP_GET_DIR_DELEGATION;
+
+	res_GDD4->gddr_status = nfs4_sanity_check_FH(data, DIRECTORY, false);
+
+	if (res_GDD4->gddr_status != NFS4_OK)
+		return res_GDD4->gddr_status;
+
+	non_fatal->gddrnf_status = GDD4_UNAVAIL;
+	non_fatal->GET_DIR_DELEGATION4res_non_fatal_u.
+		gddrnf_will_signal_deleg_avail = false;
+
+	ostate = data->current_obj->state_hdl;
+	client = data->session->clientid_record;
+	clientowner = &client->cid_owner;
+
+	if (ostate == NULL ||
+	    !nfs_param.nfsv4_param.allow_delegations ||
+	    !(op_ctx->export_perms->options & EXPORT_OPTION_READ_DELEG) ||
+	    !op_ctx->fsal_export->exp_ops.fs_supports(op_ctx->fsal_export,
+						      fso_delegations_r) ||
+	    !(data->session->flags & session_bc_up)) {
+		LogFullDebug(COMPONENT_STATE,
+			     "Directory delegation not available");
+		return res_GDD4->gddr_status;
+	}
+
+	if (arg_GDD4->gdda_notification_types.bitmap4_len > 0)
+		notify = arg_GDD4->gdda_notification_types.map[0] &
+			 DIR_DELEG_NOTIFY;
+
+	PTHREAD_RWLOCK_wrlock(&ostate->state_lock);
+
+	state = find_dir_deleg(ostate, clientowner);
+
+	if (state == NULL) {
+		memcpy(refer.session, data->session->session_id,
+		       sizeof(sessionid4));
+		refer.sequence = data->sequence;
+		refer.slot = data->slot;
+
+		init_new_deleg_state(&state_data, OPEN_DELEGATE_READ, client);
+
+		state_status = state_add_impl(data->current_obj,
+					      STATE_TYPE_DELEG, &state_data,
+					      clientowner, &state, &refer);
+
+		if (state_status != STATE_SUCCESS) {
+			PTHREAD_RWLOCK_unlock(&ostate->state_lock);
+			LogDebug(COMPONENT_STATE,
+				 "Could not add directory delegation: %s",
+				 state_err_str(state_status));
+			return res_GDD4->gddr_status;
+		}
+
+		inc_grants(client->gsh_client);
+		client->curr_deleg_grants++;
+		added = true;
+	}
+
+	state->state_data.deleg.sd_notify = notify;
+	state->state_seqid++;
+
+	non_fatal->gddrnf_status = GDD4_OK;
+	memset(resok->gddr_cookieverf, 0, sizeof(resok->gddr_cookieverf));
+	COPY_STATEID(&resok->gddr_stateid, state);
+	resok->gddr_notification.bitmap4_len = 1;
+	resok->gddr_notification.map[0] = notify;
+	resok->gddr_child_attributes.bitmap4_len = 0;
+	resok->gddr_dir_attributes.bitmap4_len = 0;
+
+	PTHREAD_RWLOCK_unlock(&ostate->state_lock);
+
+	/* Drop the reference state_add_impl returned */
+	if (added)
+		dec_state_t_ref(state);
+
+	LogFullDebug(COMPONENT_STATE,
+		     "Granted directory delegation, notifications %x",
+		     notify);
+
+	return res_GDD4->gddr_status;
+}
+
+/**
+ * @brief Free memory allocated for GET_DIR_DELEGATION result
+ *
+ * @param[in,out] resp nfs4_op results
+ */
+void nfs4_op_get_dir_delegation_Free(nfs_resop4 *resp)
+{
+	/* Nothing to be done */
+}
@@ -528,6 +528,9 @@ int nfs4_op_layouterror(struct nfs_argop4 *op, compound_data_t *data,
 	/* Convenience alias for response */
 	LAYOUTERROR4res * const res_LAYOUTERROR4 =
 					&resp->nfs_resop4_u.oplayouterror;
+	/* Overlay Ganesha's pnfs_deviceid on arg */
+	struct pnfs_deviceid *deviceid = (struct pnfs_deviceid *)
+				arg_LAYOUTERROR4->lea_errors.de_deviceid;
 	/* NFSv4.2 status code */
 	nfsstat4 nfs_status = 0;
 
@@ -539,7 +542,15 @@ int nfs4_op_layouterror(struct nfs_argop4 *op, compound_data_t *data,
 		 arg_LAYOUTERROR4->lea_offset,
 		 arg_LAYOUTERROR4->lea_length);
 
-	/** @todo: what else do we want to do with this error ???  */
+	/* Let the FSAL owning the device know */
+	if (deviceid->fsal_id < FSAL_ID_COUNT &&
+	    pnfs_fsal[deviceid->fsal_id] != NULL) {
+		struct fsal_module *fsal = pnfs_fsal[deviceid->fsal_id];
+
+		fsal->m_ops.device_error(fsal, deviceid,
+					 arg_LAYOUTERROR4->lea_errors.de_status,
+					 arg_LAYOUTERROR4->lea_errors.de_opnum);
+	}
 
 	res_LAYOUTERROR4->ler_status = nfs_status;
 
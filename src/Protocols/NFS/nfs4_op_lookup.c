@@ -88,7 +88,7 @@ int nfs4_op_lookup(struct nfs_argop4 *op, compound_data_t *data,
 	}
 
 	/* Validate and convert the UFT8 objname to a regular string */
-	res_LOOKUP4->status = nfs4_utf8string2dynamic(&arg_LOOKUP4->objname,
+	res_LOOKUP4->status = nfs4_utf8string2scratch(&arg_LOOKUP4->objname,
 						      UTF8_SCAN_ALL,
 						      &name);
 
@@ -231,7 +231,7 @@ int nfs4_op_lookup(struct nfs_argop4 *op, compound_data_t *data,
 	if (file_obj)
 		file_obj->obj_ops.put_ref(file_obj);
 
-	gsh_free(name);
+	nfs4_free_scratch(name);
 
 	return res_LOOKUP4->status;
 }				/* nfs4_op_lookup */
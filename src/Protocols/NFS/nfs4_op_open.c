@@ -1043,6 +1043,9 @@ static void do_delegation(OPEN4args *arg_OPEN4, OPEN4res *res_OPEN4,
 	/* This will be updated later if we actually delegate */
 	resok->delegation.delegation_type = OPEN_DELEGATE_NONE;
 
+	/* Record how the file is used, whether we delegate or not */
+	deleg_heuristics_open(ostate, clientid, arg_OPEN4->share_access);
+
 	/* Client doesn't want a delegation. */
 	if (arg_OPEN4->share_access & OPEN4_SHARE_ACCESS_WANT_NO_DELEG) {
 		resok->delegation.open_delegation4_u.
@@ -1062,11 +1065,6 @@ static void do_delegation(OPEN4args *arg_OPEN4, OPEN4res *res_OPEN4,
 	if (can_we_grant_deleg(ostate, open_state) &&
 	    should_we_grant_deleg(ostate, clientid, open_state,
 				  arg_OPEN4, owner, &prerecall)) {
-		/* Update delegation open stats */
-		if (ostate->file.fdeleg_stats.fds_num_opens == 0)
-			ostate->file.fdeleg_stats.fds_first_open = time(NULL);
-		ostate->file.fdeleg_stats.fds_num_opens++;
-
 		LogDebug(COMPONENT_STATE, "Attempting to grant delegation");
 		get_delegation(data, arg_OPEN4, open_state, owner, clientid,
 			       resok, prerecall);
@@ -1773,17 +1771,12 @@ int nfs4_op_open(struct nfs_argop4 *op, compound_data_t *data,
 	}
 
 	/* Check if lease is expired and reserve it */
-	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
-
 	if (data->minorversion == 0 && !reserve_lease(clientid)) {
-		PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
 		res_OPEN4->status = NFS4ERR_EXPIRED;
 		LogDebug(COMPONENT_NFS_V4, "Lease expired");
 		goto out3;
 	}
 
-	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
-
 	/* Get the open owner */
 	if (!open4_open_owner(op, data, resp, clientid, &owner)) {
 		LogDebug(COMPONENT_NFS_V4, "open4_open_owner failed");
@@ -2025,11 +2018,8 @@ int nfs4_op_open(struct nfs_argop4 *op, compound_data_t *data,
  out2:
 
 	/* Update the lease before exit */
-	if (data->minorversion == 0) {
-		PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+	if (data->minorversion == 0)
 		update_lease(clientid);
-		PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
-	}
 
 	if (file_state != NULL)
 		dec_state_t_ref(file_state);
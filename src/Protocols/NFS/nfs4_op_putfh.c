@@ -139,6 +139,7 @@ static int nfs4_mds_putfh(compound_data_t *data)
 	struct fsal_obj_handle *new_hdl;
 	fsal_status_t fsal_status = { 0, 0 };
 	bool changed = true;
+	uint64_t key_hash;
 
 	LogFullDebug(COMPONENT_FILEHANDLE,
 		     "NFS4 Handle flags 0x%X export id %d",
@@ -208,8 +209,13 @@ static int nfs4_mds_putfh(compound_data_t *data)
 		return nfs4_Errno_status(fsal_status);
 	}
 
+	if (nfs_fh_get_key_hash(v4_handle->fhflags1, v4_handle->fsopaque,
+				v4_handle->fs_len, &key_hash))
+		op_ctx->fh_key_hash = &key_hash;
+
 	fsal_status = export->exp_ops.create_handle(export, &fh_desc,
 						    &new_hdl, NULL);
+	op_ctx->fh_key_hash = NULL;
 	if (FSAL_IS_ERROR(fsal_status)) {
 		LogDebug(COMPONENT_FILEHANDLE,
 			 "could not get create_handle object error %s",
@@ -264,7 +270,7 @@ int nfs4_op_putfh(struct nfs_argop4 *op, compound_data_t *data,
 
 	/* If no currentFH were set, allocate one */
 	if (data->currentFH.nfs_fh4_val == NULL)
-		nfs4_AllocateFH(&data->currentFH);
+		nfs4_AllocateScratchFH(&data->currentFH);
 
 	/* Copy the filehandle from the arg structure */
 	data->currentFH.nfs_fh4_len = arg_PUTFH4->object.nfs_fh4_len;
@@ -47,6 +47,7 @@
 #include "fsal_pnfs.h"
 #include "server_stats.h"
 #include "export_mgr.h"
+#include "iobuf_pool.h"
 
 /**
  * @brief Read on a pNFS pNFS data server
@@ -86,7 +87,7 @@ static int op_dsread(struct nfs_argop4 *op, compound_data_t *data,
 
 	/* Construct the FSAL file handle */
 
-	buffer = gsh_malloc_aligned(4096, arg_READ4->count);
+	buffer = iobuf_get(arg_READ4->count);
 
 	res_READ4->READ4res_u.resok4.data.data_val = buffer;
 
@@ -101,7 +102,7 @@ static int op_dsread(struct nfs_argop4 *op, compound_data_t *data,
 				&eof);
 
 	if (nfs_status != NFS4_OK) {
-		gsh_free(buffer);
+		iobuf_put(buffer);
 		res_READ4->READ4res_u.resok4.data.data_val = NULL;
 	}
 
@@ -157,7 +158,7 @@ static int op_dsread_plus(struct nfs_argop4 *op, compound_data_t *data,
 
 	/* Construct the FSAL file handle */
 
-	buffer = gsh_malloc_aligned(4096, arg_READ4->count);
+	buffer = iobuf_get(arg_READ4->count);
 
 	nfs_status = data->current_ds->dsh_ops.read_plus(
 				data->current_ds,
@@ -171,7 +172,7 @@ static int op_dsread_plus(struct nfs_argop4 *op, compound_data_t *data,
 
 	res_RPLUS->rpr_status = nfs_status;
 	if (nfs_status != NFS4_OK) {
-		gsh_free(buffer);
+		iobuf_put(buffer);
 		return res_RPLUS->rpr_status;
 	}
 
@@ -448,7 +449,7 @@ static int nfs4_read(struct nfs_argop4 *op, compound_data_t *data,
 	}
 
 	/* Some work is to be done */
-	bufferdata = gsh_malloc_aligned(4096, size);
+	bufferdata = iobuf_get(size);
 
 	if (!anonymous_started && data->minorversion == 0) {
 		owner = get_state_owner_ref(state_found);
@@ -471,7 +472,7 @@ static int nfs4_read(struct nfs_argop4 *op, compound_data_t *data,
 
 	if (FSAL_IS_ERROR(fsal_status)) {
 		res_READ4->status = nfs4_Errno_status(fsal_status);
-		gsh_free(bufferdata);
+		iobuf_put(bufferdata);
 		res_READ4->READ4res_u.resok4.data.data_val = NULL;
 		goto done;
 	}
@@ -568,7 +569,7 @@ void nfs4_op_read_Free(nfs_resop4 *res)
 
 	if (resp->status == NFS4_OK)
 		if (resp->READ4res_u.resok4.data.data_val != NULL)
-			gsh_free(resp->READ4res_u.resok4.data.data_val);
+			iobuf_put(resp->READ4res_u.resok4.data.data_val);
 }
 
 /**
@@ -596,12 +597,21 @@ int nfs4_op_read_plus(struct nfs_argop4 *op, compound_data_t *data,
 
 	resp->resop = NFS4_OP_READ_PLUS;
 
+	/* The FSAL says what it found; until then it's data */
+	info.io_content.what = NFS4_CONTENT_DATA;
+
 	nfs4_read(op, data, &res, FSAL_IO_READ_PLUS, &info);
 
 	res_RPLUS->rpr_status = res_READ4->status;
 	if (res_RPLUS->rpr_status != NFS4_OK)
 		return res_RPLUS->rpr_status;
 
+	if (info.io_content.what != NFS4_CONTENT_DATA) {
+		/* The read buffer is not handed back for a hole */
+		iobuf_put(res_READ4->READ4res_u.resok4.data.data_val);
+		res_READ4->READ4res_u.resok4.data.data_val = NULL;
+	}
+
 	contentp->what = info.io_content.what;
 	res_RPLUS->rpr_resok4.rpr_contents_count = 1;
 	res_RPLUS->rpr_resok4.rpr_eof =
@@ -612,11 +622,13 @@ int nfs4_op_read_plus(struct nfs_argop4 *op, compound_data_t *data,
 		contentp->hole.di_length = info.io_content.hole.di_length;
 	}
 	if (info.io_content.what == NFS4_CONTENT_DATA) {
-		contentp->data.d_offset = info.io_content.data.d_offset;
+		/* Whatever the FSAL filled in, the data is the READ's */
+		contentp->data.d_offset =
+				op->nfs_argop4_u.opread_plus.rpa_offset;
 		contentp->data.d_data.data_len =
-					info.io_content.data.d_data.data_len;
+				res_READ4->READ4res_u.resok4.data.data_len;
 		contentp->data.d_data.data_val =
-					info.io_content.data.d_data.data_val;
+				res_READ4->READ4res_u.resok4.data.data_val;
 	}
 	return res_RPLUS->rpr_status;
 }
@@ -628,7 +640,7 @@ void nfs4_op_read_plus_Free(nfs_resop4 *res)
 
 	if (resp->rpr_status == NFS4_OK && conp->what == NFS4_CONTENT_DATA)
 		if (conp->data.d_data.data_val != NULL)
-			gsh_free(conp->data.d_data.data_val);
+			iobuf_put(conp->data.d_data.data_val);
 }
 
 /**
@@ -689,7 +701,11 @@ int nfs4_op_io_advise(struct nfs_argop4 *op, compound_data_t *data,
 		hints.offset = arg_IO_ADVISE->iaa_offset;
 		hints.count = arg_IO_ADVISE->iaa_count;
 
-		fsal_status = obj->obj_ops.io_advise(obj, &hints);
+		if (obj->fsal->m_ops.support_ex(obj))
+			fsal_status = obj->obj_ops.io_advise2(obj, state_found,
+							      &hints);
+		else
+			fsal_status = obj->obj_ops.io_advise(obj, &hints);
 		if (FSAL_IS_ERROR(fsal_status)) {
 			res_IO_ADVISE->iaa_status = NFS4ERR_NOTSUPP;
 			goto done;
@@ -762,25 +778,33 @@ int nfs4_op_seek(struct nfs_argop4 *op, compound_data_t *data,
 	if (res_SEEK->sr_status != NFS4_OK)
 		goto done;
 
-	if (state_found != NULL) {
-		info.io_advise = state_found->state_data.io_advise;
-		info.io_content.what = arg_SEEK->sa_what;
+	info.io_advise = state_found != NULL
+				? state_found->state_data.io_advise : 0;
+	info.io_content.what = arg_SEEK->sa_what;
+	info.io_eof = false;
 
-		if (arg_SEEK->sa_what == NFS4_CONTENT_DATA ||
-				arg_SEEK->sa_what == NFS4_CONTENT_HOLE) {
-			info.io_content.hole.di_offset = arg_SEEK->sa_offset;
-}
-		else
-			info.io_content.adb.adb_offset = arg_SEEK->sa_offset;
+	if (arg_SEEK->sa_what == NFS4_CONTENT_DATA ||
+	    arg_SEEK->sa_what == NFS4_CONTENT_HOLE)
+		info.io_content.hole.di_offset = arg_SEEK->sa_offset;
+	else
+		info.io_content.adb.adb_offset = arg_SEEK->sa_offset;
 
+	if (obj->fsal->m_ops.support_ex(obj))
+		fsal_status = obj->obj_ops.seek2(obj, state_found, &info);
+	else if (state_found != NULL)
 		fsal_status = obj->obj_ops.seek(obj, &info);
-		if (FSAL_IS_ERROR(fsal_status)) {
+	else
+		fsal_status = fsalstat(ERR_FSAL_NOTSUPP, 0);
+
+	if (FSAL_IS_ERROR(fsal_status)) {
+		if (fsal_status.major == ERR_FSAL_NXIO)
 			res_SEEK->sr_status = NFS4ERR_NXIO;
-			goto done;
-		}
-		res_SEEK->sr_resok4.sr_eof = info.io_eof;
-		res_SEEK->sr_resok4.sr_offset = info.io_content.hole.di_offset;
+		else
+			res_SEEK->sr_status = nfs4_Errno_status(fsal_status);
+		goto done;
 	}
+	res_SEEK->sr_resok4.sr_eof = info.io_eof;
+	res_SEEK->sr_resok4.sr_offset = info.io_content.hole.di_offset;
 done:
 	LogDebug(COMPONENT_NFS_V4,
 		 "Status  %s type %d offset %" PRIu64,
@@ -365,6 +365,10 @@ not_junction:
 	args.mounted_on_fileid = mounted_on_fileid;
 	args.fileid = obj->fileid;
 	args.fsid = obj->fsid;
+	/* Use what GETATTR encoded, but these attributes may have been
+	 * fetched before the current generation, so don't fill it.
+	 */
+	args.cache = fattr4_cache_of(obj);
 
 	if (nfs4_FSALattr_To_Fattr(&args,
 				   tracker->req_attr,
@@ -490,6 +494,7 @@ int nfs4_op_readdir(struct nfs_argop4 *op, compound_data_t *data,
 	unsigned int estimated_num_entries = 0;
 	unsigned int num_entries = 0;
 	struct nfs4_readdir_cb_data tracker;
+	struct fsal_readdir_budget budget;
 	fsal_status_t fsal_status = {0, 0};
 	attrmask_t attrmask;
 	bool use_cookie_verifier = op_ctx_export_has_option(
@@ -627,7 +632,19 @@ int nfs4_op_readdir(struct nfs_argop4 *op, compound_data_t *data,
 	if (attribute_is_set(tracker.req_attr, FATTR4_ACL))
 		attrmask |= ATTR_ACL;
 
+	/* Tell MDCACHE how much the reply can take, matching what
+	 * nfs4_readdir_callback charges for an entry: the entry4, the name
+	 * and its NUL, and the attribute mask and values.
+	 */
+	budget.bytes = tracker.mem_left;
+	budget.entry_bytes = sizeof(entry4) + 1 +
+		tracker.req_attr->bitmap4_len * sizeof(uint32_t) +
+		nfs4_Fattr_Min_Size(tracker.req_attr);
+	budget.slack = 0;
+	budget.entries = tracker.total_entries;
+
 	/* Perform the readdir operation */
+	op_ctx->readdir_budget = &budget;
 	fsal_status = fsal_readdir(dir_obj,
 				   cookie,
 				   &num_entries,
@@ -635,6 +652,7 @@ int nfs4_op_readdir(struct nfs_argop4 *op, compound_data_t *data,
 				   attrmask,
 				   nfs4_readdir_callback,
 				   &tracker);
+	op_ctx->readdir_budget = NULL;
 
 	if (FSAL_IS_ERROR(fsal_status)) {
 		res_READDIR4->status = nfs4_Errno_status(fsal_status);
@@ -85,19 +85,13 @@ int nfs4_op_release_lockowner(struct nfs_argop4 *op, compound_data_t *data,
 		goto out2;
 	}
 
-	PTHREAD_MUTEX_lock(&nfs_client_id->cid_mutex);
-
 	if (!reserve_lease(nfs_client_id)) {
-		PTHREAD_MUTEX_unlock(&nfs_client_id->cid_mutex);
-
 		dec_client_id_ref(nfs_client_id);
 
 		res_RELEASE_LOCKOWNER4->status = NFS4ERR_EXPIRED;
 		goto out2;
 	}
 
-	PTHREAD_MUTEX_unlock(&nfs_client_id->cid_mutex);
-
 	/* look up the lock owner and see if we can find it */
 	convert_nfs4_lock_owner(&arg_RELEASE_LOCKOWNER4->lock_owner,
 				&owner_name);
@@ -130,12 +124,8 @@ int nfs4_op_release_lockowner(struct nfs_argop4 *op, compound_data_t *data,
  out1:
 
 	/* Update the lease before exit */
-	PTHREAD_MUTEX_lock(&nfs_client_id->cid_mutex);
-
 	update_lease(nfs_client_id);
 
-	PTHREAD_MUTEX_unlock(&nfs_client_id->cid_mutex);
-
 	dec_client_id_ref(nfs_client_id);
 
  out2:
@@ -87,14 +87,15 @@ int nfs4_op_renew(struct nfs_argop4 *op, compound_data_t *data,
 		return res_RENEW4->status;
 	}
 
-	PTHREAD_MUTEX_lock(&clientid->cid_mutex);
-
 	if (!reserve_lease(clientid)) {
 		res_RENEW4->status = NFS4ERR_EXPIRED;
 	} else {
 		update_lease(clientid);
-		/* update the lease, check the state of callback
-		 * path and return correct error */
+
+		/* check the state of callback path and return correct
+		 * error */
+		PTHREAD_MUTEX_lock(&clientid->cid_mutex);
+
 		if (nfs_param.nfsv4_param.allow_delegations &&
 		    get_cb_chan_down(clientid) && clientid->curr_deleg_grants) {
 			res_RENEW4->status =  NFS4ERR_CB_PATH_DOWN;
@@ -107,10 +108,9 @@ int nfs4_op_renew(struct nfs_argop4 *op, compound_data_t *data,
 			/* Reset */
 			clientid->first_path_down_resp_time = 0;
 		}
+		PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
 	}
 
-	PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
-
 	dec_client_id_ref(clientid);
 
 	return res_RENEW4->status;
@@ -30,11 +30,44 @@
  */
 
 #include "config.h"
+#include <sys/param.h>
 #include "fsal.h"
 #include "sal_functions.h"
 #include "nfs_rpc_callback.h"
 #include "nfs_convert.h"
 
+/**
+ * @brief Pick the slot target to return to a client
+ *
+ * Additive increase while the client has every slot of its target in
+ * use and the workers are keeping up, halving toward NFS41_NB_SLOTS
+ * once requests queue at more than twice the worker count.
+ *
+ * @param[in] session     The session
+ * @param[in] highest     Client's highest slot in use (sa_highest_slotid)
+ *
+ * @return The new target slot count.
+ */
+
+static uint32_t nfs41_slot_target(nfs41_session_t *session, slotid4 highest)
+{
+	uint32_t nslots = session->fore_channel_attrs.ca_maxrequests;
+	uint32_t target = atomic_fetch_uint32_t(&session->target_slots);
+	uint32_t inflight = nfs_rpc_inflight_count();
+	uint32_t workers = nfs_param.core_param.nb_worker;
+	uint32_t lowest = MIN(nslots, NFS41_NB_SLOTS);
+	uint32_t next = target;
+
+	if (inflight > 2 * workers)
+		next = MAX(target / 2, lowest);
+	else if (inflight < workers / 2 && highest + 1 >= target)
+		next = MIN(target + 1, nslots);
+
+	if (next != target)
+		atomic_store_uint32_t(&session->target_slots, next);
+	return next;
+}
+
 /**
  * @brief the NFS4_OP_SEQUENCE operation
  *
@@ -83,11 +116,7 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 	LogDebug(COMPONENT_SESSIONS, "SEQUENCE session=%p", session);
 
 	/* Check if lease is expired and reserve it */
-	PTHREAD_MUTEX_lock(&session->clientid_record->cid_mutex);
-
 	if (!reserve_lease(session->clientid_record)) {
-		PTHREAD_MUTEX_unlock(&session->clientid_record->cid_mutex);
-
 		dec_session_ref(session);
 		res_SEQUENCE4->sr_status = NFS4ERR_EXPIRED;
 		LogDebugAlt(COMPONENT_SESSIONS, COMPONENT_CLIENTID,
@@ -98,8 +127,6 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 
 	data->preserved_clientid = session->clientid_record;
 
-	PTHREAD_MUTEX_unlock(&session->clientid_record->cid_mutex);
-
 	/* Check is slot is compliant with ca_maxrequests */
 	if (arg_SEQUENCE4->sa_slotid >=
 	    session->fore_channel_attrs.ca_maxrequests) {
@@ -119,15 +146,8 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 	    arg_SEQUENCE4->sa_sequenceid) {
 		if (session->slots[arg_SEQUENCE4->sa_slotid].sequence ==
 		    arg_SEQUENCE4->sa_sequenceid) {
-#if IMPLEMENT_CACHETHIS
-			/** @todo
-			 *
-			 * Ganesha always caches result anyway so ignore
-			 * cachethis
-			 */
 			if (session->slots[arg_SEQUENCE4->sa_slotid]
 			    .cache_used) {
-#endif
 				/* Replay operation through the DRC */
 				data->use_drc = true;
 				data->cached_res =
@@ -146,7 +166,6 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 				dec_session_ref(session);
 				res_SEQUENCE4->sr_status = NFS4_OK;
 				return res_SEQUENCE4->sr_status;
-#if IMPLEMENT_CACHETHIS
 			} else {
 				/* Illegal replay */
 				PTHREAD_MUTEX_unlock(&session->
@@ -161,7 +180,6 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 							    sr_status));
 				return res_SEQUENCE4->sr_status;
 			}
-#endif
 		}
 
 		PTHREAD_MUTEX_unlock(&session->
@@ -191,21 +209,35 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 	res_SEQUENCE4->SEQUENCE4res_u.sr_resok4.sr_slotid =
 	    arg_SEQUENCE4->sa_slotid;
 	res_SEQUENCE4->SEQUENCE4res_u.sr_resok4.sr_highest_slotid =
-	    NFS41_NB_SLOTS - 1;
-	res_SEQUENCE4->SEQUENCE4res_u.sr_resok4.sr_target_highest_slotid =
 	    session->fore_channel_attrs.ca_maxrequests - 1;
+	res_SEQUENCE4->SEQUENCE4res_u.sr_resok4.sr_target_highest_slotid =
+	    nfs41_slot_target(session, arg_SEQUENCE4->sa_highest_slotid) - 1;
 
 	res_SEQUENCE4->SEQUENCE4res_u.sr_resok4.sr_status_flags = 0;
 
+	nfs41_session_conn_seen(session, data->req->rq_xprt);
+
 	if (nfs_rpc_get_chan(session->clientid_record, 0) == NULL) {
 		res_SEQUENCE4->SEQUENCE4res_u.sr_resok4.sr_status_flags |=
 		    SEQ4_STATUS_CB_PATH_DOWN;
 	}
 
-#if IMPLEMENT_CACHETHIS
-/* Ganesha always caches result anyway so ignore cachethis */
+	/* Tell the client to bind a connection for this session's back
+	 * channel when we could run one but have none, e.g. after the
+	 * connection it was on went away.
+	 */
+	if ((session->flags & (session_bc_up | session_cb_sec)) ==
+	    session_cb_sec) {
+		res_SEQUENCE4->SEQUENCE4res_u.sr_resok4.sr_status_flags |=
+		    SEQ4_STATUS_CB_PATH_DOWN_SESSION;
+	}
+
+	/* Only keep the reply when the client asks for it: the previous
+	 * reply on this slot can never be replayed again, and caching
+	 * idempotent replies such as large READs would pin their data
+	 * until the slot is next used.
+	 */
 	if (arg_SEQUENCE4->sa_cachethis) {
-#endif
 		data->cached_res =
 		    &session->slots[arg_SEQUENCE4->sa_slotid].cached_result;
 		session->slots[arg_SEQUENCE4->sa_slotid].cache_used = true;
@@ -213,16 +245,15 @@ int nfs4_op_sequence(struct nfs_argop4 *op, compound_data_t *data,
 		LogFullDebugAlt(COMPONENT_SESSIONS, COMPONENT_CLIENTID,
 				"Use sesson slot %" PRIu32 "=%p for DRC",
 				arg_SEQUENCE4->sa_slotid, data->cached_res);
-#if IMPLEMENT_CACHETHIS
 	} else {
 		data->cached_res = NULL;
-		session->slots[arg_SEQUENCE4->sa_slotid].cache_used = false;
+		nfs41_Session_Release_Slot_Cache(
+			&session->slots[arg_SEQUENCE4->sa_slotid]);
 
 		LogFullDebugAlt(COMPONENT_SESSIONS, COMPONENT_CLIENTID,
 				"Don't use sesson slot %" PRIu32
 				"=NULL for DRC", arg_SEQUENCE4->sa_slotid);
 	}
-#endif
 
 	PTHREAD_MUTEX_unlock(&session->slots[arg_SEQUENCE4->sa_slotid].lock);
 
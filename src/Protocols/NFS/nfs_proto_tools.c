@@ -3516,6 +3516,15 @@ nfsstat4 file_To_Fattr(compound_data_t *data,
 	args.fileid = data->current_obj->fileid;
 	args.fsid = data->current_obj->fsid;
 
+	/* Take the generation first, so that an encoding left in the cache
+	 * is never older than the generation it is filed under.
+	 */
+	args.cache = fattr4_cache_of(data->current_obj);
+	if (args.cache != NULL) {
+		args.cache_gen = atomic_fetch_uint32_t(&args.cache->gen);
+		args.cache_fill = true;
+	}
+
 	status = data->current_obj->obj_ops.getattrs(data->current_obj, attr);
 	if (FSAL_IS_ERROR(status))
 		return nfs4_Errno_status(status);
@@ -3588,6 +3597,232 @@ int nfs4_Fattr_Fill_Error(fattr4 *Fattr, nfsstat4 rdattr_error)
 	}
 }
 
+/**
+ * @brief An attribute bitmap compiled for encoding
+ *
+ * Clients ask for the same few bitmaps over and over, so rather than
+ * walking each request's bitmap bit by bit, each thread keeps the
+ * attributes of the bitmaps it saw last in encoding order.
+ */
+
+struct fattr4_plan {
+	uint32_t map[BITMAP4_MAPLEN];	/*< Requested bitmap */
+	uint32_t len;			/*< Its length, 0 for a free slot */
+	int max_attr_idx;		/*< Highest attribute of the minor
+					    version it was compiled for */
+	uint32_t count;
+	uint8_t attr[FATTR4_XATTR_SUPPORT + 1];
+	struct bitmap4 mask;		/*< attr[] as a bitmap */
+	bool cacheable;			/*< Only depends on the object */
+};
+
+#define FATTR4_PLAN_SLOTS 8
+
+static __thread struct fattr4_plan fattr4_plans[FATTR4_PLAN_SLOTS];
+
+/**
+ * @brief Find or compile the plan for a bitmap
+ *
+ * @param[in] Bitmap       Bitmap of attributes being requested
+ * @param[in] max_attr_idx Highest attribute of the minor version
+ *
+ * @return The plan, valid until this thread compiles another one into
+ *         the same slot.
+ */
+
+static struct fattr4_plan *fattr4_plan_get(struct bitmap4 *Bitmap,
+					   int max_attr_idx)
+{
+	uint32_t map[BITMAP4_MAPLEN] = { 0 };
+	uint32_t len = MIN(Bitmap->bitmap4_len, BITMAP4_MAPLEN);
+	struct fattr4_plan *plan;
+	uint32_t i;
+	int attr;
+
+	for (i = 0; i < len; i++)
+		map[i] = Bitmap->map[i];
+
+	plan = &fattr4_plans[(map[0] ^ map[1] * 31 ^ map[2] * 961 ^
+			      max_attr_idx) % FATTR4_PLAN_SLOTS];
+
+	if (plan->len == len && plan->max_attr_idx == max_attr_idx &&
+	    memcmp(plan->map, map, sizeof(map)) == 0)
+		return plan;
+
+	memcpy(plan->map, map, sizeof(map));
+	plan->len = len;
+	plan->max_attr_idx = max_attr_idx;
+	plan->count = 0;
+	memset(&plan->mask, 0, sizeof(plan->mask));
+	plan->cacheable = true;
+
+	for (attr = next_attr_from_bitmap(Bitmap, -1);
+	     attr != -1 && attr <= max_attr_idx;
+	     attr = next_attr_from_bitmap(Bitmap, attr)) {
+		plan->attr[plan->count++] = attr;
+		(void) set_attribute_in_bitmap(&plan->mask, attr);
+
+		switch (attr) {
+		case FATTR4_ACL:
+		case FATTR4_FILES_AVAIL:
+		case FATTR4_FILES_FREE:
+		case FATTR4_FILES_TOTAL:
+		case FATTR4_FS_LOCATIONS:
+		case FATTR4_MAXREAD:
+		case FATTR4_MAXWRITE:
+		case FATTR4_QUOTA_AVAIL_HARD:
+		case FATTR4_QUOTA_AVAIL_SOFT:
+		case FATTR4_QUOTA_USED:
+		case FATTR4_SPACE_AVAIL:
+		case FATTR4_SPACE_FREE:
+		case FATTR4_SPACE_TOTAL:
+			/* Depend on the filesystem, the caller or
+			 * settings that change underneath the object.
+			 */
+			plan->cacheable = false;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return plan;
+}
+
+/* Largest encoding kept in an object's fattr4_cache */
+#define FATTR4_CACHE_MAX_LEN 512
+
+/* Everything an encoding depends on besides the object's attributes */
+struct fattr4_cache_key {
+	struct gsh_export *export;
+	uint64_t change;
+	uint64_t mounted_on_fileid;
+	attrmask_t valid_mask;
+	uint32_t gen;
+	uint32_t idmap_gen;
+	uint32_t map[BITMAP4_MAPLEN];
+	uint32_t map_len;
+	int32_t max_attr_idx;
+	uint16_t export_id;
+	uint16_t fh_len;		/*< 0 unless FILEHANDLE is encoded */
+	char fh[NFS4_FHSIZE];
+};
+
+struct fattr4_cache_blob {
+	struct fattr4_cache_key key;
+	struct bitmap4 attrmask;
+	uint32_t len;
+	char vals[];
+};
+
+/**
+ * @brief Fill in the key for encoding a plan
+ *
+ * The key is zeroed first so that keys compare with memcmp().
+ *
+ * @return false if the encoding can not be cached.
+ */
+
+static bool fattr4_cache_key_init(struct fattr4_cache_key *key,
+				  struct xdr_attrs_args *args,
+				  struct fattr4_plan *plan, uint32_t gen)
+{
+	memset(key, 0, sizeof(*key));
+
+	if (attribute_is_set(&plan->mask, FATTR4_FILEHANDLE)) {
+		if (args->hdl4->nfs_fh4_len > NFS4_FHSIZE)
+			return false;
+		key->fh_len = args->hdl4->nfs_fh4_len;
+		memcpy(key->fh, args->hdl4->nfs_fh4_val, key->fh_len);
+	}
+
+	key->export = op_ctx->ctx_export;
+	key->export_id = op_ctx->ctx_export->export_id;
+	key->change = args->attrs->change;
+	key->mounted_on_fileid = args->mounted_on_fileid;
+	key->valid_mask = args->attrs->valid_mask & ~ATTR_ACL;
+	key->gen = gen;
+	key->idmap_gen = atomic_fetch_uint32_t(&idmapper_cache_gen);
+	memcpy(key->map, plan->map, sizeof(key->map));
+	key->map_len = plan->len;
+	key->max_attr_idx = plan->max_attr_idx;
+
+	return true;
+}
+
+/**
+ * @brief Copy a cached encoding into a reply
+ *
+ * @return true if the cache held this encoding.
+ */
+
+static bool fattr4_cache_get(struct xdr_attrs_args *args,
+			     struct fattr4_plan *plan, fattr4 *Fattr)
+{
+	struct fattr4_cache *cache = args->cache;
+	struct fattr4_cache_blob *blob;
+	struct fattr4_cache_key key;
+	bool hit = false;
+
+	if (!fattr4_cache_key_init(&key, args, plan,
+				   atomic_fetch_uint32_t(&cache->gen)))
+		return false;
+
+	pthread_spin_lock(&cache->sp);
+
+	blob = cache->blob;
+	if (blob != NULL && memcmp(&blob->key, &key, sizeof(key)) == 0) {
+		Fattr->attrmask = blob->attrmask;
+		Fattr->attr_vals.attrlist4_len = blob->len;
+		if (blob->len != 0) {
+			Fattr->attr_vals.attrlist4_val = gsh_malloc(blob->len);
+			memcpy(Fattr->attr_vals.attrlist4_val, blob->vals,
+			       blob->len);
+		}
+		hit = true;
+	}
+
+	pthread_spin_unlock(&cache->sp);
+
+	return hit;
+}
+
+/**
+ * @brief Leave an encoding in the cache
+ *
+ * It is keyed on the generation from before the attributes were
+ * fetched, so it is never found if they changed since.
+ */
+
+static void fattr4_cache_put(struct xdr_attrs_args *args,
+			     struct fattr4_plan *plan, fattr4 *Fattr)
+{
+	struct fattr4_cache *cache = args->cache;
+	struct fattr4_cache_blob *blob, *old;
+	uint32_t len = Fattr->attr_vals.attrlist4_len;
+
+	if (len > FATTR4_CACHE_MAX_LEN)
+		return;
+
+	blob = gsh_malloc(sizeof(*blob) + len);
+
+	if (!fattr4_cache_key_init(&blob->key, args, plan, args->cache_gen)) {
+		gsh_free(blob);
+		return;
+	}
+
+	blob->attrmask = Fattr->attrmask;
+	blob->len = len;
+	memcpy(blob->vals, Fattr->attr_vals.attrlist4_val, len);
+
+	pthread_spin_lock(&cache->sp);
+	old = cache->blob;
+	cache->blob = blob;
+	pthread_spin_unlock(&cache->sp);
+
+	gsh_free(old);
+}
+
 /**
  * @brief Converts FSAL Attributes to NFSv4 Fattr buffer.
  *
@@ -3614,6 +3849,8 @@ int nfs4_FSALattr_To_Fattr(struct xdr_attrs_args *args, struct bitmap4 *Bitmap,
 	XDR attr_body;
 	fattr_xdr_result xdr_res;
 	uint32_t attrvals_buflen;
+	struct fattr4_plan *plan;
+	uint32_t i;
 
 	/* basic init */
 	memset(Fattr, 0, sizeof(*Fattr));
@@ -3621,6 +3858,16 @@ int nfs4_FSALattr_To_Fattr(struct xdr_attrs_args *args, struct bitmap4 *Bitmap,
 	if (Bitmap->bitmap4_len == 0)
 		return 0;	/* they ask for nothing, they get nothing */
 
+	max_attr_idx = nfs4_max_attr_index(args->data);
+	LogFullDebug(COMPONENT_NFS_V4, "Maximum allowed attr index = %d",
+		 max_attr_idx);
+
+	plan = fattr4_plan_get(Bitmap, max_attr_idx);
+
+	if (args->cache != NULL && plan->cacheable &&
+	    fattr4_cache_get(args, plan, Fattr))
+		return 0;
+
 	attrvals_buflen = NFS4_ATTRVALS_BUFFLEN;
 	if (attribute_is_set(Bitmap, FATTR4_ACL) && args->attrs->acl) {
 		/* Calculating an exact needed xdr buffer size is laborious
@@ -3636,10 +3883,6 @@ int nfs4_FSALattr_To_Fattr(struct xdr_attrs_args *args, struct bitmap4 *Bitmap,
 
 	Fattr->attr_vals.attrlist4_val = gsh_malloc(attrvals_buflen);
 
-	max_attr_idx = nfs4_max_attr_index(args->data);
-	LogFullDebug(COMPONENT_NFS_V4, "Maximum allowed attr index = %d",
-		 max_attr_idx);
-
 	LastOffset = 0;
 	memset(&attr_body, 0, sizeof(attr_body));
 	xdrmem_create(&attr_body, Fattr->attr_vals.attrlist4_val,
@@ -3648,18 +3891,16 @@ int nfs4_FSALattr_To_Fattr(struct xdr_attrs_args *args, struct bitmap4 *Bitmap,
 	if (args->dynamicinfo == NULL)
 		args->dynamicinfo = &dynamicinfo;
 
-	for (attribute_to_set = next_attr_from_bitmap(Bitmap, -1);
-	     attribute_to_set != -1;
-	     attribute_to_set =
-	     next_attr_from_bitmap(Bitmap, attribute_to_set)) {
-		if (attribute_to_set > max_attr_idx)
-			break;	/* skip out of bounds */
+	/* Start with everything the plan encodes set, and take out
+	 * what turns out not to be supported.
+	 */
+	Fattr->attrmask = plan->mask;
+
+	for (i = 0; i < plan->count; i++) {
+		attribute_to_set = plan->attr[i];
 
 		xdr_res = fattr4tab[attribute_to_set].encode(&attr_body, args);
 		if (xdr_res == FATTR_XDR_SUCCESS) {
-			bool res = set_attribute_in_bitmap(&Fattr->attrmask,
-							   attribute_to_set);
-			assert(res);
 			LogFullDebug(COMPONENT_NFS_V4,
 				     "Encoded attr %d, name = %s",
 				     attribute_to_set,
@@ -3669,6 +3910,8 @@ int nfs4_FSALattr_To_Fattr(struct xdr_attrs_args *args, struct bitmap4 *Bitmap,
 				     "Attr not supported %d name=%s",
 				     attribute_to_set,
 				     fattr4tab[attribute_to_set].name);
+			(void) clear_attribute_in_bitmap(&Fattr->attrmask,
+							 attribute_to_set);
 			continue;
 		} else {
 			LogFullDebug(COMPONENT_NFS_V4,
@@ -3679,8 +3922,12 @@ int nfs4_FSALattr_To_Fattr(struct xdr_attrs_args *args, struct bitmap4 *Bitmap,
 			/* signal fail so if(LastOffset > 0) works right */
 			goto err;
 		}
-		/* mark the attribute in the bitmap should be new bitmap btw */
 	}
+	/* Drop the words left empty by unsupported attributes */
+	while (Fattr->attrmask.bitmap4_len > 0 &&
+	       Fattr->attrmask.map[Fattr->attrmask.bitmap4_len - 1] == 0)
+		Fattr->attrmask.bitmap4_len--;
+
 	LastOffset = xdr_getpos(&attr_body);	/* dumb but for now */
 	xdr_destroy(&attr_body);
 
@@ -3690,11 +3937,16 @@ int nfs4_FSALattr_To_Fattr(struct xdr_attrs_args *args, struct bitmap4 *Bitmap,
 		Fattr->attr_vals.attrlist4_val = NULL;
 	}
 	Fattr->attr_vals.attrlist4_len = LastOffset;
+
+	if (args->cache != NULL && args->cache_fill && plan->cacheable)
+		fattr4_cache_put(args, plan, Fattr);
+
 	return 0;
 
  err:
 	gsh_free(Fattr->attr_vals.attrlist4_val);
 	Fattr->attr_vals.attrlist4_val = NULL;
+	memset(&Fattr->attrmask, 0, sizeof(Fattr->attrmask));
 	return -1;
 }
 
@@ -4051,6 +4303,74 @@ void nfs4_bitmap4_Remove_Unsupported(struct bitmap4 *bitmap)
 	}
 }
 
+/**
+ * @brief Least encoded size of the values of the requested attributes
+ *
+ * Fixed-size attributes count their size, the others a single XDR unit
+ * for their length or count.  Attributes the current export does not
+ * provide are not counted, since they will not be returned.
+ *
+ * @param[in] bitmap NFSv4 attribute bitmap.
+ *
+ * @return The size in bytes.
+ */
+
+size_t nfs4_Fattr_Min_Size(struct bitmap4 *bitmap)
+{
+	attrmask_t supported = op_ctx->fsal_export->exp_ops.fs_supported_attrs(
+							op_ctx->fsal_export);
+	size_t size = 0;
+	int attribute;
+
+	for (attribute = next_attr_from_bitmap(bitmap, -1);
+	     attribute != -1 && attribute <= FATTR4_XATTR_SUPPORT;
+	     attribute = next_attr_from_bitmap(bitmap, attribute)) {
+		if (!fattr4tab[attribute].supported ||
+		    (fattr4tab[attribute].attrmask != 0 &&
+		     (fattr4tab[attribute].attrmask & supported) == 0))
+			continue;
+
+		switch (attribute) {
+		case FATTR4_FSID:
+			size += 4 * BYTES_PER_XDR_UNIT;
+			break;
+		case FATTR4_TIME_ACCESS:
+		case FATTR4_TIME_BACKUP:
+		case FATTR4_TIME_CREATE:
+		case FATTR4_TIME_DELTA:
+		case FATTR4_TIME_METADATA:
+		case FATTR4_TIME_MODIFY:
+			size += 3 * BYTES_PER_XDR_UNIT;
+			break;
+		case FATTR4_CHANGE:
+		case FATTR4_SIZE:
+		case FATTR4_FILEID:
+		case FATTR4_FILES_AVAIL:
+		case FATTR4_FILES_FREE:
+		case FATTR4_FILES_TOTAL:
+		case FATTR4_MAXFILESIZE:
+		case FATTR4_MAXREAD:
+		case FATTR4_MAXWRITE:
+		case FATTR4_MOUNTED_ON_FILEID:
+		case FATTR4_QUOTA_AVAIL_HARD:
+		case FATTR4_QUOTA_AVAIL_SOFT:
+		case FATTR4_QUOTA_USED:
+		case FATTR4_RAWDEV:
+		case FATTR4_SPACE_AVAIL:
+		case FATTR4_SPACE_FREE:
+		case FATTR4_SPACE_TOTAL:
+		case FATTR4_SPACE_USED:
+			size += 2 * BYTES_PER_XDR_UNIT;
+			break;
+		default:
+			size += BYTES_PER_XDR_UNIT;
+			break;
+		}
+	}
+
+	return size;
+}
+
 /**
  *
  * nfs4_Fattr_Supported: Checks if an attribute is supported.
@@ -4450,16 +4770,13 @@ int nfs4_Fattr_To_fsinfo(fsal_dynamicfsinfo_t *dinfo, fattr4 *Fattr)
 	return Fattr4_To_FSAL_attr(NULL, Fattr, NULL, dinfo, NULL);
 }
 
-/* nfs4_utf8string2dynamic
- * unpack the input string from the XDR into a null term'd string
- * scan for bad chars
- */
-
-nfsstat4 nfs4_utf8string2dynamic(const utf8string *input,
-				 utf8_scantype_t scan,
-				 char **obj_name)
+static nfsstat4 utf8string_unpack(const utf8string *input,
+				  utf8_scantype_t scan,
+				  struct req_arena *arena,
+				  char **obj_name)
 {
 	nfsstat4 status = NFS4_OK;
+	char *name;
 
 	*obj_name = NULL;
 
@@ -4470,7 +4787,10 @@ nfsstat4 nfs4_utf8string2dynamic(const utf8string *input,
 	    (!(scan & UTF8_SCAN_PATH) && input->utf8string_len > MAXNAMLEN))
 		return NFS4ERR_NAMETOOLONG;
 
-	char *name = gsh_malloc(input->utf8string_len + 1);
+	if (arena != NULL)
+		name = req_arena_alloc(arena, input->utf8string_len + 1);
+	else
+		name = gsh_malloc(input->utf8string_len + 1);
 
 	memcpy(name, input->utf8string_val, input->utf8string_len);
 	name[input->utf8string_len] = '\0';
@@ -4478,11 +4798,35 @@ nfsstat4 nfs4_utf8string2dynamic(const utf8string *input,
 		status = path_filter(name, scan);
 	if (status == NFS4_OK)
 		*obj_name = name;
-	else
+	else if (arena == NULL)
 		gsh_free(name);
 	return status;
 }
 
+/* nfs4_utf8string2dynamic
+ * unpack the input string from the XDR into a null term'd string
+ * scan for bad chars
+ */
+
+nfsstat4 nfs4_utf8string2dynamic(const utf8string *input,
+				 utf8_scantype_t scan,
+				 char **obj_name)
+{
+	return utf8string_unpack(input, scan, NULL, obj_name);
+}
+
+/* nfs4_utf8string2scratch
+ * as nfs4_utf8string2dynamic, but the string is request scratch memory
+ * and must be released with nfs4_free_scratch(), never kept past the op
+ */
+
+nfsstat4 nfs4_utf8string2scratch(const utf8string *input,
+				 utf8_scantype_t scan,
+				 char **obj_name)
+{
+	return utf8string_unpack(input, scan, op_ctx->arena, obj_name);
+}
+
 /**
  * @brief: is a directory's sticky bit set?
  *
@@ -112,19 +112,136 @@ xdrproc_t nlm_reply_proc[] = {
 	[NLMPROC4_UNLOCK_RES] = (xdrproc_t) xdr_nlm4_res,
 };
 
-static void *resp_key;
+/**
+ * @brief A GRANTED callback sent and not answered yet
+ *
+ * The callback is one way, GRANTED_RES arrives as a separate call.  The
+ * callbacks to a host are pipelined over its callback connection, only
+ * once NLM_ASYNC_WINDOW of them are unanswered does the next one wait
+ * for a reply, and only for as long as the oldest may still get one.
+ */
+struct nlm_async_grant {
+	struct glist_head nag_list;
+	void *nag_key;		/*< Key passed to nlm_signal_async_resp */
+	state_nlm_client_t *nag_host;	/*< Host, holds a reference */
+	time_t nag_expire;	/*< When to stop waiting for the reply */
+};
+
+/** Unanswered callbacks, protected by nlm_async_resp_mutex */
+static struct glist_head nlm_async_grants =
+	GLIST_HEAD_INIT(nlm_async_grants);
+
+#define NLM_ASYNC_WINDOW 8
+#define NLM_ASYNC_RESP_TIMEOUT 5
 
 static const int MAX_ASYNC_RETRY = 2;
 
-/* Client routine  to send the asynchrnous response,
- * key is used to wait for a response
+/**
+ * @brief Stop waiting for a GRANTED_RES
+ *
+ * @note The nlm_async_resp_mutex MUST be held, the host reference is
+ *       left for the caller to drop after releasing it.
+ */
+static void nlm_async_grant_done(struct nlm_async_grant *grant,
+				 struct glist_head *done)
+{
+	glist_del(&grant->nag_list);
+	grant->nag_host->slc_grants_pending--;
+	glist_add_tail(done, &grant->nag_list);
+	pthread_cond_broadcast(&nlm_async_resp_cond);
+}
+
+/**
+ * @brief Give up on replies that are overdue
+ *
+ * @note The nlm_async_resp_mutex MUST be held
+ */
+static void nlm_async_expire(time_t now, struct glist_head *done)
+{
+	struct glist_head *glist, *glistn;
+	struct nlm_async_grant *grant;
+
+	glist_for_each_safe(glist, glistn, &nlm_async_grants) {
+		grant = glist_entry(glist, struct nlm_async_grant, nag_list);
+
+		if (grant->nag_expire > now)
+			continue;
+
+		LogFullDebug(COMPONENT_NLM,
+			     "No GRANTED_RES for key %p", grant->nag_key);
+
+		nlm_async_grant_done(grant, done);
+	}
+}
+
+/**
+ * @brief Free callbacks that are no longer waited for
  */
+static void nlm_async_release(struct glist_head *done)
+{
+	struct nlm_async_grant *grant;
+
+	while ((grant = glist_first_entry(done, struct nlm_async_grant,
+					  nag_list)) != NULL) {
+		glist_del(&grant->nag_list);
+		dec_nlm_client_ref(grant->nag_host);
+		gsh_free(grant);
+	}
+}
+
+/**
+ * @brief Wait for room in the window of a host and claim it
+ *
+ * Waits at most NLM_ASYNC_RESP_TIMEOUT seconds, by then the oldest
+ * callback has expired.
+ */
+static void nlm_async_grant_start(state_nlm_client_t *host, void *key)
+{
+	struct nlm_async_grant *grant = gsh_malloc(sizeof(*grant));
+	struct glist_head done = GLIST_HEAD_INIT(done);
+	struct timespec timeout;
+	time_t now = time(NULL);
+
+	timeout.tv_sec = now + NLM_ASYNC_RESP_TIMEOUT;
+	timeout.tv_nsec = 0;
+
+	PTHREAD_MUTEX_lock(&nlm_async_resp_mutex);
+
+	nlm_async_expire(now, &done);
+
+	while (host->slc_grants_pending >= NLM_ASYNC_WINDOW) {
+		LogFullDebug(COMPONENT_NLM,
+			     "Window full for %s, waiting",
+			     host->slc_nsm_client->ssc_nlm_caller_name);
+
+		(void) pthread_cond_timedwait(&nlm_async_resp_cond,
+					      &nlm_async_resp_mutex,
+					      &timeout);
+
+		nlm_async_expire(time(NULL), &done);
+	}
+
+	inc_nlm_client_ref(host);
+	grant->nag_key = key;
+	grant->nag_host = host;
+	grant->nag_expire = time(NULL) + NLM_ASYNC_RESP_TIMEOUT;
+	host->slc_grants_pending++;
+	glist_add_tail(&nlm_async_grants, &grant->nag_list);
+
+	PTHREAD_MUTEX_unlock(&nlm_async_resp_mutex);
+
+	nlm_async_release(&done);
+}
+
+
 int nlm_send_async(int proc, state_nlm_client_t *host, void *inarg, void *key)
 {
 	struct timeval tout = { 0, 10 };
 	int retval, retry;
-	struct timeval start, now;
-	struct timespec timeout;
+
+	/* Register before sending, the reply may beat clnt_call back */
+	if (key != NULL)
+		nlm_async_grant_start(host, key);
 
 	for (retry = 0; retry < MAX_ASYNC_RETRY; retry++) {
 		if (host->slc_callback_clnt == NULL) {
@@ -141,8 +258,10 @@ int nlm_send_async(int proc, state_nlm_client_t *host, void *inarg, void *key)
 				char port_str[20];
 
 				fd = socket(PF_INET6, SOCK_STREAM, IPPROTO_TCP);
-				if (fd < 0)
-					return -1;
+				if (fd < 0) {
+					retval = -1;
+					goto fail;
+				}
 
 				memcpy(&server_addr,
 				       &(host->slc_server_addr),
@@ -154,7 +273,8 @@ int nlm_send_async(int proc, state_nlm_client_t *host, void *inarg, void *key)
 					  sizeof(server_addr)) == -1) {
 					LogMajor(COMPONENT_NLM, "Cannot bind");
 					close(fd);
-					return -1;
+					retval = -1;
+					goto fail;
 				}
 
 				buf = rpcb_find_mapped_addr(
@@ -173,7 +293,8 @@ int nlm_send_async(int proc, state_nlm_client_t *host, void *inarg, void *key)
 						 host->slc_nsm_client->
 						 ssc_nlm_caller_name);
 					close(fd);
-					return -1;
+					retval = -1;
+					goto fail;
 				}
 
 				memset(&hints, 0, sizeof(struct addrinfo));
@@ -218,7 +339,8 @@ int nlm_send_async(int proc, state_nlm_client_t *host, void *inarg, void *key)
 						 host->slc_nsm_client->
 						 ssc_nlm_caller_name,
 						 gai_strerror(retval));
-					return -1;
+					retval = -1;
+					goto fail;
 				}
 
 				/* setup the netbuf with in6 address */
@@ -247,17 +369,14 @@ int nlm_send_async(int proc, state_nlm_client_t *host, void *inarg, void *key)
 							  slc_client_type),
 					 host->slc_nsm_client->
 					 ssc_nlm_caller_name);
-				return -1;
+				retval = -1;
+				goto fail;
 			}
 
 			/* split auth (for authnone, idempotent) */
 			host->slc_callback_auth = authnone_create();
 		}
 
-		PTHREAD_MUTEX_lock(&nlm_async_resp_mutex);
-		resp_key = key;
-		PTHREAD_MUTEX_unlock(&nlm_async_resp_mutex);
-
 		LogFullDebug(COMPONENT_NLM, "About to make clnt_call");
 
 		retval = clnt_call(host->slc_callback_clnt,
@@ -289,54 +408,42 @@ int nlm_send_async(int proc, state_nlm_client_t *host, void *inarg, void *key)
 		LogMajor(COMPONENT_NLM,
 			 "NLM async Client exceeded retry count %d",
 			 MAX_ASYNC_RETRY);
-		PTHREAD_MUTEX_lock(&nlm_async_resp_mutex);
-		resp_key = NULL;
-		PTHREAD_MUTEX_unlock(&nlm_async_resp_mutex);
-		return retval;
+		goto fail;
 	}
 
-	PTHREAD_MUTEX_lock(&nlm_async_resp_mutex);
-
-	if (resp_key != NULL) {
-		/* Wait for 5 seconds or a signal */
-		gettimeofday(&start, NULL);
-		gettimeofday(&now, NULL);
-		timeout.tv_sec = 5 + start.tv_sec;
-		timeout.tv_nsec = 0;
-
-		LogFullDebug(COMPONENT_NLM,
-			     "About to wait for signal for key %p", resp_key);
-
-		while (resp_key != NULL && now.tv_sec < (start.tv_sec + 5)) {
-			int rc;
-
-			rc = pthread_cond_timedwait(&nlm_async_resp_cond,
-						    &nlm_async_resp_mutex,
-						    &timeout);
-			LogFullDebug(COMPONENT_NLM,
-				     "pthread_cond_timedwait returned %d",
-				     rc);
-			gettimeofday(&now, NULL);
-		}
-		LogFullDebug(COMPONENT_NLM, "Done waiting");
-	}
+	return retval;
 
-	PTHREAD_MUTEX_unlock(&nlm_async_resp_mutex);
+ fail:
+	/* Nothing is coming back, stop waiting */
+	if (key != NULL)
+		nlm_signal_async_resp(key);
 
 	return retval;
 }
 
 void nlm_signal_async_resp(void *key)
 {
+	struct glist_head done = GLIST_HEAD_INIT(done);
+	struct glist_head *glist;
+	struct nlm_async_grant *grant;
+
 	PTHREAD_MUTEX_lock(&nlm_async_resp_mutex);
 
-	if (resp_key == key) {
-		resp_key = NULL;
-		pthread_cond_signal(&nlm_async_resp_cond);
-		LogFullDebug(COMPONENT_NLM, "Signaled condition variable");
-	} else {
-		LogFullDebug(COMPONENT_NLM, "Didn't signal condition variable");
+	glist_for_each(glist, &nlm_async_grants) {
+		grant = glist_entry(glist, struct nlm_async_grant, nag_list);
+
+		if (grant->nag_key == key) {
+			nlm_async_grant_done(grant, &done);
+			break;
+		}
 	}
 
 	PTHREAD_MUTEX_unlock(&nlm_async_resp_mutex);
+
+	if (glist_empty(&done))
+		LogFullDebug(COMPONENT_NLM, "No callback waiting for %p", key);
+	else
+		LogFullDebug(COMPONENT_NLM, "Got GRANTED_RES for %p", key);
+
+	nlm_async_release(&done);
 }
@@ -24,11 +24,24 @@
  */
 
 #include "config.h"
+#include <stdio.h>
+#include <unistd.h>
 #include <sys/utsname.h>
 #include "abstract_atomic.h"
 #include "gsh_rpc.h"
 #include "nsm.h"
 #include "sal_data.h"
+#include "nfs_core.h"
+#include "fridgethr.h"
+#include "city.h"
+
+/** Buckets of nsm_hash, a power of 2 */
+#define NSM_HASH_SIZE 1024
+/** Seconds between passes of the monitor thread when nothing wakes it */
+#define NSM_THREAD_DELAY 5
+
+#define NSM_CACHE_MAGIC 0x4e534d43	/* "NSMC" */
+#define NSM_CACHE_VERSION 1
 
 pthread_mutex_t nsm_mutex = PTHREAD_MUTEX_INITIALIZER;
 CLIENT *nsm_clnt;
@@ -36,6 +49,46 @@ AUTH *nsm_auth;
 unsigned long nsm_count;
 char *nodename;
 
+/**
+ * @brief A host rpc.statd monitors for us, or is about to
+ *
+ * Entries outlive the NSM clients using them: a host no longer in use
+ * stays registered with statd for NSM_Unmonitor_Delay seconds, so one
+ * that comes back within that time costs no SM_MON.  All fields are
+ * protected by nsm_cache_mutex.
+ */
+struct nsm_host {
+	struct glist_head nh_hash;	/*< On an nsm_hash bucket */
+	struct glist_head nh_list;	/*< On nsm_pending or nsm_idle */
+	time_t nh_idle_since;		/*< When it went on nsm_idle */
+	int32_t nh_users;		/*< NSM clients monitoring it */
+	bool nh_registered;		/*< statd has it */
+	bool nh_busy;			/*< SM_MON or SM_UNMON in flight */
+	char nh_name[];
+};
+
+/** Snapshot file header, followed by the node name and host names,
+    each as a uint16_t length and the bytes */
+struct nsm_cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;		/*< Host names following */
+};
+
+static pthread_mutex_t nsm_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct glist_head nsm_hash[NSM_HASH_SIZE];
+/** Hosts in use that statd does not have yet, in arrival order */
+static struct glist_head nsm_pending = { &nsm_pending, &nsm_pending };
+/** Registered hosts nobody uses, oldest first */
+static struct glist_head nsm_idle = { &nsm_idle, &nsm_idle };
+/** Whether nh_registered changed since NSM_Cache_File was written */
+static bool nsm_dirty;
+
+/** Runs the SM_MON and SM_UNMON calls */
+static struct fridgethr *nsm_fridge;
+/** Set at shutdown so a long pass stops early */
+static uint32_t nsm_stopping;
+
 bool nsm_connect(void)
 {
 	struct utsname utsname;
@@ -78,97 +131,245 @@ void nsm_disconnect(void)
 	}
 }
 
-bool nsm_monitor(state_nsm_client_t *host)
+/**
+ * @brief Find the nsm_hash bucket of a host name
+ *
+ * @note The nsm_cache_mutex MUST be held
+ */
+static struct glist_head *nsm_bucket(const char *name)
 {
-	enum clnt_stat ret;
-	struct mon nsm_mon;
-	struct sm_stat_res res;
-	struct timeval tout = { 25, 0 };
+	struct glist_head *head;
 
-	if (host == NULL)
-		return true;
+	head = &nsm_hash[CityHash64(name, strlen(name)) & (NSM_HASH_SIZE - 1)];
+	if (glist_null(head))
+		glist_init(head);
 
-	PTHREAD_MUTEX_lock(&host->ssc_mutex);
+	return head;
+}
 
-	if (atomic_fetch_int32_t(&host->ssc_monitored)) {
-		PTHREAD_MUTEX_unlock(&host->ssc_mutex);
-		return true;
+/**
+ * @brief Look up a host, adding it if asked to
+ *
+ * @note The nsm_cache_mutex MUST be held
+ *
+ * @param[in] name   Host name
+ * @param[in] create Whether to add a missing host
+ *
+ * @return The host, or NULL if missing and not created.
+ */
+static struct nsm_host *nsm_host_get(const char *name, bool create)
+{
+	struct glist_head *bucket = nsm_bucket(name);
+	struct glist_head *glist;
+	struct nsm_host *nh;
+	size_t len;
+
+	glist_for_each(glist, bucket) {
+		nh = glist_entry(glist, struct nsm_host, nh_hash);
+		if (strcmp(nh->nh_name, name) == 0)
+			return nh;
 	}
 
+	if (!create)
+		return NULL;
+
+	len = strlen(name) + 1;
+	nh = gsh_calloc(1, sizeof(*nh) + len);
+	memcpy(nh->nh_name, name, len);
+	glist_add(bucket, &nh->nh_hash);
+
+	return nh;
+}
+
+/**
+ * @brief Put a host where its users and statd state say it belongs
+ *
+ * In use and not registered, it waits on nsm_pending for SM_MON.
+ * Registered and unused, it waits on nsm_idle for SM_UNMON.  Neither,
+ * it is freed.  A host with a call in flight is settled once the call
+ * returns.
+ *
+ * @note The nsm_cache_mutex MUST be held
+ *
+ * @param[in] nh Host
+ *
+ * @return true if nsm_pending was empty and the thread should be woken.
+ */
+static bool nsm_host_settle(struct nsm_host *nh)
+{
+	bool wake = false;
+
+	if (nh->nh_busy)
+		return false;
+
+	glist_del(&nh->nh_list);
+
+	if (nh->nh_users > 0) {
+		if (!nh->nh_registered) {
+			wake = glist_empty(&nsm_pending);
+			glist_add_tail(&nsm_pending, &nh->nh_list);
+		}
+	} else if (nh->nh_registered) {
+		nh->nh_idle_since = time(NULL);
+		glist_add_tail(&nsm_idle, &nh->nh_list);
+	} else {
+		glist_del(&nh->nh_hash);
+		gsh_free(nh);
+	}
+
+	return wake;
+}
+
+/**
+ * @brief Make one SM_MON or SM_UNMON call to rpc.statd
+ *
+ * @param[in] name Host to monitor or unmonitor
+ * @param[in] mon  true for SM_MON, false for SM_UNMON
+ *
+ * @return true if statd did it.
+ */
+static bool nsm_call(char *name, bool mon)
+{
+	enum clnt_stat ret;
+	struct mon nsm_mon;
+	struct sm_stat_res res;
+	struct sm_stat unmon_res;
+	struct timeval tout = { 25, 0 };
+	const char *what = mon ? "monitor" : "unmonitor";
+
 	memset(&nsm_mon, 0, sizeof(nsm_mon));
-	nsm_mon.mon_id.mon_name = host->ssc_nlm_caller_name;
+	nsm_mon.mon_id.mon_name = name;
 	nsm_mon.mon_id.my_id.my_prog = NLMPROG;
 	nsm_mon.mon_id.my_id.my_vers = NLM4_VERS;
 	nsm_mon.mon_id.my_id.my_proc = NLMPROC4_SM_NOTIFY;
 	/* nothing to put in the private data */
-	LogDebug(COMPONENT_NLM, "Monitor %s", host->ssc_nlm_caller_name);
 
 	PTHREAD_MUTEX_lock(&nsm_mutex);
 
 	/* create a connection to nsm on the localhost */
 	if (!nsm_connect()) {
 		LogCrit(COMPONENT_NLM,
-			"Can not monitor %s clnt_create returned NULL",
-			nsm_mon.mon_id.mon_name);
+			"Can not %s %s clnt_create returned NULL",
+			what, name);
 		PTHREAD_MUTEX_unlock(&nsm_mutex);
-		PTHREAD_MUTEX_unlock(&host->ssc_mutex);
 		return false;
 	}
 
 	/* Set this after we call nsm_connect() */
 	nsm_mon.mon_id.my_id.my_name = nodename;
 
-	ret = clnt_call(nsm_clnt,
-			nsm_auth,
-			SM_MON,
-			(xdrproc_t) xdr_mon,
-			&nsm_mon,
-			(xdrproc_t) xdr_sm_stat_res,
-			&res,
-			tout);
+	if (mon)
+		ret = clnt_call(nsm_clnt,
+				nsm_auth,
+				SM_MON,
+				(xdrproc_t) xdr_mon,
+				&nsm_mon,
+				(xdrproc_t) xdr_sm_stat_res,
+				&res,
+				tout);
+	else
+		ret = clnt_call(nsm_clnt,
+				nsm_auth,
+				SM_UNMON,
+				(xdrproc_t) xdr_mon_id,
+				&nsm_mon.mon_id,
+				(xdrproc_t) xdr_sm_stat,
+				&unmon_res,
+				tout);
 
 	if (ret != RPC_SUCCESS) {
 		LogCrit(COMPONENT_NLM,
-			"Can not monitor %s SM_MON ret %d %s",
-			nsm_mon.mon_id.mon_name,
+			"Can not %s %s SM_%s ret %d %s",
+			what, name, mon ? "MON" : "UNMON",
 			ret,
 			clnt_sperror(nsm_clnt, ""));
 
 		nsm_disconnect();
 		PTHREAD_MUTEX_unlock(&nsm_mutex);
-		PTHREAD_MUTEX_unlock(&host->ssc_mutex);
 		return false;
 	}
 
-	if (res.res_stat != STAT_SUCC) {
+	if (mon && res.res_stat != STAT_SUCC) {
 		LogCrit(COMPONENT_NLM,
 			"Can not monitor %s SM_MON status %d",
-			nsm_mon.mon_id.mon_name, res.res_stat);
+			name, res.res_stat);
 
 		nsm_disconnect();
 		PTHREAD_MUTEX_unlock(&nsm_mutex);
-		PTHREAD_MUTEX_unlock(&host->ssc_mutex);
 		return false;
 	}
 
-	nsm_count++;
-	atomic_store_int32_t(&host->ssc_monitored, true);
+	if (mon)
+		nsm_count++;
+	else
+		nsm_count--;
 
-	LogDebug(COMPONENT_NLM,
-		 "Monitored %s for nodename %s",
-		 nsm_mon.mon_id.mon_name, nodename);
+	LogDebug(COMPONENT_NLM, "%s %s for nodename %s",
+		 mon ? "Monitored" : "Unmonitored", name, nodename);
+
+	nsm_disconnect();
 
 	PTHREAD_MUTEX_unlock(&nsm_mutex);
+	return true;
+}
+
+/**
+ * @brief Have statd monitor a host
+ *
+ * The SM_MON is left to the NSM thread, so the lock request that
+ * called this never waits on statd.  A host statd already monitors for
+ * us, because it was in use a short while ago or is in NSM_Cache_File,
+ * needs no call at all.
+ *
+ * @param[in] host NSM client
+ *
+ * @return true; a failed SM_MON is retried in the background.
+ */
+bool nsm_monitor(state_nsm_client_t *host)
+{
+	struct nsm_host *nh;
+	bool wake;
+
+	if (host == NULL)
+		return true;
+
+	PTHREAD_MUTEX_lock(&host->ssc_mutex);
+
+	if (atomic_fetch_int32_t(&host->ssc_monitored)) {
+		PTHREAD_MUTEX_unlock(&host->ssc_mutex);
+		return true;
+	}
+
+	PTHREAD_MUTEX_lock(&nsm_cache_mutex);
+	nh = nsm_host_get(host->ssc_nlm_caller_name, true);
+	nh->nh_users++;
+	wake = nsm_host_settle(nh);
+	LogDebug(COMPONENT_NLM, "Monitor %s%s", host->ssc_nlm_caller_name,
+		 nh->nh_registered ? ", already registered" : "");
+	PTHREAD_MUTEX_unlock(&nsm_cache_mutex);
+
+	atomic_store_int32_t(&host->ssc_monitored, true);
 	PTHREAD_MUTEX_unlock(&host->ssc_mutex);
+
+	if (wake && nsm_fridge != NULL)
+		(void) fridgethr_wake(nsm_fridge);
+
 	return true;
 }
 
+/**
+ * @brief Stop monitoring a host
+ *
+ * The host stays registered with statd for NSM_Unmonitor_Delay seconds
+ * before the NSM thread unmonitors it.
+ *
+ * @param[in] host NSM client
+ *
+ * @return true.
+ */
 bool nsm_unmonitor(state_nsm_client_t *host)
 {
-	enum clnt_stat ret;
-	struct sm_stat res;
-	struct mon_id nsm_mon_id;
-	struct timeval tout = { 25, 0 };
+	struct nsm_host *nh;
 
 	if (host == NULL)
 		return true;
@@ -180,59 +381,323 @@ bool nsm_unmonitor(state_nsm_client_t *host)
 		return true;
 	}
 
-	nsm_mon_id.mon_name = host->ssc_nlm_caller_name;
-	nsm_mon_id.my_id.my_prog = NLMPROG;
-	nsm_mon_id.my_id.my_vers = NLM4_VERS;
-	nsm_mon_id.my_id.my_proc = NLMPROC4_SM_NOTIFY;
+	PTHREAD_MUTEX_lock(&nsm_cache_mutex);
+	nh = nsm_host_get(host->ssc_nlm_caller_name, false);
+	if (nh != NULL) {
+		nh->nh_users--;
+		(void) nsm_host_settle(nh);
+	}
+	PTHREAD_MUTEX_unlock(&nsm_cache_mutex);
 
-	PTHREAD_MUTEX_lock(&nsm_mutex);
+	atomic_store_int32_t(&host->ssc_monitored, false);
 
-	/* create a connection to nsm on the localhost */
-	if (!nsm_connect()) {
-		LogCrit(COMPONENT_NLM,
-			"Can not unmonitor %s clnt_create returned NULL",
-			nsm_mon_id.mon_name);
-		PTHREAD_MUTEX_unlock(&nsm_mutex);
-		PTHREAD_MUTEX_unlock(&host->ssc_mutex);
-		return false;
+	LogDebug(COMPONENT_NLM, "Unmonitor %s deferred",
+		 host->ssc_nlm_caller_name);
+
+	PTHREAD_MUTEX_unlock(&host->ssc_mutex);
+	return true;
+}
+
+/**
+ * @brief SM_MON the hosts waiting on nsm_pending
+ *
+ * Stops at the first failure, statd is most likely down; the rest are
+ * tried again on the next pass.
+ */
+static void nsm_mon_pending(void)
+{
+	struct nsm_host *nh;
+	bool ok;
+
+	PTHREAD_MUTEX_lock(&nsm_cache_mutex);
+
+	while (!atomic_fetch_uint32_t(&nsm_stopping)) {
+		nh = glist_first_entry(&nsm_pending, struct nsm_host, nh_list);
+		if (nh == NULL)
+			break;
+
+		glist_del(&nh->nh_list);
+		nh->nh_busy = true;
+		PTHREAD_MUTEX_unlock(&nsm_cache_mutex);
+
+		ok = nsm_call(nh->nh_name, true);
+
+		PTHREAD_MUTEX_lock(&nsm_cache_mutex);
+		nh->nh_busy = false;
+
+		if (ok) {
+			nh->nh_registered = true;
+			nsm_dirty = true;
+		} else if (nh->nh_users > 0) {
+			/* Keep its place at the head */
+			glist_add(&nsm_pending, &nh->nh_list);
+			break;
+		}
+
+		(void) nsm_host_settle(nh);
 	}
 
-	/* Set this after we call nsm_connect() */
-	nsm_mon_id.my_id.my_name = nodename;
+	PTHREAD_MUTEX_unlock(&nsm_cache_mutex);
+}
 
-	ret = clnt_call(nsm_clnt,
-			nsm_auth,
-			SM_UNMON,
-			(xdrproc_t) xdr_mon_id,
-			&nsm_mon_id,
-			(xdrproc_t) xdr_sm_stat,
-			&res,
-			tout);
+/**
+ * @brief SM_UNMON the hosts idle for NSM_Unmonitor_Delay seconds
+ */
+static void nsm_unmon_idle(void)
+{
+	time_t delay = nfs_param.core_param.nsm_unmonitor_delay;
+	time_t now = time(NULL);
+	struct nsm_host *nh;
+	bool ok;
 
-	if (ret != RPC_SUCCESS) {
-		LogCrit(COMPONENT_NLM,
-			"Can not unmonitor %s SM_MON ret %d %s",
-			nsm_mon_id.mon_name,
-			ret,
-			clnt_sperror(nsm_clnt, ""));
+	PTHREAD_MUTEX_lock(&nsm_cache_mutex);
 
-		nsm_disconnect();
-		PTHREAD_MUTEX_unlock(&nsm_mutex);
-		PTHREAD_MUTEX_unlock(&host->ssc_mutex);
+	while (!atomic_fetch_uint32_t(&nsm_stopping)) {
+		nh = glist_first_entry(&nsm_idle, struct nsm_host, nh_list);
+		if (nh == NULL || nh->nh_idle_since + delay > now)
+			break;
+
+		glist_del(&nh->nh_list);
+		nh->nh_busy = true;
+		PTHREAD_MUTEX_unlock(&nsm_cache_mutex);
+
+		ok = nsm_call(nh->nh_name, false);
+
+		PTHREAD_MUTEX_lock(&nsm_cache_mutex);
+		nh->nh_busy = false;
+
+		if (ok) {
+			nh->nh_registered = false;
+			nsm_dirty = true;
+		}
+
+		/* A failed one goes to the tail and waits out another delay,
+		 * one back in use meanwhile is monitored again next pass.
+		 */
+		(void) nsm_host_settle(nh);
+
+		if (!ok)
+			break;
+	}
+
+	PTHREAD_MUTEX_unlock(&nsm_cache_mutex);
+}
+
+static bool nsm_write_name(FILE *fp, const char *name)
+{
+	uint16_t len = strlen(name);
+
+	return fwrite(&len, sizeof(len), 1, fp) == 1 &&
+	       fwrite(name, len, 1, fp) == 1;
+}
+
+/**
+ * @brief Write the registered hosts to NSM_Cache_File
+ *
+ * The names are copied under nsm_cache_mutex and written without it,
+ * beside the file and renamed over it, so a crash mid-write leaves the
+ * previous one intact.
+ */
+static void nsm_cache_save(void)
+{
+	const char *path = nfs_param.core_param.nsm_cache_file;
+	struct nsm_cache_hdr hdr = { NSM_CACHE_MAGIC, NSM_CACHE_VERSION, 0 };
+	struct utsname utsname;
+	struct glist_head *glist;
+	struct nsm_host *nh;
+	char **names = NULL;
+	uint32_t count = 0, max = 0, i;
+	char *tmp = NULL;
+	FILE *fp = NULL;
+	int b, rc = 0;
+
+	if (uname(&utsname) == -1) {
+		rc = errno;
+		goto out;
+	}
+
+	PTHREAD_MUTEX_lock(&nsm_cache_mutex);
+	nsm_dirty = false;
+	for (b = 0; b < NSM_HASH_SIZE; b++) {
+		if (glist_null(&nsm_hash[b]))
+			continue;
+		glist_for_each(glist, &nsm_hash[b]) {
+			nh = glist_entry(glist, struct nsm_host, nh_hash);
+			if (!nh->nh_registered)
+				continue;
+			if (count == max) {
+				max = max ? max * 2 : 64;
+				names = gsh_realloc(names,
+						    max * sizeof(*names));
+			}
+			names[count++] = gsh_strdup(nh->nh_name);
+		}
+	}
+	PTHREAD_MUTEX_unlock(&nsm_cache_mutex);
+
+	hdr.count = count;
+	tmp = gsh_malloc(strlen(path) + sizeof(".tmp"));
+	sprintf(tmp, "%s.tmp", path);
+
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		rc = errno;
+		goto out;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    !nsm_write_name(fp, utsname.nodename))
+		rc = EIO;
+
+	for (i = 0; rc == 0 && i < count; i++) {
+		if (!nsm_write_name(fp, names[i]))
+			rc = EIO;
+	}
+
+	if (rc == 0 && (fflush(fp) != 0 || fsync(fileno(fp)) != 0))
+		rc = errno ? errno : EIO;
+
+	if (fclose(fp) != 0 && rc == 0)
+		rc = errno;
+
+	if (rc == 0 && rename(tmp, path) != 0)
+		rc = errno;
+
+	if (rc != 0)
+		(void) unlink(tmp);
+	else
+		LogDebug(COMPONENT_NLM,
+			 "Saved %"PRIu32" monitored hosts to %s", count, path);
+
+out:
+	if (rc != 0) {
+		LogWarn(COMPONENT_NLM,
+			"Unable to save NSM cache file %s: %s",
+			path, strerror(rc));
+		/* Try again next pass */
+		PTHREAD_MUTEX_lock(&nsm_cache_mutex);
+		nsm_dirty = true;
+		PTHREAD_MUTEX_unlock(&nsm_cache_mutex);
+	}
+	for (i = 0; i < count; i++)
+		gsh_free(names[i]);
+	gsh_free(names);
+	gsh_free(tmp);
+}
+
+static bool nsm_read_name(FILE *fp, char *name)
+{
+	uint16_t len;
+
+	if (fread(&len, sizeof(len), 1, fp) != 1 || len == 0 ||
+	    len > LM_MAXSTRLEN || fread(name, len, 1, fp) != 1)
+		return false;
+
+	name[len] = '\0';
+	return true;
+}
+
+/**
+ * @brief Read back the hosts statd monitored for us before the restart
+ *
+ * They start out idle, so the ones whose clients do not come back are
+ * unmonitored after NSM_Unmonitor_Delay.
+ *
+ * @return false if there is nothing usable, and statd's list for us
+ *         must be cleared instead.
+ */
+static bool nsm_cache_load(void)
+{
+	const char *path = nfs_param.core_param.nsm_cache_file;
+	char name[LM_MAXSTRLEN + 1];
+	struct nsm_cache_hdr hdr;
+	struct utsname utsname;
+	struct nsm_host *nh;
+	uint32_t i, loaded = 0;
+	bool ok = false;
+	FILE *fp;
+
+	if (path == NULL)
+		return false;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		if (errno != ENOENT)
+			LogWarn(COMPONENT_NLM,
+				"Unable to open NSM cache file %s: %s",
+				path, strerror(errno));
 		return false;
 	}
 
-	atomic_store_int32_t(&host->ssc_monitored, false);
-	nsm_count--;
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    hdr.magic != NSM_CACHE_MAGIC ||
+	    hdr.version != NSM_CACHE_VERSION || !nsm_read_name(fp, name)) {
+		LogWarn(COMPONENT_NLM,
+			"Ignoring NSM cache file %s, bad header", path);
+		goto out;
+	}
 
-	LogDebug(COMPONENT_NLM, "Unonitored %s for nodename %s",
-		 nsm_mon_id.mon_name, nodename);
+	/* statd registrations are by our node name too */
+	if (uname(&utsname) == -1 || strcmp(utsname.nodename, name) != 0) {
+		LogEvent(COMPONENT_NLM,
+			 "Ignoring NSM cache file %s, written by node %s",
+			 path, name);
+		goto out;
+	}
 
-	nsm_disconnect();
+	ok = true;
+
+	PTHREAD_MUTEX_lock(&nsm_cache_mutex);
+	for (i = 0; i < hdr.count; i++) {
+		if (!nsm_read_name(fp, name)) {
+			LogWarn(COMPONENT_NLM,
+				"NSM cache file %s truncated at host %"PRIu32,
+				path, i);
+			break;
+		}
+
+		nh = nsm_host_get(name, true);
+		if (nh->nh_registered)
+			continue;
 
+		nh->nh_registered = true;
+		(void) nsm_host_settle(nh);
+		loaded++;
+	}
+	PTHREAD_MUTEX_unlock(&nsm_cache_mutex);
+
+	PTHREAD_MUTEX_lock(&nsm_mutex);
+	nsm_count += loaded;
 	PTHREAD_MUTEX_unlock(&nsm_mutex);
-	PTHREAD_MUTEX_unlock(&host->ssc_mutex);
-	return true;
+
+	LogEvent(COMPONENT_NLM,
+		 "Loaded %"PRIu32" monitored hosts from NSM cache file %s",
+		 loaded, path);
+out:
+	fclose(fp);
+	return ok;
+}
+
+/**
+ * @brief NSM thread pass
+ *
+ * @param[in] ctx Fridge context
+ */
+static void nsm_run(struct fridgethr_context *ctx)
+{
+	bool dirty;
+
+	SetNameFunction("nsm");
+
+	nsm_mon_pending();
+	nsm_unmon_idle();
+
+	PTHREAD_MUTEX_lock(&nsm_cache_mutex);
+	dirty = nsm_dirty;
+	PTHREAD_MUTEX_unlock(&nsm_cache_mutex);
+
+	if (dirty && nfs_param.core_param.nsm_cache_file != NULL)
+		nsm_cache_save();
 }
 
 void nsm_unmonitor_all(void)
@@ -278,3 +743,64 @@ void nsm_unmonitor_all(void)
 	nsm_disconnect();
 	PTHREAD_MUTEX_unlock(&nsm_mutex);
 }
+
+/**
+ * @brief Start the NSM thread
+ *
+ * Hosts statd still monitors from before the restart are read back from
+ * NSM_Cache_File; without one, statd is told to forget them all.
+ */
+void nsm_start(void)
+{
+	struct fridgethr_params frp;
+	int rc;
+
+	if (!nsm_cache_load())
+		nsm_unmonitor_all();
+
+	memset(&frp, 0, sizeof(struct fridgethr_params));
+	frp.thr_max = 1;
+	frp.thr_min = 1;
+	frp.thread_delay = NSM_THREAD_DELAY;
+	frp.flavor = fridgethr_flavor_looper;
+
+	rc = fridgethr_init(&nsm_fridge, "NSM", &frp);
+	if (rc == 0)
+		rc = fridgethr_submit(nsm_fridge, nsm_run, NULL);
+	if (rc != 0)
+		LogFatal(COMPONENT_NLM,
+			 "Unable to start NSM thread, error code %d.", rc);
+}
+
+/**
+ * @brief Stop the NSM thread and save the monitored hosts
+ *
+ * Hosts still waiting for SM_UNMON stay registered with statd; they are
+ * in NSM_Cache_File for the next start to deal with.
+ */
+void nsm_shutdown(void)
+{
+	int rc;
+
+	if (nsm_fridge == NULL)
+		return;
+
+	atomic_store_uint32_t(&nsm_stopping, 1);
+
+	rc = fridgethr_sync_command(nsm_fridge, fridgethr_comm_stop, 120);
+
+	if (rc == ETIMEDOUT) {
+		LogMajor(COMPONENT_NLM,
+			 "Shutdown timed out, cancelling NSM thread.");
+		fridgethr_cancel(nsm_fridge);
+	} else if (rc != 0) {
+		LogMajor(COMPONENT_NLM,
+			 "Failed shutting down NSM thread: %d", rc);
+	}
+
+	fridgethr_destroy(nsm_fridge);
+	nsm_fridge = NULL;
+
+	if (nfs_param.core_param.nsm_cache_file != NULL)
+		nsm_cache_save();
+}
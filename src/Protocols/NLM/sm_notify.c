@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <rpc/types.h>
 #include <rpc/nettype.h>
 #include <sys/socket.h>
@@ -12,13 +13,31 @@
 
 #define STR_SIZE 100
 
-#define USAGE "usage: %s [-p <port>] -l <local address> " \
-	"-m <monitor host> -r <remote address> -s <state>\n"
+/* Hosts notified at once and seconds allowed for each by default */
+#define DEFAULT_PARALLEL 32
+#define DEFAULT_TIMEOUT 25
+#define MAX_PARALLEL 1024
+
+#define USAGE "usage: %s [-p <port>] [-P <parallel>] [-t <timeout>] " \
+	"-l <local address> -m <monitor host> -s <state> " \
+	"-r <remote address> [-r <remote address> ...]\n"
 
 #define ERR_MSG1 "%s address too long\n"
 
-/* Default timeout can be changed using clnt_control() */
-static struct timeval TIMEOUT = { 25, 0 };
+/* Timeout for each host, set with -t */
+static struct timeval TIMEOUT = { DEFAULT_TIMEOUT, 0 };
+
+static int port;
+static int state;
+static char mon_client[STR_SIZE];
+static char local_addr_s[STR_SIZE];
+
+/* Remote hosts, handed out to the notify threads in order */
+static char **remote_addrs;
+static int remote_count;
+static int remote_next;
+static int remote_failed;
+static pthread_mutex_t remote_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* This function is dragged in by the use of abstract_mem.h, so
  * we define a simple version that does a printf rather than
@@ -34,7 +53,7 @@ void LogMallocFailure(const char *file, int line, const char *function,
 void *
 nsm_notify_1(notify *argp, CLIENT *clnt)
 {
-	static char clnt_res;
+	static __thread char clnt_res;
 	AUTH *nsm_auth;
 
 	nsm_auth = authnone_create();
@@ -49,28 +68,140 @@ nsm_notify_1(notify *argp, CLIENT *clnt)
 	return (void *)&clnt_res;
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief Send SM_NOTIFY to one remote host
+ *
+ * @return 0 if the host acknowledged, -1 otherwise.
+ */
+static int notify_host(const char *remote_addr_s)
 {
-	int c;
-	int port = 0;
-	int state = 0, sflag = 0;
-	char mon_client[STR_SIZE], mflag = 0;
-	char remote_addr_s[STR_SIZE], rflag = 0;
-	char local_addr_s[STR_SIZE], lflag = 0;
 	notify arg;
 	CLIENT *clnt;
 	struct netbuf *buf;
-	char port_str[20];
-
 	struct sockaddr_in local_addr;
-
 	int fd;
+	int one = 1;
+	int rc = -1;
+
+	/* create a udp socket */
+	fd = socket(PF_INET, SOCK_DGRAM|SOCK_NONBLOCK, IPPROTO_UDP);
+	if (fd < 0) {
+		fprintf(stderr, "socket call failed. errno=%d\n", errno);
+		return -1;
+	}
+
+	/* every thread binds its own socket to the same local port */
+	(void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	/* set up the sockaddr for local endpoint */
+	memset(&local_addr, 0, sizeof(struct sockaddr_in));
+	local_addr.sin_family = PF_INET;
+	local_addr.sin_port = htons(port);
+	local_addr.sin_addr.s_addr = inet_addr(local_addr_s);
+
+	if (bind(fd, (struct sockaddr *)&local_addr,
+			sizeof(struct sockaddr)) < 0) {
+		fprintf(stderr, "bind call failed. errno=%d\n", errno);
+		close(fd);
+		return -1;
+	}
+
+	/* find the port for SM service of the remote server */
+	buf = rpcb_find_mapped_addr(
+				"udp",
+				SM_PROG, SM_VERS,
+				(char *) remote_addr_s);
+
+	/* handle error here, for example,
+	 * client side blocking rpc call
+	 */
+	if (buf == NULL) {
+		fprintf(stderr, "%s: cannot find SM service\n",
+			remote_addr_s);
+		close(fd);
+		return -1;
+	}
+
+	clnt = clnt_dg_ncreate(fd, buf, SM_PROG,
+			SM_VERS, 0, 0);
+
+	arg.my_name = mon_client;
+	arg.state = state;
+	if (nsm_notify_1(&arg, clnt) != NULL)
+		rc = 0;
+	else
+		fprintf(stderr, "%s: SM_NOTIFY failed\n", remote_addr_s);
+
+	/* free resources */
+	gsh_free(buf->buf);
+	gsh_free(buf);
+	clnt_destroy(clnt);
+
+	close(fd);
+
+	return rc;
+}
+
+/**
+ * @brief Notify remote hosts until there are none left
+ *
+ * A host that does not answer only holds up the thread notifying it,
+ * and for no longer than the timeout.
+ */
+static void *notify_thread(void *arg)
+{
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&remote_mutex);
+		i = remote_next++;
+		pthread_mutex_unlock(&remote_mutex);
 
-	while ((c = getopt(argc, argv, "p:r:m:l:s:")) != EOF)
+		if (i >= remote_count)
+			break;
+
+		if (notify_host(remote_addrs[i]) != 0) {
+			pthread_mutex_lock(&remote_mutex);
+			remote_failed++;
+			pthread_mutex_unlock(&remote_mutex);
+		}
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int c, i;
+	int sflag = 0;
+	char mflag = 0;
+	char lflag = 0;
+	int parallel = DEFAULT_PARALLEL;
+	pthread_t *threads;
+	int started;
+
+	remote_addrs = gsh_calloc(argc, sizeof(*remote_addrs));
+
+	while ((c = getopt(argc, argv, "p:P:r:m:l:s:t:")) != EOF)
 		switch (c) {
 		case 'p':
 			port = atoi(optarg);
 			break;
+		case 'P':
+			parallel = atoi(optarg);
+			if (parallel < 1 || parallel > MAX_PARALLEL) {
+				fprintf(stderr, "parallel must be 1 to %d\n",
+					MAX_PARALLEL);
+				exit(1);
+			}
+			break;
+		case 't':
+			TIMEOUT.tv_sec = atoi(optarg);
+			if (TIMEOUT.tv_sec < 1) {
+				fprintf(stderr, "timeout must be at least 1\n");
+				exit(1);
+			}
+			break;
 		case 's':
 			state = atoi(optarg);
 			sflag = 1;
@@ -88,8 +219,7 @@ int main(int argc, char **argv)
 				fprintf(stderr, ERR_MSG1, "remote address");
 				exit(1);
 			}
-			strcpy(remote_addr_s, optarg);
-			rflag = 1;
+			remote_addrs[remote_count++] = optarg;
 			break;
 		case 'l':
 			if (strlen(optarg) >= STR_SIZE) {
@@ -106,63 +236,34 @@ int main(int argc, char **argv)
 			break;
 	}
 
-	if ((sflag + lflag + mflag + rflag) != 4) {
+	if ((sflag + lflag + mflag) != 3 || remote_count == 0) {
 		fprintf(stderr, USAGE, argv[0]);
 		exit(1);
 	}
 
+	if (parallel > remote_count)
+		parallel = remote_count;
 
-	/* create a udp socket */
-	fd = socket(PF_INET, SOCK_DGRAM|SOCK_NONBLOCK, IPPROTO_UDP);
-	if (fd < 0) {
-		fprintf(stderr, "socket call failed. errno=%d\n", errno);
-		exit(1);
-	}
-
-	/* set up the sockaddr for local endpoint */
-	memset(&local_addr, 0, sizeof(struct sockaddr_in));
-	local_addr.sin_family = PF_INET;
-	local_addr.sin_port = htons(port);
-	local_addr.sin_addr.s_addr = inet_addr(local_addr_s);
-
-	if (bind(fd, (struct sockaddr *)&local_addr,
-			sizeof(struct sockaddr)) < 0) {
-		fprintf(stderr, "bind call failed. errno=%d\n", errno);
-		exit(1);
-	}
-
-	/* find the port for SM service of the remote server */
-	buf = rpcb_find_mapped_addr(
-				"udp",
-				SM_PROG, SM_VERS,
-				remote_addr_s);
+	threads = gsh_calloc(parallel, sizeof(*threads));
 
-	/* handle error here, for example,
-	 * client side blocking rpc call
-	 */
-	if (buf == NULL) {
-		close(fd);
-		exit(1);
+	/* This thread notifies hosts too, so start one less */
+	for (started = 0; started < parallel - 1; started++) {
+		if (pthread_create(&threads[started], NULL,
+				   notify_thread, NULL) != 0)
+			break;
 	}
 
-	/* convert port to string format */
-	sprintf(port_str, "%d",
-		htons(((struct sockaddr_in *)
-		buf->buf)->sin_port));
-
-	clnt = clnt_dg_ncreate(fd, buf, SM_PROG,
-			SM_VERS, 0, 0);
+	notify_thread(NULL);
 
-	arg.my_name = mon_client;
-	arg.state = state;
-	nsm_notify_1(&arg, clnt);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
 
-	/* free resources */
-	gsh_free(buf->buf);
-	gsh_free(buf);
-	clnt_destroy(clnt);
+	gsh_free(threads);
+	gsh_free(remote_addrs);
 
-	close(fd);
+	if (remote_failed != 0)
+		fprintf(stderr, "%d of %d hosts not notified\n",
+			remote_failed, remote_count);
 
 	return 0;
 }
@@ -13,6 +13,80 @@ static struct nfs_request_lookahead dummy_lookahead = {
 	.write = 0
 };
 
+/*
+ * The hot NFSv3 procedures move their fixed-size runs of fields straight
+ * in and out of the stream's buffer when XDR_INLINE() can hand out a
+ * contiguous span, as rpcgen -i would: arguments on decode, results on
+ * encode.  When the run straddles a buffer boundary, the per-field calls
+ * that follow each inline block do the work as before.
+ */
+#define IXDR_PUT_NFS3_UINT64(buf, v) do {			\
+	IXDR_PUT_U_INT32(buf, (uint32_t)((v) >> 32));		\
+	IXDR_PUT_U_INT32(buf, (uint32_t)(v));			\
+} while (0)
+
+#define IXDR_GET_NFS3_UINT64(buf, v) do {			\
+	(v) = (nfs3_uint64)IXDR_GET_U_INT32(buf) << 32;	\
+	(v) |= IXDR_GET_U_INT32(buf);				\
+} while (0)
+
+#define FATTR3_XDR_UNITS 21
+#define WCC_ATTR_XDR_UNITS 6
+
+static inline int32_t *ixdr_put_fattr3(int32_t *buf, const fattr3 *objp)
+{
+	IXDR_PUT_ENUM(buf, objp->type);
+	IXDR_PUT_U_INT32(buf, objp->mode);
+	IXDR_PUT_U_INT32(buf, objp->nlink);
+	IXDR_PUT_U_INT32(buf, objp->uid);
+	IXDR_PUT_U_INT32(buf, objp->gid);
+	IXDR_PUT_NFS3_UINT64(buf, objp->size);
+	IXDR_PUT_NFS3_UINT64(buf, objp->used);
+	IXDR_PUT_U_INT32(buf, objp->rdev.specdata1);
+	IXDR_PUT_U_INT32(buf, objp->rdev.specdata2);
+	IXDR_PUT_NFS3_UINT64(buf, objp->fsid);
+	IXDR_PUT_NFS3_UINT64(buf, objp->fileid);
+	IXDR_PUT_U_INT32(buf, objp->atime.tv_sec);
+	IXDR_PUT_U_INT32(buf, objp->atime.tv_nsec);
+	IXDR_PUT_U_INT32(buf, objp->mtime.tv_sec);
+	IXDR_PUT_U_INT32(buf, objp->mtime.tv_nsec);
+	IXDR_PUT_U_INT32(buf, objp->ctime.tv_sec);
+	IXDR_PUT_U_INT32(buf, objp->ctime.tv_nsec);
+	return buf;
+}
+
+static inline int32_t *ixdr_get_fattr3(int32_t *buf, fattr3 *objp)
+{
+	objp->type = IXDR_GET_ENUM(buf, ftype3);
+	objp->mode = IXDR_GET_U_INT32(buf);
+	objp->nlink = IXDR_GET_U_INT32(buf);
+	objp->uid = IXDR_GET_U_INT32(buf);
+	objp->gid = IXDR_GET_U_INT32(buf);
+	IXDR_GET_NFS3_UINT64(buf, objp->size);
+	IXDR_GET_NFS3_UINT64(buf, objp->used);
+	objp->rdev.specdata1 = IXDR_GET_U_INT32(buf);
+	objp->rdev.specdata2 = IXDR_GET_U_INT32(buf);
+	IXDR_GET_NFS3_UINT64(buf, objp->fsid);
+	IXDR_GET_NFS3_UINT64(buf, objp->fileid);
+	objp->atime.tv_sec = IXDR_GET_U_INT32(buf);
+	objp->atime.tv_nsec = IXDR_GET_U_INT32(buf);
+	objp->mtime.tv_sec = IXDR_GET_U_INT32(buf);
+	objp->mtime.tv_nsec = IXDR_GET_U_INT32(buf);
+	objp->ctime.tv_sec = IXDR_GET_U_INT32(buf);
+	objp->ctime.tv_nsec = IXDR_GET_U_INT32(buf);
+	return buf;
+}
+
+static inline int32_t *ixdr_put_wcc_attr(int32_t *buf, const wcc_attr *objp)
+{
+	IXDR_PUT_NFS3_UINT64(buf, objp->size);
+	IXDR_PUT_U_INT32(buf, objp->mtime.tv_sec);
+	IXDR_PUT_U_INT32(buf, objp->mtime.tv_nsec);
+	IXDR_PUT_U_INT32(buf, objp->ctime.tv_sec);
+	IXDR_PUT_U_INT32(buf, objp->ctime.tv_nsec);
+	return buf;
+}
+
 bool xdr_nfspath2(xdrs, objp)
 register XDR *xdrs;
 nfspath2 *objp;
@@ -481,12 +555,21 @@ register XDR *xdrs;
 fattr3 *objp;
 {
 
-#if defined(_LP64) || defined(_KERNEL)
-	register int __attribute__ ((__unused__)) * buf;
-#else
-	register long __attribute__ ((__unused__)) * buf;
-#endif
-
+	register int32_t *buf;
+
+	if (xdrs->x_op == XDR_ENCODE) {
+		buf = XDR_INLINE(xdrs, FATTR3_XDR_UNITS * BYTES_PER_XDR_UNIT);
+		if (buf != NULL) {
+			ixdr_put_fattr3(buf, objp);
+			return (true);
+		}
+	} else if (xdrs->x_op == XDR_DECODE) {
+		buf = XDR_INLINE(xdrs, FATTR3_XDR_UNITS * BYTES_PER_XDR_UNIT);
+		if (buf != NULL) {
+			ixdr_get_fattr3(buf, objp);
+			return (true);
+		}
+	}
 	if (!xdr_ftype3(xdrs, &objp->type))
 		return (false);
 	if (!xdr_mode3(xdrs, &objp->mode))
@@ -521,12 +604,17 @@ register XDR *xdrs;
 post_op_attr *objp;
 {
 
-#if defined(_LP64) || defined(_KERNEL)
-	register int __attribute__ ((__unused__)) * buf;
-#else
-	register long __attribute__ ((__unused__)) * buf;
-#endif
+	register int32_t *buf;
 
+	if (xdrs->x_op == XDR_ENCODE && objp->attributes_follow) {
+		buf = XDR_INLINE(xdrs,
+				 (1 + FATTR3_XDR_UNITS) * BYTES_PER_XDR_UNIT);
+		if (buf != NULL) {
+			IXDR_PUT_BOOL(buf, TRUE);
+			ixdr_put_fattr3(buf, &objp->post_op_attr_u.attributes);
+			return (true);
+		}
+	}
 	if (!xdr_bool(xdrs, &objp->attributes_follow))
 		return (false);
 	switch (objp->attributes_follow) {
@@ -547,12 +635,15 @@ register XDR *xdrs;
 wcc_attr *objp;
 {
 
-#if defined(_LP64) || defined(_KERNEL)
-	register int __attribute__ ((__unused__)) * buf;
-#else
-	register long __attribute__ ((__unused__)) * buf;
-#endif
+	register int32_t *buf;
 
+	if (xdrs->x_op == XDR_ENCODE) {
+		buf = XDR_INLINE(xdrs, WCC_ATTR_XDR_UNITS * BYTES_PER_XDR_UNIT);
+		if (buf != NULL) {
+			ixdr_put_wcc_attr(buf, objp);
+			return (true);
+		}
+	}
 	if (!xdr_size3(xdrs, &objp->size))
 		return (false);
 	if (!xdr_nfstime3(xdrs, &objp->mtime))
@@ -567,12 +658,17 @@ register XDR *xdrs;
 pre_op_attr *objp;
 {
 
-#if defined(_LP64) || defined(_KERNEL)
-	register int __attribute__ ((__unused__)) * buf;
-#else
-	register long __attribute__ ((__unused__)) * buf;
-#endif
+	register int32_t *buf;
 
+	if (xdrs->x_op == XDR_ENCODE && objp->attributes_follow) {
+		buf = XDR_INLINE(xdrs,
+				 (1 + WCC_ATTR_XDR_UNITS) * BYTES_PER_XDR_UNIT);
+		if (buf != NULL) {
+			IXDR_PUT_BOOL(buf, TRUE);
+			ixdr_put_wcc_attr(buf, &objp->pre_op_attr_u.attributes);
+			return (true);
+		}
+	}
 	if (!xdr_bool(xdrs, &objp->attributes_follow))
 		return (false);
 	switch (objp->attributes_follow) {
@@ -1227,21 +1323,25 @@ bool xdr_READ3args(xdrs, objp)
 register XDR *xdrs;
 READ3args *objp;
 {
-#if defined(_LP64) || defined(_KERNEL)
-	register int __attribute__ ((__unused__)) * buf;
-#else
-	register long __attribute__ ((__unused__)) * buf;
-#endif
+	register int32_t *buf;
 	struct nfs_request_lookahead *lkhd =
 	    xdrs->x_public ? (struct nfs_request_lookahead *)xdrs->
 	    x_public : &dummy_lookahead;
 
 	if (!xdr_nfs_fh3(xdrs, &objp->file))
 		return (false);
-	if (!xdr_offset3(xdrs, &objp->offset))
-		return (false);
-	if (!xdr_count3(xdrs, &objp->count))
-		return (false);
+	buf = NULL;
+	if (xdrs->x_op == XDR_DECODE)
+		buf = XDR_INLINE(xdrs, 3 * BYTES_PER_XDR_UNIT);
+	if (buf != NULL) {
+		IXDR_GET_NFS3_UINT64(buf, objp->offset);
+		objp->count = IXDR_GET_U_INT32(buf);
+	} else {
+		if (!xdr_offset3(xdrs, &objp->offset))
+			return (false);
+		if (!xdr_count3(xdrs, &objp->count))
+			return (false);
+	}
 	lkhd->flags = NFS_LOOKAHEAD_READ;
 	(lkhd->read)++;
 	return (true);
@@ -1252,18 +1352,22 @@ register XDR *xdrs;
 READ3resok *objp;
 {
 
-#if defined(_LP64) || defined(_KERNEL)
-	register int __attribute__ ((__unused__)) * buf;
-#else
-	register long __attribute__ ((__unused__)) * buf;
-#endif
+	register int32_t *buf;
 
 	if (!xdr_post_op_attr(xdrs, &objp->file_attributes))
 		return (false);
-	if (!xdr_count3(xdrs, &objp->count))
-		return (false);
-	if (!xdr_bool(xdrs, &objp->eof))
-		return (false);
+	buf = NULL;
+	if (xdrs->x_op == XDR_ENCODE)
+		buf = XDR_INLINE(xdrs, 2 * BYTES_PER_XDR_UNIT);
+	if (buf != NULL) {
+		IXDR_PUT_U_INT32(buf, objp->count);
+		IXDR_PUT_BOOL(buf, objp->eof);
+	} else {
+		if (!xdr_count3(xdrs, &objp->count))
+			return (false);
+		if (!xdr_bool(xdrs, &objp->eof))
+			return (false);
+	}
 	if (!xdr_bytes
 	    (xdrs, (char **)&objp->data.data_val,
 	     &objp->data.data_len, XDR_BYTES_MAXLEN_IO))
@@ -1333,23 +1437,28 @@ bool xdr_WRITE3args(xdrs, objp)
 register XDR *xdrs;
 WRITE3args *objp;
 {
-#if defined(_LP64) || defined(_KERNEL)
-	register int __attribute__ ((__unused__)) * buf;
-#else
-	register long __attribute__ ((__unused__)) * buf;
-#endif
+	register int32_t *buf;
 	struct nfs_request_lookahead *lkhd =
 	    xdrs->x_public ? (struct nfs_request_lookahead *)xdrs->
 	    x_public : &dummy_lookahead;
 
 	if (!xdr_nfs_fh3(xdrs, &objp->file))
 		return (false);
-	if (!xdr_offset3(xdrs, &objp->offset))
-		return (false);
-	if (!xdr_count3(xdrs, &objp->count))
-		return (false);
-	if (!xdr_stable_how(xdrs, &objp->stable))
-		return (false);
+	buf = NULL;
+	if (xdrs->x_op == XDR_DECODE)
+		buf = XDR_INLINE(xdrs, 4 * BYTES_PER_XDR_UNIT);
+	if (buf != NULL) {
+		IXDR_GET_NFS3_UINT64(buf, objp->offset);
+		objp->count = IXDR_GET_U_INT32(buf);
+		objp->stable = IXDR_GET_ENUM(buf, stable_how);
+	} else {
+		if (!xdr_offset3(xdrs, &objp->offset))
+			return (false);
+		if (!xdr_count3(xdrs, &objp->count))
+			return (false);
+		if (!xdr_stable_how(xdrs, &objp->stable))
+			return (false);
+	}
 	if (!xdr_bytes
 	    (xdrs, (char **)&objp->data.data_val,
 	     &objp->data.data_len, XDR_BYTES_MAXLEN_IO))
@@ -1364,20 +1473,26 @@ register XDR *xdrs;
 WRITE3resok *objp;
 {
 
-#if defined(_LP64) || defined(_KERNEL)
-	register int __attribute__ ((__unused__)) * buf;
-#else
-	register long __attribute__ ((__unused__)) * buf;
-#endif
+	register int32_t *buf;
 
 	if (!xdr_wcc_data(xdrs, &objp->file_wcc))
 		return (false);
-	if (!xdr_count3(xdrs, &objp->count))
-		return (false);
-	if (!xdr_stable_how(xdrs, &objp->committed))
-		return (false);
-	if (!xdr_writeverf3(xdrs, objp->verf))
-		return (false);
+	buf = NULL;
+	if (xdrs->x_op == XDR_ENCODE)
+		buf = XDR_INLINE(xdrs, 2 * BYTES_PER_XDR_UNIT +
+				 sizeof(writeverf3));
+	if (buf != NULL) {
+		IXDR_PUT_U_INT32(buf, objp->count);
+		IXDR_PUT_ENUM(buf, objp->committed);
+		memcpy(buf, objp->verf, sizeof(writeverf3));
+	} else {
+		if (!xdr_count3(xdrs, &objp->count))
+			return (false);
+		if (!xdr_stable_how(xdrs, &objp->committed))
+			return (false);
+		if (!xdr_writeverf3(xdrs, objp->verf))
+			return (false);
+	}
 	return (true);
 }
 
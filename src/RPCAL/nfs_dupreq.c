@@ -46,9 +46,14 @@
 
 #include "nfs_dupreq.h"
 #include "city.h"
+#include "crc32c.h"
 #include "abstract_mem.h"
 #include "gsh_intrinsic.h"
 #include "wait_queue.h"
+#ifdef USE_DBUS
+#include "gsh_dbus.h"
+#include "server_stats_private.h"
+#endif
 
 #define DUPREQ_BAD_ADDR1 0x01	/* safe for marked pointers, etc */
 #define DUPREQ_NOCACHE   0x02
@@ -105,6 +110,21 @@ const char *dupreq_state_table[] = {
  * drc before it gets into recycle queue, we could end up with multiple
  * threads that decrement the ref count to zero.
  */
+/* With DRC_Max_Bytes set, every completed entry of every DRC is also
+ * on one of drc_st->lru[], picked by its hash key.  Hits move an entry
+ * to the tail of its partition, and finish evicts from the head until
+ * the total is back under budget, so retirement is O(1) per entry and
+ * never walks a DRC.  Lock order is partition (t->mtx), then drc->mtx,
+ * then lru->mtx; eviction unlinks from the LRU first and drops
+ * lru->mtx before taking the others.  DRC_Client_Max_Bytes further
+ * bounds what one TCP DRC holds: past it, finish retires that DRC's
+ * oldest completed entries whatever their place in the LRU.
+ */
+struct drc_lru {
+	pthread_mutex_t mtx;
+	TAILQ_HEAD(drc_lru_q, dupreq_entry) q;
+};
+
 struct drc_st {
 	pthread_mutex_t mtx;
 	drc_t udp_drc;		/* shared DRC */
@@ -113,6 +133,18 @@ struct drc_st {
 	int32_t tcp_drc_recycle_qlen;
 	time_t last_expire_check;
 	uint32_t expire_delta;
+	uint64_t max_bytes;	/* 0 for per-DRC count limits */
+	uint64_t client_max_bytes;	/* 0 for no per TCP DRC limit */
+	uint32_t limits_gen;	/* bumped when the DRC sizes change */
+	uint32_t lru_npart;
+	struct drc_lru *lru;
+	struct {
+		uint64_t bytes;	/* charged by entries on the LRU */
+		uint64_t lookups;
+		uint64_t hits;
+		uint64_t evictions;
+		uint64_t client_evictions; /* over DRC_Client_Max_Bytes */
+	} stats;
 };
 
 static struct drc_st *drc_st;
@@ -260,6 +292,7 @@ static inline void init_shared_drc(void)
 	drc->cachesz = nfs_param.core_param.drc.udp.cachesz;
 	drc->npart = nfs_param.core_param.drc.udp.npart;
 	drc->hiwat = nfs_param.core_param.drc.udp.hiwat;
+	drc->limits_gen = 0;
 
 	gsh_mutex_init(&drc->mtx, NULL);
 
@@ -287,14 +320,16 @@ static inline void init_shared_drc(void)
  */
 void dupreq2_pkginit(void)
 {
-	int code __attribute__ ((unused)) = 0;
+	int ix, code __attribute__ ((unused)) = 0;
 
-	dupreq_pool =
-	    pool_basic_init("Duplicate Request Pool", sizeof(dupreq_entry_t));
+	dupreq_pool = pool_tagged_init("Duplicate Request Pool",
+				       sizeof(dupreq_entry_t), GSH_MEM_DRC);
 
-	nfs_res_pool = pool_basic_init("nfs_res_t pool", sizeof(nfs_res_t));
+	nfs_res_pool = pool_tagged_init("nfs_res_t pool", sizeof(nfs_res_t),
+					GSH_MEM_DRC);
 
-	tcp_drc_pool = pool_basic_init("TCP DRC Pool", sizeof(drc_t));
+	tcp_drc_pool = pool_tagged_init("TCP DRC Pool", sizeof(drc_t),
+					GSH_MEM_DRC);
 
 	drc_st = gsh_calloc(1, sizeof(struct drc_st));
 
@@ -314,6 +349,20 @@ void dupreq2_pkginit(void)
 	drc_st->last_expire_check = time(NULL);
 	drc_st->expire_delta = nfs_param.core_param.drc.tcp.recycle_expire_s;
 
+	/* global LRU */
+	drc_st->max_bytes = nfs_param.core_param.drc.max_bytes;
+	drc_st->client_max_bytes = nfs_param.core_param.drc.client_max_bytes;
+	drc_st->lru_npart = nfs_param.core_param.drc.lru_npart;
+	drc_st->lru = gsh_calloc(drc_st->lru_npart, sizeof(struct drc_lru));
+	if (nfs_param.core_param.drc.write_cksum_bytes)
+		LogInfo(COMPONENT_DUPREQ,
+			"DRC WRITE checksums using %s CRC32C",
+			crc32c_impl_name());
+	for (ix = 0; ix < drc_st->lru_npart; ++ix) {
+		gsh_mutex_init(&drc_st->lru[ix].mtx, NULL);
+		TAILQ_INIT(&drc_st->lru[ix].q);
+	}
+
 	/* UDP DRC is global, shared */
 	init_shared_drc();
 }
@@ -381,6 +430,7 @@ static inline drc_t *alloc_tcp_drc(enum drc_type dtype)
 	drc->cachesz = nfs_param.core_param.drc.tcp.cachesz;
 	drc->npart = nfs_param.core_param.drc.tcp.npart;
 	drc->hiwat = nfs_param.core_param.drc.tcp.hiwat;
+	drc->limits_gen = atomic_fetch_uint32_t(&drc_st->limits_gen);
 
 	PTHREAD_MUTEX_init(&drc->mtx, NULL);
 
@@ -934,10 +984,28 @@ static inline void dupreq_entry_put(dupreq_entry_t *dv)
  */
 static inline bool drc_should_retire(drc_t *drc)
 {
+	uint32_t gen = atomic_fetch_uint32_t(&drc_st->limits_gen);
+
+	/* pick up sizes changed since this DRC last looked */
+	if (unlikely(drc->limits_gen != gen)) {
+		if (drc->type == DRC_UDP_V234) {
+			drc->maxsize = nfs_param.core_param.drc.udp.size;
+			drc->hiwat = nfs_param.core_param.drc.udp.hiwat;
+		} else {
+			drc->maxsize = nfs_param.core_param.drc.tcp.size;
+			drc->hiwat = nfs_param.core_param.drc.tcp.hiwat;
+		}
+		drc->limits_gen = gen;
+	}
+
 	/* do not exeed the hard bound on cache size */
 	if (unlikely(drc->size > drc->maxsize))
 		return true;
 
+	/* the global LRU retires requests instead */
+	if (drc_st->max_bytes)
+		return false;
+
 	/* otherwise, are we permitted to retire requests */
 	if (unlikely(drc->retwnd > 0))
 		return false;
@@ -949,6 +1017,220 @@ static inline bool drc_should_retire(drc_t *drc)
 	return false;
 }
 
+/**
+ * @brief Estimate the memory held by a completed cache entry
+ *
+ * Counts the entry and its result; for a COMPOUND, the per-operation
+ * results as well.  Buffers hanging off individual results are small
+ * for the non-idempotent requests we cache and are not walked.
+ *
+ * @param[in] dv The duplicate request entry.
+ *
+ * @return Bytes to charge against DRC_Max_Bytes.
+ */
+static inline uint32_t nfs_dupreq_cost(dupreq_entry_t *dv)
+{
+	uint32_t cost = sizeof(dupreq_entry_t) + sizeof(nfs_res_t);
+
+	if (dv->res && dv->hin.rq_prog == NFS_program[P_NFS] &&
+	    dv->hin.rq_vers == NFS_V4)
+		cost += dv->res->res_compound4.resarray.resarray_len *
+			sizeof(nfs_resop4);
+	return cost;
+}
+
+static inline struct drc_lru *drc_lru_of(dupreq_entry_t *dv)
+{
+	return &drc_st->lru[dv->hk % drc_st->lru_npart];
+}
+
+/**
+ * @brief Put a completed entry on the tail of the global LRU
+ *
+ * @param[in] dv The duplicate request entry, holding its hashtable ref.
+ */
+static inline void drc_lru_insert(dupreq_entry_t *dv)
+{
+	struct drc_lru *lru = drc_lru_of(dv);
+	uint32_t cost = nfs_dupreq_cost(dv);
+
+	PTHREAD_MUTEX_lock(&lru->mtx);
+	TAILQ_INSERT_TAIL(&lru->q, dv, lru_q);
+	dv->lru_cost = cost;
+	PTHREAD_MUTEX_unlock(&lru->mtx);
+	(void) atomic_add_uint64_t(&drc_st->stats.bytes, cost);
+	(void) atomic_add_uint64_t(&dv->hin.drc->lru_bytes, cost);
+}
+
+/**
+ * @brief Move an entry that was just hit to the tail of the global LRU
+ *
+ * Entries still being completed are not on the LRU yet and are ignored.
+ *
+ * @param[in] dv The duplicate request entry.
+ */
+static inline void drc_lru_touch(dupreq_entry_t *dv)
+{
+	struct drc_lru *lru = drc_lru_of(dv);
+
+	PTHREAD_MUTEX_lock(&lru->mtx);
+	if (dv->lru_cost != 0) {
+		TAILQ_REMOVE(&lru->q, dv, lru_q);
+		TAILQ_INSERT_TAIL(&lru->q, dv, lru_q);
+	}
+	PTHREAD_MUTEX_unlock(&lru->mtx);
+}
+
+/**
+ * @brief Take an entry off its LRU partition, lru->mtx held
+ *
+ * Once off the LRU, the caller owns the entry's hashtable ref:
+ * completed entries are not otherwise removed in this mode.
+ *
+ * @param[in] lru The partition
+ * @param[in] ov  An entry on it
+ */
+static inline void drc_lru_unlink(struct drc_lru *lru, dupreq_entry_t *ov)
+{
+	TAILQ_REMOVE(&lru->q, ov, lru_q);
+	(void) atomic_sub_uint64_t(&drc_st->stats.bytes, ov->lru_cost);
+	(void) atomic_sub_uint64_t(&ov->hin.drc->lru_bytes, ov->lru_cost);
+	ov->lru_cost = 0;
+}
+
+/**
+ * @brief Retire an entry taken off the LRU from its DRC
+ *
+ * @param[in] ov The entry, as left by drc_lru_unlink()
+ */
+static void drc_lru_retire(dupreq_entry_t *ov)
+{
+	struct rbtree_x_part *t;
+	drc_t *drc;
+
+	/* ov holds a ref on its drc */
+	drc = ov->hin.drc;
+	t = rbtx_partition_of_scalar(&drc->xt, ov->hk);
+
+	PTHREAD_MUTEX_lock(&t->mtx);	/* partition lock */
+	rbtree_x_cached_remove(&drc->xt, t, &ov->rbt_k, ov->hk);
+	PTHREAD_MUTEX_lock(&drc->mtx);
+	TAILQ_REMOVE(&drc->dupreq_q, ov, fifo_q);
+	--(drc->size);
+	/* release ov's ref on drc and unlock */
+	nfs_dupreq_put_drc(NULL, drc, DRC_FLAG_LOCKED);
+	PTHREAD_MUTEX_unlock(&t->mtx);
+
+	LogDebug(COMPONENT_DUPREQ,
+		 "evicting ov=%p xid=%" PRIu32 " on DRC=%p refcnt=%d",
+		 ov, ov->hin.tcp.rq_xid, drc, ov->refcnt);
+
+	(void) atomic_inc_uint64_t(&drc_st->stats.evictions);
+
+	/* release hashtable ref count */
+	dupreq_entry_put(ov);
+}
+
+/**
+ * @brief Evict the least recently used entry of an LRU partition
+ *
+ * @param[in] lru The partition
+ *
+ * @return true if an entry was evicted.
+ */
+static bool drc_lru_evict(struct drc_lru *lru)
+{
+	dupreq_entry_t *ov;
+
+	PTHREAD_MUTEX_lock(&lru->mtx);
+	ov = TAILQ_FIRST(&lru->q);
+	if (ov == NULL) {
+		PTHREAD_MUTEX_unlock(&lru->mtx);
+		return false;
+	}
+	drc_lru_unlink(lru, ov);
+	PTHREAD_MUTEX_unlock(&lru->mtx);
+
+	drc_lru_retire(ov);
+	return true;
+}
+
+/**
+ * @brief Bring the DRCs back under DRC_Max_Bytes
+ *
+ * Starts with the partition of the entry just completed, so finishing
+ * threads spread over the partition locks, and bounds the work done on
+ * behalf of any one request.
+ *
+ * @param[in] dv The entry just completed.
+ */
+static void drc_lru_trim(dupreq_entry_t *dv)
+{
+	uint32_t ix = dv->hk % drc_st->lru_npart;
+	uint32_t tries = 0;
+	int16_t cnt = 0;
+
+	while (atomic_fetch_uint64_t(&drc_st->stats.bytes) >
+	       drc_st->max_bytes && cnt <= DUPREQ_MAX_RETRIES &&
+	       tries < drc_st->lru_npart) {
+		if (drc_lru_evict(&drc_st->lru[ix])) {
+			cnt++;
+		} else {
+			ix = (ix + 1) % drc_st->lru_npart;
+			tries++;
+		}
+	}
+}
+
+/**
+ * @brief Bring one TCP DRC back under DRC_Client_Max_Bytes
+ *
+ * Retires the DRC's oldest completed entries, so a client that fills
+ * its connection's cache only pushes out its own replies.
+ *
+ * @param[in] drc The DRC of the entry just completed.
+ */
+static void drc_lru_trim_client(drc_t *drc)
+{
+	uint64_t max = atomic_fetch_uint64_t(&drc_st->client_max_bytes);
+	dupreq_entry_t *dv, *ov;
+	struct drc_lru *lru;
+	int16_t cnt = 0;
+
+	if (max == 0 || drc->type == DRC_UDP_V234)
+		return;
+
+	while (atomic_fetch_uint64_t(&drc->lru_bytes) > max &&
+	       cnt++ <= DUPREQ_MAX_RETRIES) {
+		ov = NULL;
+		PTHREAD_MUTEX_lock(&drc->mtx);
+		if (!(drc->flags & DRC_FLAG_CAPPED)) {
+			drc->flags |= DRC_FLAG_CAPPED;
+			LogInfo(COMPONENT_DUPREQ,
+				"DRC=%p reached DRC_Client_Max_Bytes (%" PRIu64
+				"), retiring its oldest requests", drc, max);
+		}
+		TAILQ_FOREACH(dv, &drc->dupreq_q, fifo_q) {
+			lru = drc_lru_of(dv);
+			PTHREAD_MUTEX_lock(&lru->mtx);
+			if (dv->lru_cost != 0) {
+				drc_lru_unlink(lru, dv);
+				ov = dv;
+			}
+			PTHREAD_MUTEX_unlock(&lru->mtx);
+			if (ov != NULL)
+				break;
+		}
+		PTHREAD_MUTEX_unlock(&drc->mtx);
+
+		if (ov == NULL)
+			break;
+
+		(void) atomic_inc_uint64_t(&drc_st->stats.client_evictions);
+		drc_lru_retire(ov);
+	}
+}
+
 static inline bool nfs_dupreq_v4_cacheable(nfs_request_t *reqnfs)
 {
 	COMPOUND4args *arg_c4 = (COMPOUND4args *)&reqnfs->arg_nfs;
@@ -968,6 +1250,71 @@ static inline bool nfs_dupreq_v4_cacheable(nfs_request_t *reqnfs)
 	return true;
 }
 
+/**
+ * @brief Checksum one WRITE's position and a bounded prefix of its data
+ */
+static inline uint32_t nfs_dupreq_cksum_write(uint32_t crc, uint64_t offset,
+					      const char *data, u_int len)
+{
+	u_int limit = nfs_param.core_param.drc.write_cksum_bytes;
+
+	crc = crc32c(crc, &offset, sizeof(offset));
+	crc = crc32c(crc, &len, sizeof(len));
+	return crc32c(crc, data, MIN(len, limit));
+}
+
+/**
+ * @brief Checksum the WRITE data of a request for DRC matching
+ *
+ * Retransmissions carry the same XID and the same call, so the TI-RPC
+ * checksum of the call prefix alone can match a different WRITE after
+ * XID reuse.  Folding in a CRC32C of the first DRC_Write_Checksum_Bytes
+ * of each WRITE's data distinguishes those without reading the whole
+ * payload.
+ *
+ * @param[in] reqnfs The NFS request data
+ * @param[in] req    The request being cached
+ *
+ * @return A checksum to fold into the entry's key, 0 if not a WRITE.
+ */
+static uint64_t nfs_dupreq_write_cksum(nfs_request_t *reqnfs,
+				       struct svc_req *req)
+{
+	uint32_t crc = 0;
+	bool found = false;
+
+	if (req->rq_msg.cb_prog != NFS_program[P_NFS])
+		return 0;
+
+	if (req->rq_msg.cb_vers == NFS_V3 &&
+	    req->rq_msg.cb_proc == NFSPROC3_WRITE) {
+		WRITE3args *arg = &reqnfs->arg_nfs.arg_write3;
+
+		crc = nfs_dupreq_cksum_write(crc, arg->offset,
+					     arg->data.data_val,
+					     arg->data.data_len);
+		found = true;
+	} else if (req->rq_msg.cb_vers == NFS_V4 &&
+		   (reqnfs->lookahead.flags & NFS_LOOKAHEAD_WRITE)) {
+		COMPOUND4args *arg = &reqnfs->arg_nfs.arg_compound4;
+		u_int ix;
+
+		for (ix = 0; ix < arg->argarray.argarray_len; ix++) {
+			nfs_argop4 *op = &arg->argarray.argarray_val[ix];
+
+			if (op->argop != NFS4_OP_WRITE)
+				continue;
+			crc = nfs_dupreq_cksum_write(
+				crc, op->nfs_argop4_u.opwrite.offset,
+				op->nfs_argop4_u.opwrite.data.data_val,
+				op->nfs_argop4_u.opwrite.data.data_len);
+			found = true;
+		}
+	}
+
+	return found ? (uint64_t) crc << 32 : 0;
+}
+
 /**
  * @brief Start a duplicate request transaction
  *
@@ -1013,6 +1360,7 @@ dupreq_status_t nfs_dupreq_start(nfs_request_t *reqnfs,
 	}
 
 
+	(void) atomic_inc_uint64_t(&drc_st->stats.lookups);
 	drc = nfs_dupreq_get_drc(req);
 	dk = alloc_dupreq();
 	dk->hin.drc = drc;	/* trans. call path ref to dv */
@@ -1045,6 +1393,8 @@ dupreq_status_t nfs_dupreq_start(nfs_request_t *reqnfs,
 	}
 
 	dk->hk = req->rq_cksum; /* TI-RPC computed checksum */
+	if (nfs_param.core_param.drc.write_cksum_bytes)
+		dk->hk ^= nfs_dupreq_write_cksum(reqnfs, req);
 	dk->state = DUPREQ_START;
 	dk->timestamp = time(NULL);
 
@@ -1072,9 +1422,15 @@ dupreq_status_t nfs_dupreq_start(nfs_request_t *reqnfs,
 			PTHREAD_MUTEX_unlock(&dv->mtx);
 
 			if (status == DUPREQ_EXISTS) {
-				PTHREAD_MUTEX_lock(&drc->mtx);
-				drc_inc_retwnd(drc);
-				PTHREAD_MUTEX_unlock(&drc->mtx);
+				(void) atomic_inc_uint64_t(
+					&drc_st->stats.hits);
+				if (drc_st->max_bytes) {
+					drc_lru_touch(dv);
+				} else {
+					PTHREAD_MUTEX_lock(&drc->mtx);
+					drc_inc_retwnd(drc);
+					PTHREAD_MUTEX_unlock(&drc->mtx);
+				}
 			}
 
 			LogDebug(COMPONENT_DUPREQ,
@@ -1172,6 +1528,13 @@ dupreq_status_t nfs_dupreq_finish(struct svc_req *req, nfs_res_t *res_nfs)
 	drc = dv->hin.drc;
 	PTHREAD_MUTEX_unlock(&dv->mtx);
 
+	if (drc_st->max_bytes) {
+		drc_lru_insert(dv);
+		drc_lru_trim(dv);
+		drc_lru_trim_client(drc);
+		goto out;
+	}
+
 	/* cond. remove from q head */
 	PTHREAD_MUTEX_lock(&drc->mtx);
 
@@ -1355,6 +1718,89 @@ void nfs_dupreq_rele(struct svc_req *req, const nfs_function_desc_t *func)
 		SVCAUTH_RELEASE(req);
 }
 
+#ifdef USE_DBUS
+/**
+ * @brief Report duplicate request cache statistics over D-Bus
+ *
+ * @param[in,out] iter Reply iterator
+ */
+void dupreq2_dbus_show(DBusMessageIter *iter)
+{
+	struct timespec timestamp;
+	DBusMessageIter struct_iter;
+	uint64_t val;
+	char *type;
+
+	now(&timestamp);
+	dbus_append_timestamp(iter, &timestamp);
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_STRUCT, NULL,
+					 &struct_iter);
+	type = "drc_max_bytes";
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+				       &drc_st->max_bytes);
+	type = "drc_bytes";
+	val = atomic_fetch_uint64_t(&drc_st->stats.bytes);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &val);
+	type = "drc_lookups";
+	val = atomic_fetch_uint64_t(&drc_st->stats.lookups);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &val);
+	type = "drc_hits";
+	val = atomic_fetch_uint64_t(&drc_st->stats.hits);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &val);
+	type = "drc_evictions";
+	val = atomic_fetch_uint64_t(&drc_st->stats.evictions);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &val);
+	type = "drc_client_evictions";
+	val = atomic_fetch_uint64_t(&drc_st->stats.client_evictions);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &val);
+	dbus_message_iter_close_container(iter, &struct_iter);
+}
+#endif /* USE_DBUS */
+
+/**
+ * @brief Apply changed DRC size parameters
+ *
+ * DRC_{TCP,UDP}_{Size,Hiwat} reach each DRC the next time it retires
+ * requests.  DRC_Max_Bytes may change, but not between zero and
+ * non-zero: that moves entries between the per-DRC queues and the
+ * global LRU.  DRC_Client_Max_Bytes may change freely.  Partition
+ * and hash sizes are fixed at creation.
+ *
+ * @retval 0 on success.
+ * @retval EINVAL if DRC_Max_Bytes was switched on or off.
+ */
+int dupreq2_retune(void)
+{
+	uint64_t max_bytes = nfs_param.core_param.drc.max_bytes;
+
+	if ((max_bytes == 0) != (drc_st->max_bytes == 0)) {
+		LogWarn(COMPONENT_DUPREQ,
+			"DRC_Max_Bytes can't be switched on or off without a restart");
+		return EINVAL;
+	}
+
+	atomic_store_uint64_t(&drc_st->max_bytes, max_bytes);
+	atomic_store_uint64_t(&drc_st->client_max_bytes,
+			      nfs_param.core_param.drc.client_max_bytes);
+	(void) atomic_inc_uint32_t(&drc_st->limits_gen);
+
+	LogEvent(COMPONENT_DUPREQ,
+		 "DRC limits now TCP %" PRIu32 "/%" PRIu32 " UDP %" PRIu32
+		 "/%" PRIu32 " max bytes %" PRIu64,
+		 nfs_param.core_param.drc.tcp.size,
+		 nfs_param.core_param.drc.tcp.hiwat,
+		 nfs_param.core_param.drc.udp.size,
+		 nfs_param.core_param.drc.udp.hiwat, max_bytes);
+	return 0;
+}
+
 /**
  * @brief Shutdown the dupreq2 package.
  */
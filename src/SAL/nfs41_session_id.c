@@ -37,6 +37,7 @@
 #include "config.h"
 #include "nfs_core.h"
 #include "sal_functions.h"
+#include "nfs_proto_functions.h"
 
 /**
  * @brief Pool for allocating session data
@@ -110,7 +111,8 @@ int display_session(struct display_buffer *dspbuf, nfs41_session_t *session)
 		b_left = display_session_id(dspbuf, session->session_id);
 
 	if (b_left > 0)
-		b_left = display_cat(dspbuf, "}");
+		b_left = display_printf(dspbuf, " conns=%" PRIu32 "}",
+					session->num_conns);
 
 	return b_left;
 }
@@ -202,6 +204,11 @@ static hash_parameter_t session_id_param = {
 
 int nfs41_Init_session_id(void)
 {
+	session_id_param.index_size =
+		nfs_param.nfsv4_param.state_hash_partitions;
+	session_id_param.resize_load = nfs_param.nfsv4_param.hash_resize_load;
+	session_id_param.key_hash = nfs_param.nfsv4_param.hash_function;
+
 	ht_session_id = hashtable_init(&session_id_param);
 
 	if (ht_session_id == NULL) {
@@ -231,6 +238,278 @@ void nfs41_Build_sessionid(clientid4 *clientid, char *sessionid)
 	memcpy(sessionid + sizeof(clientid4), &seq, sizeof(seq));
 }
 
+/**
+ * @brief Drop the reply cached in a session slot
+ *
+ * The caller holds the slot lock, or the last session reference.
+ *
+ * @param[in,out] slot The slot
+ */
+
+void nfs41_Session_Release_Slot_Cache(nfs41_session_slot_t *slot)
+{
+	if (slot->cached_result.res_cached) {
+		slot->cached_result.res_cached = false;
+		nfs4_Compound_Free((nfs_res_t *) &slot->cached_result);
+	}
+	slot->cache_used = false;
+}
+
+/**
+ * @brief Bind a connection to a session
+ *
+ * Directions add to what the connection already had.  At
+ * NFS41_SESSION_MAX_CONNS the least recently used connection that
+ * carries only the fore channel is dropped to make room.
+ *
+ * @param[in,out] session The session
+ * @param[in]     xprt    The connection
+ * @param[in]     dir     Channels to bind on it
+ */
+
+void nfs41_session_bind_conn(nfs41_session_t *session, SVCXPRT *xprt,
+			     channel_dir_from_server4 dir)
+{
+	struct nfs41_session_conn *conn, *victim = NULL;
+	struct glist_head *glist;
+
+	PTHREAD_MUTEX_lock(&session->conn_mutex);
+
+	glist_for_each(glist, &session->conns) {
+		conn = glist_entry(glist, struct nfs41_session_conn, link);
+		if (conn->xprt == xprt) {
+			conn->dir |= dir;
+			glist_del(&conn->link);
+			glist_add(&session->conns, &conn->link);
+			PTHREAD_MUTEX_unlock(&session->conn_mutex);
+			return;
+		}
+	}
+
+	if (session->num_conns >= NFS41_SESSION_MAX_CONNS) {
+		for (glist = session->conns.prev; glist != &session->conns;
+		     glist = glist->prev) {
+			conn = glist_entry(glist, struct nfs41_session_conn,
+					   link);
+			if (conn->xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED) {
+				victim = conn;
+				break;
+			}
+			if (victim == NULL && !(conn->dir & CDFS4_BACK))
+				victim = conn;
+		}
+		if (victim != NULL) {
+			glist_del(&victim->link);
+			session->num_conns--;
+		}
+	}
+
+	conn = gsh_calloc(1, sizeof(*conn));
+	SVC_REF(xprt, SVC_REF_FLAG_NONE);
+	conn->xprt = xprt;
+	conn->dir = dir;
+	conn->last_used = time(NULL);
+	glist_add(&session->conns, &conn->link);
+	session->num_conns++;
+
+	PTHREAD_MUTEX_unlock(&session->conn_mutex);
+
+	if (victim != NULL) {
+		SVC_RELEASE(victim->xprt, SVC_RELEASE_FLAG_NONE);
+		gsh_free(victim);
+	}
+}
+
+/**
+ * @brief Account a SEQUENCE against the connection it came in on
+ *
+ * A connection first seen here is bound for the fore channel, as
+ * RFC 5661 section 2.10.3.1 allows for SP4_NONE.  Connections ahead
+ * of it in the list that have gone away are dropped on the way.
+ *
+ * @param[in,out] session The session
+ * @param[in]     xprt    The connection
+ */
+
+void nfs41_session_conn_seen(nfs41_session_t *session, SVCXPRT *xprt)
+{
+	struct nfs41_session_conn *conn, *found = NULL;
+	struct glist_head *glist, *glistn, dead;
+
+	glist_init(&dead);
+
+	PTHREAD_MUTEX_lock(&session->conn_mutex);
+
+	glist_for_each_safe(glist, glistn, &session->conns) {
+		conn = glist_entry(glist, struct nfs41_session_conn, link);
+		if (conn->xprt == xprt) {
+			found = conn;
+			break;
+		}
+		if (conn->xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED) {
+			glist_del(&conn->link);
+			glist_add(&dead, &conn->link);
+			session->num_conns--;
+		}
+	}
+
+	if (found != NULL) {
+		found->requests++;
+		found->last_used = time(NULL);
+		glist_del(&found->link);
+		glist_add(&session->conns, &found->link);
+	}
+
+	PTHREAD_MUTEX_unlock(&session->conn_mutex);
+
+	glist_for_each_safe(glist, glistn, &dead) {
+		conn = glist_entry(glist, struct nfs41_session_conn, link);
+		glist_del(&conn->link);
+		SVC_RELEASE(conn->xprt, SVC_RELEASE_FLAG_NONE);
+		gsh_free(conn);
+	}
+
+	if (found == NULL)
+		nfs41_session_bind_conn(session, xprt, CDFS4_FORE);
+}
+
+/**
+ * @brief Check whether a connection is bound to a session
+ *
+ * @param[in] session The session
+ * @param[in] xprt    The connection
+ *
+ * @retval true if it is.
+ */
+
+bool nfs41_session_conn_bound(nfs41_session_t *session, SVCXPRT *xprt)
+{
+	struct nfs41_session_conn *conn;
+	struct glist_head *glist;
+	bool bound = false;
+
+	PTHREAD_MUTEX_lock(&session->conn_mutex);
+
+	glist_for_each(glist, &session->conns) {
+		conn = glist_entry(glist, struct nfs41_session_conn, link);
+		if (conn->xprt == xprt) {
+			bound = true;
+			break;
+		}
+	}
+
+	PTHREAD_MUTEX_unlock(&session->conn_mutex);
+
+	return bound;
+}
+
+/**
+ * @brief Pick the connection to run the back channel on
+ *
+ * @param[in] session The session
+ *
+ * @return The most recently used live connection bound for the back
+ *         channel, with a reference the caller must release, or NULL.
+ */
+
+SVCXPRT *nfs41_session_back_xprt(nfs41_session_t *session)
+{
+	struct nfs41_session_conn *conn;
+	struct glist_head *glist;
+	SVCXPRT *xprt = NULL;
+
+	PTHREAD_MUTEX_lock(&session->conn_mutex);
+
+	glist_for_each(glist, &session->conns) {
+		conn = glist_entry(glist, struct nfs41_session_conn, link);
+		if ((conn->dir & CDFS4_BACK) &&
+		    !(conn->xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED)) {
+			xprt = conn->xprt;
+			SVC_REF(xprt, SVC_REF_FLAG_NONE);
+			break;
+		}
+	}
+
+	PTHREAD_MUTEX_unlock(&session->conn_mutex);
+
+	return xprt;
+}
+
+/**
+ * @brief Keep the callback security a client offered
+ *
+ * The first AUTH_NONE or AUTH_SYS entry is copied, those being the
+ * flavors nfs_rpc_create_chan_v41() can use.
+ *
+ * @param[in,out] session       The new session
+ * @param[in]     num_sec_parms Length of sec_parms
+ * @param[in]     sec_parms     Security parameters from CREATE_SESSION
+ */
+
+void nfs41_session_save_cb_sec(nfs41_session_t *session, int num_sec_parms,
+			       callback_sec_parms4 *sec_parms)
+{
+	struct authunix_parms *dst =
+	    &session->cb_sec_parms.callback_sec_parms4_u.cbsp_sys_cred;
+	struct authunix_parms *src;
+	int i;
+
+	for (i = 0; i < num_sec_parms; i++) {
+		if (sec_parms[i].cb_secflavor == AUTH_NONE)
+			break;
+		if (sec_parms[i].cb_secflavor != AUTH_SYS)
+			continue;
+
+		src = &sec_parms[i].callback_sec_parms4_u.cbsp_sys_cred;
+		*dst = *src;
+		dst->aup_machname = gsh_strdup(src->aup_machname);
+		dst->aup_gids = NULL;
+		if (src->aup_len != 0) {
+			dst->aup_gids = gsh_malloc(src->aup_len *
+						   sizeof(*src->aup_gids));
+			memcpy(dst->aup_gids, src->aup_gids,
+			       src->aup_len * sizeof(*src->aup_gids));
+		}
+		break;
+	}
+
+	if (i == num_sec_parms)
+		return;
+
+	session->cb_sec_parms.cb_secflavor = sec_parms[i].cb_secflavor;
+	session->flags |= session_cb_sec;
+}
+
+/**
+ * @brief Release a session's connections and saved callback security
+ *
+ * @param[in,out] session The session, unreachable by now
+ */
+
+static void nfs41_session_release_conns(nfs41_session_t *session)
+{
+	struct authunix_parms *sys_parms =
+	    &session->cb_sec_parms.callback_sec_parms4_u.cbsp_sys_cred;
+	struct nfs41_session_conn *conn;
+	struct glist_head *glist, *glistn;
+
+	glist_for_each_safe(glist, glistn, &session->conns) {
+		conn = glist_entry(glist, struct nfs41_session_conn, link);
+		glist_del(&conn->link);
+		SVC_RELEASE(conn->xprt, SVC_RELEASE_FLAG_NONE);
+		gsh_free(conn);
+	}
+	session->num_conns = 0;
+
+	if ((session->flags & session_cb_sec) &&
+	    session->cb_sec_parms.cb_secflavor == AUTH_SYS) {
+		gsh_free(sys_parms->aup_machname);
+		gsh_free(sys_parms->aup_gids);
+	}
+
+	PTHREAD_MUTEX_destroy(&session->conn_mutex);
+}
+
 int32_t inc_session_ref(nfs41_session_t *session)
 {
 	int32_t refcnt = atomic_inc_int32_t(&session->refcount);
@@ -239,7 +518,7 @@ int32_t inc_session_ref(nfs41_session_t *session)
 
 int32_t dec_session_ref(nfs41_session_t *session)
 {
-	int i;
+	uint32_t i;
 	int32_t refcnt = atomic_dec_int32_t(&session->refcount);
 
 	if (refcnt == 0) {
@@ -248,14 +527,20 @@ int32_t dec_session_ref(nfs41_session_t *session)
 		   sessions */
 		PTHREAD_MUTEX_lock(&session->clientid_record->cid_mutex);
 		glist_del(&session->session_link);
+		(void) atomic_dec_uint32_t(
+			&session->clientid_record->cid_nb_session);
 		PTHREAD_MUTEX_unlock(&session->clientid_record->cid_mutex);
 
 		/* Decrement our reference to the clientid record */
 		dec_client_id_ref(session->clientid_record);
 		/* Destroy this session's mutexes and condition variable */
 
-		for (i = 0; i < NFS41_NB_SLOTS; i++)
+		for (i = 0; i < session->fore_channel_attrs.ca_maxrequests;
+		     i++) {
+			nfs41_Session_Release_Slot_Cache(&session->slots[i]);
 			PTHREAD_MUTEX_destroy(&session->slots[i].lock);
+		}
+		gsh_free(session->slots);
 
 		PTHREAD_COND_destroy(&session->cb_cond);
 		PTHREAD_MUTEX_destroy(&session->cb_mutex);
@@ -263,6 +548,10 @@ int32_t dec_session_ref(nfs41_session_t *session)
 		/* Destroy the session's back channel (if any) */
 		if (session->flags & session_bc_up)
 			nfs_rpc_destroy_chan(&session->cb_chan);
+		PTHREAD_COND_destroy(&session->cb_chan.cv);
+		PTHREAD_MUTEX_destroy(&session->cb_chan.mtx);
+
+		nfs41_session_release_conns(session);
 
 		/* Free the memory for the session */
 		pool_free(nfs41_session_pool, session);
@@ -170,6 +170,7 @@ int display_client_id_rec(struct display_buffer *dspbuf,
 			  nfs_client_id_t *clientid)
 {
 	int delta;
+	uint64_t lease;
 	int b_left = display_printf(dspbuf, "%p ClientID={", clientid);
 
 	if (b_left <= 0)
@@ -196,14 +197,18 @@ int display_client_id_rec(struct display_buffer *dspbuf,
 			return b_left;
 	}
 
-	if (clientid->cid_lease_reservations > 0)
+	lease = atomic_fetch_uint64_t(&clientid->cid_lease);
+
+	if (LEASE_RESERVATIONS(lease) > 0)
 		delta = 0;
 	else
-		delta = time(NULL) - clientid->cid_last_renew;
+		delta = time(NULL) - LEASE_LAST_RENEW(lease);
 
 	b_left = display_printf(dspbuf,
-				"} t_delta=%d reservations=%d refcount=%"PRIu32,
-				delta, clientid->cid_lease_reservations,
+				"} t_delta=%d reservations=%d%s refcount=%"
+				PRIu32,
+				delta, (int) LEASE_RESERVATIONS(lease),
+				(lease & LEASE_EXPIRING) ? " expiring" : "",
 				atomic_fetch_int32_t(&clientid->cid_refcount));
 
 	if (b_left <= 0)
@@ -347,8 +352,10 @@ void free_client_id(nfs_client_id_t *clientid)
 
 	PTHREAD_MUTEX_destroy(&clientid->cid_mutex);
 	PTHREAD_MUTEX_destroy(&clientid->cid_owner.so_mutex);
-	if (clientid->cid_minorversion == 0)
+	if (clientid->cid_minorversion == 0) {
+		PTHREAD_COND_destroy(&clientid->cid_cb.v40.cb_chan.cv);
 		PTHREAD_MUTEX_destroy(&clientid->cid_cb.v40.cb_chan.mtx);
+	}
 
 	put_gsh_client(clientid->gsh_client);
 
@@ -540,6 +547,7 @@ nfs_client_id_t *create_client_id(clientid4 clientid,
 	/* initialize the chan mutex for v4 */
 	if (minorversion == 0) {
 		PTHREAD_MUTEX_init(&client_rec->cid_cb.v40.cb_chan.mtx, NULL);
+		PTHREAD_COND_init(&client_rec->cid_cb.v40.cb_chan.cv, NULL);
 		client_rec->cid_cb.v40.cb_chan_down = true;
 		client_rec->first_path_down_resp_time = 0;
 	}
@@ -549,7 +557,7 @@ nfs_client_id_t *create_client_id(clientid4 clientid,
 
 	client_rec->cid_confirmed = UNCONFIRMED_CLIENT_ID;
 	client_rec->cid_clientid = clientid;
-	client_rec->cid_last_renew = time(NULL);
+	client_rec->cid_lease = LEASE_WORD(time(NULL), 0);
 	client_rec->cid_client_record = client_record;
 	client_rec->cid_credential = *credential;
 
@@ -635,6 +643,9 @@ clientid_status_t nfs_client_id_insert(nfs_client_id_t *clientid)
 	/* Take a reference to the unconfirmed clientid for the hash table. */
 	(void)inc_client_id_ref(clientid);
 
+	/* Have the reaper look at it when the lease is due */
+	lease_schedule(clientid);
+
 	if (isFullDebug(COMPONENT_CLIENTID) &&
 	    isFullDebug(COMPONENT_HASHTABLE)) {
 		LogFullDebug(COMPONENT_CLIENTID,
@@ -682,6 +693,8 @@ int remove_confirmed_client_id(nfs_client_id_t *clientid)
 	/* Set this up so this client id record will be freed. */
 	clientid->cid_confirmed = EXPIRED_CLIENT_ID;
 
+	lease_unschedule(clientid);
+
 	/* Release hash table reference to the unconfirmed record */
 	(void)dec_client_id_ref(clientid);
 
@@ -726,6 +739,8 @@ int remove_unconfirmed_client_id(nfs_client_id_t *clientid)
 	/* Set this up so this client id record will be freed. */
 	clientid->cid_confirmed = EXPIRED_CLIENT_ID;
 
+	lease_unschedule(clientid);
+
 	/* Release hash table reference to the unconfirmed record */
 	(void)dec_client_id_ref(clientid);
 
@@ -801,6 +816,8 @@ clientid_status_t nfs_client_id_confirm(nfs_client_id_t *clientid,
 		   freed. */
 		clientid->cid_confirmed = EXPIRED_CLIENT_ID;
 
+		lease_unschedule(clientid);
+
 		/* Release hash table reference to the unconfirmed
 		   record */
 		(void)dec_client_id_ref(clientid);
@@ -858,6 +875,67 @@ bool clientid_has_state(nfs_client_id_t *clientid)
 	return live_state;
 }
 
+/**
+ * @brief Check a client against one of its per-client limits
+ *
+ * The first time a client reaches a given limit it is logged, so a
+ * runaway client shows up once per limit rather than once per refusal.
+ *
+ * @param[in] clientid The client id of interest
+ * @param[in] limit    The limit to check
+ *
+ * @retval true if the client may not have any more.
+ */
+bool nfs4_client_at_limit(nfs_client_id_t *clientid,
+			  enum nfs4_client_limit limit)
+{
+	static const char * const names[] = {
+		[CLIENT_LIMIT_OPEN_OWNERS] = "Max_Open_Owners_Per_Client",
+		[CLIENT_LIMIT_LOCK_OWNERS] = "Max_Lock_Owners_Per_Client",
+		[CLIENT_LIMIT_STATES] = "Max_States_Per_Client",
+		[CLIENT_LIMIT_SESSIONS] = "Max_Sessions_Per_Client",
+	};
+	nfs_version4_parameter_t *v4 = &nfs_param.nfsv4_param;
+	uint32_t count, max, bit = 1 << limit;
+
+	switch (limit) {
+	case CLIENT_LIMIT_OPEN_OWNERS:
+		max = v4->max_open_owners;
+		count = atomic_fetch_uint32_t(&clientid->cid_nb_openowners);
+		break;
+	case CLIENT_LIMIT_LOCK_OWNERS:
+		max = v4->max_lock_owners;
+		count = atomic_fetch_uint32_t(&clientid->cid_nb_lockowners);
+		break;
+	case CLIENT_LIMIT_STATES:
+		max = v4->max_states;
+		count = atomic_fetch_uint32_t(&clientid->cid_nb_states);
+		break;
+	case CLIENT_LIMIT_SESSIONS:
+		max = v4->max_sessions;
+		count = atomic_fetch_uint32_t(&clientid->cid_nb_session);
+		break;
+	default:
+		return false;
+	}
+
+	if (max == 0 || count < max)
+		return false;
+
+	if (!(atomic_fetch_uint32_t(&clientid->cid_limits_logged) & bit)) {
+		char str[LOG_BUFF_LEN] = "\0";
+		struct display_buffer dspbuf = {sizeof(str), str, str};
+
+		atomic_set_uint32_t_bits(&clientid->cid_limits_logged, bit);
+		(void) display_client_id_rec(&dspbuf, clientid);
+		LogWarn(COMPONENT_CLIENTID,
+			"Client reached %s (%"PRIu32"), refusing more: %s",
+			names[limit], max, str);
+	}
+
+	return true;
+}
+
 /**
  * @brief Client expires, need to take care of owners
  *
@@ -937,6 +1015,8 @@ bool nfs_client_id_expire(nfs_client_id_t *clientid, bool make_stale)
 
 		PTHREAD_MUTEX_unlock(&clientid->cid_mutex);
 
+		lease_unschedule(clientid);
+
 		buffkey.addr = &clientid->cid_clientid;
 		buffkey.len = sizeof(clientid->cid_clientid);
 
@@ -1255,7 +1335,7 @@ static hash_parameter_t cid_unconfirmed_hash_param = {
 	.key_to_str = display_client_id_key,
 	.val_to_str = display_client_id_val,
 	.ht_name = "Unconfirmed Client ID",
-	.flags = HT_FLAG_CACHE,
+	.flags = HT_FLAG_OPEN,
 	.ht_log_component = COMPONENT_CLIENTID,
 };
 
@@ -1268,7 +1348,7 @@ static hash_parameter_t cr_hash_param = {
 	.key_to_str = display_client_record_key,
 	.val_to_str = display_client_record_val,
 	.ht_name = "Client Record",
-	.flags = HT_FLAG_CACHE,
+	.flags = HT_FLAG_OPEN,
 	.ht_log_component = COMPONENT_CLIENTID,
 };
 
@@ -1281,6 +1361,17 @@ static hash_parameter_t cr_hash_param = {
  */
 int nfs_Init_client_id(void)
 {
+	nfs_version4_parameter_t *v4 = &nfs_param.nfsv4_param;
+
+	cid_confirmed_hash_param.index_size = v4->clientid_hash_partitions;
+	cid_confirmed_hash_param.resize_load = v4->hash_resize_load;
+	cid_unconfirmed_hash_param.index_size = v4->clientid_hash_partitions;
+	cid_unconfirmed_hash_param.resize_load = v4->hash_resize_load;
+	cid_confirmed_hash_param.key_hash = v4->hash_function;
+	cid_unconfirmed_hash_param.key_hash = v4->hash_function;
+	cr_hash_param.index_size = v4->clientid_hash_partitions;
+	cr_hash_param.resize_load = v4->hash_resize_load;
+
 	ht_confirmed_client_id =
 		hashtable_init(&cid_confirmed_hash_param);
 
@@ -1307,8 +1398,11 @@ int nfs_Init_client_id(void)
 		return -1;
 	}
 
-	client_id_pool =
-	    pool_basic_init("NFS4 Client ID Pool", sizeof(nfs_client_id_t));
+	client_id_pool = pool_tagged_init("NFS4 Client ID Pool",
+					  sizeof(nfs_client_id_t),
+					  GSH_MEM_STATE);
+
+	lease_wheel_init();
 
 	return CLIENT_ID_SUCCESS;
 }
@@ -1753,6 +1847,7 @@ nfs41_foreach_client_callback(bool(*cb) (nfs_client_id_t *cl, void *state),
 	int rc;
 
 	/* For each bucket of the hashtable */
+	hashtable_walk_begin(ht);
 	for (i = 0; i < ht->parameter.index_size; i++) {
 		head_rbt = &(ht->partitions[i].rbt);
 
@@ -1787,6 +1882,7 @@ nfs41_foreach_client_callback(bool(*cb) (nfs_client_id_t *cl, void *state),
 		}
 		PTHREAD_RWLOCK_unlock(&(ht->partitions[i].lock));
 	}
+	hashtable_walk_end(ht);
 }
 
 /** @} */
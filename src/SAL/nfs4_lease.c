@@ -40,28 +40,44 @@
 #include "nfs4.h"
 #include "sal_functions.h"
 
+/**
+ * @page lease_word Lease word
+ *
+ * Reserving and renewing a lease happen on every stateful operation, so
+ * rather than serialize them on cid_mutex the lease state is one 64 bit
+ * word updated with compare and swap: the time of the last renewal in the
+ * high 32 bits, and the count of reservations plus an expiring flag in
+ * the low 32 bits.  The reaper sets the flag under cid_mutex when it
+ * finds the lease expired with no reservation, and once the flag is set
+ * no reservation can be taken, so the lease can't come back to life
+ * while the client is being expired.
+ */
+
 /**
  * @brief Return the lifetime of a valid lease
  *
  * @param[in] clientid The client record to check
+ * @param[in] lease    Lease word to check
+ * @param[in] now      Current time
  *
  * @return The lease lifetime or 0 if expired.
  */
-static unsigned int _valid_lease(nfs_client_id_t *clientid)
+static unsigned int _valid_lease(nfs_client_id_t *clientid, uint64_t lease,
+				 time_t now)
 {
-	time_t t;
+	time_t expire;
 
-	if (clientid->cid_confirmed == EXPIRED_CLIENT_ID)
+	if (clientid->cid_confirmed == EXPIRED_CLIENT_ID ||
+	    (lease & LEASE_EXPIRING) != 0)
 		return 0;
 
-	if (clientid->cid_lease_reservations != 0)
+	if (LEASE_RESERVATIONS(lease) != 0)
 		return nfs_param.nfsv4_param.lease_lifetime;
 
-	t = time(NULL);
+	expire = LEASE_LAST_RENEW(lease) + nfs_param.nfsv4_param.lease_lifetime;
 
-	if (clientid->cid_last_renew + nfs_param.nfsv4_param.lease_lifetime > t)
-		return (clientid->cid_last_renew +
-			nfs_param.nfsv4_param.lease_lifetime) - t;
+	if (expire > now)
+		return expire - now;
 
 	return 0;
 }
@@ -69,8 +85,6 @@ static unsigned int _valid_lease(nfs_client_id_t *clientid)
 /**
  * @brief Check if lease is valid
  *
- * The caller must hold cid_mutex.
- *
  * @param[in] clientid Record to check lease for.
  *
  * @return 1 if lease is valid, 0 if not.
@@ -80,7 +94,9 @@ bool valid_lease(nfs_client_id_t *clientid)
 {
 	unsigned int valid;
 
-	valid = _valid_lease(clientid);
+	valid = _valid_lease(clientid,
+			     atomic_fetch_uint64_t(&clientid->cid_lease),
+			     time(NULL));
 
 	if (isFullDebug(COMPONENT_CLIENTID)) {
 		char str[LOG_BUFF_LEN] = "\0";
@@ -96,10 +112,10 @@ bool valid_lease(nfs_client_id_t *clientid)
 }
 
 /**
- * @brief Check if lease is valid and reserve it and retain cid_mutex.
+ * @brief Check if lease is valid and reserve it.
  *
  * Lease reservation prevents any other thread from expiring the lease. Caller
- * must call update lease to release the reservation.
+ * must call update lease to release the reservation.  No lock is needed.
  *
  * @param[in] clientid Client record to check lease for
  *
@@ -109,11 +125,14 @@ bool valid_lease(nfs_client_id_t *clientid)
 int reserve_lease(nfs_client_id_t *clientid)
 {
 	unsigned int valid;
+	uint64_t lease;
+	time_t now = time(NULL);
 
-	valid = _valid_lease(clientid);
-
-	if (valid != 0)
-		clientid->cid_lease_reservations++;
+	do {
+		lease = atomic_fetch_uint64_t(&clientid->cid_lease);
+		valid = _valid_lease(clientid, lease, now);
+	} while (valid != 0 &&
+		 !atomic_cas_uint64_t(&clientid->cid_lease, lease, lease + 1));
 
 	if (isFullDebug(COMPONENT_CLIENTID)) {
 		char str[LOG_BUFF_LEN] = "\0";
@@ -133,20 +152,23 @@ int reserve_lease(nfs_client_id_t *clientid)
  *
  * Lease reservation prevents any other thread from expiring the lease. This
  * function releases the lease reservation. Before releasing the last
- * reservation, cid_last_renew will be updated.
+ * reservation, the last renewal time will be updated.  No lock is needed.
  *
  * @param[in] clientid Clientid record to update
- *
- * @return 1 if lease is valid, 0 if not.
- *
  */
 void update_lease(nfs_client_id_t *clientid)
 {
-	clientid->cid_lease_reservations--;
+	uint64_t lease, new_lease;
+	time_t now = time(NULL);
 
-	/* Renew lease when last reservation is released */
-	if (clientid->cid_lease_reservations == 0)
-		clientid->cid_last_renew = time(NULL);
+	do {
+		lease = atomic_fetch_uint64_t(&clientid->cid_lease);
+		new_lease = lease - 1;
+
+		/* Renew lease when last reservation is released */
+		if (LEASE_RESERVATIONS(new_lease) == 0)
+			new_lease = LEASE_WORD(now, new_lease);
+	} while (!atomic_cas_uint64_t(&clientid->cid_lease, lease, new_lease));
 
 	if (isFullDebug(COMPONENT_CLIENTID)) {
 		char str[LOG_BUFF_LEN] = "\0";
@@ -157,4 +179,243 @@ void update_lease(nfs_client_id_t *clientid)
 	}
 }
 
+/**
+ * @brief Renew a lease without reserving it
+ *
+ * @param[in] clientid Clientid record to renew
+ */
+void renew_lease(nfs_client_id_t *clientid)
+{
+	uint64_t lease;
+	time_t now = time(NULL);
+
+	do {
+		lease = atomic_fetch_uint64_t(&clientid->cid_lease);
+	} while (!atomic_cas_uint64_t(&clientid->cid_lease, lease,
+				      LEASE_WORD(now, lease)));
+}
+
+/**
+ * @brief Claim an expired lease for expiry
+ *
+ * If the lease is expired and not reserved, mark it expiring so no
+ * reservation can be taken any more.
+ *
+ * @note The cid_mutex MUST be held
+ *
+ * @param[in] clientid Clientid record to check
+ *
+ * @retval true if the client must be expired.
+ * @retval false if the lease is still valid.
+ */
+bool expire_lease(nfs_client_id_t *clientid)
+{
+	uint64_t lease;
+	time_t now = time(NULL);
+
+	do {
+		lease = atomic_fetch_uint64_t(&clientid->cid_lease);
+		if (_valid_lease(clientid, lease, now) != 0)
+			return false;
+	} while ((lease & LEASE_EXPIRING) == 0 &&
+		 !atomic_cas_uint64_t(&clientid->cid_lease, lease,
+				      lease | LEASE_EXPIRING));
+
+	return true;
+}
+
+/******************************************************************************
+ *
+ * Lease expiry wheel
+ *
+ ******************************************************************************/
+
+/**
+ * @page lease_wheel Lease expiry wheel
+ *
+ * Rather than walk every clientid looking for expired leases, the reaper
+ * pulls the clientids that are due from a hierarchical timer wheel with
+ * one second ticks.  Level 0 holds the next LEASE_WHEEL_SLOTS seconds,
+ * each higher level LEASE_WHEEL_SLOTS times as much, and its slots are
+ * pushed down a level as the wheel turns past them.
+ *
+ * Renewing a lease does not touch the wheel, a clientid stays queued at
+ * the deadline it had when queued.  When that deadline comes the reaper
+ * checks the lease and, if it has been renewed since, queues the
+ * clientid again at its new deadline, so each live clientid is looked at
+ * about once per lease period.
+ *
+ * The wheel holds a reference on every queued clientid.
+ */
+
+#define LEASE_WHEEL_BITS 6
+#define LEASE_WHEEL_SLOTS (1 << LEASE_WHEEL_BITS)
+#define LEASE_WHEEL_MASK (LEASE_WHEEL_SLOTS - 1)
+#define LEASE_WHEEL_LEVELS 3
+
+static pthread_mutex_t lease_wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct glist_head lease_wheel[LEASE_WHEEL_LEVELS][LEASE_WHEEL_SLOTS];
+static struct glist_head lease_wheel_due;
+static time_t lease_wheel_tick;	/*< Next tick to turn the wheel to */
+
+/**
+ * @brief Initialize the lease expiry wheel
+ */
+void lease_wheel_init(void)
+{
+	int level, slot;
+
+	for (level = 0; level < LEASE_WHEEL_LEVELS; level++)
+		for (slot = 0; slot < LEASE_WHEEL_SLOTS; slot++)
+			glist_init(&lease_wheel[level][slot]);
+
+	glist_init(&lease_wheel_due);
+	lease_wheel_tick = time(NULL);
+}
+
+/**
+ * @brief Put a clientid in the wheel slot for its deadline
+ *
+ * @note The lease_wheel_mutex MUST be held
+ */
+static void lease_wheel_add(nfs_client_id_t *clientid)
+{
+	time_t deadline = clientid->cid_lease_deadline;
+	time_t delta;
+	int level, shift = 0;
+
+	if (deadline < lease_wheel_tick)
+		deadline = lease_wheel_tick;
+
+	delta = deadline - lease_wheel_tick;
+
+	for (level = 0; level < LEASE_WHEEL_LEVELS - 1; level++) {
+		if (delta < ((time_t) LEASE_WHEEL_SLOTS << shift))
+			break;
+		shift += LEASE_WHEEL_BITS;
+	}
+
+	/* Too far out for the top level, it will come round again and be
+	 * pushed down once the wheel gets there.
+	 */
+	if (delta >= ((time_t) LEASE_WHEEL_SLOTS << shift))
+		deadline = lease_wheel_tick +
+			   ((time_t) LEASE_WHEEL_MASK << shift);
+
+	glist_add_tail(&lease_wheel[level][(deadline >> shift) &
+					   LEASE_WHEEL_MASK],
+		       &clientid->cid_lease_wheel);
+}
+
+/**
+ * @brief Queue a clientid at the deadline of its lease
+ *
+ * A clientid already queued is left where it is.
+ *
+ * @param[in] clientid Clientid record to queue
+ */
+void lease_schedule(nfs_client_id_t *clientid)
+{
+	uint64_t lease = atomic_fetch_uint64_t(&clientid->cid_lease);
+	time_t renew = LEASE_LAST_RENEW(lease);
+
+	if (LEASE_RESERVATIONS(lease) != 0)
+		renew = time(NULL);
+
+	PTHREAD_MUTEX_lock(&lease_wheel_mutex);
+
+	if (glist_null(&clientid->cid_lease_wheel)) {
+		clientid->cid_lease_deadline =
+			renew + nfs_param.nfsv4_param.lease_lifetime;
+		inc_client_id_ref(clientid);
+		lease_wheel_add(clientid);
+	}
+
+	PTHREAD_MUTEX_unlock(&lease_wheel_mutex);
+}
+
+/**
+ * @brief Take a clientid off the wheel
+ *
+ * @param[in] clientid Clientid record to remove
+ */
+void lease_unschedule(nfs_client_id_t *clientid)
+{
+	bool queued;
+
+	PTHREAD_MUTEX_lock(&lease_wheel_mutex);
+
+	queued = !glist_null(&clientid->cid_lease_wheel);
+	glist_del(&clientid->cid_lease_wheel);
+
+	PTHREAD_MUTEX_unlock(&lease_wheel_mutex);
+
+	if (queued)
+		dec_client_id_ref(clientid);
+}
+
+/**
+ * @brief Push the clientids of a higher level slot down the wheel
+ *
+ * @note The lease_wheel_mutex MUST be held
+ */
+static void lease_wheel_cascade(int level)
+{
+	struct glist_head slot, *glist, *glistn;
+	int shift = level * LEASE_WHEEL_BITS;
+
+	/* Entries may go back in the same slot, take them all out first */
+	glist_init(&slot);
+	glist_splice_tail(&slot,
+			  &lease_wheel[level][(lease_wheel_tick >> shift) &
+					      LEASE_WHEEL_MASK]);
+
+	glist_for_each_safe(glist, glistn, &slot) {
+		glist_del(glist);
+		lease_wheel_add(glist_entry(glist, nfs_client_id_t,
+					    cid_lease_wheel));
+	}
+}
+
+/**
+ * @brief Get the next clientid whose lease deadline has come
+ *
+ * The wheel's reference on the clientid passes to the caller, who
+ * must either expire it or queue it again with lease_schedule.
+ *
+ * @param[in] now Current time
+ *
+ * @return A clientid that is due, or NULL if there are no more.
+ */
+nfs_client_id_t *lease_wheel_next_due(time_t now)
+{
+	nfs_client_id_t *clientid;
+	int level;
+
+	PTHREAD_MUTEX_lock(&lease_wheel_mutex);
+
+	while (glist_empty(&lease_wheel_due) && lease_wheel_tick <= now) {
+		for (level = LEASE_WHEEL_LEVELS - 1; level > 0; level--) {
+			if ((lease_wheel_tick &
+			     ((1 << (level * LEASE_WHEEL_BITS)) - 1)) == 0)
+				lease_wheel_cascade(level);
+		}
+
+		glist_splice_tail(&lease_wheel_due,
+				  &lease_wheel[0][lease_wheel_tick &
+						  LEASE_WHEEL_MASK]);
+		lease_wheel_tick++;
+	}
+
+	clientid = glist_first_entry(&lease_wheel_due, nfs_client_id_t,
+				     cid_lease_wheel);
+
+	if (clientid != NULL)
+		glist_del(&clientid->cid_lease_wheel);
+
+	PTHREAD_MUTEX_unlock(&lease_wheel_mutex);
+
+	return clientid;
+}
+
 /** @} */
@@ -336,6 +336,13 @@ void free_nfs4_owner(state_owner_t *owner)
 
 	glist_del(&owner->so_owner.so_nfs4_owner.so_perclient);
 
+	if (owner->so_type == STATE_OPEN_OWNER_NFSV4)
+		(void) atomic_dec_uint32_t(&owner->so_owner.so_nfs4_owner
+					   .so_clientrec->cid_nb_openowners);
+	else if (owner->so_type == STATE_LOCK_OWNER_NFSV4)
+		(void) atomic_dec_uint32_t(&owner->so_owner.so_nfs4_owner
+					   .so_clientrec->cid_nb_lockowners);
+
 	PTHREAD_MUTEX_unlock(&owner->so_owner.so_nfs4_owner.so_clientrec
 			     ->cid_mutex);
 
@@ -349,7 +356,7 @@ static hash_parameter_t nfs4_owner_param = {
 	.compare_key = compare_nfs4_owner_key,
 	.key_to_str = display_nfs4_owner_key,
 	.val_to_str = display_nfs4_owner_val,
-	.flags = HT_FLAG_CACHE,
+	.flags = HT_FLAG_OPEN,
 };
 
 /**
@@ -360,6 +367,10 @@ static hash_parameter_t nfs4_owner_param = {
  */
 int Init_nfs4_owner(void)
 {
+	nfs4_owner_param.index_size =
+		nfs_param.nfsv4_param.state_hash_partitions;
+	nfs4_owner_param.resize_load = nfs_param.nfsv4_param.hash_resize_load;
+
 	ht_nfs4_owner = hashtable_init(&nfs4_owner_param);
 
 	if (ht_nfs4_owner == NULL) {
@@ -396,11 +407,15 @@ static void init_nfs4_owner(state_owner_t *owner)
 		glist_add_tail(&owner->so_owner.so_nfs4_owner.so_clientrec->
 			       cid_openowners,
 			       &owner->so_owner.so_nfs4_owner.so_perclient);
+		(void) atomic_inc_uint32_t(&owner->so_owner.so_nfs4_owner
+					   .so_clientrec->cid_nb_openowners);
 	} else if (owner->so_type == STATE_LOCK_OWNER_NFSV4) {
 		/* If lock owner, add to clientid open owner list */
 		glist_add_tail(&owner->so_owner.so_nfs4_owner.so_clientrec->
 			       cid_lockowners,
 			       &owner->so_owner.so_nfs4_owner.so_perclient);
+		(void) atomic_inc_uint32_t(&owner->so_owner.so_nfs4_owner
+					   .so_clientrec->cid_nb_lockowners);
 	}
 
 	PTHREAD_MUTEX_unlock(&owner->so_owner.so_nfs4_owner.so_clientrec
@@ -426,6 +441,9 @@ void nfs4_owner_PrintAll(void)
  * @param[out] pisnew        Whether the owner actually is new
  * @param[in]  care          Care flag (to unify v3/v4 owners?)
  *
+ * A client at Max_Open_Owners_Per_Client or Max_Lock_Owners_Per_Client
+ * may still reuse the owners it has but gets no new one.
+ *
  * @return A new state owner or NULL.
  */
 state_owner_t *create_nfs4_owner(state_nfs4_owner_name_t *name,
@@ -437,7 +455,7 @@ state_owner_t *create_nfs4_owner(state_nfs4_owner_name_t *name,
 {
 	state_owner_t key;
 	state_owner_t *owner;
-	bool_t isnew;
+	bool_t isnew = false;
 
 	/* set up the content of the open_owner */
 	memset(&key, 0, sizeof(key));
@@ -467,6 +485,12 @@ state_owner_t *create_nfs4_owner(state_nfs4_owner_name_t *name,
 		LogFullDebug(COMPONENT_STATE, "Key=%s", str);
 	}
 
+	if (nfs4_client_at_limit(clientid,
+				 type == STATE_OPEN_OWNER_NFSV4
+					? CLIENT_LIMIT_OPEN_OWNERS
+					: CLIENT_LIMIT_LOCK_OWNERS))
+		care = CARE_NOT;
+
 	owner = get_state_owner(care, &key, init_nfs4_owner, &isnew);
 
 	if (owner != NULL && related_owner != NULL) {
@@ -39,6 +39,7 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include "bsd-base64.h"
+#include "city.h"
 #include "client_mgr.h"
 #include "fsal.h"
 
@@ -47,16 +48,51 @@ pthread_mutex_t grace_mutex = PTHREAD_MUTEX_INITIALIZER;        /*< Mutex */
 struct glist_head clid_list = GLIST_HEAD_INIT(clid_list);  /*< Clients */
 struct nfs4_recovery_backend *recovery_backend;
 
+/** Buckets of clid_hash, a power of 2 */
+#define CLID_HASH_SIZE 4096
+
+/** clid_list by cl_name, so a reconnect storm of N clients does not
+    compare N names each, protected by grace_mutex */
+static struct glist_head clid_hash[CLID_HASH_SIZE];
+
+/** Clients on clid_list that have not sent RECLAIM_COMPLETE yet,
+    protected by grace_mutex */
+static int32_t reclaim_pending;
+/** Whether this grace period may end as soon as reclaim_pending drops
+    to 0, protected by grace_mutex */
+static bool grace_lift_allowed;
+
 static void nfs4_recovery_load_clids_nolock(nfs_grace_start_t *gsp);
 static void nfs_release_nlm_state(char *release_ip);
 static void nfs_release_v4_client(char *ip);
 
+/**
+ * @brief Find the clid_hash bucket of a client name
+ *
+ * @note The grace_mutex MUST be held
+ */
+static struct glist_head *clid_bucket(const char *cl_name)
+{
+	struct glist_head *head;
+
+	head = &clid_hash[CityHash64(cl_name, strlen(cl_name)) &
+			  (CLID_HASH_SIZE - 1)];
+	if (glist_null(head))
+		glist_init(head);
+
+	return head;
+}
+
 clid_entry_t *nfs4_add_clid_entry(char *cl_name)
 {
 	clid_entry_t *new_ent = gsh_malloc(sizeof(clid_entry_t));
 
 	strcpy(new_ent->cl_name, cl_name);
+	glist_init(&new_ent->cl_rfh_list);
+	new_ent->cl_reclaim_complete = false;
 	glist_add(&clid_list, &new_ent->cl_list);
+	glist_add(clid_bucket(new_ent->cl_name), &new_ent->cl_hash);
+	reclaim_pending++;
 	return new_ent;
 }
 
@@ -77,8 +113,41 @@ void nfs4_cleanup_clid_entrys(void)
 					       struct clid_entry,
 					       cl_list)) != NULL) {
 		glist_del(&clid_entry->cl_list);
+		glist_del(&clid_entry->cl_hash);
 		gsh_free(clid_entry);
 	}
+
+	reclaim_pending = 0;
+}
+
+/**
+ * @brief End grace once every known client has finished reclaiming
+ *
+ * Only NFSv4.1 clients say when they are done, so a single v4.0 client
+ * on the list keeps the full grace period, as does running NLM, whose
+ * reclaimers we can not tell apart.  Grace periods started for other
+ * reasons than a restart or a takeover always run their course.
+ *
+ * @note The grace_mutex MUST be held
+ */
+static void nfs4_try_lift_grace(void)
+{
+	time_t now = time(NULL);
+
+	if (!grace_lift_allowed || reclaim_pending > 0)
+		return;
+
+	if (atomic_fetch_time_t(&current_grace) +
+	    nfs_param.nfsv4_param.grace_period <= now)
+		return;
+
+	LogEvent(COMPONENT_STATE,
+		 "All known clients have reclaimed, lifting GRACE after %d seconds",
+		 (int)(now - atomic_fetch_time_t(&current_grace)));
+
+	atomic_store_time_t(&current_grace,
+			    now - nfs_param.nfsv4_param.grace_period);
+	grace_lift_allowed = false;
 }
 
 /**
@@ -117,6 +186,13 @@ void nfs4_start_grace(nfs_grace_start_t *gsp)
 
 	LogEvent(COMPONENT_STATE, "NFS Server Now IN GRACE, duration %d",
 		 (int)nfs_param.nfsv4_param.grace_period);
+
+	grace_lift_allowed = !nfs_param.core_param.enable_NLM &&
+			     (gsp == NULL ||
+			      gsp->event == EVENT_UPDATE_CLIENTS ||
+			      gsp->event == EVENT_TAKE_IP ||
+			      gsp->event == EVENT_TAKE_NODEID);
+
 	/*
 	 * if called from failover code and given a nodeid, then this node
 	 * is doing a take over.  read in the client ids from the failing node
@@ -136,6 +212,10 @@ void nfs4_start_grace(nfs_grace_start_t *gsp)
 				nfs4_recovery_load_clids_nolock(gsp);
 		}
 	}
+
+	/* Nobody may be left to reclaim */
+	nfs4_try_lift_grace();
+
 	PTHREAD_MUTEX_unlock(&grace_mutex);
 }
 
@@ -200,7 +280,7 @@ void nfs4_rm_clid(nfs_client_id_t *clientid)
  */
 void  nfs4_chk_clid_impl(nfs_client_id_t *clientid, clid_entry_t **clid_ent_arg)
 {
-	struct glist_head *node;
+	struct glist_head *node, *bucket;
 	clid_entry_t *clid_ent;
 	*clid_ent_arg = NULL;
 
@@ -211,13 +291,20 @@ void  nfs4_chk_clid_impl(nfs_client_id_t *clientid, clid_entry_t **clid_ent_arg)
 	if (glist_empty(&clid_list))
 		return;
 
+	/* Every backend matches cid_recov_tag against cl_name, so only
+	 * the entries hashed with the same name can match.
+	 */
+	if (clientid->cid_recov_tag == NULL)
+		return;
+
+	bucket = clid_bucket(clientid->cid_recov_tag);
+
 	/*
-	 * loop through the list and try to find this client.  if we
-	 * find it, mark it to allow reclaims.  perhaps the client should
-	 * be removed from the list at this point to make the list shorter?
+	 * loop through the bucket and try to find this client.  if we
+	 * find it, mark it to allow reclaims.
 	 */
-	glist_for_each(node, &clid_list) {
-		clid_ent = glist_entry(node, clid_entry_t, cl_list);
+	glist_for_each(node, bucket) {
+		clid_ent = glist_entry(node, clid_entry_t, cl_hash);
 		if (recovery_backend->check_clid(clientid, clid_ent)) {
 			if (isDebug(COMPONENT_CLIENTID)) {
 				char str[LOG_BUFF_LEN] = "\0";
@@ -237,6 +324,39 @@ void  nfs4_chk_clid_impl(nfs_client_id_t *clientid, clid_entry_t **clid_ent_arg)
 	}
 }
 
+/**
+ * @brief Note that a client finished reclaiming
+ *
+ * Called on RECLAIM_COMPLETE, grace ends when the last known client is
+ * done.
+ *
+ * @param[in] clientid Client record
+ */
+void nfs4_reclaim_complete(nfs_client_id_t *clientid)
+{
+	clid_entry_t *clid_ent;
+
+	if (!nfs_in_grace())
+		return;
+
+	PTHREAD_MUTEX_lock(&grace_mutex);
+
+	nfs4_chk_clid_impl(clientid, &clid_ent);
+
+	if (clid_ent != NULL && !clid_ent->cl_reclaim_complete) {
+		clid_ent->cl_reclaim_complete = true;
+		reclaim_pending--;
+
+		LogDebug(COMPONENT_CLIENTID,
+			 "%s done reclaiming, %"PRIi32" clients left",
+			 clid_ent->cl_name, reclaim_pending);
+
+		nfs4_try_lift_grace();
+	}
+
+	PTHREAD_MUTEX_unlock(&grace_mutex);
+}
+
 void  nfs4_chk_clid(nfs_client_id_t *clientid)
 {
 	clid_entry_t *dummy_clid_ent;
@@ -489,6 +609,7 @@ static void nfs_release_nlm_state(char *release_ip)
 	cancel_all_nlm_blocked();
 
 	/* walk the client list and call state_nlm_notify */
+	hashtable_walk_begin(ht);
 	for (i = 0; i < ht->parameter.index_size; i++) {
 		PTHREAD_RWLOCK_wrlock(&ht->partitions[i].lock);
 		head_rbt = &ht->partitions[i].rbt;
@@ -516,6 +637,7 @@ static void nfs_release_nlm_state(char *release_ip)
 		}
 		PTHREAD_RWLOCK_unlock(&ht->partitions[i].lock);
 	}
+	hashtable_walk_end(ht);
 #endif /* _USE_NLM */
 }
 
@@ -551,6 +673,7 @@ static void nfs_release_v4_client(char *ip)
 	LogEvent(COMPONENT_STATE, "NFS Server V4 recovery release ip %s", ip);
 
 	/* go through the confirmed clients looking for a match */
+	hashtable_walk_begin(ht);
 	for (i = 0; i < ht->parameter.index_size; i++) {
 
 		PTHREAD_RWLOCK_wrlock(&ht->partitions[i].lock);
@@ -578,6 +701,7 @@ static void nfs_release_v4_client(char *ip)
 				PTHREAD_MUTEX_unlock(&cp->cid_mutex);
 
 				PTHREAD_RWLOCK_unlock(&ht->partitions[i].lock);
+				hashtable_walk_end(ht);
 
 				/* nfs_client_id_expire requires cr_mutex
 				 * if not decoupled alread
@@ -602,6 +726,7 @@ static void nfs_release_v4_client(char *ip)
 		}
 		PTHREAD_RWLOCK_unlock(&ht->partitions[i].lock);
 	}
+	hashtable_walk_end(ht);
 }
 
 /** @} */
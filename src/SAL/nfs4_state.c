@@ -115,6 +115,13 @@ state_status_t _state_add_impl(struct fsal_obj_handle *obj,
 		goto errout;
 	}
 
+	/* A client at Max_States_Per_Client gets NFS4ERR_RESOURCE */
+	if (nfs4_client_at_limit(owner_input->so_owner.so_nfs4_owner
+				 .so_clientrec, CLIENT_LIMIT_STATES)) {
+		status = STATE_MALLOC_ERROR;
+		goto errout;
+	}
+
 	get_gsh_export_ref(op_ctx->ctx_export);
 
 	got_export_ref = true;
@@ -133,7 +140,9 @@ state_status_t _state_add_impl(struct fsal_obj_handle *obj,
 
 	mutex_init = true;
 
-	/* Add the stateid.other, this will increment cid_stateid_counter */
+	/* Add the clientid part of stateid.other, nfs4_State_Set adds the
+	 * slot.
+	 */
 	nfs4_BuildStateId_Other(owner_input->so_owner.so_nfs4_owner.
 				so_clientrec, pnew_state->stateid_other);
 
@@ -199,9 +208,14 @@ state_status_t _state_add_impl(struct fsal_obj_handle *obj,
 	PTHREAD_MUTEX_unlock(&pnew_state->state_mutex);
 	PTHREAD_RWLOCK_unlock(&op_ctx->ctx_export->lock);
 
-	/* Add state to list for file */
+	/* Add state to list for file, directories only carry delegations */
 	PTHREAD_MUTEX_lock(&pnew_state->state_mutex);
-	glist_add_tail(&ostate->file.list_of_states, &pnew_state->state_list);
+	if (obj->type == DIRECTORY)
+		glist_add_tail(&ostate->dir.dir_delegations,
+			       &pnew_state->state_list);
+	else
+		glist_add_tail(&ostate->file.list_of_states,
+			       &pnew_state->state_list);
 	/* Get ref for this state entry */
 	obj->obj_ops.get_ref(obj);
 	PTHREAD_MUTEX_unlock(&pnew_state->state_mutex);
@@ -218,6 +232,8 @@ state_status_t _state_add_impl(struct fsal_obj_handle *obj,
 
 	glist_add_tail(&owner_input->so_owner.so_nfs4_owner.so_state_list,
 		       &pnew_state->state_owner_list);
+	(void) atomic_inc_uint32_t(&owner_input->so_owner.so_nfs4_owner
+				   .so_clientrec->cid_nb_states);
 
 	PTHREAD_MUTEX_unlock(&pnew_state->state_mutex);
 	PTHREAD_MUTEX_unlock(&owner_input->so_mutex);
@@ -255,7 +271,8 @@ errout:
 		/* Make sure the new state is closed (may have been passed in
 		 * with file open).
 		 */
-		(void) obj->obj_ops.close2(obj, pnew_state);
+		if (obj->type != DIRECTORY)
+			(void) obj->obj_ops.close2(obj, pnew_state);
 
 		pnew_state->state_exp->exp_ops.free_state(pnew_state->state_exp,
 							  pnew_state);
@@ -389,7 +406,7 @@ void _state_del_locked(state_t *state, const char *func, int line)
 	state->state_obj = NULL;
 	PTHREAD_MUTEX_unlock(&state->state_mutex);
 
-	if (obj->fsal->m_ops.support_ex(obj)) {
+	if (obj->type != DIRECTORY && obj->fsal->m_ops.support_ex(obj)) {
 		/* We need to close the state at this point. The state will
 		 * eventually be freed and it must be closed before free. This
 		 * is the last point we have a valid reference to the object
@@ -412,6 +429,8 @@ void _state_del_locked(state_t *state, const char *func, int line)
 
 		glist_del(&state->state_owner_list);
 		state->state_owner = NULL;
+		(void) atomic_dec_uint32_t(&nfs4_owner->so_clientrec
+					   ->cid_nb_states);
 
 		/* If we are dropping the last open state from an open
 		 * owner, we will want to retain a refcount and let the
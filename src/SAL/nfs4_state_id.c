@@ -49,7 +49,7 @@
 #include <sys/file.h>		/* for having FNDELAY */
 #include <pwd.h>
 #include <grp.h>
-#include <pthread.h>
+#include <sched.h>
 #include "log.h"
 #include "gsh_rpc.h"
 #include "hashtable.h"
@@ -63,11 +63,164 @@
 #include "city.h"
 
 /**
- * @brief Hash table for stateids.
+ * @brief Hash table for stateids by entry/owner.
  */
-hash_table_t *ht_state_id;
 hash_table_t *ht_state_obj;
 
+/**
+ * @page stateid_table Stateid table
+ *
+ * The server makes up stateid.other itself.  After the clientid it
+ * stores the index of the slot holding the state and a generation that
+ * changes each time the slot is reused, so looking up a stateid is an
+ * array index with no hashing and no lock.
+ *
+ * Slots come in chunks allocated as the table grows and kept until
+ * shutdown, so a slot never goes away under a reader.  A reader pins the
+ * slot while it takes its reference on the state, and removing a state
+ * waits for the pins to drain before the state can be freed.  Slots are
+ * handed out and given back under state_slot_mutex, oldest free slot
+ * first, so a stale stateid only matches again after the generation of
+ * its slot wraps.
+ */
+
+#define STATE_SLOT_BITS 24
+#define STATE_SLOT_MAX (1 << STATE_SLOT_BITS)
+#define STATE_SLOT_GEN_MASK 0xFF
+#define STATE_SLOT_CHUNK_BITS 12
+#define STATE_SLOT_CHUNK (1 << STATE_SLOT_CHUNK_BITS)
+#define STATE_SLOT_NONE UINT32_MAX
+
+struct state_slot {
+	state_t *ss_state;	/*< State in the slot, NULL if free */
+	int32_t ss_readers;	/*< Lookups pinning the slot */
+	uint32_t ss_gen;	/*< Generation of the slot */
+	uint32_t ss_next_free;	/*< Next slot on the free list */
+};
+
+static struct state_slot *state_slot_chunks[STATE_SLOT_MAX / STATE_SLOT_CHUNK];
+static pthread_mutex_t state_slot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t state_slot_used;
+static uint32_t state_slot_free_head = STATE_SLOT_NONE;
+static uint32_t state_slot_free_tail = STATE_SLOT_NONE;
+
+static inline struct state_slot *state_slot_get(uint32_t index)
+{
+	struct state_slot *chunk = atomic_fetch_voidptr(
+		(void **) &state_slot_chunks[index >> STATE_SLOT_CHUNK_BITS]);
+
+	if (chunk == NULL)
+		return NULL;
+
+	return &chunk[index & (STATE_SLOT_CHUNK - 1)];
+}
+
+/**
+ * @brief Slot index and generation from a stateid other
+ */
+static inline uint32_t stateid_other_slot(const char *other)
+{
+	uint32_t counter;
+
+	memcpy(&counter, other + sizeof(clientid4), sizeof(counter));
+
+	return counter;
+}
+
+/**
+ * @brief Give a state a slot and store it in its stateid other
+ *
+ * @param[in,out] state State with the clientid part of other built
+ *
+ * @retval true if a slot was found.
+ * @retval false if the table is full.
+ */
+static bool state_slot_alloc(state_t *state)
+{
+	struct state_slot *slot;
+	uint32_t index, counter;
+
+	PTHREAD_MUTEX_lock(&state_slot_mutex);
+
+	if (state_slot_free_head != STATE_SLOT_NONE) {
+		index = state_slot_free_head;
+		slot = state_slot_get(index);
+		state_slot_free_head = slot->ss_next_free;
+		if (state_slot_free_head == STATE_SLOT_NONE)
+			state_slot_free_tail = STATE_SLOT_NONE;
+	} else if (state_slot_used < STATE_SLOT_MAX) {
+		index = state_slot_used++;
+		if ((index & (STATE_SLOT_CHUNK - 1)) == 0)
+			atomic_store_voidptr(
+			    (void **) &state_slot_chunks[index >>
+							 STATE_SLOT_CHUNK_BITS],
+			    gsh_calloc(STATE_SLOT_CHUNK,
+				       sizeof(struct state_slot)));
+		slot = state_slot_get(index);
+	} else {
+		PTHREAD_MUTEX_unlock(&state_slot_mutex);
+		LogCrit(COMPONENT_STATE, "Stateid table full");
+		return false;
+	}
+
+	counter = (slot->ss_gen << STATE_SLOT_BITS) | index;
+	memcpy(state->stateid_other + sizeof(clientid4), &counter,
+	       sizeof(counter));
+
+	atomic_store_voidptr((void **) &slot->ss_state, state);
+
+	PTHREAD_MUTEX_unlock(&state_slot_mutex);
+
+	return true;
+}
+
+/**
+ * @brief Take a state out of its slot and free the slot
+ *
+ * @param[in] state State to remove
+ *
+ * @retval true if the state was in its slot.
+ * @retval false if it was already gone.
+ */
+static bool state_slot_free(state_t *state)
+{
+	uint32_t index = stateid_other_slot(state->stateid_other) &
+			 (STATE_SLOT_MAX - 1);
+	struct state_slot *slot = state_slot_get(index);
+
+	if (slot == NULL)
+		return false;
+
+	PTHREAD_MUTEX_lock(&state_slot_mutex);
+
+	if (slot->ss_state != state) {
+		PTHREAD_MUTEX_unlock(&state_slot_mutex);
+		return false;
+	}
+
+	atomic_store_voidptr((void **) &slot->ss_state, NULL);
+
+	/* Lookups that saw the state are about to take a reference on it,
+	 * let them before the caller drops the one the table held.
+	 */
+	while (atomic_fetch_int32_t(&slot->ss_readers) != 0)
+		sched_yield();
+
+	slot->ss_gen = (slot->ss_gen + 1) & STATE_SLOT_GEN_MASK;
+	slot->ss_next_free = STATE_SLOT_NONE;
+
+	if (state_slot_free_tail == STATE_SLOT_NONE)
+		state_slot_free_head = index;
+	else
+		state_slot_get(state_slot_free_tail)->ss_next_free = index;
+
+	state_slot_free_tail = index;
+
+	PTHREAD_MUTEX_unlock(&state_slot_mutex);
+
+	return true;
+}
+
 /**
  * @brief All-zeroes stateid4.other
  */
@@ -90,7 +243,7 @@ char all_ones[OTHERSIZE];
 int display_stateid_other(struct display_buffer *dspbuf, char *other)
 {
 	uint64_t clientid = *((uint64_t *) other);
-	uint32_t count    = *((uint32_t *) (other + sizeof(uint64_t)));
+	uint32_t count    = stateid_other_slot(other);
 	int b_left = display_cat(dspbuf, "OTHER=");
 
 	if (b_left <= 0)
@@ -111,23 +264,10 @@ int display_stateid_other(struct display_buffer *dspbuf, char *other)
 	if (b_left <= 0)
 		return b_left;
 
-	return display_printf(dspbuf, "} StateIdCounter=0x%08"PRIx32"}", count);
-}
-
-/**
- * @brief Display a stateid other in the hash table
- *
- * @param[in]  buff The key
- * @param[out] str  Output buffer
- *
- * @return Length of output string.
- */
-int display_state_id_key(struct gsh_buffdesc *buff, char *str)
-{
-	struct display_buffer dspbuf = {HASHTABLE_DISPLAY_STRLEN, str, str};
-
-	display_stateid_other(&dspbuf, buff->addr);
-	return display_buffer_len(&dspbuf);
+	return display_printf(dspbuf,
+			      "} Slot=0x%06"PRIx32" Gen=0x%02"PRIx32"}",
+			      count & (STATE_SLOT_MAX - 1),
+			      count >> STATE_SLOT_BITS);
 }
 
 /**
@@ -235,95 +375,6 @@ int display_state_id_val(struct gsh_buffdesc *buff, char *str)
 	return display_buffer_len(&dspbuf);
 }
 
-/**
- * @brief Compare two stateids
- *
- * @param[in] buff1 One key
- * @param[in] buff2 Another key
- *
- * @retval 0 if equal.
- * @retval 1 if not equal.
- */
-int compare_state_id(struct gsh_buffdesc *buff1, struct gsh_buffdesc *buff2)
-{
-	if (isFullDebug(COMPONENT_STATE)) {
-		char str1[DISPLAY_STATEID_OTHER_SIZE] = "\0";
-		char str2[DISPLAY_STATEID_OTHER_SIZE] = "\0";
-		struct display_buffer dspbuf1 = {sizeof(str1), str1, str1};
-		struct display_buffer dspbuf2 = {sizeof(str2), str2, str2};
-
-		display_stateid_other(&dspbuf1, buff1->addr);
-		display_stateid_other(&dspbuf2, buff2->addr);
-
-		if (isDebug(COMPONENT_HASHTABLE))
-			LogFullDebug(COMPONENT_STATE, "{%s} vs {%s}", str1,
-				     str2);
-	}
-
-	return memcmp(buff1->addr, buff2->addr, OTHERSIZE);
-}				/* compare_state_id */
-
-/**
- * @brief Hash a stateid
- *
- * @param[in] stateid Array aliased to stateid
- */
-static inline uint32_t compute_stateid_hash_value(uint32_t *stateid)
-{
-	return stateid[1] ^ stateid[2];
-}
-
-/**
- * @brief Hash index for a stateid
- *
- * @param[in] hparam Hash parameter
- * @param[in] key    Key to hash
- *
- * @return The hash index.
- */
-uint32_t state_id_value_hash_func(hash_parameter_t *hparam,
-				  struct gsh_buffdesc *key)
-{
-	uint32_t val =
-	    compute_stateid_hash_value(key->addr) % hparam->index_size;
-
-	if (isDebug(COMPONENT_HASHTABLE))
-		LogFullDebug(COMPONENT_STATE, "val = %" PRIu32, val);
-
-	return val;
-}
-
-/**
- * @brief RBT hash for a stateid
- *
- * @param[in] hparam Hash parameter
- * @param[in] key    Key to hash
- *
- * @return The RBT hash.
- */
-uint64_t state_id_rbt_hash_func(hash_parameter_t *hparam,
-				struct gsh_buffdesc *key)
-{
-	uint64_t val = compute_stateid_hash_value(key->addr);
-
-	if (isDebug(COMPONENT_HASHTABLE))
-		LogFullDebug(COMPONENT_STATE, "rbt = %" PRIu64, val);
-
-	return val;
-}
-
-static hash_parameter_t state_id_param = {
-	.index_size = PRIME_STATE,
-	.hash_func_key = state_id_value_hash_func,
-	.hash_func_rbt = state_id_rbt_hash_func,
-	.compare_key = compare_state_id,
-	.key_to_str = display_state_id_key,
-	.val_to_str = display_state_id_val,
-	.flags = HT_FLAG_CACHE,
-	.ht_log_component = COMPONENT_STATE,
-	.ht_name = "State ID Table"
-};
-
 /**
  * @brief Compare two stateids by entry/owner
  *
@@ -431,7 +482,7 @@ static hash_parameter_t state_obj_param = {
 	.compare_key = compare_state_obj,
 	.key_to_str = display_state_id_val,
 	.val_to_str = display_state_id_val,
-	.flags = HT_FLAG_CACHE,
+	.flags = HT_FLAG_OPEN,
 	.ht_log_component = COMPONENT_STATE,
 	.ht_name = "State Obj Table"
 };
@@ -448,12 +499,9 @@ int nfs4_Init_state_id(void)
 	memset(all_zero, 0, OTHERSIZE);
 	memset(all_ones, 0xFF, OTHERSIZE);
 
-	ht_state_id = hashtable_init(&state_id_param);
-
-	if (ht_state_id == NULL) {
-		LogCrit(COMPONENT_STATE, "Cannot init State Id cache");
-		return -1;
-	}
+	state_obj_param.index_size =
+		nfs_param.nfsv4_param.state_hash_partitions;
+	state_obj_param.resize_load = nfs_param.nfsv4_param.hash_resize_load;
 
 	ht_state_obj = hashtable_init(&state_obj_param);
 
@@ -468,23 +516,21 @@ int nfs4_Init_state_id(void)
 /**
  * @brief Build the 12 byte "other" portion of a stateid
  *
- * It is built from the ServerEpoch and a 64 bit global counter.
+ * It is built from the 64 bit clientid, the slot index and generation
+ * are filled in by nfs4_State_Set.
  *
  * @param[in] other stateid.other object (a char[OTHERSIZE] string)
  */
 void nfs4_BuildStateId_Other(nfs_client_id_t *clientid, char *other)
 {
-	uint32_t my_stateid =
-	    atomic_inc_uint32_t(&clientid->cid_stateid_counter);
-
 	/* The first part of the other is the 64 bit clientid, which
 	 * consists of the epoch in the high order 32 bits followed by
 	 * the clientid counter in the low order 32 bits.
 	 */
 	memcpy(other, &clientid->cid_clientid, sizeof(clientid->cid_clientid));
 
-	memcpy(other + sizeof(clientid->cid_clientid), &my_stateid,
-	       sizeof(my_stateid));
+	memset(other + sizeof(clientid->cid_clientid), 0,
+	       OTHERSIZE - sizeof(clientid->cid_clientid));
 }
 
 /**
@@ -524,9 +570,10 @@ void dec_nfs4_state_ref(struct state_t *state)
 }
 
 /**
- * @brief Set a state into the stateid hashtable.
+ * @brief Set a state into the stateid table.
+ *
+ * This completes stateid4.other with the slot the state gets.
  *
- * @param[in] other stateid4.other
  * @param[in] state The state to add
  *
  * @retval 1 if ok.
@@ -538,23 +585,8 @@ int nfs4_State_Set(state_t *state)
 	struct gsh_buffdesc buffval;
 	hash_error_t err;
 
-	buffkey.addr = state->stateid_other;
-	buffkey.len = OTHERSIZE;
-
-	buffval.addr = state;
-	buffval.len = sizeof(state_t);
-
-	err = hashtable_test_and_set(ht_state_id,
-				     &buffkey,
-				     &buffval,
-				     HASHTABLE_SET_HOW_SET_NO_OVERWRITE);
-
-	if (err != HASHTABLE_SUCCESS) {
-		LogCrit(COMPONENT_STATE,
-			"hashtable_test_and_set failed %s for key %p",
-			hash_table_err_to_str(err), buffkey.addr);
+	if (!state_slot_alloc(state))
 		return 0;
-	}
 
 	/* If stateid is a LOCK or SHARE state, we also index by entry/owner */
 	if (state->state_type != STATE_TYPE_LOCK &&
@@ -577,14 +609,9 @@ int nfs4_State_Set(state_t *state)
 				     HASHTABLE_SET_HOW_SET_OVERWRITE);
 
 	if (err != HASHTABLE_SUCCESS) {
-		struct gsh_buffdesc buffkey, old_key, old_value;
-
-		buffkey.addr = state->stateid_other;
-		buffkey.len = OTHERSIZE;
-
 		LogCrit(COMPONENT_STATE,
 			"hashtable_test_and_set failed %s for key %p",
-			hash_table_err_to_str(err), buffkey.addr);
+			hash_table_err_to_str(err), state->stateid_other);
 
 		if (isFullDebug(COMPONENT_STATE)) {
 			char str[LOG_BUFF_LEN] = "\0";
@@ -605,14 +632,9 @@ int nfs4_State_Set(state_t *state)
 			}
 		}
 
-		err = HashTable_Del(ht_state_id, &buffkey,
-				    &old_key, &old_value);
-
-		if (err != HASHTABLE_SUCCESS) {
+		if (!state_slot_free(state))
 			LogDebug(COMPONENT_STATE,
-				 "Failure to delete stateid %s",
-				 hash_table_err_to_str(err));
-		}
+				 "Failure to delete stateid");
 		return 0;
 	}
 
@@ -628,31 +650,33 @@ int nfs4_State_Set(state_t *state)
  */
 struct state_t *nfs4_State_Get_Pointer(char *other)
 {
-	struct gsh_buffdesc buffkey;
-	struct gsh_buffdesc buffval;
-	hash_error_t rc;
-	struct hash_latch latch;
+	struct state_slot *slot;
 	struct state_t *state;
 
-	buffkey.addr = other;
-	buffkey.len = OTHERSIZE;
-
-	rc = hashtable_getlatch(ht_state_id, &buffkey, &buffval, true, &latch);
+	slot = state_slot_get(stateid_other_slot(other) & (STATE_SLOT_MAX - 1));
 
-	if (rc != HASHTABLE_SUCCESS) {
-		if (rc == HASHTABLE_ERROR_NO_SUCH_KEY)
-			hashtable_releaselatched(ht_state_id, &latch);
-		LogDebug(COMPONENT_STATE, "HashTable_Get returned %d", rc);
+	if (slot == NULL) {
+		LogDebug(COMPONENT_STATE, "No such stateid slot");
 		return NULL;
 	}
 
-	state = buffval.addr;
+	/* Pin the slot so the state can't be freed before we have our
+	 * reference, the generation in other tells a reused slot apart.
+	 */
+	atomic_inc_int32_t(&slot->ss_readers);
 
-	/* Take a reference under latch */
-	inc_state_t_ref(state);
+	state = atomic_fetch_voidptr((void **) &slot->ss_state);
 
-	/* Release latch */
-	hashtable_releaselatched(ht_state_id, &latch);
+	if (state != NULL &&
+	    memcmp(state->stateid_other, other, OTHERSIZE) == 0)
+		inc_state_t_ref(state);
+	else
+		state = NULL;
+
+	atomic_dec_int32_t(&slot->ss_readers);
+
+	if (state == NULL)
+		LogDebug(COMPONENT_STATE, "No state in stateid slot");
 
 	return state;
 }
@@ -717,33 +741,15 @@ struct state_t *nfs4_State_Get_Obj(struct fsal_obj_handle *obj,
  */
 bool nfs4_State_Del(state_t *state)
 {
-	struct gsh_buffdesc buffkey, old_key, old_value;
+	struct gsh_buffdesc buffkey, old_value;
 	struct hash_latch latch;
 	hash_error_t err;
 
-	buffkey.addr = state->stateid_other;
-	buffkey.len = OTHERSIZE;
-
-	err = HashTable_Del(ht_state_id, &buffkey, &old_key, &old_value);
-
-	if (err == HASHTABLE_ERROR_NO_SUCH_KEY) {
+	if (!state_slot_free(state)) {
 		/* Already gone */
 		return false;
-	} else if (err != HASHTABLE_SUCCESS) {
-		char str[LOG_BUFF_LEN] = "\0";
-		struct display_buffer dspbuf = {sizeof(str), str, str};
-
-		display_stateid(&dspbuf, state);
-
-		LogDebug(COMPONENT_STATE,
-			 "Failure to delete stateid %s %s",
-			 str,
-			 hash_table_err_to_str(err));
-		return false;
 	}
 
-	assert(state == old_value.addr);
-
 	/* If stateid is a LOCK or SHARE state, we had also indexed by
 	 * entry/owner
 	 */
@@ -751,11 +757,9 @@ bool nfs4_State_Del(state_t *state)
 	    state->state_type != STATE_TYPE_SHARE)
 		return true;
 
-	/* Delete the stateid hashed by entry/owner.
-	 * Use the old_value from above as the key.
-	 */
-	buffkey.addr = old_value.addr;
-	buffkey.len = old_value.len;
+	/* Delete the stateid hashed by entry/owner. */
+	buffkey.addr = state;
+	buffkey.len = sizeof(state_t);
 
 	/* Get latch: we need to check we're deleting the right state */
 	err = hashtable_getlatch(ht_state_obj, &buffkey, &old_value, true,
@@ -956,21 +960,14 @@ nfsstat4 nfs4_Check_Stateid(stateid4 *stateid, struct fsal_obj_handle *fsal_obj,
 				/* We don't expect this, but, just in case...
 				 * Update and release already reserved lease.
 				 */
-				PTHREAD_MUTEX_lock(&data->preserved_clientid
-						   ->cid_mutex);
 				update_lease(data->preserved_clientid);
-				PTHREAD_MUTEX_unlock(&data->preserved_clientid
-						     ->cid_mutex);
 				data->preserved_clientid = NULL;
 			}
 
 			/* Check if lease is expired and reserve it */
-			PTHREAD_MUTEX_lock(&pclientid->cid_mutex);
-
 			if (!reserve_lease(pclientid)) {
 				LogDebug(COMPONENT_STATE,
 					 "Returning NFS4ERR_EXPIRED");
-				PTHREAD_MUTEX_unlock(&pclientid->cid_mutex);
 				status = NFS4ERR_EXPIRED;
 				goto failure;
 			}
@@ -986,7 +983,6 @@ nfsstat4 nfs4_Check_Stateid(stateid4 *stateid, struct fsal_obj_handle *fsal_obj,
 				 */
 				data->preserved_clientid = pclientid;
 			}
-			PTHREAD_MUTEX_unlock(&pclientid->cid_mutex);
 
 			/* Replayed close, it's ok, but stateid doesn't exist */
 			LogDebug(COMPONENT_STATE,
@@ -1004,12 +1000,9 @@ nfsstat4 nfs4_Check_Stateid(stateid4 *stateid, struct fsal_obj_handle *fsal_obj,
 			 * midst of tear down due to expired lease or if
 			 * in fact the entry is actually stale.
 			 */
-			PTHREAD_MUTEX_lock(&pclientid->cid_mutex);
-
 			if (!reserve_lease(pclientid)) {
 				LogDebug(COMPONENT_STATE,
 					 "Returning NFS4ERR_EXPIRED");
-				PTHREAD_MUTEX_unlock(&pclientid->cid_mutex);
 
 				/* Release the clientid reference we just
 				 * acquired.
@@ -1023,7 +1016,6 @@ nfsstat4 nfs4_Check_Stateid(stateid4 *stateid, struct fsal_obj_handle *fsal_obj,
 			 * clientid NULL.
 			 */
 			update_lease(pclientid);
-			PTHREAD_MUTEX_unlock(&pclientid->cid_mutex);
 
 			/* The lease was valid, so this must be a stale
 			 * entry.
@@ -1043,37 +1035,22 @@ nfsstat4 nfs4_Check_Stateid(stateid4 *stateid, struct fsal_obj_handle *fsal_obj,
 			/* We don't expect this to happen, but, just in case...
 			 * Update and release already reserved lease.
 			 */
-			PTHREAD_MUTEX_lock(&data->preserved_clientid
-					   ->cid_mutex);
-
 			update_lease(data->preserved_clientid);
 
-			PTHREAD_MUTEX_unlock(&data->preserved_clientid
-					     ->cid_mutex);
-
 			data->preserved_clientid = NULL;
 		}
 
 		/* Check if lease is expired and reserve it */
-		PTHREAD_MUTEX_lock(
-		    &owner2->so_owner.so_nfs4_owner.so_clientrec->cid_mutex);
-
 		if (!reserve_lease(
 				owner2->so_owner.so_nfs4_owner.so_clientrec)) {
 			LogDebug(COMPONENT_STATE, "Returning NFS4ERR_EXPIRED");
 
-			PTHREAD_MUTEX_unlock(&owner2->so_owner.so_nfs4_owner
-					     .so_clientrec->cid_mutex);
-
 			status = NFS4ERR_EXPIRED;
 			goto failure;
 		}
 
 		data->preserved_clientid =
 		    owner2->so_owner.so_nfs4_owner.so_clientrec;
-
-		PTHREAD_MUTEX_unlock(
-		    &owner2->so_owner.so_nfs4_owner.so_clientrec->cid_mutex);
 	}
 
 	/* Sanity check : Is this the right file ? */
@@ -1231,8 +1208,28 @@ nfsstat4 nfs4_Check_Stateid(stateid4 *stateid, struct fsal_obj_handle *fsal_obj,
 
 void nfs_State_PrintAll(void)
 {
-	if (isFullDebug(COMPONENT_STATE))
-		hashtable_log(COMPONENT_STATE, ht_state_id);
+	char str[LOG_BUFF_LEN];
+	struct display_buffer dspbuf = {sizeof(str), str, str};
+	struct state_slot *slot;
+	uint32_t index;
+
+	if (!isFullDebug(COMPONENT_STATE))
+		return;
+
+	PTHREAD_MUTEX_lock(&state_slot_mutex);
+
+	for (index = 0; index < state_slot_used; index++) {
+		slot = state_slot_get(index);
+
+		if (slot->ss_state == NULL)
+			continue;
+
+		display_reset_buffer(&dspbuf);
+		display_stateid(&dspbuf, slot->ss_state);
+		LogFullDebug(COMPONENT_STATE, "%s", str);
+	}
+
+	PTHREAD_MUTEX_unlock(&state_slot_mutex);
 }
 
 /**
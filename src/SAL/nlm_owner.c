@@ -697,7 +697,7 @@ static hash_parameter_t nsm_client_hash_param = {
 	.compare_key = compare_nsm_client_key,
 	.key_to_str = display_nsm_client_key,
 	.val_to_str = display_nsm_client_val,
-	.flags = HT_FLAG_NONE,
+	.flags = HT_FLAG_OPEN,
 };
 
 static hash_parameter_t nlm_client_hash_param = {
@@ -717,7 +717,7 @@ static hash_parameter_t nlm_owner_hash_param = {
 	.compare_key = compare_nlm_owner_key,
 	.key_to_str = display_nlm_owner_key,
 	.val_to_str = display_nlm_owner_val,
-	.flags = HT_FLAG_NONE,
+	.flags = HT_FLAG_OPEN,
 };
 
 /**
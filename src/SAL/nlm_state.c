@@ -230,7 +230,7 @@ static hash_parameter_t nlm_state_hash_param = {
 	.compare_key = compare_nlm_state_key,
 	.key_to_str = display_nlm_state_key,
 	.val_to_str = display_nlm_state_val,
-	.flags = HT_FLAG_NONE,
+	.flags = HT_FLAG_OPEN,
 };
 
 /**
@@ -10,6 +10,7 @@
 #include "bsd-base64.h"
 #include "client_mgr.h"
 #include "fsal.h"
+#include "abstract_atomic.h"
 
 #define NFS_V4_RECOV_DIR "v4recov"
 #define NFS_V4_OLD_DIR "v4old"
@@ -18,6 +19,12 @@ char v4_recov_dir[PATH_MAX];
 char v4_old_dir[PATH_MAX];
 char recov_root[PATH_MAX];
 
+/** Threads walking the top level of a recovery directory */
+#define FS_RECOV_LOAD_THREADS 8
+
+/** Serializes the list hooks between loader threads */
+static pthread_mutex_t fs_load_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * @brief convert clientid opaque bytes as a hex string for mkdir purpose.
  *
@@ -370,7 +377,9 @@ static void fs_cp_pop_revoked_delegs(clid_entry_t *clid_ent,
 		}
 
 		/* Ignore the beginning \x1 and copy the rest (file handle) */
+		PTHREAD_MUTEX_lock(&fs_load_mutex);
 		new_ent = add_rfh_entry(clid_ent, dentp->d_name + 1);
+		PTHREAD_MUTEX_unlock(&fs_load_mutex);
 
 		LogFullDebug(COMPONENT_CLIENTID,
 			"revoked handle: %s",
@@ -397,6 +406,178 @@ static void fs_cp_pop_revoked_delegs(clid_entry_t *clid_ent,
 	(void)closedir(dp);
 }
 
+static int fs_read_recov_clids_impl(const char *parent_path,
+				    char *clid_str,
+				    char *tgtdir,
+				    int takeover,
+				    add_clid_entry_hook add_clid_entry,
+				    add_rfh_entry_hook add_rfh_entry);
+
+/**
+ * @brief Read one entry of a recovery directory
+ *
+ * Recurse into the subdirectory, and once it is the last segment of a
+ * clientid string add the client to the reclaim list.
+ *
+ * @param[in] parent_path Directory holding the entry
+ * @param[in] clid_str    Clientid string built so far, or NULL
+ * @param[in] tgtdir      Directory to copy the entry to, or NULL
+ * @param[in] takeover    Whether this is a takeover
+ * @param[in] name        Name of the entry
+ */
+static void fs_read_recov_clid_entry(const char *parent_path,
+				     char *clid_str,
+				     char *tgtdir,
+				     int takeover,
+				     const char *name,
+				     add_clid_entry_hook add_clid_entry,
+				     add_rfh_entry_hook add_rfh_entry)
+{
+	clid_entry_t *new_ent;
+	char *sub_path = NULL;
+	char *new_path = NULL;
+	char *build_clid = NULL;
+	int rc = 0;
+	char *ptr, *ptr2;
+	char temp[10];
+	int cid_len, len;
+	int segment_len;
+	int total_len;
+	int total_tgt_len;
+	int total_clid_len;
+
+	/* construct the path by appending the subdir for the
+	 * next readdir. This recursion keeps reading the
+	 * subdirectory until reaching the end.
+	 */
+	segment_len = strlen(name);
+	total_len = segment_len + 2 + strlen(parent_path);
+	sub_path = gsh_malloc(total_len);
+
+	memset(sub_path, 0, total_len);
+
+	strcpy(sub_path, parent_path);
+	strcat(sub_path, "/");
+	strncat(sub_path, name, segment_len);
+	/* if tgtdir is not NULL, we need to build
+	 * nfs4old/currentnode
+	 */
+	if (tgtdir) {
+		total_tgt_len = segment_len + 2 +
+				strlen(tgtdir);
+		new_path = gsh_malloc(total_tgt_len);
+
+		memset(new_path, 0, total_tgt_len);
+		strcpy(new_path, tgtdir);
+		strcat(new_path, "/");
+		strncat(new_path, name, segment_len);
+		rc = mkdir(new_path, 0700);
+		if ((rc == -1) && (errno != EEXIST)) {
+			LogEvent(COMPONENT_CLIENTID,
+				 "mkdir %s faied errno=%d",
+				 new_path, errno);
+		}
+	}
+	/* keep building the clientid str by cursively */
+	/* reading the directory structure */
+	if (clid_str)
+		total_clid_len = segment_len + 1 +
+				 strlen(clid_str);
+	else
+		total_clid_len = segment_len + 1;
+	build_clid = gsh_malloc(total_clid_len);
+
+	memset(build_clid, 0, total_clid_len);
+	if (clid_str)
+		strcpy(build_clid, clid_str);
+	strncat(build_clid, name, segment_len);
+
+	rc = fs_read_recov_clids_impl(sub_path,
+				      build_clid,
+				      new_path,
+				      takeover,
+				      add_clid_entry,
+				      add_rfh_entry);
+
+	if (new_path)
+		gsh_free(new_path);
+
+	/* after recursion, if the subdir has no non-hidden
+	 * directory this is the end of this clientid str. Add
+	 * the clientstr to the list.
+	 */
+	if (rc == 0) {
+		/* the clid format is
+		 * <IP>-(clid-len:long-form-clid-in-string-form)
+		 * make sure this reconstructed string is valid
+		 * by comparing clid-len and the actual
+		 * long-form-clid length in the string. This is
+		 * to prevent getting incompleted strings that
+		 * might exist due to program crash.
+		 */
+		if (strlen(build_clid) >= PATH_MAX) {
+			LogEvent(COMPONENT_CLIENTID,
+				"invalid clid format: %s, too long",
+				build_clid);
+			goto out;
+		}
+		ptr = strchr(build_clid, '(');
+		if (ptr == NULL) {
+			LogEvent(COMPONENT_CLIENTID,
+				 "invalid clid format: %s",
+				 build_clid);
+			goto out;
+		}
+		ptr2 = strchr(ptr, ':');
+		if (ptr2 == NULL) {
+			LogEvent(COMPONENT_CLIENTID,
+				 "invalid clid format: %s",
+				 build_clid);
+			goto out;
+		}
+		len = ptr2-ptr-1;
+		if (len >= 9) {
+			LogEvent(COMPONENT_CLIENTID,
+				 "invalid clid format: %s",
+				 build_clid);
+			goto out;
+		}
+		strncpy(temp, ptr+1, len);
+		temp[len] = 0;
+		cid_len = atoi(temp);
+		len = strlen(ptr2);
+		if ((len == (cid_len+2)) && (ptr2[len-1] == ')')) {
+			PTHREAD_MUTEX_lock(&fs_load_mutex);
+			new_ent = add_clid_entry(build_clid);
+			PTHREAD_MUTEX_unlock(&fs_load_mutex);
+			fs_cp_pop_revoked_delegs(new_ent,
+						 sub_path,
+						 tgtdir,
+						 !takeover,
+						 add_rfh_entry);
+			LogDebug(COMPONENT_CLIENTID,
+				 "added %s to clid list",
+				 new_ent->cl_name);
+		}
+	}
+	/* If this is not for takeover, remove the directory
+	 * hierarchy  that represent the current clientid
+	 */
+	if (!takeover) {
+		rc = rmdir(sub_path);
+		if (rc == -1) {
+			LogEvent(COMPONENT_CLIENTID,
+				 "Failed to rmdir (%s), errno=%d",
+				 sub_path, errno);
+		}
+	}
+
+out:
+
+	gsh_free(build_clid);
+	gsh_free(sub_path);
+}
+
 /**
  * @brief Create the client reclaim list
  *
@@ -423,19 +604,7 @@ static int fs_read_recov_clids_impl(const char *parent_path,
 {
 	struct dirent *dentp;
 	DIR *dp;
-	clid_entry_t *new_ent;
-	char *sub_path = NULL;
-	char *new_path = NULL;
-	char *build_clid = NULL;
-	int rc = 0;
 	int num = 0;
-	char *ptr, *ptr2;
-	char temp[10];
-	int cid_len, len;
-	int segment_len;
-	int total_len;
-	int total_tgt_len;
-	int total_clid_len;
 
 	dp = opendir(parent_path);
 	if (dp == NULL) {
@@ -457,154 +626,125 @@ static int fs_read_recov_clids_impl(const char *parent_path,
 			continue;
 
 		num++;
-		new_path = NULL;
 
-		/* construct the path by appending the subdir for the
-		 * next readdir. This recursion keeps reading the
-		 * subdirectory until reaching the end.
-		 */
-		segment_len = strlen(dentp->d_name);
-		total_len = segment_len + 2 + strlen(parent_path);
-		sub_path = gsh_malloc(total_len);
+		fs_read_recov_clid_entry(parent_path, clid_str, tgtdir,
+					 takeover, dentp->d_name,
+					 add_clid_entry, add_rfh_entry);
+	}
 
-		memset(sub_path, 0, total_len);
+	(void)closedir(dp);
 
-		strcpy(sub_path, parent_path);
-		strcat(sub_path, "/");
-		strncat(sub_path, dentp->d_name, segment_len);
-		/* if tgtdir is not NULL, we need to build
-		 * nfs4old/currentnode
-		 */
-		if (tgtdir) {
-			total_tgt_len = segment_len + 2 +
-					strlen(tgtdir);
-			new_path = gsh_malloc(total_tgt_len);
-
-			memset(new_path, 0, total_tgt_len);
-			strcpy(new_path, tgtdir);
-			strcat(new_path, "/");
-			strncat(new_path, dentp->d_name, segment_len);
-			rc = mkdir(new_path, 0700);
-			if ((rc == -1) && (errno != EEXIST)) {
-				LogEvent(COMPONENT_CLIENTID,
-					 "mkdir %s faied errno=%d",
-					 new_path, errno);
-			}
-		}
-		/* keep building the clientid str by cursively */
-		/* reading the directory structure */
-		if (clid_str)
-			total_clid_len = segment_len + 1 +
-					 strlen(clid_str);
-		else
-			total_clid_len = segment_len + 1;
-		build_clid = gsh_malloc(total_clid_len);
-
-		memset(build_clid, 0, total_clid_len);
-		if (clid_str)
-			strcpy(build_clid, clid_str);
-		strncat(build_clid, dentp->d_name, segment_len);
-
-		if (tgtdir)
-			rc = fs_read_recov_clids_impl(sub_path,
-						      build_clid,
-						      new_path,
-						      takeover,
-						      add_clid_entry,
-						      add_rfh_entry);
-		else
-			rc = fs_read_recov_clids_impl(sub_path,
-						      build_clid,
-						      NULL,
-						      takeover,
-						      add_clid_entry,
-						      add_rfh_entry);
-
-		if (new_path)
-			gsh_free(new_path);
-
-		/* after recursion, if the subdir has no non-hidden
-		 * directory this is the end of this clientid str. Add
-		 * the clientstr to the list.
-		 */
-		if (rc == 0) {
-			/* the clid format is
-			 * <IP>-(clid-len:long-form-clid-in-string-form)
-			 * make sure this reconstructed string is valid
-			 * by comparing clid-len and the actual
-			 * long-form-clid length in the string. This is
-			 * to prevent getting incompleted strings that
-			 * might exist due to program crash.
-			 */
-			if (strlen(build_clid) >= PATH_MAX) {
-				LogEvent(COMPONENT_CLIENTID,
-					"invalid clid format: %s, too long",
-					build_clid);
-				gsh_free(sub_path);
-				gsh_free(build_clid);
-				continue;
-			}
-			ptr = strchr(build_clid, '(');
-			if (ptr == NULL) {
-				LogEvent(COMPONENT_CLIENTID,
-					 "invalid clid format: %s",
-					 build_clid);
-				gsh_free(sub_path);
-				gsh_free(build_clid);
-				continue;
-			}
-			ptr2 = strchr(ptr, ':');
-			if (ptr2 == NULL) {
-				LogEvent(COMPONENT_CLIENTID,
-					 "invalid clid format: %s",
-					 build_clid);
-				gsh_free(sub_path);
-				gsh_free(build_clid);
-				continue;
-			}
-			len = ptr2-ptr-1;
-			if (len >= 9) {
-				LogEvent(COMPONENT_CLIENTID,
-					 "invalid clid format: %s",
-					 build_clid);
-				gsh_free(sub_path);
-				gsh_free(build_clid);
-				continue;
-			}
-			strncpy(temp, ptr+1, len);
-			temp[len] = 0;
-			cid_len = atoi(temp);
-			len = strlen(ptr2);
-			if ((len == (cid_len+2)) && (ptr2[len-1] == ')')) {
-				new_ent = add_clid_entry(build_clid);
-				fs_cp_pop_revoked_delegs(new_ent,
-							 sub_path,
-							 tgtdir,
-							 !takeover,
-							 add_rfh_entry);
-				LogDebug(COMPONENT_CLIENTID,
-					 "added %s to clid list",
-					 new_ent->cl_name);
-			}
-		}
-		gsh_free(build_clid);
-		/* If this is not for takeover, remove the directory
-		 * hierarchy  that represent the current clientid
-		 */
-		if (!takeover) {
-			rc = rmdir(sub_path);
-			if (rc == -1) {
-				LogEvent(COMPONENT_CLIENTID,
-					 "Failed to rmdir (%s), errno=%d",
-					 sub_path, errno);
-			}
+	return num;
+}
+
+/**
+ * @brief Top level of a recovery directory, shared by loader threads
+ */
+struct fs_recov_load {
+	const char *parent_path;
+	char *tgtdir;
+	int takeover;
+	add_clid_entry_hook add_clid_entry;
+	add_rfh_entry_hook add_rfh_entry;
+	char **names;		/*< Entries of the top level */
+	int32_t count;		/*< Number of entries */
+	int32_t next;		/*< Next entry to take, atomic */
+};
+
+static void *fs_recov_load_thread(void *arg)
+{
+	struct fs_recov_load *load = arg;
+	int32_t i;
+
+	SetNameFunction("recov_load");
+
+	while ((i = atomic_postinc_int32_t(&load->next)) < load->count)
+		fs_read_recov_clid_entry(load->parent_path, NULL,
+					 load->tgtdir, load->takeover,
+					 load->names[i],
+					 load->add_clid_entry,
+					 load->add_rfh_entry);
+
+	return NULL;
+}
+
+/**
+ * @brief Read a whole recovery directory with several threads
+ *
+ * Each client normally has a directory tree of its own at the top
+ * level, so the top level entries are handed out to loader threads and
+ * the tree under each is walked as before.  The syscalls of a walk are
+ * what costs, the list hooks are serialized.
+ *
+ * @return The number of top level entries, or -1 if the directory can
+ *         not be read.
+ */
+static int fs_read_recov_clids_parallel(const char *parent_path,
+					char *tgtdir,
+					int takeover,
+					add_clid_entry_hook add_clid_entry,
+					add_rfh_entry_hook add_rfh_entry)
+{
+	struct fs_recov_load load = {
+		.parent_path = parent_path,
+		.tgtdir = tgtdir,
+		.takeover = takeover,
+		.add_clid_entry = add_clid_entry,
+		.add_rfh_entry = add_rfh_entry,
+	};
+	pthread_t threads[FS_RECOV_LOAD_THREADS];
+	struct dirent *dentp;
+	int32_t size = 0;
+	int started = 0;
+	int i;
+	DIR *dp;
+
+	dp = opendir(parent_path);
+	if (dp == NULL) {
+		LogEvent(COMPONENT_CLIENTID,
+			 "Failed to open v4 recovery dir (%s), errno=%d",
+			 parent_path, errno);
+		return -1;
+	}
+
+	for (dentp = readdir(dp); dentp != NULL; dentp = readdir(dp)) {
+		if (!strcmp(dentp->d_name, ".") || !strcmp(dentp->d_name, "..")
+		    || dentp->d_name[0] == '\x1')
+			continue;
+
+		if (load.count == size) {
+			size = size ? size * 2 : 64;
+			load.names = gsh_realloc(load.names,
+						 size * sizeof(char *));
 		}
-		gsh_free(sub_path);
+
+		load.names[load.count++] = gsh_strdup(dentp->d_name);
 	}
 
 	(void)closedir(dp);
 
-	return num;
+	for (i = 0; i < FS_RECOV_LOAD_THREADS && i < load.count - 1; i++) {
+		if (pthread_create(&threads[i], NULL, fs_recov_load_thread,
+				   &load) != 0)
+			break;
+		started++;
+	}
+
+	/* Take a share ourselves, which is all of it if no thread started */
+	(void) fs_recov_load_thread(&load);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	LogDebug(COMPONENT_CLIENTID,
+		 "Read %"PRIi32" entries of %s with %d threads",
+		 load.count, parent_path, started + 1);
+
+	for (i = 0; i < load.count; i++)
+		gsh_free(load.names[i]);
+	gsh_free(load.names);
+
+	return load.count;
 }
 
 void fs_read_recov_clids_recover(add_clid_entry_hook add_clid_entry,
@@ -612,9 +752,9 @@ void fs_read_recov_clids_recover(add_clid_entry_hook add_clid_entry,
 {
 	int rc;
 
-	rc = fs_read_recov_clids_impl(v4_old_dir, NULL, NULL, 0,
-				      add_clid_entry,
-				      add_rfh_entry);
+	rc = fs_read_recov_clids_parallel(v4_old_dir, NULL, 0,
+					  add_clid_entry,
+					  add_rfh_entry);
 	if (rc == -1) {
 		LogEvent(COMPONENT_CLIENTID,
 			 "Failed to read v4 recovery dir (%s)",
@@ -622,9 +762,9 @@ void fs_read_recov_clids_recover(add_clid_entry_hook add_clid_entry,
 		return;
 	}
 
-	rc = fs_read_recov_clids_impl(v4_recov_dir, NULL, v4_old_dir, 0,
-				      add_clid_entry,
-				      add_rfh_entry);
+	rc = fs_read_recov_clids_parallel(v4_recov_dir, v4_old_dir, 0,
+					  add_clid_entry,
+					  add_rfh_entry);
 	if (rc == -1) {
 		LogEvent(COMPONENT_CLIENTID,
 			 "Failed to read v4 recovery dir (%s)",
@@ -667,9 +807,9 @@ void fs_read_recov_clids_takeover(nfs_grace_start_t *gsp,
 	LogEvent(COMPONENT_CLIENTID, "Recovery for nodeid %d dir (%s)",
 		 gsp->nodeid, path);
 
-	rc = fs_read_recov_clids_impl(path, NULL, v4_old_dir, 1,
-				      add_clid_entry,
-				      add_rfh_entry);
+	rc = fs_read_recov_clids_parallel(path, v4_old_dir, 1,
+					  add_clid_entry,
+					  add_rfh_entry);
 	if (rc == -1) {
 		LogEvent(COMPONENT_CLIENTID,
 			 "Failed to read v4 recovery dir (%s)", path);
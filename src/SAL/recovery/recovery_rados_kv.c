@@ -11,6 +11,7 @@
 #include "client_mgr.h"
 #include "fsal.h"
 #include "netdb.h"
+#include "common_utils.h"
 #include <rados/librados.h>
 
 #define KEY_MAX_LEN		NAME_MAX
@@ -33,6 +34,9 @@ static struct rados_kv_parameter {
 	char *userid;
 	/** Pool for client info */
 	char *pool;
+	/** Milliseconds client record updates wait for others to join
+	    their batch */
+	uint32_t batch_delay;
 } rados_kv_param;
 
 static struct config_item rados_kv_params[] = {
@@ -42,6 +46,8 @@ static struct config_item rados_kv_params[] = {
 		       rados_kv_parameter, userid),
 	CONF_ITEM_STR("pool", 1, MAXPATHLEN, NULL,
 		       rados_kv_parameter, pool),
+	CONF_ITEM_UI32("batch_delay", 0, 1000, 2,
+		       rados_kv_parameter, batch_delay),
 	CONFIG_EOL
 };
 
@@ -229,6 +235,201 @@ static int rados_kv_del(char *key, char *object)
 	return ret;
 }
 
+/**
+ * @brief One queued update of the recovery object
+ *
+ * Client records change in bursts, thousands of clients come back at
+ * once after a failover.  Rather than paying a RADOS round trip per
+ * client, updates are queued and a flusher thread commits everything
+ * that arrived within batch_delay in a single write op, so concurrent
+ * callers share one round trip.  Ops are applied in queue order, so an
+ * add followed by a remove of the same key ends with the key removed.
+ *
+ * Callers that need the update on stable storage before they answer
+ * the client wait for their batch.  Those that do not leave the op to
+ * the flusher to free.
+ */
+struct rados_kv_op {
+	struct glist_head rko_list;	/*< Queue or batch linkage */
+	char rko_key[KEY_MAX_LEN];	/*< OMAP key */
+	char *rko_val;			/*< Value, NULL to remove the key */
+	bool rko_wait;			/*< Caller waits and frees the op */
+	bool rko_done;			/*< Batch has been committed */
+	int rko_ret;			/*< Result of the batch */
+};
+
+static pthread_mutex_t rados_kv_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rados_kv_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t rados_kv_done_cond = PTHREAD_COND_INITIALIZER;
+static struct glist_head rados_kv_queue = GLIST_HEAD_INIT(rados_kv_queue);
+static uint32_t rados_kv_queued;
+static pthread_t rados_kv_flusher_id;
+static bool rados_kv_flusher_running;
+
+/**
+ * @brief Commit a batch of ops in one write op
+ *
+ * @param[in] batch Ops to commit, in order
+ *
+ * @return Result of rados_write_op_operate.
+ */
+static int rados_kv_commit(struct glist_head *batch)
+{
+	struct glist_head *glist;
+	struct rados_kv_op *op;
+	rados_write_op_t write_op;
+	const char *key;
+	const char *val;
+	size_t len;
+	int ret;
+
+	write_op = rados_create_write_op();
+
+	glist_for_each(glist, batch) {
+		op = glist_entry(glist, struct rados_kv_op, rko_list);
+		key = op->rko_key;
+
+		if (op->rko_val != NULL) {
+			val = op->rko_val;
+			len = strlen(val);
+			rados_write_op_omap_set(write_op, &key, &val, &len, 1);
+		} else {
+			rados_write_op_omap_rm_keys(write_op, &key, 1);
+		}
+	}
+
+	ret = rados_write_op_operate(write_op, io_ctx, myobject_recov, NULL, 0);
+	rados_release_write_op(write_op);
+
+	return ret;
+}
+
+/**
+ * @brief Commit queued ops in batches
+ *
+ * Waits batch_delay after the first op of a batch arrives, or until
+ * MAX_ITEMS ops are queued, then commits them together.  Ops queued while
+ * a commit is in flight form the next batch.
+ */
+static void *rados_kv_flusher(void *arg)
+{
+	struct glist_head batch = GLIST_HEAD_INIT(batch);
+	struct glist_head *glist, *glistn;
+	struct rados_kv_op *op;
+	struct timespec deadline;
+	uint32_t count;
+	int rc, ret;
+
+	SetNameFunction("rados_kv");
+
+	PTHREAD_MUTEX_lock(&rados_kv_queue_mutex);
+
+	while (true) {
+		while (glist_empty(&rados_kv_queue))
+			pthread_cond_wait(&rados_kv_queue_cond,
+					  &rados_kv_queue_mutex);
+
+		/* Give concurrent callers a moment to join the batch */
+		now(&deadline);
+		timespec_add_nsecs(rados_kv_param.batch_delay * NS_PER_MSEC,
+				   &deadline);
+		rc = 0;
+
+		while (rados_kv_queued < MAX_ITEMS && rc != ETIMEDOUT)
+			rc = pthread_cond_timedwait(&rados_kv_queue_cond,
+						    &rados_kv_queue_mutex,
+						    &deadline);
+
+		for (count = 0;
+		     count < MAX_ITEMS && !glist_empty(&rados_kv_queue);
+		     count++) {
+			op = glist_first_entry(&rados_kv_queue,
+					       struct rados_kv_op, rko_list);
+			glist_del(&op->rko_list);
+			glist_add_tail(&batch, &op->rko_list);
+		}
+
+		rados_kv_queued -= count;
+
+		PTHREAD_MUTEX_unlock(&rados_kv_queue_mutex);
+
+		ret = rados_kv_commit(&batch);
+
+		if (ret < 0)
+			LogEvent(COMPONENT_CLIENTID,
+				 "Failed to commit %"PRIu32" client records ret=%d",
+				 count, ret);
+		else
+			LogFullDebug(COMPONENT_CLIENTID,
+				     "Committed %"PRIu32" client records",
+				     count);
+
+		PTHREAD_MUTEX_lock(&rados_kv_queue_mutex);
+
+		glist_for_each_safe(glist, glistn, &batch) {
+			op = glist_entry(glist, struct rados_kv_op, rko_list);
+			glist_del(&op->rko_list);
+
+			if (op->rko_wait) {
+				op->rko_ret = ret;
+				op->rko_done = true;
+			} else {
+				gsh_free(op);
+			}
+		}
+
+		pthread_cond_broadcast(&rados_kv_done_cond);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Queue an update of the recovery object
+ *
+ * @param[in] op The update, on the caller's stack if rko_wait is set,
+ *               otherwise allocated and given to the flusher.
+ *
+ * @return Result of the commit if the caller waits, otherwise 0.
+ */
+static int rados_kv_queue_op(struct rados_kv_op *op)
+{
+	struct glist_head batch = GLIST_HEAD_INIT(batch);
+	int ret = 0;
+
+	op->rko_done = false;
+
+	if (!rados_kv_flusher_running) {
+		/* Init failed part way, commit straight away */
+		glist_add_tail(&batch, &op->rko_list);
+		ret = rados_kv_commit(&batch);
+		glist_del(&op->rko_list);
+
+		if (!op->rko_wait)
+			gsh_free(op);
+
+		return ret;
+	}
+
+	PTHREAD_MUTEX_lock(&rados_kv_queue_mutex);
+
+	glist_add_tail(&rados_kv_queue, &op->rko_list);
+
+	if (++rados_kv_queued == 1 || rados_kv_queued == MAX_ITEMS)
+		pthread_cond_signal(&rados_kv_queue_cond);
+
+	if (op->rko_wait) {
+		while (!op->rko_done)
+			pthread_cond_wait(&rados_kv_done_cond,
+					  &rados_kv_queue_mutex);
+		ret = op->rko_ret;
+	}
+
+	PTHREAD_MUTEX_unlock(&rados_kv_queue_mutex);
+
+	return ret;
+}
+
 typedef void (*pop_clid_entry_t)(char *, char*, add_clid_entry_hook,
 				 add_rfh_entry_hook, bool, bool);
 typedef struct pop_args {
@@ -387,21 +588,38 @@ void rados_kv_init(void)
 	}
 	rados_release_write_op(op);
 
+	ret = pthread_create(&rados_kv_flusher_id, NULL, rados_kv_flusher,
+			     NULL);
+	if (ret != 0) {
+		LogFatal(COMPONENT_CLIENTID,
+			 "Could not create rados_kv flusher, error = %d (%s)",
+			 ret, strerror(ret));
+	}
+	pthread_detach(rados_kv_flusher_id);
+	rados_kv_flusher_running = true;
+
 	LogEvent(COMPONENT_CLIENTID, "Rados kv store init done");
 }
 
+/**
+ * @brief Record a confirmed client
+ *
+ * The record must be stable before the client acquires any state it
+ * could want to reclaim, so this waits for its batch to commit.
+ */
 void rados_kv_add_clid(nfs_client_id_t *clientid)
 {
-	char ckey[KEY_MAX_LEN];
+	struct rados_kv_op op = { .rko_wait = true };
 	char *cval;
 	int ret;
 
 	cval = gsh_malloc(VAL_MAX_LEN);
 
-	create_key(clientid, ckey);
+	create_key(clientid, op.rko_key);
 	create_val(clientid, cval);
+	op.rko_val = cval;
 
-	ret = rados_kv_put(ckey, cval, myobject_recov);
+	ret = rados_kv_queue_op(&op);
 	if (ret < 0) {
 		LogEvent(COMPONENT_CLIENTID, "Failed to add clid %lu",
 			 clientid->cid_clientid);
@@ -414,21 +632,22 @@ out:
 	gsh_free(cval);
 }
 
+/**
+ * @brief Forget a client
+ *
+ * A record that outlives its client only lets that client reclaim after
+ * a restart that lands within batch_delay, so nobody waits for the
+ * removal to commit.
+ */
 void rados_kv_rm_clid(nfs_client_id_t *clientid)
 {
-	char ckey[KEY_MAX_LEN];
-	int ret;
+	struct rados_kv_op *op = gsh_calloc(1, sizeof(*op));
 
-	create_key(clientid, ckey);
+	create_key(clientid, op->rko_key);
 
-	ret = rados_kv_del(ckey, myobject_recov);
-	if (ret < 0) {
-		LogEvent(COMPONENT_CLIENTID, "Failed to del clid %lu",
-			 clientid->cid_clientid);
-		return;
-	}
+	(void) rados_kv_queue_op(op);
 
-	free(clientid->cid_recov_tag);
+	gsh_free(clientid->cid_recov_tag);
 	clientid->cid_recov_tag = NULL;
 }
 
@@ -546,6 +765,7 @@ void rados_kv_add_revoke_fh(nfs_client_id_t *delr_clid, nfs_fh4 *delr_handle)
 	char *cval;
 	char *val_out;
 	size_t val_out_len;
+	struct rados_kv_op op = { .rko_wait = true };
 
 	cval = gsh_malloc(VAL_MAX_LEN);
 
@@ -560,7 +780,11 @@ void rados_kv_add_revoke_fh(nfs_client_id_t *delr_clid, nfs_fh4 *delr_handle)
 	append_val_rdfh(cval, delr_handle->nfs_fh4_val,
 			      delr_handle->nfs_fh4_len);
 
-	ret = rados_kv_put(ckey, cval, myobject_recov);
+	/* The revoke must be on stable storage before we go on */
+	memcpy(op.rko_key, ckey, sizeof(ckey));
+	op.rko_val = cval;
+
+	ret = rados_kv_queue_op(&op);
 	if (ret < 0) {
 		LogEvent(COMPONENT_CLIENTID,
 			 "Failed to add rdfh for clid %lu",
@@ -53,6 +53,21 @@
 #include "fsal_up.h"
 #include "nfs_file_handle.h"
 
+/* Most clients retry NFS operations after 5 seconds. The following
+ * should be good enough to avoid starving a client's open
+ */
+#define RECALL2DELEG_TIME 10
+
+/* Opens and grants after which the per-file history is halved */
+#define DELEG_HISTORY_OPENS 256
+#define DELEG_HISTORY_GRANTS 64
+
+/* Grants needed before the recall rate of a file is trusted */
+#define DELEG_MIN_HISTORY 4
+
+/* Seconds after the last recall that the recall history still counts */
+#define DELEG_RECALL_MEMORY 600
+
 /**
  * @brief Check if exiting OPENs would conflict granting a delegation.
  *
@@ -128,6 +143,7 @@ void init_new_deleg_state(union state_data *deleg_state,
 	deleg_state->deleg.sd_type = deleg_type;
 	deleg_state->deleg.sd_grant_time = time(NULL);
 	deleg_state->deleg.sd_state = DELEG_GRANTED;
+	deleg_state->deleg.sd_notify = 0;
 
 	clfile_entry->cfd_rs_time = 0;
 	clfile_entry->cfd_r_time = 0;
@@ -139,7 +155,11 @@ void init_new_deleg_state(union state_data *deleg_state,
  * We do state management and call down to the FSAL as appropriate, so
  * that the caller has a single entry point.
  *
+ * FSALs that support extended operations get the delegation state as
+ * well, so they can tie the lease to a file descriptor of their own.
+ *
  * @param[in]  obj      File on which to operate
+ * @param[in]  state    Delegation state
  * @param[in]  lock_op  Operation to perform
  * @param[in]  owner    Lock operation
  * @param[in]  lock     Lock description
@@ -147,6 +167,7 @@ void init_new_deleg_state(union state_data *deleg_state,
  * @return State status.
  */
 state_status_t do_lease_op(struct fsal_obj_handle *obj,
+			  state_t *state,
 			  fsal_lock_op_t lock_op,
 			  state_owner_t *owner,
 			  fsal_lock_param_t *lock)
@@ -160,12 +181,23 @@ state_status_t do_lease_op(struct fsal_obj_handle *obj,
 			: "FSAL_OP_UNLOCK",
 		obj, owner, lock);
 
-	fsal_status = obj->obj_ops.lock_op(
+	if (!obj->fsal->m_ops.support_ex(obj)) {
+		/* Call legacy lock_op */
+		fsal_status = obj->obj_ops.lock_op(
 				obj,
 				convert_lock_owner(op_ctx->fsal_export, owner),
 				lock_op,
 				lock,
 				NULL);
+	} else {
+		fsal_status = obj->obj_ops.lock_op2(
+				obj,
+				state,
+				owner,
+				lock_op,
+				lock,
+				NULL);
+	}
 
 	status = state_error_convert(fsal_status);
 
@@ -202,7 +234,8 @@ state_status_t acquire_lease_lock(struct state_hdl *ostate,
 		lock_desc.lock_type = FSAL_LOCK_R;
 
 	/* Create a new deleg data object */
-	status = do_lease_op(ostate->file.obj, FSAL_OP_LOCK, owner, &lock_desc);
+	status = do_lease_op(ostate->file.obj, state, FSAL_OP_LOCK, owner,
+			     &lock_desc);
 
 	if (status == STATE_SUCCESS) {
 		update_delegation_stats(ostate, owner, state);
@@ -241,7 +274,7 @@ state_status_t release_lease_lock(struct fsal_obj_handle *obj, state_t *state)
 	LogLock(COMPONENT_NFS_V4_LOCK, NIV_FULL_DEBUG, "DELEGRETURN",
 		obj, owner, &lock_desc);
 
-	status = do_lease_op(obj, FSAL_OP_UNLOCK, owner, &lock_desc);
+	status = do_lease_op(obj, state, FSAL_OP_UNLOCK, owner, &lock_desc);
 
 	if (status != STATE_SUCCESS)
 		LogMajor(COMPONENT_STATE, "Unable to unlock FSAL, error=%s",
@@ -274,6 +307,14 @@ void update_delegation_stats(struct state_hdl *ostate,
 	statistics->fds_delegation_count++;
 	statistics->fds_last_delegation = time(NULL);
 
+	/* Age the recall history so it reflects recent use of the file */
+	if (statistics->fds_delegation_count >= DELEG_HISTORY_GRANTS) {
+		statistics->fds_delegation_count /= 2;
+		statistics->fds_recall_count /= 2;
+		statistics->fds_recalls_sent /= 2;
+		statistics->fds_revoke_count /= 2;
+	}
+
 	/* Update delegation stats for client. */
 	inc_grants(client->gsh_client);
 	client->curr_deleg_grants++;
@@ -299,18 +340,21 @@ void deleg_heuristics_recall(struct fsal_obj_handle *obj,
 			     struct state_t *deleg)
 {
 	nfs_client_id_t *client = owner->so_owner.so_nfs4_owner.so_clientrec;
-	/* Update delegation stats for file. */
-	struct file_deleg_stats *statistics =
-		&obj->state_hdl->file.fdeleg_stats;
-
-	statistics->fds_curr_delegations--;
-	statistics->fds_recall_count++;
+	struct file_deleg_stats *statistics;
 
 	/* Update delegation stats for client. */
 	dec_grants(client->gsh_client);
 	client->curr_deleg_grants--;
 
+	/* Directory delegations keep no per file stats */
+	if (obj->type != REGULAR_FILE)
+		return;
+
 	/* Update delegation stats for file. */
+	statistics = &obj->state_hdl->file.fdeleg_stats;
+	statistics->fds_curr_delegations--;
+	statistics->fds_recall_count++;
+
 	statistics->fds_avg_hold = advance_avg(statistics->fds_avg_hold,
 					   time(NULL)
 					   - statistics->fds_last_delegation,
@@ -346,14 +390,103 @@ bool init_deleg_heuristics(struct fsal_obj_handle *obj)
 	statistics->fds_avg_hold = 0;
 	statistics->fds_num_opens = 0;
 	statistics->fds_first_open = 0;
+	statistics->fds_write_opens = 0;
+	statistics->fds_recalls_sent = 0;
+	statistics->fds_revoke_count = 0;
+	statistics->fds_last_opener = 0;
+	statistics->fds_last_open = 0;
+	statistics->fds_last_writer = 0;
+	statistics->fds_last_write = 0;
+	statistics->fds_last_contention = 0;
 
 	return true;
 }
 
-/* Most clients retry NFS operations after 5 seconds. The following
- * should be good enough to avoid starving a client's open
+/**
+ * @brief Record an open of a file for the delegation heuristics
+ *
+ * An open for write right after another client opened the file, or an
+ * open right after another client opened it for write, marks the file
+ * contended.  Opens by any number of readers, or by a single client
+ * however it opens the file, do not.
+ *
+ * @note The state_lock MUST be held for write
+ *
+ * @param[in] ostate       File state being opened
+ * @param[in] client       Client opening the file
+ * @param[in] share_access Share access of the open
  */
-#define RECALL2DELEG_TIME 10
+void deleg_heuristics_open(struct state_hdl *ostate, nfs_client_id_t *client,
+			   uint32_t share_access)
+{
+	struct file_deleg_stats *statistics = &ostate->file.fdeleg_stats;
+	time_t now = time(NULL);
+	time_t window = nfs_param.nfsv4_param.lease_lifetime;
+	bool write = (share_access & OPEN4_SHARE_ACCESS_WRITE) != 0;
+
+	if (statistics->fds_num_opens == 0)
+		statistics->fds_first_open = now;
+
+	statistics->fds_num_opens++;
+	if (write)
+		statistics->fds_write_opens++;
+
+	if (statistics->fds_num_opens >= DELEG_HISTORY_OPENS) {
+		statistics->fds_num_opens /= 2;
+		statistics->fds_write_opens /= 2;
+	}
+
+	if ((write && statistics->fds_last_opener != client->cid_clientid &&
+	     now - statistics->fds_last_open < window) ||
+	    (statistics->fds_last_writer != client->cid_clientid &&
+	     now - statistics->fds_last_write < window))
+		statistics->fds_last_contention = now;
+
+	statistics->fds_last_opener = client->cid_clientid;
+	statistics->fds_last_open = now;
+
+	if (write) {
+		statistics->fds_last_writer = client->cid_clientid;
+		statistics->fds_last_write = now;
+	}
+}
+
+/**
+ * @brief Check if the history of a file argues against a delegation
+ *
+ * @param[in] file_stats Delegation statistics of the file
+ * @param[in] now        Current time
+ *
+ * @retval true if a delegation on the file would likely be recalled.
+ */
+static bool deleg_file_contended(struct file_deleg_stats *file_stats,
+				 time_t now)
+{
+	/* Another client has been using the file in a conflicting way
+	 * within the last lease period.
+	 */
+	if (file_stats->fds_last_contention != 0 &&
+	    now - file_stats->fds_last_contention <
+					nfs_param.nfsv4_param.lease_lifetime)
+		return true;
+
+	/* Recall history only counts while recalls are recent. */
+	if (file_stats->fds_last_recall == 0 ||
+	    now - file_stats->fds_last_recall > DELEG_RECALL_MEMORY)
+		return false;
+
+	/* Most delegations on the file have ended up recalled. */
+	if (file_stats->fds_delegation_count >= DELEG_MIN_HISTORY &&
+	    file_stats->fds_recalls_sent * 2 > file_stats->fds_delegation_count)
+		return true;
+
+	/* Recalls on the file often fail and end in a revoke. */
+	if (file_stats->fds_recalls_sent >= 2 &&
+	    file_stats->fds_revoke_count * 2 >= file_stats->fds_recalls_sent)
+		return true;
+
+	return false;
+}
 
 /**
  * @brief Decide if a delegation should be granted based on heuristics.
@@ -418,6 +551,14 @@ bool should_we_grant_deleg(struct state_hdl *ostate, nfs_client_id_t *client,
 		}
 	}
 
+	/* Nothing on an immutable export can conflict with a read
+	 * delegation, so none of the recall heuristics below apply.
+	 */
+	if (op_ctx_export_has_option(EXPORT_OPTION_IMMUTABLE)) {
+		LogDebug(COMPONENT_STATE, "Immutable export, delegating");
+		return true;
+	}
+
 	/* If there is a recent recall on this file, the client that made
 	 * the conflicting open may retry the open later. Don't give out
 	 * delegation to avoid starving the client's open that caused
@@ -427,6 +568,14 @@ bool should_we_grant_deleg(struct state_hdl *ostate, nfs_client_id_t *client,
 	    time(NULL) - file_stats->fds_last_recall < RECALL2DELEG_TIME)
 		return false;
 
+	/* Don't delegate a file other clients are contending for, the
+	 * delegation would only be recalled.
+	 */
+	if (deleg_file_contended(file_stats, time(NULL))) {
+		LogDebug(COMPONENT_STATE, "File is contended, not delegating");
+		return false;
+	}
+
 	/* Check if this is a misbehaving or unreliable client */
 	if (client->num_revokes > 2) /* more than 2 revokes */
 		return false;
@@ -494,6 +643,9 @@ nfsstat4 deleg_revoke(struct fsal_obj_handle *obj, struct state_t *deleg_state)
 
 	deleg_heuristics_recall(obj, owner, deleg_state);
 
+	if (obj->type == REGULAR_FILE)
+		obj->state_hdl->file.fdeleg_stats.fds_revoke_count++;
+
 	/* Build op_context for state_unlock_locked */
 	init_root_op_context(&root_op_context, NULL, NULL, 0, 0,
 			     UNKNOWN_REQUEST);
@@ -501,8 +653,13 @@ nfsstat4 deleg_revoke(struct fsal_obj_handle *obj, struct state_t *deleg_state)
 	root_op_context.req_ctx.ctx_export = export;
 	root_op_context.req_ctx.fsal_export = export->fsal_export;
 
-	/* release_lease_lock() returns delegation to FSAL */
-	state_status = release_lease_lock(obj, deleg_state);
+	/* release_lease_lock() returns delegation to FSAL, directory
+	 * delegations are held by SAL alone.
+	 */
+	if (obj->type == REGULAR_FILE)
+		state_status = release_lease_lock(obj, deleg_state);
+	else
+		state_status = STATE_SUCCESS;
 
 	release_root_op_context();
 
@@ -590,6 +747,60 @@ bool state_deleg_conflict(struct fsal_obj_handle *obj, bool write)
 	return false;
 }
 
+/**
+ * @brief Tell directory delegation holders about a change to the directory
+ *
+ * Holders that asked for this type of notification get a CB_NOTIFY,
+ * others have their delegation recalled.  The client making the change
+ * already knows about it and is left alone.
+ *
+ * @param[in] dir     Directory that changed
+ * @param[in] type    NOTIFY4_ADD_ENTRY, NOTIFY4_REMOVE_ENTRY or
+ *                    NOTIFY4_RENAME_ENTRY
+ * @param[in] name    Entry added or removed, or the old name on rename
+ * @param[in] newname New name on rename, otherwise NULL
+ */
+void state_dir_notify(struct fsal_obj_handle *dir, notify_type4 type,
+		      const char *name, const char *newname)
+{
+	struct glist_head *glist, *glistn;
+	struct state_hdl *ostate = dir->state_hdl;
+	state_owner_t *owner;
+	state_t *state;
+
+	if (dir->type != DIRECTORY || ostate == NULL)
+		return;
+
+	/* The common case is a directory nobody holds a delegation on */
+	PTHREAD_RWLOCK_rdlock(&ostate->state_lock);
+	if (glist_empty(&ostate->dir.dir_delegations)) {
+		PTHREAD_RWLOCK_unlock(&ostate->state_lock);
+		return;
+	}
+	PTHREAD_RWLOCK_unlock(&ostate->state_lock);
+
+	PTHREAD_RWLOCK_wrlock(&ostate->state_lock);
+
+	glist_for_each_safe(glist, glistn, &ostate->dir.dir_delegations) {
+		state = glist_entry(glist, state_t, state_list);
+		owner = state->state_owner;
+
+		if (owner != NULL && op_ctx->clientid != NULL &&
+		    owner->so_owner.so_nfs4_owner.so_clientid ==
+		    *op_ctx->clientid)
+			continue;
+
+		if (state->state_data.deleg.sd_state == DELEG_GRANTED &&
+		    (state->state_data.deleg.sd_notify & (1U << type)) &&
+		    notify_dir_deleg(dir, state, type, name, newname))
+			continue;
+
+		delegrecall_state(dir, state);
+	}
+
+	PTHREAD_RWLOCK_unlock(&ostate->state_lock);
+}
+
 bool deleg_supported(struct fsal_obj_handle *obj,
 		     struct fsal_export *fsal_export,
 		     struct export_perms *export_perms, uint32_t share_access)
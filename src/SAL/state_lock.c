@@ -49,6 +49,9 @@
 #include "sal_functions.h"
 /*#include "nlm_util.h"*/
 #include "export_mgr.h"
+#ifdef USE_LTTNG
+#include "gsh_lttng/state.h"
+#endif
 
 /**
  * @page state_lock_entry_locking state_lock_entry_t locking rule
@@ -83,12 +86,24 @@ pthread_mutex_t all_locks_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
 /**
- * @brief All locks blocked in FSAL
+ * @brief Blocked locks SAL polls
+ *
+ * Locks the FSAL refused with no conflict known to SAL, on an FSAL that
+ * can't tell us when to retry them.  Blocked locks are otherwise only on
+ * the wait queue of their file, and are retried when a lock on that file
+ * is released or the FSAL makes an upcall for them.
+ */
+static struct glist_head state_polled_locks =
+	GLIST_HEAD_INIT(state_polled_locks);
+
+/**
+ * @brief Files with blocked locks
  */
-struct glist_head state_blocked_locks = GLIST_HEAD_INIT(state_blocked_locks);
+static struct glist_head state_blocked_files =
+	GLIST_HEAD_INIT(state_blocked_files);
 
 /**
- * @brief Mutex to protect lock lists
+ * @brief Mutex to protect blocked lock lists
  */
 pthread_mutex_t blocked_locks_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -130,11 +145,19 @@ static hash_parameter_t cookie_param = {
 	.compare_key = compare_lock_cookie_key,
 	.key_to_str = display_lock_cookie_key,
 	.val_to_str = display_lock_cookie_val,
-	.flags = HT_FLAG_NONE,
+	.flags = HT_FLAG_OPEN,
 };
 
 static hash_table_t *ht_lock_cookies;
 
+static struct gsh_slab lock_entry_slab =
+	GSH_SLAB_INITIALIZER("state_lock_entry_t", state_lock_entry_t, 4096,
+			     GSH_MEM_STATE);
+
+static struct gsh_slab cookie_entry_slab =
+	GSH_SLAB_INITIALIZER("state_cookie_entry_t", state_cookie_entry_t,
+			     1024, GSH_MEM_STATE);
+
 /**
  * @brief Initalize locking
  *
@@ -153,9 +176,6 @@ state_status_t state_lock_init(void)
 
 	status = state_async_init();
 
-	state_owner_pool =
-		pool_basic_init("NFSv4 state owners", sizeof(state_owner_t));
-
 	return status;
 }
 
@@ -576,13 +596,11 @@ static state_lock_entry_t *create_state_lock_entry(struct fsal_obj_handle *obj,
 {
 	state_lock_entry_t *new_entry;
 
-	new_entry = gsh_malloc(sizeof(*new_entry));
+	new_entry = gsh_slab_alloc(&lock_entry_slab);
 
 	LogFullDebug(COMPONENT_STATE, "new_entry = %p owner %p", new_entry,
 		     owner);
 
-	memset(new_entry, 0, sizeof(*new_entry));
-
 	PTHREAD_MUTEX_init(&new_entry->sle_mutex, NULL);
 
 	/* sle_block_data will be filled in later if necessary */
@@ -667,6 +685,54 @@ state_lock_entry_t_dup(state_lock_entry_t *orig_entry)
 				       &orig_entry->sle_lock);
 }
 
+/**
+ * @brief Put a blocked lock on the wait queue of its file
+ *
+ * @note The blocked_locks_mutex MUST be held
+ *
+ * @param[in,out] block_data Blocked lock
+ */
+static void blocked_lock_enqueue(state_block_data_t *block_data)
+{
+	struct state_file *file =
+		&block_data->sbd_lock_entry->sle_obj->state_hdl->file;
+
+	if (glist_empty(&file->blocked_locks))
+		glist_add_tail(&state_blocked_files, &file->blocked_files);
+
+	glist_add_tail(&file->blocked_locks, &block_data->sbd_list);
+
+	if (block_data->sbd_block_type == STATE_BLOCK_POLL)
+		glist_add_tail(&state_polled_locks,
+			       &block_data->sbd_poll_list);
+	else
+		glist_init(&block_data->sbd_poll_list);
+}
+
+/**
+ * @brief Take a blocked lock off the wait queue of its file
+ *
+ * Does nothing if it is not queued.
+ *
+ * @note The blocked_locks_mutex MUST be held
+ *
+ * @param[in,out] lock_entry Entry whose block data to dequeue
+ */
+static void blocked_lock_dequeue(state_lock_entry_t *lock_entry)
+{
+	state_block_data_t *block_data = lock_entry->sle_block_data;
+	struct state_file *file = &lock_entry->sle_obj->state_hdl->file;
+
+	if (glist_null(&block_data->sbd_list))
+		return;
+
+	glist_del(&block_data->sbd_list);
+	glist_del(&block_data->sbd_poll_list);
+
+	if (glist_empty(&file->blocked_locks))
+		glist_del(&file->blocked_files);
+}
+
 /**
  * @brief Take a reference on a lock entry
  *
@@ -696,9 +762,9 @@ static void lock_entry_dec_ref(state_lock_entry_t *lock_entry)
 	if (refcount == 0) {
 		/* Release block data if present */
 		if (lock_entry->sle_block_data != NULL) {
-			/* need to remove from the state_blocked_locks list */
+			/* need to remove from the blocked lock lists */
 			PTHREAD_MUTEX_lock(&blocked_locks_mutex);
-			glist_del(&lock_entry->sle_block_data->sbd_list);
+			blocked_lock_dequeue(lock_entry);
 			PTHREAD_MUTEX_unlock(&blocked_locks_mutex);
 			gsh_free(lock_entry->sle_block_data);
 		}
@@ -711,8 +777,130 @@ static void lock_entry_dec_ref(state_lock_entry_t *lock_entry)
 		lock_entry->sle_obj->obj_ops.put_ref(lock_entry->sle_obj);
 		put_gsh_export(lock_entry->sle_export);
 		PTHREAD_MUTEX_destroy(&lock_entry->sle_mutex);
-		gsh_free(lock_entry);
+		gsh_slab_free(&lock_entry_slab, lock_entry);
+	}
+}
+
+/******************************************************************************
+ *
+ * The per-file lock list is indexed by range (see state_lock_tree.c) so
+ * that finding the locks overlapping a range does not walk every lock on
+ * the file.  An entry is in the index exactly while it is on the lock
+ * list of its file, entries on private lists are not indexed.
+ *
+ ******************************************************************************/
+
+/**
+ * @brief Put an entry on the lock list of a file
+ *
+ * @note The state_lock MUST be held for write
+ *
+ * @param[in,out] ostate     File state
+ * @param[in,out] lock_entry Entry to add
+ */
+static void lock_list_add(struct state_hdl *ostate,
+			  state_lock_entry_t *lock_entry)
+{
+	if (glist_empty(&ostate->file.lock_list))
+		ostate->file.lock_export = lock_entry->sle_export;
+	else if (ostate->file.lock_export != lock_entry->sle_export)
+		ostate->file.lock_export = NULL;
+
+	glist_add_tail(&ostate->file.lock_list, &lock_entry->sle_list);
+
+	lock_range_insert(&ostate->file.lock_tree, &lock_entry->sle_range,
+			  lock_entry->sle_lock.lock_start,
+			  lock_end(&lock_entry->sle_lock));
+	lock_entry->sle_indexed = true;
+}
+
+/**
+ * @brief Take an entry off whatever lock list it is on
+ *
+ * @param[in,out] lock_entry Entry to remove
+ */
+static void lock_list_del(state_lock_entry_t *lock_entry)
+{
+	struct state_hdl *ostate = lock_entry->sle_obj->state_hdl;
+
+	if (lock_entry->sle_indexed) {
+		lock_range_remove(&ostate->file.lock_tree,
+				  &lock_entry->sle_range);
+		lock_entry->sle_indexed = false;
 	}
+
+	glist_del(&lock_entry->sle_list);
+}
+
+/**
+ * @brief Update the index after the range of an entry changed
+ *
+ * @param[in,out] lock_entry Entry that changed
+ */
+static void lock_list_reindex(state_lock_entry_t *lock_entry)
+{
+	struct lock_range_tree *tree;
+
+	if (!lock_entry->sle_indexed ||
+	    (lock_entry->sle_range.start == lock_entry->sle_lock.lock_start &&
+	     lock_entry->sle_range.end == lock_end(&lock_entry->sle_lock)))
+		return;
+
+	tree = &lock_entry->sle_obj->state_hdl->file.lock_tree;
+
+	lock_range_remove(tree, &lock_entry->sle_range);
+	lock_range_insert(tree, &lock_entry->sle_range,
+			  lock_entry->sle_lock.lock_start,
+			  lock_end(&lock_entry->sle_lock));
+}
+
+static inline state_lock_entry_t *lock_range_entry(struct lock_range_node *node)
+{
+	return node != NULL
+		? container_of(node, state_lock_entry_t, sle_range)
+		: NULL;
+}
+
+/**
+ * @brief Find the first lock on a file overlapping a range
+ *
+ * Locks come back in order of their start, not in lock list order.
+ *
+ * @note The state_lock MUST be held
+ *
+ * @param[in] ostate File state
+ * @param[in] start  First byte of the range
+ * @param[in] end    Last byte of the range
+ *
+ * @return The entry or NULL.
+ */
+static inline state_lock_entry_t *first_overlapping(struct state_hdl *ostate,
+						    uint64_t start,
+						    uint64_t end)
+{
+	return lock_range_entry(lock_range_first(&ostate->file.lock_tree,
+						 start, end));
+}
+
+/**
+ * @brief Find the next lock on a file overlapping a range
+ *
+ * Other entries may be added or removed between calls, but @a lock_entry
+ * must still be on the lock list, so find the next entry before removing
+ * the current one.
+ *
+ * @param[in] lock_entry Entry returned by the last call
+ * @param[in] start      First byte of the range
+ * @param[in] end        Last byte of the range
+ *
+ * @return The entry or NULL.
+ */
+static inline state_lock_entry_t *next_overlapping(
+					state_lock_entry_t *lock_entry,
+					uint64_t start, uint64_t end)
+{
+	return lock_range_entry(lock_range_next(&lock_entry->sle_range,
+						start, end));
 }
 
 /**
@@ -770,7 +958,7 @@ static void remove_from_locklist(state_lock_entry_t *lock_entry)
 	}
 
 	lock_entry->sle_owner = NULL;
-	glist_del(&lock_entry->sle_list);
+	lock_list_del(lock_entry);
 	lock_entry_dec_ref(lock_entry);
 }
 
@@ -789,13 +977,14 @@ static state_lock_entry_t *get_overlapping_entry(struct state_hdl *ostate,
 						 state_owner_t *owner,
 						 fsal_lock_param_t *lock)
 {
-	struct glist_head *glist;
-	state_lock_entry_t *found_entry = NULL;
-	uint64_t found_entry_end, range_end = lock_end(lock);
-
-	glist_for_each(glist, &ostate->file.lock_list) {
-		found_entry = glist_entry(glist, state_lock_entry_t, sle_list);
+	state_lock_entry_t *found_entry;
+	uint64_t range_end = lock_end(lock);
 
+	for (found_entry = first_overlapping(ostate, lock->lock_start,
+					     range_end);
+	     found_entry != NULL;
+	     found_entry = next_overlapping(found_entry, lock->lock_start,
+					    range_end)) {
 		LogEntry("Checking", found_entry);
 
 		/* Skip blocked or cancelled locks */
@@ -804,33 +993,89 @@ static state_lock_entry_t *get_overlapping_entry(struct state_hdl *ostate,
 		    || found_entry->sle_blocked == STATE_CANCELED)
 			continue;
 
-		found_entry_end = lock_end(&found_entry->sle_lock);
-
-		if ((found_entry_end >= lock->lock_start)
-		    && (found_entry->sle_lock.lock_start <= range_end)) {
-			/* lock overlaps see if we can allow:
-			 * allow if neither lock is exclusive or
-			 * the owner is the same
-			 */
-			if ((found_entry->sle_lock.lock_type == FSAL_LOCK_W
-			     || lock->lock_type == FSAL_LOCK_W)
-			    && different_owners(found_entry->sle_owner, owner)
-			    ) {
-				/* found a conflicting lock, return it */
-				return found_entry;
-			}
+		/* lock overlaps see if we can allow:
+		 * allow if neither lock is exclusive or
+		 * the owner is the same
+		 */
+		if ((found_entry->sle_lock.lock_type == FSAL_LOCK_W
+		     || lock->lock_type == FSAL_LOCK_W)
+		    && different_owners(found_entry->sle_owner, owner)
+		    ) {
+			/* found a conflicting lock, return it */
+			return found_entry;
 		}
 	}
 
 	return NULL;
 }
 
+/**
+ * @brief Check if an owner holds locks on a file through another export
+ *
+ * @note The state_lock MUST be held
+ *
+ * @param[in] ostate File state to search
+ * @param[in] owner  The lock owner
+ *
+ * @return true if a lock of @a owner was taken through an export other
+ *         than the one of the current request.
+ */
+static bool lock_owner_export_conflict(struct state_hdl *ostate,
+				       state_owner_t *owner)
+{
+	struct glist_head *glist;
+	state_lock_entry_t *found_entry;
+
+	/* All the locks on the file came through this export */
+	if (glist_empty(&ostate->file.lock_list) ||
+	    ostate->file.lock_export == op_ctx->ctx_export)
+		return false;
+
+	glist_for_each(glist, &ostate->file.lock_list) {
+		found_entry = glist_entry(glist, state_lock_entry_t, sle_list);
+
+		if (found_entry->sle_export == op_ctx->ctx_export ||
+		    different_owners(found_entry->sle_owner, owner))
+			continue;
+
+		LogEvent(COMPONENT_STATE,
+			 "Lock Owner Export Conflict, Lock held for export %d (%s), request for export %d (%s)",
+			 found_entry->sle_export->export_id,
+			 op_ctx_export_path(found_entry->sle_export),
+			 op_ctx->ctx_export->export_id,
+			 op_ctx_export_path(op_ctx->ctx_export));
+
+		LogEntry("Found lock entry belonging to another export",
+			 found_entry);
+
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Range of locks that may touch or overlap a lock
+ *
+ * @param[in]  lock  Lock to check
+ * @param[out] start First byte
+ * @param[out] end   Last byte
+ */
+static inline void merge_range(fsal_lock_param_t *lock, uint64_t *start,
+			       uint64_t *end)
+{
+	*start = lock->lock_start > 0 ? lock->lock_start - 1 : 0;
+	*end = lock_end(lock);
+	if (*end != UINT64_MAX)
+		(*end)++;
+}
+
 /**
  * @brief Add a lock, potentially merging with existing locks
  *
- * We need to iterate over the full lock list and remove
- * any mapping entry. And l_offset = 0 and sle_lock.lock_length = 0 lock_entry
- * implies remove all entries
+ * We need to iterate over the locks touching or overlapping the new one
+ * and remove any mapping entry. And l_offset = 0 and
+ * sle_lock.lock_length = 0 lock_entry implies remove all entries
  *
  * @note The state_lock MUST be held for write
  *
@@ -842,19 +1087,34 @@ static void merge_lock_entry(struct state_hdl *ostate,
 {
 	state_lock_entry_t *check_entry;
 	state_lock_entry_t *check_entry_right;
+	state_lock_entry_t *next_entry;
 	uint64_t check_entry_end;
 	uint64_t lock_entry_end;
-	struct glist_head *glist;
-	struct glist_head *glistn;
+	uint64_t start, end;
+	bool indexed = lock_entry->sle_indexed;
 
 	/* lock_entry might be STATE_NON_BLOCKING or STATE_GRANTING */
 
-	glist_for_each_safe(glist, glistn, &ostate->file.lock_list) {
-		check_entry = glist_entry(glist, state_lock_entry_t, sle_list);
+	/* The entry being merged could be in the list, take it out of the
+	 * index while its range changes so we don't find it either.
+	 */
+	if (indexed) {
+		lock_range_remove(&ostate->file.lock_tree,
+				  &lock_entry->sle_range);
+		lock_entry->sle_indexed = false;
+	}
 
-		/* Skip entry being merged - it could be in the list */
-		if (check_entry == lock_entry)
-			continue;
+	merge_range(&lock_entry->sle_lock, &start, &end);
+
+	/* Granted locks of one owner never overlap, and only touch if they
+	 * are of different types, so growing lock_entry can't make it
+	 * touch an entry of the same owner outside the range we started
+	 * with that it needs to merge with.
+	 */
+	for (check_entry = first_overlapping(ostate, start, end);
+	     check_entry != NULL;
+	     check_entry = next_entry) {
+		next_entry = next_overlapping(check_entry, start, end);
 
 		if (different_owners
 		    (check_entry->sle_owner, lock_entry->sle_owner))
@@ -888,11 +1148,11 @@ static void merge_lock_entry(struct state_hdl *ostate,
 			if (lock_entry_end < check_entry_end
 			    && check_entry->sle_lock.lock_start <
 			    lock_entry->sle_lock.lock_start) {
-				/* Need to split old lock */
+				/* Need to split old lock, the right lock
+				 * goes on the list once it is shrunk.
+				 */
 				check_entry_right =
 				    state_lock_entry_t_dup(check_entry);
-				glist_add_tail(&ostate->file.lock_list,
-					       &(check_entry_right->sle_list));
 			} else {
 				/* No split, just shrink, make the logic below
 				 * work on original lock
@@ -923,6 +1183,12 @@ static void merge_lock_entry(struct state_hdl *ostate,
 				    check_entry->sle_lock.lock_start;
 				LogEntry("Merge shrunk left", check_entry);
 			}
+
+			if (check_entry_right != check_entry)
+				lock_list_add(ostate, check_entry_right);
+
+			lock_list_reindex(check_entry);
+
 			/* Done splitting/shrinking old lock */
 			continue;
 		}
@@ -949,6 +1215,14 @@ static void merge_lock_entry(struct state_hdl *ostate,
 		LogEntry("Merging removing", check_entry);
 		remove_from_locklist(check_entry);
 	}
+
+	if (indexed) {
+		lock_range_insert(&ostate->file.lock_tree,
+				  &lock_entry->sle_range,
+				  lock_entry->sle_lock.lock_start,
+				  lock_end(&lock_entry->sle_lock));
+		lock_entry->sle_indexed = true;
+	}
 }
 
 /**
@@ -1048,13 +1322,66 @@ static state_status_t subtract_lock_from_entry(state_lock_entry_t *found_entry,
 	/* Remove the lock from the list it's
 	 * on and put it on the remove_list
 	 */
-	glist_del(&found_entry->sle_list);
+	lock_list_del(found_entry);
 	glist_add_tail(remove_list, &(found_entry->sle_list));
 
 	*removed = true;
 	return status;
 }
 
+/**
+ * @brief Subtract a lock from one entry of a list of locks
+ *
+ * @param[in]     found_entry   Entry to check
+ * @param[in]     owner         Lock owner
+ * @param[in]     state_applies Indicator if state is relevant
+ * @param[in]     state         NSM state number
+ * @param[in]     lock          Lock to remove
+ * @param[out]    split_list    Remaining fragments
+ * @param[out]    remove_list   Removed lock entries
+ * @param[in,out] removed       Set if the entry was removed
+ *
+ * @return State status.
+ */
+static state_status_t subtract_lock_from_one(state_lock_entry_t *found_entry,
+					     state_owner_t *owner,
+					     bool state_applies,
+					     int32_t state,
+					     fsal_lock_param_t *lock,
+					     struct glist_head *split_list,
+					     struct glist_head *remove_list,
+					     bool *removed)
+{
+	state_status_t status;
+	bool removed_one = false;
+
+	if (owner != NULL
+	    && different_owners(found_entry->sle_owner, owner))
+		return STATE_SUCCESS;
+
+	/* Only care about granted locks */
+	if (found_entry->sle_blocked != STATE_NON_BLOCKING)
+		return STATE_SUCCESS;
+
+	/* Skip locks owned by this NLM state.
+	 * This protects NLM locks from the current iteration of an NLM
+	 * client from being released by SM_NOTIFY.
+	 */
+	if (state_applies &&
+	    found_entry->sle_state->state_seqid == state)
+		return STATE_SUCCESS;
+
+	/* We have matched owner. Even though we are taking a reference
+	 * to found_entry, we don't inc the ref count because we want
+	 * to drop the lock entry.
+	 */
+	status = subtract_lock_from_entry(found_entry, lock, split_list,
+					  remove_list, &removed_one);
+	*removed |= removed_one;
+
+	return status;
+}
+
 /**
  * @brief Subtract a lock from a list of locks
  *
@@ -1065,6 +1392,9 @@ static state_status_t subtract_lock_from_entry(state_lock_entry_t *found_entry,
  * @param[in]     lock    Lock to remove
  * @param[out]    removed True if an entry was removed
  * @param[in,out] list    List of locks to modify
+ * @param[in,out] ostate  File whose lock list @a list is, only the locks
+ *                        overlapping @a lock are then visited. NULL for
+ *                        a private list.
  *
  * @return State status.
  */
@@ -1073,53 +1403,55 @@ static state_status_t subtract_lock_from_list(state_owner_t *owner,
 					      int32_t state,
 					      fsal_lock_param_t *lock,
 					      bool *removed,
-					      struct glist_head *list)
+					      struct glist_head *list,
+					      struct state_hdl *ostate)
 {
-	state_lock_entry_t *found_entry;
+	state_lock_entry_t *found_entry, *next_entry;
 	struct glist_head split_lock_list, remove_list;
 	struct glist_head *glist, *glistn;
 	state_status_t status = STATE_SUCCESS;
-	bool removed_one = false;
+	uint64_t range_end = lock_end(lock);
 
 	*removed = false;
 
 	glist_init(&split_lock_list);
 	glist_init(&remove_list);
 
-	glist_for_each_safe(glist, glistn, list) {
-		found_entry = glist_entry(glist, state_lock_entry_t, sle_list);
-
-		if (owner != NULL
-		    && different_owners(found_entry->sle_owner, owner))
-			continue;
-
-		/* Only care about granted locks */
-		if (found_entry->sle_blocked != STATE_NON_BLOCKING)
-			continue;
-
-		/* Skip locks owned by this NLM state.
-		 * This protects NLM locks from the current iteration of an NLM
-		 * client from being released by SM_NOTIFY.
-		 */
-		if (state_applies &&
-		    found_entry->sle_state->state_seqid == state)
-			continue;
+	if (ostate != NULL) {
+		for (found_entry = first_overlapping(ostate, lock->lock_start,
+						     range_end);
+		     found_entry != NULL;
+		     found_entry = next_entry) {
+			next_entry = next_overlapping(found_entry,
+						      lock->lock_start,
+						      range_end);
+
+			status = subtract_lock_from_one(found_entry, owner,
+							state_applies, state,
+							lock, &split_lock_list,
+							&remove_list, removed);
+			if (status != STATE_SUCCESS) {
+				/* We ran out of memory while splitting,
+				 * deal with it outside loop
+				 */
+				break;
+			}
+		}
+	} else {
+		glist_for_each_safe(glist, glistn, list) {
+			found_entry = glist_entry(glist, state_lock_entry_t,
+						  sle_list);
 
-		/* We have matched owner. Even though we are taking a reference
-		 * to found_entry, we don't inc the ref count because we want
-		 * to drop the lock entry.
-		 */
-		status =
-		    subtract_lock_from_entry(found_entry, lock,
-					     &split_lock_list, &remove_list,
-					     &removed_one);
-		*removed |= removed_one;
-
-		if (status != STATE_SUCCESS) {
-			/* We ran out of memory while splitting,
-			 * deal with it outside loop
-			 */
-			break;
+			status = subtract_lock_from_one(found_entry, owner,
+							state_applies, state,
+							lock, &split_lock_list,
+							&remove_list, removed);
+			if (status != STATE_SUCCESS) {
+				/* We ran out of memory while splitting,
+				 * deal with it outside loop
+				 */
+				break;
+			}
 		}
 	}
 
@@ -1133,14 +1465,27 @@ static state_status_t subtract_lock_from_list(state_owner_t *owner,
 			found_entry =
 			    glist_entry(glist, state_lock_entry_t, sle_list);
 			glist_del(&found_entry->sle_list);
-			glist_add_tail(list, &(found_entry->sle_list));
+			if (ostate != NULL)
+				lock_list_add(ostate, found_entry);
+			else
+				glist_add_tail(list, &(found_entry->sle_list));
 		}
 	} else {
 		/* free the enttries on the remove_list */
 		free_list(&remove_list);
 
 		/* now add the split lock list */
-		glist_add_list_tail(list, &split_lock_list);
+		if (ostate != NULL) {
+			glist_for_each_safe(glist, glistn, &split_lock_list) {
+				found_entry = glist_entry(glist,
+							  state_lock_entry_t,
+							  sle_list);
+				glist_del(&found_entry->sle_list);
+				lock_list_add(ostate, found_entry);
+			}
+		} else {
+			glist_add_list_tail(list, &split_lock_list);
+		}
 	}
 
 	LogFullDebug(COMPONENT_STATE,
@@ -1151,29 +1496,31 @@ static state_status_t subtract_lock_from_list(state_owner_t *owner,
 }
 
 /**
- * @brief Remove locks in list from another list of locks
+ * @brief Remove the locks on a file overlapping a range from a list
  *
- * @param[in]     obj  File to modify
+ * @param[in]     ostate File state
  * @param[in,out] target List of locks to modify
- * @param[in]     source List of locks to subtract
+ * @param[in]     lock   Range the locks on @a target lie within
  *
  * @return State status.
  */
-static state_status_t subtract_list_from_list(struct fsal_obj_handle *obj,
+static state_status_t subtract_list_from_list(struct state_hdl *ostate,
 					      struct glist_head *target,
-					      struct glist_head *source)
+					      fsal_lock_param_t *lock)
 {
 	state_lock_entry_t *found_entry;
-	struct glist_head *glist, *glistn;
 	state_status_t status = STATE_SUCCESS;
 	bool removed = false;
+	uint64_t range_end = lock_end(lock);
 
-	glist_for_each_safe(glist, glistn, source) {
-		found_entry = glist_entry(glist, state_lock_entry_t, sle_list);
-
+	for (found_entry = first_overlapping(ostate, lock->lock_start,
+					     range_end);
+	     found_entry != NULL;
+	     found_entry = next_overlapping(found_entry, lock->lock_start,
+					    range_end)) {
 		status = subtract_lock_from_list(NULL, false, 0,
 						 &found_entry->sle_lock,
-						 &removed, target);
+						 &removed, target, NULL);
 		if (status != STATE_SUCCESS)
 			break;
 	}
@@ -1408,7 +1755,7 @@ void free_cookie(state_cookie_entry_t *cookie_entry, bool unblock)
 
 	/* Free the memory for the cookie and the cookie entry */
 	gsh_free(cookie);
-	gsh_free(cookie_entry);
+	gsh_slab_free(&cookie_entry_slab, cookie_entry);
 }
 
 /**
@@ -1448,9 +1795,7 @@ state_status_t state_add_grant_cookie(struct fsal_obj_handle *obj,
 		str_valid = true;
 	}
 
-	hash_entry = gsh_malloc(sizeof(*hash_entry));
-
-	memset(hash_entry, 0, sizeof(*hash_entry));
+	hash_entry = gsh_slab_alloc(&cookie_entry_slab);
 
 	buffkey.addr = gsh_malloc(cookie_size);
 
@@ -1474,7 +1819,8 @@ state_status_t state_add_grant_cookie(struct fsal_obj_handle *obj,
 				   &buffval,
 				   HASHTABLE_SET_HOW_SET_NO_OVERWRITE)
 	    != HASHTABLE_SUCCESS) {
-		gsh_free(hash_entry);
+		gsh_free(buffkey.addr);
+		gsh_slab_free(&cookie_entry_slab, hash_entry);
 		if (str_valid)
 			LogFullDebug(COMPONENT_STATE,
 				     "Lock Cookie {%s} HASH TABLE ERROR", str);
@@ -1683,6 +2029,10 @@ void grant_blocked_lock_immediate(struct state_hdl *ostate,
 			/* We have block data but no cookie,
 			 * so we can just free the block data
 			 */
+			PTHREAD_MUTEX_lock(&blocked_locks_mutex);
+			blocked_lock_dequeue(lock_entry);
+			PTHREAD_MUTEX_unlock(&blocked_locks_mutex);
+
 			memset(lock_entry->sle_block_data, 0,
 			       sizeof(*lock_entry->sle_block_data));
 			gsh_free(lock_entry->sle_block_data);
@@ -1812,11 +2162,11 @@ void try_to_grant_lock(state_lock_entry_t *lock_entry)
 		}
 
 		/* At this point, we no longer need the entry on the
-		 * blocked lock list.
+		 * blocked lock lists.
 		 */
 		PTHREAD_MUTEX_lock(&blocked_locks_mutex);
 
-		glist_del(&lock_entry->sle_block_data->sbd_list);
+		blocked_lock_dequeue(lock_entry);
 
 		PTHREAD_MUTEX_unlock(&blocked_locks_mutex);
 
@@ -1856,14 +2206,22 @@ void process_blocked_lock_upcall(state_block_data_t *block_data)
 /**
  * @brief Attempt to grant all blocked locks on a file
  *
+ * Only the wait queue of the file is looked at, in the order the locks
+ * blocked.
+ *
+ * @note The state_lock MUST be held for write
+ *
  * @param[in] ostate File state
  */
 
 static void grant_blocked_locks(struct state_hdl *ostate)
 {
+	state_lock_entry_t **waiters;
 	state_lock_entry_t *found_entry;
-	struct glist_head *glist, *glistn;
+	state_block_data_t *pblock;
+	struct glist_head *glist;
 	struct fsal_export *export = op_ctx->ctx_export->fsal_export;
+	int count = 0, i;
 
 	if (!ostate)
 		return;
@@ -1874,23 +2232,50 @@ static void grant_blocked_locks(struct state_hdl *ostate)
 	if (export->exp_ops.fs_supports(export, fso_lock_support_async_block))
 		return;
 
-	glist_for_each_safe(glist, glistn, &ostate->file.lock_list) {
-		found_entry = glist_entry(glist, state_lock_entry_t, sle_list);
+	/* Granting calls back into the protocol, so take a reference on
+	 * each waiter and let go of the blocked_locks_mutex before trying.
+	 */
+	PTHREAD_MUTEX_lock(&blocked_locks_mutex);
 
-		if (found_entry->sle_blocked != STATE_NLM_BLOCKING
-		    && found_entry->sle_blocked != STATE_NFSV4_BLOCKING)
-			continue;
+	glist_for_each(glist, &ostate->file.blocked_locks)
+		count++;
+
+	if (count == 0) {
+		PTHREAD_MUTEX_unlock(&blocked_locks_mutex);
+		return;
+	}
 
-		/* Found a blocked entry for this file,
-		 * see if we can place the lock.
+	waiters = gsh_malloc(count * sizeof(*waiters));
+	count = 0;
+
+	glist_for_each(glist, &ostate->file.blocked_locks) {
+		pblock = glist_entry(glist, state_block_data_t, sbd_list);
+		waiters[count] = pblock->sbd_lock_entry;
+		lock_entry_inc_ref(waiters[count]);
+		count++;
+	}
+
+	PTHREAD_MUTEX_unlock(&blocked_locks_mutex);
+
+	for (i = 0; i < count; i++) {
+		found_entry = waiters[i];
+
+		/* Granting an earlier waiter may have granted, cancelled or
+		 * removed this one. Otherwise see if we can place the lock.
 		 */
-		if (get_overlapping_entry(ostate, found_entry->sle_owner,
-					  &found_entry->sle_lock) != NULL)
-			continue;
+		if (found_entry->sle_indexed
+		    && (found_entry->sle_blocked == STATE_NLM_BLOCKING
+			|| found_entry->sle_blocked == STATE_NFSV4_BLOCKING)
+		    && get_overlapping_entry(ostate, found_entry->sle_owner,
+					     &found_entry->sle_lock) == NULL) {
+			/* Found an entry that might work, try to grant it. */
+			try_to_grant_lock(found_entry);
+		}
 
-		/* Found an entry that might work, try to grant it. */
-		try_to_grant_lock(found_entry);
+		lock_entry_dec_ref(found_entry);
 	}
+
+	gsh_free(waiters);
 }
 
 /**
@@ -2002,12 +2387,15 @@ void cancel_blocked_locks_range(struct state_hdl *ostate,
 				int32_t state,
 				fsal_lock_param_t *lock)
 {
-	struct glist_head *glist, *glistn;
-	state_lock_entry_t *found_entry = NULL;
-	uint64_t found_entry_end, range_end = lock_end(lock);
+	state_lock_entry_t *found_entry, *next_entry;
+	uint64_t range_end = lock_end(lock);
 
-	glist_for_each_safe(glist, glistn, &ostate->file.lock_list) {
-		found_entry = glist_entry(glist, state_lock_entry_t, sle_list);
+	for (found_entry = first_overlapping(ostate, lock->lock_start,
+					     range_end);
+	     found_entry != NULL;
+	     found_entry = next_entry) {
+		next_entry = next_overlapping(found_entry, lock->lock_start,
+					      range_end);
 
 		/* Skip locks not owned by owner */
 		if (owner != NULL
@@ -2028,13 +2416,8 @@ void cancel_blocked_locks_range(struct state_hdl *ostate,
 
 		LogEntry("Checking", found_entry);
 
-		found_entry_end = lock_end(&found_entry->sle_lock);
-
-		if ((found_entry_end >= lock->lock_start)
-		    && (found_entry->sle_lock.lock_start <= range_end)) {
-			/* lock overlaps, cancel it. */
-			cancel_blocked_lock(ostate->file.obj, found_entry);
-		}
+		/* lock overlaps, cancel it. */
+		cancel_blocked_lock(ostate->file.obj, found_entry);
 	}
 }
 
@@ -2185,8 +2568,8 @@ state_status_t do_unlock_no_owner(struct fsal_obj_handle *obj,
 
 	LogEntry("Generating FSAL Unlock List", unlock_entry);
 
-	status = subtract_list_from_list(obj, &fsal_unlock_list,
-					 &obj->state_hdl->file.lock_list);
+	status = subtract_list_from_list(obj->state_hdl, &fsal_unlock_list,
+					 lock);
 	if (status != STATE_SUCCESS) {
 		/* We ran out of memory while trying to build the unlock list.
 		 * We have already released the locks from cache inode lock
@@ -2504,7 +2887,6 @@ state_status_t state_lock(struct fsal_obj_handle *obj,
 			  fsal_lock_param_t *conflict)
 {
 	bool allow = true, overlap = false;
-	struct glist_head *glist;
 	state_lock_entry_t *found_entry;
 	uint64_t found_entry_end;
 	uint64_t range_end = lock_end(lock);
@@ -2547,41 +2929,38 @@ state_status_t state_lock(struct fsal_obj_handle *obj,
 		}
 	}
 
+#ifdef USE_LTTNG
+	tracepoint(state, lock_start, __func__, __LINE__, obj, owner,
+		   lock->lock_type, lock->lock_start, lock->lock_length,
+		   blocking);
+#endif
+
 	PTHREAD_RWLOCK_wrlock(&obj->state_hdl->state_lock);
 
+	/* Need to reject lock request if this lock owner already has
+	 * a lock on this file via a different export.
+	 */
+	if (lock_owner_export_conflict(obj->state_hdl, owner)) {
+		status = STATE_INVALID_ARGUMENT;
+		goto out_unlock;
+	}
+
 	if (blocking != STATE_NON_BLOCKING) {
 		/* First search for a blocked request. Client can ignore the
 		 * blocked request and keep sending us new lock request again
 		 * and again. So if we have a mapping blocked request return
 		 * that
 		 */
-		glist_for_each(glist, &obj->state_hdl->file.lock_list) {
-			found_entry =
-			    glist_entry(glist, state_lock_entry_t, sle_list);
-
+		for (found_entry = first_overlapping(obj->state_hdl,
+						     lock->lock_start,
+						     range_end);
+		     found_entry != NULL;
+		     found_entry = next_overlapping(found_entry,
+						    lock->lock_start,
+						    range_end)) {
 			if (different_owners(found_entry->sle_owner, owner))
 				continue;
 
-			/* Need to reject lock request if this lock owner
-			 * already has a lock on this file via a different
-			 * export.
-			 */
-			if (found_entry->sle_export != op_ctx->ctx_export) {
-				LogEvent(COMPONENT_STATE,
-					 "Lock Owner Export Conflict, Lock held for export %d (%s), request for export %d (%s)",
-					 found_entry->sle_export->export_id,
-					 op_ctx_export_path(
-						found_entry->sle_export),
-					 op_ctx->ctx_export->export_id,
-					 op_ctx_export_path(
-							op_ctx->ctx_export));
-				LogEntry(
-					"Found lock entry belonging to another export",
-					found_entry);
-				status = STATE_INVALID_ARGUMENT;
-				goto out_unlock;
-			}
-
 			if (found_entry->sle_blocked != blocking)
 				continue;
 
@@ -2598,33 +2977,15 @@ state_status_t state_lock(struct fsal_obj_handle *obj,
 		}
 	}
 
-	glist_for_each(glist, &obj->state_hdl->file.lock_list) {
-		found_entry = glist_entry(glist, state_lock_entry_t, sle_list);
-		/* Need to reject lock request if this lock owner already has
-		 * a lock on this file via a different export.
-		 */
-		if (found_entry->sle_export != op_ctx->ctx_export
-		    && !different_owners(found_entry->sle_owner, owner)) {
-			LogEvent(COMPONENT_STATE,
-				 "Lock Owner Export Conflict, Lock held for export %d (%s), request for export %d (%s)",
-				 found_entry->sle_export->export_id,
-				 op_ctx_export_path(found_entry->sle_export),
-				 op_ctx->ctx_export->export_id,
-				 op_ctx_export_path(op_ctx->ctx_export));
-
-			LogEntry("Found lock entry belonging to another export",
-				 found_entry);
-
-			status = STATE_INVALID_ARGUMENT;
-			goto out_unlock;
-		}
-
+	for (found_entry = first_overlapping(obj->state_hdl, lock->lock_start,
+					     range_end);
+	     found_entry != NULL;
+	     found_entry = next_overlapping(found_entry, lock->lock_start,
+					    range_end)) {
 		/* Don't skip blocked locks for fairness */
 		found_entry_end = lock_end(&found_entry->sle_lock);
 
-		if (!(lock->lock_reclaim)
-		    && (found_entry_end >= lock->lock_start)
-		    && (found_entry->sle_lock.lock_start <= range_end)) {
+		if (!(lock->lock_reclaim)) {
 			/* lock overlaps see if we can allow:
 			 * allow if neither lock is exclusive or
 			 * the owner is the same
@@ -2807,8 +3168,7 @@ state_status_t state_lock(struct fsal_obj_handle *obj,
 		/* Insert entry into lock list */
 		LogEntry("New lock", found_entry);
 
-		glist_add_tail(&obj->state_hdl->file.lock_list,
-			       &found_entry->sle_list);
+		lock_list_add(obj->state_hdl, found_entry);
 
 		/* A lock downgrade could unblock blocked locks */
 		grant_blocked_locks(obj->state_hdl);
@@ -2840,12 +3200,11 @@ state_status_t state_lock(struct fsal_obj_handle *obj,
 		/* Insert entry into lock list */
 		LogEntry("FSAL block for", found_entry);
 
-		glist_add_tail(&obj->state_hdl->file.lock_list,
-			       &found_entry->sle_list);
+		lock_list_add(obj->state_hdl, found_entry);
 
 		PTHREAD_MUTEX_lock(&blocked_locks_mutex);
 
-		glist_add_tail(&state_blocked_locks, &block_data->sbd_list);
+		blocked_lock_enqueue(block_data);
 
 		PTHREAD_MUTEX_unlock(&blocked_locks_mutex);
 	} else {
@@ -2859,6 +3218,10 @@ state_status_t state_lock(struct fsal_obj_handle *obj,
  out_unlock:
 	PTHREAD_RWLOCK_unlock(&obj->state_hdl->state_lock);
 
+#ifdef USE_LTTNG
+	tracepoint(state, lock_end, __func__, __LINE__, obj, status);
+#endif
+
 	return status;
 }
 
@@ -2889,6 +3252,11 @@ state_status_t state_unlock(struct fsal_obj_handle *obj,
 		return STATE_BAD_TYPE;
 	}
 
+#ifdef USE_LTTNG
+	tracepoint(state, unlock_start, __func__, __LINE__, obj, owner,
+		   lock->lock_start, lock->lock_length);
+#endif
+
 	PTHREAD_RWLOCK_wrlock(&obj->state_hdl->state_lock);
 
 	/* If lock list is empty, there really isn't any work for us to do. */
@@ -2916,7 +3284,8 @@ state_status_t state_unlock(struct fsal_obj_handle *obj,
 	/* Release the lock from cache inode lock list for entry */
 	status = subtract_lock_from_list(owner, state_applies, nsm_state, lock,
 					 &removed,
-					 &obj->state_hdl->file.lock_list);
+					 &obj->state_hdl->file.lock_list,
+					 obj->state_hdl);
 
 	/* If the lock list has become zero; decrement the pin ref count pt
 	 * placed. Do this here just in case subtract_lock_from_list has made
@@ -2974,6 +3343,10 @@ state_status_t state_unlock(struct fsal_obj_handle *obj,
  out_unlock:
 	PTHREAD_RWLOCK_unlock(&obj->state_hdl->state_lock);
 
+#ifdef USE_LTTNG
+	tracepoint(state, unlock_end, __func__, __LINE__, obj, status);
+#endif
+
 	return status;
 }
 
@@ -2989,8 +3362,8 @@ state_status_t state_unlock(struct fsal_obj_handle *obj,
 state_status_t state_cancel(struct fsal_obj_handle *obj,
 			    state_owner_t *owner, fsal_lock_param_t *lock)
 {
-	struct glist_head *glist;
 	state_lock_entry_t *found_entry;
+	uint64_t range_end = lock_end(lock);
 
 	if (obj->type != REGULAR_FILE) {
 		LogLock(COMPONENT_STATE, NIV_DEBUG,
@@ -3009,9 +3382,11 @@ state_status_t state_cancel(struct fsal_obj_handle *obj,
 		goto out_unlock;
 	}
 
-	glist_for_each(glist, &obj->state_hdl->file.lock_list) {
-		found_entry = glist_entry(glist, state_lock_entry_t, sle_list);
-
+	for (found_entry = first_overlapping(obj->state_hdl, lock->lock_start,
+					     range_end);
+	     found_entry != NULL;
+	     found_entry = next_overlapping(found_entry, lock->lock_start,
+					    range_end)) {
 		if (different_owners(found_entry->sle_owner, owner))
 			continue;
 
@@ -3556,6 +3931,9 @@ void state_export_unlock_all(void)
 /**
  * @brief Poll any blocked locks of type STATE_BLOCK_POLL
  *
+ * Only the locks an FSAL without blocking lock upcalls refused are
+ * polled, lock releases within Ganesha retry the others.
+ *
  * @param[in] ctx Fridge Thread Context
  *
  */
@@ -3570,12 +3948,8 @@ void blocked_lock_polling(struct fridgethr_context *ctx)
 
 	PTHREAD_MUTEX_lock(&blocked_locks_mutex);
 
-	if (isFullDebug(COMPONENT_STATE) && isFullDebug(COMPONENT_MEMLEAKS))
-		LogBlockedList("Blocked Lock List",
-			       NULL, &state_blocked_locks);
-
-	glist_for_each(glist, &state_blocked_locks) {
-		pblock = glist_entry(glist, state_block_data_t, sbd_list);
+	glist_for_each(glist, &state_polled_locks) {
+		pblock = glist_entry(glist, state_block_data_t, sbd_poll_list);
 
 		found_entry = pblock->sbd_lock_entry;
 
@@ -3583,10 +3957,6 @@ void blocked_lock_polling(struct fridgethr_context *ctx)
 		if (found_entry == NULL)
 			continue;
 
-		/* Check if right type */
-		if (pblock->sbd_block_type != STATE_BLOCK_POLL)
-			continue;
-
 		/* Schedule async processing, leave the lock on the blocked
 		 * lock list since we might not succeed in granting this lock.
 		 */
@@ -3621,7 +3991,7 @@ static void find_blocked_lock_upcall(struct fsal_obj_handle *obj, void *owner,
 
 	PTHREAD_MUTEX_lock(&blocked_locks_mutex);
 
-	glist_for_each(glist, &state_blocked_locks) {
+	glist_for_each(glist, &obj->state_hdl->file.blocked_locks) {
 		pblock = glist_entry(glist, state_block_data_t, sbd_list);
 
 		found_entry = pblock->sbd_lock_entry;
@@ -3630,10 +4000,6 @@ static void find_blocked_lock_upcall(struct fsal_obj_handle *obj, void *owner,
 		if (found_entry == NULL)
 			continue;
 
-		/* Check if for same file */
-		if (found_entry->sle_obj != obj)
-			continue;
-
 		/* Check if for same owner */
 		if (found_entry->sle_owner != owner)
 			continue;
@@ -3662,7 +4028,7 @@ static void find_blocked_lock_upcall(struct fsal_obj_handle *obj, void *owner,
 
 	if (isFullDebug(COMPONENT_STATE) && isFullDebug(COMPONENT_MEMLEAKS))
 		LogBlockedList("Blocked Lock List",
-			       NULL, &state_blocked_locks);
+			       obj, &obj->state_hdl->file.blocked_locks);
 
 	PTHREAD_MUTEX_unlock(&blocked_locks_mutex);
 
@@ -3720,6 +4086,27 @@ bool state_lock_wipe(struct state_hdl *hstate)
 	return true;
 }
 
+/**
+ * @brief Find a blocked lock on any file
+ *
+ * @note The blocked_locks_mutex MUST be held
+ *
+ * @return Block data or NULL if no lock is blocked.
+ */
+static state_block_data_t *first_blocked_lock(void)
+{
+	struct state_file *file;
+
+	file = glist_first_entry(&state_blocked_files, struct state_file,
+				 blocked_files);
+
+	if (file == NULL)
+		return NULL;
+
+	return glist_first_entry(&file->blocked_locks, state_block_data_t,
+				 sbd_list);
+}
+
 void cancel_all_nlm_blocked(void)
 {
 	state_lock_entry_t *found_entry;
@@ -3733,9 +4120,7 @@ void cancel_all_nlm_blocked(void)
 
 	PTHREAD_MUTEX_lock(&blocked_locks_mutex);
 
-	pblock = glist_first_entry(&state_blocked_locks,
-				   state_block_data_t,
-				   sbd_list);
+	pblock = first_blocked_lock();
 
 	if (pblock == NULL) {
 		LogFullDebug(COMPONENT_STATE, "No blocked locks");
@@ -3745,8 +4130,8 @@ void cancel_all_nlm_blocked(void)
 	while (pblock != NULL) {
 		found_entry = pblock->sbd_lock_entry;
 
-		/* Remove lock from blocked list */
-		glist_del(&pblock->sbd_list);
+		/* Remove lock from blocked lists */
+		blocked_lock_dequeue(found_entry);
 
 		lock_entry_inc_ref(found_entry);
 
@@ -3779,9 +4164,7 @@ void cancel_all_nlm_blocked(void)
 		PTHREAD_MUTEX_lock(&blocked_locks_mutex);
 
 		/* Get next item off list */
-		pblock = glist_first_entry(&state_blocked_locks,
-					   state_block_data_t,
-					   sbd_list);
+		pblock = first_blocked_lock();
 	}
 
 out:
@@ -0,0 +1,331 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup SAL State abstraction layer
+ * @{
+ */
+
+/**
+ * @file    state_lock_tree.c
+ * @brief   Byte-range index of the locks on a file
+ *
+ * An AVL tree of lock ranges ordered by start, ties broken by node
+ * address, augmented with the largest end in each subtree.  Finding the
+ * first range overlapping a query is O(log n), so walking the k
+ * overlapping ranges costs O(log n + k log n) at worst rather than a
+ * walk of every lock on the file.
+ *
+ * The tree does no locking of its own, callers hold the state_lock of
+ * the file.
+ */
+
+#include "config.h"
+#include <sys/param.h>
+
+#include "sal_functions.h"
+
+static inline int lock_range_height(struct lock_range_node *node)
+{
+	return node != NULL ? node->height : 0;
+}
+
+/**
+ * @brief Recompute height and max_end of a node from its children
+ */
+static void lock_range_update(struct lock_range_node *node)
+{
+	node->height = MAX(lock_range_height(node->left),
+			   lock_range_height(node->right)) + 1;
+	node->max_end = node->end;
+
+	if (node->left != NULL && node->left->max_end > node->max_end)
+		node->max_end = node->left->max_end;
+
+	if (node->right != NULL && node->right->max_end > node->max_end)
+		node->max_end = node->right->max_end;
+}
+
+/**
+ * @brief Hang a node where another one was
+ */
+static void lock_range_replace(struct lock_range_tree *tree,
+			       struct lock_range_node *parent,
+			       struct lock_range_node *old,
+			       struct lock_range_node *node)
+{
+	if (parent == NULL)
+		tree->root = node;
+	else if (parent->left == old)
+		parent->left = node;
+	else
+		parent->right = node;
+
+	if (node != NULL)
+		node->parent = parent;
+}
+
+static struct lock_range_node *lock_range_rotate_left(
+					struct lock_range_tree *tree,
+					struct lock_range_node *node)
+{
+	struct lock_range_node *right = node->right;
+
+	lock_range_replace(tree, node->parent, node, right);
+
+	node->right = right->left;
+	if (node->right != NULL)
+		node->right->parent = node;
+
+	right->left = node;
+	node->parent = right;
+
+	lock_range_update(node);
+	lock_range_update(right);
+
+	return right;
+}
+
+static struct lock_range_node *lock_range_rotate_right(
+					struct lock_range_tree *tree,
+					struct lock_range_node *node)
+{
+	struct lock_range_node *left = node->left;
+
+	lock_range_replace(tree, node->parent, node, left);
+
+	node->left = left->right;
+	if (node->left != NULL)
+		node->left->parent = node;
+
+	left->right = node;
+	node->parent = left;
+
+	lock_range_update(node);
+	lock_range_update(left);
+
+	return left;
+}
+
+/**
+ * @brief Restore balance and max_end from a node up to the root
+ *
+ * Every ancestor of a changed node needs its max_end refreshed, so this
+ * always runs to the root.
+ */
+static void lock_range_retrace(struct lock_range_tree *tree,
+			       struct lock_range_node *node)
+{
+	while (node != NULL) {
+		int balance = lock_range_height(node->left) -
+			      lock_range_height(node->right);
+
+		if (balance > 1) {
+			if (lock_range_height(node->left->left) <
+			    lock_range_height(node->left->right))
+				lock_range_rotate_left(tree, node->left);
+			node = lock_range_rotate_right(tree, node);
+		} else if (balance < -1) {
+			if (lock_range_height(node->right->right) <
+			    lock_range_height(node->right->left))
+				lock_range_rotate_right(tree, node->right);
+			node = lock_range_rotate_left(tree, node);
+		} else {
+			lock_range_update(node);
+		}
+
+		node = node->parent;
+	}
+}
+
+static inline bool lock_range_before(struct lock_range_node *a,
+				     struct lock_range_node *b)
+{
+	if (a->start != b->start)
+		return a->start < b->start;
+
+	return (uintptr_t) a < (uintptr_t) b;
+}
+
+/**
+ * @brief Add a range to the index
+ *
+ * @param[in,out] tree  Index to add to
+ * @param[in,out] node  Node to add, must not be in any index
+ * @param[in]     start First byte of the range
+ * @param[in]     end   Last byte of the range
+ */
+void lock_range_insert(struct lock_range_tree *tree,
+		       struct lock_range_node *node,
+		       uint64_t start, uint64_t end)
+{
+	struct lock_range_node **link = &tree->root;
+	struct lock_range_node *parent = NULL;
+
+	node->start = start;
+	node->end = end;
+	node->max_end = end;
+	node->height = 1;
+	node->left = NULL;
+	node->right = NULL;
+
+	while (*link != NULL) {
+		parent = *link;
+		if (lock_range_before(node, parent))
+			link = &parent->left;
+		else
+			link = &parent->right;
+	}
+
+	node->parent = parent;
+	*link = node;
+
+	lock_range_retrace(tree, parent);
+}
+
+/**
+ * @brief Remove a range from the index
+ *
+ * @param[in,out] tree Index to remove from
+ * @param[in,out] node Node to remove
+ */
+void lock_range_remove(struct lock_range_tree *tree,
+		       struct lock_range_node *node)
+{
+	struct lock_range_node *fix;
+
+	if (node->left == NULL || node->right == NULL) {
+		fix = node->parent;
+		lock_range_replace(tree, node->parent, node,
+				   node->left != NULL ? node->left
+						      : node->right);
+	} else {
+		/* Put the successor in place of the node */
+		struct lock_range_node *next = node->right;
+
+		while (next->left != NULL)
+			next = next->left;
+
+		if (next->parent == node) {
+			fix = next;
+		} else {
+			fix = next->parent;
+			lock_range_replace(tree, next->parent, next,
+					   next->right);
+			next->right = node->right;
+			next->right->parent = next;
+		}
+
+		next->left = node->left;
+		next->left->parent = next;
+		lock_range_replace(tree, node->parent, node, next);
+	}
+
+	node->left = NULL;
+	node->right = NULL;
+	node->parent = NULL;
+
+	lock_range_retrace(tree, fix);
+}
+
+/**
+ * @brief Find the leftmost range of a subtree overlapping a range
+ *
+ * If the left subtree reaches start but holds no overlap, the range in
+ * it that does reach start begins past end, and so does everything to
+ * its right, so there is no need to come back up.
+ */
+static struct lock_range_node *lock_range_subtree_first(
+					struct lock_range_node *node,
+					uint64_t start, uint64_t end)
+{
+	while (node != NULL && node->max_end >= start) {
+		if (node->left != NULL && node->left->max_end >= start) {
+			node = node->left;
+			continue;
+		}
+
+		if (node->start > end)
+			return NULL;
+
+		if (node->end >= start)
+			return node;
+
+		node = node->right;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Find the first range overlapping a range
+ *
+ * @param[in] tree  Index to search
+ * @param[in] start First byte of the range
+ * @param[in] end   Last byte of the range
+ *
+ * @return The overlapping node with the lowest start, or NULL.
+ */
+struct lock_range_node *lock_range_first(struct lock_range_tree *tree,
+					 uint64_t start, uint64_t end)
+{
+	return lock_range_subtree_first(tree->root, start, end);
+}
+
+/**
+ * @brief Find the next range overlapping a range
+ *
+ * Nodes other than @a node may be removed or added between calls, as
+ * long as @a node itself is still in the index.
+ *
+ * @param[in] node  Node returned by the last call
+ * @param[in] start First byte of the range
+ * @param[in] end   Last byte of the range
+ *
+ * @return The next overlapping node in start order, or NULL.
+ */
+struct lock_range_node *lock_range_next(struct lock_range_node *node,
+					uint64_t start, uint64_t end)
+{
+	struct lock_range_node *found;
+
+	found = lock_range_subtree_first(node->right, start, end);
+
+	while (found == NULL) {
+		/* Climb to the first ancestor we are left of */
+		while (node->parent != NULL && node->parent->right == node)
+			node = node->parent;
+
+		node = node->parent;
+
+		if (node == NULL || node->start > end)
+			return NULL;
+
+		if (node->end >= start)
+			return node;
+
+		found = lock_range_subtree_first(node->right, start, end);
+	}
+
+	return found;
+}
+
+/** @} */
@@ -54,7 +54,9 @@ struct glist_head cached_open_owners = GLIST_HEAD_INIT(cached_open_owners);
 
 pthread_mutex_t cached_open_owners_lock = PTHREAD_MUTEX_INITIALIZER;
 
-pool_t *state_owner_pool;	/*< Pool for NFSv4 files's open owner */
+struct gsh_slab state_owner_slab =
+	GSH_SLAB_INITIALIZER("state_owner_t", state_owner_t, 4096,
+			     GSH_MEM_STATE);
 
 #ifdef DEBUG_SAL
 struct glist_head state_owners_all = GLIST_HEAD_INIT(state_owners_all);
@@ -850,7 +852,7 @@ void free_state_owner(state_owner_t *owner)
 	PTHREAD_MUTEX_unlock(&all_state_owners_mutex);
 #endif
 
-	pool_free(state_owner_pool, owner);
+	gsh_slab_free(&state_owner_slab, owner);
 }
 
 /**
@@ -1144,7 +1146,7 @@ not_found:
 		return NULL;
 	}
 
-	owner = pool_alloc(state_owner_pool);
+	owner = gsh_slab_alloc(&state_owner_slab);
 
 	/* Copy everything over */
 	memcpy(owner, key, sizeof(*key));
@@ -77,6 +77,34 @@ else (NOT CEPH_FS)
   else(NOT CEPH_FS_LOOKUP_ROOT)
     set(USE_FSAL_CEPH_LL_LOOKUP_ROOT ON)
   endif(NOT CEPH_FS_LOOKUP_ROOT)
+  check_library_exists(cephfs ceph_ll_writev ${CEPHFS_LIBRARY_DIR} CEPH_FS_WRITEV)
+  if(NOT CEPH_FS_WRITEV)
+    message("Cannot find ceph_ll_writev. Writing segments one at a time")
+    set(USE_FSAL_CEPH_LL_WRITEV OFF)
+  else(NOT CEPH_FS_WRITEV)
+    set(USE_FSAL_CEPH_LL_WRITEV ON)
+  endif(NOT CEPH_FS_WRITEV)
+  check_library_exists(cephfs ceph_ll_nonblocking_readv_writev ${CEPHFS_LIBRARY_DIR} CEPH_FS_NONBLOCKING_IO)
+  if(NOT CEPH_FS_NONBLOCKING_IO)
+    message("Cannot find ceph_ll_nonblocking_readv_writev. Reads and writes will block")
+    set(USE_FSAL_CEPH_LL_NONBLOCKING_IO OFF)
+  else(NOT CEPH_FS_NONBLOCKING_IO)
+    set(USE_FSAL_CEPH_LL_NONBLOCKING_IO ON)
+  endif(NOT CEPH_FS_NONBLOCKING_IO)
+  check_library_exists(cephfs ceph_ll_delegation ${CEPHFS_LIBRARY_DIR} CEPH_FS_DELEGATION)
+  if(NOT CEPH_FS_DELEGATION OR NOT CEPH_FS_SETLK)
+    message("Cannot find ceph_ll_delegation. Disabling delegation support")
+    set(USE_FSAL_CEPH_LL_DELEGATION OFF)
+  else(NOT CEPH_FS_DELEGATION)
+    set(USE_FSAL_CEPH_LL_DELEGATION ON)
+  endif(NOT CEPH_FS_DELEGATION)
+  check_library_exists(cephfs ceph_ll_register_callbacks ${CEPHFS_LIBRARY_DIR} CEPH_FS_CALLBACKS)
+  if(NOT CEPH_FS_CALLBACKS)
+    message("Cannot find ceph_ll_register_callbacks. Revoked caps will not invalidate the cache")
+    set(USE_FSAL_CEPH_LL_CALLBACKS OFF)
+  else(NOT CEPH_FS_CALLBACKS)
+    set(USE_FSAL_CEPH_LL_CALLBACKS ON)
+  endif(NOT CEPH_FS_CALLBACKS)
   set(CMAKE_REQUIRED_INCLUDES ${CEPHFS_INCLUDE_DIR})
   check_symbol_exists(CEPH_STATX_INO "cephfs/libcephfs.h" CEPH_FS_CEPH_STATX)
   if(NOT CEPH_FS_CEPH_STATX)
@@ -85,6 +113,14 @@ else (NOT CEPH_FS)
   else(NOT CEPH_FS_CEPH_STATX)
     set(USE_FSAL_CEPH_STATX ON)
   endif(NOT CEPH_FS_CEPH_STATX)
+  check_library_exists(cephfs ceph_ll_file_layout ${CEPHFS_LIBRARY_DIR} CEPH_FS_FILE_LAYOUT)
+  check_library_exists(cephfs ceph_ll_sync_inode ${CEPHFS_LIBRARY_DIR} CEPH_FS_SYNC_INODE)
+  if(NOT CEPH_FS_FILE_LAYOUT OR NOT CEPH_FS_SYNC_INODE OR NOT CEPH_FS_CEPH_STATX)
+    message("Cannot find ceph_ll_file_layout or ceph_ll_sync_inode. Disabling CEPH fsal pNFS")
+    set(USE_FSAL_CEPH_PNFS OFF)
+  else()
+    set(USE_FSAL_CEPH_PNFS ON)
+  endif()
 endif (NOT CEPH_FS)
 
 set(CEPHFS_LIBRARIES ${CEPHFS_LIBRARY})
@@ -102,4 +138,9 @@ mark_as_advanced(CEPHFS_LIBRARY_DIR)
 mark_as_advanced(USE_FSAL_CEPH_MKNOD)
 mark_as_advanced(USE_FSAL_CEPH_SETLK)
 mark_as_advanced(USE_FSAL_CEPH_LL_LOOKUP_ROOT)
+mark_as_advanced(USE_FSAL_CEPH_LL_WRITEV)
+mark_as_advanced(USE_FSAL_CEPH_LL_NONBLOCKING_IO)
+mark_as_advanced(USE_FSAL_CEPH_LL_DELEGATION)
+mark_as_advanced(USE_FSAL_CEPH_LL_CALLBACKS)
 mark_as_advanced(USE_FSAL_CEPH_STATX)
+mark_as_advanced(USE_FSAL_CEPH_PNFS)
@@ -62,6 +62,13 @@ else (NOT RGWLIB)
   else(RGW_MOUNT2)
     set(USE_FSAL_RGW_MOUNT2 ON)
   endif(NOT RGW_MOUNT2)
+  check_library_exists(rgw rgw_readdir2 ${RGW_LIBRARY_DIR} RGW_READDIR2)
+  if(NOT RGW_READDIR2)
+    message("Cannot find rgw_readdir2. READDIR will resume by offset")
+    set(USE_FSAL_RGW_READDIR2 OFF)
+  else(RGW_READDIR2)
+    set(USE_FSAL_RGW_READDIR2 ON)
+  endif(NOT RGW_READDIR2)
 endif (NOT RGWLIB)
 
 set(RGW_LIBRARIES ${RGW_LIBRARY})
@@ -34,6 +34,7 @@
 #include "config_parsing.h"
 #include "analyse.h"
 #include "abstract_mem.h"
+#include "abstract_atomic.h"
 #include "conf_yacc.h"
 #include "log.h"
 #include "fsal_convert.h"
@@ -905,6 +906,88 @@ int noop_conf_commit(void *node, void *link_mem, void *self_struct,
 	return 0;
 }
 
+static struct config_item *find_uint_param(struct config_block *conf_blk,
+					   const char *name)
+{
+	struct config_item *item;
+
+	for (item = conf_blk->blk_desc.u.blk.params; item->name != NULL;
+	     item++) {
+		if ((item->type == CONFIG_UINT32 ||
+		     item->type == CONFIG_UINT64) &&
+		    strcasecmp(item->name, name) == 0)
+			return item;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Read an unsigned parameter of a loaded block by name
+ *
+ * @param[in]  conf_blk Block description
+ * @param[in]  param    Structure the block was loaded into
+ * @param[in]  name     Parameter name, case insensitive
+ * @param[out] value    Its value
+ *
+ * @retval 0 on success.
+ * @retval ENOENT if the block has no such UINT32 or UINT64 parameter.
+ */
+int config_get_uint_param(struct config_block *conf_blk, void *param,
+			  const char *name, uint64_t *value)
+{
+	struct config_item *item = find_uint_param(conf_blk, name);
+	void *addr;
+
+	if (item == NULL)
+		return ENOENT;
+
+	addr = (char *)param + item->off;
+	if (item->type == CONFIG_UINT32)
+		*value = atomic_fetch_uint32_t(addr);
+	else
+		*value = atomic_fetch_uint64_t(addr);
+	return 0;
+}
+
+/**
+ * @brief Change an unsigned parameter of a loaded block by name
+ *
+ * The value is checked against the range the parameter has in the
+ * config file and stored atomically, for readers that don't lock.
+ *
+ * @param[in]     conf_blk Block description
+ * @param[in,out] param    Structure the block was loaded into
+ * @param[in]     name     Parameter name, case insensitive
+ * @param[in]     value    New value
+ *
+ * @retval 0 on success.
+ * @retval ENOENT if the block has no such UINT32 or UINT64 parameter.
+ * @retval ERANGE if the value is out of range.
+ */
+int config_set_uint_param(struct config_block *conf_blk, void *param,
+			  const char *name, uint64_t value)
+{
+	struct config_item *item = find_uint_param(conf_blk, name);
+	void *addr;
+
+	if (item == NULL)
+		return ENOENT;
+
+	addr = (char *)param + item->off;
+	if (item->type == CONFIG_UINT32) {
+		if (value < item->u.ui32.minval ||
+		    value > item->u.ui32.maxval)
+			return ERANGE;
+		atomic_store_uint32_t(addr, value);
+	} else {
+		if (value < item->u.ui64.minval ||
+		    value > item->u.ui64.maxval)
+			return ERANGE;
+		atomic_store_uint64_t(addr, value);
+	}
+	return 0;
+}
+
 static bool proc_block(struct config_node *node,
 		      struct config_item *item,
 		      void *link_mem,
@@ -204,10 +204,55 @@ void init_dbus_broadcast(void)
 		init_heartbeat();
 }
 
-void gsh_dbus_pkginit(void)
+/**
+ * @brief Become the primary owner of the server's bus name
+ *
+ * @return true if we own the name.
+ */
+
+bool gsh_dbus_request_name(void)
 {
-	int code = 0;
+	int code;
+
+	code =
+	    dbus_bus_request_name(thread_state.dbus_conn, dbus_name,
+				  DBUS_NAME_FLAG_REPLACE_EXISTING,
+				  &thread_state.dbus_err);
+	if (dbus_error_is_set(&thread_state.dbus_err)) {
+		LogCrit(COMPONENT_DBUS, "server bus reg failed (%s, %s)",
+			dbus_name, thread_state.dbus_err.message);
+		dbus_error_free(&thread_state.dbus_err);
+		return false;
+	}
+	if (code != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+		LogCrit(COMPONENT_DBUS,
+			"server failed becoming primary bus owner (%s, %d)",
+			dbus_name, code);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Give up the server's bus name, keeping the connection
+ *
+ * Lets another server process claim the name while this one
+ * keeps running, e.g. during an upgrade.
+ */
 
+void gsh_dbus_release_name(void)
+{
+	dbus_bus_release_name(thread_state.dbus_conn, dbus_name,
+			      &thread_state.dbus_err);
+	if (dbus_error_is_set(&thread_state.dbus_err)) {
+		LogCrit(COMPONENT_DBUS, "err releasing name (%s, %s)",
+			dbus_name, thread_state.dbus_err.message);
+		dbus_error_free(&thread_state.dbus_err);
+	}
+}
+
+void gsh_dbus_pkginit(void)
+{
 	LogDebug(COMPONENT_DBUS, "init");
 
 	avltree_init(&thread_state.callouts, dbus_callout_cmpf,
@@ -223,24 +268,8 @@ void gsh_dbus_pkginit(void)
 		goto out;
 	}
 
-	code =
-	    dbus_bus_request_name(thread_state.dbus_conn, dbus_name,
-				  DBUS_NAME_FLAG_REPLACE_EXISTING,
-				  &thread_state.dbus_err);
-	if (dbus_error_is_set(&thread_state.dbus_err)) {
-		LogCrit(COMPONENT_DBUS, "server bus reg failed (%s, %s)",
-			dbus_name, thread_state.dbus_err.message);
-		dbus_error_free(&thread_state.dbus_err);
-		if (!code)
-			code = EINVAL;
+	if (!gsh_dbus_request_name())
 		goto out;
-	}
-	if (code != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
-		LogCrit(COMPONENT_DBUS,
-			"server failed becoming primary bus owner (%s, %d)",
-			dbus_name, code);
-		goto out;
-	}
 
 	init_dbus_broadcast();
 
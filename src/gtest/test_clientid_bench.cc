@@ -0,0 +1,360 @@
+// -*- mode:C; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/*
+ * Client id reconnect storm benchmark
+ *
+ * Replays what the server sees after a restart: --clients NFSv4.1
+ * clients, spread over --threads threads, all do the SAL work of
+ * EXCHANGE_ID and CREATE_SESSION at once.  Each benchmark reports ops/s
+ * and latency percentiles:
+ *
+ *   SEED	the clients connect once, so the recovery backend holds
+ *		a record for each
+ *   RELOAD	the records are read back and grace starts, as on a
+ *		restart; the seeded clients are expired
+ *   STORM	the same clients reconnect; every one must be allowed to
+ *		reclaim.  The mean latency of the last tenth is compared
+ *		with the first tenth; a ratio above --max-growth fails
+ *		the test, which catches client lookups going O(n).
+ *
+ * Run it on a config with Graceless = false and a Grace_Period long
+ * enough to cover STORM.  It writes to the configured recovery backend.
+ */
+
+#include <sys/types.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "gtest/gtest.h"
+#include <boost/program_options.hpp>
+
+extern "C" {
+/* Ganesha headers */
+#include "nfs_lib.h"
+#include "nfs_core.h"
+#include "sal_data.h"
+#include "sal_functions.h"
+}
+
+namespace {
+
+  char* ganesha_conf = nullptr;
+  char* lpath = nullptr;
+  int dlevel = -1;
+  unsigned int nclients = 10000;
+  unsigned int nthreads = 8;
+  double max_growth = 8.0;
+
+  struct bench_client {
+    std::string owner;
+    nfs_client_record_t *record = nullptr;
+    nfs_client_id_t *clientid = nullptr;
+  };
+  std::vector<struct bench_client> clients;
+
+  int ganesha_server() {
+    /* XXX */
+    return nfs_libmain(
+      ganesha_conf,
+      lpath,
+      dlevel
+      );
+  }
+
+  /* What EXCHANGE_ID does for a new client, under its record's mutex */
+  bool exchange_id(struct bench_client *bc) {
+    nfs_client_cred_t cred;
+    bool ok;
+
+    bc->record = get_client_record(bc->owner.c_str(), bc->owner.size(),
+				   0, 0);
+    if (bc->record == nullptr)
+      return false;
+
+    memset(&cred, 0, sizeof(cred));
+    pthread_mutex_lock(&bc->record->cr_mutex);
+    bc->clientid = create_client_id(0, bc->record, &cred, 1);
+    ok = bc->clientid != nullptr &&
+      nfs_client_id_insert(bc->clientid) == CLIENT_ID_SUCCESS;
+    pthread_mutex_unlock(&bc->record->cr_mutex);
+
+    if (!ok)
+      bc->clientid = nullptr;
+    return ok;
+  }
+
+  /* What CREATE_SESSION does to confirm it */
+  bool create_session(struct bench_client *bc) {
+    clientid_status_t rc;
+
+    pthread_mutex_lock(&bc->record->cr_mutex);
+    rc = nfs_client_id_confirm(bc->clientid, COMPONENT_CLIENTID);
+    if (rc == CLIENT_ID_SUCCESS)
+      nfs4_chk_clid(bc->clientid);
+    pthread_mutex_unlock(&bc->record->cr_mutex);
+
+    return rc == CLIENT_ID_SUCCESS;
+  }
+
+  void expire(struct bench_client *bc) {
+    if (bc->clientid != nullptr) {
+      pthread_mutex_lock(&bc->record->cr_mutex);
+      nfs_client_id_expire(bc->clientid, false);
+      pthread_mutex_unlock(&bc->record->cr_mutex);
+      bc->clientid = nullptr;
+    }
+    if (bc->record != nullptr) {
+      dec_client_record_ref(bc->record);
+      bc->record = nullptr;
+    }
+  }
+
+  struct bench_result {
+    std::vector<uint64_t> nsecs;	/* per client, in order */
+    uint64_t errors = 0;
+    double secs = 0;
+  };
+
+  uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty())
+      return 0;
+    return sorted[std::min(sorted.size() - 1,
+			   (size_t) (p / 100.0 * sorted.size()))];
+  }
+
+  /*
+   * Connect every client, client c on thread c % nthreads, and time
+   * each one's EXCHANGE_ID and CREATE_SESSION together.
+   */
+  bench_result run_storm(const char *name) {
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> errors(0);
+    bench_result res;
+
+    res.nsecs.resize(nclients);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int t = 0; t < nthreads; ++t) {
+      threads.emplace_back([t, &res, &errors]() {
+	  for (unsigned int c = t; c < nclients; c += nthreads) {
+	    struct bench_client *bc = &clients[c];
+	    auto t0 = std::chrono::steady_clock::now();
+	    bool ok = exchange_id(bc) && create_session(bc);
+	    auto t1 = std::chrono::steady_clock::now();
+
+	    res.nsecs[c] =
+	      std::chrono::duration_cast<std::chrono::nanoseconds>(
+		t1 - t0).count();
+	    if (!ok)
+	      ++errors;
+	  }
+	});
+    }
+    for (auto& th : threads)
+      th.join();
+
+    std::chrono::duration<double> secs =
+      std::chrono::steady_clock::now() - start;
+
+    res.secs = secs.count();
+    res.errors = errors.load();
+
+    std::vector<uint64_t> sorted(res.nsecs);
+    std::sort(sorted.begin(), sorted.end());
+
+    double ops = (double) sorted.size();
+
+    std::cout << std::left << std::setw(12) << name
+	      << " threads " << nthreads
+	      << " clients " << (uint64_t) ops
+	      << " clients/s " << (uint64_t) (ops / res.secs)
+	      << " p50 " << percentile(sorted, 50) / 1000.0
+	      << "us p99 " << percentile(sorted, 99) / 1000.0
+	      << "us p99.9 " << percentile(sorted, 99.9) / 1000.0
+	      << "us" << std::endl;
+
+    EXPECT_EQ(res.errors, 0U);
+    return res;
+  }
+
+} /* namespace */
+
+TEST(CLIENTID_BENCH, INIT)
+{
+  clients.resize(nclients);
+  for (unsigned int c = 0; c < nclients; ++c)
+    clients[c].owner = "clientid_bench_client" + std::to_string(c);
+}
+
+TEST(CLIENTID_BENCH, SEED)
+{
+  run_storm("SEED");
+}
+
+TEST(CLIENTID_BENCH, RELOAD)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  nfs4_recovery_load_clids(nullptr);
+  nfs4_start_grace(nullptr);
+
+  std::chrono::duration<double> secs =
+    std::chrono::steady_clock::now() - start;
+
+  std::cout << std::left << std::setw(12) << "RELOAD"
+	    << " clients " << nclients
+	    << " secs " << secs.count() << std::endl;
+
+  ASSERT_TRUE(nfs_in_grace());
+
+  for (auto& bc : clients)
+    expire(&bc);
+}
+
+TEST(CLIENTID_BENCH, STORM)
+{
+  bench_result res = run_storm("STORM");
+  unsigned int reclaim = 0;
+
+  for (auto& bc : clients) {
+    if (bc.clientid != nullptr && bc.clientid->cid_allow_reclaim)
+      ++reclaim;
+  }
+  EXPECT_EQ(reclaim, nclients);
+
+  /* Compare the first and last tenth of the clients to connect */
+  unsigned int tenth = nclients / 10;
+  double early = 0, late = 0;
+
+  if (tenth == 0)
+    return;
+
+  for (unsigned int c = 0; c < tenth; ++c) {
+    early += res.nsecs[c];
+    late += res.nsecs[nclients - 1 - c];
+  }
+
+  double growth = late / std::max(early, 1.0);
+
+  std::cout << "STORM growth " << growth << " (last/first tenth of "
+	    << nclients << " clients)" << std::endl;
+  if (max_growth > 0) {
+    EXPECT_LE(growth, max_growth);
+  }
+}
+
+TEST(CLIENTID_BENCH, CLEANUP)
+{
+  for (auto& bc : clients)
+    expire(&bc);
+}
+
+int main(int argc, char *argv[])
+{
+  int code = 0;
+
+  using namespace std;
+  using namespace std::literals;
+  namespace po = boost::program_options;
+
+  po::options_description opts("program options");
+  po::variables_map vm;
+
+  try {
+
+    opts.add_options()
+      ("config", po::value<string>(),
+	"path to Ganesha conf file")
+
+      ("logfile", po::value<string>(),
+	"log to the provided file path")
+
+      ("debug", po::value<string>(),
+	"ganesha debug level")
+
+      ("clients", po::value<unsigned int>(),
+	"clients that reconnect (default 10000)")
+
+      ("threads", po::value<unsigned int>(),
+	"threads the clients are spread over (default 8)")
+
+      ("max-growth", po::value<double>(),
+	"fail STORM if the last clients take this many times longer "
+	"than the first ones, 0 to only report (default 8)")
+      ;
+
+    po::variables_map::iterator vm_iter;
+    po::store(po::parse_command_line(argc, argv, opts), vm);
+    po::notify(vm);
+
+    // use config vars--leaves them on the stack
+    vm_iter = vm.find("config");
+    if (vm_iter != vm.end()) {
+      ganesha_conf = (char*) vm_iter->second.as<std::string>().c_str();
+    }
+    vm_iter = vm.find("logfile");
+    if (vm_iter != vm.end()) {
+      lpath = (char*) vm_iter->second.as<std::string>().c_str();
+    }
+    vm_iter = vm.find("debug");
+    if (vm_iter != vm.end()) {
+      dlevel = ReturnLevelAscii(
+	(char*) vm_iter->second.as<std::string>().c_str());
+    }
+    vm_iter = vm.find("clients");
+    if (vm_iter != vm.end()) {
+      nclients = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+    vm_iter = vm.find("threads");
+    if (vm_iter != vm.end()) {
+      nthreads = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+    vm_iter = vm.find("max-growth");
+    if (vm_iter != vm.end()) {
+      max_growth = vm_iter->second.as<double>();
+    }
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    std::thread ganesha(ganesha_server);
+    std::this_thread::sleep_for(5s);
+
+    code  = RUN_ALL_TESTS();
+    ganesha.join();
+  }
+
+  catch(po::error& e) {
+    cout << "Error parsing opts " << e.what() << endl;
+  }
+
+  catch(...) {
+    cout << "Unhandled exception in main()" << endl;
+  }
+
+  return code;
+}
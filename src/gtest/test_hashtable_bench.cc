@@ -0,0 +1,403 @@
+// -*- mode:C; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/*
+ * Hash table engine and hash function benchmarks
+ *
+ * Needs no config or export, only the hashtable code.  Keys are built
+ * the way Ganesha builds them:
+ *
+ *   clientid	8 bytes, server epoch in the upper half, a counter below
+ *   stateid	the 12 byte "other" of a stateid, epoch then counter
+ *   session	16 bytes, the clientid then a counter
+ *   handle	32 byte file handles differing only in the inode bytes
+ *
+ * HASH times each hash function on each key shape.  RBT and OPEN fill
+ * a table of either engine with --keys keys, look every key up
+ * --lookups times from --threads threads and delete them again, once
+ * per hash function; Table is the table's own functions and only
+ * exists for clientid and session.  Each run reports ops/s and how
+ * evenly the keys spread over the partitions (fullest over mean).
+ */
+
+#include <sys/types.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <random>
+#include "gtest/gtest.h"
+#include <boost/program_options.hpp>
+
+extern "C" {
+/* Ganesha headers */
+#include "log.h"
+#include "hashtable.h"
+#include "gsh_config.h"
+#include "sal_data.h"
+#include "sal_functions.h"
+}
+
+namespace {
+
+  char* lpath = nullptr;
+  int dlevel = -1;
+  unsigned int nkeys = 100000;
+  unsigned int nlookups = 4;
+  unsigned int nthreads = 1;
+  uint32_t partitions = NFS4_HASH_PARTITIONS_DEFAULT;
+  uint32_t resize_load = 0;
+
+  const uint32_t EPOCH = 0x5a5a1234;
+
+  struct key_shape {
+    const char *name;
+    size_t len;
+    void (*make)(uint8_t *key, uint64_t n);
+    index_function_t table_key;	/* nullptr if no table uses it */
+    rbthash_function_t table_rbt;
+  };
+
+  void make_clientid(uint8_t *key, uint64_t n) {
+    uint64_t clientid = ((uint64_t) EPOCH << 32) | (uint32_t) n;
+
+    memcpy(key, &clientid, sizeof(clientid));
+  }
+
+  void make_stateid(uint8_t *key, uint64_t n) {
+    memcpy(key, &EPOCH, sizeof(EPOCH));
+    memcpy(key + sizeof(EPOCH), &n, sizeof(n));
+  }
+
+  void make_session(uint8_t *key, uint64_t n) {
+    make_clientid(key, n / 4);
+    memcpy(key + sizeof(uint64_t), &n, sizeof(n));
+  }
+
+  void make_handle(uint8_t *key, uint64_t n) {
+    uint64_t ino = 0x1000 + n;
+
+    /* version, flags, export id, then the FSAL's handle bytes */
+    memset(key, 0, 32);
+    key[0] = 0x43;
+    key[1] = 0x03;
+    key[2] = 77;
+    memcpy(key + 4, "fsid\x01\x02\x03\x04", 8);
+    memcpy(key + 12, &ino, sizeof(ino));
+    key[20] = 0xff;
+  }
+
+  const key_shape shapes[] = {
+    { "clientid", sizeof(clientid4), make_clientid,
+      client_id_value_hash_func, client_id_rbt_hash_func },
+    { "stateid", OTHERSIZE, make_stateid, nullptr, nullptr },
+    { "session", NFS4_SESSIONID_SIZE, make_session,
+      session_id_value_hash_func, session_id_rbt_hash_func },
+    { "handle", 32, make_handle, nullptr, nullptr },
+  };
+
+  struct hash_func {
+    const char *name;
+    enum hash_key_func func;
+  };
+
+  const hash_func funcs[] = {
+    { "Table", HT_HASH_TABLE },
+    { "City", HT_HASH_CITY },
+    { "Murmur3", HT_HASH_MURMUR3 },
+    { "CRC32C", HT_HASH_CRC32C },
+  };
+
+  int compare_bytes(struct gsh_buffdesc *a, struct gsh_buffdesc *b) {
+    if (a->len != b->len)
+      return 1;
+    return memcmp(a->addr, b->addr, a->len);
+  }
+
+  int display_none(struct gsh_buffdesc *buff, char *str) {
+    return sprintf(str, "%zu bytes", buff->len);
+  }
+
+  /* Keys and values live in the key vector, nothing to free */
+  int free_none(struct gsh_buffdesc key, struct gsh_buffdesc val) {
+    return 1;
+  }
+
+  std::vector<uint8_t> make_keys(const key_shape& shape) {
+    std::vector<uint8_t> keys(nkeys * shape.len);
+
+    for (unsigned int n = 0; n < nkeys; ++n)
+      shape.make(&keys[n * shape.len], n);
+    return keys;
+  }
+
+  double since(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> secs =
+      std::chrono::steady_clock::now() - start;
+
+    return secs.count();
+  }
+
+  /* Fullest partition over the mean, 1.0 is perfectly even */
+  double balance(struct hash_table *ht) {
+    size_t max = 0, total = 0;
+
+    for (uint32_t i = 0; i < ht->parameter.index_size; ++i) {
+      max = std::max(max, ht->partitions[i].count);
+      total += ht->partitions[i].count;
+    }
+    if (total == 0)
+      return 0;
+    return (double) max * ht->parameter.index_size / total;
+  }
+
+  void run_engine(const char *engine, uint32_t flags) {
+    for (const auto& shape : shapes) {
+      std::vector<uint8_t> keys = make_keys(shape);
+      std::vector<unsigned int> order(nkeys);
+      std::mt19937 rng(8675309);
+
+      for (unsigned int n = 0; n < nkeys; ++n)
+	order[n] = n;
+      std::shuffle(order.begin(), order.end(), rng);
+
+      for (const auto& func : funcs) {
+	struct hash_param param;
+	struct hash_table *ht;
+	std::atomic<uint64_t> errors(0);
+	std::vector<std::thread> threads;
+	double set_secs, get_secs, del_secs, spread;
+
+	if (func.func == HT_HASH_TABLE && shape.table_key == nullptr)
+	  continue;
+
+	memset(&param, 0, sizeof(param));
+	param.flags = flags;
+	param.index_size = partitions;
+	param.resize_load = resize_load;
+	param.hash_func_key = shape.table_key;
+	param.hash_func_rbt = shape.table_rbt;
+	param.key_hash = func.func;
+	param.compare_key = compare_bytes;
+	param.key_to_str = display_none;
+	param.val_to_str = display_none;
+	param.ht_name = (char *) "bench";
+	param.ht_log_component = COMPONENT_HASHTABLE;
+
+	ht = hashtable_init(&param);
+	ASSERT_NE(ht, nullptr);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned int n = 0; n < nkeys; ++n) {
+	  struct gsh_buffdesc key = { &keys[n * shape.len], shape.len };
+	  struct gsh_buffdesc val = key;
+
+	  if (HashTable_Set(ht, &key, &val) != HASHTABLE_SUCCESS)
+	    ++errors;
+	}
+	set_secs = since(start);
+	spread = balance(ht);
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned int t = 0; t < nthreads; ++t) {
+	  threads.emplace_back([t, &shape, &keys, &order, &ht, &errors]() {
+	      for (unsigned int l = 0; l < nlookups; ++l) {
+		for (unsigned int i = t; i < nkeys; i += nthreads) {
+		  unsigned int n = order[i];
+		  struct gsh_buffdesc key = { &keys[n * shape.len],
+					      shape.len };
+		  struct gsh_buffdesc val;
+
+		  if (HashTable_Get(ht, &key, &val) != HASHTABLE_SUCCESS
+		      || val.addr != key.addr)
+		    ++errors;
+		}
+	      }
+	    });
+	}
+	for (auto& th : threads)
+	  th.join();
+	get_secs = since(start);
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < nkeys; ++i) {
+	  unsigned int n = order[i];
+	  struct gsh_buffdesc key = { &keys[n * shape.len], shape.len };
+
+	  if (HashTable_Del(ht, &key, nullptr, nullptr)
+	      != HASHTABLE_SUCCESS)
+	    ++errors;
+	}
+	del_secs = since(start);
+
+	std::cout << std::left << std::setw(5) << engine
+		  << std::setw(9) << shape.name
+		  << std::setw(8) << func.name
+		  << " set/s " << (uint64_t) (nkeys / set_secs)
+		  << " get/s "
+		  << (uint64_t) ((double) nkeys * nlookups / get_secs)
+		  << " del/s " << (uint64_t) (nkeys / del_secs)
+		  << " partitions " << ht->parameter.index_size
+		  << " balance " << std::setprecision(3) << spread
+		  << std::endl;
+
+	EXPECT_EQ(errors.load(), 0U);
+	hashtable_destroy(ht, free_none);
+      }
+    }
+  }
+
+} /* namespace */
+
+TEST(HASHTABLE_BENCH, HASH)
+{
+  for (const auto& shape : shapes) {
+    std::vector<uint8_t> keys = make_keys(shape);
+
+    for (const auto& func : funcs) {
+      uint64_t sum = 0;
+
+      if (func.func == HT_HASH_TABLE)
+	continue;
+
+      auto start = std::chrono::steady_clock::now();
+
+      for (unsigned int n = 0; n < nkeys; ++n)
+	sum += hashtable_hash_bytes(func.func, &keys[n * shape.len],
+				    shape.len);
+
+      double secs = since(start);
+
+      std::cout << std::left << std::setw(9) << shape.name
+		<< std::setw(8) << func.name
+		<< " ns/hash " << std::setprecision(3)
+		<< secs * 1e9 / nkeys
+		<< " (" << std::hex << (sum & 0xff) << std::dec << ")"
+		<< std::endl;
+    }
+  }
+}
+
+TEST(HASHTABLE_BENCH, RBT)
+{
+  run_engine("RBT", HT_FLAG_CACHE);
+}
+
+TEST(HASHTABLE_BENCH, OPEN)
+{
+  run_engine("OPEN", HT_FLAG_OPEN);
+}
+
+int main(int argc, char *argv[])
+{
+  int code = 0;
+
+  using namespace std;
+  namespace po = boost::program_options;
+
+  po::options_description opts("program options");
+  po::variables_map vm;
+
+  try {
+
+    opts.add_options()
+      ("logfile", po::value<string>(),
+	"log to the provided file path")
+
+      ("debug", po::value<string>(),
+	"ganesha debug level")
+
+      ("keys", po::value<unsigned int>(),
+	"keys per table (default 100000)")
+
+      ("lookups", po::value<unsigned int>(),
+	"times every key is looked up (default 4)")
+
+      ("threads", po::value<unsigned int>(),
+	"threads sharing the lookups (default 1)")
+
+      ("partitions", po::value<uint32_t>(),
+	"partitions per table, a prime (default 17)")
+
+      ("resize-load", po::value<uint32_t>(),
+	"entries per partition before a table grows, 0 never "
+	"(default 0)")
+      ;
+
+    po::variables_map::iterator vm_iter;
+    po::store(po::parse_command_line(argc, argv, opts), vm);
+    po::notify(vm);
+
+    // use config vars--leaves them on the stack
+    vm_iter = vm.find("logfile");
+    if (vm_iter != vm.end()) {
+      lpath = (char*) vm_iter->second.as<std::string>().c_str();
+    }
+    vm_iter = vm.find("debug");
+    if (vm_iter != vm.end()) {
+      dlevel = ReturnLevelAscii(
+	(char*) vm_iter->second.as<std::string>().c_str());
+    }
+    vm_iter = vm.find("keys");
+    if (vm_iter != vm.end()) {
+      nkeys = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+    vm_iter = vm.find("lookups");
+    if (vm_iter != vm.end()) {
+      nlookups = vm_iter->second.as<unsigned int>();
+    }
+    vm_iter = vm.find("threads");
+    if (vm_iter != vm.end()) {
+      nthreads = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+    vm_iter = vm.find("partitions");
+    if (vm_iter != vm.end()) {
+      partitions = min(max(vm_iter->second.as<uint32_t>(), 1U),
+		       (uint32_t) HASHTABLE_MAX_INDEX);
+    }
+    vm_iter = vm.find("resize-load");
+    if (vm_iter != vm.end()) {
+      resize_load = vm_iter->second.as<uint32_t>();
+    }
+
+    SetNamePgm("test_hashtable_bench");
+    init_logging(lpath, dlevel);
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    code  = RUN_ALL_TESTS();
+  }
+
+  catch(po::error& e) {
+    cout << "Error parsing opts " << e.what() << endl;
+  }
+
+  catch(...) {
+    cout << "Unhandled exception in main()" << endl;
+  }
+
+  return code;
+}
@@ -0,0 +1,570 @@
+// -*- mode:C; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/*
+ * Byte-range lock and state benchmarks
+ *
+ * Boots Ganesha on the given config, which should export FSAL_MEM with
+ * the given export id.  --files files are created and --owners lock
+ * owners (9P owners, one proc_id each) open every file, one thread per
+ * owner.  Each benchmark reports ops/s and latency percentiles:
+ *
+ *   FILL	each owner takes --locks disjoint write locks on every
+ *		file, so each file ends up with owners * locks locks.
+ *		The mean latency of the last tenth of the inserts is
+ *		compared with the first tenth; a ratio above --max-growth
+ *		fails the test, which catches lock lists going O(n).
+ *   TEST	state_test of random ranges held by other owners
+ *   CONTEND	lock/unlock pairs; --contention-pct of them aim at one
+ *		range shared by all owners, the rest at a private range
+ *   UNLOCK	each owner drops its locks one range at a time
+ *   OPEN_CLOSE	NFSv4 share state creation and removal (state_add and
+ *		state_del), one open owner per thread
+ */
+
+#include <sys/types.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <random>
+#include "gtest/gtest.h"
+#include <boost/program_options.hpp>
+
+extern "C" {
+/* Ganesha headers */
+#include "nfs_lib.h"
+#include "export_mgr.h"
+#include "nfs_exports.h"
+#include "sal_data.h"
+#include "sal_functions.h"
+#include "fsal.h"
+}
+
+namespace {
+
+  char* ganesha_conf = nullptr;
+  char* lpath = nullptr;
+  int dlevel = -1;
+  uint16_t export_id = 77;
+  unsigned int nfiles = 4;
+  unsigned int nowners = 8;
+  unsigned int nlocks = 1000;
+  unsigned int contention_pct = 10;
+  unsigned int iters = 100000;
+  double max_growth = 8.0;
+
+  /* Every lock is LOCK_LEN bytes, LOCK_LEN apart so none merge */
+  const uint64_t LOCK_LEN = 16;
+  const uint64_t LOCK_STRIDE = 2 * LOCK_LEN;
+
+  struct user_cred user_credentials;
+
+  struct gsh_export* a_export = nullptr;
+  struct fsal_obj_handle *root_entry = nullptr;
+  struct fsal_obj_handle *test_root = nullptr;
+  std::vector<struct fsal_obj_handle *> files;
+
+  struct bench_owner {
+    state_owner_t *owner;
+    std::vector<struct state_t *> states;	/* one per file */
+  };
+  std::vector<struct bench_owner> owners;
+
+  int ganesha_server() {
+    /* XXX */
+    return nfs_libmain(
+      ganesha_conf,
+      lpath,
+      dlevel
+      );
+  }
+
+  /* Ganesha call paths need real or forged context info, per thread */
+  void set_op_ctx(struct req_op_context *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->ctx_export = a_export;
+    ctx->fsal_export = a_export->fsal_export;
+    ctx->creds = &user_credentials;
+    op_ctx = ctx;
+  }
+
+  /* Private ranges: owner o, lock l */
+  uint64_t lock_start(unsigned int o, unsigned int l) {
+    return ((uint64_t) l * nowners + o) * LOCK_STRIDE;
+  }
+
+  /* Range CONTEND aims at: one shared, one past the FILL ranges per owner */
+  uint64_t contend_start(unsigned int o, bool shared) {
+    uint64_t base = lock_start(0, nlocks);
+
+    return shared ? base : base + (o + 1) * LOCK_STRIDE;
+  }
+
+  void set_lock(fsal_lock_param_t *lock, fsal_lock_t type, uint64_t start) {
+    memset(lock, 0, sizeof(*lock));
+    lock->lock_sle_type = FSAL_POSIX_LOCK;
+    lock->lock_type = type;
+    lock->lock_start = start;
+    lock->lock_length = LOCK_LEN;
+  }
+
+  state_status_t lock_one(struct fsal_obj_handle *obj,
+			  struct bench_owner *bo, unsigned int f,
+			  fsal_lock_t type, uint64_t start) {
+    fsal_lock_param_t lock, conflict;
+    state_owner_t *holder = nullptr;
+    state_status_t status;
+
+    set_lock(&lock, type, start);
+    status = state_lock(obj, bo->owner, bo->states[f], STATE_NON_BLOCKING,
+			nullptr, &lock, &holder, &conflict);
+    if (holder != nullptr)
+      dec_state_owner_ref(holder);
+    return status;
+  }
+
+  state_status_t unlock_one(struct fsal_obj_handle *obj,
+			    struct bench_owner *bo, unsigned int f,
+			    uint64_t start) {
+    fsal_lock_param_t lock;
+
+    set_lock(&lock, FSAL_LOCK_W, start);
+    return state_unlock(obj, bo->states[f], bo->owner, false, 0, &lock);
+  }
+
+  struct bench_result {
+    std::vector<uint64_t> nsecs;	/* per op, all threads */
+    uint64_t errors = 0;
+    uint64_t conflicts = 0;
+    double secs = 0;
+  };
+
+  uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty())
+      return 0;
+    return sorted[std::min(sorted.size() - 1,
+			   (size_t) (p / 100.0 * sorted.size()))];
+  }
+
+  /*
+   * Run fn(thread, iteration) n times on each of nthreads threads.  fn
+   * returns STATE_SUCCESS, STATE_LOCK_CONFLICT (counted, not an error)
+   * or anything else (an error).
+   */
+  template <typename F>
+  bench_result run_bench(const char *name, unsigned int nthreads,
+			 unsigned int n, F fn) {
+    std::vector<std::thread> threads;
+    std::vector<std::vector<uint64_t>> nsecs(nthreads);
+    std::atomic<uint64_t> errors(0), conflicts(0);
+    bench_result res;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int t = 0; t < nthreads; ++t) {
+      threads.emplace_back([t, n, &fn, &nsecs, &errors, &conflicts]() {
+	  struct req_op_context ctx;
+
+	  set_op_ctx(&ctx);
+	  nsecs[t].reserve(n);
+	  for (unsigned int i = 0; i < n; ++i) {
+	    auto t0 = std::chrono::steady_clock::now();
+	    state_status_t status = fn(t, i);
+	    auto t1 = std::chrono::steady_clock::now();
+
+	    nsecs[t].push_back(
+	      std::chrono::duration_cast<std::chrono::nanoseconds>(
+		t1 - t0).count());
+	    if (status == STATE_LOCK_CONFLICT)
+	      ++conflicts;
+	    else if (status != STATE_SUCCESS)
+	      ++errors;
+	  }
+	  op_ctx = nullptr;
+	});
+    }
+    for (auto& th : threads)
+      th.join();
+
+    std::chrono::duration<double> secs =
+      std::chrono::steady_clock::now() - start;
+
+    res.secs = secs.count();
+    res.errors = errors.load();
+    res.conflicts = conflicts.load();
+    for (unsigned int t = 0; t < nthreads; ++t)
+      res.nsecs.insert(res.nsecs.end(), nsecs[t].begin(), nsecs[t].end());
+
+    std::vector<uint64_t> sorted(res.nsecs);
+    std::sort(sorted.begin(), sorted.end());
+
+    double ops = (double) sorted.size();
+
+    std::cout << std::left << std::setw(12) << name
+	      << " threads " << nthreads
+	      << " ops " << (uint64_t) ops
+	      << " ops/s " << (uint64_t) (ops / res.secs)
+	      << " conflicts " << res.conflicts
+	      << " p50 " << percentile(sorted, 50) / 1000.0
+	      << "us p99 " << percentile(sorted, 99) / 1000.0
+	      << "us p99.9 " << percentile(sorted, 99.9) / 1000.0
+	      << "us" << std::endl;
+
+    EXPECT_EQ(res.errors, 0U);
+    return res;
+  }
+
+} /* namespace */
+
+TEST(LOCK_BENCH, INIT)
+{
+  fsal_status_t status;
+  static struct req_op_context req_ctx;
+
+  a_export = get_gsh_export(export_id);
+  ASSERT_NE(a_export, nullptr);
+
+  status = nfs_export_get_root_entry(a_export, &root_entry);
+  ASSERT_FALSE(FSAL_IS_ERROR(status));
+  ASSERT_NE(root_entry, nullptr);
+
+  memset(&user_credentials, 0, sizeof(struct user_cred));
+
+  /* stashed in tls */
+  set_op_ctx(&req_ctx);
+}
+
+TEST(LOCK_BENCH, PRELOAD)
+{
+  fsal_status_t status;
+  struct attrlist attrs;
+  struct sockaddr_storage client_addr;
+
+  memset(&attrs, 0, sizeof(attrs));
+  FSAL_SET_MASK(attrs.valid_mask, ATTR_MODE);
+  attrs.mode = 0755;
+
+  status = fsal_create(root_entry, "lock_bench", DIRECTORY, &attrs,
+		       nullptr, &test_root, nullptr);
+  ASSERT_FALSE(FSAL_IS_ERROR(status));
+
+  attrs.mode = 0644;
+  for (unsigned int f = 0; f < nfiles; ++f) {
+    struct fsal_obj_handle *obj = nullptr;
+
+    status = fsal_create(test_root, ("f" + std::to_string(f)).c_str(),
+			 REGULAR_FILE, &attrs, nullptr, &obj, nullptr);
+    ASSERT_FALSE(FSAL_IS_ERROR(status));
+    files.push_back(obj);
+  }
+
+  memset(&client_addr, 0, sizeof(client_addr));
+  client_addr.ss_family = AF_INET;
+
+  owners.resize(nowners);
+  for (unsigned int o = 0; o < nowners; ++o) {
+    struct bench_owner *bo = &owners[o];
+
+    bo->owner = get_9p_owner(&client_addr, o + 1);
+    ASSERT_NE(bo->owner, nullptr);
+
+    for (unsigned int f = 0; f < nfiles; ++f) {
+      struct state_t *state;
+
+      state = op_ctx->fsal_export->exp_ops.alloc_state(
+	op_ctx->fsal_export, STATE_TYPE_9P_FID, nullptr);
+      ASSERT_NE(state, nullptr);
+      glist_init(&state->state_data.fid.state_locklist);
+      state->state_refcount = 1;
+
+      status = fsal_open2(files[f], state, FSAL_O_RDWR, FSAL_NO_CREATE,
+			  nullptr, nullptr, nullptr, nullptr, nullptr);
+      ASSERT_FALSE(FSAL_IS_ERROR(status));
+      bo->states.push_back(state);
+    }
+  }
+}
+
+TEST(LOCK_BENCH, FILL)
+{
+  unsigned int n = nlocks * nfiles;
+
+  /* Lock l of every file before lock l + 1, so the lists grow evenly */
+  bench_result res = run_bench("FILL", nowners, n,
+			       [](unsigned int t, unsigned int i) {
+      unsigned int f = i % nfiles;
+
+      return lock_one(files[f], &owners[t], f, FSAL_LOCK_W,
+		      lock_start(t, i / nfiles));
+    });
+  EXPECT_EQ(res.conflicts, 0U);
+
+  /* Compare the first and last tenth of each thread's inserts */
+  unsigned int tenth = n / 10;
+  double early = 0, late = 0;
+
+  if (tenth == 0)
+    return;
+
+  for (unsigned int t = 0; t < nowners; ++t) {
+    for (unsigned int i = 0; i < tenth; ++i) {
+      early += res.nsecs[t * n + i];
+      late += res.nsecs[t * n + n - 1 - i];
+    }
+  }
+
+  double growth = late / std::max(early, 1.0);
+
+  std::cout << "FILL growth " << growth << " (last/first tenth of "
+	    << nowners * nlocks << " locks per file)" << std::endl;
+  if (max_growth > 0) {
+    EXPECT_LE(growth, max_growth);
+  }
+}
+
+TEST(LOCK_BENCH, TEST)
+{
+  run_bench("TEST", nowners, iters, [](unsigned int t, unsigned int i) {
+      thread_local std::mt19937 rng(t);
+      fsal_lock_param_t lock, conflict;
+      state_owner_t *holder = nullptr;
+      unsigned int f = i % nfiles;
+      unsigned int o = rng() % nowners;
+      state_status_t status;
+
+      set_lock(&lock, FSAL_LOCK_R, lock_start(o, rng() % nlocks));
+      status = state_test(files[f], owners[t].states[f], owners[t].owner,
+			  &lock, &holder, &conflict);
+      if (holder != nullptr)
+	dec_state_owner_ref(holder);
+      return status;
+    });
+}
+
+TEST(LOCK_BENCH, CONTEND)
+{
+  run_bench("CONTEND", nowners, iters, [](unsigned int t, unsigned int i) {
+      thread_local std::mt19937 rng(t);
+      unsigned int f = i % nfiles;
+      uint64_t start = contend_start(t, rng() % 100 < contention_pct);
+      state_status_t status;
+
+      status = lock_one(files[f], &owners[t], f, FSAL_LOCK_W, start);
+      if (status != STATE_SUCCESS)
+	return status;
+      return unlock_one(files[f], &owners[t], f, start);
+    });
+}
+
+TEST(LOCK_BENCH, UNLOCK)
+{
+  /* Newest first, so the list shrinks from the end a FILL grew */
+  run_bench("UNLOCK", nowners, nlocks * nfiles,
+	    [](unsigned int t, unsigned int i) {
+      unsigned int f = i % nfiles;
+
+      return unlock_one(files[f], &owners[t], f,
+			lock_start(t, nlocks - 1 - i / nfiles));
+    });
+}
+
+TEST(LOCK_BENCH, OPEN_CLOSE)
+{
+  std::vector<nfs_client_record_t *> records(nowners);
+  std::vector<state_owner_t *> open_owners(nowners);
+
+  for (unsigned int t = 0; t < nowners; ++t) {
+    std::string name = "lock_bench_client" + std::to_string(t);
+    nfs_client_cred_t cred;
+    nfs_client_id_t *clientid;
+    state_nfs4_owner_name_t owner_name;
+    bool_t isnew;
+
+    records[t] = get_client_record(name.c_str(), name.size(), 0, 0);
+    ASSERT_NE(records[t], nullptr);
+
+    memset(&cred, 0, sizeof(cred));
+    clientid = create_client_id(0, records[t], &cred, 1);
+    ASSERT_NE(clientid, nullptr);
+    ASSERT_EQ(nfs_client_id_insert(clientid), CLIENT_ID_SUCCESS);
+
+    owner_name.son_owner_len = name.size();
+    owner_name.son_owner_val = (char *) name.c_str();
+    open_owners[t] = create_nfs4_owner(&owner_name, clientid,
+				       STATE_OPEN_OWNER_NFSV4, nullptr, 0,
+				       &isnew, CARE_ALWAYS);
+    ASSERT_NE(open_owners[t], nullptr);
+  }
+
+  run_bench("OPEN_CLOSE", nowners, iters,
+	    [&open_owners](unsigned int t, unsigned int i) {
+      union state_data state_data;
+      struct state_t *state = nullptr;
+      state_status_t status;
+
+      memset(&state_data, 0, sizeof(state_data));
+      state_data.share.share_access = OPEN4_SHARE_ACCESS_BOTH;
+      status = state_add(files[(t + i) % nfiles], STATE_TYPE_SHARE,
+			 &state_data, open_owners[t], &state, nullptr);
+      if (status != STATE_SUCCESS)
+	return status;
+      state_del(state);
+      return STATE_SUCCESS;
+    });
+
+  for (unsigned int t = 0; t < nowners; ++t) {
+    dec_state_owner_ref(open_owners[t]);
+    dec_client_record_ref(records[t]);
+  }
+}
+
+TEST(LOCK_BENCH, CLEANUP)
+{
+  for (auto& bo : owners) {
+    for (unsigned int f = 0; f < nfiles; ++f) {
+      files[f]->obj_ops.close2(files[f], bo.states[f]);
+      op_ctx->fsal_export->exp_ops.free_state(op_ctx->fsal_export,
+					      bo.states[f]);
+    }
+    dec_state_owner_ref(bo.owner);
+  }
+  for (auto obj : files)
+    obj->obj_ops.put_ref(obj);
+}
+
+int main(int argc, char *argv[])
+{
+  int code = 0;
+
+  using namespace std;
+  using namespace std::literals;
+  namespace po = boost::program_options;
+
+  po::options_description opts("program options");
+  po::variables_map vm;
+
+  try {
+
+    opts.add_options()
+      ("config", po::value<string>(),
+	"path to Ganesha conf file")
+
+      ("logfile", po::value<string>(),
+	"log to the provided file path")
+
+      ("export", po::value<uint16_t>(),
+	"id of export on which to operate (must exist)")
+
+      ("debug", po::value<string>(),
+	"ganesha debug level")
+
+      ("files", po::value<unsigned int>(),
+	"number of files to lock (default 4)")
+
+      ("owners", po::value<unsigned int>(),
+	"lock owners, one thread each (default 8)")
+
+      ("locks", po::value<unsigned int>(),
+	"locks per owner per file in FILL (default 1000)")
+
+      ("contention-pct", po::value<unsigned int>(),
+	"percent of CONTEND ops on the shared range (default 10)")
+
+      ("iters", po::value<unsigned int>(),
+	"operations per thread in TEST, CONTEND and OPEN_CLOSE "
+	"(default 100000)")
+
+      ("max-growth", po::value<double>(),
+	"fail FILL if late inserts are this many times slower than "
+	"early ones, 0 to only report (default 8)")
+      ;
+
+    po::variables_map::iterator vm_iter;
+    po::store(po::parse_command_line(argc, argv, opts), vm);
+    po::notify(vm);
+
+    // use config vars--leaves them on the stack
+    vm_iter = vm.find("config");
+    if (vm_iter != vm.end()) {
+      ganesha_conf = (char*) vm_iter->second.as<std::string>().c_str();
+    }
+    vm_iter = vm.find("logfile");
+    if (vm_iter != vm.end()) {
+      lpath = (char*) vm_iter->second.as<std::string>().c_str();
+    }
+    vm_iter = vm.find("debug");
+    if (vm_iter != vm.end()) {
+      dlevel = ReturnLevelAscii(
+	(char*) vm_iter->second.as<std::string>().c_str());
+    }
+    vm_iter = vm.find("export");
+    if (vm_iter != vm.end()) {
+      export_id = vm_iter->second.as<uint16_t>();
+    }
+    vm_iter = vm.find("files");
+    if (vm_iter != vm.end()) {
+      nfiles = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+    vm_iter = vm.find("owners");
+    if (vm_iter != vm.end()) {
+      nowners = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+    vm_iter = vm.find("locks");
+    if (vm_iter != vm.end()) {
+      nlocks = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+    vm_iter = vm.find("contention-pct");
+    if (vm_iter != vm.end()) {
+      contention_pct = min(vm_iter->second.as<unsigned int>(), 100U);
+    }
+    vm_iter = vm.find("iters");
+    if (vm_iter != vm.end()) {
+      iters = vm_iter->second.as<unsigned int>();
+    }
+    vm_iter = vm.find("max-growth");
+    if (vm_iter != vm.end()) {
+      max_growth = vm_iter->second.as<double>();
+    }
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    std::thread ganesha(ganesha_server);
+    std::this_thread::sleep_for(5s);
+
+    code  = RUN_ALL_TESTS();
+    ganesha.join();
+  }
+
+  catch(po::error& e) {
+    cout << "Error parsing opts " << e.what() << endl;
+  }
+
+  catch(...) {
+    cout << "Unhandled exception in main()" << endl;
+  }
+
+  return code;
+}
@@ -0,0 +1,392 @@
+// -*- mode:C; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/*
+ * MDCACHE microbenchmarks
+ *
+ * Boots Ganesha on the given config, which should export FSAL_MEM
+ * (stacked under MDCACHE, the default) with the given export id.  A
+ * tree of --dirs directories holding --files files each is created,
+ * then each benchmark runs --iters times on --threads threads and
+ * reports ops/s:
+ *
+ *   LOOKUP		fsal_lookup of cached names
+ *   READDIR		fsal_readdir of whole directories (the chunked
+ *			readdir when Dir_Chunk is set, the default)
+ *   GETATTRS_HIT	getattrs of entries with trusted attributes
+ *   GETATTRS_MISS	getattrs after an attribute invalidate upcall
+ *   LRU_REAP		lookups of every file in the tree; with more files
+ *			than Entries_HWMark each one reaps an entry
+ */
+
+#include <sys/types.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <random>
+#include "gtest/gtest.h"
+#include <boost/program_options.hpp>
+
+extern "C" {
+/* Ganesha headers */
+#include "nfs_lib.h"
+#include "export_mgr.h"
+#include "nfs_exports.h"
+#include "sal_data.h"
+#include "fsal.h"
+#include "fsal_up.h"
+}
+
+namespace {
+
+  char* ganesha_conf = nullptr;
+  char* lpath = nullptr;
+  int dlevel = -1;
+  uint16_t export_id = 77;
+  unsigned int ndirs = 16;
+  unsigned int nfiles = 1024;
+  unsigned int iters = 100000;
+  unsigned int nthreads = 1;
+
+  struct user_cred user_credentials;
+
+  struct gsh_export* a_export = nullptr;
+  struct fsal_obj_handle *root_entry = nullptr;
+  struct fsal_obj_handle *test_root = nullptr;
+  std::vector<struct fsal_obj_handle *> dirs;
+
+  int ganesha_server() {
+    /* XXX */
+    return nfs_libmain(
+      ganesha_conf,
+      lpath,
+      dlevel
+      );
+  }
+
+  /* Ganesha call paths need real or forged context info, per thread */
+  void set_op_ctx(struct req_op_context *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->ctx_export = a_export;
+    ctx->fsal_export = a_export->fsal_export;
+    ctx->creds = &user_credentials;
+    op_ctx = ctx;
+  }
+
+  std::string file_name(unsigned int i) {
+    return "f" + std::to_string(i);
+  }
+
+  std::string dir_name(unsigned int i) {
+    return "d" + std::to_string(i);
+  }
+
+  /* Run fn(thread, iteration) iters times on each of nthreads threads */
+  template <typename F>
+  void run_bench(const char *name, F fn) {
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> errors(0);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int t = 0; t < nthreads; ++t) {
+      threads.emplace_back([t, &fn, &errors]() {
+	  struct req_op_context ctx;
+
+	  set_op_ctx(&ctx);
+	  for (unsigned int i = 0; i < iters; ++i)
+	    if (!fn(t, i))
+	      ++errors;
+	  op_ctx = nullptr;
+	});
+    }
+    for (auto& th : threads)
+      th.join();
+
+    std::chrono::duration<double> secs =
+      std::chrono::steady_clock::now() - start;
+    double ops = (double) iters * nthreads;
+
+    std::cout << std::left << std::setw(16) << name
+	      << " threads " << nthreads
+	      << " ops " << (uint64_t) ops
+	      << " secs " << secs.count()
+	      << " ops/s " << (uint64_t) (ops / secs.count())
+	      << std::endl;
+
+    EXPECT_EQ(errors.load(), 0U);
+  }
+
+  bool lookup_one(struct fsal_obj_handle *dir, const std::string& name) {
+    struct fsal_obj_handle *obj = nullptr;
+    fsal_status_t status;
+
+    status = fsal_lookup(dir, name.c_str(), &obj, nullptr);
+    if (FSAL_IS_ERROR(status))
+      return false;
+    obj->obj_ops.put_ref(obj);
+    return true;
+  }
+
+  fsal_errors_t readdir_count(void *opaque, struct fsal_obj_handle *obj,
+			      const struct attrlist *attr,
+			      uint64_t mounted_on_fileid, uint64_t cookie,
+			      enum cb_state cb_state) {
+    struct fsal_readdir_cb_parms *parms =
+      (struct fsal_readdir_cb_parms *) opaque;
+
+    parms->in_result = true;
+    return ERR_FSAL_NO_ERROR;
+  }
+
+  bool getattrs_one(struct fsal_obj_handle *obj) {
+    struct attrlist attrs;
+    fsal_status_t status;
+
+    fsal_prepare_attrs(&attrs, ATTRS_POSIX);
+    status = obj->obj_ops.getattrs(obj, &attrs);
+    fsal_release_attrs(&attrs);
+    return !FSAL_IS_ERROR(status);
+  }
+
+} /* namespace */
+
+TEST(MDCACHE_BENCH, INIT)
+{
+  fsal_status_t status;
+  static struct req_op_context req_ctx;
+
+  a_export = get_gsh_export(export_id);
+  ASSERT_NE(a_export, nullptr);
+
+  status = nfs_export_get_root_entry(a_export, &root_entry);
+  ASSERT_FALSE(FSAL_IS_ERROR(status));
+  ASSERT_NE(root_entry, nullptr);
+
+  memset(&user_credentials, 0, sizeof(struct user_cred));
+
+  /* stashed in tls */
+  set_op_ctx(&req_ctx);
+}
+
+TEST(MDCACHE_BENCH, PRELOAD)
+{
+  fsal_status_t status;
+  struct attrlist attrs;
+
+  memset(&attrs, 0, sizeof(attrs));
+  FSAL_SET_MASK(attrs.valid_mask, ATTR_MODE);
+  attrs.mode = 0755;
+
+  status = fsal_create(root_entry, "mdcache_bench", DIRECTORY, &attrs,
+		       nullptr, &test_root, nullptr);
+  ASSERT_FALSE(FSAL_IS_ERROR(status));
+
+  for (unsigned int d = 0; d < ndirs; ++d) {
+    struct fsal_obj_handle *dir = nullptr;
+
+    attrs.mode = 0755;
+    status = fsal_create(test_root, dir_name(d).c_str(), DIRECTORY,
+			 &attrs, nullptr, &dir, nullptr);
+    ASSERT_FALSE(FSAL_IS_ERROR(status));
+    dirs.push_back(dir);
+
+    attrs.mode = 0644;
+    for (unsigned int f = 0; f < nfiles; ++f) {
+      struct fsal_obj_handle *obj = nullptr;
+
+      status = fsal_create(dir, file_name(f).c_str(), REGULAR_FILE,
+			   &attrs, nullptr, &obj, nullptr);
+      ASSERT_FALSE(FSAL_IS_ERROR(status));
+      obj->obj_ops.put_ref(obj);
+    }
+  }
+}
+
+TEST(MDCACHE_BENCH, LOOKUP)
+{
+  /* Warm the cache */
+  for (unsigned int d = 0; d < ndirs; ++d)
+    for (unsigned int f = 0; f < nfiles; ++f)
+      lookup_one(dirs[d], file_name(f));
+
+  run_bench("LOOKUP", [](unsigned int t, unsigned int i) {
+      return lookup_one(dirs[(t + i) % ndirs], file_name(i % nfiles));
+    });
+}
+
+TEST(MDCACHE_BENCH, READDIR)
+{
+  unsigned int riters = iters / nfiles + 1;
+
+  std::swap(iters, riters);
+  run_bench("READDIR", [](unsigned int t, unsigned int i) {
+      unsigned int nbfound = 0;
+      bool eod = false;
+      fsal_status_t status;
+
+      status = fsal_readdir(dirs[(t + i) % ndirs], 0, &nbfound, &eod,
+			    ATTRS_POSIX, readdir_count, nullptr);
+      return !FSAL_IS_ERROR(status) && eod && nbfound == nfiles;
+    });
+  std::swap(iters, riters);
+}
+
+TEST(MDCACHE_BENCH, GETATTRS_HIT)
+{
+  run_bench("GETATTRS_HIT", [](unsigned int t, unsigned int i) {
+      return getattrs_one(dirs[(t + i) % ndirs]);
+    });
+}
+
+TEST(MDCACHE_BENCH, GETATTRS_MISS)
+{
+  const struct fsal_up_vector *up_ops =
+    a_export->fsal_export->sub_export->up_ops;
+
+  run_bench("GETATTRS_MISS", [up_ops](unsigned int t, unsigned int i) {
+      struct fsal_obj_handle *dir = dirs[(t + i) % ndirs];
+      struct gsh_buffdesc key;
+
+      dir->obj_ops.handle_to_key(dir, &key);
+      up_ops->invalidate(up_ops, &key, FSAL_UP_INVALIDATE_ATTRS);
+      return getattrs_one(dir);
+    });
+}
+
+TEST(MDCACHE_BENCH, LRU_REAP)
+{
+  std::mt19937 rng(8675309);
+  std::vector<unsigned int> order(ndirs * nfiles);
+
+  for (unsigned int n = 0; n < order.size(); ++n)
+    order[n] = n;
+  std::shuffle(order.begin(), order.end(), rng);
+
+  run_bench("LRU_REAP", [&order](unsigned int t, unsigned int i) {
+      unsigned int n = order[(i * nthreads + t) % order.size()];
+
+      return lookup_one(dirs[n / nfiles], file_name(n % nfiles));
+    });
+}
+
+int main(int argc, char *argv[])
+{
+  int code = 0;
+
+  using namespace std;
+  using namespace std::literals;
+  namespace po = boost::program_options;
+
+  po::options_description opts("program options");
+  po::variables_map vm;
+
+  try {
+
+    opts.add_options()
+      ("config", po::value<string>(),
+	"path to Ganesha conf file")
+
+      ("logfile", po::value<string>(),
+	"log to the provided file path")
+
+      ("export", po::value<uint16_t>(),
+	"id of export on which to operate (must exist)")
+
+      ("debug", po::value<string>(),
+	"ganesha debug level")
+
+      ("dirs", po::value<unsigned int>(),
+	"number of directories to preload (default 16)")
+
+      ("files", po::value<unsigned int>(),
+	"number of files per directory (default 1024)")
+
+      ("iters", po::value<unsigned int>(),
+	"operations per thread in each benchmark (default 100000)")
+
+      ("threads", po::value<unsigned int>(),
+	"threads running each benchmark (default 1)")
+      ;
+
+    po::variables_map::iterator vm_iter;
+    po::store(po::parse_command_line(argc, argv, opts), vm);
+    po::notify(vm);
+
+    // use config vars--leaves them on the stack
+    vm_iter = vm.find("config");
+    if (vm_iter != vm.end()) {
+      ganesha_conf = (char*) vm_iter->second.as<std::string>().c_str();
+    }
+    vm_iter = vm.find("logfile");
+    if (vm_iter != vm.end()) {
+      lpath = (char*) vm_iter->second.as<std::string>().c_str();
+    }
+    vm_iter = vm.find("debug");
+    if (vm_iter != vm.end()) {
+      dlevel = ReturnLevelAscii(
+	(char*) vm_iter->second.as<std::string>().c_str());
+    }
+    vm_iter = vm.find("export");
+    if (vm_iter != vm.end()) {
+      export_id = vm_iter->second.as<uint16_t>();
+    }
+    vm_iter = vm.find("dirs");
+    if (vm_iter != vm.end()) {
+      ndirs = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+    vm_iter = vm.find("files");
+    if (vm_iter != vm.end()) {
+      nfiles = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+    vm_iter = vm.find("iters");
+    if (vm_iter != vm.end()) {
+      iters = vm_iter->second.as<unsigned int>();
+    }
+    vm_iter = vm.find("threads");
+    if (vm_iter != vm.end()) {
+      nthreads = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    std::thread ganesha(ganesha_server);
+    std::this_thread::sleep_for(5s);
+
+    code  = RUN_ALL_TESTS();
+    ganesha.join();
+  }
+
+  catch(po::error& e) {
+    cout << "Error parsing opts " << e.what() << endl;
+  }
+
+  catch(...) {
+    cout << "Unhandled exception in main()" << endl;
+  }
+
+  return code;
+}
@@ -0,0 +1,528 @@
+// -*- mode:C; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/*
+ * Request pipeline and DRC benchmarks
+ *
+ * Boots Ganesha on the given config, then:
+ *
+ *   DISPATCH	opens --conns TCP connections to 127.0.0.1:--port, each
+ *		with a thread sending --iters hand encoded NFSv3 calls
+ *		one at a time: NULL, which never reaches an FSAL, and
+ *		--getattr-pct percent GETATTR of the export root, which
+ *		with FSAL_MEM stays in memory.  Each call goes through
+ *		decode, enqueue, dequeue and execute on the server.
+ *		Reports ops/s and latency percentiles; the worker count
+ *		is the config's Nb_Worker.
+ *
+ *   DRC	drives nfs_dupreq_start/finish/rele directly from
+ *		--threads threads over --drc-conns fake TCP transports,
+ *		replaying --dup-pct percent of the requests.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <random>
+#include "gtest/gtest.h"
+#include <boost/program_options.hpp>
+
+extern "C" {
+/* Ganesha headers */
+#include "nfs_lib.h"
+#include "export_mgr.h"
+#include "nfs_exports.h"
+#include "nfs_file_handle.h"
+#include "nfs_proto_functions.h"
+#include "nfs_dupreq.h"
+#include "fsal.h"
+}
+
+namespace {
+
+  char* ganesha_conf = nullptr;
+  char* lpath = nullptr;
+  int dlevel = -1;
+  uint16_t export_id = 77;
+  uint16_t port = 2049;
+  unsigned int nconns = 16;
+  unsigned int iters = 10000;
+  unsigned int getattr_pct = 0;
+  unsigned int nthreads = 4;
+  unsigned int drc_conns = 1024;
+  unsigned int drc_iters = 100000;
+  unsigned int dup_pct = 1;
+
+  struct gsh_export* a_export = nullptr;
+  std::vector<uint8_t> root_fh;
+
+  int ganesha_server() {
+    /* XXX */
+    return nfs_libmain(
+      ganesha_conf,
+      lpath,
+      dlevel
+      );
+  }
+
+  void report(const char *name, uint64_t ops, double secs,
+	      std::vector<double>& lat) {
+    std::cout << std::left << std::setw(10) << name
+	      << " ops " << ops
+	      << " secs " << secs
+	      << " ops/s " << (uint64_t) (ops / secs);
+
+    if (!lat.empty()) {
+      std::sort(lat.begin(), lat.end());
+      for (double p : {0.5, 0.9, 0.99, 0.999})
+	std::cout << " p" << p * 100 << " "
+		  << lat[(size_t) (p * (lat.size() - 1))] << "us";
+    }
+    std::cout << std::endl;
+  }
+
+  /* Minimal XDR for the calls we send */
+  void put32(std::vector<uint8_t>& b, uint32_t v) {
+    b.push_back(v >> 24);
+    b.push_back(v >> 16);
+    b.push_back(v >> 8);
+    b.push_back(v);
+  }
+
+  void put_opaque(std::vector<uint8_t>& b, const uint8_t *p, uint32_t len) {
+    put32(b, len);
+    b.insert(b.end(), p, p + len);
+    while (b.size() % 4)
+      b.push_back(0);
+  }
+
+  std::vector<uint8_t> encode_call(uint32_t xid, uint32_t proc) {
+    std::vector<uint8_t> b;
+    static const uint8_t machine[] = "bench";
+
+    put32(b, 0);	/* record mark, filled in below */
+    put32(b, xid);
+    put32(b, 0);	/* CALL */
+    put32(b, 2);	/* RPC version */
+    put32(b, nfs_param.core_param.program[P_NFS]);
+    put32(b, 3);
+    put32(b, proc);
+
+    /* AUTH_SYS as root, then a null verifier */
+    put32(b, 1);
+    put32(b, 28);
+    put32(b, 0);
+    put_opaque(b, machine, sizeof(machine) - 1);
+    put32(b, 0);
+    put32(b, 0);
+    put32(b, 0);
+    put32(b, 0);
+    put32(b, 0);
+
+    if (proc == NFSPROC3_GETATTR)
+      put_opaque(b, root_fh.data(), root_fh.size());
+
+    uint32_t rm = 0x80000000 | (b.size() - 4);
+
+    b[0] = rm >> 24;
+    b[1] = rm >> 16;
+    b[2] = rm >> 8;
+    b[3] = rm;
+    return b;
+  }
+
+  bool read_full(int fd, void *buf, size_t len) {
+    uint8_t *p = (uint8_t *) buf;
+
+    while (len > 0) {
+      ssize_t n = read(fd, p, len);
+
+      if (n <= 0)
+	return false;
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  /* Read one reply record, checking its xid and accept status */
+  bool read_reply(int fd, uint32_t xid) {
+    std::vector<uint8_t> body;
+    uint32_t rm;
+
+    do {
+      size_t off = body.size();
+
+      if (!read_full(fd, &rm, sizeof(rm)))
+	return false;
+      rm = ntohl(rm);
+      body.resize(off + (rm & 0x7fffffff));
+      if (!read_full(fd, body.data() + off, rm & 0x7fffffff))
+	return false;
+    } while (!(rm & 0x80000000));
+
+    if (body.size() < 24)
+      return false;
+
+    auto get32 = [&body](size_t off) {
+      return ((uint32_t) body[off] << 24) | (body[off + 1] << 16) |
+	(body[off + 2] << 8) | body[off + 3];
+    };
+    uint32_t verf_len = get32(16);
+
+    /* xid, REPLY, MSG_ACCEPTED, verifier, SUCCESS */
+    return get32(0) == xid && get32(4) == 1 && get32(8) == 0 &&
+      body.size() >= 24 + verf_len + 4 &&
+      get32(20 + ((verf_len + 3) & ~3U)) == 0;
+  }
+
+  int connect_server() {
+    struct sockaddr_in sin;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+
+    if (fd < 0)
+      return -1;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr *) &sin, sizeof(sin)) < 0) {
+      close(fd);
+      return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+  }
+
+} /* namespace */
+
+TEST(RPC_BENCH, INIT)
+{
+  fsal_status_t status;
+  struct fsal_obj_handle *root_entry = nullptr;
+  struct req_op_context req_ctx;
+  struct user_cred user_credentials;
+  nfs_fh3 fh3;
+
+  a_export = get_gsh_export(export_id);
+  ASSERT_NE(a_export, nullptr);
+
+  memset(&user_credentials, 0, sizeof(struct user_cred));
+  memset(&req_ctx, 0, sizeof(struct req_op_context));
+  req_ctx.ctx_export = a_export;
+  req_ctx.fsal_export = a_export->fsal_export;
+  req_ctx.creds = &user_credentials;
+  op_ctx = &req_ctx;
+
+  status = nfs_export_get_root_entry(a_export, &root_entry);
+  ASSERT_FALSE(FSAL_IS_ERROR(status));
+
+  /* The handle a client would have got from MOUNT */
+  memset(&fh3, 0, sizeof(fh3));
+  ASSERT_TRUE(nfs3_FSALToFhandle(true, &fh3, root_entry, a_export));
+  root_fh.assign((uint8_t *) fh3.data.data_val,
+		 (uint8_t *) fh3.data.data_val + fh3.data.data_len);
+  gsh_free(fh3.data.data_val);
+
+  root_entry->obj_ops.put_ref(root_entry);
+  op_ctx = nullptr;
+}
+
+TEST(RPC_BENCH, DISPATCH)
+{
+  std::vector<std::thread> threads;
+  std::vector<std::vector<double>> lats(nconns);
+  std::atomic<uint64_t> errors(0);
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (unsigned int c = 0; c < nconns; ++c) {
+    threads.emplace_back([c, &lats, &errors]() {
+	std::mt19937 rng(c);
+	int fd = connect_server();
+
+	if (fd < 0) {
+	  errors += iters;
+	  return;
+	}
+
+	lats[c].reserve(iters);
+	for (unsigned int i = 0; i < iters; ++i) {
+	  uint32_t xid = (c << 20) ^ i;
+	  uint32_t proc = rng() % 100 < getattr_pct ?
+	    NFSPROC3_GETATTR : NFSPROC3_NULL;
+	  std::vector<uint8_t> call = encode_call(xid, proc);
+	  auto t0 = std::chrono::steady_clock::now();
+
+	  if (write(fd, call.data(), call.size()) != (ssize_t) call.size() ||
+	      !read_reply(fd, xid)) {
+	    ++errors;
+	    break;
+	  }
+
+	  std::chrono::duration<double, std::micro> us =
+	    std::chrono::steady_clock::now() - t0;
+	  lats[c].push_back(us.count());
+	}
+	close(fd);
+      });
+  }
+  for (auto& th : threads)
+    th.join();
+
+  std::chrono::duration<double> secs =
+    std::chrono::steady_clock::now() - start;
+  std::vector<double> lat;
+
+  for (auto& l : lats)
+    lat.insert(lat.end(), l.begin(), l.end());
+
+  std::cout << "workers " << nfs_param.core_param.nb_worker
+	    << " conns " << nconns
+	    << " getattr " << getattr_pct << "%" << std::endl;
+  report("DISPATCH", lat.size(), secs.count(), lat);
+
+  EXPECT_EQ(errors.load(), 0U);
+}
+
+TEST(RPC_BENCH, DRC)
+{
+  std::vector<SVCXPRT> xprts(drc_conns);
+  std::vector<struct sockaddr_in> addrs(drc_conns);
+  std::vector<std::thread> threads;
+  const nfs_function_desc_t *func = &nfs3_func_desc[NFSPROC3_SETATTR];
+  std::atomic<uint64_t> hits(0);
+
+  /* Just enough of a TCP transport for the DRC: a type, a peer
+   * address to key the per-connection DRC on, and xp_u2 to hang it on.
+   */
+  for (unsigned int c = 0; c < drc_conns; ++c) {
+    struct netbuf *nb;
+
+    memset(&xprts[c], 0, sizeof(xprts[c]));
+    xprts[c].xp_type = XPRT_TCP;
+
+    memset(&addrs[c], 0, sizeof(addrs[c]));
+    addrs[c].sin_family = AF_INET;
+    addrs[c].sin_port = htons(1024 + c % 60000);
+    addrs[c].sin_addr.s_addr = htonl(0x0a000000 + c / 60000);
+
+    nb = svc_getcaller_netbuf(&xprts[c]);
+    nb->buf = &addrs[c];
+    nb->len = sizeof(addrs[c]);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (unsigned int t = 0; t < nthreads; ++t) {
+    threads.emplace_back([t, &xprts, func, &hits]() {
+	std::mt19937 rng(t);
+	nfs_request_t reqnfs;
+
+	/* Threads own disjoint connections, connection c being thread
+	 * c % nthreads's, so each sees its calls in xid order.
+	 */
+	unsigned int owned = (xprts.size() + nthreads - 1 - t) / nthreads;
+
+	for (unsigned int i = 0; owned > 0 && i < drc_iters; ++i) {
+	  unsigned int c = t + nthreads * (i % owned);
+	  uint32_t xid = i / owned;
+	  dupreq_status_t status;
+
+	  if (xid > 0 && rng() % 100 < dup_pct)
+	    --xid;
+
+	  memset(&reqnfs, 0, sizeof(reqnfs));
+	  reqnfs.svc.rq_xprt = &xprts[c];
+	  reqnfs.svc.rq_msg.rm_xid = xid;
+	  reqnfs.svc.rq_msg.cb_prog = nfs_param.core_param.program[P_NFS];
+	  reqnfs.svc.rq_msg.cb_vers = 3;
+	  reqnfs.svc.rq_msg.cb_proc = NFSPROC3_SETATTR;
+	  reqnfs.svc.rq_cksum = ((uint64_t) c << 32) | xid;
+	  reqnfs.funcdesc = func;
+
+	  status = nfs_dupreq_start(&reqnfs, &reqnfs.svc);
+	  if (status == DUPREQ_SUCCESS)
+	    (void) nfs_dupreq_finish(&reqnfs.svc, reqnfs.res_nfs);
+	  else if (status == DUPREQ_EXISTS)
+	    ++hits;
+	  else
+	    continue;
+	  nfs_dupreq_rele(&reqnfs.svc, func);
+	}
+      });
+  }
+  for (auto& th : threads)
+    th.join();
+
+  std::chrono::duration<double> secs =
+    std::chrono::steady_clock::now() - start;
+  std::vector<double> nolat;
+
+  std::cout << "threads " << nthreads
+	    << " conns " << drc_conns
+	    << " hits " << hits.load() << std::endl;
+  report("DRC", (uint64_t) drc_iters * nthreads, secs.count(), nolat);
+
+  for (auto& x : xprts)
+    if (x.xp_u2)
+      nfs_dupreq_put_drc(&x, (drc_t *) x.xp_u2, DRC_FLAG_RELEASE);
+}
+
+int main(int argc, char *argv[])
+{
+  int code = 0;
+
+  using namespace std;
+  using namespace std::literals;
+  namespace po = boost::program_options;
+
+  po::options_description opts("program options");
+  po::variables_map vm;
+
+  try {
+
+    opts.add_options()
+      ("config", po::value<string>(),
+	"path to Ganesha conf file")
+
+      ("logfile", po::value<string>(),
+	"log to the provided file path")
+
+      ("export", po::value<uint16_t>(),
+	"id of export on which to operate (must exist)")
+
+      ("debug", po::value<string>(),
+	"ganesha debug level")
+
+      ("port", po::value<uint16_t>(),
+	"NFS port of the server (default 2049)")
+
+      ("conns", po::value<unsigned int>(),
+	"client connections for DISPATCH (default 16)")
+
+      ("iters", po::value<unsigned int>(),
+	"calls per connection for DISPATCH (default 10000)")
+
+      ("getattr-pct", po::value<unsigned int>(),
+	"percent of DISPATCH calls that are GETATTR (default 0)")
+
+      ("threads", po::value<unsigned int>(),
+	"threads for DRC (default 4)")
+
+      ("drc-conns", po::value<unsigned int>(),
+	"transports for DRC (default 1024)")
+
+      ("drc-iters", po::value<unsigned int>(),
+	"requests per thread for DRC (default 100000)")
+
+      ("dup-pct", po::value<unsigned int>(),
+	"percent of DRC requests that are retransmissions (default 1)")
+      ;
+
+    po::variables_map::iterator vm_iter;
+    po::store(po::parse_command_line(argc, argv, opts), vm);
+    po::notify(vm);
+
+    // use config vars--leaves them on the stack
+    vm_iter = vm.find("config");
+    if (vm_iter != vm.end()) {
+      ganesha_conf = (char*) vm_iter->second.as<std::string>().c_str();
+    }
+    vm_iter = vm.find("logfile");
+    if (vm_iter != vm.end()) {
+      lpath = (char*) vm_iter->second.as<std::string>().c_str();
+    }
+    vm_iter = vm.find("debug");
+    if (vm_iter != vm.end()) {
+      dlevel = ReturnLevelAscii(
+	(char*) vm_iter->second.as<std::string>().c_str());
+    }
+    vm_iter = vm.find("export");
+    if (vm_iter != vm.end()) {
+      export_id = vm_iter->second.as<uint16_t>();
+    }
+    vm_iter = vm.find("port");
+    if (vm_iter != vm.end()) {
+      port = vm_iter->second.as<uint16_t>();
+    }
+    vm_iter = vm.find("conns");
+    if (vm_iter != vm.end()) {
+      nconns = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+    vm_iter = vm.find("iters");
+    if (vm_iter != vm.end()) {
+      iters = vm_iter->second.as<unsigned int>();
+    }
+    vm_iter = vm.find("getattr-pct");
+    if (vm_iter != vm.end()) {
+      getattr_pct = min(vm_iter->second.as<unsigned int>(), 100U);
+    }
+    vm_iter = vm.find("threads");
+    if (vm_iter != vm.end()) {
+      nthreads = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+    vm_iter = vm.find("drc-conns");
+    if (vm_iter != vm.end()) {
+      drc_conns = max(vm_iter->second.as<unsigned int>(), 1U);
+    }
+    vm_iter = vm.find("drc-iters");
+    if (vm_iter != vm.end()) {
+      drc_iters = vm_iter->second.as<unsigned int>();
+    }
+    vm_iter = vm.find("dup-pct");
+    if (vm_iter != vm.end()) {
+      dup_pct = min(vm_iter->second.as<unsigned int>(), 100U);
+    }
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    std::thread ganesha(ganesha_server);
+    std::this_thread::sleep_for(5s);
+
+    code  = RUN_ALL_TESTS();
+    ganesha.join();
+  }
+
+  catch(po::error& e) {
+    cout << "Error parsing opts " << e.what() << endl;
+  }
+
+  catch(...) {
+    cout << "Unhandled exception in main()" << endl;
+  }
+
+  return code;
+}
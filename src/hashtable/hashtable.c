@@ -39,6 +39,13 @@
  * determines which of the partitions (each containing a tree and each
  * separately locked), and a hash which acts as the key within an
  * individual Red-Black Tree.
+ *
+ * A table created with a resize_load grows its number of partitions
+ * when one of them holds more than that many entries.  The resize runs
+ * on a thread of its own, locks every partition, moves the entries to
+ * a new set of partitions and publishes it; lookups that raced with it
+ * notice the set changed once they hold their partition lock and try
+ * again.
  */
 
 #include "config.h"
@@ -50,7 +57,14 @@
 #include "log.h"
 #include "abstract_atomic.h"
 #include "common_utils.h"
+#include "gsh_intrinsic.h"
+#include "city.h"
+#include "murmur3.h"
+#include "crc32c.h"
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /**
  * @brief Total size of the cache page configured for a table
@@ -121,6 +135,40 @@ hash_table_err_to_str(hash_error_t err)
 	return "UNKNOWN HASH TABLE ERROR";
 }
 
+/**
+ * @brief Hash a key's bytes
+ *
+ * Computes the value a table with key_hash set uses for both its
+ * partition index (the upper 32 bits) and its red-black tree hash.
+ *
+ * @param[in] func Hash function, not HT_HASH_TABLE
+ * @param[in] addr Key bytes
+ * @param[in] len  Length of the key
+ *
+ * @return The 64 bit hash.
+ */
+uint64_t
+hashtable_hash_bytes(enum hash_key_func func, const void *addr, size_t len)
+{
+	uint64_t out[2];
+
+	switch (func) {
+	case HT_HASH_CITY:
+		return CityHash64(addr, len);
+	case HT_HASH_MURMUR3:
+		MurmurHash3_x64_128(addr, len, 0, out);
+		return out[0];
+	case HT_HASH_CRC32C:
+		return ((uint64_t) crc32c(0, addr, len) << 32) |
+			crc32c(0x9e3779b9, addr, len);
+	case HT_HASH_TABLE:
+		break;
+	}
+
+	LogFatal(COMPONENT_HASHTABLE, "No hash function %d", func);
+	return 0;
+}
+
 /**
  * @brief Locate a key within a partition
  *
@@ -244,7 +292,11 @@ compute(struct hash_table *ht, const struct gsh_buffdesc *key,
 	uint32_t *index, uint64_t *rbt_hash)
 {
 	/* Compute the partition index and red-black tree hash */
-	if (ht->parameter.hash_func_both) {
+	if (ht->parameter.key_hash != HT_HASH_TABLE) {
+		*rbt_hash = hashtable_hash_bytes(ht->parameter.key_hash,
+						 key->addr, key->len);
+		*index = (*rbt_hash >> 32) % ht->parameter.index_size;
+	} else if (ht->parameter.hash_func_both) {
 		if (!(*(ht->parameter.hash_func_both))
 		    (&ht->parameter, (struct gsh_buffdesc *)key, index,
 		     rbt_hash))
@@ -268,6 +320,494 @@ compute(struct hash_table *ht, const struct gsh_buffdesc *key,
 	return HASHTABLE_SUCCESS;
 }
 
+/*
+ * Open addressing partitions
+ *
+ * With HT_FLAG_OPEN a partition is an array of groups of
+ * HASH_OPEN_GROUP slots instead of a red-black tree.  A key hashes to a
+ * home group and a 7 bit tag; a lookup compares the tag against all
+ * tags of a group at once (one SSE2 compare where available) and only
+ * compares keys for slots whose tag matches, moving on to the next
+ * group of a triangular probe sequence until it meets a group with an
+ * empty slot.  Deleted slots keep a tombstone when their group is full,
+ * since a probe may have passed through it; tombstones are purged when
+ * the partition is regrown.
+ *
+ * The partition lock protects the slots exactly as it does the tree,
+ * so the latch protocol and its guarantees are unchanged.
+ */
+
+#define HASH_OPEN_EMPTY 0x80
+#define HASH_OPEN_DELETED 0xFE
+
+/** Grow once more than 7/8 of the slots are full or deleted */
+#define HASH_OPEN_MAX_LOAD(groups) ((groups) * HASH_OPEN_GROUP / 8 * 7)
+
+/**
+ * @brief Spread the caller's hash over all 64 bits
+ *
+ * The partition hash of several tables is weak in the low or high
+ * bits, and both are used here.
+ */
+static inline uint64_t hash_open_mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static inline uint8_t hash_open_tag(uint64_t mixed)
+{
+	return mixed >> 57;
+}
+
+/**
+ * @brief Find the slots of a group with a given tag
+ *
+ * @return A bit mask with bit i set if tags[i] is tag.
+ */
+static inline uint32_t hash_open_match(const uint8_t *tags, uint8_t tag)
+{
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((const __m128i *)tags);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+	uint32_t match = 0;
+	int i;
+
+	for (i = 0; i < HASH_OPEN_GROUP; i++)
+		if (tags[i] == tag)
+			match |= 1U << i;
+
+	return match;
+#endif
+}
+
+/**
+ * @brief Allocate empty groups for a partition
+ */
+static void hash_open_alloc(struct hash_open *open, uint32_t ngroups)
+{
+	uint32_t i;
+
+	open->groups = gsh_malloc_tag(GSH_MEM_HASHTABLE,
+				      ngroups * sizeof(struct hash_open_group));
+	for (i = 0; i < ngroups; i++)
+		memset(open->groups[i].tags, HASH_OPEN_EMPTY,
+		       sizeof(open->groups[i].tags));
+	open->mask = ngroups - 1;
+	open->used = 0;
+}
+
+/**
+ * @brief Free the groups of a partition, if it has any
+ */
+static void hash_open_free(struct hash_open *open)
+{
+	if (open->groups == NULL)
+		return;
+
+	gsh_free_tag(GSH_MEM_HASHTABLE, open->groups,
+		     (open->mask + 1) * sizeof(struct hash_open_group));
+	open->groups = NULL;
+}
+
+/**
+ * @brief Look a key up in an open addressing partition
+ *
+ * @note The partition lock MUST be held
+ */
+static hash_error_t hash_open_locate(struct hash_table *ht,
+				     struct hash_partition *partition,
+				     const struct gsh_buffdesc *key,
+				     uint64_t rbthash,
+				     struct hash_open_slot **slot)
+{
+	struct hash_open *open = &partition->open;
+	uint64_t mixed = hash_open_mix(rbthash);
+	uint8_t tag = hash_open_tag(mixed);
+	uint32_t g = mixed & open->mask;
+	uint32_t probe, match;
+	struct hash_open_group *group;
+	int i;
+
+	*slot = NULL;
+
+	for (probe = 0; probe <= open->mask; probe++) {
+		group = &open->groups[g];
+
+		for (match = hash_open_match(group->tags, tag); match != 0;
+		     match &= match - 1) {
+			i = __builtin_ctz(match);
+
+			if (group->slots[i].hash == mixed &&
+			    ht->parameter.compare_key(
+					(struct gsh_buffdesc *)key,
+					&group->slots[i].data.key) == 0) {
+				*slot = &group->slots[i];
+				return HASHTABLE_SUCCESS;
+			}
+		}
+
+		if (hash_open_match(group->tags, HASH_OPEN_EMPTY) != 0)
+			break;
+
+		g = (g + probe + 1) & open->mask;
+	}
+
+	if (isFullDebug(COMPONENT_HASHTABLE)
+	    && isFullDebug(ht->parameter.ht_log_component))
+		LogFullDebug(ht->parameter.ht_log_component,
+			     "Key not found: rbthash = %" PRIu64, rbthash);
+
+	return HASHTABLE_ERROR_NO_SUCH_KEY;
+}
+
+/**
+ * @brief Claim a free slot for a hash
+ *
+ * There always is one, the partition is grown before it fills.
+ */
+static struct hash_open_slot *hash_open_claim(struct hash_open *open,
+					      uint64_t mixed)
+{
+	uint32_t g = mixed & open->mask;
+	uint32_t probe, match;
+	struct hash_open_group *group;
+	int i;
+
+	for (probe = 0; ; probe++) {
+		group = &open->groups[g];
+		match = hash_open_match(group->tags, HASH_OPEN_EMPTY) |
+			hash_open_match(group->tags, HASH_OPEN_DELETED);
+
+		if (match != 0) {
+			i = __builtin_ctz(match);
+			if (group->tags[i] == HASH_OPEN_EMPTY)
+				open->used++;
+			group->tags[i] = hash_open_tag(mixed);
+			group->slots[i].hash = mixed;
+			return &group->slots[i];
+		}
+
+		g = (g + probe + 1) & open->mask;
+	}
+}
+
+/**
+ * @brief Make room for one more entry
+ *
+ * Doubles the partition when more than half of it is live, otherwise
+ * rebuilds it at the same size to drop the tombstones.
+ *
+ * @note The partition lock MUST be held for write
+ */
+static void hash_open_reserve(struct hash_partition *partition)
+{
+	struct hash_open *open = &partition->open;
+	struct hash_open_group *old = open->groups;
+	uint32_t oldgroups = open->mask + 1;
+	uint32_t ngroups = oldgroups;
+	struct hash_open_slot *slot;
+	uint32_t g;
+	int i;
+
+	if (open->used < HASH_OPEN_MAX_LOAD(oldgroups))
+		return;
+
+	if (partition->count >= oldgroups * HASH_OPEN_GROUP / 2)
+		ngroups *= 2;
+
+	hash_open_alloc(open, ngroups);
+
+	for (g = 0; g < oldgroups; g++) {
+		for (i = 0; i < HASH_OPEN_GROUP; i++) {
+			if (old[g].tags[i] & HASH_OPEN_EMPTY)
+				continue;
+
+			slot = hash_open_claim(open, old[g].slots[i].hash);
+			slot->data = old[g].slots[i].data;
+		}
+	}
+
+	gsh_free_tag(GSH_MEM_HASHTABLE, old,
+		     oldgroups * sizeof(struct hash_open_group));
+}
+
+/**
+ * @brief Empty a slot
+ *
+ * @note The partition lock MUST be held for write
+ */
+static void hash_open_release(struct hash_open *open,
+			      struct hash_open_slot *slot)
+{
+	uint32_t g = ((char *)slot - (char *)open->groups) /
+		     sizeof(struct hash_open_group);
+	struct hash_open_group *group = &open->groups[g];
+	int i = slot - group->slots;
+
+	/* A group that ever filled up may have been probed through */
+	if (hash_open_match(group->tags, HASH_OPEN_EMPTY) != 0) {
+		group->tags[i] = HASH_OPEN_EMPTY;
+		open->used--;
+	} else {
+		group->tags[i] = HASH_OPEN_DELETED;
+	}
+}
+
+/**
+ * @brief Allocate and initialize a set of partitions
+ *
+ * @param[in] ht         The table the partitions are for
+ * @param[in] size       Number of partitions
+ * @param[in] rwlockattr Attributes for the partition locks
+ *
+ * @return The new set or NULL if a lock could not be initialized.
+ */
+static struct hash_generation *
+hash_generation_alloc(struct hash_table *ht, uint32_t size,
+		      pthread_rwlockattr_t *rwlockattr)
+{
+	struct hash_generation *gen;
+	struct hash_partition *partition;
+	uint32_t index;
+
+	gen = gsh_calloc(1, sizeof(struct hash_generation) +
+			 (sizeof(struct hash_partition) * size));
+	gen->size = size;
+
+	for (index = 0; index < size; ++index) {
+		partition = &gen->partitions[index];
+		RBT_HEAD_INIT(&(partition->rbt));
+
+		if (pthread_rwlock_init(&partition->lock, rwlockattr) != 0) {
+			LogCrit(COMPONENT_HASHTABLE,
+				"Unable to initialize lock in hash table.");
+			goto deconstruct;
+		}
+
+		if (ht->parameter.flags & HT_FLAG_OPEN)
+			hash_open_alloc(&partition->open, 1);
+		/* Allocate a cache if requested */
+		else if (ht->parameter.flags & HT_FLAG_CACHE)
+			partition->cache = gsh_calloc(1, cache_page_size(ht));
+	}
+
+	return gen;
+
+ deconstruct:
+
+	while (index != 0) {
+		index--;
+		gsh_free(gen->partitions[index].cache);
+		hash_open_free(&gen->partitions[index].open);
+		PTHREAD_RWLOCK_destroy(&gen->partitions[index].lock);
+	}
+
+	gsh_free(gen);
+	return NULL;
+}
+
+/**
+ * @brief Free a set of partitions and all the sets it replaced
+ */
+static void hash_generation_free(struct hash_generation *gen)
+{
+	struct hash_generation *prev;
+	uint32_t index;
+
+	while (gen != NULL) {
+		for (index = 0; index < gen->size; ++index) {
+			gsh_free(gen->partitions[index].cache);
+			hash_open_free(&gen->partitions[index].open);
+			PTHREAD_RWLOCK_destroy(&gen->partitions[index].lock);
+		}
+
+		prev = gen->prev;
+		gsh_free(gen);
+		gen = prev;
+	}
+}
+
+/**
+ * @brief Pick the number of partitions to grow to
+ *
+ * @return The smallest prime past twice the size, at most
+ *         HASHTABLE_MAX_INDEX.
+ */
+static uint32_t hash_grow_size(uint32_t size)
+{
+	uint32_t next, d;
+
+	if (size >= HASHTABLE_MAX_INDEX / 2)
+		return HASHTABLE_MAX_INDEX;
+
+	for (next = size * 2 + 1; ; next += 2) {
+		for (d = 3; d * d <= next; d += 2)
+			if (next % d == 0)
+				break;
+
+		if (d * d > next)
+			return next;
+	}
+}
+
+/**
+ * @brief Move the entries of one old partition into the new set
+ *
+ * @note All partition locks of the old set MUST be held for write and
+ *       the table parameters must already give the new size.
+ */
+static void hash_migrate(struct hash_table *ht, struct hash_partition *old,
+			 struct hash_generation *gen)
+{
+	struct hash_partition *partition;
+	struct hash_data *data;
+	struct rbt_node *cursor, *locator;
+	uint32_t index;
+	uint64_t rbt_hash;
+
+	if (ht->parameter.flags & HT_FLAG_OPEN) {
+		struct hash_open *open = &old->open;
+		struct hash_open_slot *slot;
+		uint32_t g;
+		int i;
+
+		for (g = 0; g <= open->mask; g++) {
+			for (i = 0; i < HASH_OPEN_GROUP; i++) {
+				if (open->groups[g].tags[i] & HASH_OPEN_EMPTY)
+					continue;
+
+				data = &open->groups[g].slots[i].data;
+				(void) compute(ht, &data->key, &index,
+					       &rbt_hash);
+				partition = &gen->partitions[index];
+
+				hash_open_reserve(partition);
+				slot = hash_open_claim(&partition->open,
+						       hash_open_mix(rbt_hash));
+				slot->data = *data;
+				++partition->count;
+			}
+		}
+
+		hash_open_free(open);
+		old->count = 0;
+		return;
+	}
+
+	while ((cursor = RBT_LEFTMOST(&old->rbt)) != NULL) {
+		RBT_UNLINK(&old->rbt, cursor);
+		data = RBT_OPAQ(cursor);
+		(void) compute(ht, &data->key, &index, &rbt_hash);
+		partition = &gen->partitions[index];
+
+		RBT_FIND(&partition->rbt, locator, RBT_VALUE(cursor));
+		RBT_INSERT(&partition->rbt, cursor, locator);
+		++partition->count;
+	}
+
+	/* Nodes in the old cache are all in the new set now */
+	gsh_free(old->cache);
+	old->cache = NULL;
+	old->count = 0;
+}
+
+/**
+ * @brief Grow the partitions of a table
+ *
+ * Walkers are kept out by the resize lock and lookups by the
+ * partition locks, so the whole table stops for as long as it takes
+ * to move its entries.  That is done rarely, each resize at least
+ * doubles the partitions.
+ *
+ * @param[in] arg The hash table
+ *
+ * @return NULL.
+ */
+static void *hash_resize_thread(void *arg)
+{
+	struct hash_table *ht = arg;
+	struct hash_generation *old, *gen;
+	uint32_t size, index;
+
+	PTHREAD_RWLOCK_wrlock(&ht->resize_lock);
+
+	old = ht->generation;
+	size = hash_grow_size(old->size);
+
+	if (size <= old->size)
+		goto out;
+
+	gen = hash_generation_alloc(ht, size, NULL);
+	if (gen == NULL)
+		goto out;
+
+	for (index = 0; index < old->size; index++)
+		PTHREAD_RWLOCK_wrlock(&old->partitions[index].lock);
+
+	/* The hash functions take the number of partitions from the
+	 * table parameters.
+	 */
+	atomic_store_uint32_t(&ht->parameter.index_size, size);
+
+	for (index = 0; index < old->size; index++)
+		hash_migrate(ht, &old->partitions[index], gen);
+
+	gen->prev = old;
+	ht->partitions = gen->partitions;
+	atomic_store_voidptr((void **)&ht->generation, gen);
+
+	for (index = 0; index < old->size; index++)
+		PTHREAD_RWLOCK_unlock(&old->partitions[index].lock);
+
+	LogEvent(COMPONENT_HASHTABLE,
+		 "Hash table %s grown from %" PRIu32 " to %" PRIu32
+		 " partitions", ht->parameter.ht_name, old->size, size);
+
+ out:
+	atomic_store_int32_t(&ht->resizing, 0);
+	PTHREAD_RWLOCK_unlock(&ht->resize_lock);
+
+	return NULL;
+}
+
+/**
+ * @brief Queue a resize of a table unless one is already pending
+ */
+static void hash_resize(struct hash_table *ht)
+{
+	pthread_attr_t attr;
+	pthread_t tid;
+
+	if (!atomic_cas_int32_t(&ht->resizing, 0, 1))
+		return;
+
+	if (pthread_attr_init(&attr) != 0)
+		goto fail;
+
+	if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0 ||
+	    pthread_create(&tid, &attr, hash_resize_thread, ht) != 0) {
+		pthread_attr_destroy(&attr);
+		goto fail;
+	}
+
+	pthread_attr_destroy(&attr);
+	return;
+
+ fail:
+	LogMajor(COMPONENT_HASHTABLE,
+		 "Could not start a resize of hash table %s",
+		 ht->parameter.ht_name);
+	atomic_store_int32_t(&ht->resizing, 0);
+}
+
 /* The following are the hash table primitives implementing the
    actual functionality. */
 
@@ -288,15 +828,9 @@ hashtable_init(struct hash_param *hparam)
 {
 	/* The hash table being constructed */
 	struct hash_table *ht = NULL;
-	/* The index for initializing each partition */
-	uint32_t index = 0;
 	/* Read-Write Lock attributes, to prevent write starvation under
 	   GLIBC */
 	pthread_rwlockattr_t rwlockattr;
-	/* Hash partition */
-	struct hash_partition *partition = NULL;
-	/* The number of fully initialized partitions */
-	uint32_t completed = 0;
 
 	if (pthread_rwlockattr_init(&rwlockattr) != 0)
 		return NULL;
@@ -313,9 +847,7 @@ hashtable_init(struct hash_param *hparam)
 	}
 #endif				/* GLIBC */
 
-	ht = gsh_calloc(1, sizeof(struct hash_table) +
-			(sizeof(struct hash_partition) *
-			 hparam->index_size));
+	ht = gsh_calloc(1, sizeof(struct hash_table));
 
 	/* Fixup entry size */
 	if (hparam->flags & HT_FLAG_CACHE) {
@@ -326,43 +858,25 @@ hashtable_init(struct hash_param *hparam)
 
 	/* We need to save copy of the parameters in the table. */
 	ht->parameter = *hparam;
-	for (index = 0; index < hparam->index_size; ++index) {
-		partition = (&ht->partitions[index]);
-		RBT_HEAD_INIT(&(partition->rbt));
-
-		if (pthread_rwlock_init(&partition->lock, &rwlockattr) != 0) {
-			LogCrit(COMPONENT_HASHTABLE,
-				"Unable to initialize lock in hash table.");
-			goto deconstruct;
-		}
-
-		/* Allocate a cache if requested */
-		if (hparam->flags & HT_FLAG_CACHE)
-			partition->cache = gsh_calloc(1, cache_page_size(ht));
+	ht->generation = hash_generation_alloc(ht, hparam->index_size,
+					       &rwlockattr);
+	if (ht->generation == NULL)
+		goto deconstruct;
 
-		completed++;
-	}
+	ht->partitions = ht->generation->partitions;
+	PTHREAD_RWLOCK_init(&ht->resize_lock, NULL);
 
-	ht->node_pool = pool_basic_init(NULL, sizeof(rbt_node_t));
-	ht->data_pool = pool_basic_init(NULL, sizeof(struct hash_data));
+	ht->node_pool = pool_tagged_init(NULL, sizeof(rbt_node_t),
+					 GSH_MEM_HASHTABLE);
+	ht->data_pool = pool_tagged_init(NULL, sizeof(struct hash_data),
+					 GSH_MEM_HASHTABLE);
 
 	pthread_rwlockattr_destroy(&rwlockattr);
 	return ht;
 
  deconstruct:
 
-	while (completed != 0) {
-		if (hparam->flags & HT_FLAG_CACHE)
-			gsh_free(ht->partitions[completed - 1].cache);
-
-		PTHREAD_RWLOCK_destroy(&(ht->partitions[completed - 1].lock));
-		completed--;
-	}
-	if (ht->node_pool)
-		pool_destroy(ht->node_pool);
-	if (ht->data_pool)
-		pool_destroy(ht->data_pool);
-
+	pthread_rwlockattr_destroy(&rwlockattr);
 	gsh_free(ht);
 	return ht = NULL;
 }
@@ -386,21 +900,18 @@ hashtable_destroy(struct hash_table *ht,
 		  int (*free_func)(struct gsh_buffdesc,
 				   struct gsh_buffdesc))
 {
-	size_t index = 0;
 	hash_error_t hrc = HASHTABLE_SUCCESS;
 
 	hrc = hashtable_delall(ht, free_func);
 	if (hrc != HASHTABLE_SUCCESS)
 		goto out;
 
-	for (index = 0; index < ht->parameter.index_size; ++index) {
-		if (ht->partitions[index].cache) {
-			gsh_free(ht->partitions[index].cache);
-			ht->partitions[index].cache = NULL;
-		}
+	/* Wait out a resize still running */
+	PTHREAD_RWLOCK_wrlock(&ht->resize_lock);
+	PTHREAD_RWLOCK_unlock(&ht->resize_lock);
+	PTHREAD_RWLOCK_destroy(&ht->resize_lock);
 
-		PTHREAD_RWLOCK_destroy(&(ht->partitions[index].lock));
-	}
+	hash_generation_free(ht->generation);
 	pool_destroy(ht->node_pool);
 	pool_destroy(ht->data_pool);
 	gsh_free(ht);
@@ -439,8 +950,14 @@ hashtable_getlatch(struct hash_table *ht,
 {
 	/* The index specifying the partition to search */
 	uint32_t index = 0;
+	/* The set of partitions searched */
+	struct hash_generation *gen;
+	/* The partition searched */
+	struct hash_partition *partition;
 	/* The node found for the key */
 	struct rbt_node *locator = NULL;
+	/* The slot found for the key, with HT_FLAG_OPEN */
+	struct hash_open_slot *slot = NULL;
 	/* The buffer descritpros for the key and value for the found entry */
 	struct hash_data *data = NULL;
 	/* The hash value to be searched for within the Red-Black tree */
@@ -451,21 +968,40 @@ hashtable_getlatch(struct hash_table *ht,
 	/* This combination of options makes no sense ever */
 	assert(!(may_write && !latch));
 
+	/* A resize may replace the partitions until we hold the lock of
+	 * one of the current set.
+	 */
+ retry:
+	gen = atomic_fetch_voidptr((void **)&ht->generation);
+
 	rc = compute(ht, key, &index, &rbt_hash);
 	if (rc != HASHTABLE_SUCCESS)
 		return rc;
 
+	if (unlikely(index >= gen->size))
+		goto retry;
+
+	partition = &gen->partitions[index];
+
 	/* Acquire mutex */
 	if (may_write)
-		PTHREAD_RWLOCK_wrlock(&(ht->partitions[index].lock));
+		PTHREAD_RWLOCK_wrlock(&partition->lock);
 	else
-		PTHREAD_RWLOCK_rdlock(&(ht->partitions[index].lock));
+		PTHREAD_RWLOCK_rdlock(&partition->lock);
+
+	if (unlikely(gen != atomic_fetch_voidptr((void **)&ht->generation))) {
+		PTHREAD_RWLOCK_unlock(&partition->lock);
+		goto retry;
+	}
 
-	rc = key_locate(ht, key, index, rbt_hash, &locator);
+	if (ht->parameter.flags & HT_FLAG_OPEN)
+		rc = hash_open_locate(ht, partition, key, rbt_hash, &slot);
+	else
+		rc = key_locate(ht, key, index, rbt_hash, &locator);
 
 	if (rc == HASHTABLE_SUCCESS) {
 		/* Key was found */
-		data = RBT_OPAQ(locator);
+		data = slot != NULL ? &slot->data : RBT_OPAQ(locator);
 		if (val) {
 			val->addr = data->val.addr;
 			val->len = data->val.len;
@@ -492,8 +1028,9 @@ hashtable_getlatch(struct hash_table *ht,
 		latch->index = index;
 		latch->rbt_hash = rbt_hash;
 		latch->locator = locator;
+		latch->slot = slot;
 	} else {
-		PTHREAD_RWLOCK_unlock(&ht->partitions[index].lock);
+		PTHREAD_RWLOCK_unlock(&partition->lock);
 	}
 
 	if (rc != HASHTABLE_SUCCESS && isDebug(COMPONENT_HASHTABLE)
@@ -571,6 +1108,8 @@ hashtable_setlatched(struct hash_table *ht,
 	struct rbt_node *locator = NULL;
 	/* New node for the case of non-overwrite */
 	struct rbt_node *mutator = NULL;
+	/* The partition has outgrown the table */
+	bool grow = false;
 
 	if (isDebug(COMPONENT_HASHTABLE)
 	    && isFullDebug(ht->parameter.ht_log_component)) {
@@ -595,13 +1134,14 @@ hashtable_setlatched(struct hash_table *ht,
 	}
 
 	/* In the case of collision */
-	if (latch->locator) {
+	if (latch->locator || latch->slot) {
 		if (!overwrite) {
 			rc = HASHTABLE_ERROR_KEY_ALREADY_EXISTS;
 			goto out;
 		}
 
-		descriptors = RBT_OPAQ(latch->locator);
+		descriptors = latch->slot != NULL ? &latch->slot->data
+						  : RBT_OPAQ(latch->locator);
 
 		if (isDebug(COMPONENT_HASHTABLE)
 		    && isFullDebug(ht->parameter.ht_log_component)) {
@@ -644,6 +1184,21 @@ hashtable_setlatched(struct hash_table *ht,
 	/* We have no collision, so go about creating and inserting a new
 	   node. */
 
+	if (ht->parameter.flags & HT_FLAG_OPEN) {
+		struct hash_partition *partition =
+					&ht->partitions[latch->index];
+
+		hash_open_reserve(partition);
+		descriptors = &hash_open_claim(&partition->open,
+					       hash_open_mix(latch->rbt_hash))
+								->data;
+		descriptors->key = *key;
+		descriptors->val = *val;
+		++partition->count;
+		rc = HASHTABLE_SUCCESS;
+		goto grown;
+	}
+
 	RBT_FIND(&ht->partitions[latch->index].rbt, locator, latch->rbt_hash);
 
 	mutator = pool_alloc(ht->node_pool);
@@ -665,9 +1220,17 @@ hashtable_setlatched(struct hash_table *ht,
 
 	rc = HASHTABLE_SUCCESS;
 
+ grown:
+	grow = ht->parameter.resize_load != 0 &&
+	       ht->partitions[latch->index].count > ht->parameter.resize_load &&
+	       ht->parameter.index_size < HASHTABLE_MAX_INDEX;
+
  out:
 	hashtable_releaselatched(ht, latch);
 
+	if (grow)
+		hash_resize(ht);
+
 	if (rc != HASHTABLE_SUCCESS && isDebug(COMPONENT_HASHTABLE)
 	    && isFullDebug(ht->parameter.ht_log_component))
 		LogFullDebug(ht->parameter.ht_log_component,
@@ -707,7 +1270,8 @@ void hashtable_deletelatched(struct hash_table *ht,
 	/* Its partition */
 	struct hash_partition *partition = &ht->partitions[latch->index];
 
-	data = RBT_OPAQ(latch->locator);
+	data = latch->slot != NULL ? &latch->slot->data
+				   : RBT_OPAQ(latch->locator);
 
 	if (isDebug(COMPONENT_HASHTABLE)
 	    && isFullDebug(ht->parameter.ht_log_component)) {
@@ -738,6 +1302,13 @@ void hashtable_deletelatched(struct hash_table *ht,
 	if (stored_val)
 		*stored_val = data->val;
 
+	if (latch->slot != NULL) {
+		hash_open_release(&partition->open, latch->slot);
+		--partition->count;
+		latch->slot = NULL;
+		return;
+	}
+
 	/* Clear cache */
 	if (partition->cache) {
 		uint32_t offset = cache_offsetof(ht, latch->rbt_hash);
@@ -796,6 +1367,10 @@ hashtable_delall(struct hash_table *ht,
 {
 	/* Successive partition numbers */
 	uint32_t index = 0;
+	/* Return code */
+	hash_error_t hrc = HASHTABLE_SUCCESS;
+
+	hashtable_walk_begin(ht);
 
 	for (index = 0; index < ht->parameter.index_size; index++) {
 		/* The root of each successive partition */
@@ -805,6 +1380,35 @@ hashtable_delall(struct hash_table *ht,
 
 		PTHREAD_RWLOCK_wrlock(&ht->partitions[index].lock);
 
+		if (ht->parameter.flags & HT_FLAG_OPEN) {
+			struct hash_open *open = &ht->partitions[index].open;
+			struct hash_open_group *group;
+			uint32_t g;
+			int i;
+
+			for (g = 0; g <= open->mask; g++) {
+				group = &open->groups[g];
+				for (i = 0; i < HASH_OPEN_GROUP; i++) {
+					if (group->tags[i] & HASH_OPEN_EMPTY)
+						continue;
+
+					hash_open_release(open,
+							  &group->slots[i]);
+					--ht->partitions[index].count;
+
+					if (free_func(group->slots[i].data.key,
+						      group->slots[i].data.val)
+					    == 0) {
+						PTHREAD_RWLOCK_unlock(
+						    &ht->partitions[index].lock);
+						hrc =
+						    HASHTABLE_ERROR_DELALL_FAIL;
+						goto out;
+					}
+				}
+			}
+		}
+
 		/* Continue until there are no more entries in the red-black
 		   tree */
 		while ((cursor = RBT_LEFTMOST(root)) != NULL) {
@@ -836,13 +1440,17 @@ hashtable_delall(struct hash_table *ht,
 			if (rc == 0) {
 				PTHREAD_RWLOCK_unlock(&ht->partitions[index].
 						      lock);
-				return HASHTABLE_ERROR_DELALL_FAIL;
+				hrc = HASHTABLE_ERROR_DELALL_FAIL;
+				goto out;
 			}
 		}
 		PTHREAD_RWLOCK_unlock(&ht->partitions[index].lock);
 	}
 
-	return HASHTABLE_SUCCESS;
+ out:
+	hashtable_walk_end(ht);
+
+	return hrc;
 }
 
 /**
@@ -877,6 +1485,8 @@ hashtable_log(log_components_t component, struct hash_table *ht)
 	/* Recomputed hash for Red-Black tree */
 	uint64_t rbt_hash = 0;
 
+	hashtable_walk_begin(ht);
+
 	LogFullDebug(component, "The hash is partitioned into %d trees",
 		     ht->parameter.index_size);
 
@@ -885,6 +1495,39 @@ hashtable_log(log_components_t component, struct hash_table *ht)
 
 	LogFullDebug(component, "The hash contains %zd entries", nb_entries);
 
+	if (ht->parameter.flags & HT_FLAG_OPEN) {
+		for (i = 0; i < ht->parameter.index_size; i++) {
+			struct hash_open *open = &ht->partitions[i].open;
+			uint32_t g;
+			int j;
+
+			LogFullDebug(component,
+				     "The partition in position %" PRIu32
+				     " contains: %zu entries in %" PRIu32
+				     " slots", i, ht->partitions[i].count,
+				     (open->mask + 1) * HASH_OPEN_GROUP);
+			PTHREAD_RWLOCK_rdlock(&ht->partitions[i].lock);
+			for (g = 0; g <= open->mask; g++) {
+				for (j = 0; j < HASH_OPEN_GROUP; j++) {
+					if (open->groups[g].tags[j] &
+					    HASH_OPEN_EMPTY)
+						continue;
+
+					data = &open->groups[g].slots[j].data;
+					ht->parameter.key_to_str(&data->key,
+								 dispkey);
+					ht->parameter.val_to_str(&data->val,
+								 dispval);
+					LogFullDebug(component, "%s => %s",
+						     dispkey, dispval);
+				}
+			}
+			PTHREAD_RWLOCK_unlock(&ht->partitions[i].lock);
+		}
+		hashtable_walk_end(ht);
+		return;
+	}
+
 	for (i = 0; i < ht->parameter.index_size; i++) {
 		root = &ht->partitions[i].rbt;
 		LogFullDebug(component,
@@ -912,6 +1555,35 @@ hashtable_log(log_components_t component, struct hash_table *ht)
 		}
 		PTHREAD_RWLOCK_unlock(&ht->partitions[i].lock);
 	}
+
+	hashtable_walk_end(ht);
+}
+
+/**
+ * @brief Start walking the partitions of a table
+ *
+ * Code that loops over ht->partitions itself must bracket the loop
+ * with hashtable_walk_begin and hashtable_walk_end, so the table does
+ * not grow under it.  Lookups and updates of the same table are fine
+ * inside the walk.
+ *
+ * @param[in] ht The hash table to walk
+ */
+
+void hashtable_walk_begin(struct hash_table *ht)
+{
+	PTHREAD_RWLOCK_rdlock(&ht->resize_lock);
+}
+
+/**
+ * @brief Done walking the partitions of a table
+ *
+ * @param[in] ht The hash table walked
+ */
+
+void hashtable_walk_end(struct hash_table *ht)
+{
+	PTHREAD_RWLOCK_unlock(&ht->resize_lock);
 }
 
 /**
@@ -52,10 +52,16 @@
 #include "common_utils.h"
 #include "gsh_rpc.h"
 #include "nfs_core.h"
+#include "gsh_inflight.h"
 #include "idmapper.h"
 
 static struct gsh_buffdesc owner_domain;
 
+/* Directory lookups in progress, keyed by a 'u' or 'g' and the name or
+ * id, so that a burst of misses on one owner makes a single lookup.
+ */
+static struct gsh_inflight idmapper_inflight = GSH_INFLIGHT_INITIALIZER;
+
 /**
  * @brief Initialize the ID Mapper
  *
@@ -90,6 +96,64 @@ bool idmapper_init(void)
 	return true;
 }
 
+/**
+ * @brief Encode the cached name for a UID or GID
+ *
+ * @param[in,out] xdrs    XDR stream to which to encode
+ * @param[in]     id      UID or GID
+ * @param[in]     group   True if this is a GID, false for a UID
+ * @param[out]    success Result of the encoding
+ *
+ * @retval true if the id was in the cache.
+ * @retval false if it was not, and nothing was encoded.
+ */
+
+static bool xdr_encode_cached_princ(XDR *xdrs, uint32_t id, bool group,
+				    bool *success)
+{
+	const struct gsh_buffdesc *found;
+	uint32_t not_a_size_t;
+	int64_t *reader;
+	bool hit;
+
+	/* Most owners are in the front cache, which needs no lock */
+	reader = gsh_rcu_read_lock(&idmapper_rcu);
+	if (group)
+		hit = idmapper_peek_by_gid(id, &found);
+	else
+		hit = idmapper_peek_by_uid(id, &found, NULL);
+
+	if (likely(hit)) {
+		not_a_size_t = found->len;
+		*success =
+		    inline_xdr_bytes(xdrs, (char **)&found->addr, &not_a_size_t,
+				     UINT32_MAX);
+	}
+	gsh_rcu_read_unlock(reader);
+	if (likely(hit))
+		return true;
+
+	PTHREAD_RWLOCK_rdlock(group ? &idmapper_group_lock :
+			      &idmapper_user_lock);
+	if (group)
+		hit = idmapper_lookup_by_gid(id, &found);
+	else
+		hit = idmapper_lookup_by_uid(id, &found, NULL);
+
+	if (likely(hit)) {
+		not_a_size_t = found->len;
+
+		/* Fully qualified owners are always stored in the
+		   hash table, no matter what our lookup method. */
+		*success =
+		    inline_xdr_bytes(xdrs, (char **)&found->addr, &not_a_size_t,
+				     UINT32_MAX);
+	}
+	PTHREAD_RWLOCK_unlock(group ? &idmapper_group_lock :
+			      &idmapper_user_lock);
+	return hit;
+}
+
 /**
  * @brief Encode a UID or GID as a string
  *
@@ -103,9 +167,17 @@ bool idmapper_init(void)
 
 static bool xdr_encode_nfs4_princ(XDR *xdrs, uint32_t id, bool group)
 {
-	const struct gsh_buffdesc *found;
+	enum gsh_inflight_status status;
 	uint32_t not_a_size_t;
 	bool success = false;
+	bool waited = false;
+	char key[1 + sizeof(id)];
+	int slot;
+	int rc;
+	int size;
+	bool looked_up = false;
+	char *namebuff = NULL;
+	struct gsh_buffdesc new_name;
 
 	if (nfs_param.nfsv4_param.only_numeric_owners) {
 		/* 2**32 is 10 digits long in decimal */
@@ -120,146 +192,141 @@ static bool xdr_encode_nfs4_princ(XDR *xdrs, uint32_t id, bool group)
 					&not_a_size_t, UINT32_MAX);
 	}
 
-	PTHREAD_RWLOCK_rdlock(group ? &idmapper_group_lock :
-			      &idmapper_user_lock);
-	if (group)
-		success = idmapper_lookup_by_gid(id, &found);
-	else
-		success = idmapper_lookup_by_uid(id, &found, NULL);
+	key[0] = group ? 'g' : 'u';
+	memcpy(key + 1, &id, sizeof(id));
 
-	if (likely(success)) {
-		not_a_size_t = found->len;
+	/* If someone else is already looking this id up, wait for them
+	 * and try the cache again.
+	 */
+	for (;;) {
+		if (xdr_encode_cached_princ(xdrs, id, group, &success))
+			return success;
+		if (waited) {
+			status = GSH_INFLIGHT_FULL;
+			break;
+		}
+		status = gsh_inflight_begin(&idmapper_inflight, key,
+					    sizeof(key), &slot);
+		if (status != GSH_INFLIGHT_WAITED)
+			break;
+		waited = true;
+	}
 
-		/* Fully qualified owners are always stored in the
-		   hash table, no matter what our lookup method. */
-		success =
-		    inline_xdr_bytes(xdrs, (char **)&found->addr, &not_a_size_t,
-				     UINT32_MAX);
-		PTHREAD_RWLOCK_unlock(group ? &idmapper_group_lock :
-				      &idmapper_user_lock);
-		return success;
+	if (nfs_param.nfsv4_param.use_getpwnam) {
+		if (group)
+			size = sysconf(_SC_GETGR_R_SIZE_MAX);
+		else
+			size = sysconf(_SC_GETPW_R_SIZE_MAX);
+		if (size == -1)
+			size = PWENT_BEST_GUESS_LEN;
+		new_name.len = size;
+		size += owner_domain.len + 2;
 	} else {
-		PTHREAD_RWLOCK_unlock(group ? &idmapper_group_lock :
-				      &idmapper_user_lock);
-		int rc;
-		int size;
-		bool looked_up = false;
-		char *namebuff = NULL;
-		struct gsh_buffdesc new_name;
-
-		if (nfs_param.nfsv4_param.use_getpwnam) {
-			if (group)
-				size = sysconf(_SC_GETGR_R_SIZE_MAX);
-			else
-				size = sysconf(_SC_GETPW_R_SIZE_MAX);
-			if (size == -1)
-				size = PWENT_BEST_GUESS_LEN;
-			new_name.len = size;
-			size += owner_domain.len + 2;
-		} else {
-			size = NFS4_MAX_DOMAIN_LEN + 2;
-		}
+		size = NFS4_MAX_DOMAIN_LEN + 2;
+	}
 
-		namebuff = alloca(size);
+	namebuff = alloca(size);
 
-		new_name.addr = namebuff;
+	new_name.addr = namebuff;
 
-		if (nfs_param.nfsv4_param.use_getpwnam) {
-			char *cursor;
-			bool nulled;
+	if (nfs_param.nfsv4_param.use_getpwnam) {
+		char *cursor;
+		bool nulled;
 
-			if (group) {
-				struct group g;
-				struct group *gres;
+		if (group) {
+			struct group g;
+			struct group *gres;
 
-				rc = getgrgid_r(id, &g, namebuff, new_name.len,
-						&gres);
-				nulled = (gres == NULL);
-			} else {
-				struct passwd p;
-				struct passwd *pres;
+			rc = getgrgid_r(id, &g, namebuff, new_name.len,
+					&gres);
+			nulled = (gres == NULL);
+		} else {
+			struct passwd p;
+			struct passwd *pres;
 
-				rc = getpwuid_r(id, &p, namebuff, new_name.len,
-						&pres);
-				nulled = (pres == NULL);
-			}
+			rc = getpwuid_r(id, &p, namebuff, new_name.len,
+					&pres);
+			nulled = (pres == NULL);
+		}
 
-			if ((rc == 0) && !nulled) {
-				new_name.len = strlen(namebuff);
-				cursor = namebuff + new_name.len;
-				*(cursor++) = '@';
-				++new_name.len;
-				memcpy(cursor, owner_domain.addr,
-				       owner_domain.len);
-				new_name.len += owner_domain.len;
-				looked_up = true;
-			} else {
-				LogInfo(COMPONENT_IDMAPPER,
-					"%s failed with code %d.",
-					(group ? "getgrgid_r" : "getpwuid_r"),
-					rc);
-			}
+		if ((rc == 0) && !nulled) {
+			new_name.len = strlen(namebuff);
+			cursor = namebuff + new_name.len;
+			*(cursor++) = '@';
+			++new_name.len;
+			memcpy(cursor, owner_domain.addr,
+			       owner_domain.len);
+			new_name.len += owner_domain.len;
+			looked_up = true;
 		} else {
+			LogInfo(COMPONENT_IDMAPPER,
+				"%s failed with code %d.",
+				(group ? "getgrgid_r" : "getpwuid_r"),
+				rc);
+		}
+	} else {
 #ifdef USE_NFSIDMAP
-			if (group) {
-				rc = nfs4_gid_to_name(id, owner_domain.addr,
-						      namebuff,
-						      NFS4_MAX_DOMAIN_LEN + 1);
-			} else {
-				rc = nfs4_uid_to_name(id, owner_domain.addr,
-						      namebuff,
-						      NFS4_MAX_DOMAIN_LEN + 1);
-			}
-			if (rc == 0) {
-				new_name.len = strlen(namebuff);
-				looked_up = true;
-			} else {
-				LogInfo(COMPONENT_IDMAPPER,
-					"%s failed with code %d.",
-					(group ? "nfs4_gid_to_name" :
-					"nfs4_uid_to_name"), rc);
-			}
+		if (group) {
+			rc = nfs4_gid_to_name(id, owner_domain.addr,
+					      namebuff,
+					      NFS4_MAX_DOMAIN_LEN + 1);
+		} else {
+			rc = nfs4_uid_to_name(id, owner_domain.addr,
+					      namebuff,
+					      NFS4_MAX_DOMAIN_LEN + 1);
+		}
+		if (rc == 0) {
+			new_name.len = strlen(namebuff);
+			looked_up = true;
+		} else {
+			LogInfo(COMPONENT_IDMAPPER,
+				"%s failed with code %d.",
+				(group ? "nfs4_gid_to_name" :
+				"nfs4_uid_to_name"), rc);
+		}
 #else				/* USE_NFSIDMAP */
-			looked_up = false;
+		looked_up = false;
 #endif				/* !USE_NFSIDMAP */
-		}
+	}
 
-		if (!looked_up) {
-			if (nfs_param.nfsv4_param.allow_numeric_owners) {
-				LogInfo(COMPONENT_IDMAPPER,
-					"Lookup for %d failed, using numeric %s",
-					id, (group ? "group" : "owner"));
-				/* 2**32 is 10 digits long in decimal */
-				sprintf(namebuff, "%"PRIu32, id);
-				new_name.len = strlen(namebuff);
-			} else {
-				LogInfo(COMPONENT_IDMAPPER,
-					"Lookup for %d failed, using nobody.",
-					id);
-				memcpy(new_name.addr, "nobody", 6);
-				new_name.len = 6;
-			}
+	if (!looked_up) {
+		if (nfs_param.nfsv4_param.allow_numeric_owners) {
+			LogInfo(COMPONENT_IDMAPPER,
+				"Lookup for %d failed, using numeric %s",
+				id, (group ? "group" : "owner"));
+			/* 2**32 is 10 digits long in decimal */
+			sprintf(namebuff, "%"PRIu32, id);
+			new_name.len = strlen(namebuff);
+		} else {
+			LogInfo(COMPONENT_IDMAPPER,
+				"Lookup for %d failed, using nobody.",
+				id);
+			memcpy(new_name.addr, "nobody", 6);
+			new_name.len = 6;
 		}
+	}
 
-		/* Add to the cache and encode the result. */
-		PTHREAD_RWLOCK_wrlock(group ? &idmapper_group_lock :
-				      &idmapper_user_lock);
-		if (group)
-			success = idmapper_add_group(&new_name, id);
-		else
-			success = idmapper_add_user(&new_name, id, NULL, false);
+	/* Add to the cache and encode the result. */
+	PTHREAD_RWLOCK_wrlock(group ? &idmapper_group_lock :
+			      &idmapper_user_lock);
+	if (group)
+		success = idmapper_add_group(&new_name, id);
+	else
+		success = idmapper_add_user(&new_name, id, NULL, false);
 
-		PTHREAD_RWLOCK_unlock(group ? &idmapper_group_lock :
-				      &idmapper_user_lock);
-		if (unlikely(!success)) {
-			LogMajor(COMPONENT_IDMAPPER, "%s failed.",
-				 group ? "idmapper_add_group" :
-				 "idmaper_add_user");
-		}
-		not_a_size_t = new_name.len;
-		return inline_xdr_bytes(xdrs, (char **)&new_name.addr,
-					&not_a_size_t, UINT32_MAX);
+	PTHREAD_RWLOCK_unlock(group ? &idmapper_group_lock :
+			      &idmapper_user_lock);
+	if (unlikely(!success)) {
+		LogMajor(COMPONENT_IDMAPPER, "%s failed.",
+			 group ? "idmapper_add_group" :
+			 "idmaper_add_user");
 	}
+	if (status == GSH_INFLIGHT_OWNER)
+		gsh_inflight_end(&idmapper_inflight, slot);
+
+	not_a_size_t = new_name.len;
+	return inline_xdr_bytes(xdrs, (char **)&new_name.addr,
+				&not_a_size_t, UINT32_MAX);
 }
 
 /**
@@ -520,75 +587,111 @@ static bool idmapname2id(char *name, size_t len, uint32_t *id,
 static bool name2id(const struct gsh_buffdesc *name, uint32_t *id, bool group,
 		    const uint32_t anon)
 {
+	enum gsh_inflight_status status;
 	bool success;
+	bool waited = false;
+	int64_t *reader;
+	gid_t gid;
+	bool got_gid = false;
+	/* Something we can mutate and count on as terminated */
+	char *namebuff = alloca(name->len + 1);
+	char *key = alloca(name->len + 1);
+	char *at;
+	bool looked_up = false;
+	int slot;
+
+	key[0] = group ? 'g' : 'u';
+	memcpy(key + 1, name->addr, name->len);
+
+	/* If someone else is already looking this name up, wait for them
+	 * and try the cache again.
+	 */
+	for (;;) {
+		reader = gsh_rcu_read_lock(&idmapper_rcu);
+		if (group)
+			success = idmapper_peek_by_gname(name, id);
+		else
+			success = idmapper_peek_by_uname(name, id, NULL);
+		gsh_rcu_read_unlock(reader);
+		if (success)
+			return true;
 
-	PTHREAD_RWLOCK_rdlock(group ? &idmapper_group_lock :
-			      &idmapper_user_lock);
-	if (group)
-		success = idmapper_lookup_by_gname(name, id);
-	else
-		success = idmapper_lookup_by_uname(name, id, NULL, false);
-	PTHREAD_RWLOCK_unlock(group ? &idmapper_group_lock :
-			      &idmapper_user_lock);
-
-	if (success)
-		return true;
-	else {
-		gid_t gid;
-		bool got_gid = false;
-		/* Something we can mutate and count on as terminated */
-		char *namebuff = alloca(name->len + 1);
-		char *at;
-		bool looked_up = false;
-
-		memcpy(namebuff, name->addr, name->len);
-		*(namebuff + name->len) = '\0';
-		at = memchr(namebuff, '@', name->len);
-
-		if (at == NULL) {
-			if (pwentname2id
-			    (namebuff, name->len, id, anon, group, &gid,
-			     &got_gid, NULL))
-				looked_up = true;
-			else if (atless2id(namebuff, name->len, id, anon))
-				looked_up = true;
-			else
-				return false;
-		} else if (nfs_param.nfsv4_param.use_getpwnam) {
-			looked_up =
-			    pwentname2id(namebuff, name->len, id, anon, group,
-					 &gid, &got_gid, at);
-		} else {
-			looked_up =
-			    idmapname2id(namebuff, name->len, id, anon, group,
-					 &gid, &got_gid, at);
-		}
-
-		if (!looked_up) {
-			LogInfo(COMPONENT_IDMAPPER,
-				"All lookups failed for %s, using anonymous.",
-				namebuff);
-			*id = anon;
-		}
-
-		PTHREAD_RWLOCK_wrlock(group ? &idmapper_group_lock :
+		PTHREAD_RWLOCK_rdlock(group ? &idmapper_group_lock :
 				      &idmapper_user_lock);
 		if (group)
-			success = idmapper_add_group(name, *id);
+			success = idmapper_lookup_by_gname(name, id);
 		else
-			success =
-			    idmapper_add_user(name, *id, got_gid ? &gid : NULL,
-					      false);
-
+			success = idmapper_lookup_by_uname(name, id, NULL,
+							   false);
 		PTHREAD_RWLOCK_unlock(group ? &idmapper_group_lock :
 				      &idmapper_user_lock);
 
-		if (!success)
-			LogMajor(COMPONENT_IDMAPPER, "%s(%s %u) failed",
-				 (group ? "gidmap_add" : "uidmap_add"),
-				 namebuff, *id);
-		return true;
+		if (success)
+			return true;
+		if (waited) {
+			status = GSH_INFLIGHT_FULL;
+			break;
+		}
+		status = gsh_inflight_begin(&idmapper_inflight, key,
+					    name->len + 1, &slot);
+		if (status != GSH_INFLIGHT_WAITED)
+			break;
+		waited = true;
+	}
+
+	memcpy(namebuff, name->addr, name->len);
+	*(namebuff + name->len) = '\0';
+	at = memchr(namebuff, '@', name->len);
+
+	if (at == NULL) {
+		if (pwentname2id
+		    (namebuff, name->len, id, anon, group, &gid,
+		     &got_gid, NULL)) {
+			looked_up = true;
+		} else if (atless2id(namebuff, name->len, id, anon)) {
+			looked_up = true;
+		} else {
+			if (status == GSH_INFLIGHT_OWNER)
+				gsh_inflight_end(&idmapper_inflight, slot);
+			return false;
+		}
+	} else if (nfs_param.nfsv4_param.use_getpwnam) {
+		looked_up =
+		    pwentname2id(namebuff, name->len, id, anon, group,
+				 &gid, &got_gid, at);
+	} else {
+		looked_up =
+		    idmapname2id(namebuff, name->len, id, anon, group,
+				 &gid, &got_gid, at);
+	}
+
+	if (!looked_up) {
+		LogInfo(COMPONENT_IDMAPPER,
+			"All lookups failed for %s, using anonymous.",
+			namebuff);
+		*id = anon;
 	}
+
+	PTHREAD_RWLOCK_wrlock(group ? &idmapper_group_lock :
+			      &idmapper_user_lock);
+	if (group)
+		success = idmapper_add_group(name, *id);
+	else
+		success =
+		    idmapper_add_user(name, *id, got_gid ? &gid : NULL,
+				      false);
+
+	PTHREAD_RWLOCK_unlock(group ? &idmapper_group_lock :
+			      &idmapper_user_lock);
+
+	if (!success)
+		LogMajor(COMPONENT_IDMAPPER, "%s(%s %u) failed",
+			 (group ? "gidmap_add" : "uidmap_add"),
+			 namebuff, *id);
+
+	if (status == GSH_INFLIGHT_OWNER)
+		gsh_inflight_end(&idmapper_inflight, slot);
+	return true;
 }
 
 /**
@@ -649,6 +752,7 @@ bool principal2uid(char *principal, uid_t *uid, gid_t *gid)
 	uid_t gss_uid = -1;
 	gid_t gss_gid = -1;
 	const gid_t *gss_gidres = NULL;
+	int64_t *reader;
 	int rc;
 	bool success;
 	struct gsh_buffdesc princbuff = {
@@ -661,18 +765,28 @@ bool principal2uid(char *principal, uid_t *uid, gid_t *gid)
 		return false;
 
 #ifdef USE_NFSIDMAP
-	PTHREAD_RWLOCK_rdlock(&idmapper_user_lock);
-	success =
-	    idmapper_lookup_by_uname(&princbuff, &gss_uid, &gss_gidres, true);
-
-	/* We do need uid and gid. If gid is not in the cache, treat it as a
-	 * failure.
-	 */
+	reader = gsh_rcu_read_lock(&idmapper_rcu);
+	success = idmapper_peek_by_uname(&princbuff, &gss_uid, &gss_gidres);
 	if (success && gss_gidres != NULL)
 		gss_gid = *gss_gidres;
 	else
 		success = false;
-	PTHREAD_RWLOCK_unlock(&idmapper_user_lock);
+	gsh_rcu_read_unlock(reader);
+
+	if (!success) {
+		PTHREAD_RWLOCK_rdlock(&idmapper_user_lock);
+		success = idmapper_lookup_by_uname(&princbuff, &gss_uid,
+						   &gss_gidres, true);
+
+		/* We do need uid and gid. If gid is not in the cache, treat
+		 * it as a failure.
+		 */
+		if (success && gss_gidres != NULL)
+			gss_gid = *gss_gidres;
+		else
+			success = false;
+		PTHREAD_RWLOCK_unlock(&idmapper_user_lock);
+	}
 	if (unlikely(!success)) {
 		if ((princbuff.len >= 4)
 		    && (!memcmp(princbuff.addr, "nfs/", 4)
@@ -43,6 +43,7 @@
 #include "avltree.h"
 #include "idmapper.h"
 #include "abstract_atomic.h"
+#include "city.h"
 
 /**
  * @brief User entry in the IDMapper cache
@@ -93,6 +94,38 @@ static struct avltree_node *uid_cache[id_cache_size];
 
 static struct avltree_node *gid_cache[id_cache_size];
 
+/**
+ * @brief User name cache, indexed by a hash of the name, with the same
+ * rules as the UID cache.
+ */
+
+static struct avltree_node *uname_cache[id_cache_size];
+
+/**
+ * @brief Group name cache, indexed by a hash of the name, with the same
+ * rules as the GID cache.
+ */
+
+static struct avltree_node *gname_cache[id_cache_size];
+
+/**
+ * @brief Read side sections for the front caches
+ *
+ * The four caches above can also be read without either lock, between
+ * gsh_rcu_read_lock() and gsh_rcu_read_unlock() on this, with the
+ * idmapper_peek_ functions.  Whoever takes an entry out of a cache
+ * synchronizes before freeing it.
+ */
+
+struct gsh_rcu idmapper_rcu;
+
+/**
+ * @brief Bumped each time the cache is wiped, so that mappings kept
+ * outside it know to be redone.
+ */
+
+uint32_t idmapper_cache_gen;
+
 /**
  * @brief Lock that protects the idmapper user cache
  */
@@ -265,6 +298,51 @@ static int gid_comparator(const struct avltree_node *node1,
 		return 0;
 }
 
+static inline uint32_t name_slot(const struct gsh_buffdesc *name)
+{
+	return CityHash64(name->addr, name->len) % id_cache_size;
+}
+
+/**
+ * @brief Take a user out of the front caches
+ *
+ * @note The caller must hold idmapper_user_lock for write, and must
+ * synchronize idmapper_rcu before freeing the user.
+ */
+
+static void uncache_user(struct cache_user *user)
+{
+	void **cache_slot;
+
+	cache_slot = (void **)&uid_cache[user->uid % id_cache_size];
+	if (*cache_slot == &user->uid_node)
+		atomic_store_voidptr(cache_slot, NULL);
+
+	cache_slot = (void **)&uname_cache[name_slot(&user->uname)];
+	if (*cache_slot == &user->uname_node)
+		atomic_store_voidptr(cache_slot, NULL);
+}
+
+/**
+ * @brief Take a group out of the front caches
+ *
+ * @note The caller must hold idmapper_group_lock for write, and must
+ * synchronize idmapper_rcu before freeing the group.
+ */
+
+static void uncache_group(struct cache_group *group)
+{
+	void **cache_slot;
+
+	cache_slot = (void **)&gid_cache[group->gid % id_cache_size];
+	if (*cache_slot == &group->gid_node)
+		atomic_store_voidptr(cache_slot, NULL);
+
+	cache_slot = (void **)&gname_cache[name_slot(&group->gname)];
+	if (*cache_slot == &group->gname_node)
+		atomic_store_voidptr(cache_slot, NULL);
+}
+
 /**
  * @brief Initialize the IDMapper cache
  */
@@ -274,10 +352,14 @@ void idmapper_cache_init(void)
 	avltree_init(&uname_tree, uname_comparator, 0);
 	avltree_init(&uid_tree, uid_comparator, 0);
 	memset(uid_cache, 0, id_cache_size * sizeof(struct avltree_node *));
+	memset(uname_cache, 0, id_cache_size * sizeof(struct avltree_node *));
 
 	avltree_init(&gname_tree, gname_comparator, 0);
 	avltree_init(&gid_tree, gid_comparator, 0);
 	memset(gid_cache, 0, id_cache_size * sizeof(struct avltree_node *));
+	memset(gname_cache, 0, id_cache_size * sizeof(struct avltree_node *));
+
+	gsh_rcu_init(&idmapper_rcu);
 }
 
 /**
@@ -361,16 +443,19 @@ bool idmapper_add_user(const struct gsh_buffdesc *name, uid_t uid,
 		}
 
 		/* Remove the old and insert the new */
+		uncache_user(old);
 		avltree_remove(found_name, &uname_tree);
-		if (old->in_uidtree) {
-			uid_cache[old->uid % id_cache_size] = NULL;
+		if (old->in_uidtree)
 			avltree_remove(&old->uid_node, &uid_tree);
-		}
+		gsh_rcu_synchronize(&idmapper_rcu);
 		gsh_free(old);
 		found_name = avltree_insert(&new->uname_node, &uname_tree);
 		assert(found_name == NULL);
 	}
 
+	atomic_store_voidptr((void **)&uname_cache[name_slot(&new->uname)],
+			     &new->uname_node);
+
 	if (!new->in_uidtree) /* all done */
 		return true;
 
@@ -378,14 +463,16 @@ bool idmapper_add_user(const struct gsh_buffdesc *name, uid_t uid,
 	if (unlikely(found_id)) {
 		old = avltree_container_of(found_id, struct cache_user,
 					   uid_node);
-		uid_cache[old->uid % id_cache_size] = NULL;
+		uncache_user(old);
 		avltree_remove(found_id, &uid_tree);
 		avltree_remove(&old->uname_node, &uname_tree);
+		gsh_rcu_synchronize(&idmapper_rcu);
 		gsh_free(old);
 		found_id = avltree_insert(&new->uid_node, &uid_tree);
 		assert(found_id == NULL);
 	}
-	uid_cache[uid % id_cache_size] = &new->uid_node;
+	atomic_store_voidptr((void **)&uid_cache[uid % id_cache_size],
+			     &new->uid_node);
 
 	return true;
 }
@@ -434,9 +521,10 @@ bool idmapper_add_group(const struct gsh_buffdesc *name, const gid_t gid)
 	if (unlikely(found_name)) {
 		tmp = avltree_container_of(found_name, struct cache_group,
 					   gname_node);
+		uncache_group(tmp);
 		avltree_remove(found_name, &gname_tree);
 		avltree_remove(&tmp->gid_node, &gid_tree);
-		gid_cache[tmp->gid % id_cache_size] = NULL;
+		gsh_rcu_synchronize(&idmapper_rcu);
 		gsh_free(tmp);
 		found_name = avltree_insert(&new->gname_node, &gname_tree);
 		assert(found_name == NULL);
@@ -447,14 +535,18 @@ bool idmapper_add_group(const struct gsh_buffdesc *name, const gid_t gid)
 		tmp = avltree_container_of(found_id, struct cache_group,
 					   gid_node);
 
-		gid_cache[tmp->gid % id_cache_size] = NULL;
+		uncache_group(tmp);
 		avltree_remove(found_id, &gid_tree);
 		avltree_remove(&tmp->gname_node, &gname_tree);
+		gsh_rcu_synchronize(&idmapper_rcu);
 		gsh_free(tmp);
 		found_id = avltree_insert(&new->gid_node, &gid_tree);
 		assert(found_id == NULL);
 	}
-	gid_cache[gid % id_cache_size] = &new->gid_node;
+	atomic_store_voidptr((void **)&gid_cache[gid % id_cache_size],
+			     &new->gid_node);
+	atomic_store_voidptr((void **)&gname_cache[name_slot(&new->gname)],
+			     &new->gname_node);
 
 	return true;
 }
@@ -492,7 +584,9 @@ bool idmapper_lookup_by_uname(const struct gsh_buffdesc *name, uid_t *uid,
 
 	found_user =
 	    avltree_container_of(found_node, struct cache_user, uname_node);
-	if (!gss_princ) {
+	atomic_store_voidptr((void **)&uname_cache[name_slot(name)],
+			     found_node);
+	if (!gss_princ && found_user->in_uidtree) {
 		/* I assume that if someone likes this user enough to look it
 		   up by name, they'll like it enough to look it up by ID
 		   later.
@@ -599,6 +693,8 @@ bool idmapper_lookup_by_gname(const struct gsh_buffdesc *name, uid_t *gid)
 
 	found_group =
 	    avltree_container_of(found_node, struct cache_group, gname_node);
+	atomic_store_voidptr((void **)&gname_cache[name_slot(name)],
+			     found_node);
 
 	/* I assume that if someone likes this group enough to look it
 	   up by name, they'll like it enough to look it up by ID
@@ -665,6 +761,139 @@ bool idmapper_lookup_by_gid(const gid_t gid, const struct gsh_buffdesc **name)
 	return true;
 }
 
+/**
+ * @brief Look up a user by name in the front cache only
+ *
+ * @note The caller must be in a read side section of idmapper_rcu,
+ * which is where the results stay valid.
+ *
+ * @param[in]  name The user name to look up.
+ * @param[out] uid  The user ID found.
+ * @param[out] gid  The GID for the user, or NULL if there is none.
+ *                  May be NULL if the caller isn't interested.
+ *
+ * @retval true on success.
+ * @retval false if the caller has to take the lock and look further.
+ */
+
+bool idmapper_peek_by_uname(const struct gsh_buffdesc *name, uid_t *uid,
+			    const gid_t **gid)
+{
+	struct avltree_node *found_node =
+	    atomic_fetch_voidptr((void **)&uname_cache[name_slot(name)]);
+	struct cache_user *found_user;
+
+	if (!found_node)
+		return false;
+
+	found_user =
+	    avltree_container_of(found_node, struct cache_user, uname_node);
+	if (buffdesc_comparator(&found_user->uname, name) != 0)
+		return false;
+
+	*uid = found_user->uid;
+	if (gid)
+		*gid = (found_user->gid_set ? &found_user->gid : NULL);
+
+	return true;
+}
+
+/**
+ * @brief Look up a user by ID in the front cache only
+ *
+ * @note The caller must be in a read side section of idmapper_rcu.
+ *
+ * @param[in]  uid  The user ID to look up.
+ * @param[out] name The user name found.
+ * @param[out] gid  The GID for the user, or NULL if there is none.
+ *                  May be NULL if the caller isn't interested.
+ *
+ * @retval true on success.
+ * @retval false if the caller has to take the lock and look further.
+ */
+
+bool idmapper_peek_by_uid(const uid_t uid, const struct gsh_buffdesc **name,
+			  const gid_t **gid)
+{
+	struct avltree_node *found_node =
+	    atomic_fetch_voidptr((void **)&uid_cache[uid % id_cache_size]);
+	struct cache_user *found_user;
+
+	if (!found_node)
+		return false;
+
+	found_user =
+	    avltree_container_of(found_node, struct cache_user, uid_node);
+	if (found_user->uid != uid)
+		return false;
+
+	*name = &found_user->uname;
+	if (gid)
+		*gid = (found_user->gid_set ? &found_user->gid : NULL);
+
+	return true;
+}
+
+/**
+ * @brief Look up a group by name in the front cache only
+ *
+ * @note The caller must be in a read side section of idmapper_rcu.
+ *
+ * @param[in]  name The group name to look up.
+ * @param[out] gid  The group ID found.
+ *
+ * @retval true on success.
+ * @retval false if the caller has to take the lock and look further.
+ */
+
+bool idmapper_peek_by_gname(const struct gsh_buffdesc *name, gid_t *gid)
+{
+	struct avltree_node *found_node =
+	    atomic_fetch_voidptr((void **)&gname_cache[name_slot(name)]);
+	struct cache_group *found_group;
+
+	if (!found_node)
+		return false;
+
+	found_group =
+	    avltree_container_of(found_node, struct cache_group, gname_node);
+	if (buffdesc_comparator(&found_group->gname, name) != 0)
+		return false;
+
+	*gid = found_group->gid;
+	return true;
+}
+
+/**
+ * @brief Look up a group by ID in the front cache only
+ *
+ * @note The caller must be in a read side section of idmapper_rcu.
+ *
+ * @param[in]  gid  The group ID to look up.
+ * @param[out] name The group name found.
+ *
+ * @retval true on success.
+ * @retval false if the caller has to take the lock and look further.
+ */
+
+bool idmapper_peek_by_gid(const gid_t gid, const struct gsh_buffdesc **name)
+{
+	struct avltree_node *found_node =
+	    atomic_fetch_voidptr((void **)&gid_cache[gid % id_cache_size]);
+	struct cache_group *found_group;
+
+	if (!found_node)
+		return false;
+
+	found_group =
+	    avltree_container_of(found_node, struct cache_group, gid_node);
+	if (found_group->gid != gid)
+		return false;
+
+	*name = &found_group->gname;
+	return true;
+}
+
 /**
  * @brief Wipe out the idmapper cache
  */
@@ -672,12 +901,19 @@ bool idmapper_lookup_by_gid(const gid_t gid, const struct gsh_buffdesc **name)
 void idmapper_clear_cache(void)
 {
 	struct avltree_node *node;
+	int i;
 
 	PTHREAD_RWLOCK_wrlock(&idmapper_user_lock);
 	PTHREAD_RWLOCK_wrlock(&idmapper_group_lock);
 
-	memset(uid_cache, 0, id_cache_size * sizeof(struct avltree_node *));
-	memset(gid_cache, 0, id_cache_size * sizeof(struct avltree_node *));
+	for (i = 0; i < id_cache_size; i++) {
+		atomic_store_voidptr((void **)&uid_cache[i], NULL);
+		atomic_store_voidptr((void **)&uname_cache[i], NULL);
+		atomic_store_voidptr((void **)&gid_cache[i], NULL);
+		atomic_store_voidptr((void **)&gname_cache[i], NULL);
+	}
+	gsh_rcu_synchronize(&idmapper_rcu);
+	(void) atomic_inc_uint32_t(&idmapper_cache_gen);
 
 	for (node = avltree_first(&uname_tree);
 	     node != NULL;
@@ -40,6 +40,7 @@
 #include "9p_types.h"
 #include "fsal_types.h"
 #include "sal_data.h"
+#include "abstract_atomic.h"
 
 #ifdef _USE_9P_RDMA
 #include <infiniband/arch.h>
@@ -53,7 +54,11 @@
 
 #define _9P_LOCK_CLIENT_LEN 64
 
-#define _9P_FID_PER_CONN        1024
+/* Fids of a connection are kept in pages allocated as they are used */
+#define _9P_FID_PAGE_SHIFT 10
+#define _9P_FID_PAGE_SIZE (1 << _9P_FID_PAGE_SHIFT)
+#define _9P_FID_PAGES 1024
+#define _9P_FID_MAX (_9P_FID_PAGES * _9P_FID_PAGE_SIZE)
 
 /* _9P_MSG_SIZE: maximum message size for 9P/TCP */
 #define _9P_MSG_SIZE 70000
@@ -330,6 +335,10 @@ struct _9p_fid {
 	char name[MAXNAMLEN+1];
 	u32 opens;
 	struct _9p_xattr_desc *xattr;
+	/** Offset just past the last entry of the directory, as told by
+	    the last TREADDIR that reached its end, 0 if not known */
+	u64 readdir_eod;
+	uint64_t readdir_change;	/*< Directory change when it did */
 };
 
 enum _9p_trans_type {
@@ -376,7 +385,10 @@ struct _9p_conn {
 	struct gsh_client *client;
 	struct timeval birth;	/* This is useful if same sockfd is
 				   reused on socket's close/open */
-	struct _9p_fid *fids[_9P_FID_PER_CONN];
+	struct _9p_fid **fids[_9P_FID_PAGES];	/* Read without lock */
+	pthread_mutex_t fid_lock;	/* Serializes fid page allocation */
+	uint32_t fid_count;		/* Fids in use */
+	uint32_t fid_pages;		/* Pages allocated */
 	struct _9p_flush_bucket flush_buckets[FLUSH_BUCKETS];
 	unsigned long sequence;
 	pthread_mutex_t sock_lock;
@@ -606,6 +618,16 @@ do {                                                   \
  */
 #define _9P_TCP_MSIZE 65536
 
+/**
+ * @brief Default value for _9p_tcp_event_threads
+ */
+#define _9P_TCP_EVENT_THREADS 4
+
+/**
+ * @brief Default value for _9p_max_fids
+ */
+#define _9P_MAX_FIDS 65536
+
 /**
  * @brief Default value for _9p_rdma_msize
  */
@@ -645,6 +667,12 @@ struct _9p_param {
 	/** Msize for 9P operation on tcp.  Defaults to _9P_TCP_MSIZE,
 	    settable by _9P_TCP_Msize */
 	uint32_t _9p_tcp_msize;
+	/** Threads reading the 9P/TCP connections.  Defaults to
+	    _9P_TCP_EVENT_THREADS, settable by _9P_TCP_Event_Threads */
+	uint32_t _9p_tcp_event_threads;
+	/** Fids are numbered below this on each connection.  Defaults to
+	    _9P_MAX_FIDS, settable by _9P_Max_Fids */
+	uint32_t _9p_max_fids;
 	/** Msize for 9P operation on rdma.  Defaults to _9P_RDMA_MSIZE,
 	    settable by _9P_RDMA_Msize */
 	uint32_t _9p_rdma_msize;
@@ -727,6 +755,34 @@ int _9p_tools_errno(fsal_status_t fsal_status);
 void _9p_openflags2FSAL(u32 *inflags, fsal_openflags_t *outflags);
 int _9p_tools_clunk(struct _9p_fid *pfid);
 void _9p_cleanup_fids(struct _9p_conn *conn);
+void _9p_setfid(struct _9p_conn *conn, u32 fid, struct _9p_fid *pfid);
+
+/**
+ * @brief Look up a fid of a connection
+ *
+ * Takes no lock: pages are only added while the connection lives, and
+ * a fid is only looked up by requests of the connection.
+ *
+ * @param[in] conn The connection
+ * @param[in] fid  The fid
+ *
+ * @return The fid, NULL if unused.
+ */
+static inline struct _9p_fid *_9p_getfid(struct _9p_conn *conn, u32 fid)
+{
+	struct _9p_fid **page;
+
+	if (fid >= _9P_FID_MAX)
+		return NULL;
+
+	page = atomic_fetch_voidptr(
+			(void **)&conn->fids[fid >> _9P_FID_PAGE_SHIFT]);
+	if (page == NULL)
+		return NULL;
+
+	return atomic_fetch_voidptr(
+			(void **)&page[fid & (_9P_FID_PAGE_SIZE - 1)]);
+}
 
 static inline unsigned int _9p_openflags_to_share_access(u32 *inflags)
 {
@@ -742,6 +798,47 @@ static inline unsigned int _9p_openflags_to_share_access(u32 *inflags)
 	}
 }
 
+/**
+ * @brief Message type of a raw 9P message
+ *
+ * @param[in] msg Start of the message (its size field)
+ */
+static inline u8 _9p_msgtype(const char *msg)
+{
+	return *(u8 *) (msg + _9P_HDR_SIZE);
+}
+
+/**
+ * @brief Whether a 9P request should go to the high latency queue
+ *
+ * The 9P counterpart of NFS_LOOKAHEAD_HIGH_LATENCY: bulk data and
+ * directory transfers are kept apart from metadata operations such as
+ * TWALK and TGETATTR in the dispatcher.
+ *
+ * @param[in] req9p The request
+ */
+static inline bool _9p_lookahead_high_latency(struct _9p_request_data *req9p)
+{
+	const char *msg = req9p->_9pmsg;
+
+#ifdef _USE_9P_RDMA
+	if (msg == NULL && req9p->data != NULL)
+		msg = (const char *) req9p->data->data;
+#endif
+	if (msg == NULL)
+		return false;
+
+	switch (_9p_msgtype(msg)) {
+	case _9P_TREAD:
+	case _9P_TWRITE:
+	case _9P_TREADDIR:
+	case _9P_TFSYNC:
+		return true;
+	default:
+		return false;
+	}
+}
+
 #ifdef _USE_9P_RDMA
 /* 9P/RDMA callbacks */
 void *_9p_rdma_handle_trans(void *arg);
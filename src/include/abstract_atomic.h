@@ -66,12 +66,20 @@
  * uint64_t atomic_postclear_uint64_t_bits(uint64_t *var,
  * uint64_t atomic_postset_uint64_t_bits(uint64_t *var,
  *
+ * Compare and swap is provided for int32_t, int64_t and uint64_t:
+ *
+ * bool atomic_cas_int32_t(int32_t *var, int32_t expected, int32_t val)
+ * bool atomic_cas_int64_t(int64_t *var, int64_t expected, int64_t val)
+ *
+ * and a full memory barrier as atomic_full_barrier().
+ *
  */
 
 #ifndef _ABSTRACT_ATOMIC_H
 #define _ABSTRACT_ATOMIC_H
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <time.h>
 
 #undef GCC_SYNC_FUNCTIONS
@@ -2470,4 +2478,101 @@ static inline void atomic_store_uint8_t(uint8_t *var, uint8_t val)
 	(void)__sync_lock_test_and_set(var, val);
 }
 #endif
+/*
+ * Compare and swap
+ */
+
+/**
+ * @brief Atomically replace an int32_t holding an expected value
+ *
+ * @param[in,out] var      Pointer to the variable to modify
+ * @param[in]     expected The value var must hold
+ * @param[in]     val      The value to store
+ *
+ * @return true if var held expected and now holds val.
+ */
+
+#ifdef GCC_ATOMIC_FUNCTIONS
+static inline bool atomic_cas_int32_t(int32_t *var, int32_t expected,
+				      int32_t val)
+{
+	return __atomic_compare_exchange_n(var, &expected, val, false,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#elif defined(GCC_SYNC_FUNCTIONS)
+static inline bool atomic_cas_int32_t(int32_t *var, int32_t expected,
+				      int32_t val)
+{
+	return __sync_bool_compare_and_swap(var, expected, val);
+}
+#endif
+
+/**
+ * @brief Atomically replace an int64_t holding an expected value
+ *
+ * @param[in,out] var      Pointer to the variable to modify
+ * @param[in]     expected The value var must hold
+ * @param[in]     val      The value to store
+ *
+ * @return true if var held expected and now holds val.
+ */
+
+#ifdef GCC_ATOMIC_FUNCTIONS
+static inline bool atomic_cas_int64_t(int64_t *var, int64_t expected,
+				      int64_t val)
+{
+	return __atomic_compare_exchange_n(var, &expected, val, false,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#elif defined(GCC_SYNC_FUNCTIONS)
+static inline bool atomic_cas_int64_t(int64_t *var, int64_t expected,
+				      int64_t val)
+{
+	return __sync_bool_compare_and_swap(var, expected, val);
+}
+#endif
+
+/**
+ * @brief Atomically replace a uint64_t holding an expected value
+ *
+ * @param[in,out] var      Pointer to the variable to modify
+ * @param[in]     expected The value var must hold
+ * @param[in]     val      The value to store
+ *
+ * @return true if var held expected and now holds val.
+ */
+
+#ifdef GCC_ATOMIC_FUNCTIONS
+static inline bool atomic_cas_uint64_t(uint64_t *var, uint64_t expected,
+				       uint64_t val)
+{
+	return __atomic_compare_exchange_n(var, &expected, val, false,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#elif defined(GCC_SYNC_FUNCTIONS)
+static inline bool atomic_cas_uint64_t(uint64_t *var, uint64_t expected,
+				       uint64_t val)
+{
+	return __sync_bool_compare_and_swap(var, expected, val);
+}
+#endif
+
+/**
+ * @brief Issue a full memory barrier
+ *
+ * Orders plain loads and stores around the barrier, as needed by
+ * sequence-count readers that copy data outside any lock.
+ */
+
+#ifdef GCC_ATOMIC_FUNCTIONS
+static inline void atomic_full_barrier(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+#elif defined(GCC_SYNC_FUNCTIONS)
+static inline void atomic_full_barrier(void)
+{
+	__sync_synchronize();
+}
+#endif
 #endif				/* !_ABSTRACT_ATOMIC_H */
@@ -42,7 +42,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "log.h"
+#include "gsh_intrinsic.h"
+#include "gsh_slab.h"
 
 /**
  * @page GeneralAllocator General Allocator Shim
@@ -56,6 +60,72 @@
  * memory tracking or that call allocators with other names.
  */
 
+/**
+ * @page MemoryTags Memory Accounting
+ *
+ * Slabs, and so pools, and the gsh_*_tag allocators charge their
+ * memory to the subsystem it belongs to.  Slabs already count their
+ * objects per thread, those counts are read when reported.  Counting
+ * every gsh_malloc_tag would put an atomic add on a shared line, so
+ * each thread only counts one in GSH_MEM_SAMPLE of the tagged
+ * allocations and frees it makes, weighting it by GSH_MEM_SAMPLE.  The
+ * ShowMemory method of the exportstats D-Bus interface reports live
+ * bytes and allocation rates per subsystem.  Plain gsh_malloc is not
+ * accounted.
+ */
+
+/**
+ * @brief Subsystems memory is accounted to
+ */
+enum gsh_mem_tag {
+	GSH_MEM_OTHER,		/*< Pools of none of the below */
+	GSH_MEM_MDCACHE,	/*< Metadata cache entries */
+	GSH_MEM_DRC,		/*< Duplicate request cache */
+	GSH_MEM_STATE,		/*< Clients, sessions, owners and states */
+	GSH_MEM_9P,		/*< 9P connections and fids */
+	GSH_MEM_HASHTABLE,	/*< Hash table nodes */
+	GSH_MEM_REQUEST,	/*< Requests being processed */
+	GSH_MEM_TAG_COUNT
+};
+
+/** One in this many accounted allocations and frees is counted */
+#define GSH_MEM_SAMPLE 64
+
+/**
+ * @brief Sampled counts of one subsystem, weighted by GSH_MEM_SAMPLE
+ */
+struct gsh_mem_counters {
+	int64_t allocs;		/*< Allocations */
+	int64_t alloc_bytes;	/*< Bytes allocated */
+	int64_t frees;		/*< Frees */
+	int64_t free_bytes;	/*< Bytes freed */
+	GSH_CACHE_PAD(0);
+};
+
+extern struct gsh_mem_counters gsh_mem_counters[GSH_MEM_TAG_COUNT];
+extern __thread uint32_t gsh_mem_countdown;
+
+void gsh_mem_sample(enum gsh_mem_tag tag, int64_t n);
+const char *gsh_mem_tag_name(enum gsh_mem_tag tag);
+
+/**
+ * @brief Account an allocation or free to a subsystem
+ *
+ * @param[in] tag Subsystem
+ * @param[in] n   Bytes allocated, negative for bytes freed
+ */
+static inline void
+gsh_mem_account(enum gsh_mem_tag tag, int64_t n)
+{
+	if (likely(gsh_mem_countdown > 1)) {
+		gsh_mem_countdown--;
+		return;
+	}
+
+	gsh_mem_countdown = GSH_MEM_SAMPLE;
+	gsh_mem_sample(tag, n);
+}
+
 /**
  * @brief Allocate memory
  *
@@ -257,6 +327,55 @@ gsh_strldup__(const char *s, size_t length, size_t *copied,
 #define gsh_strldup(s, l, n) gsh_strldup__(s, l, n, __FILE__, __LINE__, \
 						__func__)
 
+/**
+ * @brief Allocate memory charged to a subsystem
+ *
+ * As gsh_malloc, the block must be released with gsh_free_tag.
+ *
+ * @param[in] tag Subsystem
+ * @param[in] n Number of bytes to allocate
+ * @param[in] file Calling source file
+ * @param[in] line Calling source line
+ * @param[in] function Calling source function
+ *
+ * @return Pointer to a block of memory.
+ */
+static inline void *
+gsh_malloc_tag__(enum gsh_mem_tag tag, size_t n,
+		 const char *file, int line, const char *function)
+{
+	gsh_mem_account(tag, n);
+	return gsh_malloc__(n, file, line, function);
+}
+
+#define gsh_malloc_tag(tag, n) \
+	gsh_malloc_tag__(tag, n, __FILE__, __LINE__, __func__)
+
+/**
+ * @brief Allocate zeroed memory charged to a subsystem
+ *
+ * As gsh_calloc, the block must be released with gsh_free_tag.
+ *
+ * @param[in] tag Subsystem
+ * @param[in] n Number of objects in block
+ * @param[in] s Size of object
+ * @param[in] file Calling source file
+ * @param[in] line Calling source line
+ * @param[in] function Calling source function
+ *
+ * @return Pointer to a block of zeroed memory.
+ */
+static inline void *
+gsh_calloc_tag__(enum gsh_mem_tag tag, size_t n, size_t s,
+		 const char *file, int line, const char *function)
+{
+	gsh_mem_account(tag, n * s);
+	return gsh_calloc__(n, s, file, line, function);
+}
+
+#define gsh_calloc_tag(tag, n, s) \
+	gsh_calloc_tag__(tag, n, s, __FILE__, __LINE__, __func__)
+
 /**
  * @brief Free a block of memory
  *
@@ -271,6 +390,20 @@ gsh_free(void *p)
 	free(p);
 }
 
+/**
+ * @brief Free a block of memory charged to a subsystem
+ *
+ * @param[in] tag Subsystem the block was allocated with
+ * @param[in] p   Block of memory to free
+ * @param[in] n   Size it was allocated with
+ */
+static inline void
+gsh_free_tag(enum gsh_mem_tag tag, void *p, size_t n)
+{
+	gsh_mem_account(tag, -(int64_t) n);
+	free(p);
+}
+
 /**
  * @brief Free a block of memory with size
  *
@@ -296,28 +429,40 @@ gsh_free_size(void *p, size_t n __attribute__ ((unused)))
  * referenced.  No assumptions about the size of the pointed-to type
  * should be made.
  *
- * This allows for flexible growth in the future.
+ * A pool is a slab (see gsh_slab.h): each thread allocates from and
+ * frees to a magazine of its own, refilled from and spilled to a
+ * shared depot of up to POOL_DEPOT_OBJECTS free objects.
  */
 
 typedef struct pool {
 	char *name; /*< The name of the pool */
 	size_t object_size; /*< The size of the objects created */
+	struct gsh_slab slab; /*< Magazines and depot */
 } pool_t;
 
+/** Free objects a pool keeps beyond the threads' magazines */
+#define POOL_DEPOT_OBJECTS 1024
+
 /**
- * @brief Create a basic object pool
+ * @brief Create an object pool
  *
  * This function creates a new object pool, given a name, object size,
  * constructor and destructor.
  *
- * This particular implementation throws the name away, but other
- * implementations that do tracking or keep counts of allocated or
- * de-allocated objects will likely wish to use it in log messages.
+ * The name is what the ShowSlabs D-Bus method reports the pool as.
+ * Without a constructor pool_alloc returns zeroed objects.  With one,
+ * the constructor runs when an object is first allocated from the
+ * heap and pool_alloc returns objects as pool_free got them, but for
+ * their first pointer; the destructor runs before an object goes
+ * back to the heap.
  *
  * This initializer function is expected to abort if it fails.
  *
  * @param[in] name             The name of this pool
  * @param[in] object_size      The size of objects to allocate
+ * @param[in] tag              Subsystem the objects are charged to
+ * @param[in] ctor             Constructor or NULL
+ * @param[in] dtor             Destructor or NULL
  * @param[in] file             Calling source file
  * @param[in] line             Calling source line
  * @param[in] function         Calling source function
@@ -330,11 +475,16 @@ typedef struct pool {
  */
 
 static inline pool_t *
-pool_basic_init__(const char *name, size_t object_size,
-		  const char *file, int line, const char *function)
+pool_init__(const char *name, size_t object_size, enum gsh_mem_tag tag,
+	    void (*ctor)(void *), void (*dtor)(void *),
+	    const char *file, int line, const char *function)
 {
-	pool_t *pool = (pool_t *) gsh_malloc__(sizeof(pool_t), file, line,
-					function);
+	pool_t *pool = (pool_t *) gsh_calloc__(1, sizeof(pool_t), file, line,
+					       function);
+
+	/* The depot links free objects through their first word */
+	if (object_size < sizeof(void *))
+		object_size = sizeof(void *);
 
 	pool->object_size = object_size;
 
@@ -343,11 +493,28 @@ pool_basic_init__(const char *name, size_t object_size,
 	else
 		pool->name = NULL;
 
+	pool->slab.name = pool->name ? pool->name : "unnamed pool";
+	pool->slab.size = object_size;
+	pool->slab.max = POOL_DEPOT_OBJECTS;
+	pool->slab.tag = tag;
+	pool->slab.ctor = ctor;
+	pool->slab.dtor = dtor;
+	pthread_mutex_init(&pool->slab.mtx, NULL);
+
 	return pool;
 }
 
+#define pool_init(name, object_size, tag, ctor, dtor) \
+	pool_init__(name, object_size, tag, ctor, dtor, __FILE__, __LINE__, \
+		    __func__)
+
 #define pool_basic_init(name, object_size) \
-	pool_basic_init__(name, object_size, __FILE__, __LINE__, __func__)
+	pool_init__(name, object_size, GSH_MEM_OTHER, NULL, NULL, __FILE__, \
+		    __LINE__, __func__)
+
+#define pool_tagged_init(name, object_size, tag) \
+	pool_init__(name, object_size, tag, NULL, NULL, __FILE__, __LINE__, \
+		    __func__)
 
 /**
  * @brief Destroy a memory pool
@@ -361,6 +528,8 @@ pool_basic_init__(const char *name, size_t object_size,
 static inline void
 pool_destroy(pool_t *pool)
 {
+	gsh_slab_destroy(&pool->slab);
+	pthread_mutex_destroy(&pool->slab.mtx);
 	gsh_free(pool->name);
 	gsh_free(pool);
 }
@@ -369,10 +538,9 @@ pool_destroy(pool_t *pool)
  * @brief Allocate an object from a pool
  *
  * This function allocates a single object from the pool and returns a
- * pointer to it.  If a constructor was specified at pool creation, it
- * is called on that pointer.  This function must be thread safe.  If
- * the underlying pool abstraction requires a lock, this function must
- * take and release it.
+ * pointer to it.  The object is zeroed, unless a constructor was
+ * specified at pool creation, see pool_init__.  This function is
+ * thread safe.
  *
  * This function returns void pointers.  Programmers who wish for more
  * type safety can easily create static inline wrappers (alloc_client
@@ -392,7 +560,7 @@ pool_destroy(pool_t *pool)
 static inline void *
 pool_alloc__(pool_t *pool, const char *file, int line, const char *function)
 {
-	return gsh_calloc__(1, pool->object_size, file, line, function);
+	return gsh_slab_alloc(&pool->slab);
 }
 
 #define pool_alloc(pool) \
@@ -402,10 +570,8 @@ pool_alloc__(pool_t *pool, const char *file, int line, const char *function)
  * @brief Return an entry to a pool
  *
  * This function returns a single object to the pool.  If a destructor
- * was defined at pool creation time, it is called before the object
- * is freed.  This function must be thread-safe.  If the underlying
- * pool abstract requires a lock, this function must take and release
- * it.
+ * was defined at pool creation time, it is called once the object
+ * goes back to the heap.  This function is thread-safe.
  *
  * @param[in] pool   Pool to which to return the object
  * @param[in] object Object to return.  This is a void pointer.
@@ -417,7 +583,8 @@ pool_alloc__(pool_t *pool, const char *file, int line, const char *function)
 static inline void
 pool_free(pool_t *pool, void *object)
 {
-	gsh_free(object);
+	if (object != NULL)
+		gsh_slab_free(&pool->slab, object);
 }
 
 #endif /* ABSTRACT_MEM_H */
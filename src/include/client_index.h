@@ -0,0 +1,62 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @file client_index.h
+ * @brief Compiled export client lists
+ */
+
+#ifndef CLIENT_INDEX_H
+#define CLIENT_INDEX_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "gsh_list.h"
+#include "nfs_exports.h"
+
+/** No entry matched */
+#define CLIENT_INDEX_NONE UINT32_MAX
+
+/**
+ * @brief A client entry that has to be matched the slow way
+ *
+ * Netgroups, wildcards and the like need a name lookup, so the index
+ * only keeps them in list order for the caller to try.
+ */
+struct client_index_slow {
+	exportlist_client_entry_t *client;
+	uint32_t order;		/*< Position in the client list */
+};
+
+struct client_index;
+
+struct client_index *client_index_build(struct glist_head *clients);
+void client_index_free(struct client_index *index);
+
+exportlist_client_entry_t *client_index_match_v4(struct client_index *index,
+						 in_addr_t addr,
+						 uint32_t *order);
+exportlist_client_entry_t *client_index_match_v6(struct client_index *index,
+						 struct in6_addr *addr);
+struct client_index_slow *client_index_slow_list(struct client_index *index,
+						 uint32_t *count);
+
+#endif				/* CLIENT_INDEX_H */
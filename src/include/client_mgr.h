@@ -51,6 +51,7 @@ struct gsh_client {
 	struct gsh_buffdesc addr;
 	int64_t refcnt;
 	nsecs_elapsed_t last_update;
+	uint32_t sched_weight;	/*< fair-share weight, 0 for default */
 	char *hostaddr_str;
 	unsigned char addrbuf[];
 };
@@ -60,6 +61,10 @@ static inline int64_t inc_gsh_client_refcount(struct gsh_client *client)
 	return atomic_inc_int64_t(&client->refcnt);
 }
 
+/** Bumped whenever a client's sched_weight changes, so copies of the
+    weight held elsewhere know to read it again.  Starts at 1. */
+extern uint32_t client_weight_gen;
+
 void client_pkginit(void);
 #ifdef USE_DBUS
 void dbus_client_init(void);
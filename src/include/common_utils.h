@@ -16,8 +16,10 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <errno.h>
 
 #include "gsh_types.h"
+#include "gsh_intrinsic.h"
 #include "log.h"
 
 /**
@@ -82,6 +84,69 @@ extern int portable_clock_gettime(struct timespec *ts);
 #define SCANDIR_CONST
 #endif
 
+#ifdef USE_LOCK_PROFILE
+/**
+ * @brief Contention counts of one lock call site
+ *
+ * Each PTHREAD_MUTEX_lock, PTHREAD_RWLOCK_wrlock and
+ * PTHREAD_RWLOCK_rdlock defines one statically.  It is linked into the
+ * profile the first time it is reached with profiling on.  Wait times
+ * are sampled, one contended acquire in LOCK_PROF_SAMPLE per thread,
+ * and scaled back up.
+ */
+struct lock_prof_site {
+	const char *name;	/*< The lock expression */
+	const char *file;
+	int line;
+	uint32_t listed;	/*< Linked into the profile */
+	uint64_t acquires;
+	uint64_t contended;	/*< Acquires that had to wait */
+	uint64_t wait_ns;	/*< Estimated total wait */
+	uint64_t max_wait_ns;	/*< Longest sampled wait */
+	struct lock_prof_site *next;
+};
+
+#define LOCK_PROF_SAMPLE 8
+
+extern bool lock_prof_enabled;
+
+void lock_prof_acquired(struct lock_prof_site *site);
+uint64_t lock_prof_wait_begin(struct lock_prof_site *site);
+void lock_prof_wait_end(struct lock_prof_site *site, uint64_t start);
+
+/**
+ * @brief Take a lock, counting it against its call site
+ *
+ * With profiling off this is the blocking call and a test.  With it on,
+ * the lock is tried first and only a failed try is timed.
+ */
+#define PTHREAD_LOCK_PROFILED(_rc, _name, _try, _block)		\
+	do {								\
+		static struct lock_prof_site _site = {			\
+			.name = _name,					\
+			.file = __FILE__,				\
+			.line = __LINE__,				\
+		};							\
+		uint64_t _start;					\
+									\
+		if (likely(!lock_prof_enabled)) {			\
+			_rc = _block;					\
+			break;						\
+		}							\
+		_rc = _try;						\
+		if (_rc != EBUSY) {					\
+			lock_prof_acquired(&_site);			\
+			break;						\
+		}							\
+		_start = lock_prof_wait_begin(&_site);			\
+		_rc = _block;						\
+		lock_prof_wait_end(&_site, _start);			\
+	} while (0)
+#else
+#define PTHREAD_LOCK_PROFILED(_rc, _name, _try, _block)		\
+	((_rc) = (_block))
+#endif
+
 /**
  * @brief Logging rwlock initialization
  *
@@ -141,7 +206,9 @@ extern int portable_clock_gettime(struct timespec *ts);
 	do {								\
 		int rc;							\
 									\
-		rc = pthread_rwlock_wrlock(_lock);			\
+		PTHREAD_LOCK_PROFILED(rc, #_lock,			\
+				      pthread_rwlock_trywrlock(_lock),	\
+				      pthread_rwlock_wrlock(_lock));	\
 		if (rc == 0) {						\
 			LogFullDebug(COMPONENT_RW_LOCK,			\
 				     "Got write lock on %p (%s) "	\
@@ -166,7 +233,9 @@ extern int portable_clock_gettime(struct timespec *ts);
 	do {								\
 		int rc;							\
 									\
-		rc = pthread_rwlock_rdlock(_lock);			\
+		PTHREAD_LOCK_PROFILED(rc, #_lock,			\
+				      pthread_rwlock_tryrdlock(_lock),	\
+				      pthread_rwlock_rdlock(_lock));	\
 		if (rc == 0) {						\
 			LogFullDebug(COMPONENT_RW_LOCK,			\
 				     "Got read lock on %p (%s) "	\
@@ -216,7 +285,9 @@ extern int portable_clock_gettime(struct timespec *ts);
 	do {								\
 		int rc;							\
 									\
-		rc = pthread_mutex_lock(_mtx);				\
+		PTHREAD_LOCK_PROFILED(rc, #_mtx,			\
+				      pthread_mutex_trylock(_mtx),	\
+				      pthread_mutex_lock(_mtx));	\
 		if (rc == 0) {						\
 			LogFullDebug(COMPONENT_RW_LOCK,			\
 				     "Acquired mutex %p (%s) at %s:%d",	\
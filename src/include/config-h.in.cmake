@@ -50,17 +50,30 @@
 #cmakedefine LITTLEEND 1
 #cmakedefine BIGEND 1
 #cmakedefine HAVE_XATTR_H 1
+#cmakedefine HAVE_STATX 1
 #cmakedefine HAVE_DAEMON 1
 #cmakedefine USE_LTTNG 1
 #cmakedefine ENABLE_VFS_DEBUG_ACL 1
+#cmakedefine USE_VFS_IO_URING 1
+#cmakedefine USE_RPC_TLS 1
+#cmakedefine USE_LOCK_PROFILE 1
 #cmakedefine ENABLE_RFC_ACL 1
 #cmakedefine USE_GLUSTER_SYMLINK_MOUNT 1
 #cmakedefine USE_GLUSTER_XREADDIRPLUS 1
+#cmakedefine USE_GLUSTER_COPY_FILE_RANGE 1
+#cmakedefine USE_GLUSTER_UPCALL_REGISTER 1
 #cmakedefine USE_FSAL_CEPH_MKNOD 1
 #cmakedefine USE_FSAL_CEPH_SETLK 1
 #cmakedefine USE_FSAL_CEPH_LL_LOOKUP_ROOT 1
+#cmakedefine USE_FSAL_CEPH_LL_WRITEV 1
+#cmakedefine USE_FSAL_CEPH_LL_NONBLOCKING_IO 1
+#cmakedefine USE_FSAL_CEPH_LL_DELEGATION 1
+#cmakedefine USE_FSAL_CEPH_LL_CALLBACKS 1
+#cmakedefine USE_FSAL_CEPH_RADOS_NOTIFY 1
 #cmakedefine USE_FSAL_CEPH_STATX 1
+#cmakedefine USE_FSAL_CEPH_PNFS 1
 #cmakedefine USE_FSAL_RGW_MOUNT2 1
+#cmakedefine USE_FSAL_RGW_READDIR2 1
 #cmakedefine ENABLE_LOCKTRACE 1
 #cmakedefine SANITIZE_ADDRESS 1
 #cmakedefine DEBUG_MDCACHE 1
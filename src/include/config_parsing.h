@@ -879,4 +879,10 @@ void *noop_conf_init(void *link_mem, void *self_struct);
 int noop_conf_commit(void *node, void *link_mem, void *self_struct,
 		     struct config_error_type *err_type);
 
+/* runtime access to numeric parameters of a loaded block */
+int config_get_uint_param(struct config_block *conf_blk, void *param,
+			  const char *name, uint64_t *value);
+int config_set_uint_param(struct config_block *conf_blk, void *param,
+			  const char *name, uint64_t value);
+
 #endif
@@ -53,7 +53,7 @@
 #include <stdbool.h>
 #include "gsh_types.h"
 
-void delayed_start(void);
+void delayed_start(uint32_t count);
 void delayed_shutdown(void);
 int delayed_submit(void (*)(void *), void *, nsecs_elapsed_t);
 
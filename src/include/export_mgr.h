@@ -49,6 +49,88 @@ enum export_status {
 	EXPORT_STALE,		/*< export is no longer valid */
 };
 
+/**
+ * @brief Token bucket classes for export QoS
+ */
+
+enum export_qos_class {
+	EXPORT_QOS_IOPS,	/*< requests per second */
+	EXPORT_QOS_READ,	/*< bytes read per second */
+	EXPORT_QOS_WRITE,	/*< bytes written per second */
+	EXPORT_QOS_COUNT
+};
+
+/** Number of MDCACHE partitions exports can be assigned to */
+#define EXPORT_CACHE_PARTITIONS 16
+
+/**
+ * @brief Per-export QoS token buckets
+ *
+ * Each bucket refills at its configured rate and holds at most one
+ * second of credit.  Requests are charged up front, so a bucket may go
+ * negative; the debt determines how long the request is held off the
+ * worker queues.
+ */
+
+struct export_qos {
+	/** Protects tokens and last_refill */
+	pthread_spinlock_t sp;
+	/** Current credit per class, may be negative */
+	int64_t tokens[EXPORT_QOS_COUNT];
+	/** Requests delayed because of each class */
+	uint64_t throttled[EXPORT_QOS_COUNT];
+	/** Total time requests have been held, in nanoseconds */
+	uint64_t delayed_ns;
+	/** Last time the buckets were refilled */
+	nsecs_elapsed_t last_refill;
+};
+
+/**
+ * @brief Requests an export has on the workers, under Max_Inflight
+ *
+ * A request over the limit waits on parked, holding no worker, until
+ * one of the export's requests finishes.  Everything is protected by
+ * sp.
+ */
+
+struct export_inflight {
+	pthread_spinlock_t sp;
+	/** Requests queued to or running on a worker */
+	uint32_t count;
+	/** Requests waiting on parked */
+	uint32_t parked_count;
+	/** Requests that had to wait, since startup */
+	uint64_t held;
+	/** request_data_t chained by req_q */
+	struct glist_head parked;
+};
+
+/**
+ * @brief Circuit breaker over an export's backend
+ *
+ * Health_Failures failed or slow requests in a row open it.  While open
+ * requests are answered NFS4ERR_DELAY or NFS3ERR_JUKEBOX before they
+ * reach the FSAL, except that every Health_Retry a trickle of
+ * Health_Probes requests is let through.  A probe that succeeds closes
+ * it.  Everything is protected by sp.
+ */
+
+struct export_health {
+	pthread_spinlock_t sp;
+	/** Failed or slow requests in a row */
+	uint32_t strikes;
+	/** Probes left in the current retry window */
+	uint32_t probes;
+	/** Shedding requests, read unlocked to skip the lock */
+	uint32_t open;
+	/** When open, time the next probes may go through */
+	nsecs_elapsed_t retry_at;
+	/** Times it opened, since startup */
+	uint64_t trips;
+	/** Requests answered without reaching the FSAL, since startup */
+	uint64_t shed;
+};
+
 /**
  * @brief Represents an export.
  *
@@ -59,8 +141,6 @@ enum export_status {
 struct gsh_export {
 	/** List of all exports */
 	struct glist_head exp_list;
-	/** gsh_exports are kept in an AVL tree by export_id */
-	struct avltree_node node_k;
 	/** List of NFS v4 state belonging to this export */
 	struct glist_head exp_state_list;
 	/** List of locks belonging to this export */
@@ -79,6 +159,8 @@ struct gsh_export {
 	struct fsal_obj_handle *exp_root_obj;
 	/** CFG Allowed clients - update protected by lock */
 	struct glist_head clients;
+	/** Compiled clients, rebuilt with them - protected by lock */
+	struct client_index *client_index;
 	/** Entry for the junction of this export.  Protected by lock */
 	struct fsal_obj_handle *exp_junction_obj;
 	/** The export this export sits on. Protected by lock */
@@ -107,6 +189,37 @@ struct gsh_export {
 	uint64_t MaxOffsetWrite;
 	/** CFG: Maximum Offset allowed for read - atomic changeable option */
 	uint64_t MaxOffsetRead;
+	/** CFG: Per class QoS rates, 0 is unlimited - atomic changeable
+	    option */
+	uint64_t qos_limit[EXPORT_QOS_COUNT];
+	/** QoS token bucket state */
+	struct export_qos qos;
+	/** CFG: Requests that may be queued to or running on the workers
+	    at once, 0 is unlimited - atomic changeable option */
+	uint32_t max_inflight;
+	/** Max_Inflight accounting */
+	struct export_inflight inflight;
+	/** CFG: Failed or slow requests in a row that make the export
+	    shed load, 0 disables it - atomic changeable option */
+	uint32_t health_failures;
+	/** CFG: Milliseconds in the FSAL past which a request counts as
+	    failed, 0 is no limit - atomic changeable option */
+	uint32_t health_latency;
+	/** CFG: Milliseconds between probes while shedding - atomic
+	    changeable option */
+	uint32_t health_retry;
+	/** CFG: Requests let through each Health_Retry - atomic changeable
+	    option */
+	uint32_t health_probes;
+	/** Backend health state */
+	struct export_health health;
+	/** CFG: Cache entries and dirent chunks reserved for this export's
+	    cache partition - atomic changeable option */
+	uint64_t cache_reserved_entries;
+	uint64_t cache_reserved_chunks;
+	/** CFG: MDCACHE partition objects cached through this export are
+	    charged to, 0 being the shared one - atomic changeable option */
+	uint32_t cache_partition;
 	/** CFG: Filesystem ID for overriding fsid from FSAL - ????? */
 	fsal_fsid_t filesystem_id;
 	/** References to this export */
@@ -174,6 +287,11 @@ struct gsh_export *get_gsh_export_by_tag(char *tag);
 bool mount_gsh_export(struct gsh_export *exp);
 void put_gsh_export(struct gsh_export *a_export);
 void remove_gsh_export(uint16_t export_id);
+nsecs_elapsed_t export_qos_charge(struct gsh_export *a_export,
+				  uint64_t read_bytes, uint64_t write_bytes);
+bool export_health_admit(struct gsh_export *a_export);
+void export_health_done(struct gsh_export *a_export,
+			nsecs_elapsed_t fsal_time, bool failed);
 bool foreach_gsh_export(bool(*cb) (struct gsh_export *exp, void *state),
 			bool wrlock, void *state);
 
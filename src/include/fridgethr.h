@@ -45,9 +45,11 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "gsh_list.h"
+#include "gsh_intrinsic.h"
 #include "wait_queue.h"
 
 struct fridgethr;
+struct fridgethr_deque;
 
 /*< Decoder thread pool */
 extern struct fridgethr *req_fridge;
@@ -85,6 +87,8 @@ struct fridgethr_entry {
 		void *arg;	/*< Functions argument */
 
 		pthread_t id;	/*< Thread ID */
+		int numa_node;	/*< NUMA node this thread is bound to, -1
+				   if the fridge does no placement */
 		uint32_t uflags; /*< Flags (for any use) */
 		bool woke;	/*< Set to false on first run and if wait
 				   in fridgethr_freeze didn't time out. */
@@ -96,6 +100,8 @@ struct fridgethr_entry {
 					   threads */
 	struct glist_head idle_link; /*< Link in the idle queue */
 	struct fridgethr *fr; /*< The fridge we belong to */
+	struct fridgethr_deque *deque; /*< Jobs this thread submitted, with
+					   work stealing */
 };
 
 /**
@@ -179,6 +185,22 @@ struct fridgethr_params {
 	void (*wake_threads)(void *);
 	/* Argument for wake_threads */
 	void *wake_threads_arg;
+	/**
+	 * If true, threads are dealt round-robin to the host's NUMA
+	 * nodes and bound to the CPUs of their node.  Has no effect on
+	 * single node hosts.
+	 */
+	bool numa_affinity;
+	/**
+	 * If true, jobs a thread of the fridge submits to it go on a
+	 * deque of that thread, without taking the fridge mutex.  The
+	 * thread runs them newest first once its job is done, and idle
+	 * threads steal them oldest first.  Jobs from outside the
+	 * fridge still go through the fridge queue.  Only allowed for
+	 * fridgethr_flavor_worker fridges with fridgethr_defer_queue
+	 * and a thr_max.
+	 */
+	bool work_stealing;
 };
 
 /**
@@ -191,6 +213,23 @@ struct fridgethr_work {
 	void *arg; /*< Functions argument */
 };
 
+/** Jobs a work stealing deque holds, a power of 2 */
+#define FRIDGETHR_DEQUE_SIZE 256
+
+/**
+ * @brief Work stealing deque of a thread
+ *
+ * Only the owning thread pushes and pops at the bottom, thieves take
+ * from the top with a compare and swap.  Indices only grow.
+ */
+struct fridgethr_deque {
+	uint64_t top; /*< Oldest job, next to be stolen */
+	GSH_CACHE_PAD(0);
+	uint64_t bottom; /*< Past the newest job */
+	bool owned; /*< In use by a thread, under the fridge mutex */
+	struct fridgethr_work jobs[FRIDGETHR_DEQUE_SIZE]; /*< Ring of jobs */
+};
+
 /**
  * @brief Commands a caller can issue
  */
@@ -223,6 +262,9 @@ struct fridgethr {
 	pthread_cond_t *cb_cv;	/*< Condition variable, signalled on
 				   completion */
 	bool transitioning; /*< Changing state */
+	uint32_t next_node; /*< Next NUMA node to place a thread on */
+	struct fridgethr_deque *deques; /*< p.thr_max deques, with work
+					    stealing */
 	union {
 		struct glist_head work_q; /*< Work queued */
 		struct {
@@ -256,6 +298,8 @@ int fridgethr_start(struct fridgethr *, pthread_mutex_t *, pthread_cond_t *,
 		    void (*)(void *), void *);
 int fridgethr_sync_command(struct fridgethr *, fridgethr_comm_t, time_t);
 bool fridgethr_you_should_break(struct fridgethr_context *);
+int fridgethr_resize(struct fridgethr *, uint32_t,
+		     void (*)(struct fridgethr_context *), void *);
 int fridgethr_populate(struct fridgethr *, void (*)(struct fridgethr_context *),
 		      void *);
 
@@ -264,6 +308,9 @@ time_t fridgethr_getwait(struct fridgethr_context *ctx);
 
 void fridgethr_cancel(struct fridgethr *fr);
 
+int fridgethr_numa_nodes(void);
+int fridgethr_cpu_node(int cpu);
+
 extern struct fridgethr *general_fridge;
 int general_fridge_init(void);
 int general_fridge_shutdown(void);
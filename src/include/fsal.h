@@ -62,6 +62,7 @@ extern __thread struct req_op_context *op_ctx;
 #include "fsal_api.h"
 #include "nfs23.h"
 #include "nfs4_acls.h"
+#include "city.h"
 
 /**
  * @brief If we don't know how big a buffer we want for a link, use
@@ -366,6 +367,14 @@ fsal_status_t fsal_write2(struct fsal_obj_handle *obj,
 			  void *buffer,
 			  bool *sync,
 			  struct io_info *info);
+fsal_status_t fsal_copy(struct fsal_obj_handle *dst,
+			struct state_t *dst_state,
+			uint64_t dst_offset,
+			struct fsal_obj_handle *src,
+			struct state_t *src_state,
+			uint64_t src_offset,
+			uint64_t count,
+			uint64_t *copied);
 fsal_status_t fsal_rdwr(struct fsal_obj_handle *obj,
 		      fsal_io_direction_t io_direction,
 		      uint64_t offset, size_t io_size,
@@ -558,6 +567,25 @@ fsal_get_changeid4(struct fsal_obj_handle *obj)
 	return change;
 }
 
+/**
+ * @brief Hash an object's FSAL key
+ *
+ * This is the hash the cache keys its entries by, and the one file
+ * handles may carry to spare the cache hashing the key again.
+ *
+ * @param[in] key Key, from handle_to_key() or host_to_key()
+ *
+ * @return The hash.
+ */
+
+#define FSAL_KEY_HASH_SEED 557
+
+static inline uint64_t fsal_key_hash(const struct gsh_buffdesc *key)
+{
+	return CityHash64WithSeed((const char *) key->addr, key->len,
+				  FSAL_KEY_HASH_SEED);
+}
+
 static inline
 enum fsal_create_mode nfs4_createmode_to_fsal(createmode4 createmode)
 {
@@ -618,6 +646,24 @@ static inline bool open_correct(fsal_openflags_t fd_openflags,
 					== (to_openflags & FSAL_O_RDWR));
 }
 
+/**
+ * @brief Total length of the segments of a writev2
+ *
+ * @param[in] iov     Segments
+ * @param[in] iovcnt  Number of segments
+ */
+
+static inline size_t fsal_iov_length(const struct iovec *iov, int iovcnt)
+{
+	size_t total = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	return total;
+}
+
 /**
  * @brief "fsal_op_stats" struct useful for all the fsals which are going to
  * implement support for FSAL specific statistics
@@ -40,6 +40,7 @@
 #ifndef FSAL_API
 #define FSAL_API
 
+#include <sys/uio.h>
 #include "fsal_types.h"
 #include "fsal_pnfs.h"
 #include "sal_shared.h"
@@ -52,6 +53,7 @@
 */
 struct gsh_client;
 struct gsh_export;
+struct req_arena;
 struct fsal_up_vector;		/* From fsal_up.h */
 struct state_t;
 
@@ -324,7 +326,7 @@ struct state_t;
  * rules), increment the minor version
  */
 
-#define FSAL_MINOR_VERSION 0
+#define FSAL_MINOR_VERSION 6
 
 /* Forward references for object methods */
 
@@ -398,6 +400,22 @@ struct io_hints {
  *          module does not know and the code will still do the right thing.
  */
 
+/**
+ * @brief Room left in a readdir reply
+ *
+ * Set by the protocol layer around fsal_readdir() so that a caching FSAL
+ * can stop looking up and refreshing entries the reply has no room for.
+ * It is an estimate: the callback still has the last word on what fits,
+ * and the first entry is always offered to it.
+ */
+struct fsal_readdir_budget {
+	size_t bytes;		/*< Room left in the reply */
+	size_t entry_bytes;	/*< Least room an entry takes besides its name */
+	size_t slack;		/*< Room the callback wants left besides what
+				    it charges for an entry */
+	uint32_t entries;	/*< Entries the reply has slots for */
+};
+
 struct req_op_context {
 	struct user_cred *creds;	/*< resolved user creds from request */
 	struct user_cred original_creds;	/*< Saved creds */
@@ -420,6 +438,11 @@ struct req_op_context {
 	void *fsal_private;		/*< private for FSAL use */
 	struct fsal_module *fsal_module;	/*< current fsal module */
 	struct fsal_pnfs_ds *fsal_pnfs_ds;	/*< current pNFS DS */
+	struct req_arena *arena;	/*< request scratch memory, may be NULL */
+	nsecs_elapsed_t fsal_time;	/*< time spent below MDCACHE */
+	struct fsal_readdir_budget *readdir_budget; /*< NULL if unbounded */
+	const uint64_t *fh_key_hash;	/*< Key hash the handle being decoded
+					    carries, NULL if none */
 	/* add new context members here */
 };
 
@@ -644,6 +667,21 @@ struct fsal_ops {
  */
 	void (*fsal_reset_stats)(struct fsal_module *const fsal_hdl);
 
+/**
+ * @brief Note an error a client got doing I/O to a pNFS device
+ *
+ * Called for LAYOUTERROR, so that the FSAL may steer new layouts away
+ * from a failing device.
+ *
+ * @param[in] fsal_hdl FSAL module
+ * @param[in] deviceid The device
+ * @param[in] status   The error the client got
+ * @param[in] opnum    The operation that got it
+ */
+	 void (*device_error)(struct fsal_module *fsal_hdl,
+			      const struct pnfs_deviceid *deviceid,
+			      nfsstat4 status, nfs_opnum4 opnum);
+
 /**@}*/
 };
 
@@ -1301,6 +1339,21 @@ typedef enum fsal_dir_result (*fsal_readdir_cb)(
 				const char *name, struct fsal_obj_handle *obj,
 				struct attrlist *attrs,
 				void *dir_state, fsal_cookie_t cookie);
+
+/**
+ * @brief Callback completing an asynchronous I/O
+ *
+ * Called exactly once per read2_async or write2_async, either before the
+ * method returns or later from a thread of the FSAL's choosing.  The
+ * output parameters of the call are filled in before it is made.  The
+ * callback runs without the submitter's op_ctx.
+ *
+ * @param[in] obj          Object the I/O was made on
+ * @param[in] ret          Result of the I/O
+ * @param[in] caller_data  caller_data passed to the method
+ */
+typedef void (*fsal_async_cb)(struct fsal_obj_handle *obj, fsal_status_t ret,
+			      void *caller_data);
 /**
  * @brief FSAL object operations vector
  */
@@ -2739,6 +2792,191 @@ struct fsal_obj_ops {
 	 fsal_status_t (*close2)(struct fsal_obj_handle *obj_hdl,
 				 struct state_t *state);
 
+/**
+ * @brief Get attributes for several children of a directory
+ *
+ * This optional method fetches the attributes of @a count objects in
+ * one operation, for FSALs that can do so with fewer round trips than
+ * @c getattrs on each (a single compound, a readdirplus style call).
+ * It is used to refresh the attributes of a cached directory chunk.
+ *
+ * Each attrs_out[i] is prepared by the caller with its request_mask,
+ * which always includes ATTR_RDATTR_ERR.  An object whose attributes
+ * could not be fetched has its valid_mask set to ATTR_RDATTR_ERR; that
+ * does not fail the call.
+ *
+ * The caller MUST call fsal_release_attrs on each attrs_out[i].
+ *
+ * @param[in]     dir_hdl    Directory the objects were read from
+ * @param[in]     count      Number of objects
+ * @param[in]     obj_hdls   Objects to query
+ * @param[in,out] attrs_out  Attribute lists, one per object
+ *
+ * @return FSAL status, ERR_FSAL_NOTSUPP if the FSAL has no bulk method.
+ */
+	 fsal_status_t (*getattrs_bulk)(struct fsal_obj_handle *dir_hdl,
+					uint32_t count,
+					struct fsal_obj_handle **obj_hdls,
+					struct attrlist **attrs_out);
+
+/**
+ * @brief Read data from a file asynchronously
+ *
+ * As read2, except that the result is delivered to @a done_cb, which
+ * may happen after this method returns.  The buffer and output
+ * parameters must stay valid until then.  The default calls read2 and
+ * completes inline.
+ *
+ * @param[in]     obj_hdl        File on which to operate
+ * @param[in]     bypass         If state doesn't indicate a share reservation,
+ *                               bypass any deny read
+ * @param[in]     state          state_t to use for this operation
+ * @param[in]     offset         Position from which to read
+ * @param[in]     buffer_size    Amount of data to read
+ * @param[out]    buffer         Buffer to which data are to be copied
+ * @param[out]    read_amount    Amount of data read
+ * @param[out]    end_of_file    true if the end of file has been reached
+ * @param[in,out] info           more information about the data
+ * @param[in]     done_cb        Completion callback
+ * @param[in]     caller_data    Passed to done_cb
+ */
+	 void (*read2_async)(struct fsal_obj_handle *obj_hdl,
+			     bool bypass,
+			     struct state_t *state,
+			     uint64_t offset,
+			     size_t buffer_size,
+			     void *buffer,
+			     size_t *read_amount,
+			     bool *end_of_file,
+			     struct io_info *info,
+			     fsal_async_cb done_cb,
+			     void *caller_data);
+
+/**
+ * @brief Write data to a file asynchronously
+ *
+ * As write2, except that the result is delivered to @a done_cb, which
+ * may happen after this method returns.  The buffer and output
+ * parameters must stay valid until then.  The default calls write2 and
+ * completes inline.
+ *
+ * @param[in]     obj_hdl        File on which to operate
+ * @param[in]     bypass         If state doesn't indicate a share reservation,
+ *                               bypass any non-mandatory deny write
+ * @param[in]     state          state_t to use for this operation
+ * @param[in]     offset         Position at which to write
+ * @param[in]     buffer_size    Amount of data to write
+ * @param[in]     buffer         Data to be written
+ * @param[out]    wrote_amount   Amount of data written
+ * @param[in,out] fsal_stable    In, if on, the fsal is requested to write data
+ *                               to stable store. Out, the fsal reports what
+ *                               it did.
+ * @param[in,out] info           more information about the data
+ * @param[in]     done_cb        Completion callback
+ * @param[in]     caller_data    Passed to done_cb
+ */
+	 void (*write2_async)(struct fsal_obj_handle *obj_hdl,
+			      bool bypass,
+			      struct state_t *state,
+			      uint64_t offset,
+			      size_t buffer_size,
+			      void *buffer,
+			      size_t *wrote_amount,
+			      bool *fsal_stable,
+			      struct io_info *info,
+			      fsal_async_cb done_cb,
+			      void *caller_data);
+
+/**
+ * @brief Write a scatter list to a file
+ *
+ * As write2, except that the data is described by an array of
+ * segments, so a caller holding the data in several buffers need not
+ * gather it first.  The array and the buffers it references must stay
+ * valid for the duration of the call.  The default gathers the
+ * segments into one buffer (unless there is only one) and calls
+ * write2.
+ *
+ * @param[in]     obj_hdl        File on which to operate
+ * @param[in]     bypass         If state doesn't indicate a share reservation,
+ *                               bypass any non-mandatory deny write
+ * @param[in]     state          state_t to use for this operation
+ * @param[in]     offset         Position at which to write
+ * @param[in]     iov            Segments to be written, in order
+ * @param[in]     iovcnt         Number of segments
+ * @param[out]    wrote_amount   Amount of data written
+ * @param[in,out] fsal_stable    In, if on, the fsal is requested to write data
+ *                               to stable store. Out, the fsal reports what
+ *                               it did.
+ * @param[in,out] info           more information about the data
+ *
+ * @return FSAL status.
+ */
+	 fsal_status_t (*writev2)(struct fsal_obj_handle *obj_hdl,
+				  bool bypass,
+				  struct state_t *state,
+				  uint64_t offset,
+				  const struct iovec *iov,
+				  int iovcnt,
+				  size_t *wrote_amount,
+				  bool *fsal_stable,
+				  struct io_info *info);
+
+/**
+ * @brief Copy a range of one file into another
+ *
+ * Copy data between two regular files of the same export without
+ * passing it through the caller.  Both offsets and the count are in
+ * bytes; a count of zero means to the end of the source.  The FSAL may
+ * copy less than asked (as a short write would) and reports what it
+ * did in @a copied.  Data copied is unstable, as if written by a WRITE
+ * with UNSTABLE4.  The default returns ERR_FSAL_NOTSUPP.
+ *
+ * @param[in]  dst_hdl     File to copy into
+ * @param[in]  dst_state   state_t (open for write) for dst_hdl, or NULL
+ * @param[in]  dst_offset  Position in dst_hdl to copy to
+ * @param[in]  src_hdl     File to copy from
+ * @param[in]  src_state   state_t (open for read) for src_hdl, or NULL
+ * @param[in]  src_offset  Position in src_hdl to copy from
+ * @param[in]  count       Amount of data to copy
+ * @param[out] copied      Amount of data copied
+ *
+ * @return FSAL status.
+ */
+	 fsal_status_t (*copy)(struct fsal_obj_handle *dst_hdl,
+			       struct state_t *dst_state,
+			       uint64_t dst_offset,
+			       struct fsal_obj_handle *src_hdl,
+			       struct state_t *src_state,
+			       uint64_t src_offset,
+			       uint64_t count,
+			       uint64_t *copied);
+
+/**
+ * @brief Clone a range of one file into another
+ *
+ * As copy, except that the destination range is made to share the
+ * source's storage and the whole range is cloned or nothing is.  The
+ * default returns ERR_FSAL_NOTSUPP.
+ *
+ * @param[in]  dst_hdl     File to clone into
+ * @param[in]  dst_state   state_t (open for write) for dst_hdl, or NULL
+ * @param[in]  dst_offset  Position in dst_hdl to clone to
+ * @param[in]  src_hdl     File to clone from
+ * @param[in]  src_state   state_t (open for read) for src_hdl, or NULL
+ * @param[in]  src_offset  Position in src_hdl to clone from
+ * @param[in]  count       Amount of data to clone, 0 for to end of file
+ *
+ * @return FSAL status.
+ */
+	 fsal_status_t (*clone)(struct fsal_obj_handle *dst_hdl,
+				struct state_t *dst_state,
+				uint64_t dst_offset,
+				struct fsal_obj_handle *src_hdl,
+				struct state_t *src_state,
+				uint64_t src_offset,
+				uint64_t count);
+
 /**@}*/
 };
 
@@ -201,11 +201,15 @@ typedef struct fsal_ace__ {
 	} who;
 } fsal_ace_t;
 
+struct fsal_acl_compiled;
+
 typedef struct fsal_acl__ {
 	uint32_t naces;
 	fsal_ace_t *aces;
 	pthread_rwlock_t lock;
 	uint32_t ref;
+	/** Evaluation aid built when the ACL is interned, may be NULL */
+	struct fsal_acl_compiled *compiled;
 } fsal_acl_t;
 
 typedef struct fsal_acl_data__ {
@@ -396,6 +400,12 @@ typedef uint64_t attrmask_t;
 #define ATTR4_FS_LOCATIONS  0x0000000000800000LL
 /* xattr supported */
 #define ATTR4_XATTR  0x0000000001000000LL
+/* Only in valid_mask: change is a counter the file system bumps on every
+ * modification, so equal values mean an unchanged object.  Without it
+ * change is derived from the times and may miss changes within their
+ * granularity.
+ */
+#define ATTR_CHANGE_COUNTER  0x0000000002000000LL
 
 /* attributes that used for NFS v3 */
 
@@ -691,6 +701,7 @@ typedef struct fsal_staticfsinfo_t {
 	bool reopen_method;	/* fsal supports reopen method */
 	bool fsal_trace;	/*< fsal trace supports */
 	bool fsal_grace;	/*< fsal will handle grace */
+	uint32_t up_threads;	/*< threads processing fsal upcalls */
 	bool link_supports_permission_checks;
 	bool rename_changes_key;/*< Handle key is changed across rename */
 	bool compute_readdir_cookie;
@@ -261,6 +261,31 @@ struct fsal_up_vector {
 	fsal_status_t (*invalidate_close)(const struct fsal_up_vector *vec,
 					  struct gsh_buffdesc *obj,
 					  uint32_t flags);
+
+	/** Invalidate a directory and everything below it
+	 *
+	 * Cheap enough to call from an upcall thread: entries below the
+	 * directory are invalidated as they are next looked up through
+	 * it, not when this is called.
+	 *
+	 * @param[in] vec	Up ops vector
+	 * @param[in] obj	The directory
+	 *
+	 * @return FSAL status
+	 */
+	fsal_status_t (*invalidate_subtree)(const struct fsal_up_vector *vec,
+					    struct gsh_buffdesc *obj);
+
+	/** Invalidate every cached object of the export
+	 *
+	 * Like invalidate_subtree, entries are invalidated as they are
+	 * next found.
+	 *
+	 * @param[in] vec	Up ops vector
+	 *
+	 * @return FSAL status
+	 */
+	fsal_status_t (*invalidate_export)(const struct fsal_up_vector *vec);
 };
 
 extern struct fsal_up_vector fsal_up_top;
@@ -79,6 +79,16 @@ typedef enum protos {
  */
 #define RQUOTA_PORT 875
 
+/**
+ * @brief Default NFS over RPC/RDMA port.
+ */
+#define NFS_RDMA_PORT 20049
+
+/**
+ * @brief Default RPC/RDMA credits granted to a connection.
+ */
+#define NFS_RDMA_CREDITS_DEFAULT 30
+
 /**
  * @brief Default value for core_param.nb_worker
  */
@@ -144,6 +154,11 @@ typedef enum protos {
  */
 #define DRC_UDP_CHECKSUM true
 
+/**
+ * @brief Default value for core_param.drc.lru_npart
+ */
+#define DRC_LRU_NPART 17
+
 /**
  * @brief Default value for core_param.rpc.debug_flags
  */
@@ -159,6 +174,16 @@ typedef enum protos {
  */
 #define NFS_DEFAULT_RECV_BUFFER_SIZE 1048576
 
+/**
+ * Default value for core_param.rpc.tcp_buf_min
+ */
+#define NFS_DEFAULT_TCP_BUFFER_MIN 65536
+
+/**
+ * Default value for core_param.rpc.tcp_buf_max
+ */
+#define NFS_DEFAULT_TCP_BUFFER_MAX 16777216
+
 /**
  * @brief Support NFSv3
  */
@@ -201,8 +226,13 @@ typedef enum protos {
 
 typedef struct nfs_core_param {
 	/** An array of port numbers, one for each protocol.  Set by
-	    the NFS_Port, MNT_Port, NLM_Port, and Rquota_Port options. */
+	    the NFS_Port, MNT_Port, NLM_Port, Rquota_Port, and
+	    NFS_RDMA_Port options. */
 	uint16_t port[P_COUNT];
+	/** RPC/RDMA credits, the requests a client may have
+	    outstanding on one connection.  Defaults to
+	    NFS_RDMA_CREDITS_DEFAULT, settable by NFS_RDMA_Credits. */
+	uint32_t rdma_credits;
 	/** The address to which to bind for our listening port.
 	    IPv4 only, for now.  Set by the Bind_Addr option. */
 	struct sockaddr_in bind_addr;
@@ -215,6 +245,19 @@ typedef struct nfs_core_param {
 	/** Number of worker threads.  Set to NB_WORKER_DEFAULT by
 	    default and changed with the Nb_Worker option. */
 	uint32_t nb_worker;
+	/** Whether to grow and shrink the worker pool, starting from
+	    Nb_Worker, by how many workers are blocked in the FSAL and
+	    how many requests are queued.  Defaults to false and
+	    settable by Worker_Autotune. */
+	bool worker_autotune;
+	/** Bounds on the pool size when autotuning.  Default to 16 and
+	    1024, settable by Nb_Worker_Min and Nb_Worker_Max. */
+	uint32_t nb_worker_min;
+	uint32_t nb_worker_max;
+	/** Seconds of samples the autotuner averages before each
+	    resize.  Defaults to 10 and settable by
+	    Worker_Autotune_Interval. */
+	uint32_t worker_autotune_interval;
 	/** For NFSv3, whether to drop rather than reply to requests
 	    yielding I/O errors.  True by default and settable with
 	    Drop_IO_Errors.  As this generally results in client
@@ -232,6 +275,17 @@ typedef struct nfs_core_param {
 	    retry and there is no NFSERR_DELAY, this seems like an
 	    excellent idea. */
 	bool drop_delay_errors;
+	/** For NFSv3, how long (in microseconds) a stable write that is
+	    about to flush a file waits for other stable writes to the
+	    same file still in progress, so that one flush covers them
+	    all.  0 (the default) disables write gathering.  Settable by
+	    Write_Gather_Usec. */
+	uint32_t write_gather_usec;
+	/** Microseconds a queued FSAL upcall invalidate waits for more
+	    invalidates to coalesce with it.  0 (the default) runs them
+	    at once, still merging those queued for the same object.
+	    Settable by Upcall_Coalesce_Usec. */
+	uint32_t upcall_coalesce_usec;
 	/** Total number of requests to allow into the dispatcher at
 	    once.  Defaults to 5000 and settable by Dispatch_Max_Reqs */
 	uint32_t dispatch_max_reqs;
@@ -239,6 +293,69 @@ typedef struct nfs_core_param {
 	    specific transport.  Defaults to 512 and settable by
 	    Dispatch_Max_Reqs_Xprt. */
 	uint32_t dispatch_max_reqs_xprt;
+	/** Number of request queue shards.  Workers drain their home
+	    shard first and steal from siblings when it is empty.  0
+	    (the default) sizes it to the number of online CPUs, capped
+	    by Nb_Worker.  Settable by Dispatch_Queue_Shards. */
+	uint32_t dispatch_queue_shards;
+	/** How long (in microseconds) an idle worker polls the request
+	    queues before parking on its condition variable.  While a
+	    worker is spinning, producers skip the wakeup handoff.  0
+	    (the default) parks immediately.  Settable by
+	    Worker_Spin_Usec. */
+	uint32_t worker_spin_usec;
+	/** Whether to bind workers to NUMA nodes and group the queue
+	    shards per node, steering each connection's requests to the
+	    node its packets arrive on.  Defaults to false and settable
+	    by Worker_NUMA_Affinity. */
+	bool worker_numa_affinity;
+	/** Number of timer wheels, each with its own thread, the delayed
+	    executor runs.  0 means one per CPU.  Defaults to 1 and
+	    settable by Delayed_Exec_Wheels. */
+	uint32_t delayed_wheels;
+	/** Whether to schedule the low and high latency request classes
+	    round-robin among clients (deficit round-robin) rather than
+	    FIFO.  Defaults to false and settable by
+	    Dispatch_Fair_Share. */
+	bool dispatch_fair_share;
+	/** Scheduling weight of clients with no weight of their own.
+	    Defaults to 1 and settable by Dispatch_Fair_Share_Weight. */
+	uint32_t dispatch_fair_share_weight;
+	/** Queue wait (in microseconds) above which the busiest
+	    connections stop being read until the backlog clears.  0 (the
+	    default) disables admission control.  Settable by
+	    Dispatch_Target_Latency_Usec. */
+	uint32_t dispatch_target_latency_usec;
+	/** Window (in milliseconds) over which the minimum queue wait is
+	    compared to the target.  Defaults to 100, settable by
+	    Dispatch_Latency_Interval_Msec. */
+	uint32_t dispatch_latency_interval_msec;
+	/** Queue wait (in milliseconds) after which a request, other
+	    than NFSv4, is dropped unexecuted as its client will have
+	    retransmitted it.  0 (the default) never drops.  Settable by
+	    Dispatch_Request_Deadline_Msec. */
+	uint32_t dispatch_request_deadline_msec;
+	/** Port on which to serve the statistics in the OpenMetrics
+	    text format.  0 (the default) disables the endpoint.
+	    Settable by Metrics_Port. */
+	uint16_t metrics_port;
+	/** Address the metrics endpoint listens on.  Defaults to
+	    127.0.0.1 and settable by Metrics_Addr. */
+	struct sockaddr_in metrics_addr;
+	/** Most clients to report per-client series for, to bound the
+	    size of a scrape.  Defaults to 64 and settable by
+	    Metrics_Max_Clients. */
+	uint32_t metrics_max_clients;
+	/** Number of keys each heavy hitter tracker keeps.  0 disables
+	    the trackers.  Defaults to 32 and settable by Topk_Entries. */
+	uint32_t topk_entries;
+	/** Length (in seconds) of the windows the heavy hitters are
+	    counted over.  Defaults to 60 and settable by
+	    Topk_Window_S. */
+	uint32_t topk_window_s;
+	/** Threads initializing the exports' root objects at startup.
+	    Defaults to 8 and settable by Export_Init_Threads. */
+	uint32_t export_init_threads;
 	/** Parameters controlling the Duplicate Request Cache.  */
 	struct {
 		/** Whether to disable the DRC entirely.  Defaults to
@@ -309,6 +426,27 @@ typedef struct nfs_core_param {
 			    DRC_UDP_Checksum. */
 			bool checksum;
 		} udp;
+		/** Memory budget, in bytes, shared by all DRCs.  When
+		    non-zero, completed requests are retired from a
+		    global LRU to stay within it instead of by the per
+		    DRC size and high water marks.  Defaults to 0,
+		    settable by DRC_Max_Bytes. */
+		uint64_t max_bytes;
+		/** Share of DRC_Max_Bytes one TCP connection's DRC may
+		    hold, its oldest completed requests are retired
+		    beyond it.  0 (the default) for no limit, settable
+		    by DRC_Client_Max_Bytes. */
+		uint64_t client_max_bytes;
+		/** Number of independently locked partitions of the
+		    global LRU.  Defaults to DRC_LRU_NPART, settable by
+		    DRC_LRU_Npart. */
+		uint32_t lru_npart;
+		/** Bytes of each WRITE's data, in addition to its offset
+		    and length, folded into the request checksum with
+		    CRC32C.  0 (the default) leaves matching to the
+		    TI-RPC checksum, settable by
+		    DRC_Write_Checksum_Bytes. */
+		uint32_t write_cksum_bytes;
 	} drc;
 	/** Parameters affecting the relation with TIRPC.   */
 	struct {
@@ -333,6 +471,70 @@ typedef struct nfs_core_param {
 		/** TIRPC ioq max simultaneous io threads.  Defaults to
 		    200 and settable by RPC_Ioq_ThrdMax. */
 		uint32_t ioq_thrd_max;
+		/** Seconds a new TCP connection may wait for its first
+		    request before it is handed to the event loop.  0
+		    disables TCP_DEFER_ACCEPT.  Settable by
+		    RPC_TCP_Defer_Accept. */
+		uint32_t tcp_defer_accept;
+		/** UDP sockets sharing each RPC port with SO_REUSEPORT,
+		    each polled by its own event thread.  Defaults to 1,
+		    settable by RPC_UDP_Listeners. */
+		uint32_t udp_listeners;
+		/** TCP listeners sharing each RPC port with SO_REUSEPORT,
+		    each accepting on its own event thread.  Defaults to
+		    1, settable by RPC_TCP_Listeners. */
+		uint32_t tcp_listeners;
+		/** Hand each connection or datagram to the listener of
+		    the CPU that received it, with a reuseport BPF
+		    program.  Defaults to false, settable by
+		    RPC_Listeners_CPU_Steering. */
+		bool listeners_cpu_steering;
+		/** Microseconds a receive on an RPC socket busy polls
+		    the NIC (SO_BUSY_POLL) before sleeping.  0, the
+		    default, disables it.  Settable by
+		    RPC_Busy_Poll_Usec. */
+		uint32_t busy_poll_usec;
+		/** Packets per busy poll (SO_BUSY_POLL_BUDGET).  0
+		    leaves the kernel default.  Settable by
+		    RPC_Busy_Poll_Budget. */
+		uint32_t busy_poll_budget;
+		/** Size each TCP connection's socket buffers from its
+		    own TCP_INFO instead of leaving them to the kernel.
+		    Defaults to false, settable by
+		    RPC_TCP_Buffer_Autotune. */
+		bool tcp_buf_autotune;
+		/** Smallest auto-tuned buffer.  Defaults to
+		    NFS_DEFAULT_TCP_BUFFER_MIN, settable by
+		    RPC_TCP_Buffer_Min. */
+		uint32_t tcp_buf_min;
+		/** Largest auto-tuned buffer.  Defaults to
+		    NFS_DEFAULT_TCP_BUFFER_MAX, settable by
+		    RPC_TCP_Buffer_Max. */
+		uint32_t tcp_buf_max;
+		/** TCP_NOTSENT_LOWAT for connections, in bytes.  0
+		    (the default) leaves it unset.  Settable by
+		    RPC_TCP_Notsent_Lowat. */
+		uint32_t tcp_notsent_lowat;
+		struct {
+			/** Answer RPC-with-TLS probes on TCP and move the
+			    connection to kernel TLS.  Defaults to false,
+			    settable by RPC_TLS. */
+			bool enable;
+			/** Refuse all but NULL calls on connections that
+			    did not start TLS.  Settable by
+			    RPC_TLS_Required. */
+			bool required;
+			/** PEM certificate chain.  Settable by
+			    RPC_TLS_Certificate. */
+			char *certificate;
+			/** PEM private key.  Settable by
+			    RPC_TLS_Private_Key. */
+			char *private_key;
+			/** CAs client certificates must chain to.  NULL
+			    (the default) does not ask for one.  Settable
+			    by RPC_TLS_CA_File. */
+			char *ca_file;
+		} tls;
 		struct {
 			/** Partitions in GSS ctx cache table (default 13). */
 			uint32_t ctx_hash_partitions;
@@ -344,6 +546,11 @@ typedef struct nfs_core_param {
 			 * check (default 200)
 			 */
 			uint32_t max_gc;
+			/** Threads that unwrap krb5i and krb5p arguments
+			 * off the connection's decoder.  0 (the default)
+			 * unwraps inline.
+			 */
+			uint32_t unwrap_threads;
 		} gss;
 	} rpc;
 	/** How long (in seconds) to let unused decoder threads wait before
@@ -355,6 +562,10 @@ typedef struct nfs_core_param {
 	time_t decoder_fridge_block_timeout;
 	/** Polling interval for blocked lock polling thread. */
 	time_t blocked_lock_poller_interval;
+	/** Requests taking longer than this many milliseconds are logged
+	    when they finish, 0 to log none.  Settable with
+	    Slow_Request_Threshold. */
+	uint32_t slow_request_threshold;
 	/** Protocols to support.  Should probably be renamed.
 	    Defaults to CORE_OPTION_ALL_VERS and is settable with
 	    NFS_Protocols (as a comma-separated list of 3 and 4.) */
@@ -363,6 +574,12 @@ typedef struct nfs_core_param {
 	    address in NSM operations.  Settable with
 	    NSM_Use_Caller_Name. */
 	bool nsm_use_caller_name;
+	/** File keeping the hosts rpc.statd monitors for us across
+	    restarts, NULL for none.  Settable with NSM_Cache_File. */
+	char *nsm_cache_file;
+	/** Seconds a host stays monitored after its last lock goes.
+	    Settable with NSM_Unmonitor_Delay. */
+	uint32_t nsm_unmonitor_delay;
 	/** Whether this Ganesha is part of a cluster of Ganeshas.
 	    This is somewhat vendor-specific and should probably be
 	    moved somewhere else.  Settable with Clustered. */
@@ -383,15 +600,30 @@ typedef struct nfs_core_param {
 	uint32_t tcp_keepidle;
 	/** Time between each keepalive probe */
 	uint32_t tcp_keepintvl;
+	/** Whether to cork TCP connections while more replies for them
+	    are in flight, so pipelined replies share segments.  Defaults
+	    to false, settable with Enable_TCP_Reply_Coalescing. */
+	bool tcp_reply_coalesce;
 	/** Whether to use short NFS file handle to accommodate VMware
 	    NFS client. Enable this if you have a VMware NFSv3 client.
 	    VMware NFSv3 client has a max limit of 56 byte file handles!
 	    Defaults to false. */
 	bool short_file_handle;
+	/** Whether to put the hash the cache keys an object by in the
+	    file handles handed out, so that decoding them does not
+	    have to hash the key again.  Handles get 8 bytes longer.
+	    Defaults to false and settable by File_Handle_Key_Hash. */
+	bool fh_key_hash;
 	/** How long the server will trust information it got by
 	    calling getgroups() when "Manage_Gids = TRUE" is
 	    used in a export entry. */
 	time_t manage_gids_expiration;
+	/** How long a netgroup membership found by innetgr() is
+	    trusted.  Entries are refreshed in the background once they
+	    are three quarters of the way there. */
+	time_t netgroup_cache_expiration;
+	/** The same for a host found not to be in a netgroup. */
+	time_t netgroup_negative_cache_expiration;
 	/** Path to the directory containing server specific
 	    modules.  In particular, this is where FSALs live. */
 	char *ganesha_modules_loc;
@@ -402,6 +634,19 @@ typedef struct nfs_core_param {
 	/** Whether to use Pseudo (true) or Path (false) for NFS v3 and 9P
 	    mounts. */
 	bool mount_path_pseudo;
+	/** Shared I/O buffer pool used for READ data. */
+	struct {
+		/** Bytes of pre-faulted buffers to set aside, split
+		    between the size classes.  Defaults to 0 (no pool),
+		    settable with IOBuf_Pool_Bytes. */
+		uint64_t pool_bytes;
+		/** Size of the largest class.  Defaults to 1MiB,
+		    settable with IOBuf_Max_Size. */
+		uint32_t max_size;
+		/** Whether to back the pool with 2MiB huge pages.
+		    Defaults to false, settable with IOBuf_Hugepages. */
+		bool hugepages;
+	} iobuf;
 } nfs_core_parameter_t;
 
 /** @} */
@@ -437,11 +682,31 @@ typedef struct nfs_core_param {
  */
 #define DELEG_RECALL_RETRY_DELAY_DEFAULT 1
 
+/**
+ * @brief Default number of threads sending callbacks.
+ */
+#define CB_THREADS_DEFAULT 32
+
+/**
+ * @brief Default timeout, in seconds, of a single callback.
+ */
+#define CB_TIMEOUT_DEFAULT 15
+
 /**
  * @brief Default value of recovery_backend.
  */
 #define RECOVERY_BACKEND_DEFAULT "fs"
 
+/**
+ * @brief Default number of partitions of the NFSv4 hash tables.
+ */
+#define NFS4_HASH_PARTITIONS_DEFAULT 17
+
+/**
+ * @brief Default entries in a partition before a table grows.
+ */
+#define NFS4_HASH_RESIZE_LOAD_DEFAULT 1024
+
 typedef struct nfs_version4_parameter {
 	/** Whether to disable the NFSv4 grace period.  Defaults to
 	    false and settable with Graceless. */
@@ -482,8 +747,54 @@ typedef struct nfs_version4_parameter {
 	bool pnfs_mds;
 	/** Whether this a pNFS DS server. Defaults to false */
 	bool pnfs_ds;
+	/** Largest forechannel slot table granted to a session.  The
+	    target the client is asked to use moves between
+	    NFS41_NB_SLOTS and this with server load.  Defaults to
+	    NFS41_MAX_SLOTS_DEFAULT, settable by Max_Slots. */
+	uint32_t max_slots;
+	/** Most backchannel slots used on a session, when the client
+	    offers that many.  Defaults to NFS41_MAX_CB_SLOTS, settable
+	    by Callback_Slots. */
+	uint32_t cb_slots;
+	/** Threads sending callbacks, which bounds how many clients are
+	    called back at once.  Defaults to CB_THREADS_DEFAULT, settable
+	    by Callback_Threads. */
+	uint32_t cb_threads;
+	/** Seconds a callback may wait for the client to answer.
+	    Defaults to CB_TIMEOUT_DEFAULT, settable by
+	    Callback_Timeout. */
+	uint32_t cb_timeout;
 	/** Recovery backend */
 	char *recovery_backend;
+	/** Number of partitions, a prime, of the client id and client
+	    record tables.  Defaults to NFS4_HASH_PARTITIONS_DEFAULT,
+	    settable by Clientid_Hash_Partitions. */
+	uint32_t clientid_hash_partitions;
+	/** Number of partitions, a prime, of the state, owner and
+	    session tables.  Defaults to NFS4_HASH_PARTITIONS_DEFAULT,
+	    settable by State_Hash_Partitions. */
+	uint32_t state_hash_partitions;
+	/** Entries in one partition of those tables past which the table
+	    grows its partitions, 0 to never grow.  Defaults to
+	    NFS4_HASH_RESIZE_LOAD_DEFAULT, settable by
+	    Hash_Resize_Load. */
+	uint32_t hash_resize_load;
+	/** Hash of the client id and session tables, an enum
+	    hash_key_func.  Defaults to the tables' own functions,
+	    settable by Hash_Function. */
+	uint32_t hash_function;
+	/** Most open owners a client may have, 0 for no limit.  Settable
+	    by Max_Open_Owners_Per_Client. */
+	uint32_t max_open_owners;
+	/** Most lock owners a client may have, 0 for no limit.  Settable
+	    by Max_Lock_Owners_Per_Client. */
+	uint32_t max_lock_owners;
+	/** Most stateids a client may hold, 0 for no limit.  Settable by
+	    Max_States_Per_Client. */
+	uint32_t max_states;
+	/** Most sessions a client may have, 0 for no limit.  Settable by
+	    Max_Sessions_Per_Client. */
+	uint32_t max_sessions;
 } nfs_version4_parameter_t;
 
 /** @} */
@@ -212,6 +212,8 @@ void init_heartbeat(void);
 
 void gsh_dbus_pkginit(void);
 void gsh_dbus_pkgshutdown(void);
+bool gsh_dbus_request_name(void);
+void gsh_dbus_release_name(void);
 void *gsh_dbus_thread(void *arg);
 
 /* callout method */
@@ -0,0 +1,129 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @file gsh_inflight.h
+ * @brief Collapse concurrent cache misses on the same key
+ *
+ * When many threads miss a cache on the same key, only the first does
+ * the slow lookup; the others wait for it and then look in the cache
+ * again.  The table is small and fixed: once it is full, further
+ * lookups simply go ahead on their own.
+ */
+
+#ifndef GSH_INFLIGHT_H
+#define GSH_INFLIGHT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "common_utils.h"
+
+#define GSH_INFLIGHT_SLOTS 64
+
+struct gsh_inflight_slot {
+	const void *key;	/*< Owner's key, NULL if the slot is free */
+	size_t len;
+	uint32_t gen;		/*< Bumped each time a lookup ends */
+};
+
+struct gsh_inflight {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	struct gsh_inflight_slot slot[GSH_INFLIGHT_SLOTS];
+};
+
+#define GSH_INFLIGHT_INITIALIZER {		\
+	.mtx = PTHREAD_MUTEX_INITIALIZER,	\
+	.cond = PTHREAD_COND_INITIALIZER,	\
+}
+
+enum gsh_inflight_status {
+	GSH_INFLIGHT_OWNER,	/*< Do the lookup, then gsh_inflight_end() */
+	GSH_INFLIGHT_WAITED,	/*< Another lookup ended, check the cache */
+	GSH_INFLIGHT_FULL,	/*< Do the lookup, nothing to end */
+};
+
+/**
+ * @brief Claim a lookup, or wait for the one in progress
+ *
+ * @param[in]  inf  The table
+ * @param[in]  key  Key, which must stay valid until gsh_inflight_end()
+ * @param[in]  len  Length of the key
+ * @param[out] slot Slot to pass to gsh_inflight_end()
+ *
+ * @return What the caller should do next.
+ */
+static inline enum gsh_inflight_status
+gsh_inflight_begin(struct gsh_inflight *inf, const void *key, size_t len,
+		   int *slot)
+{
+	struct gsh_inflight_slot *s;
+	int i, free_slot = -1;
+	uint32_t gen;
+
+	PTHREAD_MUTEX_lock(&inf->mtx);
+
+	for (i = 0; i < GSH_INFLIGHT_SLOTS; i++) {
+		s = &inf->slot[i];
+		if (s->key == NULL) {
+			if (free_slot < 0)
+				free_slot = i;
+			continue;
+		}
+		if (s->len != len || memcmp(s->key, key, len) != 0)
+			continue;
+
+		gen = s->gen;
+		while (s->gen == gen)
+			pthread_cond_wait(&inf->cond, &inf->mtx);
+		PTHREAD_MUTEX_unlock(&inf->mtx);
+		return GSH_INFLIGHT_WAITED;
+	}
+
+	if (free_slot < 0) {
+		PTHREAD_MUTEX_unlock(&inf->mtx);
+		return GSH_INFLIGHT_FULL;
+	}
+
+	inf->slot[free_slot].key = key;
+	inf->slot[free_slot].len = len;
+	*slot = free_slot;
+
+	PTHREAD_MUTEX_unlock(&inf->mtx);
+	return GSH_INFLIGHT_OWNER;
+}
+
+/**
+ * @brief End a lookup claimed with gsh_inflight_begin()
+ *
+ * The result must be in the cache by now, for the waiters to find.
+ */
+static inline void gsh_inflight_end(struct gsh_inflight *inf, int slot)
+{
+	PTHREAD_MUTEX_lock(&inf->mtx);
+	inf->slot[slot].key = NULL;
+	inf->slot[slot].gen++;
+	pthread_cond_broadcast(&inf->cond);
+	PTHREAD_MUTEX_unlock(&inf->mtx);
+}
+
+#endif				/* GSH_INFLIGHT_H */
@@ -0,0 +1,193 @@
+#undef TRACEPOINT_PROVIDER
+#define TRACEPOINT_PROVIDER fsal
+
+#if !defined(GANESHA_LTTNG_FSAL_TP_H) || \
+	defined(TRACEPOINT_HEADER_MULTI_READ)
+#define GANESHA_LTTNG_FSAL_TP_H
+
+#include <stdint.h>
+#include <lttng/tracepoint.h>
+
+/**
+ * @brief Trace the start of a read or write by a backend
+ *
+ * Emitted just before the backend call, on the worker thread, so the
+ * timestamp difference to io_end is the time spent in the backend.
+ *
+ * @param[in] fsal	Name of the FSAL
+ * @param[in] obj	Address of the obj being read or written
+ * @param[in] write	1 for a write, 0 for a read
+ * @param[in] offset	Offset of the I/O
+ * @param[in] length	Bytes asked for
+ */
+TRACEPOINT_EVENT(
+	fsal,
+	io_start,
+	TP_ARGS(const char *, fsal,
+		void *, obj,
+		int, write,
+		uint64_t, offset,
+		uint64_t, length),
+	TP_FIELDS(
+		ctf_string(fsal, fsal)
+		ctf_integer_hex(void *, obj, obj)
+		ctf_integer(int, write, write)
+		ctf_integer(uint64_t, offset, offset)
+		ctf_integer(uint64_t, length, length)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	fsal,
+	io_start,
+	TRACE_INFO)
+
+/**
+ * @brief Trace the end of a read or write by a backend
+ *
+ * @param[in] obj	Address of the obj read or written
+ * @param[in] write	1 for a write, 0 for a read
+ * @param[in] result	Bytes transferred, or negative on error
+ * @param[in] error	errno of a failed call
+ */
+TRACEPOINT_EVENT(
+	fsal,
+	io_end,
+	TP_ARGS(void *, obj,
+		int, write,
+		int64_t, result,
+		int, error),
+	TP_FIELDS(
+		ctf_integer_hex(void *, obj, obj)
+		ctf_integer(int, write, write)
+		ctf_integer(int64_t, result, result)
+		ctf_integer(int, error, error)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	fsal,
+	io_end,
+	TRACE_INFO)
+
+/**
+ * @brief Trace a read or write handed to a backend without waiting
+ *
+ * The completion comes on a backend thread, so it is matched to this
+ * event by the address of the I/O rather than by thread.
+ *
+ * @param[in] fsal	Name of the FSAL
+ * @param[in] io	Address of the FSAL's record of the I/O
+ * @param[in] obj	Address of the obj being read or written
+ * @param[in] write	1 for a write, 0 for a read
+ * @param[in] offset	Offset of the I/O
+ * @param[in] length	Bytes asked for
+ */
+TRACEPOINT_EVENT(
+	fsal,
+	async_io_start,
+	TP_ARGS(const char *, fsal,
+		void *, io,
+		void *, obj,
+		int, write,
+		uint64_t, offset,
+		uint64_t, length),
+	TP_FIELDS(
+		ctf_string(fsal, fsal)
+		ctf_integer_hex(void *, io, io)
+		ctf_integer_hex(void *, obj, obj)
+		ctf_integer(int, write, write)
+		ctf_integer(uint64_t, offset, offset)
+		ctf_integer(uint64_t, length, length)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	fsal,
+	async_io_start,
+	TRACE_INFO)
+
+/**
+ * @brief Trace the completion of a read or write not waited for
+ *
+ * @param[in] io	Address of the FSAL's record of the I/O
+ * @param[in] result	Bytes transferred, or negative on error
+ * @param[in] error	errno of a failed call
+ */
+TRACEPOINT_EVENT(
+	fsal,
+	async_io_end,
+	TP_ARGS(void *, io,
+		int64_t, result,
+		int, error),
+	TP_FIELDS(
+		ctf_integer_hex(void *, io, io)
+		ctf_integer(int64_t, result, result)
+		ctf_integer(int, error, error)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	fsal,
+	async_io_end,
+	TRACE_INFO)
+
+/**
+ * @brief Trace the start of a lookup by a backend
+ *
+ * @param[in] fsal	Name of the FSAL
+ * @param[in] parent	Address of the directory searched
+ * @param[in] name	Name looked up
+ */
+TRACEPOINT_EVENT(
+	fsal,
+	lookup_start,
+	TP_ARGS(const char *, fsal,
+		void *, parent,
+		const char *, name),
+	TP_FIELDS(
+		ctf_string(fsal, fsal)
+		ctf_integer_hex(void *, parent, parent)
+		ctf_string(name, name)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	fsal,
+	lookup_start,
+	TRACE_INFO)
+
+/**
+ * @brief Trace the end of a lookup by a backend
+ *
+ * @param[in] parent	Address of the directory searched
+ * @param[in] obj	Address of the obj found, NULL if none
+ * @param[in] major	FSAL error
+ * @param[in] minor	Backend error
+ */
+TRACEPOINT_EVENT(
+	fsal,
+	lookup_end,
+	TP_ARGS(void *, parent,
+		void *, obj,
+		int, major,
+		int, minor),
+	TP_FIELDS(
+		ctf_integer_hex(void *, parent, parent)
+		ctf_integer_hex(void *, obj, obj)
+		ctf_integer(int, major, major)
+		ctf_integer(int, minor, minor)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	fsal,
+	lookup_end,
+	TRACE_INFO)
+
+#endif /* GANESHA_LTTNG_FSAL_TP_H */
+
+#undef TRACEPOINT_INCLUDE
+#define TRACEPOINT_INCLUDE "gsh_lttng/fsal.h"
+
+#include <lttng/tracepoint-event.h>
@@ -311,6 +311,65 @@ TRACEPOINT_LOGLEVEL(
 	mdc_readdir,
 	TRACE_INFO)
 
+/**
+ * @brief Trace a reaper thread waking up
+ *
+ * @param[in] function	Name of the reaper
+ * @param[in] line	Line number of call
+ * @param[in] used	Entries (or chunks) in use
+ * @param[in] open	Open file descriptors
+ */
+TRACEPOINT_EVENT(
+	mdcache,
+	mdc_lru_run_start,
+	TP_ARGS(const char *, function,
+		int, line,
+		uint64_t, used,
+		uint64_t, open),
+	TP_FIELDS(
+		ctf_string(function, function)
+		ctf_integer(int, line, line)
+		ctf_integer(uint64_t, used, used)
+		ctf_integer(uint64_t, open, open)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	mdcache,
+	mdc_lru_run_start,
+	TRACE_INFO)
+
+/**
+ * @brief Trace a reaper thread going back to sleep
+ *
+ * @param[in] function	Name of the reaper
+ * @param[in] line	Line number of call
+ * @param[in] work	Entries, chunks or fds reclaimed
+ * @param[in] closed	File descriptors closed
+ * @param[in] wait	Seconds until the next run
+ */
+TRACEPOINT_EVENT(
+	mdcache,
+	mdc_lru_run_end,
+	TP_ARGS(const char *, function,
+		int, line,
+		uint64_t, work,
+		uint64_t, closed,
+		uint64_t, wait),
+	TP_FIELDS(
+		ctf_string(function, function)
+		ctf_integer(int, line, line)
+		ctf_integer(uint64_t, work, work)
+		ctf_integer(uint64_t, closed, closed)
+		ctf_integer(uint64_t, wait, wait)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	mdcache,
+	mdc_lru_run_end,
+	TRACE_INFO)
+
 #endif /* GANESHA_LTTNG_MDCACHE_TP_H */
 
 #undef TRACEPOINT_INCLUDE
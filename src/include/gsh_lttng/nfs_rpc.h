@@ -152,6 +152,132 @@ TRACEPOINT_LOGLEVEL(
 	v4op_end,
 	TRACE_INFO)
 
+/**
+ * @brief Trace the time a request spent in each phase
+ *
+ * @param req     - the address of the request we just replied to
+ * @param decode  - nsecs decoding the header and arguments
+ * @param queue   - nsecs waiting for a worker
+ * @param execute - nsecs running the operation, less the FSAL
+ * @param fsal    - nsecs in the FSAL
+ * @param reply   - nsecs encoding and sending the reply
+ */
+
+TRACEPOINT_EVENT(
+	nfs_rpc,
+	phases,
+	TP_ARGS(request_data_t *, req,
+		uint64_t, decode,
+		uint64_t, queue,
+		uint64_t, execute,
+		uint64_t, fsal,
+		uint64_t, reply),
+	TP_FIELDS(
+		ctf_integer_hex(request_data_t *, req, req)
+		ctf_integer(uint64_t, decode, decode)
+		ctf_integer(uint64_t, queue, queue)
+		ctf_integer(uint64_t, execute, execute)
+		ctf_integer(uint64_t, fsal, fsal)
+		ctf_integer(uint64_t, reply, reply)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	nfs_rpc,
+	phases,
+	TRACE_INFO)
+
+/**
+ * @brief Trace the start of a duplicate request cache lookup
+ *
+ * @param req  - the address of the request being looked up
+ * @param xid  - RPC xid of the request
+ */
+
+TRACEPOINT_EVENT(
+	nfs_rpc,
+	drc_start,
+	TP_ARGS(request_data_t *, req,
+		uint32_t, xid),
+	TP_FIELDS(
+		ctf_integer_hex(request_data_t *, req, req)
+		ctf_integer(uint32_t, xid, xid)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	nfs_rpc,
+	drc_start,
+	TRACE_INFO)
+
+/**
+ * @brief Trace the end of a duplicate request cache lookup
+ *
+ * @param req     - the address of the request looked up
+ * @param status  - dupreq_status_t of nfs_dupreq_start
+ */
+
+TRACEPOINT_EVENT(
+	nfs_rpc,
+	drc_start_end,
+	TP_ARGS(request_data_t *, req,
+		int, status),
+	TP_FIELDS(
+		ctf_integer_hex(request_data_t *, req, req)
+		ctf_integer(int, status, status)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	nfs_rpc,
+	drc_start_end,
+	TRACE_INFO)
+
+/**
+ * @brief Trace the start of caching a request's reply
+ *
+ * @param req  - the address of the request being completed
+ */
+
+TRACEPOINT_EVENT(
+	nfs_rpc,
+	drc_finish,
+	TP_ARGS(request_data_t *, req),
+	TP_FIELDS(
+		ctf_integer_hex(request_data_t *, req, req)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	nfs_rpc,
+	drc_finish,
+	TRACE_INFO)
+
+/**
+ * @brief Trace the end of caching a request's reply
+ *
+ * The timestamp difference includes retiring older entries
+ *
+ * @param req     - the address of the request completed
+ * @param status  - dupreq_status_t of nfs_dupreq_finish
+ */
+
+TRACEPOINT_EVENT(
+	nfs_rpc,
+	drc_finish_end,
+	TP_ARGS(request_data_t *, req,
+		int, status),
+	TP_FIELDS(
+		ctf_integer_hex(request_data_t *, req, req)
+		ctf_integer(int, status, status)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	nfs_rpc,
+	drc_finish_end,
+	TRACE_INFO)
+
 #endif /* GANESHA_LTTNG_NFS_RPC_H */
 
 #undef TRACEPOINT_INCLUDE
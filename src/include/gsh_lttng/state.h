@@ -64,6 +64,141 @@ TRACEPOINT_LOGLEVEL(
 	delete,
 	TRACE_INFO)
 
+/**
+ * @brief Trace the start of a byte range lock request
+ *
+ * Emitted before the object's state lock is taken, so the timestamp
+ * difference to lock_end includes waiting for it.
+ *
+ * @param[in] function	Name of function locking
+ * @param[in] line	Line number of call
+ * @param[in] obj	obj being locked
+ * @param[in] owner	Lock owner
+ * @param[in] type	fsal_lock_t of the lock
+ * @param[in] start	Start of the range
+ * @param[in] length	Length of the range, 0 to end of file
+ * @param[in] blocking	state_blocking_t of the request
+ */
+TRACEPOINT_EVENT(
+	state,
+	lock_start,
+	TP_ARGS(const char *, function,
+		int, line,
+		void *, obj,
+		void *, owner,
+		int, type,
+		uint64_t, start,
+		uint64_t, length,
+		int, blocking),
+	TP_FIELDS(
+		ctf_string(function, function)
+		ctf_integer(int, line, line)
+		ctf_integer_hex(void *, obj, obj)
+		ctf_integer_hex(void *, owner, owner)
+		ctf_integer(int, type, type)
+		ctf_integer(uint64_t, start, start)
+		ctf_integer(uint64_t, length, length)
+		ctf_integer(int, blocking, blocking)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	state,
+	lock_start,
+	TRACE_INFO)
+
+/**
+ * @brief Trace the result of a byte range lock request
+ *
+ * @param[in] function	Name of function locking
+ * @param[in] line	Line number of call
+ * @param[in] obj	obj being locked
+ * @param[in] status	state_status_t of the request
+ */
+TRACEPOINT_EVENT(
+	state,
+	lock_end,
+	TP_ARGS(const char *, function,
+		int, line,
+		void *, obj,
+		int, status),
+	TP_FIELDS(
+		ctf_string(function, function)
+		ctf_integer(int, line, line)
+		ctf_integer_hex(void *, obj, obj)
+		ctf_integer(int, status, status)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	state,
+	lock_end,
+	TRACE_INFO)
+
+/**
+ * @brief Trace the start of a byte range unlock
+ *
+ * @param[in] function	Name of function unlocking
+ * @param[in] line	Line number of call
+ * @param[in] obj	obj being unlocked
+ * @param[in] owner	Lock owner
+ * @param[in] start	Start of the range
+ * @param[in] length	Length of the range, 0 to end of file
+ */
+TRACEPOINT_EVENT(
+	state,
+	unlock_start,
+	TP_ARGS(const char *, function,
+		int, line,
+		void *, obj,
+		void *, owner,
+		uint64_t, start,
+		uint64_t, length),
+	TP_FIELDS(
+		ctf_string(function, function)
+		ctf_integer(int, line, line)
+		ctf_integer_hex(void *, obj, obj)
+		ctf_integer_hex(void *, owner, owner)
+		ctf_integer(uint64_t, start, start)
+		ctf_integer(uint64_t, length, length)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	state,
+	unlock_start,
+	TRACE_INFO)
+
+/**
+ * @brief Trace the result of a byte range unlock
+ *
+ * The timestamp difference includes granting blocked locks.
+ *
+ * @param[in] function	Name of function unlocking
+ * @param[in] line	Line number of call
+ * @param[in] obj	obj being unlocked
+ * @param[in] status	state_status_t of the unlock
+ */
+TRACEPOINT_EVENT(
+	state,
+	unlock_end,
+	TP_ARGS(const char *, function,
+		int, line,
+		void *, obj,
+		int, status),
+	TP_FIELDS(
+		ctf_string(function, function)
+		ctf_integer(int, line, line)
+		ctf_integer_hex(void *, obj, obj)
+		ctf_integer(int, status, status)
+	)
+)
+
+TRACEPOINT_LOGLEVEL(
+	state,
+	unlock_end,
+	TRACE_INFO)
+
 #endif /* GANESHA_LTTNG_STATE_TP_H */
 
 #undef TRACEPOINT_INCLUDE
@@ -0,0 +1,89 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @file gsh_rcu.h
+ * @brief Read side sections for tables read on every request
+ *
+ * A reader brackets its loads of published pointers with
+ * gsh_rcu_read_lock() and gsh_rcu_read_unlock() and takes a reference
+ * on what it found before leaving.  A writer unpublishes a pointer,
+ * calls gsh_rcu_synchronize() and only then drops the reference that
+ * kept the object alive.  Readers never block; writers wait for the
+ * sections in progress, so this is only for rarely written tables.
+ */
+
+#ifndef GSH_RCU_H
+#define GSH_RCU_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "abstract_atomic.h"
+#include "gsh_intrinsic.h"
+
+#define GSH_RCU_SHARDS 64
+
+struct gsh_rcu_shard {
+	int64_t count;
+	GSH_CACHE_PAD(0);
+};
+
+struct gsh_rcu {
+	uint32_t phase;
+	GSH_CACHE_PAD(0);
+	struct gsh_rcu_shard readers[2][GSH_RCU_SHARDS];
+	pthread_mutex_t mutex;	/*< Serializes gsh_rcu_synchronize */
+};
+
+extern __thread int32_t gsh_rcu_shard;
+int32_t gsh_rcu_shard_assign(void);
+
+/**
+ * @brief Enter a read side section
+ *
+ * @param[in] rcu The table's read side state
+ *
+ * @return The counter to pass to gsh_rcu_read_unlock().
+ */
+static inline int64_t *gsh_rcu_read_lock(struct gsh_rcu *rcu)
+{
+	int32_t shard = gsh_rcu_shard;
+	int64_t *count;
+
+	if (unlikely(shard < 0))
+		shard = gsh_rcu_shard_assign();
+
+	count = &rcu->readers[atomic_fetch_uint32_t(&rcu->phase) & 1]
+			     [shard].count;
+	(void) atomic_inc_int64_t(count);
+	return count;
+}
+
+static inline void gsh_rcu_read_unlock(int64_t *count)
+{
+	(void) atomic_dec_int64_t(count);
+}
+
+void gsh_rcu_init(struct gsh_rcu *rcu);
+void gsh_rcu_destroy(struct gsh_rcu *rcu);
+void gsh_rcu_synchronize(struct gsh_rcu *rcu);
+
+#endif				/* GSH_RCU_H */
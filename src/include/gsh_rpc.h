@@ -145,6 +145,7 @@ const char *str_gc_proc(rpc_gss_proc_t);
 /* uint16_t actually used */
 #define XPRT_PRIVATE_FLAG_DECODING 0x0008
 #define XPRT_PRIVATE_FLAG_STALLED 0x0010	/* ie, -on stallq- */
+#define XPRT_PRIVATE_FLAG_TLS 0x0020	/* records in kernel TLS */
 
 /* uint32_t instructions */
 #define XPRT_PRIVATE_FLAG_LOCKED	SVC_XPRT_FLAG_LOCKED
@@ -152,12 +153,51 @@ const char *str_gc_proc(rpc_gss_proc_t);
 #define XPRT_PRIVATE_FLAG_INCREQ	0x00040000
 #define XPRT_PRIVATE_FLAG_DECREQ	0x00080000
 
+#ifdef _HAVE_GSSAPI
+/**
+ * @brief A connection's last RPCSEC_GSS context and who it mapped to
+ *
+ * Written under a sequence count, so readers never lock.  The bound
+ * context is referenced, so its address cannot be reused while bound.
+ */
+struct gss_binding {
+	int32_t seq;			/*< Odd while being written */
+	uint32_t gen;			/*< idmapper_cache_gen when mapped */
+	struct svc_rpc_gss_data *gd;	/*< NULL if nothing is bound */
+	uint32_t uid;
+	uint32_t gid;
+};
+#endif
+
 typedef struct gsh_xprt_private {
 	SVCXPRT *xprt;
 	struct glist_head stallq;
+	uint32_t inflight;	/*< requests queued or executing */
+	uint32_t corked;	/*< TCP_CORK set for reply coalescing */
+	uint32_t replies;	/*< replies sent, paces buffer tuning */
+	uint32_t sndbuf;	/*< auto-tuned SO_SNDBUF, 0 if untouched */
+	uint32_t rcvbuf;	/*< auto-tuned SO_RCVBUF, 0 if untouched */
+	int32_t numa_node;	/*< node the connection is received on,
+				    -1 if not yet known */
+	struct export_perm_cache *perm_cache;	/*< connection's resolved
+						    export perms, NULL if
+						    not connection oriented */
+	struct gsh_client *client;	/*< connection's client, referenced
+					    at accept, NULL if not
+					    connection oriented */
+#ifdef _HAVE_GSSAPI
+	struct gss_binding gss;		/*< only used when client is set */
+#endif
 	uint16_t flags;
+	uint32_t sched_weight;	/*< client's fair-share weight, 0 for
+				    default */
+	uint32_t sched_weight_gen;	/*< client_weight_gen sched_weight
+					    was read at, 0 if not cached */
 } gsh_xprt_private_t;
 
+struct export_perm_cache *export_perm_cache_alloc(void);
+void export_perm_cache_free(struct export_perm_cache *cache);
+
 static inline gsh_xprt_private_t *alloc_gsh_xprt_private(SVCXPRT *xprt,
 							 uint32_t flags)
 {
@@ -165,7 +205,20 @@ static inline gsh_xprt_private_t *alloc_gsh_xprt_private(SVCXPRT *xprt,
 		gsh_malloc(sizeof(gsh_xprt_private_t));
 
 	xu->xprt = xprt;
+	xu->inflight = 0;
+	xu->corked = 0;
+	xu->replies = 0;
+	xu->sndbuf = 0;
+	xu->rcvbuf = 0;
+	xu->numa_node = -1;
+	xu->perm_cache = NULL;
+	xu->client = NULL;
+#ifdef _HAVE_GSSAPI
+	memset(&xu->gss, 0, sizeof(xu->gss));
+#endif
 	xu->flags = flags;
+	xu->sched_weight = 0;
+	xu->sched_weight_gen = 0;
 
 	return xu;
 }
@@ -179,6 +232,12 @@ static inline void free_gsh_xprt_private(SVCXPRT *xprt)
 	gsh_xprt_private_t *xu = (gsh_xprt_private_t *)xprt->xp_u1;
 
 	if (xu) {
+		if (xu->perm_cache != NULL)
+			export_perm_cache_free(xu->perm_cache);
+#ifdef _HAVE_GSSAPI
+		if (xu->gss.gd != NULL)
+			unref_svc_rpc_gss_data(xu->gss.gd, 0);
+#endif
 		gsh_free(xu);
 		xprt->xp_u1 = NULL;
 	}
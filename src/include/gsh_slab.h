@@ -0,0 +1,106 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup gsh_slab Typed object slabs
+ *
+ * Freed objects of one type are kept for reuse instead of going back
+ * to the heap.  Each thread holds a small magazine of them that it
+ * allocates from and frees to without locking; a magazine that runs dry
+ * refills half way from the shared list of the slab, and one that
+ * overflows hands half of itself back.  The shared list holds at most
+ * the number of objects the slab was defined with, anything past that
+ * goes back to the heap.  Free objects are linked through their first
+ * word.
+ *
+ * Slabs are defined statically with GSH_SLAB_INITIALIZER and set up on
+ * first use, so they work in FSAL modules as well as in the core.  A
+ * module that defines one must destroy it before it is unloaded.  The
+ * pools of abstract_mem.h are slabs as well.
+ *
+ * A slab with a constructor hands out objects as they were freed
+ * instead of zeroed: the constructor runs once when an object comes
+ * from the heap and the destructor when it goes back, so state kept
+ * across reuse, such as an initialized mutex, need not be rebuilt.
+ * Only the first pointer of a freed object is overwritten.
+ *
+ * @{
+ */
+
+/**
+ * @file gsh_slab.h
+ * @brief Typed object slabs with per-thread magazines
+ */
+
+#ifndef GSH_SLAB_H
+#define GSH_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "gsh_list.h"
+
+struct gsh_slab {
+	const char *name;	/*< Name reported in stats */
+	size_t size;		/*< Size of each object */
+	uint32_t max;		/*< Most objects kept on head */
+	uint32_t tag;		/*< enum gsh_mem_tag charged with them */
+	void (*ctor)(void *);	/*< Run on objects new from the heap, or
+				    NULL to zero objects on every alloc */
+	void (*dtor)(void *);	/*< Run on objects going back to the heap */
+	pthread_mutex_t mtx;	/*< Protects everything below */
+	void *head;		/*< Shared free objects */
+	uint32_t count;		/*< Length of head */
+	struct glist_head mags;	/*< Magazines of running threads */
+	uint64_t allocs;	/*< Allocations by exited threads */
+	uint64_t frees;		/*< Frees by exited threads */
+	uint64_t hits;		/*< Allocations not from the heap by exited
+				    threads */
+	struct glist_head slabs;	/*< Link in the list of all slabs */
+	pthread_key_t key;	/*< Flushes a magazine on thread exit */
+	bool ready;		/*< Set up, key is valid */
+};
+
+/**
+ * @brief Define a slab of objects of a type
+ *
+ * @param[in] _name Name reported in stats
+ * @param[in] _type Type of the objects
+ * @param[in] _max  Most free objects kept beyond the magazines
+ * @param[in] _tag  Subsystem charged with the memory
+ */
+#define GSH_SLAB_INITIALIZER(_name, _type, _max, _tag) {	\
+	.name = _name,						\
+	.size = sizeof(_type),					\
+	.max = _max,						\
+	.tag = _tag,						\
+	.mtx = PTHREAD_MUTEX_INITIALIZER,			\
+}
+
+void *gsh_slab_alloc(struct gsh_slab *slab);
+void gsh_slab_free(struct gsh_slab *slab, void *obj);
+void gsh_slab_destroy(struct gsh_slab *slab);
+void gsh_slab_mem_usage(int64_t *bytes, int64_t *allocs);
+
+#endif				/* GSH_SLAB_H */
+
+/** @} */
@@ -77,6 +77,27 @@ typedef int (*val_display_function_t)(struct gsh_buffdesc *, char *);
 #define HT_FLAG_NONE 0x0000	/*< Null hash table flags */
 #define HT_FLAG_CACHE 0x0001	/*< Indicates that caching should be
 				   enabled */
+#define HT_FLAG_OPEN 0x0002	/*< Use open addressing partitions
+				   instead of red-black trees, the
+				   cache is not used with them.  Only
+				   for tables nobody walks through
+				   partitions[].rbt */
+
+/**
+ * @brief Hashes of the raw key bytes, selected with Hash_Function
+ *
+ * Only for tables whose keys are equal exactly when their bytes are.
+ */
+enum hash_key_func {
+	/** The table's own hash_func_key and hash_func_rbt */
+	HT_HASH_TABLE,
+	/** CityHash64 */
+	HT_HASH_CITY,
+	/** 64 bits of MurmurHash3_x64_128 */
+	HT_HASH_MURMUR3,
+	/** Two CRC32C passes, hardware assisted where available */
+	HT_HASH_CRC32C
+};
 
 /**
  * @brief Hash parameters
@@ -90,6 +111,8 @@ struct hash_param {
 	uint32_t cache_entry_count; /*< 2^10 <= Power of 2 <= 2^15 */
 	uint32_t index_size;	/*< Number of partition trees, this MUST
 				   be a prime number. */
+	uint32_t resize_load;	/*< Entries in a partition past which the
+				   table grows its partitions, 0 never */
 	index_function_t hash_func_key;	/*< Partition function,
 					   returns an integer from 0
 					   to (index_size - 1).  This
@@ -116,6 +139,10 @@ struct hash_param {
 					       to a string. */
 	val_display_function_t val_to_str; /*< Function to convert a
 					       value to a string. */
+	uint32_t key_hash; /*< An enum hash_key_func, unless
+			       HT_HASH_TABLE replaces hash_func_key and
+			       hash_func_rbt with a hash of the key
+			       bytes */
 	char *ht_name; /*< Name of this hash table. */
 	log_components_t ht_log_component; /*< Log component to use for this
 					       hash table */
@@ -137,6 +164,41 @@ typedef struct hash_stat {
 				       the rbt used. */
 } hash_stat_t;
 
+/** Slots in a group of an open addressing partition */
+#define HASH_OPEN_GROUP 16
+
+/**
+ * @brief A slot of an open addressing partition
+ */
+
+struct hash_open_slot {
+	struct hash_data data; /*< Key and value */
+	uint64_t hash; /*< Mixed hash, to regrow without rehashing keys */
+};
+
+/**
+ * @brief A group of slots probed together
+ *
+ * A tag byte per slot holds 7 bits of the hash of a full slot, so one
+ * compare of the tags finds the handful of slots worth comparing keys
+ * for.
+ */
+
+struct hash_open_group {
+	uint8_t tags[HASH_OPEN_GROUP]; /*< Slot tags */
+	struct hash_open_slot slots[HASH_OPEN_GROUP]; /*< Slots */
+};
+
+/**
+ * @brief An open addressing partition
+ */
+
+struct hash_open {
+	struct hash_open_group *groups; /*< Power of 2 groups */
+	uint32_t mask; /*< Number of groups - 1 */
+	uint32_t used; /*< Slots full or deleted */
+};
+
 /**
  * @brief Represents an individual partition
  *
@@ -149,6 +211,24 @@ struct hash_partition {
 	struct rbt_head rbt; /*< The red-black tree */
 	pthread_rwlock_t lock; /*< Lock for this partition */
 	struct rbt_node **cache; /*< Expected entry cache */
+	struct hash_open open; /*< Slots, with HT_FLAG_OPEN */
+};
+
+/** Largest number of partitions a table grows to */
+#define HASHTABLE_MAX_INDEX 65521
+
+/**
+ * @brief A set of partitions
+ *
+ * A table that grows gets a new set of partitions, the old set is kept
+ * until the table is destroyed so a thread that picked one of its
+ * locks before the switch can still take it and see it lost the race.
+ */
+
+struct hash_generation {
+	struct hash_generation *prev; /*< Set this one replaced */
+	uint32_t size; /*< Number of partitions */
+	struct hash_partition partitions[]; /*< The partitions */
 };
 
 /**
@@ -162,9 +242,15 @@ typedef struct hash_table {
 					 HashTable */
 	pool_t *node_pool; /*< Pool of RBT nodes */
 	pool_t *data_pool; /*< Pool of buffer pairs */
-	struct hash_partition partitions[]; /*< Parameter.index_size
-						partitions of the hash
-						table. */
+	pthread_rwlock_t resize_lock; /*< Held for read by walkers of the
+					  partitions, and for write by a
+					  resize */
+	int32_t resizing; /*< A resize is queued or running */
+	struct hash_generation *generation; /*< Current set of partitions */
+	struct hash_partition *partitions; /*< Parameter.index_size
+					       partitions of the hash
+					       table, those of the
+					       current generation. */
 } hash_table_t;
 
 /**
@@ -176,6 +262,7 @@ typedef struct hash_table {
 
 struct hash_latch {
 	struct rbt_node *locator; /*< Saved location in the tree */
+	struct hash_open_slot *slot; /*< Saved slot, with HT_FLAG_OPEN */
 	uint64_t rbt_hash; /*< Saved red-black hash */
 	uint32_t index;	/*< Saved partition index */
 };
@@ -202,6 +289,7 @@ typedef enum hash_error {
 } hash_error_t;
 
 const char *hash_table_err_to_str(hash_error_t err);
+uint64_t hashtable_hash_bytes(enum hash_key_func, const void *, size_t);
 
 /* These are the primitives of the hash table */
 
@@ -228,6 +316,8 @@ hash_error_t hashtable_delall(struct hash_table *,
 				      struct gsh_buffdesc));
 
 void hashtable_log(log_components_t, struct hash_table *);
+void hashtable_walk_begin(struct hash_table *);
+void hashtable_walk_end(struct hash_table *);
 
 /* These are very simple wrappers around the primitives */
 
@@ -43,6 +43,7 @@
 #include <pthread.h>
 #include "gsh_rpc.h"
 #include "gsh_types.h"
+#include "gsh_rcu.h"
 
 /* Arbitrary string buffer lengths */
 #define PWENT_BEST_GUESS_LEN 1024
@@ -56,6 +57,8 @@
 
 extern pthread_rwlock_t idmapper_user_lock;
 extern pthread_rwlock_t idmapper_group_lock;
+extern struct gsh_rcu idmapper_rcu;
+extern uint32_t idmapper_cache_gen;
 
 void idmapper_cache_init(void);
 bool idmapper_add_user(const struct gsh_buffdesc *, uid_t, const gid_t *,
@@ -67,6 +70,12 @@ bool idmapper_lookup_by_uid(const uid_t, const struct gsh_buffdesc **,
 			    const gid_t **);
 bool idmapper_lookup_by_gname(const struct gsh_buffdesc *, uid_t *);
 bool idmapper_lookup_by_gid(const gid_t, const struct gsh_buffdesc **);
+bool idmapper_peek_by_uname(const struct gsh_buffdesc *, uid_t *,
+			    const gid_t **);
+bool idmapper_peek_by_uid(const uid_t, const struct gsh_buffdesc **,
+			  const gid_t **);
+bool idmapper_peek_by_gname(const struct gsh_buffdesc *, gid_t *);
+bool idmapper_peek_by_gid(const gid_t, const struct gsh_buffdesc **);
 /** @} */
 
 bool idmapper_init(void);
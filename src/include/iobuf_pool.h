@@ -0,0 +1,81 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup iobuf_pool Shared I/O buffer pool
+ *
+ * Page aligned data buffers for READ and WRITE, carved out of a few
+ * fixed, pre-faulted regions (one per size class) that are optionally
+ * backed by 2MiB huge pages.  Borrowing a buffer is a freelist pop, so
+ * large I/O does not churn malloc or fault in fresh pages per request.
+ *
+ * The regions never move or grow once the pool is set up, so an FSAL
+ * can register them once for RDMA or O_DIRECT use with
+ * iobuf_pool_foreach_region().  When a class is exhausted, or a size
+ * is larger than the largest class, iobuf_get() falls back to an
+ * aligned heap allocation; iobuf_put() takes either kind.
+ *
+ * @{
+ */
+
+/**
+ * @file iobuf_pool.h
+ * @brief Shared aligned I/O buffer pool
+ */
+
+#ifndef IOBUF_POOL_H
+#define IOBUF_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Alignment of every buffer handed out by iobuf_get() */
+#define IOBUF_ALIGN 4096
+
+/** Smallest size class */
+#define IOBUF_MIN_SIZE IOBUF_ALIGN
+
+/** Maximum number of size classes */
+#define IOBUF_MAX_CLASSES 8
+
+/**
+ * @brief Callback for iobuf_pool_foreach_region()
+ *
+ * @param[in] base     Start of the region
+ * @param[in] len      Length of the region in bytes
+ * @param[in] buf_size Size of each buffer in the region
+ * @param[in] arg      Caller's argument
+ *
+ * @return 0 to continue, anything else stops the walk and is returned.
+ */
+typedef int (*iobuf_region_cb)(void *base, size_t len, size_t buf_size,
+			       void *arg);
+
+void iobuf_pool_pkginit(void);
+void *iobuf_get(size_t size);
+void iobuf_put(void *buf);
+bool iobuf_is_pooled(const void *buf);
+int iobuf_pool_foreach_region(iobuf_region_cb cb, void *arg);
+
+#endif				/* IOBUF_POOL_H */
+
+/** @} */
@@ -55,6 +55,17 @@ fsal_status_t mdcache_pkginit(void);
 int mdcache_set_param_from_conf(config_file_t parse_tree,
 				struct config_error_type *err_type);
 
+/* Change parameters on a running server */
+int mdcache_set_tunable(const char *name, uint64_t value);
+int mdcache_reread_tunables(config_file_t parse_tree,
+			    struct config_error_type *err_type);
+
+/* Prefetch the warm-start snapshot and start periodic snapshots */
+void mdcache_warm_start(void);
+
+/* Stop warm-start threads and write a final snapshot */
+void mdcache_warm_shutdown(void);
+
 bool mdcache_lru_fds_available(void);
 void init_fds_limit(void);
 #endif /* MDCACHE_H */
@@ -40,6 +40,31 @@ typedef int fsal_acl_status_t;
 #define NFS_V4_ACL_INIT_ENTRY_FAILED  6
 #define NFS_V4_ACL_NOT_FOUND  7
 
+/** Most distinct named groups a compiled ACL indexes */
+#define NFS4_ACL_MAX_GIDS 256
+
+/**
+ * @brief Evaluation aid built once when an ACL is interned
+ *
+ * ACE order still decides access, so this only takes the per-ACE
+ * principal tests out of the evaluation loop.
+ */
+struct fsal_acl_compiled {
+	/** Only OWNER@, GROUP@ and EVERYONE@ are named */
+	bool special_only;
+	/** With special_only, the bits whose first applicable ACE is
+	 *  an allow, by [is_dir][is_owner][is_group].
+	 */
+	fsal_aceperm_t allow[2][2][2];
+	/** Distinct gids of the named group ACEs, sorted, or 0 if there
+	 *  are more than NFS4_ACL_MAX_GIDS.
+	 */
+	uint32_t ngids;
+	gid_t *gids;
+	/** For each named group ACE, the index of its gid in gids */
+	uint16_t *gid_idx;
+};
+
 fsal_acl_t *nfs4_acl_alloc();
 fsal_ace_t *nfs4_ace_alloc(int nace);
 
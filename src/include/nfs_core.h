@@ -40,6 +40,8 @@
 
 #include "sal_data.h"
 #include "gsh_config.h"
+#include "common_utils.h"
+#include "req_arena.h"
 
 #ifdef _USE_9P
 #include "9p.h"
@@ -107,12 +109,33 @@ typedef enum request_type {
 #endif				/* _USE_9P */
 } request_type_t;
 
+/**
+ * @brief Phases of a request
+ *
+ * A request goes through these in order.  The time spent in the FSAL
+ * is taken out of execution, NFSv4 attribute encoding is part of
+ * execution because the operations do it themselves, and the reply is
+ * encoded and sent in one call to the RPC library.
+ */
+enum req_phase {
+	REQ_PHASE_DECODE,	/*< header and argument decoding */
+	REQ_PHASE_QUEUE,	/*< waiting for a worker */
+	REQ_PHASE_EXECUTE,	/*< running the protocol operation */
+	REQ_PHASE_FSAL,		/*< inside the FSAL, below MDCACHE */
+	REQ_PHASE_REPLY,	/*< encoding and sending the reply */
+	REQ_PHASES
+};
+
+extern const char *req_phase_name[REQ_PHASES];
+
 typedef struct request_data {
 	struct glist_head req_q;	/* chaining of pending requests */
 	struct timespec time_queued;	/*< The time at which a request was
 					 *  added to the worker thread queue.
 					 */
 	request_type_t rtype;
+	nsecs_elapsed_t phase_mark;	/*< when the current phase began */
+	nsecs_elapsed_t phase[REQ_PHASES];	/*< time spent in each phase */
 
 	union request_content {
 		rpc_call_t call;
@@ -123,10 +146,123 @@ typedef struct request_data {
 	} r_u;
 
 	uint32_t r_d_refs;	/* handle reference count */
+	struct req_arena arena;	/* request scoped scratch memory */
 } request_data_t;
 
 extern pool_t *request_pool;
 
+/**
+ * @brief Start timing the phases of a request
+ *
+ * @param[in] reqdata The request, as it is received
+ */
+static inline void req_phase_begin(request_data_t *reqdata)
+{
+	struct timespec ts;
+
+	now(&ts);
+	reqdata->phase_mark = timespec_to_nsecs(&ts);
+	memset(reqdata->phase, 0, sizeof(reqdata->phase));
+}
+
+/**
+ * @brief Close the current phase of a request
+ *
+ * @param[in] reqdata The request
+ * @param[in] phase   The phase that just ended
+ */
+static inline void req_phase_end(request_data_t *reqdata,
+				 enum req_phase phase)
+{
+	struct timespec ts;
+	nsecs_elapsed_t mark;
+
+	now(&ts);
+	mark = timespec_to_nsecs(&ts);
+	reqdata->phase[phase] += mark - reqdata->phase_mark;
+	reqdata->phase_mark = mark;
+}
+
+/**
+ * @brief Move the time spent in the FSAL out of execution
+ *
+ * @param[in] reqdata   The request, its execution phase closed
+ * @param[in] fsal_time Time its op context spent in the FSAL
+ */
+static inline void req_phase_fsal(request_data_t *reqdata,
+				  nsecs_elapsed_t fsal_time)
+{
+	if (fsal_time > reqdata->phase[REQ_PHASE_EXECUTE])
+		fsal_time = reqdata->phase[REQ_PHASE_EXECUTE];
+	reqdata->phase[REQ_PHASE_EXECUTE] -= fsal_time;
+	reqdata->phase[REQ_PHASE_FSAL] += fsal_time;
+}
+
+/**
+ * @brief What a worker is executing
+ *
+ * Each worker thread owns one, reported by the ShowInflight D-Bus method
+ * and used to log slow requests.  Only the owner writes it, bumping seq
+ * to odd before and back to even after, so readers take a consistent
+ * copy without stopping it.  fsal_call is stored on its own, outside
+ * the seq pair.
+ */
+struct req_inflight {
+	struct glist_head list;	/*< on the list of all workers */
+	uint32_t seq;
+	uint32_t worker;	/*< worker index */
+	const char *proc;	/*< procedure name, NULL when idle */
+	const char *op;		/*< NFSv4 operation, else proc */
+	uint32_t xid;
+	int32_t export_id;	/*< -1 until known */
+	enum req_phase phase;
+	struct timespec received;	/*< when the request was queued */
+	struct timespec started;	/*< when the worker picked it up */
+	sockaddr_t client;
+	uint32_t fh_len;
+	char fh[NFS4_FHSIZE];	/*< handle being operated on */
+	const char *fsal_call;	/*< sub-FSAL call in progress, or NULL */
+};
+
+extern __thread struct req_inflight *req_inflight_cur;
+
+void req_inflight_register(unsigned int worker);
+void req_inflight_unregister(void);
+void req_inflight_begin(request_data_t *reqdata);
+void req_inflight_op(const char *op, const void *fh, uint32_t fh_len);
+void req_inflight_phase(enum req_phase phase);
+void req_inflight_end(request_data_t *reqdata);
+void req_inflight_count(uint32_t *workers, uint32_t *busy,
+			uint32_t *in_fsal);
+
+/**
+ * @brief Note a call into the sub-FSAL
+ *
+ * @param[in] call Text of the call
+ *
+ * @return The call it nests in, for req_inflight_fsal_exit().
+ */
+static inline const char *req_inflight_fsal_enter(const char *call)
+{
+	struct req_inflight *ri = req_inflight_cur;
+	const char *prev;
+
+	if (ri == NULL)
+		return NULL;
+
+	prev = ri->fsal_call;
+	atomic_store_voidptr((void **)&ri->fsal_call, (void *)call);
+	return prev;
+}
+
+static inline void req_inflight_fsal_exit(const char *prev)
+{
+	struct req_inflight *ri = req_inflight_cur;
+
+	if (ri != NULL)
+		atomic_store_voidptr((void **)&ri->fsal_call, (void *)prev);
+}
+
 /* ServerEpoch is ServerBootTime unless overriden by -E command line option */
 extern struct timespec ServerBootTime;
 extern time_t ServerEpoch;
@@ -143,6 +279,7 @@ extern char *pidfile_path;
 
 #ifdef _USE_9P
 void *_9p_dispatcher_thread(void *arg);
+void _9p_tcp_conn_put(struct _9p_conn *pconn);
 void _9p_tcp_process_request(struct _9p_request_data *req9p);
 int _9p_process_buffer(struct _9p_request_data *req9p, char *replydata,
 		       u32 *poutlen);
@@ -161,17 +298,42 @@ void _9p_rdma_cleanup_conn(msk_trans_t *trans);
 void Clean_RPC(void);
 void nfs_Init_svc(void);
 void nfs_rpc_dispatch_stop(void);
+void nfs_rpc_register_programs(void);
+int nfs_rpc_listener_fds(int *fds, int max);
 
 request_data_t *nfs_rpc_dequeue_req(nfs_worker_data_t *worker);
 void nfs_rpc_enqueue_req(request_data_t *req);
+uint32_t nfs_rpc_xprt_done(SVCXPRT *xprt);
+uint32_t nfs_rpc_inflight_count(void);
+uint32_t nfs_rpc_outstanding_reqs_est(void);
+bool nfs_rpc_req_stale(request_data_t *reqdata);
+void nfs_rpc_export_release(request_data_t *reqdata);
 uint32_t get_dequeue_count(void);
 uint32_t get_enqueue_count(void);
 
+#ifdef USE_RPC_TLS
+/* in nfs_rpc_tls.c */
+
+#ifndef AUTH_TLS
+#define AUTH_TLS 7		/* RFC 9289 */
+#endif
+
+bool nfs_rpc_tls_init(void);
+enum xprt_stat nfs_rpc_tls_starttls(struct svc_req *req);
+bool nfs_rpc_tls_refused(struct svc_req *req);
+#endif
+
 /* in nfs_worker_thread.c */
 
 int worker_init(void);
+int worker_resize(uint32_t nb_worker);
 int worker_shutdown(void);
 
+/* in nfs_tunables.c */
+
+int nfs_set_tunable(const char *name, uint64_t value);
+int reread_tunables(config_file_t config, struct config_error_type *err_type);
+
 /* Config parsing routines */
 extern config_file_t config_struct;
 extern struct config_block nfs_core;
@@ -187,9 +349,19 @@ void nfs_Init_admin_thread(void);
 void *admin_thread(void *UnusedArg);
 void admin_halt(void);
 
-/* Tools */
+/* in nfs_upgrade.c */
+
+/** Every udp and tcp listener, as handed over by an upgrade */
+#define NFS_UPGRADE_MAX_FDS (2 * P_COUNT)
+
+extern bool nfs_upgrading;
 
-int compare_state_id(struct gsh_buffdesc *buff1, struct gsh_buffdesc *buff2);
+bool nfs_upgrade_init(char **argv);
+int nfs_upgrade_recv_sockets(int *fds, int max);
+void nfs_upgrade_ready(void);
+bool nfs_upgrade_start(char **errormsg);
+
+/* Tools */
 
 /* used in DBUS-api diagnostic functions (e.g., serialize sessionid) */
 int b64_ntop(u_char const *src, size_t srclength, char *target,
@@ -55,6 +55,7 @@ enum drc_type {
 #define DRC_FLAG_LOCKED 0x0010
 #define DRC_FLAG_RECYCLE 0x0020
 #define DRC_FLAG_RELEASE 0x0040
+#define DRC_FLAG_CAPPED 0x0080	/*< reached DRC_Client_Max_Bytes */
 
 typedef struct drc {
 	enum drc_type type;
@@ -70,6 +71,8 @@ typedef struct drc {
 	uint32_t flags;
 	uint32_t refcnt; /* call path refs */
 	uint32_t retwnd;
+	uint32_t limits_gen; /* maxsize and hiwat are as of this retune */
+	uint64_t lru_bytes; /* charged by its entries on the global LRU */
 	union {
 		struct {
 			sockaddr_t addr;
@@ -92,6 +95,10 @@ struct dupreq_entry {
 	struct opr_rbtree_node rbt_k;
 	/* Define the tail queue */
 	TAILQ_ENTRY(dupreq_entry) fifo_q;
+	/* Global LRU, when DRC_Max_Bytes is set */
+	TAILQ_ENTRY(dupreq_entry) lru_q;
+	uint32_t lru_cost;	/*< bytes charged to the budget, 0 if not
+				    on the LRU */
 	pthread_mutex_t mtx;
 	struct {
 		drc_t *drc;
@@ -117,7 +124,7 @@ extern pool_t *nfs_res_pool;
 
 static inline nfs_res_t *alloc_nfs_res(void)
 {
-	return pool_alloc(nfs_res_pool);
+	return (nfs_res_t *) pool_alloc(nfs_res_pool);
 }
 
 static inline void free_nfs_res(nfs_res_t *res)
@@ -135,6 +142,7 @@ typedef enum dupreq_status {
 
 void dupreq2_pkginit(void);
 void dupreq2_pkgshutdown(void);
+int dupreq2_retune(void);
 
 drc_t *drc_get_tcp_drc(struct svc_req *);
 void drc_release_tcp_drc(drc_t *);
@@ -45,8 +45,15 @@
 
 #define GANESHA_FH_VERSION 0x43
 #define FILE_HANDLE_V4_FLAG_DS	0x01 /*< handle for a DS */
+#define FILE_HANDLE_FLAG_KEY_HASH 0x02 /*< key hash follows fsopaque */
 #define FH_FSAL_BIG_ENDIAN	0x40 /*< FSAL FH is big endian */
 
+/* A handle flagged FILE_HANDLE_FLAG_KEY_HASH carries, right after the
+ * fs_len bytes of fsopaque and in the byte order of FH_FSAL_BIG_ENDIAN,
+ * a 64 bit hash of the FSAL key of the object: the hash the cache keys
+ * the object's entry by.  It is only a hint, a wrong one just misses.
+ */
+
 /**
  * @brief An NFSv3 handle
  *
@@ -39,6 +39,54 @@
 #include "sal_data.h"
 #include "export_mgr.h"
 #include "nfs_fh.h"
+#include "req_arena.h"
+
+/**
+ * @brief Size of the key hash a handle carries after its fsopaque
+ *
+ * @param[in] fhflags1 Handle flags
+ *
+ * @return The size of the hash, 0 if the handle has none.
+ */
+
+static inline size_t nfs_fh_key_hash_size(uint8_t fhflags1)
+{
+	return (fhflags1 & FILE_HANDLE_FLAG_KEY_HASH) ? sizeof(uint64_t) : 0;
+}
+
+/**
+ * @brief Get the key hash a handle carries, if it can be trusted
+ *
+ * The hash is in the byte order of the server that made the handle,
+ * there is no point in swapping a hint we would then miss with.
+ *
+ * @param[in]  fhflags1 Handle flags
+ * @param[in]  fsopaque Opaque part of the handle
+ * @param[in]  fs_len   Length of the opaque part
+ * @param[out] hash     The hash
+ *
+ * @return true if the handle has a usable hash.
+ */
+
+static inline bool nfs_fh_get_key_hash(uint8_t fhflags1,
+				       const uint8_t *fsopaque,
+				       uint8_t fs_len,
+				       uint64_t *hash)
+{
+	if (!(fhflags1 & FILE_HANDLE_FLAG_KEY_HASH))
+		return false;
+
+#if (BYTE_ORDER == BIG_ENDIAN)
+	if (!(fhflags1 & FH_FSAL_BIG_ENDIAN))
+		return false;
+#else
+	if (fhflags1 & FH_FSAL_BIG_ENDIAN)
+		return false;
+#endif
+
+	memcpy(hash, fsopaque + fs_len, sizeof(*hash));
+	return true;
+}
 
 /**
  * @brief Get the actual size of a v3 handle based on the sized fsopaque
@@ -51,7 +99,8 @@ static inline size_t nfs3_sizeof_handle(struct file_handle_v3 *hdl)
 	int hsize;
 	int aligned_hsize;
 
-	hsize = offsetof(struct file_handle_v3, fsopaque) + hdl->fs_len;
+	hsize = offsetof(struct file_handle_v3, fsopaque) + hdl->fs_len +
+		nfs_fh_key_hash_size(hdl->fhflags1);
 
 	/* correct packet's fh length so it's divisible by 4 to trick dNFS into
 	   working. This is essentially sending the padding. */
@@ -76,7 +125,7 @@ void nfs3_AllocateFH(nfs_fh3 *fh)
 {
 	/* Allocating the filehandle in memory */
 	fh->data.data_len = NFS3_FHSIZE;
-	fh->data.data_val = gsh_calloc(1, NFS3_FHSIZE);
+	fh->data.data_val = (char *) gsh_calloc(1, NFS3_FHSIZE);
 }
 
 static inline void nfs3_freeFH(nfs_fh3 *fh)
@@ -100,7 +149,36 @@ void nfs4_AllocateFH(nfs_fh4 *fh)
 {
 	/* Allocating the filehandle in memory */
 	fh->nfs_fh4_len = NFS4_FHSIZE;
-	fh->nfs_fh4_val = gsh_calloc(1, NFS4_FHSIZE);
+	fh->nfs_fh4_val = (char *) gsh_calloc(1, NFS4_FHSIZE);
+}
+
+/**
+ *
+ * @brief Allocates a compound scratch NFSv4 filehandle.
+ *
+ * The current and saved filehandles of a compound never outlive the
+ * request, so they come from the request arena when there is one.
+ *
+ * @param fh [INOUT] the filehandle to manage.
+ *
+ */
+static inline
+void nfs4_AllocateScratchFH(nfs_fh4 *fh)
+{
+	fh->nfs_fh4_len = NFS4_FHSIZE;
+	if (op_ctx->arena != NULL)
+		fh->nfs_fh4_val = (char *) req_arena_calloc(op_ctx->arena,
+							    NFS4_FHSIZE);
+	else
+		fh->nfs_fh4_val = (char *) gsh_calloc(1, NFS4_FHSIZE);
+}
+
+static inline void nfs4_freeScratchFH(nfs_fh4 *fh)
+{
+	if (op_ctx->arena == NULL)
+		gsh_free(fh->nfs_fh4_val);
+	fh->nfs_fh4_len = 0;
+	fh->nfs_fh4_val = NULL;
 }
 
 static inline void nfs4_freeFH(nfs_fh4 *fh)
@@ -118,7 +196,8 @@ static inline void nfs4_freeFH(nfs_fh4 *fh)
 
 static inline size_t nfs4_sizeof_handle(struct file_handle_v4 *hdl)
 {
-	return offsetof(struct file_handle_v4, fsopaque)+hdl->fs_len;
+	return offsetof(struct file_handle_v4, fsopaque) + hdl->fs_len +
+		nfs_fh_key_hash_size(hdl->fhflags1);
 }
 
 #define LEN_FH_STR 1024
@@ -194,6 +194,9 @@ typedef struct nfs_request {
 	nfs_arg_t arg_nfs;
 	nfs_res_t *res_nfs;
 	const nfs_function_desc_t *funcdesc;
+	/** Export the request is charged to for Max_Inflight, referenced,
+	    or NULL */
+	struct gsh_export *admit_export;
 } nfs_request_t;
 
 enum rpc_chan_type {
@@ -204,6 +207,9 @@ enum rpc_chan_type {
 typedef struct rpc_call_channel {
 	enum rpc_chan_type type;
 	pthread_mutex_t mtx;
+	pthread_cond_t cv;	/*< Signalled when inflight drops to 0 */
+	uint32_t inflight;	/*< Calls sent without holding mtx */
+	bool draining;		/*< Being destroyed, start no new calls */
 	uint32_t states;
 	union {
 		nfs_client_id_t *clientid;
@@ -275,6 +275,9 @@ int nfs4_op_getdevicelist(struct nfs_argop4 *, compound_data_t *,
 int nfs4_op_free_stateid(struct nfs_argop4 *, compound_data_t *,
 			 struct nfs_resop4 *);
 
+int nfs4_op_get_dir_delegation(struct nfs_argop4 *, compound_data_t *,
+			       struct nfs_resop4 *);
+
 int nfs4_op_getdeviceinfo(struct nfs_argop4 *, compound_data_t *,
 			  struct nfs_resop4 *);
 
@@ -284,6 +287,9 @@ int nfs4_op_destroy_clientid(struct nfs_argop4 *, compound_data_t *,
 int nfs4_op_destroy_session(struct nfs_argop4 *, compound_data_t *,
 			    struct nfs_resop4 *);
 
+int nfs4_op_bind_conn(struct nfs_argop4 *, compound_data_t *,
+		      struct nfs_resop4 *);
+
 int nfs4_op_layoutget(struct nfs_argop4 *, compound_data_t *,
 		      struct nfs_resop4 *);
 
@@ -333,6 +339,26 @@ int nfs4_op_seek(struct nfs_argop4 *, compound_data_t *,
 
 void nfs4_op_seek_Free(nfs_resop4 *resp);
 
+int nfs4_op_copy(struct nfs_argop4 *, compound_data_t *,
+		 struct nfs_resop4 *);
+
+void nfs4_op_copy_Free(nfs_resop4 *resp);
+
+int nfs4_op_clone(struct nfs_argop4 *, compound_data_t *,
+		  struct nfs_resop4 *);
+
+void nfs4_op_clone_Free(nfs_resop4 *resp);
+
+int nfs4_op_offload_status(struct nfs_argop4 *, compound_data_t *,
+			   struct nfs_resop4 *);
+
+void nfs4_op_offload_status_Free(nfs_resop4 *resp);
+
+int nfs4_op_offload_cancel(struct nfs_argop4 *, compound_data_t *,
+			   struct nfs_resop4 *);
+
+void nfs4_op_offload_cancel_Free(nfs_resop4 *resp);
+
 int nfs4_op_io_advise(struct nfs_argop4 *, compound_data_t *,
 		      struct nfs_resop4 *);
 
@@ -490,7 +516,9 @@ void nfs4_op_create_session_Free(nfs_resop4 *);
 void nfs4_op_getdevicelist_Free(nfs_resop4 *);
 void nfs4_op_getdeviceinfo_Free(nfs_resop4 *);
 void nfs4_op_free_stateid_Free(nfs_resop4 *);
+void nfs4_op_get_dir_delegation_Free(nfs_resop4 *);
 void nfs4_op_destroy_session_Free(nfs_resop4 *);
+void nfs4_op_bind_conn_Free(nfs_resop4 *);
 void nfs4_op_lock_Free(nfs_resop4 *);
 void nfs4_op_lockt_Free(nfs_resop4 *);
 void nfs4_op_locku_Free(nfs_resop4 *);
@@ -85,8 +85,27 @@ struct xdr_attrs_args {
 	compound_data_t *data;
 	bool statfscalled;
 	fsal_dynamicfsinfo_t *dynamicinfo;
+	struct fattr4_cache *cache;	/*< Encoded attributes of the object,
+					   or NULL */
+	uint32_t cache_gen;	/*< cache->gen from before attrs were
+				   fetched */
+	bool cache_fill;	/*< Leave the result in cache */
 };
 
+/**
+ * @brief An object's encoded attribute cache, if it has one
+ *
+ * @param[in] obj The object
+ *
+ * @return The cache or NULL.
+ */
+static inline struct fattr4_cache *fattr4_cache_of(struct fsal_obj_handle *obj)
+{
+	if (obj->state_hdl == NULL || !obj->state_hdl->fattr.enabled)
+		return NULL;
+	return &obj->state_hdl->fattr;
+}
+
 typedef struct fattr4_dent {
 	char *name;		/* The name of the operation */
 	unsigned int supported;	/* Is this action supported? */
@@ -264,6 +283,20 @@ typedef enum {
 
 nfsstat4 nfs4_utf8string2dynamic(const utf8string *input, utf8_scantype_t scan,
 				 char **obj_name);
+nfsstat4 nfs4_utf8string2scratch(const utf8string *input, utf8_scantype_t scan,
+				 char **obj_name);
+
+/**
+ * @brief Release memory from nfs4_utf8string2scratch
+ *
+ * Arena memory goes back with the request, so this only frees when the
+ * request has no arena.
+ */
+static inline void nfs4_free_scratch(void *ptr)
+{
+	if (op_ctx->arena == NULL)
+		gsh_free(ptr);
+}
 
 int bitmap4_to_attrmask_t(bitmap4 *bitmap4, attrmask_t *mask);
 
@@ -298,6 +331,8 @@ int nfs4_FSALattr_To_Fattr(struct xdr_attrs_args *, struct bitmap4 *,
 
 void nfs4_bitmap4_Remove_Unsupported(struct bitmap4 *);
 
+size_t nfs4_Fattr_Min_Size(struct bitmap4 *);
+
 enum nfs4_minor_vers {
 	NFS4_MINOR_VERS_0,
 	NFS4_MINOR_VERS_1,
@@ -46,8 +46,39 @@ struct req_q {
 	uint32_t waiters;
 };
 
+/**
+ * @brief Number of flow buckets in a fair-share queue
+ *
+ * Clients are hashed onto buckets by address (stochastic fair
+ * queueing), so this bounds memory independently of client count.
+ */
+#define REQ_FQ_BUCKETS 64
+
+struct req_fq_bucket {
+	struct glist_head q;	/*< queued requests, FIFO */
+	struct glist_head active;	/*< link in req_fq.active */
+	int32_t deficit;	/*< DRR deficit counter */
+	uint32_t weight;	/*< quantum, from the last client seen */
+	uint32_t size;
+};
+
+/**
+ * @brief Deficit round-robin queue over client flows
+ *
+ * Replaces the producer/consumer FIFO of a class when fair-share
+ * scheduling is enabled, so that one busy client cannot starve the
+ * others sharing the class.
+ */
+struct req_fq {
+	pthread_spinlock_t sp;
+	struct glist_head active;	/*< ring of non-empty buckets */
+	uint32_t size;
+	struct req_fq_bucket bucket[REQ_FQ_BUCKETS];
+};
+
 struct req_q_pair {
 	const char *s;
+	struct req_fq *fq;	/* fair-share queue, or NULL for FIFO */
 	GSH_CACHE_PAD(0);
 	struct req_q producer;	/* from decoder */
 	GSH_CACHE_PAD(1);
@@ -63,18 +94,35 @@ struct req_q_pair {
 
 extern const char *req_q_s[N_REQ_QUEUES];	/* for debug prints */
 
+/**
+ * @brief One shard of the request queues
+ *
+ * Each shard carries the full set of classification queues, plus its
+ * own list of idle workers, so that producers and consumers running on
+ * different CPUs do not contend on the same spinlocks.  Workers are
+ * bound to a home shard, drain it first, and steal from sibling shards
+ * when it runs dry.
+ */
 struct req_q_set {
 	struct req_q_pair qset[N_REQ_QUEUES];
+	uint32_t ctr;		/*< slot rotor for this shard */
+	GSH_CACHE_PAD(0);
+	uint32_t spinners;	/*< idle workers polling before parking */
+	pthread_spinlock_t sp;	/*< protects wait_list and waiters */
+	struct glist_head wait_list;
+	uint32_t waiters;
+	GSH_CACHE_PAD(1);
 };
 
 struct nfs_req_st {
 	struct {
 		uint32_t ctr;
-		struct req_q_set nfs_request_q;
+		uint32_t nshards;	/*< number of queue shards */
+		uint32_t nnodes;	/*< NUMA groups, shard s is on
+					    node s % nnodes */
+		struct req_q_set *nfs_request_q;	/*< array of shards */
 		uint64_t size;
-		pthread_spinlock_t sp;
-		struct glist_head wait_list;
-		uint32_t waiters;
+		uint32_t waiters;	/*< idle workers, all shards */
 	} reqs;
 	GSH_CACHE_PAD(1);
 	struct {
@@ -83,6 +131,26 @@ struct nfs_req_st {
 		uint32_t stalled;
 		bool active;
 	} stallq;
+	GSH_CACHE_PAD(2);
+	/** Latency driven admission control */
+	struct {
+		pthread_spinlock_t sp;	/*< protects the interval state */
+		nsecs_elapsed_t interval_start;
+		nsecs_elapsed_t min_sojourn;	/*< lowest wait this interval */
+		uint32_t samples;
+		uint32_t overloaded;	/*< min wait above target */
+		uint32_t inflight;	/*< requests queued or executing */
+		uint32_t active_xprts;	/*< connections with inflight */
+		uint64_t stalls;	/*< times a connection was held */
+		pthread_mutex_t mtx;
+		pthread_cond_t cv;	/*< signalled when load clears */
+	} admission;
+	/** Requests never executed, see nfs_rpc_req_stale() */
+	struct {
+		uint64_t closed;	/*< connection destroyed */
+		uint64_t late;		/*< past the request deadline */
+		uint64_t in_progress;	/*< duplicate of a queued request */
+	} dropped;
 };
 
 extern struct nfs_req_st nfs_req_st;
@@ -97,12 +165,12 @@ static inline void nfs_rpc_q_init(struct req_q *q)
 	q->waiters = 0;
 }
 
-static inline uint32_t nfs_rpc_q_next_slot(void)
+static inline uint32_t nfs_rpc_q_next_slot(struct req_q_set *shard)
 {
-	uint32_t ix = atomic_inc_uint32_t(&nfs_req_st.reqs.ctr);
+	uint32_t ix = atomic_inc_uint32_t(&shard->ctr);
 
 	if (!ix)
-		ix = atomic_inc_uint32_t(&nfs_req_st.reqs.ctr);
+		ix = atomic_inc_uint32_t(&shard->ctr);
 	return ix;
 }
 
@@ -111,15 +179,21 @@ static inline void nfs_rpc_queue_awaken(void *arg)
 	struct nfs_req_st *st = arg;
 	struct glist_head *g = NULL;
 	struct glist_head *n = NULL;
+	uint32_t ix;
+
+	for (ix = 0; ix < st->reqs.nshards; ++ix) {
+		struct req_q_set *shard = &st->reqs.nfs_request_q[ix];
 
-	pthread_spin_lock(&st->reqs.sp);
-	glist_for_each_safe(g, n, &st->reqs.wait_list) {
-		wait_q_entry_t *wqe = glist_entry(g, wait_q_entry_t, waitq);
+		pthread_spin_lock(&shard->sp);
+		glist_for_each_safe(g, n, &shard->wait_list) {
+			wait_q_entry_t *wqe =
+				glist_entry(g, wait_q_entry_t, waitq);
 
-		pthread_cond_signal(&wqe->lwe.cv);
-		pthread_cond_signal(&wqe->rwe.cv);
+			pthread_cond_signal(&wqe->lwe.cv);
+			pthread_cond_signal(&wqe->rwe.cv);
+		}
+		pthread_spin_unlock(&shard->sp);
 	}
-	pthread_spin_unlock(&st->reqs.sp);
 }
 
 #endif				/* NFS_REQ_QUEUE_H */
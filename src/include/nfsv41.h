@@ -2574,8 +2574,8 @@ extern "C" {
 	} seek_res4;
 
 	typedef struct OFFLOAD_STATUS4resok {
-		length4         osr_bytes_copied;
-		count4          osr_count_complete;
+		length4         osr_count;
+		count4          osr_count_complete;	/* 0 or 1 */
 		nfsstat4        osr_complete;
 	} OFFLOAD_STATUS4resok;
 
@@ -2616,39 +2616,58 @@ extern "C" {
 	};
 	typedef struct OFFLOAD_REVOKE4res OFFLOAD_REVOKE4res;
 
+	typedef struct {
+		netloc_type4    nl_type;
+		union {
+			utf8str_cis nl_name;
+			utf8str_cis nl_url;
+			netaddr4    nl_addr;
+		};
+	} netloc4;
+
 	struct COPY4args {
 		stateid4        ca_src_stateid;
 		stateid4        ca_dst_stateid;
 		offset4         ca_src_offset;
 		offset4         ca_dst_offset;
 		length4         ca_count;
-		netloc_type4        ca_type;
-		union {
-			utf8str_cis ca_name;
-			utf8str_cis ca_url;
-			netaddr4    ca_addr;
-		};
+		bool_t          ca_consecutive;
+		bool_t          ca_synchronous;
+		struct {
+			u_int ca_source_server_len;
+			netloc4 *ca_source_server_val;
+		} ca_source_server;
 	};
 	typedef struct COPY4args COPY4args;
 
+	typedef struct {
+		bool_t          cr_consecutive;
+		bool_t          cr_synchronous;
+	} copy_requirements4;
+
+	typedef struct {
+		write_response4    cr_response;
+		copy_requirements4 cr_requirements;
+	} COPY4resok;
+
 	struct COPY4res {
 		nfsstat4 cr_status;
 		union {
-			write_response4 cr_resok4;
-			length4         cr_bytes_copied;
+			COPY4resok         cr_resok4;
+			copy_requirements4 cr_requirements;
 		} COPY4res_u;
 	};
 	typedef struct COPY4res COPY4res;
 
-	struct OFFLOAD_ABORT4args {
-		stateid4        oaa_stateid;
+	struct OFFLOAD_CANCEL4args {
+		stateid4        oca_stateid;
 	};
-	typedef struct OFFLOAD_ABORT4args OFFLOAD_ABORT4args;
+	typedef struct OFFLOAD_CANCEL4args OFFLOAD_CANCEL4args;
 
-	struct OFFLOAD_ABORT4res {
-		stateid4        oar_stateid;
+	struct OFFLOAD_CANCEL4res {
+		nfsstat4        ocr_status;
 	};
-	typedef struct OFFLOAD_ABORT4res OFFLOAD_ABORT4res;
+	typedef struct OFFLOAD_CANCEL4res OFFLOAD_CANCEL4res;
 
 	struct OFFLOAD_STATUS4args {
 		stateid4        osa_stateid;
@@ -2663,6 +2682,20 @@ extern "C" {
 	};
 	typedef struct OFFLOAD_STATUS4res OFFLOAD_STATUS4res;
 
+	struct CLONE4args {
+		stateid4        cl_src_stateid;
+		stateid4        cl_dst_stateid;
+		offset4         cl_src_offset;
+		offset4         cl_dst_offset;
+		length4         cl_count;
+	};
+	typedef struct CLONE4args CLONE4args;
+
+	struct CLONE4res {
+		nfsstat4        cl_status;
+	};
+	typedef struct CLONE4res CLONE4res;
+
 	struct WRITE_SAME4args {
 		stateid4        wp_stateid;
 		stable_how4     wp_stable;
@@ -3167,7 +3200,7 @@ extern "C" {
 			COPY_NOTIFY4args opoffload_notify;
 			OFFLOAD_REVOKE4args opcopy_revoke;
 			COPY4args opcopy;
-			OFFLOAD_ABORT4args opoffload_abort;
+			OFFLOAD_CANCEL4args opoffload_cancel;
 			OFFLOAD_STATUS4args opoffload_status;
 			WRITE_SAME4args opwrite_plus;
 			ALLOCATE4args opallocate;
@@ -3177,6 +3210,7 @@ extern "C" {
 			IO_ADVISE4args opio_advise;
 			LAYOUTERROR4args oplayouterror;
 			LAYOUTSTATS4args oplayoutstats;
+			CLONE4args opclone;
 
 			/* NFSv4.3 */
 			GETXATTR4args opgetxattr;
@@ -3252,7 +3286,7 @@ extern "C" {
 			COPY_NOTIFY4res opoffload_notify;
 			OFFLOAD_REVOKE4res opcopy_revoke;
 			COPY4res opcopy;
-			OFFLOAD_ABORT4res opoffload_abort;
+			OFFLOAD_CANCEL4res opoffload_cancel;
 			OFFLOAD_STATUS4res opoffload_status;
 			WRITE_SAME4res opwrite_plus;
 			ALLOCATE4res opallocate;
@@ -3262,6 +3296,7 @@ extern "C" {
 			IO_ADVISE4res opio_advise;
 			LAYOUTERROR4res oplayouterror;
 			LAYOUTSTATS4res oplayoutstats;
+			CLONE4res opclone;
 
 			/* NFSv4.3 */
 			GETXATTR4res opgetxattr;
@@ -8063,6 +8098,161 @@ extern "C" {
 		return true;
 	}
 
+	static inline bool xdr_netloc4(XDR * xdrs, netloc4 *objp)
+	{
+		if (!inline_xdr_enum(xdrs, (enum_t *)&objp->nl_type))
+			return false;
+		switch (objp->nl_type) {
+		case NL4_NAME:
+			if (!xdr_utf8str_cis(xdrs, &objp->nl_name))
+				return false;
+			break;
+		case NL4_URL:
+			if (!xdr_utf8str_cis(xdrs, &objp->nl_url))
+				return false;
+			break;
+		case NL4_NETADDR:
+			if (!xdr_netaddr4(xdrs, &objp->nl_addr))
+				return false;
+			break;
+		default:
+			return false;
+		}
+		return true;
+	}
+
+	static inline bool xdr_COPY4args(XDR * xdrs, COPY4args *objp)
+	{
+		if (!xdr_stateid4(xdrs, &objp->ca_src_stateid))
+			return false;
+		if (!xdr_stateid4(xdrs, &objp->ca_dst_stateid))
+			return false;
+		if (!xdr_offset4(xdrs, &objp->ca_src_offset))
+			return false;
+		if (!xdr_offset4(xdrs, &objp->ca_dst_offset))
+			return false;
+		if (!xdr_length4(xdrs, &objp->ca_count))
+			return false;
+		if (!inline_xdr_bool(xdrs, &objp->ca_consecutive))
+			return false;
+		if (!inline_xdr_bool(xdrs, &objp->ca_synchronous))
+			return false;
+		if (!xdr_array
+		    (xdrs,
+		     (char **)&objp->ca_source_server.ca_source_server_val,
+		     &objp->ca_source_server.ca_source_server_len,
+		     XDR_ARRAY_MAXLEN, sizeof(netloc4),
+		     (xdrproc_t) xdr_netloc4))
+			return false;
+		return true;
+	}
+
+	static inline bool xdr_copy_requirements4(XDR * xdrs,
+						  copy_requirements4 *objp)
+	{
+		if (!inline_xdr_bool(xdrs, &objp->cr_consecutive))
+			return false;
+		if (!inline_xdr_bool(xdrs, &objp->cr_synchronous))
+			return false;
+		return true;
+	}
+
+	static inline bool xdr_COPY4res(XDR * xdrs, COPY4res *objp)
+	{
+		if (!xdr_nfsstat4(xdrs, &objp->cr_status))
+			return false;
+		switch (objp->cr_status) {
+		case NFS4_OK:
+			if (!xdr_WRITE_SAME4resok(xdrs,
+				&objp->COPY4res_u.cr_resok4.cr_response))
+				return false;
+			if (!xdr_copy_requirements4(xdrs,
+				&objp->COPY4res_u.cr_resok4.cr_requirements))
+				return false;
+			break;
+		case NFS4ERR_OFFLOAD_NO_REQS:
+			if (!xdr_copy_requirements4(xdrs,
+				&objp->COPY4res_u.cr_requirements))
+				return false;
+			break;
+		default:
+			break;
+		}
+		return true;
+	}
+
+	static inline bool xdr_OFFLOAD_CANCEL4args(XDR * xdrs,
+						   OFFLOAD_CANCEL4args *objp)
+	{
+		if (!xdr_stateid4(xdrs, &objp->oca_stateid))
+			return false;
+		return true;
+	}
+
+	static inline bool xdr_OFFLOAD_CANCEL4res(XDR * xdrs,
+						  OFFLOAD_CANCEL4res *objp)
+	{
+		if (!xdr_nfsstat4(xdrs, &objp->ocr_status))
+			return false;
+		return true;
+	}
+
+	static inline bool xdr_OFFLOAD_STATUS4args(XDR * xdrs,
+						   OFFLOAD_STATUS4args *objp)
+	{
+		if (!xdr_stateid4(xdrs, &objp->osa_stateid))
+			return false;
+		return true;
+	}
+
+	static inline bool xdr_OFFLOAD_STATUS4res(XDR * xdrs,
+						  OFFLOAD_STATUS4res *objp)
+	{
+		OFFLOAD_STATUS4resok *resok =
+			&objp->OFFLOAD_STATUS4res_u.osr_resok4;
+
+		if (!xdr_nfsstat4(xdrs, &objp->osr_status))
+			return false;
+		switch (objp->osr_status) {
+		case NFS4_OK:
+			if (!xdr_length4(xdrs, &resok->osr_count))
+				return false;
+			if (!xdr_count4(xdrs, &resok->osr_count_complete))
+				return false;
+			if (resok->osr_count_complete > 1)
+				return false;
+			if (resok->osr_count_complete == 1)
+				if (!xdr_nfsstat4(xdrs, &resok->osr_complete))
+					return false;
+			break;
+		default:
+			break;
+		}
+		return true;
+	}
+
+	static inline bool xdr_CLONE4args(XDR * xdrs, CLONE4args *objp)
+	{
+		if (!xdr_stateid4(xdrs, &objp->cl_src_stateid))
+			return false;
+		if (!xdr_stateid4(xdrs, &objp->cl_dst_stateid))
+			return false;
+		if (!xdr_offset4(xdrs, &objp->cl_src_offset))
+			return false;
+		if (!xdr_offset4(xdrs, &objp->cl_dst_offset))
+			return false;
+		if (!xdr_length4(xdrs, &objp->cl_count))
+			return false;
+		return true;
+	}
+
+	static inline bool xdr_CLONE4res(XDR * xdrs, CLONE4res *objp)
+	{
+		if (!xdr_nfsstat4(xdrs, &objp->cl_status))
+			return false;
+		return true;
+	}
+
 	static inline bool xdr_data_contents(XDR * xdrs, contents *objp)
 	{
 		if (!inline_xdr_enum(xdrs, (enum_t *)&objp->what))
@@ -8558,10 +8748,30 @@ extern "C" {
 			break;
 
 		case NFS4_OP_COPY:
-		case NFS4_OP_COPY_NOTIFY:
+			if (!xdr_COPY4args(xdrs,
+					&objp->nfs_argop4_u.opcopy))
+				return false;
+			lkhd->flags |= NFS_LOOKAHEAD_WRITE;
+			(lkhd->write)++;
+			break;
 		case NFS4_OP_OFFLOAD_CANCEL:
+			if (!xdr_OFFLOAD_CANCEL4args(xdrs,
+					&objp->nfs_argop4_u.opoffload_cancel))
+				return false;
+			break;
 		case NFS4_OP_OFFLOAD_STATUS:
+			if (!xdr_OFFLOAD_STATUS4args(xdrs,
+					&objp->nfs_argop4_u.opoffload_status))
+				return false;
+			break;
 		case NFS4_OP_CLONE:
+			if (!xdr_CLONE4args(xdrs,
+					&objp->nfs_argop4_u.opclone))
+				return false;
+			lkhd->flags |= NFS_LOOKAHEAD_WRITE;
+			(lkhd->write)++;
+			break;
+		case NFS4_OP_COPY_NOTIFY:
 			break;
 
 		/* NFSv4.3 */
@@ -8908,10 +9118,26 @@ extern "C" {
 			break;
 
 		case NFS4_OP_COPY:
-		case NFS4_OP_COPY_NOTIFY:
+			if (!xdr_COPY4res
+			    (xdrs, &objp->nfs_resop4_u.opcopy))
+				return false;
+			break;
 		case NFS4_OP_OFFLOAD_CANCEL:
+			if (!xdr_OFFLOAD_CANCEL4res
+			    (xdrs, &objp->nfs_resop4_u.opoffload_cancel))
+				return false;
+			break;
 		case NFS4_OP_OFFLOAD_STATUS:
+			if (!xdr_OFFLOAD_STATUS4res
+			    (xdrs, &objp->nfs_resop4_u.opoffload_status))
+				return false;
+			break;
 		case NFS4_OP_CLONE:
+			if (!xdr_CLONE4res
+			    (xdrs, &objp->nfs_resop4_u.opclone))
+				return false;
+			break;
+		case NFS4_OP_COPY_NOTIFY:
 
 		/* NFSv4.3 */
 		case NFS4_OP_GETXATTR:
@@ -225,6 +225,29 @@ nfsstat4 FSAL_encode_file_layout(XDR *xdrs,
 nfsstat4 FSAL_encode_v4_multipath(XDR *xdrs, const uint32_t num_hosts,
 				  const fsal_multipath_member_t *hosts);
 
+/**
+ * @brief A data server in a flex files layout
+ */
+typedef struct fsal_ff_data_server {
+	struct pnfs_deviceid deviceid;	/*< Device of the data server */
+	uint32_t efficiency;		/*< Higher is better */
+	struct gsh_buffdesc fh;		/*< File handle on the data server */
+	uid_t uid;			/*< Credentials for loosely */
+	gid_t gid;			/*< coupled I/O */
+} fsal_ff_data_server_t;
+
+nfsstat4 FSAL_encode_flex_file_layout(XDR *xdrs, const length4 stripe_unit,
+				      const uint32_t num_mirrors,
+				      const uint32_t stripe_width,
+				      const fsal_ff_data_server_t *dss);
+
+nfsstat4 FSAL_encode_flex_file_devaddr(XDR *xdrs, const uint32_t num_hosts,
+				       const fsal_multipath_member_t *hosts,
+				       const uint32_t version,
+				       const uint32_t minorversion,
+				       const uint32_t rsize,
+				       const uint32_t wsize);
+
 nfsstat4 posix2nfs4_error(int posix_errorcode);
 
 /*
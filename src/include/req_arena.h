@@ -0,0 +1,73 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup req_arena Request scoped memory
+ *
+ * A bump pointer arena that lives for the duration of one request.
+ * Protocol handlers use it for scratch memory that is never referenced
+ * once the reply is sent (current and saved filehandles, decoded
+ * names), and the whole arena is returned in one step when the request
+ * completes.  Slabs are recycled through a small per-thread cache so
+ * steady state request processing does not touch malloc.
+ *
+ * Reply bodies must not be allocated here: the duplicate request cache
+ * and NFSv4.1 slot replay keep results alive past the request.
+ *
+ * @{
+ */
+
+/**
+ * @file req_arena.h
+ * @brief Request scoped arena allocator
+ */
+
+#ifndef REQ_ARENA_H
+#define REQ_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Usable bytes in a standard slab */
+#define REQ_ARENA_SLAB_SIZE (16 * 1024)
+
+/** Alignment of every arena allocation */
+#define REQ_ARENA_ALIGN 16
+
+struct req_arena_slab {
+	struct req_arena_slab *next;	/*< Next slab in arena or cache */
+	size_t size;			/*< Usable bytes in data */
+	size_t used;			/*< Bytes handed out so far */
+	char data[] __attribute__ ((aligned(REQ_ARENA_ALIGN)));
+};
+
+struct req_arena {
+	struct req_arena_slab *slabs;	/*< Head is the slab being bumped */
+};
+
+void *req_arena_alloc(struct req_arena *arena, size_t size);
+void *req_arena_calloc(struct req_arena *arena, size_t size);
+void req_arena_release(struct req_arena *arena);
+void req_arena_thread_cleanup(void);
+
+#endif				/* REQ_ARENA_H */
+
+/** @} */
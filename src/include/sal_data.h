@@ -46,6 +46,7 @@
 
 #include "abstract_atomic.h"
 #include "abstract_mem.h"
+#include "gsh_slab.h"
 #include "hashtable.h"
 #include "fsal_pnfs.h"
 #include "config_parsing.h"
@@ -116,13 +117,25 @@ extern pool_t *nfs41_session_pool;
 extern hash_table_t *ht_session_id;
 
 /**
- * @brief Number of forechannel slots in a session
+ * @brief Lowest forechannel slot target
  *
- * This is also the maximum number of backchannel slots we'll use,
- * even if the client offers more.
+ * This is the lowest target we shrink a forechannel slot table to.
  */
 #define NFS41_NB_SLOTS 3
 
+/**
+ * @brief Size of a session's backchannel slot table
+ *
+ * This is the most backchannel slots we'll use, even if the client
+ * offers more; nfsv4_param.cb_slots may lower it.
+ */
+#define NFS41_MAX_CB_SLOTS 16
+
+/**
+ * @brief Default for nfsv4_param.max_slots
+ */
+#define NFS41_MAX_SLOTS_DEFAULT 64
+
 /**
  * @brief Members in the slot table
  */
@@ -151,8 +164,30 @@ typedef struct nfs41_cb_session_slot {
 enum {
 	session_bc_up = 0x01,
 	session_bc_fault = 0x02, /* not actually used anywhere */
+	session_cb_sec = 0x04, /* cb_sec_parms is set */
 };
 
+/**
+ * @brief A connection bound to an NFSv4.1 session
+ *
+ * Clients spread one session over several connections (trunking, or
+ * nconnect) and move the back channel between them.  Each holds a
+ * reference on its transport.  The list is kept most recently used
+ * first so the connection a run of SEQUENCEs arrives on is found at
+ * the head.
+ */
+
+struct nfs41_session_conn {
+	struct glist_head link;	/*< Link in the session's conns */
+	SVCXPRT *xprt;		/*< Referenced transport */
+	channel_dir_from_server4 dir;	/*< Channels bound on it */
+	uint64_t requests;	/*< SEQUENCEs received on it */
+	time_t last_used;	/*< When the last one came in */
+};
+
+/** Connections kept per session, the least recently used goes first */
+#define NFS41_SESSION_MAX_CONNS 64
+
 /**
  * @brief Structure representing an NFSv4.1 session
  */
@@ -167,15 +202,26 @@ struct nfs41_session {
 					   sessions for this
 					   clientid */
 	uint32_t flags;		/*< Flags pertaining to this session */
-	SVCXPRT *xprt;		/*< Referenced pointer to transport */
-
-	channel_attrs4 fore_channel_attrs;	/*< Fore-channel attributes */
-	nfs41_session_slot_t slots[NFS41_NB_SLOTS];	/*< Slot table */
+	pthread_mutex_t conn_mutex;	/*< Protects conns and num_conns,
+					   never held while taking
+					   cb_chan.mtx */
+	struct glist_head conns;	/*< Bound nfs41_session_conn */
+	uint32_t num_conns;	/*< Length of conns */
+
+	channel_attrs4 fore_channel_attrs;	/*< Fore-channel attributes,
+						   ca_maxrequests is the
+						   size of slots */
+	nfs41_session_slot_t *slots;	/*< Slot table */
+	uint32_t target_slots;	/*< Slots the client is asked to use */
 
 	channel_attrs4 back_channel_attrs;	/*< Back-channel attributes */
-	nfs41_cb_session_slot_t cb_slots[NFS41_NB_SLOTS];	/*< Callback
+	nfs41_cb_session_slot_t cb_slots[NFS41_MAX_CB_SLOTS];	/*< Callback
 								   Slot table */
 	uint32_t cb_program;	/*< Callback program ID */
+	callback_sec_parms4 cb_sec_parms;	/*< Security the back channel
+						   was set up with, to set
+						   it up again on another
+						   connection */
 	struct rpc_call_channel cb_chan;	/*< Back channel */
 	pthread_mutex_t cb_mutex;	/*< Protects the cb slot table,
 					   when searching for a free slot */
@@ -215,7 +261,9 @@ typedef struct rdel_fh {
  */
 typedef struct clid_entry {
 	struct glist_head cl_list;	/*< Link in the list */
+	struct glist_head cl_hash;	/*< Link in its name hash bucket */
 	struct glist_head cl_rfh_list;
+	bool cl_reclaim_complete;	/*< Client sent RECLAIM_COMPLETE */
 	char cl_name[PATH_MAX];	/*< Client name */
 } clid_entry_t;
 
@@ -228,7 +276,6 @@ extern char v4_recov_dir[PATH_MAX];
  *
  *****************************************************************************/
 
-extern hash_table_t *ht_state_id;
 
 #include "sal_shared.h"
 
@@ -315,6 +362,7 @@ struct state_deleg {
 	time_t sd_grant_time;               /* time of successful delegation */
 	enum deleg_state sd_state;
 	struct cf_deleg_stats sd_clfile_stats;  /* client specific */
+	uint32_t sd_notify;	/* directory only, NOTIFY4 types granted */
 };
 
 /**
@@ -499,6 +547,9 @@ struct state_nlm_client_t {
 	char *slc_nlm_caller_name;	/*< Client name */
 	CLIENT *slc_callback_clnt;	/*< Callback for blocking locks */
 	AUTH *slc_callback_auth;	/*< Authentication for callback */
+	int32_t slc_grants_pending;	/*< GRANTED callbacks awaiting
+					   GRANTED_RES, protected by
+					   nlm_async_resp_mutex */
 };
 
 /**
@@ -645,6 +696,29 @@ typedef enum clientid_status {
 	CLIENT_ID_STALE		/*< requested client id stale */
 } clientid_status_t;
 
+/**
+ * @brief Per-client limits from the NFSv4 block
+ */
+
+enum nfs4_client_limit {
+	CLIENT_LIMIT_OPEN_OWNERS,	/*< Max_Open_Owners_Per_Client */
+	CLIENT_LIMIT_LOCK_OWNERS,	/*< Max_Lock_Owners_Per_Client */
+	CLIENT_LIMIT_STATES,	/*< Max_States_Per_Client */
+	CLIENT_LIMIT_SESSIONS	/*< Max_Sessions_Per_Client */
+};
+
+/**
+ * @brief Packing of nfs_client_id_t::cid_lease
+ *
+ * The time of the last renewal is in the high 32 bits, the count of
+ * reservations and LEASE_EXPIRING in the low 32 bits.
+ */
+#define LEASE_EXPIRING 0x80000000ULL
+#define LEASE_RESERVATIONS(lease) ((lease) & 0x7FFFFFFFULL)
+#define LEASE_LAST_RENEW(lease) ((time_t) ((lease) >> 32))
+#define LEASE_WORD(renew, lease) \
+	(((uint64_t) (uint32_t) (renew) << 32) | ((lease) & 0xFFFFFFFFULL))
+
 /**
  * @brief Record associated with a clientid
  *
@@ -655,7 +729,6 @@ struct nfs_client_id_t {
 	clientid4 cid_clientid;	/*< The clientid */
 	verifier4 cid_verifier;	/*< Known verifier */
 	verifier4 cid_incoming_verifier; /*< Most recently supplied verifier */
-	time_t cid_last_renew;	/*< Time of last renewal */
 	nfs_clientid_confirm_state_t cid_confirmed; /*< Confirm/expire state */
 	nfs_client_cred_t cid_credential;	/*< Client credential */
 	int cid_allow_reclaim;	/*< Whether this client can still
@@ -691,16 +764,26 @@ struct nfs_client_id_t {
 	time_t first_path_down_resp_time;  /* Time when the server first sent
 					       NFS4ERR_CB_PATH_DOWN */
 	unsigned int cid_nb_session;	/*< Number of sessions stored */
+	uint32_t cid_nb_openowners;	/*< Number of open owners */
+	uint32_t cid_nb_lockowners;	/*< Number of lock owners */
+	uint32_t cid_nb_states;	/*< Number of stateids held */
+	uint32_t cid_limits_logged;	/*< Per-client limits already
+					   logged, bits of
+					   nfs4_client_limit */
 	CREATE_SESSION4res cid_create_session_slot; /*< Cached response to
 							  last CREATE_SESSION */
 	unsigned cid_create_session_sequence;	/*< Sequence number for session
 						   creation. */
 	state_owner_t cid_owner;	/*< Owner for per-client state */
 	int32_t cid_refcount;	/*< Reference count for lifecycle */
-	int cid_lease_reservations;	/*< Counted lease reservations, to spare
-					   this clientid from the reaper */
+	uint64_t cid_lease;	/*< Last renewal and counted lease
+				   reservations, to spare this clientid
+				   from the reaper, see LEASE_WORD */
+	struct glist_head cid_lease_wheel;	/*< Slot in the lease expiry
+						   wheel */
+	time_t cid_lease_deadline;	/*< Deadline the clientid is queued
+					   at in the wheel */
 	uint32_t cid_minorversion;
-	uint32_t cid_stateid_counter;
 
 	uint32_t curr_deleg_grants; /* current num of delegations owned by
 				       this client */
@@ -779,8 +862,6 @@ typedef struct state_nlm_block_data_t {
 						   FH buffer */
 } state_nlm_block_data_t;
 
-extern struct glist_head state_blocked_locks;
-
 /**
  * @brief Grant types
  */
@@ -807,7 +888,8 @@ typedef enum state_block_type_t {
  * @brief Blocking lock data
  */
 struct state_block_data_t {
-	struct glist_head sbd_list;	/*< Lost of blocking locks */
+	struct glist_head sbd_list;	/*< Blocked locks on the same file */
+	struct glist_head sbd_poll_list; /*< Link on the polled locks list */
 	state_grant_type_t sbd_grant_type;	/*< Type of grant */
 	state_block_type_t sbd_block_type;	/*< Type of block */
 	granted_callback_t sbd_granted_callback; /*< Callback for grant */
@@ -819,8 +901,29 @@ struct state_block_data_t {
 	} sbd_prot;
 };
 
+/**
+ * @brief Node of a per-file byte-range lock index
+ *
+ * The index is an AVL tree ordered by range start.  Each node also
+ * carries the largest range end in its subtree, so the locks
+ * overlapping a range are found without walking the whole lock list.
+ */
+struct lock_range_node {
+	struct lock_range_node *left, *right, *parent;
+	uint64_t start;		/*< First byte of the range */
+	uint64_t end;		/*< Last byte of the range */
+	uint64_t max_end;	/*< Largest end in this subtree */
+	int height;		/*< Height of this subtree */
+};
+
+struct lock_range_tree {
+	struct lock_range_node *root;
+};
+
 struct state_lock_entry_t {
 	struct glist_head sle_list;	/*< Locks on this file */
+	struct lock_range_node sle_range; /*< Link in the file lock index */
+	bool sle_indexed;	/*< sle_list is on the file lock list */
 	struct glist_head sle_owner_locks; /*< Link on the owner lock list */
 	struct glist_head sle_client_locks;	/*< Locks on this client */
 	struct glist_head sle_state_locks;	/*< Locks on this state */
@@ -874,6 +977,15 @@ struct file_deleg_stats {
 	uint32_t fds_num_opens;         /* total num of opens so far. */
 	time_t fds_first_open;          /* time that we started recording
 					   num_opens */
+	uint32_t fds_write_opens;       /* opens for write among num_opens */
+	uint32_t fds_recalls_sent;      /* times a recall was sent */
+	uint32_t fds_revoke_count;      /* times a delegation was revoked */
+	clientid4 fds_last_opener;      /* client of the last open */
+	time_t fds_last_open;
+	clientid4 fds_last_writer;      /* client of the last open for write */
+	time_t fds_last_write;
+	time_t fds_last_contention;     /* last open of the file by one client
+					   conflicting with another's */
 };
 
 /**
@@ -890,6 +1002,17 @@ struct state_file {
 	struct glist_head layoutrecall_list;
 	/** Pointers for lock list. Protected by state_lock */
 	struct glist_head lock_list;
+	/** Index of lock_list by range. Protected by state_lock */
+	struct lock_range_tree lock_tree;
+	/** Export every lock on lock_list was taken through, NULL if they
+	 *  span exports. Protected by state_lock */
+	struct gsh_export *lock_export;
+	/** Blocked locks on this file in the order they blocked.
+	 *  Protected by blocked_locks_mutex */
+	struct glist_head blocked_locks;
+	/** Link on the list of files with blocked locks.
+	 *  Protected by blocked_locks_mutex */
+	struct glist_head blocked_files;
 	/** Pointers for NLM share list. Protected by state_lock */
 	struct glist_head nlm_share_list;
 	/** Share reservation state for this file. Protected by state_lock */
@@ -919,12 +1042,33 @@ struct state_dir {
 	    for which this entry is a root for. This field is used
 	    with the atomic inc/dec/fetch routines. */
 	int32_t exp_root_refcount;
+	/** Directory delegations granted on this directory.
+	 * Protected by state_lock */
+	struct glist_head dir_delegations;
+};
+
+/**
+ * @brief The last fattr4 encoded for an object
+ *
+ * GETATTR leaves its encoded reply here, and later GETATTRs and
+ * READDIRs asking the same of the same object through the same export
+ * copy it for as long as gen has not moved.  Only a cache that bumps
+ * gen whenever it changes the object's attributes (MDCACHE) enables
+ * it.
+ */
+struct fattr4_cache {
+	pthread_spinlock_t sp;		/*< Protects blob */
+	bool enabled;
+	uint32_t gen;			/*< Bumped when the attributes change */
+	void *blob;			/*< Single allocation, or NULL */
 };
 
 struct state_hdl {
 	/** Lock protecting state */
 	pthread_rwlock_t state_lock;
 	bool no_cleanup;
+	/** Encoded attributes, not protected by state_lock */
+	struct fattr4_cache fattr;
 	union {
 		struct state_file	file;
 		struct state_dir	dir;
@@ -1086,9 +1230,9 @@ typedef struct nfs_grace_start {
 	char *ipaddr;		/*< IP of failed node */
 } nfs_grace_start_t;
 
-/* Memory pools */
+/* Memory slabs */
 
-extern pool_t *state_owner_pool;	/*< Pool for NFSv4 files's open owner */
+extern struct gsh_slab state_owner_slab; /*< Slab for all state owners */
 
 #ifdef DEBUG_SAL
 extern struct glist_head state_v4_all;
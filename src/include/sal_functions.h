@@ -105,22 +105,62 @@ static inline void state_hdl_init(struct state_hdl *ostate,
 {
 	memset(ostate, 0, sizeof(*ostate));
 	PTHREAD_RWLOCK_init(&ostate->state_lock, NULL);
+	pthread_spin_init(&ostate->fattr.sp, PTHREAD_PROCESS_PRIVATE);
 	switch (type) {
 	case REGULAR_FILE:
 		glist_init(&ostate->file.list_of_states);
 		glist_init(&ostate->file.layoutrecall_list);
 		glist_init(&ostate->file.lock_list);
+		glist_init(&ostate->file.blocked_locks);
 		glist_init(&ostate->file.nlm_share_list);
 		ostate->file.obj = obj;
 		break;
 	case DIRECTORY:
 		glist_init(&ostate->dir.export_roots);
+		glist_init(&ostate->dir.dir_delegations);
 		break;
 	default:
 		break;
 	}
 }
 
+/**
+ * @brief Let the protocol layer cache encoded attributes for an object
+ *
+ * The caller must then call fattr4_cache_invalidate() whenever it
+ * changes the object's attributes, and fattr4_cache_fini() before the
+ * handle goes away.
+ *
+ * @param[in,out] ostate State handle of the object
+ */
+static inline void fattr4_cache_enable(struct state_hdl *ostate)
+{
+	ostate->fattr.enabled = true;
+}
+
+/**
+ * @brief Stop using the object's encoded attributes
+ *
+ * @param[in,out] ostate State handle of the object
+ */
+static inline void fattr4_cache_invalidate(struct state_hdl *ostate)
+{
+	(void) atomic_inc_uint32_t(&ostate->fattr.gen);
+}
+
+/**
+ * @brief Free the object's encoded attributes
+ *
+ * @param[in,out] ostate State handle of the object
+ */
+static inline void fattr4_cache_fini(struct state_hdl *ostate)
+{
+	gsh_free(ostate->fattr.blob);
+	ostate->fattr.blob = NULL;
+	ostate->fattr.enabled = false;
+	pthread_spin_destroy(&ostate->fattr.sp);
+}
+
 /*****************************************************************************
  *
  * 9P State functions
@@ -280,6 +320,8 @@ clientid_status_t nfs_client_id_confirm(nfs_client_id_t *clientid,
 					log_components_t component);
 
 bool clientid_has_state(nfs_client_id_t *clientid);
+bool nfs4_client_at_limit(nfs_client_id_t *clientid,
+			  enum nfs4_client_limit limit);
 
 bool nfs_client_id_expire(nfs_client_id_t *clientid, bool make_stale);
 
@@ -353,6 +395,15 @@ int display_session(struct display_buffer *dspbuf, nfs41_session_t *session);
 
 int32_t inc_session_ref(nfs41_session_t *session);
 int32_t dec_session_ref(nfs41_session_t *session);
+void nfs41_Session_Release_Slot_Cache(nfs41_session_slot_t *slot);
+
+void nfs41_session_bind_conn(nfs41_session_t *session, SVCXPRT *xprt,
+			     channel_dir_from_server4 dir);
+void nfs41_session_conn_seen(nfs41_session_t *session, SVCXPRT *xprt);
+bool nfs41_session_conn_bound(nfs41_session_t *session, SVCXPRT *xprt);
+SVCXPRT *nfs41_session_back_xprt(nfs41_session_t *session);
+void nfs41_session_save_cb_sec(nfs41_session_t *session, int num_sec_parms,
+			       callback_sec_parms4 *sec_parms);
 
 int display_session_id_key(struct gsh_buffdesc *buff, char *str);
 int display_session_id_val(struct gsh_buffdesc *buff, char *str);
@@ -459,13 +510,6 @@ struct state_t *nfs4_State_Get_Obj(struct fsal_obj_handle *obj,
 				     state_owner_t *owner);
 
 int display_state_id_val(struct gsh_buffdesc *buff, char *str);
-int display_state_id_key(struct gsh_buffdesc *buff, char *str);
-
-uint32_t state_id_value_hash_func(hash_parameter_t *hparam,
-				  struct gsh_buffdesc *key);
-
-uint64_t state_id_rbt_hash_func(hash_parameter_t *hparam,
-				struct gsh_buffdesc *key);
 
 /******************************************************************************
  *
@@ -476,6 +520,12 @@ uint64_t state_id_rbt_hash_func(hash_parameter_t *hparam,
 int reserve_lease(nfs_client_id_t *clientid);
 void update_lease(nfs_client_id_t *clientid);
 bool valid_lease(nfs_client_id_t *clientid);
+void renew_lease(nfs_client_id_t *clientid);
+bool expire_lease(nfs_client_id_t *clientid);
+void lease_wheel_init(void);
+void lease_schedule(nfs_client_id_t *clientid);
+void lease_unschedule(nfs_client_id_t *clientid);
+nfs_client_id_t *lease_wheel_next_due(time_t now);
 
 /******************************************************************************
  *
@@ -612,6 +662,16 @@ uint64_t lock_cookie_rbt_hash_func(hash_parameter_t *hparam,
 
 state_status_t state_lock_init(void);
 
+void lock_range_insert(struct lock_range_tree *tree,
+		       struct lock_range_node *node,
+		       uint64_t start, uint64_t end);
+void lock_range_remove(struct lock_range_tree *tree,
+		       struct lock_range_node *node);
+struct lock_range_node *lock_range_first(struct lock_range_tree *tree,
+					 uint64_t start, uint64_t end);
+struct lock_range_node *lock_range_next(struct lock_range_node *node,
+					uint64_t start, uint64_t end);
+
 void log_lock(log_components_t component,
 	      log_levels_t debug,
 	      const char *reason,
@@ -759,29 +819,29 @@ static inline struct fsal_obj_handle *get_state_obj_ref(state_t *state)
 
 static inline struct gsh_export *get_state_export_ref(state_t *state)
 {
-	struct gsh_export *export = NULL;
+	struct gsh_export *exp = NULL;
 
 	PTHREAD_MUTEX_lock(&state->state_mutex);
 
 	if (state->state_export != NULL &&
 	    export_ready(state->state_export)) {
 		get_gsh_export_ref(state->state_export);
-		export = state->state_export;
+		exp = state->state_export;
 	}
 
 	PTHREAD_MUTEX_unlock(&state->state_mutex);
 
-	return export;
+	return exp;
 }
 
-static inline bool state_same_export(state_t *state, struct gsh_export *export)
+static inline bool state_same_export(state_t *state, struct gsh_export *exp)
 {
 	bool same = false;
 
 	PTHREAD_MUTEX_lock(&state->state_mutex);
 
 	if (state->state_export != NULL)
-		same = state->state_export == export;
+		same = state->state_export == exp;
 
 	PTHREAD_MUTEX_unlock(&state->state_mutex);
 
@@ -850,7 +910,7 @@ static inline bool state_same_owner(state_t *state, state_owner_t *owner)
 
 bool get_state_obj_export_owner_refs(state_t *state,
 				     struct fsal_obj_handle **obj,
-				       struct gsh_export **export,
+				       struct gsh_export **exp,
 				       state_owner_t **owner);
 
 void state_nfs4_state_wipe(struct state_hdl *ostate);
@@ -890,11 +950,19 @@ void init_new_deleg_state(union state_data *deleg_state,
 void deleg_heuristics_recall(struct fsal_obj_handle *obj,
 			     state_owner_t *owner,
 			     struct state_t *deleg);
+void deleg_heuristics_open(struct state_hdl *ostate, nfs_client_id_t *client,
+			   uint32_t share_access);
 void get_deleg_perm(nfsace4 *permissions, open_delegation_type4 type);
 void update_delegation_stats(struct state_hdl *ostate,
 			     state_owner_t *owner,
 			     struct state_t *deleg);
 state_status_t delegrecall_impl(struct fsal_obj_handle *obj);
+void delegrecall_state(struct fsal_obj_handle *obj, struct state_t *state);
+bool notify_dir_deleg(struct fsal_obj_handle *dir, struct state_t *state,
+		      notify_type4 type, const char *name,
+		      const char *newname);
+void state_dir_notify(struct fsal_obj_handle *dir, notify_type4 type,
+		      const char *name, const char *newname);
 nfsstat4 deleg_revoke(struct fsal_obj_handle *obj, struct state_t *deleg_state);
 void state_deleg_revoke(struct fsal_obj_handle *obj, state_t *state);
 bool state_deleg_conflict(struct fsal_obj_handle *obj, bool write);
@@ -1025,6 +1093,7 @@ void nfs4_start_grace(nfs_grace_start_t *gsp);
 int nfs_in_grace(void);
 void nfs4_add_clid(nfs_client_id_t *);
 void nfs4_rm_clid(nfs_client_id_t *);
+void nfs4_reclaim_complete(nfs_client_id_t *);
 void nfs4_chk_clid(nfs_client_id_t *);
 void nfs4_recovery_load_clids(nfs_grace_start_t *gsp);
 void nfs4_recovery_cleanup(void);
@@ -1069,6 +1138,9 @@ struct nfs4_recovery_backend {
 	void (*add_clid)(nfs_client_id_t *);
 	void (*rm_clid)(nfs_client_id_t *);
 	void (*add_revoke_fh)(nfs_client_id_t *, nfs_fh4 *);
+	/* May only match entries whose cl_name is the cid_recov_tag,
+	 * nfs4_chk_clid_impl() offers no others.
+	 */
 	bool (*check_clid)(nfs_client_id_t *, clid_entry_t *);
 };
 
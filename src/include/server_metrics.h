@@ -0,0 +1,53 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @defgroup Server statistics management
+ * @{
+ */
+
+/**
+ * @file server_metrics.h
+ * @brief OpenMetrics endpoint for the server statistics
+ */
+
+#ifndef SERVER_METRICS_H
+#define SERVER_METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+void metrics_start(void);
+void metrics_shutdown(void);
+
+/* Helpers for the renderers */
+void metrics_family(FILE *out, const char *name, const char *type,
+		    const char *help);
+void metrics_scalar(FILE *out, const char *name, const char *type,
+		    const char *help, uint64_t value);
+
+/* Each module renders the statistics it owns */
+void server_stats_metrics(FILE *out);
+void mdcache_metrics(FILE *out);
+void nfs_rpc_queue_metrics(FILE *out);
+
+#endif				/* SERVER_METRICS_H */
+/** @} */
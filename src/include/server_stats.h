@@ -42,6 +42,7 @@
 #include <sys/types.h>
 
 void server_stats_nfs_done(request_data_t *reqdata, int rc, bool dup);
+void server_stats_phases_done(request_data_t *reqdata);
 
 #ifdef _USE_9P
 void server_stats_9p_done(u8 msgtype, struct _9p_request_data *req9p);
@@ -50,13 +51,25 @@ void server_stats_9p_done(u8 msgtype, struct _9p_request_data *req9p);
 void server_stats_io_done(size_t requested,
 			  size_t transferred, bool success, bool is_write);
 void server_stats_compound_done(int num_ops, int status);
-void server_stats_nfsv4_op_done(int proto_op,
-				nsecs_elapsed_t start_time, int status);
+void server_stats_nfsv4_op_done(int proto_op, nsecs_elapsed_t start_time,
+				nsecs_elapsed_t fsal_time, int status,
+				nfs_fh4 *fh);
 void server_stats_transport_done(struct gsh_client *client,
 				uint64_t rx_bytes, uint64_t rx_pkt,
 				uint64_t rx_err, uint64_t tx_bytes,
 				uint64_t tx_pkt, uint64_t tx_err);
 
+/* Protocols server_stats_op_name knows the ops of */
+enum stats_proto {
+	STATS_NFSV3,
+	STATS_NFSV4,
+	STATS_NLM,
+	STATS_MNT,
+	STATS_RQUOTA,
+};
+
+const char *server_stats_op_name(enum stats_proto proto, uint32_t op);
+
 /* For delegations */
 void inc_grants(struct gsh_client *client);
 void dec_grants(struct gsh_client *client);
@@ -135,6 +135,50 @@ struct export_stats {
 	.direction = "out" \
 }
 
+#define QOS_REPLY          \
+{                          \
+	.name = "iops",    \
+	.type = "(txt)",   \
+	.direction = "out" \
+},                         \
+{                          \
+	.name = "read",    \
+	.type = "(txt)",   \
+	.direction = "out" \
+},                         \
+{                          \
+	.name = "write",   \
+	.type = "(txt)",   \
+	.direction = "out" \
+},                         \
+{                          \
+	.name = "delayed_ns", \
+	.type = "t",       \
+	.direction = "out" \
+}
+
+#define HEALTH_REPLY       \
+{                          \
+	.name = "shedding", \
+	.type = "b",       \
+	.direction = "out" \
+},                         \
+{                          \
+	.name = "strikes", \
+	.type = "u",       \
+	.direction = "out" \
+},                         \
+{                          \
+	.name = "trips",   \
+	.type = "t",       \
+	.direction = "out" \
+},                         \
+{                          \
+	.name = "shed",    \
+	.type = "t",       \
+	.direction = "out" \
+}
+
 #define TRANSPORT_REPLY    \
 {                          \
 	.name = "rx_bytes",\
@@ -174,6 +218,68 @@ struct export_stats {
 	.direction = "out"   \
 }
 
+#define IOBUF_POOL_REPLY     \
+{                            \
+	.name = "hugepages", \
+	.type = "b",         \
+	.direction = "out"   \
+},                           \
+{                            \
+	.name = "oversize",  \
+	.type = "t",         \
+	.direction = "out"   \
+},                           \
+{                            \
+	.name = "classes",   \
+	.type = "a(ttttt)",  \
+	.direction = "out"   \
+}
+
+#define SLAB_REPLY           \
+{                            \
+	.name = "slabs",     \
+	.type = "a(sttttt)", \
+	.direction = "out"   \
+}
+
+#define MEMORY_REPLY          \
+{                             \
+	.name = "subsystems", \
+	.type = "a(stttdd)",  \
+	.direction = "out"    \
+}
+
+#define LOCK_PROFILE_REPLY    \
+{                             \
+	.name = "enabled",    \
+	.type = "b",          \
+	.direction = "out"    \
+},                            \
+{                             \
+	.name = "sites",      \
+	.type = "a(sstttt)",  \
+	.direction = "out"    \
+}
+
+#define LOCK_PROFILE_ARG     \
+{                            \
+	.name = "enable",    \
+	.type = "b",         \
+	.direction = "in"    \
+}
+
+#define INFLIGHT_REPLY        \
+{                             \
+	.name = "queued",     \
+	.type = "t",          \
+	.direction = "out"    \
+},                            \
+{                             \
+	.name = "requests",   \
+	.type = "a(uussissttay)", \
+	.direction = "out"    \
+}
+
 #define FSAL_OPS_REPLY      \
 {                            \
 	.name = "op",        \
@@ -227,6 +333,56 @@ struct export_stats {
 }						\
 
 
+/* latency histogram, (upper bound in nsecs, count) per bucket */
+#define LAT_HIST_REPLY_TYPE "(tt)"
+#define LATENCY_REPLY_ARRAY_TYPE "(sa(tt)a(tt))"
+#define LATENCY_REPLY				\
+{						\
+	.name = "latency",			\
+	.type = DBUS_TYPE_ARRAY_AS_STRING	\
+		LATENCY_REPLY_ARRAY_TYPE,	\
+	.direction = "out"			\
+}
+
+#define OP_LATENCY_REPLY_ARRAY_TYPE "(sa(tt))"
+#define OP_LATENCY_REPLY			\
+{						\
+	.name = "op_latency",			\
+	.type = DBUS_TYPE_ARRAY_AS_STRING	\
+		OP_LATENCY_REPLY_ARRAY_TYPE,	\
+	.direction = "out"			\
+}
+
+#define PHASE_LATENCY_REPLY_ARRAY_TYPE "(ssa(tt))"
+#define PHASE_LATENCY_REPLY			\
+{						\
+	.name = "phase_latency",		\
+	.type = DBUS_TYPE_ARRAY_AS_STRING	\
+		PHASE_LATENCY_REPLY_ARRAY_TYPE,	\
+	.direction = "out"			\
+}
+
+#define TOPK_REPLY_ARRAY_TYPE "(sstt)"
+#define TOPK_REPLY				\
+{						\
+	.name = "hot_spots",			\
+	.type = DBUS_TYPE_ARRAY_AS_STRING	\
+		TOPK_REPLY_ARRAY_TYPE,		\
+	.direction = "out"			\
+}
+
+/* Per protocol ops (total, errors) and read and write iostats */
+#define PROTO_STATS_ARRAY_TYPE "(s(tt)(tttttt)(tttttt))"
+#define ALL_CLIENTS_REPLY_ARRAY_TYPE			\
+	"(s" DBUS_TYPE_ARRAY_AS_STRING PROTO_STATS_ARRAY_TYPE ")"
+#define ALL_CLIENTS_REPLY				\
+{							\
+	.name = "clients",				\
+	.type = DBUS_TYPE_ARRAY_AS_STRING		\
+		ALL_CLIENTS_REPLY_ARRAY_TYPE,		\
+	.direction = "out"				\
+}
+
 #define _9P_OP_ARG           \
 {                            \
 	.name = "_9p_opname",\
@@ -257,7 +413,20 @@ void server_dbus_total_ops(struct export_stats *export_st,
 			   DBusMessageIter *iter);
 void global_dbus_total_ops(DBusMessageIter *iter);
 void server_dbus_fast_ops(DBusMessageIter *iter);
+void server_dbus_latency(struct gsh_stats *st, DBusMessageIter *iter);
+void server_dbus_fast_latency(DBusMessageIter *iter);
+void server_dbus_phase_latency(DBusMessageIter *iter);
+void server_dbus_proto_stats(struct gsh_stats *st, DBusMessageIter *iter);
 void mdcache_dbus_show(DBusMessageIter *iter);
+void dupreq2_dbus_show(DBusMessageIter *iter);
+void iobuf_pool_dbus_show(DBusMessageIter *iter);
+void gsh_slab_dbus_show(DBusMessageIter *iter);
+void gsh_mem_dbus_show(DBusMessageIter *iter);
+void req_inflight_dbus_show(DBusMessageIter *iter);
+#ifdef USE_LOCK_PROFILE
+void lock_prof_dbus_show(DBusMessageIter *iter);
+void lock_prof_set(bool enable);
+#endif
 void server_reset_stats(DBusMessageIter *iter);
 void reset_export_stats(void);
 void reset_client_stats(void);
@@ -0,0 +1,63 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @defgroup Server statistics management
+ * @{
+ */
+
+/**
+ * @file server_topk.h
+ * @brief Heavy hitter tracking
+ */
+
+#ifndef SERVER_TOPK_H
+#define SERVER_TOPK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#ifdef USE_DBUS
+#include "gsh_dbus.h"
+#endif
+
+/** What a tracker counts */
+enum topk_kind {
+	TOPK_FILE_OP,		/*< requests per (file handle, op) */
+	TOPK_CLIENT_OP,		/*< requests per (client address, op) */
+	TOPK_EXPORT_BYTES,	/*< bytes read or written per export */
+	TOPK_KINDS
+};
+
+/** Ops of TOPK_EXPORT_BYTES */
+#define TOPK_IO_READ 0
+#define TOPK_IO_WRITE 1
+
+void topk_pkginit(void);
+void topk_record(enum topk_kind kind, const void *key, size_t len,
+		 uint16_t proto, uint16_t op, uint64_t weight);
+void topk_reset(void);
+
+#ifdef USE_DBUS
+void topk_dbus_report(enum topk_kind kind, DBusMessageIter *iter);
+#endif
+
+#endif				/* SERVER_TOPK_H */
+/** @} */
@@ -43,6 +43,7 @@
 #include <pthread.h>
 #include "gsh_rpc.h"
 #include "gsh_types.h"
+#include "gsh_rcu.h"
 
 /**
  * @brief Shared between idmapper.c and uid2grp_cache.c.  If you
@@ -56,12 +57,12 @@ typedef struct group_data {
 	gid_t gid;
 	time_t epoch;
 	int nbgroups;
-	unsigned int refcount;
-	pthread_mutex_t lock;
+	uint32_t refcount;
 	gid_t *groups;
 } group_data_t;
 
 extern pthread_rwlock_t uid2grp_user_lock;
+extern struct gsh_rcu uid2grp_rcu;
 
 void uid2grp_cache_init(void);
 
@@ -69,6 +70,9 @@ void uid2grp_add_user(struct group_data *);
 bool uid2grp_lookup_by_uname(const struct gsh_buffdesc *, uid_t *,
 			     struct group_data **);
 bool uid2grp_lookup_by_uid(const uid_t, struct group_data **);
+bool uid2grp_peek_by_uname(const struct gsh_buffdesc *, uid_t *,
+			   struct group_data **);
+bool uid2grp_peek_by_uid(const uid_t, struct group_data **);
 
 void uid2grp_remove_by_uname(const struct gsh_buffdesc *);
 void uid2grp_remove_by_uid(const uid_t);
@@ -43,6 +43,7 @@
 #include <sys/resource.h>
 
 #include "log.h"
+#include "abstract_atomic.h"
 #include "gsh_list.h"
 #include "rpc/rpc.h"
 #include "gsh_rpc.h"
@@ -65,7 +66,8 @@
  * DEBUG is enabled. If such a macro is called from this logging file as
  * part of logging a message, it generates endless loop of lock tracing
  * messages. The following code redefines these lock macros to avoid the
- * loop.
+ * loop.  The same goes for the mutex macros, which the asynchronous
+ * logging takes while queueing a message.
  */
 #ifdef PTHREAD_RWLOCK_wrlock
 #undef PTHREAD_RWLOCK_wrlock
@@ -94,6 +96,24 @@
 			assert(0);					\
 	} while (0)
 
+#ifdef PTHREAD_MUTEX_lock
+#undef PTHREAD_MUTEX_lock
+#endif
+#define PTHREAD_MUTEX_lock(_mtx)					\
+	do {								\
+		if (pthread_mutex_lock(_mtx) != 0)			\
+			assert(0);					\
+	} while (0)
+
+#ifdef PTHREAD_MUTEX_unlock
+#undef PTHREAD_MUTEX_unlock
+#endif
+#define PTHREAD_MUTEX_unlock(_mtx)					\
+	do {								\
+		if (pthread_mutex_unlock(_mtx) != 0)			\
+			assert(0);					\
+	} while (0)
+
 pthread_rwlock_t log_rwlock = PTHREAD_RWLOCK_INITIALIZER;
 
 /* Variables to control log fields */
@@ -233,6 +253,9 @@ log_header_t max_headers = LH_COMPONENT;
 char const_log_str[LOG_BUFF_LEN] = "\0";
 char date_time_fmt[MAX_TD_FMT_LEN] = "\0";
 
+/* Bumped whenever date_time_fmt is rebuilt, so cached times go stale */
+static uint32_t date_time_fmt_gen;
+
 typedef struct loglev {
 	char *str;
 	char *short_str;
@@ -639,6 +662,8 @@ void set_const_log_str(void)
 	if (date_time_fmt[0] != '\0' &&
 	    date_time_fmt[strlen(date_time_fmt) - 1] == ' ')
 		date_time_fmt[strlen(date_time_fmt) - 1] = '\0';
+
+	(void)atomic_inc_uint32_t(&date_time_fmt_gen);
 }
 
 static void set_logging_from_env(void)
@@ -1077,6 +1102,8 @@ int set_log_level(const char *name, log_levels_t max_level)
 	return 0;
 }
 
+static void log_sites_init(void);
+
 /**
  * @brief Initialize Logging
  *
@@ -1100,6 +1127,7 @@ void init_logging(const char *log_path, const int debug_level)
 	/* Finish initialization of and register log facilities. */
 	glist_init(&facility_list);
 	glist_init(&active_facility_list);
+	log_sites_init();
 
 	/* Initialize const_log_str to defaults. Ganesha can start logging
 	 * before the LOG config is processed (in fact, LOG config can itself
@@ -1288,13 +1316,54 @@ static int log_to_stream(log_header_t headers, void *private,
 		return 0;
 }
 
+/**
+ * @brief The last second formatted by this thread
+ *
+ * Nearly every log message is stamped with the same second as the one
+ * before it, so keep the strftime output around and only redo it, and
+ * the localtime behind it, when the second or the format changes.
+ */
+struct log_time_cache {
+	time_t sec;		/*< Second formatted */
+	const char *fmt;	/*< Format used */
+	uint32_t gen;		/*< date_time_fmt_gen when formatted */
+	bool valid;		/*< strftime succeeded */
+	char tbuf[MAX_TD_FMT_LEN];
+};
+
+static __thread struct log_time_cache log_time_cache;
+
+/**
+ * @brief Format a second, using this thread's cache if it can
+ *
+ * @param[in] sec  The second
+ * @param[in] fmt  strftime format
+ *
+ * @return The formatted time or NULL if it could not be formatted.
+ */
+static char *log_time_str(time_t sec, const char *fmt)
+{
+	struct log_time_cache *cache = &log_time_cache;
+	uint32_t gen = atomic_fetch_uint32_t(&date_time_fmt_gen);
+	struct tm the_date;
+
+	if (cache->sec != sec || cache->fmt != fmt || cache->gen != gen) {
+		Localtime_r(&sec, &the_date);
+		cache->valid = strftime(cache->tbuf, sizeof(cache->tbuf), fmt,
+					&the_date) != 0;
+		cache->sec = sec;
+		cache->fmt = fmt;
+		cache->gen = gen;
+	}
+
+	return cache->valid ? cache->tbuf : NULL;
+}
+
 int display_timeval(struct display_buffer *dspbuf, struct timeval *tv)
 {
 	char *fmt = date_time_fmt;
 	int b_left = display_start(dspbuf);
-	struct tm the_date;
-	char tbuf[MAX_TD_FMT_LEN];
-	time_t tm = tv->tv_sec;
+	char *tbuf;
 
 	if (b_left <= 0)
 		return b_left;
@@ -1302,8 +1371,6 @@ int display_timeval(struct display_buffer *dspbuf, struct timeval *tv)
 	if (logfields->datefmt == TD_NONE && logfields->timefmt == TD_NONE)
 		fmt = "%c ";
 
-	Localtime_r(&tm, &the_date);
-
 	/* Earlier we build the date/time format string in
 	 * date_time_fmt, now use that to format the time and/or date.
 	 * If time format is TD_SYSLOG_USEC, then we need an additional
@@ -1311,7 +1378,8 @@ int display_timeval(struct display_buffer *dspbuf, struct timeval *tv)
 	 * struct tm which was filled in from a time_t and thus does not
 	 * have microseconds.
 	 */
-	if (strftime(tbuf, sizeof(tbuf), fmt, &the_date) != 0) {
+	tbuf = log_time_str(tv->tv_sec, fmt);
+	if (tbuf != NULL) {
 		if (logfields->timefmt == TD_SYSLOG_USEC)
 			b_left = display_printf(dspbuf, tbuf, tv->tv_usec);
 		else
@@ -1325,9 +1393,7 @@ int display_timespec(struct display_buffer *dspbuf, struct timespec *ts)
 {
 	char *fmt = date_time_fmt;
 	int b_left = display_start(dspbuf);
-	struct tm the_date;
-	char tbuf[MAX_TD_FMT_LEN];
-	time_t tm = ts->tv_sec;
+	char *tbuf;
 
 	if (b_left <= 0)
 		return b_left;
@@ -1335,8 +1401,6 @@ int display_timespec(struct display_buffer *dspbuf, struct timespec *ts)
 	if (logfields->datefmt == TD_NONE && logfields->timefmt == TD_NONE)
 		fmt = "%c ";
 
-	Localtime_r(&tm, &the_date);
-
 	/* Earlier we build the date/time format string in
 	 * date_time_fmt, now use that to format the time and/or date.
 	 * If time format is TD_SYSLOG_USEC, then we need an additional
@@ -1344,7 +1408,8 @@ int display_timespec(struct display_buffer *dspbuf, struct timespec *ts)
 	 * struct tm which was filled in from a time_t and thus does not
 	 * have microseconds.
 	 */
-	if (strftime(tbuf, sizeof(tbuf), fmt, &the_date) != 0) {
+	tbuf = log_time_str(ts->tv_sec, fmt);
+	if (tbuf != NULL) {
 		if (logfields->timefmt == TD_SYSLOG_USEC)
 			b_left = display_printf(dspbuf, tbuf, ts->tv_nsec);
 		else
@@ -1455,7 +1520,416 @@ static int display_log_component(struct display_buffer *dsp_log,
 	return b_left;
 }
 
-void display_log_component_level(log_components_t component, const char *file,
+/**
+ * @brief Hand a formatted message to every active facility
+ *
+ * @param[in] level   Level of the message
+ * @param[in] dsp_log The whole message
+ * @param[in] compstr Message from the component header on
+ * @param[in] message Message body
+ */
+static void log_to_facilities(log_levels_t level,
+			      struct display_buffer *dsp_log,
+			      char *compstr, char *message)
+{
+	struct glist_head *glist;
+	struct log_facility *facility;
+
+	PTHREAD_RWLOCK_rdlock(&log_rwlock);
+
+	glist_for_each(glist, &active_facility_list) {
+		facility = glist_entry(glist, struct log_facility, lf_active);
+
+		if (level <= facility->lf_max_level
+		    && facility->lf_func != NULL)
+			facility->lf_func(facility->lf_headers,
+					  facility->lf_private,
+					  level, dsp_log,
+					  compstr, message);
+	}
+
+	PTHREAD_RWLOCK_unlock(&log_rwlock);
+}
+
+/**
+ * @brief Asynchronous logging
+ *
+ * When LOG { Async = true; } the thread logging a message only formats
+ * it into a slot of a bounded ring.  One writer thread takes messages
+ * off the ring and hands them to the facilities, so a slow syslog,
+ * file or console holds up only the writer.
+ *
+ * The ring is a multi-producer, single-consumer queue: a producer
+ * claims a position by advancing tail with a compare and swap, fills
+ * the slot and then publishes it by setting the slot's seq to one past
+ * the position.  The writer consumes position head once its seq says
+ * it is published and recycles the slot by setting its seq a ring
+ * further on.  A producer that finds its slot still unconsumed counts
+ * the message as dropped instead of waiting; the writer reports the
+ * drops in the log.
+ *
+ * Fatal messages, and every message before the writer starts or after
+ * it stops, are still written in the logging thread.
+ */
+
+/* How long the writer sleeps when it has nothing to do. Producers wake
+ * it early, this is only a backstop.
+ */
+#define LOG_ASYNC_IDLE_MS 100
+
+struct log_slot {
+	uint64_t seq;		/*< Position this slot holds, see above */
+	log_levels_t level;	/*< Level of the message */
+	int len;		/*< Length of the message */
+	int comp_off;		/*< Offset of the component header */
+	int msg_off;		/*< Offset of the message body */
+	/* The facilities may append a newline after the terminator */
+	char buf[LOG_BUFF_LEN + 2];
+};
+
+static struct log_async {
+	struct log_slot *ring;	/*< Slots, allocated on first start */
+	uint64_t mask;		/*< Ring size - 1 */
+	GSH_CACHE_PAD(0);
+	uint64_t tail;		/*< Next position to claim */
+	GSH_CACHE_PAD(1);
+	uint64_t head;		/*< Next position to write */
+	GSH_CACHE_PAD(2);
+	uint64_t dropped;	/*< Messages lost to a full ring */
+	GSH_CACHE_PAD(3);
+	uint32_t running;	/*< Producers may use the ring */
+	uint32_t sleeping;	/*< Writer is waiting for messages */
+	bool started;		/*< Writer thread exists */
+	pthread_t thrid;	/*< Writer thread */
+	pthread_mutex_t ctl;	/*< Serializes start and stop */
+	pthread_mutex_t mutex;	/*< Sleeping writer and its wake up */
+	pthread_cond_t cond;
+} log_async = {
+	.ctl = PTHREAD_MUTEX_INITIALIZER,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void log_async_cleanup(void);
+
+static cleanup_list_element log_async_cleanup_element = {
+	.clean = log_async_cleanup,
+};
+
+/**
+ * @brief Queue a formatted message for the writer
+ *
+ * @param[in] level   Level of the message
+ * @param[in] dsp_log The whole message
+ * @param[in] compstr Message from the component header on
+ * @param[in] message Message body
+ *
+ * @return false if the writer is not running and the caller must write
+ *         the message itself.
+ */
+static bool log_async_enqueue(log_levels_t level,
+			      struct display_buffer *dsp_log,
+			      char *compstr, char *message)
+{
+	struct log_slot *slot;
+	uint64_t pos, seq;
+	int len;
+
+	if (!atomic_fetch_uint32_t(&log_async.running))
+		return false;
+
+	pos = atomic_fetch_uint64_t(&log_async.tail);
+	for (;;) {
+		slot = &log_async.ring[pos & log_async.mask];
+		seq = atomic_fetch_uint64_t(&slot->seq);
+		if (seq == pos) {
+			if (atomic_cas_uint64_t(&log_async.tail, pos, pos + 1))
+				break;
+			pos = atomic_fetch_uint64_t(&log_async.tail);
+		} else if ((int64_t)(seq - pos) < 0) {
+			/* The writer has not got to this slot yet */
+			(void)atomic_inc_uint64_t(&log_async.dropped);
+			return true;
+		} else {
+			/* Another producer claimed pos */
+			pos = atomic_fetch_uint64_t(&log_async.tail);
+		}
+	}
+
+	len = display_buffer_len(dsp_log);
+	memcpy(slot->buf, dsp_log->b_start, len + 1);
+	slot->len = len;
+	slot->level = level;
+	slot->comp_off = compstr - dsp_log->b_start;
+	slot->msg_off = message - dsp_log->b_start;
+	atomic_store_uint64_t(&slot->seq, pos + 1);
+
+	if (atomic_fetch_uint32_t(&log_async.sleeping)) {
+		PTHREAD_MUTEX_lock(&log_async.mutex);
+		pthread_cond_signal(&log_async.cond);
+		PTHREAD_MUTEX_unlock(&log_async.mutex);
+	}
+
+	return true;
+}
+
+/**
+ * @brief Write the message at head, if it has been published
+ *
+ * Only the writer, or whoever stopped it, calls this.
+ *
+ * @return false if the ring is empty.
+ */
+static bool log_async_write_one(void)
+{
+	uint64_t head = log_async.head;
+	struct log_slot *slot = &log_async.ring[head & log_async.mask];
+	struct display_buffer dsp_log = {LOG_BUFF_LEN + 1, slot->buf,
+					 slot->buf};
+
+	if (atomic_fetch_uint64_t(&slot->seq) != head + 1)
+		return false;
+
+	dsp_log.b_current = slot->buf + slot->len;
+	log_to_facilities(slot->level, &dsp_log, slot->buf + slot->comp_off,
+			  slot->buf + slot->msg_off);
+
+	atomic_store_uint64_t(&slot->seq, head + log_async.mask + 1);
+	atomic_store_uint64_t(&log_async.head, head + 1);
+	return true;
+}
+
+/**
+ * @brief Log how many messages a full ring cost since the last report
+ *
+ * @param[in,out] reported Drops already reported
+ */
+static void log_async_report_drops(uint64_t *reported)
+{
+	uint64_t dropped = atomic_fetch_uint64_t(&log_async.dropped);
+	struct display_buffer dsp_log = {sizeof(log_buffer),
+					 log_buffer, log_buffer};
+	char *compstr, *message;
+
+	if (dropped == *reported)
+		return;
+
+	(void)display_log_header(&dsp_log);
+	compstr = dsp_log.b_current;
+	(void)display_log_component(&dsp_log, COMPONENT_LOG, __FILE__,
+				    __LINE__, __func__, NIV_WARN);
+	message = dsp_log.b_current;
+	(void)display_printf(&dsp_log,
+			     "%" PRIu64 " log messages dropped, ring full",
+			     dropped - *reported);
+	log_to_facilities(NIV_WARN, &dsp_log, compstr, message);
+	*reported = dropped;
+}
+
+static void *log_async_thread(void *arg)
+{
+	uint64_t reported = atomic_fetch_uint64_t(&log_async.dropped);
+	struct timespec timeout;
+	bool wrote;
+
+	SetNameFunction("log_writer");
+
+	while (atomic_fetch_uint32_t(&log_async.running)) {
+		wrote = false;
+		while (log_async_write_one())
+			wrote = true;
+		log_async_report_drops(&reported);
+		if (wrote)
+			continue;
+
+		PTHREAD_MUTEX_lock(&log_async.mutex);
+		atomic_store_uint32_t(&log_async.sleeping, 1);
+		/* A producer that published before seeing sleeping set is
+		 * caught by looking again, one after it takes the mutex.
+		 */
+		if (atomic_fetch_uint32_t(&log_async.running) &&
+		    atomic_fetch_uint64_t(&log_async.ring[log_async.head &
+							  log_async.mask].seq)
+		    != log_async.head + 1) {
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timespec_add_nsecs(LOG_ASYNC_IDLE_MS * NS_PER_MSEC,
+					   &timeout);
+			(void)pthread_cond_timedwait(&log_async.cond,
+						     &log_async.mutex,
+						     &timeout);
+		}
+		atomic_store_uint32_t(&log_async.sleeping, 0);
+		PTHREAD_MUTEX_unlock(&log_async.mutex);
+	}
+
+	/* Whatever was queued before running was cleared */
+	while (log_async_write_one())
+		;
+	log_async_report_drops(&reported);
+
+	return NULL;
+}
+
+/**
+ * @brief Start the writer thread
+ *
+ * @param[in] ring_size Slots in the ring, used on the first start only
+ */
+static void log_async_start(uint32_t ring_size)
+{
+	uint64_t size = 1;
+	uint64_t i;
+	int rc;
+
+	PTHREAD_MUTEX_lock(&log_async.ctl);
+	if (log_async.started)
+		goto out;
+
+	if (log_async.ring == NULL) {
+		while (size < ring_size)
+			size <<= 1;
+		log_async.ring = gsh_malloc(size * sizeof(*log_async.ring));
+		for (i = 0; i < size; i++)
+			log_async.ring[i].seq = i;
+		log_async.mask = size - 1;
+		RegisterCleanup(&log_async_cleanup_element);
+	}
+
+	atomic_store_uint32_t(&log_async.running, 1);
+	rc = pthread_create(&log_async.thrid, NULL, log_async_thread, NULL);
+	if (rc != 0) {
+		atomic_store_uint32_t(&log_async.running, 0);
+		LogCrit(COMPONENT_LOG,
+			"Could not create log writer thread: %s",
+			strerror(rc));
+		goto out;
+	}
+	log_async.started = true;
+	LogEvent(COMPONENT_LOG, "Asynchronous logging started, %" PRIu64
+		 " slots", log_async.mask + 1);
+ out:
+	PTHREAD_MUTEX_unlock(&log_async.ctl);
+}
+
+/**
+ * @brief Stop the writer thread once it has written what is queued
+ *
+ * Messages logged from here on are written by the logging thread.
+ */
+static void log_async_stop(void)
+{
+	PTHREAD_MUTEX_lock(&log_async.ctl);
+	if (!log_async.started)
+		goto out;
+
+	atomic_store_uint32_t(&log_async.running, 0);
+	PTHREAD_MUTEX_lock(&log_async.mutex);
+	pthread_cond_signal(&log_async.cond);
+	PTHREAD_MUTEX_unlock(&log_async.mutex);
+	pthread_join(log_async.thrid, NULL);
+	log_async.started = false;
+
+	/* Pick up any producer that saw running just before it cleared */
+	while (log_async_write_one())
+		;
+ out:
+	PTHREAD_MUTEX_unlock(&log_async.ctl);
+}
+
+static void log_async_cleanup(void)
+{
+	log_async_stop();
+}
+
+/**
+ * @brief Per call site rate limiting
+ *
+ * With LOG { Rate_Limit = N; } each call site, the file and line of a
+ * LogXxx, may log N messages a second with bursts of Rate_Limit_Burst.
+ * A message over the limit is counted and dropped before it is
+ * formatted.  The next message the site is allowed to log is preceded
+ * by how many were suppressed.
+ *
+ * Sites hash to a fixed table of buckets; a site that lands on a bucket
+ * held by another takes it over, starting with a full burst.  Each
+ * bucket is a generic cell rate algorithm: tat is when the bucket will
+ * next be empty and a message is let through if that is no more than
+ * a burst's worth of intervals ahead of now.  Fatal messages are never
+ * limited.
+ */
+
+#define LOG_SITE_BUCKETS 1024
+
+struct log_site {
+	pthread_spinlock_t sp;	/*< Protects the rest */
+	const char *file;	/*< Call site holding the bucket */
+	int line;
+	uint32_t suppressed;	/*< Messages dropped since the last one */
+	uint64_t tat;		/*< Theoretical arrival time, nsecs */
+};
+
+static struct log_site log_sites[LOG_SITE_BUCKETS];
+static uint32_t log_rate_limit;		/*< Messages/sec per site, 0 is off */
+static uint32_t log_rate_burst;		/*< Messages a site may burst */
+
+static void log_sites_init(void)
+{
+	int i;
+
+	for (i = 0; i < LOG_SITE_BUCKETS; i++)
+		pthread_spin_init(&log_sites[i].sp, PTHREAD_PROCESS_PRIVATE);
+}
+
+/**
+ * @brief Decide whether a call site may log now
+ *
+ * @param[in]  file       File of the call site
+ * @param[in]  line       Line of the call site
+ * @param[out] suppressed Messages the site lost before this one
+ *
+ * @return false if the message must be dropped.
+ */
+static bool log_rate_check(const char *file, int line, uint32_t *suppressed)
+{
+	uint32_t limit = atomic_fetch_uint32_t(&log_rate_limit);
+	uint64_t interval, tolerance, cur, tat;
+	struct log_site *site;
+	struct timespec ts;
+	bool allowed;
+
+	*suppressed = 0;
+	if (limit == 0)
+		return true;
+
+	interval = NS_PER_SEC / limit;
+	tolerance = interval * (atomic_fetch_uint32_t(&log_rate_burst) - 1);
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	cur = timespec_to_nsecs(&ts);
+	site = &log_sites[(((uintptr_t)file >> 3) * 31 + line) %
+			  LOG_SITE_BUCKETS];
+
+	pthread_spin_lock(&site->sp);
+	if (site->file != file || site->line != line) {
+		site->file = file;
+		site->line = line;
+		site->suppressed = 0;
+		site->tat = 0;
+	}
+	tat = site->tat > cur ? site->tat : cur;
+	allowed = tat - cur <= tolerance;
+	if (allowed) {
+		site->tat = tat + interval;
+		*suppressed = site->suppressed;
+		site->suppressed = 0;
+	} else {
+		site->suppressed++;
+	}
+	pthread_spin_unlock(&site->sp);
+
+	return allowed;
+}
+
+static void display_log_message(log_components_t component, const char *file,
 				int line, const char *function,
 				log_levels_t level, const char *format,
 				va_list arguments)
@@ -1463,8 +1937,6 @@ void display_log_component_level(log_components_t component, const char *file,
 	char *compstr;
 	char *message;
 	int b_left;
-	struct glist_head *glist;
-	struct log_facility *facility;
 	struct display_buffer dsp_log = {sizeof(log_buffer),
 					 log_buffer, log_buffer};
 
@@ -1494,25 +1966,50 @@ void display_log_component_level(log_components_t component, const char *file,
 		   component, level, file, line, function, message);
 #endif
 
-	PTHREAD_RWLOCK_rdlock(&log_rwlock);
-
-	glist_for_each(glist, &active_facility_list) {
-		facility = glist_entry(glist, struct log_facility, lf_active);
-
-		if (level <= facility->lf_max_level
-		    && facility->lf_func != NULL)
-			facility->lf_func(facility->lf_headers,
-					  facility->lf_private,
-					  level, &dsp_log,
-					  compstr, message);
+	if (level != NIV_FATAL) {
+		if (log_async_enqueue(level, &dsp_log, compstr, message))
+			return;
+	} else {
+		/* Get what came before it out first */
+		log_async_stop();
 	}
 
-	PTHREAD_RWLOCK_unlock(&log_rwlock);
+	log_to_facilities(level, &dsp_log, compstr, message);
 
 	if (level == NIV_FATAL)
 		Fatal();
 }
 
+static void display_log_printf(log_components_t component, const char *file,
+			       int line, const char *function,
+			       log_levels_t level, const char *format, ...)
+{
+	va_list arguments;
+
+	va_start(arguments, format);
+	display_log_message(component, file, line, function, level, format,
+			    arguments);
+	va_end(arguments);
+}
+
+void display_log_component_level(log_components_t component, const char *file,
+				int line, const char *function,
+				log_levels_t level, const char *format,
+				va_list arguments)
+{
+	uint32_t suppressed = 0;
+
+	if (level != NIV_FATAL && !log_rate_check(file, line, &suppressed))
+		return;
+
+	if (suppressed != 0)
+		display_log_printf(component, file, line, function, level,
+				   "%" PRIu32 " messages suppressed", suppressed);
+
+	display_log_message(component, file, line, function, level, format,
+			    arguments);
+}
+
 /**
  * @brief Default logging levels
  *
@@ -1912,6 +2409,10 @@ struct logger_config {
 	struct glist_head facility_list;
 	struct logfields *logfields;
 	log_levels_t *comp_log_level;
+	bool async;
+	uint32_t async_ring_size;
+	uint32_t rate_limit;
+	uint32_t rate_burst;
 };
 
 /**
@@ -2528,6 +3029,12 @@ static int log_conf_commit(void *node, void *link_mem, void *self_struct,
 				gsh_free(component_log_level);
 			component_log_level = logger->comp_log_level;
 		}
+		if (logger->async)
+			log_async_start(logger->async_ring_size);
+		else
+			log_async_stop();
+		atomic_store_uint32_t(&log_rate_burst, logger->rate_burst);
+		atomic_store_uint32_t(&log_rate_limit, logger->rate_limit);
 	} else {
 		if (logger->logfields != NULL) {
 			struct logfields *lf = logger->logfields;
@@ -2549,6 +3056,14 @@ static int log_conf_commit(void *node, void *link_mem, void *self_struct,
 static struct config_item logging_params[] = {
 	CONF_ITEM_TOKEN("Default_log_level", NB_LOG_LEVEL, log_levels,
 			 logger_config, default_level),
+	CONF_ITEM_BOOL("Async", false,
+		       logger_config, async),
+	CONF_ITEM_UI32("Async_Ring_Size", 16, 1024 * 1024, 1024,
+		       logger_config, async_ring_size),
+	CONF_ITEM_UI32("Rate_Limit", 0, 1000000, 0,
+		       logger_config, rate_limit),
+	CONF_ITEM_UI32("Rate_Limit_Burst", 1, 1000000, 10,
+		       logger_config, rate_burst),
 	CONF_ITEM_BLOCK("Facility", facility_params,
 			facility_init, facility_commit,
 			logger_config, facility_list),
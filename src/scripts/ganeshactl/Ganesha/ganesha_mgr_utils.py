@@ -174,6 +174,15 @@ class ExportMgr():
            return False, e
         return True, "Done"
 
+    def RefreshExport(self, exp_id):
+        refresh_export_method = self.dbusobj.get_dbus_method("RefreshExport",
+                                                             self.dbus_interface)
+        try:
+           refresh_export_method(int(exp_id))
+        except dbus.exceptions.DBusException as e:
+           return False, e
+        return True, "Done"
+
     def DisplayExport(self, exp_id):
         display_export_method = self.dbusobj.get_dbus_method("DisplayExport",
                                                              self.dbus_interface)
@@ -256,6 +265,18 @@ class AdminInterface():
         msg = reply[1]
         return status, msg
 
+    def upgrade(self):
+        method = self.dbusobj.get_dbus_method("upgrade",
+                                              self.dbus_interface)
+        try:
+           reply = method()
+        except dbus.exceptions.DBusException as e:
+           return False, e
+
+        status = reply[0]
+        msg = reply[1]
+        return status, msg
+
     def purge_netgroups(self):
         method = self.dbusobj.get_dbus_method("purge_netgroups",
                                               self.dbus_interface)
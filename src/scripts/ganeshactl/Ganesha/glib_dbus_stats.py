@@ -39,6 +39,28 @@ class RetrieveExportStats():
         stats_op = self.exportmgrobj.get_dbus_method("GetGlobalOPS",
                                  self.dbus_exportstats_name)
         return GlobalStats(stats_op())
+    # latency histograms of every NFSv3/NFSv4 operation
+    def fast_latency(self):
+        stats_op = self.exportmgrobj.get_dbus_method("GetFastLatency",
+                                 self.dbus_exportstats_name)
+        return LatencyStats(stats_op())
+    # decode/queue/execute/fsal/reply histograms of every operation
+    def phase_latency(self):
+        stats_op = self.exportmgrobj.get_dbus_method("GetPhaseLatency",
+                                 self.dbus_exportstats_name)
+        return PhaseStats(stats_op())
+    # latency histograms of a single export
+    def latency(self, export_id):
+        stats_op = self.exportmgrobj.get_dbus_method("GetLatency",
+                                 self.dbus_exportstats_name)
+        return LatencyStats(stats_op(int(export_id)))
+    # heaviest (file handle, op), (client, op) and (export, bytes)
+    def hot_spots(self, kind):
+        method = {"files": "GetHotFiles", "clients": "GetHotClients",
+                  "exports": "GetHotExports"}[kind]
+        stats_op = self.exportmgrobj.get_dbus_method(method,
+                                 self.dbus_exportstats_name)
+        return HotSpots(stats_op())
     # cache inode stats
     def inode_stats(self):
         stats_op = self.exportmgrobj.get_dbus_method("ShowCacheInode",
@@ -124,6 +146,16 @@ class RetrieveClientStats():
         stats_op = self.clientmgrobj.get_dbus_method("GetDelegations",
                           self.dbus_clientstats_name)
         return DelegStats(stats_op(ip))
+    # latency histograms of a single client ip
+    def latency(self, ip):
+        stats_op = self.clientmgrobj.get_dbus_method("GetLatency",
+                          self.dbus_clientstats_name)
+        return LatencyStats(stats_op(ip))
+    # op and I/O counters of every client in one call
+    def all_client_stats(self):
+        stats_op = self.clientmgrobj.get_dbus_method("GetAllClientStats",
+                          self.dbus_clientstats_name)
+        return AllClientStats(stats_op())
     def list_clients(self):
         stats_op = self.clientmgrobj.get_dbus_method("ShowClients",
                           self.dbus_clientmgr_name)
@@ -147,6 +179,30 @@ class Clients():
                        "\nNFSv4.2 stats available: " + str(client[7]) +
                        "\n9P stats available: " + str(client[8]) )
         return output
+class AllClientStats():
+    def __init__(self, stats):
+        self.status = stats[1]
+        if stats[1] == "OK":
+            self.timestamp = (stats[2][0], stats[2][1])
+            self.clients = stats[3]
+    def __str__(self):
+        if self.status != "OK":
+            return ("GANESHA RESPONSE STATUS: " + self.status)
+        output = ("GANESHA RESPONSE STATUS: " + self.status +
+                  "\nTimestamp: " + time.ctime(self.timestamp[0]) +
+                  str(self.timestamp[1]) + " nsecs")
+        for client in self.clients:
+            output += "\n\nAddress: " + client[0]
+            output += ("\n%-12s %12s %8s %12s %8s %16s %12s %8s %16s" %
+                       ("protocol", "ops", "errors", "reads", "rerrors",
+                        "read bytes", "writes", "werrors", "write bytes"))
+            for proto in client[1]:
+                output += ("\n%-12s %12d %8d %12d %8d %16d %12d %8d %16d" %
+                           (proto[0], proto[1][0], proto[1][1],
+                            proto[2][2], proto[2][3], proto[2][1],
+                            proto[3][2], proto[3][3], proto[3][1]))
+        return output
+
 class DelegStats():
     def __init__(self, stats):
         self.status = stats[1]
@@ -235,6 +291,25 @@ class InodeStats():
         self.cache_conflict = stats[3][7]
         self.cache_add = stats[3][9]
         self.cache_mapping = stats[3][11]
+        self.cache_entry_bytes = stats[3][13]
+        self.cache_chunk_bytes = stats[3][15]
+        self.cache_dirent_bytes = stats[3][17]
+        self.cache_memory_limit = stats[3][19]
+        self.ra_hit_bytes = stats[3][21]
+        self.ra_miss = stats[3][23]
+        self.ra_fill_bytes = stats[3][25]
+        self.ra_waste_bytes = stats[3][27]
+        self.ra_bytes = stats[3][29]
+        self.ra_memory_limit = stats[3][31]
+        self.wb_writes = stats[3][33]
+        self.wb_flushes = stats[3][35]
+        self.wb_flush_bytes = stats[3][37]
+        self.wb_bytes = stats[3][39]
+        self.wb_memory_limit = stats[3][41]
+        self.sc_hit_bytes = stats[3][43]
+        self.sc_fill_bytes = stats[3][45]
+        self.sc_bytes = stats[3][47]
+        self.sc_memory_limit = stats[3][49]
     def __str__(self):
         if self.status != "OK":
             return "No NFS activity, GANESHA RESPONSE STATUS: " + self.status
@@ -244,7 +319,26 @@ class InodeStats():
                  "\nInode Cache Misses: " + str(self.cache_miss) +
                  "\nInode Cache Conflicts:: " + str(self.cache_conflict) +
                  "\nInode Cache Adds: " + str(self.cache_add) +
-                 "\nInode Cache Mapping: " + str(self.cache_mapping) )
+                 "\nInode Cache Mapping: " + str(self.cache_mapping) +
+                 "\nInode Cache Entry Bytes: " + str(self.cache_entry_bytes) +
+                 "\nInode Cache Chunk Bytes: " + str(self.cache_chunk_bytes) +
+                 "\nInode Cache Dirent Bytes: " + str(self.cache_dirent_bytes) +
+                 "\nInode Cache Memory Limit: " + str(self.cache_memory_limit) +
+                 "\nRead-ahead Hit Bytes: " + str(self.ra_hit_bytes) +
+                 "\nRead-ahead Misses: " + str(self.ra_miss) +
+                 "\nRead-ahead Fill Bytes: " + str(self.ra_fill_bytes) +
+                 "\nRead-ahead Waste Bytes: " + str(self.ra_waste_bytes) +
+                 "\nRead-ahead Bytes: " + str(self.ra_bytes) +
+                 "\nRead-ahead Memory Limit: " + str(self.ra_memory_limit) +
+                 "\nWrite-behind Writes: " + str(self.wb_writes) +
+                 "\nWrite-behind Flushes: " + str(self.wb_flushes) +
+                 "\nWrite-behind Flush Bytes: " + str(self.wb_flush_bytes) +
+                 "\nWrite-behind Bytes: " + str(self.wb_bytes) +
+                 "\nWrite-behind Memory Limit: " + str(self.wb_memory_limit) +
+                 "\nSmall File Hit Bytes: " + str(self.sc_hit_bytes) +
+                 "\nSmall File Fill Bytes: " + str(self.sc_fill_bytes) +
+                 "\nSmall File Bytes: " + str(self.sc_bytes) +
+                 "\nSmall File Memory Limit: " + str(self.sc_memory_limit) )
 
 class FastStats():
     def __init__(self, stats):
@@ -265,6 +359,85 @@ class FastStats():
                     output += "%s: " % (self.stats[3][i].ljust(20))
         return output
 
+class LatencyStats():
+    percentiles = (50.0, 90.0, 99.0, 99.9)
+    def __init__(self, stats):
+        self.stats = stats
+    # upper bound of the bucket holding the percentile, in usecs
+    def percentile(self, hist, pct):
+        total = sum(count for bound, count in hist)
+        seen = 0
+        for bound, count in hist:
+            seen += count
+            if seen * 100.0 >= total * pct:
+                if bound == 2**64 - 1:
+                    return "inf"
+                return str(bound / 1000)
+        return "-"
+    def __str__(self):
+        if self.stats[1] != "OK":
+            return "No NFS activity, GANESHA RESPONSE STATUS: " + self.stats[1]
+        output = ("Timestamp: " + time.ctime(self.stats[2][0]) +
+                  str(self.stats[2][1]) + " nsecs" +
+                  "\nLatency percentiles (usecs, upper bound):\n" +
+                  "".ljust(24))
+        for pct in self.percentiles:
+            output += ("p" + str(pct)).rjust(12)
+        output += "\n"
+        for entry in self.stats[3]:
+            if sum(count for bound, count in entry[1]) == 0:
+                continue
+            output += str(entry[0]).ljust(24)
+            for pct in self.percentiles:
+                output += self.percentile(entry[1], pct).rjust(12)
+            output += "\n"
+            # queue wait, for the protocol level histograms
+            if len(entry) > 2:
+                output += ("  queue wait").ljust(24)
+                for pct in self.percentiles:
+                    output += self.percentile(entry[2], pct).rjust(12)
+                output += "\n"
+        return output
+
+class PhaseStats(LatencyStats):
+    def __str__(self):
+        if self.stats[1] != "OK":
+            return "No NFS activity, GANESHA RESPONSE STATUS: " + self.stats[1]
+        output = ("Timestamp: " + time.ctime(self.stats[2][0]) +
+                  str(self.stats[2][1]) + " nsecs" +
+                  "\nPhase latency percentiles (usecs, upper bound):\n" +
+                  "".ljust(24) + "".ljust(10))
+        for pct in self.percentiles:
+            output += ("p" + str(pct)).rjust(12)
+        output += "\n"
+        name = None
+        for entry in self.stats[3]:
+            if entry[0] != name:
+                name = entry[0]
+                output += str(name).ljust(24)
+            else:
+                output += "".ljust(24)
+            output += str(entry[1]).ljust(10)
+            for pct in self.percentiles:
+                output += self.percentile(entry[2], pct).rjust(12)
+            output += "\n"
+        return output
+
+class HotSpots():
+    def __init__(self, stats):
+        self.stats = stats
+    def __str__(self):
+        if self.stats[1] != "OK":
+            return "GANESHA RESPONSE STATUS: " + self.stats[1]
+        output = ("Timestamp: " + time.ctime(self.stats[2][0]) +
+                  str(self.stats[2][1]) + " nsecs\n" +
+                  "count".rjust(16) + "+/-".rjust(16) + "  " +
+                  "op".ljust(20) + "key\n")
+        for key, op, count, error in self.stats[3]:
+            output += (str(count).rjust(16) + str(error).rjust(16) + "  " +
+                       str(op).ljust(20) + str(key) + "\n")
+        return output
+
 class ExportIOv3Stats():
     def __init__(self, stats):
         self.stats = stats
@@ -104,6 +104,11 @@ class ShowExports():
         print "Remove Export with id %d" % int(exp_id)
         self.exportmgr.RemoveExport(exp_id)
 
+    def refreshexport(self, exp_id):
+        print "Refresh Export with id %d" % int(exp_id)
+        status, msg = self.exportmgr.RefreshExport(exp_id)
+        self.status_message(status, msg)
+
     def updateexport(self, conf_path, exp_expr):
         print "Update Export in %s" % conf_path
 	status, msg = self.exportmgr.UpdateExport(conf_path, exp_expr)
@@ -160,6 +165,11 @@ class ServerAdmin():
         status, msg = self.admin.shutdown()
         self.status_message(status, msg)
 
+    def upgrade(self):
+        print "Handing over to a new server process."
+        status, msg = self.admin.upgrade()
+        self.status_message(status, msg)
+
     def grace(self, ipaddr):
         print "Start grace period."
         status, msg = self.admin.grace(ipaddr)
@@ -233,12 +243,14 @@ if __name__ == '__main__':
        "      Example: \n"                                                   \
        "      add_export /etc/ganesha/gpfs.conf \"EXPORT(Export_ID=77)\"\n\n"\
        "   remove_export id: Removes the export with the given id    \n\n"   \
+       "   refresh_export id: Drops the cached metadata of the export\n\n"   \
        "   update_export conf expr:\n"                                       \
        "      Updates an export from the given config file that contains\n"  \
        "      the given expression\n"                                        \
        "      Example: \n"                                                   \
        "      update_export /etc/ganesha/gpfs.conf \"EXPORT(Export_ID=77)\"\n\n"\
        "   shutdown: Shuts down the ganesha nfs server\n\n"                  \
+       "   upgrade: Restarts the server binary without closing its ports\n\n"\
        "   purge netgroups: Purges netgroups cache\n\n"                      \
        "   grace ipaddr: Begins grace for the given IP\n\n"                  \
        "   get_log component: Gets the log level for the given component\n\n"\
@@ -277,6 +289,12 @@ if __name__ == '__main__':
                  " Try \"ganesha_mgr.py help\" for more info"
            sys.exit(1)
         exportmgr.removeexport(sys.argv[2])
+    elif sys.argv[1] == "refresh_export":
+        if len(sys.argv) < 3:
+           print "refresh_export requires an export ID."\
+                 " Try \"ganesha_mgr.py help\" for more info"
+           sys.exit(1)
+        exportmgr.refreshexport(sys.argv[2])
     elif sys.argv[1] == "update_export":
         if len(sys.argv) < 4:
            print "update_export requires a config file and an expression."\
@@ -294,6 +312,8 @@ if __name__ == '__main__':
 
     elif sys.argv[1] == "shutdown":
         ganesha.shutdown()
+    elif sys.argv[1] == "upgrade":
+        ganesha.upgrade()
     elif sys.argv[1] == "purge":
         if len(sys.argv) < 3:
             msg = 'purge requires a cache name to purge, '
@@ -14,10 +14,13 @@ import Ganesha.glib_dbus_stats
 
 def usage():
     message = "Command gives global stats by default.\n"
-    message += "%s [list_clients | deleg <ip address> | " % (sys.argv[0])
+    message += "%s [list_clients | all_clients | deleg <ip address> | " % (
+        sys.argv[0])
     message += "inode | iov3 [export id] | iov4 [export id] | export |"
     message += " total [export id] | fast | pnfs [export id] |"
-    message += " fsal <fsal name> ] \n"
+    message += " fsal <fsal name> | latency <export id> |"
+    message += " client_latency <ip address> | fast_latency | phases |"
+    message += " hot_files | hot_clients | hot_exports ] \n"
     message += "To reset stat counters use \n"
     message += "%s reset " % (sys.argv[0])
     sys.exit(message)
@@ -28,18 +31,25 @@ else:
     command = sys.argv[1]
 
 # check arguments
-commands = ('help', 'list_clients', 'deleg', 'global', 'inode', 'iov3', 'iov4',
-	    'export', 'total', 'fast', 'pnfs', 'fsal', 'reset')
+commands = ('help', 'list_clients', 'all_clients', 'deleg', 'global', 'inode',
+	    'iov3', 'iov4', 'export', 'total', 'fast', 'pnfs', 'fsal', 'reset', 'latency',
+	    'client_latency', 'fast_latency', 'phases', 'hot_files',
+	    'hot_clients', 'hot_exports')
 if command not in commands:
     print "Option \"%s\" is not correct." % (command)
     usage()
 # requires an IP address
-elif command in ('deleg'):
+elif command in ('deleg', 'client_latency'):
     if not len(sys.argv) == 3:
         print "Option \"%s\" must be followed by an ip address." % (command)
         usage()
     command_arg = sys.argv[2]
 # optionally accepts an export id
+elif command == 'latency':
+    if not (len(sys.argv) == 3 and sys.argv[2].isdigit()):
+        print "Option \"%s\" must be followed by an export id." % (command)
+        usage()
+    command_arg = sys.argv[2]
 elif command in ('iov3', 'iov4', 'total', 'pnfs'):
     if (len(sys.argv) == 2):
         command_arg = -1
@@ -69,6 +79,8 @@ elif command == "fast":
     print exp_interface.fast_stats()
 elif command == "list_clients":
     print cl_interface.list_clients()
+elif command == "all_clients":
+    print cl_interface.all_client_stats()
 elif command == "deleg":
     print cl_interface.deleg_stats(command_arg)
 elif command == "iov3":
@@ -83,3 +95,13 @@ elif command == "reset":
     print exp_interface.reset_stats()
 elif command == "fsal":
     print exp_interface.fsal_stats(command_arg)
+elif command == "latency":
+    print exp_interface.latency(command_arg)
+elif command == "client_latency":
+    print cl_interface.latency(command_arg)
+elif command == "fast_latency":
+    print exp_interface.fast_latency()
+elif command == "phases":
+    print exp_interface.phase_latency()
+elif command in ('hot_files', 'hot_clients', 'hot_exports'):
+    print exp_interface.hot_spots(command[4:])
@@ -0,0 +1,180 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file abstract_mem.c
+ * @brief Memory accounting by subsystem
+ *
+ * See @ref MemoryTags.
+ */
+
+#include "config.h"
+#include <pthread.h>
+#include "log.h"
+#include "abstract_mem.h"
+#include "abstract_atomic.h"
+#include "common_utils.h"
+#include "nfs_core.h"
+#include "gsh_slab.h"
+#ifdef USE_DBUS
+#include "gsh_dbus.h"
+#include "server_stats_private.h"
+#endif
+
+struct gsh_mem_counters gsh_mem_counters[GSH_MEM_TAG_COUNT];
+__thread uint32_t gsh_mem_countdown;
+
+static const char *gsh_mem_tag_names[GSH_MEM_TAG_COUNT] = {
+	[GSH_MEM_OTHER] = "other",
+	[GSH_MEM_MDCACHE] = "mdcache",
+	[GSH_MEM_DRC] = "drc",
+	[GSH_MEM_STATE] = "state",
+	[GSH_MEM_9P] = "9p",
+	[GSH_MEM_HASHTABLE] = "hashtable",
+	[GSH_MEM_REQUEST] = "request",
+};
+
+/**
+ * @brief Count a sampled allocation or free
+ *
+ * @param[in] tag Subsystem
+ * @param[in] n   Bytes allocated, negative for bytes freed
+ */
+void gsh_mem_sample(enum gsh_mem_tag tag, int64_t n)
+{
+	struct gsh_mem_counters *c = &gsh_mem_counters[tag];
+
+	if (n >= 0) {
+		(void) atomic_add_int64_t(&c->allocs, GSH_MEM_SAMPLE);
+		(void) atomic_add_int64_t(&c->alloc_bytes,
+					  n * GSH_MEM_SAMPLE);
+	} else {
+		(void) atomic_add_int64_t(&c->frees, GSH_MEM_SAMPLE);
+		(void) atomic_add_int64_t(&c->free_bytes,
+					  -n * GSH_MEM_SAMPLE);
+	}
+}
+
+/**
+ * @brief Name of a subsystem, as reported
+ *
+ * @param[in] tag Subsystem
+ *
+ * @return Its name.
+ */
+const char *gsh_mem_tag_name(enum gsh_mem_tag tag)
+{
+	return tag < GSH_MEM_TAG_COUNT ? gsh_mem_tag_names[tag] : "unknown";
+}
+
+#ifdef USE_DBUS
+/** Counts at the previous report, for the rates */
+static struct {
+	pthread_mutex_t mtx;
+	struct timespec when;
+	int64_t allocs[GSH_MEM_TAG_COUNT];
+	int64_t alloc_bytes[GSH_MEM_TAG_COUNT];
+} gsh_mem_last = {
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/**
+ * @brief Report memory by subsystem
+ *
+ * Appends the timestamp and for each subsystem its name, live bytes,
+ * allocations and bytes allocated since start, then allocations and
+ * bytes allocated per second since the previous report (since start
+ * for the first one).  Counts include slabs charged to the subsystem
+ * and, but for slabs, are estimates from sampling.
+ */
+void gsh_mem_dbus_show(DBusMessageIter *iter)
+{
+	struct timespec timestamp;
+	DBusMessageIter array_iter, struct_iter;
+	int64_t slab_bytes[GSH_MEM_TAG_COUNT] = { 0 };
+	int64_t slab_allocs[GSH_MEM_TAG_COUNT] = { 0 };
+	struct gsh_mem_counters *c;
+	uint64_t live, allocs, alloc_bytes;
+	double secs, alloc_rate, byte_rate;
+	char *name;
+	int tag;
+
+	now(&timestamp);
+	dbus_append_timestamp(iter, &timestamp);
+
+	gsh_slab_mem_usage(slab_bytes, slab_allocs);
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "(stttdd)",
+					 &array_iter);
+
+	PTHREAD_MUTEX_lock(&gsh_mem_last.mtx);
+
+	secs = (double) timespec_diff(gsh_mem_last.when.tv_sec == 0
+				      ? &ServerBootTime : &gsh_mem_last.when,
+				      &timestamp) / NS_PER_SEC;
+
+	for (tag = 0; tag < GSH_MEM_TAG_COUNT; tag++) {
+		int64_t in_use;
+
+		c = &gsh_mem_counters[tag];
+		in_use = atomic_fetch_int64_t(&c->alloc_bytes) -
+			 atomic_fetch_int64_t(&c->free_bytes);
+
+		/* Sampling can briefly see more freed than allocated */
+		live = (in_use > 0 ? in_use : 0) + slab_bytes[tag];
+		allocs = atomic_fetch_int64_t(&c->allocs) + slab_allocs[tag];
+		alloc_bytes = atomic_fetch_int64_t(&c->alloc_bytes);
+
+		alloc_rate = byte_rate = 0;
+		if (secs > 0) {
+			alloc_rate = (allocs - gsh_mem_last.allocs[tag]) / secs;
+			byte_rate = (alloc_bytes -
+				     gsh_mem_last.alloc_bytes[tag]) / secs;
+		}
+		gsh_mem_last.allocs[tag] = allocs;
+		gsh_mem_last.alloc_bytes[tag] = alloc_bytes;
+
+		name = (char *) gsh_mem_tag_names[tag];
+
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &struct_iter);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &name);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &live);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &allocs);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &alloc_bytes);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_DOUBLE,
+					       &alloc_rate);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_DOUBLE,
+					       &byte_rate);
+		dbus_message_iter_close_container(&array_iter, &struct_iter);
+	}
+
+	gsh_mem_last.when = timestamp;
+
+	PTHREAD_MUTEX_unlock(&gsh_mem_last.mtx);
+
+	dbus_message_iter_close_container(iter, &array_iter);
+}
+#endif
@@ -0,0 +1,387 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @file client_index.c
+ * @brief Compiled export client lists
+ *
+ * An export's CLIENT entries are matched in list order and the first
+ * match wins.  Rather than walking the list for every access check,
+ * the list is compiled when the export is committed:
+ *
+ * - IPv4 and IPv6 host entries go in open addressed hash tables,
+ * - IPv4 networks go in a binary trie on the address bits,
+ * - the first match-all entry is remembered,
+ * - netgroups, wildcards and anything odd stay in a list.
+ *
+ * Every entry keeps its position in the client list, and each structure
+ * only keeps the earliest entry for a key, so a lookup is the earliest
+ * of at most one host, the prefixes on one path of the trie and the
+ * match-all entry.  The caller then only tries the slow entries that
+ * come before that.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "log.h"
+#include "abstract_mem.h"
+#include "city.h"
+#include "client_index.h"
+
+struct client_host4 {
+	exportlist_client_entry_t *client;	/*< NULL if the slot is free */
+	uint32_t addr;				/*< Network byte order */
+	uint32_t order;
+};
+
+struct client_host6 {
+	exportlist_client_entry_t *client;	/*< NULL if the slot is free */
+	struct in6_addr addr;
+	uint32_t order;
+};
+
+struct client_trie_node {
+	uint32_t child[2];	/*< Node index, 0 for none (0 is the root) */
+	uint32_t order;		/*< CLIENT_INDEX_NONE if no prefix ends here */
+	exportlist_client_entry_t *client;
+};
+
+struct client_index {
+	struct client_host4 *host4;
+	uint32_t host4_mask;		/*< Slots - 1 */
+	struct client_host6 *host6;
+	uint32_t host6_mask;		/*< Slots - 1 */
+	struct client_trie_node *trie;
+	uint32_t trie_count;
+	uint32_t trie_size;
+	exportlist_client_entry_t *any;	/*< First match-all entry */
+	uint32_t any_order;
+	struct client_index_slow *slow;
+	uint32_t slow_count;
+};
+
+static inline uint32_t host4_hash(uint32_t addr)
+{
+	return (addr * 2654435761U) ^ (addr >> 16);
+}
+
+static inline uint32_t host6_hash(struct in6_addr *addr)
+{
+	return CityHash64((char *)addr->s6_addr, sizeof(addr->s6_addr));
+}
+
+/* Slots for n hosts, a power of two at most half full */
+static uint32_t host_slots(uint32_t n)
+{
+	uint32_t slots = 4;
+
+	while (slots < n * 2)
+		slots <<= 1;
+	return slots;
+}
+
+static void host4_insert(struct client_index *index,
+			 exportlist_client_entry_t *client, uint32_t order)
+{
+	uint32_t addr = client->client.hostif.clientaddr;
+	uint32_t i = host4_hash(addr) & index->host4_mask;
+
+	while (index->host4[i].client != NULL) {
+		/* Only the first entry for a host can ever match */
+		if (index->host4[i].addr == addr)
+			return;
+		i = (i + 1) & index->host4_mask;
+	}
+	index->host4[i].client = client;
+	index->host4[i].addr = addr;
+	index->host4[i].order = order;
+}
+
+static void host6_insert(struct client_index *index,
+			 exportlist_client_entry_t *client, uint32_t order)
+{
+	struct in6_addr *addr = &client->client.hostif.clientaddr6;
+	uint32_t i = host6_hash(addr) & index->host6_mask;
+
+	while (index->host6[i].client != NULL) {
+		if (memcmp(&index->host6[i].addr, addr, sizeof(*addr)) == 0)
+			return;
+		i = (i + 1) & index->host6_mask;
+	}
+	index->host6[i].client = client;
+	index->host6[i].addr = *addr;
+	index->host6[i].order = order;
+}
+
+/**
+ * @brief Length of a netmask's prefix
+ *
+ * @return Prefix length or -1 if the mask is not a prefix.
+ */
+static int prefix_len(uint32_t netmask)
+{
+	int len = 0;
+
+	while (len < 32 && (netmask & (0x80000000U >> len)) != 0)
+		len++;
+	if (len < 32 && (netmask << len) != 0)
+		return -1;
+	return len;
+}
+
+static void trie_insert(struct client_index *index,
+			exportlist_client_entry_t *client, uint32_t order,
+			uint32_t netaddr, int len)
+{
+	uint32_t node = 0, bit;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		bit = (netaddr >> (31 - i)) & 1;
+		if (index->trie[node].child[bit] == 0) {
+			assert(index->trie_count < index->trie_size);
+			index->trie[index->trie_count].order =
+							CLIENT_INDEX_NONE;
+			index->trie[node].child[bit] = index->trie_count++;
+		}
+		node = index->trie[node].child[bit];
+	}
+	if (index->trie[node].order == CLIENT_INDEX_NONE) {
+		index->trie[node].order = order;
+		index->trie[node].client = client;
+	}
+}
+
+/**
+ * @brief Compile a client list
+ *
+ * The index points at the entries of the list, so it must be freed no
+ * later than the list and rebuilt if the list changes.
+ *
+ * @param[in] clients List of exportlist_client_entry_t
+ *
+ * @return The index.
+ */
+struct client_index *client_index_build(struct glist_head *clients)
+{
+	struct client_index *index = gsh_calloc(1, sizeof(*index));
+	uint32_t n4 = 0, n6 = 0, nnet = 0, nslow = 0, order = 0;
+	exportlist_client_entry_t *client;
+	struct glist_head *glist;
+	int len;
+
+	glist_for_each(glist, clients) {
+		client = glist_entry(glist, exportlist_client_entry_t,
+				     cle_list);
+		switch (client->type) {
+		case HOSTIF_CLIENT:
+			n4++;
+			break;
+		case HOSTIF_CLIENT_V6:
+			n6++;
+			break;
+		case NETWORK_CLIENT:
+			/* It may turn out not to be a prefix */
+			nnet++;
+			/* fall through */
+		default:
+			nslow++;
+			break;
+		}
+	}
+
+	index->host4_mask = host_slots(n4) - 1;
+	index->host4 = gsh_calloc(index->host4_mask + 1,
+				  sizeof(*index->host4));
+	index->host6_mask = host_slots(n6) - 1;
+	index->host6 = gsh_calloc(index->host6_mask + 1,
+				  sizeof(*index->host6));
+	index->trie_size = nnet * 32 + 1;
+	index->trie = gsh_calloc(index->trie_size, sizeof(*index->trie));
+	index->trie[0].order = CLIENT_INDEX_NONE;
+	index->trie_count = 1;
+	index->any_order = CLIENT_INDEX_NONE;
+	index->slow = gsh_calloc(nslow + 1, sizeof(*index->slow));
+
+	glist_for_each(glist, clients) {
+		client = glist_entry(glist, exportlist_client_entry_t,
+				     cle_list);
+		switch (client->type) {
+		case HOSTIF_CLIENT:
+			host4_insert(index, client, order);
+			break;
+
+		case HOSTIF_CLIENT_V6:
+			host6_insert(index, client, order);
+			break;
+
+		case NETWORK_CLIENT:
+			len = prefix_len(client->client.network.netmask);
+			/* Odd masks, or an address with bits outside its
+			 * mask, keep the list's exact comparison.
+			 */
+			if (len < 0 || (client->client.network.netaddr &
+					~client->client.network.netmask) != 0)
+				goto slow;
+			trie_insert(index, client, order,
+				    client->client.network.netaddr, len);
+			break;
+
+		case MATCH_ANY_CLIENT:
+			if (index->any == NULL) {
+				index->any = client;
+				index->any_order = order;
+			}
+			break;
+
+		case NETGROUP_CLIENT:
+		case WILDCARDHOST_CLIENT:
+		case GSSPRINCIPAL_CLIENT:
+ slow:
+			index->slow[index->slow_count].client = client;
+			index->slow[index->slow_count].order = order;
+			index->slow_count++;
+			break;
+
+		case BAD_CLIENT:
+		default:
+			break;
+		}
+		order++;
+	}
+
+	LogDebug(COMPONENT_EXPORT,
+		 "Indexed %" PRIu32 " clients: %" PRIu32 " IPv4 hosts, %"
+		 PRIu32 " IPv6 hosts, %" PRIu32 " trie nodes, %" PRIu32
+		 " to match in order",
+		 order, n4, n6, index->trie_count, index->slow_count);
+
+	return index;
+}
+
+void client_index_free(struct client_index *index)
+{
+	if (index == NULL)
+		return;
+
+	gsh_free(index->host4);
+	gsh_free(index->host6);
+	gsh_free(index->trie);
+	gsh_free(index->slow);
+	gsh_free(index);
+}
+
+/**
+ * @brief Find the earliest address entry matching an IPv4 address
+ *
+ * Only host, network and match-all entries are considered; the slow
+ * entries before @a order must still be tried.
+ *
+ * @param[in]  index The index
+ * @param[in]  addr  Address, network byte order
+ * @param[out] order Position of the match, CLIENT_INDEX_NONE if none
+ *
+ * @return The matching entry or NULL.
+ */
+exportlist_client_entry_t *client_index_match_v4(struct client_index *index,
+						 in_addr_t addr,
+						 uint32_t *order)
+{
+	exportlist_client_entry_t *best = index->any;
+	uint32_t best_order = index->any_order;
+	uint32_t haddr = ntohl(addr);
+	uint32_t i, node = 0;
+	int bit = 0;
+
+	i = host4_hash(addr) & index->host4_mask;
+	while (index->host4[i].client != NULL) {
+		if (index->host4[i].addr == addr) {
+			if (index->host4[i].order < best_order) {
+				best = index->host4[i].client;
+				best_order = index->host4[i].order;
+			}
+			break;
+		}
+		i = (i + 1) & index->host4_mask;
+	}
+
+	for (;;) {
+		if (index->trie[node].order < best_order) {
+			best = index->trie[node].client;
+			best_order = index->trie[node].order;
+		}
+		if (bit == 32)
+			break;
+		node = index->trie[node].child[(haddr >> (31 - bit)) & 1];
+		if (node == 0)
+			break;
+		bit++;
+	}
+
+	*order = best_order;
+	return best;
+}
+
+/**
+ * @brief Find the earliest entry matching an IPv6 address
+ *
+ * Only host and match-all entries apply to IPv6 addresses.
+ *
+ * @param[in] index The index
+ * @param[in] addr  Address
+ *
+ * @return The matching entry or NULL.
+ */
+exportlist_client_entry_t *client_index_match_v6(struct client_index *index,
+						 struct in6_addr *addr)
+{
+	uint32_t i = host6_hash(addr) & index->host6_mask;
+
+	while (index->host6[i].client != NULL) {
+		if (memcmp(&index->host6[i].addr, addr, sizeof(*addr)) == 0) {
+			if (index->host6[i].order < index->any_order)
+				return index->host6[i].client;
+			break;
+		}
+		i = (i + 1) & index->host6_mask;
+	}
+
+	return index->any;
+}
+
+/**
+ * @brief The entries to be matched in order
+ *
+ * @param[in]  index The index
+ * @param[out] count Number of entries
+ *
+ * @return The entries, in client list order.
+ */
+struct client_index_slow *client_index_slow_list(struct client_index *index,
+						 uint32_t *count)
+{
+	*count = index->slow_count;
+	return index->slow;
+}
@@ -64,10 +64,13 @@
 #include "server_stats_private.h"
 #include "abstract_atomic.h"
 #include "gsh_intrinsic.h"
+#include "gsh_rcu.h"
 #include "server_stats.h"
 #include "sal_functions.h"
 
-/* Clients are stored in an AVL tree
+/* Clients are stored in an AVL tree.  The front-end cache is probed
+ * without the lock, from a read side section; a client is freed only
+ * once it is out of the cache and the sections have drained.
  */
 
 struct client_by_ip {
@@ -75,10 +78,13 @@ struct client_by_ip {
 	pthread_rwlock_t lock;
 	struct avltree_node **cache;
 	uint32_t cache_sz;
+	struct gsh_rcu rcu;
 };
 
 static struct client_by_ip client_by_ip;
 
+uint32_t client_weight_gen = 1;
+
 /**
  * @brief Compute cache slot for an entry
  *
@@ -116,6 +122,28 @@ static int client_ip_cmpf(const struct avltree_node *lhs,
 		return memcmp(lk->addr.addr, rk->addr.addr, lk->addr.len);
 }
 
+/**
+ * @brief Take a reference on a client found without the lock
+ *
+ * remove_gsh_client() marks an unreferenced client dead with a
+ * negative count, so a reader racing with it either gets its reference
+ * in first or leaves the client alone.
+ *
+ * @return true if the reference was taken.
+ */
+
+static inline bool get_gsh_client_ref_live(struct gsh_client *cl)
+{
+	int64_t refcnt = atomic_fetch_int64_t(&cl->refcnt);
+
+	while (refcnt >= 0) {
+		if (atomic_cas_int64_t(&cl->refcnt, refcnt, refcnt + 1))
+			return true;
+		refcnt = atomic_fetch_int64_t(&cl->refcnt);
+	}
+	return false;
+}
+
 /**
  * @brief Lookup the client manager struct for this client IP
  *
@@ -140,6 +168,7 @@ struct gsh_client *get_gsh_client(sockaddr_t *client_ipaddr, bool lookup_only)
 	uint32_t ipaddr;
 	int addr_len = 0;
 	void **cache_slot;
+	int64_t *reader;
 
 	switch (client_ipaddr->ss_family) {
 	case AF_INET:
@@ -178,23 +207,25 @@ struct gsh_client *get_gsh_client(sockaddr_t *client_ipaddr, bool lookup_only)
 	v.addr.addr = addr;
 	v.addr.len = addr_len;
 
-	PTHREAD_RWLOCK_rdlock(&client_by_ip.lock);
-
 	/* check cache */
 	cache_slot = (void **)
 	    &(client_by_ip.cache[eip_cache_offsetof(&client_by_ip, ipaddr)]);
+	reader = gsh_rcu_read_lock(&client_by_ip.rcu);
 	node = (struct avltree_node *)atomic_fetch_voidptr(cache_slot);
-	if (node) {
-		if (client_ip_cmpf(&v.node_k, node) == 0) {
+	if (node && client_ip_cmpf(&v.node_k, node) == 0) {
+		cl = avltree_container_of(node, struct gsh_client, node_k);
+		if (get_gsh_client_ref_live(cl)) {
 			/* got it in 1 */
+			gsh_rcu_read_unlock(reader);
 			LogDebug(COMPONENT_HASHTABLE_CACHE,
 				 "client_mgr cache hit slot %d",
 				 eip_cache_offsetof(&client_by_ip, ipaddr));
-			cl = avltree_container_of(node, struct gsh_client,
-						  node_k);
-			goto out;
+			return cl;
 		}
 	}
+	gsh_rcu_read_unlock(reader);
+
+	PTHREAD_RWLOCK_rdlock(&client_by_ip.lock);
 
 	/* fall back to AVL */
 	node = avltree_lookup(&v.node_k, &client_by_ip.t);
@@ -313,7 +344,8 @@ int remove_gsh_client(sockaddr_t *client_ipaddr)
 	node = avltree_lookup(&v.node_k, &client_by_ip.t);
 	if (node) {
 		cl = avltree_container_of(node, struct gsh_client, node_k);
-		if (atomic_fetch_int64_t(&cl->refcnt) > 0) {
+		/* No reference can be taken once it is dead */
+		if (!atomic_cas_int64_t(&cl->refcnt, 0, -1)) {
 			removed = EBUSY;
 			goto out;
 		}
@@ -330,6 +362,8 @@ int remove_gsh_client(sockaddr_t *client_ipaddr)
  out:
 	PTHREAD_RWLOCK_unlock(&client_by_ip.lock);
 	if (removed == 0) {
+		/* Wait out lookups that may still be looking at it */
+		gsh_rcu_synchronize(&client_by_ip.rcu);
 		server_st = container_of(cl, struct server_stats, client);
 		server_stats_free(&server_st->st);
 		if (cl->hostaddr_str != NULL)
@@ -368,6 +402,48 @@ int foreach_gsh_client(bool(*cb) (struct gsh_client *cl, void *state),
 
 #ifdef USE_DBUS
 
+/**
+ * @brief Take a reference on every client
+ *
+ * The tree lock is only held long enough to collect the clients so a
+ * caller can report on them without stalling get_gsh_client, whose
+ * writers would otherwise queue behind a long walk.
+ *
+ * @param count [OUT] number of clients returned
+ *
+ * @return Array of referenced clients, free with put_gsh_clients.
+ */
+
+static struct gsh_client **get_gsh_clients(size_t *count)
+{
+	struct avltree_node *client_node;
+	struct gsh_client **clients;
+	size_t cnt = 0;
+
+	PTHREAD_RWLOCK_rdlock(&client_by_ip.lock);
+	clients = gsh_malloc((avltree_size(&client_by_ip.t) + 1) *
+			     sizeof(*clients));
+	for (client_node = avltree_first(&client_by_ip.t); client_node != NULL;
+	     client_node = avltree_next(client_node)) {
+		clients[cnt] = avltree_container_of(client_node,
+						    struct gsh_client, node_k);
+		inc_gsh_client_refcount(clients[cnt]);
+		cnt++;
+	}
+	PTHREAD_RWLOCK_unlock(&client_by_ip.lock);
+	*count = cnt;
+	return clients;
+}
+
+static void put_gsh_clients(struct gsh_client **clients, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		put_gsh_client(clients[i]);
+	gsh_free(clients);
+}
+
 /* DBUS helpers
  */
 
@@ -494,6 +570,69 @@ static struct gsh_dbus_method cltmgr_remove_client = {
 		 END_ARG_LIST}
 };
 
+/**
+ * @brief Set a client's request scheduling weight via DBUS
+ *
+ * The weight is used by the fair-share dispatcher; 0 reverts the
+ * client to Dispatch_Fair_Share_Weight.
+ *
+ * @param args [IN] dbus argument stream from the message
+ * @param reply [OUT] dbus reply stream for method to fill
+ */
+
+static bool gsh_client_setweight(DBusMessageIter *args,
+				 DBusMessage *reply,
+				 DBusError *error)
+{
+	struct gsh_client *client;
+	sockaddr_t sockaddr;
+	bool success = true;
+	char *errormsg = "OK";
+	uint32_t weight = 0;
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	success = arg_ipaddr(args, &sockaddr, &errormsg);
+	if (success) {
+		dbus_message_iter_next(args);
+		if (dbus_message_iter_get_arg_type(args) != DBUS_TYPE_UINT32) {
+			success = false;
+			errormsg = "weight not a uint32";
+		} else {
+			dbus_message_iter_get_basic(args, &weight);
+			if (weight > 1024) {
+				success = false;
+				errormsg = "weight out of range (0 to 1024)";
+			}
+		}
+	}
+	if (success) {
+		client = get_gsh_client(&sockaddr, false);
+		if (client != NULL) {
+			atomic_store_uint32_t(&client->sched_weight, weight);
+			(void) atomic_inc_uint32_t(&client_weight_gen);
+			put_gsh_client(client);
+		} else {
+			success = false;
+			errormsg = "No memory to insert client";
+		}
+	}
+	dbus_status_reply(&iter, success, errormsg);
+	return true;
+}
+
+static struct gsh_dbus_method cltmgr_set_weight = {
+	.name = "SetClientWeight",
+	.method = gsh_client_setweight,
+	.args = {IPADDR_ARG,
+		 {
+		  .name = "weight",
+		  .type = "u",
+		  .direction = "in"},
+		 STATUS_REPLY,
+		 END_ARG_LIST}
+};
+
 struct showclients_state {
 	DBusMessageIter client_iter;
 };
@@ -531,6 +670,8 @@ static bool gsh_client_showclients(DBusMessageIter *args,
 	DBusMessageIter iter;
 	struct showclients_state iter_state;
 	struct timespec timestamp;
+	struct gsh_client **clients;
+	size_t count, i;
 
 	now(&timestamp);
 	/* create a reply from the message */
@@ -540,7 +681,10 @@ static bool gsh_client_showclients(DBusMessageIter *args,
 					 "(sbbbbbbbb(tt))",
 					 &iter_state.client_iter);
 
-	(void)foreach_gsh_client(client_to_dbus, (void *)&iter_state);
+	clients = get_gsh_clients(&count);
+	for (i = 0; i < count; i++)
+		(void)client_to_dbus(clients[i], (void *)&iter_state);
+	put_gsh_clients(clients, count);
 
 	dbus_message_iter_close_container(&iter, &iter_state.client_iter);
 	return true;
@@ -580,6 +724,7 @@ static struct gsh_dbus_method *cltmgr_client_methods[] = {
 	&cltmgr_add_client,
 	&cltmgr_remove_client,
 	&cltmgr_show_clients,
+	&cltmgr_set_weight,
 	NULL
 };
 
@@ -848,6 +993,100 @@ static struct gsh_dbus_method cltmgr_show_delegations = {
 		 END_ARG_LIST}
 };
 
+/**
+ * DBUS method to report the latency histograms of a client
+ */
+static bool get_client_latency(DBusMessageIter *args,
+			       DBusMessage *reply,
+			       DBusError *error)
+{
+	char *errormsg = "OK";
+	struct gsh_client *client = NULL;
+	struct server_stats *server_st = NULL;
+	bool success = true;
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	client = lookup_client(args, &errormsg);
+	if (client == NULL) {
+		success = false;
+		if (errormsg == NULL)
+			errormsg = "Client IP address not found";
+	}
+
+	dbus_status_reply(&iter, success, errormsg);
+	if (success) {
+		server_st = container_of(client, struct server_stats, client);
+		server_dbus_latency(&server_st->st, &iter);
+	}
+
+	if (client != NULL)
+		put_gsh_client(client);
+
+	return true;
+}
+
+/**
+ * DBUS method to report the op and I/O counters of every client
+ *
+ * One call replaces a Get*IO call per client and protocol.  The
+ * counters are read as snapshots and the client tree is walked
+ * outside its lock, so polling this does not slow the workers.
+ */
+static bool get_all_client_stats(DBusMessageIter *args,
+				 DBusMessage *reply,
+				 DBusError *error)
+{
+	DBusMessageIter iter, array_iter, struct_iter;
+	struct server_stats *server_st;
+	struct gsh_client **clients;
+	struct timespec timestamp;
+	size_t count, i;
+
+	now(&timestamp);
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_status_reply(&iter, true, "OK");
+	dbus_append_timestamp(&iter, &timestamp);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					 ALL_CLIENTS_REPLY_ARRAY_TYPE,
+					 &array_iter);
+
+	clients = get_gsh_clients(&count);
+	for (i = 0; i < count; i++) {
+		server_st = container_of(clients[i], struct server_stats,
+					 client);
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &struct_iter);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &clients[i]->hostaddr_str);
+		server_dbus_proto_stats(&server_st->st, &struct_iter);
+		dbus_message_iter_close_container(&array_iter, &struct_iter);
+	}
+	put_gsh_clients(clients, count);
+
+	dbus_message_iter_close_container(&iter, &array_iter);
+	return true;
+}
+
+static struct gsh_dbus_method cltmgr_show_all_stats = {
+	.name = "GetAllClientStats",
+	.method = get_all_client_stats,
+	.args = {STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 ALL_CLIENTS_REPLY,
+		 END_ARG_LIST}
+};
+
+static struct gsh_dbus_method cltmgr_show_latency = {
+	.name = "GetLatency",
+	.method = get_client_latency,
+	.args = {IPADDR_ARG,
+		 STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 LATENCY_REPLY,
+		 END_ARG_LIST}
+};
+
 #ifdef _USE_9P
 /**
  * DBUS method to report 9p I/O statistics
@@ -1001,6 +1240,8 @@ static struct gsh_dbus_method *cltmgr_stats_methods[] = {
 	&cltmgr_show_v41_io,
 	&cltmgr_show_v41_layouts,
 	&cltmgr_show_delegations,
+	&cltmgr_show_latency,
+	&cltmgr_show_all_stats,
 #ifdef _USE_9P
 	&cltmgr_show_9p_io,
 	&cltmgr_show_9p_trans,
@@ -1051,6 +1292,7 @@ void client_pkginit(void)
 	client_by_ip.cache_sz = 32767;
 	client_by_ip.cache =
 	    gsh_calloc(client_by_ip.cache_sz, sizeof(struct avltree_node *));
+	gsh_rcu_init(&client_by_ip.rcu);
 }
 
 /** @} */
@@ -0,0 +1,153 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file crc32c.c
+ * @brief CRC32C (Castagnoli) checksum with runtime CPU dispatch
+ */
+
+#include "config.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_acle.h>
+#endif
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82F63B78	/* reflected */
+
+typedef uint32_t (*crc32c_fn)(uint32_t, const unsigned char *, size_t);
+
+static uint32_t crc32c_table[256];
+static crc32c_fn crc32c_impl;
+static const char *crc32c_name;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	while (len--)
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__ ((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t crc64 = crc;
+	uint64_t word;
+
+	while (len && ((uintptr_t) p & 7)) {
+		crc64 = _mm_crc32_u8(crc64, *p++);
+		len--;
+	}
+	while (len >= 8) {
+		memcpy(&word, p, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc64 = _mm_crc32_u8(crc64, *p++);
+	return crc64;
+}
+
+static bool crc32c_hw_available(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__)
+__attribute__ ((target("+crc")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t word;
+
+	while (len && ((uintptr_t) p & 7)) {
+		crc = __crc32cb(crc, *p++);
+		len--;
+	}
+	while (len >= 8) {
+		memcpy(&word, p, sizeof(word));
+		crc = __crc32cd(crc, word);
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = __crc32cb(crc, *p++);
+	return crc;
+}
+
+static bool crc32c_hw_available(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#endif
+
+static void crc32c_init(void)
+{
+	uint32_t ix, bit, crc;
+
+	for (ix = 0; ix < 256; ix++) {
+		crc = ix;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32c_table[ix] = crc;
+	}
+
+	crc32c_impl = crc32c_sw;
+	crc32c_name = "software";
+#if defined(__x86_64__) || defined(__aarch64__)
+	if (crc32c_hw_available()) {
+		crc32c_impl = crc32c_hw;
+		crc32c_name = "hardware";
+	}
+#endif
+}
+
+/**
+ * @brief Extend a CRC32C over a buffer
+ *
+ * @param[in] crc Checksum so far, 0 to start
+ * @param[in] buf Data
+ * @param[in] len Length of data
+ *
+ * @return The updated checksum.
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	(void) pthread_once(&crc32c_once, crc32c_init);
+	return ~crc32c_impl(~crc, buf, len);
+}
+
+/**
+ * @brief Name the implementation selected for this CPU
+ */
+const char *crc32c_impl_name(void)
+{
+	(void) pthread_once(&crc32c_once, crc32c_init);
+	return crc32c_name;
+}
@@ -37,6 +37,8 @@
 
 #include "config.h"
 #include <pthread.h>
+#include <unistd.h>
+#include <sched.h>
 #ifdef LINUX
 #include <sys/signal.h>
 #elif FREEBSD
@@ -45,28 +47,44 @@
 #include "abstract_mem.h"
 #include "delayed_exec.h"
 #include "log.h"
-#include "avltree.h"
 #include "misc/queue.h"
 #include "gsh_intrinsic.h"
 #include "common_utils.h"
 
-/**
- * @brief A list of tasks
+/*
+ * Tasks are kept in hierarchical hashed timer wheels.  Time is counted
+ * in ticks of DELAYED_TICK_NS since the executor started.  Level 0 of
+ * a wheel has a slot per tick for the next DELAYED_SLOTS ticks, each
+ * higher level a slot per DELAYED_SLOTS slots of the level below.
+ * Insertion is a list insertion in the slot of the expiry, and when
+ * the clock of a wheel wraps a level, the next slot of the level above
+ * is brought down ("cascaded") to finer slots.
+ *
+ * Each wheel has its own lock and thread.  With several wheels a task
+ * goes on the wheel of the CPU submitting it, so submitters on
+ * different CPUs do not contend.  A thread takes every task due in one
+ * go and runs them with the wheel unlocked.
  */
 
-LIST_HEAD(delayed_tasklist, delayed_task);
+/** Length of a tick */
+#define DELAYED_TICK_NS NS_PER_MSEC
+
+#define DELAYED_BITS 8
+#define DELAYED_SLOTS (1 << DELAYED_BITS)
+#define DELAYED_MASK (DELAYED_SLOTS - 1)
+#define DELAYED_LEVELS 4
+
+/** Ticks covered by the wheel, tasks due later wait in the top level */
+#define DELAYED_SPAN (UINT64_C(1) << (DELAYED_BITS * DELAYED_LEVELS))
+
+/** Most wheels to run */
+#define DELAYED_MAX_WHEELS 64
 
 /**
- * @brief All tasks executing at a given time.
+ * @brief A list of tasks
  */
 
-struct delayed_multi {
-	struct timespec realtime;	/*< A wallclock time at which to
-					   perform the given task. */
-	struct delayed_tasklist list;	/*< The linked list of tasks to
-					   perform. */
-	struct avltree_node node;	/*< Our node in the tree */
-};
+LIST_HEAD(delayed_tasklist, delayed_task);
 
 /**
  * @brief An individual delayed task
@@ -77,10 +95,27 @@ struct delayed_task {
 	void (*func)(void *);
 	/** Argument for delayed task */
 	void *arg;
-	/** Link in the task list. */
+	/** Tick at which to run */
+	uint64_t expires;
+	/** Link in the slot or the batch being run. */
 	LIST_ENTRY(delayed_task) link;
 };
 
+/**
+ * @brief A timer wheel
+ */
+
+struct delayed_wheel {
+	pthread_mutex_t mtx;	/*< Mutex for the wheel */
+	pthread_cond_t cv;	/*< Its thread waits on this */
+	uint64_t clk;		/*< Next tick to expire */
+	uint64_t wake;		/*< Tick the thread sleeps until, UINT64_MAX
+				   if it waits for work */
+	size_t count;		/*< Tasks in the wheel */
+	bool stopping;		/*< The executor is shutting down */
+	struct delayed_tasklist slots[DELAYED_LEVELS][DELAYED_SLOTS];
+};
+
 /**
  * @brief A list of threads
  */
@@ -93,6 +128,7 @@ LIST_HEAD(delayed_threadlist, delayed_thread);
 
 struct delayed_thread {
 	pthread_t id;		/*< Thread id */
+	struct delayed_wheel *wheel;	/*< The wheel it runs */
 	 LIST_ENTRY(delayed_thread) link;	/*< Link in the thread list. */
 };
 
@@ -103,92 +139,157 @@ struct delayed_thread {
 
 /** list of all threads */
 static struct delayed_threadlist thread_list;
-/** Mutex for delayed execution */
+/** Mutex for the thread list and state */
 static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
-/** Condition variable for delayed execution */
+/** Condition variable signalled when the last thread exits */
 static pthread_cond_t cv = PTHREAD_COND_INITIALIZER;
-/** The timer tree */
-static struct avltree tree;
+/** The wheels */
+static struct delayed_wheel *wheels;
+/** Number of wheels */
+static uint32_t nwheels;
+/** Time of tick 0 */
+static struct timespec delayed_epoch;
+
+/** @} */
 
 /**
- * @brief Posssible states for the delayed executor
+ * @brief Time elapsed since the start
+ *
+ * A clock stepped back before the start counts as no time.
  */
-enum delayed_state {
-	delayed_running,	/*< Executor is running */
-	delayed_stopping	/*< Executor is stopping */
-};
 
-/** State for the executor */
-static enum delayed_state delayed_state;
+static nsecs_elapsed_t delayed_elapsed(const struct timespec *ts)
+{
+	if (gsh_time_cmp(ts, &delayed_epoch) <= 0)
+		return 0;
 
-enum delayed_employment {
-	delayed_employed,	/*< Work is available, do it. */
-	delayed_on_break,	/*< Work is available, but wait for it */
-	delayed_unemployed	/*< No work is available, wait indefinitely */
-};
+	return timespec_diff(&delayed_epoch, ts);
+}
 
-/** @} */
+/**
+ * @brief Put a task in the slot for its expiry
+ *
+ * This function must be called with the wheel mutex held.
+ */
 
-static int comparator(const struct avltree_node *a,
-		      const struct avltree_node *b)
+static void delayed_place(struct delayed_wheel *wh, struct delayed_task *task)
 {
-	struct delayed_multi *p =
-	    avltree_container_of(a, struct delayed_multi, node);
-	struct delayed_multi *q =
-	    avltree_container_of(b, struct delayed_multi, node);
-
-	return gsh_time_cmp(&p->realtime, &q->realtime);
+	uint64_t expires = task->expires;
+	int level = 0;
+
+	if (expires < wh->clk)
+		expires = task->expires = wh->clk;
+
+	/* Beyond the span, park it in the furthest slot and look again
+	   when that is cascaded. */
+	if (expires - wh->clk >= DELAYED_SPAN)
+		expires = wh->clk + DELAYED_SPAN - 1;
+
+	while (level < DELAYED_LEVELS - 1 &&
+	       expires - wh->clk >=
+	       (UINT64_C(1) << (DELAYED_BITS * (level + 1))))
+		level++;
+
+	LIST_INSERT_HEAD(
+		&wh->slots[level][(expires >> (DELAYED_BITS * level)) &
+				  DELAYED_MASK],
+		task, link);
 }
 
 /**
- * @brief Get a task to perform
+ * @brief Bring a slot of a level down to the levels below
  *
- * This function must be called with the mutex held.
+ * This function must be called with the wheel mutex held.
+ */
+
+static void delayed_cascade(struct delayed_wheel *wh, int level)
+{
+	struct delayed_tasklist *slot =
+		&wh->slots[level][(wh->clk >> (DELAYED_BITS * level)) &
+				  DELAYED_MASK];
+	struct delayed_tasklist moving;
+	struct delayed_task *task;
+
+	LIST_INIT(&moving);
+	while ((task = LIST_FIRST(slot)) != NULL) {
+		LIST_REMOVE(task, link);
+		LIST_INSERT_HEAD(&moving, task, link);
+	}
+
+	while ((task = LIST_FIRST(&moving)) != NULL) {
+		LIST_REMOVE(task, link);
+		delayed_place(wh, task);
+	}
+}
+
+/**
+ * @brief Expire the ticks up to a time
  *
- * @param[out] when The time for which to wait, if there is one
- * @param[out] func The function to execute, if there is one
- * @param[out] arg  The argument to supply, if there is one
+ * This function must be called with the wheel mutex held.
  *
- * @retval delayed_employed if there is a task to perform now.  Its
- *         argument and function are stored in @c arg and @c func.
- * @retval delayed_on_break if there is work but it is not to be
- *         performed yet.  The time at which it is to be performed is
- *         set in *when.
- * @retval delayed_unemployed if there is no work at all.  The caller
- *         should wait indefinitely to be signalled.
+ * @param[in,out] wh    The wheel
+ * @param[in]     until Last tick to expire
+ * @param[out]    batch Tasks due
  */
 
-static enum delayed_employment delayed_get_work(struct timespec *when,
-						void (**func) (void *),
-						void **arg)
+static void delayed_advance(struct delayed_wheel *wh, uint64_t until,
+			    struct delayed_tasklist *batch)
 {
-	struct avltree_node *first = avltree_first(&tree);
-	struct delayed_multi *mul;
-	struct timespec current;
+	struct delayed_tasklist *slot;
 	struct delayed_task *task;
+	int level;
 
-	if (first == NULL)
-		return delayed_unemployed;
+	while (wh->clk <= until) {
+		if (wh->count == 0) {
+			/* Nothing to move, jump ahead */
+			wh->clk = until + 1;
+			break;
+		}
 
-	now(&current);
-	mul = avltree_container_of(first, struct delayed_multi, node);
+		for (level = 1; level < DELAYED_LEVELS; level++) {
+			if ((wh->clk &
+			     ((UINT64_C(1) << (DELAYED_BITS * level)) - 1)) != 0)
+				break;
+			delayed_cascade(wh, level);
+		}
 
-	if (gsh_time_cmp(&mul->realtime, &current) > 0) {
-		*when = mul->realtime;
-		return delayed_on_break;
+		slot = &wh->slots[0][wh->clk & DELAYED_MASK];
+		while ((task = LIST_FIRST(slot)) != NULL) {
+			LIST_REMOVE(task, link);
+			LIST_INSERT_HEAD(batch, task, link);
+			wh->count--;
+		}
+
+		wh->clk++;
 	}
+}
+
+/**
+ * @brief Find the next tick the thread of a wheel must handle
+ *
+ * That is a full slot of level 0 or, failing that, the next wrap of
+ * level 0, where later tasks may come down.
+ *
+ * This function must be called with the wheel mutex held.
+ *
+ * @return The tick, UINT64_MAX if the wheel is empty.
+ */
+
+static uint64_t delayed_next(struct delayed_wheel *wh)
+{
+	uint64_t tick;
 
-	task = LIST_FIRST(&mul->list);
-	*func = task->func;
-	*arg = task->arg;
-	LIST_REMOVE(task, link);
-	gsh_free(task);
-	if (LIST_EMPTY(&mul->list)) {
-		avltree_remove(first, &tree);
-		gsh_free(mul);
+	if (wh->count == 0)
+		return UINT64_MAX;
+
+	for (tick = wh->clk; tick < wh->clk + DELAYED_SLOTS; tick++) {
+		if (!LIST_EMPTY(&wh->slots[0][tick & DELAYED_MASK]))
+			return tick;
+		if ((tick & DELAYED_MASK) == 0)
+			return tick;
 	}
 
-	return delayed_employed;
+	return tick;
 }
 
 /**
@@ -202,6 +303,7 @@ static enum delayed_employment delayed_get_work(struct timespec *when,
 void *delayed_thread(void *arg)
 {
 	struct delayed_thread *thr = arg;
+	struct delayed_wheel *wh = thr->wheel;
 	int old_type = 0;
 	int old_state = 0;
 	sigset_t old_sigmask;
@@ -218,28 +320,41 @@ void *delayed_thread(void *arg)
 
 	pthread_sigmask(SIG_SETMASK, NULL, &old_sigmask);
 
-	PTHREAD_MUTEX_lock(&mtx);
-	while (delayed_state == delayed_running) {
-		struct timespec then;
-		void (*func)(void *);
-		void *arg;
-
-		switch (delayed_get_work(&then, &func, &arg)) {
-		case delayed_unemployed:
-			pthread_cond_wait(&cv, &mtx);
-			break;
-
-		case delayed_on_break:
-			pthread_cond_timedwait(&cv, &mtx, &then);
-			break;
+	PTHREAD_MUTEX_lock(&wh->mtx);
+	while (!wh->stopping) {
+		struct delayed_tasklist batch;
+		struct delayed_task *task;
+		struct timespec current, then;
+
+		now(&current);
+		LIST_INIT(&batch);
+		delayed_advance(wh, delayed_elapsed(&current) / DELAYED_TICK_NS,
+				&batch);
+
+		if (!LIST_EMPTY(&batch)) {
+			PTHREAD_MUTEX_unlock(&wh->mtx);
+			while ((task = LIST_FIRST(&batch)) != NULL) {
+				LIST_REMOVE(task, link);
+				task->func(task->arg);
+				gsh_free(task);
+			}
+			PTHREAD_MUTEX_lock(&wh->mtx);
+			continue;
+		}
 
-		case delayed_employed:
-			PTHREAD_MUTEX_unlock(&mtx);
-			func(arg);
-			PTHREAD_MUTEX_lock(&mtx);
-			break;
+		wh->wake = delayed_next(wh);
+		if (wh->wake == UINT64_MAX) {
+			pthread_cond_wait(&wh->cv, &wh->mtx);
+		} else {
+			then = delayed_epoch;
+			timespec_add_nsecs(wh->wake * DELAYED_TICK_NS, &then);
+			pthread_cond_timedwait(&wh->cv, &wh->mtx, &then);
 		}
+		wh->wake = 0;
 	}
+	PTHREAD_MUTEX_unlock(&wh->mtx);
+
+	PTHREAD_MUTEX_lock(&mtx);
 	LIST_REMOVE(thr, link);
 	if (LIST_EMPTY(&thread_list))
 		pthread_cond_broadcast(&cv);
@@ -252,24 +367,39 @@ void *delayed_thread(void *arg)
 
 /**
  * @brief Initialize and start the delayed execution system
+ *
+ * @param[in] count Number of wheels, each with its own thread, 0 for
+ *                  one per CPU
  */
 
-void delayed_start(void)
+void delayed_start(uint32_t count)
 {
-	/* Make this a parameter later */
-	const size_t threads_to_start = 1;
 	/* Thread attributes */
 	pthread_attr_t attr;
-	/* Thread index */
-	int i;
+	/* Wheel index */
+	uint32_t i;
+	int level, slot;
 
-	LIST_INIT(&thread_list);
-	avltree_init(&tree, comparator, 0);
+	if (count == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		count = cpus > 0 ? cpus : 1;
+	}
+	if (count > DELAYED_MAX_WHEELS)
+		count = DELAYED_MAX_WHEELS;
 
-	if (threads_to_start == 0) {
-		LogFatal(COMPONENT_THREAD,
-			 "You can't execute tasks with zero threads.");
+	LIST_INIT(&thread_list);
+	now(&delayed_epoch);
+
+	wheels = gsh_calloc(count, sizeof(struct delayed_wheel));
+	for (i = 0; i < count; i++) {
+		PTHREAD_MUTEX_init(&wheels[i].mtx, NULL);
+		PTHREAD_COND_init(&wheels[i].cv, NULL);
+		for (level = 0; level < DELAYED_LEVELS; level++)
+			for (slot = 0; slot < DELAYED_SLOTS; slot++)
+				LIST_INIT(&wheels[i].slots[level][slot]);
 	}
+	nwheels = count;
 
 	if (pthread_attr_init(&attr) != 0)
 		LogFatal(COMPONENT_THREAD, "can't init pthread's attributes");
@@ -278,13 +408,13 @@ void delayed_start(void)
 		LogFatal(COMPONENT_THREAD, "can't set pthread's join state");
 
 	PTHREAD_MUTEX_lock(&mtx);
-	delayed_state = delayed_running;
 
-	for (i = 0; i < threads_to_start; ++i) {
+	for (i = 0; i < count; ++i) {
 		struct delayed_thread *thread =
 		    gsh_malloc(sizeof(struct delayed_thread));
 		int rc = 0;
 
+		thread->wheel = &wheels[i];
 		rc = pthread_create(&thread->id, &attr, delayed_thread, thread);
 		if (rc != 0) {
 			LogFatal(COMPONENT_THREAD,
@@ -293,6 +423,11 @@ void delayed_start(void)
 		LIST_INSERT_HEAD(&thread_list, thread, link);
 	}
 	PTHREAD_MUTEX_unlock(&mtx);
+
+	pthread_attr_destroy(&attr);
+
+	LogInfo(COMPONENT_THREAD, "Delayed executor running %" PRIu32
+		" timer wheel(s)", count);
 }
 
 /**
@@ -303,13 +438,20 @@ void delayed_shutdown(void)
 {
 	int rc = -1;
 	struct timespec then;
+	uint32_t i;
 
 	now(&then);
 	then.tv_sec += 120;
 
 	PTHREAD_MUTEX_lock(&mtx);
-	delayed_state = delayed_stopping;
-	pthread_cond_broadcast(&cv);
+
+	for (i = 0; i < nwheels; i++) {
+		PTHREAD_MUTEX_lock(&wheels[i].mtx);
+		wheels[i].stopping = true;
+		pthread_cond_broadcast(&wheels[i].cv);
+		PTHREAD_MUTEX_unlock(&wheels[i].mtx);
+	}
+
 	while ((rc != ETIMEDOUT) && !LIST_EMPTY(&thread_list))
 		rc = pthread_cond_timedwait(&cv, &mtx, &then);
 
@@ -327,6 +469,23 @@ void delayed_shutdown(void)
 	PTHREAD_MUTEX_unlock(&mtx);
 }
 
+/**
+ * @brief Pick the wheel for a new task
+ */
+
+static struct delayed_wheel *delayed_pick(void)
+{
+#ifdef LINUX
+	if (nwheels > 1) {
+		int cpu = sched_getcpu();
+
+		if (cpu >= 0)
+			return &wheels[cpu % nwheels];
+	}
+#endif
+	return &wheels[0];
+}
+
 /**
  * @brief Submit a new task
  *
@@ -340,36 +499,36 @@ void delayed_shutdown(void)
 
 int delayed_submit(void (*func) (void *), void *arg, nsecs_elapsed_t delay)
 {
-	struct delayed_multi *mul = NULL;
-	struct delayed_task *task = NULL;
-	struct avltree_node *collision = NULL;
-	struct avltree_node *first = NULL;
+	struct delayed_wheel *wh = delayed_pick();
+	struct delayed_task *task;
+	struct timespec when;
+	uint64_t tick;
 
-	mul = gsh_malloc(sizeof(struct delayed_multi));
 	task = gsh_malloc(sizeof(struct delayed_task));
-
-	now(&mul->realtime);
-	timespec_add_nsecs(delay, &mul->realtime);
-
-	PTHREAD_MUTEX_lock(&mtx);
-	first = avltree_first(&tree);
-	collision = avltree_insert(&mul->node, &tree);
-	if (unlikely(collision)) {
-		gsh_free(mul);
-		/* There is already a node for this exact time in the
-		   tree.  Add our task to its list. */
-		mul =
-		    avltree_container_of(collision, struct delayed_multi, node);
-	} else {
-		LIST_INIT(&mul->list);
-	}
 	task->func = func;
 	task->arg = arg;
-	LIST_INSERT_HEAD(&mul->list, task, link);
-	if (!first || comparator(&mul->node, first) < 0)
-		pthread_cond_broadcast(&cv);
 
-	PTHREAD_MUTEX_unlock(&mtx);
+	now(&when);
+	tick = delayed_elapsed(&when) / DELAYED_TICK_NS;
+	timespec_add_nsecs(delay, &when);
+	task->expires = (delayed_elapsed(&when) + DELAYED_TICK_NS - 1) /
+			DELAYED_TICK_NS;
+
+	PTHREAD_MUTEX_lock(&wh->mtx);
+
+	/* An idle wheel may lag, bring it up to date so the thread does
+	   not have to step through the ticks it slept over. */
+	if (wh->count == 0 && wh->clk < tick)
+		wh->clk = tick;
+
+	delayed_place(wh, task);
+	wh->count++;
+
+	/* Wake the thread if it sleeps past this task */
+	if (task->expires < wh->wake)
+		pthread_cond_signal(&wh->cv);
+
+	PTHREAD_MUTEX_unlock(&wh->mtx);
 
 	return 0;
 }
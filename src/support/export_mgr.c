@@ -50,7 +50,6 @@
 #include "fsal.h"
 #include "nfs_core.h"
 #include "log.h"
-#include "avltree.h"
 #include "gsh_types.h"
 #ifdef USE_DBUS
 #include "gsh_dbus.h"
@@ -59,27 +58,342 @@
 #include "client_mgr.h"
 #include "server_stats_private.h"
 #include "server_stats.h"
+#include "server_topk.h"
 #include "abstract_atomic.h"
 #include "gsh_intrinsic.h"
+#include "gsh_rcu.h"
 #include "nfs_exports.h"
 #include "nfs_proto_functions.h"
 #include "pnfs_utils.h"
 
 /**
- * @brief Exports are stored in an AVL tree with front-end cache.
+ * @brief Exports are published in a flat array indexed by export id.
  *
- * @note  number of cache slots should be prime.
+ * Lookups take no lock: a reader loads the slot and takes a reference
+ * inside a read side section, and a writer that clears a slot waits
+ * for the sections that may have seen the old value before it drops
+ * the sentinel reference (see gsh_rcu.h).  Writers, and the lists
+ * below, are serialized by the lock.
  */
-#define EXPORT_BY_ID_CACHE_SIZE 769
-
 struct export_by_id {
 	pthread_rwlock_t lock;
-	struct avltree t;
-	struct avltree_node *cache[EXPORT_BY_ID_CACHE_SIZE];
+	struct gsh_export *slot[UINT16_MAX + 1];
+	struct gsh_rcu rcu;
 };
 
 static struct export_by_id export_by_id;
 
+/**
+ * @brief Exports indexed by pseudo path, one node per path component
+ *
+ * Readers walk the trie inside an export_by_id.rcu read side section
+ * without any lock.  Writers hold export_by_id.lock.  A node's children
+ * are sorted by name and never change in place: adding or removing a
+ * child publishes a new copy of the node in its parent's slot and
+ * retires the old one, to be freed once the readers that may have seen
+ * it are gone.  Only the export pointer is updated in place.
+ */
+struct pseudo_node {
+	struct pseudo_node *retired;	/*< Next on pseudo_retired */
+	struct gsh_export *export;	/*< Export at this path, if any */
+	const char *name;		/*< Component, not NUL terminated */
+	uint32_t len;
+	uint32_t count;			/*< Children */
+	struct pseudo_node *child[];
+};
+
+/** Root of the trie, for the pseudo path "/" */
+static struct pseudo_node *pseudo_root;
+
+/** Nodes replaced since the last grace period,
+  * protected by export_by_id.lock
+  */
+static struct pseudo_node *pseudo_retired;
+
+/**
+ * @brief Make a node
+ *
+ * @param[in] name  Component, copied
+ * @param[in] len   Length of the component
+ * @param[in] count Number of children to make room for
+ */
+
+static struct pseudo_node *pseudo_node_alloc(const char *name, uint32_t len,
+					     uint32_t count)
+{
+	struct pseudo_node *node;
+	char *copy;
+
+	node = gsh_calloc(1, sizeof(*node) + count * sizeof(node->child[0]) +
+			     len);
+	copy = (char *)&node->child[count];
+	memcpy(copy, name, len);
+	node->name = copy;
+	node->len = len;
+	node->count = count;
+
+	return node;
+}
+
+/**
+ * @brief Find the child that is, or would be, for a component
+ *
+ * @param[in]  node  Parent
+ * @param[in]  name  Component
+ * @param[in]  len   Length of the component
+ * @param[out] found Whether the child exists
+ *
+ * @return Index of the child, or where to insert it.
+ */
+
+static uint32_t pseudo_node_search(const struct pseudo_node *node,
+				   const char *name, uint32_t len,
+				   bool *found)
+{
+	uint32_t lo = 0, hi = node->count, mid;
+	const struct pseudo_node *child;
+	int rc;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		child = atomic_fetch_voidptr((void **)&node->child[mid]);
+		rc = memcmp(name, child->name, MIN(len, child->len));
+		if (rc == 0)
+			rc = (len > child->len) - (len < child->len);
+		if (rc == 0) {
+			*found = true;
+			return mid;
+		}
+		if (rc < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	*found = false;
+	return lo;
+}
+
+/**
+ * @brief Publish a copy of a node with a child added or removed
+ *
+ * @note Called with export_by_id.lock held for write.
+ *
+ * @param[in] slot  Where the node is published
+ * @param[in] index Child to remove, or where to add
+ * @param[in] add   New child, NULL to remove
+ */
+
+static void pseudo_node_replace(struct pseudo_node **slot, uint32_t index,
+				struct pseudo_node *add)
+{
+	struct pseudo_node *old = *slot, *node;
+	uint32_t count = add != NULL ? old->count + 1 : old->count - 1;
+	uint32_t skip = add != NULL ? 0 : 1;
+
+	node = pseudo_node_alloc(old->name, old->len, count);
+	node->export = old->export;
+	memcpy(node->child, old->child, index * sizeof(node->child[0]));
+	memcpy(&node->child[index + !skip], &old->child[index + skip],
+	       (old->count - index - skip) * sizeof(node->child[0]));
+	if (add != NULL)
+		node->child[index] = add;
+
+	atomic_store_voidptr((void **)slot, node);
+
+	old->retired = pseudo_retired;
+	pseudo_retired = old;
+}
+
+/**
+ * @brief Add an export to the pseudo path index
+ *
+ * @note Called with export_by_id.lock held for write.
+ */
+
+static void pseudo_index_add(struct gsh_export *export)
+{
+	struct pseudo_node **slot = &pseudo_root;
+	const char *p, *q, *end;
+	uint32_t index;
+	bool found;
+
+	if (export->pseudopath == NULL || export->pseudopath[0] != '/')
+		return;
+
+	p = export->pseudopath + 1;
+	end = p + strlen(p);
+
+	while (p < end) {
+		q = memchr(p, '/', end - p);
+		if (q == NULL)
+			q = end;
+
+		index = pseudo_node_search(*slot, p, q - p, &found);
+		if (!found)
+			pseudo_node_replace(slot, index,
+					    pseudo_node_alloc(p, q - p, 0));
+		slot = &(*slot)->child[index];
+
+		p = q + 1;
+	}
+
+	/* Pseudo paths are unique, but keep the first one if not */
+	if ((*slot)->export == NULL)
+		atomic_store_voidptr((void **)&(*slot)->export, export);
+}
+
+/**
+ * @brief Remove an export from below a node of the pseudo path index
+ *
+ * Nodes left with neither an export nor children are pruned.
+ *
+ * @note Called with export_by_id.lock held for write.
+ *
+ * @param[in] slot   Where the node is published
+ * @param[in] p      Rest of the pseudo path
+ * @param[in] end    End of the pseudo path
+ * @param[in] export The export
+ */
+
+static void pseudo_index_del(struct pseudo_node **slot, const char *p,
+			     const char *end, struct gsh_export *export)
+{
+	struct pseudo_node *child;
+	const char *q;
+	uint32_t index;
+	bool found;
+
+	if (p >= end) {
+		if ((*slot)->export == export)
+			atomic_store_voidptr((void **)&(*slot)->export, NULL);
+		return;
+	}
+
+	q = memchr(p, '/', end - p);
+	if (q == NULL)
+		q = end;
+
+	index = pseudo_node_search(*slot, p, q - p, &found);
+	if (!found)
+		return;
+
+	pseudo_index_del(&(*slot)->child[index], q + 1, end, export);
+
+	child = (*slot)->child[index];
+	if (child->export == NULL && child->count == 0) {
+		pseudo_node_replace(slot, index, NULL);
+		child->retired = pseudo_retired;
+		pseudo_retired = child;
+	}
+}
+
+/**
+ * @brief Take the nodes retired so far
+ *
+ * @note Called with export_by_id.lock held for write.  Free the result
+ * with pseudo_free_retired() after a grace period.
+ */
+
+static struct pseudo_node *pseudo_take_retired(void)
+{
+	struct pseudo_node *retired = pseudo_retired;
+
+	pseudo_retired = NULL;
+	return retired;
+}
+
+static void pseudo_free_retired(struct pseudo_node *retired)
+{
+	struct pseudo_node *next;
+
+	for (; retired != NULL; retired = next) {
+		next = retired->retired;
+		gsh_free(retired);
+	}
+}
+
+/**
+ * @brief Look up an export in the pseudo path index
+ *
+ * @param path        [IN] the pseudo path
+ * @param exact_match [IN] the path must match exactly
+ *
+ * @return pointer to ref counted export
+ */
+
+static struct gsh_export *pseudo_index_lookup(const char *path,
+					      bool exact_match)
+{
+	int64_t *reader = gsh_rcu_read_lock(&export_by_id.rcu);
+	struct pseudo_node *node = atomic_fetch_voidptr((void **)&pseudo_root);
+	struct gsh_export *export = NULL, *best = NULL;
+	size_t len = strlen(path);
+	const char *p, *q, *end;
+	uint32_t index;
+	bool found;
+
+	/* Ignore trailing slash in path */
+	if (len > 1 && path[len - 1] == '/')
+		len--;
+
+	/* Special case for Pseudo root match */
+	if (len == 0) {
+		export = atomic_fetch_voidptr((void **)&node->export);
+		goto out;
+	}
+
+	if (path[0] != '/')
+		goto out;
+
+	best = atomic_fetch_voidptr((void **)&node->export);
+	p = path + 1;
+	end = path + len;
+
+	/* Only one trailing slash was dropped, a second one makes an
+	 * empty last component that must not match.
+	 */
+	while (len > 1) {
+		q = memchr(p, '/', end - p);
+		if (q == NULL)
+			q = end;
+
+		index = pseudo_node_search(node, p, q - p, &found);
+		if (!found) {
+			node = NULL;
+			break;
+		}
+
+		node = atomic_fetch_voidptr((void **)&node->child[index]);
+		export = atomic_fetch_voidptr((void **)&node->export);
+		if (export != NULL)
+			best = export;
+
+		if (q == end)
+			break;
+		p = q + 1;
+	}
+
+	if (!exact_match)
+		export = best;
+	else if (node != NULL)
+		export = atomic_fetch_voidptr((void **)&node->export);
+	else
+		export = NULL;
+
+out:
+	if (export != NULL)
+		get_gsh_export_ref(export);
+
+	gsh_rcu_read_unlock(reader);
+
+	LogFullDebug(COMPONENT_EXPORT,
+		     "Pseudo path %s matches export %d",
+		     path, export != NULL ? export->export_id : -1);
+
+	return export;
+}
+
 /** List of all active exports,
   * protected by export_by_id.lock
   */
@@ -148,21 +462,6 @@ struct gsh_export *export_take_unexport_work(void)
 	return export;
 }
 
-/**
- * @brief Compute cache slot for an entry
- *
- * This function computes a hash slot, taking an address modulo the
- * number of cache slotes (which should be prime).
- *
- * @param k [in] Entry index value
- *
- * @return The computed offset.
- */
-static inline uint16_t eid_cache_offsetof(uint16_t k)
-{
-	return k % EXPORT_BY_ID_CACHE_SIZE;
-}
-
 /**
  * @brief Revert export_commit()
  *
@@ -170,21 +469,26 @@ static inline uint16_t eid_cache_offsetof(uint16_t k)
  */
 void export_revert(struct gsh_export *export)
 {
-	struct avltree_node *cnode;
-	void **cache_slot = (void **)
-	     &(export_by_id.cache[eid_cache_offsetof(export->export_id)]);
+	void **slot = (void **)&export_by_id.slot[export->export_id];
+	struct pseudo_node *retired;
 
 	PTHREAD_RWLOCK_wrlock(&export_by_id.lock);
 
-	cnode = (struct avltree_node *)atomic_fetch_voidptr(cache_slot);
-	if (&export->node_k == cnode)
-		atomic_store_voidptr(cache_slot, NULL);
-	avltree_remove(&export->node_k, &export_by_id.t);
+	if (atomic_fetch_voidptr(slot) == export)
+		atomic_store_voidptr(slot, NULL);
 	glist_del(&export->exp_list);
 	glist_del(&export->exp_work);
+	if (export->pseudopath != NULL && export->pseudopath[0] == '/')
+		pseudo_index_del(&pseudo_root, export->pseudopath + 1,
+				 export->pseudopath + strlen(export->pseudopath),
+				 export);
+	retired = pseudo_take_retired();
 
 	PTHREAD_RWLOCK_unlock(&export_by_id.lock);
 
+	gsh_rcu_synchronize(&export_by_id.rcu);
+	pseudo_free_retired(retired);
+
 	if (export->has_pnfs_ds) {
 		/* once-only, so no need for lock here */
 		export->has_pnfs_ds = false;
@@ -193,23 +497,6 @@ void export_revert(struct gsh_export *export)
 	put_gsh_export(export); /* Release sentinel ref */
 }
 
-/**
- * @brief Export id comparator for AVL tree walk
- *
- */
-static int export_id_cmpf(const struct avltree_node *lhs,
-			  const struct avltree_node *rhs)
-{
-	struct gsh_export *lk, *rk;
-
-	lk = avltree_container_of(lhs, struct gsh_export, node_k);
-	rk = avltree_container_of(rhs, struct gsh_export, node_k);
-	if (lk->export_id != rk->export_id)
-		return (lk->export_id < rk->export_id) ? -1 : 1;
-	else
-		return 0;
-}
-
 /**
  * @brief Allocate a gsh_export entry.
  *
@@ -237,6 +524,10 @@ struct gsh_export *alloc_export(void)
 	glist_init(&export->clients);
 
 	PTHREAD_RWLOCK_init(&export->lock, NULL);
+	pthread_spin_init(&export->qos.sp, PTHREAD_PROCESS_PRIVATE);
+	pthread_spin_init(&export->inflight.sp, PTHREAD_PROCESS_PRIVATE);
+	pthread_spin_init(&export->health.sp, PTHREAD_PROCESS_PRIVATE);
+	glist_init(&export->inflight.parked);
 
 	return export;
 }
@@ -256,10 +547,15 @@ void free_export(struct gsh_export *export)
 
 	/* free resources */
 	free_export_resources(export);
+	/* the address may come back as another export */
+	export_perms_changed();
 	export_st = container_of(export, struct export_stats, export);
 	server_stats_free(&export_st->st);
-	gsh_free(export_st);
 	PTHREAD_RWLOCK_destroy(&export->lock);
+	pthread_spin_destroy(&export->qos.sp);
+	pthread_spin_destroy(&export->inflight.sp);
+	pthread_spin_destroy(&export->health.sp);
+	gsh_free(export_st);
 }
 
 
@@ -277,27 +573,33 @@ void free_export(struct gsh_export *export)
 
 bool insert_gsh_export(struct gsh_export *export)
 {
-	struct avltree_node *node;
-	void **cache_slot = (void **)
-	    &(export_by_id.cache[eid_cache_offsetof(export->export_id)]);
+	void **slot = (void **)&export_by_id.slot[export->export_id];
 
 	PTHREAD_RWLOCK_wrlock(&export_by_id.lock);
-	node = avltree_insert(&export->node_k, &export_by_id.t);
-	if (node) {
+	if (atomic_fetch_voidptr(slot) != NULL) {
 		/* somebody beat us to it */
 		PTHREAD_RWLOCK_unlock(&export_by_id.lock);
 		return false;
 	}
 
+	struct pseudo_node *retired;
+
 	/* we will hold a ref starting out... */
 	get_gsh_export_ref(export);
-
-	/* update cache */
-	atomic_store_voidptr(cache_slot, &export->node_k);
 	glist_add_tail(&exportlist, &export->exp_list);
 	get_gsh_export_ref(export);		/* == 2 */
 
+	/* publish it, the references are taken first */
+	atomic_store_voidptr(slot, export);
+	pseudo_index_add(export);
+	retired = pseudo_take_retired();
+
 	PTHREAD_RWLOCK_unlock(&export_by_id.lock);
+
+	if (retired != NULL) {
+		gsh_rcu_synchronize(&export_by_id.rcu);
+		pseudo_free_retired(retired);
+	}
 	return true;
 }
 
@@ -314,42 +616,14 @@ bool insert_gsh_export(struct gsh_export *export)
  */
 struct gsh_export *get_gsh_export(uint16_t export_id)
 {
-	struct gsh_export v;
-	struct avltree_node *node;
 	struct gsh_export *exp;
-	void **cache_slot = (void **)
-	    &(export_by_id.cache[eid_cache_offsetof(export_id)]);
-
-	v.export_id = export_id;
-	PTHREAD_RWLOCK_rdlock(&export_by_id.lock);
-
-	/* check cache */
-	node = (struct avltree_node *)atomic_fetch_voidptr(cache_slot);
-	if (node) {
-		exp = avltree_container_of(node, struct gsh_export, node_k);
-		if (exp->export_id == export_id) {
-			/* got it in 1 */
-			LogDebug(COMPONENT_HASHTABLE_CACHE,
-				 "export_mgr cache hit slot %d",
-				 eid_cache_offsetof(export_id));
-			goto out;
-		}
-	}
+	int64_t *reader = gsh_rcu_read_lock(&export_by_id.rcu);
 
-	/* fall back to AVL */
-	node = avltree_lookup(&v.node_k, &export_by_id.t);
-	if (node) {
-		exp = avltree_container_of(node, struct gsh_export, node_k);
-		/* update cache */
-		atomic_store_voidptr(cache_slot, node);
-	} else {
-		PTHREAD_RWLOCK_unlock(&export_by_id.lock);
-		return NULL;
-	}
+	exp = atomic_fetch_voidptr((void **)&export_by_id.slot[export_id]);
+	if (exp != NULL)
+		get_gsh_export_ref(exp);
 
- out:
-	get_gsh_export_ref(exp);
-	PTHREAD_RWLOCK_unlock(&export_by_id.lock);
+	gsh_rcu_read_unlock(reader);
 	return exp;
 }
 
@@ -463,9 +737,11 @@ struct gsh_export *get_gsh_export_by_path(char *path, bool exact_match)
 /**
  * @brief Lookup the export manager struct by export pseudo path
  *
- * Gets an export entry from its pseudo (if it exists), assumes
- * being called with export manager lock held (such as from within
- * foreach_gsh_export.
+ * Gets an export entry from its pseudo (if it exists), the one with
+ * the longest pseudo path leading to path unless exact_match.  The
+ * pseudo path index needs no lock, so this may be called with or
+ * without the export manager lock held.
+ * If path has a trailing '/', ignore it.
  *
  * @param path        [IN] the path for the entry to be found.
  * @param exact_match [IN] the path must match exactly
@@ -476,78 +752,7 @@ struct gsh_export *get_gsh_export_by_path(char *path, bool exact_match)
 struct gsh_export *get_gsh_export_by_pseudo_locked(char *path,
 						   bool exact_match)
 {
-	struct gsh_export *export;
-	struct glist_head *glist;
-	int len_path = strlen(path);
-	int len_export;
-	struct gsh_export *ret_exp = NULL;
-	int len_ret = 0;
-
-	/* Ignore trailing slash in path */
-	if (len_path > 1 && path[len_path - 1] == '/')
-		len_path--;
-
-	LogFullDebug(COMPONENT_EXPORT,
-		     "Searching for export matching pseudo path %s",
-		     path);
-
-	glist_for_each(glist, &exportlist) {
-		export = glist_entry(glist, struct gsh_export, exp_list);
-
-		if (export->pseudopath == NULL)
-			continue;
-
-		len_export = strlen(export->pseudopath);
-
-		LogFullDebug(COMPONENT_EXPORT,
-			     "Comparing %s %d to %s %d",
-			     path, len_path,
-			     export->pseudopath, len_export);
-
-		if (len_path == 0 && len_export == 1) {
-			/* Special case for Pseudo root match */
-			ret_exp = export;
-			len_ret = len_export;
-			break;
-		}
-
-		/* A path shorter than the full path cannot match.
-		 * Also skip if this export has a shorter path than
-		 * the previous match.
-		 */
-		if (len_path < len_export ||
-		    len_export < len_ret)
-			continue;
-
-		/* If partial match is not allowed, lengths must be the same */
-		if (exact_match && len_path != len_export)
-			continue;
-
-		/* if the char in pseudopath just after the end of path is not
-		 * '/' it is a name token longer, i.e. /mnt/foo != /mnt/foob/
-		 */
-		if (len_export > 1 &&
-		    path[len_export] != '/' &&
-		    path[len_export] != '\0')
-			continue;
-
-		/* we agree on size, now compare the leading substring
-		 */
-		if (strncmp(export->pseudopath, path, len_export)
-		    == 0) {
-			ret_exp = export;
-			len_ret = len_export;
-
-			/* If we have found an exact match, exit loop. */
-			if (len_export == len_path)
-				break;
-		}
-	}
-
-	if (ret_exp != NULL)
-		get_gsh_export_ref(ret_exp);
-
-	return ret_exp;
+	return pseudo_index_lookup(path, exact_match);
 }
 
 /**
@@ -563,15 +768,7 @@ struct gsh_export *get_gsh_export_by_pseudo_locked(char *path,
 
 struct gsh_export *get_gsh_export_by_pseudo(char *path, bool exact_match)
 {
-	struct gsh_export *exp;
-
-	PTHREAD_RWLOCK_rdlock(&export_by_id.lock);
-
-	exp = get_gsh_export_by_pseudo_locked(path, exact_match);
-
-	PTHREAD_RWLOCK_unlock(&export_by_id.lock);
-
-	return exp;
+	return pseudo_index_lookup(path, exact_match);
 }
 
 /**
@@ -646,37 +843,242 @@ void put_gsh_export(struct gsh_export *export)
 	free_export(export);
 }
 
+/**
+ * @brief Charge a request against the export QoS token buckets
+ *
+ * Every request costs one IOPS token plus its read and write payload
+ * against the bandwidth buckets.  The charge is always taken, so a
+ * request that overdraws a bucket leaves it in debt and the caller is
+ * told how long to hold the request until that debt is repaid.
+ *
+ * @param[in] export      Export the request is addressed to
+ * @param[in] read_bytes  Bytes the request will read
+ * @param[in] write_bytes Bytes the request will write
+ *
+ * @return Nanoseconds to delay the request, 0 if within budget.
+ */
+
+nsecs_elapsed_t export_qos_charge(struct gsh_export *export,
+				  uint64_t read_bytes, uint64_t write_bytes)
+{
+	struct export_qos *qos = &export->qos;
+	uint64_t limit[EXPORT_QOS_COUNT];
+	uint64_t cost[EXPORT_QOS_COUNT] = {1, read_bytes, write_bytes};
+	nsecs_elapsed_t delay = 0, elapsed, cur;
+	struct timespec ts;
+	int i;
+
+	for (i = 0; i < EXPORT_QOS_COUNT; i++)
+		limit[i] = atomic_fetch_uint64_t(&export->qos_limit[i]);
+
+	if (limit[EXPORT_QOS_IOPS] == 0 && limit[EXPORT_QOS_READ] == 0 &&
+	    limit[EXPORT_QOS_WRITE] == 0)
+		return 0;
+
+	now(&ts);
+	cur = timespec_diff(&ServerBootTime, &ts);
+
+	pthread_spin_lock(&qos->sp);
+
+	elapsed = cur - qos->last_refill;
+	if (cur < qos->last_refill || elapsed > NS_PER_SEC)
+		elapsed = NS_PER_SEC;
+	qos->last_refill = cur;
+
+	for (i = 0; i < EXPORT_QOS_COUNT; i++) {
+		int64_t tokens;
+
+		if (limit[i] == 0)
+			continue;
+
+		/* Refill, holding at most one second of credit. Split the
+		 * multiply so large byte rates cannot overflow.
+		 */
+		tokens = qos->tokens[i] +
+			 (limit[i] / NS_PER_SEC) * elapsed +
+			 (limit[i] % NS_PER_SEC) * elapsed / NS_PER_SEC;
+		if (tokens > (int64_t) limit[i] || tokens < qos->tokens[i])
+			tokens = limit[i];
+
+		tokens -= cost[i];
+		qos->tokens[i] = tokens;
+
+		if (tokens < 0 && cost[i] != 0) {
+			nsecs_elapsed_t wait;
+
+			wait = (double) -tokens * NS_PER_SEC / limit[i];
+			if (wait > delay)
+				delay = wait;
+			qos->throttled[i]++;
+		}
+	}
+
+	qos->delayed_ns += delay;
+
+	pthread_spin_unlock(&qos->sp);
+
+	return delay;
+}
+
+static inline nsecs_elapsed_t health_retry_at(struct gsh_export *export,
+					      nsecs_elapsed_t cur)
+{
+	return cur + (nsecs_elapsed_t)
+		     atomic_fetch_uint32_t(&export->health_retry) * NS_PER_MSEC;
+}
+
+/**
+ * @brief Ask the health breaker to let a request reach the FSAL
+ *
+ * @param[in] export Export the request works on
+ *
+ * @retval true if the request may go on.
+ * @retval false if it should be answered with a delay error.
+ */
+
+bool export_health_admit(struct gsh_export *export)
+{
+	struct export_health *health = &export->health;
+	struct timespec ts;
+	nsecs_elapsed_t cur;
+	bool admit = true;
+
+	if (!atomic_fetch_uint32_t(&health->open))
+		return true;
+
+	now(&ts);
+	cur = timespec_diff(&ServerBootTime, &ts);
+
+	pthread_spin_lock(&health->sp);
+
+	if (health->open) {
+		if (cur < health->retry_at) {
+			admit = false;
+			health->shed++;
+		} else {
+			/* No report from the last probes, send more */
+			if (health->probes == 0)
+				health->probes = atomic_fetch_uint32_t(
+							&export->health_probes);
+			if (--health->probes == 0)
+				health->retry_at = health_retry_at(export, cur);
+		}
+	}
+
+	pthread_spin_unlock(&health->sp);
+
+	return admit;
+}
+
+/**
+ * @brief Report how a request fared to the health breaker
+ *
+ * A request fails if its backend returned an I/O or server fault error,
+ * if it was dropped, or if it spent more than Health_Latency in the
+ * FSAL.  Delay errors are not counted, conflicts with delegations and
+ * locks return them too.
+ *
+ * @param[in] export    Export the request worked on
+ * @param[in] fsal_time Time the request spent in the FSAL
+ * @param[in] failed    Whether the backend returned an error
+ */
+
+void export_health_done(struct gsh_export *export,
+			nsecs_elapsed_t fsal_time, bool failed)
+{
+	struct export_health *health = &export->health;
+	uint32_t threshold = atomic_fetch_uint32_t(&export->health_failures);
+	uint32_t latency = atomic_fetch_uint32_t(&export->health_latency);
+	struct timespec ts;
+	nsecs_elapsed_t cur;
+
+	if (threshold == 0) {
+		if (atomic_fetch_uint32_t(&health->open)) {
+			/* Turned off by a reload */
+			pthread_spin_lock(&health->sp);
+			atomic_store_uint32_t(&health->open, false);
+			health->strikes = 0;
+			pthread_spin_unlock(&health->sp);
+		}
+		return;
+	}
+
+	if (latency != 0 &&
+	    fsal_time > (nsecs_elapsed_t) latency * NS_PER_MSEC)
+		failed = true;
+
+	/* Healthy and staying so, the common case */
+	if (!failed && !atomic_fetch_uint32_t(&health->open) &&
+	    atomic_fetch_uint32_t(&health->strikes) == 0)
+		return;
+
+	now(&ts);
+	cur = timespec_diff(&ServerBootTime, &ts);
+
+	pthread_spin_lock(&health->sp);
+
+	if (!health->open) {
+		if (!failed) {
+			health->strikes = 0;
+		} else if (++health->strikes >= threshold) {
+			atomic_store_uint32_t(&health->open, true);
+			health->trips++;
+			health->probes = atomic_fetch_uint32_t(
+						&export->health_probes);
+			health->retry_at = health_retry_at(export, cur);
+			pthread_spin_unlock(&health->sp);
+			LogWarn(COMPONENT_EXPORT,
+				"Export %d backend unhealthy after %" PRIu32
+				" failed requests, shedding load",
+				export->export_id, threshold);
+			return;
+		}
+	} else if (failed) {
+		/* Still sick, wait another retry interval */
+		health->probes = atomic_fetch_uint32_t(&export->health_probes);
+		health->retry_at = health_retry_at(export, cur);
+	} else if (cur >= health->retry_at ||
+		   health->probes <
+			atomic_fetch_uint32_t(&export->health_probes)) {
+		/* A probe made it, not a straggler from before opening */
+		atomic_store_uint32_t(&health->open, false);
+		health->strikes = 0;
+		pthread_spin_unlock(&health->sp);
+		LogEvent(COMPONENT_EXPORT, "Export %d backend recovered",
+			 export->export_id);
+		return;
+	}
+
+	pthread_spin_unlock(&health->sp);
+}
+
 /**
  * @brief Remove the export management struct
  *
- * Remove it from the AVL tree.
+ * Unpublish it from the export id array.
  */
 
 void remove_gsh_export(uint16_t export_id)
 {
-	struct gsh_export v;
-	struct avltree_node *node;
-	struct gsh_export *export = NULL;
-	void **cache_slot = (void **)
-	    &(export_by_id.cache[eid_cache_offsetof(export_id)]);
+	struct gsh_export *export;
+	void **slot = (void **)&export_by_id.slot[export_id];
+	struct pseudo_node *retired = NULL;
 
-	v.export_id = export_id;
 	PTHREAD_RWLOCK_wrlock(&export_by_id.lock);
 
-	node = avltree_lookup(&v.node_k, &export_by_id.t);
-	if (node) {
-		struct avltree_node *cnode = (struct avltree_node *)
-			atomic_fetch_voidptr(cache_slot);
-
-		/* Remove from the AVL cache and tree */
-		if (node == cnode)
-			atomic_store_voidptr(cache_slot, NULL);
-		avltree_remove(node, &export_by_id.t);
-
-		export = avltree_container_of(node, struct gsh_export, node_k);
+	export = atomic_fetch_voidptr(slot);
+	if (export != NULL) {
+		atomic_store_voidptr(slot, NULL);
 
 		/* Remove the export from the export list */
 		glist_del(&export->exp_list);
+		if (export->pseudopath != NULL &&
+		    export->pseudopath[0] == '/')
+			pseudo_index_del(&pseudo_root, export->pseudopath + 1,
+					 export->pseudopath +
+					 strlen(export->pseudopath),
+					 export);
+		retired = pseudo_take_retired();
 
 		/* No new references will be granted. Idempotent. */
 		export->export_status = EXPORT_STALE;
@@ -686,6 +1088,10 @@ void remove_gsh_export(uint16_t export_id)
 
 	/* removal has a once-only semantic */
 	if (export != NULL) {
+		/* Lookups that found it have their reference by now */
+		gsh_rcu_synchronize(&export_by_id.rcu);
+		pseudo_free_retired(retired);
+
 		if (export->has_pnfs_ds) {
 			/* once-only, so no need for lock here */
 			export->has_pnfs_ds = false;
@@ -1124,6 +1530,64 @@ static struct gsh_dbus_method export_remove_export = {
 		 END_ARG_LIST}
 };
 
+/**
+ * @brief Drop everything cached for an export
+ *
+ * Required after changing the content of an Immutable export, whose
+ * cached attributes and directories otherwise never go stale.  The
+ * invalidation enters at the bottom of the FSAL stack, like an upcall
+ * from the backing filesystem would.
+ *
+ * @param "id"  [IN] the id of the export to refresh
+ *
+ * @return           As above, use DBusError to return errors.
+ */
+
+static bool gsh_export_refreshexport(DBusMessageIter *args,
+				     DBusMessage *reply,
+				     DBusError *error)
+{
+	struct gsh_export *export;
+	struct fsal_export *fsal_export;
+	fsal_status_t status;
+	char *errormsg;
+
+	export = lookup_export(args, &errormsg);
+	if (export == NULL) {
+		LogDebug(COMPONENT_EXPORT, "lookup_export failed with %s",
+			errormsg);
+		dbus_set_error(error, DBUS_ERROR_INVALID_ARGS,
+			       "lookup_export failed with %s",
+			       errormsg);
+		return false;
+	}
+
+	fsal_export = export->fsal_export;
+	while (fsal_export->sub_export != NULL)
+		fsal_export = fsal_export->sub_export;
+
+	status = fsal_export->up_ops->invalidate_export(fsal_export->up_ops);
+
+	if (FSAL_IS_ERROR(status)) {
+		dbus_set_error(error, DBUS_ERROR_FAILED,
+			       "Invalidation failed: %s",
+			       msg_fsal_err(status.major));
+	} else {
+		LogInfo(COMPONENT_EXPORT, "Refreshed export with id %d",
+			export->export_id);
+	}
+
+	put_gsh_export(export);
+	return !FSAL_IS_ERROR(status);
+}
+
+static struct gsh_dbus_method export_refresh_export = {
+	.name = "RefreshExport",
+	.method = gsh_export_refreshexport,
+	.args = {ID_ARG,
+		 END_ARG_LIST}
+};
+
 #define DISP_EXP_REPLY		\
 {				\
 	.name = "id",		\
@@ -1471,6 +1935,7 @@ static struct gsh_dbus_method *export_mgr_methods[] = {
 	&export_display_export,
 	&export_show_exports,
 	&export_update_export,
+	&export_refresh_export,
 	NULL
 };
 
@@ -1513,21 +1978,147 @@ static bool get_nfsv3_export_io(DBusMessageIter *args,
 		}
 	}
 	dbus_status_reply(&iter, success, errormsg);
-	if (success)
-		server_dbus_v3_iostats(export_st->st.nfsv3, &iter);
+	if (success)
+		server_dbus_v3_iostats(export_st->st.nfsv3, &iter);
+
+	if (export != NULL)
+		put_gsh_export(export);
+	return true;
+}
+
+static struct gsh_dbus_method export_show_v3_io = {
+	.name = "GetNFSv3IO",
+	.method = get_nfsv3_export_io,
+	.args = {EXPORT_ID_ARG,
+		 STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 IOSTATS_REPLY,
+		 END_ARG_LIST}
+};
+
+/**
+ * DBUS method to report export QoS token bucket state
+ *
+ * For each of IOPS, read and write bandwidth reports the configured
+ * limit, the current token level and the number of throttled requests.
+ */
+
+static bool get_export_qos(DBusMessageIter *args,
+			   DBusMessage *reply,
+			   DBusError *error)
+{
+	struct gsh_export *export = NULL;
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter, struct_iter;
+	struct timespec timestamp;
+	uint64_t limit, throttled, delayed_ns;
+	int64_t tokens;
+	int i;
+
+	dbus_message_iter_init_append(reply, &iter);
+	export = lookup_export(args, &errormsg);
+	if (export == NULL)
+		success = false;
+	dbus_status_reply(&iter, success, errormsg);
+	if (!success)
+		return true;
+
+	now(&timestamp);
+	dbus_append_timestamp(&iter, &timestamp);
+
+	for (i = 0; i < EXPORT_QOS_COUNT; i++) {
+		limit = atomic_fetch_uint64_t(&export->qos_limit[i]);
+		pthread_spin_lock(&export->qos.sp);
+		tokens = export->qos.tokens[i];
+		throttled = export->qos.throttled[i];
+		pthread_spin_unlock(&export->qos.sp);
+
+		dbus_message_iter_open_container(&iter, DBUS_TYPE_STRUCT,
+						 NULL, &struct_iter);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &limit);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_INT64,
+					       &tokens);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &throttled);
+		dbus_message_iter_close_container(&iter, &struct_iter);
+	}
+
+	pthread_spin_lock(&export->qos.sp);
+	delayed_ns = export->qos.delayed_ns;
+	pthread_spin_unlock(&export->qos.sp);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT64, &delayed_ns);
+
+	put_gsh_export(export);
+	return true;
+}
+
+static struct gsh_dbus_method export_show_qos = {
+	.name = "GetQoS",
+	.method = get_export_qos,
+	.args = {EXPORT_ID_ARG,
+		 STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 QOS_REPLY,
+		 END_ARG_LIST}
+};
+
+/**
+ * DBUS method to report export backend health
+ *
+ * Reports whether the export is shedding load, its failed requests in
+ * a row, how many times it started shedding and how many requests were
+ * answered without reaching the FSAL.
+ */
+
+static bool get_export_health(DBusMessageIter *args,
+			      DBusMessage *reply,
+			      DBusError *error)
+{
+	struct gsh_export *export = NULL;
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+	struct timespec timestamp;
+	dbus_bool_t shedding;
+	uint32_t strikes;
+	uint64_t trips, shed;
+
+	dbus_message_iter_init_append(reply, &iter);
+	export = lookup_export(args, &errormsg);
+	if (export == NULL)
+		success = false;
+	dbus_status_reply(&iter, success, errormsg);
+	if (!success)
+		return true;
 
-	if (export != NULL)
-		put_gsh_export(export);
+	now(&timestamp);
+	dbus_append_timestamp(&iter, &timestamp);
+
+	pthread_spin_lock(&export->health.sp);
+	shedding = export->health.open;
+	strikes = export->health.strikes;
+	trips = export->health.trips;
+	shed = export->health.shed;
+	pthread_spin_unlock(&export->health.sp);
+
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_BOOLEAN, &shedding);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT32, &strikes);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT64, &trips);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT64, &shed);
+
+	put_gsh_export(export);
 	return true;
 }
 
-static struct gsh_dbus_method export_show_v3_io = {
-	.name = "GetNFSv3IO",
-	.method = get_nfsv3_export_io,
+static struct gsh_dbus_method export_show_health = {
+	.name = "GetHealth",
+	.method = get_export_health,
 	.args = {EXPORT_ID_ARG,
 		 STATUS_REPLY,
 		 TIMESTAMP_REPLY,
-		 IOSTATS_REPLY,
+		 HEALTH_REPLY,
 		 END_ARG_LIST}
 };
 
@@ -1686,6 +2277,34 @@ static bool get_nfsv_export_total_ops(DBusMessageIter *args,
 	return true;
 }
 
+/**
+ * DBUS method to report the latency histograms of an export
+ */
+
+static bool get_export_latency(DBusMessageIter *args,
+			       DBusMessage *reply,
+			       DBusError *error)
+{
+	struct gsh_export *export = NULL;
+	struct export_stats *export_st = NULL;
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	export = lookup_export(args, &errormsg);
+	if (export != NULL) {
+		export_st = container_of(export, struct export_stats, export);
+		dbus_status_reply(&iter, success, errormsg);
+		server_dbus_latency(&export_st->st, &iter);
+		put_gsh_export(export);
+	} else {
+		success = false;
+		dbus_status_reply(&iter, success, errormsg);
+	}
+	return true;
+}
+
 static bool get_nfsv_global_total_ops(DBusMessageIter *args,
 				      DBusMessage *reply,
 				      DBusError *error)
@@ -1718,6 +2337,70 @@ static bool get_nfsv_global_fast_ops(DBusMessageIter *args,
 	return true;
 }
 
+static bool get_nfsv_global_fast_latency(DBusMessageIter *args,
+					 DBusMessage *reply,
+					 DBusError *error)
+{
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_status_reply(&iter, success, errormsg);
+
+	server_dbus_fast_latency(&iter);
+
+	return true;
+}
+
+static bool get_nfsv_global_phase_latency(DBusMessageIter *args,
+					  DBusMessage *reply,
+					  DBusError *error)
+{
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_status_reply(&iter, success, errormsg);
+
+	server_dbus_phase_latency(&iter);
+
+	return true;
+}
+
+static bool get_hot_spots(enum topk_kind kind, DBusMessage *reply)
+{
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_status_reply(&iter, success, errormsg);
+
+	topk_dbus_report(kind, &iter);
+
+	return true;
+}
+
+static bool get_hot_files(DBusMessageIter *args, DBusMessage *reply,
+			  DBusError *error)
+{
+	return get_hot_spots(TOPK_FILE_OP, reply);
+}
+
+static bool get_hot_clients(DBusMessageIter *args, DBusMessage *reply,
+			    DBusError *error)
+{
+	return get_hot_spots(TOPK_CLIENT_OP, reply);
+}
+
+static bool get_hot_exports(DBusMessageIter *args, DBusMessage *reply,
+			    DBusError *error)
+{
+	return get_hot_spots(TOPK_EXPORT_BYTES, reply);
+}
+
 static bool show_cache_inode_stats(DBusMessageIter *args,
 				   DBusMessage *reply,
 				   DBusError *error)
@@ -1734,6 +2417,145 @@ static bool show_cache_inode_stats(DBusMessageIter *args,
 	return true;
 }
 
+static bool show_drc_stats(DBusMessageIter *args,
+			   DBusMessage *reply,
+			   DBusError *error)
+{
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_status_reply(&iter, success, errormsg);
+
+	dupreq2_dbus_show(&iter);
+
+	return true;
+}
+
+static bool show_iobuf_pool_stats(DBusMessageIter *args,
+				  DBusMessage *reply,
+				  DBusError *error)
+{
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_status_reply(&iter, success, errormsg);
+
+	iobuf_pool_dbus_show(&iter);
+
+	return true;
+}
+
+static bool show_slab_stats(DBusMessageIter *args,
+			    DBusMessage *reply,
+			    DBusError *error)
+{
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_status_reply(&iter, success, errormsg);
+
+	gsh_slab_dbus_show(&iter);
+
+	return true;
+}
+
+/**
+ * DBUS method to report memory by subsystem
+ *
+ */
+static bool show_mem_stats(DBusMessageIter *args,
+			   DBusMessage *reply,
+			   DBusError *error)
+{
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_status_reply(&iter, success, errormsg);
+
+	gsh_mem_dbus_show(&iter);
+
+	return true;
+}
+
+/**
+ * DBUS method to report what every worker is executing
+ *
+ */
+static bool show_inflight(DBusMessageIter *args,
+			  DBusMessage *reply,
+			  DBusError *error)
+{
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_status_reply(&iter, success, errormsg);
+
+	req_inflight_dbus_show(&iter);
+
+	return true;
+}
+
+#ifdef USE_LOCK_PROFILE
+/**
+ * DBUS method to report lock contention by call site
+ *
+ */
+static bool show_lock_profile(DBusMessageIter *args,
+			      DBusMessage *reply,
+			      DBusError *error)
+{
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_status_reply(&iter, success, errormsg);
+
+	lock_prof_dbus_show(&iter);
+
+	return true;
+}
+
+/**
+ * DBUS method to turn the lock profile on or off
+ *
+ */
+static bool set_lock_profile(DBusMessageIter *args,
+			     DBusMessage *reply,
+			     DBusError *error)
+{
+	bool success = true;
+	char *errormsg = "OK";
+	dbus_bool_t enable;
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+
+	if (args == NULL ||
+	    dbus_message_iter_get_arg_type(args) != DBUS_TYPE_BOOLEAN) {
+		success = false;
+		errormsg = "arg not a boolean";
+	} else {
+		dbus_message_iter_get_basic(args, &enable);
+		lock_prof_set(enable);
+	}
+
+	dbus_status_reply(&iter, success, errormsg);
+
+	return true;
+}
+#endif
+
 static struct gsh_dbus_method export_show_v41_layouts = {
 	.name = "GetNFSv41Layouts",
 	.method = get_nfsv41_export_layouts,
@@ -1779,6 +2601,7 @@ static bool stats_reset(DBusMessageIter *args,
 
 	reset_fsal_stats();
 	server_reset_stats(&iter);
+	topk_reset();
 
 	return true;
 }
@@ -1969,6 +2792,61 @@ static struct gsh_dbus_method global_show_fast_ops = {
 		 END_ARG_LIST}
 };
 
+static struct gsh_dbus_method export_show_latency = {
+	.name = "GetLatency",
+	.method = get_export_latency,
+	.args = {EXPORT_ID_ARG,
+		 STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 LATENCY_REPLY,
+		 END_ARG_LIST}
+};
+
+static struct gsh_dbus_method global_show_fast_latency = {
+	.name = "GetFastLatency",
+	.method = get_nfsv_global_fast_latency,
+	.args = {STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 OP_LATENCY_REPLY,
+		 END_ARG_LIST}
+};
+
+static struct gsh_dbus_method global_show_phase_latency = {
+	.name = "GetPhaseLatency",
+	.method = get_nfsv_global_phase_latency,
+	.args = {STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 PHASE_LATENCY_REPLY,
+		 END_ARG_LIST}
+};
+
+static struct gsh_dbus_method global_hot_files = {
+	.name = "GetHotFiles",
+	.method = get_hot_files,
+	.args = {STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 TOPK_REPLY,
+		 END_ARG_LIST}
+};
+
+static struct gsh_dbus_method global_hot_clients = {
+	.name = "GetHotClients",
+	.method = get_hot_clients,
+	.args = {STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 TOPK_REPLY,
+		 END_ARG_LIST}
+};
+
+static struct gsh_dbus_method global_hot_exports = {
+	.name = "GetHotExports",
+	.method = get_hot_exports,
+	.args = {STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 TOPK_REPLY,
+		 END_ARG_LIST}
+};
+
 static struct gsh_dbus_method cache_inode_show = {
 	.name = "ShowCacheInode",
 	.method = show_cache_inode_stats,
@@ -1978,6 +2856,70 @@ static struct gsh_dbus_method cache_inode_show = {
 		 END_ARG_LIST}
 };
 
+static struct gsh_dbus_method drc_show = {
+	.name = "ShowDRC",
+	.method = show_drc_stats,
+	.args = {STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 TOTAL_OPS_REPLY,
+		 END_ARG_LIST}
+};
+
+static struct gsh_dbus_method iobuf_pool_show = {
+	.name = "ShowIOBufPool",
+	.method = show_iobuf_pool_stats,
+	.args = {STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 IOBUF_POOL_REPLY,
+		 END_ARG_LIST}
+};
+
+static struct gsh_dbus_method slab_show = {
+	.name = "ShowSlabs",
+	.method = show_slab_stats,
+	.args = {STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 SLAB_REPLY,
+		 END_ARG_LIST}
+};
+
+static struct gsh_dbus_method memory_show = {
+	.name = "ShowMemory",
+	.method = show_mem_stats,
+	.args = {STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 MEMORY_REPLY,
+		 END_ARG_LIST}
+};
+
+static struct gsh_dbus_method inflight_show = {
+	.name = "ShowInflight",
+	.method = show_inflight,
+	.args = {STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 INFLIGHT_REPLY,
+		 END_ARG_LIST}
+};
+
+#ifdef USE_LOCK_PROFILE
+static struct gsh_dbus_method lock_profile_show = {
+	.name = "ShowLockProfile",
+	.method = show_lock_profile,
+	.args = {STATUS_REPLY,
+		 TIMESTAMP_REPLY,
+		 LOCK_PROFILE_REPLY,
+		 END_ARG_LIST}
+};
+
+static struct gsh_dbus_method lock_profile_set = {
+	.name = "SetLockProfile",
+	.method = set_lock_profile,
+	.args = {LOCK_PROFILE_ARG,
+		 STATUS_REPLY,
+		 END_ARG_LIST}
+};
+#endif
+
 /**
  * @brief Report all IO stats of all exports in one call
  *
@@ -2038,6 +2980,8 @@ static struct gsh_dbus_method *export_stats_methods[] = {
 	&export_show_v40_io,
 	&export_show_v41_io,
 	&export_show_v41_layouts,
+	&export_show_qos,
+	&export_show_health,
 	&export_show_total_ops,
 #ifdef _USE_9P
 	&export_show_9p_io,
@@ -2045,7 +2989,22 @@ static struct gsh_dbus_method *export_stats_methods[] = {
 #endif
 	&global_show_total_ops,
 	&global_show_fast_ops,
+	&export_show_latency,
+	&global_show_fast_latency,
+	&global_show_phase_latency,
+	&global_hot_files,
+	&global_hot_clients,
+	&global_hot_exports,
 	&cache_inode_show,
+	&drc_show,
+	&iobuf_pool_show,
+	&slab_show,
+	&memory_show,
+	&inflight_show,
+#ifdef USE_LOCK_PROFILE
+	&lock_profile_show,
+	&lock_profile_set,
+#endif
 	&export_show_all_io,
 	&reset_statistics,
 	&fsal_statistics,
@@ -2087,8 +3046,8 @@ void export_pkginit(void)
 		PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
 #endif
 	PTHREAD_RWLOCK_init(&export_by_id.lock, &rwlock_attr);
-	avltree_init(&export_by_id.t, export_id_cmpf, 0);
-	memset(&export_by_id.cache, 0, sizeof(export_by_id.cache));
+	gsh_rcu_init(&export_by_id.rcu);
+	pseudo_root = pseudo_node_alloc("", 0, 0);
 
 	glist_init(&exportlist);
 	glist_init(&mount_work);
@@ -51,6 +51,7 @@
 #include "sal_functions.h"
 #include "pnfs_utils.h"
 #include "netgroup_cache.h"
+#include "client_index.h"
 #include "mdcache.h"
 
 /**
@@ -984,6 +985,133 @@ static inline void update_atomic_fields(struct gsh_export *export,
 	atomic_store_uint32_t(&export->options, src->options);
 	atomic_store_uint32_t(&export->options_set, src->options_set);
 	atomic_store_int32_t(&export->expire_time_attr, src->expire_time_attr);
+	atomic_store_uint64_t(&export->qos_limit[EXPORT_QOS_IOPS],
+			      src->qos_limit[EXPORT_QOS_IOPS]);
+	atomic_store_uint64_t(&export->qos_limit[EXPORT_QOS_READ],
+			      src->qos_limit[EXPORT_QOS_READ]);
+	atomic_store_uint64_t(&export->qos_limit[EXPORT_QOS_WRITE],
+			      src->qos_limit[EXPORT_QOS_WRITE]);
+	atomic_store_uint32_t(&export->max_inflight, src->max_inflight);
+	atomic_store_uint32_t(&export->health_failures, src->health_failures);
+	atomic_store_uint32_t(&export->health_latency, src->health_latency);
+	atomic_store_uint32_t(&export->health_retry, src->health_retry);
+	atomic_store_uint32_t(&export->health_probes, src->health_probes);
+	atomic_store_uint32_t(&export->cache_partition, src->cache_partition);
+	atomic_store_uint64_t(&export->cache_reserved_entries,
+			      src->cache_reserved_entries);
+	atomic_store_uint64_t(&export->cache_reserved_chunks,
+			      src->cache_reserved_chunks);
+}
+
+static inline bool export_perms_equal(const struct export_perms *a,
+				      const struct export_perms *b)
+{
+	return a->anonymous_uid == b->anonymous_uid &&
+	       a->anonymous_gid == b->anonymous_gid &&
+	       a->options == b->options &&
+	       a->set == b->set;
+}
+
+static bool client_entry_equal(exportlist_client_entry_t *a,
+			       exportlist_client_entry_t *b)
+{
+	if (a->type != b->type ||
+	    !export_perms_equal(&a->client_perms, &b->client_perms))
+		return false;
+
+	switch (a->type) {
+	case HOSTIF_CLIENT:
+		return a->client.hostif.clientaddr ==
+		       b->client.hostif.clientaddr;
+	case HOSTIF_CLIENT_V6:
+		return memcmp(&a->client.hostif.clientaddr6,
+			      &b->client.hostif.clientaddr6,
+			      sizeof(a->client.hostif.clientaddr6)) == 0;
+	case NETWORK_CLIENT:
+		return a->client.network.netaddr ==
+		       b->client.network.netaddr &&
+		       a->client.network.netmask ==
+		       b->client.network.netmask;
+	case NETGROUP_CLIENT:
+		return strcmp_null(a->client.netgroup.netgroupname,
+				   b->client.netgroup.netgroupname) == 0;
+	case WILDCARDHOST_CLIENT:
+		return strcmp_null(a->client.wildcard.wildcard,
+				   b->client.wildcard.wildcard) == 0;
+	case GSSPRINCIPAL_CLIENT:
+		return strcmp_null(a->client.gssprinc.princname,
+				   b->client.gssprinc.princname) == 0;
+	default:
+		return true;
+	}
+}
+
+/**
+ * @brief Check whether an update leaves an export as it is
+ *
+ * Compares what an update would replace: the fields set by
+ * update_atomic_fields, the export perms and the client list, in order.
+ *
+ * @param[in] export The live export, export->lock held for read
+ * @param[in] src    The export parsed from the new configuration
+ *
+ * @return true if the update would change nothing.
+ */
+
+static bool export_update_unchanged(struct gsh_export *export,
+				    struct gsh_export *src)
+{
+	struct glist_head *ga, *gb;
+	int i;
+
+	if (atomic_fetch_uint64_t(&export->MaxRead) != src->MaxRead ||
+	    atomic_fetch_uint64_t(&export->MaxWrite) != src->MaxWrite ||
+	    atomic_fetch_uint64_t(&export->PrefRead) != src->PrefRead ||
+	    atomic_fetch_uint64_t(&export->PrefWrite) != src->PrefWrite ||
+	    atomic_fetch_uint64_t(&export->PrefReaddir) != src->PrefReaddir ||
+	    atomic_fetch_uint64_t(&export->MaxOffsetWrite) !=
+						src->MaxOffsetWrite ||
+	    atomic_fetch_uint64_t(&export->MaxOffsetRead) !=
+						src->MaxOffsetRead ||
+	    atomic_fetch_uint32_t(&export->options) != src->options ||
+	    atomic_fetch_uint32_t(&export->options_set) != src->options_set ||
+	    atomic_fetch_int32_t(&export->expire_time_attr) !=
+						src->expire_time_attr ||
+	    atomic_fetch_uint32_t(&export->max_inflight) !=
+						src->max_inflight ||
+	    atomic_fetch_uint32_t(&export->health_failures) !=
+						src->health_failures ||
+	    atomic_fetch_uint32_t(&export->health_latency) !=
+						src->health_latency ||
+	    atomic_fetch_uint32_t(&export->health_retry) !=
+						src->health_retry ||
+	    atomic_fetch_uint32_t(&export->health_probes) !=
+						src->health_probes ||
+	    atomic_fetch_uint32_t(&export->cache_partition) !=
+						src->cache_partition ||
+	    atomic_fetch_uint64_t(&export->cache_reserved_entries) !=
+						src->cache_reserved_entries ||
+	    atomic_fetch_uint64_t(&export->cache_reserved_chunks) !=
+						src->cache_reserved_chunks)
+		return false;
+
+	for (i = 0; i < EXPORT_QOS_COUNT; i++)
+		if (atomic_fetch_uint64_t(&export->qos_limit[i]) !=
+		    src->qos_limit[i])
+			return false;
+
+	if (!export_perms_equal(&export->export_perms, &src->export_perms))
+		return false;
+
+	for (ga = export->clients.next, gb = src->clients.next;
+	     ga != &export->clients && gb != &src->clients;
+	     ga = ga->next, gb = gb->next)
+		if (!client_entry_equal(
+			glist_entry(ga, exportlist_client_entry_t, cle_list),
+			glist_entry(gb, exportlist_client_entry_t, cle_list)))
+			return false;
+
+	return ga == &export->clients && gb == &src->clients;
 }
 
 /**
@@ -1004,6 +1132,8 @@ static int export_commit_common(void *node, void *link_mem, void *self_struct,
 				enum export_commit_type commit_type)
 {
 	struct gsh_export *export = self_struct, *probe_exp;
+	struct client_index *client_index;
+	bool unchanged;
 	int errcnt = 0;
 	char perms[1024] = "\0";
 	struct display_buffer dspbuf = {sizeof(perms), perms, perms};
@@ -1151,6 +1281,27 @@ static int export_commit_common(void *node, void *link_mem, void *self_struct,
 			return errcnt;
 		}
 
+		/* A reload visits every export; leave the ones it does not
+		 * change alone so their index and the connections' cached
+		 * permissions stay valid.
+		 */
+		PTHREAD_RWLOCK_rdlock(&probe_exp->lock);
+		unchanged = export_update_unchanged(probe_exp, export);
+		PTHREAD_RWLOCK_unlock(&probe_exp->lock);
+
+		if (unchanged) {
+			LogDebug(COMPONENT_CONFIG,
+				 "Export %d unchanged", export->export_id);
+			err_type->dispose = true;
+			put_gsh_export(probe_exp);
+			return 0;
+		}
+
+		/* The client list is complete, compile it for
+		 * export_check_access
+		 */
+		export->client_index = client_index_build(&export->clients);
+
 		/* Update atomic fields */
 		update_atomic_fields(probe_exp, export);
 
@@ -1170,8 +1321,12 @@ static int export_commit_common(void *node, void *link_mem, void *self_struct,
 			     export->clients.next, export->clients.prev);
 
 		glist_swap_lists(&probe_exp->clients, &export->clients);
+		client_index = probe_exp->client_index;
+		probe_exp->client_index = export->client_index;
+		export->client_index = client_index;
 
 		PTHREAD_RWLOCK_unlock(&probe_exp->lock);
+		export_perms_changed();
 
 		/* We will need to dispose of the config export since we
 		 * updated the existing export.
@@ -1263,6 +1418,9 @@ static int export_commit_common(void *node, void *link_mem, void *self_struct,
 		return errcnt;  /* have errors. don't init or load a fsal */
 	}
 
+	/* The client list is complete, compile it for export_check_access */
+	export->client_index = client_index_build(&export->clients);
+
 	if (!insert_gsh_export(export)) {
 		LogCrit(COMPONENT_CONFIG,
 			"Export id %d already in use.",
@@ -1428,6 +1586,7 @@ static int export_defaults_commit(void *node, void *link_mem,
 {
 	char perms[1024] = "\0";
 	struct display_buffer dspbuf = {sizeof(perms), perms, perms};
+	bool changed;
 
 	(void) StrExportOptions(&dspbuf, &export_opt_cfg.conf);
 
@@ -1435,8 +1594,13 @@ static int export_defaults_commit(void *node, void *link_mem,
 
 	/* Update under lock. */
 	PTHREAD_RWLOCK_wrlock(&export_opt_lock);
+	changed = !export_perms_equal(&export_opt.def, &export_opt_cfg.def) ||
+		  !export_perms_equal(&export_opt.conf, &export_opt_cfg.conf) ||
+		  export_opt.expire_time_attr != export_opt_cfg.expire_time_attr;
 	export_opt = export_opt_cfg;
 	PTHREAD_RWLOCK_unlock(&export_opt_lock);
+	if (changed)
+		export_perms_changed();
 
 	return 0;
 }
@@ -1730,9 +1894,35 @@ static struct config_item fsal_params[] = {
 	CONF_ITEM_BOOLBIT_SET("Disable_ACL",				\
 		false, EXPORT_OPTION_DISABLE_ACL,			\
 		_struct_, options, options_set),			\
+	CONF_ITEM_BOOLBIT_SET("Immutable",				\
+		false, EXPORT_OPTION_IMMUTABLE,				\
+		_struct_, options, options_set),			\
 	CONF_ITEM_I32_SET("Attr_Expiration_Time", -1, INT32_MAX, 60,	\
 		       _struct_, expire_time_attr,			\
-		       EXPORT_OPTION_EXPIRE_SET, options_set)
+		       EXPORT_OPTION_EXPIRE_SET, options_set),		\
+	CONF_ITEM_UI64("QoS_IOPS", 0, UINT32_MAX, 0,			\
+		       _struct_, qos_limit[EXPORT_QOS_IOPS]),		\
+	CONF_ITEM_UI64("QoS_Read_Bandwidth", 0, UINT64_MAX, 0,		\
+		       _struct_, qos_limit[EXPORT_QOS_READ]),		\
+	CONF_ITEM_UI64("QoS_Write_Bandwidth", 0, UINT64_MAX, 0,		\
+		       _struct_, qos_limit[EXPORT_QOS_WRITE]),		\
+	CONF_ITEM_UI32("Max_Inflight", 0, UINT32_MAX, 0,		\
+		       _struct_, max_inflight),				\
+	CONF_ITEM_UI32("Health_Failures", 0, UINT32_MAX, 0,		\
+		       _struct_, health_failures),			\
+	CONF_ITEM_UI32("Health_Latency", 0, 3600000, 0,			\
+		       _struct_, health_latency),			\
+	CONF_ITEM_UI32("Health_Retry", 1, 3600000, 1000,		\
+		       _struct_, health_retry),				\
+	CONF_ITEM_UI32("Health_Probes", 1, 1024, 1,			\
+		       _struct_, health_probes),			\
+	CONF_ITEM_UI32("Cache_Partition", 0,				\
+		       EXPORT_CACHE_PARTITIONS - 1, 0,			\
+		       _struct_, cache_partition),			\
+	CONF_ITEM_UI64("Cache_Reserved_Entries", 0, UINT64_MAX, 0,	\
+		       _struct_, cache_reserved_entries),		\
+	CONF_ITEM_UI64("Cache_Reserved_Chunks", 0, UINT64_MAX, 0,	\
+		       _struct_, cache_reserved_chunks)
 
 /**
  * @brief Table of EXPORT block parameters
@@ -2096,6 +2286,8 @@ static void FreeClientList(struct glist_head *clients)
 
 void free_export_resources(struct gsh_export *export)
 {
+	client_index_free(export->client_index);
+	export->client_index = NULL;
 	FreeClientList(&export->clients);
 	if (export->fsal_export != NULL) {
 		struct fsal_module *fsal = export->fsal_export->fsal;
@@ -2114,7 +2306,22 @@ void free_export_resources(struct gsh_export *export)
 }
 
 /**
- * @brief pkginit callback to initialize exports from nfs_init
+ * @brief Exports whose roots are looked up at startup
+ *
+ * Threads take the next export from the array until it is exhausted.
+ */
+
+struct export_init_work {
+	struct gsh_export **exports;
+	int *status;		/*< init_export_root() result per export */
+	uint32_t count;
+	uint32_t size;
+	uint32_t next;
+	uint32_t end;
+};
+
+/**
+ * @brief pkginit callback to collect the exports from nfs_init
  *
  * Assumes being called with the export_by_id.lock held.
  * true on success
@@ -2122,33 +2329,135 @@ void free_export_resources(struct gsh_export *export)
 
 static bool init_export_cb(struct gsh_export *exp, void *state)
 {
-	struct glist_head *errlist = state;
+	struct export_init_work *work = state;
 
-	if (init_export_root(exp)) {
-		glist_del(&exp->exp_list);
-		glist_add(errlist, &exp->exp_list);
+	if (work->count == work->size) {
+		work->size = work->size ? work->size * 2 : 64;
+		work->exports = gsh_realloc(work->exports,
+					    work->size *
+					    sizeof(*work->exports));
 	}
+	get_gsh_export_ref(exp);
+	work->exports[work->count++] = exp;
 
 	return true;
 }
 
+/* The FSAL module at the bottom of an export's stack */
+static struct fsal_module *export_init_fsal(struct gsh_export *export)
+{
+	struct fsal_export *exp_hdl = export->fsal_export;
+
+	while (exp_hdl->sub_export != NULL)
+		exp_hdl = exp_hdl->sub_export;
+	return exp_hdl->fsal;
+}
+
+static void export_init_some(struct export_init_work *work)
+{
+	uint32_t i;
+
+	while ((i = atomic_inc_uint32_t(&work->next) - 1) < work->end)
+		work->status[i] = init_export_root(work->exports[i]);
+}
+
+static void *export_init_thread(void *arg)
+{
+	SetNameFunction("export_init");
+	export_init_some(arg);
+	return NULL;
+}
+
+/**
+ * @brief Initialize exports [first, end) on up to Export_Init_Threads
+ *
+ * The calling thread takes part, so this still completes if no thread
+ * can be started.
+ */
+
+static void export_init_run(struct export_init_work *work, uint32_t first,
+			    uint32_t end)
+{
+	uint32_t nthreads = nfs_param.core_param.export_init_threads;
+	pthread_t *thrid;
+	uint32_t i, started = 0;
+	int rc;
+
+	if (end - first < nthreads)
+		nthreads = end - first;
+	if (nthreads == 0)
+		return;
+
+	work->next = first;
+	work->end = end;
+
+	thrid = gsh_calloc(nthreads, sizeof(*thrid));
+	for (i = 1; i < nthreads; i++) {
+		rc = pthread_create(&thrid[started], NULL, export_init_thread,
+				    work);
+		if (rc != 0) {
+			LogMajor(COMPONENT_THREAD,
+				 "Could not create export init thread: %s",
+				 strerror(rc));
+			break;
+		}
+		started++;
+	}
+
+	export_init_some(work);
+
+	for (i = 0; i < started; i++)
+		pthread_join(thrid[i], NULL);
+	gsh_free(thrid);
+}
+
 /**
  * @brief Initialize exports over a live cache inode and fsal layer
+ *
+ * Root lookups may be slow (a CephFS mount, a Gluster volume init), so
+ * exports are initialized concurrently.  The first export of each FSAL
+ * module is done in a round ahead of the others, so that whatever an
+ * FSAL sets up on first use is in place before its other exports run
+ * in parallel.
  */
 
 void exports_pkginit(void)
 {
-	struct glist_head errlist;
-	struct glist_head *glist, *glistn;
+	struct export_init_work work;
 	struct gsh_export *export;
+	uint32_t i, j, firsts = 0;
+
+	memset(&work, 0, sizeof(work));
+	foreach_gsh_export(init_export_cb, false, &work);
+	work.status = gsh_calloc(work.count + 1, sizeof(*work.status));
+
+	/* Move the first export of each FSAL to the front, keeping the
+	 * configuration order otherwise.
+	 */
+	for (i = 0; i < work.count; i++) {
+		for (j = 0; j < firsts; j++)
+			if (export_init_fsal(work.exports[j]) ==
+			    export_init_fsal(work.exports[i]))
+				break;
+		if (j < firsts)
+			continue;
+		export = work.exports[i];
+		memmove(&work.exports[firsts + 1], &work.exports[firsts],
+			(i - firsts) * sizeof(*work.exports));
+		work.exports[firsts++] = export;
+	}
 
-	glist_init(&errlist);
-	foreach_gsh_export(init_export_cb, true, &errlist);
+	export_init_run(&work, 0, firsts);
+	export_init_run(&work, firsts, work.count);
 
-	glist_for_each_safe(glist, glistn, &errlist) {
-		export = glist_entry(glist, struct gsh_export, exp_list);
-		export_revert(export);
+	for (i = 0; i < work.count; i++) {
+		if (work.status[i] != 0)
+			export_revert(work.exports[i]);
+		put_gsh_export(work.exports[i]);
 	}
+
+	gsh_free(work.status);
+	gsh_free(work.exports);
 }
 
 /**
@@ -2408,6 +2717,172 @@ void unexport(struct gsh_export *export)
 		release_root_op_context();
 }
 
+/**
+ * @brief Match an IPv4 host against one client entry
+ *
+ * @param[in]     client       Entry to match
+ * @param[in]     hostaddr     Host to match
+ * @param[in]     addr         Its address
+ * @param[in,out] ipvalid      Whether ipstring is set, -1 if not tried
+ * @param[in,out] ipstring     Printed address, filled in when needed
+ * @param[in]     ipstring_len Size of ipstring
+ *
+ * @return true if the entry matches.
+ */
+static bool client_match_entry(exportlist_client_entry_t *client,
+			       sockaddr_t *hostaddr, in_addr_t addr,
+			       int *ipvalid, char *ipstring,
+			       size_t ipstring_len)
+{
+	int rc;
+	char hostname[MAXHOSTNAMELEN + 1];
+
+	switch (client->type) {
+	case HOSTIF_CLIENT:
+		if (client->client.hostif.clientaddr == addr)
+			return true;
+		break;
+
+	case NETWORK_CLIENT:
+		if ((client->client.network.netmask & ntohl(addr)) ==
+		    client->client.network.netaddr)
+			return true;
+		break;
+
+	case NETGROUP_CLIENT:
+		/* Try to get the entry from th IP/name cache */
+		rc = nfs_ip_name_get(hostaddr, hostname,
+				     sizeof(hostname));
+
+		if (rc == IP_NAME_NOT_FOUND) {
+			/* IPaddr was not cached, add it to the cache */
+			rc = nfs_ip_name_add(hostaddr,
+					     hostname,
+					     sizeof(hostname));
+		}
+
+		if (rc != IP_NAME_SUCCESS)
+			break; /* Fatal failure */
+
+		/* At this point 'hostname' should contain the
+		 * name that was found
+		 */
+		if (ng_innetgr(client->client.netgroup.netgroupname,
+			    hostname)) {
+			return true;
+		}
+		break;
+
+	case WILDCARDHOST_CLIENT:
+		/* Now checking for IP wildcards */
+		if (*ipvalid < 0)
+			*ipvalid = sprint_sockip(hostaddr,
+						 ipstring,
+						 ipstring_len);
+
+		if (*ipvalid &&
+		    (fnmatch(client->client.wildcard.wildcard,
+			     ipstring,
+			     FNM_PATHNAME) == 0)) {
+			return true;
+		}
+
+		/* Try to get the entry from th IP/name cache */
+		rc = nfs_ip_name_get(hostaddr, hostname,
+				     sizeof(hostname));
+
+		if (rc == IP_NAME_NOT_FOUND) {
+			/* IPaddr was not cached, add it to the cache */
+
+			/** @todo this change from 1.5 is not IPv6
+			 * useful.  come back to this and use the
+			 * string from client mgr inside req_ctx...
+			 */
+			rc = nfs_ip_name_add(hostaddr,
+					     hostname,
+					     sizeof(hostname));
+		}
+
+		if (rc != IP_NAME_SUCCESS)
+				break;
+
+		/* At this point 'hostname' should contain the
+		 * name that was found
+		 */
+		if (fnmatch
+		    (client->client.wildcard.wildcard, hostname,
+		     FNM_PATHNAME) == 0) {
+			return true;
+		}
+		break;
+
+	case GSSPRINCIPAL_CLIENT:
+  /** @todo BUGAZOMEU a completer lors de l'integration de RPCSEC_GSS */
+		LogCrit(COMPONENT_EXPORT,
+			"Unsupported type GSS_PRINCIPAL_CLIENT");
+		break;
+
+	case HOSTIF_CLIENT_V6:
+		break;
+
+	case MATCH_ANY_CLIENT:
+		return true;
+
+	case BAD_CLIENT:
+	default:
+		break;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Match an IPv4 host against the export's compiled client list
+ *
+ * The index gives the earliest host, network or match-all entry for
+ * the address; only the netgroup and wildcard entries ahead of it are
+ * tried one by one.
+ *
+ * @param[in] hostaddr Host to search for
+ * @param[in] export   Export whose client_index to search
+ *
+ * @return The first matching entry or NULL.
+ */
+static exportlist_client_entry_t *client_match_index(sockaddr_t *hostaddr,
+						     struct gsh_export *export)
+{
+	in_addr_t addr = get_in_addr(hostaddr);
+	exportlist_client_entry_t *client;
+	struct client_index_slow *slow;
+	uint32_t order, count, i;
+	int ipvalid = -1;	/* -1 need to print, 0 - invalid, 1 - ok */
+	char ipstring[SOCK_NAME_MAX + 1];
+
+	client = client_index_match_v4(export->client_index, addr, &order);
+	slow = client_index_slow_list(export->client_index, &count);
+
+	for (i = 0; i < count && slow[i].order < order; i++) {
+		LogClientListEntry(NIV_MID_DEBUG,
+				   COMPONENT_EXPORT,
+				   __LINE__,
+				   (char *) __func__,
+				   "Match V4: ",
+				   slow[i].client);
+		if (client_match_entry(slow[i].client, hostaddr, addr,
+				       &ipvalid, ipstring, sizeof(ipstring)))
+			return slow[i].client;
+	}
+
+	if (client != NULL)
+		LogClientListEntry(NIV_MID_DEBUG,
+				   COMPONENT_EXPORT,
+				   __LINE__,
+				   (char *) __func__,
+				   "Match V4: ",
+				   client);
+	return client;
+}
+
 /**
  * @brief Match a specific option in the client export list
  *
@@ -2423,11 +2898,12 @@ static exportlist_client_entry_t *client_match(sockaddr_t *hostaddr,
 {
 	struct glist_head *glist;
 	in_addr_t addr = get_in_addr(hostaddr);
-	int rc;
 	int ipvalid = -1;	/* -1 need to print, 0 - invalid, 1 - ok */
-	char hostname[MAXHOSTNAMELEN + 1];
 	char ipstring[SOCK_NAME_MAX + 1];
 
+	if (export->client_index != NULL)
+		return client_match_index(hostaddr, export);
+
 	glist_for_each(glist, &export->clients) {
 		exportlist_client_entry_t *client;
 
@@ -2440,101 +2916,9 @@ static exportlist_client_entry_t *client_match(sockaddr_t *hostaddr,
 				   "Match V4: ",
 				   client);
 
-		switch (client->type) {
-		case HOSTIF_CLIENT:
-			if (client->client.hostif.clientaddr == addr)
-				return client;
-			break;
-
-		case NETWORK_CLIENT:
-			if ((client->client.network.netmask & ntohl(addr)) ==
-			    client->client.network.netaddr)
-				return client;
-			break;
-
-		case NETGROUP_CLIENT:
-			/* Try to get the entry from th IP/name cache */
-			rc = nfs_ip_name_get(hostaddr, hostname,
-					     sizeof(hostname));
-
-			if (rc == IP_NAME_NOT_FOUND) {
-				/* IPaddr was not cached, add it to the cache */
-				rc = nfs_ip_name_add(hostaddr,
-						     hostname,
-						     sizeof(hostname));
-			}
-
-			if (rc != IP_NAME_SUCCESS)
-				break; /* Fatal failure */
-
-			/* At this point 'hostname' should contain the
-			 * name that was found
-			 */
-			if (ng_innetgr(client->client.netgroup.netgroupname,
-				    hostname)) {
-				return client;
-			}
-			break;
-
-		case WILDCARDHOST_CLIENT:
-			/* Now checking for IP wildcards */
-			if (ipvalid < 0)
-				ipvalid = sprint_sockip(hostaddr,
-							ipstring,
-							sizeof(ipstring));
-
-			if (ipvalid &&
-			    (fnmatch(client->client.wildcard.wildcard,
-				     ipstring,
-				     FNM_PATHNAME) == 0)) {
-				return client;
-			}
-
-			/* Try to get the entry from th IP/name cache */
-			rc = nfs_ip_name_get(hostaddr, hostname,
-					     sizeof(hostname));
-
-			if (rc == IP_NAME_NOT_FOUND) {
-				/* IPaddr was not cached, add it to the cache */
-
-				/** @todo this change from 1.5 is not IPv6
-				 * useful.  come back to this and use the
-				 * string from client mgr inside req_ctx...
-				 */
-				rc = nfs_ip_name_add(hostaddr,
-						     hostname,
-						     sizeof(hostname));
-			}
-
-			if (rc != IP_NAME_SUCCESS)
-					break;
-
-			/* At this point 'hostname' should contain the
-			 * name that was found
-			 */
-			if (fnmatch
-			    (client->client.wildcard.wildcard, hostname,
-			     FNM_PATHNAME) == 0) {
-				return client;
-			}
-			break;
-
-		case GSSPRINCIPAL_CLIENT:
-	  /** @todo BUGAZOMEU a completer lors de l'integration de RPCSEC_GSS */
-			LogCrit(COMPONENT_EXPORT,
-				"Unsupported type GSS_PRINCIPAL_CLIENT");
-			break;
-
-		case HOSTIF_CLIENT_V6:
-			break;
-
-		case MATCH_ANY_CLIENT:
+		if (client_match_entry(client, hostaddr, addr, &ipvalid,
+				       ipstring, sizeof(ipstring)))
 			return client;
-
-		case BAD_CLIENT:
-		default:
-			continue;
-		}
 	}
 
 	/* no export found for this option */
@@ -2557,6 +2941,9 @@ static exportlist_client_entry_t *client_matchv6(struct in6_addr *paddrv6,
 {
 	struct glist_head *glist;
 
+	if (export->client_index != NULL)
+		return client_index_match_v6(export->client_index, paddrv6);
+
 	glist_for_each(glist, &export->clients) {
 		exportlist_client_entry_t *client;
 
@@ -2947,6 +3334,15 @@ void export_check_access(void)
 
 	op_ctx->export_perms->set |= export_opt.def.set;
 
+	/* Nothing may change the content of an immutable export */
+	if (op_ctx->ctx_export != NULL &&
+	    (atomic_fetch_uint32_t(&op_ctx->ctx_export->options) &
+	     EXPORT_OPTION_IMMUTABLE))
+		op_ctx->export_perms->options &=
+			~(EXPORT_OPTION_WRITE_ACCESS |
+			  EXPORT_OPTION_MD_WRITE_ACCESS |
+			  EXPORT_OPTION_WRITE_DELEG);
+
 	if (isMidDebug(COMPONENT_EXPORT)) {
 		char perms[1024] = "\0";
 		struct display_buffer dspbuf = {sizeof(perms), perms, perms};
@@ -2993,3 +3389,97 @@ void export_check_access(void)
 		PTHREAD_RWLOCK_unlock(&op_ctx->ctx_export->lock);
 	}
 }
+
+/**
+ * @brief Export permissions resolved on one connection
+ *
+ * Every request on a connection comes from the same address, and the
+ * result of export_check_access only depends on the address, the export
+ * and the export configuration.  So each TCP connection keeps the last
+ * few results, tagged with export_perms_gen, which is bumped whenever
+ * an export's clients or perms, the export defaults, or the set of
+ * exports changes.
+ */
+
+#define EXPORT_PERM_CACHE_SIZE 4
+
+struct export_perm_cache {
+	pthread_spinlock_t sp;
+	uint32_t next;		/*< Entry to replace next */
+	struct {
+		struct gsh_export *export;	/*< NULL for no export */
+		uint64_t gen;			/*< 0 for unused */
+		struct export_perms perms;
+	} entry[EXPORT_PERM_CACHE_SIZE];
+};
+
+static uint64_t export_perms_gen = 1;
+
+/**
+ * @brief Invalidate every cached export permission decision
+ */
+void export_perms_changed(void)
+{
+	(void)atomic_inc_uint64_t(&export_perms_gen);
+}
+
+struct export_perm_cache *export_perm_cache_alloc(void)
+{
+	struct export_perm_cache *cache = gsh_calloc(1, sizeof(*cache));
+
+	pthread_spin_init(&cache->sp, PTHREAD_PROCESS_PRIVATE);
+	return cache;
+}
+
+void export_perm_cache_free(struct export_perm_cache *cache)
+{
+	pthread_spin_destroy(&cache->sp);
+	gsh_free(cache);
+}
+
+/**
+ * @brief Checks if a machine is authorized to access an export entry
+ *
+ * Same as export_check_access but reuses the decision made for an
+ * earlier request on the same connection.
+ *
+ * @param[in] xprt Transport the request came on
+ */
+void export_check_access_xprt(SVCXPRT *xprt)
+{
+	gsh_xprt_private_t *xu = xprt->xp_u1;
+	struct export_perm_cache *cache = xu != NULL ? xu->perm_cache : NULL;
+	uint64_t gen;
+	int i;
+
+	if (cache == NULL || isMidDebug(COMPONENT_EXPORT)) {
+		export_check_access();
+		return;
+	}
+
+	gen = atomic_fetch_uint64_t(&export_perms_gen);
+
+	pthread_spin_lock(&cache->sp);
+	for (i = 0; i < EXPORT_PERM_CACHE_SIZE; i++) {
+		if (cache->entry[i].gen == gen &&
+		    cache->entry[i].export == op_ctx->ctx_export) {
+			*op_ctx->export_perms = cache->entry[i].perms;
+			pthread_spin_unlock(&cache->sp);
+			return;
+		}
+	}
+	pthread_spin_unlock(&cache->sp);
+
+	export_check_access();
+
+	/* Tagged with the generation read before the check, so a change
+	 * made meanwhile leaves this entry stale.
+	 */
+	pthread_spin_lock(&cache->sp);
+	i = cache->next;
+	cache->next = (i + 1) % EXPORT_PERM_CACHE_SIZE;
+	cache->entry[i].export = op_ctx->ctx_export;
+	cache->entry[i].gen = gen;
+	cache->entry[i].perms = *op_ctx->export_perms;
+	pthread_spin_unlock(&cache->sp);
+}
@@ -37,19 +37,180 @@
 
 #include "config.h"
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "log.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #ifdef LINUX
 #include <sys/signal.h>
 #elif FREEBSD
 #include <signal.h>
 #endif
 #include "abstract_mem.h"
+#include "abstract_atomic.h"
 #include "fridgethr.h"
 #include "nfs_core.h"
 
+/**
+ * @brief Host NUMA topology, read once from sysfs
+ */
+
+#define FRIDGETHR_MAX_NODES 64
+
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+static int numa_nnodes = 1;
+static cpu_set_t numa_cpus[FRIDGETHR_MAX_NODES];
+static int16_t numa_cpu_to_node[CPU_SETSIZE];
+
+/**
+ * @brief Parse a sysfs cpulist ("0-3,8-11") into a CPU set
+ *
+ * @param[in]  list The list
+ * @param[out] set  CPUs in the list
+ *
+ * @return Number of CPUs in the list.
+ */
+
+static int numa_parse_cpulist(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+	char *end;
+	long lo, hi;
+
+	CPU_ZERO(set);
+
+	while (*p != '\0' && *p != '\n') {
+		lo = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		hi = lo;
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+		for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+			CPU_SET(lo, set);
+		p = (*end == ',') ? end + 1 : end;
+	}
+
+	return CPU_COUNT(set);
+}
+
+static void numa_topology_init(void)
+{
+	char path[64];
+	char list[4096];
+	cpu_set_t online;
+	FILE *f;
+	int node, cpu, n = 0;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		numa_cpu_to_node[cpu] = 0;
+
+	/* Node ids need not be contiguous, so take them from the online
+	 * list rather than stopping at the first missing one.
+	 */
+	CPU_ZERO(&online);
+	f = fopen("/sys/devices/system/node/online", "r");
+	if (f != NULL) {
+		if (fgets(list, sizeof(list), f) != NULL)
+			(void) numa_parse_cpulist(list, &online);
+		fclose(f);
+	}
+	if (CPU_COUNT(&online) == 0)
+		for (node = 0; node < FRIDGETHR_MAX_NODES; node++)
+			CPU_SET(node, &online);
+
+	for (node = 0; node < CPU_SETSIZE && n < FRIDGETHR_MAX_NODES;
+	     node++) {
+		if (!CPU_ISSET(node, &online))
+			continue;
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d/cpulist", node);
+		f = fopen(path, "r");
+		if (f == NULL)
+			continue;
+		if (fgets(list, sizeof(list), f) == NULL ||
+		    numa_parse_cpulist(list, &numa_cpus[n]) == 0) {
+			fclose(f);
+			continue;
+		}
+		fclose(f);
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &numa_cpus[n]))
+				numa_cpu_to_node[cpu] = n;
+		n++;
+	}
+
+	if (n > 0)
+		numa_nnodes = n;
+
+	LogInfo(COMPONENT_THREAD, "Found %d NUMA node(s)", numa_nnodes);
+}
+
+/**
+ * @brief Number of NUMA nodes with CPUs on this host
+ *
+ * @return Node count, 1 if the topology is not available.
+ */
+
+int fridgethr_numa_nodes(void)
+{
+	(void) pthread_once(&numa_once, numa_topology_init);
+	return numa_nnodes;
+}
+
+/**
+ * @brief Map a CPU to its NUMA node
+ *
+ * Nodes are numbered densely from 0, skipping memory-only nodes.
+ *
+ * @param[in] cpu CPU number
+ *
+ * @return Node index, 0 for unknown CPUs.
+ */
+
+int fridgethr_cpu_node(int cpu)
+{
+	(void) pthread_once(&numa_once, numa_topology_init);
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		return 0;
+	return numa_cpu_to_node[cpu];
+}
+
+/**
+ * @brief Bind the calling fridge thread to its NUMA node
+ *
+ * @param[in] fe The thread entry
+ */
+
+static void fridgethr_place(struct fridgethr_entry *fe)
+{
+	struct fridgethr *fr = fe->fr;
+	int node, rc;
+
+	fe->ctx.numa_node = -1;
+
+	if (!fr->p.numa_affinity || fridgethr_numa_nodes() < 2)
+		return;
+
+	node = atomic_postinc_uint32_t(&fr->next_node) % numa_nnodes;
+	rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+				    &numa_cpus[node]);
+	if (rc != 0) {
+		LogMajor(COMPONENT_THREAD,
+			 "Unable to bind thread in fridge %s to node %d: %d",
+			 fr->s, node, rc);
+		return;
+	}
+
+	fe->ctx.numa_node = node;
+}
+
 /**
  * @brief Initialize a thread fridge
  *
@@ -92,6 +253,16 @@ int fridgethr_init(struct fridgethr **frout, const char *s,
 		goto out;
 	}
 
+	if (p->work_stealing &&
+	    ((p->flavor != fridgethr_flavor_worker) ||
+	     (p->deferment != fridgethr_defer_queue) || (p->thr_max == 0))) {
+		LogMajor(COMPONENT_THREAD,
+			 "Work stealing needs a queueing worker fridge with a thread maximum: %s",
+			 s);
+		rc = EINVAL;
+		goto out;
+	}
+
 	*frout = NULL;
 
 	frobj->p = *p;
@@ -100,6 +271,7 @@ int fridgethr_init(struct fridgethr **frout, const char *s,
 	frobj->nthreads = 0;
 	frobj->nidle = 0;
 	frobj->flags = fridgethr_flag_none;
+	frobj->deques = NULL;
 
 	/* This always succeeds on Linux, but it might fail on other
 	   systems or future versions of Linux. */
@@ -186,6 +358,10 @@ int fridgethr_init(struct fridgethr **frout, const char *s,
 		goto out;
 	}
 
+	if (frobj->p.work_stealing)
+		frobj->deques = gsh_calloc(frobj->p.thr_max,
+					   sizeof(struct fridgethr_deque));
+
 	*frout = frobj;
 	rc = 0;
 
@@ -221,6 +397,7 @@ int fridgethr_init(struct fridgethr **frout, const char *s,
 
 void fridgethr_destroy(struct fridgethr *fr)
 {
+	gsh_free(fr->deques);
 	PTHREAD_MUTEX_destroy(&fr->mtx);
 	pthread_attr_destroy(&fr->attr);
 	gsh_free(fr->s);
@@ -265,6 +442,199 @@ static void fridgethr_finish_transition(struct fridgethr *fr, bool locked)
 	fr->transitioning = false;
 }
 
+/*
+ * Work stealing
+ *
+ * Each thread of a work stealing fridge owns a deque, after Chase and
+ * Lev.  Jobs a thread submits to its own fridge are pushed at the
+ * bottom and popped back from there when its current job is done, so
+ * a chain of jobs stays on one thread and never touches the fridge
+ * mutex.  An idle thread steals from the top of the others' deques.
+ *
+ * A deque belongs to the fridge.  A thread only gives its deque up
+ * once it found it empty, and only the owner pushes, so jobs are
+ * never left behind without a thread that will look at them.
+ */
+
+/** The fridge thread we are, if any */
+static __thread struct fridgethr_entry *fridgethr_self;
+
+/**
+ * @brief Push a job on our own deque
+ *
+ * @return false if the deque is full.
+ */
+
+static bool fridgethr_deque_push(struct fridgethr_deque *dq,
+				 void (*func)(struct fridgethr_context *),
+				 void *arg)
+{
+	uint64_t b = dq->bottom;
+	uint64_t t = atomic_fetch_uint64_t(&dq->top);
+	struct fridgethr_work *job;
+
+	if (b - t >= FRIDGETHR_DEQUE_SIZE)
+		return false;
+
+	job = &dq->jobs[b & (FRIDGETHR_DEQUE_SIZE - 1)];
+	job->func = func;
+	job->arg = arg;
+
+	/* Publish it */
+	atomic_store_uint64_t(&dq->bottom, b + 1);
+
+	return true;
+}
+
+/**
+ * @brief Pop the newest job of our own deque
+ */
+
+static bool fridgethr_deque_pop(struct fridgethr_deque *dq,
+				struct fridgethr_entry *fe)
+{
+	uint64_t b = dq->bottom;
+	uint64_t t = atomic_fetch_uint64_t(&dq->top);
+	struct fridgethr_work *job;
+	bool taken = true;
+
+	if (b == t)
+		return false;
+
+	/* Claim the bottom job, then see whether a thief got it */
+	b--;
+	atomic_store_uint64_t(&dq->bottom, b);
+	t = atomic_fetch_uint64_t(&dq->top);
+
+	if ((int64_t) (b - t) < 0) {
+		atomic_store_uint64_t(&dq->bottom, b + 1);
+		return false;
+	}
+
+	job = &dq->jobs[b & (FRIDGETHR_DEQUE_SIZE - 1)];
+
+	if (b == t) {
+		/* The last job, race the thieves for it */
+		taken = atomic_cas_uint64_t(&dq->top, t, t + 1);
+		atomic_store_uint64_t(&dq->bottom, b + 1);
+	}
+
+	if (taken) {
+		fe->ctx.func = job->func;
+		fe->ctx.arg = job->arg;
+	}
+
+	return taken;
+}
+
+/**
+ * @brief Steal the oldest job of a deque
+ *
+ * The job is read before it is claimed.  If the owner reused the slot
+ * meanwhile, top moved and the claim fails.
+ */
+
+static bool fridgethr_deque_steal(struct fridgethr_deque *dq,
+				  struct fridgethr_entry *fe)
+{
+	uint64_t t = atomic_fetch_uint64_t(&dq->top);
+	uint64_t b = atomic_fetch_uint64_t(&dq->bottom);
+	struct fridgethr_work job;
+
+	if ((int64_t) (b - t) <= 0)
+		return false;
+
+	job = dq->jobs[t & (FRIDGETHR_DEQUE_SIZE - 1)];
+
+	if (!atomic_cas_uint64_t(&dq->top, t, t + 1))
+		return false;
+
+	fe->ctx.func = job.func;
+	fe->ctx.arg = job.arg;
+
+	return true;
+}
+
+/**
+ * @brief Steal a job from any deque of the fridge
+ *
+ * Victims are tried starting past our own deque, so thieves spread.
+ */
+
+static bool fridgethr_steal(struct fridgethr *fr, struct fridgethr_entry *fe)
+{
+	uint32_t start = fe->deque != NULL ? fe->deque - fr->deques : 0;
+	uint32_t i;
+
+	for (i = 1; i <= fr->p.thr_max; i++) {
+		struct fridgethr_deque *dq =
+			&fr->deques[(start + i) % fr->p.thr_max];
+
+		if (dq != fe->deque && fridgethr_deque_steal(dq, fe))
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Test whether any deque of the fridge holds a job
+ */
+
+static bool fridgethr_ws_pending(struct fridgethr *fr)
+{
+	uint32_t i;
+
+	for (i = 0; i < fr->p.thr_max; i++) {
+		struct fridgethr_deque *dq = &fr->deques[i];
+
+		if ((int64_t) (atomic_fetch_uint64_t(&dq->bottom) -
+			       atomic_fetch_uint64_t(&dq->top)) > 0)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Give a new thread a deque
+ *
+ * @note The fridge mutex must be held.
+ */
+
+static void fridgethr_claim_deque(struct fridgethr *fr,
+				  struct fridgethr_entry *fe)
+{
+	uint32_t i;
+
+	fe->deque = NULL;
+
+	if (!fr->p.work_stealing)
+		return;
+
+	for (i = 0; i < fr->p.thr_max; i++) {
+		if (!fr->deques[i].owned) {
+			fr->deques[i].owned = true;
+			fe->deque = &fr->deques[i];
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Give up the deque of a thread
+ *
+ * @note The fridge mutex must be held.
+ */
+
+static void fridgethr_release_deque(struct fridgethr_entry *fe)
+{
+	if (fe->deque != NULL) {
+		fe->deque->owned = false;
+		fe->deque = NULL;
+	}
+}
+
 /**
  * @brief Test whether the fridge has deferred work waiting
  *
@@ -279,7 +649,8 @@ static bool fridgethr_deferredwork(struct fridgethr *fr)
 
 	switch (fr->p.deferment) {
 	case fridgethr_defer_queue:
-		res = !glist_empty(&fr->deferment.work_q);
+		res = !glist_empty(&fr->deferment.work_q) ||
+		      (fr->p.work_stealing && fridgethr_ws_pending(fr));
 		break;
 
 	case fridgethr_defer_block:
@@ -302,6 +673,9 @@ static bool fridgethr_deferredwork(struct fridgethr *fr)
  * and returns true.  If work is not available (or the fridge is not a
  * queueing fridge) it returns false and leaves the context untouched.
  *
+ * In a work stealing fridge our own deque comes first, then the
+ * queue, then the deques of the other threads.
+ *
  * @param[in,out] fr Fridge
  * @param[in,out] fe Fridge entry
  *
@@ -312,10 +686,14 @@ static bool fridgethr_deferredwork(struct fridgethr *fr)
 
 static bool fridgethr_getwork(struct fridgethr *fr, struct fridgethr_entry *fe)
 {
+	if (fr->p.work_stealing && fe->deque != NULL &&
+	    fridgethr_deque_pop(fe->deque, fe))
+		return true;
+
 	if ((fr->p.deferment == fridgethr_defer_block)
 	    || (fr->p.deferment == fridgethr_defer_fail)
 	    || glist_empty(&fr->deferment.work_q)) {
-		return false;
+		return fr->p.work_stealing && fridgethr_steal(fr, fe);
 	} else {
 		struct fridgethr_work *q =
 		    glist_first_entry(&fr->deferment.work_q,
@@ -355,6 +733,11 @@ static bool fridgethr_freeze(struct fridgethr *fr,
 	/* Return code from system calls */
 	int rc = 0;
 
+	/* Jobs we queued ourselves need no lock */
+	if (fe->deque != NULL && fr->command != fridgethr_comm_pause &&
+	    fridgethr_deque_pop(fe->deque, fe))
+		return true;
+
 	PTHREAD_MUTEX_lock(&fr->mtx);
  restart:
 	/* If we are not paused and there is work left to do in the
@@ -367,11 +750,13 @@ static bool fridgethr_freeze(struct fridgethr *fr,
 
 	/* rc would have been set in the while loop below */
 	if (((rc == ETIMEDOUT) && (fr->nthreads > fr->p.thr_min))
+	    || ((fr->p.thr_max != 0) && (fr->nthreads > fr->p.thr_max))
 	    || (fr->command == fridgethr_comm_stop)) {
 		/* We do this here since we already have the fridge
 		   lock. */
 		--(fr->nthreads);
 		glist_del(&fe->thread_link);
+		fridgethr_release_deque(fe);
 		if ((fr->nthreads == 0) && (fr->command == fridgethr_comm_stop)
 		    && (fr->transitioning) && !fridgethr_deferredwork(fr)) {
 			/* We're the last thread to exit, signal the
@@ -387,7 +772,17 @@ static bool fridgethr_freeze(struct fridgethr *fr,
 	assert(fr->command != fridgethr_comm_stop);
 
 	glist_add_tail(&fr->idle_q, &fe->idle_link);
-	++(fr->nidle);
+	atomic_inc_uint32_t(&fr->nidle);
+
+	/* A thread that pushed a job before it could see us idle left
+	   it for us. */
+	if (fr->p.work_stealing && (fr->command != fridgethr_comm_pause)
+	    && fridgethr_ws_pending(fr)) {
+		glist_del(&fe->idle_link);
+		--(fr->nidle);
+		goto restart;
+	}
+
 	if ((fr->nidle == fr->nthreads) && (fr->command == fridgethr_comm_pause)
 	    && (fr->transitioning)) {
 		/* We're the last thread to suspend, signal the
@@ -543,6 +938,9 @@ static void *fridgethr_start_routine(void *arg)
 	   which would indicate bugs in the code. */
 	assert(rc == 0);
 
+	fridgethr_place(fe);
+	fridgethr_self = fe;
+
 	if (fr->p.thread_initialize)
 		fr->p.thread_initialize(&fe->ctx);
 
@@ -617,6 +1015,7 @@ static int fridgethr_spawn(struct fridgethr *fr,
 	fe->ctx.func = func;
 	fe->ctx.arg = arg;
 	fe->frozen = false;
+	fridgethr_claim_deque(fr, fe);
 
 	rc = pthread_create(&fe->ctx.id, &fr->attr, fridgethr_start_routine,
 			    fe);
@@ -624,6 +1023,7 @@ static int fridgethr_spawn(struct fridgethr *fr,
 		LogMajor(COMPONENT_THREAD,
 			 "Unable to create new thread in fridge %s: %d",
 			 fr->s, rc);
+		fridgethr_release_deque(fe);
 		goto create_err;
 	}
 #ifdef LINUX
@@ -803,6 +1203,86 @@ static int fridgethr_block(struct fridgethr *fr,
 	return rc;
 }
 
+/**
+ * @brief Slightly stupid workaround for an unlikely case
+ *
+ * @param[in] dummy Ignored
+ */
+static void fridgethr_noop(struct fridgethr_context *dummy)
+{
+	/* return */
+}
+
+/**
+ * @brief Wake an idle thread to look for work
+ *
+ * @note The fridge mutex must be held.
+ *
+ * @return true if a thread was woken.
+ */
+
+static bool fridgethr_wake_one(struct fridgethr *fr)
+{
+	struct glist_head *g = NULL;
+	bool woke = false;
+
+	glist_for_each(g, &fr->idle_q) {
+		struct fridgethr_entry *fe =
+		    container_of(g, struct fridgethr_entry, idle_link);
+
+		PTHREAD_MUTEX_lock(&fe->ctx.mtx);
+		if (fe->flags & fridgethr_flag_available) {
+			pthread_cond_signal(&fe->ctx.cv);
+			woke = true;
+		}
+		PTHREAD_MUTEX_unlock(&fe->ctx.mtx);
+
+		if (woke)
+			break;
+	}
+
+	return woke;
+}
+
+/**
+ * @brief Submit a job from a thread of the fridge to its own deque
+ *
+ * The fridge mutex is only taken when an idle thread can be woken or
+ * a new one started to steal the job.  Otherwise the job waits for
+ * the current one of this thread.
+ *
+ * @return true if the job was pushed.
+ */
+
+static bool fridgethr_ws_submit(struct fridgethr *fr,
+				void (*func)(struct fridgethr_context *),
+				void *arg)
+{
+	struct fridgethr_entry *fe = fridgethr_self;
+
+	if (fe == NULL || fe->fr != fr || fe->deque == NULL ||
+	    fr->command != fridgethr_comm_run)
+		return false;
+
+	if (!fridgethr_deque_push(fe->deque, func, arg))
+		return false;
+
+	if (atomic_fetch_uint32_t(&fr->nidle) == 0 &&
+	    atomic_fetch_uint32_t(&fr->nthreads) >= fr->p.thr_max)
+		return true;
+
+	PTHREAD_MUTEX_lock(&fr->mtx);
+	if (!fridgethr_wake_one(fr) && (fr->command == fridgethr_comm_run)
+	    && (fr->nthreads < fr->p.thr_max)) {
+		/* It unlocks the fridge */
+		(void) fridgethr_spawn(fr, fridgethr_noop, NULL);
+		return true;
+	}
+	PTHREAD_MUTEX_unlock(&fr->mtx);
+
+	return true;
+}
+
 /**
  * @brief Schedule a thread to perform a function
  *
@@ -833,6 +1313,9 @@ int fridgethr_submit(struct fridgethr *fr,
 		return EPIPE;
 	}
 
+	if (fr->p.work_stealing && fridgethr_ws_submit(fr, func, arg))
+		return 0;
+
 	PTHREAD_MUTEX_lock(&fr->mtx);
 	if (fr->command == fridgethr_comm_stop) {
 		LogMajor(COMPONENT_THREAD,
@@ -995,16 +1478,6 @@ int fridgethr_pause(struct fridgethr *fr, pthread_mutex_t *mtx,
 	return 0;
 }
 
-/**
- * @brief Slightly stupid workaround for an unlikely case
- *
- * @param[in] dummy Ignored
- */
-static void fridgethr_noop(struct fridgethr_context *dummy)
-{
-	/* return */
-}
-
 /**
  * @brief Stop execution in the fridge
  *
@@ -1331,8 +1804,9 @@ int fridgethr_sync_command(struct fridgethr *fr, fridgethr_comm_t command,
 /**
  * @brief Return true if a looper function should return
  *
- * For the moment, this checks if we're in the middle of a state
- * transition.
+ * This checks if we're in the middle of a state transition, or if
+ * the fridge was shrunk below its current thread count, in which case
+ * the thread will exit once it is back in the fridge.
  *
  * @param[in] ctx The thread context
  *
@@ -1348,7 +1822,9 @@ bool fridgethr_you_should_break(struct fridgethr_context *ctx)
 	struct fridgethr *fr = fe->fr;
 
 	/* No locking is needed as it is only read */
-	return fr->transitioning;
+	return fr->transitioning ||
+	       ((fr->p.thr_max != 0) &&
+		(atomic_fetch_uint32_t(&fr->nthreads) > fr->p.thr_max));
 }
 
 /**
@@ -1363,6 +1839,65 @@ bool fridgethr_you_should_break(struct fridgethr_context *ctx)
  * @retval Other codes from thread creation.
  */
 
+/**
+ * @brief Start one thread running a function
+ *
+ * @note The fridge mutex must be held.
+ *
+ * @param[in,out] fr   Fridge to add the thread to
+ * @param[in]     func Function the thread should run
+ * @param[in]     arg  Argument supplied for that function
+ *
+ * @return 0 on success or POSIX error codes.
+ */
+
+static int fridgethr_add_thread(struct fridgethr *fr,
+				void (*func)(struct fridgethr_context *),
+				void *arg)
+{
+	struct fridgethr_entry *fe = NULL;
+	int rc = 0;
+
+	fe = gsh_calloc(1, sizeof(struct fridgethr_entry));
+
+	/* Make a new thread */
+	++(fr->nthreads);
+
+	glist_add_tail(&fr->thread_list, &fe->thread_link);
+
+	fe->fr = fr;
+	rc = pthread_mutex_init(&fe->ctx.mtx, NULL);
+	if (rc != 0) {
+		LogMajor(COMPONENT_THREAD,
+			 "Unable to initialize mutex for new thread in fridge %s: %d",
+			 fr->s, rc);
+		return rc;
+	}
+	rc = pthread_cond_init(&fe->ctx.cv, NULL);
+	if (rc != 0) {
+		LogMajor(COMPONENT_THREAD,
+			 "Unable to initialize condition variable for new thread in fridge %s: %d",
+			 fr->s, rc);
+		return rc;
+	}
+
+	fe->ctx.func = func;
+	fe->ctx.arg = arg;
+	fe->frozen = false;
+	fridgethr_claim_deque(fr, fe);
+
+	rc = pthread_create(&fe->ctx.id, &fr->attr,
+			    fridgethr_start_routine, fe);
+	if (rc != 0) {
+		LogMajor(COMPONENT_THREAD,
+			 "Unable to create new thread in fridge %s: %d",
+			 fr->s, rc);
+		return rc;
+	}
+
+	return 0;
+}
+
 int fridgethr_populate(struct fridgethr *fr,
 		      void (*func)(struct fridgethr_context *), void *arg)
 {
@@ -1383,51 +1918,71 @@ int fridgethr_populate(struct fridgethr *fr,
 	}
 
 	for (i = 0; i < threads_to_run; ++i) {
-		struct fridgethr_entry *fe = NULL;
-		int rc = 0;
+		int rc = fridgethr_add_thread(fr, func, arg);
 
-		fe = gsh_calloc(1, sizeof(struct fridgethr_entry));
-
-		/* Make a new thread */
-		++(fr->nthreads);
-
-		glist_add_tail(&fr->thread_list, &fe->thread_link);
-
-		fe->fr = fr;
-		rc = pthread_mutex_init(&fe->ctx.mtx, NULL);
-		if (rc != 0) {
-			LogMajor(COMPONENT_THREAD,
-				 "Unable to initialize mutex for new thread in fridge %s: %d",
-				 fr->s, rc);
-			PTHREAD_MUTEX_unlock(&fr->mtx);
-			return rc;
-		}
-		rc = pthread_cond_init(&fe->ctx.cv, NULL);
 		if (rc != 0) {
-			LogMajor(COMPONENT_THREAD,
-				 "Unable to initialize condition variable for new thread in fridge %s: %d",
-				 fr->s, rc);
 			PTHREAD_MUTEX_unlock(&fr->mtx);
 			return rc;
 		}
+	}
+	PTHREAD_MUTEX_unlock(&fr->mtx);
 
-		fe->ctx.func = func;
-		fe->ctx.arg = arg;
-		fe->frozen = false;
+	return 0;
+}
 
-		rc = pthread_create(&fe->ctx.id, &fr->attr,
-				    fridgethr_start_routine, fe);
-		if (rc != 0) {
-			LogMajor(COMPONENT_THREAD,
-				 "Unable to create new thread in fridge %s: %d",
-				 fr->s, rc);
-			PTHREAD_MUTEX_unlock(&fr->mtx);
-			return rc;
-		}
+/**
+ * @brief Change the thread count of a populated fridge
+ *
+ * The fridge is kept at exactly @c nthreads threads, as
+ * fridgethr_populate() leaves it.  Growing starts the new threads
+ * running @c func at once.  Shrinking lets threads finish what they
+ * are doing; the extra ones exit as they next return to the fridge,
+ * which loopers do when fridgethr_you_should_break() tells them to.
+ *
+ * Work stealing fridges size their deques at init and can't be
+ * resized.
+ *
+ * @param[in,out] fr       Fridge to resize
+ * @param[in]     nthreads New thread count, at least 1
+ * @param[in]     func     Function new threads should run
+ * @param[in]     arg      Argument supplied for that function
+ *
+ * @retval 0 on success.
+ * @retval EINVAL if the fridge can't be resized to that.
+ * @retval Other codes from thread creation.
+ */
+
+int fridgethr_resize(struct fridgethr *fr, uint32_t nthreads,
+		     void (*func)(struct fridgethr_context *), void *arg)
+{
+	int rc = 0;
+
+	if (nthreads == 0 || fr->p.work_stealing)
+		return EINVAL;
+
+	PTHREAD_MUTEX_lock(&fr->mtx);
+
+	if (fr->command != fridgethr_comm_run) {
+		PTHREAD_MUTEX_unlock(&fr->mtx);
+		return EINVAL;
 	}
+
+	fr->p.thr_min = nthreads;
+	fr->p.thr_max = nthreads;
+
+	while (rc == 0 && fr->nthreads < nthreads)
+		rc = fridgethr_add_thread(fr, func, arg);
+
 	PTHREAD_MUTEX_unlock(&fr->mtx);
 
-	return 0;
+	/* Wake idle threads so the extra ones notice and go */
+	if (rc == 0 && fr->p.wake_threads != NULL)
+		fr->p.wake_threads(fr->p.wake_threads_arg);
+
+	LogEvent(COMPONENT_THREAD, "Fridge %s resized to %" PRIu32 " threads",
+		 fr->s, nthreads);
+
+	return rc;
 }
 
 /**
@@ -1515,6 +2070,7 @@ int general_fridge_init(void)
 	frp.thr_min = 0;
 	frp.flavor = fridgethr_flavor_worker;
 	frp.deferment = fridgethr_defer_queue;
+	frp.work_stealing = true;
 
 	rc = fridgethr_init(&general_fridge, "Gen_Fridge", &frp);
 	if (rc != 0) {
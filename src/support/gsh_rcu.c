@@ -0,0 +1,95 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @file gsh_rcu.c
+ * @brief Read side sections for tables read on every request
+ *
+ * Each reader counts itself in its thread's shard of the current
+ * phase.  Readers increment their counter before they load a published
+ * pointer, so when a writer sees a counter at zero after unpublishing,
+ * every reader it did not wait for will load the new value.  Flipping
+ * the phase keeps new readers off the counters being drained, and both
+ * phases are drained so a reader that picked its phase before an
+ * earlier flip is not missed.
+ */
+
+#include "config.h"
+
+#include <sched.h>
+#include "common_utils.h"
+#include "gsh_rcu.h"
+
+/* shard of the calling thread, assigned round-robin on first use */
+__thread int32_t gsh_rcu_shard = -1;
+static uint32_t gsh_rcu_shard_next;
+
+int32_t gsh_rcu_shard_assign(void)
+{
+	gsh_rcu_shard = atomic_inc_uint32_t(&gsh_rcu_shard_next) &
+			(GSH_RCU_SHARDS - 1);
+	return gsh_rcu_shard;
+}
+
+void gsh_rcu_init(struct gsh_rcu *rcu)
+{
+	memset(rcu->readers, 0, sizeof(rcu->readers));
+	rcu->phase = 0;
+	PTHREAD_MUTEX_init(&rcu->mutex, NULL);
+}
+
+void gsh_rcu_destroy(struct gsh_rcu *rcu)
+{
+	PTHREAD_MUTEX_destroy(&rcu->mutex);
+}
+
+static void gsh_rcu_drain(struct gsh_rcu *rcu, uint32_t phase)
+{
+	int i;
+
+	for (i = 0; i < GSH_RCU_SHARDS; i++)
+		while (atomic_fetch_int64_t(&rcu->readers[phase][i].count)
+		       != 0)
+			sched_yield();
+}
+
+/**
+ * @brief Wait for the read side sections in progress
+ *
+ * Once this returns, no reader can still be using a value it loaded
+ * before the call.  Must not be called from a read side section.
+ *
+ * @param[in] rcu The table's read side state
+ */
+void gsh_rcu_synchronize(struct gsh_rcu *rcu)
+{
+	uint32_t phase;
+
+	PTHREAD_MUTEX_lock(&rcu->mutex);
+
+	phase = atomic_fetch_uint32_t(&rcu->phase) & 1;
+	atomic_store_uint32_t(&rcu->phase, phase ^ 1);
+	gsh_rcu_drain(rcu, phase);
+	atomic_store_uint32_t(&rcu->phase, phase);
+	gsh_rcu_drain(rcu, phase ^ 1);
+
+	PTHREAD_MUTEX_unlock(&rcu->mutex);
+}
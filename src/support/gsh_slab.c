@@ -0,0 +1,428 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup gsh_slab
+ * @{
+ */
+
+/**
+ * @file gsh_slab.c
+ * @brief Typed object slabs with per-thread magazines
+ */
+
+#include "config.h"
+#include <string.h>
+#include <pthread.h>
+#include "log.h"
+#include "abstract_mem.h"
+#include "common_utils.h"
+#include "gsh_slab.h"
+#ifdef USE_DBUS
+#include "gsh_dbus.h"
+#include "server_stats_private.h"
+#endif
+
+/** Objects held by one thread's magazine */
+#define GSH_SLAB_MAG 32
+
+struct gsh_slab_mag {
+	struct glist_head list;	/*< Link in mags of the slab */
+	struct gsh_slab *slab;
+	uint64_t allocs;	/*< Objects handed out by this thread */
+	uint64_t frees;		/*< Objects given back by this thread */
+	uint64_t hits;		/*< Objects handed out not from the heap */
+	uint32_t count;
+	void *objs[GSH_SLAB_MAG];
+};
+
+/** All slabs set up so far, for stats */
+static struct glist_head gsh_slabs = GLIST_HEAD_INIT(gsh_slabs);
+static pthread_mutex_t gsh_slabs_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Get a new object from the heap
+ *
+ * @param[in] slab  The slab
+ *
+ * @return The object, zeroed or constructed.
+ */
+static void *gsh_slab_heap_alloc(struct gsh_slab *slab)
+{
+	void *obj;
+
+	if (slab->ctor == NULL)
+		return gsh_calloc(1, slab->size);
+
+	obj = gsh_malloc(slab->size);
+	slab->ctor(obj);
+	return obj;
+}
+
+/**
+ * @brief Give an object back to the heap
+ *
+ * @param[in] slab  The slab
+ * @param[in] obj   The object
+ */
+static void gsh_slab_heap_free(struct gsh_slab *slab, void *obj)
+{
+	if (slab->dtor != NULL)
+		slab->dtor(obj);
+	gsh_free(obj);
+}
+
+/**
+ * @brief Return objects to the shared list, or the heap once it is full
+ *
+ * @param[in] mag    Magazine to take objects from
+ * @param[in] count  Number of objects to take from the top of mag
+ */
+static void gsh_slab_flush(struct gsh_slab_mag *mag, uint32_t count)
+{
+	struct gsh_slab *slab = mag->slab;
+	void *obj;
+
+	PTHREAD_MUTEX_lock(&slab->mtx);
+	while (count-- > 0) {
+		obj = mag->objs[--mag->count];
+		if (slab->count < slab->max) {
+			*(void **)obj = slab->head;
+			slab->head = obj;
+			++slab->count;
+		} else {
+			gsh_slab_heap_free(slab, obj);
+		}
+	}
+	PTHREAD_MUTEX_unlock(&slab->mtx);
+}
+
+/**
+ * @brief Thread exit destructor for a magazine
+ *
+ * @param[in] arg  The magazine
+ */
+static void gsh_slab_mag_release(void *arg)
+{
+	struct gsh_slab_mag *mag = arg;
+	struct gsh_slab *slab = mag->slab;
+
+	gsh_slab_flush(mag, mag->count);
+
+	PTHREAD_MUTEX_lock(&slab->mtx);
+	glist_del(&mag->list);
+	slab->allocs += mag->allocs;
+	slab->frees += mag->frees;
+	slab->hits += mag->hits;
+	PTHREAD_MUTEX_unlock(&slab->mtx);
+
+	gsh_free(mag);
+}
+
+/**
+ * @brief Set up a slab on first use
+ *
+ * @param[in] slab  The slab
+ */
+static void gsh_slab_setup(struct gsh_slab *slab)
+{
+	int rc;
+
+	PTHREAD_MUTEX_lock(&gsh_slabs_mtx);
+
+	if (slab->ready)
+		goto out;
+
+	rc = pthread_key_create(&slab->key, gsh_slab_mag_release);
+	if (rc != 0) {
+		/* Not fatal, objects come straight from the heap */
+		LogMajor(COMPONENT_MEM_ALLOC,
+			 "Unable to create %s slab key, error code %d.",
+			 slab->name, rc);
+		goto out;
+	}
+
+	glist_init(&slab->mags);
+	glist_add_tail(&gsh_slabs, &slab->slabs);
+	__sync_synchronize();
+	slab->ready = true;
+
+ out:
+	PTHREAD_MUTEX_unlock(&gsh_slabs_mtx);
+}
+
+/**
+ * @brief Get this thread's magazine, creating it on first use
+ *
+ * @param[in] slab  The slab
+ *
+ * @return The magazine, or NULL if the slab could not be set up.
+ */
+static inline struct gsh_slab_mag *gsh_slab_get_mag(struct gsh_slab *slab)
+{
+	struct gsh_slab_mag *mag;
+
+	if (unlikely(!slab->ready)) {
+		gsh_slab_setup(slab);
+		if (!slab->ready)
+			return NULL;
+	}
+
+	mag = pthread_getspecific(slab->key);
+	if (likely(mag != NULL))
+		return mag;
+
+	mag = gsh_calloc(1, sizeof(*mag));
+	mag->slab = slab;
+	(void) pthread_setspecific(slab->key, mag);
+
+	PTHREAD_MUTEX_lock(&slab->mtx);
+	glist_add_tail(&slab->mags, &mag->list);
+	PTHREAD_MUTEX_unlock(&slab->mtx);
+
+	return mag;
+}
+
+/**
+ * @brief Take an object from a slab, or the heap if it is empty
+ *
+ * @param[in] slab  The slab
+ *
+ * @return The object, zeroed unless the slab has a constructor.
+ */
+void *gsh_slab_alloc(struct gsh_slab *slab)
+{
+	struct gsh_slab_mag *mag = gsh_slab_get_mag(slab);
+	void *obj;
+
+	if (mag == NULL)
+		return gsh_slab_heap_alloc(slab);
+
+	mag->allocs++;
+
+	if (mag->count == 0 && slab->count != 0) {
+		PTHREAD_MUTEX_lock(&slab->mtx);
+		while (mag->count < GSH_SLAB_MAG / 2 && slab->head != NULL) {
+			obj = slab->head;
+			slab->head = *(void **)obj;
+			--slab->count;
+			mag->objs[mag->count++] = obj;
+		}
+		PTHREAD_MUTEX_unlock(&slab->mtx);
+	}
+
+	if (mag->count == 0)
+		return gsh_slab_heap_alloc(slab);
+
+	mag->hits++;
+	obj = mag->objs[--mag->count];
+	if (slab->ctor == NULL)
+		memset(obj, 0, slab->size);
+
+	return obj;
+}
+
+/**
+ * @brief Give an object back to its slab
+ *
+ * @param[in] slab  The slab
+ * @param[in] obj   The object
+ */
+void gsh_slab_free(struct gsh_slab *slab, void *obj)
+{
+	struct gsh_slab_mag *mag = gsh_slab_get_mag(slab);
+
+	if (mag == NULL) {
+		gsh_slab_heap_free(slab, obj);
+		return;
+	}
+
+	mag->frees++;
+
+	if (mag->count == GSH_SLAB_MAG)
+		gsh_slab_flush(mag, GSH_SLAB_MAG / 2);
+
+	mag->objs[mag->count++] = obj;
+}
+
+/**
+ * @brief Return everything a slab holds to the heap
+ *
+ * Only for slabs none of whose objects are in use any more, such as
+ * the slab of a module being unloaded.  The slab may be used again
+ * afterwards, it is set up anew.
+ *
+ * @param[in] slab  The slab
+ */
+void gsh_slab_destroy(struct gsh_slab *slab)
+{
+	struct glist_head *glist, *glistn;
+	struct gsh_slab_mag *mag;
+	void *obj;
+
+	PTHREAD_MUTEX_lock(&gsh_slabs_mtx);
+
+	if (!slab->ready) {
+		PTHREAD_MUTEX_unlock(&gsh_slabs_mtx);
+		return;
+	}
+
+	glist_del(&slab->slabs);
+	slab->ready = false;
+
+	PTHREAD_MUTEX_unlock(&gsh_slabs_mtx);
+
+	/* Destructors do not run for a deleted key, so no thread will
+	 * touch its magazine again.
+	 */
+	(void) pthread_key_delete(slab->key);
+
+	PTHREAD_MUTEX_lock(&slab->mtx);
+
+	while (slab->head != NULL) {
+		obj = slab->head;
+		slab->head = *(void **)obj;
+		gsh_slab_heap_free(slab, obj);
+	}
+	slab->count = 0;
+
+	glist_for_each_safe(glist, glistn, &slab->mags) {
+		mag = glist_entry(glist, struct gsh_slab_mag, list);
+		glist_del(&mag->list);
+		while (mag->count > 0)
+			gsh_slab_heap_free(slab, mag->objs[--mag->count]);
+		gsh_free(mag);
+	}
+
+	slab->allocs = 0;
+	slab->frees = 0;
+	slab->hits = 0;
+
+	PTHREAD_MUTEX_unlock(&slab->mtx);
+}
+
+/**
+ * @brief Add up slab memory by subsystem
+ *
+ * Adds the bytes of every slab's objects, in use or held free, and its
+ * allocations to the entries for its tag.  Like the D-Bus report the
+ * counts of running threads are only approximate.
+ *
+ * @param[in,out] bytes  GSH_MEM_TAG_COUNT byte counts
+ * @param[in,out] allocs GSH_MEM_TAG_COUNT allocation counts
+ */
+void gsh_slab_mem_usage(int64_t *bytes, int64_t *allocs)
+{
+	struct glist_head *gs, *gm;
+	struct gsh_slab *slab;
+	struct gsh_slab_mag *mag;
+	int64_t objs, slab_allocs;
+
+	PTHREAD_MUTEX_lock(&gsh_slabs_mtx);
+	glist_for_each(gs, &gsh_slabs) {
+		slab = glist_entry(gs, struct gsh_slab, slabs);
+
+		PTHREAD_MUTEX_lock(&slab->mtx);
+		slab_allocs = slab->allocs;
+		objs = slab->allocs - slab->frees + slab->count;
+		glist_for_each(gm, &slab->mags) {
+			mag = glist_entry(gm, struct gsh_slab_mag, list);
+			slab_allocs += mag->allocs;
+			objs += mag->allocs - mag->frees + mag->count;
+		}
+		PTHREAD_MUTEX_unlock(&slab->mtx);
+
+		bytes[slab->tag] += objs * slab->size;
+		allocs[slab->tag] += slab_allocs;
+	}
+	PTHREAD_MUTEX_unlock(&gsh_slabs_mtx);
+}
+
+#ifdef USE_DBUS
+/**
+ * @brief Report slab occupancy
+ *
+ * Appends the timestamp and for each slab its name, object size,
+ * objects in use, free objects held (shared and in magazines),
+ * allocations and allocations that did not go to the heap.  Counts
+ * from running threads are read without stopping them, so they are
+ * only approximate.
+ */
+void gsh_slab_dbus_show(DBusMessageIter *iter)
+{
+	struct timespec timestamp;
+	DBusMessageIter array_iter, struct_iter;
+	struct glist_head *gs, *gm;
+	struct gsh_slab *slab;
+	struct gsh_slab_mag *mag;
+	uint64_t size, in_use, cached, allocs, hits;
+	char *name;
+
+	now(&timestamp);
+	dbus_append_timestamp(iter, &timestamp);
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "(sttttt)",
+					 &array_iter);
+
+	PTHREAD_MUTEX_lock(&gsh_slabs_mtx);
+	glist_for_each(gs, &gsh_slabs) {
+		slab = glist_entry(gs, struct gsh_slab, slabs);
+
+		PTHREAD_MUTEX_lock(&slab->mtx);
+		allocs = slab->allocs;
+		in_use = slab->allocs - slab->frees;
+		hits = slab->hits;
+		cached = slab->count;
+		glist_for_each(gm, &slab->mags) {
+			mag = glist_entry(gm, struct gsh_slab_mag, list);
+			allocs += mag->allocs;
+			in_use += mag->allocs - mag->frees;
+			hits += mag->hits;
+			cached += mag->count;
+		}
+		PTHREAD_MUTEX_unlock(&slab->mtx);
+
+		name = (char *) slab->name;
+		size = slab->size;
+
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &struct_iter);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &name);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &size);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &in_use);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &cached);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &allocs);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &hits);
+		dbus_message_iter_close_container(&array_iter, &struct_iter);
+	}
+	PTHREAD_MUTEX_unlock(&gsh_slabs_mtx);
+
+	dbus_message_iter_close_container(iter, &array_iter);
+}
+#endif
+
+/** @} */
@@ -0,0 +1,374 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup iobuf_pool
+ * @{
+ */
+
+/**
+ * @file iobuf_pool.c
+ * @brief Shared aligned I/O buffer pool
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include "log.h"
+#include "abstract_mem.h"
+#include "abstract_atomic.h"
+#include "common_utils.h"
+#include "nfs_core.h"
+#include "iobuf_pool.h"
+#ifdef USE_DBUS
+#include "gsh_dbus.h"
+#include "server_stats_private.h"
+#endif
+
+/** Huge page size used to round regions */
+#define IOBUF_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+struct iobuf_class {
+	char *base;		/*< Start of the region */
+	size_t len;		/*< Length of the region */
+	size_t size;		/*< Size of each buffer */
+	uint32_t count;		/*< Buffers in the region */
+	pthread_mutex_t lock;	/*< Protects free and in_use */
+	void *free;		/*< Freelist, linked through the buffers */
+	uint32_t in_use;	/*< Buffers handed out */
+	uint64_t gets;		/*< Buffers handed out from the region */
+	uint64_t misses;	/*< Requests served from the heap */
+};
+
+static struct iobuf_class iobuf_classes[IOBUF_MAX_CLASSES];
+static unsigned int iobuf_nclasses;
+static bool iobuf_hugepages;
+static uint64_t iobuf_oversize;
+
+/**
+ * @brief Map and pre-fault one region
+ *
+ * Explicit huge pages are tried first when asked for.  If none are
+ * reserved, fall back to normal pages and let transparent huge pages
+ * back the region where the kernel supports it.
+ *
+ * @param[in]  len  Length of the region
+ * @param[out] huge Set if the region is backed by explicit huge pages
+ *
+ * @return The region, or NULL.
+ */
+static char *iobuf_map(size_t len, bool *huge)
+{
+	char *base = MAP_FAILED;
+	size_t off;
+
+	*huge = false;
+
+#ifdef MAP_HUGETLB
+	if (nfs_param.core_param.iobuf.hugepages) {
+		base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (base != MAP_FAILED)
+			*huge = true;
+	}
+#endif
+
+	if (base == MAP_FAILED) {
+		base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		if (nfs_param.core_param.iobuf.hugepages)
+			(void) madvise(base, len, MADV_HUGEPAGE);
+#endif
+	}
+
+	/* Fault the whole region in now rather than on the I/O path */
+	for (off = 0; off < len; off += IOBUF_ALIGN)
+		base[off] = 0;
+
+	return base;
+}
+
+/**
+ * @brief Set up the buffer pool
+ *
+ * Size classes grow by a factor of four from IOBUF_MIN_SIZE, the last
+ * one being IOBuf_Max_Size.  IOBuf_Pool_Bytes is split evenly between
+ * them, with at least one buffer per class.  A zero budget leaves the
+ * pool empty so every request goes to the heap.
+ */
+void iobuf_pool_pkginit(void)
+{
+	uint64_t budget = nfs_param.core_param.iobuf.pool_bytes;
+	size_t max_size = roundup(nfs_param.core_param.iobuf.max_size,
+				  IOBUF_ALIGN);
+	size_t size;
+	unsigned int i;
+	bool huge = true;
+
+	if (budget == 0)
+		return;
+
+	for (size = IOBUF_MIN_SIZE;
+	     iobuf_nclasses < IOBUF_MAX_CLASSES;
+	     size *= 4) {
+		if (size >= max_size || iobuf_nclasses == IOBUF_MAX_CLASSES - 1)
+			size = max_size;
+		iobuf_classes[iobuf_nclasses++].size = size;
+		if (size == max_size)
+			break;
+	}
+
+	for (i = 0; i < iobuf_nclasses; i++) {
+		struct iobuf_class *c = &iobuf_classes[i];
+		bool region_huge;
+		uint32_t j;
+
+		c->count = MAX(budget / iobuf_nclasses / c->size, 1);
+		c->len = (size_t) c->count * c->size;
+		if (nfs_param.core_param.iobuf.hugepages) {
+			/* Hand the slack at the end of the last huge page
+			 * out as extra buffers. */
+			c->len = roundup(c->len, IOBUF_HUGEPAGE_SIZE);
+			c->count = c->len / c->size;
+		}
+
+		PTHREAD_MUTEX_init(&c->lock, NULL);
+		c->base = iobuf_map(c->len, &region_huge);
+		if (c->base == NULL) {
+			LogWarn(COMPONENT_INIT,
+				"Could not map %zu bytes of %zu byte I/O buffers, errno=%d",
+				c->len, c->size, errno);
+			c->len = 0;
+			c->count = 0;
+			huge = false;
+			continue;
+		}
+		huge &= region_huge;
+
+		for (j = c->count; j > 0; j--) {
+			void *buf = c->base + (size_t) (j - 1) * c->size;
+
+			*(void **)buf = c->free;
+			c->free = buf;
+		}
+
+		LogInfo(COMPONENT_INIT,
+			"I/O buffer pool: %"PRIu32" buffers of %zu bytes%s",
+			c->count, c->size,
+			region_huge ? " on huge pages" : "");
+	}
+
+	iobuf_hugepages = huge;
+}
+
+static struct iobuf_class *iobuf_class_of(const void *buf)
+{
+	const char *p = buf;
+	unsigned int i;
+
+	for (i = 0; i < iobuf_nclasses; i++) {
+		struct iobuf_class *c = &iobuf_classes[i];
+
+		if (p >= c->base && p < c->base + c->len)
+			return c;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Borrow an I/O buffer
+ *
+ * The buffer is IOBUF_ALIGN aligned and at least @a size bytes.  It
+ * comes from the smallest size class that fits, or from the heap when
+ * that class is empty or @a size exceeds the largest class.
+ *
+ * @param[in] size Bytes needed
+ *
+ * @return The buffer, to be returned with iobuf_put().
+ */
+void *iobuf_get(size_t size)
+{
+	unsigned int i;
+	void *buf;
+
+	for (i = 0; i < iobuf_nclasses; i++) {
+		struct iobuf_class *c = &iobuf_classes[i];
+
+		if (c->size < size)
+			continue;
+
+		PTHREAD_MUTEX_lock(&c->lock);
+		buf = c->free;
+		if (buf != NULL) {
+			c->free = *(void **)buf;
+			c->in_use++;
+			c->gets++;
+		} else {
+			c->misses++;
+		}
+		PTHREAD_MUTEX_unlock(&c->lock);
+
+		if (buf != NULL)
+			return buf;
+
+		return gsh_malloc_aligned(IOBUF_ALIGN, size);
+	}
+
+	if (iobuf_nclasses != 0)
+		(void) atomic_inc_uint64_t(&iobuf_oversize);
+
+	return gsh_malloc_aligned(IOBUF_ALIGN, size);
+}
+
+/**
+ * @brief Return a buffer obtained from iobuf_get()
+ *
+ * @param[in] buf The buffer, may be NULL
+ */
+void iobuf_put(void *buf)
+{
+	struct iobuf_class *c;
+
+	if (buf == NULL)
+		return;
+
+	c = iobuf_class_of(buf);
+	if (c == NULL) {
+		gsh_free(buf);
+		return;
+	}
+
+	PTHREAD_MUTEX_lock(&c->lock);
+	*(void **)buf = c->free;
+	c->free = buf;
+	c->in_use--;
+	PTHREAD_MUTEX_unlock(&c->lock);
+}
+
+/**
+ * @brief Check whether a buffer lies in one of the pool's regions
+ *
+ * FSALs that registered the regions use this to tell buffers they can
+ * hand to the device directly from heap fallbacks that need bouncing.
+ *
+ * @param[in] buf The buffer
+ *
+ * @return true if the buffer belongs to the pool.
+ */
+bool iobuf_is_pooled(const void *buf)
+{
+	return iobuf_class_of(buf) != NULL;
+}
+
+/**
+ * @brief Walk the pool's regions
+ *
+ * Regions are set up before exports are created and stay put until
+ * shutdown, so an FSAL can register them (ibv_reg_mr(), fixed io_uring
+ * buffers and the like) once when its export is created.
+ *
+ * @param[in] cb  Called for each region
+ * @param[in] arg Passed to @a cb
+ *
+ * @return 0, or the first non-zero value returned by @a cb.
+ */
+int iobuf_pool_foreach_region(iobuf_region_cb cb, void *arg)
+{
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < iobuf_nclasses; i++) {
+		struct iobuf_class *c = &iobuf_classes[i];
+
+		if (c->base == NULL)
+			continue;
+
+		rc = cb(c->base, c->len, c->size, arg);
+		if (rc != 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+#ifdef USE_DBUS
+/**
+ * @brief Report pool sizing and usage
+ *
+ * Appends the timestamp, whether all regions are on explicit huge
+ * pages, the number of requests larger than the largest class, and
+ * for each class its buffer size, buffer count, buffers in use,
+ * buffers handed out and requests that fell back to the heap.
+ */
+void iobuf_pool_dbus_show(DBusMessageIter *iter)
+{
+	struct timespec timestamp;
+	DBusMessageIter array_iter, struct_iter;
+	dbus_bool_t huge = iobuf_hugepages;
+	uint64_t val;
+	unsigned int i;
+
+	now(&timestamp);
+	dbus_append_timestamp(iter, &timestamp);
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_BOOLEAN, &huge);
+	val = atomic_fetch_uint64_t(&iobuf_oversize);
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_UINT64, &val);
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "(ttttt)",
+					 &array_iter);
+	for (i = 0; i < iobuf_nclasses; i++) {
+		struct iobuf_class *c = &iobuf_classes[i];
+		uint64_t size = c->size, count = c->count;
+		uint64_t in_use, gets, misses;
+
+		PTHREAD_MUTEX_lock(&c->lock);
+		in_use = c->in_use;
+		gets = c->gets;
+		misses = c->misses;
+		PTHREAD_MUTEX_unlock(&c->lock);
+
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &struct_iter);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &size);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &count);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &in_use);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &gets);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &misses);
+		dbus_message_iter_close_container(&array_iter, &struct_iter);
+	}
+	dbus_message_iter_close_container(iter, &array_iter);
+}
+#endif /* USE_DBUS */
+
+/** @} */
@@ -0,0 +1,227 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file lock_prof.c
+ * @brief Lock contention profile by call site
+ *
+ * Built with USE_LOCK_PROFILE.  The PTHREAD_* lock macros count into a
+ * static struct lock_prof_site at each call site while
+ * lock_prof_enabled is set; see PTHREAD_LOCK_PROFILED.  The locks here
+ * are taken with the bare pthread calls so the profiler does not
+ * profile itself.
+ */
+
+#include "config.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "log.h"
+#include "abstract_mem.h"
+#include "abstract_atomic.h"
+#include "common_utils.h"
+#ifdef USE_DBUS
+#include "gsh_dbus.h"
+#endif
+
+bool lock_prof_enabled;
+
+static __thread uint32_t lock_prof_countdown;
+
+/** Sites reached so far, pushed on first use and never removed */
+static struct lock_prof_site *lock_prof_sites;
+static uint32_t lock_prof_nsites;
+static pthread_mutex_t lock_prof_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static void lock_prof_list(struct lock_prof_site *site)
+{
+	pthread_mutex_lock(&lock_prof_mtx);
+	if (!site->listed) {
+		site->next = lock_prof_sites;
+		lock_prof_sites = site;
+		lock_prof_nsites++;
+		atomic_store_uint32_t(&site->listed, 1);
+	}
+	pthread_mutex_unlock(&lock_prof_mtx);
+}
+
+/**
+ * @brief Count an acquire that did not wait
+ *
+ * @param[in,out] site Call site
+ */
+void lock_prof_acquired(struct lock_prof_site *site)
+{
+	if (unlikely(!atomic_fetch_uint32_t(&site->listed)))
+		lock_prof_list(site);
+
+	(void) atomic_inc_uint64_t(&site->acquires);
+}
+
+/**
+ * @brief Count an acquire that is about to wait
+ *
+ * @param[in,out] site Call site
+ *
+ * @return Start of the wait in ns if this one is timed, else 0.
+ */
+uint64_t lock_prof_wait_begin(struct lock_prof_site *site)
+{
+	struct timespec ts;
+
+	if (unlikely(!atomic_fetch_uint32_t(&site->listed)))
+		lock_prof_list(site);
+
+	(void) atomic_inc_uint64_t(&site->acquires);
+	(void) atomic_inc_uint64_t(&site->contended);
+
+	if (lock_prof_countdown-- != 0)
+		return 0;
+
+	lock_prof_countdown = LOCK_PROF_SAMPLE - 1;
+	now(&ts);
+	return timespec_to_nsecs(&ts);
+}
+
+/**
+ * @brief Account a timed wait
+ *
+ * @param[in,out] site  Call site
+ * @param[in]     start Return of lock_prof_wait_begin()
+ */
+void lock_prof_wait_end(struct lock_prof_site *site, uint64_t start)
+{
+	struct timespec ts;
+	uint64_t waited, max;
+
+	if (start == 0)
+		return;
+
+	now(&ts);
+	waited = timespec_to_nsecs(&ts) - start;
+
+	(void) atomic_add_uint64_t(&site->wait_ns, waited * LOCK_PROF_SAMPLE);
+
+	max = atomic_fetch_uint64_t(&site->max_wait_ns);
+	while (waited > max &&
+	       !atomic_cas_int64_t((int64_t *)&site->max_wait_ns, max, waited))
+		max = atomic_fetch_uint64_t(&site->max_wait_ns);
+}
+
+#ifdef USE_DBUS
+static int lock_prof_cmp(const void *a, const void *b)
+{
+	uint64_t wa = (*(struct lock_prof_site * const *)a)->wait_ns;
+	uint64_t wb = (*(struct lock_prof_site * const *)b)->wait_ns;
+
+	return wa < wb ? 1 : wa > wb ? -1 : 0;
+}
+
+/**
+ * @brief Turn the profile on or off
+ *
+ * Turning it on clears what was counted before.
+ *
+ * @param[in] enable New state
+ */
+void lock_prof_set(bool enable)
+{
+	struct lock_prof_site *site;
+
+	pthread_mutex_lock(&lock_prof_mtx);
+	if (enable && !lock_prof_enabled) {
+		for (site = lock_prof_sites; site != NULL; site = site->next) {
+			atomic_store_uint64_t(&site->acquires, 0);
+			atomic_store_uint64_t(&site->contended, 0);
+			atomic_store_uint64_t(&site->wait_ns, 0);
+			atomic_store_uint64_t(&site->max_wait_ns, 0);
+		}
+	}
+	lock_prof_enabled = enable;
+	pthread_mutex_unlock(&lock_prof_mtx);
+
+	LogEvent(COMPONENT_DBUS, "Lock profile %s",
+		 enable ? "enabled" : "disabled");
+}
+
+/**
+ * @brief Report the profile, most waited on call sites first
+ *
+ * Appends the timestamp, whether profiling is on, then for each call
+ * site reached the lock expression, "file:line", acquires, contended
+ * acquires, estimated total wait and longest sampled wait in ns.
+ */
+void lock_prof_dbus_show(DBusMessageIter *iter)
+{
+	struct timespec timestamp;
+	DBusMessageIter array_iter, struct_iter;
+	struct lock_prof_site **sites, *site;
+	dbus_bool_t enabled = lock_prof_enabled;
+	char where[PATH_MAX], *wherep = where;
+	uint64_t acquires, contended, wait_ns, max_wait_ns;
+	char *name;
+	uint32_t i, n;
+
+	now(&timestamp);
+	dbus_append_timestamp(iter, &timestamp);
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_BOOLEAN, &enabled);
+
+	pthread_mutex_lock(&lock_prof_mtx);
+	sites = gsh_malloc((lock_prof_nsites + 1) * sizeof(*sites));
+	for (n = 0, site = lock_prof_sites; site != NULL; site = site->next)
+		sites[n++] = site;
+	pthread_mutex_unlock(&lock_prof_mtx);
+
+	qsort(sites, n, sizeof(*sites), lock_prof_cmp);
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "(sstttt)",
+					 &array_iter);
+
+	for (i = 0; i < n; i++) {
+		site = sites[i];
+		name = (char *) site->name;
+		snprintf(where, sizeof(where), "%s:%d", site->file, site->line);
+		acquires = atomic_fetch_uint64_t(&site->acquires);
+		contended = atomic_fetch_uint64_t(&site->contended);
+		wait_ns = atomic_fetch_uint64_t(&site->wait_ns);
+		max_wait_ns = atomic_fetch_uint64_t(&site->max_wait_ns);
+
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &struct_iter);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &name);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &wherep);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &acquires);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &contended);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &wait_ns);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &max_wait_ns);
+		dbus_message_iter_close_container(&array_iter, &struct_iter);
+	}
+
+	dbus_message_iter_close_container(iter, &array_iter);
+	gsh_free(sites);
+}
+#endif
@@ -29,6 +29,9 @@
 #include "abstract_atomic.h"
 #include "netdb.h"
 #include "abstract_mem.h"
+#include "gsh_config.h"
+#include "fridgethr.h"
+#include "gsh_inflight.h"
 #include "netgroup_cache.h"
 
 /* Netgroup cache information */
@@ -37,6 +40,13 @@ struct ng_cache_info {
 	struct gsh_buffdesc ng_group;
 	struct gsh_buffdesc ng_host;
 	time_t ng_epoch;
+	int32_t ng_refreshing;	/*< A background refresh is queued */
+};
+
+/* A queued refresh of a cache entry */
+struct ng_refresh_req {
+	char *group;
+	char *host;
 };
 
 #define NG_CACHE_SIZE 1009
@@ -72,6 +82,9 @@ pthread_rwlock_t ng_lock = PTHREAD_RWLOCK_INITIALIZER;
 static struct avltree pos_ng_tree;
 static struct avltree neg_ng_tree;
 
+/* innetgr() calls in progress */
+static struct gsh_inflight ng_inflight = GSH_INFLIGHT_INITIALIZER;
+
 static inline int buffdesc_comparator(const struct gsh_buffdesc *buff1,
 				      const struct gsh_buffdesc *buff2)
 {
@@ -100,20 +113,86 @@ static int ng_comparator(const struct avltree_node *node1,
 	return rc;
 }
 
-static bool ng_expired(struct avltree_node *node)
+/* How fresh a cache entry is */
+enum ng_freshness {
+	NG_FRESH,	/*< Use it */
+	NG_STALE,	/*< Use it, but refresh it */
+	NG_EXPIRED,	/*< Too old to use */
+};
+
+static enum ng_freshness ng_expired(struct avltree_node *node, bool negative)
 {
 	struct ng_cache_info *info;
+	time_t ttl, age;
 
 	info = avltree_container_of(node, struct ng_cache_info, ng_node);
 
-	/* Hardcoded to 30 minutes for now */
-	if (time(NULL) - info->ng_epoch > 30 * 60)
-		return true;
+	ttl = negative
+		? nfs_param.core_param.netgroup_negative_cache_expiration
+		: nfs_param.core_param.netgroup_cache_expiration;
+	age = time(NULL) - info->ng_epoch;
 
-	return false;
+	/* Refresh ahead of expiry, and keep serving an expired entry
+	 * until the refresh lands, so that a busy entry never makes the
+	 * workers wait on the directory.
+	 */
+	if (age <= ttl - ttl / 4)
+		return NG_FRESH;
+	if (age <= ttl * 2)
+		return NG_STALE;
+	return NG_EXPIRED;
 }
 
+static void ng_add(const char *group, const char *host, bool negative);
+
+static void ng_refresh(struct fridgethr_context *ctx)
+{
+	struct ng_refresh_req *req = ctx->arg;
+	int rc;
 
+	rc = innetgr(req->group, req->host, NULL, NULL);
+
+	PTHREAD_RWLOCK_wrlock(&ng_lock);
+	ng_add(req->group, req->host, !rc);
+	PTHREAD_RWLOCK_unlock(&ng_lock);
+
+	LogFullDebug(COMPONENT_IDMAPPER, "Refreshed %s in netgroup %s: %d",
+		     req->host, req->group, rc);
+
+	gsh_free(req->group);
+	gsh_free(req->host);
+	gsh_free(req);
+}
+
+/**
+ * @brief Queue a background refresh of a stale entry
+ *
+ * Only one refresh is queued per entry.  The caller must hold ng_lock.
+ */
+static void ng_refresh_ahead(struct avltree_node *node)
+{
+	struct ng_cache_info *info;
+	struct ng_refresh_req *req;
+	int rc;
+
+	info = avltree_container_of(node, struct ng_cache_info, ng_node);
+	if (!atomic_cas_int32_t(&info->ng_refreshing, 0, 1))
+		return;
+
+	req = gsh_malloc(sizeof(*req));
+	req->group = gsh_strdup(info->ng_group.addr);
+	req->host = gsh_strdup(info->ng_host.addr);
+
+	rc = fridgethr_submit(general_fridge, ng_refresh, req);
+	if (rc != 0) {
+		LogDebug(COMPONENT_IDMAPPER,
+			 "Unable to queue netgroup refresh: %d", rc);
+		gsh_free(req->group);
+		gsh_free(req->host);
+		gsh_free(req);
+		atomic_store_int32_t(&info->ng_refreshing, 0);
+	}
+}
 
 /**
  * @brief Initialize the netgroups cache
@@ -159,9 +238,19 @@ static void ng_add(const char *group, const char *host, bool negative)
 	info->ng_host.addr = gsh_strdup(host);
 	info->ng_host.len = strlen(host)+1;
 	info->ng_epoch = time(NULL);
+	info->ng_refreshing = 0;
+
+	/* A refresh may have flipped the answer */
+	found_node = avltree_lookup(&info->ng_node,
+				    negative ? &pos_ng_tree : &neg_ng_tree);
+	if (found_node) {
+		found_info = avltree_container_of(found_node,
+				struct ng_cache_info, ng_node);
+		ng_remove(found_info, !negative);
+		ng_free(found_info);
+	}
 
 	if (negative) {
-		/* @todo check positive cache first? */
 		found_node = avltree_insert(&info->ng_node, &neg_ng_tree);
 
 		/* If an already existing entry is found, keep the old
@@ -171,10 +260,10 @@ static void ng_add(const char *group, const char *host, bool negative)
 			found_info = avltree_container_of(found_node,
 					struct ng_cache_info, ng_node);
 			found_info->ng_epoch = info->ng_epoch;
+			atomic_store_int32_t(&found_info->ng_refreshing, 0);
 			ng_free(info);
 		}
 	} else {
-		/* @todo delete from negative cache if there? */
 		found_node = avltree_insert(&info->ng_node, &pos_ng_tree);
 
 		/* If an already existing entry is found, keep the old
@@ -185,6 +274,7 @@ static void ng_add(const char *group, const char *host, bool negative)
 					struct ng_cache_info, ng_node);
 			ng_cache[ng_hash_key(found_info)] = found_node;
 			found_info->ng_epoch = info->ng_epoch;
+			atomic_store_int32_t(&found_info->ng_refreshing, 0);
 			ng_free(info);
 		} else {
 			ng_cache[ng_hash_key(info)] = &info->ng_node;
@@ -209,35 +299,33 @@ static bool ng_lookup(const char *group, const char *host, bool negative)
 		node = avltree_lookup(&prototype.ng_node, &neg_ng_tree);
 		if (!node)
 			return false;
-
-		if (!ng_expired(node))
-			return true;
-
-		goto expired;
+		goto found;
 	}
 
 	/* Positive lookups are stored in the cache */
 	cache_slot = (void **)&ng_cache[ng_hash_key(&prototype)];
 	node = atomic_fetch_voidptr(cache_slot);
-	if (node && ng_comparator(node, &prototype.ng_node) == 0) {
-		if (!ng_expired(node))
-			return true;
-		goto expired;
-	}
+	if (node && ng_comparator(node, &prototype.ng_node) == 0)
+		goto found;
 
 	/* cache miss, search AVL tree */
 	node = avltree_lookup(&prototype.ng_node, &pos_ng_tree);
 	if (!node)
 		return false;
 
-	if (ng_expired(node))
-		goto expired;
-
 	atomic_store_voidptr(cache_slot, node);
 
-	return true;
+found:
+	switch (ng_expired(node, negative)) {
+	case NG_FRESH:
+		return true;
+	case NG_STALE:
+		ng_refresh_ahead(node);
+		return true;
+	case NG_EXPIRED:
+		break;
+	}
 
-expired:
 	/* entry expired, acquire write mode lock for removal */
 	PTHREAD_RWLOCK_unlock(&ng_lock);
 	PTHREAD_RWLOCK_wrlock(&ng_lock);
@@ -266,21 +354,42 @@ expired:
  */
 bool ng_innetgr(const char *group, const char *host)
 {
-	int rc;
+	size_t glen = strlen(group) + 1, hlen = strlen(host) + 1;
+	char *key = alloca(glen + hlen);
+	enum gsh_inflight_status status;
+	bool waited = false;
+	int rc, slot;
+
+	memcpy(key, group, glen);
+	memcpy(key + glen, host, hlen);
 
 	/* Check positive lookup and then negative lookup.  If absent in
-	 * both, then do a real innetgr call and cache the results.
+	 * both, then do a real innetgr call and cache the results.  If
+	 * another thread is already making that call for the same pair,
+	 * wait for it and check again.
 	 */
-	PTHREAD_RWLOCK_rdlock(&ng_lock);
-	if (ng_lookup(group, host, false)) { /* positive lookup */
-		PTHREAD_RWLOCK_unlock(&ng_lock);
-		return true;
-	}
-	if (ng_lookup(group, host, true)) { /* negative lookup */
+	for (;;) {
+		PTHREAD_RWLOCK_rdlock(&ng_lock);
+		if (ng_lookup(group, host, false)) { /* positive lookup */
+			PTHREAD_RWLOCK_unlock(&ng_lock);
+			return true;
+		}
+		if (ng_lookup(group, host, true)) { /* negative lookup */
+			PTHREAD_RWLOCK_unlock(&ng_lock);
+			return false;
+		}
 		PTHREAD_RWLOCK_unlock(&ng_lock);
-		return false;
+
+		if (waited) {
+			status = GSH_INFLIGHT_FULL;
+			break;
+		}
+		status = gsh_inflight_begin(&ng_inflight, key, glen + hlen,
+					    &slot);
+		if (status != GSH_INFLIGHT_WAITED)
+			break;
+		waited = true;
 	}
-	PTHREAD_RWLOCK_unlock(&ng_lock);
 
 	rc = innetgr(group, host, NULL, NULL);
 
@@ -291,6 +400,9 @@ bool ng_innetgr(const char *group, const char *host)
 		ng_add(group, host, true);	/* negative lookup */
 	PTHREAD_RWLOCK_unlock(&ng_lock);
 
+	if (status == GSH_INFLIGHT_OWNER)
+		gsh_inflight_end(&ng_inflight, slot);
+
 	return rc;
 }
 
@@ -72,6 +72,145 @@ void nfs4_ace_free(fsal_ace_t *ace)
 	gsh_free(ace);
 }
 
+static int nfs4_acl_gid_cmp(const void *a, const void *b)
+{
+	gid_t ga = *(const gid_t *)a, gb = *(const gid_t *)b;
+
+	return ga < gb ? -1 : ga > gb;
+}
+
+/**
+ * @brief Work out which bits special principals are first allowed
+ *
+ * @param[in]  aces     ACEs to walk, in order
+ * @param[in]  naces    Number of ACEs
+ * @param[in]  is_dir   Object is a directory
+ * @param[in]  is_owner Caller owns the object
+ * @param[in]  is_group Caller is in the owning group
+ *
+ * @return The allowed bits.
+ */
+static fsal_aceperm_t nfs4_acl_first_allow(fsal_ace_t *aces, uint32_t naces,
+					   bool is_dir, bool is_owner,
+					   bool is_group)
+{
+	fsal_aceperm_t decided = 0, allow = 0;
+	fsal_ace_t *pace;
+
+	for (pace = aces; pace < aces + naces; pace++) {
+		if (!IS_FSAL_ACE_PERM(*pace) || IS_FSAL_ACE_INHERIT_ONLY(*pace))
+			continue;
+		if (is_dir ? !IS_FSAL_DIR_APPLICABLE(*pace)
+			   : !IS_FSAL_FILE_APPLICABLE(*pace))
+			continue;
+
+		switch (pace->who.uid) {
+		case FSAL_ACE_SPECIAL_OWNER:
+			if (!is_owner)
+				continue;
+			break;
+		case FSAL_ACE_SPECIAL_GROUP:
+			if (!is_group)
+				continue;
+			break;
+		case FSAL_ACE_SPECIAL_EVERYONE:
+			break;
+		default:
+			continue;
+		}
+
+		if (IS_FSAL_ACE_ALLOW(*pace))
+			allow |= pace->perm & ~decided;
+		decided |= pace->perm;
+	}
+
+	return allow;
+}
+
+/**
+ * @brief Build the evaluation aid of a newly interned ACL
+ *
+ * @param[in,out] acl The ACL
+ */
+static void nfs4_acl_compile(fsal_acl_t *acl)
+{
+	struct fsal_acl_compiled *comp;
+	uint32_t i, n, ngroups = 0;
+	bool special_only = true;
+	gid_t *gids, *found;
+	int d, o, g;
+
+	for (i = 0; i < acl->naces; i++) {
+		if (!IS_FSAL_ACE_PERM(acl->aces[i]) ||
+		    IS_FSAL_ACE_SPECIAL_ID(acl->aces[i]))
+			continue;
+		special_only = false;
+		if (IS_FSAL_ACE_GROUP_ID(acl->aces[i]))
+			ngroups++;
+	}
+
+	comp = gsh_calloc(1, sizeof(*comp));
+	comp->special_only = special_only;
+
+	if (special_only) {
+		for (d = 0; d < 2; d++)
+			for (o = 0; o < 2; o++)
+				for (g = 0; g < 2; g++)
+					comp->allow[d][o][g] =
+						nfs4_acl_first_allow(
+							acl->aces, acl->naces,
+							d, o, g);
+	}
+
+	if (ngroups == 0)
+		goto out;
+
+	gids = gsh_malloc(ngroups * sizeof(gid_t));
+	for (i = 0, n = 0; i < acl->naces; i++)
+		if (IS_FSAL_ACE_PERM(acl->aces[i]) &&
+		    !IS_FSAL_ACE_SPECIAL_ID(acl->aces[i]) &&
+		    IS_FSAL_ACE_GROUP_ID(acl->aces[i]))
+			gids[n++] = acl->aces[i].who.gid;
+
+	qsort(gids, n, sizeof(gid_t), nfs4_acl_gid_cmp);
+	for (i = 1, n = 1; i < ngroups; i++)
+		if (gids[i] != gids[n - 1])
+			gids[n++] = gids[i];
+
+	if (n > NFS4_ACL_MAX_GIDS) {
+		/* Left to the plain membership test */
+		gsh_free(gids);
+		goto out;
+	}
+
+	comp->ngids = n;
+	comp->gids = gids;
+	comp->gid_idx = gsh_calloc(acl->naces, sizeof(uint16_t));
+
+	for (i = 0; i < acl->naces; i++) {
+		if (!IS_FSAL_ACE_PERM(acl->aces[i]) ||
+		    IS_FSAL_ACE_SPECIAL_ID(acl->aces[i]) ||
+		    !IS_FSAL_ACE_GROUP_ID(acl->aces[i]))
+			continue;
+		found = bsearch(&acl->aces[i].who.gid, gids, n, sizeof(gid_t),
+				nfs4_acl_gid_cmp);
+		comp->gid_idx[i] = found - gids;
+	}
+
+out:
+	acl->compiled = comp;
+}
+
+static void nfs4_acl_compiled_free(struct fsal_acl_compiled *comp)
+{
+	if (!comp)
+		return;
+
+	gsh_free(comp->gids);
+	gsh_free(comp->gid_idx);
+	gsh_free(comp);
+}
+
 void nfs4_acl_free(fsal_acl_t *acl)
 {
 	if (!acl)
@@ -80,6 +219,9 @@ void nfs4_acl_free(fsal_acl_t *acl)
 	if (acl->aces)
 		nfs4_ace_free(acl->aces);
 
+	nfs4_acl_compiled_free(acl->compiled);
+	acl->compiled = NULL;
+
 	pool_free(fsal_acl_pool, acl);
 }
 
@@ -154,6 +296,7 @@ fsal_acl_t *nfs4_acl_new_entry(fsal_acl_data_t *acldata,
 	acl->naces = acldata->naces;
 	acl->aces = acldata->aces;
 	acl->ref = 1;		/* We give out one reference */
+	nfs4_acl_compile(acl);
 
 	/* Build the value */
 	value.addr = acl;
@@ -236,6 +236,65 @@ int nfs_rpc_req2client_cred(struct svc_req *req, nfs_client_cred_t *pcred)
 	return 1;
 }
 
+#ifdef _HAVE_GSSAPI
+/**
+ * @brief Find the credentials a connection already mapped a context to
+ *
+ * @param[in]  gb  The connection's binding
+ * @param[in]  gd  The request's context
+ * @param[out] uid Mapped uid
+ * @param[out] gid Mapped gid
+ *
+ * @return true if @a gd is bound and was mapped since the idmapper
+ *         cache was last wiped.
+ */
+static bool gss_binding_get(struct gss_binding *gb,
+			    struct svc_rpc_gss_data *gd,
+			    uid_t *uid, gid_t *gid)
+{
+	int32_t seq = atomic_fetch_int32_t(&gb->seq);
+
+	if ((seq & 1) != 0 ||
+	    atomic_fetch_voidptr((void **)&gb->gd) != gd ||
+	    atomic_fetch_uint32_t(&gb->gen) !=
+	    atomic_fetch_uint32_t(&idmapper_cache_gen))
+		return false;
+
+	*uid = atomic_fetch_uint32_t(&gb->uid);
+	*gid = atomic_fetch_uint32_t(&gb->gid);
+
+	return atomic_fetch_int32_t(&gb->seq) == seq;
+}
+
+/**
+ * @brief Bind a context and its mapped credentials to a connection
+ *
+ * If another request on the connection is binding at the same time,
+ * this one just gives up.
+ */
+static void gss_binding_set(struct gss_binding *gb,
+			    struct svc_rpc_gss_data *gd,
+			    uint32_t gen, uid_t uid, gid_t gid)
+{
+	int32_t seq = atomic_fetch_int32_t(&gb->seq);
+	struct svc_rpc_gss_data *old;
+
+	if ((seq & 1) != 0 || !atomic_cas_int32_t(&gb->seq, seq, seq + 1))
+		return;
+
+	old = gb->gd;
+	(void)atomic_inc_uint32_t(&gd->refcnt);
+	atomic_store_voidptr((void **)&gb->gd, gd);
+	atomic_store_uint32_t(&gb->gen, gen);
+	atomic_store_uint32_t(&gb->uid, uid);
+	atomic_store_uint32_t(&gb->gid, gid);
+	atomic_store_int32_t(&gb->seq, seq + 2);
+
+	if (old != NULL)
+		unref_svc_rpc_gss_data(old, 0);
+}
+#endif				/* _HAVE_GSSAPI */
+
 /**
  * @brief Get numeric credentials from request
  *
@@ -257,6 +316,8 @@ nfsstat4 nfs_req_creds(struct svc_req *req)
 #ifdef _HAVE_GSSAPI
 	struct svc_rpc_gss_data *gd = NULL;
 	char principal[MAXNAMLEN + 1];
+	gsh_xprt_private_t *xu = req->rq_xprt->xp_u1;
+	uint32_t gen;
 #endif
 
 	/* Make sure we clear out all the cred_flags except CREDS_LOADED and
@@ -303,6 +364,18 @@ nfsstat4 nfs_req_creds(struct svc_req *req)
 			/* Get the gss data to process them */
 			gd = SVCAUTH_PRIVATE(req->rq_auth);
 
+			/* A connection mostly carries one context, so
+			 * only map it the first time it is seen here.
+			 */
+			if (xu != NULL && xu->client != NULL &&
+			    gss_binding_get(&xu->gss, gd,
+				&op_ctx->original_creds.caller_uid,
+				&op_ctx->original_creds.caller_gid)) {
+				op_ctx->cred_flags |= CREDS_LOADED;
+				goto gss_mapped;
+			}
+			gen = atomic_fetch_uint32_t(&idmapper_cache_gen);
+
 			memcpy(principal, gd->cname.value, gd->cname.length);
 			principal[gd->cname.length] = 0;
 
@@ -335,9 +408,14 @@ nfsstat4 nfs_req_creds(struct svc_req *req)
 				break;
 			}
 
+			if (xu != NULL && xu->client != NULL)
+				gss_binding_set(&xu->gss, gd, gen,
+					op_ctx->original_creds.caller_uid,
+					op_ctx->original_creds.caller_gid);
+
 			op_ctx->cred_flags |= CREDS_LOADED;
 		}
-
+ gss_mapped:
 		auth_label = "RPCSEC_GSS";
 		op_ctx->cred_flags |= MANAGED_GIDS;
 		garray_copy = &op_ctx->managed_garray_copy;
@@ -553,7 +631,7 @@ nfsstat4 nfs4_export_check_access(struct svc_req *req)
 
 	LogMidDebugAlt(COMPONENT_NFS_V4, COMPONENT_EXPORT,
 		    "nfs4_export_check_access about to call export_check_access");
-	export_check_access();
+	export_check_access_xprt(req->rq_xprt);
 
 	/* Check if any access at all */
 	if ((op_ctx->export_perms->options &
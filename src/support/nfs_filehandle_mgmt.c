@@ -67,6 +67,7 @@ struct fsal_obj_handle *nfs3_FhandleToCache(nfs_fh3 *fh3,
 	struct fsal_export *export;
 	struct fsal_obj_handle *obj = NULL;
 	struct gsh_buffdesc fh_desc;
+	uint64_t key_hash;
 
 	/* Default behaviour */
 	*rc = NFS_REQ_OK;
@@ -94,9 +95,16 @@ struct fsal_obj_handle *nfs3_FhandleToCache(nfs_fh3 *fh3,
 					 &fh_desc,
 					 v3_handle->fhflags1);
 
-	if (!FSAL_IS_ERROR(fsal_status))
+	if (!FSAL_IS_ERROR(fsal_status)) {
+		if (nfs_fh_get_key_hash(v3_handle->fhflags1,
+					v3_handle->fsopaque,
+					v3_handle->fs_len, &key_hash))
+			op_ctx->fh_key_hash = &key_hash;
+
 		fsal_status = export->exp_ops.create_handle(export, &fh_desc,
 							    &obj, NULL);
+		op_ctx->fh_key_hash = NULL;
+	}
 
 	if (FSAL_IS_ERROR(fsal_status)) {
 		*status = nfs3_Errno_status(fsal_status);
@@ -109,6 +117,35 @@ struct fsal_obj_handle *nfs3_FhandleToCache(nfs_fh3 *fh3,
 }
 #endif /* _USE_NFS3 */
 
+/**
+ * @brief Append the object's key hash to a handle, if wanted and it fits
+ *
+ * @param[in]     obj      Object the handle is for
+ * @param[in,out] fhflags1 Handle flags, FILE_HANDLE_FLAG_KEY_HASH is set
+ * @param[in]     fsopaque Opaque part of the handle, already filled
+ * @param[in]     fs_len   Length of the opaque part
+ * @param[in]     room     Room for the opaque part and the hash
+ */
+
+static void nfs_fh_put_key_hash(const struct fsal_obj_handle *obj,
+				uint8_t *fhflags1, uint8_t *fsopaque,
+				size_t fs_len, size_t room)
+{
+	struct fsal_obj_handle *hdl = (struct fsal_obj_handle *) obj;
+	struct gsh_buffdesc key;
+	uint64_t hash;
+
+	if (!nfs_param.core_param.fh_key_hash ||
+	    fs_len + sizeof(hash) > room)
+		return;
+
+	hdl->obj_ops.handle_to_key(hdl, &key);
+	hash = fsal_key_hash(&key);
+
+	memcpy(fsopaque + fs_len, &hash, sizeof(hash));
+	*fhflags1 |= FILE_HANDLE_FLAG_KEY_HASH;
+}
+
 /**
  * @brief Converts an FSAL object to an NFSv4 file handle
  *
@@ -155,6 +192,9 @@ bool nfs4_FSALToFhandle(bool allocate,
 	file_handle->fhflags1 = FH_FSAL_BIG_ENDIAN;
 #endif
 	file_handle->fs_len = fh_desc.len;	/* set the actual size */
+	nfs_fh_put_key_hash(fsalhandle, &file_handle->fhflags1,
+			    file_handle->fsopaque, fh_desc.len,
+			    NFS4_FHSIZE - offsetof(file_handle_v4_t, fsopaque));
 	/* keep track of the export id network byte order for nfs_fh4*/
 	file_handle->id.exports = htons(exp->export_id);
 
@@ -219,6 +259,11 @@ bool nfs3_FSALToFhandle(bool allocate,
 	file_handle->fhflags1 = FH_FSAL_BIG_ENDIAN;
 #endif
 	file_handle->fs_len = fh_desc.len;	/* set the actual size */
+	nfs_fh_put_key_hash(fsalhandle, &file_handle->fhflags1,
+			    file_handle->fsopaque, fh_desc.len,
+			    (nfs_param.core_param.short_file_handle
+				? 56 : NFS3_FHSIZE) -
+			    offsetof(file_handle_v3_t, fsopaque));
 	/* keep track of the export id in network byte order*/
 	file_handle->exportid = htons(exp->export_id);
 
@@ -52,6 +52,7 @@
 #include "nfs_proto_functions.h"
 #include "nfs_dupreq.h"
 #include "config_parsing.h"
+#include "hashtable.h"
 
 /**
  * @brief Core configuration parameters
@@ -82,6 +83,10 @@ static struct config_item core_params[] = {
 		       nfs_core_param, port[P_NLM]),
 	CONF_ITEM_UI16("Rquota_Port", 0, UINT16_MAX, RQUOTA_PORT,
 		       nfs_core_param, port[P_RQUOTA]),
+	CONF_ITEM_UI16("NFS_RDMA_Port", 0, UINT16_MAX, NFS_RDMA_PORT,
+		       nfs_core_param, port[P_NFS_RDMA]),
+	CONF_ITEM_UI32("NFS_RDMA_Credits", 2, 1024, NFS_RDMA_CREDITS_DEFAULT,
+		       nfs_core_param, rdma_credits),
 	CONF_ITEM_IP_ADDR("Bind_Addr", "0.0.0.0",
 			  nfs_core_param, bind_addr),
 	CONF_ITEM_UI32("NFS_Program", 1, INT32_MAX, NFS_PROGRAM,
@@ -94,16 +99,58 @@ static struct config_item core_params[] = {
 		       nfs_core_param, program[P_RQUOTA]),
 	CONF_ITEM_UI32("Nb_Worker", 1, 1024*128, NB_WORKER_THREAD_DEFAULT,
 		       nfs_core_param, nb_worker),
+	CONF_ITEM_BOOL("Worker_Autotune", false,
+		       nfs_core_param, worker_autotune),
+	CONF_ITEM_UI32("Nb_Worker_Min", 1, 1024*128, 16,
+		       nfs_core_param, nb_worker_min),
+	CONF_ITEM_UI32("Nb_Worker_Max", 1, 1024*128, 1024,
+		       nfs_core_param, nb_worker_max),
+	CONF_ITEM_UI32("Worker_Autotune_Interval", 1, 3600, 10,
+		       nfs_core_param, worker_autotune_interval),
 	CONF_ITEM_BOOL("Drop_IO_Errors", false,
 		       nfs_core_param, drop_io_errors),
 	CONF_ITEM_BOOL("Drop_Inval_Errors", false,
 		       nfs_core_param, drop_inval_errors),
 	CONF_ITEM_BOOL("Drop_Delay_Errors", false,
 		       nfs_core_param, drop_delay_errors),
+	CONF_ITEM_UI32("Write_Gather_Usec", 0, 100000, 0,
+		       nfs_core_param, write_gather_usec),
+	CONF_ITEM_UI32("Upcall_Coalesce_Usec", 0, 100000, 0,
+		       nfs_core_param, upcall_coalesce_usec),
 	CONF_ITEM_UI32("Dispatch_Max_Reqs", 1, 10000, 5000,
 		       nfs_core_param, dispatch_max_reqs),
 	CONF_ITEM_UI32("Dispatch_Max_Reqs_Xprt", 1, 2048, 512,
 		       nfs_core_param, dispatch_max_reqs_xprt),
+	CONF_ITEM_UI32("Dispatch_Queue_Shards", 0, 256, 0,
+		       nfs_core_param, dispatch_queue_shards),
+	CONF_ITEM_UI32("Worker_Spin_Usec", 0, 10000, 0,
+		       nfs_core_param, worker_spin_usec),
+	CONF_ITEM_BOOL("Worker_NUMA_Affinity", false,
+		       nfs_core_param, worker_numa_affinity),
+	CONF_ITEM_UI32("Delayed_Exec_Wheels", 0, 64, 1,
+		       nfs_core_param, delayed_wheels),
+	CONF_ITEM_BOOL("Dispatch_Fair_Share", false,
+		       nfs_core_param, dispatch_fair_share),
+	CONF_ITEM_UI32("Dispatch_Fair_Share_Weight", 1, 1024, 1,
+		       nfs_core_param, dispatch_fair_share_weight),
+	CONF_ITEM_UI32("Dispatch_Target_Latency_Usec", 0, 10000000, 0,
+		       nfs_core_param, dispatch_target_latency_usec),
+	CONF_ITEM_UI32("Dispatch_Latency_Interval_Msec", 10, 10000, 100,
+		       nfs_core_param, dispatch_latency_interval_msec),
+	CONF_ITEM_UI32("Dispatch_Request_Deadline_Msec", 0, 600000, 0,
+		       nfs_core_param, dispatch_request_deadline_msec),
+	CONF_ITEM_UI16("Metrics_Port", 0, UINT16_MAX, 0,
+		       nfs_core_param, metrics_port),
+	CONF_ITEM_IP_ADDR("Metrics_Addr", "127.0.0.1",
+			  nfs_core_param, metrics_addr),
+	CONF_ITEM_UI32("Metrics_Max_Clients", 0, UINT32_MAX, 64,
+		       nfs_core_param, metrics_max_clients),
+	CONF_ITEM_UI32("Topk_Entries", 0, 1024, 32,
+		       nfs_core_param, topk_entries),
+	CONF_ITEM_UI32("Topk_Window_S", 1, 3600, 60,
+		       nfs_core_param, topk_window_s),
+	CONF_ITEM_UI32("Export_Init_Threads", 1, 256, 8,
+		       nfs_core_param, export_init_threads),
 	CONF_ITEM_BOOL("DRC_Disabled", false,
 		       nfs_core_param, drc.disabled),
 	CONF_ITEM_UI32("DRC_TCP_Npart", 1, 20, DRC_TCP_NPART,
@@ -130,6 +177,14 @@ static struct config_item core_params[] = {
 		       nfs_core_param, drc.udp.hiwat),
 	CONF_ITEM_BOOL("DRC_UDP_Checksum", DRC_UDP_CHECKSUM,
 		       nfs_core_param, drc.udp.checksum),
+	CONF_ITEM_UI64("DRC_Max_Bytes", 0, UINT64_MAX, 0,
+		       nfs_core_param, drc.max_bytes),
+	CONF_ITEM_UI64("DRC_Client_Max_Bytes", 0, UINT64_MAX, 0,
+		       nfs_core_param, drc.client_max_bytes),
+	CONF_ITEM_UI32("DRC_LRU_Npart", 1, 64, DRC_LRU_NPART,
+		       nfs_core_param, drc.lru_npart),
+	CONF_ITEM_UI32("DRC_Write_Checksum_Bytes", 0, 1024*1024, 0,
+		       nfs_core_param, drc.write_cksum_bytes),
 	CONF_ITEM_UI32("RPC_Debug_Flags", 0, UINT32_MAX, TIRPC_DEBUG_FLAGS,
 		       nfs_core_param, rpc.debug_flags),
 	CONF_ITEM_UI32("RPC_Max_Connections", 1, 10000, 1024,
@@ -144,24 +199,64 @@ static struct config_item core_params[] = {
 		       nfs_core_param, rpc.max_recv_buffer_size),
 	CONF_ITEM_UI32("RPC_Ioq_ThrdMax", 1, 1024*128, 200,
 		       nfs_core_param, rpc.ioq_thrd_max),
+	CONF_ITEM_UI32("RPC_TCP_Defer_Accept", 0, 600, 0,
+		       nfs_core_param, rpc.tcp_defer_accept),
+	CONF_ITEM_UI32("RPC_UDP_Listeners", 1, 16, 1,
+		       nfs_core_param, rpc.udp_listeners),
+	CONF_ITEM_UI32("RPC_TCP_Listeners", 1, 16, 1,
+		       nfs_core_param, rpc.tcp_listeners),
+	CONF_ITEM_BOOL("RPC_Listeners_CPU_Steering", false,
+		       nfs_core_param, rpc.listeners_cpu_steering),
+	CONF_ITEM_UI32("RPC_Busy_Poll_Usec", 0, 10000, 0,
+		       nfs_core_param, rpc.busy_poll_usec),
+	CONF_ITEM_UI32("RPC_Busy_Poll_Budget", 0, 1024, 0,
+		       nfs_core_param, rpc.busy_poll_budget),
+	CONF_ITEM_BOOL("RPC_TCP_Buffer_Autotune", false,
+		       nfs_core_param, rpc.tcp_buf_autotune),
+	CONF_ITEM_UI32("RPC_TCP_Buffer_Min", 4096, 1024*1024*64,
+		       NFS_DEFAULT_TCP_BUFFER_MIN,
+		       nfs_core_param, rpc.tcp_buf_min),
+	CONF_ITEM_UI32("RPC_TCP_Buffer_Max", 4096, 1024*1024*256,
+		       NFS_DEFAULT_TCP_BUFFER_MAX,
+		       nfs_core_param, rpc.tcp_buf_max),
+	CONF_ITEM_UI32("RPC_TCP_Notsent_Lowat", 0, 1024*1024*64, 0,
+		       nfs_core_param, rpc.tcp_notsent_lowat),
+	CONF_ITEM_BOOL("RPC_TLS", false,
+		       nfs_core_param, rpc.tls.enable),
+	CONF_ITEM_BOOL("RPC_TLS_Required", false,
+		       nfs_core_param, rpc.tls.required),
+	CONF_ITEM_PATH("RPC_TLS_Certificate", 1, MAXPATHLEN, NULL,
+		       nfs_core_param, rpc.tls.certificate),
+	CONF_ITEM_PATH("RPC_TLS_Private_Key", 1, MAXPATHLEN, NULL,
+		       nfs_core_param, rpc.tls.private_key),
+	CONF_ITEM_PATH("RPC_TLS_CA_File", 1, MAXPATHLEN, NULL,
+		       nfs_core_param, rpc.tls.ca_file),
 	CONF_ITEM_UI32("RPC_GSS_Npart", 1, 1021, 13,
 		       nfs_core_param, rpc.gss.ctx_hash_partitions),
 	CONF_ITEM_UI32("RPC_GSS_Max_Ctx", 1, 1024*1024, 16384,
 		       nfs_core_param, rpc.gss.max_ctx),
 	CONF_ITEM_UI32("RPC_GSS_Max_GC", 1, 1024*1024, 200,
 		       nfs_core_param, rpc.gss.max_gc),
+	CONF_ITEM_UI32("RPC_GSS_Unwrap_Threads", 0, 256, 0,
+		       nfs_core_param, rpc.gss.unwrap_threads),
 	CONF_ITEM_I64("Decoder_Fridge_Expiration_Delay", 0, 7200, 600,
 		      nfs_core_param, decoder_fridge_expiration_delay),
 	CONF_ITEM_I64("Decoder_Fridge_Block_Timeout", 0, 7200, 600,
 		      nfs_core_param, decoder_fridge_block_timeout),
 	CONF_ITEM_I64("Blocked_Lock_Poller_Interval", 0, 180, 10,
 		      nfs_core_param, blocked_lock_poller_interval),
+	CONF_ITEM_UI32("Slow_Request_Threshold", 0, 3600000, 0,
+		       nfs_core_param, slow_request_threshold),
 	CONF_ITEM_LIST("NFS_Protocols", CORE_OPTION_ALL_VERS, protocols,
 		       nfs_core_param, core_options),
 	CONF_ITEM_LIST("Protocols", CORE_OPTION_ALL_VERS, protocols,
 		       nfs_core_param, core_options),
 	CONF_ITEM_BOOL("NSM_Use_Caller_Name", false,
 		       nfs_core_param, nsm_use_caller_name),
+	CONF_ITEM_PATH("NSM_Cache_File", 1, MAXPATHLEN, NULL,
+		       nfs_core_param, nsm_cache_file),
+	CONF_ITEM_UI32("NSM_Unmonitor_Delay", 0, 86400, 300,
+		       nfs_core_param, nsm_unmonitor_delay),
 	CONF_ITEM_BOOL("Clustered", true,
 		       nfs_core_param, clustered),
 	CONF_ITEM_BOOL("Enable_NLM", true,
@@ -176,12 +271,21 @@ static struct config_item core_params[] = {
 		       nfs_core_param, tcp_keepidle),
 	CONF_ITEM_UI32("TCP_KEEPINTVL", 0, 65535, 0,
 		       nfs_core_param, tcp_keepintvl),
+	CONF_ITEM_BOOL("Enable_TCP_Reply_Coalescing", false,
+		       nfs_core_param, tcp_reply_coalesce),
 	CONF_ITEM_BOOL("Enable_Fast_Stats", false,
 		       nfs_core_param, enable_FASTSTATS),
 	CONF_ITEM_BOOL("Short_File_Handle", false,
 		       nfs_core_param, short_file_handle),
+	CONF_ITEM_BOOL("File_Handle_Key_Hash", false,
+		       nfs_core_param, fh_key_hash),
 	CONF_ITEM_I64("Manage_Gids_Expiration", 0, 7*24*60*60, 30*60,
 			nfs_core_param, manage_gids_expiration),
+	CONF_ITEM_I64("Netgroup_Cache_Expiration", 0, 7*24*60*60, 30*60,
+			nfs_core_param, netgroup_cache_expiration),
+	CONF_ITEM_I64("Netgroup_Negative_Cache_Expiration", 0, 7*24*60*60,
+			30*60, nfs_core_param,
+			netgroup_negative_cache_expiration),
 	CONF_ITEM_PATH("Plugins_Dir", 1, MAXPATHLEN, FSAL_MODULE_LOC,
 		       nfs_core_param, ganesha_modules_loc),
 	CONF_ITEM_UI32("heartbeat_freq", 0, 5000, 1000,
@@ -190,6 +294,12 @@ static struct config_item core_params[] = {
 		       nfs_core_param, fsid_device),
 	CONF_ITEM_BOOL("mount_path_pseudo", false,
 		       nfs_core_param, mount_path_pseudo),
+	CONF_ITEM_UI64("IOBuf_Pool_Bytes", 0, UINT64_MAX, 0,
+		       nfs_core_param, iobuf.pool_bytes),
+	CONF_ITEM_UI32("IOBuf_Max_Size", 4096, 64*1024*1024, 1024*1024,
+		       nfs_core_param, iobuf.max_size),
+	CONF_ITEM_BOOL("IOBuf_Hugepages", false,
+		       nfs_core_param, iobuf.hugepages),
 	CONFIG_EOL
 };
 
@@ -241,6 +351,14 @@ struct config_block krb5_param = {
  * @brief NFSv4 specific parameters
  */
 
+static struct config_item_list hash_functions[] = {
+	CONFIG_LIST_TOK("Table", HT_HASH_TABLE),
+	CONFIG_LIST_TOK("City", HT_HASH_CITY),
+	CONFIG_LIST_TOK("Murmur3", HT_HASH_MURMUR3),
+	CONFIG_LIST_TOK("CRC32C", HT_HASH_CRC32C),
+	CONFIG_LIST_EOL
+};
+
 static struct config_item version4_params[] = {
 	CONF_ITEM_BOOL("Graceless", false,
 		       nfs_version4_parameter, graceless),
@@ -267,17 +385,67 @@ static struct config_item version4_params[] = {
 		       nfs_version4_parameter, pnfs_mds),
 	CONF_ITEM_BOOL("PNFS_DS", true,
 		       nfs_version4_parameter, pnfs_ds),
+	CONF_ITEM_UI32("Max_Slots", NFS41_NB_SLOTS, 1024,
+		       NFS41_MAX_SLOTS_DEFAULT,
+		       nfs_version4_parameter, max_slots),
+	CONF_ITEM_UI32("Callback_Slots", 1, NFS41_MAX_CB_SLOTS,
+		       NFS41_MAX_CB_SLOTS,
+		       nfs_version4_parameter, cb_slots),
+	CONF_ITEM_UI32("Callback_Threads", 1, 1024, CB_THREADS_DEFAULT,
+		       nfs_version4_parameter, cb_threads),
+	CONF_ITEM_UI32("Callback_Timeout", 1, 300, CB_TIMEOUT_DEFAULT,
+		       nfs_version4_parameter, cb_timeout),
 	CONF_ITEM_STR("RecoveryBackend", 1, MAXPATHLEN,
 		      RECOVERY_BACKEND_DEFAULT,
 		      nfs_version4_parameter, recovery_backend),
+	CONF_ITEM_UI32("Clientid_Hash_Partitions", 1, HASHTABLE_MAX_INDEX,
+		       NFS4_HASH_PARTITIONS_DEFAULT,
+		       nfs_version4_parameter, clientid_hash_partitions),
+	CONF_ITEM_UI32("State_Hash_Partitions", 1, HASHTABLE_MAX_INDEX,
+		       NFS4_HASH_PARTITIONS_DEFAULT,
+		       nfs_version4_parameter, state_hash_partitions),
+	CONF_ITEM_UI32("Hash_Resize_Load", 0, 1000000,
+		       NFS4_HASH_RESIZE_LOAD_DEFAULT,
+		       nfs_version4_parameter, hash_resize_load),
+	CONF_ITEM_TOKEN("Hash_Function", HT_HASH_TABLE, hash_functions,
+			nfs_version4_parameter, hash_function),
+	CONF_ITEM_UI32("Max_Open_Owners_Per_Client", 0, UINT32_MAX, 0,
+		       nfs_version4_parameter, max_open_owners),
+	CONF_ITEM_UI32("Max_Lock_Owners_Per_Client", 0, UINT32_MAX, 0,
+		       nfs_version4_parameter, max_lock_owners),
+	CONF_ITEM_UI32("Max_States_Per_Client", 0, UINT32_MAX, 0,
+		       nfs_version4_parameter, max_states),
+	CONF_ITEM_UI32("Max_Sessions_Per_Client", 0, UINT32_MAX, 0,
+		       nfs_version4_parameter, max_sessions),
 	CONFIG_EOL
 };
 
+static int version4_commit(void *node, void *link_mem, void *self_struct,
+			   struct config_error_type *err_type)
+{
+	struct nfs_version4_parameter *params = self_struct;
+	int errcnt = 0;
+
+	if (!is_prime(params->clientid_hash_partitions)) {
+		LogCrit(COMPONENT_CONFIG,
+			"Clientid_Hash_Partitions must be a prime.");
+		errcnt++;
+	}
+
+	if (!is_prime(params->state_hash_partitions)) {
+		LogCrit(COMPONENT_CONFIG,
+			"State_Hash_Partitions must be a prime.");
+		errcnt++;
+	}
+
+	return errcnt;
+}
+
 struct config_block version4_param = {
 	.dbus_interface_name = "org.ganesha.nfsd.config.nfsv4",
 	.blk_desc.name = "NFSv4",
 	.blk_desc.type = CONFIG_BLOCK,
 	.blk_desc.u.blk.init = noop_conf_init,
 	.blk_desc.u.blk.params = version4_params,
-	.blk_desc.u.blk.commit = noop_conf_commit
+	.blk_desc.u.blk.commit = version4_commit
 };
@@ -0,0 +1,172 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup req_arena
+ * @{
+ */
+
+/**
+ * @file req_arena.c
+ * @brief Request scoped arena allocator
+ */
+
+#include "config.h"
+#include <string.h>
+#include "abstract_mem.h"
+#include "req_arena.h"
+
+/** Standard slabs kept per thread for reuse */
+#define REQ_ARENA_CACHE_MAX 4
+
+static __thread struct req_arena_slab *slab_cache;
+static __thread unsigned int slab_cache_count;
+
+static struct req_arena_slab *req_arena_slab_get(size_t size)
+{
+	struct req_arena_slab *slab;
+
+	if (size <= REQ_ARENA_SLAB_SIZE && slab_cache != NULL) {
+		slab = slab_cache;
+		slab_cache = slab->next;
+		slab_cache_count--;
+	} else {
+		if (size < REQ_ARENA_SLAB_SIZE)
+			size = REQ_ARENA_SLAB_SIZE;
+		slab = gsh_malloc(sizeof(*slab) + size);
+		slab->size = size;
+	}
+
+	slab->next = NULL;
+	slab->used = 0;
+	return slab;
+}
+
+static void req_arena_slab_put(struct req_arena_slab *slab)
+{
+	if (slab->size == REQ_ARENA_SLAB_SIZE &&
+	    slab_cache_count < REQ_ARENA_CACHE_MAX) {
+		slab->next = slab_cache;
+		slab_cache = slab;
+		slab_cache_count++;
+		return;
+	}
+
+	gsh_free(slab);
+}
+
+/**
+ * @brief Allocate from a request arena
+ *
+ * Memory is only returned by req_arena_release().  Requests larger than
+ * a slab get a dedicated slab, which is chained behind the current one
+ * so small allocations keep bumping where they were.
+ *
+ * @param[in] arena Arena to allocate from
+ * @param[in] size  Bytes wanted
+ *
+ * @return Pointer aligned to REQ_ARENA_ALIGN.
+ */
+
+void *req_arena_alloc(struct req_arena *arena, size_t size)
+{
+	struct req_arena_slab *slab = arena->slabs;
+	size_t offset;
+
+	size = (size + REQ_ARENA_ALIGN - 1) & ~((size_t) REQ_ARENA_ALIGN - 1);
+
+	if (slab != NULL && slab->size - slab->used >= size) {
+		offset = slab->used;
+		slab->used += size;
+		return slab->data + offset;
+	}
+
+	slab = req_arena_slab_get(size);
+	slab->used = size;
+
+	if (size > REQ_ARENA_SLAB_SIZE && arena->slabs != NULL) {
+		slab->next = arena->slabs->next;
+		arena->slabs->next = slab;
+	} else {
+		slab->next = arena->slabs;
+		arena->slabs = slab;
+	}
+
+	return slab->data;
+}
+
+/**
+ * @brief Allocate zeroed memory from a request arena
+ *
+ * @param[in] arena Arena to allocate from
+ * @param[in] size  Bytes wanted
+ *
+ * @return Zeroed pointer aligned to REQ_ARENA_ALIGN.
+ */
+
+void *req_arena_calloc(struct req_arena *arena, size_t size)
+{
+	void *p = req_arena_alloc(arena, size);
+
+	memset(p, 0, size);
+	return p;
+}
+
+/**
+ * @brief Release everything allocated from an arena
+ *
+ * Standard slabs go back to the calling thread's cache.
+ *
+ * @param[in] arena Arena to empty
+ */
+
+void req_arena_release(struct req_arena *arena)
+{
+	struct req_arena_slab *slab, *next;
+
+	for (slab = arena->slabs; slab != NULL; slab = next) {
+		next = slab->next;
+		req_arena_slab_put(slab);
+	}
+
+	arena->slabs = NULL;
+}
+
+/**
+ * @brief Free the calling thread's cached slabs
+ *
+ * Called by worker threads as they exit.
+ */
+
+void req_arena_thread_cleanup(void)
+{
+	struct req_arena_slab *slab;
+
+	while (slab_cache != NULL) {
+		slab = slab_cache;
+		slab_cache = slab->next;
+		gsh_free(slab);
+	}
+
+	slab_cache_count = 0;
+}
+
+/** @} */
@@ -0,0 +1,321 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @defgroup Server statistics management
+ * @{
+ */
+
+/**
+ * @file server_metrics.c
+ * @brief OpenMetrics endpoint for the server statistics
+ *
+ * A single thread answers GET /metrics on Metrics_Addr:Metrics_Port
+ * with the statistics in the OpenMetrics text format, so that they can
+ * be scraped without going through D-Bus.  Scrapes come seconds apart,
+ * so connections are served one at a time and closed after the reply.
+ * Each module renders its own statistics, the page is built in memory
+ * before anything is sent so that a slow reader holds no locks.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "log.h"
+#include "abstract_atomic.h"
+#include "nfs_core.h"
+#include "server_metrics.h"
+
+/** Largest request head we read */
+#define METRICS_REQ_MAX 1024
+/** How long a client may take to send its request or read the reply */
+#define METRICS_TIMEOUT_S 5
+/** How often the thread looks for shutdown, in msecs */
+#define METRICS_POLL_MS 1000
+
+#define METRICS_CONTENT_TYPE \
+	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+static struct metrics_state {
+	pthread_t thrid;
+	int fd;			/*< listening socket, -1 if not serving */
+	uint32_t stopping;
+} metrics = {
+	.fd = -1,
+};
+
+/**
+ * @brief Start a metric family
+ *
+ * @param out  [IN] page being built
+ * @param name [IN] family name
+ * @param type [IN] OpenMetrics type
+ * @param help [IN] description
+ */
+void metrics_family(FILE *out, const char *name, const char *type,
+		    const char *help)
+{
+	fprintf(out, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+/**
+ * @brief Report a family with a single unlabelled value
+ *
+ * @param out   [IN] page being built
+ * @param name  [IN] family name
+ * @param type  [IN] "counter" or "gauge"
+ * @param help  [IN] description
+ * @param value [IN] the value
+ */
+void metrics_scalar(FILE *out, const char *name, const char *type,
+		    const char *help, uint64_t value)
+{
+	metrics_family(out, name, type, help);
+	fprintf(out, "%s%s %" PRIu64 "\n", name,
+		strcmp(type, "counter") == 0 ? "_total" : "", value);
+}
+
+/**
+ * @brief Send all of a buffer
+ *
+ * @return true if everything went out.
+ */
+static bool metrics_send(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * @brief Send a complete HTTP reply
+ */
+static void metrics_reply(int fd, const char *status, const char *type,
+			  const char *body, size_t len)
+{
+	char head[256];
+	int n;
+
+	n = snprintf(head, sizeof(head),
+		     "HTTP/1.1 %s\r\n"
+		     "Content-Type: %s\r\n"
+		     "Content-Length: %zu\r\n"
+		     "Connection: close\r\n"
+		     "\r\n", status, type, len);
+
+	if (metrics_send(fd, head, n))
+		(void)metrics_send(fd, body, len);
+}
+
+/**
+ * @brief Build the page
+ *
+ * @param[out] len Length of the page
+ *
+ * @return The page, to be released with free, or NULL.
+ */
+static char *metrics_render(size_t *len)
+{
+	char *page = NULL;
+	FILE *out = open_memstream(&page, len);
+
+	if (out == NULL)
+		return NULL;
+
+	server_stats_metrics(out);
+	mdcache_metrics(out);
+	nfs_rpc_queue_metrics(out);
+	fputs("# EOF\n", out);
+
+	if (fclose(out) != 0) {
+		free(page);
+		return NULL;
+	}
+	return page;
+}
+
+/**
+ * @brief Answer one connection
+ *
+ * @param fd [IN] the accepted socket
+ */
+static void metrics_serve(int fd)
+{
+	struct timeval tv = {
+		.tv_sec = METRICS_TIMEOUT_S,
+	};
+	char req[METRICS_REQ_MAX];
+	size_t len = 0;
+	ssize_t n;
+	char *page;
+	size_t page_len;
+
+	(void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	(void)setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	/* Read the request head, the request line is all we look at */
+	while (len < sizeof(req) - 1) {
+		n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		len += n;
+		req[len] = '\0';
+		if (strstr(req, "\r\n\r\n") != NULL ||
+		    strstr(req, "\n\n") != NULL)
+			break;
+	}
+	req[len] = '\0';
+
+	if (strncmp(req, "GET /metrics", 12) != 0 ||
+	    (req[12] != ' ' && req[12] != '?')) {
+		metrics_reply(fd, "404 Not Found", "text/plain",
+			      "Not Found\n", strlen("Not Found\n"));
+		return;
+	}
+
+	page = metrics_render(&page_len);
+	if (page == NULL) {
+		LogMajor(COMPONENT_INIT, "Could not build the metrics page");
+		metrics_reply(fd, "500 Internal Server Error", "text/plain",
+			      "Internal Server Error\n",
+			      strlen("Internal Server Error\n"));
+		return;
+	}
+
+	metrics_reply(fd, "200 OK", METRICS_CONTENT_TYPE, page, page_len);
+	free(page);
+}
+
+static void *metrics_thread(void *arg)
+{
+	struct pollfd pfd = {
+		.fd = metrics.fd,
+		.events = POLLIN,
+	};
+	int fd;
+
+	SetNameFunction("metrics");
+
+	while (!atomic_fetch_uint32_t(&metrics.stopping)) {
+		if (poll(&pfd, 1, METRICS_POLL_MS) <= 0)
+			continue;
+
+		fd = accept4(metrics.fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno != EINTR && errno != EAGAIN)
+				LogDebug(COMPONENT_INIT,
+					 "metrics accept failed: %s",
+					 strerror(errno));
+			continue;
+		}
+
+		metrics_serve(fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Start serving the metrics, if configured
+ */
+void metrics_start(void)
+{
+	struct sockaddr_in addr = nfs_param.core_param.metrics_addr;
+	int one = 1;
+	int rc;
+
+	if (nfs_param.core_param.metrics_port == 0)
+		return;
+
+	metrics.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (metrics.fd < 0) {
+		LogCrit(COMPONENT_INIT, "Could not create metrics socket: %s",
+			strerror(errno));
+		return;
+	}
+
+	(void)setsockopt(metrics.fd, SOL_SOCKET, SO_REUSEADDR, &one,
+			 sizeof(one));
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(nfs_param.core_param.metrics_port);
+
+	if (bind(metrics.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(metrics.fd, 16) != 0) {
+		LogCrit(COMPONENT_INIT,
+			"Could not listen for metrics on port %u: %s",
+			nfs_param.core_param.metrics_port, strerror(errno));
+		goto fail;
+	}
+
+	rc = pthread_create(&metrics.thrid, NULL, metrics_thread, NULL);
+	if (rc != 0) {
+		LogCrit(COMPONENT_THREAD,
+			"Could not create metrics thread: %s", strerror(rc));
+		goto fail;
+	}
+
+	LogEvent(COMPONENT_THREAD, "metrics thread was started on port %u",
+		 nfs_param.core_param.metrics_port);
+	return;
+
+fail:
+	close(metrics.fd);
+	metrics.fd = -1;
+}
+
+/**
+ * @brief Stop serving the metrics
+ */
+void metrics_shutdown(void)
+{
+	if (metrics.fd < 0)
+		return;
+
+	atomic_store_uint32_t(&metrics.stopping, 1);
+	pthread_join(metrics.thrid, NULL);
+	close(metrics.fd);
+	metrics.fd = -1;
+}
+
+/** @} */
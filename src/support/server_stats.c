@@ -40,9 +40,11 @@
 #include "config.h"
 
 #include <time.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <sys/param.h>
 #include <pthread.h>
 #include <assert.h>
@@ -58,6 +60,8 @@
 #include "client_mgr.h"
 #include "export_mgr.h"
 #include "server_stats.h"
+#include "server_metrics.h"
+#include "server_topk.h"
 #include <abstract_atomic.h>
 #include "nfs_proto_functions.h"
 
@@ -75,8 +79,6 @@
 #define NFS_pcp nfs_param.core_param
 #define NFS_program NFS_pcp.program
 
-#ifdef USE_DBUS
-
 struct op_name {
 	char *name;
 };
@@ -226,8 +228,6 @@ static const struct op_name optabv4[] = {
 	[NFS4_OP_REMOVEXATTR] = {.name = "OP_REMOVEXATTR",},
 };
 
-#endif
-
 /* Classify protocol ops for stats purposes
  */
 
@@ -270,62 +270,138 @@ static const uint32_t nfsv42_optype[NFS_V42_NB_OPERATION] = {
 	[NFS4_OP_READ_PLUS] = READ_OP,
 };
 
+/* latency histograms
+ *
+ * Log-linear buckets, as in HDR histograms.  Everything below
+ * 2^LAT_HIST_UNIT_SHIFT nsecs (about a microsecond) is one unit, the
+ * first LAT_HIST_SUB units have a bucket each and every power of two
+ * above is split in LAT_HIST_SUB buckets, so a bucket is never wider
+ * than a quarter of the values it holds.  Anything past
+ * 2^LAT_HIST_MAX_BITS units (about 68 seconds) lands in the last one.
+ */
+#define LAT_HIST_UNIT_SHIFT 10
+#define LAT_HIST_SUB_BITS 2
+#define LAT_HIST_SUB (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_MAX_BITS 26
+#define LAT_HIST_BUCKETS ((LAT_HIST_MAX_BITS - LAT_HIST_SUB_BITS + 1) \
+			  * LAT_HIST_SUB)
+
+struct lat_hist {
+	uint64_t bucket[LAT_HIST_BUCKETS];
+};
+
 /* latency stats
  */
 struct op_latency {
 	uint64_t latency;
 	uint64_t min;
 	uint64_t max;
+	struct lat_hist hist;
 };
 
+/* Counter shards
+ *
+ * The busy counters are kept in STATS_SHARDS copies, each thread
+ * always updating the same one, so that workers on different CPUs
+ * are not all hitting the same cache lines.  Each copy ends in a
+ * cache line of padding.  Readers add the copies up.
+ */
+#define STATS_SHARDS 8
+
 /* v3 ops
  */
 struct nfsv3_ops {
 	uint64_t op[NFSPROC3_COMMIT+1];
+	struct op_latency latency[NFSPROC3_COMMIT+1];
+	GSH_CACHE_PAD(0);
 };
 
 /* quota ops
  */
 struct qta_ops {
 	uint64_t op[RQUOTAPROC_SETACTIVEQUOTA+1];
+	GSH_CACHE_PAD(0);
 };
 
 /* nlm ops
  */
 struct nlm_ops {
 	uint64_t op[NLMPROC4_FREE_ALL+1];
+	GSH_CACHE_PAD(0);
 };
 
 /* mount ops
  */
 struct mnt_ops {
 	uint64_t op[MOUNTPROC3_EXPORT+1];
+	GSH_CACHE_PAD(0);
 };
 
 /* v4 ops
  */
 struct nfsv4_ops {
 	uint64_t op[NFS4_OP_LAST_ONE];
+	struct op_latency latency[NFS4_OP_LAST_ONE];
+	GSH_CACHE_PAD(0);
 };
 
-/* basic op counter
+/* time spent in each phase of a request
  */
+struct op_phases {
+	struct op_latency phase[REQ_PHASES];
+};
 
-struct proto_op {
+/* 9P requests are even message types */
+#define _9P_PHASE_OPS ((_9P_TWSTAT >> 1) + 1)
+
+/* phase latencies
+ *
+ * NFSv4 is decoded, queued and replied to a compound at a time, so
+ * its ops only get execution and FSAL times.
+ */
+struct phase_ops {
+	struct op_phases v3[NFS_V3_NB_COMMAND];
+	struct op_phases v4;
+	struct op_latency v4_execute[NFS4_OP_LAST_ONE];
+	struct op_latency v4_fsal[NFS4_OP_LAST_ONE];
+#ifdef _USE_9P
+	struct op_phases _9p[_9P_PHASE_OPS];
+#endif
+	GSH_CACHE_PAD(0);
+};
+
+/* basic op counter, one shard
+ *
+ * Every update is bracketed by incrementing seq_begin and then
+ * seq_end, so that a reader can tell whether an update overlapped its
+ * copy; see proto_op_snapshot.
+ */
+
+struct proto_op_shard {
+	uint64_t seq_begin;	/* updates started */
+	uint64_t seq_end;	/* updates finished */
 	uint64_t total;		/* total of any kind */
 	uint64_t errors;	/* ! NFS_OK */
 	uint64_t dups;		/* detected dup requests */
+	uint64_t requested;	/* bytes asked for, transfers only */
+	uint64_t transferred;	/* bytes moved, transfers only */
 	struct op_latency latency;	/* either executed ops latency */
 	struct op_latency dup_latency;	/* or latency (runtime) to replay */
 	struct op_latency queue_latency;	/* queue wait time */
+	GSH_CACHE_PAD(0);
+};
+
+/* basic op counter
+ */
+
+struct proto_op {
+	struct proto_op_shard shard[STATS_SHARDS];
 };
 
 /* basic I/O transfer counter
  */
 struct xfer_op {
 	struct proto_op cmd;
-	uint64_t requested;
-	uint64_t transferred;
 };
 
 /* pNFS Layout counters
@@ -417,11 +493,12 @@ struct global_stats {
 	struct nfsv40_stats nfsv40;
 	struct nfsv41_stats nfsv41;
 	struct nfsv41_stats nfsv42; /* Uses v41 stats */
-	struct nfsv3_ops v3;
-	struct nfsv4_ops v4;
-	struct nlm_ops lm;
-	struct mnt_ops mn;
-	struct qta_ops qt;
+	struct nfsv3_ops v3[STATS_SHARDS];
+	struct nfsv4_ops v4[STATS_SHARDS];
+	struct nlm_ops lm[STATS_SHARDS];
+	struct mnt_ops mn[STATS_SHARDS];
+	struct qta_ops qt[STATS_SHARDS];
+	struct phase_ops ph[STATS_SHARDS];
 };
 
 struct deleg_stats {
@@ -435,6 +512,18 @@ struct deleg_stats {
 
 static struct global_stats global_st;
 
+const char *req_phase_name[REQ_PHASES] = {
+	[REQ_PHASE_DECODE] = "decode",
+	[REQ_PHASE_QUEUE] = "queue",
+	[REQ_PHASE_EXECUTE] = "execute",
+	[REQ_PHASE_FSAL] = "fsal",
+	[REQ_PHASE_REPLY] = "reply",
+};
+
+/* shard of the calling thread, assigned round-robin on first use */
+static __thread int32_t stats_shard = -1;
+static uint32_t stats_shard_next;
+
 /* include the top level server_stats struct definition
  */
 #include "server_stats_private.h"
@@ -558,6 +647,96 @@ static struct _9p_stats *get_9p(struct gsh_stats *stats, pthread_rwlock_t *lock)
 /* Functions for recording statistics
  */
 
+/**
+ * @brief Get the counter shard of the calling thread
+ */
+static inline uint32_t get_stats_shard(void)
+{
+	if (unlikely(stats_shard < 0))
+		stats_shard = atomic_inc_uint32_t(&stats_shard_next) &
+			      (STATS_SHARDS - 1);
+	return stats_shard;
+}
+
+/**
+ * @brief Mark the start and end of an update to an op shard
+ *
+ * More than one thread may update a shard, so rather than one
+ * sequence whose parity marks a writer, there is a count of updates
+ * started and a count of updates finished.
+ */
+static inline void shard_write_begin(struct proto_op_shard *sh)
+{
+	(void)atomic_inc_uint64_t(&sh->seq_begin);
+}
+
+static inline void shard_write_end(struct proto_op_shard *sh)
+{
+	(void)atomic_inc_uint64_t(&sh->seq_end);
+}
+
+/**
+ * @brief Find the histogram bucket of a latency
+ *
+ * @param nsecs [IN] the latency
+ *
+ * @return bucket index
+ */
+static inline uint32_t lat_hist_index(nsecs_elapsed_t nsecs)
+{
+	uint64_t units = nsecs >> LAT_HIST_UNIT_SHIFT;
+	uint32_t msb;
+
+	if (units < LAT_HIST_SUB)
+		return units;
+
+	msb = 63 - __builtin_clzll(units);
+	if (unlikely(msb >= LAT_HIST_MAX_BITS))
+		return LAT_HIST_BUCKETS - 1;
+
+	return (msb - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB +
+	       ((units >> (msb - LAT_HIST_SUB_BITS)) & (LAT_HIST_SUB - 1));
+}
+
+/**
+ * @brief Record one latency sample
+ *
+ * @param lat   [IN] latency stats struct
+ * @param nsecs [IN] the latency
+ */
+static inline void record_op_latency(struct op_latency *lat,
+				     nsecs_elapsed_t nsecs)
+{
+	(void)atomic_add_uint64_t(&lat->latency, nsecs);
+	if (lat->min == 0L || lat->min > nsecs)
+		(void)atomic_store_uint64_t(&lat->min, nsecs);
+	if (lat->max == 0L || lat->max < nsecs)
+		(void)atomic_store_uint64_t(&lat->max, nsecs);
+	(void)atomic_inc_uint64_t(&lat->hist.bucket[lat_hist_index(nsecs)]);
+}
+
+/**
+ * @brief Record latency stats in a shard
+ *
+ * @param sh           [IN] the caller's shard, being updated
+ * @param request_time [IN] time consumed by request
+ * @param qwait_time   [IN] time sitting on queue
+ * @param dup          [IN] detected this was a dup request
+ */
+static inline void record_shard_latency(struct proto_op_shard *sh,
+					nsecs_elapsed_t request_time,
+					nsecs_elapsed_t qwait_time, bool dup)
+{
+	/* dup latency is counted separately */
+	if (likely(!dup))
+		record_op_latency(&sh->latency, request_time);
+	else
+		record_op_latency(&sh->dup_latency, request_time);
+
+	/* record how long it was laying around waiting ... */
+	record_op_latency(&sh->queue_latency, qwait_time);
+}
+
 /**
  * @brief Record latency stats
  *
@@ -569,34 +748,11 @@ static struct _9p_stats *get_9p(struct gsh_stats *stats, pthread_rwlock_t *lock)
 void record_latency(struct proto_op *op, nsecs_elapsed_t request_time,
 		    nsecs_elapsed_t qwait_time, bool dup)
 {
+	struct proto_op_shard *sh = &op->shard[get_stats_shard()];
 
-	/* dup latency is counted separately */
-	if (likely(!dup)) {
-		(void)atomic_add_uint64_t(&op->latency.latency, request_time);
-		if (op->latency.min == 0L || op->latency.min > request_time)
-			(void)atomic_store_uint64_t(&op->latency.min,
-						    request_time);
-		if (op->latency.max == 0L || op->latency.max < request_time)
-			(void)atomic_store_uint64_t(&op->latency.max,
-						    request_time);
-	} else {
-		(void)atomic_add_uint64_t(&op->dup_latency.latency,
-					  request_time);
-		if (op->dup_latency.min == 0L
-		    || op->dup_latency.min > request_time)
-			(void)atomic_store_uint64_t(&op->dup_latency.min,
-						    request_time);
-		if (op->dup_latency.max == 0L
-		    || op->dup_latency.max < request_time)
-			(void)atomic_store_uint64_t(&op->dup_latency.max,
-						    request_time);
-	}
-	/* record how long it was laying around waiting ... */
-	(void)atomic_add_uint64_t(&op->queue_latency.latency, qwait_time);
-	if (op->queue_latency.min == 0L || op->queue_latency.min > qwait_time)
-		(void)atomic_store_uint64_t(&op->queue_latency.min, qwait_time);
-	if (op->queue_latency.max == 0L || op->queue_latency.max < qwait_time)
-		(void)atomic_store_uint64_t(&op->queue_latency.max, qwait_time);
+	shard_write_begin(sh);
+	record_shard_latency(sh, request_time, qwait_time, dup);
+	shard_write_end(sh);
 }
 
 /**
@@ -614,13 +770,17 @@ void record_latency(struct proto_op *op, nsecs_elapsed_t request_time,
 static void record_io(struct xfer_op *iop, size_t requested, size_t transferred,
 		      bool success)
 {
-	(void)atomic_inc_uint64_t(&iop->cmd.total);
+	struct proto_op_shard *sh = &iop->cmd.shard[get_stats_shard()];
+
+	shard_write_begin(sh);
+	(void)atomic_inc_uint64_t(&sh->total);
 	if (success) {
-		(void)atomic_add_uint64_t(&iop->requested, requested);
-		(void)atomic_add_uint64_t(&iop->transferred, transferred);
+		(void)atomic_add_uint64_t(&sh->requested, requested);
+		(void)atomic_add_uint64_t(&sh->transferred, transferred);
 	} else {
-		(void)atomic_inc_uint64_t(&iop->cmd.errors);
+		(void)atomic_inc_uint64_t(&sh->errors);
 	}
+	shard_write_end(sh);
 	/* somehow we must record latency */
 }
 
@@ -672,9 +832,9 @@ static void record_io_stats(struct gsh_stats *gsh_st, pthread_rwlock_t *lock,
 /**
  * @brief count the protocol operation
  *
- * Use atomic ops to avoid locks. We don't lock for the max
- * and min because if there is a collision, over the long haul,
- * the error is near zero...
+ * Use atomic ops on the shard of the thread to avoid locks. We don't
+ * lock for the max and min because if there is a collision, over the
+ * long haul, the error is near zero...
  *
  * @param op           [IN] pointer to specific protocol struct
  * @param request_time [IN] wallclock time (nsecs) for this op
@@ -686,17 +846,38 @@ static void record_io_stats(struct gsh_stats *gsh_st, pthread_rwlock_t *lock,
 static void record_op(struct proto_op *op, nsecs_elapsed_t request_time,
 		      nsecs_elapsed_t qwait_time, bool success, bool dup)
 {
+	struct proto_op_shard *sh = &op->shard[get_stats_shard()];
+
+	shard_write_begin(sh);
 	/* count the op */
-	(void)atomic_inc_uint64_t(&op->total);
+	(void)atomic_inc_uint64_t(&sh->total);
 	/* also count it as an error if protocol not happy */
 	if (!success)
-		(void)atomic_inc_uint64_t(&op->errors);
+		(void)atomic_inc_uint64_t(&sh->errors);
 	if (unlikely(dup))
-		(void)atomic_inc_uint64_t(&op->dups);
-	record_latency(op, request_time, qwait_time, dup);
+		(void)atomic_inc_uint64_t(&sh->dups);
+	record_shard_latency(sh, request_time, qwait_time, dup);
+	shard_write_end(sh);
 }
 
 #ifdef USE_DBUS
+/**
+ *  @brief reset the latency counters
+ *  Use atomic ops to avoid locks.
+ *  @param lat          [IN] pointer to latency stats struct
+ */
+
+static void reset_op_latency(struct op_latency *lat)
+{
+	int i;
+
+	(void)atomic_store_uint64_t(&lat->latency, 0);
+	(void)atomic_store_uint64_t(&lat->min, 0);
+	(void)atomic_store_uint64_t(&lat->max, 0);
+	for (i = 0; i < LAT_HIST_BUCKETS; i++)
+		(void)atomic_store_uint64_t(&lat->hist.bucket[i], 0);
+}
+
 /**
  *  @brief reset the counts for protocol operation
  *  Use atomic ops to avoid locks.
@@ -705,19 +886,23 @@ static void record_op(struct proto_op *op, nsecs_elapsed_t request_time,
 
 static void reset_op(struct proto_op *op)
 {
-	(void)atomic_store_uint64_t(&op->total, 0);
-	(void)atomic_store_uint64_t(&op->errors, 0);
-	(void)atomic_store_uint64_t(&op->dups, 0);
-	/* reset latency related counters */
-	(void)atomic_store_uint64_t(&op->latency.latency, 0);
-	(void)atomic_store_uint64_t(&op->latency.min, 0);
-	(void)atomic_store_uint64_t(&op->latency.max, 0);
-	(void)atomic_store_uint64_t(&op->dup_latency.latency, 0);
-	(void)atomic_store_uint64_t(&op->dup_latency.min, 0);
-	(void)atomic_store_uint64_t(&op->dup_latency.max, 0);
-	(void)atomic_store_uint64_t(&op->queue_latency.latency, 0);
-	(void)atomic_store_uint64_t(&op->queue_latency.min, 0);
-	(void)atomic_store_uint64_t(&op->queue_latency.max, 0);
+	struct proto_op_shard *sh;
+	int i;
+
+	for (i = 0; i < STATS_SHARDS; i++) {
+		sh = &op->shard[i];
+		shard_write_begin(sh);
+		(void)atomic_store_uint64_t(&sh->total, 0);
+		(void)atomic_store_uint64_t(&sh->errors, 0);
+		(void)atomic_store_uint64_t(&sh->dups, 0);
+		(void)atomic_store_uint64_t(&sh->requested, 0);
+		(void)atomic_store_uint64_t(&sh->transferred, 0);
+		/* reset latency related counters */
+		reset_op_latency(&sh->latency);
+		reset_op_latency(&sh->dup_latency);
+		reset_op_latency(&sh->queue_latency);
+		shard_write_end(sh);
+	}
 }
 
 /**
@@ -729,8 +914,6 @@ static void reset_op(struct proto_op *op)
 static void reset_xfer_op(struct xfer_op *xfer)
 {
 	reset_op(&xfer->cmd);
-	(void)atomic_store_uint64_t(&xfer->requested, 0);
-	(void)atomic_store_uint64_t(&xfer->transferred, 0);
 }
 
 /**
@@ -1181,6 +1364,43 @@ void server_stats_9p_done(u8 opc, struct _9p_request_data *req9p)
 }
 #endif
 
+/**
+ * @brief Feed the heavy hitter trackers with a finished request
+ *
+ * NFSv4 is fed per operation by server_stats_nfsv4_op_done.
+ */
+static void record_topk(request_data_t *reqdata, struct gsh_client *client,
+			uint32_t program_op, uint32_t proto_op)
+{
+	nfs_fh3 *fh;
+	enum stats_proto proto;
+
+	if (program_op == NFS_PROGRAM && op_ctx->nfs_vers == NFS_V3)
+		proto = STATS_NFSV3;
+	else if (program_op == NFS_program[P_NLM])
+		proto = STATS_NLM;
+	else if (program_op == NFS_program[P_MNT])
+		proto = STATS_MNT;
+	else if (program_op == NFS_program[P_RQUOTA])
+		proto = STATS_RQUOTA;
+	else
+		return;
+
+	if (client != NULL)
+		topk_record(TOPK_CLIENT_OP, client->hostaddr_str,
+			    strlen(client->hostaddr_str), proto, proto_op, 1);
+
+	/* Every NFSv3 procedure but NULL starts with the handle it works
+	 * on.
+	 */
+	if (proto == STATS_NFSV3 && proto_op != NFSPROC3_NULL) {
+		fh = (nfs_fh3 *) &reqdata->r_u.req.arg_nfs;
+		if (fh->data.data_len > 0)
+			topk_record(TOPK_FILE_OP, fh->data.data_val,
+				    fh->data.data_len, proto, proto_op, 1);
+	}
+}
+
 /**
  * @brief record NFS op finished
  *
@@ -1195,21 +1415,28 @@ void server_stats_nfs_done(request_data_t *reqdata, int rc, bool dup)
 	struct svc_req *req = &reqdata->r_u.req.svc;
 	uint32_t proto_op = req->rq_msg.cb_proc;
 	uint32_t program_op = req->rq_msg.cb_prog;
+	uint32_t shard = get_stats_shard();
 
 	if (program_op == NFS_PROGRAM && op_ctx->nfs_vers == NFS_V3)
-		global_st.v3.op[proto_op]++;
+		global_st.v3[shard].op[proto_op]++;
 	else if (program_op == NFS_program[P_NLM])
-		global_st.lm.op[proto_op]++;
+		global_st.lm[shard].op[proto_op]++;
 	else if (program_op == NFS_program[P_MNT])
-		global_st.mn.op[proto_op]++;
+		global_st.mn[shard].op[proto_op]++;
 	else if (program_op == NFS_program[P_RQUOTA])
-		global_st.qt.op[proto_op]++;
+		global_st.qt[shard].op[proto_op]++;
 
 	if (nfs_param.core_param.enable_FASTSTATS)
 		return;
 
+	if (!dup)
+		record_topk(reqdata, client, program_op, proto_op);
+
 	now(&current_time);
 	stop_time = timespec_diff(&ServerBootTime, &current_time);
+	if (program_op == NFS_PROGRAM && op_ctx->nfs_vers == NFS_V3 && !dup)
+		record_op_latency(&global_st.v3[shard].latency[proto_op],
+				  stop_time - op_ctx->start_time);
 	if (client != NULL) {
 		struct server_stats *server_st;
 
@@ -1240,15 +1467,18 @@ void server_stats_nfs_done(request_data_t *reqdata, int rc, bool dup)
  * Called from nfs4_compound at compound loop completion
  */
 
-void server_stats_nfsv4_op_done(int proto_op,
-				nsecs_elapsed_t start_time, int status)
+void server_stats_nfsv4_op_done(int proto_op, nsecs_elapsed_t start_time,
+				nsecs_elapsed_t fsal_time, int status,
+				nfs_fh4 *fh)
 {
 	struct gsh_client *client = op_ctx->client;
 	struct timespec current_time;
 	nsecs_elapsed_t stop_time;
+	uint32_t shard = get_stats_shard();
+	struct phase_ops *ph = &global_st.ph[shard];
 
 	if (op_ctx->nfs_vers == NFS_V4)
-		global_st.v4.op[proto_op]++;
+		global_st.v4[shard].op[proto_op]++;
 
 	if (nfs_param.core_param.enable_FASTSTATS)
 		return;
@@ -1256,9 +1486,26 @@ void server_stats_nfsv4_op_done(int proto_op,
 	now(&current_time);
 	stop_time = timespec_diff(&ServerBootTime, &current_time);
 
+	if (op_ctx->nfs_vers == NFS_V4) {
+		record_op_latency(&global_st.v4[shard].latency[proto_op],
+				  stop_time - start_time);
+		if (fsal_time > stop_time - start_time)
+			fsal_time = stop_time - start_time;
+		record_op_latency(&ph->v4_execute[proto_op],
+				  stop_time - start_time - fsal_time);
+		record_op_latency(&ph->v4_fsal[proto_op], fsal_time);
+	}
+
+	if (fh->nfs_fh4_len > 0)
+		topk_record(TOPK_FILE_OP, fh->nfs_fh4_val, fh->nfs_fh4_len,
+			    STATS_NFSV4, proto_op, 1);
+
 	if (client != NULL) {
 		struct server_stats *server_st;
 
+		topk_record(TOPK_CLIENT_OP, client->hostaddr_str,
+			    strlen(client->hostaddr_str), STATS_NFSV4,
+			    proto_op, 1);
 		server_st = container_of(client, struct server_stats, client);
 		record_nfsv4_op(&server_st->st, &client->lock, proto_op,
 				op_ctx->nfs_minorvers, stop_time - start_time,
@@ -1291,6 +1538,69 @@ void server_stats_nfsv4_op_done(int proto_op,
 	}
 }
 
+#ifdef _USE_9P
+/**
+ * @brief Phase table index of a 9P request
+ *
+ * Requests the interpreter has no function for share the index of
+ * message type 0 with it.
+ */
+static inline uint32_t _9p_phase_op(const char *msg)
+{
+	u8 msgtype = _9p_msgtype(msg);
+
+	if (msgtype < _9P_TSTATFS || msgtype > _9P_TWSTAT ||
+	    _9pfuncdesc[msgtype].service_function == NULL)
+		msgtype = 0;
+	return msgtype >> 1;
+}
+#endif
+
+/**
+ * @brief record the phase times of a request
+ *
+ * Called by the workers once the reply has gone out.  Only NFS and 9P
+ * requests are timed.
+ *
+ * @param reqdata [IN] the request, its phases closed
+ */
+
+void server_stats_phases_done(request_data_t *reqdata)
+{
+	struct phase_ops *ph = &global_st.ph[get_stats_shard()];
+	struct op_phases *ops = NULL;
+	struct svc_req *req;
+	int i;
+
+	if (nfs_param.core_param.enable_FASTSTATS)
+		return;
+
+	switch (reqdata->rtype) {
+	case NFS_REQUEST:
+		req = &reqdata->r_u.req.svc;
+		if (req->rq_msg.cb_prog != NFS_program[P_NFS])
+			break;
+		if (req->rq_msg.cb_vers == NFS_V3)
+			ops = &ph->v3[req->rq_msg.cb_proc];
+		else if (req->rq_msg.cb_vers == NFS_V4)
+			ops = &ph->v4;
+		break;
+#ifdef _USE_9P
+	case _9P_REQUEST:
+		ops = &ph->_9p[_9p_phase_op(reqdata->r_u._9p._9pmsg)];
+		break;
+#endif
+	default:
+		break;
+	}
+
+	if (ops == NULL)
+		return;
+
+	for (i = 0; i < REQ_PHASES; i++)
+		record_op_latency(&ops->phase[i], reqdata->phase[i]);
+}
+
 /**
  * @brief record NFS V4 compound finished
  *
@@ -1357,6 +1667,12 @@ void server_stats_io_done(size_t requested,
 			    export);
 		record_io_stats(&exp_st->st, &op_ctx->ctx_export->lock,
 				requested, transferred, success, is_write);
+		if (success)
+			topk_record(TOPK_EXPORT_BYTES,
+				    &op_ctx->ctx_export->export_id,
+				    sizeof(op_ctx->ctx_export->export_id), 0,
+				    is_write ? TOPK_IO_WRITE : TOPK_IO_READ,
+				    transferred);
 	}
 }
 
@@ -1426,6 +1742,250 @@ void inc_failed_recalls(struct gsh_client *client)
 	}
 }
 
+/* Functions for reading statistics
+ */
+
+/**
+ * @brief Name of a protocol operation
+ *
+ * @param proto [IN] protocol of the op
+ * @param op    [IN] the op
+ *
+ * @return the name, "UNKNOWN" for ops we do not know
+ */
+const char *server_stats_op_name(enum stats_proto proto, uint32_t op)
+{
+	const struct op_name *names;
+	uint32_t count;
+
+	switch (proto) {
+	case STATS_NFSV3:
+		names = optabv3;
+		count = sizeof(optabv3) / sizeof(optabv3[0]);
+		break;
+	case STATS_NFSV4:
+		names = optabv4;
+		count = sizeof(optabv4) / sizeof(optabv4[0]);
+		break;
+	case STATS_NLM:
+		names = optnlm;
+		count = sizeof(optnlm) / sizeof(optnlm[0]);
+		break;
+	case STATS_MNT:
+		names = optmnt;
+		count = sizeof(optmnt) / sizeof(optmnt[0]);
+		break;
+	case STATS_RQUOTA:
+		names = optqta;
+		count = sizeof(optqta) / sizeof(optqta[0]);
+		break;
+	default:
+		return "UNKNOWN";
+	}
+
+	if (op >= count || names[op].name == NULL)
+		return "UNKNOWN";
+	return names[op].name;
+}
+
+/**
+ * @brief Add up the shards of a counter
+ *
+ * @param counter [IN] the counter in the first shard
+ * @param stride  [IN] size of a shard
+ *
+ * @return the sum
+ */
+static uint64_t sum_shards(uint64_t *counter, size_t stride)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < STATS_SHARDS; i++)
+		sum += atomic_fetch_uint64_t(
+			(uint64_t *)((char *)counter + i * stride));
+	return sum;
+}
+
+/* Sum a counter over its shards
+ */
+#define shard_sum(_shards, _field) \
+	sum_shards(&(_shards)[0]._field, sizeof((_shards)[0]))
+
+/* Times a reader copies a shard again when an update overlapped it
+ * before settling for what it has
+ */
+#define STATS_SNAP_RETRIES 4
+
+/* A coherent copy of the counters of a proto_op
+ */
+struct proto_op_snap {
+	uint64_t total;
+	uint64_t errors;
+	uint64_t dups;
+	uint64_t requested;
+	uint64_t transferred;
+	uint64_t latency;
+	uint64_t dup_latency;
+	uint64_t queue_latency;
+};
+
+/**
+ * @brief Copy the counters of a protocol op
+ *
+ * Each shard is copied between reading its seq_end and its seq_begin.
+ * If no update started since the last one finished, nothing changed
+ * under the copy, so the op's total, errors, bytes and latency agree
+ * with each other.  Otherwise the shard is copied again, a few times
+ * at most.  The reader takes no lock and the writers never wait for
+ * it.
+ *
+ * @param op   [IN] the op, NULL if not in use
+ * @param snap [OUT] the sums over the shards
+ */
+static void proto_op_snapshot(struct proto_op *op, struct proto_op_snap *snap)
+{
+	struct proto_op_shard *sh;
+	struct proto_op_snap copy;
+	uint64_t end;
+	int i, try;
+
+	memset(snap, 0, sizeof(*snap));
+	if (op == NULL)
+		return;
+
+	for (i = 0; i < STATS_SHARDS; i++) {
+		sh = &op->shard[i];
+		for (try = 0; ; try++) {
+			end = atomic_fetch_uint64_t(&sh->seq_end);
+			copy.total = atomic_fetch_uint64_t(&sh->total);
+			copy.errors = atomic_fetch_uint64_t(&sh->errors);
+			copy.dups = atomic_fetch_uint64_t(&sh->dups);
+			copy.requested = atomic_fetch_uint64_t(&sh->requested);
+			copy.transferred =
+				atomic_fetch_uint64_t(&sh->transferred);
+			copy.latency =
+				atomic_fetch_uint64_t(&sh->latency.latency);
+			copy.dup_latency =
+				atomic_fetch_uint64_t(&sh->dup_latency.latency);
+			copy.queue_latency =
+			      atomic_fetch_uint64_t(&sh->queue_latency.latency);
+			if (atomic_fetch_uint64_t(&sh->seq_begin) == end ||
+			    try == STATS_SNAP_RETRIES)
+				break;
+		}
+		snap->total += copy.total;
+		snap->errors += copy.errors;
+		snap->dups += copy.dups;
+		snap->requested += copy.requested;
+		snap->transferred += copy.transferred;
+		snap->latency += copy.latency;
+		snap->dup_latency += copy.dup_latency;
+		snap->queue_latency += copy.queue_latency;
+	}
+}
+
+/**
+ * @brief Upper bound of a histogram bucket
+ *
+ * @param idx [IN] bucket index
+ *
+ * @return first latency in nsecs past the bucket
+ */
+static uint64_t lat_hist_bound(uint32_t idx)
+{
+	uint32_t msb;
+	uint64_t units;
+
+	if (idx == LAT_HIST_BUCKETS - 1)
+		return UINT64_MAX;	/* it takes everything larger */
+
+	if (idx < LAT_HIST_SUB)
+		return (uint64_t)(idx + 1) << LAT_HIST_UNIT_SHIFT;
+
+	msb = idx / LAT_HIST_SUB + LAT_HIST_SUB_BITS - 1;
+	units = (uint64_t)(LAT_HIST_SUB + idx % LAT_HIST_SUB + 1)
+		<< (msb - LAT_HIST_SUB_BITS);
+
+	return units << LAT_HIST_UNIT_SHIFT;
+}
+
+/**
+ * @brief Number of samples in a histogram
+ *
+ * @param hist   [IN] the histogram in the first shard
+ * @param stride [IN] size of a shard
+ */
+static uint64_t lat_hist_count(struct lat_hist *hist, size_t stride)
+{
+	uint64_t count = 0;
+	uint32_t i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; i++)
+		count += sum_shards(&hist->bucket[i], stride);
+	return count;
+}
+
+/* Called for each phase histogram with samples, op and phase named,
+ * the latency struct of the first shard.
+ */
+typedef void (*phase_cb_t)(const char *proto, const char *op,
+			   enum req_phase phase, struct op_latency *lat,
+			   void *arg);
+
+/**
+ * @brief Report one timed op
+ */
+static void phase_report(const char *proto, const char *op,
+			 struct op_latency *lat, enum req_phase first,
+			 enum req_phase last, phase_cb_t cb, void *arg)
+{
+	int i;
+
+	for (i = first; i <= last; i++) {
+		if (lat_hist_count(&lat[i - first].hist,
+				   sizeof(global_st.ph[0])) != 0)
+			cb(proto, op, i, &lat[i - first], arg);
+	}
+}
+
+/**
+ * @brief Walk the phase histograms that have samples
+ *
+ * @param cb  [IN] called for each
+ * @param arg [IN] passed to cb
+ */
+static void foreach_phase(phase_cb_t cb, void *arg)
+{
+	struct phase_ops *ph = &global_st.ph[0];
+	int i;
+
+	for (i = 0; i < NFS_V3_NB_COMMAND; i++)
+		phase_report("NFSv3", optabv3[i].name, ph->v3[i].phase,
+			     REQ_PHASE_DECODE, REQ_PHASE_REPLY, cb, arg);
+
+	phase_report("NFSv4", "COMPOUND", ph->v4.phase, REQ_PHASE_DECODE,
+		     REQ_PHASE_REPLY, cb, arg);
+	for (i = 0; i < NFS4_OP_LAST_ONE; i++) {
+		if (optabv4[i].name == NULL)
+			continue;
+		phase_report("NFSv4", optabv4[i].name, &ph->v4_execute[i],
+			     REQ_PHASE_EXECUTE, REQ_PHASE_EXECUTE, cb, arg);
+		phase_report("NFSv4", optabv4[i].name, &ph->v4_fsal[i],
+			     REQ_PHASE_FSAL, REQ_PHASE_FSAL, cb, arg);
+	}
+
+#ifdef _USE_9P
+	for (i = 0; i < _9P_PHASE_OPS; i++) {
+		if (_9pfuncdesc[i << 1].funcname == NULL)
+			continue;
+		phase_report("9P", _9pfuncdesc[i << 1].funcname,
+			     ph->_9p[i].phase, REQ_PHASE_DECODE,
+			     REQ_PHASE_REPLY, cb, arg);
+	}
+#endif
+}
+
 #ifdef USE_DBUS
 
 /* Functions for marshalling statistics to DBUS
@@ -1483,7 +2043,6 @@ void server_stats_summary(DBusMessageIter *iter, struct gsh_stats *st)
 				       &stats_available);
 }
 
-#ifdef _USE_9P
 /** @brief Report protocol operation statistics
  *
  * struct proto_op {
@@ -1498,17 +2057,17 @@ void server_stats_summary(DBusMessageIter *iter, struct gsh_stats *st)
 static void server_dbus_op_stats(struct proto_op *op, DBusMessageIter *iter)
 {
 	DBusMessageIter struct_iter;
-	uint64_t zero = 0;
+	struct proto_op_snap snap;
 
+	proto_op_snapshot(op, &snap);
 	dbus_message_iter_open_container(iter, DBUS_TYPE_STRUCT, NULL,
 					 &struct_iter);
 	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				       op == NULL ? &zero : &op->total);
+				       &snap.total);
 	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				       op == NULL ? &zero : &op->errors);
+				       &snap.errors);
 	dbus_message_iter_close_container(iter, &struct_iter);
 }
-#endif
 
 /**
  * @brief Report I/O statistics as a struct
@@ -1529,21 +2088,23 @@ static void server_dbus_op_stats(struct proto_op *op, DBusMessageIter *iter)
 static void server_dbus_iostats(struct xfer_op *iop, DBusMessageIter *iter)
 {
 	DBusMessageIter struct_iter;
+	struct proto_op_snap snap;
+	uint64_t stats[6];
+	int i;
+
+	proto_op_snapshot(iop == NULL ? NULL : &iop->cmd, &snap);
+	stats[0] = snap.requested;
+	stats[1] = snap.transferred;
+	stats[2] = snap.total;
+	stats[3] = snap.errors;
+	stats[4] = snap.latency;
+	stats[5] = snap.queue_latency;
 
 	dbus_message_iter_open_container(iter, DBUS_TYPE_STRUCT, NULL,
 					 &struct_iter);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				       &iop->requested);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				       &iop->transferred);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				       &iop->cmd.total);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				       &iop->cmd.errors);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				       &iop->cmd.latency.latency);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				       &iop->cmd.queue_latency.latency);
+	for (i = 0; i < 6; i++)
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &stats[i]);
 	dbus_message_iter_close_container(iter, &struct_iter);
 }
 
@@ -1571,176 +2132,428 @@ static void server_dbus_transportstats(struct transport_stats *tstats,
 }
 #endif
 
+/**
+ * @brief Report the total of a protocol op struct after its name
+ *
+ * @param name  [IN] the name
+ * @param op    [IN] the op struct, NULL if not in use
+ * @param iter  [IN] interator in reply stream to fill
+ */
+static void server_dbus_op_total(char *name, struct proto_op *op,
+				 DBusMessageIter *iter)
+{
+	struct proto_op_snap snap;
+
+	proto_op_snapshot(op, &snap);
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &name);
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_UINT64, &snap.total);
+}
+
 void server_dbus_total(struct export_stats *export_st, DBusMessageIter *iter)
 {
 	DBusMessageIter struct_iter;
-	uint64_t total = 0;
-	char *version;
+	struct gsh_stats *st = &export_st->st;
 
 	dbus_message_iter_open_container(iter, DBUS_TYPE_STRUCT, NULL,
 					 &struct_iter);
 
-	version = "NFSv3";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	if (export_st->st.nfsv3 == NULL)
-		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				&total);
-	else
-		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				&export_st->st.nfsv3->cmds.total);
-	version = "NFSv40";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	if (export_st->st.nfsv40 == NULL)
-		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				&total);
-	else
-		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				&export_st->st.nfsv40->compounds.total);
-	version = "NFSv41";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	if (export_st->st.nfsv41 == NULL)
-		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				&total);
-	else
-		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				&export_st->st.nfsv41->compounds.total);
-	version = "NFSv42";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	if (export_st->st.nfsv42 == NULL)
-		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				&total);
-	else
-		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-				&export_st->st.nfsv42->compounds.total);
+	server_dbus_op_total("NFSv3",
+			     st->nfsv3 == NULL ? NULL : &st->nfsv3->cmds,
+			     &struct_iter);
+	server_dbus_op_total("NFSv40",
+			     st->nfsv40 == NULL ? NULL
+						: &st->nfsv40->compounds,
+			     &struct_iter);
+	server_dbus_op_total("NFSv41",
+			     st->nfsv41 == NULL ? NULL
+						: &st->nfsv41->compounds,
+			     &struct_iter);
+	server_dbus_op_total("NFSv42",
+			     st->nfsv42 == NULL ? NULL
+						: &st->nfsv42->compounds,
+			     &struct_iter);
 	dbus_message_iter_close_container(iter, &struct_iter);
 }
 
+/**
+ * @brief Report a protocol's ops and I/O as one struct
+ *
+ * @param name       [IN] the protocol
+ * @param op         [IN] its op, or compound, counter
+ * @param read       [IN] its read counter, NULL if it has none
+ * @param write      [IN] its write counter, NULL if it has none
+ * @param array_iter [IN] the array to add to
+ */
+static void server_dbus_proto_entry(char *name, struct proto_op *op,
+				    struct xfer_op *read,
+				    struct xfer_op *write,
+				    DBusMessageIter *array_iter)
+{
+	DBusMessageIter struct_iter;
+
+	dbus_message_iter_open_container(array_iter, DBUS_TYPE_STRUCT, NULL,
+					 &struct_iter);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &name);
+	server_dbus_op_stats(op, &struct_iter);
+	server_dbus_iostats(read, &struct_iter);
+	server_dbus_iostats(write, &struct_iter);
+	dbus_message_iter_close_container(array_iter, &struct_iter);
+}
+
+/**
+ * @brief Report every counter block of a client or export in use
+ *
+ * The counters are read as proto_op snapshots, so this is safe to
+ * call for many clients in one reply without slowing the workers.
+ *
+ * @param st   [IN] the stats
+ * @param iter [IN] interator in reply stream to fill
+ */
+void server_dbus_proto_stats(struct gsh_stats *st, DBusMessageIter *iter)
+{
+	DBusMessageIter array_iter;
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					 PROTO_STATS_ARRAY_TYPE, &array_iter);
+	if (st->nfsv3 != NULL)
+		server_dbus_proto_entry("NFSv3", &st->nfsv3->cmds,
+					&st->nfsv3->read, &st->nfsv3->write,
+					&array_iter);
+	if (st->nfsv40 != NULL)
+		server_dbus_proto_entry("NFSv40", &st->nfsv40->compounds,
+					&st->nfsv40->read, &st->nfsv40->write,
+					&array_iter);
+	if (st->nfsv41 != NULL)
+		server_dbus_proto_entry("NFSv41", &st->nfsv41->compounds,
+					&st->nfsv41->read, &st->nfsv41->write,
+					&array_iter);
+	if (st->nfsv42 != NULL)
+		server_dbus_proto_entry("NFSv42", &st->nfsv42->compounds,
+					&st->nfsv42->read, &st->nfsv42->write,
+					&array_iter);
+	if (st->mnt != NULL) {
+		server_dbus_proto_entry("MNTv1", &st->mnt->v1_ops, NULL, NULL,
+					&array_iter);
+		server_dbus_proto_entry("MNTv3", &st->mnt->v3_ops, NULL, NULL,
+					&array_iter);
+	}
+	if (st->nlm4 != NULL)
+		server_dbus_proto_entry("NLMv4", &st->nlm4->ops, NULL, NULL,
+					&array_iter);
+	if (st->rquota != NULL) {
+		server_dbus_proto_entry("RQUOTA", &st->rquota->ops, NULL, NULL,
+					&array_iter);
+		server_dbus_proto_entry("RQUOTA_EXT", &st->rquota->ext_ops,
+					NULL, NULL, &array_iter);
+	}
+#ifdef _USE_9P
+	if (st->_9p != NULL)
+		server_dbus_proto_entry("9P", &st->_9p->cmds, &st->_9p->read,
+					&st->_9p->write, &array_iter);
+#endif
+	dbus_message_iter_close_container(iter, &array_iter);
+}
+
 void global_dbus_total(DBusMessageIter *iter)
 {
 	DBusMessageIter struct_iter;
-	char *version;
 
 	dbus_message_iter_open_container(iter, DBUS_TYPE_STRUCT, NULL,
 					 &struct_iter);
 
-	version = "NFSv3";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-					&global_st.nfsv3.cmds.total);
-	version = "NFSv40";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-					&global_st.nfsv40.compounds.total);
-	version = "NFSv41";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-					&global_st.nfsv41.compounds.total);
-	version = "NFSv42";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-					&global_st.nfsv42.compounds.total);
-	version = "NLM4";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-					&global_st.nlm4.ops.total);
-	version = "MNTv1";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-					&global_st.mnt.v1_ops.total);
-	version = "MNTv3";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-					&global_st.mnt.v3_ops.total);
-	version = "RQUOTA";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
-					&global_st.rquota.ops.total);
+	server_dbus_op_total("NFSv3", &global_st.nfsv3.cmds, &struct_iter);
+	server_dbus_op_total("NFSv40", &global_st.nfsv40.compounds,
+			     &struct_iter);
+	server_dbus_op_total("NFSv41", &global_st.nfsv41.compounds,
+			     &struct_iter);
+	server_dbus_op_total("NFSv42", &global_st.nfsv42.compounds,
+			     &struct_iter);
+	server_dbus_op_total("NLM4", &global_st.nlm4.ops, &struct_iter);
+	server_dbus_op_total("MNTv1", &global_st.mnt.v1_ops, &struct_iter);
+	server_dbus_op_total("MNTv3", &global_st.mnt.v3_ops, &struct_iter);
+	server_dbus_op_total("RQUOTA", &global_st.rquota.ops, &struct_iter);
 	dbus_message_iter_close_container(iter, &struct_iter);
 }
 
-void global_dbus_fast(DBusMessageIter *iter)
+/**
+ * @brief Report the ops of one protocol that have been seen
+ *
+ * @param iter    [IN] interator in reply stream to fill
+ * @param version [IN] protocol heading
+ * @param ops     [IN] op counters of the first shard
+ * @param stride  [IN] size of a shard
+ * @param names   [IN] op names
+ * @param count   [IN] number of ops
+ */
+static void global_dbus_fast_ops(DBusMessageIter *iter, char *version,
+				 uint64_t *ops, size_t stride,
+				 const struct op_name *names, int count)
 {
-	DBusMessageIter struct_iter;
-	char *version;
+	uint64_t total;
 	char *op;
 	int i;
 
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &version);
+	for (i = 0; i < count; i++) {
+		total = sum_shards(&ops[i], stride);
+		if (total > 0) {
+			op = names[i].name;
+			dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING,
+						       &op);
+			dbus_message_iter_append_basic(iter, DBUS_TYPE_UINT64,
+						       &total);
+		}
+	}
+}
+
+void global_dbus_fast(DBusMessageIter *iter)
+{
+	DBusMessageIter struct_iter;
+
 	dbus_message_iter_open_container(iter, DBUS_TYPE_STRUCT, NULL,
 					 &struct_iter);
 
-	version = "NFSv3:";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	for (i = 0; i < NFSPROC3_COMMIT; i++) {
-		if (global_st.v3.op[i] > 0) {
-			op = optabv3[i].name;
-			dbus_message_iter_append_basic(&struct_iter,
-					DBUS_TYPE_STRING, &op);
-			dbus_message_iter_append_basic(&struct_iter,
-					DBUS_TYPE_UINT64, &global_st.v3.op[i]);
-		}
+	global_dbus_fast_ops(&struct_iter, "NFSv3:", global_st.v3[0].op,
+			     sizeof(global_st.v3[0]), optabv3,
+			     NFSPROC3_COMMIT);
+	global_dbus_fast_ops(&struct_iter, "\nNFSv4:", global_st.v4[0].op,
+			     sizeof(global_st.v4[0]), optabv4,
+			     NFS4_OP_LAST_ONE);
+	global_dbus_fast_ops(&struct_iter, "\nNLM:", global_st.lm[0].op,
+			     sizeof(global_st.lm[0]), optnlm, NLM4_FAILED);
+	global_dbus_fast_ops(&struct_iter, "\nMNT:", global_st.mn[0].op,
+			     sizeof(global_st.mn[0]), optmnt,
+			     MOUNTPROC3_EXPORT);
+	global_dbus_fast_ops(&struct_iter, "\nQUOTA:", global_st.qt[0].op,
+			     sizeof(global_st.qt[0]), optqta,
+			     RQUOTAPROC_SETACTIVEQUOTA);
+	dbus_message_iter_close_container(iter, &struct_iter);
+}
+
+/**
+ * @brief Report a latency histogram as an array
+ *
+ * Only the buckets with samples are sent, in increasing order.
+ *
+ * array of (
+ *	uint64_t upper bound in nsecs (exclusive)
+ *	uint64_t count
+ * )
+ *
+ * @param hist   [IN] the histogram in the first shard
+ * @param stride [IN] size of a shard
+ * @param iter   [IN] interator in reply stream to fill
+ */
+static void server_dbus_lat_hist(struct lat_hist *hist, size_t stride,
+				 DBusMessageIter *iter)
+{
+	DBusMessageIter array_iter, struct_iter;
+	uint64_t bound, count;
+	uint32_t i;
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					 LAT_HIST_REPLY_TYPE, &array_iter);
+	for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+		count = sum_shards(&hist->bucket[i], stride);
+		if (count == 0)
+			continue;
+		bound = lat_hist_bound(i);
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &struct_iter);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &bound);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &count);
+		dbus_message_iter_close_container(&array_iter, &struct_iter);
 	}
-	version = "\nNFSv4:";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	for (i = 0; i < NFS4_OP_LAST_ONE; i++) {
-		if (global_st.v4.op[i] > 0) {
-			op = optabv4[i].name;
-			dbus_message_iter_append_basic(&struct_iter,
-					DBUS_TYPE_STRING, &op);
-			dbus_message_iter_append_basic(&struct_iter,
-					DBUS_TYPE_UINT64, &global_st.v4.op[i]);
-		}
+	dbus_message_iter_close_container(iter, &array_iter);
+}
+
+/**
+ * @brief Report the latency histograms of a protocol op struct
+ *
+ * struct {
+ *	char *name;
+ *	histogram latency;
+ *	histogram queue_wait;
+ * }
+ */
+static void server_dbus_op_latency(char *name, struct proto_op *op,
+				   DBusMessageIter *array_iter)
+{
+	DBusMessageIter struct_iter;
+
+	dbus_message_iter_open_container(array_iter, DBUS_TYPE_STRUCT, NULL,
+					 &struct_iter);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &name);
+	server_dbus_lat_hist(&op->shard[0].latency.hist,
+			     sizeof(op->shard[0]), &struct_iter);
+	server_dbus_lat_hist(&op->shard[0].queue_latency.hist,
+			     sizeof(op->shard[0]), &struct_iter);
+	dbus_message_iter_close_container(array_iter, &struct_iter);
+}
+
+/**
+ * @brief Report the latency histograms of an export or client
+ *
+ * One entry for each kind of request it has seen.
+ *
+ * @param st    [IN] the export or client stats
+ * @param iter  [IN] interator in reply stream to fill
+ */
+void server_dbus_latency(struct gsh_stats *st, DBusMessageIter *iter)
+{
+	DBusMessageIter array_iter;
+	struct timespec timestamp;
+
+	now(&timestamp);
+	dbus_append_timestamp(iter, &timestamp);
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					 LATENCY_REPLY_ARRAY_TYPE,
+					 &array_iter);
+	if (st->nfsv3 != NULL) {
+		server_dbus_op_latency("NFSv3", &st->nfsv3->cmds, &array_iter);
+		server_dbus_op_latency("NFSv3 READ", &st->nfsv3->read.cmd,
+				       &array_iter);
+		server_dbus_op_latency("NFSv3 WRITE", &st->nfsv3->write.cmd,
+				       &array_iter);
 	}
-	version = "\nNLM:";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	for (i = 0; i < NLM4_FAILED; i++) {
-		if (global_st.lm.op[i] > 0) {
-			op = optnlm[i].name;
-			dbus_message_iter_append_basic(&struct_iter,
-					DBUS_TYPE_STRING, &op);
-			dbus_message_iter_append_basic(&struct_iter,
-					DBUS_TYPE_UINT64, &global_st.lm.op[i]);
-		}
+	if (st->nfsv40 != NULL) {
+		server_dbus_op_latency("NFSv40", &st->nfsv40->compounds,
+				       &array_iter);
+		server_dbus_op_latency("NFSv40 READ", &st->nfsv40->read.cmd,
+				       &array_iter);
+		server_dbus_op_latency("NFSv40 WRITE", &st->nfsv40->write.cmd,
+				       &array_iter);
 	}
-	version = "\nMNT:";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	for (i = 0; i < MOUNTPROC3_EXPORT; i++) {
-		if (global_st.mn.op[i] > 0) {
-			op = optmnt[i].name;
-			dbus_message_iter_append_basic(&struct_iter,
-					DBUS_TYPE_STRING, &op);
-			dbus_message_iter_append_basic(&struct_iter,
-					DBUS_TYPE_UINT64, &global_st.mn.op[i]);
-		}
+	if (st->nfsv41 != NULL) {
+		server_dbus_op_latency("NFSv41", &st->nfsv41->compounds,
+				       &array_iter);
+		server_dbus_op_latency("NFSv41 READ", &st->nfsv41->read.cmd,
+				       &array_iter);
+		server_dbus_op_latency("NFSv41 WRITE", &st->nfsv41->write.cmd,
+				       &array_iter);
 	}
-	version = "\nQUOTA:";
-	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
-				       &version);
-	for (i = 0; i < RQUOTAPROC_SETACTIVEQUOTA; i++) {
-		if (global_st.qt.op[i] > 0) {
-			op = optqta[i].name;
-			dbus_message_iter_append_basic(&struct_iter,
-					DBUS_TYPE_STRING, &op);
-			dbus_message_iter_append_basic(&struct_iter,
-					DBUS_TYPE_UINT64, &global_st.qt.op[i]);
-		}
+	if (st->nfsv42 != NULL) {
+		server_dbus_op_latency("NFSv42", &st->nfsv42->compounds,
+				       &array_iter);
+		server_dbus_op_latency("NFSv42 READ", &st->nfsv42->read.cmd,
+				       &array_iter);
+		server_dbus_op_latency("NFSv42 WRITE", &st->nfsv42->write.cmd,
+				       &array_iter);
 	}
-	dbus_message_iter_close_container(iter, &struct_iter);
+	if (st->mnt != NULL) {
+		server_dbus_op_latency("MNTv1", &st->mnt->v1_ops, &array_iter);
+		server_dbus_op_latency("MNTv3", &st->mnt->v3_ops, &array_iter);
+	}
+	if (st->nlm4 != NULL)
+		server_dbus_op_latency("NLM4", &st->nlm4->ops, &array_iter);
+	if (st->rquota != NULL) {
+		server_dbus_op_latency("RQUOTA", &st->rquota->ops,
+				       &array_iter);
+		server_dbus_op_latency("RQUOTA EXT", &st->rquota->ext_ops,
+				       &array_iter);
+	}
+	dbus_message_iter_close_container(iter, &array_iter);
+}
+
+/**
+ * @brief Report the latency histograms of every NFS operation
+ *
+ * array of (
+ *	char *name;
+ *	histogram latency;
+ * )
+ *
+ * Operations never seen are left out.
+ *
+ * @param iter  [IN] interator in reply stream to fill
+ */
+void server_dbus_fast_latency(DBusMessageIter *iter)
+{
+	DBusMessageIter array_iter, struct_iter;
+	struct timespec timestamp;
+	char name[32];
+	char *namep = name;
+	int i;
+
+	now(&timestamp);
+	dbus_append_timestamp(iter, &timestamp);
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					 OP_LATENCY_REPLY_ARRAY_TYPE,
+					 &array_iter);
+	for (i = 0; i < NFS_V3_NB_COMMAND; i++) {
+		if (shard_sum(global_st.v3, op[i]) == 0)
+			continue;
+		snprintf(name, sizeof(name), "NFSv3 %s", optabv3[i].name);
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &struct_iter);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &namep);
+		server_dbus_lat_hist(&global_st.v3[0].latency[i].hist,
+				     sizeof(global_st.v3[0]), &struct_iter);
+		dbus_message_iter_close_container(&array_iter, &struct_iter);
+	}
+	for (i = 0; i < NFS4_OP_LAST_ONE; i++) {
+		if (shard_sum(global_st.v4, op[i]) == 0)
+			continue;
+		snprintf(name, sizeof(name), "NFSv4 %s", optabv4[i].name);
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &struct_iter);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &namep);
+		server_dbus_lat_hist(&global_st.v4[0].latency[i].hist,
+				     sizeof(global_st.v4[0]), &struct_iter);
+		dbus_message_iter_close_container(&array_iter, &struct_iter);
+	}
+	dbus_message_iter_close_container(iter, &array_iter);
+}
+
+static void server_dbus_phase_cb(const char *proto, const char *op,
+				 enum req_phase phase, struct op_latency *lat,
+				 void *arg)
+{
+	DBusMessageIter *array_iter = arg;
+	DBusMessageIter struct_iter;
+	char name[48];
+	char *namep = name;
+
+	snprintf(name, sizeof(name), "%s %s", proto, op);
+	dbus_message_iter_open_container(array_iter, DBUS_TYPE_STRUCT, NULL,
+					 &struct_iter);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &namep);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+				       &req_phase_name[phase]);
+	server_dbus_lat_hist(&lat->hist, sizeof(global_st.ph[0]),
+			     &struct_iter);
+	dbus_message_iter_close_container(array_iter, &struct_iter);
+}
+
+/**
+ * @brief Report the phase histograms of every operation
+ *
+ * array of (
+ *	char *name;
+ *	char *phase;
+ *	histogram latency;
+ * )
+ *
+ * Phases without samples are left out.
+ *
+ * @param iter  [IN] interator in reply stream to fill
+ */
+void server_dbus_phase_latency(DBusMessageIter *iter)
+{
+	DBusMessageIter array_iter;
+	struct timespec timestamp;
+
+	now(&timestamp);
+	dbus_append_timestamp(iter, &timestamp);
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					 PHASE_LATENCY_REPLY_ARRAY_TYPE,
+					 &array_iter);
+	foreach_phase(server_dbus_phase_cb, &array_iter);
+	dbus_message_iter_close_container(iter, &array_iter);
 }
 
 void server_dbus_v3_iostats(struct nfsv3_stats *v3p, DBusMessageIter *iter)
@@ -1881,28 +2694,56 @@ void reset_gsh_stats(struct gsh_stats *st)
 #endif
 }
 
-void reset_global_stats(void)
+static void reset_op_phases(struct op_phases *ops)
 {
 	int i;
-	/* Reset all ops counters of nfsv3 */
-	for (i = 0; i < NFSPROC3_COMMIT; i++) {
-		(void)atomic_store_uint64_t(&global_st.v3.op[i], 0);
-	}
-	/* Reset all ops counters of nfsv4 */
+
+	for (i = 0; i < REQ_PHASES; i++)
+		reset_op_latency(&ops->phase[i]);
+}
+
+static void reset_phase_ops(struct phase_ops *ph)
+{
+	int i;
+
+	for (i = 0; i < NFS_V3_NB_COMMAND; i++)
+		reset_op_phases(&ph->v3[i]);
+	reset_op_phases(&ph->v4);
 	for (i = 0; i < NFS4_OP_LAST_ONE; i++) {
-		(void)atomic_store_uint64_t(&global_st.v4.op[i], 0);
-	}
-	/* Reset all ops counters of lock manager */
-	for (i = 0; i < NLM4_FAILED; i++) {
-		(void)atomic_store_uint64_t(&global_st.lm.op[i], 0);
+		reset_op_latency(&ph->v4_execute[i]);
+		reset_op_latency(&ph->v4_fsal[i]);
 	}
-	/* Reset all ops counters of mountd */
-	for (i = 0; i < MOUNTPROC3_EXPORT; i++) {
-		(void)atomic_store_uint64_t(&global_st.mn.op[i], 0);
-	}
-	/* Reset all ops counters of rquotad */
-	for (i = 0; i < RQUOTAPROC_SETACTIVEQUOTA; i++) {
-		(void)atomic_store_uint64_t(&global_st.qt.op[i], 0);
+#ifdef _USE_9P
+	for (i = 0; i < _9P_PHASE_OPS; i++)
+		reset_op_phases(&ph->_9p[i]);
+#endif
+}
+
+void reset_global_stats(void)
+{
+	int i, k;
+
+	for (k = 0; k < STATS_SHARDS; k++) {
+		/* Reset all ops counters of nfsv3 */
+		for (i = 0; i < NFSPROC3_COMMIT; i++) {
+			(void)atomic_store_uint64_t(&global_st.v3[k].op[i], 0);
+			reset_op_latency(&global_st.v3[k].latency[i]);
+		}
+		/* Reset all ops counters of nfsv4 */
+		for (i = 0; i < NFS4_OP_LAST_ONE; i++) {
+			(void)atomic_store_uint64_t(&global_st.v4[k].op[i], 0);
+			reset_op_latency(&global_st.v4[k].latency[i]);
+		}
+		/* Reset all ops counters of lock manager */
+		for (i = 0; i < NLM4_FAILED; i++)
+			(void)atomic_store_uint64_t(&global_st.lm[k].op[i], 0);
+		/* Reset all ops counters of mountd */
+		for (i = 0; i < MOUNTPROC3_EXPORT; i++)
+			(void)atomic_store_uint64_t(&global_st.mn[k].op[i], 0);
+		/* Reset all ops counters of rquotad */
+		for (i = 0; i < RQUOTAPROC_SETACTIVEQUOTA; i++)
+			(void)atomic_store_uint64_t(&global_st.qt[k].op[i], 0);
+		reset_phase_ops(&global_st.ph[k]);
 	}
 	reset_nfsv3_stats(&global_st.nfsv3);
 	reset_nfsv40_stats(&global_st.nfsv40);
@@ -2071,6 +2912,395 @@ void server_dbus_delegations(struct deleg_stats *ds, DBusMessageIter *iter)
 
 #endif				/* USE_DBUS */
 
+/* Functions for the OpenMetrics endpoint
+ */
+
+/**
+ * @brief One protocol op struct of a stats block
+ */
+struct metrics_op {
+	const char *proto;
+	const char *kind;	/*< member of the proto stats struct */
+	struct proto_op *op;
+	bool xfer;		/*< read or write, with byte counts */
+};
+
+#define METRICS_OPS 24
+
+enum metrics_kind {
+	METRICS_REQUESTS,
+	METRICS_ERRORS,
+	METRICS_BYTES,
+	METRICS_LATENCY,
+	METRICS_QUEUE,
+};
+
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+} metrics_desc[] = {
+	[METRICS_REQUESTS] = {"requests", "counter", "Requests completed"},
+	[METRICS_ERRORS] = {"request_errors", "counter",
+			    "Requests completed with an error"},
+	[METRICS_BYTES] = {"request_bytes", "counter", "Bytes transferred"},
+	[METRICS_LATENCY] = {"request_latency_seconds", "histogram",
+			     "Time spent executing requests"},
+	[METRICS_QUEUE] = {"request_queue_seconds", "histogram",
+			   "Time requests waited for a worker"},
+};
+
+static int metrics_add_op(struct metrics_op *ops, int n, const char *proto,
+			  const char *kind, struct proto_op *op, bool xfer)
+{
+	ops[n].proto = proto;
+	ops[n].kind = kind;
+	ops[n].op = op;
+	ops[n].xfer = xfer;
+	return n + 1;
+}
+
+/**
+ * @brief List the protocol op structs of a stats block
+ *
+ * @param st  [IN] the stats block
+ * @param ops [OUT] array of METRICS_OPS to fill
+ *
+ * @return number of entries filled
+ */
+static int metrics_ops(struct gsh_stats *st, struct metrics_op *ops)
+{
+	int n = 0;
+
+	if (st->nfsv3 != NULL) {
+		n = metrics_add_op(ops, n, "NFSv3", "cmds", &st->nfsv3->cmds,
+				   false);
+		n = metrics_add_op(ops, n, "NFSv3", "read",
+				   &st->nfsv3->read.cmd, true);
+		n = metrics_add_op(ops, n, "NFSv3", "write",
+				   &st->nfsv3->write.cmd, true);
+	}
+	if (st->mnt != NULL) {
+		n = metrics_add_op(ops, n, "MNT", "v1_ops", &st->mnt->v1_ops,
+				   false);
+		n = metrics_add_op(ops, n, "MNT", "v3_ops", &st->mnt->v3_ops,
+				   false);
+	}
+	if (st->nlm4 != NULL)
+		n = metrics_add_op(ops, n, "NLM4", "ops", &st->nlm4->ops,
+				   false);
+	if (st->rquota != NULL) {
+		n = metrics_add_op(ops, n, "RQUOTA", "ops", &st->rquota->ops,
+				   false);
+		n = metrics_add_op(ops, n, "RQUOTA", "ext_ops",
+				   &st->rquota->ext_ops, false);
+	}
+	if (st->nfsv40 != NULL) {
+		n = metrics_add_op(ops, n, "NFSv40", "compounds",
+				   &st->nfsv40->compounds, false);
+		n = metrics_add_op(ops, n, "NFSv40", "read",
+				   &st->nfsv40->read.cmd, true);
+		n = metrics_add_op(ops, n, "NFSv40", "write",
+				   &st->nfsv40->write.cmd, true);
+	}
+	if (st->nfsv41 != NULL) {
+		n = metrics_add_op(ops, n, "NFSv41", "compounds",
+				   &st->nfsv41->compounds, false);
+		n = metrics_add_op(ops, n, "NFSv41", "read",
+				   &st->nfsv41->read.cmd, true);
+		n = metrics_add_op(ops, n, "NFSv41", "write",
+				   &st->nfsv41->write.cmd, true);
+	}
+	if (st->nfsv42 != NULL) {
+		n = metrics_add_op(ops, n, "NFSv42", "compounds",
+				   &st->nfsv42->compounds, false);
+		n = metrics_add_op(ops, n, "NFSv42", "read",
+				   &st->nfsv42->read.cmd, true);
+		n = metrics_add_op(ops, n, "NFSv42", "write",
+				   &st->nfsv42->write.cmd, true);
+	}
+#ifdef _USE_9P
+	if (st->_9p != NULL) {
+		n = metrics_add_op(ops, n, "9P", "cmds", &st->_9p->cmds, false);
+		n = metrics_add_op(ops, n, "9P", "read", &st->_9p->read.cmd,
+				   true);
+		n = metrics_add_op(ops, n, "9P", "write", &st->_9p->write.cmd,
+				   true);
+	}
+#endif
+	return n;
+}
+
+/**
+ * @brief Report a latency histogram
+ *
+ * Only the buckets ending on a power of two are reported, cumulative
+ * as OpenMetrics wants them, with bounds in seconds.
+ *
+ * @param out    [IN] page being built
+ * @param name   [IN] family name
+ * @param labels [IN] labels of the series
+ * @param hist   [IN] the histogram in the first shard
+ * @param stride [IN] size of a shard
+ * @param sum    [IN] sum of the samples in nsecs
+ */
+static void metrics_lat_hist(FILE *out, const char *name, const char *labels,
+			     struct lat_hist *hist, size_t stride,
+			     uint64_t sum)
+{
+	uint64_t count = 0;
+	uint64_t units;
+	uint32_t i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS - 1; i++) {
+		count += sum_shards(&hist->bucket[i], stride);
+		units = lat_hist_bound(i) >> LAT_HIST_UNIT_SHIFT;
+		if ((units & (units - 1)) != 0)
+			continue;
+		fprintf(out, "%s_bucket{%s,le=\"%.9f\"} %" PRIu64 "\n", name,
+			labels, (double)lat_hist_bound(i) / NS_PER_SEC, count);
+	}
+	count += sum_shards(&hist->bucket[i], stride);
+	fprintf(out, "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n", name, labels,
+		count);
+	fprintf(out, "%s_count{%s} %" PRIu64 "\n", name, labels, count);
+	fprintf(out, "%s_sum{%s} %.9f\n", name, labels,
+		(double)sum / NS_PER_SEC);
+}
+
+static void metrics_phase_cb(const char *proto, const char *op,
+			     enum req_phase phase, struct op_latency *lat,
+			     void *arg)
+{
+	char labels[96];
+
+	snprintf(labels, sizeof(labels),
+		 "proto=\"%s\",op=\"%s\",phase=\"%s\"", proto, op,
+		 req_phase_name[phase]);
+	metrics_lat_hist(arg, "ganesha_request_phase_seconds", labels,
+			 &lat->hist, sizeof(global_st.ph[0]),
+			 sum_shards(&lat->latency, sizeof(global_st.ph[0])));
+}
+
+/**
+ * @brief Report one family for the op structs of a stats block
+ *
+ * Op structs that never saw a request are left out.
+ *
+ * @param out    [IN] page being built
+ * @param name   [IN] family name
+ * @param labels [IN] labels of the block, each followed by a comma
+ * @param st     [IN] the stats block
+ * @param kind   [IN] what to report
+ */
+static void metrics_stats(FILE *out, const char *name, const char *labels,
+			  struct gsh_stats *st, enum metrics_kind kind)
+{
+	struct metrics_op ops[METRICS_OPS];
+	struct proto_op_shard *sh;
+	struct proto_op_snap snap;
+	char lbl[128];
+	int i, n;
+
+	n = metrics_ops(st, ops);
+	for (i = 0; i < n; i++) {
+		sh = ops[i].op->shard;
+		proto_op_snapshot(ops[i].op, &snap);
+		if (snap.total == 0)
+			continue;
+		snprintf(lbl, sizeof(lbl), "%sproto=\"%s\",kind=\"%s\"",
+			 labels, ops[i].proto, ops[i].kind);
+		switch (kind) {
+		case METRICS_REQUESTS:
+			fprintf(out, "%s_total{%s} %" PRIu64 "\n", name, lbl,
+				snap.total);
+			break;
+		case METRICS_ERRORS:
+			fprintf(out, "%s_total{%s} %" PRIu64 "\n", name, lbl,
+				snap.errors);
+			break;
+		case METRICS_BYTES:
+			if (ops[i].xfer)
+				fprintf(out, "%s_total{%s} %" PRIu64 "\n",
+					name, lbl, snap.transferred);
+			break;
+		case METRICS_LATENCY:
+			metrics_lat_hist(out, name, lbl, &sh[0].latency.hist,
+					 sizeof(sh[0]), snap.latency);
+			break;
+		case METRICS_QUEUE:
+			metrics_lat_hist(out, name, lbl,
+					 &sh[0].queue_latency.hist,
+					 sizeof(sh[0]), snap.queue_latency);
+			break;
+		}
+	}
+}
+
+struct metrics_walk {
+	FILE *out;
+	char name[64];
+	enum metrics_kind kind;
+	uint32_t clients;	/*< clients seen so far */
+};
+
+static bool metrics_export_cb(struct gsh_export *export, void *state)
+{
+	struct metrics_walk *walk = state;
+	struct export_stats *exp_st =
+		container_of(export, struct export_stats, export);
+	char labels[32];
+
+	snprintf(labels, sizeof(labels), "export_id=\"%d\",",
+		 export->export_id);
+	metrics_stats(walk->out, walk->name, labels, &exp_st->st, walk->kind);
+	return true;
+}
+
+static bool metrics_client_cb(struct gsh_client *client, void *state)
+{
+	struct metrics_walk *walk = state;
+	struct server_stats *server_st =
+		container_of(client, struct server_stats, client);
+	char labels[96];
+
+	/* Keep walking to count the clients left out */
+	if (walk->clients++ >= NFS_pcp.metrics_max_clients)
+		return true;
+
+	snprintf(labels, sizeof(labels), "client=\"%s\",",
+		 client->hostaddr_str);
+	metrics_stats(walk->out, walk->name, labels, &server_st->st,
+		      walk->kind);
+	return true;
+}
+
+/**
+ * @brief Report the calls to each op of a protocol
+ */
+static void metrics_op_counts(FILE *out, const char *proto, uint64_t *ops,
+			      size_t stride, const struct op_name *names,
+			      int count)
+{
+	uint64_t total;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		total = sum_shards(&ops[i], stride);
+		if (total == 0 || names[i].name == NULL)
+			continue;
+		fprintf(out,
+			"ganesha_op_requests_total{proto=\"%s\",op=\"%s\"} %"
+			PRIu64 "\n", proto, names[i].name, total);
+	}
+}
+
+/**
+ * @brief Report the server statistics
+ *
+ * Global totals and per op counts and latencies, then the same totals
+ * per export and per client.  A family's samples must be together, so
+ * the exports and clients are walked once per family.
+ *
+ * @param out [IN] page being built
+ */
+void server_stats_metrics(FILE *out)
+{
+	struct gsh_stats global = {
+		.nfsv3 = &global_st.nfsv3,
+		.mnt = &global_st.mnt,
+		.nlm4 = &global_st.nlm4,
+		.rquota = &global_st.rquota,
+		.nfsv40 = &global_st.nfsv40,
+		.nfsv41 = &global_st.nfsv41,
+		.nfsv42 = &global_st.nfsv42,
+	};
+	struct metrics_walk walk = {
+		.out = out,
+	};
+	char name[64];
+	char labels[64];
+	int kind, i;
+
+	for (kind = METRICS_REQUESTS; kind <= METRICS_QUEUE; kind++) {
+		snprintf(name, sizeof(name), "ganesha_%s",
+			 metrics_desc[kind].name);
+		metrics_family(out, name, metrics_desc[kind].type,
+			       metrics_desc[kind].help);
+		metrics_stats(out, name, "", &global, kind);
+	}
+
+	metrics_family(out, "ganesha_op_requests", "counter",
+		       "Requests completed, per operation");
+	metrics_op_counts(out, "NFSv3", global_st.v3[0].op,
+			  sizeof(global_st.v3[0]), optabv3,
+			  NFS_V3_NB_COMMAND);
+	metrics_op_counts(out, "NFSv4", global_st.v4[0].op,
+			  sizeof(global_st.v4[0]), optabv4, NFS4_OP_LAST_ONE);
+	metrics_op_counts(out, "NLM4", global_st.lm[0].op,
+			  sizeof(global_st.lm[0]), optnlm,
+			  NLM_V4_NB_OPERATION);
+	metrics_op_counts(out, "MNT", global_st.mn[0].op,
+			  sizeof(global_st.mn[0]), optmnt,
+			  MNT_V3_NB_COMMAND);
+	metrics_op_counts(out, "RQUOTA", global_st.qt[0].op,
+			  sizeof(global_st.qt[0]), optqta,
+			  RQUOTA_NB_COMMAND);
+
+	metrics_family(out, "ganesha_op_latency_seconds", "histogram",
+		       "Time spent executing requests, per operation");
+	for (i = 0; i < NFS_V3_NB_COMMAND; i++) {
+		if (shard_sum(global_st.v3, op[i]) == 0)
+			continue;
+		snprintf(labels, sizeof(labels), "proto=\"NFSv3\",op=\"%s\"",
+			 optabv3[i].name);
+		metrics_lat_hist(out, "ganesha_op_latency_seconds", labels,
+				 &global_st.v3[0].latency[i].hist,
+				 sizeof(global_st.v3[0]),
+				 shard_sum(global_st.v3, latency[i].latency));
+	}
+	for (i = 0; i < NFS4_OP_LAST_ONE; i++) {
+		if (shard_sum(global_st.v4, op[i]) == 0 ||
+		    optabv4[i].name == NULL)
+			continue;
+		snprintf(labels, sizeof(labels), "proto=\"NFSv4\",op=\"%s\"",
+			 optabv4[i].name);
+		metrics_lat_hist(out, "ganesha_op_latency_seconds", labels,
+				 &global_st.v4[0].latency[i].hist,
+				 sizeof(global_st.v4[0]),
+				 shard_sum(global_st.v4, latency[i].latency));
+	}
+
+	metrics_family(out, "ganesha_request_phase_seconds", "histogram",
+		       "Time spent in each phase of requests, per operation");
+	foreach_phase(metrics_phase_cb, out);
+
+	/* Queue wait is only kept globally */
+	for (kind = METRICS_REQUESTS; kind <= METRICS_LATENCY; kind++) {
+		walk.kind = kind;
+		snprintf(walk.name, sizeof(walk.name), "ganesha_export_%s",
+			 metrics_desc[kind].name);
+		metrics_family(out, walk.name, metrics_desc[kind].type,
+			       metrics_desc[kind].help);
+		(void)foreach_gsh_export(metrics_export_cb, false, &walk);
+	}
+
+	for (kind = METRICS_REQUESTS; kind <= METRICS_LATENCY; kind++) {
+		walk.kind = kind;
+		walk.clients = 0;
+		snprintf(walk.name, sizeof(walk.name), "ganesha_client_%s",
+			 metrics_desc[kind].name);
+		metrics_family(out, walk.name, metrics_desc[kind].type,
+			       metrics_desc[kind].help);
+		(void)foreach_gsh_client(metrics_client_cb, &walk);
+	}
+
+	metrics_scalar(out, "ganesha_metrics_clients_omitted", "gauge",
+		       "Clients past Metrics_Max_Clients left out",
+		       walk.clients > NFS_pcp.metrics_max_clients
+		       ? walk.clients - NFS_pcp.metrics_max_clients : 0);
+}
+
 /**
  * @brief Free statistics storage
  *
@@ -0,0 +1,418 @@
+/*
+ * vim:noexpandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @defgroup Server statistics management
+ * @{
+ */
+
+/**
+ * @file server_topk.c
+ * @brief Heavy hitter tracking
+ *
+ * Each tracker keeps the Topk_Entries heaviest keys with the
+ * Space-Saving algorithm: a key not in the table takes over the
+ * smallest counter, adding to its count and remembering it as the
+ * possible overestimate.  Any key heavier than 1/Topk_Entries of the
+ * stream is guaranteed to be there.
+ *
+ * Time is cut in windows of Topk_Window_S seconds, and a table is kept
+ * for the current and the previous window, so a report covers between
+ * one and two windows.  There are TOPK_SHARDS copies of everything,
+ * each thread using one, so that workers do not all take the same
+ * lock.  Reports merge the copies.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "log.h"
+#include "abstract_atomic.h"
+#include "abstract_mem.h"
+#include "gsh_intrinsic.h"
+#include "common_utils.h"
+#include "city.h"
+#include "nfs_core.h"
+#include "server_stats.h"
+#ifdef USE_DBUS
+#include "gsh_dbus.h"
+#endif
+#include "server_stats_private.h"
+#include "server_topk.h"
+
+#define TOPK_SHARDS 8
+/** Longest key kept, longer ones are cut */
+#define TOPK_KEY_MAX NFS4_FHSIZE
+
+struct topk_entry {
+	uint64_t count;
+	uint64_t error;		/*< count may be this much too high */
+	uint16_t proto;
+	uint16_t op;
+	uint16_t len;
+	uint8_t key[TOPK_KEY_MAX];
+};
+
+struct topk_window {
+	time_t epoch;		/*< time / Topk_Window_S */
+	uint32_t used;
+	uint64_t *hash;		/*< hashes of the entries, scanned first */
+	struct topk_entry *entry;
+};
+
+struct topk_shard {
+	pthread_mutex_t mtx;
+	/* window with epoch e is win[e & 1] */
+	struct topk_window win[2];
+	GSH_CACHE_PAD(0);
+};
+
+struct topk_tracker {
+	struct topk_shard shard[TOPK_SHARDS];
+};
+
+static struct topk_tracker topk[TOPK_KINDS];
+static uint32_t topk_size;	/*< 0 when disabled */
+static time_t topk_window_s;
+
+/* shard of the calling thread, assigned round-robin on first use */
+static __thread int32_t topk_shard = -1;
+static uint32_t topk_shard_next;
+
+static inline uint32_t get_topk_shard(void)
+{
+	if (unlikely(topk_shard < 0))
+		topk_shard = atomic_inc_uint32_t(&topk_shard_next) &
+			     (TOPK_SHARDS - 1);
+	return topk_shard;
+}
+
+/**
+ * @brief Allocate the trackers
+ */
+void topk_pkginit(void)
+{
+	struct topk_window *win;
+	int kind, sx, w;
+
+	topk_size = nfs_param.core_param.topk_entries;
+	topk_window_s = nfs_param.core_param.topk_window_s;
+
+	if (topk_size == 0)
+		return;
+
+	for (kind = 0; kind < TOPK_KINDS; kind++) {
+		for (sx = 0; sx < TOPK_SHARDS; sx++) {
+			PTHREAD_MUTEX_init(&topk[kind].shard[sx].mtx, NULL);
+			for (w = 0; w < 2; w++) {
+				win = &topk[kind].shard[sx].win[w];
+				win->hash = gsh_calloc(topk_size,
+						       sizeof(uint64_t));
+				win->entry = gsh_calloc(topk_size,
+						sizeof(struct topk_entry));
+			}
+		}
+	}
+}
+
+/**
+ * @brief Count a key
+ *
+ * @param kind   [IN] tracker to count in
+ * @param key    [IN] the key
+ * @param len    [IN] length of the key
+ * @param proto  [IN] protocol of the op, an enum stats_proto
+ * @param op     [IN] the op
+ * @param weight [IN] how much to count
+ */
+void topk_record(enum topk_kind kind, const void *key, size_t len,
+		 uint16_t proto, uint16_t op, uint64_t weight)
+{
+	struct topk_shard *shard;
+	struct topk_window *win;
+	struct topk_entry *e;
+	uint64_t hash, min;
+	time_t epoch;
+	uint32_t i, j;
+
+	if (topk_size == 0 || weight == 0)
+		return;
+
+	if (len > TOPK_KEY_MAX)
+		len = TOPK_KEY_MAX;
+
+	hash = CityHash64WithSeed(key, len, ((uint64_t)proto << 16) | op);
+	epoch = time(NULL) / topk_window_s;
+	shard = &topk[kind].shard[get_topk_shard()];
+
+	PTHREAD_MUTEX_lock(&shard->mtx);
+
+	win = &shard->win[epoch & 1];
+	if (win->epoch != epoch) {
+		/* Two windows old, start over */
+		win->epoch = epoch;
+		win->used = 0;
+	}
+
+	for (i = 0; i < win->used; i++) {
+		if (win->hash[i] != hash)
+			continue;
+		e = &win->entry[i];
+		if (e->proto == proto && e->op == op && e->len == len &&
+		    memcmp(e->key, key, len) == 0) {
+			e->count += weight;
+			goto out;
+		}
+	}
+
+	if (win->used < topk_size) {
+		i = win->used++;
+		min = 0;
+	} else {
+		/* The new key takes over the smallest counter */
+		i = 0;
+		for (j = 1; j < topk_size; j++) {
+			if (win->entry[j].count < win->entry[i].count)
+				i = j;
+		}
+		min = win->entry[i].count;
+	}
+
+	e = &win->entry[i];
+	win->hash[i] = hash;
+	e->count = min + weight;
+	e->error = min;
+	e->proto = proto;
+	e->op = op;
+	e->len = len;
+	memcpy(e->key, key, len);
+
+out:
+	PTHREAD_MUTEX_unlock(&shard->mtx);
+}
+
+/**
+ * @brief Forget everything counted so far
+ */
+void topk_reset(void)
+{
+	struct topk_shard *shard;
+	int kind, sx;
+
+	if (topk_size == 0)
+		return;
+
+	for (kind = 0; kind < TOPK_KINDS; kind++) {
+		for (sx = 0; sx < TOPK_SHARDS; sx++) {
+			shard = &topk[kind].shard[sx];
+			PTHREAD_MUTEX_lock(&shard->mtx);
+			shard->win[0].used = 0;
+			shard->win[1].used = 0;
+			PTHREAD_MUTEX_unlock(&shard->mtx);
+		}
+	}
+}
+
+#ifdef USE_DBUS
+
+struct topk_merge {
+	uint64_t hash;
+	struct topk_entry entry;
+};
+
+static int topk_cmp_key(const void *a, const void *b)
+{
+	const struct topk_merge *ma = a, *mb = b;
+	const struct topk_entry *ea = &ma->entry, *eb = &mb->entry;
+
+	if (ma->hash != mb->hash)
+		return ma->hash < mb->hash ? -1 : 1;
+	if (ea->proto != eb->proto)
+		return ea->proto - eb->proto;
+	if (ea->op != eb->op)
+		return ea->op - eb->op;
+	if (ea->len != eb->len)
+		return ea->len - eb->len;
+	return memcmp(ea->key, eb->key, ea->len);
+}
+
+static int topk_cmp_count(const void *a, const void *b)
+{
+	const struct topk_merge *ma = a, *mb = b;
+
+	if (ma->entry.count != mb->entry.count)
+		return ma->entry.count > mb->entry.count ? -1 : 1;
+	return 0;
+}
+
+/**
+ * @brief Gather the shards and windows of a tracker
+ *
+ * Counts of the same key are added up, and the result sorted heaviest
+ * first.
+ *
+ * @param kind  [IN] tracker to read
+ * @param count [OUT] number of distinct keys
+ *
+ * @return Array of keys, to be freed by the caller.
+ */
+static struct topk_merge *topk_merge(enum topk_kind kind, uint32_t *count)
+{
+	struct topk_merge *merged;
+	struct topk_shard *shard;
+	struct topk_window *win;
+	time_t epoch = time(NULL) / topk_window_s;
+	uint32_t n = 0, i, j;
+	int sx, w;
+
+	merged = gsh_malloc(TOPK_SHARDS * 2 * topk_size *
+			    sizeof(struct topk_merge));
+
+	for (sx = 0; sx < TOPK_SHARDS; sx++) {
+		shard = &topk[kind].shard[sx];
+		PTHREAD_MUTEX_lock(&shard->mtx);
+		for (w = 0; w < 2; w++) {
+			win = &shard->win[w];
+			if (win->epoch != epoch && win->epoch != epoch - 1)
+				continue;
+			for (i = 0; i < win->used; i++) {
+				merged[n].hash = win->hash[i];
+				merged[n].entry = win->entry[i];
+				n++;
+			}
+		}
+		PTHREAD_MUTEX_unlock(&shard->mtx);
+	}
+
+	qsort(merged, n, sizeof(*merged), topk_cmp_key);
+
+	for (i = 0, j = 0; i < n; i++) {
+		if (j > 0 && topk_cmp_key(&merged[j - 1], &merged[i]) == 0) {
+			merged[j - 1].entry.count += merged[i].entry.count;
+			merged[j - 1].entry.error += merged[i].entry.error;
+			continue;
+		}
+		if (j != i)
+			merged[j] = merged[i];
+		j++;
+	}
+
+	qsort(merged, j, sizeof(*merged), topk_cmp_count);
+
+	*count = j;
+	return merged;
+}
+
+/**
+ * @brief Print a key for a report
+ */
+static void topk_key_str(enum topk_kind kind, struct topk_entry *e,
+			 char *buf, size_t size)
+{
+	uint16_t export_id;
+	int i;
+
+	switch (kind) {
+	case TOPK_FILE_OP:
+		for (i = 0; i < e->len && 2 * i + 2 < size; i++)
+			sprintf(buf + 2 * i, "%02x", e->key[i]);
+		buf[2 * i] = '\0';
+		break;
+	case TOPK_CLIENT_OP:
+		snprintf(buf, size, "%.*s", (int)e->len, (char *)e->key);
+		break;
+	case TOPK_EXPORT_BYTES:
+		memcpy(&export_id, e->key, sizeof(export_id));
+		snprintf(buf, size, "%u", export_id);
+		break;
+	default:
+		buf[0] = '\0';
+	}
+}
+
+/**
+ * @brief Report the heaviest keys of a tracker
+ *
+ * array of (
+ *	string key
+ *	string op
+ *	uint64_t count
+ *	uint64_t error, count may be as much too high
+ * )
+ *
+ * Keys are file handles in hex, client addresses and export ids.
+ *
+ * @param kind [IN] tracker to report
+ * @param iter [IN] interator in reply stream to fill
+ */
+void topk_dbus_report(enum topk_kind kind, DBusMessageIter *iter)
+{
+	DBusMessageIter array_iter, struct_iter;
+	struct topk_merge *merged = NULL;
+	struct timespec timestamp;
+	char key[2 * TOPK_KEY_MAX + 1];
+	char *keyp = key;
+	const char *op;
+	uint32_t count = 0, i;
+
+	now(&timestamp);
+	dbus_append_timestamp(iter, &timestamp);
+
+	if (topk_size != 0)
+		merged = topk_merge(kind, &count);
+	if (count > topk_size)
+		count = topk_size;
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					 TOPK_REPLY_ARRAY_TYPE, &array_iter);
+	for (i = 0; i < count; i++) {
+		struct topk_entry *e = &merged[i].entry;
+
+		topk_key_str(kind, e, key, sizeof(key));
+		if (kind == TOPK_EXPORT_BYTES)
+			op = e->op == TOPK_IO_WRITE ? "WRITE" : "READ";
+		else
+			op = server_stats_op_name(e->proto, e->op);
+
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+						 NULL, &struct_iter);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &keyp);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+					       &op);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &e->count);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &e->error);
+		dbus_message_iter_close_container(&array_iter, &struct_iter);
+	}
+	dbus_message_iter_close_container(iter, &array_iter);
+
+	gsh_free(merged);
+}
+
+#endif				/* USE_DBUS */
+
+/** @} */
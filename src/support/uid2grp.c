@@ -62,23 +62,19 @@
  */
 void uid2grp_hold_group_data(struct group_data *gdata)
 {
-	PTHREAD_MUTEX_lock(&gdata->lock);
-	gdata->refcount++;
-	PTHREAD_MUTEX_unlock(&gdata->lock);
+	(void) atomic_inc_uint32_t(&gdata->refcount);
 }
 
 void uid2grp_release_group_data(struct group_data *gdata)
 {
-	unsigned int refcount;
+	uint32_t refcount;
 
-	PTHREAD_MUTEX_lock(&gdata->lock);
-	refcount = --gdata->refcount;
-	PTHREAD_MUTEX_unlock(&gdata->lock);
+	refcount = atomic_dec_uint32_t(&gdata->refcount);
 
 	if (refcount == 0) {
 		gsh_free(gdata->groups);
 		gsh_free(gdata);
-	} else if (refcount == (unsigned int)-1) {
+	} else if (refcount == (uint32_t)-1) {
 		LogAlways(COMPONENT_IDMAPPER, "negative refcount on gdata: %p",
 			  gdata);
 	}
@@ -196,7 +192,6 @@ static struct group_data *uid2grp_allocate_by_name(
 		return NULL;
 	}
 
-	PTHREAD_MUTEX_init(&gdata->lock, NULL);
 	gdata->epoch = time(NULL);
 	gdata->refcount = 0;
 	return gdata;
@@ -243,7 +238,6 @@ static struct group_data *uid2grp_allocate_by_uid(uid_t uid)
 		return NULL;
 	}
 
-	PTHREAD_MUTEX_init(&gdata->lock, NULL);
 	gdata->epoch = time(NULL);
 	gdata->refcount = 0;
 	return gdata;
@@ -263,6 +257,17 @@ bool name2grp(const struct gsh_buffdesc *name, struct group_data **gdata)
 {
 	bool success = false;
 	uid_t uid = -1;
+	int64_t *reader;
+
+	/* The front cache needs no lock */
+	reader = gsh_rcu_read_lock(&uid2grp_rcu);
+	success = uid2grp_peek_by_uname(name, &uid, gdata) &&
+		  !uid2grp_expired(*gdata);
+	if (success)
+		uid2grp_hold_group_data(*gdata);
+	gsh_rcu_read_unlock(reader);
+	if (success)
+		return true;
 
 	PTHREAD_RWLOCK_rdlock(&uid2grp_user_lock);
 	success = uid2grp_lookup_by_uname(name, &uid, gdata);
@@ -305,6 +310,16 @@ bool name2grp(const struct gsh_buffdesc *name, struct group_data **gdata)
 bool uid2grp(uid_t uid, struct group_data **gdata)
 {
 	bool success = false;
+	int64_t *reader;
+
+	/* The front cache needs no lock */
+	reader = gsh_rcu_read_lock(&uid2grp_rcu);
+	success = uid2grp_peek_by_uid(uid, gdata) && !uid2grp_expired(*gdata);
+	if (success)
+		uid2grp_hold_group_data(*gdata);
+	gsh_rcu_read_unlock(reader);
+	if (success)
+		return true;
 
 	PTHREAD_RWLOCK_rdlock(&uid2grp_user_lock);
 	success = uid2grp_lookup_by_uid(uid, gdata);
@@ -44,6 +44,7 @@
 #include "avltree.h"
 #include "uid2grp.h"
 #include "abstract_atomic.h"
+#include "city.h"
 
 /**
  * @brief User entry in the IDMapper cache
@@ -72,6 +73,24 @@ struct cache_info {
 
 static struct avltree_node *uid_grplist_cache[id_cache_size];
 
+/**
+ * @brief User name cache, indexed by a hash of the name, with the same
+ * rules as the UID cache.
+ */
+
+static struct avltree_node *uname_grplist_cache[id_cache_size];
+
+/**
+ * @brief Read side sections for the front caches
+ *
+ * Both caches can also be read without the lock, between
+ * gsh_rcu_read_lock() and gsh_rcu_read_unlock() on this, with the
+ * uid2grp_peek_ functions.  Entries are only freed, and their group
+ * data released, after synchronizing.
+ */
+
+struct gsh_rcu uid2grp_rcu;
+
 /**
  * @brief Lock that protects the idmapper user cache
  */
@@ -184,17 +203,38 @@ void uid2grp_cache_init(void)
 	avltree_init(&uid_tree, uid_comparator, 0);
 	memset(uid_grplist_cache, 0,
 	       id_cache_size * sizeof(struct avltree_node *));
+	memset(uname_grplist_cache, 0,
+	       id_cache_size * sizeof(struct avltree_node *));
+	gsh_rcu_init(&uid2grp_rcu);
 }
 
-/* Remove given user/cache_info from the AVL trees
+static inline uint32_t name_slot(const struct gsh_buffdesc *name)
+{
+	return CityHash64(name->addr, name->len) % id_cache_size;
+}
+
+/* Take given user/cache_info out of the front caches and AVL trees
  *
  * @note The caller must hold uid2grp_user_lock for write.
  */
-static void uid2grp_remove_user(struct cache_info *info)
+static void uid2grp_unlink_user(struct cache_info *info)
 {
-	uid_grplist_cache[info->uid % id_cache_size] = NULL;
+	void **cache_slot;
+
+	cache_slot = (void **)&uid_grplist_cache[info->uid % id_cache_size];
+	if (*cache_slot == &info->uid_node)
+		atomic_store_voidptr(cache_slot, NULL);
+	cache_slot = (void **)&uname_grplist_cache[name_slot(&info->uname)];
+	if (*cache_slot == &info->uname_node)
+		atomic_store_voidptr(cache_slot, NULL);
+
 	avltree_remove(&info->uid_node, &uid_tree);
 	avltree_remove(&info->uname_node, &uname_tree);
+}
+
+/* Free an unlinked user/cache_info once no reader can see it */
+static void uid2grp_free_user(struct cache_info *info)
+{
 	/* We decrement hold on group data when it is
 	 * removed from cache trees.
 	 */
@@ -202,6 +242,17 @@ static void uid2grp_remove_user(struct cache_info *info)
 	gsh_free(info);
 }
 
+/* Remove given user/cache_info from the AVL trees
+ *
+ * @note The caller must hold uid2grp_user_lock for write.
+ */
+static void uid2grp_remove_user(struct cache_info *info)
+{
+	uid2grp_unlink_user(info);
+	gsh_rcu_synchronize(&uid2grp_rcu);
+	uid2grp_free_user(info);
+}
+
 /**
  * @brief Add a user entry to the cache
  *
@@ -220,6 +271,7 @@ void uid2grp_add_user(struct group_data *gdata)
 	struct avltree_node *id_node2 = NULL;
 	struct cache_info *info;
 	struct cache_info *tmp;
+	void **cache_slot;
 
 	info = gsh_malloc(sizeof(struct cache_info));
 
@@ -257,7 +309,10 @@ void uid2grp_add_user(struct group_data *gdata)
 		uid2grp_remove_user(tmp);
 		id_node2 = avltree_insert(&info->uid_node, &uid_tree);
 	}
-	uid_grplist_cache[info->uid % id_cache_size] = &info->uid_node;
+	cache_slot = (void **)&uid_grplist_cache[info->uid % id_cache_size];
+	atomic_store_voidptr(cache_slot, &info->uid_node);
+	cache_slot = (void **)&uname_grplist_cache[name_slot(&info->uname)];
+	atomic_store_voidptr(cache_slot, &info->uname_node);
 
 	if (name_node && id_node)
 		LogWarn(COMPONENT_IDMAPPER, "shouldn't happen, internal error");
@@ -283,6 +338,8 @@ static bool lookup_by_uname(const struct gsh_buffdesc *name,
 	found_info = avltree_container_of(found_node,
 					  struct cache_info,
 					  uname_node);
+	atomic_store_voidptr((void **)&uname_grplist_cache[name_slot(name)],
+			     found_node);
 
 	/* I assume that if someone likes this user enough to look it
 	   up by name, they'll like it enough to look it up by ID
@@ -390,6 +447,70 @@ bool uid2grp_lookup_by_uid(const uid_t uid, struct group_data **gdata)
 	return success;
 }
 
+/**
+ * @brief Look up a user by name in the front cache only
+ *
+ * @note The caller must be in a read side section of uid2grp_rcu, and
+ * must take a hold on the group data before leaving it.
+ *
+ * @param[in]  name  The user name to look up.
+ * @param[out] uid   The user ID found.
+ * @param[out] gdata group_data containing supplementary groups.
+ *
+ * @retval true on success.
+ * @retval false if the caller has to take the lock and look further.
+ */
+
+bool uid2grp_peek_by_uname(const struct gsh_buffdesc *name, uid_t *uid,
+			   struct group_data **gdata)
+{
+	struct avltree_node *found_node = atomic_fetch_voidptr(
+		(void **)&uname_grplist_cache[name_slot(name)]);
+	struct cache_info *info;
+
+	if (!found_node)
+		return false;
+
+	info = avltree_container_of(found_node, struct cache_info,
+				    uname_node);
+	if (buffdesc_comparator(&info->uname, name) != 0)
+		return false;
+
+	*gdata = info->gdata;
+	*uid = info->gdata->uid;
+	return true;
+}
+
+/**
+ * @brief Look up a user by ID in the front cache only
+ *
+ * @note The caller must be in a read side section of uid2grp_rcu, and
+ * must take a hold on the group data before leaving it.
+ *
+ * @param[in]  uid   The user ID to look up.
+ * @param[out] gdata group_data containing supplementary groups.
+ *
+ * @retval true on success.
+ * @retval false if the caller has to take the lock and look further.
+ */
+
+bool uid2grp_peek_by_uid(const uid_t uid, struct group_data **gdata)
+{
+	struct avltree_node *found_node = atomic_fetch_voidptr(
+		(void **)&uid_grplist_cache[uid % id_cache_size]);
+	struct cache_info *info;
+
+	if (!found_node)
+		return false;
+
+	info = avltree_container_of(found_node, struct cache_info, uid_node);
+	if (info->uid != uid)
+		return false;
+
+	*gdata = info->gdata;
+	return true;
+}
+
 void uid2grp_remove_by_uid(const uid_t uid)
 {
 	struct cache_info *info;
@@ -417,15 +538,24 @@ void uid2grp_remove_by_uname(const struct gsh_buffdesc *name)
 void uid2grp_clear_cache(void)
 {
 	struct avltree_node *node;
+	int i;
 
 	PTHREAD_RWLOCK_wrlock(&uid2grp_user_lock);
 
+	/* Empty the front caches and wait for their readers once */
+	for (i = 0; i < id_cache_size; i++) {
+		atomic_store_voidptr((void **)&uid_grplist_cache[i], NULL);
+		atomic_store_voidptr((void **)&uname_grplist_cache[i], NULL);
+	}
+	gsh_rcu_synchronize(&uid2grp_rcu);
+
 	while ((node = avltree_first(&uname_tree))) {
 		struct cache_info *info = avltree_container_of(node,
 							       struct
 							       cache_info,
 							       uname_node);
-		uid2grp_remove_user(info);
+		uid2grp_unlink_user(info);
+		uid2grp_free_user(info);
 	}
 
 	assert(avltree_first(&uid_tree) == NULL);
@@ -891,6 +891,208 @@ void do_close(struct response *resp)
 	resp->r_status = STATUS_OK;
 }
 
+/* LOAD runs in a directory of its own under ceph_path, named after the
+ * client
+ */
+char load_name[MAXSTR + 16];
+Inode *load_parent;
+Inode *load_dir;
+Inode **load_inodes;
+Fh **load_fhs;
+char load_buf[LOAD_IO_SIZE];
+
+static void load_teardown(int files)
+{
+	char fname[32];
+	int file;
+
+	for (file = 0; file < files; file++) {
+		if (load_fhs[file] != NULL)
+			ceph_ll_close(cmount, load_fhs[file]);
+
+		if (load_inodes[file] != NULL)
+			ceph_ll_put(cmount, load_inodes[file]);
+
+		array_sprintf(fname, "f%d", file);
+		ceph_ll_unlink(cmount, load_dir, fname, cephperms);
+	}
+
+	ceph_ll_put(cmount, load_dir);
+	ceph_ll_rmdir(cmount, load_parent, load_name, cephperms);
+	ceph_ll_put(cmount, load_parent);
+
+	free(load_inodes);
+	free(load_fhs);
+	load_inodes = NULL;
+	load_fhs = NULL;
+}
+
+static int load_setup(int files)
+{
+	char fname[32];
+	struct ceph_statx stx;
+	long long int offset;
+	int file, rc;
+
+	if (name[0] != '\0')
+		array_sprintf(load_name, "ml_load.%s", name);
+	else
+		array_sprintf(load_name, "ml_load.%d", (int) getpid());
+
+	rc = ceph_ll_walk(cmount, ceph_path, &load_parent, &stx, 0,
+			  AT_NO_ATTR_SYNC, cephperms);
+
+	if (rc < 0)
+		return -rc;
+
+	rc = ceph_ll_mkdir(cmount, load_parent, load_name, 0755, &load_dir,
+			   &stx, 0, 0, cephperms);
+
+	if (rc == -EEXIST)
+		rc = ceph_ll_lookup(cmount, load_parent, load_name, &load_dir,
+				    &stx, 0, 0, cephperms);
+
+	if (rc < 0) {
+		ceph_ll_put(cmount, load_parent);
+		return -rc;
+	}
+
+	load_inodes = calloc(files, sizeof(*load_inodes));
+	load_fhs = calloc(files, sizeof(*load_fhs));
+
+	if (load_inodes == NULL || load_fhs == NULL) {
+		rc = -ENOMEM;
+		goto fail;
+	}
+
+	memset(load_buf, 'L', sizeof(load_buf));
+
+	for (file = 0; file < files; file++) {
+		array_sprintf(fname, "f%d", file);
+
+		rc = ceph_ll_create(cmount, load_dir, fname, 0644,
+				    O_RDWR | O_CREAT,
+				    &load_inodes[file], &load_fhs[file],
+				    &stx, 0, 0, cephperms);
+
+		if (rc < 0)
+			goto fail;
+
+		for (offset = 0; offset < LOAD_FILE_SIZE;
+		     offset += LOAD_IO_SIZE) {
+			rc = ceph_ll_write(cmount, load_fhs[file], offset,
+					   LOAD_IO_SIZE, load_buf);
+
+			if (rc < 0)
+				goto fail;
+		}
+	}
+
+	return 0;
+
+ fail:
+	if (load_inodes == NULL || load_fhs == NULL) {
+		free(load_inodes);
+		free(load_fhs);
+		ceph_ll_put(cmount, load_dir);
+		ceph_ll_put(cmount, load_parent);
+	} else {
+		load_teardown(files);
+	}
+
+	return -rc;
+}
+
+static int load_op(enum load_op op, int file, long long int offset)
+{
+	char fname[32];
+	struct ceph_statx stx;
+	struct ceph_dir_result *dirp;
+	struct flock lock;
+	Inode *inode;
+	Fh *fh;
+	int rc;
+
+	switch (op) {
+	case LOAD_OPEN:
+		array_sprintf(fname, "f%d", file);
+
+		rc = ceph_ll_lookup(cmount, load_dir, fname, &inode, &stx, 0,
+				    0, cephperms);
+
+		if (rc < 0)
+			return -rc;
+
+		rc = ceph_ll_open(cmount, inode, O_RDWR, &fh, cephperms);
+
+		if (rc >= 0)
+			rc = ceph_ll_close(cmount, fh);
+
+		ceph_ll_put(cmount, inode);
+		return rc < 0 ? -rc : 0;
+
+	case LOAD_STAT:
+		rc = ceph_ll_getattr(cmount, load_inodes[file], &stx,
+				     CEPH_STATX_BASIC_STATS, 0, cephperms);
+		return rc < 0 ? -rc : 0;
+
+	case LOAD_READDIR:
+		rc = ceph_ll_opendir(cmount, load_dir, &dirp, cephperms);
+
+		if (rc < 0)
+			return -rc;
+
+		while (ceph_readdir(cmount, dirp) != NULL)
+			;
+
+		rc = ceph_ll_releasedir(cmount, dirp);
+		return rc < 0 ? -rc : 0;
+
+	case LOAD_READ:
+		rc = ceph_ll_read(cmount, load_fhs[file], offset,
+				  LOAD_IO_SIZE, load_buf);
+		return rc < 0 ? -rc : 0;
+
+	case LOAD_WRITE:
+		rc = ceph_ll_write(cmount, load_fhs[file], offset,
+				   LOAD_IO_SIZE, load_buf);
+		return rc < 0 ? -rc : 0;
+
+	case LOAD_LOCK:
+		/* Losing the race with another client is not an error */
+		lock.l_whence = SEEK_SET;
+		lock.l_type = F_WRLCK;
+		lock.l_start = offset;
+		lock.l_len = LOAD_IO_SIZE;
+		lock.l_pid = 0;
+
+		rc = ceph_ll_setlk(cmount, load_fhs[file], &lock, getpid(),
+				   false);
+
+		if (rc == -EAGAIN)
+			return 0;
+
+		if (rc < 0)
+			return -rc;
+
+		lock.l_type = F_UNLCK;
+		rc = ceph_ll_setlk(cmount, load_fhs[file], &lock, getpid(),
+				   false);
+		return rc < 0 ? -rc : 0;
+
+	case NUM_LOAD_OPS:
+		break;
+	}
+
+	return EINVAL;
+}
+
+struct load_ops cephfs_load_ops = {
+	.lo_setup = load_setup,
+	.lo_op = load_op,
+	.lo_teardown = load_teardown,
+};
+
 struct test_list {
 	struct test_list *tl_next;
 	long long int tl_start;
@@ -1373,6 +1575,9 @@ int main(int argc, char **argv)
 				case CMD_FORK:
 					complete = do_fork(&resp, oflags == 7);
 					break;
+				case CMD_LOAD:
+					do_load(&resp, &cephfs_load_ops);
+					break;
 
 				case CMD_HELLO:
 				case CMD_COMMENT:
@@ -418,6 +418,7 @@ enum master_cmd {
 	MCMD_SIMPLE_DEADLOCK,
 	MCMD_CLIENTS,
 	MCMD_FORK,
+	MCMD_LOAD,
 };
 
 struct token master_commands[] = {
@@ -435,6 +436,7 @@ struct token master_commands[] = {
 	{"DEADLOCK", 8, MCMD_SIMPLE_DEADLOCK},
 	{"CLIENTS", 7, MCMD_CLIENTS},
 	{"FORK", 4, MCMD_FORK},
+	{"LOAD", 4, MCMD_LOAD},
 	{"", 0, MCMD_CLIENT_CMD}
 };
 
@@ -851,6 +853,178 @@ void mcmd_fork(struct master_state *ms)
 	ms->count = 0;
 }
 
+static void print_load_line(const char *name, struct load_hist *hist,
+			    long int secs)
+{
+	fprintf(output,
+		"%-8s %10lld %8lld %10lld %8lld %8lld %8lld %8lld %8lld\n",
+		name, hist->lh_count, hist->lh_errors,
+		hist->lh_count / secs,
+		hist->lh_count ? hist->lh_total_us / hist->lh_count : 0,
+		load_hist_percentile(hist, 50),
+		load_hist_percentile(hist, 90),
+		load_hist_percentile(hist, 99),
+		load_hist_percentile(hist, 99.9));
+}
+
+void print_load_report(struct load_hist *hists, long int secs, int nclients)
+{
+	struct load_hist total;
+	int op, bucket;
+
+	memset(&total, 0, sizeof(total));
+
+	for (op = 0; op < NUM_LOAD_OPS; op++) {
+		total.lh_count += hists[op].lh_count;
+		total.lh_errors += hists[op].lh_errors;
+		total.lh_total_us += hists[op].lh_total_us;
+
+		for (bucket = 0; bucket < LOAD_BUCKETS; bucket++)
+			total.lh_bucket[bucket] += hists[op].lh_bucket[bucket];
+	}
+
+	fprintf(output, "LOAD %ld secs %d clients\n", secs, nclients);
+	fprintf(output, "%-8s %10s %8s %10s %8s %8s %8s %8s %8s\n",
+		"op", "ops", "errors", "ops/s", "mean_us", "p50_us",
+		"p90_us", "p99_us", "p99.9_us");
+
+	for (op = 0; op < NUM_LOAD_OPS; op++)
+		if (hists[op].lh_count != 0)
+			print_load_line(load_op_names[op].t_name, &hists[op],
+					secs);
+
+	print_load_line("total", &total, secs);
+
+	/* Histogram, one column per op, percentiles above are the upper
+	 * bounds of these buckets
+	 */
+	fprintf(output, "%-10s", "<us");
+
+	for (op = 0; op < NUM_LOAD_OPS; op++)
+		if (hists[op].lh_count != 0)
+			fprintf(output, " %10s", load_op_names[op].t_name);
+
+	fprintf(output, "\n");
+
+	for (bucket = 0; bucket < LOAD_BUCKETS; bucket++) {
+		if (total.lh_bucket[bucket] == 0)
+			continue;
+
+		fprintf(output, "%-10lld", 2LL << bucket);
+
+		for (op = 0; op < NUM_LOAD_OPS; op++)
+			if (hists[op].lh_count != 0)
+				fprintf(output, " %10lld",
+					hists[op].lh_bucket[bucket]);
+
+		fprintf(output, "\n");
+	}
+
+	fflush(output);
+}
+
+/*
+ * LOAD secs rate files "mix" sends a LOAD command to every connected
+ * client, splitting rate between them, then waits for all the responses
+ * and reports the combined latency histograms.
+ */
+void mcmd_load(struct master_state *ms)
+{
+	struct response *req;
+	struct client *client;
+	struct load_hist hists[NUM_LOAD_OPS];
+	long int rate;
+	int nclients = 0, pending, i = 0;
+
+	if (ms->inbrace) {
+		errno = 0;
+		array_strcpy(errdetail,
+			     "LOAD command not allowed inside brace");
+		ms->rest = NULL;
+		return;
+	}
+
+	array_strcpy(ms->last, ms->line);
+
+	req = alloc_resp(NULL);
+	req->r_cmd = CMD_LOAD;
+
+	ms->rest = parse_load(ms->rest, req);
+
+	if (ms->rest == NULL || syntax) {
+		free_response(req, NULL);
+		return;
+	}
+
+	for (client = client_list; client != NULL; client = client->c_next)
+		if (client->c_socket != 0)
+			nclients++;
+
+	if (nclients == 0) {
+		errno = 0;
+		array_strcpy(errdetail, "LOAD requires connected clients");
+		ms->rest = NULL;
+		free_response(req, NULL);
+		return;
+	}
+
+	rate = req->r_rate;
+	req->r_tag = get_global_tag(true);
+
+	for (client = client_list; client != NULL; client = client->c_next) {
+		if (client->c_socket == 0)
+			continue;
+
+		/* Split the rate evenly, spreading any remainder */
+		req->r_client = client;
+		req->r_rate = rate / nclients + (i++ < rate % nclients);
+		send_cmd(req);
+	}
+
+	req->r_client = NULL;
+	memset(hists, 0, sizeof(hists));
+
+	fprintf(output, "Waiting for %d LOAD responses...\n", nclients);
+
+	for (pending = nclients; pending > 0 && !terminate; pending--) {
+		struct response *client_resp = receive_response(false, -1);
+
+		if (terminate) {
+			free_response(client_resp, NULL);
+			break;
+		}
+
+		if (client_resp->r_cmd == CMD_LOAD &&
+		    client_resp->r_tag == req->r_tag &&
+		    client_resp->r_status == STATUS_OK) {
+			if (!add_load_hists(client_resp->r_data, hists))
+				error();
+		} else {
+			if (err_accounting)
+				fprintf(stderr, "%s\nResp:      %s\n",
+					ms->last, client_resp->r_original);
+
+			errno = 0;
+			array_strcpy(errdetail, "Unexpected response to LOAD");
+			error();
+
+			/* A failed receive won't be followed by the rest */
+			if (client_resp->r_client == NULL) {
+				free_response(client_resp, NULL);
+				break;
+			}
+		}
+
+		free_response(client_resp, NULL);
+	}
+
+	print_load_report(hists, req->r_secs, nclients);
+	free_response(req, NULL);
+
+	if (terminate)
+		handle_quit();
+}
+
 void mcmd_expect(struct master_state *ms)
 {
 	ms->rest = get_client(ms->rest, &ms->client, true, REQUIRES_MORE);
@@ -916,6 +1090,7 @@ void mcmd_simple(struct master_state *ms)
 	case CMD_WRITE:
 	case CMD_COMMENT:
 	case CMD_ALARM:
+	case CMD_LOAD:
 	case CMD_HELLO:
 	case CMD_QUIT:
 		if (ms->cmd != MCMD_SIMPLE_OK) {
@@ -1096,6 +1271,10 @@ void master_command(void)
 				mcmd_fork(&ms);
 				break;
 
+			case MCMD_LOAD:
+				mcmd_load(&ms);
+				break;
+
 			case MCMD_SIMPLE_OK:
 			case MCMD_SIMPLE_AVAILABLE:
 			case MCMD_SIMPLE_GRANTED:
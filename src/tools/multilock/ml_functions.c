@@ -43,6 +43,7 @@ struct command_def commands[NUM_COMMANDS + 1] = {
 	{"ALARM", 5},
 	{"HELLO", 5},
 	{"FORK", 4},
+	{"LOAD", 4},
 	{"QUIT", 4},
 	{"UNKNOWN", 0},
 };
@@ -801,6 +802,11 @@ void sprintf_resp(char *line, int size, const char *lead,
 			sprint_left(rest, left, " %ld\n", resp->r_secs);
 			break;
 
+		case CMD_LOAD:
+			sprint_left(rest, left, " %ld \"%s\"\n", resp->r_secs,
+				    resp->r_data);
+			break;
+
 		case CMD_QUIT:
 			sprint_left(rest, left, "\n");
 			break;
@@ -959,6 +965,17 @@ char *parse_response(char *line, struct response *resp)
 			return get_long(rest, &resp->r_secs, REQUIRES_NO_MORE,
 					"Invalid alarm time");
 
+		case CMD_LOAD:
+			rest = get_long(rest, &resp->r_secs, REQUIRES_MORE,
+					"Invalid load time");
+
+			if (rest == NULL)
+				goto fail;
+
+			rest = get_rdata(rest, resp, MAXDATA - 1,
+					 REQUIRES_NO_MORE);
+			break;
+
 		case CMD_QUIT:
 			return rest;
 
@@ -1222,6 +1239,7 @@ int compare_responses(struct response *expected, struct response *received)
 			return false;
 
 		case CMD_ALARM:
+		case CMD_LOAD:
 			return_if_ne_long(expected->r_secs, received->r_secs,
 					  "Unexpected secs");
 			break;
@@ -1494,6 +1512,43 @@ char *parse_empty(char *line, struct response *req)
 	return line;
 }
 
+char *parse_load(char *line, struct response *req)
+{
+	char *more;
+	int weights[NUM_LOAD_OPS];
+
+	more = get_long(line, &req->r_secs, REQUIRES_MORE, "Invalid secs");
+
+	if (more == NULL)
+		return more;
+
+	more = get_long(more, &req->r_rate, REQUIRES_MORE, "Invalid rate");
+
+	if (more == NULL)
+		return more;
+
+	more = get_long(more, &req->r_files, REQUIRES_MORE,
+			"Invalid number of files");
+
+	if (more == NULL)
+		return more;
+
+	if (req->r_secs <= 0 || req->r_rate < 0 || req->r_files <= 0) {
+		errno = EINVAL;
+		array_strcpy(errdetail, "Invalid load parameters");
+		array_sprintf(badtoken, "%ld %ld %ld",
+			      req->r_secs, req->r_rate, req->r_files);
+		return NULL;
+	}
+
+	more = get_rdata(more, req, MAXSTR, REQUIRES_NO_MORE);
+
+	if (more == NULL || !get_load_mix(req->r_data, weights))
+		return NULL;
+
+	return more;
+}
+
 typedef char *(*parse_function_t) (char *line, struct response *req);
 
 parse_function_t parse_functions[NUM_COMMANDS] = {
@@ -1513,6 +1568,7 @@ parse_function_t parse_functions[NUM_COMMANDS] = {
 	parse_alarm,
 	parse_string,		/* hello */
 	parse_string,		/* fork */
+	parse_load,
 	parse_empty,		/* quit */
 };
 
@@ -1553,6 +1609,7 @@ char *parse_request(char *line, struct response *req, int no_tag)
 	case CMD_FORK:
 	case CMD_COMMENT:
 	case CMD_ALARM:
+	case CMD_LOAD:
 	case CMD_QUIT:
 		rest = parse_functions[req->r_cmd] (rest, req);
 		break;
@@ -1622,6 +1679,11 @@ void sprintf_req(char *line, int size, const char *lead, struct response *req)
 		sprint_left(rest, left, " %ld\n", req->r_secs);
 		break;
 
+	case CMD_LOAD:
+		sprint_left(rest, left, " %ld %ld %ld \"%s\"\n", req->r_secs,
+			    req->r_rate, req->r_files, req->r_data);
+		break;
+
 	case CMD_QUIT:
 		sprint_left(rest, left, "\n");
 		break;
@@ -1657,3 +1719,283 @@ void sprintf_req(char *line, int size, const char *lead, struct response *req)
 	/* Make sure we are NUL terminated even if we used the last byte. */
 	*rest = '\0';
 }
+
+struct token load_op_names[] = {
+	{"open", 4, LOAD_OPEN},
+	{"stat", 4, LOAD_STAT},
+	{"readdir", 7, LOAD_READDIR},
+	{"read", 4, LOAD_READ},
+	{"write", 5, LOAD_WRITE},
+	{"lock", 4, LOAD_LOCK},
+	{"", 0, 0}
+};
+
+bool get_load_mix(const char *mix, int *weights)
+{
+	const char *c = mix;
+	int total = 0;
+
+	memset(weights, 0, sizeof(*weights) * NUM_LOAD_OPS);
+
+	while (*c != '\0') {
+		struct token *tok;
+		char *e;
+		long int weight;
+		int len = strcspn(c, "=");
+
+		for (tok = load_op_names; tok->t_len != 0; tok++) {
+			if (tok->t_len == len &&
+			    strncasecmp(c, tok->t_name, len) == 0)
+				break;
+		}
+
+		if (tok->t_len == 0 || c[len] != '=') {
+			errno = EINVAL;
+			array_strcpy(errdetail, "Invalid load op");
+			array_strcpy(badtoken, c);
+			return false;
+		}
+
+		weight = strtol(c + len + 1, &e, 10);
+
+		if (e == c + len + 1 || weight < 0 ||
+		    (*e != ',' && *e != '\0')) {
+			errno = EINVAL;
+			array_strcpy(errdetail, "Invalid load weight");
+			array_strcpy(badtoken, c);
+			return false;
+		}
+
+		weights[tok->t_value] = weight;
+		total += weight;
+		c = *e == ',' ? e + 1 : e;
+	}
+
+	if (total == 0) {
+		errno = EINVAL;
+		array_strcpy(errdetail, "Load mix has no ops");
+		array_strcpy(badtoken, mix);
+		return false;
+	}
+
+	return true;
+}
+
+void load_hist_add(struct load_hist *hist, long long int usecs, bool error)
+{
+	int bucket = 0;
+
+	while (bucket < LOAD_BUCKETS - 1 && usecs >= (2LL << bucket))
+		bucket++;
+
+	hist->lh_count++;
+	hist->lh_total_us += usecs;
+	hist->lh_bucket[bucket]++;
+
+	if (error)
+		hist->lh_errors++;
+}
+
+/* Returns the upper bound of the bucket holding the pct percentile */
+long long int load_hist_percentile(struct load_hist *hist, double pct)
+{
+	long long int want = (long long int) (hist->lh_count * pct / 100.0);
+	long long int seen = 0;
+	int bucket;
+
+	for (bucket = 0; bucket < LOAD_BUCKETS - 1; bucket++) {
+		seen += hist->lh_bucket[bucket];
+		if (seen > want)
+			break;
+	}
+
+	return 2LL << bucket;
+}
+
+/*
+ * Histograms are sent as space separated op:count:errors:total_us:buckets
+ * items where buckets is a comma separated list with trailing empty
+ * buckets dropped.  Ops that never ran are left out.
+ */
+void sprintf_load_hists(char *line, int size, struct load_hist *hists)
+{
+	char *rest = line;
+	int left = size - 1; /* Leave room for terminating NUL */
+	const char *sep = "";
+	int op, bucket, last;
+
+	for (op = 0; op < NUM_LOAD_OPS; op++) {
+		struct load_hist *hist = &hists[op];
+
+		if (hist->lh_count == 0)
+			continue;
+
+		for (last = LOAD_BUCKETS - 1; last > 0; last--)
+			if (hist->lh_bucket[last] != 0)
+				break;
+
+		sprint_left(rest, left, "%s%s:%lld:%lld:%lld:", sep,
+			    load_op_names[op].t_name, hist->lh_count,
+			    hist->lh_errors, hist->lh_total_us);
+
+		for (bucket = 0; bucket <= last; bucket++)
+			sprint_left(rest, left, "%s%lld", bucket ? "," : "",
+				    hist->lh_bucket[bucket]);
+
+		sep = " ";
+	}
+
+	*rest = '\0';
+}
+
+/* Adds the histograms in line (as sent by sprintf_load_hists) to hists */
+bool add_load_hists(const char *line, struct load_hist *hists)
+{
+	const char *c = line;
+
+	while (*c != '\0') {
+		struct load_hist hist;
+		struct token *tok;
+		char *e;
+		int len = strcspn(c, ":");
+		int bucket;
+
+		memset(&hist, 0, sizeof(hist));
+
+		for (tok = load_op_names; tok->t_len != 0; tok++) {
+			if (tok->t_len == len &&
+			    strncasecmp(c, tok->t_name, len) == 0)
+				break;
+		}
+
+		if (tok->t_len == 0 || c[len] != ':')
+			goto fail;
+
+		hist.lh_count = strtoll(c + len + 1, &e, 10);
+		if (*e != ':')
+			goto fail;
+
+		hist.lh_errors = strtoll(e + 1, &e, 10);
+		if (*e != ':')
+			goto fail;
+
+		hist.lh_total_us = strtoll(e + 1, &e, 10);
+		if (*e != ':')
+			goto fail;
+
+		for (bucket = 0; bucket < LOAD_BUCKETS; bucket++) {
+			hist.lh_bucket[bucket] = strtoll(e + 1, &e, 10);
+			if (*e != ',')
+				break;
+		}
+
+		if (*e != ' ' && *e != '\0')
+			goto fail;
+
+		hists[tok->t_value].lh_count += hist.lh_count;
+		hists[tok->t_value].lh_errors += hist.lh_errors;
+		hists[tok->t_value].lh_total_us += hist.lh_total_us;
+
+		for (bucket = 0; bucket < LOAD_BUCKETS; bucket++)
+			hists[tok->t_value].lh_bucket[bucket] +=
+						hist.lh_bucket[bucket];
+
+		c = *e == ' ' ? e + 1 : e;
+	}
+
+	return true;
+
+ fail:
+	errno = EINVAL;
+	array_strcpy(errdetail, "Invalid load histogram");
+	array_strcpy(badtoken, c);
+	return false;
+}
+
+static long long int ns_since(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000000000LL +
+	       now.tv_nsec - start->tv_nsec;
+}
+
+/*
+ * Run a LOAD command.  Ops are issued on a fixed schedule of r_rate per
+ * second (as fast as possible if 0); a client that falls behind issues the
+ * late ops back to back rather than dropping them.
+ */
+void do_load(struct response *resp, struct load_ops *ops)
+{
+	int weights[NUM_LOAD_OPS];
+	struct load_hist hists[NUM_LOAD_OPS];
+	struct timespec start, op_start;
+	long long int end_ns = resp->r_secs * 1000000000LL;
+	long long int interval_ns = 0;
+	long long int issued = 0;
+	long long int now_ns;
+	unsigned int seed = getpid() ^ time(NULL);
+	int total = 0;
+	int op, rc;
+
+	if (!get_load_mix(resp->r_data, weights)) {
+		resp->r_status = STATUS_ERRNO;
+		resp->r_errno = errno;
+		return;
+	}
+
+	for (op = 0; op < NUM_LOAD_OPS; op++)
+		total += weights[op];
+
+	if (resp->r_rate > 0)
+		interval_ns = 1000000000LL / resp->r_rate;
+
+	rc = ops->lo_setup(resp->r_files);
+
+	if (rc != 0) {
+		resp->r_status = STATUS_ERRNO;
+		resp->r_errno = rc;
+		array_strcpy(errdetail, "Load setup failed");
+		array_sprintf(badtoken, "%ld", resp->r_files);
+		return;
+	}
+
+	memset(hists, 0, sizeof(hists));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while ((now_ns = ns_since(&start)) < end_ns) {
+		long long int offset;
+		int pick, file;
+
+		if (interval_ns != 0 && issued * interval_ns > now_ns) {
+			struct timespec delay;
+			long long int wait = issued * interval_ns - now_ns;
+
+			delay.tv_sec = wait / 1000000000LL;
+			delay.tv_nsec = wait % 1000000000LL;
+			nanosleep(&delay, NULL);
+			continue;
+		}
+
+		pick = rand_r(&seed) % total;
+		for (op = 0; pick >= weights[op]; op++)
+			pick -= weights[op];
+
+		file = rand_r(&seed) % resp->r_files;
+		offset = (long long int) (rand_r(&seed) %
+			 (LOAD_FILE_SIZE / LOAD_IO_SIZE)) * LOAD_IO_SIZE;
+
+		clock_gettime(CLOCK_MONOTONIC, &op_start);
+		rc = ops->lo_op(op, file, offset);
+		load_hist_add(&hists[op], ns_since(&op_start) / 1000, rc != 0);
+		issued++;
+	}
+
+	ops->lo_teardown(resp->r_files);
+
+	sprintf_load_hists(resp->r_data, sizeof(resp->r_data), hists);
+	resp->r_length = strlen(resp->r_data);
+	resp->r_status = STATUS_OK;
+}
@@ -25,6 +25,7 @@
 
 #include <pthread.h>
 #include <assert.h>
+#include <dirent.h>
 #include "multilock.h"
 #include "../../include/gsh_list.h"
 
@@ -843,6 +844,143 @@ void do_close(struct response *resp)
 	resp->r_status = STATUS_OK;
 }
 
+/* LOAD runs in a directory of its own, named after the client */
+char load_dir[MAXSTR + 16];
+int *load_fds;
+char load_buf[LOAD_IO_SIZE];
+
+static void load_path(char *path, int file)
+{
+	snprintf(path, PATH_MAX, "%s/f%d", load_dir, file);
+}
+
+static void load_teardown(int files)
+{
+	char path[PATH_MAX];
+	int file;
+
+	for (file = 0; file < files; file++) {
+		if (load_fds[file] > 0)
+			close(load_fds[file]);
+
+		load_path(path, file);
+		unlink(path);
+	}
+
+	rmdir(load_dir);
+	free(load_fds);
+	load_fds = NULL;
+}
+
+static int load_setup(int files)
+{
+	char path[PATH_MAX];
+	int file, fd;
+	long long int offset;
+
+	if (name[0] != '\0')
+		array_sprintf(load_dir, "ml_load.%s", name);
+	else
+		array_sprintf(load_dir, "ml_load.%d", (int) getpid());
+
+	if (mkdir(load_dir, 0755) == -1 && errno != EEXIST)
+		return errno;
+
+	load_fds = calloc(files, sizeof(*load_fds));
+
+	if (load_fds == NULL)
+		return ENOMEM;
+
+	memset(load_buf, 'L', sizeof(load_buf));
+
+	for (file = 0; file < files; file++) {
+		load_path(path, file);
+
+		fd = open(path, O_RDWR | O_CREAT, 0644);
+
+		if (fd == -1)
+			goto fail;
+
+		load_fds[file] = fd;
+
+		for (offset = 0; offset < LOAD_FILE_SIZE;
+		     offset += LOAD_IO_SIZE) {
+			if (pwrite(fd, load_buf, LOAD_IO_SIZE, offset) == -1)
+				goto fail;
+		}
+	}
+
+	return 0;
+
+ fail:
+	fd = errno;
+	load_teardown(files);
+	return fd;
+}
+
+static int load_op(enum load_op op, int file, long long int offset)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	struct flock lock;
+	DIR *dir;
+	int fd;
+
+	switch (op) {
+	case LOAD_OPEN:
+		load_path(path, file);
+		fd = open(path, O_RDWR);
+		if (fd == -1)
+			return errno;
+		return close(fd) == -1 ? errno : 0;
+
+	case LOAD_STAT:
+		load_path(path, file);
+		return stat(path, &st) == -1 ? errno : 0;
+
+	case LOAD_READDIR:
+		dir = opendir(load_dir);
+		if (dir == NULL)
+			return errno;
+		while (readdir(dir) != NULL)
+			;
+		return closedir(dir) == -1 ? errno : 0;
+
+	case LOAD_READ:
+		return pread(load_fds[file], load_buf, LOAD_IO_SIZE,
+			     offset) == -1 ? errno : 0;
+
+	case LOAD_WRITE:
+		return pwrite(load_fds[file], load_buf, LOAD_IO_SIZE,
+			      offset) == -1 ? errno : 0;
+
+	case LOAD_LOCK:
+		/* Losing the race with another client is not an error */
+		lock.l_whence = SEEK_SET;
+		lock.l_type = F_WRLCK;
+		lock.l_start = offset;
+		lock.l_len = LOAD_IO_SIZE;
+		lock.l_pid = 0;
+
+		if (fcntl(load_fds[file], F_SETLK, &lock) == -1)
+			return errno == EAGAIN || errno == EACCES ? 0 : errno;
+
+		lock.l_type = F_UNLCK;
+		return fcntl(load_fds[file], F_SETLK, &lock) == -1 ? errno : 0;
+
+	case NUM_LOAD_OPS:
+		break;
+	}
+
+	return EINVAL;
+}
+
+struct load_ops posix_load_ops = {
+	.lo_setup = load_setup,
+	.lo_op = load_op,
+	.lo_teardown = load_teardown,
+};
+
 struct test_list {
 	struct test_list *tl_next;
 	long long int tl_start;
@@ -1304,6 +1442,9 @@ int main(int argc, char **argv)
 				case CMD_FORK:
 					complete = do_fork(&resp, oflags == 7);
 					break;
+				case CMD_LOAD:
+					do_load(&resp, &posix_load_ops);
+					break;
 
 				case CMD_HELLO:
 				case CMD_COMMENT:
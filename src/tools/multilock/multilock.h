@@ -102,6 +102,7 @@ enum commands {
 	CMD_ALARM,
 	CMD_HELLO,
 	CMD_FORK,
+	CMD_LOAD,
 	CMD_QUIT,
 	NUM_COMMANDS
 };
@@ -260,6 +261,53 @@ void add_response(struct response *resp, struct response **list);
 struct response *check_expected_responses(struct response *expected_responses,
 					  struct response *client_resp);
 
+/* Load generation
+ *
+ * A LOAD command runs a weighted mix of operations against files a client
+ * creates for the purpose, spread evenly over the run to hit the given rate.
+ * The mix is a list of op=weight pairs, for example
+ * "open=5,stat=30,readdir=5,read=30,write=20,lock=10".  Latencies are kept
+ * in power of two buckets of microseconds, bucket 0 being everything under
+ * 2us and the last bucket everything past its lower bound.
+ */
+enum load_op {
+	LOAD_OPEN,
+	LOAD_STAT,
+	LOAD_READDIR,
+	LOAD_READ,
+	LOAD_WRITE,
+	LOAD_LOCK,
+	NUM_LOAD_OPS
+};
+
+#define LOAD_BUCKETS 24
+#define LOAD_IO_SIZE 4096
+#define LOAD_FILE_SIZE (16 * LOAD_IO_SIZE)
+
+struct load_hist {
+	long long int lh_count;
+	long long int lh_errors;
+	long long int lh_total_us;
+	long long int lh_bucket[LOAD_BUCKETS];
+};
+
+/* Implemented by each client, return 0 or an errno value */
+struct load_ops {
+	int (*lo_setup)(int files);
+	int (*lo_op)(enum load_op op, int file, long long int offset);
+	void (*lo_teardown)(int files);
+};
+
+extern struct token load_op_names[];
+
+bool get_load_mix(const char *mix, int *weights);
+void load_hist_add(struct load_hist *hist, long long int usecs, bool error);
+long long int load_hist_percentile(struct load_hist *hist, double pct);
+void sprintf_load_hists(char *line, int size, struct load_hist *hists);
+bool add_load_hists(const char *line, struct load_hist *hists);
+char *parse_load(char *line, struct response *req);
+void do_load(struct response *resp, struct load_ops *ops);
+
 struct response {
 	struct response *r_next;
 	struct response *r_prev;
@@ -277,6 +325,8 @@ struct response {
 	int r_flags;
 	int r_mode;
 	long int r_errno;
+	long int r_rate;
+	long int r_files;
 	/**
 	 * @brief complex data for a request/response
 	 *
@@ -286,6 +336,7 @@ struct response {
 	 * COMMENT - the string
 	 * HELLO   - name of the client
 	 * FORK    - name of the client
+	 * LOAD    - op mix (request), latency histograms (response)
 	 */
 	char r_data[MAXDATA];
 	char r_original[MAXXFER];
@@ -309,6 +360,7 @@ extern struct command_def commands[NUM_COMMANDS + 1];
  * tag WRITE   fpos "string"
  * tag COMMENT "string"
  * tag ALARM   seconds
+ * tag LOAD    seconds rate files "mix" - rate is ops/sec, 0 for unthrottled
  * tag HELLO   "name" (command ignored, really just a response to server)
  * tag QUIT    (tag is optional, if not present, tag = -1)
  */
@@ -336,6 +388,7 @@ extern struct command_def commands[NUM_COMMANDS + 1];
  * tag ALARM   OK seconds
  * tag ALARM   CANCELED remain
  * tag ALARM   COMPLETED
+ * tag LOAD    OK seconds "histograms"
  * 0   HELLO   OK "name"
  * tag QUIT    OK
  */
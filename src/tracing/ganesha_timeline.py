@@ -0,0 +1,206 @@
+#!/usr/bin/python
+#
+# Rebuild per-request timelines from an LTTng trace of ganesha.nfsd.
+#
+# ./ganesha_timeline.py [--min-us N] [--summary] <trace directory>
+#
+# A request runs on one worker thread from nfs_rpc:start to nfs_rpc:end,
+# so every event that thread emits in between belongs to it.  Asynchronous
+# FSAL I/O completes on a backend thread and is matched to its start by the
+# address of the I/O.  The trace must carry the vtid context:
+#
+#	lttng add-context -u -t vtid
+#
+# Needs the babeltrace python bindings (python-babeltrace or
+# python3-babeltrace).
+#
+
+import sys
+import getopt
+import babeltrace
+
+# Events that open a span, and the event that closes it
+SPANS = {
+    'nfs_rpc:op_start': 'nfs_rpc:op_end',
+    'nfs_rpc:v4op_start': 'nfs_rpc:v4op_end',
+    'nfs_rpc:drc_start': 'nfs_rpc:drc_start_end',
+    'nfs_rpc:drc_finish': 'nfs_rpc:drc_finish_end',
+    'fsal:io_start': 'fsal:io_end',
+    'fsal:lookup_start': 'fsal:lookup_end',
+    'state:lock_start': 'state:lock_end',
+    'state:unlock_start': 'state:unlock_end',
+}
+CLOSERS = dict((v, k) for k, v in SPANS.items())
+
+# Fields worth showing for an event, in order
+LABELS = ('op_name', 'fsal', 'name', 'xid', 'write', 'offset', 'length',
+          'result', 'error', 'status', 'major', 'minor', 'type', 'start',
+          'decode', 'queue', 'execute', 'reply')
+
+
+def usage():
+    message = "%s [--min-us N] [--summary] <trace directory>\n" % (
+        sys.argv[0])
+    message += "  --min-us N  only show requests taking at least N usecs\n"
+    message += "  --summary   show time per span instead of timelines\n"
+    sys.exit(message)
+
+
+def describe(event):
+    parts = []
+    for label in LABELS:
+        try:
+            value = event[label]
+        except KeyError:
+            continue
+        parts.append("%s=%s" % (label, value))
+    return " ".join(parts)
+
+
+class Request(object):
+    def __init__(self, req, tid, start):
+        self.req = req
+        self.tid = tid
+        self.start = start
+        self.end = None
+        # (offset, depth, name, detail, duration or None)
+        self.lines = []
+        self.open = []
+        self.spans = {}
+        self.inflight = 0
+
+    def add(self, event, name):
+        offset = event.timestamp - self.start
+        if name in CLOSERS:
+            opener = CLOSERS[name]
+            for i in range(len(self.open) - 1, -1, -1):
+                if self.open[i][0] == opener:
+                    self.close(i, event)
+                    return
+        index = len(self.lines)
+        self.lines.append([offset, len(self.open), name, describe(event),
+                           None])
+        if name in SPANS:
+            self.open.append((name, index, event.timestamp))
+
+    def close(self, i, event):
+        name, index, begin = self.open.pop(i)
+        duration = event.timestamp - begin
+        line = self.lines[index]
+        line[4] = duration
+        detail = describe(event)
+        if detail:
+            line[3] = (line[3] + " -> " + detail).strip()
+        self.spans[name] = self.spans.get(name, 0) + duration
+
+    def async_start(self, event, name):
+        self.inflight += 1
+        index = len(self.lines)
+        self.lines.append([event.timestamp - self.start, len(self.open),
+                           name, describe(event), None])
+        return (self, index, event.timestamp)
+
+    def async_end(self, index, begin, event):
+        self.inflight -= 1
+        line = self.lines[index]
+        line[4] = event.timestamp - begin
+        line[3] = (line[3] + " -> " + describe(event)).strip()
+        self.spans[line[2]] = self.spans.get(line[2], 0) + line[4]
+
+    def show(self):
+        print("req %#x tid %d %.3f us" % (self.req, self.tid,
+                                          (self.end - self.start) / 1000.0))
+        for offset, depth, name, detail, duration in self.lines:
+            took = ("%10.3f" % (duration / 1000.0)
+                    if duration is not None else " " * 10)
+            print("  +%10.3f %s %s%s %s" % (offset / 1000.0, took,
+                                            "  " * depth, name, detail))
+        print("")
+
+
+def main():
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "", ["min-us=",
+                                                      "summary", "help"])
+    except getopt.GetoptError:
+        usage()
+    min_ns = 0
+    summary = False
+    for opt, arg in opts:
+        if opt == "--min-us":
+            min_ns = int(float(arg) * 1000)
+        elif opt == "--summary":
+            summary = True
+        else:
+            usage()
+    if len(args) != 1:
+        usage()
+
+    traces = babeltrace.TraceCollection()
+    if traces.add_traces_recursive(args[0], "ctf") is None:
+        sys.exit("No trace found in %s" % args[0])
+
+    running = {}	# vtid -> Request
+    pending = {}	# async I/O address -> (Request, line, start)
+    totals = {}		# span -> [count, nsecs]
+    requests = [0]
+
+    def finish(request):
+        # A request is shown once it has ended and its I/O completed
+        requests[0] += 1
+        if request.end - request.start < min_ns:
+            return
+        if summary:
+            for span, nsecs in request.spans.items():
+                total = totals.setdefault(span, [0, 0])
+                total[0] += 1
+                total[1] += nsecs
+        else:
+            request.show()
+
+    for event in traces.events:
+        name = event.name
+        try:
+            tid = event["vtid"]
+        except KeyError:
+            sys.exit("Trace has no vtid; use 'lttng add-context -u -t vtid'")
+
+        if name == "nfs_rpc:start":
+            running[tid] = Request(event["req"], tid, event.timestamp)
+            continue
+
+        if name == "fsal:async_io_end":
+            started = pending.pop(event["io"], None)
+            if started is not None:
+                request, index, begin = started
+                request.async_end(index, begin, event)
+                if request.end is not None and request.inflight == 0:
+                    finish(request)
+            continue
+
+        request = running.get(tid)
+        if request is None:
+            continue
+
+        if name == "nfs_rpc:end":
+            del running[tid]
+            request.end = event.timestamp
+            if request.inflight == 0:
+                finish(request)
+        elif name == "fsal:async_io_start":
+            pending[event["io"]] = request.async_start(event, name)
+        else:
+            request.add(event, name)
+
+    if summary:
+        print("%d requests" % requests[0])
+        print("%-24s %10s %14s %12s" % ("span", "requests", "total us",
+                                        "mean us"))
+        for span in sorted(totals, key=lambda s: -totals[s][1]):
+            count, nsecs = totals[span]
+            print("%-24s %10d %14.3f %12.3f" % (span, count, nsecs / 1000.0,
+                                                nsecs / 1000.0 / count))
+
+
+if __name__ == "__main__":
+    main()